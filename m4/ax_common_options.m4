@@ -26,6 +26,7 @@ AX_ARG_ENABLE(exceptions,   yes, [am-yes cpp-bool], [enable the C++ exception me
 AX_ARG_ENABLE(debug,         no, [none],            [generate debugging symbols])
 AX_ARG_ENABLE(optimize,       3, [none],            [compiler optimization level])
 AX_ARG_ENABLE(profile,       no, [none],            [generate profiling data])
+AX_ARG_ENABLE(native-arch,   no, [none],            [tune for the instruction set (SSE/AVX/NEON) of the build machine])
 AX_ARG_ENABLE(arch-libs,     no, [none],            [force /lib64 (=64) or /lib32 (=32) instead of /lib])
 AX_ARG_ENABLE(ccache,        no, [none],            [try to use ccache, if available])
 AX_ARG_ENABLE(multi-arch,    [], [none],            [build multi-arch (universal) binaries])
@@ -112,6 +113,14 @@ case "$ENABLE_OPTIMIZE" in
     *)       AC_MSG_ERROR([Unknown optimize option: "$ENABLE_OPTIMIZE"]) ;;
 esac
 
+# Let the compiler use the vector units of the build machine. The
+# binaries will then not run on older CPUs.
+if test x"$ENABLE_NATIVE_ARCH" = "xyes"; then
+    AX_TRY_CPPFLAGS([-march=native], [AX_CFLAGS="$AX_CFLAGS -march=native"],
+                    [AX_TRY_CPPFLAGS([-mcpu=native], [AX_CFLAGS="$AX_CFLAGS -mcpu=native"],
+                                     [AC_MSG_WARN([Compiler does not support -march=native or -mcpu=native])])])
+fi
+
 if test x"$ENABLE_PROFILE" = "xyes"; then
     AX_TRY_CPPFLAGS([-pg], [AX_CFLAGS="$AX_CFLAGS -pg"], [AC_MSG_ERROR([Cannot enable profiling: compiler doesn't seem to support it])])
 fi
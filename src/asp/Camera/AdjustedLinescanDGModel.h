@@ -65,6 +65,16 @@ namespace asp {
     dt = (end_t - beg_t)/(num_adjustments - 1.0);
   }
 
+  // As compute_t0_dt(), when only the adjustments starting at
+  // first_index, out of num_adjustments, are given. An adjusted camera
+  // built with them is valid only near these adjustments.
+  inline void compute_window_t0_dt(double beg_t, double end_t,
+                                   int num_adjustments, int first_index,
+                                   double & y0, double & dt){
+    compute_t0_dt(beg_t, end_t, num_adjustments, y0, dt);
+    y0 += first_index*dt;
+  }
+
   // Return the closest piecewise adjustment camera indices to given time.
   std::vector<int> get_closest_adjusted_indices
   (vw::camera::LinearPiecewisePositionInterpolation const& linear_position_adjustments,
@@ -107,18 +117,41 @@ namespace asp {
     return smooth_position_adjustments.get_indices_of_largest_weights(bound_t);
   }
   
+  // The weight given to the adjustment with given index when linearly
+  // interpolating at time t. The time is bounded as when interpolating.
+  inline double get_linear_adj_weight
+  (vw::camera::LinearPiecewisePositionInterpolation const& linear_position_adjustments,
+   double t, int index){
+
+    double t0 = linear_position_adjustments.get_t0();
+    double dt = linear_position_adjustments.get_dt();
+
+    double bound_t = t;
+    bound_t = std::max(bound_t, t0);
+    bound_t = std::min(bound_t, TINY_ADJ*linear_position_adjustments.get_tend());
+
+    double ratio = (bound_t - t0)/dt;
+    int    i0    = floor(ratio);
+    double frac  = ratio - i0;
+    if (index == i0)     return 1.0 - frac;
+    if (index == i0 + 1) return frac;
+    return 0.0;
+  }
+
   class AdjustablePosition {
   public:
     AdjustablePosition(int interp_type,
                        vw::Vector2 const& adjustment_bounds,
                        std::vector<vw::Vector3> const& position_adjustments,
-                       int num_wts, double sigma):
+                       int num_wts, double sigma,
+                       int first_index = 0, int num_total = 0):
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
       double t0, dt;
-      compute_t0_dt(adjustment_bounds[0], adjustment_bounds[1],
-		    position_adjustments.size(), t0, dt);
+      compute_window_t0_dt(adjustment_bounds[0], adjustment_bounds[1],
+                           num_total > 0 ? num_total : int(position_adjustments.size()),
+                           first_index, t0, dt);
 
       // Linear interp
       if (m_interp_type == LinearInterp){
@@ -159,6 +192,14 @@ namespace asp {
 					  m_interp_type, t);
     }
 
+    PiecewiseAdjustmentInterpType interp_type() const { return m_interp_type; }
+
+    // The weight of the adjustment with given index at time t. Only
+    // for linear interpolation.
+    double get_adj_weight(double t, int index) const {
+      return get_linear_adj_weight(m_linear_position_adjustments, t, index);
+    }
+
   private:
     PiecewiseAdjustmentInterpType m_interp_type;
     vw::camera::LinearPiecewisePositionInterpolation m_linear_position_adjustments;
@@ -170,13 +211,15 @@ namespace asp {
     AdjustablePose(int interp_type,
                    vw::Vector2 const& adjustment_bounds,
                    std::vector<vw::Quat> const& pose_adjustments,
-                   int num_wts, double sigma):
+                   int num_wts, double sigma,
+                   int first_index = 0, int num_total = 0):
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
       double t0, dt;
-      compute_t0_dt(adjustment_bounds[0], adjustment_bounds[1],
-		    pose_adjustments.size(), t0, dt);
+      compute_window_t0_dt(adjustment_bounds[0], adjustment_bounds[1],
+                           num_total > 0 ? num_total : int(pose_adjustments.size()),
+                           first_index, t0, dt);
 
       if (m_interp_type == LinearInterp){
         m_linear_pose_adjustments
@@ -226,6 +269,12 @@ namespace asp {
   // A point X gets mapped by the pieceiwe adjusted camera at pixel pix as
   // m_adj_pose(pix.y()) * ( X - m_cam.camera_center(pix) ) 
   //    + m_cam.camera_center(pix) + m_adj_position(pix.y())  
+  //
+  // The given adjustments can also be a window of the num_total_adj
+  // adjustments, starting at first_adj_index. Each adjustment only
+  // affects the lines near it, so the camera is then valid near the
+  // window, and is much cheaper to create when there are many
+  // adjustments.
   class PiecewiseAdjustedLinescanModel: public vw::camera::CameraModel {
 
   public:
@@ -237,11 +286,12 @@ namespace asp {
                                    vw::Vector2               const& adjustment_bounds,
                                    std::vector<vw::Vector3>  const& position_adjustments,
                                    std::vector<vw::Quat>     const& pose_adjustments,
-                                   vw::Vector2i              const& image_size):
+                                   vw::Vector2i              const& image_size,
+                                   int first_adj_index = 0, int num_total_adj = 0):
       m_adj_position(interp_type, adjustment_bounds, position_adjustments,
-                     g_num_wts, g_sigma),
+                     g_num_wts, g_sigma, first_adj_index, num_total_adj),
       m_adj_pose(interp_type, adjustment_bounds, pose_adjustments,
-                 g_num_wts, g_sigma),
+                 g_num_wts, g_sigma, first_adj_index, num_total_adj),
       // The line below is very important. We must make sure to keep track of
       // the smart pointer to the original camera, so it does not go out of scope.
       m_cam(cam), m_image_size(image_size)
@@ -260,6 +310,17 @@ namespace asp {
     std::vector<int> get_closest_adj_indices(double line_pos){
       return m_adj_position.get_closest_adj_indices(line_pos);
     }
+
+    // True if the adjustments are interpolated linearly, so that
+    // get_adj_weight() can be used.
+    bool linear_interp() const {
+      return m_adj_position.interp_type() == LinearInterp;
+    }
+
+    // The weight of the adjustment with given index at the given line.
+    double get_adj_weight(double line_pos, int index) const {
+      return m_adj_position.get_adj_weight(line_pos, index);
+    }
     
     vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
       return m_adj_pose(pix.y()).rotate(m_cam->pixel_to_vector(pix));
@@ -321,15 +382,17 @@ namespace asp {
                        int interp_type,
                        vw::Vector2 const& adjustment_bounds,
                        std::vector<vw::Vector3> const& position_adjustments,
-                       int num_wts, double sigma):
+                       int num_wts, double sigma,
+                       int first_index = 0, int num_total = 0):
       m_cam_ptr(cam_ptr),
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
       double t0, dt;
-      compute_t0_dt(cam_ptr->get_time_at_line(adjustment_bounds[0]),
-		    cam_ptr->get_time_at_line(adjustment_bounds[1]),
-		    position_adjustments.size(), t0, dt);
+      compute_window_t0_dt(cam_ptr->get_time_at_line(adjustment_bounds[0]),
+                           cam_ptr->get_time_at_line(adjustment_bounds[1]),
+                           num_total > 0 ? num_total : int(position_adjustments.size()),
+                           first_index, t0, dt);
       
       // Linear interp
       if (m_interp_type == LinearInterp){
@@ -369,6 +432,14 @@ namespace asp {
 					  m_smooth_position_adjustments,
 					  m_interp_type, t);
     }
+
+    PiecewiseAdjustmentInterpType interp_type() const { return m_interp_type; }
+
+    // The weight of the adjustment with given index at time t. Only
+    // for linear interpolation.
+    double get_adj_weight(double t, int index) const {
+      return get_linear_adj_weight(m_linear_position_adjustments, t, index);
+    }
     
   private:
     DGCameraModel const* m_cam_ptr;
@@ -383,15 +454,17 @@ namespace asp {
                    int interp_type,
                    vw::Vector2 const& adjustment_bounds,
                    std::vector<vw::Quat> const& pose_adjustments,
-                   int num_wts, double sigma):
+                   int num_wts, double sigma,
+                   int first_index = 0, int num_total = 0):
       m_cam_ptr(cam_ptr),
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
       double t0, dt;
-      compute_t0_dt(cam_ptr->get_time_at_line(adjustment_bounds[0]),
-		    cam_ptr->get_time_at_line(adjustment_bounds[1]),
-		    pose_adjustments.size(), t0, dt);
+      compute_window_t0_dt(cam_ptr->get_time_at_line(adjustment_bounds[0]),
+                           cam_ptr->get_time_at_line(adjustment_bounds[1]),
+                           num_total > 0 ? num_total : int(pose_adjustments.size()),
+                           first_index, t0, dt);
       
       if (m_interp_type == LinearInterp){
         m_linear_pose_adjustments
@@ -451,14 +524,17 @@ namespace asp {
                             vw::Vector2 const& adjustment_bounds,
                             std::vector<vw::Vector3> const& position_adjustments,
                             std::vector<vw::Quat>    const& pose_adjustments,
-			    vw::Vector2i              const& image_size):
+			    vw::Vector2i              const& image_size,
+                            int first_adj_index = 0, int num_total_adj = 0):
       // Initialize the base
       LinescanDGModel<AdjustableDGPosition, AdjustableDGPose>
     (AdjustableDGPosition(get_dg_ptr(cam), interp_type, adjustment_bounds,
-			  position_adjustments, g_num_wts, g_sigma),
+			  position_adjustments, g_num_wts, g_sigma,
+                          first_adj_index, num_total_adj),
      get_dg_ptr(cam)->get_velocity_func(),
      AdjustableDGPose(get_dg_ptr(cam), interp_type, adjustment_bounds,
-		      pose_adjustments, g_num_wts, g_sigma),
+		      pose_adjustments, g_num_wts, g_sigma,
+                      first_adj_index, num_total_adj),
      get_dg_ptr(cam)->get_time_func(),
      get_dg_ptr(cam)->get_image_size(),
      get_dg_ptr(cam)->get_detector_origin(),
@@ -485,6 +561,17 @@ namespace asp {
       return m_position_func.get_closest_adj_indices(t);
     }
 
+    // True if the adjustments are interpolated linearly, so that
+    // get_adj_weight() can be used.
+    bool linear_interp() const {
+      return m_position_func.interp_type() == LinearInterp;
+    }
+
+    // The weight of the adjustment with given index at the given line.
+    double get_adj_weight(double line_pos, int index) const {
+      return m_position_func.get_adj_weight(m_time_func(line_pos), index);
+    }
+
   private:
     boost::shared_ptr<vw::camera::CameraModel> m_cam;
     vw::Vector2i m_image_size;
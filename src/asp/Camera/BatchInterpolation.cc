@@ -0,0 +1,116 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BatchInterpolation.cc
+///
+
+#include <asp/Camera/BatchInterpolation.h>
+#include <cmath>
+
+namespace asp {
+
+void interpolate_at_times(vw::camera::SLERPPoseInterpolation const& func,
+                          std::vector<double> const& times,
+                          std::vector<vw::Quat> & poses) {
+
+  int num = times.size();
+  poses.resize(num);
+  if (num == 0)
+    return;
+
+  double t0 = func.get_t0(), dt = func.get_dt(), tend = func.get_tend();
+  int num_intervals = (dt > 0) ? int(round((tend - t0)/dt)) : 0;
+  if (num_intervals < 1) {
+    for (int k = 0; k < num; k++)
+      poses[k] = func(times[k]);
+    return;
+  }
+
+  // The samples and the angles between them, fetched as needed
+  std::vector<vw::Quat> nodes(num_intervals + 1);
+  std::vector<char>     have_node(num_intervals + 1, 0);
+  std::vector<double>   interval_theta(num_intervals), interval_inv_sin(num_intervals);
+  std::vector<char>     interval_flip(num_intervals), have_interval(num_intervals, 0);
+
+  // Below this, sin(theta) is too small to divide by, and the
+  // interpolation is linear. As in vw::math::slerp().
+  const double SLERP_EPSILON = 1.0e-6;
+
+  // Find the interval of each time and the position in it
+  std::vector<int>    index(num);
+  std::vector<double> alpha(num), theta(num), inv_sin(num);
+  for (int k = 0; k < num; k++) {
+    double s = (times[k] - t0)/dt;
+    if (!(s >= 0 && s <= num_intervals)) {
+      index[k] = -1;
+      alpha[k] = theta[k] = inv_sin[k] = 0;
+      continue;
+    }
+    int i = std::min(int(s), num_intervals - 1);
+    index[k] = i;
+    alpha[k] = s - i;
+
+    if (!have_interval[i]) {
+      for (int j = i; j <= i + 1; j++) {
+        if (!have_node[j]) {
+          nodes[j]     = func(t0 + j*dt);
+          have_node[j] = 1;
+        }
+      }
+      vw::Quat const& a = nodes[i];
+      vw::Quat const& b = nodes[i+1];
+      double cos_t = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+      interval_flip[i] = (cos_t < 0);
+      cos_t = std::abs(cos_t);
+      if (1.0 - cos_t < SLERP_EPSILON) {
+        interval_theta[i]   = 0; // linear interpolation
+        interval_inv_sin[i] = 0;
+      } else {
+        interval_theta[i]   = acos(cos_t);
+        interval_inv_sin[i] = 1.0/sin(interval_theta[i]);
+      }
+      have_interval[i] = 1;
+    }
+    theta[k]   = interval_theta[i];
+    inv_sin[k] = interval_inv_sin[i];
+  }
+
+  // The weights of the two ends of the interval
+  std::vector<double> wa(num), wb(num);
+  for (int k = 0; k < num; k++) {
+    double lin = (inv_sin[k] == 0) ? 1.0 : 0.0;
+    wa[k] = lin*(1.0 - alpha[k]) + (1.0 - lin)*sin((1.0 - alpha[k])*theta[k])*inv_sin[k];
+    wb[k] = lin*alpha[k]         + (1.0 - lin)*sin(alpha[k]*theta[k])*inv_sin[k];
+  }
+
+  // Blend
+  for (int k = 0; k < num; k++) {
+    int i = index[k];
+    if (i < 0) {
+      poses[k] = func(times[k]);
+      continue;
+    }
+    double sb = interval_flip[i] ? -wb[k] : wb[k];
+    vw::Quat const& a = nodes[i];
+    vw::Quat const& b = nodes[i+1];
+    poses[k] = vw::Quat(wa[k]*a[0] + sb*b[0], wa[k]*a[1] + sb*b[1],
+                        wa[k]*a[2] + sb*b[2], wa[k]*a[3] + sb*b[3]);
+  }
+}
+
+} // namespace asp
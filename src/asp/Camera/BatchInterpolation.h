@@ -0,0 +1,55 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BatchInterpolation.h
+///
+/// Evaluate the position, velocity, pose and time functors of the
+/// linescan cameras at many times at once, as for all the lines of a
+/// tile.
+
+#ifndef __ASP_CAMERA_BATCH_INTERPOLATION_H__
+#define __ASP_CAMERA_BATCH_INTERPOLATION_H__
+
+#include <vw/Camera/Extrinsics.h>
+#include <vector>
+
+namespace asp {
+
+  /// Evaluate a functor at each of the given times. This is the
+  /// fallback for functors which have no specialized version below.
+  template <class FuncT, class ValueT>
+  void interpolate_at_times(FuncT const& func, std::vector<double> const& times,
+                            std::vector<ValueT> & values) {
+    values.resize(times.size());
+    for (size_t k = 0; k < times.size(); k++)
+      values[k] = func(times[k]);
+  }
+
+  /// SLERP at many times. The quaternions at the ends of each sample
+  /// interval and the angle between them are found once per interval
+  /// rather than once per time, and the weights and the blending are
+  /// computed in separate branch-free loops over all the times, which
+  /// the compiler can vectorize. Times need not be sorted. Those outside
+  /// the range of the samples are passed to the functor itself.
+  void interpolate_at_times(vw::camera::SLERPPoseInterpolation const& func,
+                            std::vector<double> const& times,
+                            std::vector<vw::Quat> & poses);
+
+} // namespace asp
+
+#endif // __ASP_CAMERA_BATCH_INTERPOLATION_H__
@@ -0,0 +1,261 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraBenchmark.h
+///
+/// A small harness to time pixel_to_vector() and point_to_pixel() of
+/// any camera model and to measure the round-trip pixel error. It is
+/// shared by the camera benchmark programs in Camera/tests and
+/// IsisIO/tests, which write the results as CSV so that runs before
+/// and after an upgrade can be compared, or as JSON for tracking
+/// across releases together with the output of Core/tests/BenchCoreKernels.
+///
+/// Each query pixel is cast to the datum, which gives a ground point,
+/// and the ground point is projected back into the camera. The first
+/// step times pixel_to_vector() together with camera_center(), the
+/// second one times point_to_pixel().
+
+#ifndef __ASP_CAMERA_CAMERA_BENCHMARK_H__
+#define __ASP_CAMERA_CAMERA_BENCHMARK_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+namespace asp {
+
+  /// The outcome of benchmarking one camera on one query pattern
+  /// with a given number of threads. Rates are in calls per second.
+  struct CameraBenchmarkResult {
+    std::string camera, pattern;
+    int    num_threads, num_points, num_failed;
+    double pixel_to_vector_rate, point_to_pixel_rate;
+    double mean_error, max_error; // round-trip error, in pixels
+    CameraBenchmarkResult(): num_threads(0), num_points(0), num_failed(0),
+                             pixel_to_vector_rate(0), point_to_pixel_rate(0),
+                             mean_error(0), max_error(0){}
+  };
+
+  /// Query pixels on a regular grid covering the box, about num_points
+  /// of them, traversed row by row as stereo and mapproject do.
+  inline std::vector<vw::Vector2> structured_benchmark_pixels(vw::BBox2 const& box,
+                                                              int num_points){
+    int n = std::max(2, int(std::ceil(std::sqrt(double(num_points)))));
+    std::vector<vw::Vector2> pixels;
+    for (int row = 0; row < n; row++){
+      for (int col = 0; col < n; col++){
+        pixels.push_back(box.min() + vw::elem_prod(vw::Vector2(col, row)/(n - 1.0),
+                                                   box.size()));
+      }
+    }
+    return pixels;
+  }
+
+  /// Query pixels scattered uniformly in the box, as with interest
+  /// points. A fixed linear congruential generator is used, so the
+  /// pixels are the same from run to run and from machine to machine.
+  inline std::vector<vw::Vector2> random_benchmark_pixels(vw::BBox2 const& box,
+                                                          int num_points){
+    std::vector<vw::Vector2> pixels;
+    unsigned long long state = 1234567;
+    for (int k = 0; k < num_points; k++){
+      vw::Vector2 frac;
+      for (int c = 0; c < 2; c++){
+        state = state*6364136223846793005ULL + 1442695040888963407ULL;
+        frac[c] = double(state >> 11)/double(1ULL << 53);
+      }
+      pixels.push_back(box.min() + vw::elem_prod(frac, box.size()));
+    }
+    return pixels;
+  }
+
+  /// Run pixel_to_vector() or point_to_pixel() on a range of the
+  /// inputs. A ground point of zero marks a failure.
+  class CameraBenchmarkTask: public vw::Task, private boost::noncopyable {
+    vw::camera::CameraModel const& m_cam;
+    vw::cartography::Datum  const& m_datum;
+    bool m_cast_rays;
+    std::vector<vw::Vector2> const& m_pixels;
+    std::vector<vw::Vector3>      & m_points;
+    std::vector<vw::Vector2>      & m_reprojected;
+    int m_beg, m_end;
+  public:
+    CameraBenchmarkTask(vw::camera::CameraModel const& cam,
+                        vw::cartography::Datum const& datum, bool cast_rays,
+                        std::vector<vw::Vector2> const& pixels,
+                        std::vector<vw::Vector3> & points,
+                        std::vector<vw::Vector2> & reprojected, int beg, int end):
+      m_cam(cam), m_datum(datum), m_cast_rays(cast_rays), m_pixels(pixels),
+      m_points(points), m_reprojected(reprojected), m_beg(beg), m_end(end){}
+
+    void operator()(){
+      for (int k = m_beg; k < m_end; k++){
+        if (m_cast_rays){
+          m_points[k] = vw::Vector3();
+          try {
+            vw::Vector3 ctr = m_cam.camera_center(m_pixels[k]);
+            vw::Vector3 dir = m_cam.pixel_to_vector(m_pixels[k]);
+            m_points[k] = vw::cartography::datum_intersection(m_datum, ctr, dir);
+          } catch(...){}
+        }else{
+          if (m_points[k] == vw::Vector3())
+            continue;
+          try {
+            m_reprojected[k] = m_cam.point_to_pixel(m_points[k]);
+          } catch(...){
+            m_points[k] = vw::Vector3();
+          }
+        }
+      }
+    }
+  };
+
+  /// Run one of the two benchmark passes with the given number of threads.
+  /// Returns the elapsed wall-clock time in seconds.
+  inline double camera_benchmark_pass(vw::camera::CameraModel const& cam,
+                                      vw::cartography::Datum const& datum, bool cast_rays,
+                                      std::vector<vw::Vector2> const& pixels,
+                                      std::vector<vw::Vector3> & points,
+                                      std::vector<vw::Vector2> & reprojected,
+                                      int num_threads){
+    int num = pixels.size();
+    vw::Stopwatch sw;
+    sw.start();
+    if (num_threads <= 1){
+      CameraBenchmarkTask task(cam, datum, cast_rays, pixels, points, reprojected, 0, num);
+      task();
+    }else{
+      // A few chunks per thread, so that they finish at about the same time
+      int num_chunks = 4*num_threads;
+      vw::FifoWorkQueue queue(num_threads);
+      for (int chunk = 0; chunk < num_chunks; chunk++){
+        int beg = (long long)num*chunk/num_chunks;
+        int end = (long long)num*(chunk + 1)/num_chunks;
+        if (beg >= end)
+          continue;
+        boost::shared_ptr<CameraBenchmarkTask>
+          task(new CameraBenchmarkTask(cam, datum, cast_rays, pixels, points,
+                                       reprojected, beg, end));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+    sw.stop();
+    return sw.elapsed_seconds();
+  }
+
+  /// Time the camera on the given query pixels. The camera must be
+  /// safe to use from several threads at once if num_threads > 1.
+  inline CameraBenchmarkResult benchmark_camera(std::string const& camera_name,
+                                                std::string const& pattern,
+                                                vw::camera::CameraModel const& cam,
+                                                vw::cartography::Datum const& datum,
+                                                std::vector<vw::Vector2> const& pixels,
+                                                int num_threads){
+    CameraBenchmarkResult result;
+    result.camera      = camera_name;
+    result.pattern     = pattern;
+    result.num_threads = std::max(num_threads, 1);
+    result.num_points  = pixels.size();
+    if (pixels.empty())
+      return result;
+
+    std::vector<vw::Vector3> points(pixels.size());
+    std::vector<vw::Vector2> reprojected(pixels.size());
+
+    double ray_time = camera_benchmark_pass(cam, datum, true, pixels, points,
+                                            reprojected, num_threads);
+    double proj_time = camera_benchmark_pass(cam, datum, false, pixels, points,
+                                             reprojected, num_threads);
+
+    int num_good = 0;
+    double sum_error = 0;
+    for (size_t k = 0; k < pixels.size(); k++){
+      if (points[k] == vw::Vector3()){
+        result.num_failed++;
+        continue;
+      }
+      double err = vw::math::norm_2(reprojected[k] - pixels[k]);
+      sum_error += err;
+      result.max_error = std::max(result.max_error, err);
+      num_good++;
+    }
+    if (num_good > 0)
+      result.mean_error = sum_error/num_good;
+
+    // Guard against a timer resolution coarser than the pass
+    double min_time = 1e-9;
+    result.pixel_to_vector_rate = pixels.size()/std::max(ray_time, min_time);
+    result.point_to_pixel_rate  = num_good/std::max(proj_time, min_time);
+
+    return result;
+  }
+
+  /// The CSV header matching write_camera_benchmark_result().
+  inline void write_camera_benchmark_header(std::ostream & os){
+    os << "camera,pattern,threads,points,failed,pixel_to_vector_per_sec,"
+       << "point_to_pixel_per_sec,mean_error_pixels,max_error_pixels\n";
+  }
+
+  inline void write_camera_benchmark_result(std::ostream & os,
+                                            CameraBenchmarkResult const& r){
+    os << r.camera << "," << r.pattern << "," << r.num_threads << ","
+       << r.num_points << "," << r.num_failed << ","
+       << r.pixel_to_vector_rate << "," << r.point_to_pixel_rate << ","
+       << r.mean_error << "," << r.max_error << "\n";
+  }
+
+  /// Write the results as a JSON object, one result per line, with a
+  /// fixed key order, in the layout of asp::write_benchmark_json().
+  inline void write_camera_benchmark_json(std::ostream & os, std::string const& suite,
+                                          std::vector<CameraBenchmarkResult> const& results){
+    os << "{\"suite\": \"" << suite << "\", \"results\": [\n";
+    for (size_t k = 0; k < results.size(); k++){
+      CameraBenchmarkResult const& r = results[k];
+      os << "  {\"name\": \"" << r.camera << "\", \"params\": \"" << r.pattern
+         << ", " << r.num_threads << " threads\""
+         << ", \"points\": " << r.num_points << ", \"failed\": " << r.num_failed
+         << ", \"pixel_to_vector_per_s\": " << r.pixel_to_vector_rate
+         << ", \"point_to_pixel_per_s\": "  << r.point_to_pixel_rate
+         << ", \"mean_error_pixels\": "     << r.mean_error
+         << ", \"max_error_pixels\": "      << r.max_error << "}"
+         << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "]}\n";
+  }
+
+  /// If the benchmark output file name ends in .json
+  inline bool is_json_benchmark_output(std::string const& file){
+    std::string ext = ".json";
+    return file.size() >= ext.size() &&
+      file.compare(file.size() - ext.size(), ext.size(), ext) == 0;
+  }
+
+} // namespace asp
+
+#endif // __ASP_CAMERA_CAMERA_BENCHMARK_H__
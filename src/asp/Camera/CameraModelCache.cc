@@ -0,0 +1,339 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/CameraModelCache.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+using namespace vw;
+
+namespace {
+
+  // Increment this when the layout of a cache file changes
+  const uint32 CACHE_VERSION = 1;
+  const char   CACHE_MAGIC[8] = {'A', 'S', 'P', 'C', 'A', 'M', 'C', '\0'};
+
+  // To reject files written on a machine of different byte order
+  const uint32 BYTE_ORDER_MARK = 0x01020304;
+
+  // No sane camera has more samples than this. Guards against
+  // allocating absurd amounts for a corrupt file.
+  const uint64 MAX_CACHE_ELEMENTS = 100000000;
+
+  template <class T>
+  void write_pod(std::ostream & os, T const& val) {
+    os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+
+  template <class T>
+  bool read_pod(std::istream & is, T & val) {
+    is.read(reinterpret_cast<char*>(&val), sizeof(T));
+    return bool(is);
+  }
+
+  void write_string(std::ostream & os, std::string const& str) {
+    write_pod(os, uint64(str.size()));
+    os.write(str.data(), str.size());
+  }
+
+  bool read_string(std::istream & is, std::string & str) {
+    uint64 len = 0;
+    if (!read_pod(is, len) || len > MAX_CACHE_ELEMENTS)
+      return false;
+    str.resize(len);
+    if (len > 0)
+      is.read(&str[0], len);
+    return bool(is);
+  }
+
+  template <class VecT>
+  void write_vec(std::ostream & os, VecT const& v) {
+    for (size_t i = 0; i < v.size(); i++)
+      write_pod(os, double(v[i]));
+  }
+
+  template <class VecT>
+  bool read_vec(std::istream & is, VecT & v) {
+    for (size_t i = 0; i < v.size(); i++) {
+      double val;
+      if (!read_pod(is, val))
+        return false;
+      v[i] = val;
+    }
+    return true;
+  }
+
+  void write_vec3s(std::ostream & os, std::vector<Vector3> const& vecs) {
+    write_pod(os, uint64(vecs.size()));
+    for (size_t i = 0; i < vecs.size(); i++)
+      write_vec(os, vecs[i]);
+  }
+
+  bool read_vec3s(std::istream & is, std::vector<Vector3> & vecs) {
+    uint64 len = 0;
+    if (!read_pod(is, len) || len > MAX_CACHE_ELEMENTS)
+      return false;
+    vecs.resize(len);
+    for (size_t i = 0; i < vecs.size(); i++) {
+      if (!read_vec(is, vecs[i]))
+        return false;
+    }
+    return true;
+  }
+
+  // The header has the magic string, the version, the byte order, and
+  // the kind of camera.
+  void write_header(std::ostream & os, std::string const& kind) {
+    os.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    write_pod(os, CACHE_VERSION);
+    write_pod(os, BYTE_ORDER_MARK);
+    write_string(os, kind);
+  }
+
+  bool read_header(std::istream & is, std::string const& kind) {
+    char magic[sizeof(CACHE_MAGIC)];
+    is.read(magic, sizeof(magic));
+    if (!is || !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC))
+      return false;
+    uint32 version = 0, byte_order = 0;
+    std::string file_kind;
+    return read_pod(is, version)    && version    == CACHE_VERSION   &&
+           read_pod(is, byte_order) && byte_order == BYTE_ORDER_MARK &&
+           read_string(is, file_kind) && file_kind == kind;
+  }
+
+  // The file ends with the magic string, in case it was cut short
+  bool read_footer(std::istream & is) {
+    char magic[sizeof(CACHE_MAGIC)];
+    is.read(magic, sizeof(magic));
+    return is && std::equal(magic, magic + sizeof(magic), CACHE_MAGIC) &&
+           is.peek() == std::char_traits<char>::eof();
+  }
+
+  // Write under a temporary name, then rename
+  template <class WriteFuncT>
+  void write_cache_file(std::string const& cache_file, WriteFuncT write_payload) {
+    if (cache_file == "")
+      return;
+
+    std::ostringstream tmp_name;
+    tmp_name << cache_file << ".tmp" << ::getpid();
+    try {
+      fs::path dir = fs::path(cache_file).parent_path();
+      if (!dir.empty())
+        fs::create_directories(dir);
+
+      std::ofstream ofs(tmp_name.str().c_str(), std::ios::binary);
+      if (ofs) {
+        write_payload(ofs);
+        ofs.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        ofs.close();
+      }
+      if (ofs) {
+        fs::rename(tmp_name.str(), cache_file);
+        return;
+      }
+    } catch (const std::exception& e) {
+      vw_out(WarningMessage) << e.what() << "\n";
+    }
+    vw_out(WarningMessage) << "Could not write the camera cache file: " << cache_file << "\n";
+    boost::system::error_code ec;
+    fs::remove(tmp_name.str(), ec);
+  }
+
+  struct DGPayloadWriter {
+    DGCameraData const& m_data;
+    DGPayloadWriter(DGCameraData const& data): m_data(data) {}
+    void operator()(std::ostream & os) const {
+      write_header(os, "dg");
+      write_vec3s(os, m_data.positions);
+      write_vec3s(os, m_data.velocities);
+      write_pod(os, uint64(m_data.poses.size()));
+      for (size_t i = 0; i < m_data.poses.size(); i++) {
+        Quat const& q = m_data.poses[i];
+        write_vec(os, Vector4(q.w(), q.x(), q.y(), q.z()));
+      }
+      write_pod(os, m_data.position_t0);
+      write_pod(os, m_data.position_dt);
+      write_pod(os, m_data.pose_t0);
+      write_pod(os, m_data.pose_dt);
+      write_pod(os, uint64(m_data.tlc.size()));
+      for (size_t i = 0; i < m_data.tlc.size(); i++) {
+        write_pod(os, m_data.tlc[i].first);
+        write_pod(os, m_data.tlc[i].second);
+      }
+      write_pod(os, m_data.tlc_t0);
+      write_vec(os, m_data.image_size);
+      write_vec(os, m_data.detector_origin);
+      write_pod(os, m_data.focal_length);
+    }
+  };
+
+  struct RPCPayloadWriter {
+    RPCModel const& m_model;
+    RPCPayloadWriter(RPCModel const& model): m_model(model) {}
+    void operator()(std::ostream & os) const {
+      write_header(os, "rpc");
+      cartography::Datum const& datum = m_model.datum();
+      write_string(os, datum.name());
+      write_string(os, datum.spheroid_name());
+      write_string(os, datum.meridian_name());
+      write_pod(os, datum.semi_major_axis());
+      write_pod(os, datum.semi_minor_axis());
+      write_pod(os, datum.meridian_offset());
+      write_vec(os, m_model.line_num_coeff());
+      write_vec(os, m_model.line_den_coeff());
+      write_vec(os, m_model.sample_num_coeff());
+      write_vec(os, m_model.sample_den_coeff());
+      write_vec(os, m_model.xy_offset());
+      write_vec(os, m_model.xy_scale());
+      write_vec(os, m_model.lonlatheight_offset());
+      write_vec(os, m_model.lonlatheight_scale());
+    }
+  };
+
+} // end anonymous namespace
+
+uint64 file_content_hash(std::string const& path) {
+  std::ifstream ifs(path.c_str(), std::ios::binary);
+  if (!ifs)
+    vw_throw(IOErr() << "Cannot read: " << path << "\n");
+
+  const uint64 FNV_OFFSET = 14695981039346656037ULL, FNV_PRIME = 1099511628211ULL;
+  uint64 hash = FNV_OFFSET;
+  std::vector<char> buf(1 << 16);
+  while (ifs) {
+    ifs.read(&buf[0], buf.size());
+    std::streamsize count = ifs.gcount();
+    for (std::streamsize i = 0; i < count; i++) {
+      hash ^= uint64(static_cast<unsigned char>(buf[i]));
+      hash *= FNV_PRIME;
+    }
+  }
+  return hash;
+}
+
+std::string camera_cache_file(std::string const& cache_dir, std::string const& xml_file,
+                              std::string const& kind) {
+  if (cache_dir == "")
+    return "";
+
+  uint64 hash = 0;
+  try {
+    hash = file_content_hash(xml_file);
+  } catch (...) {
+    return "";
+  }
+  std::ostringstream os;
+  os << kind << "-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return (fs::path(cache_dir) / os.str()).string();
+}
+
+bool read_dg_camera_cache(std::string const& cache_file, DGCameraData & data) {
+  if (cache_file == "")
+    return false;
+  std::ifstream is(cache_file.c_str(), std::ios::binary);
+  if (!is || !read_header(is, "dg"))
+    return false;
+
+  DGCameraData d;
+  uint64 num = 0;
+  if (!read_vec3s(is, d.positions) || !read_vec3s(is, d.velocities))
+    return false;
+  if (!read_pod(is, num) || num > MAX_CACHE_ELEMENTS)
+    return false;
+  d.poses.resize(num);
+  for (size_t i = 0; i < d.poses.size(); i++) {
+    Vector4 q;
+    if (!read_vec(is, q))
+      return false;
+    d.poses[i] = Quat(q[0], q[1], q[2], q[3]);
+  }
+  if (!read_pod(is, d.position_t0) || !read_pod(is, d.position_dt) ||
+      !read_pod(is, d.pose_t0)     || !read_pod(is, d.pose_dt))
+    return false;
+  if (!read_pod(is, num) || num > MAX_CACHE_ELEMENTS)
+    return false;
+  d.tlc.resize(num);
+  for (size_t i = 0; i < d.tlc.size(); i++) {
+    if (!read_pod(is, d.tlc[i].first) || !read_pod(is, d.tlc[i].second))
+      return false;
+  }
+  if (!read_pod(is, d.tlc_t0) || !read_vec(is, d.image_size) ||
+      !read_vec(is, d.detector_origin) || !read_pod(is, d.focal_length) ||
+      !read_footer(is))
+    return false;
+
+  if (d.positions.size() != d.velocities.size() || d.positions.size() != d.poses.size() ||
+      d.positions.empty() || d.tlc.size() < 2)
+    return false;
+
+  data = d;
+  return true;
+}
+
+bool read_rpc_camera_cache(std::string const& cache_file, boost::shared_ptr<RPCModel> & model) {
+  if (cache_file == "")
+    return false;
+  std::ifstream is(cache_file.c_str(), std::ios::binary);
+  if (!is || !read_header(is, "rpc"))
+    return false;
+
+  std::string name, spheroid_name, meridian_name;
+  double semi_major = 0, semi_minor = 0, meridian_offset = 0;
+  RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+  Vector2 xy_offset, xy_scale;
+  Vector3 llh_offset, llh_scale;
+  if (!read_string(is, name) || !read_string(is, spheroid_name) ||
+      !read_string(is, meridian_name) ||
+      !read_pod(is, semi_major) || !read_pod(is, semi_minor) || !read_pod(is, meridian_offset) ||
+      !read_vec(is, line_num) || !read_vec(is, line_den) ||
+      !read_vec(is, samp_num) || !read_vec(is, samp_den) ||
+      !read_vec(is, xy_offset)  || !read_vec(is, xy_scale) ||
+      !read_vec(is, llh_offset) || !read_vec(is, llh_scale) ||
+      !read_footer(is))
+    return false;
+
+  cartography::Datum datum(name, spheroid_name, meridian_name,
+                           semi_major, semi_minor, meridian_offset);
+  model.reset(new RPCModel(datum, line_num, line_den, samp_num, samp_den,
+                           xy_offset, xy_scale, llh_offset, llh_scale));
+  return true;
+}
+
+void write_dg_camera_cache(std::string const& cache_file, DGCameraData const& data) {
+  write_cache_file(cache_file, DGPayloadWriter(data));
+}
+
+void write_rpc_camera_cache(std::string const& cache_file, RPCModel const& model) {
+  write_cache_file(cache_file, RPCPayloadWriter(model));
+}
+
+} // namespace asp
@@ -0,0 +1,63 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraModelCache.h
+///
+/// A cache of camera models read from XML files, so that the many
+/// processes of parallel_stereo which load the same cameras do not
+/// each parse the XML. A model is stored in binary in a file in a
+/// cache directory, named after a hash of the XML file contents, so
+/// a changed XML file does not use a stale entry.
+///
+#ifndef __STEREO_CAMERA_CAMERA_MODEL_CACHE_H__
+#define __STEREO_CAMERA_CAMERA_MODEL_CACHE_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+namespace asp {
+
+  /// The 64-bit FNV-1a hash of the contents of a file.
+  vw::uint64 file_content_hash(std::string const& path);
+
+  /// The cache file in cache_dir for the camera of given kind, such
+  /// as "dg" or "rpc", in the given XML file. Return an empty string
+  /// if cache_dir is empty or the XML file cannot be read.
+  std::string camera_cache_file(std::string const& cache_dir, std::string const& xml_file,
+                                std::string const& kind);
+
+  /// Read a DG camera from the cache. Return false if the file does
+  /// not exist or is not a valid cache file of the current version.
+  bool read_dg_camera_cache(std::string const& cache_file, DGCameraData & data);
+
+  /// Read an RPC camera from the cache, as for read_dg_camera_cache().
+  bool read_rpc_camera_cache(std::string const& cache_file, boost::shared_ptr<RPCModel> & model);
+
+  /// Write a camera to the cache. The file is written under a
+  /// temporary name and renamed, as other processes may be reading or
+  /// writing it. A failure to write is a warning, not an error.
+  void write_dg_camera_cache (std::string const& cache_file, DGCameraData const& data);
+  void write_rpc_camera_cache(std::string const& cache_file, RPCModel const& model);
+
+} // namespace asp
+
+#endif // __STEREO_CAMERA_CAMERA_MODEL_CACHE_H__
@@ -19,6 +19,7 @@
 #include <asp/Camera/ASTER_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanASTERModel.h>
+#include <limits>
 namespace asp {
 
 using namespace vw;
@@ -31,7 +32,10 @@ ASTERCameraModel::ASTERCameraModel(std::vector< std::vector<vw::Vector2> > const
 				   boost::shared_ptr<vw::camera::CameraModel> rpc_model):
   m_lattice_mat(lattice_mat), m_sight_mat(sight_mat),
   m_world_sight_mat(world_sight_mat),
-  m_sat_pos(sat_pos), m_image_size(image_size), m_rpc_model(rpc_model){
+  m_sat_pos(sat_pos), m_image_size(image_size), m_rpc_model(rpc_model),
+  m_grid_row0(0), m_grid_col0(0), m_grid_drow(0), m_grid_dcol(0),
+  m_grid_rows(0), m_grid_cols(0),
+  m_last_pixel(new boost::thread_specific_ptr<vw::Vector2>){
   
   if (m_lattice_mat.empty() || m_lattice_mat[0].empty()) 
     vw::vw_throw( vw::ArgumentErr() << "Empty matrix of lattice points.\n" );
@@ -74,6 +78,8 @@ ASTERCameraModel::ASTERCameraModel(std::vector< std::vector<vw::Vector2> > const
   m_interp_sight_mat
     = vw::camera::SlerpGridPointingInterpolation(m_world_sight_mat, min_row, d_row, min_col, d_col);
 
+  build_sight_grid(min_row, d_row, min_col, d_col, num_rows, num_cols);
+
 #if 0
   // This is useful in testing how well point_to_pixel() works for given point and pixel.
   double spacing = 9.5655;
@@ -105,15 +111,101 @@ ASTERCameraModel::ASTERCameraModel(std::vector< std::vector<vw::Vector2> > const
 #endif
 }
 
-// Project the point onto the camera. Sometimes, but not always, seeding with the RPC
-// model is beneficial.  
+void ASTERCameraModel::build_sight_grid(double min_row, double d_row,
+                                        double min_col, double d_col,
+                                        int num_rows, int num_cols) {
+
+  m_sight_grid.clear();
+  if (num_rows < 2 || num_cols < 2 || d_row <= 0 || d_col <= 0)
+    return;
+
+  // About this many pixels between the nodes of the fine grid. The
+  // lattice of ASTER is spaced at a few hundred pixels, and between
+  // nodes this close linear interpolation agrees with slerp to much
+  // better than a hundredth of a pixel.
+  const double FINE_SPACING = 16.0;
+  int row_factor = std::max(1, int(ceil(d_row/FINE_SPACING)));
+  int col_factor = std::max(1, int(ceil(d_col/FINE_SPACING)));
+
+  m_grid_row0 = min_row;
+  m_grid_col0 = min_col;
+  m_grid_drow = d_row/row_factor;
+  m_grid_dcol = d_col/col_factor;
+  m_grid_rows = (num_rows - 1)*row_factor + 1;
+  m_grid_cols = (num_cols - 1)*col_factor + 1;
+
+  double max_row = min_row + (num_rows - 1)*d_row;
+  double max_col = min_col + (num_cols - 1)*d_col;
+  std::vector<vw::Vector3> grid(m_grid_rows*m_grid_cols);
+  try {
+    for (int r = 0; r < m_grid_rows; r++) {
+      for (int c = 0; c < m_grid_cols; c++) {
+        // Don't let roundoff put the last nodes past the lattice
+        Vector2 pix(std::min(m_grid_col0 + c*m_grid_dcol, max_col),
+                    std::min(m_grid_row0 + r*m_grid_drow, max_row));
+        grid[r*m_grid_cols + c] = normalize(m_interp_sight_mat(pix));
+      }
+    }
+  } catch (const vw::Exception &e) {
+    vw_out(vw::WarningMessage) << "Could not precompute the ASTER pointing vectors, "
+                               << "will interpolate them on the fly. " << e.what() << "\n";
+    return;
+  }
+  m_sight_grid.swap(grid);
+
+  // Compare with slerp at the centers of some of the fine cells
+  double max_err = 0;
+  for (int r = 0; r < m_grid_rows - 1; r += std::max(1, row_factor/2)) {
+    for (int c = 0; c < m_grid_cols - 1; c += std::max(1, col_factor/2)) {
+      Vector2 pix(m_grid_col0 + (c + 0.5)*m_grid_dcol, m_grid_row0 + (r + 0.5)*m_grid_drow);
+      Vector3 exact = normalize(m_interp_sight_mat(pix));
+      max_err = std::max(max_err, norm_2(cross_prod(exact, this->pixel_to_vector(pix))));
+    }
+  }
+  vw_out(vw::DebugMessage,"asp") << "ASTER fine pointing grid: " << m_grid_cols << " x "
+                                 << m_grid_rows << " nodes, max error vs slerp: "
+                                 << max_err << " radians.\n";
+}
+
+double ASTERCameraModel::solve_from(vw::camera::CameraGenericLMA const& model,
+                                    Vector3 const& point, Vector2 const& start,
+                                    Vector2 & solution, int & status) const {
+
+  // Solver constants
+  const double ABS_TOL = 1e-16;
+  const double REL_TOL = 1e-16;
+  const int    MAX_ITERATIONS = 1e+5;
+
+  Vector3 objective(0, 0, 0);
+  solution = vw::math::levenberg_marquardt(model, start, objective, status,
+                                           ABS_TOL, REL_TOL, MAX_ITERATIONS);
+  try {
+    Vector3 dir      = this->pixel_to_vector(solution);
+    Vector3 to_point = normalize(point - this->camera_center(solution));
+    if (dot_prod(dir, to_point) > 0)
+      return norm_2(cross_prod(dir, to_point));
+  } catch(...) {}
+
+  return std::numeric_limits<double>::max();
+}
+
+// Project the point onto the camera. The guesses are tried in order:
+// the one from the caller, the last pixel found by this thread, the
+// RPC model, and a search along the lattice, until one leads to a pixel
+// whose ray goes through the point.
 vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const& start_in) const {
 
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model( this, point );
-  int status;
   vw::Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
 
+  // A ray this close to the point is taken as the solution without
+  // trying other guesses. The ASTER VNIR pixel is about 2e-5 radians.
+  const double GOOD_ANGLE = 1e-9;
+  // If the error is higher than this, the solver probably got stuck
+  // at the edge of the image.
+  const double MAX_ERROR = 1e-2;
+
   bool has_guess = false;
   
   // If the user provided a column number guess.
@@ -128,95 +220,77 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
     has_guess = true;
   }
 
-  if (!has_guess) {
-    double min_err = norm_2(model(start));
-    // No good initial guess. The method will fail to converge.
-    // Iterate through the lattice to find a good initial guess.
-    for (int row = 0; row < int(m_lattice_mat.size())-1; row++) {
-      // TODO: Experiment more with the number below.
-      int T = 100; // This way we'll sample about every 4-th pixel since dcol = 400
-      int col = m_lattice_mat.front().size()/2;
-      for (int r = 0; r < T; r++) {
-	double wr = double(r)/(T-1.0);
-	Vector2 pt
-	  = wr*m_lattice_mat[row+1][col]
-	  + (1-wr)*m_lattice_mat[row][col];
-	double err = norm_2(model(pt));
-	if (err < min_err) {
-	  min_err = err;
-	  start = pt;
-	}
+  std::vector<Vector2> guesses;
+  if (has_guess)
+    guesses.push_back(start);
+  if (m_last_pixel->get() != NULL)
+    guesses.push_back(*m_last_pixel->get());
+
+  Vector2 best_solution;
+  double  best_angle  = std::numeric_limits<double>::max();
+  int     best_status = -1;
+  for (size_t attempt = 0; attempt < guesses.size() + 2; attempt++) {
+
+    Vector2 guess;
+    if (attempt < guesses.size()) {
+      guess = guesses[attempt];
+    } else if (attempt == guesses.size()) {
+      try {
+        guess = this->m_rpc_model->point_to_pixel(point);
+      } catch(...) {
+        continue;
+      }
+    } else {
+      if (has_guess)
+        break;
+      // No good initial guess. The method will fail to converge.
+      // Iterate through the lattice to find a good initial guess.
+      guess = start;
+      double min_err = norm_2(model(guess));
+      for (int row = 0; row < int(m_lattice_mat.size())-1; row++) {
+        // TODO: Experiment more with the number below.
+        int T = 100; // This way we'll sample about every 4-th pixel since dcol = 400
+        int col = m_lattice_mat.front().size()/2;
+        for (int r = 0; r < T; r++) {
+          double wr = double(r)/(T-1.0);
+          Vector2 pt
+            = wr*m_lattice_mat[row+1][col]
+            + (1-wr)*m_lattice_mat[row][col];
+          double err = norm_2(model(pt));
+          if (err < min_err) {
+            min_err = err;
+            guess = pt;
+          }
+        }
       }
     }
-  }
 
-#if 0
-  // This exhaustive search for an initial guess is an overkill
-  if (!has_guess) {
-    double min_err = norm_2(model(start));
-    // No good initial guess. The method will fail to converge.
-    // Iterate through the lattice to find a good initial guess.
-    for (int row = 0; row < int(m_lattice_mat.size())-1; row++) {
-      for (int col = 0; col < int(m_lattice_mat.front().size())-1; col++) {
-	int T = 100;
-	for (int r = 0; r < T; r++) {
-	  for (int c = 0; c < T; c++) {
-	    double wr = double(r)/(T-1.0);
-	    double wc = double(c)/(T-1.0);
-	    Vector2 pt
-	      = wr*wc*m_lattice_mat[row+1][col+1]
-	      + (1-wr)*wc*m_lattice_mat[row][col+1]
-	      + wr*(1-wc)*m_lattice_mat[row+1][col]
-	      + (1-wr)*(1-wc)*m_lattice_mat[row][col];
-	    double err = norm_2(model(pt));
-	    if (err < min_err) {
-	      min_err = err;
-	      start = pt;
-	    }
-	  }
-	}
-      }
+    Vector2 solution;
+    int status = -1;
+    double angle = solve_from(model, point, guess, solution, status);
+    if (angle < best_angle) {
+      best_angle    = angle;
+      best_solution = solution;
+      best_status   = status;
     }
+    if (best_angle < GOOD_ANGLE && best_status > 0)
+      break;
   }
-#endif
-
-  // Solver constants
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
-  const double MAX_ERROR = 1e-2;
-
-  // Try two initial guesses. TODO: Study this in more detail.
-  
-  // Solution with user-provided initial guess
-  Vector3 objective(0, 0, 0);
-  vw::Vector2 solution1 = vw::math::levenberg_marquardt(model, start, objective, status,
-							ABS_TOL, REL_TOL, MAX_ITERATIONS);
-  
 
-  // Solution with the RPC initial guess
-  Vector2 start_rpc = this->m_rpc_model->point_to_pixel(point);
-  vw::Vector2 solution2 = vw::math::levenberg_marquardt(model, start_rpc, objective, status,
-							ABS_TOL, REL_TOL, MAX_ITERATIONS);
-  
-  
-  double error1 = norm_2(model(solution1));
-  double error2 = norm_2(model(solution2));
-  double error  = std::min(error1, error2);
-  
-  vw::Vector2 solution;
-  if (error1 < error2) {
-    solution = solution1;
-  } else if (error1 > error2) {
-    solution = solution2;
-  }
-  
   // Check the error - If it is too high then the solver probably got
   // stuck at the edge of the image.
-  VW_ASSERT( (status > 0) && (error < MAX_ERROR),
+  double error = std::numeric_limits<double>::max();
+  if (best_angle < std::numeric_limits<double>::max())
+    error = norm_2(model(best_solution));
+  VW_ASSERT( (best_status > 0) && (error < MAX_ERROR),
              vw::camera::PointToPixelErr() << "Unable to project point into LinescanASTER model" );
-  
-  return solution;
+
+  if (m_last_pixel->get() == NULL)
+    m_last_pixel->reset(new Vector2(best_solution));
+  else
+    *m_last_pixel->get() = best_solution;
+
+  return best_solution;
 }
 
 vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, double starty) const {
@@ -228,6 +302,21 @@ vw::Vector3 ASTERCameraModel::camera_center(vw::Vector2 const& pix) const {
 }
     
 vw::Vector3 ASTERCameraModel::pixel_to_vector(vw::Vector2 const& pixel) const{
+
+  // Bilinear interpolation in the fine grid, if the pixel is in it
+  if (!m_sight_grid.empty()) {
+    double x = (pixel.x() - m_grid_col0)/m_grid_dcol;
+    double y = (pixel.y() - m_grid_row0)/m_grid_drow;
+    if (x >= 0 && y >= 0 && x <= m_grid_cols - 1 && y <= m_grid_rows - 1) {
+      int c = std::min(int(x), m_grid_cols - 2);
+      int r = std::min(int(y), m_grid_rows - 2);
+      double wx = x - c, wy = y - r;
+      Vector3 const* p = &m_sight_grid[r*m_grid_cols + c];
+      return normalize((1-wy)*((1-wx)*p[0]           + wx*p[1]) +
+                          wy *((1-wx)*p[m_grid_cols] + wx*p[m_grid_cols+1]));
+    }
+  }
+
   try {
     return m_interp_sight_mat(pixel);
   } catch(const vw::Exception &e) {
@@ -29,6 +29,8 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <vw/Camera/CameraSolve.h>
+#include <boost/thread/tss.hpp>
 
 
 namespace asp {
@@ -45,6 +47,11 @@ namespace asp {
 
   // We do linear interpolation to find at each pixel the camera center
   // and pointing vector, and use a solver to back-project into the camera.
+  // To make pixel_to_vector() cheap, the pointing vectors are slerped once,
+  // at load time, onto a grid much finer than the lattice, and then
+  // interpolated linearly in that grid. point_to_pixel() starts from the
+  // last pixel found by the same thread, which for queries coming in
+  // image order, as in stereo_tri and mapproject, is a close guess.
   // The useful load_ASTER_camera_model() function is at the end of the file.
 
   /// Specialization of the generic LinescanModel for ASTER satellites.
@@ -81,6 +88,15 @@ namespace asp {
     
   protected:
 
+    /// Build m_sight_grid from m_interp_sight_mat.
+    void build_sight_grid(double min_row, double d_row, double min_col, double d_col,
+                          int num_rows, int num_cols);
+
+    /// Run the solver from the given guess. Returns the angle between
+    /// the ray through the solution and the direction to the point.
+    double solve_from(vw::camera::CameraGenericLMA const& model, vw::Vector3 const& point,
+                      vw::Vector2 const& start, vw::Vector2 & solution, int & status) const;
+
     std::vector< std::vector<vw::Vector2> > m_lattice_mat;
     std::vector< std::vector<vw::Vector3> > m_sight_mat;
     std::vector< std::vector<vw::Vector3> > m_world_sight_mat;
@@ -89,6 +105,16 @@ namespace asp {
     vw::camera::LinearPiecewisePositionInterpolation m_interp_sat_pos;
     vw::camera::SlerpGridPointingInterpolation m_interp_sight_mat;
     boost::shared_ptr<vw::camera::CameraModel> m_rpc_model; // rpc approx, for initial guess
+
+    // The fine grid of pointing vectors, stored by rows. If empty,
+    // m_interp_sight_mat is used.
+    double m_grid_row0, m_grid_col0, m_grid_drow, m_grid_dcol;
+    int    m_grid_rows, m_grid_cols;
+    std::vector<vw::Vector3> m_sight_grid;
+
+    // The last pixel found by point_to_pixel() in each thread. Shared
+    // by copies of this model, which is fine, as it is only a guess.
+    boost::shared_ptr< boost::thread_specific_ptr<vw::Vector2> > m_last_pixel;
   }; // End class ASTERCameraModel
 
 
@@ -27,6 +27,10 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <asp/Camera/BatchInterpolation.h>
+
+#include <utility>
+#include <vector>
 
 namespace asp {
 
@@ -73,6 +77,25 @@ namespace asp {
     virtual vw::Vector3 get_camera_velocity_at_time(double time) const { return m_velocity_func(time); }
     virtual vw::Quat    get_camera_pose_at_time    (double time) const { return m_pose_func    (time); }
     virtual double      get_time_at_line           (double line) const { return m_time_func    (line); }
+
+    /// Batch versions of the four functions above, for many lines or
+    /// times at once, such as all the lines of a tile.
+    void get_times_at_lines(std::vector<double> const& lines,
+                            std::vector<double> & times) const {
+      interpolate_at_times(m_time_func, lines, times);
+    }
+    void get_camera_centers_at_times(std::vector<double> const& times,
+                                     std::vector<vw::Vector3> & centers) const {
+      interpolate_at_times(m_position_func, times, centers);
+    }
+    void get_camera_velocities_at_times(std::vector<double> const& times,
+                                        std::vector<vw::Vector3> & velocities) const {
+      interpolate_at_times(m_velocity_func, times, velocities);
+    }
+    void get_camera_poses_at_times(std::vector<double> const& times,
+                                   std::vector<vw::Quat> & poses) const {
+      interpolate_at_times(m_pose_func, times, poses);
+    }
     
     /// As pixel_to_vector, but in the local camera frame.
     virtual vw::Vector3 get_local_pixel_vector(vw::Vector2 const& pix) const;
@@ -160,6 +183,27 @@ namespace asp {
   typedef LinescanDGModel<vw::camera::PiecewiseAPositionInterpolation,
                   			  vw::camera::SLERPPoseInterpolation> DGCameraModel;
 
+  /// The values from which a DG camera model is made, once they are
+  /// read from the XML file and converted to the camera frame and to
+  /// seconds. These are what CameraModelCache.h stores.
+  struct DGCameraData {
+    std::vector<vw::Vector3> positions, velocities;          ///< Sampled at position_t0 + k*position_dt
+    std::vector<vw::Quat>    poses;                          ///< Sampled at pose_t0 + k*pose_dt
+    double position_t0, position_dt, pose_t0, pose_dt;
+    std::vector<std::pair<double,double> > tlc;              ///< Line -> time offset pairings
+    double       tlc_t0;                                     ///< Time of the TLC start
+    vw::Vector2i image_size;
+    vw::Vector2  detector_origin;                            ///< In pixels
+    double       focal_length;                               ///< In pixels
+  };
+
+  /// Read the values for a DG camera model from an XML file.
+  /// - The same Xerces init/de-init caveat as below applies.
+  inline void read_dg_camera_data_from_xml(std::string const& path, DGCameraData & data);
+
+  /// Make a DG camera model from the values read from its XML file.
+  inline boost::shared_ptr<DGCameraModel> dg_camera_model_from_data(DGCameraData const& data);
+
   /// Load a DG camera model from an XML file.
   /// - This function does not take care of Xerces XML init/de-init, the caller must
   ///   make sure this is done before/after this function is called!
@@ -75,21 +75,56 @@ vw::Vector2 LinescanDGModel<PositionFuncT, PoseFuncT>::point_to_pixel_uncorrecte
 
   // Solve for the correct line number to use
   LinescanLMA model( this, point );
-  int status;
-  vw::Vector<double> objective(1), start(1);
+  vw::Vector<double> start(1);
   start[0] = m_image_size.y()/2; 
   // Use a refined guess, if available, otherwise the center line.
   if (starty >= 0)
     start[0] = starty;
 
-  // Run the solver
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
-  vw::Vector<double> solution = vw::math::levenberg_marquardt(model, start, objective, status,
-                                                              ABS_TOL, REL_TOL, MAX_ITERATIONS);
+  // The error on the optical plane is a smooth function of the line
+  // alone, so first try the secant method. From a nearby guess, such
+  // as the line of a neighboring point, it needs just a few function
+  // evaluations, while the LM solver below also estimates a Jacobian.
+  vw::Vector<double> solution(1);
+  bool converged = false;
+  const double SECANT_TOL      = 1e-10; // in lines
+  const int    SECANT_MAX_ITER = 50;
+  try {
+    vw::Vector<double> y(1);
+    double y0 = start[0],     y1 = start[0] + 1.0;
+    y[0] = y0; double f0 = model(y)[0];
+    y[0] = y1; double f1 = model(y)[0];
+    for (int iter = 0; iter < SECANT_MAX_ITER; iter++) {
+      double df = f1 - f0;
+      if (df == 0 || df != df)
+        break;
+      double y2 = y1 - f1*(y1 - y0)/df;
+      if (y2 != y2)
+        break;
+      y0 = y1; f0 = f1;
+      y1 = y2; y[0] = y1; f1 = model(y)[0];
+      if (std::abs(y1 - y0) < SECANT_TOL) {
+        converged = (f1 == f1);
+        break;
+      }
+    }
+    solution[0] = y1;
+  } catch (...) {
+    converged = false;
+  }
 
-  VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
+  if (!converged) {
+    // Run the solver
+    int status;
+    vw::Vector<double> objective(1);
+    const double ABS_TOL = 1e-16;
+    const double REL_TOL = 1e-16;
+    const int    MAX_ITERATIONS = 1e+5;
+    solution = vw::math::levenberg_marquardt(model, start, objective, status,
+                                             ABS_TOL, REL_TOL, MAX_ITERATIONS);
+
+    VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model" );
+  }
 
   // Solve for sample location now that we know the correct line
   double      t  = m_time_func( solution[0] );
@@ -153,7 +188,7 @@ inline boost::posix_time::ptime parse_time(std::string str)
   return boost::posix_time::time_from_string(str); // Never reached!
 }
 
-boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const& path)
+void read_dg_camera_data_from_xml(std::string const& path, DGCameraData & data)
 {
   //vw_out() << "DEBUG - Loading DG camera file: " << camera_file << std::endl;
 
@@ -228,19 +263,39 @@ boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const
 							      geo.detector_origin[1],
 							      0)), 0, 2);
 
-  double et0 = convert( parse_time( eph.start_time ) );
-  double at0 = convert( parse_time( att.start_time ) );
-  double edt = eph.time_interval;
-  double adt = att.time_interval;
-
+  data.positions        = eph.position_vec;
+  data.velocities       = eph.velocity_vec;
+  data.poses            = att.quat_vec;
+  data.position_t0      = convert( parse_time( eph.start_time ) );
+  data.position_dt      = eph.time_interval;
+  data.pose_t0          = convert( parse_time( att.start_time ) );
+  data.pose_dt          = att.time_interval;
+  data.tlc              = img.tlc_vec;
+  data.tlc_t0           = convert( parse_time( img.tlc_start_time ) );
+  data.image_size       = img.image_size;
+  data.detector_origin  = final_detector_origin;
+  data.focal_length     = geo.principal_distance;
+} // End function read_dg_camera_data_from_xml()
+
+boost::shared_ptr<DGCameraModel> dg_camera_model_from_data(DGCameraData const& data)
+{
   typedef boost::shared_ptr<DGCameraModel> CameraModelPtr;
-  return CameraModelPtr(new DGCameraModel(vw::camera::PiecewiseAPositionInterpolation(eph.position_vec, eph.velocity_vec, et0, edt ),
-					                                vw::camera::LinearPiecewisePositionInterpolation(eph.velocity_vec, et0, edt),
-					                                vw::camera::SLERPPoseInterpolation(att.quat_vec, at0, adt),
-					                                tlc_time_interpolation, img.image_size,
-					                                final_detector_origin,
-					                                geo.principal_distance)
+  return CameraModelPtr(new DGCameraModel(vw::camera::PiecewiseAPositionInterpolation(data.positions, data.velocities,
+                                                                                      data.position_t0, data.position_dt),
+					                                vw::camera::LinearPiecewisePositionInterpolation(data.velocities, data.position_t0,
+                                                                                           data.position_dt),
+					                                vw::camera::SLERPPoseInterpolation(data.poses, data.pose_t0, data.pose_dt),
+					                                vw::camera::TLCTimeInterpolation(data.tlc, data.tlc_t0),
+					                                data.image_size, data.detector_origin,
+					                                data.focal_length)
 		    );
+}
+
+boost::shared_ptr<DGCameraModel> load_dg_camera_model_from_xml(std::string const& path)
+{
+  DGCameraData data;
+  read_dg_camera_data_from_xml(path, data);
+  return dg_camera_model_from_data(data);
 } // End function load_dg_camera_model()
 
 
@@ -19,6 +19,8 @@
 #include <asp/Camera/SPOT_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/BatchInterpolation.h>
+#include <algorithm>
 
 namespace asp {
 
@@ -62,6 +64,14 @@ void SPOTCameraModel::check_time(double time, std::string const& location) const
                  << m_min_time << " <-> "<<m_max_time<<")\n");
 }
 
+void SPOTCameraModel::check_times(std::vector<double> const& times,
+                                  std::string const& location) const {
+  if (times.empty())
+    return;
+  check_time(*std::min_element(times.begin(), times.end()), location);
+  check_time(*std::max_element(times.begin(), times.end()), location);
+}
+
 vw::Vector3 SPOTCameraModel::get_camera_center_at_time(double time) const {
   check_time(time, "get_camera_center_at_time");
   return m_position_func(time);
@@ -82,6 +92,34 @@ double SPOTCameraModel::get_time_at_line(double line) const {
  return m_time_func(line); 
 }
 
+void SPOTCameraModel::get_times_at_lines(std::vector<double> const& lines,
+                                         std::vector<double> & times) const {
+  if (!lines.empty()) {
+    double min_line = *std::min_element(lines.begin(), lines.end());
+    double max_line = *std::max_element(lines.begin(), lines.end());
+    if ((min_line < 0.0) || (static_cast<int>(max_line) >= m_image_size[1]))
+      vw::vw_throw(vw::ArgumentErr() << "SPOTCameraModel::get_times_at_lines"
+                   << ": Requested lines are out of bounds (0"
+                   << " <-> "<<m_image_size[1]<<")\n");
+  }
+  interpolate_at_times(m_time_func, lines, times);
+}
+void SPOTCameraModel::get_camera_centers_at_times(std::vector<double> const& times,
+                                                  std::vector<Vector3> & centers) const {
+  check_times(times, "get_camera_centers_at_times");
+  interpolate_at_times(m_position_func, times, centers);
+}
+void SPOTCameraModel::get_camera_velocities_at_times(std::vector<double> const& times,
+                                                     std::vector<Vector3> & velocities) const {
+  check_times(times, "get_camera_velocities_at_times");
+  interpolate_at_times(m_velocity_func, times, velocities);
+}
+void SPOTCameraModel::get_camera_poses_at_times(std::vector<double> const& times,
+                                                std::vector<vw::Quat> & poses) const {
+  check_times(times, "get_camera_poses_at_times");
+  interpolate_at_times(m_pose_func, times, poses);
+}
+
 
 
 Vector3 SPOTCameraModel::get_local_pixel_vector(vw::Vector2 const& pix) const {
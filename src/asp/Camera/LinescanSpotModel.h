@@ -121,6 +121,18 @@ namespace asp {
     virtual vw::Vector3 get_camera_velocity_at_time(double time) const;
     virtual vw::Quat    get_camera_pose_at_time    (double time) const;
     virtual double      get_time_at_line           (double line) const;
+
+    /// Batch versions of the four functions above, for many lines or
+    /// times at once, such as all the lines of a tile. The bounds are
+    /// checked once per batch.
+    void get_times_at_lines            (std::vector<double> const& lines,
+                                        std::vector<double> & times) const;
+    void get_camera_centers_at_times   (std::vector<double> const& times,
+                                        std::vector<vw::Vector3> & centers) const;
+    void get_camera_velocities_at_times(std::vector<double> const& times,
+                                        std::vector<vw::Vector3> & velocities) const;
+    void get_camera_poses_at_times     (std::vector<double> const& times,
+                                        std::vector<vw::Quat> & poses) const;
     
     /// As pixel_to_vector, but in the local camera frame.
     virtual vw::Vector3 get_local_pixel_vector(vw::Vector2 const& pix) const;
@@ -173,6 +185,9 @@ namespace asp {
     /// - Pass the caller location in to get a nice error message.
     void check_time(double time, std::string const& location) const;
 
+    /// The same, for the smallest and largest of the given times.
+    void check_times(std::vector<double> const& times, std::string const& location) const;
+
   }; // End class SPOTCameraModel
 
 
@@ -30,8 +30,45 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <algorithm>
+#include <limits>
+
 using namespace vw;
 
+namespace {
+
+  // Evaluate the RPC polynomial with coefficients c, in the order of
+  // RPCModel::calculate_terms(), at (x, y, z). The terms are grouped
+  // Horner style, which takes fewer multiplications than forming the
+  // 20 terms and their dot product with c.
+  inline double rpc_poly(double const* c, double x, double y, double z){
+    return c[0] + z*(c[3] + z*(c[9] + z*c[19]))
+      + y*(c[2] + z*(c[6] + z*c[16]) + y*(c[8] + z*c[18] + y*c[15]))
+      + x*(c[1] + z*(c[5] + z*c[13]) + y*(c[4] + z*c[10] + y*c[12])
+           + x*(c[7] + z*c[17] + y*c[14] + x*c[11]));
+  }
+
+  // The RPC polynomial as above, and its derivatives in x and y
+  inline void rpc_poly_grad(double const* c, double x, double y, double z,
+                            double & p, double & px, double & py){
+    // The coefficients of the cubic in x and y at this z
+    double a0  = c[0] + z*(c[3] + z*(c[9] + z*c[19]));
+    double ax  = c[1] + z*(c[5] + z*c[13]);
+    double ay  = c[2] + z*(c[6] + z*c[16]);
+    double axy = c[4] + z*c[10];
+    double axx = c[7] + z*c[17];
+    double ayy = c[8] + z*c[18];
+    double xx = x*x, xy = x*y, yy = y*y;
+    p  = a0 + ax*x + ay*y + axy*xy + axx*xx + ayy*yy
+      + c[11]*xx*x + c[12]*x*yy + c[14]*xx*y + c[15]*yy*y;
+    px = ax + axy*y + 2.0*axx*x + 3.0*c[11]*xx + c[12]*yy + 2.0*c[14]*xy;
+    py = ay + axy*x + 2.0*ayy*y + 2.0*c[12]*xy + c[14]*xx + 3.0*c[15]*yy;
+  }
+
+  // How many points to process at a time in the batch projection
+  const int RPC_BLOCK_SIZE = 64;
+}
+
 namespace asp {
 
   void RPCModel::initialize( DiskImageResourceGDAL* resource ) {
@@ -123,15 +160,93 @@ namespace asp {
    RPCModel::CoeffVec const& sample_num_coeff,
    RPCModel::CoeffVec const& sample_den_coeff){
 
-    CoeffVec term = calculate_terms( normalized_geodetic );
-    Vector2 normalized_pixel( dot_prod(term,sample_num_coeff) /
-                              dot_prod(term,sample_den_coeff),
-                              dot_prod(term,line_num_coeff) /
-                              dot_prod(term,line_den_coeff) );
+    double x = normalized_geodetic[0], y = normalized_geodetic[1], z = normalized_geodetic[2];
+    Vector2 normalized_pixel( rpc_poly(&sample_num_coeff[0], x, y, z) /
+                              rpc_poly(&sample_den_coeff[0], x, y, z),
+                              rpc_poly(&line_num_coeff[0],   x, y, z) /
+                              rpc_poly(&line_den_coeff[0],   x, y, z) );
 
     return normalized_pixel;
   }
 
+  void RPCModel::normalized_geodetic_to_normalized_pixel
+  (double const* normalized_geodetics, int num_pts,
+   RPCModel::CoeffVec const& line_num_coeff,
+   RPCModel::CoeffVec const& line_den_coeff,
+   RPCModel::CoeffVec const& sample_num_coeff,
+   RPCModel::CoeffVec const& sample_den_coeff,
+   double * normalized_pixels){
+
+    double const* sn = &sample_num_coeff[0];
+    double const* sd = &sample_den_coeff[0];
+    double const* ln = &line_num_coeff[0];
+    double const* ld = &line_den_coeff[0];
+
+    double x[RPC_BLOCK_SIZE], y[RPC_BLOCK_SIZE], z[RPC_BLOCK_SIZE];
+    double px[RPC_BLOCK_SIZE], py[RPC_BLOCK_SIZE];
+
+    for (int beg = 0; beg < num_pts; beg += RPC_BLOCK_SIZE) {
+      int len = std::min(RPC_BLOCK_SIZE, num_pts - beg);
+
+      double const* in = normalized_geodetics + GEODETIC_COORD_SIZE*beg;
+      for (int i = 0; i < len; i++) {
+        x[i] = in[GEODETIC_COORD_SIZE*i + 0];
+        y[i] = in[GEODETIC_COORD_SIZE*i + 1];
+        z[i] = in[GEODETIC_COORD_SIZE*i + 2];
+      }
+
+      // No dependencies between iterations, and no branches
+      for (int i = 0; i < len; i++) {
+        px[i] = rpc_poly(sn, x[i], y[i], z[i]) / rpc_poly(sd, x[i], y[i], z[i]);
+        py[i] = rpc_poly(ln, x[i], y[i], z[i]) / rpc_poly(ld, x[i], y[i], z[i]);
+      }
+
+      double * out = normalized_pixels + IMAGE_COORD_SIZE*beg;
+      for (int i = 0; i < len; i++) {
+        out[IMAGE_COORD_SIZE*i + 0] = px[i];
+        out[IMAGE_COORD_SIZE*i + 1] = py[i];
+      }
+    }
+  }
+
+  void RPCModel::geodetic_to_pixel(std::vector<Vector3> const& geodetics,
+                                   std::vector<Vector2> & pixels) const {
+
+    int num_pts = geodetics.size();
+    pixels.resize(num_pts);
+    if (num_pts == 0)
+      return;
+
+    std::vector<double> normalized_geodetics(GEODETIC_COORD_SIZE*num_pts);
+    for (int i = 0; i < num_pts; i++) {
+      Vector3 G = elem_quot(geodetics[i] - m_lonlatheight_offset, m_lonlatheight_scale);
+      for (int c = 0; c < GEODETIC_COORD_SIZE; c++)
+        normalized_geodetics[GEODETIC_COORD_SIZE*i + c] = G[c];
+    }
+
+    std::vector<double> normalized_pixels(IMAGE_COORD_SIZE*num_pts);
+    normalized_geodetic_to_normalized_pixel(&normalized_geodetics[0], num_pts,
+                                            m_line_num_coeff, m_line_den_coeff,
+                                            m_sample_num_coeff, m_sample_den_coeff,
+                                            &normalized_pixels[0]);
+
+    for (int i = 0; i < num_pts; i++) {
+      Vector2 P(normalized_pixels[IMAGE_COORD_SIZE*i + 0],
+                normalized_pixels[IMAGE_COORD_SIZE*i + 1]);
+      pixels[i] = elem_prod(P, m_xy_scale) + m_xy_offset;
+    }
+  }
+
+  void RPCModel::point_to_pixel(std::vector<Vector3> const& points,
+                                std::vector<Vector2> & pixels) const {
+
+    std::vector<Vector3> geodetics(points.size());
+    for (size_t i = 0; i < points.size(); i++)
+      geodetics[i] = m_datum.cartesian_to_geodetic(points[i]);
+
+    geodetic_to_pixel(geodetics, pixels);
+  }
+
   Vector2 RPCModel::normalized_geodetic_to_normalized_pixel
   (Vector3 const& normalized_geodetic ) const {
 
@@ -401,47 +516,138 @@ namespace asp {
 
   }
 
-  void RPCModel::point_and_dir(Vector2 const& pix, Vector3 & P, Vector3 & dir ) const {
+  void RPCModel::image_to_ground(std::vector<Vector2> const& pixels,
+                                 std::vector<double>  const& heights,
+                                 std::vector<Vector2>      & lonlats) const {
+
+    // The same tolerance and number of iterations as for one pixel
+    const double abs_tolerance = 1e-6;
+    const int    max_iter      = 10;
+
+    int num_pts = pixels.size();
+    VW_ASSERT((int)heights.size() == num_pts,
+              ArgumentErr() << "Expecting as many heights as pixels.\n");
+    if ((int)lonlats.size() != num_pts)
+      lonlats.assign(num_pts, Vector2(0.0, 0.0));
+
+    double const* sn = &m_sample_num_coeff[0];
+    double const* sd = &m_sample_den_coeff[0];
+    double const* ln = &m_line_num_coeff[0];
+    double const* ld = &m_line_den_coeff[0];
+
+    double x[RPC_BLOCK_SIZE], y[RPC_BLOCK_SIZE], z[RPC_BLOCK_SIZE];
+    double tx[RPC_BLOCK_SIZE], ty[RPC_BLOCK_SIZE], active[RPC_BLOCK_SIZE];
+
+    for (int beg = 0; beg < num_pts; beg += RPC_BLOCK_SIZE) {
+      int len = std::min(RPC_BLOCK_SIZE, num_pts - beg);
+
+      // Normalize, and screen the guesses as image_to_ground() does
+      int num_active = 0;
+      for (int i = 0; i < len; i++) {
+        Vector2 const& pix = pixels[beg + i];
+        Vector2 guess = lonlats[beg + i];
+        if (guess == Vector2(0.0, 0.0))
+          guess = subvector(m_lonlatheight_offset, 0, 2);
+        x[i]  = (guess[0] - m_lonlatheight_offset[0])/m_lonlatheight_scale[0];
+        y[i]  = (guess[1] - m_lonlatheight_offset[1])/m_lonlatheight_scale[1];
+        double dist = sqrt(x[i]*x[i] + y[i]*y[i]);
+        if (dist != dist || dist > 1.5){
+          x[i] = 0.0;
+          y[i] = 0.0;
+        }
+        z[i]  = (heights[beg + i] - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
+        tx[i] = (pix[0] - m_xy_offset[0])/m_xy_scale[0];
+        ty[i] = (pix[1] - m_xy_offset[1])/m_xy_scale[1];
+
+        // Pixels which are NaN take no iterations, and come out as NaN
+        active[i] = (tx[i] == tx[i] && ty[i] == ty[i] && z[i] == z[i]) ? 1.0 : 0.0;
+        if (active[i] == 0.0) {
+          x[i] = std::numeric_limits<double>::quiet_NaN();
+          y[i] = x[i];
+        }
+        num_active += (active[i] != 0.0);
+      }
 
-    // For an RPC model there is no defined origin so it and the ray need to be computed.
+      for (int iter = 0; iter < max_iter && num_active > 0; iter++) {
+
+        // No dependencies between iterations, and no branches. A point
+        // which has converged is still evaluated, but not moved.
+        for (int i = 0; i < len; i++) {
+          double ns, nsx, nsy, ds, dsx, dsy, nl, nlx, nly, dl, dlx, dly;
+          rpc_poly_grad(sn, x[i], y[i], z[i], ns, nsx, nsy);
+          rpc_poly_grad(sd, x[i], y[i], z[i], ds, dsx, dsy);
+          rpc_poly_grad(ln, x[i], y[i], z[i], nl, nlx, nly);
+          rpc_poly_grad(ld, x[i], y[i], z[i], dl, dlx, dly);
+
+          // The quotients, and their Jacobian
+          double s = ns/ds, l = nl/dl;
+          double J00 = (nsx - s*dsx)/ds, J01 = (nsy - s*dsy)/ds;
+          double J10 = (nlx - l*dlx)/dl, J11 = (nly - l*dly)/dl;
+
+          double es = s - tx[i], el = l - ty[i];
+          double det = J00*J11 - J01*J10;
+          double step = active[i]/det;
+          x[i] -= step*( J11*es - J01*el);
+          y[i] -= step*(-J10*es + J00*el);
+
+          // Converged after this step, as in image_to_ground()
+          active[i] *= (es*es + el*el >= abs_tolerance*abs_tolerance);
+        }
+
+        num_active = 0;
+        for (int i = 0; i < len; i++)
+          num_active += (active[i] != 0.0);
+      }
+
+      for (int i = 0; i < len; i++)
+        lonlats[beg + i] = Vector2(x[i]*m_lonlatheight_scale[0] + m_lonlatheight_offset[0],
+                                   y[i]*m_lonlatheight_scale[1] + m_lonlatheight_offset[1]);
+    }
+  }
 
+  void RPCModel::ray_heights(double & height_up, double & height_dn) const {
     // Center of valid region to bottom of valid region (normalized)
     const double VERT_SCALE_FACTOR = 0.9; // - The virtual center should be above the terrain
-    double  height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
-    double  height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
-
-    //vw_out() << "m_lonlatheight_offset = " << m_lonlatheight_offset << std::endl;
-    //vw_out() << "m_lonlatheight_scale = " << m_lonlatheight_scale << std::endl;
-
-    //vw_out() << "Height up = " << height_up << std::endl;
-    //vw_out() << "Height dn = " << height_dn << std::endl;
+    height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
+    height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
+  }
 
-    // Given the pixel and elevation, estimate lon-lat.
-    // Use m_lonlatheight_offset as initial guess for lonlat_up,
-    // and then use lonlat_up as initial guess for lonlat_dn.
-    Vector2 lonlat_up = image_to_ground(pix, height_up, subvector(m_lonlatheight_offset, 0, 2));
-    Vector2 lonlat_dn = image_to_ground(pix, height_dn, lonlat_up);
+  void RPCModel::lonlats_to_ray(Vector2 const& lonlat_up, Vector2 const& lonlat_dn,
+                                Vector3 & P, Vector3 & dir) const {
 
-    //vw_out() << "lonlat_up = " << lonlat_up << std::endl;
-    //vw_out() << "lonlat_dn = " << lonlat_dn << std::endl;
+    double height_up, height_dn;
+    ray_heights(height_up, height_dn);
 
     Vector3 geo_up = Vector3(lonlat_up[0], lonlat_up[1], height_up);
     Vector3 geo_dn = Vector3(lonlat_dn[0], lonlat_dn[1], height_dn);
 
-    //vw_out() << "geo_up = " << geo_up << std::endl;
-    //vw_out() << "geo_dn = " << geo_dn << std::endl;
-
     Vector3 P_up = m_datum.geodetic_to_cartesian( geo_up );
     Vector3 P_dn = m_datum.geodetic_to_cartesian( geo_dn );
 
     dir = normalize(P_dn - P_up);
-    
+
     // Set the origin location very far in the opposite direction of the pointing vector,
     //  to put it high above the terrain.
     const double LONG_SCALE_UP = 10000; // This is a distance in meters approx from the top of the llh valid cube
     P = P_up - dir*LONG_SCALE_UP;
   }
 
+  void RPCModel::point_and_dir(Vector2 const& pix, Vector3 & P, Vector3 & dir ) const {
+
+    // For an RPC model there is no defined origin so it and the ray need to be computed.
+
+    double height_up, height_dn;
+    ray_heights(height_up, height_dn);
+
+    // Given the pixel and elevation, estimate lon-lat.
+    // Use m_lonlatheight_offset as initial guess for lonlat_up,
+    // and then use lonlat_up as initial guess for lonlat_dn.
+    Vector2 lonlat_up = image_to_ground(pix, height_up, subvector(m_lonlatheight_offset, 0, 2));
+    Vector2 lonlat_dn = image_to_ground(pix, height_dn, lonlat_up);
+
+    lonlats_to_ray(lonlat_up, lonlat_dn, P, dir);
+  }
+
   Vector3 RPCModel::camera_center(Vector2 const& pix ) const{
     // Return an arbitrarily chosen point on the ray back-projected
     // through the camera from the current pixel.
@@ -36,6 +36,7 @@
 #include <vw/Cartography/Datum.h>
 
 #include <string>
+#include <vector>
 #include <ostream>
 
 namespace vw {
@@ -88,6 +89,24 @@ namespace asp {
 
     vw::Vector2 geodetic_to_pixel( vw::Vector3 const& geodetic ) const;
 
+    /// Project many normalized geodetics at once. They are packed as
+    /// x0 y0 z0 x1 y1 z1 ..., and the normalized pixels are returned
+    /// packed as x0 y0 x1 y1 ... The points are processed in blocks,
+    /// stored coordinate by coordinate, so that the loop over them in
+    /// which the polynomials are evaluated can be vectorized.
+    static void normalized_geodetic_to_normalized_pixel
+      (double const* normalized_geodetics, int num_pts,
+       CoeffVec const& line_num_coeff,   CoeffVec const& line_den_coeff,
+       CoeffVec const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+       double * normalized_pixels
+      );
+
+    /// Batch versions of geodetic_to_pixel() and point_to_pixel().
+    void geodetic_to_pixel(std::vector<vw::Vector3> const& geodetics,
+                           std::vector<vw::Vector2> & pixels) const;
+    void point_to_pixel   (std::vector<vw::Vector3> const& points,
+                           std::vector<vw::Vector2> & pixels) const;
+
     // Access to constants
     vw::cartography::Datum const& datum   () const { return m_datum;               }
     CoeffVec    const& line_num_coeff     () const { return m_line_num_coeff;      }
@@ -120,10 +139,29 @@ namespace asp {
     vw::Vector2 image_to_ground(vw::Vector2 const& pixel, double height,
                                 vw::Vector2 lonlat_guess = vw::Vector2(0.0, 0.0)) const;
 
+    /// Batch version of image_to_ground(), each pixel with its own
+    /// height. On input, lonlats has the guesses, or is empty, and on
+    /// output it has the solutions. The Newton iterations are done in
+    /// lockstep over blocks of points, with the polynomials and their
+    /// derivatives evaluated in a loop which can be vectorized, so good
+    /// guesses, such as the solutions at neighboring pixels, pay off.
+    void image_to_ground(std::vector<vw::Vector2> const& pixels,
+                         std::vector<double>      const& heights,
+                         std::vector<vw::Vector2>      & lonlats) const;
+
     /// Find a point which gets projected onto the current pixel,
     /// and the direction of the ray going through that point.
     void point_and_dir(vw::Vector2 const& pix, vw::Vector3 & P, vw::Vector3 & dir ) const;
 
+    /// The heights at which point_and_dir() finds the lon-lat of a
+    /// pixel, near the top and bottom of the valid region.
+    void ray_heights(double & height_up, double & height_dn) const;
+
+    /// The ray of point_and_dir(), given the lon-lat of its pixel at
+    /// each of the ray_heights().
+    void lonlats_to_ray(vw::Vector2 const& lonlat_up, vw::Vector2 const& lonlat_dn,
+                        vw::Vector3 & P, vw::Vector3 & dir) const;
+
   private:
     vw::cartography::Datum m_datum;
 
@@ -19,6 +19,14 @@
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
+#include <vw/Math/LinearAlgebra.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/ProgressCallback.h>
+
+#include <cmath>
+
+#include <boost/noncopyable.hpp>
 
 using namespace vw;
 
@@ -127,12 +135,108 @@ namespace asp {
     //VW_OUT(VerboseDebugMessage, "math") << "LM: final    error " << final_error       << std::endl;
   }
 
+  double fit_rpc_coord_linear(Vector<double> const& normalized_geodetics,
+                              Vector<double> const& normalized_pixels,
+                              int coord, double penalty_weight,
+                              RPCModel::CoeffVec & num, RPCModel::CoeffVec & den) {
+
+    // The unknowns are num[0..19] followed by den[1..19]
+    const int NUM_TERMS = 20, NUM_UNKNOWNS = 2*NUM_TERMS - 1;
+    const int    MAX_ITERATIONS = 10;
+    const double MIN_RMS_CHANGE = 1e-12;
+    int numPts = normalized_geodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    if (numPts < NUM_UNKNOWNS)
+      vw_throw( ArgumentErr() << "Need at least " << NUM_UNKNOWNS
+                << " points to fit an RPC model.\n" );
+
+    // The penalty terms of RpcSolveLMA, which do not change
+    Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+    Vector<double> penalty(NUM_UNKNOWNS);
+    for (int i = 4; i < NUM_TERMS; i++) {
+      double wt = penalty_weight*(coeff_order[i] - 1);
+      penalty[i]                 = wt*wt;
+      penalty[NUM_TERMS + i - 1] = wt*wt;
+    }
+
+    for (int i = 0; i < NUM_TERMS; i++) {
+      num[i] = 0;
+      den[i] = 0;
+    }
+    den[0] = 1;
+
+    double prev_rms = -1;
+    Matrix<double> M(NUM_UNKNOWNS, NUM_UNKNOWNS);
+    Vector<double> rhs(NUM_UNKNOWNS), row(NUM_UNKNOWNS);
+    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+
+      M.set_zero();
+      rhs.set_zero();
+      for (int p = 0; p < numPts; p++) {
+        Vector3 g(normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 0],
+                  normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 1],
+                  normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 2]);
+        double u = normalized_pixels[RPCModel::IMAGE_COORD_SIZE*p + coord];
+        RPCModel::CoeffVec t = RPCModel::calculate_terms(g);
+
+        double d = dot_prod(den, t);
+        if (d == 0)
+          continue;
+        double w2 = 1.0/(d*d);
+
+        for (int i = 0; i < NUM_TERMS; i++)
+          row[i] = t[i];
+        for (int i = 1; i < NUM_TERMS; i++)
+          row[NUM_TERMS + i - 1] = -u*t[i];
+
+        // Only the upper triangle, mirrored below
+        for (int i = 0; i < NUM_UNKNOWNS; i++) {
+          double wi = w2*row[i];
+          rhs[i] += wi*u;
+          for (int j = i; j < NUM_UNKNOWNS; j++)
+            M(i, j) += wi*row[j];
+        }
+      }
+      for (int i = 0; i < NUM_UNKNOWNS; i++) {
+        M(i, i) += penalty[i];
+        for (int j = 0; j < i; j++)
+          M(i, j) = M(j, i);
+      }
+
+      Vector<double> x = math::solve(M, rhs);
+      for (int i = 0; i < NUM_TERMS; i++)
+        num[i] = x[i];
+      for (int i = 1; i < NUM_TERMS; i++)
+        den[i] = x[NUM_TERMS + i - 1];
+
+      // The error of the rational function itself
+      double sum = 0;
+      for (int p = 0; p < numPts; p++) {
+        Vector3 g(normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 0],
+                  normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 1],
+                  normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 2]);
+        RPCModel::CoeffVec t = RPCModel::calculate_terms(g);
+        double diff = dot_prod(num, t)/dot_prod(den, t)
+          - normalized_pixels[RPCModel::IMAGE_COORD_SIZE*p + coord];
+        sum += diff*diff;
+      }
+      double rms = std::sqrt(sum/numPts);
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: linear fit iteration " << iter
+                                  << ", RMS error = " << rms << std::endl;
+      if (prev_rms >= 0 && std::abs(prev_rms - rms) < MIN_RMS_CHANGE)
+        return rms;
+      prev_rms = rms;
+    }
+
+    return prev_rms;
+  }
+
   /// Computes a system solution from a seed and returns the final error number.
   int find_solution_from_seed(RpcSolveLMA    const& lma_model,
                               Vector<double> const& seed_params,
                               Vector<double> const& actual_observations,
                               Vector<double>      & final_params,
-                              double              & norm_error) {
+                              double              & norm_error,
+                              int                   max_iterations) {
 
     // Initialize a zero vector of RPC model coefficients
     int status;
@@ -140,7 +244,6 @@ namespace asp {
     // Use the L-M solver to optimize the RPC model coefficient values.
     const double abs_tolerance  = 1e-24;
     const double rel_tolerance  = 1e-24;
-    const int    max_iterations = 2000;
     final_params = math::levenberg_marquardt( lma_model, seed_params, actual_observations,
                                               status, abs_tolerance, rel_tolerance,
                                               max_iterations );
@@ -232,6 +335,21 @@ namespace asp {
     // The denominator is just 1 to start
     samp_den[0] = 1;
     line_den[0] = 1;
+
+    // A much better guess is the solution of the linearized problem,
+    // which is then only refined. Keep the affine guess if that fails.
+    const int MAX_LMA_ITERATIONS = 2000, MAX_REFINE_ITERATIONS = 50;
+    int max_iterations = MAX_LMA_ITERATIONS;
+    try {
+      RPCModel::CoeffVec ln, ld, sn, sd;
+      fit_rpc_coord_linear(normalized_geodetics, normalized_pixels, 0, penalty_adjustment, sn, sd);
+      fit_rpc_coord_linear(normalized_geodetics, normalized_pixels, 1, penalty_adjustment, ln, ld);
+      samp_num = sn; samp_den = sd;
+      line_num = ln; line_den = ld;
+      max_iterations = MAX_REFINE_ITERATIONS;
+    } catch (const vw::Exception& e) {
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: linear fit failed: " << e.what() << std::endl;
+    }
     
     // Initialize the model
     Vector<double> startGuess;
@@ -243,7 +361,7 @@ namespace asp {
     
     // Use the L-M solver to optimize the RPC model coefficient values.
     int status = find_solution_from_seed(lma_model, startGuess, normalized_pixels,
-                                         solution, norm_error);
+                                         solution, norm_error, max_iterations);
     VW_OUT(DebugMessage, "asp") << "Solved RPC coeffs: " << solution << std::endl;
     VW_OUT(DebugMessage, "asp") << "rpc_gen: norm_error = " << norm_error << std::endl;
 
@@ -257,6 +375,138 @@ namespace asp {
 
     unpackCoeffs(solution, line_num, line_den, samp_num, samp_den);
   }
-  
-  
+
+  namespace {
+    // Project a range of points into the camera. Points which fail to
+    // project are marked as not valid.
+    class ProjectPointsTask : public vw::Task, private boost::noncopyable {
+      camera::CameraModel const*   m_cam;
+      std::vector<Vector3> const & m_xyz;
+      std::vector<Vector2>       & m_pixels;
+      std::vector<char>          & m_valid;
+      int                          m_beg, m_end;
+      vw::Mutex                  & m_mutex;
+      TerminalProgressCallback   & m_tpc;
+    public:
+      ProjectPointsTask(camera::CameraModel const* cam, std::vector<Vector3> const& xyz,
+                        std::vector<Vector2> & pixels, std::vector<char> & valid,
+                        int beg, int end, vw::Mutex & mutex, TerminalProgressCallback & tpc):
+        m_cam(cam), m_xyz(xyz), m_pixels(pixels), m_valid(valid), m_beg(beg), m_end(end),
+        m_mutex(mutex), m_tpc(tpc) {}
+
+      void operator()() {
+        for (int k = m_beg; k < m_end; k++) {
+          try {
+            m_pixels[k] = m_cam->point_to_pixel(m_xyz[k]);
+            m_valid[k]  = 1;
+          } catch (const std::exception&) {
+            m_valid[k]  = 0;
+          }
+        }
+        vw::Mutex::Lock lock(m_mutex);
+        m_tpc.report_incremental_progress(double(m_end - m_beg)/std::max(size_t(1), m_xyz.size()));
+      }
+    };
+  }
+
+  void project_points_to_camera(camera::CameraModel const* cam,
+                                std::vector<Vector3> const& xyz,
+                                int num_threads,
+                                std::vector<Vector2> & pixels,
+                                std::vector<char>    & valid) {
+
+    int num_pts = xyz.size();
+    pixels.assign(num_pts, Vector2());
+    valid.assign(num_pts, 0);
+
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    vw::Mutex mutex;
+    tpc.report_progress(0);
+    if (num_threads <= 1) {
+      ProjectPointsTask task(cam, xyz, pixels, valid, 0, num_pts, mutex, tpc);
+      task();
+    }else{
+      int num_tasks = std::max(1, std::min(num_pts, 16*num_threads));
+      FifoWorkQueue queue(num_threads);
+      for (int t = 0; t < num_tasks; t++) {
+        int beg = (long long)num_pts*t/num_tasks;
+        int end = (long long)num_pts*(t + 1)/num_tasks;
+        if (beg >= end)
+          continue;
+        boost::shared_ptr<ProjectPointsTask>
+          task(new ProjectPointsTask(cam, xyz, pixels, valid, beg, end, mutex, tpc));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+    tpc.report_finished();
+  }
+
+  void normalize_point_pairs(std::vector<Vector3> const& llh,
+                             std::vector<Vector2> const& pixels,
+                             Vector3 const& llh_scale,   Vector3 const& llh_offset,
+                             Vector2 const& pixel_scale, Vector2 const& pixel_offset,
+                             Vector<double> & normalized_llh,
+                             Vector<double> & normalized_pixels) {
+
+    int num_pts = llh.size();
+    if (pixels.size() != llh.size())
+      vw_throw( ArgumentErr() << "Expecting as many pixels as lon-lat-heights.\n" );
+
+    normalized_llh.set_size(RPCModel::GEODETIC_COORD_SIZE*num_pts);
+    normalized_pixels.set_size(RPCModel::IMAGE_COORD_SIZE*num_pts
+                               + RpcSolveLMA::NUM_PENALTY_TERMS);
+    for (size_t i = 0; i < normalized_pixels.size(); i++) {
+      // Important: The extra penalty terms are all set to zero here.
+      normalized_pixels[i] = 0.0;
+    }
+
+    for (int pt = 0; pt < num_pts; pt++) {
+      subvector(normalized_llh, RPCModel::GEODETIC_COORD_SIZE*pt,
+                RPCModel::GEODETIC_COORD_SIZE) = elem_quot(llh[pt] - llh_offset, llh_scale);
+      subvector(normalized_pixels, RPCModel::IMAGE_COORD_SIZE*pt,
+                RPCModel::IMAGE_COORD_SIZE) = elem_quot(pixels[pt] - pixel_offset, pixel_scale);
+    }
+  }
+
+  double rpc_fit_errors(std::vector<Vector3> const& llh,
+                        std::vector<Vector2> const& pixels,
+                        Vector3 const& llh_scale,   Vector3 const& llh_offset,
+                        Vector2 const& pixel_scale, Vector2 const& pixel_offset,
+                        RPCModel::CoeffVec const& line_num,
+                        RPCModel::CoeffVec const& line_den,
+                        RPCModel::CoeffVec const& samp_num,
+                        RPCModel::CoeffVec const& samp_den,
+                        std::vector<double> & errors) {
+
+    errors.resize(llh.size());
+    double max_err = 0.0;
+    for (size_t i = 0; i < llh.size(); i++) {
+      Vector3 llh_n = elem_quot(llh[i] - llh_offset, llh_scale);
+      Vector2 pix_n = RPCModel::normalized_geodetic_to_normalized_pixel
+        (llh_n, line_num, line_den, samp_num, samp_den);
+      Vector2 pix   = elem_prod(pix_n, pixel_scale) + pixel_offset;
+      errors[i] = norm_2(pix - pixels[i]);
+      max_err   = std::max(max_err, errors[i]);
+    }
+    return max_err;
+  }
+
+  int add_poorly_fit_points(std::vector<Vector3> const& check_llh,
+                            std::vector<Vector2> const& check_pixels,
+                            std::vector<double>  const& errors,
+                            double max_error,
+                            std::vector<Vector3> & llh,
+                            std::vector<Vector2> & pixels) {
+    int num_added = 0;
+    for (size_t i = 0; i < check_llh.size(); i++) {
+      if (errors[i] <= max_error)
+        continue;
+      llh.push_back(check_llh[i]);
+      pixels.push_back(check_pixels[i]);
+      num_added++;
+    }
+    return num_added;
+  }
+
 }
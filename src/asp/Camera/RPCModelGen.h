@@ -23,6 +23,12 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/LevenbergMarquardt.h>
 
+#include <vector>
+
+namespace vw { namespace camera {
+  class CameraModel;
+}}
+
 namespace asp {
 
   /// Unpack the 78 RPC coefficients from one long vector into four seperate vectors.
@@ -83,18 +89,12 @@ namespace asp {
       result_type result;
       result.set_size(m_normalizedPixels.size());
       
-      // Loop through each test point
-      for (int i = 0; i < numPts; i++){
-        // Unpack the normalized Geodetic coordinate
-        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE);
-        
-        // Project the normalized geodetic coordinate into the RPC camera to get a normalized pixel
-        vw::Vector2 pxn = RPCModel::normalized_geodetic_to_normalized_pixel(G, lineNum, lineDen, sampNum, sampDen);
-             
-        // Pack the normalized pixel into the output result vector
-        subvector(result, RPCModel::IMAGE_COORD_SIZE*i, RPCModel::IMAGE_COORD_SIZE) = pxn;
-
-      }
+      // Project all the normalized geodetics into the RPC camera at
+      // once, writing the normalized pixels at the start of the output.
+      if (numPts > 0)
+        RPCModel::normalized_geodetic_to_normalized_pixel(&m_normalizedGeodetics[0], numPts,
+                                                          lineNum, lineDen, sampNum, sampDen,
+                                                          &result[0]);
 
       // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
       // are 0-th degree, 4*3 = 12 are 1st degree, and the rest, 78 - 12
@@ -129,11 +129,26 @@ namespace asp {
                                    vw::Vector<double> const& actual_observation,
                                    RpcSolveLMA const& lma_model);
   
+  /// Fit the numerator and denominator of one of the normalized pixel
+  /// coordinates (0 for sample, 1 for line) by linear least squares,
+  /// as with the RpcSolveLMA cost function. Multiplying through by
+  /// the denominator makes the problem linear in the 39 coefficients.
+  /// The equations are weighted by the inverse of the previous
+  /// denominator and the solve is repeated, which converges to the
+  /// solution of the original problem. The 39x39 normal equations are
+  /// accumulated point by point, rather than forming the Jacobian for
+  /// all points. Return the RMS error in normalized pixels.
+  double fit_rpc_coord_linear(vw::Vector<double> const& normalized_geodetics,
+                              vw::Vector<double> const& normalized_pixels,
+                              int coord, double penalty_weight,
+                              RPCModel::CoeffVec & num, RPCModel::CoeffVec & den);
+
   int find_solution_from_seed(RpcSolveLMA    const& lma_model,
                               vw::Vector<double> const& seed_params,
                               vw::Vector<double> const& actual_observations,
                               vw::Vector<double>      & final_params,
-                              double              & norm_error);
+                              double              & norm_error,
+                              int                   max_iterations = 2000);
   
   void gen_rpc(// Inputs
                double penalty_weight,
@@ -149,6 +164,53 @@ namespace asp {
                RPCModel::CoeffVec & line_den,
                RPCModel::CoeffVec & samp_num,
                RPCModel::CoeffVec & samp_den);
+
+  // The functions below are the sampling shared by the tools which
+  // approximate a camera with an RPC model.
+
+  /// Project the points, in ECEF, into the camera, on the given
+  /// number of threads. A point which fails to project gets valid
+  /// set to 0. Do not use more than one thread with a camera which
+  /// is not thread-safe, such as an ISIS camera.
+  void project_points_to_camera(vw::camera::CameraModel const* cam,
+                                std::vector<vw::Vector3> const& xyz,
+                                int num_threads,
+                                std::vector<vw::Vector2> & pixels,
+                                std::vector<char>        & valid);
+
+  /// Normalize the lon-lat-height and pixel pairs to the -1 to 1
+  /// range, into the vectors gen_rpc() takes. The extra penalty
+  /// terms at the end of normalized_pixels are set to zero.
+  void normalize_point_pairs(std::vector<vw::Vector3> const& llh,
+                             std::vector<vw::Vector2> const& pixels,
+                             vw::Vector3 const& llh_scale,   vw::Vector3 const& llh_offset,
+                             vw::Vector2 const& pixel_scale, vw::Vector2 const& pixel_offset,
+                             vw::Vector<double> & normalized_llh,
+                             vw::Vector<double> & normalized_pixels);
+
+  /// The distance, in pixels, between the given pixels and the
+  /// projections of the given lon-lat-heights with the RPC model.
+  /// Return the largest one.
+  double rpc_fit_errors(std::vector<vw::Vector3> const& llh,
+                        std::vector<vw::Vector2> const& pixels,
+                        vw::Vector3 const& llh_scale,   vw::Vector3 const& llh_offset,
+                        vw::Vector2 const& pixel_scale, vw::Vector2 const& pixel_offset,
+                        RPCModel::CoeffVec const& line_num,
+                        RPCModel::CoeffVec const& line_den,
+                        RPCModel::CoeffVec const& samp_num,
+                        RPCModel::CoeffVec const& samp_den,
+                        std::vector<double> & errors);
+
+  /// Append to the fit points the check points at which the RPC
+  /// model is off by more than max_error pixels, so that the next fit
+  /// has more samples where the model is worst. Return how many were
+  /// added.
+  int add_poorly_fit_points(std::vector<vw::Vector3> const& check_llh,
+                            std::vector<vw::Vector2> const& check_pixels,
+                            std::vector<double>      const& errors,
+                            double max_error,
+                            std::vector<vw::Vector3> & llh,
+                            std::vector<vw::Vector2> & pixels);
 }
 
 #endif //__STEREO_CAMERA_RPC_MODEL_GEN_H__
@@ -23,6 +23,9 @@
 #include <vw/Camera/CameraModel.h>
 #include <vw/Cartography/Datum.h>
 
+#include <cmath>
+#include <limits>
+
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPCStereoModel.h>
 
@@ -57,6 +60,59 @@ namespace asp {
       }
 
     };
+
+    // Refine with least squares the point seen at the given pixels
+    Vector3 rpc_refine(RPCModel const* rpc_cam1, RPCModel const* rpc_cam2,
+                       Vector2 const& pix1, Vector2 const& pix2, Vector3 const& point) {
+
+      RPCTriangulateLMA model(rpc_cam1, rpc_cam2);
+      Vector4 objective(pix1[0], pix1[1], pix2[0], pix2[1]);
+      int status = 0;
+
+      Vector3 initialGeodetic = rpc_cam1->datum().cartesian_to_geodetic(point);
+
+      // To do: Find good values for the numbers controlling the convergence
+      Vector3 finalGeodetic = levenberg_marquardt( model, initialGeodetic,
+                                                   objective, status, 1e-3, 1e-6, 10 );
+
+      if ( status > 0 )
+        return rpc_cam1->datum().geodetic_to_cartesian(finalGeodetic);
+      return point;
+    }
+
+    inline bool is_finite(Vector2 const& v) {
+      return v[0] == v[0] && v[1] == v[1] &&
+        std::abs(v[0]) != std::numeric_limits<double>::infinity() &&
+        std::abs(v[1]) != std::numeric_limits<double>::infinity();
+    }
+
+    // The guesses for the lon-lat at the given columns: the solution of
+    // the previous row at the same column, or else the nearest one on
+    // the left, or else on the right. Empty if there is none.
+    void row_guesses(vector<Vector2> const& prev, vector<int> const& cols,
+                     vector<Vector2> & guesses) {
+
+      guesses.clear();
+      int width = prev.size();
+      int first = -1;
+      vector<Vector2> filled(prev);
+      for (int col = 0; col < width; col++) {
+        if (is_finite(prev[col])) {
+          if (first < 0)
+            first = col;
+        }else if (first >= 0) {
+          filled[col] = filled[col - 1];
+        }
+      }
+      if (first < 0)
+        return;
+      for (int col = 0; col < first; col++)
+        filled[col] = prev[first];
+
+      for (size_t k = 0; k < cols.size(); k++)
+        guesses.push_back(filled[cols[k]]);
+    }
+
   }
 
   Vector3 RPCStereoModel::operator()(vector<Vector2> const& pixVec,
@@ -118,18 +174,7 @@ namespace asp {
           vw::vw_throw(vw::NoImplErr() << "Least squares refinement is not "
                        << "implemented for multi-view stereo.");
 
-        detail::RPCTriangulateLMA model(rpc_cams[0], rpc_cams[1]);
-        Vector4 objective(pixVec[0][0], pixVec[0][1], pixVec[1][0], pixVec[1][1]);
-        int status = 0;
-
-        Vector3 initialGeodetic = rpc_cams[0]->datum().cartesian_to_geodetic(result);
-
-        // To do: Find good values for the numbers controlling the convergence
-        Vector3 finalGeodetic = levenberg_marquardt( model, initialGeodetic,
-                                                     objective, status, 1e-3, 1e-6, 10 );
-
-        if ( status > 0 )
-          result = rpc_cams[0]->datum().geodetic_to_cartesian(finalGeodetic);
+        result = detail::rpc_refine(rpc_cams[0], rpc_cams[1], pixVec[0], pixVec[1], result);
       } // End least squares case
 
 
@@ -152,4 +197,214 @@ namespace asp {
     return StereoModel::operator()(pix1, pix2, error);
   }
 
+  bool RPCStereoModel::are_rpc(vector<const vw::camera::CameraModel *> const& cameras) {
+    for (size_t p = 0; p < cameras.size(); p++) {
+      if (dynamic_cast<const RPCModel*>(cameras[p]) == NULL)
+        return false;
+    }
+    return !cameras.empty();
+  }
+
+  void RPCStereoModel::triangulate_row(vector< vector<Vector2> > const& pixels,
+                                       vector<bool> const& valid, RowSeeds & seeds,
+                                       vector<Vector3> & points,
+                                       vector<Vector3> & errors) const {
+
+    int num_cams = m_cameras.size();
+    VW_ASSERT((int)pixels.size() == num_cams,
+              vw::ArgumentErr() << "the number of rays must match "
+                                << "the number of cameras.\n");
+    int width = valid.size();
+    points.assign(width, Vector3());
+    errors.assign(width, Vector3());
+
+    vector<const RPCModel*> rpc_cams(num_cams);
+    for (int p = 0; p < num_cams; p++) {
+      rpc_cams[p] = dynamic_cast<const RPCModel*>(m_cameras[p]);
+      VW_ASSERT(rpc_cams[p] != NULL,
+                vw::ArgumentErr() << "Camera models are not RPC.\n");
+    }
+
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    if ((int)seeds.up.size() != num_cams) {
+      seeds.up.assign(num_cams, vector<Vector2>(width, Vector2(nan, nan)));
+      seeds.dn.assign(num_cams, vector<Vector2>(width, Vector2(nan, nan)));
+    }
+
+    // For each camera, find the lon-lat of all the pixels at the
+    // heights of the rays, with Newton's method. The neighboring pixel
+    // on the previous row gives a guess within a fraction of a pixel,
+    // so one or two iterations are enough. Without a previous row, the
+    // first pixel of the row is solved from scratch, and used as the
+    // guess for the others.
+    vector< vector<Vector2> > lonlats_up(num_cams), lonlats_dn(num_cams);
+    vector<double> heights_up(num_cams), heights_dn(num_cams);
+    vector<int> cols;
+    vector<Vector2> pix, lonlats;
+    vector<double> heights;
+    for (int p = 0; p < num_cams; p++) {
+
+      rpc_cams[p]->ray_heights(heights_up[p], heights_dn[p]);
+      lonlats_up[p].assign(width, Vector2(nan, nan));
+      lonlats_dn[p].assign(width, Vector2(nan, nan));
+
+      cols.clear();
+      pix.clear();
+      for (int col = 0; col < width; col++) {
+        if (valid[col] && detail::is_finite(pixels[p][col])) {
+          cols.push_back(col);
+          pix.push_back(pixels[p][col]);
+        }
+      }
+      int num_pts = cols.size();
+      if (num_pts == 0)
+        continue;
+
+      detail::row_guesses(seeds.up[p], cols, lonlats);
+      if (lonlats.empty()) {
+        vector<Vector2> first_pix(1, pix[0]), first_lonlat;
+        rpc_cams[p]->image_to_ground(first_pix, vector<double>(1, heights_up[p]), first_lonlat);
+        lonlats.assign(num_pts, first_lonlat[0]);
+      }
+      heights.assign(num_pts, heights_up[p]);
+      rpc_cams[p]->image_to_ground(pix, heights, lonlats);
+      for (int k = 0; k < num_pts; k++) {
+        lonlats_up[p][cols[k]] = lonlats[k];
+        seeds.up[p][cols[k]]   = lonlats[k];
+      }
+
+      // Lower down, the guess is the same pixel higher up if there is
+      // no previous row, as in point_and_dir().
+      for (int k = 0; k < num_pts; k++) {
+        Vector2 guess = seeds.dn[p][cols[k]];
+        lonlats[k] = detail::is_finite(guess) ? guess : lonlats_up[p][cols[k]];
+      }
+      heights.assign(num_pts, heights_dn[p]);
+      rpc_cams[p]->image_to_ground(pix, heights, lonlats);
+      for (int k = 0; k < num_pts; k++) {
+        lonlats_dn[p][cols[k]] = lonlats[k];
+        seeds.dn[p][cols[k]]   = lonlats[k];
+      }
+    }
+
+    // Intersect the rays. With direct intersection, the columns to do
+    // are set aside, with the height where the ground tracks of the two
+    // pixels meet if they are taken as straight.
+    bool direct = (m_direct_intersection && num_cams == 2);
+    vector<int> direct_cols;
+    vector<double> direct_heights;
+    vector<Vector3> camDirs, camCtrs;
+    for (int col = 0; col < width; col++) {
+      if (!valid[col])
+        continue;
+
+      camDirs.clear();
+      camCtrs.clear();
+      for (int p = 0; p < num_cams; p++) {
+        if (!detail::is_finite(lonlats_up[p][col]) || !detail::is_finite(lonlats_dn[p][col]))
+          continue;
+        Vector3 ctr, dir;
+        rpc_cams[p]->lonlats_to_ray(lonlats_up[p][col], lonlats_dn[p][col], ctr, dir);
+        camDirs.push_back(dir);
+        camCtrs.push_back(ctr);
+      }
+
+      // Not enough valid rays
+      if (camDirs.size() < 2)
+        continue;
+
+      if (are_nearly_parallel(m_least_squares, m_angle_tol, camDirs))
+        continue;
+
+      if (direct) {
+        // The tracks are g_p(h) = g_p(h_dn) + s_p*(h - h_dn), with lon
+        // scaled to be in the same units as lat. Find where their
+        // difference D + S*(h - h_dn_0) is smallest.
+        double c = cos(lonlats_dn[0][col][1]*M_PI/180.0);
+        Vector2 D, S;
+        for (int p = 0; p < 2; p++) {
+          Vector2 slope = (lonlats_up[p][col] - lonlats_dn[p][col])
+            / (heights_up[p] - heights_dn[p]);
+          Vector2 start = lonlats_dn[p][col] + slope*(heights_dn[0] - heights_dn[p]);
+          double sign = (p == 0) ? 1.0 : -1.0;
+          D += sign*Vector2(c*start[0], start[1]);
+          S += sign*Vector2(c*slope[0], slope[1]);
+        }
+        double len2 = dot_prod(S, S);
+        if (!(len2 > 0.0))
+          continue;
+        direct_cols.push_back(col);
+        direct_heights.push_back(heights_dn[0] - dot_prod(D, S)/len2);
+        continue;
+      }
+
+      // Determine range by triangulation
+      Vector3 result = triangulate_point(camDirs, camCtrs, errors[col]);
+
+      if ( m_least_squares ){
+        if (num_cams != 2)
+          vw::vw_throw(vw::NoImplErr() << "Least squares refinement is not "
+                       << "implemented for multi-view stereo.");
+        result = detail::rpc_refine(rpc_cams[0], rpc_cams[1],
+                                    pixels[0][col], pixels[1][col], result);
+      }
+
+      // Reflect points that fall behind one of the two cameras
+      bool reflect = false;
+      for (int p = 0; p < (int)camCtrs.size(); p++)
+        if (dot_prod(result - camCtrs[p], camDirs[p]) < 0 ) reflect = true;
+      if (reflect)
+        result = -result + 2*camCtrs[0];
+
+      points[col] = result;
+    }
+
+    int num_direct = direct_cols.size();
+    if (num_direct == 0)
+      return;
+
+    // The tracks are not quite straight, so find the lon-lat of the
+    // pixels at the estimated height, starting from the straight
+    // tracks, and correct the height by one more step.
+    vector< vector<Vector2> > lonlats_mid(2);
+    vector< Vector2 > slopes(2*num_direct);
+    for (int p = 0; p < 2; p++) {
+      pix.resize(num_direct);
+      lonlats_mid[p].resize(num_direct);
+      for (int k = 0; k < num_direct; k++) {
+        int col = direct_cols[k];
+        Vector2 slope = (lonlats_up[p][col] - lonlats_dn[p][col])
+          / (heights_up[p] - heights_dn[p]);
+        pix[k] = pixels[p][col];
+        lonlats_mid[p][k] = lonlats_dn[p][col] + slope*(direct_heights[k] - heights_dn[p]);
+        slopes[2*k + p] = slope;
+      }
+      rpc_cams[p]->image_to_ground(pix, direct_heights, lonlats_mid[p]);
+    }
+
+    cartography::Datum const& datum = rpc_cams[0]->datum();
+    for (int k = 0; k < num_direct; k++) {
+      double c = cos(lonlats_mid[0][k][1]*M_PI/180.0);
+      Vector2 D = lonlats_mid[0][k] - lonlats_mid[1][k];
+      Vector2 S = slopes[2*k] - slopes[2*k + 1];
+      D[0] *= c;
+      S[0] *= c;
+      double dh = -dot_prod(D, S)/dot_prod(S, S);
+      double height = direct_heights[k] + dh;
+      Vector2 lonlat0 = lonlats_mid[0][k] + slopes[2*k]*dh;
+      Vector2 lonlat1 = lonlats_mid[1][k] + slopes[2*k + 1]*dh;
+
+      Vector3 P0 = datum.geodetic_to_cartesian(Vector3(lonlat0[0], lonlat0[1], height));
+      Vector3 P1 = datum.geodetic_to_cartesian(Vector3(lonlat1[0], lonlat1[1], height));
+      Vector3 result = (P0 + P1)/2.0;
+
+      int col = direct_cols[k];
+      if ( m_least_squares )
+        result = detail::rpc_refine(rpc_cams[0], rpc_cams[1],
+                                    pixels[0][col], pixels[1][col], result);
+      points[col] = result;
+      errors[col] = P0 - P1;
+    }
+  }
+
 } // namespace asp
@@ -44,13 +44,15 @@ namespace asp {
     RPCStereoModel(std::vector<const vw::camera::CameraModel *> const& cameras,
                    bool least_squares_refine = false,
                    double angle_tol = 0.0):
-      vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol){}
+      vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol),
+      m_direct_intersection(false){}
       
     RPCStereoModel(vw::camera::CameraModel const* camera_model1,
                    vw::camera::CameraModel const* camera_model2,
                    bool least_squares_refine = false,
                    double angle_tol = 0.0):
-      vw::stereo::StereoModel(camera_model1, camera_model2, least_squares_refine, angle_tol){}
+      vw::stereo::StereoModel(camera_model1, camera_model2, least_squares_refine, angle_tol),
+      m_direct_intersection(false){}
     
     virtual ~RPCStereoModel() {}
     
@@ -64,6 +66,36 @@ namespace asp {
     virtual vw::Vector3 operator()(vw::Vector2 const& pix1,
                                    vw::Vector2 const& pix2,
                                    double& error) const;
+
+    /// True if all cameras are RPC models themselves, not adjusted or
+    /// otherwise wrapped, as triangulate_row() needs.
+    static bool are_rpc(std::vector<const vw::camera::CameraModel *> const& cameras);
+
+    /// With two cameras, have triangulate_row() intersect the ground
+    /// tracks of the pixels, that is, their lon-lat as a function of
+    /// height, rather than the straight rays through two of their points.
+    void set_direct_intersection(bool direct) { m_direct_intersection = direct; }
+
+    /// The lon-lat of the pixels of the last row, for each camera and
+    /// column, at the heights where the rays are found. These are the
+    /// Newton guesses for the next row.
+    struct RowSeeds {
+      std::vector< std::vector<vw::Vector2> > up, dn;
+    };
+
+    /// Triangulate a row of pixels, with pixels[c][col] the pixel in
+    /// camera c, NaN if not seen in it, and only the columns marked
+    /// valid triangulated. This gives the same results as
+    /// operator(), but the lon-lat of all the pixels of a camera are
+    /// found together, with the ones of the previous row as guesses,
+    /// so the seeds must be kept from one row to the next.
+    void triangulate_row(std::vector< std::vector<vw::Vector2> > const& pixels,
+                         std::vector<bool> const& valid, RowSeeds & seeds,
+                         std::vector<vw::Vector3> & points,
+                         std::vector<vw::Vector3> & errors) const;
+
+  private:
+    bool m_direct_intersection;
   };
   
 } // namespace asp
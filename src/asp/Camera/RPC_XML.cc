@@ -27,6 +27,7 @@
 #include <asp/Camera/XMLBase.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <xercesc/framework/MemBufInputSource.hpp>
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/sax/HandlerBase.hpp>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -35,6 +36,10 @@
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
 using namespace vw;
 using namespace vw::cartography;
 using namespace xercesc;
@@ -102,6 +107,70 @@ void parse_index(DOMElement* model, std::string const& prefix, size_t index, Vec
 
   cast_xmlch( get_node<DOMElement>( model, field.c_str() )->getTextContent(), vals[index] );
 }
+
+// Parse the numbers in each <item_tag>...</item_tag> element in the
+// text of a list such as EPHEMLISTList, as they come, with strtod.
+// Each item must have at least min_values numbers. Up to max_values
+// are kept, with any missing ones set to zero. Return the number of items.
+size_t parse_list_text(std::string const& text, std::string const& item_tag,
+                       size_t min_values, size_t max_values, std::vector<double> & values) {
+  std::string open_tag  = "<"  + item_tag + ">";
+  std::string close_tag = "</" + item_tag + ">";
+  values.clear();
+  size_t count = 0, pos = 0;
+  while ( (pos = text.find(open_tag, pos)) != std::string::npos ) {
+    pos += open_tag.size();
+    size_t end = text.find(close_tag, pos);
+    if (end == std::string::npos)
+      vw_throw( ArgumentErr() << "Missing " << close_tag << " in XML list.\n" );
+
+    // strtod stops at the '<' of the closing tag
+    const char* ptr = text.c_str() + pos;
+    const char* item_end = text.c_str() + end;
+    size_t num = 0;
+    for ( ; num < max_values; num++ ) {
+      char* next = NULL;
+      double val = std::strtod(ptr, &next);
+      if (next == ptr || next > item_end)
+        break;
+      values.push_back(val);
+      ptr = next;
+    }
+    if (num < min_values)
+      vw_throw( ArgumentErr() << "Failed to parse the numbers in XML list item: "
+                << text.substr(pos, end - pos) << "\n" );
+    values.resize(values.size() + max_values - num, 0.0);
+
+    pos = end + close_tag.size();
+    count++;
+  }
+  return count;
+}
+
+// The index of a list item. These start from 1, but are written as
+// floats.
+size_t list_index(double val, size_t num_items) {
+  size_t index = size_t(val + 0.5) - 1;
+  if (val < 0.5 || index >= num_items)
+    vw_throw( ArgumentErr() << "Out of range index in XML list: " << val << "\n" );
+  return index;
+}
+
+// Find the text inside <tag>...</tag>, and remove it from the XML.
+// Return false if the tag is not found exactly once.
+bool extract_element_text(std::string & xml, std::string const& tag, std::string & text) {
+  std::string open_tag = "<" + tag + ">", close_tag = "</" + tag + ">";
+  size_t beg = xml.find(open_tag);
+  if (beg == std::string::npos || xml.find(open_tag, beg + 1) != std::string::npos)
+    return false;
+  beg += open_tag.size();
+  size_t end = xml.find(close_tag, beg);
+  if (end == std::string::npos)
+    return false;
+  text = xml.substr(beg, end - beg);
+  xml.erase(beg, end - beg);
+  return true;
+}
   
 }
 
@@ -341,10 +410,30 @@ void asp::EphemerisXML::parse_eph_list( xercesc::DOMElement* node ) {
 
 asp::EphemerisXML::EphemerisXML() : BitChecker(2) {}
 
-void asp::EphemerisXML::parse( xercesc::DOMElement* node ) {
+void asp::EphemerisXML::parse_eph_list_text( std::string const& text ) {
+  const size_t NUM_VALUES = 13; // index, position, velocity, covariance
+  std::vector<double> values;
+  size_t count = parse_list_text( text, "EPHEMLIST", 7, NUM_VALUES, values );
+  VW_ASSERT( count == position_vec.size(),
+             IOErr() << "Read incorrect number of points." );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const double* v = &values[i*NUM_VALUES];
+    size_t index = list_index( v[0], count );
+    position_vec[index] = Vector3( v[1], v[2], v[3] );
+    velocity_vec[index] = Vector3( v[4], v[5], v[6] );
+    for ( size_t k = 0; k < 6; k++ )
+      covariance_vec[index][k] = v[7+k];
+  }
+  check_argument(1);
+}
+
+void asp::EphemerisXML::parse( xercesc::DOMElement* node, bool skip_list ) {
   parse_meta( node );
   check_argument(0);
 
+  if ( skip_list )
+    return;
   parse_eph_list( get_node<DOMElement>( node, "EPHEMLISTList" ) );
   check_argument(1);
 }
@@ -400,10 +489,29 @@ void asp::AttitudeXML::parse_att_list( xercesc::DOMElement* node ) {
 
 asp::AttitudeXML::AttitudeXML() : BitChecker(2) {}
 
-void asp::AttitudeXML::parse( xercesc::DOMElement* node ) {
+void asp::AttitudeXML::parse_att_list_text( std::string const& text ) {
+  const size_t NUM_VALUES = 15; // index, quaternion, covariance
+  std::vector<double> values;
+  size_t count = parse_list_text( text, "ATTLIST", 5, NUM_VALUES, values );
+  VW_ASSERT( count == quat_vec.size(),
+             IOErr() << "Read incorrect number of points." );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const double* v = &values[i*NUM_VALUES];
+    size_t index = list_index( v[0], count );
+    quat_vec[index] = Quat( v[4], v[1], v[2], v[3] );
+    for ( size_t k = 0; k < 10; k++ )
+      covariance_vec[index][k] = v[5+k];
+  }
+  check_argument(1);
+}
+
+void asp::AttitudeXML::parse( xercesc::DOMElement* node, bool skip_list ) {
   parse_meta( node );
   check_argument(0);
 
+  if ( skip_list )
+    return;
   parse_att_list( get_node<DOMElement>( node, "ATTLISTList" ) );
   check_argument(1);
 }
@@ -653,6 +761,19 @@ void asp::read_xml( std::string const& filename,
   if ( !fs::exists( filename ) )
     vw_throw( ArgumentErr() << "XML file \"" << filename << "\" does not exist." );
 
+  // The ephemeris and attitude lists are most of the file for a long
+  // strip. Take them out of the text, so no DOM is made for them,
+  // and parse them directly. If they are not found as expected,
+  // leave them to the DOM parser.
+  std::string xml;
+  {
+    std::ifstream ifs( filename.c_str(), std::ios::binary );
+    xml.assign( (std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>() );
+  }
+  std::string eph_text, att_text;
+  bool eph_from_text = extract_element_text( xml, "EPHEMLISTList", eph_text );
+  bool att_from_text = extract_element_text( xml, "ATTLISTList",   att_text );
+
   try{
     boost::scoped_ptr<XercesDOMParser> parser( new XercesDOMParser() );
     parser->setValidationScheme(XercesDOMParser::Val_Always);
@@ -660,7 +781,9 @@ void asp::read_xml( std::string const& filename,
     boost::scoped_ptr<ErrorHandler> errHandler( new HandlerBase() );
     parser->setErrorHandler(errHandler.get());
 
-    parser->parse( filename.c_str() );
+    MemBufInputSource source( reinterpret_cast<const XMLByte*>( xml.data() ), xml.size(),
+                              filename.c_str(), false );
+    parser->parse( source );
     DOMDocument* xmlDoc = parser->getDocument();
     DOMElement* elementRoot = xmlDoc->getDocumentElement();
 
@@ -675,10 +798,15 @@ void asp::read_xml( std::string const& filename,
 
         if ( tag == "GEO" )
           geo.parse( curr_element );
-        else if ( tag == "EPH" )
-          eph.parse( curr_element );
-        else if ( tag == "ATT" )
-          att.parse( curr_element );
+        else if ( tag == "EPH" ) {
+          eph.parse( curr_element, eph_from_text );
+          if ( eph_from_text )
+            eph.parse_eph_list_text( eph_text );
+        } else if ( tag == "ATT" ) {
+          att.parse( curr_element, att_from_text );
+          if ( att_from_text )
+            att.parse_att_list_text( att_text );
+        }
         else if ( tag == "IMD" )
           img.parse( curr_element );
         else if ( tag == "RPB" )
@@ -112,7 +112,14 @@ namespace asp {
   public:
     EphemerisXML();
 
-    void parse( xercesc::DOMElement* node );
+    /// If skip_list is true, the EPHEMLISTList element is not read,
+    /// and parse_eph_list_text() must be called afterwards.
+    void parse( xercesc::DOMElement* node, bool skip_list = false );
+
+    /// Read the ephemeris from the text inside the EPHEMLISTList
+    /// element, without making a DOM for it, which for a long strip
+    /// is most of the file.
+    void parse_eph_list_text( std::string const& text );
 
     std::string start_time;      // UTC
     double time_interval;        // seconds
@@ -130,7 +137,9 @@ namespace asp {
   public:
     AttitudeXML();
 
-    void parse( xercesc::DOMElement* node );
+    /// As for EphemerisXML, for the ATTLISTList element.
+    void parse( xercesc::DOMElement* node, bool skip_list = false );
+    void parse_att_list_text( std::string const& text );
 
     std::string start_time;
     double time_interval;
@@ -0,0 +1,265 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+using namespace vw;
+
+namespace {
+  // Stop refining when the grid would have more nodes than this
+  const int MAX_GRID_NODES = 4000000;
+
+  double angle_between(Vector3 const& a, Vector3 const& b) {
+    // atan2 of the cross and dot products is accurate also for tiny angles
+    return std::atan2(norm_2(cross_prod(a, b)), dot_prod(a, b));
+  }
+}
+
+RayGridCameraModel::RayGridCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_cam,
+                                       vw::BBox2i const& image_box,
+                                       double max_angle_error, double max_center_error,
+                                       std::string const& grid_file):
+  m_exact_cam(exact_cam), m_image_box(image_box),
+  m_max_angle_error(max_angle_error), m_max_center_error(max_center_error), m_spacing(0) {
+
+  if (m_exact_cam.get() == NULL)
+    vw_throw( ArgumentErr() << "RayGridCameraModel: Expecting a camera model.\n" );
+  if (m_image_box.empty())
+    vw_throw( ArgumentErr() << "RayGridCameraModel: Expecting a non-empty pixel box.\n" );
+  if (m_max_angle_error <= 0 || m_max_center_error <= 0)
+    vw_throw( ArgumentErr() << "RayGridCameraModel: Expecting positive tolerances.\n" );
+
+  if (grid_file != "" && fs::exists(grid_file) && read(grid_file)) {
+    vw_out() << "Read camera ray grid: " << grid_file << "\n";
+    return;
+  }
+
+  // Start with a few cells along the longer side of the box
+  double spacing = std::max(m_image_box.width(), m_image_box.height())/8.0;
+  while (1) {
+    double angle_error = 0, center_error = 0;
+    sample(spacing, angle_error, center_error);
+    if (angle_error <= m_max_angle_error && center_error <= m_max_center_error)
+      break;
+
+    double next_spacing = spacing/2.0;
+    double num_nodes = (m_image_box.width()/next_spacing + 2.0)*(m_image_box.height()/next_spacing + 2.0);
+    if (next_spacing < 1.0 || num_nodes > MAX_GRID_NODES) {
+      vw_out(WarningMessage) << "Could not make the camera ray grid accurate to within the "
+                             << "given tolerances. The errors in angle and camera center are "
+                             << angle_error << " radians and " << center_error << " meters.\n";
+      break;
+    }
+    spacing = next_spacing;
+  }
+  vw_out() << "Camera ray grid spacing: " << m_spacing << " pixels.\n";
+
+  if (grid_file != "") {
+    // Write to a temporary file and rename it, as several processes
+    // may be creating the same grid
+    std::ostringstream os;
+    os << grid_file << ".tmp" << ::getpid();
+    if (write(os.str()))
+      fs::rename(os.str(), grid_file);
+    else
+      vw_out(WarningMessage) << "Could not write: " << grid_file << "\n";
+  }
+}
+
+void RayGridCameraModel::sample(double spacing, double & angle_error, double & center_error) {
+
+  m_spacing = spacing;
+  int cols = int(std::ceil(m_image_box.width() /m_spacing)) + 1;
+  int rows = int(std::ceil(m_image_box.height()/m_spacing)) + 1;
+  m_dirs.set_size(cols, rows);
+  m_centers.set_size(cols, rows);
+  m_valid.set_size(cols, rows);
+
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      Vector2 pix = Vector2(m_image_box.min()) + m_spacing*Vector2(col, row);
+      m_valid(col, row) = 0;
+      try {
+        m_dirs   (col, row) = m_exact_cam->pixel_to_vector(pix);
+        m_centers(col, row) = m_exact_cam->camera_center(pix);
+        m_valid  (col, row) = 1;
+      } catch (...) {}
+    }
+  }
+
+  // Compare with the exact camera at the middle of each cell, where
+  // the bilinear interpolation is least accurate
+  angle_error = 0; center_error = 0;
+  for (int row = 0; row < rows - 1; row++) {
+    for (int col = 0; col < cols - 1; col++) {
+      Vector2 pix = Vector2(m_image_box.min()) + m_spacing*Vector2(col + 0.5, row + 0.5);
+      if (!m_image_box.contains(pix))
+        continue;
+      Vector3 dir, ctr;
+      try {
+        dir = m_exact_cam->pixel_to_vector(pix);
+        ctr = m_exact_cam->camera_center(pix);
+      } catch (...) {
+        continue;
+      }
+      angle_error  = std::max(angle_error,  angle_between(pixel_to_vector(pix), dir));
+      center_error = std::max(center_error, norm_2(camera_center(pix) - ctr));
+    }
+  }
+}
+
+bool RayGridCameraModel::find_cell(vw::Vector2 const& pix, int & col, int & row,
+                                   double & wx, double & wy) const {
+
+  if (m_spacing <= 0 || m_dirs.cols() < 2 || m_dirs.rows() < 2)
+    return false;
+
+  double x = (pix.x() - m_image_box.min().x())/m_spacing;
+  double y = (pix.y() - m_image_box.min().y())/m_spacing;
+  if (!(x >= 0 && y >= 0 && x <= m_dirs.cols() - 1 && y <= m_dirs.rows() - 1))
+    return false; // also catches NaN
+
+  col = std::min(int(x), m_dirs.cols() - 2);
+  row = std::min(int(y), m_dirs.rows() - 2);
+  wx = x - col;
+  wy = y - row;
+
+  return m_valid(col, row) && m_valid(col + 1, row) &&
+    m_valid(col, row + 1) && m_valid(col + 1, row + 1);
+}
+
+vw::Vector3 RayGridCameraModel::pixel_to_vector(vw::Vector2 const& pix) const {
+  int col, row;
+  double wx, wy;
+  if (!find_cell(pix, col, row, wx, wy))
+    return m_exact_cam->pixel_to_vector(pix);
+
+  Vector3 dir = (1 - wy)*((1 - wx)*m_dirs(col, row    ) + wx*m_dirs(col + 1, row    ))
+    +                wy*((1 - wx)*m_dirs(col, row + 1) + wx*m_dirs(col + 1, row + 1));
+  return normalize(dir);
+}
+
+vw::Vector3 RayGridCameraModel::camera_center(vw::Vector2 const& pix) const {
+  int col, row;
+  double wx, wy;
+  if (!find_cell(pix, col, row, wx, wy))
+    return m_exact_cam->camera_center(pix);
+
+  return (1 - wy)*((1 - wx)*m_centers(col, row    ) + wx*m_centers(col + 1, row    ))
+    +          wy*((1 - wx)*m_centers(col, row + 1) + wx*m_centers(col + 1, row + 1));
+}
+
+vw::Vector2 RayGridCameraModel::point_to_pixel(vw::Vector3 const& point) const {
+  return m_exact_cam->point_to_pixel(point);
+}
+
+bool RayGridCameraModel::write(std::string const& grid_file) const {
+
+  std::ofstream ofs(grid_file.c_str());
+  if (!ofs.good())
+    return false;
+
+  ofs << std::setprecision(17);
+  ofs << "RayGrid\n";
+  ofs << m_image_box.min().x() << ' ' << m_image_box.min().y() << ' '
+      << m_image_box.max().x() << ' ' << m_image_box.max().y() << "\n";
+  ofs << m_max_angle_error << ' ' << m_max_center_error << "\n";
+  ofs << m_spacing << ' ' << m_dirs.cols() << ' ' << m_dirs.rows() << "\n";
+  for (int row = 0; row < m_dirs.rows(); row++) {
+    for (int col = 0; col < m_dirs.cols(); col++) {
+      Vector3 const& d = m_dirs(col, row);
+      Vector3 const& c = m_centers(col, row);
+      ofs << int(m_valid(col, row)) << ' '
+          << d[0] << ' ' << d[1] << ' ' << d[2] << ' '
+          << c[0] << ' ' << c[1] << ' ' << c[2] << "\n";
+    }
+  }
+  ofs.close();
+  return ofs.good();
+}
+
+bool RayGridCameraModel::read(std::string const& grid_file) {
+
+  std::ifstream ifs(grid_file.c_str());
+  std::string tag;
+  BBox2i box;
+  double angle_error, center_error, spacing;
+  int cols, rows;
+  if (!(ifs >> tag) || tag != "RayGrid")
+    return false;
+  if (!(ifs >> box.min().x() >> box.min().y() >> box.max().x() >> box.max().y()
+        >> angle_error >> center_error >> spacing >> cols >> rows))
+    return false;
+
+  // The grid must have been made the same way
+  if (box != m_image_box || angle_error != m_max_angle_error ||
+      center_error != m_max_center_error || spacing <= 0 || cols < 2 || rows < 2)
+    return false;
+
+  m_spacing = spacing;
+  m_dirs.set_size(cols, rows);
+  m_centers.set_size(cols, rows);
+  m_valid.set_size(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      int valid;
+      Vector3 & d = m_dirs(col, row);
+      Vector3 & c = m_centers(col, row);
+      if (!(ifs >> valid >> d[0] >> d[1] >> d[2] >> c[0] >> c[1] >> c[2])) {
+        m_spacing = 0;
+        return false;
+      }
+      m_valid(col, row) = (valid != 0);
+    }
+  }
+
+  // The exact camera may have changed since the grid was written, as
+  // with new adjustments. Check the nodes at the corners and center.
+  int check_cols[] = {0, cols - 1, 0,        cols - 1, cols/2};
+  int check_rows[] = {0, 0,        rows - 1, rows - 1, rows/2};
+  for (int k = 0; k < 5; k++) {
+    int col = check_cols[k], row = check_rows[k];
+    if (!m_valid(col, row))
+      continue;
+    Vector2 pix = Vector2(m_image_box.min()) + m_spacing*Vector2(col, row);
+    try {
+      if (angle_between(m_dirs(col, row), m_exact_cam->pixel_to_vector(pix)) > m_max_angle_error ||
+          norm_2(m_centers(col, row) - m_exact_cam->camera_center(pix)) > m_max_center_error) {
+        m_spacing = 0;
+        return false;
+      }
+    } catch (...) {}
+  }
+
+  return true;
+}
+
+} // namespace asp
@@ -0,0 +1,96 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file RayGridCameraModel.h
+///
+/// A camera model which interpolates the rays of another camera from
+/// their values on a grid of pixels. This is for cameras such as ISIS,
+/// DG and ASTER, for which pixel_to_vector() and camera_center() are
+/// expensive, but which vary smoothly over the image.
+///
+#ifndef __STEREO_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+#define __STEREO_CAMERA_RAY_GRID_CAMERA_MODEL_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class RayGridCameraModel : public vw::camera::CameraModel {
+  public:
+
+    /// Sample the rays of the exact camera on a grid over the given
+    /// box of pixels. Halve the grid spacing until, at the middle of
+    /// each cell, the interpolated direction is within max_angle_error
+    /// (in radians) of the exact one, and the interpolated camera
+    /// center is within max_center_error (in meters) of the exact one.
+    /// If grid_file is not empty and has a grid for the same box and
+    /// tolerances which agrees with the exact camera, read it from
+    /// there, else compute it and write it there.
+    RayGridCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_cam,
+                       vw::BBox2i const& image_box,
+                       double max_angle_error, double max_center_error,
+                       std::string const& grid_file = "");
+
+    virtual ~RayGridCameraModel() {}
+    virtual std::string type() const { return "RayGrid"; }
+
+    /// Interpolated in the grid. Outside of it, or in cells with a
+    /// corner at which the exact camera failed, use the exact camera.
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+    virtual vw::Vector3 camera_center  (vw::Vector2 const& pix) const;
+
+    /// This is not approximated.
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+
+    /// Units are pixels
+    double grid_spacing() const { return m_spacing; }
+
+    /// Write the grid to a text file. Return false on failure.
+    bool write(std::string const& grid_file) const;
+
+  private:
+
+    /// Find the grid cell and the position in it. Return false if
+    /// the exact camera must be used.
+    bool find_cell(vw::Vector2 const& pix, int & col, int & row, double & wx, double & wy) const;
+
+    /// Fill the grid with the given spacing, and return the largest
+    /// errors at the cell centers.
+    void sample(double spacing, double & angle_error, double & center_error);
+
+    /// Read the grid, and check a few rays against the exact camera.
+    bool read(std::string const& grid_file);
+
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_cam;
+    vw::BBox2i m_image_box;
+    double m_max_angle_error, m_max_center_error;
+
+    double m_spacing;
+    vw::ImageView<vw::Vector3> m_dirs, m_centers;
+    vw::ImageView<vw::uint8>   m_valid;
+  };
+
+} // namespace asp
+
+#endif // __STEREO_CAMERA_RAY_GRID_CAMERA_MODEL_H__
@@ -0,0 +1,180 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BenchCameraModels.cxx
+///
+/// Time the camera models in this directory on the test fixtures, with
+/// one thread and with many, on a grid of pixels and on random pixels.
+/// This is not run by "make check". Build it with "make BenchCameraModels",
+/// then run
+///
+///   BenchCameraModels [num_points] [num_threads] [output.csv]
+///
+/// The results go to standard output if no output file is given. They
+/// are written as JSON if the output file name ends in .json.
+
+#include <asp/Camera/CameraBenchmark.h>
+#include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/AdjustedLinescanDGModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Exception.h>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <fstream>
+
+using namespace vw;
+using namespace asp;
+
+typedef boost::shared_ptr<camera::CameraModel> CamPtr;
+
+namespace {
+
+  struct NamedCamera {
+    std::string name;
+    CamPtr      cam;
+    BBox2       box;
+    NamedCamera(std::string const& n, CamPtr c, BBox2 const& b): name(n), cam(c), box(b){}
+  };
+
+  std::string fixture(std::string const& file){
+    return std::string(TEST_SRCDIR) + "/" + file;
+  }
+
+  // Small made-up piecewise adjustments, so that the wrappers do the
+  // same interpolation work as after jitter_adjust.
+  void make_adjustments(int num_lines, Vector2 & bounds,
+                        std::vector<Vector3> & positions, std::vector<Quat> & poses){
+    bounds = Vector2(0, num_lines - 1);
+    positions.clear();
+    poses.clear();
+    int num_adj = 5;
+    for (int k = 0; k < num_adj; k++){
+      positions.push_back(Vector3(0.3*k, -0.2*k, 0.1));
+      poses.push_back(Quat(1, 1e-7*k, -1e-7*k, 0));
+      poses.back() = normalize(poses.back());
+    }
+  }
+
+  std::vector<NamedCamera> load_cameras(){
+
+    std::vector<NamedCamera> cameras;
+
+    RPCXML rpc_xml;
+    rpc_xml.read_from_file(fixture("dg_example1.xml"));
+    CamPtr rpc(new RPCModel(*rpc_xml.rpc_ptr()));
+
+    boost::shared_ptr<DGCameraModel> dg = load_dg_camera_model_from_xml(fixture("dg_example1.xml"));
+    Vector2i dg_size = dg->get_image_size();
+    BBox2    dg_box(0, 0, dg_size.x() - 1, dg_size.y() - 1);
+    cameras.push_back(NamedCamera("RPCModel", rpc, dg_box));
+    cameras.push_back(NamedCamera("LinescanDGModel", dg, dg_box));
+
+    boost::shared_ptr<SPOTCameraModel> spot
+      = load_spot5_camera_model_from_xml(fixture("spot_example1.xml"));
+    Vector2i spot_size = spot->get_image_size();
+    cameras.push_back(NamedCamera("SPOTCameraModel", spot,
+                                  BBox2(0, 0, spot_size.x() - 1, spot_size.y() - 1)));
+
+    CamPtr adj(new camera::AdjustedCameraModel(dg, Vector3(1, -2, 0.5),
+                                               normalize(Quat(1, 1e-6, 0, -1e-6)),
+                                               Vector2(0.5, -0.25)));
+    cameras.push_back(NamedCamera("AdjustedCameraModel", adj, dg_box));
+
+    Vector2 bounds;
+    std::vector<Vector3> positions;
+    std::vector<Quat>    poses;
+    make_adjustments(dg_size.y(), bounds, positions, poses);
+    CamPtr adj_dg(new AdjustedLinescanDGModel(dg, LinearInterp, bounds, positions,
+                                              poses, dg_size));
+    cameras.push_back(NamedCamera("AdjustedLinescanDGModel", adj_dg, dg_box));
+    CamPtr piecewise(new PiecewiseAdjustedLinescanModel(dg, LinearInterp, bounds, positions,
+                                                        poses, dg_size));
+    cameras.push_back(NamedCamera("PiecewiseAdjustedLinescanModel", piecewise, dg_box));
+
+    CamPtr ray_grid(new RayGridCameraModel(dg, BBox2i(0, 0, dg_size.x(), dg_size.y()),
+                                           1e-8, 1e-3));
+    cameras.push_back(NamedCamera("RayGridCameraModel", ray_grid, dg_box));
+
+    return cameras;
+  }
+
+}
+
+int main(int argc, char* argv[]){
+
+  try {
+    int num_points  = 10000;
+    int num_threads = vw_settings().default_num_threads();
+    if (argc > 1) num_points  = boost::lexical_cast<int>(argv[1]);
+    if (argc > 2) num_threads = boost::lexical_cast<int>(argv[2]);
+    if (num_points <= 0 || num_threads <= 0)
+      vw_throw( ArgumentErr() << "The number of points and of threads must be positive.\n" );
+
+    std::ofstream ofs;
+    if (argc > 3){
+      ofs.open(argv[3]);
+      if (!ofs.is_open())
+        vw_throw( IOErr() << "Unable to open for writing: " << argv[3] << "\n" );
+    }
+    std::ostream & os = (argc > 3) ? ofs : std::cout;
+    os.precision(10);
+
+    xercesc::XMLPlatformUtils::Initialize();
+    std::vector<NamedCamera> cameras = load_cameras();
+    xercesc::XMLPlatformUtils::Terminate();
+
+    std::vector<int> thread_counts;
+    thread_counts.push_back(1);
+    if (num_threads > 1)
+      thread_counts.push_back(num_threads);
+
+    cartography::Datum datum("WGS84");
+    std::vector<CameraBenchmarkResult> results;
+    for (size_t i = 0; i < cameras.size(); i++){
+      for (int p = 0; p < 2; p++){
+        std::string pattern = (p == 0) ? "grid" : "random";
+        std::vector<Vector2> pixels = (p == 0) ?
+          structured_benchmark_pixels(cameras[i].box, num_points) :
+          random_benchmark_pixels(cameras[i].box, num_points);
+        for (size_t t = 0; t < thread_counts.size(); t++)
+          results.push_back(benchmark_camera(cameras[i].name, pattern, *cameras[i].cam,
+                                             datum, pixels, thread_counts[t]));
+      }
+    }
+
+    if (argc > 3 && is_json_benchmark_output(argv[3])){
+      write_camera_benchmark_json(os, "BenchCameraModels", results);
+    }else{
+      write_camera_benchmark_header(os);
+      for (size_t k = 0; k < results.size(); k++)
+        write_camera_benchmark_result(os, results[k]);
+    }
+
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Camera/LinescanASTERModel.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Camera/Extrinsics.h>
+#include <test/Helpers.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+using namespace vw::test;
+
+TEST( ASTERCameraModel, FineGridAndSolver ) {
+
+  // A made-up lattice like the one in ASTER L1A files: a satellite
+  // at 700 km moving along y, looking down with a fan of rays across
+  // the track and a small tilt along it.
+  int num_rows = 5, num_cols = 5;
+  double d_row = 300, d_col = 400, ifov = 2e-5, radius = 6378137;
+  Vector2 image_size((num_cols - 1)*d_col, (num_rows - 1)*d_row);
+  std::vector< std::vector<Vector2> > lattice(num_rows);
+  std::vector< std::vector<Vector3> > sight(num_rows);
+  std::vector<Vector3> sat_pos;
+  for (int r = 0; r < num_rows; r++) {
+    double row = r*d_row;
+    sat_pos.push_back(Vector3(radius + 700000, 7*row, 0));
+    for (int c = 0; c < num_cols; c++) {
+      double col = c*d_col;
+      lattice[r].push_back(Vector2(col, row));
+      sight[r].push_back(normalize(Vector3(-1, 1e-3 + 1e-7*row,
+                                           ifov*(col - image_size[0]/2))));
+    }
+  }
+
+  boost::shared_ptr<camera::CameraModel>
+    guess_cam(new camera::PinholeModel(sat_pos[0], math::identity_matrix<3>(),
+                                       1.0/ifov, 1.0/ifov, 0, 0));
+  ASTERCameraModel cam(lattice, sight, sight, sat_pos, image_size, guess_cam);
+
+  // The fine grid agrees with slerp in the lattice
+  camera::SlerpGridPointingInterpolation slerp(sight, 0, d_row, 0, d_col);
+  for (int k = 0; k < 50; k++) {
+    Vector2 pix(31.7*k, 23.9*k);
+    Vector3 exact = normalize(slerp(pix));
+    EXPECT_LT( norm_2(cross_prod(exact, cam.pixel_to_vector(pix))), 1e-9 );
+  }
+
+  // Going to the ground and back, along a row as stereo_tri does,
+  // so that most calls start from the previous solution.
+  for (int k = 0; k < 50; k++) {
+    Vector2 pix(20.5 + 30.3*k, 600.25);
+    Vector3 ctr = cam.camera_center(pix), dir = cam.pixel_to_vector(pix);
+    double b = dot_prod(ctr, dir), c = dot_prod(ctr, ctr) - radius*radius;
+    Vector3 xyz = ctr + (-b - std::sqrt(b*b - c))*dir;
+    EXPECT_VECTOR_NEAR( pix, cam.point_to_pixel(xyz), 1e-3 );
+  }
+}
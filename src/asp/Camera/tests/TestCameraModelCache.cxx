@@ -0,0 +1,94 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Camera/CameraModelCache.h>
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/RPCModel.h>
+#include <boost/filesystem.hpp>
+#include <test/Helpers.h>
+
+#include <fstream>
+#include <iterator>
+
+using namespace vw;
+using namespace asp;
+using namespace xercesc;
+using namespace vw::test;
+
+namespace fs = boost::filesystem;
+
+TEST(CameraModelCache, DGRoundTrip) {
+  XMLPlatformUtils::Initialize();
+
+  std::string cache_file = camera_cache_file("camera_cache_test", "dg_example1.xml", "dg");
+  EXPECT_FALSE( cache_file.empty() );
+  fs::remove(cache_file);
+
+  DGCameraData data, cached_data;
+  read_dg_camera_data_from_xml("dg_example1.xml", data);
+  EXPECT_FALSE( read_dg_camera_cache(cache_file, cached_data) );
+  write_dg_camera_cache(cache_file, data);
+  ASSERT_TRUE( read_dg_camera_cache(cache_file, cached_data) );
+
+  boost::shared_ptr<DGCameraModel> cam1 = dg_camera_model_from_data(data);
+  boost::shared_ptr<DGCameraModel> cam2 = dg_camera_model_from_data(cached_data);
+  for (int i = 0; i < 4; i++) {
+    Vector2 pix(1000*i, 3000*i);
+    EXPECT_VECTOR_NEAR( cam1->camera_center(pix),   cam2->camera_center(pix),   1e-8 );
+    EXPECT_VECTOR_NEAR( cam1->pixel_to_vector(pix), cam2->pixel_to_vector(pix), 1e-12 );
+  }
+
+  // A truncated file must be rejected
+  std::string truncated = cache_file + ".truncated";
+  {
+    std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::ofstream ofs(truncated.c_str(), std::ios::binary);
+    ofs.write(contents.data(), contents.size()/2);
+  }
+  EXPECT_FALSE( read_dg_camera_cache(truncated, cached_data) );
+  // An entry of the wrong kind too
+  boost::shared_ptr<RPCModel> rpc_model;
+  EXPECT_FALSE( read_rpc_camera_cache(cache_file, rpc_model) );
+
+  fs::remove_all("camera_cache_test");
+  fs::remove(truncated);
+  XMLPlatformUtils::Terminate();
+}
+
+TEST(CameraModelCache, RPCRoundTrip) {
+  XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file("dg_example1.xml");
+  RPCModel model(*xml.rpc_ptr());
+
+  std::string cache_file = camera_cache_file("camera_cache_test", "dg_example1.xml", "rpc");
+  write_rpc_camera_cache(cache_file, model);
+  boost::shared_ptr<RPCModel> cached_model;
+  ASSERT_TRUE( read_rpc_camera_cache(cache_file, cached_model) );
+
+  EXPECT_VECTOR_NEAR( model.line_num_coeff(), cached_model->line_num_coeff(), 0 );
+  EXPECT_VECTOR_NEAR( model.lonlatheight_scale(), cached_model->lonlatheight_scale(), 0 );
+  EXPECT_EQ( model.datum().semi_major_axis(), cached_model->datum().semi_major_axis() );
+  Vector3 llh = model.lonlatheight_offset();
+  EXPECT_VECTOR_NEAR( model.geodetic_to_pixel(llh), cached_model->geodetic_to_pixel(llh), 1e-10 );
+
+  fs::remove_all("camera_cache_test");
+  XMLPlatformUtils::Terminate();
+}
@@ -158,3 +158,36 @@ TEST(DGCameraModel, CreateCamera) {
   XMLPlatformUtils::Terminate();
 }
 
+
+TEST(DGCameraModel, BatchInterpolation) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+  boost::shared_ptr<DGCameraModel> cam = load_dg_camera_model_from_xml("dg_example1.xml");
+
+  // Some lines in order, as for a tile, and some out of order
+  std::vector<double> lines;
+  for (int k = 0; k < 200; k++)
+    lines.push_back(100.37*k);
+  for (int k = 0; k < 50; k++)
+    lines.push_back(19000.0 - 371.3*k);
+
+  std::vector<double>  times;
+  std::vector<Vector3> centers, velocities;
+  std::vector<Quat>    poses;
+  cam->get_times_at_lines(lines, times);
+  cam->get_camera_centers_at_times(times, centers);
+  cam->get_camera_velocities_at_times(times, velocities);
+  cam->get_camera_poses_at_times(times, poses);
+  ASSERT_EQ( lines.size(), poses.size() );
+
+  for (size_t k = 0; k < lines.size(); k++) {
+    EXPECT_EQ( cam->get_time_at_line(lines[k]), times[k] );
+    EXPECT_VECTOR_NEAR( cam->get_camera_center_at_time(times[k]),   centers[k],    1e-8 );
+    EXPECT_VECTOR_NEAR( cam->get_camera_velocity_at_time(times[k]), velocities[k], 1e-8 );
+    Quat q = cam->get_camera_pose_at_time(times[k]);
+    for (int c = 0; c < 4; c++)
+      EXPECT_NEAR( q[c], poses[k][c], 1e-12 );
+  }
+
+  XMLPlatformUtils::Terminate();
+}
@@ -29,8 +29,10 @@
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/RPCModelGen.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <limits>
 
 
 using namespace vw;
@@ -182,6 +184,234 @@ TEST( StereoSessionRPC, InstantiateTest ) {
   xercesc::XMLPlatformUtils::Terminate();
 }
 
+TEST( StereoSessionRPC, BatchProjection ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  // More points than fit in one block, to exercise the remainder too
+  std::vector<Vector3> geodetics;
+  for (int i = 0; i < 150; i++)
+    geodetics.push_back(Vector3(-105.29 + 0.001*(i % 13), 39.745 - 0.001*(i % 7),
+                                2281 + 10.0*(i % 5)));
+
+  std::vector<Vector2> pixels;
+  model.geodetic_to_pixel(geodetics, pixels);
+  ASSERT_EQ( geodetics.size(), pixels.size() );
+
+  for (size_t i = 0; i < geodetics.size(); i++) {
+
+    // The batch and single-point versions must agree exactly
+    EXPECT_VECTOR_NEAR( model.geodetic_to_pixel(geodetics[i]), pixels[i], 0.0 );
+
+    // Compare with the dot product of the coefficients and the terms
+    Vector3 G = elem_quot(geodetics[i] - model.lonlatheight_offset(),
+                          model.lonlatheight_scale());
+    RPCModel::CoeffVec term = model.calculate_terms(G);
+    Vector2 P( dot_prod(term, model.sample_num_coeff()) / dot_prod(term, model.sample_den_coeff()),
+               dot_prod(term, model.line_num_coeff())   / dot_prod(term, model.line_den_coeff()) );
+    P = elem_prod(P, model.xy_scale()) + model.xy_offset();
+    EXPECT_VECTOR_NEAR( P, pixels[i], 1e-8 );
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST( StereoSessionRPC, BatchImageToGround ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  std::vector<Vector2> pixels;
+  std::vector<double> heights;
+  for (int i = 0; i < 100; i++) {
+    pixels.push_back(Vector2(100.0*(i % 10), 150.0*(i / 10)));
+    heights.push_back(2281 + 20.0*(i % 3));
+  }
+  pixels[5] = Vector2(std::numeric_limits<double>::quiet_NaN(), 0.0);
+
+  // With no guesses, and with the solutions as guesses
+  std::vector<Vector2> lonlats;
+  for (int pass = 0; pass < 2; pass++) {
+    model.image_to_ground(pixels, heights, lonlats);
+    ASSERT_EQ( pixels.size(), lonlats.size() );
+    for (size_t i = 0; i < pixels.size(); i++) {
+      if (i == 5) {
+        EXPECT_TRUE( lonlats[i] != lonlats[i] );
+        continue;
+      }
+      EXPECT_VECTOR_NEAR( model.image_to_ground(pixels[i], heights[i]), lonlats[i], 1e-8 );
+      Vector2 pix = model.geodetic_to_pixel(Vector3(lonlats[i][0], lonlats[i][1], heights[i]));
+      EXPECT_LT( norm_2(pix - pixels[i]), 1e-6 );
+    }
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST( RPCStereoModel, TriangulateRow ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  boost::shared_ptr<vw::camera::CameraModel> cam1 = load_rpc_camera_model("wv_mvp_1.xml");
+  boost::shared_ptr<vw::camera::CameraModel> cam2 = load_rpc_camera_model("wv_mvp_2.xml");
+  std::vector<const vw::camera::CameraModel*> cameras;
+  cameras.push_back(cam1.get());
+  cameras.push_back(cam2.get());
+  EXPECT_TRUE( RPCStereoModel::are_rpc(cameras) );
+
+  RPCStereoModel model(cameras);
+  RPCStereoModel direct_model(cameras);
+  direct_model.set_direct_intersection(true);
+
+  // A few rows, with a pixel skipped, and one seen only in one image
+  const int WIDTH = 20;
+  std::vector<bool> valid(WIDTH, true);
+  valid[3] = false;
+  std::vector< std::vector<Vector2> > pixels(2, std::vector<Vector2>(WIDTH));
+  RPCStereoModel::RowSeeds seeds, direct_seeds;
+  std::vector<Vector3> points, errors, direct_points, direct_errors;
+  for (int row = 0; row < 3; row++) {
+    for (int col = 0; col < WIDTH; col++) {
+      pixels[0][col] = Vector2(10000 + col, 10000 + row);
+      pixels[1][col] = Vector2(10000 + 0.9*col, 10000 + row);
+    }
+    pixels[1][7] = Vector2(std::numeric_limits<double>::quiet_NaN(),
+                           std::numeric_limits<double>::quiet_NaN());
+
+    model.triangulate_row(pixels, valid, seeds, points, errors);
+    direct_model.triangulate_row(pixels, valid, direct_seeds, direct_points, direct_errors);
+
+    for (int col = 0; col < WIDTH; col++) {
+      if (!valid[col] || col == 7) {
+        EXPECT_VECTOR_NEAR( Vector3(), points[col], 0.0 );
+        EXPECT_VECTOR_NEAR( Vector3(), direct_points[col], 0.0 );
+        continue;
+      }
+
+      // The same as one pixel at a time, up to the Newton tolerance
+      std::vector<Vector2> pixVec(2);
+      pixVec[0] = pixels[0][col];
+      pixVec[1] = pixels[1][col];
+      Vector3 errorVec;
+      Vector3 xyz = model(pixVec, errorVec);
+      EXPECT_VECTOR_NEAR( xyz, points[col], 1e-3 );
+      EXPECT_VECTOR_NEAR( errorVec, errors[col], 1e-3 );
+
+      // The ground tracks are nearly straight
+      EXPECT_VECTOR_NEAR( xyz, direct_points[col], 0.1 );
+      EXPECT_NEAR( norm_2(errorVec), norm_2(direct_errors[col]), 0.1 );
+    }
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST( StereoSessionRPC, LinearFit ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  // Sample the model on a grid in normalized coordinates, and fit
+  // it back with no penalty.
+  const int N = 8;
+  Vector<double> geodetics(3*N*N*N), pixels(2*N*N*N);
+  int count = 0;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      for (int k = 0; k < N; k++) {
+        Vector3 G(-1.0 + 2.0*i/(N-1), -1.0 + 2.0*j/(N-1), -1.0 + 2.0*k/(N-1));
+        Vector2 P = model.normalized_geodetic_to_normalized_pixel(G);
+        subvector(geodetics, 3*count, 3) = G;
+        subvector(pixels,    2*count, 2) = P;
+        count++;
+      }
+    }
+  }
+
+  RPCModel::CoeffVec samp_num, samp_den, line_num, line_den;
+  double samp_err = fit_rpc_coord_linear(geodetics, pixels, 0, 0.0, samp_num, samp_den);
+  double line_err = fit_rpc_coord_linear(geodetics, pixels, 1, 0.0, line_num, line_den);
+  EXPECT_LT( samp_err, 1e-6 );
+  EXPECT_LT( line_err, 1e-6 );
+
+  // Check between the samples
+  Vector3 G(0.123, -0.456, 0.789);
+  Vector2 P = RPCModel::normalized_geodetic_to_normalized_pixel(G, line_num, line_den,
+                                                                samp_num, samp_den);
+  EXPECT_VECTOR_NEAR( model.normalized_geodetic_to_normalized_pixel(G), P, 1e-5 );
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST( StereoSessionRPC, SampleAndCheckFit ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  // Sample the lon-lat-height box of the model
+  const int N = 6;
+  std::vector<Vector3> llh, xyz;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      for (int k = 0; k < N; k++) {
+        Vector3 G(-0.9 + 1.8*i/(N-1), -0.9 + 1.8*j/(N-1), -0.9 + 1.8*k/(N-1));
+        G = elem_prod(G, model.lonlatheight_scale()) + model.lonlatheight_offset();
+        llh.push_back(G);
+        xyz.push_back(model.datum().geodetic_to_cartesian(G));
+      }
+    }
+  }
+
+  // Projecting on one or several threads gives the same pixels
+  std::vector<Vector2> pixels1, pixels4;
+  std::vector<char>    valid1,  valid4;
+  project_points_to_camera(&model, xyz, 1, pixels1, valid1);
+  project_points_to_camera(&model, xyz, 4, pixels4, valid4);
+  ASSERT_EQ( xyz.size(), pixels4.size() );
+  for (size_t i = 0; i < xyz.size(); i++) {
+    EXPECT_TRUE( valid4[i] );
+    EXPECT_EQ( valid1[i], valid4[i] );
+    EXPECT_VECTOR_NEAR( pixels1[i], pixels4[i], 1e-10 );
+  }
+
+  // Normalized the way gen_rpc() wants, with zero penalty terms
+  Vector<double> normalized_llh, normalized_pixels;
+  normalize_point_pairs(llh, pixels4, model.lonlatheight_scale(), model.lonlatheight_offset(),
+                        model.xy_scale(), model.xy_offset(), normalized_llh, normalized_pixels);
+  EXPECT_EQ( 3*llh.size(), normalized_llh.size() );
+  EXPECT_EQ( 2*llh.size() + RpcSolveLMA::NUM_PENALTY_TERMS, normalized_pixels.size() );
+  EXPECT_EQ( 0.0, normalized_pixels[normalized_pixels.size() - 1] );
+
+  // The model's own coefficients fit its pixels
+  std::vector<double> errors;
+  double max_err = rpc_fit_errors(llh, pixels4, model.lonlatheight_scale(),
+                                  model.lonlatheight_offset(),
+                                  model.xy_scale(), model.xy_offset(),
+                                  model.line_num_coeff(), model.line_den_coeff(),
+                                  model.sample_num_coeff(), model.sample_den_coeff(),
+                                  errors);
+  EXPECT_LT( max_err, 1e-6 );
+
+  // Only the points off by more than the threshold are added
+  std::vector<Vector3> fit_llh;
+  std::vector<Vector2> fit_pixels;
+  errors[3] = 2.0;
+  errors[7] = 0.5;
+  EXPECT_EQ( 1, add_poorly_fit_points(llh, pixels4, errors, 1.0, fit_llh, fit_pixels) );
+  ASSERT_EQ( 1u, fit_llh.size() );
+  EXPECT_VECTOR_NEAR( llh[3], fit_llh[0], 1e-10 );
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
 TEST( StereoSessionRPC, CheckStereo ) {
 
   xercesc::XMLPlatformUtils::Initialize();
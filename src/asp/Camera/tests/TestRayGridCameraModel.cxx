@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Camera/RayGridCameraModel.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Math/EulerAngles.h>
+#include <test/Helpers.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+using namespace vw::test;
+
+TEST( RayGridCameraModel, InterpolationAccuracy ) {
+
+  // A wide-angle pinhole camera, whose rays are not linear in the
+  // pixel once normalized, so the grid must be refined.
+  boost::shared_ptr<camera::CameraModel>
+    exact_cam(new camera::PinholeModel(Vector3(1000, -2000, 7000),
+                                       math::euler_to_rotation_matrix(0.1, -0.2, 0.3, "xyz"),
+                                       500, 500, 512, 384));
+  BBox2i box(0, 0, 1024, 768);
+  double angle_tol = 1e-6, center_tol = 1e-3;
+
+  UnlinkName grid_file("ray_grid.txt");
+  RayGridCameraModel grid_cam(exact_cam, box, angle_tol, center_tol, grid_file);
+  EXPECT_LT( grid_cam.grid_spacing(), 1024/8.0 );
+
+  for (int k = 0; k < 100; k++) {
+    Vector2 pix(10.23*k, 7.61*k + 0.5);
+    Vector3 exact_dir = exact_cam->pixel_to_vector(pix);
+    Vector3 grid_dir  = grid_cam.pixel_to_vector(pix);
+    EXPECT_LT( std::acos(std::min(1.0, dot_prod(exact_dir, grid_dir))), 2*angle_tol );
+    EXPECT_VECTOR_NEAR( exact_cam->camera_center(pix), grid_cam.camera_center(pix), center_tol );
+  }
+
+  // Outside the box the exact camera is used
+  Vector2 out_pix(-50, 1000);
+  EXPECT_VECTOR_NEAR( exact_cam->pixel_to_vector(out_pix), grid_cam.pixel_to_vector(out_pix), 1e-15 );
+
+  // Reading back the grid gives the same rays
+  RayGridCameraModel read_cam(exact_cam, box, angle_tol, center_tol, grid_file);
+  EXPECT_EQ( grid_cam.grid_spacing(), read_cam.grid_spacing() );
+  Vector2 pix(333.3, 222.2);
+  EXPECT_VECTOR_NEAR( grid_cam.pixel_to_vector(pix), read_cam.pixel_to_vector(pix), 1e-14 );
+}
@@ -21,8 +21,11 @@
 #include <vw/Math/Matrix.h>
 #include <vw/Math/LinearAlgebra.h>
 #include <vw/InterestPoint/InterestData.h>
+#include <vw/Core/Log.h>
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
 
 using namespace vw;
 
@@ -63,6 +66,140 @@ namespace asp {
     return f;
   }
 
+  namespace {
+
+    // The matches in separate arrays, so that scoring a model vectorizes
+    struct AffineMatchArrays {
+      std::vector<double> x2, y2, x1, y1;
+      AffineMatchArrays(std::vector<ip::InterestPoint> const& ip1,
+                        std::vector<ip::InterestPoint> const& ip2):
+        x2(ip1.size()), y2(ip1.size()), x1(ip1.size()), y1(ip1.size()) {
+        for (size_t i = 0; i < ip1.size(); i++) {
+          x2[i] = ip2[i].x; y2[i] = ip2[i].y;
+          x1[i] = ip1[i].x; y1[i] = ip1[i].y;
+        }
+      }
+    };
+
+    // The signed distance, in R^4, from the point (x2, y2, x1, y1) made
+    // of a pair of matches to the hyperplane described by the affine
+    // fundamental matrix. The normal of the hyperplane has unit length.
+    void affine_residuals(AffineMatchArrays const& m, Matrix<double> const& f,
+                          std::vector<double> & res) {
+      double n0 = f(0,2), n1 = f(1,2), n2 = f(2,0), n3 = f(2,1), e = f(2,2);
+      int num = m.x1.size();
+      res.resize(num);
+      const double *x2 = &m.x2[0], *y2 = &m.y2[0], *x1 = &m.x1[0], *y1 = &m.y1[0];
+      double *r = &res[0];
+      for (int i = 0; i < num; i++)
+        r[i] = n0*x2[i] + n1*y2[i] + n2*x1[i] + n3*y1[i] + e;
+    }
+
+    // The MSAC cost: the squared residuals, truncated at the threshold
+    double msac_cost(AffineMatchArrays const& m, Matrix<double> const& f,
+                     double thresh2, std::vector<double> & res) {
+      affine_residuals(m, f, res);
+      int num = res.size();
+      const double *r = &res[0];
+      double cost = 0;
+      for (int i = 0; i < num; i++)
+        cost += std::min(r[i]*r[i], thresh2);
+      return cost;
+    }
+
+    double median_abs(std::vector<double> vals) {
+      for (size_t i = 0; i < vals.size(); i++)
+        vals[i] = std::abs(vals[i]);
+      size_t mid = vals.size()/2;
+      std::nth_element(vals.begin(), vals.begin() + mid, vals.end());
+      return vals[mid];
+    }
+  }
+
+  // Find the matches consistent with one affine fundamental matrix
+  // with MSAC, starting from minimal samples of four matches. The
+  // inlier threshold is a few times the robust spread of the residuals
+  // of the fit to all matches, but no less than a couple of pixels, so
+  // that with no outliers nearly all matches are kept. The samples are
+  // drawn with a fixed linear congruential generator, so the result is
+  // repeatable, and sampling stops once a better model has less than a
+  // 1% chance of being found.
+  void robust_affine_inliers( std::vector<ip::InterestPoint> const& ip1,
+                              std::vector<ip::InterestPoint> const& ip2,
+                              std::vector<ip::InterestPoint> & inlier_ip1,
+                              std::vector<ip::InterestPoint> & inlier_ip2 ) {
+
+    inlier_ip1 = ip1;
+    inlier_ip2 = ip2;
+    const int sample_size = 4, min_num_matches = 10, max_iterations = 1000;
+    const double min_thresh = 2.0, confidence = 0.99;
+    int num = ip1.size();
+    if (num < min_num_matches)
+      return;
+
+    AffineMatchArrays matches(ip1, ip2);
+    std::vector<double> res;
+    affine_residuals(matches, linear_affine_fundamental_matrix(ip1, ip2), res);
+    double thresh  = std::max(min_thresh, 3.0*1.4826*median_abs(res));
+    double thresh2 = thresh*thresh;
+
+    Matrix<double> best_fund;
+    double best_cost = -1;
+    unsigned long long state = 1234567;
+    std::vector<ip::InterestPoint> s1(sample_size), s2(sample_size);
+    int num_iterations = max_iterations;
+    for (int iter = 0; iter < num_iterations; iter++) {
+      int ids[sample_size];
+      for (int k = 0; k < sample_size; k++) {
+        bool repeated = true;
+        while (repeated) {
+          state = state*6364136223846793005ULL + 1442695040888963407ULL;
+          ids[k] = int((state >> 33) % (unsigned long long)num);
+          repeated = false;
+          for (int j = 0; j < k; j++)
+            repeated = repeated || (ids[j] == ids[k]);
+        }
+        s1[k] = ip1[ids[k]];
+        s2[k] = ip2[ids[k]];
+      }
+
+      Matrix<double> fund = linear_affine_fundamental_matrix(s1, s2);
+      double cost = msac_cost(matches, fund, thresh2, res);
+      if (best_cost >= 0 && cost >= best_cost)
+        continue;
+      best_cost = cost;
+      best_fund = fund;
+
+      // Update the number of samples needed from the inlier ratio
+      int num_inliers = 0;
+      for (int i = 0; i < num; i++)
+        num_inliers += (res[i]*res[i] < thresh2);
+      double w = std::pow(double(num_inliers)/num, sample_size);
+      if (w >= 1.0)
+        break;
+      if (w > 0) {
+        double needed = std::log(1.0 - confidence)/std::log(1.0 - w);
+        num_iterations = std::min(num_iterations, int(std::ceil(needed)));
+      }
+    }
+
+    affine_residuals(matches, best_fund, res);
+    std::vector<ip::InterestPoint> out1, out2;
+    for (int i = 0; i < num; i++) {
+      if (res[i]*res[i] < thresh2) {
+        out1.push_back(ip1[i]);
+        out2.push_back(ip2[i]);
+      }
+    }
+    if (int(out1.size()) < min_num_matches)
+      return;
+
+    vw_out() << "\t    Affine epipolar inliers: " << out1.size() << " of "
+             << num << " matches, threshold " << thresh << " pixels.\n";
+    inlier_ip1 = out1;
+    inlier_ip2 = out2;
+  }
+
   void solve_y_scaling( std::vector<ip::InterestPoint> const& ip1,
                         std::vector<ip::InterestPoint> const& ip2,
                         Matrix<double>& affine_left,
@@ -103,10 +240,15 @@ namespace asp {
   Vector2i
   affine_epipolar_rectification( Vector2i const& left_size,
                                  Vector2i const& right_size,
-                                 std::vector<ip::InterestPoint> const& ip1,
-                                 std::vector<ip::InterestPoint> const& ip2,
+                                 std::vector<ip::InterestPoint> const& all_ip1,
+                                 std::vector<ip::InterestPoint> const& all_ip2,
                                  Matrix<double>& left_matrix,
                                  Matrix<double>& right_matrix ) {
+    // Leave out the matches not consistent with an affine camera pair,
+    // which would otherwise skew the least squares solutions below.
+    std::vector<ip::InterestPoint> ip1, ip2;
+    robust_affine_inliers( all_ip1, all_ip2, ip1, ip2 );
+
     // Create affine fundamental matrix
     Matrix<double> fund = linear_affine_fundamental_matrix( ip1, ip2 );
 
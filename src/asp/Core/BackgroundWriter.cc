@@ -0,0 +1,121 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/BackgroundWriter.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <exception>
+
+using namespace vw;
+
+namespace asp {
+
+class BackgroundWriter::JobTask: public Task, private boost::noncopyable {
+  BackgroundWriter & m_writer;
+  Job                m_job;
+public:
+  JobTask(BackgroundWriter & writer, Job const& job): m_writer(writer), m_job(job) {}
+  void operator()() {
+    {
+      Mutex::Lock lock(m_writer.m_mutex);
+      m_writer.m_pending--;
+      m_writer.m_cond.notify_all();
+    }
+    m_writer.run(m_job);
+  }
+};
+
+BackgroundWriter::BackgroundWriter(bool background, int max_pending):
+  m_background(background), m_max_pending(std::max(max_pending, 1)), m_pending(0),
+  m_queue(1) {}
+
+BackgroundWriter::~BackgroundWriter() {
+  m_queue.join_all();
+  if (!m_error.empty())
+    vw_out(WarningMessage) << "Failed to write in the background: " << m_error << "\n";
+}
+
+void BackgroundWriter::run(Job const& job) {
+  std::string error;
+  try {
+    job();
+  } catch (std::exception const& e) {
+    error = e.what();
+  } catch (...) {
+    error = "unknown error";
+  }
+  if (error.empty())
+    return;
+  if (!m_background)
+    vw_throw( IOErr() << error );
+
+  // Keep the first error, which the others may follow from
+  Mutex::Lock lock(m_mutex);
+  if (m_error.empty())
+    m_error = error;
+}
+
+void BackgroundWriter::check_error() {
+  if (m_error.empty())
+    return;
+  std::string error = m_error;
+  m_error.clear();
+  vw_throw( IOErr() << error );
+}
+
+void BackgroundWriter::start(Job const& job) {
+  m_pending++;
+  m_queue.add_task(boost::shared_ptr<Task>(new JobTask(*this, job)));
+}
+
+void BackgroundWriter::add(Job const& job) {
+  if (!m_background) {
+    run(job);
+    return;
+  }
+  Mutex::Lock lock(m_mutex);
+  check_error();
+  while (m_pending >= m_max_pending)
+    m_cond.wait(lock);
+  start(job);
+}
+
+bool BackgroundWriter::try_add(Job const& job) {
+  if (!m_background) {
+    run(job);
+    return true;
+  }
+  Mutex::Lock lock(m_mutex);
+  check_error();
+  if (m_pending >= m_max_pending)
+    return false;
+  start(job);
+  return true;
+}
+
+void BackgroundWriter::wait() {
+  m_queue.join_all();
+  Mutex::Lock lock(m_mutex);
+  check_error();
+}
+
+} // namespace asp
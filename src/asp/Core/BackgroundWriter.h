@@ -0,0 +1,87 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BackgroundWriter.h
+///
+/// Write the outputs of the iterations of a solver, such as the DEMs
+/// of sfs or the checkpoints of bundle_adjust, in a background thread,
+/// so that the solver can go on meanwhile. The caller copies what is
+/// to be written, and queues a job writing that copy. The jobs are run
+/// one at a time, in the order they were queued.
+///
+/// At most max_pending jobs wait besides the one running, so with the
+/// default of one, at most two copies are in memory. Then add() waits
+/// for the writer, while try_add() returns false, so that the outputs
+/// of an iteration can be skipped when the writing falls behind.
+///
+/// An exception thrown by a job is rethrown by the next call to add(),
+/// try_add() or wait(), as an IOErr with the same message.
+
+#ifndef __ASP_CORE_BACKGROUND_WRITER_H__
+#define __ASP_CORE_BACKGROUND_WRITER_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+
+namespace asp {
+
+  class BackgroundWriter: private boost::noncopyable {
+  public:
+    typedef boost::function<void ()> Job;
+
+    /// If background is false, each job is run as soon as it is added
+    BackgroundWriter(bool background, int max_pending = 1);
+
+    /// Wait for the jobs. An error is only printed.
+    ~BackgroundWriter();
+
+    bool background() const { return m_background; }
+
+    /// Queue a job, first waiting while max_pending jobs wait to start
+    void add(Job const& job);
+
+    /// Queue a job unless max_pending jobs wait to start, and return
+    /// whether it was queued.
+    bool try_add(Job const& job);
+
+    /// Wait for all the jobs queued so far
+    void wait();
+
+  private:
+    class JobTask;
+
+    void start(Job const& job); // the lock must be held
+    void run(Job const& job);
+    void check_error();         // the lock must be held
+
+    bool              m_background;
+    int               m_max_pending, m_pending;
+    std::string       m_error;
+    vw::Mutex         m_mutex;
+    vw::Condition     m_cond;
+    vw::FifoWorkQueue m_queue;
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_BACKGROUND_WRITER_H__
@@ -0,0 +1,105 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Benchmark.h
+///
+/// A small harness for the benchmark programs in the tests directories.
+/// A kernel is a functor whose operator()() does one iteration of the
+/// work and returns how many items (pixels, points, lines) it processed.
+/// It is run until a minimum time has passed, and the median time per
+/// iteration is kept, which is less sensitive to a busy machine than the
+/// mean. The results are written as JSON with a fixed layout, so that
+/// runs of different releases can be compared with a script.
+
+#ifndef __ASP_CORE_BENCHMARK_H__
+#define __ASP_CORE_BENCHMARK_H__
+
+#include <vw/Core/Stopwatch.h>
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The timing of one kernel
+  struct BenchmarkResult {
+    std::string name;      ///< The kernel, such as "fast_median_filter"
+    std::string params;    ///< What distinguishes runs of the same kernel
+    int    iterations;
+    double items;          ///< Items processed per iteration
+    double median_s;       ///< Median wall time of an iteration
+    double min_s;          ///< Fastest iteration
+    BenchmarkResult(): iterations(0), items(0), median_s(0), min_s(0){}
+  };
+
+  /// Run the kernel at least min_iterations times and for at least
+  /// min_seconds, after one untimed warm-up iteration.
+  template <class KernelT>
+  BenchmarkResult run_benchmark(std::string const& name, std::string const& params,
+                                KernelT & kernel, double min_seconds = 0.5,
+                                int min_iterations = 3){
+    BenchmarkResult result;
+    result.name   = name;
+    result.params = params;
+    result.items  = kernel();
+
+    std::vector<double> times;
+    double total = 0;
+    while (int(times.size()) < min_iterations || total < min_seconds){
+      vw::Stopwatch sw;
+      sw.start();
+      kernel();
+      sw.stop();
+      times.push_back(sw.elapsed_seconds());
+      total += times.back();
+    }
+
+    std::sort(times.begin(), times.end());
+    result.iterations = times.size();
+    result.median_s   = times[times.size()/2];
+    result.min_s      = times[0];
+    return result;
+  }
+
+  /// Write the results as a JSON object, one result per line, with a
+  /// fixed key order.
+  inline void write_benchmark_json(std::ostream & os, std::string const& suite,
+                                   std::vector<BenchmarkResult> const& results){
+    os << "{\"suite\": \"" << suite << "\", \"results\": [\n";
+    for (size_t k = 0; k < results.size(); k++){
+      BenchmarkResult const& r = results[k];
+      double rate = (r.median_s > 0) ? r.items/r.median_s : 0.0;
+      os << "  {\"name\": \"" << r.name << "\", \"params\": \"" << r.params << "\""
+         << ", \"iterations\": " << r.iterations
+         << std::setprecision(0) << std::fixed
+         << ", \"items\": " << r.items
+         << std::setprecision(9) << std::scientific
+         << ", \"median_s\": " << r.median_s
+         << ", \"min_s\": " << r.min_s
+         << ", \"items_per_s\": " << rate << "}"
+         << (k + 1 < results.size() ? "," : "") << "\n";
+      os.unsetf(std::ios::floatfield);
+    }
+    os << "]}\n";
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_BENCHMARK_H__
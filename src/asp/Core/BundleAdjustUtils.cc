@@ -154,3 +154,38 @@ void asp::compute_stereo_residuals(std::vector<boost::shared_ptr<CameraModel> >
   vw_out() << "\nStereo Intersection Residuals -- Min: " << min_error
            << "  Max: " << max_error << "  Average: " << (error_sum/n) << "\n";
 }
+
+void asp::CameraObservations::read_controlnetwork(ControlNetwork const& cnet, int num_cameras){
+
+  // First count the observations of each camera, then fill them in.
+  m_offsets.assign(num_cameras + 1, 0);
+  int num_points = cnet.size();
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    for (size_t m = 0; m < cnet[ipt].size(); m++) {
+      size_t icam = cnet[ipt][m].image_id();
+      if (icam < size_t(num_cameras))
+        m_offsets[icam + 1]++;
+    }
+  }
+  for (int icam = 0; icam < num_cameras; icam++)
+    m_offsets[icam + 1] += m_offsets[icam];
+
+  size_t num_obs = m_offsets[num_cameras];
+  m_point_ids.resize(num_obs);
+  m_locations.resize(num_obs);
+  m_scales.resize(num_obs);
+
+  std::vector<size_t> pos(m_offsets.begin(), m_offsets.end() - 1);
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    for (size_t m = 0; m < cnet[ipt].size(); m++) {
+      ControlMeasure const& cm = cnet[ipt][m];
+      size_t icam = cm.image_id();
+      if (icam >= size_t(num_cameras))
+        continue;
+      size_t k = pos[icam]++;
+      m_point_ids[k] = ipt;
+      m_locations[k] = cm.position();
+      m_scales   [k] = cm.sigma();
+    }
+  }
+}
@@ -60,6 +60,31 @@ namespace asp{
                          vw::Vector3 const& position_correction,
                          vw::Quat    const& pose_correction);
 
+  /// The observations of the control network points, grouped by
+  /// camera, in flat arrays rather than the per-feature objects of
+  /// vw::ba::CameraRelationNetwork. The observations of camera icam
+  /// are at indices from begin(icam) to end(icam), in the order of
+  /// the points in the control network.
+  class CameraObservations {
+  public:
+    /// Build from the control network. Measures with an image id not
+    /// less than the number of cameras are ignored.
+    void read_controlnetwork(vw::ba::ControlNetwork const& cnet, int num_cameras);
+
+    int    num_cameras() const { return int(m_offsets.size()) - 1; }
+    size_t begin(int icam) const { return m_offsets[icam];     }
+    size_t end  (int icam) const { return m_offsets[icam + 1]; }
+
+    int                point_id(size_t k) const { return m_point_ids[k]; }
+    vw::Vector2 const& location(size_t k) const { return m_locations[k]; }
+    vw::Vector2 const& scale   (size_t k) const { return m_scales[k];    }
+
+  private:
+    std::vector<size_t>      m_offsets; // one more than the number of cameras
+    std::vector<int>         m_point_ids;
+    std::vector<vw::Vector2> m_locations, m_scales;
+  };
+
   ///
   void compute_stereo_residuals(std::vector<boost::shared_ptr<vw::camera::CameraModel> >
                                 const& camera_models,
@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CensusTransform.cc
+///
+
+#include <asp/Core/CensusTransform.h>
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+  CensusImage::CensusImage(ImageView<float> const& image, Vector2i const& kernel_size,
+                           bool ternary, float threshold):
+    m_cols(image.cols()), m_rows(image.rows()) {
+
+    int half_cols = kernel_size[0]/2, half_rows = kernel_size[1]/2;
+    int bits_per_neighbor = ternary ? 2 : 1;
+    int num_bits = ((2*half_cols + 1)*(2*half_rows + 1) - 1)*bits_per_neighbor;
+    m_words = std::max(1, (num_bits + 63)/64);
+    m_bits.assign(size_t(m_cols)*m_rows*m_words, 0);
+
+    for (int row = 0; row < m_rows; row++) {
+      for (int col = 0; col < m_cols; col++) {
+        uint64* bits = &m_bits[(size_t(row)*m_cols + col)*m_words];
+        float center = image(col, row);
+        int b = 0;
+        for (int dr = -half_rows; dr <= half_rows; dr++) {
+          int r = row + dr;
+          for (int dc = -half_cols; dc <= half_cols; dc++) {
+            if (dr == 0 && dc == 0)
+              continue;
+            int c = col + dc;
+            if (r >= 0 && r < m_rows && c >= 0 && c < m_cols) {
+              float v = image(c, r);
+              if (ternary) {
+                if (v < center - threshold)
+                  bits[b/64] |= uint64(1) << (b%64);
+                if (v > center + threshold)
+                  bits[(b + 1)/64] |= uint64(1) << ((b + 1)%64);
+              } else if (v < center) {
+                bits[b/64] |= uint64(1) << (b%64);
+              }
+            }
+            b += bits_per_neighbor;
+          }
+        }
+      }
+    }
+  }
+
+} // namespace asp
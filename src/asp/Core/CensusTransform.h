@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CensusTransform.h
+///
+/// The census transform of an image tile, computed once, with the
+/// census of each pixel packed in 64 bit words, so that the cost of
+/// matching two pixels is the popcount of the XOR of their words, the
+/// Hamming distance of their census bit strings.
+///
+/// The census of a pixel has a bit for each other pixel of the kernel
+/// around it, set if that pixel is darker than the center one. The
+/// ternary census has two bits for each, one set if the pixel is
+/// darker than the center one by more than a threshold, and the other
+/// if it is brighter by more than it. The pixels of the kernel past
+/// the edges of the tile count as equal to the center one.
+
+#ifndef __ASP_CORE_CENSUS_TRANSFORM_H__
+#define __ASP_CORE_CENSUS_TRANSFORM_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/Vector.h>
+#include <cstddef>
+#include <vector>
+
+namespace asp {
+
+  /// The number of bits set
+  inline int popcount64(vw::uint64 x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return int((x * 0x0101010101010101ULL) >> 56);
+#endif
+  }
+
+  class CensusImage {
+  public:
+    /// The census of each pixel of the image over a kernel of the given
+    /// size. The ternary census ignores differences up to the threshold.
+    CensusImage(vw::ImageView<float> const& image, vw::Vector2i const& kernel_size,
+                bool ternary = false, float threshold = 0.0);
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    int words_per_pixel() const { return m_words; }
+
+    /// The packed census of a pixel
+    const vw::uint64* pixel(int col, int row) const {
+      return &m_bits[(size_t(row)*m_cols + col)*m_words];
+    }
+
+    /// The Hamming distance between the census of a pixel of this image
+    /// and of one of another one, made with the same kernel
+    int cost(int col, int row, CensusImage const& other, int other_col, int other_row) const {
+      const vw::uint64* a = pixel(col, row);
+      const vw::uint64* b = other.pixel(other_col, other_row);
+      int sum = 0;
+      for (int w = 0; w < m_words; w++)
+        sum += popcount64(a[w] ^ b[w]);
+      return sum;
+    }
+
+  private:
+    int m_cols, m_rows, m_words;
+    std::vector<vw::uint64> m_bits;
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_CENSUS_TRANSFORM_H__
@@ -0,0 +1,70 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CoherentPointToPixel.h
+///
+
+#ifndef __ASP_CORE_COHERENT_POINT_TO_PIXEL_H__
+#define __ASP_CORE_COHERENT_POINT_TO_PIXEL_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Camera/LinescanModel.h>
+
+namespace asp {
+
+  /// Project in turn nearby points into a camera, as when iterating
+  /// over the pixels of a DEM or mapprojection tile. For linescan
+  /// cameras, the solve for each point starts from the line found for
+  /// the previous one, which is usually very close. Other cameras are
+  /// projected into as usual. This keeps state, so use one object per
+  /// thread, and call reset() when jumping to a far away point.
+  class CoherentPointToPixel {
+    vw::camera::CameraModel   const* m_cam;
+    vw::camera::LinescanModel const* m_linescan;
+    double                           m_last_line;
+  public:
+    CoherentPointToPixel(vw::camera::CameraModel const* cam):
+      m_cam(cam), m_linescan(dynamic_cast<vw::camera::LinescanModel const*>(cam)),
+      m_last_line(-1) {}
+
+    vw::Vector2 operator()(vw::Vector3 const& point) {
+      if (m_linescan == NULL)
+        return m_cam->point_to_pixel(point);
+
+      if (m_last_line >= 0) {
+        try {
+          vw::Vector2 pix = m_linescan->point_to_pixel(point, m_last_line);
+          m_last_line = pix.y();
+          return pix;
+        } catch (...) {
+          // Start from scratch below
+        }
+      }
+
+      m_last_line = -1;
+      vw::Vector2 pix = m_linescan->point_to_pixel(point, -1);
+      m_last_line = pix.y();
+      return pix;
+    }
+
+    void reset() { m_last_line = -1; }
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_COHERENT_POINT_TO_PIXEL_H__
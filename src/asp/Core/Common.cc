@@ -21,6 +21,7 @@
 #include <vw/FileIO/DiskImageResource.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/ObjectStorage.h>
 
 #include <map>
 #include <sstream>
@@ -41,6 +42,8 @@
 
 #if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
 #include "ogr_spatialref.h"
+#include <gdal_priv.h>
+#include <cpl_string.h>
 #endif
 
 using namespace vw;
@@ -262,14 +265,14 @@ bool asp::parse_multiview_cmd_files(std::vector<std::string> const &filesIn,
 
   // Verify that the images and cameras exist, otherwise GDAL prints funny messages later.
   for (int i = 0; i < (int)image_paths.size(); i++){
-    if (!fs::exists(image_paths[i])) {
+    if (!asp::object_exists(image_paths[i])) {
       vw_throw( ArgumentErr() << "Cannot find the image file: " << image_paths[i] << ".\n");
       return false;
     }
   }
   
   for (int i = 0; i < (int)camera_paths.size(); i++){
-    if (!fs::exists(camera_paths[i])) {
+    if (!asp::object_exists(camera_paths[i])) {
       vw_throw( ArgumentErr() << "Cannot find the camera file: " << camera_paths[i] << ".\n");
       return false;
     }
@@ -568,6 +571,68 @@ void asp::set_srs_string(std::string srs_string, bool have_user_datum,
 }
 
 
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+namespace {
+  // Pass GDAL's progress on to a VW progress callback
+  int gdal_to_vw_progress(double complete, const char*, void* data){
+    static_cast<vw::ProgressCallback const*>(data)->report_progress(complete);
+    return TRUE;
+  }
+}
+#endif
+
+void asp::convert_to_cog(std::string const& filename,
+                         vw::cartography::GdalWriteOptions const& opt,
+                         vw::ProgressCallback const& progress_callback){
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  if (opt.tif_compress == "PACKBITS")
+    vw_throw( ArgumentErr() << "Packbits compression is not supported for "
+              << "Cloud-Optimized GeoTIFF output.\n" );
+
+  GDALAllRegister();
+  GDALDriver * driver = GetGDALDriverManager()->GetDriverByName("COG");
+  if (driver == NULL)
+    vw_throw( ArgumentErr() << "Cannot write " << filename
+              << " as a Cloud-Optimized GeoTIFF, as that needs GDAL 3.1 or newer.\n" );
+
+  GDALDataset * src = static_cast<GDALDataset*>(GDALOpen(filename.c_str(), GA_ReadOnly));
+  if (src == NULL)
+    vw_throw( IOErr() << "Could not open: " << filename << "\n" );
+
+  // The COG driver compresses the tiles in parallel and makes the
+  // overviews as part of the same copy. It writes the file
+  // sequentially, so the copy could also go to object storage.
+  int block_size = std::max(opt.raster_tile_size[0], opt.raster_tile_size[1]);
+  char ** options = NULL;
+  options = CSLSetNameValue(options, "COMPRESS",   opt.tif_compress.c_str());
+  options = CSLSetNameValue(options, "NUM_THREADS",
+                            boost::lexical_cast<std::string>(opt.num_threads).c_str());
+  options = CSLSetNameValue(options, "BLOCKSIZE",
+                            boost::lexical_cast<std::string>(block_size).c_str());
+  std::map<std::string, std::string>::const_iterator it = opt.gdal_options.find("BIGTIFF");
+  if (it != opt.gdal_options.end())
+    options = CSLSetNameValue(options, "BIGTIFF", it->second.c_str());
+
+  std::string tmp_file = fs::path(filename).replace_extension(".cog.tif").string();
+  vw_out() << "Writing Cloud-Optimized GeoTIFF: " << filename << "\n";
+  GDALDataset * dst = driver->CreateCopy(tmp_file.c_str(), src, FALSE, options,
+                                         gdal_to_vw_progress,
+                                         const_cast<vw::ProgressCallback*>(&progress_callback));
+  CSLDestroy(options);
+  GDALClose(src);
+  if (dst == NULL)
+    vw_throw( IOErr() << "Failed to write: " << tmp_file << "\n" );
+  GDALClose(dst);
+  progress_callback.report_finished();
+
+  fs::rename(tmp_file, filename);
+#else
+  vw_throw( NoImplErr() << "Cannot write " << filename
+            << " as a Cloud-Optimized GeoTIFF, as ASP was built without GDAL.\n" );
+#endif
+}
+
 void asp::BitChecker::check_argument( vw::uint8 arg ) {
   // Turn on the arg'th bit in m_checksum
   m_checksum.set(arg);
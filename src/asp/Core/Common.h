@@ -38,6 +38,7 @@
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
+#include <limits>
 #include <map>
 #include <string>
 
@@ -132,6 +133,10 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in ASP written point cloud files to indicate that the
+  ///  values are integers, to be multiplied by this number.
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -178,6 +183,38 @@ namespace asp {
       ( image.impl(), RoundImagePixels<typename ImageT::pixel_type>(rounding_error) );
   }
 
+  /// Divide the pixels by the given scale and round them to int32,
+  /// so that they can be recovered exactly by multiplying back. It is
+  /// an error if a value does not fit.
+  template <class VecT>
+  struct FixedPointEncode:
+    public vw::ReturnFixedType< vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> > {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> result_type;
+    double m_scale;
+    FixedPointEncode(double scale):m_scale(scale){
+      VW_ASSERT( m_scale > 0.0,
+                 vw::ArgumentErr() << "The fixed-point scale must be positive.");
+    }
+    result_type operator() (VecT const& pt) const {
+      result_type out;
+      for (size_t i = 0; i < pt.size(); i++) {
+        double val = round(pt[i]/m_scale);
+        if (!(std::abs(val) <= double(std::numeric_limits<vw::int32>::max())))
+          vw_throw( vw::ArgumentErr() << "The value " << pt[i]
+                    << " does not fit in a fixed-point point cloud with scale "
+                    << m_scale << ". Write the cloud as float instead.\n" );
+        out[i] = vw::int32(val);
+      }
+      return out;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, FixedPointEncode<typename ImageT::pixel_type> >
+  inline fixed_point_encode( vw::ImageViewBase<ImageT> const& image, double scale ) {
+    return vw::UnaryPerPixelView<ImageT, FixedPointEncode<typename ImageT::pixel_type> >
+      ( image.impl(), FixedPointEncode<typename ImageT::pixel_type>(scale) );
+  }
+
 
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
@@ -225,6 +262,37 @@ namespace asp {
                                std::map<std::string, std::string> const& keywords =
                                std::map<std::string, std::string>() );
 
+  /// Block write image while subtracting a given value from all pixels
+  /// and storing the result as int32 multiples of the rounding error,
+  /// with horizontal differencing before compression. The rounding
+  /// error is saved with the ASP_POINT_SCALE_TAG_STR keyword. Without a
+  /// shift, the image is written as is.
+  template <class ImageT>
+  void block_write_fixed_point_gdal_image(const std::string &filename,
+                                          vw::Vector3 const& shift,
+                                          double rounding_error,
+                                          vw::ImageViewBase<ImageT> const& image,
+                                          bool has_georef,
+                                          vw::cartography::GeoReference const& georef,
+                                          vw::cartography::GdalWriteOptions const& opt,
+                                          vw::ProgressCallback const& progress_callback
+                                          = vw::ProgressCallback::dummy_instance(),
+                                          std::map<std::string, std::string> const& keywords =
+                                          std::map<std::string, std::string>() );
+
+  /// Single-threaded version of block_write_fixed_point_gdal_image().
+  template <class ImageT>
+  void write_fixed_point_gdal_image(const std::string &filename,
+                                    vw::Vector3 const& shift,
+                                    double rounding_error,
+                                    vw::ImageViewBase<ImageT> const& image,
+                                    bool has_georef,
+                                    vw::cartography::GeoReference const& georef,
+                                    vw::cartography::GdalWriteOptions const& opt,
+                                    vw::ProgressCallback const& progress_callback
+                                    = vw::ProgressCallback::dummy_instance(),
+                                    std::map<std::string, std::string> const& keywords =
+                                    std::map<std::string, std::string>() );
 
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
@@ -238,6 +306,14 @@ namespace asp {
                                  vw::ProgressCallback const& tpc);
 
 
+  /// Re-write in place a GeoTIFF file as a Cloud-Optimized GeoTIFF,
+  /// with overviews, using the compression, block size, and number
+  /// of threads in the given options.
+  void convert_to_cog(std::string const& filename,
+                      vw::cartography::GdalWriteOptions const& opt,
+                      vw::ProgressCallback const& progress_callback
+                      = vw::ProgressCallback::dummy_instance());
+
   // TODO: Replace with something else!
   /// Convenience class for setting flags and later on
   ///  making sure that we set all of them.
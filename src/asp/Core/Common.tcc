@@ -97,6 +97,90 @@ namespace asp {
     }
   }
 
+  // Options for writing a fixed-point cloud. Differencing the
+  // neighboring pixels of a smooth cloud leaves small integers, which
+  // compress much better than the pixels themselves.
+  inline vw::cartography::GdalWriteOptions
+  fixed_point_write_options(vw::cartography::GdalWriteOptions const& opt){
+    vw::cartography::GdalWriteOptions fixed_opt = opt;
+    std::map<std::string, std::string>::const_iterator it = opt.gdal_options.find("COMPRESS");
+    if (it != opt.gdal_options.end() && it->second != "NONE")
+      fixed_opt.gdal_options["PREDICTOR"] = "2";
+    return fixed_opt;
+  }
+
+  // Block write image while subtracting a given value from all pixels
+  // and storing the result as int32 multiples of the rounding error.
+  template <class ImageT>
+  void block_write_fixed_point_gdal_image(const std::string &filename,
+                                          vw::Vector3 const& shift,
+                                          double rounding_error,
+                                          vw::ImageViewBase<ImageT> const& image,
+                                          bool has_georef,
+                                          vw::cartography::GeoReference const& georef,
+                                          vw::cartography::GdalWriteOptions const& opt,
+                                          vw::ProgressCallback const& progress_callback,
+                                          std::map<std::string, std::string> const& keywords) {
+
+    bool has_nodata = false;
+    double nodata = 0;
+    if (norm_2(shift) > 0){
+
+      // Add the point shift and scale to keywords
+      double scale = get_rounding_error(shift, rounding_error);
+      std::map<std::string, std::string> local_keywords = keywords;
+      local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+      local_keywords[ASP_POINT_SCALE_TAG_STR]  = vw::num_to_str(scale);
+
+      block_write_gdal_image(filename,
+                             fixed_point_encode(subtract_shift(image.impl(), shift), scale),
+                             has_georef, georef, has_nodata, nodata,
+                             fixed_point_write_options(opt), progress_callback,
+                             local_keywords);
+
+    }else{
+      block_write_gdal_image(filename, image, has_georef, georef,
+                             has_nodata, nodata, opt,
+                             progress_callback, keywords);
+    }
+
+  }
+
+  // Single-threaded version of block_write_fixed_point_gdal_image().
+  template <class ImageT>
+  void write_fixed_point_gdal_image(const std::string &filename,
+                                    vw::Vector3 const& shift,
+                                    double rounding_error,
+                                    vw::ImageViewBase<ImageT> const& image,
+                                    bool has_georef,
+                                    vw::cartography::GeoReference const& georef,
+                                    vw::cartography::GdalWriteOptions const& opt,
+                                    vw::ProgressCallback const& progress_callback,
+                                    std::map<std::string, std::string> const& keywords) {
+
+    bool has_nodata = false;
+    double nodata = 0;
+    if (norm_2(shift) > 0){
+
+      double scale = get_rounding_error(shift, rounding_error);
+      std::map<std::string, std::string> local_keywords = keywords;
+      local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+      local_keywords[ASP_POINT_SCALE_TAG_STR]  = vw::num_to_str(scale);
+
+      write_gdal_image(filename,
+                       fixed_point_encode(subtract_shift(image.impl(), shift), scale),
+                       has_georef, georef, has_nodata, nodata,
+                       fixed_point_write_options(opt), progress_callback,
+                       local_keywords);
+
+    }else{
+
+      write_gdal_image(filename, image, has_georef, georef,
+                       has_nodata, nodata, opt, progress_callback, keywords);
+
+    }
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
@@ -0,0 +1,393 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DecodedImageCache.cc
+///
+
+#include <asp/Core/DecodedImageCache.h>
+#include <asp/Core/ObjectStorage.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/config.h>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal_priv.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#endif
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // A lock file not touched for this long is left from a process
+  // which died while decoding
+  const int STALE_LOCK_SECONDS = 600;
+
+  // Bands of rows read at a time, when the image is one JPEG2000 tile
+  const int SINGLE_TILE_BAND_HEIGHT = 1024;
+
+  // The tile size of the decoded files
+  const int DECODED_TILE_SIZE = 256;
+
+  uint64 string_hash(std::string const& str) {
+    // 64-bit FNV-1a
+    const uint64 FNV_OFFSET = 14695981039346656037ULL, FNV_PRIME = 1099511628211ULL;
+    uint64 hash = FNV_OFFSET;
+    for (size_t i = 0; i < str.size(); i++) {
+      hash ^= uint64(static_cast<unsigned char>(str[i]));
+      hash *= FNV_PRIME;
+    }
+    return hash;
+  }
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+
+  GDALDataset* open_image(std::string const& image_file) {
+    GDALAllRegister();
+    return static_cast<GDALDataset*>(GDALOpen(image_file.c_str(), GA_ReadOnly));
+  }
+
+  bool is_jpeg2000_dataset(GDALDataset * dataset) {
+    std::string driver = dataset->GetDriver()->GetDescription();
+    if (driver == "JP2OpenJPEG" || driver == "JP2KAK" || driver == "JP2ECW" ||
+        driver == "JP2MrSID"    || driver == "JPEG2000")
+      return true;
+    if (driver != "NITF")
+      return false;
+    // C8 and M8 are the NITF codes for JPEG2000, without and with a mask
+    const char * ic = dataset->GetMetadataItem("NITF_IC");
+    return ic != NULL && (std::string(ic) == "C8" || std::string(ic) == "M8");
+  }
+
+  /// Copy the georeference, the metadata, including the RPC model, and
+  /// the nodata values
+  void copy_image_info(GDALDataset * in, GDALDataset * out) {
+    double transform[6];
+    if (in->GetGeoTransform(transform) == CE_None)
+      out->SetGeoTransform(transform);
+    else if (in->GetGCPCount() > 0)
+      out->SetGCPs(in->GetGCPCount(), in->GetGCPs(), in->GetGCPProjection());
+    const char * proj = in->GetProjectionRef();
+    if (proj != NULL && proj[0] != '\0')
+      out->SetProjection(proj);
+
+    if (in->GetMetadata() != NULL)
+      out->SetMetadata(in->GetMetadata());
+    if (in->GetMetadata("RPC") != NULL)
+      out->SetMetadata(in->GetMetadata("RPC"), "RPC");
+
+    for (int b = 1; b <= in->GetRasterCount(); b++) {
+      int has_nodata = 0;
+      double nodata = in->GetRasterBand(b)->GetNoDataValue(&has_nodata);
+      if (has_nodata)
+        out->GetRasterBand(b)->SetNoDataValue(nodata);
+    }
+  }
+
+  /// What the decoding tasks share
+  struct DecodeState {
+    std::string image_file, lock_file;
+    GDALDataset * out;
+    int cols, rows, num_bands, pixel_bytes;
+    GDALDataType data_type;
+    Mutex mutex;             ///< Guards the members below, and the output
+    int64 rows_done;
+    std::string error;
+    TerminalProgressCallback tpc;
+    DecodeState(): out(NULL), cols(0), rows(0), num_bands(0), pixel_bytes(0),
+                   data_type(GDT_Unknown), rows_done(0), tpc("asp", "\t--> Decoding: ") {}
+  };
+
+  /// Decode a range of rows of the image in bands, with a dataset
+  /// handle of its own, and write them to the output
+  class DecodeRowsTask: public Task, private boost::noncopyable {
+    DecodeState & m_state;
+    int m_beg_row, m_end_row, m_band_height, m_codec_threads;
+  public:
+    DecodeRowsTask(DecodeState & state, int beg_row, int end_row, int band_height,
+                   int codec_threads):
+      m_state(state), m_beg_row(beg_row), m_end_row(end_row), m_band_height(band_height),
+      m_codec_threads(codec_threads) {}
+
+    void operator()() {
+      if (m_beg_row >= m_end_row)
+        return;
+
+      // The OpenJPEG and Kakadu drivers read these when opening the image
+      std::string threads = boost::lexical_cast<std::string>(m_codec_threads);
+      CPLSetThreadLocalConfigOption("GDAL_NUM_THREADS", threads.c_str());
+      CPLSetThreadLocalConfigOption("JP2KAK_THREADS",   threads.c_str());
+      GDALDataset * in = open_image(m_state.image_file);
+      CPLSetThreadLocalConfigOption("GDAL_NUM_THREADS", NULL);
+      CPLSetThreadLocalConfigOption("JP2KAK_THREADS",   NULL);
+      if (in == NULL) {
+        Mutex::Lock lock(m_state.mutex);
+        m_state.error = "Could not open: " + m_state.image_file;
+        return;
+      }
+
+      int pixel_space = m_state.num_bands*m_state.pixel_bytes;
+      std::vector<char> buf;
+      for (int row = m_beg_row; row < m_end_row; row += m_band_height) {
+        int num_rows = std::min(m_band_height, m_end_row - row);
+        buf.resize(size_t(m_state.cols)*num_rows*pixel_space);
+        CPLErr err = in->RasterIO(GF_Read, 0, row, m_state.cols, num_rows, &buf[0],
+                                  m_state.cols, num_rows, m_state.data_type,
+                                  m_state.num_bands, NULL, pixel_space,
+                                  m_state.cols*pixel_space, m_state.pixel_bytes);
+
+        Mutex::Lock lock(m_state.mutex);
+        if (!m_state.error.empty())
+          break;
+        if (err == CE_None)
+          err = m_state.out->RasterIO(GF_Write, 0, row, m_state.cols, num_rows, &buf[0],
+                                      m_state.cols, num_rows, m_state.data_type,
+                                      m_state.num_bands, NULL, pixel_space,
+                                      m_state.cols*pixel_space, m_state.pixel_bytes);
+        if (err != CE_None) {
+          m_state.error = "Failed to decode rows " + boost::lexical_cast<std::string>(row)
+            + " to " + boost::lexical_cast<std::string>(row + num_rows) + " of "
+            + m_state.image_file + ": " + CPLGetLastErrorMsg();
+          break;
+        }
+
+        // Let the processes waiting for this image know that it is progressing
+        boost::system::error_code ec;
+        fs::last_write_time(m_state.lock_file, std::time(NULL), ec);
+
+        m_state.rows_done += num_rows;
+        m_state.tpc.report_fractional_progress(m_state.rows_done, m_state.rows);
+      }
+
+      GDALClose(in);
+    }
+  };
+
+  /// Decode the image into the given file, with the given number of
+  /// threads. Convert the pixels to float if asked.
+  void decode_image(std::string const& image_file, std::string const& out_file,
+                    std::string const& lock_file, int num_threads, bool as_float) {
+
+    GDALDataset * in = open_image(image_file);
+    if (in == NULL)
+      vw_throw( IOErr() << "Could not open: " << image_file << "\n" );
+
+    DecodeState state;
+    state.image_file  = image_file;
+    state.lock_file   = lock_file;
+    state.cols        = in->GetRasterXSize();
+    state.rows        = in->GetRasterYSize();
+    state.num_bands   = in->GetRasterCount();
+    state.data_type   = as_float ? GDT_Float32 : in->GetRasterBand(1)->GetRasterDataType();
+    state.pixel_bytes = GDALGetDataTypeSize(state.data_type)/8;
+    int block_cols = 0, block_rows = 0;
+    in->GetRasterBand(1)->GetBlockSize(&block_cols, &block_rows);
+
+    GDALDriver * driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    std::string tile_size = boost::lexical_cast<std::string>(DECODED_TILE_SIZE);
+    char ** options = NULL;
+    options = CSLSetNameValue(options, "TILED",      "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", tile_size.c_str());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", tile_size.c_str());
+    options = CSLSetNameValue(options, "INTERLEAVE", "PIXEL");
+    options = CSLSetNameValue(options, "COMPRESS",   "NONE");
+    options = CSLSetNameValue(options, "BIGTIFF",    "IF_SAFER");
+    state.out = driver->Create(out_file.c_str(), state.cols, state.rows, state.num_bands,
+                               state.data_type, options);
+    CSLDestroy(options);
+    if (state.out == NULL) {
+      GDALClose(in);
+      vw_throw( IOErr() << "Could not create: " << out_file << "\n" );
+    }
+    copy_image_info(in, state.out);
+    GDALClose(in);
+
+    // With many JPEG2000 tiles, give each thread its own bands of
+    // tiles. With one tile, read it in order, with the codec threads.
+    int num_tasks = 1, codec_threads = num_threads, band_height = SINGLE_TILE_BAND_HEIGHT;
+    if (block_rows > 0 && block_rows < state.rows) {
+      num_tasks     = num_threads;
+      codec_threads = 1;
+      band_height   = block_rows*std::max(1, DECODED_TILE_SIZE/block_rows);
+    }
+    int num_bands_of_rows = (state.rows + band_height - 1)/band_height;
+    num_tasks = std::max(1, std::min(num_tasks, num_bands_of_rows));
+
+    vw_out() << "Decoding " << image_file << " to " << out_file << " with "
+             << num_threads << " threads.\n";
+    FifoWorkQueue queue(num_tasks);
+    for (int t = 0; t < num_tasks; t++) {
+      int beg = band_height*int((long long)num_bands_of_rows*t/num_tasks);
+      int end = std::min(state.rows,
+                         band_height*int((long long)num_bands_of_rows*(t+1)/num_tasks));
+      boost::shared_ptr<DecodeRowsTask>
+        task(new DecodeRowsTask(state, beg, end, band_height, codec_threads));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    state.tpc.report_finished();
+
+    GDALClose(state.out);
+    if (!state.error.empty())
+      vw_throw( IOErr() << state.error << "\n" );
+  }
+
+#endif
+
+} // end anonymous namespace
+
+bool is_jpeg2000_image(std::string const& image_file) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  GDALDataset * dataset = open_image(image_file);
+  if (dataset == NULL)
+    return false;
+  bool ans = is_jpeg2000_dataset(dataset);
+  GDALClose(dataset);
+  return ans;
+#else
+  return false;
+#endif
+}
+
+namespace {
+
+  /// The cache file for the image, with the tag before the hash
+  std::string cache_file_name(std::string const& image_file, std::string const& cache_dir,
+                              std::string const& tag) {
+    // The name of the local copy of an object has its size and time in it
+    fs::path path;
+    std::ostringstream key;
+    if (is_remote_object(image_file)) {
+      path = fs::path(object_cache_file(image_file, cache_dir));
+      key << path.string();
+    } else {
+      path = fs::system_complete(image_file);
+      key << path.string() << " " << fs::file_size(path) << " " << fs::last_write_time(path);
+    }
+    std::ostringstream os;
+    os << path.stem().string() << tag << "-" << std::hex << std::setw(16) << std::setfill('0')
+       << string_hash(key.str()) << ".tif";
+    return (fs::path(cache_dir) / os.str()).string();
+  }
+
+  /// Decode the image into the cache file, unless that was done
+  /// already, or wait for the process decoding it
+  std::string cached_decode(std::string const& image_file, std::string const& cache_file,
+                            int num_threads, bool as_float) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+    fs::create_directories(fs::path(cache_file).parent_path());
+    std::string lock_file = cache_file + ".lock";
+
+    // Wait for any other process decoding this image, and take over
+    // its lock if it died.
+    bool announced = false;
+    while (!fs::exists(cache_file)) {
+      int fd = ::open(lock_file.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+      if (fd >= 0) {
+        ::close(fd);
+        break;
+      }
+      boost::system::error_code ec;
+      std::time_t touched = fs::last_write_time(lock_file, ec);
+      if (!ec && std::time(NULL) - touched > STALE_LOCK_SECONDS) {
+        fs::remove(lock_file, ec);
+        continue;
+      }
+      if (!announced)
+        vw_out() << "Waiting for another process to decode " << image_file << ".\n";
+      announced = true;
+      ::sleep(1);
+    }
+
+    if (fs::exists(cache_file)) {
+      boost::system::error_code ec;
+      fs::remove(lock_file, ec);
+      vw_out() << "Using the decoded image: " << cache_file << "\n";
+      return cache_file;
+    }
+
+    // Write under a temporary name, then rename
+    std::ostringstream tmp_name;
+    tmp_name << cache_file << ".tmp" << ::getpid() << ".tif";
+    try {
+      decode_image(image_file, tmp_name.str(), lock_file, std::max(1, num_threads), as_float);
+      fs::rename(tmp_name.str(), cache_file);
+    } catch (...) {
+      boost::system::error_code ec;
+      fs::remove(tmp_name.str(), ec);
+      fs::remove(lock_file, ec);
+      throw;
+    }
+    boost::system::error_code ec;
+    fs::remove(lock_file, ec);
+    return cache_file;
+#else
+    return image_file;
+#endif
+  }
+
+} // end anonymous namespace
+
+std::string decoded_image_cache_file(std::string const& image_file,
+                                     std::string const& cache_dir) {
+  return cache_file_name(image_file, cache_dir, "");
+}
+
+std::string decoded_image_path(std::string const& image_file,
+                               std::string const& cache_dir,
+                               int num_threads) {
+  if (cache_dir.empty() || !is_jpeg2000_image(image_file))
+    return image_file;
+  return cached_decode(image_file, decoded_image_cache_file(image_file, cache_dir),
+                       num_threads, false);
+}
+
+std::string float_image_cache_file(std::string const& image_file,
+                                   std::string const& cache_dir) {
+  return cache_file_name(image_file, cache_dir, "-float");
+}
+
+std::string float_image_path(std::string const& image_file,
+                             std::string const& cache_dir,
+                             int num_threads) {
+  if (cache_dir.empty())
+    return image_file;
+  return cached_decode(image_file, float_image_cache_file(image_file, cache_dir),
+                       num_threads, true);
+}
+
+} // namespace asp
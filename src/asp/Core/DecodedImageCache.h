@@ -0,0 +1,80 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DecodedImageCache.h
+///
+/// Decode JPEG2000 images, such as the DigitalGlobe NITF files with
+/// JPEG2000 compression, once, into uncompressed tiled GeoTIFF files
+/// in a cache directory which the tools reading these images share.
+///
+/// The image is decoded with several threads. If it is made of many
+/// JPEG2000 tiles, each thread opens it on its own and decodes a range
+/// of bands of rows. If it is one large tile, decoding a band of rows
+/// means decoding much of the tile, so the rows are read in order and
+/// the codec is asked to use the threads instead, which the OpenJPEG
+/// and Kakadu drivers of GDAL do for the code-blocks.
+///
+/// A cached file is named after a hash of the path, size and
+/// modification time of the image, so a changed image is decoded
+/// again. It is written under a temporary name and renamed, and a lock
+/// file makes processes which need the same image at the same time
+/// wait for the one decoding it.
+///
+/// Images, such as DEMs, can also be converted to float pixels this
+/// way, so that the file can be mapped in memory as it is.
+
+#ifndef __ASP_CORE_DECODED_IMAGE_CACHE_H__
+#define __ASP_CORE_DECODED_IMAGE_CACHE_H__
+
+#include <string>
+
+namespace asp {
+
+  /// If the image is compressed with JPEG2000, as a .jp2 file or
+  /// inside a NITF file
+  bool is_jpeg2000_image(std::string const& image_file);
+
+  /// The file in the cache directory where the image would be decoded
+  std::string decoded_image_cache_file(std::string const& image_file,
+                                       std::string const& cache_dir);
+
+  /// Decode the image into the cache directory with the given number
+  /// of threads, unless that was done already, and return the decoded
+  /// file. Return the image itself if it is not compressed with
+  /// JPEG2000 or if the cache directory is empty.
+  std::string decoded_image_path(std::string const& image_file,
+                                 std::string const& cache_dir,
+                                 int num_threads);
+
+  /// The file in the cache directory where the image would be
+  /// converted to float
+  std::string float_image_cache_file(std::string const& image_file,
+                                     std::string const& cache_dir);
+
+  /// Convert the image, such as a compressed DEM, into an uncompressed
+  /// tiled GeoTIFF file with float pixels in the cache directory, in
+  /// the same way as decoded_image_path(), unless that was done
+  /// already, and return that file. Return the image itself if the
+  /// cache directory is empty.
+  std::string float_image_path(std::string const& image_file,
+                               std::string const& cache_dir,
+                               int num_threads);
+
+} // namespace asp
+
+#endif // __ASP_CORE_DECODED_IMAGE_CACHE_H__
@@ -19,6 +19,7 @@
 /// \file DEMDisparity.cc
 ///
 
+#include <vw/Core/Settings.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/Transform.h>
 #include <vw/Image/MaskViews.h>
@@ -30,6 +31,8 @@
 #include <vw/InterestPoint/MatrixIO.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/DemDisparity.h>
+#include <asp/Core/CoherentPointToPixel.h>
+#include <asp/Core/SharedDem.h>
 
 #include <boost/filesystem/operations.hpp>
 namespace fs = boost::filesystem;
@@ -49,10 +52,15 @@ namespace asp {
     boost::shared_ptr<camera::CameraModel> m_left_camera_model;
     boost::shared_ptr<camera::CameraModel> m_right_camera_model;
     bool            m_do_align;
-    Matrix<double>  m_align_left_matrix, m_align_right_matrix;
-    int             m_pixel_sample;
+    // Made once, as each HomographyTransform inverts its matrix
+    HomographyTransform m_align_left_trans, m_align_right_trans;
+    int             m_pixel_sample, m_lattice_spacing;
     ImageView<PixelMask<Vector2i> > & m_disparity_spread;
 
+    // The tolerance, in low-res pixels, of the bilinear interpolation
+    // of the disparity and of its spread in lattice mode
+    static const double LATTICE_TOL;
+
   public:
     DemDisparity( ImageViewBase<ImageT> const& left_image,
                   double dem_error, GeoReference dem_georef,
@@ -62,7 +70,8 @@ namespace asp {
                   boost::shared_ptr<camera::CameraModel> right_camera_model,
                   bool do_align,
                   Matrix<double> const& align_left_matrix, Matrix<double> const& align_right_matrix,
-                  int pixel_sample, ImageView<PixelMask<Vector2i> > & disparity_spread)
+                  int pixel_sample, int lattice_spacing,
+                  ImageView<PixelMask<Vector2i> > & disparity_spread)
       :m_left_image(left_image.impl()),
        m_dem_error(dem_error),
        m_dem_georef(dem_georef),
@@ -71,9 +80,9 @@ namespace asp {
        m_left_camera_model(left_camera_model),
        m_right_camera_model(right_camera_model),
        m_do_align(do_align),
-       m_align_left_matrix(align_left_matrix),
-       m_align_right_matrix(align_right_matrix),
-       m_pixel_sample(pixel_sample),
+       m_align_left_trans (do_align ? align_left_matrix  : Matrix<double>(math::identity_matrix<3>())),
+       m_align_right_trans(do_align ? align_right_matrix : Matrix<double>(math::identity_matrix<3>())),
+       m_pixel_sample(pixel_sample), m_lattice_spacing(lattice_spacing),
        m_disparity_spread(disparity_spread){}
 
     // Image View interface
@@ -136,7 +145,7 @@ namespace asp {
         Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
         if (m_do_align){
           // Need to go to the image pixel in the untransformed image
-          left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+          left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
         }
 
         bool has_intersection;
@@ -174,93 +183,224 @@ namespace asp {
       ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
 
       // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
+      if (m_lattice_spacing <= 1 ||
+          !lattice_disparity(bbox, dem_crop, georef_crop, lowres_disparity)) {
+        // Consecutive points project to nearby right image lines
+        CoherentPointToPixel right_point_to_pixel(m_right_camera_model.get());
+        for (int row = bbox.min().y(); row < bbox.max().y(); row++){
+          if (row%m_pixel_sample != 0) continue;
+
+          // Must wipe the previous guess since we are now too far from it
+          prev_xyz = Vector3();
+          right_point_to_pixel.reset();
+
+          for (int col = bbox.min().x(); col < bbox.max().x(); col++){
+            if (col%m_pixel_sample != 0) continue;
+            Vector2 mid, half_range;
+            if (pixel_disparity(Vector2(col, row), dem_crop, georef_crop, prev_xyz,
+                                right_point_to_pixel, mid, half_range))
+              set_disparity(lowres_disparity, col, row, mid, half_range);
+          }
+        }
+      }
 
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        if (row%m_pixel_sample != 0) continue;
+      return lowres_disparity;
+    }
 
-        // Must wipe the previous guess since we are now too far from it
-        prev_xyz = Vector3();
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
 
-        for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-          if (col%m_pixel_sample != 0) continue;
+  private:
 
-          Vector2 left_lowres_pix = Vector2(col, row);
+    // Intersect the ray from the given left low-res pixel with the DEM,
+    // and project the intersection, moved by -m_dem_error, 0, and
+    // m_dem_error along the ray, into the right image. Return the
+    // middle and half-width of the resulting range of disparities.
+    bool pixel_disparity(Vector2 const& left_lowres_pix,
+                         ImageView<PixelMask<float> > const& dem_crop,
+                         GeoReference const& georef_crop,
+                         Vector3 & prev_xyz,
+                         CoherentPointToPixel & right_point_to_pixel,
+                         Vector2 & mid, Vector2 & half_range) const {
 
-          Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
-          if (m_do_align){
-            // Need to go to the image pixel in the untransformed image
-            left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
-          }
+      double height_error_tol = std::max(m_dem_error/4.0, 1.0); // height error in meters
+      double max_abs_tol      = height_error_tol/4.0; // abs cost function change b/w iterations
+      double max_rel_tol      = 1e-14;                // rel cost function change b/w iterations
+      int    num_max_iter     = 50;
+      bool   treat_nodata_as_zero = false;
 
-          bool has_intersection;
-          Vector3 left_camera_ctr, left_camera_vec;
-          try {
-            left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
-            left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
-          } catch (...) {
-            continue;
-          }
-          Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
-                                                dem_crop, georef_crop,
-                                                treat_nodata_as_zero,
-                                                has_intersection,
-                                                height_error_tol, max_abs_tol,
-                                                max_rel_tol, num_max_iter,
-                                                prev_xyz
-                                                );
-          if ( !has_intersection || xyz == Vector3() ) continue;
-          prev_xyz = xyz;
-
-          // Since our DEM is only known approximately, the true
-          // intersection point of the ray coming from the left camera
-          // with the DEM could be anywhere within m_dem_error from
-          // xyz. Use that to get an estimate of the disparity
-          // error.
-
-          ImageView< PixelMask<Vector2> > curr_pixel_disp_range(3, 1);
-          double bias[] = {-1.0, 1.0, 0.0};
-          int success[] = {0, 0, 0};
-
-          for (int k = 0; k < curr_pixel_disp_range.cols(); k++){
-
-            Vector2 right_fullres_pix;
-            try {
-              right_fullres_pix = m_right_camera_model->point_to_pixel(xyz + bias[k]*m_dem_error*left_camera_vec);
-            } catch (...) {
-              curr_pixel_disp_range(k, 0).invalidate();
-              continue;
-            }
-            if (m_do_align){
-              right_fullres_pix = HomographyTransform(m_align_right_matrix).forward(right_fullres_pix);
-            }
+      Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
+      if (m_do_align){
+        // Need to go to the image pixel in the untransformed image
+        left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
+      }
 
-            Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
-            curr_pixel_disp_range(k, 0) = right_lowres_pix - left_lowres_pix;
-            success[k] = 1;
+      bool has_intersection;
+      Vector3 left_camera_ctr, left_camera_vec;
+      try {
+        left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
+        left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
+      } catch (...) {
+        return false;
+      }
+      Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
+                                            dem_crop, georef_crop,
+                                            treat_nodata_as_zero,
+                                            has_intersection,
+                                            height_error_tol, max_abs_tol,
+                                            max_rel_tol, num_max_iter,
+                                            prev_xyz
+                                            );
+      if ( !has_intersection || xyz == Vector3() ) return false;
+      prev_xyz = xyz;
+
+      // Since our DEM is only known approximately, the true
+      // intersection point of the ray coming from the left camera
+      // with the DEM could be anywhere within m_dem_error from
+      // xyz. Use that to get an estimate of the disparity
+      // error.
+
+      ImageView< PixelMask<Vector2> > curr_pixel_disp_range(3, 1);
+      double bias[] = {-1.0, 1.0, 0.0};
+      int success[] = {0, 0, 0};
+
+      for (int k = 0; k < curr_pixel_disp_range.cols(); k++){
+
+        Vector2 right_fullres_pix;
+        try {
+          right_fullres_pix = right_point_to_pixel(xyz + bias[k]*m_dem_error*left_camera_vec);
+        } catch (...) {
+          curr_pixel_disp_range(k, 0).invalidate();
+          continue;
+        }
+        if (m_do_align){
+          right_fullres_pix = m_align_right_trans.forward(right_fullres_pix);
+        }
 
-            // If the disparities at the endpoints of the range were successful,
-            // don't bother with the middle estimate.
-            if (k == 1 && success[0] && success[1]) break;
-          }
+        Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
+        curr_pixel_disp_range(k, 0) = right_lowres_pix - left_lowres_pix;
+        success[k] = 1;
 
-          BBox2f search_range = stereo::get_disparity_range(curr_pixel_disp_range);
-          if (search_range ==  BBox2f(0,0,0,0)) continue;
+        // If the disparities at the endpoints of the range were successful,
+        // don't bother with the middle estimate.
+        if (k == 1 && success[0] && success[1]) break;
+      }
 
-          lowres_disparity(col, row) = round( (search_range.min() + search_range.max())/2.0 );
-          m_disparity_spread(col, row) = ceil( (search_range.max() - search_range.min())/2.0 );
+      BBox2f search_range = stereo::get_disparity_range(curr_pixel_disp_range);
+      if (search_range ==  BBox2f(0,0,0,0)) return false;
 
-        }
-      }
+      mid        = (search_range.min() + search_range.max())/2.0;
+      half_range = (search_range.max() - search_range.min())/2.0;
+      return true;
+    }
 
-      return lowres_disparity;
+    void set_disparity(prerasterize_type & lowres_disparity, int col, int row,
+                       Vector2 const& mid, Vector2 const& half_range) const {
+      lowres_disparity(col, row)   = round(mid);
+      m_disparity_spread(col, row) = ceil(half_range);
     }
 
-    template <class DestT>
-    inline void rasterize(DestT const& dest, BBox2i bbox) const {
-      vw::rasterize(prerasterize(bbox), dest, bbox);
+    // The sampled pixels from 'beg' to 'end' (exclusive), with a node
+    // every 'step' pixels and at the last one.
+    void lattice_nodes(int beg, int end, std::vector<int> & nodes) const {
+      nodes.clear();
+      int first = ((beg + m_pixel_sample - 1)/m_pixel_sample)*m_pixel_sample;
+      int last  = ((end - 1)/m_pixel_sample)*m_pixel_sample;
+      if (first > last) return;
+      int step = m_pixel_sample*m_lattice_spacing;
+      for (int v = first; v < last; v += step)
+        nodes.push_back(v);
+      nodes.push_back(last);
+    }
+
+    // Find the disparity exactly on a lattice of the sampled pixels,
+    // every m_lattice_spacing of them. In each cell, if the four
+    // corners succeeded and the bilinear interpolation at the cell
+    // center agrees with the exact value to within LATTICE_TOL, fill
+    // the cell by interpolation, otherwise compute all its pixels
+    // exactly. Return false if the tile is too thin for a lattice.
+    bool lattice_disparity(BBox2i const& bbox,
+                           ImageView<PixelMask<float> > const& dem_crop,
+                           GeoReference const& georef_crop,
+                           prerasterize_type & lowres_disparity) const {
+
+      std::vector<int> xs, ys;
+      lattice_nodes(bbox.min().x(), bbox.max().x(), xs);
+      lattice_nodes(bbox.min().y(), bbox.max().y(), ys);
+      if (xs.size() < 2 || ys.size() < 2)
+        return false;
+
+      int nx = xs.size(), ny = ys.size();
+      std::vector<char>    valid(nx*ny, 0);
+      std::vector<Vector2> mids(nx*ny), halfs(nx*ny);
+      Vector3 prev_xyz;
+      CoherentPointToPixel right_point_to_pixel(m_right_camera_model.get());
+      for (int j = 0; j < ny; j++){
+        prev_xyz = Vector3();
+        right_point_to_pixel.reset();
+        for (int i = 0; i < nx; i++)
+          valid[j*nx + i] = pixel_disparity(Vector2(xs[i], ys[j]), dem_crop, georef_crop, prev_xyz,
+                                            right_point_to_pixel, mids[j*nx + i], halfs[j*nx + i]);
+      }
+
+      for (int j = 0; j < ny - 1; j++){
+        for (int i = 0; i < nx - 1; i++){
+
+          int x0 = xs[i], x1 = xs[i+1], y0 = ys[j], y1 = ys[j+1];
+          int c00 = j*nx + i, c10 = c00 + 1, c01 = c00 + nx, c11 = c01 + 1;
+
+          bool interp = (valid[c00] && valid[c10] && valid[c01] && valid[c11]);
+          if (interp){
+            // Check the interpolation at the sampled pixel closest to the center
+            int cx = x0 + ((x1 - x0)/(2*m_pixel_sample))*m_pixel_sample;
+            int cy = y0 + ((y1 - y0)/(2*m_pixel_sample))*m_pixel_sample;
+            double tx = double(cx - x0)/(x1 - x0), ty = double(cy - y0)/(y1 - y0);
+            Vector2 mid, half_range;
+            prev_xyz = Vector3();
+            right_point_to_pixel.reset();
+            if (!pixel_disparity(Vector2(cx, cy), dem_crop, georef_crop, prev_xyz,
+                                 right_point_to_pixel, mid, half_range)){
+              interp = false;
+            }else{
+              Vector2 imid  = (1-ty)*((1-tx)*mids [c00] + tx*mids [c10])
+                            +    ty *((1-tx)*mids [c01] + tx*mids [c11]);
+              Vector2 ihalf = (1-ty)*((1-tx)*halfs[c00] + tx*halfs[c10])
+                            +    ty *((1-tx)*halfs[c01] + tx*halfs[c11]);
+              interp = (norm_inf(imid - mid) <= LATTICE_TOL &&
+                        norm_inf(ihalf - half_range) <= LATTICE_TOL);
+            }
+          }
+
+          for (int row = y0; row <= y1; row += m_pixel_sample){
+            prev_xyz = Vector3();
+            right_point_to_pixel.reset();
+            for (int col = x0; col <= x1; col += m_pixel_sample){
+              if (interp){
+                double tx = double(col - x0)/(x1 - x0), ty = double(row - y0)/(y1 - y0);
+                Vector2 mid  = (1-ty)*((1-tx)*mids [c00] + tx*mids [c10])
+                             +    ty *((1-tx)*mids [c01] + tx*mids [c11]);
+                Vector2 half = (1-ty)*((1-tx)*halfs[c00] + tx*halfs[c10])
+                             +    ty *((1-tx)*halfs[c01] + tx*halfs[c11]);
+                set_disparity(lowres_disparity, col, row, mid, half);
+              }else{
+                Vector2 mid, half_range;
+                if (pixel_disparity(Vector2(col, row), dem_crop, georef_crop, prev_xyz,
+                                    right_point_to_pixel, mid, half_range))
+                  set_disparity(lowres_disparity, col, row, mid, half_range);
+              }
+            }
+          }
+        }
+      }
+      return true;
     }
   };
 
+  template <class ImageT, class DEMImageT>
+  const double DemDisparity<ImageT, DEMImageT>::LATTICE_TOL = 0.5;
+
   template <class ImageT, class DEMImageT>
   DemDisparity<ImageT, DEMImageT>
   dem_disparity( ImageViewBase<ImageT> const& left,
@@ -272,7 +412,7 @@ namespace asp {
                  bool do_align,
                  Matrix<double> const& align_left_matrix,
                  Matrix<double> const& align_right_matrix,
-                 int pixel_sample,
+                 int pixel_sample, int lattice_spacing,
                  ImageView<PixelMask<Vector2i> > & disparity_spread
                  ) {
     typedef DemDisparity<ImageT, DEMImageT> return_type;
@@ -281,7 +421,7 @@ namespace asp {
                         dem, downsample_scale,
                         left_camera_model, right_camera_model,
                         do_align, align_left_matrix, align_right_matrix,
-                        pixel_sample, disparity_spread
+                        pixel_sample, lattice_spacing, disparity_spread
                         );
   }
 
@@ -311,19 +451,13 @@ namespace asp {
       vw_throw( ArgumentErr() << "dem_disparity: Invalid value for disparity-estimation-dem-error: " << dem_error << ".\n" );
     }
 
-    GeoReference dem_georef;
-    bool has_georef = cartography::read_georeference(dem_georef, dem_file);
-    if (!has_georef)
-      vw_throw( ArgumentErr() << "There is no georeference information in: " << dem_file << ".\n" );
-
-    DiskImageView<float> dem_disk_image(dem_file);
-    ImageViewRef<PixelMask<float > > dem = pixel_cast<PixelMask<float> >(dem_disk_image);
-    boost::shared_ptr<DiskImageResource> rsrc( DiskImageResourcePtr(dem_file) );
-    if ( rsrc->has_nodata_read() ){
-      double nodata_value = rsrc->nodata_read();
-      if ( !std::isnan(nodata_value) )
-        dem = create_mask(dem_disk_image, nodata_value);
-    }
+    // The processes of parallel_stereo can share one mapped copy of the DEM
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    asp::SharedDem shared_dem(dem_file, stereo_settings().dem_cache_dir, num_threads);
+    GeoReference dem_georef = shared_dem.georef();
+    ImageViewRef<PixelMask<float > > dem = shared_dem.masked_dem();
 
     Vector2f downsample_scale( float(left_image_sub.cols()) / float(left_image.cols()),
                                float(left_image_sub.rows()) / float(left_image.rows()) );
@@ -358,7 +492,9 @@ namespace asp {
                                                        left_camera_model, right_camera_model,
                                                        do_align,
                                                        align_left_matrix, align_right_matrix,
-                                                       pixel_sample, disparity_spread
+                                                       pixel_sample,
+                                                       stereo_settings().disparity_estimation_dem_lattice,
+                                                       disparity_spread
                                                        ));
     std::string disparity_file = opt.out_prefix + "-D_sub.tif";
     vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
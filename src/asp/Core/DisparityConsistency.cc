@@ -0,0 +1,148 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DisparityConsistency.cc
+///
+
+#include <asp/Core/DisparityConsistency.h>
+#include <asp/Core/CensusTransform.h>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // The mean absolute difference of the left image around (lc, lr)
+  // and of the right image around (rc, rr), over the pixels of the
+  // kernel in both images.
+  double match_cost(ImageView<float> const& left,  int lc, int lr,
+                    ImageView<float> const& right, int rc, int rr,
+                    Vector2i const& half_kernel) {
+    double sum = 0;
+    int count = 0;
+    for (int dr = -half_kernel[1]; dr <= half_kernel[1]; dr++) {
+      int l_row = lr + dr, r_row = rr + dr;
+      if (l_row < 0 || l_row >= left.rows() || r_row < 0 || r_row >= right.rows())
+        continue;
+      for (int dc = -half_kernel[0]; dc <= half_kernel[0]; dc++) {
+        int l_col = lc + dc, r_col = rc + dc;
+        if (l_col < 0 || l_col >= left.cols() || r_col < 0 || r_col >= right.cols())
+          continue;
+        sum += std::fabs(left(l_col, l_row) - right(r_col, r_row));
+        count++;
+      }
+    }
+    if (count == 0)
+      return std::numeric_limits<double>::max();
+    return sum/count;
+  }
+
+  /// The cost of matching a left and a right pixel
+  class MatchCost {
+  public:
+    MatchCost(ImageView<float> const& left, ImageView<float> const& right,
+              Vector2i const& kernel_size, asp::ConsistencyCost cost):
+      m_left(left), m_right(right), m_half_kernel(kernel_size/2) {
+      if (cost == asp::MEAN_ABSOLUTE_DIFFERENCE)
+        return;
+      // The census of each tile once, rather than at each match
+      bool ternary = (cost == asp::TERNARY_CENSUS_COST);
+      m_left_census.reset (new asp::CensusImage(left,  kernel_size, ternary,
+                                                asp::TERNARY_CENSUS_THRESHOLD));
+      m_right_census.reset(new asp::CensusImage(right, kernel_size, ternary,
+                                                asp::TERNARY_CENSUS_THRESHOLD));
+    }
+
+    double operator()(int lc, int lr, int rc, int rr) const {
+      if (!m_left_census)
+        return match_cost(m_left, lc, lr, m_right, rc, rr, m_half_kernel);
+      if (lc < 0 || lc >= m_left.cols() || lr < 0 || lr >= m_left.rows())
+        return std::numeric_limits<double>::max();
+      return m_left_census->cost(lc, lr, *m_right_census, rc, rr);
+    }
+
+  private:
+    ImageView<float> const& m_left;
+    ImageView<float> const& m_right;
+    Vector2i m_half_kernel;
+    boost::shared_ptr<asp::CensusImage> m_left_census, m_right_census;
+  };
+
+} // end anonymous namespace
+
+namespace asp {
+
+  int single_pass_consistency_check(ImageView<float> const& left,
+                                    Vector2i const& left_origin,
+                                    ImageView<float> const& right,
+                                    Vector2i const& right_origin,
+                                    Vector2i const& kernel_size,
+                                    double threshold,
+                                    ImageView<PixelMask<Vector2f> > & disp,
+                                    ConsistencyCost cost_type) {
+
+    MatchCost match(left, right, kernel_size, cost_type);
+    int cols = disp.cols();
+
+    // The best match of each right image pixel, as the disparity pixel index
+    std::vector<int>    best_match(size_t(right.cols())*right.rows(), -1);
+    std::vector<double> best_cost (best_match.size(), std::numeric_limits<double>::max());
+    std::vector<int>    target    (size_t(cols)*disp.rows(), -1);
+
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < cols; col++) {
+        PixelMask<Vector2f> const& d = disp(col, row);
+        if (!is_valid(d))
+          continue;
+        int rc = col + int(floor(d.child()[0] + 0.5)) - right_origin[0];
+        int rr = row + int(floor(d.child()[1] + 0.5)) - right_origin[1];
+        if (rc < 0 || rc >= right.cols() || rr < 0 || rr >= right.rows())
+          continue;
+        int index = row*cols + col, r_index = rr*right.cols() + rc;
+        target[index] = r_index;
+        double cost = match(col - left_origin[0], row - left_origin[1], rc, rr);
+        if (cost < best_cost[r_index]) {
+          best_cost [r_index] = cost;
+          best_match[r_index] = index;
+        }
+      }
+    }
+
+    // The right to left disparity at the match of a left pixel is minus
+    // the disparity of the best match there.
+    int num_invalidated = 0;
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < cols; col++) {
+        int index = row*cols + col;
+        if (target[index] < 0)
+          continue;
+        int best = best_match[target[index]];
+        Vector2f diff = disp(col, row).child() - disp(best % cols, best / cols).child();
+        if (std::fabs(diff[0]) > threshold || std::fabs(diff[1]) > threshold) {
+          disp(col, row).invalidate();
+          num_invalidated++;
+        }
+      }
+    }
+    return num_invalidated;
+  }
+
+} // namespace asp
@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DisparityConsistency.h
+///
+/// A left-right consistency check done with the left to right
+/// disparity alone, without correlating the images a second time with
+/// their roles swapped. The disparity of a right image pixel is taken
+/// to be the one, among the left image pixels matched to it, of lowest
+/// matching cost, which is the minimum along the diagonal of the cost
+/// volume restricted to the forward matches. A left pixel whose
+/// disparity differs from that by more than a threshold is discarded.
+
+#ifndef __ASP_CORE_DISPARITY_CONSISTENCY_H__
+#define __ASP_CORE_DISPARITY_CONSISTENCY_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  /// The cost of matching pixels in the consistency check
+  enum ConsistencyCost {
+    MEAN_ABSOLUTE_DIFFERENCE,
+    CENSUS_COST,         ///< The Hamming distance of the census, as in CensusTransform.h
+    TERNARY_CENSUS_COST  ///< Of the ternary census, with the threshold below
+  };
+
+  /// The threshold of the ternary census of the normalized images
+  const float TERNARY_CENSUS_THRESHOLD = 2.0/255.0;
+
+  /// Invalidate the pixels of the disparity which are not consistent
+  /// with the implied right to left disparity. The left and right
+  /// images have their pixel (0, 0) at the disparity pixel left_origin
+  /// and right_origin, respectively, and should extend by half the
+  /// kernel size past the disparity and its matches. The matching cost
+  /// is the mean absolute difference over the kernel, or, to agree with
+  /// SGM run with a census cost, the census one. Returns the number of
+  /// pixels invalidated.
+  int single_pass_consistency_check(vw::ImageView<float> const& left,
+                                    vw::Vector2i const& left_origin,
+                                    vw::ImageView<float> const& right,
+                                    vw::Vector2i const& right_origin,
+                                    vw::Vector2i const& kernel_size,
+                                    double threshold,
+                                    vw::ImageView<vw::PixelMask<vw::Vector2f> > & disp,
+                                    ConsistencyCost cost = MEAN_ABSOLUTE_DIFFERENCE);
+
+} // namespace asp
+
+#endif // __ASP_CORE_DISPARITY_CONSISTENCY_H__
@@ -20,6 +20,15 @@
 ///
 
 #include <asp/Core/EigenUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
 
 // Allows FileIO to correctly read/write these pixel types
 namespace vw {
@@ -49,147 +58,290 @@ void null_check(const char* token, std::string const& line){
     vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
 }
 
-void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::vector<int>& elems){
+namespace {
+  int  g_point_loading_threads     = 0;
+  bool g_stratified_point_sampling = false;
 
-  // Out of the elements 0, 1,..., n - 1, pick m unique
-  // random elements and sort them in increasing order.
-
-  elems.clear();
+  int point_loading_threads(){
+    if (g_point_loading_threads > 0)
+      return g_point_loading_threads;
+    return std::max(1, int(vw::vw_settings().default_num_threads()));
+  }
 
-  if (m < 1 || n < 1) return;
-  if (m > n) m = n;
+  // DEMs and point clouds are read in blocks of this many pixels on a
+  // side, and CSV files in blocks of this many lines.
+  const int POINT_LOADING_BLOCK_SIZE = 1024;
+  const int CSV_LINES_PER_BLOCK      = 65536;
+
+  // Spread the low 16 bits of x to the even bits of the result
+  vw::uint32 spread_bits(vw::uint32 x){
+    x &= 0x0000FFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+  }
 
-  std::vector<int> all(n);
-  for (int i = 0; i < n; i++) all[i] = i;
+  vw::uint32 reverse_bits(vw::uint32 x){
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+  }
 
-  // Swap a randomly selected element from index 0 to j with the one
-  // at index j. Then decrement j. Done after m elements are
-  // processed.
-  for (int j = n-1; j >= n-m; j--){
-    int r = rand()%(j+1); // 0 <= r <= j
-    std::swap(all[r], all[j]);
+  bool less_index(std::pair<vw::uint64, int> const& a, std::pair<vw::uint64, int> const& b){
+    return a.second < b.second;
   }
+}
 
-  elems.resize(m);
-  for (int i = 0; i < m; i++) elems[i] = all[n-m+i];
-  std::sort(elems.begin(), elems.end());
+void set_point_loading_threads(int num_threads){
+  g_point_loading_threads = num_threads;
+}
 
+void set_stratified_point_sampling(bool stratified){
+  g_stratified_point_sampling = stratified;
 }
 
-// Return at most m random points out of the input point cloud.
-void random_pc_subsample(int m, DoubleMatrix& points){
+vw::uint64 sampling_key(vw::int64 index, vw::uint64 seed){
+  // The splitmix64 finalizer, which maps consecutive integers to
+  // well-spread values
+  vw::uint64 z = (vw::uint64(index) + 1)*0x9E3779B97F4A7C15ULL + seed;
+  z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
 
-  int n = points.cols();
-  std::vector<int> elems;
-  pick_at_most_m_unique_elems_from_n_elems(m, n, elems);
-  m = elems.size();
+SamplingGrid::SamplingGrid(vw::BBox2 const& box, double min_cell_size, bool stratified):
+  m_box(box), m_cell_size(min_cell_size), m_stratified(stratified && !box.empty()){
+  if (!m_stratified)
+    return;
+  m_cell_size = std::max(min_cell_size, std::max(box.width(), box.height())/65536.0);
+  if (!(m_cell_size > 0))
+    m_stratified = false; // A box of zero size
+}
 
-  for (int col = 0; col < m; col++){
-    for (int row = 0; row < DIM; row++)
-      points(row, col) = points(row, elems[col]);
-  }
-  points.conservativeResize(Eigen::NoChange, m);
+vw::uint64 SamplingGrid::key(vw::int64 index, vw::Vector2 const& location) const {
+  vw::uint64 random = sampling_key(index);
+  if (!m_stratified)
+    return random;
+
+  double cx = floor((location.x() - m_box.min().x())/m_cell_size);
+  double cy = floor((location.y() - m_box.min().y())/m_cell_size);
+  cx = std::min(std::max(cx, 0.0), 65535.0);
+  cy = std::min(std::max(cy, 0.0), 65535.0);
+  vw::uint32 cell = reverse_bits(spread_bits(vw::uint32(cx)) | (spread_bits(vw::uint32(cy)) << 1));
+  return (vw::uint64(cell) << 32) | (random >> 32);
 }
 
-int load_csv_aux(std::string const& file_name, int num_points_to_load,
-                 vw::BBox2 const& lonlat_box,
-                 bool calc_shift, vw::Vector3 & shift,
-                 vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
-                 bool & is_lola_rdr_format, double & mean_longitude,
-                 bool verbose, DoubleMatrix & data){
+PointReservoir::PointReservoir(int capacity): m_capacity(std::max(capacity, 0)){}
+
+bool PointReservoir::accepts(vw::uint64 key, vw::int64 index) const {
+  if ((int)m_items.size() < m_capacity)
+    return true;
+  if (m_items.empty())
+    return false;
+  Item probe;
+  probe.key   = key;
+  probe.index = index;
+  return probe < m_items.front();
+}
 
-  // Note: The input CsvConv object is responsible for parsing out the
-  //       type of information contained in the CSV file.
+void PointReservoir::add(vw::uint64 key, vw::int64 index, vw::Vector3 const& xyz, double lon){
+  if (!accepts(key, index))
+    return;
+
+  Item item;
+  item.key   = key;
+  item.index = index;
+  item.xyz   = xyz;
+  item.lon   = lon;
+  if ((int)m_items.size() < m_capacity){
+    m_items.push_back(item);
+    std::push_heap(m_items.begin(), m_items.end());
+  }else{
+    // Replace the item with the largest key
+    std::pop_heap(m_items.begin(), m_items.end());
+    m_items.back() = item;
+    std::push_heap(m_items.begin(), m_items.end());
+  }
+}
 
-  is_lola_rdr_format = false;
+void PointReservoir::merge(PointReservoir const& other){
+  for (size_t it = 0; it < other.m_items.size(); it++){
+    Item const& item = other.m_items[it];
+    add(item.key, item.index, item.xyz, item.lon);
+  }
+}
 
-  int num_total_points = csv_file_size(file_name);
+void PointReservoir::to_matrix(bool calc_shift, vw::Vector3 & shift,
+                               DoubleMatrix & data, double & mean_longitude) const {
 
-  std::string sep_str = csv_separator();
-  const char* sep = sep_str.c_str();
+  // Put the points in the order of the source
+  std::vector< std::pair<vw::int64, int> > order(m_items.size());
+  for (size_t it = 0; it < m_items.size(); it++)
+    order[it] = std::make_pair(m_items[it].index, int(it));
+  std::sort(order.begin(), order.end());
 
-  const int bufSize = 1024;
-  char temp[bufSize];
-  std::ifstream file( file_name.c_str() );
-  if( !file ) {
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file_name << "\"" );
-  }
+  int num_points = order.size();
+  data.conservativeResize(DIM+1, num_points);
+  if (calc_shift && num_points > 0)
+    shift = m_items[order[0].second].xyz;
 
-  // We will randomly pick or not a point with probability load_ratio
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
+  mean_longitude = 0.0;
+  for (int col = 0; col < num_points; col++){
+    Item const& item = m_items[order[col].second];
+    for (int row = 0; row < DIM; row++)
+      data(row, col) = item.xyz[row] - shift[row];
+    data(DIM, col) = 1; // Extend to be a homogenous coordinate
+    mean_longitude += item.lon;
+  }
+  if (num_points > 0)
+    mean_longitude /= num_points;
+}
 
-  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
+// Return at most m random points out of the input point cloud.
+void random_pc_subsample(int m, DoubleMatrix& points, DoubleMatrix* aux){
 
-  // Peek at the first valid line and see how many elements it has
-  std::string line;
-  while ( getline(file, line, '\n') ) {
-    if (is_valid_csv_line(line))
-      break;
+  int n = points.cols();
+  if (aux != NULL && aux->cols() != n)
+    vw_throw( vw::LogicErr() << "random_pc_subsample: Size mismatch.\n");
+  if (m >= n)
+    return;
+  m = std::max(m, 0);
+
+  // Keep the columns with the smallest keys in a max-heap, so that
+  // only the m columns kept are in memory.
+  const vw::uint64 seed = 1; // different from the loaders
+  std::vector< std::pair<vw::uint64, int> > heap;
+  heap.reserve(m);
+  for (int col = 0; col < n && m > 0; col++){
+    std::pair<vw::uint64, int> item(sampling_key(col, seed), col);
+    if ((int)heap.size() < m){
+      heap.push_back(item);
+      std::push_heap(heap.begin(), heap.end());
+    }else if (item < heap.front()){
+      std::pop_heap(heap.begin(), heap.end());
+      heap.back() = item;
+      std::push_heap(heap.begin(), heap.end());
+    }
   }
 
-  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
-  strncpy(temp, line.c_str(), bufSize);
-  const char* token = strtok (temp, sep);
-  int numTokens = 0;
-  while (token != NULL){
-    numTokens++;
-    token = strtok (NULL, sep);
-  }
-  if (numTokens < 3){
-    vw_throw( vw::IOErr() << "Expecting at least three fields on each "
-                          << "line of file: " << file_name << "\n" );
+  // Move the columns kept to the front, in their order, which is
+  // in place as each one goes to the same place or before it.
+  std::sort(heap.begin(), heap.end(), less_index);
+  for (int col = 0; col < m; col++){
+    for (int row = 0; row < points.rows(); row++)
+      points(row, col) = points(row, heap[col].second);
+    if (aux != NULL) {
+      for (int row = 0; row < aux->rows(); row++)
+        (*aux)(row, col) = (*aux)(row, heap[col].second);
+    }
   }
+  points.conservativeResize(Eigen::NoChange, m);
+  if (aux != NULL)
+    aux->conservativeResize(Eigen::NoChange, m);
+}
 
-  if (!csv_conv.is_configured()){
-    if (numTokens > 20){
-      is_lola_rdr_format = true;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name <<
-	  " to be in LOLA RDR PointPerRow format.\n";
-    }else{
-      is_lola_rdr_format = false;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name
-                     << " to be in latitude,longitude,height above datum (meters) format.\n";
+namespace {
+  // The integer coordinates of a voxel, with a hash so they can be
+  // kept in an unordered set.
+  struct VoxelIndex {
+    long long x, y, z;
+    VoxelIndex(long long x_in, long long y_in, long long z_in): x(x_in), y(y_in), z(z_in){}
+    bool operator==(VoxelIndex const& other) const {
+      return x == other.x && y == other.y && z == other.z;
     }
+  };
+
+  std::size_t hash_value(VoxelIndex const& v){
+    std::size_t seed = 0;
+    boost::hash_combine(seed, v.x);
+    boost::hash_combine(seed, v.y);
+    boost::hash_combine(seed, v.z);
+    return seed;
   }
-  // TODO: We parse these guessed file types manually but we should
-  // use a CsvConv object to do it!!!!!
+}
 
-  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
-    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
-              << " LOLA RDR format, yet the datum semi-axes are not equal "
-              << "as expected for the Moon.\n" );
-  }
+void voxel_pc_subsample(double voxel_size, DoubleMatrix& points){
 
-  bool shift_was_calc = false;
-  bool is_first_line  = true;
-  int points_count = 0;
-  mean_longitude = 0.0;
-  line = "";
-  while ( getline(file, line, '\n') ){
+  if (voxel_size <= 0)
+    return;
 
-    if (!is_first_line && !line.empty() && line[0] == '#') {
-      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-      continue;
-    }
-    
-    if (points_count >= num_points_to_load)
-      break;
+  boost::unordered_set<VoxelIndex> used;
+  int n = points.cols(), m = 0;
+  for (int col = 0; col < n; col++){
+    VoxelIndex v((long long)floor(points(0, col)/voxel_size),
+                 (long long)floor(points(1, col)/voxel_size),
+                 (long long)floor(points(2, col)/voxel_size));
+    if (!used.insert(v).second)
+      continue; // There is a point in this voxel already
 
-    if (!is_valid_csv_line(line))
-      continue;
+    for (int row = 0; row < DIM; row++)
+      points(row, m) = points(row, col);
+    m++;
+  }
+  points.conservativeResize(Eigen::NoChange, m);
+}
 
-    // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
-      continue;
+namespace {
+
+  // What the tasks loading parts of a source share
+  struct PointLoadState: private boost::noncopyable {
+    PointReservoir reservoir;
+    vw::Mutex      mutex;
+    std::string    error;  // The first error met by a task
+    vw::TerminalProgressCallback * tpc;
+    double         inc_amount;
+    PointLoadState(int capacity):
+      reservoir(capacity), tpc(NULL), inc_amount(0.0){}
+
+    // Add the points found by a task, and report progress
+    void finish(PointReservoir const& local){
+      vw::Mutex::Lock lock(mutex);
+      reservoir.merge(local);
+      if (tpc != NULL)
+        tpc->report_incremental_progress(inc_amount);
+    }
 
-    // We went with C-style file reading instead of C++ in this instance
-    // because we found it to be significantly faster on large files.
+    void set_error(std::string const& message){
+      vw::Mutex::Lock lock(mutex);
+      if (error.empty())
+        error = message;
+    }
 
-    vw::Vector3 xyz;
-    double lon = 0.0, lat = 0.0;
+    void rethrow() const {
+      if (!error.empty())
+        vw_throw(vw::ArgumentErr() << error);
+    }
+  };
+
+  // The format of a CSV file, as found from its first valid line
+  struct CsvFormat {
+    vw::int64 first_line;  // The index of the first valid line, which may be a header
+    bool      is_lola_rdr_format;
+  };
+
+  // Parse a line in the lat,lon,height or LOLA RDR format, or with a
+  // CsvConv. Return false for lines to skip.
+  bool parse_csv_point(std::string const& line, bool is_first_line,
+                       CsvFormat const& format, CsvConv const& csv_conv,
+                       vw::cartography::GeoReference const& geo,
+                       vw::BBox2 const& lonlat_box, std::string const& file_name,
+                       vw::Vector3 & xyz, double & lon, double & lat){
+
+    std::string sep_str = csv_separator();
+    const char* sep = sep_str.c_str();
+    const int bufSize = 1024;
+    char temp[bufSize];
+    char* saveptr = NULL;
+    lon = 0.0;
+    lat = 0.0;
+
+    // We went with C-style parsing instead of C++ in this instance
+    // because we found it to be significantly faster on large files.
+    // The tokenizer must be reentrant, as lines are parsed in parallel.
 
     if (csv_conv.is_configured()){
 
@@ -197,7 +349,7 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       bool success;
       CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
       if (!success)
-        continue;
+        return false;
 
       xyz = csv_conv.csv_to_cartesian(vals, geo);
 
@@ -212,42 +364,40 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
                               && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
                               && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
-        continue;
+        return false;
       }
 
-    }else if (!is_lola_rdr_format){
+    }else if (!format.is_lola_rdr_format){
 
       // lat,lon,height format
       double height;
 
       strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
+      temp[bufSize - 1] = '\0';
+      const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
       int ret = sscanf(token, "%lg", &lat);
 
-      token = strtok(NULL, sep); null_check(token, line);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &lon);
 
-      token = strtok(NULL, sep); null_check(token, line);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &height);
 
       // Be prepared for the fact that the first line may be the header.
       if (ret != 3){
-        if (!is_first_line){
+        if (!is_first_line)
           vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
+        return false;
       }
-      is_first_line = false;
 
       // Skip points outside the given box
       if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+        return false;
 
       vw::Vector3 llh( lon, lat, height );
       xyz = geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) ) continue; // invalid and NaN check
+      if ( xyz == vw::Vector3() || !(xyz == xyz) )
+        return false; // invalid and NaN check
 
     }else{
 
@@ -256,72 +406,57 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       // We will ignore lines which do not start with year (or a value that
       // cannot be converted into an integer greater than zero, specifically).
 
-      int year, month, day, hour, min;
-      double lat, rad, sec, is_invalid;
+      int year = 0, month, day, hour, min;
+      double rad, sec, is_invalid;
 
       strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
+      temp[bufSize - 1] = '\0';
+      const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
 
       int ret = sscanf(token, "%d-%d-%dT%d:%d:%lg", &year, &month, &day, &hour,
                        &min, &sec);
       if( year <= 0 )
-        continue;
+        return false;
 
-      token = strtok(NULL, sep); null_check(token, line);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &lon);
 
-      token = strtok(NULL, sep); null_check(token, line);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &lat);
-      token = strtok(NULL, sep); null_check(token, line);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &rad);
       rad *= 1000; // km to m
 
       // Scan 7 more fields, until we get to the is_invalid flag.
       for (int i = 0; i < 7; i++)
-        token = strtok(NULL, sep); null_check(token, line);
+        token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
       ret += sscanf(token, "%lg", &is_invalid);
 
       // Be prepared for the fact that the first line may be the header.
       if (ret != 10){
-        if (!is_first_line){
+        if (!is_first_line)
           vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
+        return false;
       }
-      is_first_line = false;
 
       if (is_invalid)
-        continue;
+        return false;
 
       // Skip points outside the given box
       if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+        return false;
 
       vw::Vector3 lonlatrad( lon, lat, 0 );
 
       xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
       if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
+        return false; // invalid and NaN check
 
       // Adjust the point so that it is at the right distance from
       // planet center.
       xyz = rad*(xyz/norm_2(xyz));
     }
 
-    if (calc_shift && !shift_was_calc){
-      shift = xyz;
-      shift_was_calc = true;
-    }
-
-    for (int row = 0; row < DIM; row++)
-      data(row, points_count) = xyz[row] - shift[row];
-    data(DIM, points_count) = 1;
-
-    points_count++;
-    mean_longitude += lon;
-
     // Throw an error if the lon and lat are not within bounds.
     // Note that we allow some slack for lon, perhaps the point
     // cloud is say from 350 to 370 degrees.
@@ -331,13 +466,77 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
     if (lon < -360.0 || lon > 2*360.0)
       vw_throw(vw::ArgumentErr() << "Invalid longitude value: "
                << lon << " in " << file_name << "\n");
+
+    return true;
   }
-  data.conservativeResize(Eigen::NoChange, points_count);
 
-  mean_longitude /= points_count;
+  // Parse a block of lines of a CSV file
+  class CsvLoadTask: public vw::Task, private boost::noncopyable {
+    boost::shared_ptr< std::vector<std::string> > m_lines;
+    vw::int64 m_first_index; // of the block in the file
+    CsvFormat m_format;
+    CsvConv const& m_csv_conv;
+    vw::cartography::GeoReference m_geo;
+    vw::BBox2 m_lonlat_box;
+    SamplingGrid const& m_grid;
+    std::string m_file_name;
+    int m_capacity;
+    PointLoadState & m_state;
+  public:
+    CsvLoadTask(boost::shared_ptr< std::vector<std::string> > lines, vw::int64 first_index,
+                CsvFormat const& format, CsvConv const& csv_conv,
+                vw::cartography::GeoReference const& geo, vw::BBox2 const& lonlat_box,
+                SamplingGrid const& grid, std::string const& file_name,
+                int capacity, PointLoadState & state):
+      m_lines(lines), m_first_index(first_index), m_format(format), m_csv_conv(csv_conv),
+      m_geo(geo), m_lonlat_box(lonlat_box), m_grid(grid), m_file_name(file_name),
+      m_capacity(capacity), m_state(state){}
+
+    void operator()(){
+      try {
+        PointReservoir local(m_capacity);
+        bool stratified = g_stratified_point_sampling;
+        for (size_t it = 0; it < m_lines->size(); it++){
+          std::string const& line = (*m_lines)[it];
+          vw::int64 index = m_first_index + it;
+          if (!is_valid_csv_line(line))
+            continue;
+
+          // Without stratification, the key does not depend on the
+          // point, so most lines need not be parsed.
+          vw::uint64 key = 0;
+          if (!stratified){
+            key = sampling_key(index);
+            if (!local.accepts(key, index))
+              continue;
+          }
+
+          vw::Vector3 xyz;
+          double lon, lat;
+          bool is_first_line = (index == m_format.first_line);
+          if (!parse_csv_point(line, is_first_line, m_format, m_csv_conv, m_geo,
+                               m_lonlat_box, m_file_name, xyz, lon, lat))
+            continue;
+
+          if (stratified){
+            // Longitudes are wrapped to the grid
+            vw::Vector2 lonlat(lon, lat);
+            if (m_lonlat_box.empty())
+              lonlat[0] -= 360.0*floor((lonlat[0] + 180.0)/360.0);
+            else
+              lonlat[0] += 360.0*round((m_lonlat_box.center().x() - lonlat[0])/360.0);
+            key = m_grid.key(index, lonlat);
+          }
+          local.add(key, index, xyz, lon);
+        }
+        m_state.finish(local);
+      } catch (std::exception const& e){
+        m_state.set_error(e.what());
+      }
+    }
+  };
 
-  return num_total_points;
-}
+} // end anonymous namespace
 
 // Load a csv file
 void load_csv(std::string const& file_name,
@@ -352,37 +551,310 @@ void load_csv(std::string const& file_name,
                  bool verbose,
                  DoubleMatrix & data){
 
-  int num_total_points = load_csv_aux(file_name, num_points_to_load,
-				      lonlat_box,
-				      calc_shift, shift,
-				      geo, csv_conv, is_lola_rdr_format,
-				      mean_longitude, verbose, data);
-  
+  // Note: The input CsvConv object is responsible for parsing out the
+  //       type of information contained in the CSV file.
+
+  is_lola_rdr_format = false;
+
+  std::string sep_str = csv_separator();
+  const char* sep = sep_str.c_str();
+
+  const int bufSize = 1024;
+  char temp[bufSize];
+  std::ifstream file( file_name.c_str() );
+  if( !file ) {
+    vw_throw( vw::IOErr() << "Unable to open file \"" << file_name << "\"" );
+  }
+
+  // Peek at the first valid line and see how many elements it has
+  CsvFormat format;
+  format.first_line = 0;
+  std::string line;
+  while ( getline(file, line, '\n') ) {
+    if (is_valid_csv_line(line))
+      break;
+    format.first_line++;
+  }
+
+  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
+  strncpy(temp, line.c_str(), bufSize);
+  temp[bufSize - 1] = '\0';
+  const char* token = strtok (temp, sep);
+  int numTokens = 0;
+  while (token != NULL){
+    numTokens++;
+    token = strtok (NULL, sep);
+  }
+  if (numTokens < 3){
+    vw_throw( vw::IOErr() << "Expecting at least three fields on each "
+                          << "line of file: " << file_name << "\n" );
+  }
+
+  if (!csv_conv.is_configured()){
+    if (numTokens > 20){
+      is_lola_rdr_format = true;
+      if (verbose)
+        vw::vw_out() << "Guessing file " << file_name <<
+	  " to be in LOLA RDR PointPerRow format.\n";
+    }else{
+      is_lola_rdr_format = false;
+      if (verbose)
+        vw::vw_out() << "Guessing file " << file_name
+                     << " to be in latitude,longitude,height above datum (meters) format.\n";
+    }
+  }
+  format.is_lola_rdr_format = is_lola_rdr_format;
+  // TODO: We parse these guessed file types manually but we should
+  // use a CsvConv object to do it!!!!!
+
+  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
+    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
+              << " LOLA RDR format, yet the datum semi-axes are not equal "
+              << "as expected for the Moon.\n" );
+  }
+
+  // Read blocks of lines, and parse them in parallel. A few blocks per
+  // thread are read at a time, to bound the memory use. The points are
+  // sampled in the same pass, so the file is read only once.
+  vw::BBox2 grid_box = lonlat_box;
+  if (grid_box.empty())
+    grid_box = vw::BBox2(-180.0, -90.0, 360.0, 180.0);
+  SamplingGrid grid(grid_box, 0.0, g_stratified_point_sampling);
+  PointLoadState state(num_points_to_load);
+  int num_threads = point_loading_threads();
+  vw::int64 line_index = 0;
+  bool done = false;
+  while (!done){
+    vw::FifoWorkQueue queue(num_threads);
+    for (int b = 0; b < 2*num_threads && !done; b++){
+      boost::shared_ptr< std::vector<std::string> > lines(new std::vector<std::string>());
+      lines->reserve(CSV_LINES_PER_BLOCK);
+      vw::int64 first_index = line_index;
+      while ((int)lines->size() < CSV_LINES_PER_BLOCK){
+        if (!getline(file, line, '\n')){
+          done = true;
+          break;
+        }
+        if (line_index > format.first_line && !line.empty() && line[0] == '#')
+          vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
+        lines->push_back(line);
+        line_index++;
+      }
+      queue.add_task(boost::shared_ptr<vw::Task>
+                     (new CsvLoadTask(lines, first_index, format, csv_conv, geo, lonlat_box,
+                                      grid, file_name, num_points_to_load, state)));
+    }
+    queue.join_all();
+    state.rethrow();
+  }
+
+  state.reservoir.to_matrix(calc_shift, shift, data, mean_longitude);
+}
+
+bool can_use_point_cache(std::string const& file_name, CsvConv const& csv_conv){
+  return use_point_cache() &&
+    (is_las(file_name) || (is_csv(file_name) && csv_conv.is_configured()));
+}
+
+vw::int64 load_cached_cloud_aux(std::string const& file_name,
+                                int num_points_to_load,
+                                vw::BBox2 const& lonlat_box,
+                                bool calc_shift,
+                                vw::Vector3 & shift,
+                                double & mean_longitude,
+                                DoubleMatrix & data){
+
+  PointCacheReader reader(point_cache_file(file_name));
+  PointCacheHeader const& header = reader.header();
+
+  // We will randomly pick or not a point with probability load_ratio
+  vw::int64 num_total_points = header.num_points;
+  double load_ratio
+    = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
+  data.conservativeResize(DIM+1, std::min(vw::int64(num_points_to_load), num_total_points));
+
+  // Longitudes are put in the range of the source file, around its mean.
+  bool is_csv_file = is_csv(file_name);
+  bool shift_was_calc = false;
+  vw::int64 points_count = 0;
+  mean_longitude = 0.0;
+  // Chunks with no points in the box are skipped by the reader, and
+  // the lon-lat of the others were saved in the cache.
+  std::vector<double> x, y, z, lon, lat;
+  while (points_count < num_points_to_load && reader.read_chunk(x, y, z, lon, lat, lonlat_box)){
+    for (size_t i = 0; i < x.size(); i++){
+
+      if (points_count >= num_points_to_load)
+        break;
+
+      double r = (double)std::rand()/(double)RAND_MAX;
+      if (r > load_ratio)
+        continue;
+
+      vw::Vector3 xyz(x[i], y[i], z[i]);
+      if (!lonlat_box.empty() || is_csv_file){
+        vw::Vector2 lonlat(lon[i], lat[i]);
+        lonlat[0] += 360.0*round((header.mean_longitude - lonlat[0])/360.0);
+        if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
+                                && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
+                                && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
+          continue;
+        }
+        mean_longitude += lonlat[0];
+      }
+
+      if (calc_shift && !shift_was_calc){
+        shift = xyz;
+        shift_was_calc = true;
+      }
+
+      for (int row = 0; row < DIM; row++)
+        data(row, points_count) = xyz[row] - shift[row];
+      data(DIM, points_count) = 1;
+
+      points_count++;
+    }
+  }
+
+  data.conservativeResize(Eigen::NoChange, points_count);
+
+  // The mean longitude is only needed for CSV files
+  if (is_csv_file && points_count > 0)
+    mean_longitude /= points_count;
+  else
+    mean_longitude = 0.0;
+
+  return num_total_points;
+}
+
+void load_cached_cloud(std::string const& file_name,
+                       int num_points_to_load,
+                       vw::BBox2 const& lonlat_box,
+                       bool calc_shift,
+                       vw::Vector3 & shift,
+                       vw::cartography::GeoReference const& geo,
+                       CsvConv const& csv_conv,
+                       double & mean_longitude, bool verbose,
+                       DoubleMatrix & data){
+
+  if (!point_cache_is_valid(file_name, csv_conv, geo))
+    write_point_cache(file_name, csv_conv, geo);
+  else if (verbose)
+    vw::vw_out() << "Using point cache: " << point_cache_file(file_name) << std::endl;
+
+  vw::int64 num_total_points = load_cached_cloud_aux(file_name, num_points_to_load,
+                                                     lonlat_box, calc_shift, shift,
+                                                     mean_longitude, data);
+
   int num_loaded_points = data.cols();
   if (!lonlat_box.empty()                    &&
       num_loaded_points < num_points_to_load &&
       num_loaded_points < num_total_points){
-    // We loaded too few points. Just load them all, as CSV files are
-    // not too large, we will drop extraneous points later.
-    load_csv_aux(file_name, num_total_points, lonlat_box,
-		 calc_shift, shift,
-		 geo, csv_conv, is_lola_rdr_format,
-		 mean_longitude,
-		 false, // Skip repeating same messages
-                 data);
+    // We loaded too few points. Try harder, reading the cache is cheap.
+    if (verbose)
+      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
+    double num_to_load = std::max(4.0*num_points_to_load, 10000000.0);
+    num_to_load = std::min(num_to_load, double(std::numeric_limits<int>::max()));
+    load_cached_cloud_aux(file_name, int(num_to_load), lonlat_box, calc_shift, shift, mean_longitude, data);
   }
-  
-  return;
 }
 
+namespace {
+
+  // Whether a block of pixels of a georeferenced image may have some
+  // in the lon-lat box, judging by points on the border of the block,
+  // with some slack as these may miss the extremes.
+  bool block_may_be_in_box(vw::cartography::GeoReference const& geo,
+                           vw::BBox2i const& block, vw::BBox2 const& lonlat_box){
+    const int num_samples = 8;
+    vw::BBox2 block_box;
+    try {
+      for (int k = 0; k <= num_samples; k++){
+        double x = block.min().x() + double(k)*block.width() /num_samples;
+        double y = block.min().y() + double(k)*block.height()/num_samples;
+        block_box.grow(geo.pixel_to_lonlat(vw::Vector2(x, block.min().y())));
+        block_box.grow(geo.pixel_to_lonlat(vw::Vector2(x, block.max().y())));
+        block_box.grow(geo.pixel_to_lonlat(vw::Vector2(block.min().x(), y)));
+        block_box.grow(geo.pixel_to_lonlat(vw::Vector2(block.max().x(), y)));
+      }
+    } catch(...){
+      return true; // Cannot tell
+    }
+    block_box.expand(0.1*std::max(block_box.width(), block_box.height()));
+    return block_box.intersects(lonlat_box);
+  }
+
+  // Load a block of a DEM
+  template<typename DemPixelType>
+  class DemLoadTask: public vw::Task, private boost::noncopyable {
+    vw::DiskImageView<DemPixelType> m_dem;
+    vw::cartography::GeoReference   m_geo;
+    DemPixelType        m_nodata;
+    vw::BBox2i          m_block;
+    vw::BBox2           m_lonlat_box;
+    SamplingGrid const& m_grid;
+    int                 m_capacity;
+    PointLoadState    & m_state;
+  public:
+    DemLoadTask(vw::DiskImageView<DemPixelType> const& dem,
+                vw::cartography::GeoReference const& geo, DemPixelType nodata,
+                vw::BBox2i const& block, vw::BBox2 const& lonlat_box,
+                SamplingGrid const& grid, int capacity, PointLoadState & state):
+      m_dem(dem), m_geo(geo), m_nodata(nodata), m_block(block), m_lonlat_box(lonlat_box),
+      m_grid(grid), m_capacity(capacity), m_state(state){}
+
+    void operator()(){
+      try {
+        PointReservoir local(m_capacity);
+
+        // Skip the blocks out of the box without reading them
+        if (m_lonlat_box.empty() || block_may_be_in_box(m_geo, m_block, m_lonlat_box)){
+
+          vw::ImageView<DemPixelType> tile = crop(m_dem, m_block);
+          for (int row = 0; row < tile.rows(); row++){
+            for (int col = 0; col < tile.cols(); col++){
+
+              DemPixelType height = tile(col, row);
+              if ( height == m_nodata || std::isnan(height) || std::isinf(height) )
+                continue;
+
+              // Check the key first, as finding the point is the slow part
+              int i = m_block.min().x() + col, j = m_block.min().y() + row;
+              vw::int64 index = vw::int64(j)*m_dem.cols() + i;
+              vw::uint64 key  = m_grid.key(index, vw::Vector2(i, j));
+              if (!local.accepts(key, index))
+                continue;
+
+              vw::Vector2 lonlat = m_geo.pixel_to_lonlat( vw::Vector2(i,j) );
+
+              // Skip points outside the given box
+              if (!m_lonlat_box.empty() && !m_lonlat_box.contains(lonlat))
+                continue;
+
+              vw::Vector3 llh( lonlat.x(), lonlat.y(), height );
+              vw::Vector3 xyz = m_geo.datum().geodetic_to_cartesian( llh );
+              if ( xyz == vw::Vector3() || !(xyz == xyz) )
+                continue; // invalid and NaN check
+
+              local.add(key, index, xyz, lonlat.x());
+            }
+          }
+        }
+        m_state.finish(local);
+      } catch (std::exception const& e){
+        m_state.set_error(e.what());
+      }
+    }
+  };
+
+} // end anonymous namespace
+
 // Load a DEM
 template<typename DemPixelType>
 void load_dem_pixel_type(std::string const& file_name,
                          int num_points_to_load, vw::BBox2 const& lonlat_box,
                          bool calc_shift, vw::Vector3 & shift,
                          bool verbose, DoubleMatrix & data){
-  
-  data.conservativeResize(DIM+1, num_points_to_load);
 
   vw::cartography::GeoReference dem_geo;
   bool has_georef = vw::cartography::read_georeference( dem_geo, file_name );
@@ -418,62 +890,32 @@ void load_dem_pixel_type(std::string const& file_name,
   if (pix_box.empty())
     pix_box = bounding_box(dem);
 
-  // We will randomly pick or not a point with probability load_ratio
-  int    num_points = pix_box.width()*pix_box.height();
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_points);
-
-  bool shift_was_calc = false;
-  int  points_count   = 0;
+  // Read the blocks in parallel, each keeping its own sample, which
+  // are merged into one.
+  SamplingGrid grid(vw::BBox2(pix_box), 1.0, g_stratified_point_sampling);
+  PointLoadState state(num_points_to_load);
+  std::vector<vw::BBox2i> blocks = subdivide_bbox(pix_box, POINT_LOADING_BLOCK_SIZE,
+                                                  POINT_LOADING_BLOCK_SIZE);
 
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(pix_box.width() );
-  if (verbose)
+  if (verbose){
     tpc.report_progress(0);
+    state.tpc = &tpc;
+    state.inc_amount = 1.0/std::max(1.0, double(blocks.size()));
+  }
 
-  for (int i = pix_box.min().x(); i < pix_box.max().x(); i++ ) {
-
-    for (int j = pix_box.min().y(); j < pix_box.max().y(); j++ ) {
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      if ( dem(i, j) == nodata || std::isnan(dem(i, j)) || std::isinf(dem(i, j)) )
-        continue;
-      
-      vw::Vector2 lonlat = dem_geo.pixel_to_lonlat( vw::Vector2(i,j) );
-
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat))
-        continue;
-
-      vw::Vector3 llh( lonlat.x(), lonlat.y(), dem(i,j) );
-      vw::Vector3 xyz = dem_geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
-
-      for (int row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1; // Extend to be a homogenous coordinate
-
-      points_count++;
-    } // end y loop
-
-    if (verbose)
-      tpc.report_incremental_progress( inc_amount );
-  } // end x loop
+  vw::FifoWorkQueue queue(point_loading_threads());
+  for (size_t b = 0; b < blocks.size(); b++)
+    queue.add_task(boost::shared_ptr<vw::Task>
+                   (new DemLoadTask<DemPixelType>(dem, dem_geo, nodata, blocks[b], lonlat_box,
+                                                  grid, num_points_to_load, state)));
+  queue.join_all();
   if (verbose)
     tpc.report_finished();
+  state.rethrow();
 
-  data.conservativeResize(Eigen::NoChange, points_count);
-
+  double mean_longitude = 0.0; // not needed for DEMs
+  state.reservoir.to_matrix(calc_shift, shift, data, mean_longitude);
 }
 
 // Load a DEM
@@ -500,71 +942,80 @@ void load_dem(std::string const& file_name,
   }
 }
 
-vw::int64 load_pc_aux(std::string const& file_name,
-		      int num_points_to_load,
-		      vw::BBox2 const& lonlat_box,
-		      bool calc_shift,
-		      vw::Vector3 & shift,
-		      vw::cartography::GeoReference const& geo,
-		      bool verbose, DoubleMatrix & data){
-
-  data.conservativeResize(DIM+1, num_points_to_load);
-
-  // To do: Is it faster to to do for_each?
-  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name);
-
-  // We will randomly pick or not a point with probability load_ratio
-  vw::int64 num_total_points = point_cloud.cols()*point_cloud.rows();
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  bool shift_was_calc = false;
-  vw::int64 points_count = 0;
-
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(point_cloud.rows() );
-  if (verbose) tpc.report_progress(0);
-
-  for (int j = 0; j < point_cloud.rows(); j++ ) {
-
-    for ( int i = 0; i < point_cloud.cols(); i++ ) {
-
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      vw::Vector3 xyz = point_cloud(i, j);
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
+namespace {
+
+  // Whether a point is in the lon-lat box. The geocentric latitude is
+  // within a small multiple of the flattening of the geodetic one, so
+  // the slow conversion to geodetic coordinates is done only for points
+  // near the top and bottom of the box.
+  bool point_in_box(vw::cartography::Datum const& datum, double lat_margin,
+                    vw::BBox2 const& lonlat_box, vw::Vector3 const& xyz){
+    double lon = atan2(xyz[1], xyz[0])*180.0/M_PI;
+    double lat = atan2(xyz[2], sqrt(xyz[0]*xyz[0] + xyz[1]*xyz[1]))*180.0/M_PI;
+    if (lon < lonlat_box.min().x() || lon > lonlat_box.max().x())
+      return false; // Same as for the geodetic longitude
+    if (lat < lonlat_box.min().y() - lat_margin || lat > lonlat_box.max().y() + lat_margin)
+      return false;
+    if (lat > lonlat_box.min().y() + lat_margin && lat < lonlat_box.max().y() - lat_margin)
+      return true;
+    vw::Vector3 llh = datum.cartesian_to_geodetic(xyz);
+    return lonlat_box.contains(subvector(llh, 0, 2));
+  }
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty()){
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
-        if ( !lonlat_box.contains(subvector(llh, 0, 2)))
-          continue;
+  // Load a block of an ASP point cloud. Unlike with a DEM, the place of
+  // a block in the image says nothing of where its points are, so the
+  // lon-lat box is checked point by point, with the shortcut above.
+  class PcLoadTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef<vw::Vector3> m_point_cloud;
+    vw::cartography::Datum m_datum;
+    vw::BBox2i          m_block;
+    vw::BBox2           m_lonlat_box;
+    SamplingGrid const& m_grid;
+    int                 m_capacity;
+    PointLoadState    & m_state;
+  public:
+    PcLoadTask(vw::ImageViewRef<vw::Vector3> const& point_cloud,
+               vw::cartography::Datum const& datum, vw::BBox2i const& block,
+               vw::BBox2 const& lonlat_box, SamplingGrid const& grid,
+               int capacity, PointLoadState & state):
+      m_point_cloud(point_cloud), m_datum(datum), m_block(block), m_lonlat_box(lonlat_box),
+      m_grid(grid), m_capacity(capacity), m_state(state){}
+
+    void operator()(){
+      try {
+        PointReservoir local(m_capacity);
+        double flattening = 1.0 - m_datum.semi_minor_axis()/m_datum.semi_major_axis();
+        double lat_margin = 2.0*std::abs(flattening)*180.0/M_PI + 1e-6;
+
+        vw::ImageView<vw::Vector3> tile = crop(m_point_cloud, m_block);
+        for (int row = 0; row < tile.rows(); row++){
+          for (int col = 0; col < tile.cols(); col++){
+
+            vw::Vector3 xyz = tile(col, row);
+            if ( xyz == vw::Vector3() || !(xyz == xyz) )
+              continue; // invalid and NaN check
+
+            int i = m_block.min().x() + col, j = m_block.min().y() + row;
+            vw::int64 index = vw::int64(j)*m_point_cloud.cols() + i;
+            vw::uint64 key  = m_grid.key(index, vw::Vector2(i, j));
+            if (!local.accepts(key, index))
+              continue;
+
+            // Skip points outside the given box
+            if (!m_lonlat_box.empty() && !point_in_box(m_datum, lat_margin, m_lonlat_box, xyz))
+              continue;
+
+            local.add(key, index, xyz);
+          }
+        }
+        m_state.finish(local);
+      } catch (std::exception const& e){
+        m_state.set_error(e.what());
       }
-
-      for (int row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1;
-
-      points_count++;
     }
-    if (verbose) tpc.report_incremental_progress( inc_amount );
-  }
-  if (verbose) tpc.report_finished();
-
-  data.conservativeResize(Eigen::NoChange, points_count);
+  };
 
-  return num_total_points;
-}
+} // end anonymous namespace
 
 void load_pc(std::string const& file_name,
              int num_points_to_load,
@@ -574,24 +1025,34 @@ void load_pc(std::string const& file_name,
              vw::cartography::GeoReference const& geo,
              bool verbose, DoubleMatrix & data){
 
-  vw::int64 num_total_points = load_pc_aux(file_name, num_points_to_load,
-                                          lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
+  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name);
 
-  int num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
+  // Read the blocks in parallel, each keeping its own sample, which
+  // are merged into one.
+  SamplingGrid grid(vw::BBox2(bounding_box(point_cloud)), 1.0, g_stratified_point_sampling);
+  PointLoadState state(num_points_to_load);
+  std::vector<vw::BBox2i> blocks = subdivide_bbox(point_cloud, POINT_LOADING_BLOCK_SIZE,
+                                                  POINT_LOADING_BLOCK_SIZE);
 
-    // We loaded too few points. Try harder. Need some care here as to not run
-    // out of memory.
-    num_points_to_load = std::max(4*num_points_to_load, 10000000);
-    if (verbose)
-      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
-    load_pc_aux(file_name, num_points_to_load, lonlat_box,
-                calc_shift, shift, geo, verbose, data);
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  if (verbose){
+    tpc.report_progress(0);
+    state.tpc = &tpc;
+    state.inc_amount = 1.0/std::max(1.0, double(blocks.size()));
   }
 
+  vw::FifoWorkQueue queue(point_loading_threads());
+  for (size_t b = 0; b < blocks.size(); b++)
+    queue.add_task(boost::shared_ptr<vw::Task>
+                   (new PcLoadTask(point_cloud, geo.datum(), blocks[b], lonlat_box,
+                                   grid, num_points_to_load, state)));
+  queue.join_all();
+  if (verbose)
+    tpc.report_finished();
+  state.rethrow();
+
+  double mean_longitude = 0.0; // not needed for point clouds
+  state.reservoir.to_matrix(calc_shift, shift, data, mean_longitude);
 }
 
 }
@@ -32,6 +32,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 #include <Eigen/Dense>
+#include <vector>
 
 // A set of routines kept here because they use Eigen, and a set of routine
 // auxiliary to the routines using Eigen. 
@@ -45,9 +46,83 @@ typedef typename Eigen::Matrix<RealT, Eigen::Dynamic, Eigen::Dynamic> DoubleMatr
 // work with 2D point clouds. There are some Vector3's all over the place.
 const int DIM = 3;
 
-// Return at most m random points out of the input point cloud.
-void random_pc_subsample(int m, DoubleMatrix& points);
+// The number of threads the loaders below use (the VW default if not
+// positive), and whether they spread the points they keep evenly over
+// the source rather than picking them at random.
+void set_point_loading_threads(int num_threads);
+void set_stratified_point_sampling(bool stratified);
+
+// A pseudo-random key for the item with this index, the same from one
+// run to the next. The items with the smallest keys form a random
+// sample, whichever order the items are seen in.
+vw::uint64 sampling_key(vw::int64 index, vw::uint64 seed = 0);
+
+// Keys for points in a box, split into square cells, at most 2^16 on
+// a side. If stratified, the cell of the point makes up the high bits
+// of the key, with its coordinates interleaved and then bit-reversed,
+// so the cells with the smallest keys form a lattice over the whole
+// box, which gets finer as more are taken. Points in the same cell
+// are ordered at random. This is the reverse hierarchical order of
+// the GRTS design (Stevens and Olsen, 2004). Otherwise the keys are
+// just random.
+class SamplingGrid {
+  vw::BBox2 m_box;
+  double    m_cell_size;
+  bool      m_stratified;
+public:
+  SamplingGrid(vw::BBox2 const& box, double min_cell_size, bool stratified);
+  vw::uint64 key(vw::int64 index, vw::Vector2 const& location) const;
+};
+
+// Keep, out of the points added to it, the ones with the smallest
+// keys, up to a given number. Reservoirs filled from different parts
+// of a source, in parallel, can be merged into one, with the same
+// result as if all points were added to it.
+class PointReservoir {
+  struct Item {
+    vw::uint64  key;
+    vw::int64   index; // in the source, to break ties and order the result
+    vw::Vector3 xyz;
+    double      lon;
+    bool operator<(Item const& other) const {
+      return key < other.key || (key == other.key && index < other.index);
+    }
+  };
+  int m_capacity;
+  std::vector<Item> m_items; // a max-heap
+public:
+  explicit PointReservoir(int capacity);
+
+  // Whether a point with this key would be kept, so that the work of
+  // finding it can be skipped otherwise
+  bool accepts(vw::uint64 key, vw::int64 index) const;
+
+  void add(vw::uint64 key, vw::int64 index, vw::Vector3 const& xyz, double lon = 0.0);
+  void merge(PointReservoir const& other);
+  int  size() const { return m_items.size(); }
+
+  // The points, in the order they have in the source, in homogeneous
+  // coordinates. If calc_shift, the first one becomes the shift, which
+  // is subtracted from all. Also the mean of the longitudes.
+  void to_matrix(bool calc_shift, vw::Vector3 & shift,
+                 DoubleMatrix & data, double & mean_longitude) const;
+};
+
+// Return at most m random points out of the input point cloud. If
+// given, the columns of 'aux', such as the errors of the points, are
+// kept along with the points.
+void random_pc_subsample(int m, DoubleMatrix& points, DoubleMatrix* aux = NULL);
+
+// Keep only the first point in each cube of the given size, with
+// the cubes forming a grid starting at the origin. This bounds the
+// density of the cloud, so the tree built on it is smaller and
+// faster to search, while its extent is kept.
+void voxel_pc_subsample(double voxel_size, DoubleMatrix& points);
   
+// The loaders below read the source once, in parallel, keeping a
+// sample of at most the given number of points, and only points in the
+// lon-lat box if not empty.
+
 // Load a csv file, perhaps sub-sampling it along the way
 void load_csv(std::string const& file_name,
 	      int num_points_to_load,
@@ -60,6 +135,22 @@ void load_csv(std::string const& file_name,
 	      double & mean_longitude, bool verbose,
 	      DoubleMatrix & data);
   
+// Return true if this file can be loaded through a point cache,
+// which must be enabled and made of a LAS or a CSV file with a format.
+bool can_use_point_cache(std::string const& file_name, CsvConv const& csv_conv);
+
+// Load a LAS or CSV file from its point cache, perhaps sub-sampling
+// it along the way. The cache is created first if missing or stale.
+void load_cached_cloud(std::string const& file_name,
+                       int num_points_to_load,
+                       vw::BBox2 const& lonlat_box,
+                       bool calc_shift,
+                       vw::Vector3 & shift,
+                       vw::cartography::GeoReference const& geo,
+                       CsvConv const& csv_conv,
+                       double & mean_longitude, bool verbose,
+                       DoubleMatrix & data);
+
 // Load a DEM, perhaps subsampling it along the way
 void load_dem(std::string const& file_name,
               int num_points_to_load, vw::BBox2 const& lonlat_box,
@@ -0,0 +1,200 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file FftCorrelation.cc
+///
+
+#include <asp/Core/FftCorrelation.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+#include <limits>
+#include <map>
+
+using namespace vw;
+
+namespace {
+  vw::Mutex g_fft_plan_mutex;
+  std::map<int, boost::shared_ptr<asp::FftPlan> > g_fft_plans;
+}
+
+namespace asp {
+
+  FftPlan::FftPlan(int size): m_size(size) {
+    if (size < 1 || (size & (size - 1)) != 0)
+      vw_throw(ArgumentErr() << "FFT length must be a power of two, got " << size << ".\n");
+
+    int num_bits = 0;
+    while ((1 << num_bits) < size)
+      num_bits++;
+    m_bit_reverse.resize(size);
+    for (int k = 0; k < size; k++) {
+      int r = 0;
+      for (int b = 0; b < num_bits; b++)
+        r |= ((k >> b) & 1) << (num_bits - 1 - b);
+      m_bit_reverse[k] = r;
+    }
+
+    // exp(-2*pi*i*k/size), found in double precision
+    m_twiddles.resize(size/2);
+    for (int k = 0; k < size/2; k++) {
+      double angle = -2.0*M_PI*k/size;
+      m_twiddles[k] = std::complex<float>(cos(angle), sin(angle));
+    }
+  }
+
+  void FftPlan::transform(std::complex<float>* data, bool inverse) const {
+    for (int k = 0; k < m_size; k++) {
+      if (k < m_bit_reverse[k])
+        std::swap(data[k], data[m_bit_reverse[k]]);
+    }
+    for (int len = 2; len <= m_size; len *= 2) {
+      int half = len/2, step = m_size/len;
+      for (int start = 0; start < m_size; start += len) {
+        for (int k = 0; k < half; k++) {
+          std::complex<float> w = m_twiddles[k*step];
+          if (inverse)
+            w = std::conj(w);
+          std::complex<float> a = data[start + k], b = w*data[start + k + half];
+          data[start + k]        = a + b;
+          data[start + k + half] = a - b;
+        }
+      }
+    }
+  }
+
+  FftPlan const& fft_plan(int size) {
+    vw::Mutex::Lock lock(g_fft_plan_mutex);
+    boost::shared_ptr<FftPlan> & plan = g_fft_plans[size];
+    if (!plan)
+      plan.reset(new FftPlan(size));
+    return *plan;
+  }
+
+  int next_power_of_two(int n) {
+    int p = 1;
+    while (p < n)
+      p *= 2;
+    return p;
+  }
+
+  void fft_2d(ImageView<std::complex<float> > & data, bool inverse) {
+    int cols = data.cols(), rows = data.rows();
+    FftPlan const& row_plan = fft_plan(cols);
+    FftPlan const& col_plan = fft_plan(rows);
+
+    // The pixels of an ImageView are contiguous along rows
+    for (int row = 0; row < rows; row++)
+      row_plan.transform(&data(0, row), inverse);
+
+    std::vector<std::complex<float> > column(rows);
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++)
+        column[row] = data(col, row);
+      col_plan.transform(&column[0], inverse);
+      for (int row = 0; row < rows; row++)
+        data(col, row) = column[row];
+    }
+  }
+
+  bool normalized_cross_correlation(ImageView<float> const& tmpl,
+                                    ImageView<float> const& search,
+                                    ImageView<float>      & ncc) {
+
+    int tcols = tmpl.cols(), trows = tmpl.rows();
+    int scols = search.cols(), srows = search.rows();
+    if (tcols < 1 || trows < 1 || tcols > scols || trows > srows)
+      return false;
+
+    // Remove the template mean, so the correlation with the search
+    // image is the numerator of the normalized cross-correlation
+    double mean = 0;
+    for (int row = 0; row < trows; row++)
+      for (int col = 0; col < tcols; col++)
+        mean += tmpl(col, row);
+    mean /= double(tcols)*trows;
+    double sigma_t = 0;
+    for (int row = 0; row < trows; row++) {
+      for (int col = 0; col < tcols; col++) {
+        double d = tmpl(col, row) - mean;
+        sigma_t += d*d;
+      }
+    }
+    sigma_t = sqrt(sigma_t);
+    if (sigma_t <= 0)
+      return false;
+
+    // No wrap-around occurs at the positions kept, as the transform
+    // size is no less than the search image size.
+    ImageView<std::complex<float> > S(next_power_of_two(scols), next_power_of_two(srows));
+    ImageView<std::complex<float> > T(S.cols(), S.rows());
+    for (int row = 0; row < srows; row++)
+      for (int col = 0; col < scols; col++)
+        S(col, row) = search(col, row);
+    for (int row = 0; row < trows; row++)
+      for (int col = 0; col < tcols; col++)
+        T(col, row) = float(tmpl(col, row) - mean);
+    fft_2d(S, false);
+    fft_2d(T, false);
+    for (int row = 0; row < S.rows(); row++)
+      for (int col = 0; col < S.cols(); col++)
+        S(col, row) *= std::conj(T(col, row));
+    fft_2d(S, true);
+    float scale = 1.0/(double(S.cols())*S.rows());
+
+    // Integral images of the search image and of its square, to get the
+    // search image variance under the template
+    ImageView<double> sum(scols + 1, srows + 1), sum2(scols + 1, srows + 1);
+    for (int col = 0; col <= scols; col++)
+      sum(col, 0) = sum2(col, 0) = 0;
+    for (int row = 0; row < srows; row++) {
+      double line = 0, line2 = 0;
+      sum(0, row + 1) = sum2(0, row + 1) = 0;
+      for (int col = 0; col < scols; col++) {
+        double v = search(col, row);
+        line  += v;
+        line2 += v*v;
+        sum (col + 1, row + 1) = sum (col + 1, row) + line;
+        sum2(col + 1, row + 1) = sum2(col + 1, row) + line2;
+      }
+    }
+
+    double num_pix = double(tcols)*trows;
+    double tol = sqrt(std::numeric_limits<float>::epsilon());
+    ncc.set_size(scols - tcols + 1, srows - trows + 1);
+    for (int row = 0; row < ncc.rows(); row++) {
+      for (int col = 0; col < ncc.cols(); col++) {
+        int c1 = col + tcols, r1 = row + trows;
+        double s  = sum (c1, r1) - sum (col, r1) - sum (c1, row) + sum (col, row);
+        double s2 = sum2(c1, r1) - sum2(col, r1) - sum2(c1, row) + sum2(col, row);
+        double var = std::max(s2 - s*s/num_pix, 0.0);
+        double denom = sigma_t*sqrt(var);
+        double value = 0;
+        if (denom > tol)
+          value = scale*S(col, row).real()/denom;
+        // Values past 1 come from a near zero variance and are not reliable
+        if (value - 1.0 > tol)
+          value = 0;
+        ncc(col, row) = value;
+      }
+    }
+    return true;
+  }
+
+} // namespace asp
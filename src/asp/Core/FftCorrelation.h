@@ -0,0 +1,76 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file FftCorrelation.h
+///
+/// Normalized cross-correlation of a template over a search image
+/// computed with FFTs, as done by norm_xcorr() in sparse_disp. The
+/// transforms are single precision radix-2 ones, and the plan of each
+/// transform length (the bit reversal permutation and the twiddle
+/// factors) is made once and shared by all threads.
+
+#ifndef __ASP_CORE_FFT_CORRELATION_H__
+#define __ASP_CORE_FFT_CORRELATION_H__
+
+#include <vw/Image/ImageView.h>
+#include <complex>
+#include <vector>
+
+namespace asp {
+
+  /// The plan of a complex FFT of a power of two length
+  class FftPlan {
+    int m_size;
+    std::vector<int> m_bit_reverse;
+    std::vector<std::complex<float> > m_twiddles;
+  public:
+    explicit FftPlan(int size);
+
+    int size() const { return m_size; }
+
+    /// Transform in place the given contiguous values. The inverse
+    /// transform is not scaled by 1/size.
+    void transform(std::complex<float>* data, bool inverse) const;
+  };
+
+  /// The plan for the given length, made on first use. Safe to call
+  /// from several threads.
+  FftPlan const& fft_plan(int size);
+
+  /// The smallest power of two no less than n
+  int next_power_of_two(int n);
+
+  /// Transform in place a complex image whose dimensions are powers of
+  /// two, along the rows and then the columns. The inverse transform
+  /// is not scaled.
+  void fft_2d(vw::ImageView<std::complex<float> > & data, bool inverse);
+
+  /// The normalized cross-correlation of the template at each position
+  /// where it lies fully within the search image. The result is of
+  /// size (search.cols() - tmpl.cols() + 1) x (search.rows() -
+  /// tmpl.rows() + 1), and its pixel (i, j) is for the template placed
+  /// at (i, j) in the search image. Where the search image has no
+  /// variance under the template the result is zero. Returns false if
+  /// the template has no variance or does not fit in the search image.
+  bool normalized_cross_correlation(vw::ImageView<float> const& tmpl,
+                                    vw::ImageView<float> const& search,
+                                    vw::ImageView<float>      & ncc);
+
+} // namespace asp
+
+#endif // __ASP_CORE_FFT_CORRELATION_H__
@@ -0,0 +1,150 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file GaussianFilter.cc
+///
+
+#include <asp/Core/GaussianFilter.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/noncopyable.hpp>
+#include <vector>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+
+  // The coefficients of the Young-van Vliet recursive filter.
+  struct RecursiveGaussianCoeffs {
+    double B, b1, b2, b3; // b1, b2, b3 are already divided by b0
+    int pad;              // how far past the end to run the forward pass
+
+    RecursiveGaussianCoeffs(double sigma){
+      double q;
+      if (sigma >= 2.5)
+        q = 0.98711*sigma - 0.96330;
+      else
+        q = 3.97156 - 4.14554*std::sqrt(1.0 - 0.26891*sigma);
+
+      double q2 = q*q, q3 = q2*q;
+      double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+      b1 = (2.44413*q + 2.85619*q2 + 1.26661*q3)/b0;
+      b2 = -(1.4281*q2 + 1.26661*q3)/b0;
+      b3 = 0.422205*q3/b0;
+      B  = 1.0 - (b1 + b2 + b3);
+
+      // The forward pass does not stop at the last pixel, as the
+      // zeros beyond it still have a nonzero response which the
+      // backward pass must see. By 6*sigma it has died off.
+      pad = int(std::ceil(6.0*sigma)) + 3;
+    }
+  };
+
+  // Filter in place n values starting at 'data', a distance of
+  // 'stride' apart. 'buf' must have room for n + coeffs.pad values.
+  void recursive_gaussian_line(double * data, int n, std::ptrdiff_t stride,
+                               RecursiveGaussianCoeffs const& c,
+                               std::vector<double> & buf){
+
+    int len = n + c.pad;
+    buf.resize(len);
+
+    // Forward (causal) pass. Before the first pixel the input is zero,
+    // so the starting state is zero as well.
+    double w1 = 0, w2 = 0, w3 = 0;
+    for (int i = 0; i < len; i++){
+      double x = (i < n) ? data[i*stride] : 0.0;
+      double w = c.B*x + c.b1*w1 + c.b2*w2 + c.b3*w3;
+      buf[i] = w;
+      w3 = w2; w2 = w1; w1 = w;
+    }
+
+    // Backward (anti-causal) pass, starting far enough past the end.
+    w1 = w2 = w3 = 0;
+    for (int i = len - 1; i >= 0; i--){
+      double w = c.B*buf[i] + c.b1*w1 + c.b2*w2 + c.b3*w3;
+      if (i < n)
+        data[i*stride] = w;
+      w3 = w2; w2 = w1; w1 = w;
+    }
+  }
+
+  // Filter a range of rows (if by_rows is true) or of columns
+  // of an image.
+  class RecursiveGaussianTask : public vw::Task, private boost::noncopyable {
+    ImageView<double> & m_image;
+    RecursiveGaussianCoeffs const& m_coeffs;
+    bool m_by_rows;
+    int m_beg, m_end;
+  public:
+    RecursiveGaussianTask(ImageView<double> & image, RecursiveGaussianCoeffs const& coeffs,
+                          bool by_rows, int beg, int end):
+      m_image(image), m_coeffs(coeffs), m_by_rows(by_rows), m_beg(beg), m_end(end){}
+
+    void operator()() {
+      std::vector<double> buf;
+      std::ptrdiff_t cstride = m_image.cstride(), rstride = m_image.rstride();
+      for (int k = m_beg; k < m_end; k++){
+        if (m_by_rows)
+          recursive_gaussian_line(&m_image(0, k), m_image.cols(), cstride, m_coeffs, buf);
+        else
+          recursive_gaussian_line(&m_image(k, 0), m_image.rows(), rstride, m_coeffs, buf);
+      }
+    }
+  };
+
+  void recursive_gaussian_pass(ImageView<double> & image, RecursiveGaussianCoeffs const& coeffs,
+                               bool by_rows, int num_threads){
+
+    int num_lines = by_rows ? image.rows() : image.cols();
+    if (num_threads <= 1 || num_lines < 2*num_threads){
+      RecursiveGaussianTask task(image, coeffs, by_rows, 0, num_lines);
+      task();
+      return;
+    }
+
+    // A few bands per thread, so that they finish at about the same time
+    int num_bands = 4*num_threads;
+    FifoWorkQueue queue(num_threads);
+    for (int band = 0; band < num_bands; band++){
+      int beg = (long long)num_lines*band/num_bands;
+      int end = (long long)num_lines*(band + 1)/num_bands;
+      if (beg >= end)
+        continue;
+      boost::shared_ptr<RecursiveGaussianTask>
+        task(new RecursiveGaussianTask(image, coeffs, by_rows, beg, end));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+}
+
+void asp::recursive_gaussian_blur(ImageView<double> & image, double sigma, int num_threads){
+
+  if (sigma < 0.5)
+    vw_throw( ArgumentErr() << "recursive_gaussian_blur: sigma must be at least 0.5.\n" );
+
+  if (image.cols() == 0 || image.rows() == 0)
+    return;
+
+  RecursiveGaussianCoeffs coeffs(sigma);
+  recursive_gaussian_pass(image, coeffs, true,  num_threads);
+  recursive_gaussian_pass(image, coeffs, false, num_threads);
+}
@@ -0,0 +1,44 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file GaussianFilter.h
+///
+/// A recursive (IIR) approximation of the Gaussian blur, after
+/// Young and van Vliet, "Recursive implementation of the Gaussian
+/// filter", Signal Processing, 1995. Its cost per pixel does not
+/// depend on sigma, unlike convolution with a kernel of size about
+/// 6*sigma, so it is meant for large sigma.
+
+#ifndef __ASP_CORE_GAUSSIAN_FILTER_H__
+#define __ASP_CORE_GAUSSIAN_FILTER_H__
+
+#include <vw/Image/ImageView.h>
+
+namespace asp {
+
+  /// Blur the image in place with a Gaussian of given sigma, in
+  /// pixels. Pixels outside the image are treated as zero, as when
+  /// the image is padded with zeros and convolved with the Gaussian
+  /// kernel. The rows, and then the columns, are split among the
+  /// given number of threads. Sigma must be at least 0.5.
+  void recursive_gaussian_blur(vw::ImageView<double> & image, double sigma,
+                               int num_threads = 1);
+
+} // namespace asp
+
+#endif // __ASP_CORE_GAUSSIAN_FILTER_H__
@@ -0,0 +1,310 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file HoleFill.cc
+///
+
+#include <asp/Core/HoleFill.h>
+#include <vw/Core/Exception.h>
+#include <vw/Image/Algorithms.h>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+
+  // A level of the push-pull pyramid. The values are interleaved,
+  // num_channels per pixel. A weight of 1 is a known pixel, of 0 an
+  // empty one, and in between a pixel averaged from few known ones.
+  struct PyramidLevel {
+    int cols, rows;
+    std::vector<double> weights, values;
+  };
+
+  // Average each 2x2 block of a level into a pixel of the next one.
+  // The weights add up, capped at 1.
+  void pull(PyramidLevel const& fine, int num_channels, PyramidLevel & coarse) {
+    coarse.cols = (fine.cols + 1)/2;
+    coarse.rows = (fine.rows + 1)/2;
+    coarse.weights.assign(size_t(coarse.cols)*coarse.rows, 0.0);
+    coarse.values.assign(coarse.weights.size()*num_channels, 0.0);
+    for (int row = 0; row < coarse.rows; row++) {
+      for (int col = 0; col < coarse.cols; col++) {
+        size_t k = size_t(row)*coarse.cols + col;
+        double w_sum = 0.0;
+        for (int r = 2*row; r < std::min(2*row + 2, fine.rows); r++) {
+          for (int c = 2*col; c < std::min(2*col + 2, fine.cols); c++) {
+            size_t f = size_t(r)*fine.cols + c;
+            double w = fine.weights[f];
+            if (w <= 0.0)
+              continue;
+            w_sum += w;
+            for (int ch = 0; ch < num_channels; ch++)
+              coarse.values[k*num_channels + ch] += w*fine.values[f*num_channels + ch];
+          }
+        }
+        if (w_sum <= 0.0)
+          continue;
+        for (int ch = 0; ch < num_channels; ch++)
+          coarse.values[k*num_channels + ch] /= w_sum;
+        coarse.weights[k] = std::min(w_sum, 1.0);
+      }
+    }
+  }
+
+  // Blend into the pixels of a level which are not fully known the
+  // bilinear interpolation of the next level, in proportion to how
+  // little they are known. The next level has no empty pixels.
+  void push(PyramidLevel const& coarse, int num_channels, PyramidLevel & fine) {
+    for (int row = 0; row < fine.rows; row++) {
+      // The center of a fine pixel is at (row + 0.5)/2 - 0.5 in the coarse level
+      double y = std::max(0.0, std::min(0.5*row - 0.25, coarse.rows - 1.0));
+      int    r0 = int(y), r1 = std::min(r0 + 1, coarse.rows - 1);
+      double fy = y - r0;
+      for (int col = 0; col < fine.cols; col++) {
+        size_t f = size_t(row)*fine.cols + col;
+        double w = fine.weights[f];
+        if (w >= 1.0)
+          continue;
+        double x = std::max(0.0, std::min(0.5*col - 0.25, coarse.cols - 1.0));
+        int    c0 = int(x), c1 = std::min(c0 + 1, coarse.cols - 1);
+        double fx = x - c0;
+        size_t k00 = size_t(r0)*coarse.cols + c0, k01 = size_t(r0)*coarse.cols + c1;
+        size_t k10 = size_t(r1)*coarse.cols + c0, k11 = size_t(r1)*coarse.cols + c1;
+        for (int ch = 0; ch < num_channels; ch++) {
+          double up
+            = (1.0 - fy)*((1.0 - fx)*coarse.values[k00*num_channels + ch] +
+                          fx       *coarse.values[k01*num_channels + ch])
+            + fy       *((1.0 - fx)*coarse.values[k10*num_channels + ch] +
+                          fx       *coarse.values[k11*num_channels + ch]);
+          double & val = fine.values[f*num_channels + ch];
+          val = w*val + (1.0 - w)*up;
+        }
+      }
+    }
+  }
+
+  // Relax the Laplace equation at the pixels of a level flagged as
+  // unknown, keeping the others fixed, by red-black successive
+  // over-relaxation. Stop when no value changes by more than the
+  // tolerance, or after the given number of sweeps. The unknown
+  // pixels at the level border average only their neighbors inside.
+  void relax_laplace(PyramidLevel & level, int num_channels,
+                     std::vector<char> const& unknown,
+                     double tolerance, int max_sweeps) {
+
+    int n = std::max(level.cols, level.rows);
+    double omega = 2.0/(1.0 + std::sin(M_PI/std::max(n, 2)));
+
+    for (int sweep = 0; sweep < max_sweeps; sweep++) {
+      double max_change = 0.0;
+      for (int color = 0; color < 2; color++) {
+        for (int row = 0; row < level.rows; row++) {
+          for (int col = (row + color) % 2; col < level.cols; col += 2) {
+            size_t k = size_t(row)*level.cols + col;
+            if (!unknown[k])
+              continue;
+            size_t nbrs[4];
+            int num_nbrs = 0;
+            if (col > 0)              nbrs[num_nbrs++] = k - 1;
+            if (col < level.cols - 1) nbrs[num_nbrs++] = k + 1;
+            if (row > 0)              nbrs[num_nbrs++] = k - level.cols;
+            if (row < level.rows - 1) nbrs[num_nbrs++] = k + level.cols;
+            if (num_nbrs == 0)
+              continue;
+            for (int ch = 0; ch < num_channels; ch++) {
+              double sum = 0.0;
+              for (int q = 0; q < num_nbrs; q++)
+                sum += level.values[nbrs[q]*num_channels + ch];
+              double & val = level.values[k*num_channels + ch];
+              double change = omega*(sum/num_nbrs - val);
+              val += change;
+              max_change = std::max(max_change, std::abs(change));
+            }
+          }
+        }
+      }
+      if (max_change <= tolerance)
+        break;
+    }
+  }
+
+  // Fill the pixels of one hole, listed as indices into the image, using
+  // the pixels of the image in the given window around it.
+  void fill_hole(ImageView<double> & values, ImageView<uint8> const& valid,
+                 BBox2i const& window, std::vector<size_t> const& hole,
+                 asp::HoleFillMethod method) {
+
+    int num_channels = values.planes();
+    std::vector<PyramidLevel> levels(1);
+    PyramidLevel & base = levels[0];
+    base.cols = window.width();
+    base.rows = window.height();
+    base.weights.assign(size_t(base.cols)*base.rows, 0.0);
+    base.values.assign(base.weights.size()*num_channels, 0.0);
+
+    // The range of the known values, to set the Laplace tolerance
+    double min_val = std::numeric_limits<double>::max(), max_val = -min_val;
+    for (int row = 0; row < base.rows; row++) {
+      for (int col = 0; col < base.cols; col++) {
+        int x = col + window.min().x(), y = row + window.min().y();
+        if (!valid(x, y))
+          continue;
+        size_t k = size_t(row)*base.cols + col;
+        base.weights[k] = 1.0;
+        for (int ch = 0; ch < num_channels; ch++) {
+          double val = values(x, y, ch);
+          base.values[k*num_channels + ch] = val;
+          min_val = std::min(min_val, val);
+          max_val = std::max(max_val, val);
+        }
+      }
+    }
+
+    // Pull until no pixel of the coarsest level is empty. The hole is
+    // surrounded by known pixels, so this ends.
+    while (true) {
+      PyramidLevel const& last = levels.back();
+      if (std::find(last.weights.begin(), last.weights.end(), 0.0) == last.weights.end())
+        break;
+      if (last.cols == 1 && last.rows == 1)
+        return;
+      PyramidLevel coarse;
+      pull(last, num_channels, coarse);
+      levels.push_back(coarse);
+    }
+
+    // Adding the coarse levels may have moved the finest one
+    PyramidLevel & finest = levels[0];
+
+    // Push back down. For the Laplace solution, relax each level before
+    // it seeds the next one. At the coarse levels the unknowns are the
+    // empty pixels, and at the finest one those of the hole.
+    double tolerance = 1e-6*std::max(max_val - min_val, 1e-6);
+    for (int l = int(levels.size()) - 1; l >= 0; l--) {
+      if (l + 1 < int(levels.size()))
+        push(levels[l + 1], num_channels, levels[l]);
+      if (method != asp::LAPLACE_HOLE_FILL)
+        continue;
+      PyramidLevel & level = levels[l];
+      std::vector<char> unknown(level.weights.size(), 0);
+      if (l > 0) {
+        for (size_t k = 0; k < unknown.size(); k++)
+          unknown[k] = (level.weights[k] <= 0.0);
+      } else {
+        for (size_t p = 0; p < hole.size(); p++) {
+          int x = hole[p] % values.cols() - window.min().x();
+          int y = hole[p] / values.cols() - window.min().y();
+          unknown[size_t(y)*finest.cols + x] = 1;
+        }
+      }
+      // The finest level is solved to the tolerance, the coarse ones
+      // just smoothed, as they only provide the starting point.
+      int max_sweeps = (l == 0) ? 10*(level.cols + level.rows) + 100 : 10;
+      relax_laplace(level, num_channels, unknown, tolerance, max_sweeps);
+    }
+
+    for (size_t p = 0; p < hole.size(); p++) {
+      int x = hole[p] % values.cols(), y = hole[p] / values.cols();
+      size_t k = size_t(y - window.min().y())*finest.cols + (x - window.min().x());
+      for (int ch = 0; ch < num_channels; ch++)
+        values(x, y, ch) = finest.values[k*num_channels + ch];
+    }
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+  HoleFillMethod parse_hole_fill_method(std::string const& name) {
+    if (name == "push-pull")
+      return PUSH_PULL_HOLE_FILL;
+    if (name == "laplace")
+      return LAPLACE_HOLE_FILL;
+    vw_throw(ArgumentErr() << "Unknown hole fill method: " << name
+             << ". Use 'push-pull' or 'laplace'.\n");
+    return PUSH_PULL_HOLE_FILL; // never reached
+  }
+
+  void fill_tile_holes(ImageView<double> & values, ImageView<uint8> const& valid,
+                       int max_len, BBox2i const& region, HoleFillMethod method,
+                       ImageView<uint8> & filled) {
+
+    int cols = valid.cols(), rows = valid.rows();
+    filled.set_size(cols, rows);
+    fill(filled, 0);
+    if (max_len <= 0)
+      return;
+
+    // Find the components of invalid pixels by flood fill. The visited
+    // pixels are flagged with 1 in 'filled' and reset later unless filled.
+    std::vector<size_t> hole, stack;
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if (valid(col, row) || filled(col, row))
+          continue;
+
+        hole.clear();
+        stack.assign(1, size_t(row)*cols + col);
+        filled(col, row) = 1;
+        int min_x = col, max_x = col, min_y = row, max_y = row;
+        while (!stack.empty()) {
+          size_t k = stack.back();
+          stack.pop_back();
+          hole.push_back(k);
+          int x = k % cols, y = k / cols;
+          min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+          min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+          int nx[4] = {x - 1, x + 1, x, x}, ny[4] = {y, y, y - 1, y + 1};
+          for (int q = 0; q < 4; q++) {
+            if (nx[q] < 0 || ny[q] < 0 || nx[q] >= cols || ny[q] >= rows ||
+                valid(nx[q], ny[q]) || filled(nx[q], ny[q]))
+              continue;
+            filled(nx[q], ny[q]) = 1;
+            stack.push_back(size_t(ny[q])*cols + nx[q]);
+          }
+        }
+
+        BBox2i extent(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+        bool on_border = (min_x == 0 || min_y == 0 || max_x == cols - 1 || max_y == rows - 1);
+        bool fill_it = !on_border && extent.width() <= max_len &&
+          extent.height() <= max_len && region.intersects(extent);
+        if (!fill_it) {
+          // Flag with 2 the pixels seen but left as they are
+          for (size_t p = 0; p < hole.size(); p++)
+            filled(hole[p] % cols, hole[p] / cols) = 2;
+          continue;
+        }
+
+        BBox2i window = extent;
+        window.expand(1);
+        fill_hole(values, valid, window, hole, method);
+      }
+    }
+
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if (filled(col, row) == 2)
+          filled(col, row) = 0;
+      }
+    }
+  }
+
+} // namespace asp
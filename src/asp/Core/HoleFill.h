@@ -0,0 +1,225 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file HoleFill.h
+///
+/// Fill the holes of a masked image, tile by tile. A hole is a
+/// 4-connected component of invalid pixels which does not touch the
+/// image border and whose bounding box is at most a given length on
+/// each side. So a tile expanded by that length sees all the holes
+/// which intersect it, and the tiles can be filled in parallel.
+///
+/// Each hole is filled on its own, using only the pixels in its
+/// bounding box grown by one, so the result does not depend on the
+/// tiling. It is interpolated with a push-pull pyramid (Gortler et
+/// al., "The Lumigraph", 1996): the valid pixels are averaged into
+/// coarser and coarser levels until no level pixel is empty, and then
+/// the coarse values are interpolated back into the empty fine ones.
+/// This costs a few operations per pixel no matter the hole size.
+/// Optionally, the result is then made harmonic, that is, the solution
+/// of the Laplace equation with the hole boundary as boundary values,
+/// by a cascadic multigrid. The pyramid levels are relaxed from the
+/// coarsest to the finest one, each starting from the values of the
+/// coarser one, which makes for few iterations at the finest level.
+///
+/// Also here, the filling of the enclosed holes of a mask of any size,
+/// for which the image is scanned once in advance.
+
+#ifndef __ASP_CORE_HOLE_FILL_H__
+#define __ASP_CORE_HOLE_FILL_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Math/BBox.h>
+#include <asp/Core/SmallBlobs.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <limits>
+
+namespace asp {
+
+  enum HoleFillMethod { PUSH_PULL_HOLE_FILL, LAPLACE_HOLE_FILL };
+
+  /// Parse "push-pull" or "laplace"
+  HoleFillMethod parse_hole_fill_method(std::string const& name);
+
+  /// Fill the holes of a tile, as above, taking the tile border as
+  /// the image border. The image has one plane per channel, and a
+  /// pixel is valid where 'valid' is nonzero. Only the holes
+  /// intersecting the given region are filled. The filled pixels
+  /// are set to 1 in 'filled', the others to 0.
+  void fill_tile_holes(vw::ImageView<double> & values,
+                       vw::ImageView<vw::uint8> const& valid,
+                       int max_len, vw::BBox2i const& region,
+                       HoleFillMethod method,
+                       vw::ImageView<vw::uint8> & filled);
+
+  /// Fill the holes of a masked image, up to max_len pixels on each side
+  template <class ImageT>
+  class HoleFillView: public vw::ImageViewBase<HoleFillView<ImageT> > {
+    ImageT         m_img;
+    int            m_max_len;
+    HoleFillMethod m_method;
+  public:
+    HoleFillView(ImageT const& img, int max_len, HoleFillMethod method):
+      m_img(img), m_max_len(max_len), m_method(method) {}
+
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<HoleFillView> pixel_accessor;
+
+    typedef typename vw::UnmaskedPixelType<pixel_type>::type  child_type;
+    typedef typename vw::CompoundChannelType<child_type>::type channel_type;
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(vw::int32 i, vw::int32 j, vw::int32 p = 0) const {
+      return prerasterize(vw::BBox2i(i, j, 1, 1))(i, j, p);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      // A hole intersecting the tile is within max_len of it
+      vw::BBox2i big = bbox;
+      big.expand(m_max_len);
+      big.crop(vw::bounding_box(m_img));
+      vw::ImageView<pixel_type> tile = vw::crop(m_img, big);
+
+      const int num_channels = vw::CompoundNumChannels<child_type>::value;
+      vw::ImageView<double>    values(tile.cols(), tile.rows(), num_channels);
+      vw::ImageView<vw::uint8> valid (tile.cols(), tile.rows()), filled;
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          valid(col, row) = is_valid(tile(col, row));
+          for (int ch = 0; ch < num_channels; ch++)
+            values(col, row, ch) = vw::compound_select_channel<channel_type const&>
+              (tile(col, row).child(), ch);
+        }
+      }
+
+      fill_tile_holes(values, valid, m_max_len, bbox - big.min(), m_method, filled);
+
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          if (!filled(col, row))
+            continue;
+          for (int ch = 0; ch < num_channels; ch++)
+            vw::compound_select_channel<channel_type&>(tile(col, row).child(), ch)
+              = channel_type(values(col, row, ch));
+          tile(col, row).validate();
+        }
+      }
+
+      return prerasterize_type(tile, -big.min().x(), -big.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Fill the holes of a masked image which are at most max_len pixels
+  /// on each side. Each tile reads max_len pixels beyond it, so large
+  /// tiles, or a cache of the input, pay off for big values.
+  template <class ImageT>
+  HoleFillView<ImageT>
+  fill_holes_pyramid(vw::ImageViewBase<ImageT> const& img, int max_len,
+                     HoleFillMethod method = PUSH_PULL_HOLE_FILL) {
+    return HoleFillView<ImageT>(img.impl(), max_len, method);
+  }
+
+  /// Make valid, with the given value, the pixels of the image marked
+  /// in the bit image
+  template <class ImageT>
+  class BitFillView: public vw::ImageViewBase<BitFillView<ImageT> > {
+    typedef typename ImageT::pixel_type pixel_type_;
+    ImageT m_img;
+    boost::shared_ptr<BitImage> m_marked;
+    pixel_type_ m_value;
+  public:
+    BitFillView(ImageT const& img, boost::shared_ptr<BitImage> marked,
+                pixel_type_ const& value):
+      m_img(img), m_marked(marked), m_value(value) {
+      m_value.validate();
+    }
+
+    typedef pixel_type_ pixel_type;
+    typedef pixel_type  result_type;
+    typedef vw::ProceduralPixelAccessor<BitFillView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(vw::int32 i, vw::int32 j, vw::int32 p = 0) const {
+      if (m_marked->get(i, j))
+        return m_value;
+      return m_img(i, j, p);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> tile = vw::crop(m_img, bbox);
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          if (m_marked->get(col + bbox.min().x(), row + bbox.min().y()))
+            tile(col, row) = m_value;
+        }
+      }
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Set to the given value the holes of a masked image of any size,
+  /// that is, the components of invalid pixels not touching the image
+  /// border. These are found over the whole image in advance, reading
+  /// bands of rows of the given height in parallel.
+  template <class ImageT>
+  BitFillView<ImageT>
+  fill_enclosed_holes(vw::ImageViewBase<ImageT> const& img,
+                      typename ImageT::pixel_type const& value,
+                      int band_height, int num_threads) {
+    BitImage invalid = valid_pixel_bits(vw::invert_mask(img.impl()), band_height,
+                                        num_threads);
+    boost::shared_ptr<BitImage> holes(new BitImage(invalid.cols(), invalid.rows()));
+    bool enclosed_only = true;
+    mark_small_blobs(invalid, std::numeric_limits<int>::max(), num_threads, *holes,
+                     enclosed_only);
+    return BitFillView<ImageT>(img.impl(), holes, value);
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_HOLE_FILL_H__
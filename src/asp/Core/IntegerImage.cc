@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IntegerImage.cc
+///
+
+#include <asp/Core/IntegerImage.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+ChannelTypeEnum preprocessed_channel_type(int bits) {
+  switch (bits) {
+  case 0:  return VW_CHANNEL_FLOAT32;
+  case 8:  return VW_CHANNEL_UINT8;
+  case 16: return VW_CHANNEL_UINT16;
+  default:
+    vw_throw( ArgumentErr() << "The preprocessed images can have 0 (float), 8, or 16 "
+              << "bit pixels, not " << bits << ".\n" );
+  }
+  return VW_CHANNEL_FLOAT32;
+}
+
+DisparityDifference
+compare_disparities(ImageViewRef< PixelMask<Vector2f> > const& first,
+                    ImageViewRef< PixelMask<Vector2f> > const& second,
+                    double threshold) {
+  if (first.cols() != second.cols() || first.rows() != second.rows())
+    vw_throw( ArgumentErr() << "The disparities to compare are of different sizes: "
+              << first.cols() << " x " << first.rows() << " and "
+              << second.cols() << " x " << second.rows() << ".\n" );
+
+  DisparityDifference diff;
+  const int block_rows = std::max(1, (1 << 22) / std::max(1, first.cols()));
+  for (int row0 = 0; row0 < first.rows(); row0 += block_rows) {
+    BBox2i box(0, row0, first.cols(), std::min(block_rows, first.rows() - row0));
+    ImageView< PixelMask<Vector2f> > a = crop(first,  box);
+    ImageView< PixelMask<Vector2f> > b = crop(second, box);
+    for (int row = 0; row < a.rows(); row++) {
+      for (int col = 0; col < a.cols(); col++) {
+        bool va = is_valid(a(col, row)), vb = is_valid(b(col, row));
+        if (va && !vb) {
+          diff.num_first_only++;
+        } else if (!va && vb) {
+          diff.num_second_only++;
+        } else if (va && vb) {
+          double d = norm_2(Vector2(a(col, row).child()) - Vector2(b(col, row).child()));
+          diff.num_both++;
+          diff.sum_diff += d;
+          diff.max_diff  = std::max(diff.max_diff, d);
+          if (d > threshold)
+            diff.num_above++;
+        }
+      }
+    }
+  }
+  return diff;
+}
+
+} // namespace asp
@@ -0,0 +1,130 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IntegerImage.h
+///
+/// Saving the preprocessed images, L.tif and R.tif, with 8 or 16 bit
+/// integer pixels rather than float ones, and comparing the disparity
+/// found from them with the one found from float images.
+///
+/// The valid pixels of the preprocessed images are normalized to
+/// [0, 1]. They are saved as 1 + round(v * (M - 1)), where M is the
+/// largest value of the channel type, and the invalid pixels as 0,
+/// which is the nodata value of the file. The images are read as
+/// before, as float images, and the reader rescales the values to
+/// [1/M, 1], so that the nodata value is still 0 after the reading.
+
+#ifndef __ASP_CORE_INTEGER_IMAGE_H__
+#define __ASP_CORE_INTEGER_IMAGE_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelMath.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/UtilityViews.h>
+#include <vw/Math/Vector.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace asp {
+
+  /// The nodata value of the preprocessed images saved with float pixels
+  const float PREPROCESSED_FLOAT_NODATA = -32768.0;
+
+  /// A normalized pixel as an integer, as above
+  template <class ChannelT>
+  struct QuantizePixelFunctor: public vw::ReturnFixedType<ChannelT> {
+    ChannelT operator()(vw::PixelMask<float> const& pix) const {
+      double v = pix.child();
+      if (!is_valid(pix) || v != v) // NaN
+        return ChannelT(0);
+      double levels = vw::ChannelRange<ChannelT>::max();
+      v = std::max(0.0, std::min(1.0, v));
+      return ChannelT(1.0 + std::floor(v*(levels - 1.0) + 0.5));
+    }
+  };
+
+  /// Write a preprocessed image, of normalized pixels, with float
+  /// pixels if bits is 0, or else with integer pixels of that many bits,
+  /// 8 or 16.
+  template <class ImageT>
+  void write_preprocessed_image(std::string const& file,
+                                vw::ImageViewBase<ImageT> const& image,
+                                int bits, bool has_georef,
+                                vw::cartography::GeoReference const& georef,
+                                vw::cartography::GdalWriteOptions const& opt,
+                                vw::ProgressCallback const& progress) {
+    switch (bits) {
+    case 0:
+      vw::cartography::block_write_gdal_image(file, vw::apply_mask(image.impl(),
+                                                                   PREPROCESSED_FLOAT_NODATA),
+                                              has_georef, georef,
+                                              true, PREPROCESSED_FLOAT_NODATA, opt, progress);
+      break;
+    case 8:
+      vw::cartography::block_write_gdal_image(file, vw::per_pixel_filter(image.impl(),
+                                                                         QuantizePixelFunctor<vw::uint8>()),
+                                              has_georef, georef, true, 0, opt, progress);
+      break;
+    case 16:
+      vw::cartography::block_write_gdal_image(file, vw::per_pixel_filter(image.impl(),
+                                                                         QuantizePixelFunctor<vw::uint16>()),
+                                              has_georef, georef, true, 0, opt, progress);
+      break;
+    default:
+      vw_throw( vw::ArgumentErr() << "The preprocessed images can have 0 (float), 8, or 16 "
+                << "bit pixels, not " << bits << ".\n" );
+    }
+  }
+
+  /// The channel type of the preprocessed images saved as above
+  vw::ChannelTypeEnum preprocessed_channel_type(int bits);
+
+  /// How much two disparities of the same image pair differ
+  struct DisparityDifference {
+    vw::uint64 num_both;         ///< Pixels valid in both
+    vw::uint64 num_first_only;   ///< Pixels valid only in the first
+    vw::uint64 num_second_only;  ///< Pixels valid only in the second
+    vw::uint64 num_above;        ///< Pixels valid in both which differ by more than the threshold
+    double     sum_diff;         ///< Of the lengths of the differences, where valid in both
+    double     max_diff;
+
+    DisparityDifference(): num_both(0), num_first_only(0), num_second_only(0),
+                           num_above(0), sum_diff(0.0), max_diff(0.0) {}
+
+    double mean_diff() const { return num_both > 0 ? sum_diff / num_both : 0.0; }
+  };
+
+  /// Compare two disparities of the same size, a block of rows at a time
+  DisparityDifference
+  compare_disparities(vw::ImageViewRef< vw::PixelMask<vw::Vector2f> > const& first,
+                      vw::ImageViewRef< vw::PixelMask<vw::Vector2f> > const& second,
+                      double threshold);
+
+} // namespace asp
+
+#endif // __ASP_CORE_INTEGER_IMAGE_H__
@@ -21,6 +21,8 @@
 #include <vw/Math/RANSAC.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Stereo/StereoModel.h>
+#include <boost/functional/hash.hpp>
+#include <map>
 
 using namespace vw;
 
@@ -113,40 +115,96 @@ namespace asp {
       norm_2( subvector( line, 0, 2 ) );
   }
 
-  // Local class definition -----
-  class EpipolarLineMatchTask : public Task, private boost::noncopyable {
-    typedef ip::InterestPointList::const_iterator IPListIter;
+  // Local class definitions -----
+
+  /// Find the epipolar lines in the second image of a range of the
+  /// distinct IP locations in the first image.
+  class EpipolarLineTask : public Task, private boost::noncopyable {
     bool                            m_single_threaded_camera;
+    std::vector<Vector2> const&     m_locations;
+    size_t                          m_beg, m_end;
+    camera::CameraModel            *m_cam1, *m_cam2;
+    TransformRef                    m_tx1;
+    EpipolarLinePointMatcher const& m_matcher;
+    Mutex&                          m_camera_mutex;
+    std::vector<Vector3>&           m_lines;
+    std::vector<char>&              m_found;
+  public:
+    EpipolarLineTask( bool single_threaded_camera,
+                      std::vector<Vector2> const& locations, size_t beg, size_t end,
+                      camera::CameraModel* cam1, camera::CameraModel* cam2,
+                      TransformRef const& tx1, EpipolarLinePointMatcher const& matcher,
+                      Mutex& camera_mutex,
+                      std::vector<Vector3>& lines, std::vector<char>& found ) :
+      m_single_threaded_camera(single_threaded_camera), m_locations(locations),
+      m_beg(beg), m_end(end), m_cam1(cam1), m_cam2(cam2), m_tx1(tx1),
+      m_matcher(matcher), m_camera_mutex(camera_mutex), m_lines(lines), m_found(found) {}
+
+    void operator()() {
+      for (size_t k = m_beg; k < m_end; k++) {
+        Vector2 ip_org_coord = m_tx1.reverse( m_locations[k] );
+        bool found_epipolar = false;
+        if (m_single_threaded_camera){
+          // ISIS camera is single-threaded
+          Mutex::Lock lock( m_camera_mutex );
+          m_lines[k] = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
+        }else{
+          m_lines[k] = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
+        }
+        m_found[k] = found_epipolar;
+      }
+    }
+  };
+
+  /// Undo the transform of a range of the IPs of the second image.
+  class IpReverseTransformTask : public Task, private boost::noncopyable {
+    std::vector<Vector2> const& m_ip_coords;
+    size_t                      m_beg, m_end;
+    TransformRef                m_tx;
+    std::vector<Vector2>&       m_org_coords;
+  public:
+    IpReverseTransformTask( std::vector<Vector2> const& ip_coords, size_t beg, size_t end,
+                            TransformRef const& tx, std::vector<Vector2>& org_coords ) :
+      m_ip_coords(ip_coords), m_beg(beg), m_end(end), m_tx(tx), m_org_coords(org_coords) {}
+
+    void operator()() {
+      for (size_t k = m_beg; k < m_end; k++)
+        m_org_coords[k] = m_tx.reverse( m_ip_coords[k] );
+    }
+  };
+
+  /// Match a range of the IPs of the first image, given their epipolar
+  /// lines and the IP locations of the second image, found beforehand.
+  class EpipolarLineMatchTask : public Task, private boost::noncopyable {
     bool                            m_use_uchar_tree;
     math::FLANNTree<float        >& m_tree_float;
     math::FLANNTree<unsigned char>& m_tree_uchar;
-    IPListIter                      m_start, m_end;
-    ip::InterestPointList const&    m_ip_other;
-    camera::CameraModel            *m_cam1, *m_cam2;
-    TransformRef                    m_tx1, m_tx2;
+    Matrix<float        > const&    m_desc1_float;
+    Matrix<unsigned char> const&    m_desc1_uchar;
+    size_t                          m_start, m_end;
+    std::vector<size_t>  const&     m_location_index; // for each IP in the first image
+    std::vector<Vector3> const&     m_lines;          // for each distinct location
+    std::vector<char>    const&     m_found;
+    std::vector<Vector2> const&     m_ip2_org_coords; // for each IP in the second image
     EpipolarLinePointMatcher const& m_matcher;
-    Mutex&                          m_camera_mutex;
     std::vector<size_t>::iterator   m_output;
   public:
-    EpipolarLineMatchTask( bool single_threaded_camera,
-			   bool use_uchar_tree,
+    EpipolarLineMatchTask( bool use_uchar_tree,
 			   math::FLANNTree<float        >& tree_float,
 			   math::FLANNTree<unsigned char>& tree_uchar,
-			   ip::InterestPointList::const_iterator start,
-			   ip::InterestPointList::const_iterator end,
-			   ip::InterestPointList const& ip2,
-			   camera::CameraModel* cam1,
-			   camera::CameraModel* cam2,
-			   TransformRef const& tx1,
-			   TransformRef const& tx2,
+			   Matrix<float        > const& desc1_float,
+			   Matrix<unsigned char> const& desc1_uchar,
+			   size_t start, size_t end,
+			   std::vector<size_t>  const& location_index,
+			   std::vector<Vector3> const& lines,
+			   std::vector<char>    const& found,
+			   std::vector<Vector2> const& ip2_org_coords,
 			   EpipolarLinePointMatcher const& matcher,
-			   Mutex& camera_mutex,
 			   std::vector<size_t>::iterator output ) :
-      m_single_threaded_camera(single_threaded_camera),
       m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-      m_start(start), m_end(end), m_ip_other(ip2),
-      m_cam1(cam1), m_cam2(cam2), m_tx1(tx1), m_tx2(tx2),
-      m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
+      m_desc1_float(desc1_float), m_desc1_uchar(desc1_uchar), m_start(start), m_end(end),
+      m_location_index(location_index), m_lines(lines), m_found(found),
+      m_ip2_org_coords(ip2_org_coords), m_matcher( matcher ), m_output(output) {}
 
     void operator()() {
 
@@ -154,24 +212,15 @@ namespace asp {
       Vector<int   > indices  (NUM_MATCHES_TO_FIND);
       Vector<double> distances(NUM_MATCHES_TO_FIND);
 
-      for ( IPListIter ip = m_start; ip != m_end; ip++ ) {
-        Vector2 ip_org_coord = m_tx1.reverse( Vector2( ip->x, ip->y ) );
-        Vector3 line_eq;
-
-        // Find the equation that describes the epipolar line
-        bool found_epipolar = false;
-        if (m_single_threaded_camera){
-          // ISIS camera is single-threaded
-          Mutex::Lock lock( m_camera_mutex );
-          line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
-        }else{
-          line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
-        }
+      for ( size_t ip_index = m_start; ip_index < m_end; ip_index++ ) {
 
-        if (!found_epipolar) {
+        // The equation that describes the epipolar line
+        size_t loc = m_location_index[ip_index];
+        if (!m_found[loc]) {
           *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
           continue; // Skip to the next IP
         }
+        Vector3 const& line_eq = m_lines[loc];
 
         // Use FLANN tree to find the N nearest neighbors according to the IP region descriptor?
         std::vector<std::pair<float,int> > kept_indices;
@@ -180,12 +229,11 @@ namespace asp {
         // Call the correct FLANN tree for the matching type
         size_t num_matches_valid = 0;
         if (m_use_uchar_tree) {
-          vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
-          for (size_t i=0; i<ip->descriptor.size(); ++i)
-            uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
-          num_matches_valid = m_tree_uchar.knn_search( uchar_descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+          num_matches_valid = m_tree_uchar.knn_search( select_row(m_desc1_uchar, ip_index), indices,
+                                                       distances, NUM_MATCHES_TO_FIND );
         } else {
-          num_matches_valid = m_tree_float.knn_search( ip->descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+          num_matches_valid = m_tree_float.knn_search( select_row(m_desc1_float, ip_index), indices,
+                                                       distances, NUM_MATCHES_TO_FIND );
         }
 
         if (num_matches_valid < 1) {
@@ -193,35 +241,18 @@ namespace asp {
           continue; // Skip to the next IP
         }
 
-        //vw_out() << "For descriptor: " << ip->descriptor << std::endl;
-        //vw_out() << num_matches_valid << " Best match distances: " << distances << std::endl;
-        //vw_out() << "Indices: " << indices << std::endl;
-
         // Loop through the N "nearest" points and keep only the ones within
         //   m_matcher.m_epipolar_threshold pixel distance from the epipolar line
         const double EPIPOLAR_BAND_EXPANSION = 200;
         double small_epipolar_threshold = m_matcher.m_epipolar_threshold;
         double large_epipolar_threshold = small_epipolar_threshold + EPIPOLAR_BAND_EXPANSION;
         for ( size_t i = 0; i < num_matches_valid; i++ ) {
-          IPListIter ip2_it = m_ip_other.begin();
-          std::advance( ip2_it, indices[i] );
-
-          if (found_epipolar){
-            Vector2 ip2_org_coord = m_tx2.reverse( Vector2( ip2_it->x, ip2_it->y ) );
-            double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
-            if ( line_distance < large_epipolar_threshold ) {
-              if ( line_distance < small_epipolar_threshold )
-                kept_indices.push_back( std::pair<float,int>( distances[i], indices[i] ) );
-              else // In between thresholds
-                kept_indices.push_back( std::pair<float,int>( distances[i], -1 ) );
-            }
-            else {
-              Vector2 ip1_coord( ip->x, ip->y );
-              //double normDist = norm_2(ip1_coord - ip2_org_coord);
-              //vw_out() << "Discarding match between " << ip1_coord << " and " << ip2_org_coord
-              //        << " because distance is " << line_distance << " and threshold is "
-              //        << m_matcher.m_epipolar_threshold << " norm dist = " << normDist<<"\n";
-            }
+          double line_distance = m_matcher.distance_point_line( line_eq, m_ip2_org_coords[indices[i]] );
+          if ( line_distance < large_epipolar_threshold ) {
+            if ( line_distance < small_epipolar_threshold )
+              kept_indices.push_back( std::pair<float,int>( distances[i], indices[i] ) );
+            else // In between thresholds
+              kept_indices.push_back( std::pair<float,int>( distances[i], -1 ) );
           }
         } // End loop for match prunining
 
@@ -231,7 +262,6 @@ namespace asp {
                      (kept_indices[0].first < m_matcher.m_uniqueness_threshold * kept_indices[1].first) )
               || (kept_indices.size() == 1) ){
           *m_output++ = kept_indices[0].second; // Return the first of the matches we found
-          //vw_out() << "Kept distance: " << kept_indices[0].first << std::endl;
         } else { // No matches or no clear winner
           *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
         }
@@ -240,16 +270,14 @@ namespace asp {
 
   }; // End class EpipolarLineMatchTask -------------------
 
-  void EpipolarLinePointMatcher::operator()( ip::InterestPointList const& ip1,
-					     ip::InterestPointList const& ip2,
+  void EpipolarLinePointMatcher::operator()( IpSet const& ip1,
+					     IpSet const& ip2,
 					     DetectIpMethod  ip_detect_method,
 					     camera::CameraModel        * cam1,
 					     camera::CameraModel        * cam2,
 					     TransformRef          const& tx1,
 					     TransformRef          const& tx2,
 					     std::vector<size_t>        & output_indices ) const {
-    typedef ip::InterestPointList::const_iterator IPListIter;
-
     Timer total_time("Total elapsed time", DebugMessage, "interest_point");
     size_t ip1_size = ip1.size(), ip2_size = ip2.size();
 
@@ -262,67 +290,319 @@ namespace asp {
     // Build the output indices
     output_indices.resize( ip1_size );
 
+    // Jobs set to 2x the number of cores. This is just incase all jobs are not equal.
+    size_t num_threads = vw_settings().default_num_threads();
+    size_t number_of_jobs = num_threads * 2;
+
+    // Find the epipolar lines, and undo the transform of the IPs in the
+    // second image, before matching and with all threads. These call
+    // the cameras, which is the slow part, so it is done once per IP
+    // rather than once per candidate match, and only once for IPs at
+    // the same location, which is common as detectors find several
+    // IPs at different scales or orientations at a location.
+    std::vector<Vector2> locations;
+    std::vector<size_t>  location_index(ip1_size);
+    {
+      std::map<std::pair<float, float>, size_t> location_map;
+      for (size_t ip_index = 0; ip_index < ip1_size; ip_index++) {
+        std::pair<float, float> key(ip1.x(ip_index), ip1.y(ip_index));
+        std::map<std::pair<float, float>, size_t>::iterator it = location_map.find(key);
+        if (it == location_map.end()) {
+          it = location_map.insert(std::make_pair(key, locations.size())).first;
+          locations.push_back(ip1.location(ip_index));
+        }
+        location_index[ip_index] = it->second;
+      }
+    }
+    std::vector<Vector2> ip2_coords(ip2_size), ip2_org_coords(ip2_size);
+    for (size_t ip_index = 0; ip_index < ip2_size; ip_index++)
+      ip2_coords[ip_index] = ip2.location(ip_index);
+
+    std::vector<Vector3> lines(locations.size());
+    std::vector<char>    found(locations.size(), 0);
+    Mutex camera_mutex;
+    {
+      FifoWorkQueue queue(num_threads);
+      size_t num_loc = locations.size();
+      for (size_t job = 0; job < number_of_jobs; job++) {
+        size_t beg = num_loc*job/number_of_jobs, end = num_loc*(job + 1)/number_of_jobs;
+        if (beg < end) {
+          boost::shared_ptr<Task>
+            task( new EpipolarLineTask( m_single_threaded_camera, locations, beg, end,
+                                        cam1, cam2, tx1, *this, camera_mutex, lines, found ) );
+          queue.add_task( task );
+        }
+        beg = ip2_size*job/number_of_jobs;
+        end = ip2_size*(job + 1)/number_of_jobs;
+        if (beg < end) {
+          boost::shared_ptr<Task>
+            task( new IpReverseTransformTask( ip2_coords, beg, end, tx2, ip2_org_coords ) );
+          queue.add_task( task );
+        }
+      }
+      queue.join_all();
+    }
+    vw_out(DebugMessage,"interest_point") << "Found the epipolar lines of " << locations.size()
+                                          << " distinct IP locations.\n";
+
     // Set up FLANNTree objects of all the different types we may need.
     math::FLANNTree<float        > kd_float;
     math::FLANNTree<unsigned char> kd_uchar;
 
-    Matrix<float        > ip2_matrix_float;
-    Matrix<unsigned char> ip2_matrix_uchar;
+    Matrix<unsigned char> ip1_matrix_uchar, ip2_matrix_uchar;
 
-    // Pack the IP descriptors into a matrix and feed it to the chosen FLANNTree object
+    // Feed the IP descriptors to the chosen FLANNTree object. Those
+    // of an IpSet are already a matrix, which needs to be converted
+    // only for the binary descriptors.
     const bool use_uchar_FLANN = (ip_detect_method == DETECT_IP_METHOD_ORB);
     if (use_uchar_FLANN) {
-      ip_list_to_matrix(ip2, ip2_matrix_uchar);
+      ip1.descriptors_as(ip1_matrix_uchar);
+      ip2.descriptors_as(ip2_matrix_uchar);
       kd_uchar.load_match_data( ip2_matrix_uchar, vw::math::FLANN_DistType_Hamming );
     }else {
-      ip_list_to_matrix(ip2, ip2_matrix_float);
-      kd_float.load_match_data( ip2_matrix_float,  vw::math::FLANN_DistType_L2 );
+      kd_float.load_match_data( ip2.descriptors(),  vw::math::FLANN_DistType_L2 );
     }
 
     vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
     FifoWorkQueue matching_queue; // Create a thread pool object
-    Mutex camera_mutex;
 
-    // Jobs set to 2x the number of cores. This is just incase all jobs are not equal.
     // The total number of interest points will be divided up among the jobs.
-    size_t number_of_jobs = vw_settings().default_num_threads() * 2;
-
     // Robustness fix
     if (ip1_size < number_of_jobs)
       number_of_jobs = ip1_size;
 
-    // Get input and output iterators
-    IPListIter start_it = ip1.begin();
-    std::vector<size_t>::iterator output_it = output_indices.begin();
-
-    for ( size_t i = 0; i < number_of_jobs - 1; i++ ) { // For each job...
-      // Update iterators and launch the job.
-      IPListIter end_it = start_it;
-      std::advance( end_it, ip1_size / number_of_jobs );
+    for ( size_t i = 0; i < number_of_jobs; i++ ) { // For each job...
+      size_t start = ip1_size*i/number_of_jobs, end = ip1_size*(i + 1)/number_of_jobs;
+      if (start >= end)
+        continue;
       boost::shared_ptr<Task>
-	match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-					       use_uchar_FLANN, kd_float, kd_uchar,
-					       start_it, end_it,
-					       ip2, cam1, cam2, tx1, tx2, *this,
-					       camera_mutex, output_it ) );
+	match_task( new EpipolarLineMatchTask( use_uchar_FLANN, kd_float, kd_uchar,
+					       ip1.descriptors(), ip1_matrix_uchar, start, end,
+					       location_index, lines, found, ip2_org_coords,
+					       *this, output_indices.begin() + start ) );
       matching_queue.add_task( match_task );
-      start_it = end_it;
-      std::advance( output_it, ip1_size / number_of_jobs );
     }
-    boost::shared_ptr<Task>
-      match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-					     use_uchar_FLANN, kd_float, kd_uchar,
-					     start_it, ip1.end(),
-					     ip2, cam1, cam2, tx1, tx2, *this,
-					     camera_mutex, output_it ) );
-    matching_queue.add_task( match_task );
     matching_queue.join_all(); // Wait for all the jobs to finish.
   }
 
 // End class EpipolarLinePointMatcher
 //---------------------------------------------------------------------------------------
 
+  namespace {
+
+    // The number of bits set in a word
+    inline int popcount64(vw::uint64 x) {
+      x = x - ((x >> 1) & 0x5555555555555555ULL);
+      x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+      x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+      return int((x * 0x0101010101010101ULL) >> 56);
+    }
+
+    // Pack the descriptor bytes of binary descriptors, as ORB makes,
+    // into words, so that the Hamming distance is a few popcounts.
+    void pack_binary_descriptors( IpSet const& ip,
+                                  size_t num_words, std::vector<vw::uint64>& bits ) {
+      Matrix<float> const& desc = ip.descriptors();
+      bits.assign( ip.size()*num_words, 0 );
+      for (size_t i = 0; i < ip.size(); i++) {
+        for (size_t b = 0; b < desc.cols(); b++) {
+          vw::uint64 byte = static_cast<unsigned char>(desc(i, b));
+          bits[i*num_words + b/8] |= byte << (8*(b%8));
+        }
+      }
+    }
+
+  }
+
+  /// For a range of the IPs of the first image, find the closest and
+  /// second closest descriptors among the IPs of the second image, and
+  /// record the index of the closest one if it passes the uniqueness
+  /// test, or -1 otherwise.
+  class DescriptorMatchTask : public Task, private boost::noncopyable {
+    bool                              m_use_flann, m_use_hamming;
+    math::FLANNTree<float        >&   m_tree_float;
+    math::FLANNTree<unsigned char>&   m_tree_uchar;
+    Matrix<float        > const&      m_desc1_float, & m_desc2_float;
+    Matrix<unsigned char> const&      m_desc1_uchar;
+    std::vector<vw::uint64> const&    m_bits1, & m_bits2;
+    size_t                            m_num_words;
+    double                            m_threshold;
+    size_t                            m_beg, m_end;
+    std::vector<int>&                 m_output;
+  public:
+    DescriptorMatchTask( bool use_flann, bool use_hamming,
+                         math::FLANNTree<float        >& tree_float,
+                         math::FLANNTree<unsigned char>& tree_uchar,
+                         Matrix<float> const& desc1_float, Matrix<float> const& desc2_float,
+                         Matrix<unsigned char> const& desc1_uchar,
+                         std::vector<vw::uint64> const& bits1,
+                         std::vector<vw::uint64> const& bits2, size_t num_words,
+                         double threshold, size_t beg, size_t end,
+                         std::vector<int>& output ) :
+      m_use_flann(use_flann), m_use_hamming(use_hamming),
+      m_tree_float(tree_float), m_tree_uchar(tree_uchar),
+      m_desc1_float(desc1_float), m_desc2_float(desc2_float), m_desc1_uchar(desc1_uchar),
+      m_bits1(bits1), m_bits2(bits2), m_num_words(num_words),
+      m_threshold(threshold), m_beg(beg), m_end(end), m_output(output) {}
+
+    void operator()() {
+      const size_t NUM_MATCHES_TO_FIND = 2;
+      Vector<int   > indices  (NUM_MATCHES_TO_FIND);
+      Vector<double> distances(NUM_MATCHES_TO_FIND);
+
+      size_t num2 = m_use_hamming ? m_bits2.size()/std::max(m_num_words, size_t(1))
+                                  : m_desc2_float.rows();
+      size_t num_elems = m_desc2_float.cols();
+
+      for (size_t i = m_beg; i < m_end; i++) {
+        m_output[i] = -1;
+        double best = std::numeric_limits<double>::max(), second = best;
+        int    best_index = -1;
+
+        if (m_use_flann) {
+          size_t num_valid = 0;
+          if (m_use_hamming)
+            num_valid = m_tree_uchar.knn_search( select_row(m_desc1_uchar, i), indices,
+                                                 distances, NUM_MATCHES_TO_FIND );
+          else
+            num_valid = m_tree_float.knn_search( select_row(m_desc1_float, i), indices,
+                                                 distances, NUM_MATCHES_TO_FIND );
+          if (num_valid < NUM_MATCHES_TO_FIND)
+            continue;
+          best = distances[0]; second = distances[1]; best_index = indices[0];
+        } else if (m_use_hamming) {
+          vw::uint64 const* a = &m_bits1[i*m_num_words];
+          for (size_t j = 0; j < num2; j++) {
+            vw::uint64 const* b = &m_bits2[j*m_num_words];
+            int dist = 0;
+            for (size_t w = 0; w < m_num_words; w++)
+              dist += popcount64(a[w] ^ b[w]);
+            if (dist < best) {
+              second = best; best = dist; best_index = j;
+            } else if (dist < second) {
+              second = dist;
+            }
+          }
+        } else {
+          float const* a = &m_desc1_float(i, 0);
+          for (size_t j = 0; j < num2; j++) {
+            float const* b = &m_desc2_float(j, 0);
+            double dist = 0;
+            for (size_t e = 0; e < num_elems && dist < second; e++) {
+              double d = double(a[e]) - double(b[e]);
+              dist += d*d;
+            }
+            if (dist < best) {
+              second = best; best = dist; best_index = j;
+            } else if (dist < second) {
+              second = dist;
+            }
+          }
+        }
+
+        if (best_index >= 0 && second < std::numeric_limits<double>::max() &&
+            best < m_threshold * second)
+          m_output[i] = best_index;
+      }
+    }
+  }; // End class DescriptorMatchTask
+
+  void match_ip_descriptors( IpSet const& ip1, IpSet const& ip2,
+                             bool use_hamming, double uniqueness_threshold,
+                             std::string const& method,
+                             std::vector<size_t>& matched_index1,
+                             std::vector<size_t>& matched_index2 ) {
+
+    if (method != "flann" && method != "brute-force")
+      vw_throw( ArgumentErr() << "Unknown interest point matching method: " << method
+                              << ". Use flann or brute-force.\n" );
+
+    matched_index1.clear();
+    matched_index2.clear();
+    if (ip1.empty() || ip2.size() < 2)
+      return;
+
+    // Each set has descriptors of one length
+    size_t num_elems = ip1.descriptor_length();
+    if (ip2.descriptor_length() != num_elems)
+      vw_throw( ArgumentErr() << "match_ip_descriptors: The descriptors differ in size.\n" );
+    if (num_elems == 0)
+      vw_throw( ArgumentErr() << "match_ip_descriptors: The interest points have no descriptors.\n" );
+
+    Stopwatch sw;
+    sw.start();
+
+    bool use_flann = (method == "flann");
+    math::FLANNTree<float        > tree_float;
+    math::FLANNTree<unsigned char> tree_uchar;
+    // The float descriptors are used as they are stored
+    Matrix<float> const& desc1_float = ip1.descriptors();
+    Matrix<float> const& desc2_float = ip2.descriptors();
+    Matrix<unsigned char> desc1_uchar, desc2_uchar;
+    std::vector<vw::uint64> bits1, bits2;
+    size_t num_words = (num_elems + 7)/8;
+    if (use_flann) {
+      if (use_hamming) {
+        ip1.descriptors_as(desc1_uchar);
+        ip2.descriptors_as(desc2_uchar);
+        tree_uchar.load_match_data( desc2_uchar, vw::math::FLANN_DistType_Hamming );
+      } else {
+        tree_float.load_match_data( desc2_float, vw::math::FLANN_DistType_L2 );
+      }
+    } else if (use_hamming) {
+      pack_binary_descriptors(ip1, num_words, bits1);
+      pack_binary_descriptors(ip2, num_words, bits2);
+    }
+
+    // A few chunks per thread, so that they finish at about the same time
+    std::vector<int> output(ip1.size(), -1);
+    size_t num_threads = vw_settings().default_num_threads();
+    size_t num_jobs    = 4*num_threads;
+    FifoWorkQueue queue(num_threads);
+    for (size_t job = 0; job < num_jobs; job++) {
+      size_t beg = ip1.size()*job/num_jobs, end = ip1.size()*(job + 1)/num_jobs;
+      if (beg >= end)
+        continue;
+      boost::shared_ptr<Task>
+        task( new DescriptorMatchTask( use_flann, use_hamming, tree_float, tree_uchar,
+                                       desc1_float, desc2_float, desc1_uchar,
+                                       bits1, bits2, num_words,
+                                       uniqueness_threshold, beg, end, output ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+
+    for (size_t i = 0; i < ip1.size(); i++) {
+      if (output[i] < 0)
+        continue;
+      matched_index1.push_back(i);
+      matched_index2.push_back(output[i]);
+    }
+
+    sw.stop();
+    vw_out(DebugMessage,"interest_point") << "Matched " << ip1.size() << " against "
+                                          << ip2.size() << " descriptors with " << method
+                                          << " in " << sw.elapsed_seconds() << " seconds.\n";
+  }
+
+  void match_ip_descriptors( std::vector<ip::InterestPoint> const& ip1,
+                             std::vector<ip::InterestPoint> const& ip2,
+                             bool use_hamming, double uniqueness_threshold,
+                             std::string const& method,
+                             std::vector<ip::InterestPoint>& matched_ip1,
+                             std::vector<ip::InterestPoint>& matched_ip2 ) {
+    std::vector<size_t> index1, index2;
+    match_ip_descriptors( IpSet(ip1), IpSet(ip2), use_hamming, uniqueness_threshold,
+                          method, index1, index2 );
+    matched_ip1.resize(index1.size());
+    matched_ip2.resize(index2.size());
+    for (size_t k = 0; k < index1.size(); k++) {
+      matched_ip1[k] = ip1[index1[k]];
+      matched_ip2[k] = ip2[index2[k]];
+    }
+  }
+
   void check_homography_matrix(Matrix<double>       const& H,
 			       std::vector<Vector3> const& left_points,
 			       std::vector<Vector3> const& right_points,
@@ -866,4 +1146,26 @@ namespace asp {
     return disp_file + "-unaligned-D.tif";
   }
 
+  std::string ip_cache_file(std::string const& ip_cache_prefix,
+                            vw::Vector2i const& image_size,
+                            size_t points_per_tile, double nodata){
+
+    // Everything which affects the detected interest points and their
+    // descriptors, other than the image itself.
+    size_t key = 0;
+    boost::hash_combine(key, image_size[0]);
+    boost::hash_combine(key, image_size[1]);
+    boost::hash_combine(key, points_per_tile);
+    boost::hash_combine(key, boost::math::isnan(nodata) ? -std::numeric_limits<double>::max()
+                        : nodata);
+    boost::hash_combine(key, stereo_settings().ip_matching_method);
+    boost::hash_combine(key, stereo_settings().num_scales);
+    boost::hash_combine(key, stereo_settings().skip_image_normalization);
+    boost::hash_combine(key, stereo_settings().ip_normalize_tiles);
+
+    std::ostringstream os;
+    os << ip_cache_prefix << "-" << std::hex << key << ".vwip";
+    return os.str();
+  }
+
 }
@@ -32,7 +32,10 @@
 #include <vw/Cartography/Datum.h>
 
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/IpSet.h>
 #include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 
 // TODO: This function should live somewhere else!  It was pulled from vw->tools->ipmatch.cc
@@ -159,6 +162,8 @@ namespace asp {
   /// filters them by whom are closest to the epipolar line via a
   /// threshold. The first 2 are then selected to be a match if
   /// their descriptor distance is sufficiently far apart.
+  /// The epipolar lines are found before matching, once for each
+  /// distinct IP location.
   class EpipolarLinePointMatcher {
     bool   m_single_threaded_camera;
     double m_uniqueness_threshold, m_epipolar_threshold;
@@ -172,8 +177,8 @@ namespace asp {
 
     /// This only returns the indicies
     /// - ip_detect_method must match the method used to obtain the interest points
-    void operator()( vw::ip::InterestPointList const& ip1,
-                     vw::ip::InterestPointList const& ip2,
+    void operator()( IpSet const& ip1,
+                     IpSet const& ip2,
                      DetectIpMethod  ip_detect_method,
                      vw::camera::CameraModel        * cam1,
                      vw::camera::CameraModel        * cam2,
@@ -193,6 +198,7 @@ namespace asp {
     static double distance_point_line( vw::Vector3 const& line,
 				       vw::Vector2 const& point );
 
+    friend class EpipolarLineTask;
     friend class EpipolarLineMatchTask;
   };
 
@@ -204,6 +210,15 @@ namespace asp {
                               vw::ip::InterestPointList& ip_list,
                               int    radius = 1 );
 
+  /// Build the descriptors of the interest points with all threads,
+  /// each describing a contiguous run of the list with its own copy of
+  /// the descriptor generator. The points keep their order, so the
+  /// result is the same as with describe_interest_points().
+  template <class ImageT, class DescriptorT>
+  void describe_ip_threaded( vw::ImageViewBase<ImageT> const& image,
+                             DescriptorT const& descriptor,
+                             vw::ip::InterestPointList& ip_list );
+
   /// Find a rough homography that maps right to left using the camera
   /// and datum information.
   /// - This intersects rays with the datum, then projects them into the other camera.
@@ -227,18 +242,55 @@ namespace asp {
                             vw::Matrix<double>& left_matrix,
                             vw::Matrix<double>& right_matrix );
 
+  /// The file in which the interest points and descriptors detected
+  /// in an image are cached, for the current detection settings. The
+  /// prefix identifies the image, the rest of the name the settings,
+  /// so a change in settings results in a new file.
+  std::string ip_cache_file(std::string const& ip_cache_prefix,
+                            vw::Vector2i const& image_size,
+                            size_t points_per_tile, double nodata);
+
   /// Detect InterestPoints
   ///
   /// This is not meant to be used directly. Please use ip_matching() or
   /// the dumb homography_ip_matching().
+  ///
+  /// If a cache prefix is not empty, the interest points of that image
+  /// are read from its cache file if present, and otherwise are saved
+  /// to it, before any filtering specific to the image pair.
   template <class Image1T, class Image2T>
-  void detect_ip( vw::ip::InterestPointList& ip1, 
-                  vw::ip::InterestPointList& ip2,  
+  void detect_ip( IpSet& ip1,
+                  IpSet& ip2,
 		  vw::ImageViewBase<Image1T> const& image1,
 		  vw::ImageViewBase<Image2T> const& image2,
 		  int ip_per_tile,
 		  double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-		  double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+		  double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+		  std::string const& ip_cache_prefix1 = "",
+		  std::string const& ip_cache_prefix2 = "" );
+
+  /// Match the descriptors of the IPs of the first image to those of
+  /// the second one with all threads. A pair is kept if the closest
+  /// descriptor distance is less than uniqueness_threshold times the
+  /// second closest one, as in ip::InterestPointMatcher, with squared
+  /// L2 distances, or with the Hamming distance on the descriptor bytes
+  /// if use_hamming is true (for ORB). With method "flann" the two
+  /// neighbors are found approximately with a FLANN tree, and with
+  /// "brute-force" exactly, by comparing all pairs.
+  /// The matches are returned as the indices of the IPs in each set.
+  void match_ip_descriptors( IpSet const& ip1, IpSet const& ip2,
+                             bool use_hamming, double uniqueness_threshold,
+                             std::string const& method,
+                             std::vector<size_t>& matched_index1,
+                             std::vector<size_t>& matched_index2 );
+
+  /// As above, returning copies of the matched IPs
+  void match_ip_descriptors( std::vector<vw::ip::InterestPoint> const& ip1,
+                             std::vector<vw::ip::InterestPoint> const& ip2,
+                             bool use_hamming, double uniqueness_threshold,
+                             std::string const& method,
+                             std::vector<vw::ip::InterestPoint>& matched_ip1,
+                             std::vector<vw::ip::InterestPoint>& matched_ip2 );
 
   /// Detect and Match Interest Points
   ///
@@ -250,7 +302,9 @@ namespace asp {
 			vw::ImageViewBase<Image2T> const& image2,
 			int ip_per_tile,
 			double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-			double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+			double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+			std::string const& ip_cache_prefix1 = "",
+			std::string const& ip_cache_prefix2 = "" );
 
   /// Homography IP matching
   ///
@@ -262,7 +316,9 @@ namespace asp {
 			       std::string const& output_name,
 			       int inlier_threshold=10,
 			       double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-			       double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+			       double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+			       std::string const& ip_cache_prefix1 = "",
+			       std::string const& ip_cache_prefix2 = "" );
 
   /// IP matching that uses clustering on triangulation error to
   /// determine inliers.  Check output this filter can fail.
@@ -328,11 +384,15 @@ namespace asp {
 		    double nodata2 = std::numeric_limits<double>::quiet_NaN(),
 		    vw::TransformRef const& left_tx  = vw::TransformRef(vw::TranslateTransform(0,0)),
 		    vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)),
-		    bool transform_to_original_coord = true );
+		    bool transform_to_original_coord = true,
+		    std::string const& ip_cache_prefix1 = "",
+		    std::string const& ip_cache_prefix2 = "" );
 
   /// Calls ip matching above but with an additional step where we
   /// apply a homography to make right image like left image. This is
   /// useful so that both images have similar scale and similar affine qualities.
+  /// Only the interest points of the left image can be cached, as the
+  /// right image is warped differently for each pair.
   template <class Image1T, class Image2T>
   bool ip_matching_w_alignment( bool single_threaded_camera,
 				vw::camera::CameraModel* cam1,
@@ -347,7 +407,8 @@ namespace asp {
 				double nodata1 = std::numeric_limits<double>::quiet_NaN(),
 				double nodata2 = std::numeric_limits<double>::quiet_NaN(),
 				vw::TransformRef const& left_tx  = vw::TransformRef(vw::TranslateTransform(0,0)),
-				vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)) );
+				vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)),
+				std::string const& left_ip_cache_prefix = "" );
 
 // ==============================================================================================
 // Function definitions
@@ -402,54 +463,102 @@ namespace asp {
   /// Remove points in/out of a bounding box depending on "remove_outside".
   /// - Returns the number of points removed.
   /// TODO: MOVE THIS FUNCTION!
-  inline size_t remove_ip_bbox(vw::BBox2i const& roi, vw::ip::InterestPointList & ip_list,
+  inline size_t remove_ip_bbox(vw::BBox2i const& roi, IpSet & ip_set,
                         bool remove_outside){
-    // Loop through all the points
-    size_t num_removed = 0;
-    vw::ip::InterestPointList::iterator ip;
-    for (ip = ip_list.begin(); ip != ip_list.end(); ++ip) {
-      
-      if ( roi.contains(vw::Vector2i(ip->ix,ip->iy)) xor remove_outside  ) {
-        ip = ip_list.erase(ip);
-        ++num_removed;
-        --ip;
-      }
+    // Find the points to keep, then keep them in place
+    std::vector<size_t> kept;
+    kept.reserve(ip_set.size());
+    for (size_t i = 0; i < ip_set.size(); i++) {
+      if ( !(roi.contains(vw::Vector2i(ip_set.ix(i), ip_set.iy(i))) xor remove_outside) )
+        kept.push_back(i);
     }
+    size_t num_removed = ip_set.size() - kept.size();
+    if (num_removed > 0)
+      ip_set.select(kept);
     return num_removed;
-  } // End function remove_ip_near_nodata
-  
+  } // End function remove_ip_bbox
+
+  /// Describe one run of interest points.
+  template <class ImageT, class DescriptorT>
+  class DescribeIpTask : public vw::Task, private boost::noncopyable {
+    ImageT const&              m_image;
+    DescriptorT                m_descriptor;
+    vw::ip::InterestPointList& m_ip_list;
+  public:
+    DescribeIpTask( ImageT const& image, DescriptorT const& descriptor,
+                    vw::ip::InterestPointList& ip_list ) :
+      m_image(image), m_descriptor(descriptor), m_ip_list(ip_list) {}
 
-  // Detect InterestPoints
-  //
-  /// This is not meant to be used directly. Please use ip_matching() or
-  /// the dumb homography_ip_matching().
-  template <class Image1T, class Image2T>
-  void detect_ip( vw::ip::InterestPointList& ip1,
-                  vw::ip::InterestPointList& ip2,
-                  vw::ImageViewBase<Image1T> const& image1,
-                  vw::ImageViewBase<Image2T> const& image2,
-                  int    ip_per_tile,
-                  double nodata1,
-                  double nodata2 ) {
+    void operator()() {
+      vw::ip::describe_interest_points( m_image, m_descriptor, m_ip_list );
+    }
+  };
+
+  template <class ImageT, class DescriptorT>
+  void describe_ip_threaded( vw::ImageViewBase<ImageT> const& image,
+                             DescriptorT const& descriptor,
+                             vw::ip::InterestPointList& ip_list ) {
     using namespace vw;
-    BBox2i box1 = bounding_box(image1.impl());
-    ip1.clear();
-    ip2.clear();
 
-    Stopwatch sw;
-    sw.start();
+    size_t num_ip      = ip_list.size();
+    size_t num_threads = vw_settings().default_num_threads();
+    size_t num_jobs    = std::min(num_ip, 4*num_threads);
+    if (num_threads <= 1 || num_jobs <= 1) {
+      DescriptorT desc(descriptor);
+      ip::describe_interest_points( image.impl(), desc, ip_list );
+      return;
+    }
 
-    // Automatically determine how many ip we need
-    float  number_boxes    = (box1.width() / 1024.f) * (box1.height() / 1024.f);
-    size_t points_per_tile = 5000.f / number_boxes;
-    if ( points_per_tile > 5000 ) points_per_tile = 5000;
-    if ( points_per_tile < 50   ) points_per_tile = 50;
+    // Move the points into as many lists as jobs, with splice(), which
+    // does not copy them, and put them back in order when done.
+    std::vector<ip::InterestPointList> runs(num_jobs);
+    for (size_t job = 0; job < num_jobs; job++) {
+      size_t len = num_ip*(job + 1)/num_jobs - num_ip*job/num_jobs;
+      ip::InterestPointList::iterator end = ip_list.begin();
+      std::advance( end, len );
+      runs[job].splice( runs[job].end(), ip_list, ip_list.begin(), end );
+    }
 
-    // See if to override with manual value
-    if (ip_per_tile != 0)
-      points_per_tile = ip_per_tile;
+    FifoWorkQueue queue(num_threads);
+    for (size_t job = 0; job < num_jobs; job++) {
+      boost::shared_ptr<Task>
+        task( new DescribeIpTask<ImageT, DescriptorT>( image.impl(), descriptor, runs[job] ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
 
-    vw_out() << "Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
+    for (size_t job = 0; job < num_jobs; job++)
+      ip_list.splice( ip_list.end(), runs[job] );
+  }
+  
+
+  /// Detect interest points in one image, remove those near nodata,
+  /// and build their descriptors. Read them from the cache file instead,
+  /// if it exists, and otherwise write them to it, unless its name is empty.
+  /// - The index (1 or 2) is used in messages and debug image names.
+  template <class ImageT>
+  void detect_ip_aux( IpSet& ip_set,
+                      vw::ImageViewBase<ImageT> const& image,
+                      size_t points_per_tile,
+                      double nodata,
+                      std::string const& cache_file,
+                      int    index ) {
+    using namespace vw;
+    ip_set = IpSet();
+
+    std::string side = (index == 1) ? "left" : "right";
+    if (!cache_file.empty() && boost::filesystem::exists(cache_file)) {
+      vw_out() << "\t    Using cached " << side << " interest points: " << cache_file << "\n";
+      std::vector<ip::InterestPoint> ip_vec = ip::read_binary_ip_file(cache_file);
+      ip_set.assign( ip_vec.begin(), ip_vec.end() );
+      return;
+    }
+
+    // The detectors and descriptor generators of vw::ip work on lists
+    ip::InterestPointList ip;
+
+    Stopwatch sw;
+    sw.start();
 
     // Load the detection method from stereo_settings.
     // - This relies on a direct match in the enum integer value.
@@ -457,6 +566,7 @@ namespace asp {
 
     // Detect Interest Points
     // - Due to templated types we need to duplicate a bunch of code here
+    vw_out() << "\t    Processing " << side << " image" << std::endl;
     if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
       // Zack's custom detector
       int num_scales = stereo_settings().num_scales;
@@ -470,17 +580,10 @@ namespace asp {
       
       // This detector can't handle a mask so if there is nodata just
       //  set those pixels to zero.
-      
-      vw_out() << "\t    Processing left image" << std::endl;
-      if ( boost::math::isnan(nodata1) )
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
+      if ( boost::math::isnan(nodata) )
+        ip = detect_interest_points( image.impl(), detector, points_per_tile );
       else
-        ip1 = detect_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if ( boost::math::isnan(nodata2) )
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
-      else
-        ip2 = detect_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), detector, points_per_tile );
+        ip = detect_interest_points( apply_mask(create_mask_less_or_equal(image.impl(),nodata)), detector, points_per_tile );
     } else {
 
       // Initialize the OpenCV detector.  Conveniently we can just pass in the type argument.
@@ -503,17 +606,10 @@ namespace asp {
       vw::ip::OpenCvInterestPointDetector detector(cv_method, opencv_normalize, build_opencv_descriptors, points_per_tile);
 
       // These detectors do accept a mask so use one if applicable.
-
-      vw_out() << "\t    Processing left image" << std::endl;
-      if ( boost::math::isnan(nodata1) )
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
-      else
-        ip1 = detect_interest_points( create_mask_less_or_equal(image1.impl(),nodata1), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if ( boost::math::isnan(nodata2) )
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
+      if ( boost::math::isnan(nodata) )
+        ip = detect_interest_points( image.impl(), detector, points_per_tile );
       else
-        ip2 = detect_interest_points( create_mask_less_or_equal(image2.impl(),nodata2), detector, points_per_tile );
+        ip = detect_interest_points( create_mask_less_or_equal(image.impl(),nodata), detector, points_per_tile );
     } // End OpenCV case
 
     sw.stop();
@@ -521,25 +617,91 @@ namespace asp {
                                << sw.elapsed_seconds() << " s." << std::endl;
 
     if (stereo_settings().ip_debug_images) {
-      vw_out() << "\t    Writing detected IP debug images. " << std::endl;
-      write_point_image("InterestPointMatching__ip_detect_debug1.tif", image1, ip1);
-      write_point_image("InterestPointMatching__ip_detect_debug2.tif", image2, ip2);
+      vw_out() << "\t    Writing detected IP debug image. " << std::endl;
+      std::ostringstream os;
+      os << "InterestPointMatching__ip_detect_debug" << index << ".tif";
+      write_point_image(os.str(), image, ip);
     }
 
     sw.start();
 
-    vw_out() << "\t    Removing IP near nodata" << std::endl;
     const int NODATA_RADIUS = 4;
-    if ( !boost::math::isnan(nodata1) )
-      remove_ip_near_nodata( image1.impl(), nodata1, ip1, NODATA_RADIUS );
-
-    if ( !boost::math::isnan(nodata2) )
-      remove_ip_near_nodata( image2.impl(), nodata2, ip2, NODATA_RADIUS );
+    if ( !boost::math::isnan(nodata) ) {
+      vw_out() << "\t    Removing IP near nodata" << std::endl;
+      remove_ip_near_nodata( image.impl(), nodata, ip, NODATA_RADIUS );
+    }
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Remove IP elapsed time: "
 			       << sw.elapsed_seconds() << " s." << std::endl;
 
+    sw.start();
+
+    // For the two OpenCV options we already built the descriptors, so only do this for the integral method.
+    if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
+      vw_out() << "\t    Building descriptors" << std::endl;
+      ip::SGradDescriptorGenerator descriptor;
+      if ( boost::math::isnan(nodata) )
+        describe_ip_threaded( image.impl(), descriptor, ip );
+      else
+        describe_ip_threaded( apply_mask(create_mask_less_or_equal(image.impl(),nodata)), descriptor, ip );
+
+      vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
+                                 << sw.elapsed_seconds() << " s." << std::endl;
+    }
+
+    if (!cache_file.empty()) {
+      // Write to a temporary file first, as another process matching
+      // a different pair may be reading or writing the same file.
+      vw_out() << "\t    Caching " << side << " interest points: " << cache_file << "\n";
+      std::string tmp_file = cache_file + "-" + boost::filesystem::unique_path().string() + ".tmp";
+      ip::write_binary_ip_file(tmp_file, ip);
+      boost::filesystem::rename(tmp_file, cache_file);
+    }
+
+    ip_set.assign( ip.begin(), ip.end() );
+  }
+
+  // Detect InterestPoints
+  //
+  /// This is not meant to be used directly. Please use ip_matching() or
+  /// the dumb homography_ip_matching().
+  template <class Image1T, class Image2T>
+  void detect_ip( IpSet& ip1,
+                  IpSet& ip2,
+                  vw::ImageViewBase<Image1T> const& image1,
+                  vw::ImageViewBase<Image2T> const& image2,
+                  int    ip_per_tile,
+                  double nodata1,
+                  double nodata2,
+                  std::string const& ip_cache_prefix1,
+                  std::string const& ip_cache_prefix2 ) {
+    using namespace vw;
+    BBox2i box1 = bounding_box(image1.impl());
+
+    // Automatically determine how many ip we need
+    float  number_boxes    = (box1.width() / 1024.f) * (box1.height() / 1024.f);
+    size_t points_per_tile = 5000.f / number_boxes;
+    if ( points_per_tile > 5000 ) points_per_tile = 5000;
+    if ( points_per_tile < 50   ) points_per_tile = 50;
+
+    // See if to override with manual value
+    if (ip_per_tile != 0)
+      points_per_tile = ip_per_tile;
+
+    vw_out() << "Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
+
+    std::string cache_file1, cache_file2;
+    if (!ip_cache_prefix1.empty())
+      cache_file1 = ip_cache_file(ip_cache_prefix1, Vector2i(image1.impl().cols(), image1.impl().rows()),
+                                  points_per_tile, nodata1);
+    if (!ip_cache_prefix2.empty())
+      cache_file2 = ip_cache_file(ip_cache_prefix2, Vector2i(image2.impl().cols(), image2.impl().rows()),
+                                  points_per_tile, nodata2);
+
+    detect_ip_aux(ip1, image1.impl(), points_per_tile, nodata1, cache_file1, 1);
+    detect_ip_aux(ip2, image2.impl(), points_per_tile, nodata2, cache_file2, 2);
+
     // Filter out IP from the opposite sides of the two images.
     // - Would be better to just pass an ROI into the IP detector!
     if (stereo_settings().ip_edge_buffer_percent > 0) {
@@ -557,25 +719,6 @@ namespace asp {
                << num_removed_right << " points from the right side of the right image.\n";
     } // End side IP filtering
 
-    sw.start();
-
-    // For the two OpenCV options we already built the descriptors, so only do this for the integral method.
-    if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
-      vw_out() << "\t    Building descriptors" << std::endl;
-      ip::SGradDescriptorGenerator descriptor;
-      if ( boost::math::isnan(nodata1) )
-        describe_interest_points( image1.impl(), descriptor, ip1 );
-      else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), descriptor, ip1 );
-      if ( boost::math::isnan(nodata2) )
-        describe_interest_points( image2.impl(), descriptor, ip2 );
-      else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), descriptor, ip2 );
-
-      vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
-                                 << sw.elapsed_seconds() << " s." << std::endl;
-    }
-
     vw_out() << "\t    Found interest points:\n" << "\t      left: " << ip1.size() << std::endl;
     vw_out() << "\t     right: " << ip2.size() << std::endl;
   }
@@ -590,41 +733,36 @@ namespace asp {
                         vw::ImageViewBase<Image2T> const& image2,
                         int    ip_per_tile,
                         double nodata1,
-                        double nodata2) {
+                        double nodata2,
+                        std::string const& ip_cache_prefix1,
+                        std::string const& ip_cache_prefix2) {
     using namespace vw;
 
     // Detect Interest Points
-    ip::InterestPointList ip1, ip2;
+    IpSet ip1, ip2;
     detect_ip( ip1, ip2, image1.impl(), image2.impl(),
-               ip_per_tile, nodata1, nodata2 );
+               ip_per_tile, nodata1, nodata2,
+               ip_cache_prefix1, ip_cache_prefix2 );
 
     // Match the interset points using the default matcher
     vw_out() << "\t--> Matching interest points\n";
 
-    // Replace the IP lists with IP vectors
-    std::vector<vw::ip::InterestPoint> ip1_copy, ip2_copy;
-    ip1_copy.reserve( ip1.size() );
-    ip2_copy.reserve( ip2.size() );
-    std::copy( ip1.begin(), ip1.end(), std::back_inserter( ip1_copy ) );
-    std::copy( ip2.begin(), ip2.end(), std::back_inserter( ip2_copy ) );
-
     DetectIpMethod detect_method = static_cast<DetectIpMethod>(stereo_settings().ip_matching_method);
 
     // Best point must be closer than the next best point
     vw_out() << "Uniqueness threshold: " << stereo_settings().ip_uniqueness_thresh << "\n";
     const double uniqueness_threshold = (0.8/0.7)*stereo_settings().ip_uniqueness_thresh;  // adj
-    
-    if (detect_method != DETECT_IP_METHOD_ORB) {
-      // For all L2Norm distance metrics
-      ip::InterestPointMatcher<ip::L2NormMetric,ip::NullConstraint> matcher(uniqueness_threshold);
-      matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-	       TerminalProgressCallback( "asp", "\t   Matching: " ));
-    }
-    else {
-      // For Hamming distance metrics
-      ip::InterestPointMatcher<ip::HammingMetric,ip::NullConstraint> matcher(uniqueness_threshold);
-      matcher( ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-	       TerminalProgressCallback( "asp", "\t   Matching: " ));
+
+    // L2 distance, except for ORB, which needs the Hamming distance
+    bool use_hamming = (detect_method == DETECT_IP_METHOD_ORB);
+    std::vector<size_t> index1, index2;
+    match_ip_descriptors( ip1, ip2, use_hamming, uniqueness_threshold,
+                          stereo_settings().ip_nn_method, index1, index2 );
+    matched_ip1.resize( index1.size() );
+    matched_ip2.resize( index2.size() );
+    for (size_t k = 0; k < index1.size(); k++) {
+      matched_ip1[k] = ip1.point(index1[k]);
+      matched_ip2[k] = ip2.point(index2[k]);
     }
 
     ip::remove_duplicates( matched_ip1, matched_ip2 );
@@ -648,7 +786,9 @@ namespace asp {
                                std::string const& output_name,
                                int    inlier_threshold,
                                double nodata1,
-                               double nodata2 ) {
+                               double nodata2,
+                               std::string const& ip_cache_prefix1,
+                               std::string const& ip_cache_prefix2 ) {
 
     using namespace vw;
 
@@ -656,7 +796,8 @@ namespace asp {
     detect_match_ip( matched_ip1, matched_ip2,
                      image1.impl(), image2.impl(),
                      ip_per_tile,
-                     nodata1, nodata2 );
+                     nodata1, nodata2,
+                     ip_cache_prefix1, ip_cache_prefix2 );
     if ( matched_ip1.size() == 0 || matched_ip2.size() == 0 )
       return false;
     std::vector<Vector3> ransac_ip1 = iplist_to_vectorlist(matched_ip1),
@@ -717,14 +858,17 @@ namespace asp {
                     double nodata2,
                     vw::TransformRef const& left_tx,
                     vw::TransformRef const& right_tx,
-                    bool transform_to_original_coord) {
+                    bool transform_to_original_coord,
+                    std::string const& ip_cache_prefix1,
+                    std::string const& ip_cache_prefix2) {
     using namespace vw;
 
     // Detect interest points
-    ip::InterestPointList ip1, ip2;
+    IpSet ip1, ip2;
     detect_ip( ip1, ip2, image1.impl(), image2.impl(),
                ip_per_tile,
-               nodata1, nodata2 );
+               nodata1, nodata2,
+               ip_cache_prefix1, ip_cache_prefix2 );
     if ( ip1.size() == 0 || ip2.size() == 0 ){
       vw_out() << "Unable to detect interest points." << std::endl;
       return false;
@@ -768,16 +912,10 @@ namespace asp {
     std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
     matched_ip1.reserve( valid_count ); // Get our allocations out of the way.
     matched_ip2.reserve( valid_count );
-    {
-      ip::InterestPointList::const_iterator ip1_it = ip1.begin(), ip2_it = ip2.begin();
-      for ( size_t i = 0; i < forward_match.size(); i++ ) {
-        if ( forward_match[i] != NULL_INDEX ) {
-          matched_ip1.push_back( *ip1_it );
-          ip2_it = ip2.begin();
-          std::advance( ip2_it, forward_match[i] );
-          matched_ip2.push_back( *ip2_it );
-        }
-        ip1_it++;
+    for ( size_t i = 0; i < forward_match.size(); i++ ) {
+      if ( forward_match[i] != NULL_INDEX ) {
+        matched_ip1.push_back( ip1.point(i) );
+        matched_ip2.push_back( ip2.point(forward_match[i]) );
       }
     }
 
@@ -886,7 +1024,8 @@ namespace asp {
 				double nodata1,
 				double nodata2,
 				vw::TransformRef const& left_tx,
-				vw::TransformRef const& right_tx ) {
+				vw::TransformRef const& right_tx,
+				std::string const& left_ip_cache_prefix ) {
 
     using namespace vw;
 
@@ -936,14 +1075,16 @@ namespace asp {
 				  NearestPixelInterpolation()), raster_box),
 		   ip_per_tile,
 		   datum, output_name, epipolar_threshold, uniqueness_threshold,
-		   nodata1, nodata2, left_tx, tx );
+		   nodata1, nodata2, left_tx, tx,
+		   true, // transform_to_original_coord
+		   left_ip_cache_prefix, "" );
     if (!inlier)
       return inlier;
 
     // For some reason ip_matching writes its points to file instead
     // of returning them, so read them from disk.
     std::vector<ip::InterestPoint> ip1_copy, ip2_copy;
-    ip::read_binary_match_file( output_name, ip1_copy, ip2_copy );
+    asp::read_match_file( output_name, ip1_copy, ip2_copy );
 
     // Use the interest points that we found to compute an aligning
     // homography transform for the two images
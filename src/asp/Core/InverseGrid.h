@@ -0,0 +1,149 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file InverseGrid.h
+///
+/// Find the reverse of a costly transform, such as the one from a
+/// mapprojected image to its camera image, at all pixels of a tile.
+/// The transform is evaluated exactly at the nodes of a coarse lattice,
+/// and elsewhere found by bilinear interpolation in each cell whose
+/// midpoint is so predicted to within a tolerance. The other cells are
+/// split in four, until they are interpolated or all their pixels are
+/// evaluated exactly.
+
+#ifndef __ASP_CORE_INVERSE_GRID_H__
+#define __ASP_CORE_INVERSE_GRID_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <algorithm>
+
+namespace asp {
+
+  /// Fills the reverse of a transform into an image, for the pixels of a box
+  template <class TransformT>
+  class InverseGridFiller {
+    TransformT const&            m_trans;
+    vw::BBox2i                   m_box;
+    double                       m_tol;
+    vw::Vector2                  m_invalid;
+    vw::ImageView<vw::Vector2> & m_coords;
+    vw::ImageView<vw::uint8>   & m_exact;
+
+    vw::Vector2 const& exact(int col, int row) {
+      if (!m_exact(col, row)) {
+        m_coords(col, row) = m_trans.reverse(vw::Vector2(m_box.min().x() + col,
+                                                         m_box.min().y() + row));
+        m_exact(col, row) = 1;
+      }
+      return m_coords(col, row);
+    }
+
+    // The cell has corners (c0, r0) and (c1, r1), both inclusive
+    void fill_cell(int c0, int r0, int c1, int r1) {
+      vw::Vector2 p00 = exact(c0, r0), p10 = exact(c1, r0);
+      vw::Vector2 p01 = exact(c0, r1), p11 = exact(c1, r1);
+      if (c1 - c0 <= 1 && r1 - r0 <= 1)
+        return; // All pixels are corners
+
+      int cm = (c0 + c1)/2, rm = (r0 + r1)/2;
+      bool corners_valid = (p00 != m_invalid && p10 != m_invalid &&
+                            p01 != m_invalid && p11 != m_invalid);
+      if (corners_valid && m_tol > 0) {
+        vw::Vector2 mid = exact(cm, rm);
+        if (mid != m_invalid &&
+            vw::math::norm_2(interpolate(c0, r0, c1, r1, p00, p10, p01, p11, cm, rm) - mid) <= m_tol) {
+          for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+              if (!m_exact(col, row))
+                m_coords(col, row) = interpolate(c0, r0, c1, r1, p00, p10, p01, p11, col, row);
+            }
+          }
+          return;
+        }
+      }
+
+      // Split the cell along the dimensions in which it is at least two pixels wide
+      if (c1 - c0 >= 2 && r1 - r0 >= 2) {
+        fill_cell(c0, r0, cm, rm);
+        fill_cell(cm, r0, c1, rm);
+        fill_cell(c0, rm, cm, r1);
+        fill_cell(cm, rm, c1, r1);
+      } else if (c1 - c0 >= 2) {
+        fill_cell(c0, r0, cm, r1);
+        fill_cell(cm, r0, c1, r1);
+      } else {
+        fill_cell(c0, r0, c1, rm);
+        fill_cell(c0, rm, c1, r1);
+      }
+    }
+
+    static vw::Vector2 interpolate(int c0, int r0, int c1, int r1,
+                                   vw::Vector2 const& p00, vw::Vector2 const& p10,
+                                   vw::Vector2 const& p01, vw::Vector2 const& p11,
+                                   int col, int row) {
+      double a = (c1 > c0) ? double(col - c0)/(c1 - c0) : 0.0;
+      double b = (r1 > r0) ? double(row - r0)/(r1 - r0) : 0.0;
+      return (1 - b)*((1 - a)*p00 + a*p10) + b*((1 - a)*p01 + a*p11);
+    }
+
+  public:
+    InverseGridFiller(TransformT const& trans, vw::BBox2i const& box, double tol,
+                      vw::Vector2 const& invalid_pix,
+                      vw::ImageView<vw::Vector2> & coords, vw::ImageView<vw::uint8> & exact):
+      m_trans(trans), m_box(box), m_tol(tol), m_invalid(invalid_pix),
+      m_coords(coords), m_exact(exact) {}
+
+    void operator()(int spacing) {
+      m_coords.set_size(m_box.width(), m_box.height());
+      m_exact.set_size(m_box.width(), m_box.height());
+      vw::fill(m_exact, 0);
+      if (m_box.width() <= 0 || m_box.height() <= 0)
+        return;
+      spacing = std::max(spacing, 1);
+      for (int r0 = 0; r0 < m_box.height(); r0 += spacing) {
+        int r1 = std::min(r0 + spacing, m_box.height() - 1);
+        for (int c0 = 0; c0 < m_box.width(); c0 += spacing) {
+          int c1 = std::min(c0 + spacing, m_box.width() - 1);
+          fill_cell(c0, r0, c1, r1);
+        }
+      }
+    }
+  };
+
+  /// Find the reverse of the transform at the pixels of the box, with
+  /// the lattice of the given spacing and the given tolerance, in
+  /// pixels. A zero tolerance has all pixels evaluated exactly. Cells
+  /// with a corner where the transform returns the invalid pixel are not
+  /// interpolated, but invalid regions within a cell can be missed, so
+  /// the caller should check the interpolated results if these may
+  /// occur. The pixel (0, 0) of the results is for the box corner, and
+  /// exact tells which results are not interpolated.
+  template <class TransformT>
+  void inverse_grid(TransformT const& trans, vw::BBox2i const& box,
+                    int spacing, double tol, vw::Vector2 const& invalid_pix,
+                    vw::ImageView<vw::Vector2> & coords, vw::ImageView<vw::uint8> & exact) {
+    InverseGridFiller<TransformT> filler(trans, box, tol, invalid_pix, coords, exact);
+    filler(spacing);
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_INVERSE_GRID_H__
@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IpSet.cc
+///
+
+#include <asp/Core/IpSet.h>
+
+using namespace vw;
+
+namespace asp {
+
+  ip::InterestPoint IpSet::point(size_t i) const {
+    ip::InterestPoint ip;
+    ip.x           = m_x[i];
+    ip.y           = m_y[i];
+    ip.ix          = m_ix[i];
+    ip.iy          = m_iy[i];
+    ip.scale       = m_scale[i];
+    ip.interest    = m_interest[i];
+    ip.orientation = m_orientation[i];
+    ip.polarity    = m_polarity[i];
+    ip.octave      = m_octave[i];
+    ip.scale_lvl   = m_scale_lvl[i];
+    size_t len = m_descriptors.cols();
+    ip.descriptor.set_size(len);
+    for (size_t d = 0; d < len; d++)
+      ip.descriptor[d] = m_descriptors(i, d);
+    return ip;
+  }
+
+  void IpSet::select(std::vector<size_t> const& indices) {
+
+    // Each point kept moves to the same place or before it
+    size_t num = indices.size(), len = m_descriptors.cols();
+    for (size_t k = 0; k < num; k++) {
+      size_t i = indices[k];
+      if (i >= size() || (k > 0 && i <= indices[k-1]))
+        vw_throw( ArgumentErr() << "IpSet: The indices must be increasing and in range.\n" );
+      if (i == k)
+        continue;
+      m_x[k]           = m_x[i];
+      m_y[k]           = m_y[i];
+      m_ix[k]          = m_ix[i];
+      m_iy[k]          = m_iy[i];
+      m_scale[k]       = m_scale[i];
+      m_interest[k]    = m_interest[i];
+      m_orientation[k] = m_orientation[i];
+      m_polarity[k]    = m_polarity[i];
+      m_octave[k]      = m_octave[i];
+      m_scale_lvl[k]   = m_scale_lvl[i];
+      for (size_t d = 0; d < len; d++)
+        m_descriptors(k, d) = m_descriptors(i, d);
+    }
+
+    m_x.resize(num);        m_y.resize(num);
+    m_ix.resize(num);       m_iy.resize(num);
+    m_scale.resize(num);    m_interest.resize(num);
+    m_orientation.resize(num);
+    m_polarity.resize(num);
+    m_octave.resize(num);   m_scale_lvl.resize(num);
+    bool preserve = true;
+    m_descriptors.set_size(num, len, preserve);
+  }
+
+} // namespace asp
@@ -0,0 +1,128 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IpSet.h
+///
+/// Interest points stored as a structure of arrays. Each field of the
+/// points is in its own vector, and the descriptors are the rows of a
+/// single matrix, which can be given as is to a FLANN tree. Points are
+/// filtered by the indices of those to keep, in place. Unlike with the
+/// std::list of vw::ip::InterestPointList, no point is allocated on its
+/// own, and the matching code need not copy the points into vectors
+/// or walk lists to reach a point by its index.
+
+#ifndef __ASP_CORE_IP_SET_H__
+#define __ASP_CORE_IP_SET_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Math/Matrix.h>
+#include <vw/Math/Vector.h>
+#include <vw/InterestPoint/InterestData.h>
+#include <iterator>
+#include <vector>
+
+namespace asp {
+
+  class IpSet {
+  public:
+    IpSet() {}
+    explicit IpSet(vw::ip::InterestPointList const& ip) { assign(ip.begin(), ip.end()); }
+    explicit IpSet(std::vector<vw::ip::InterestPoint> const& ip) { assign(ip.begin(), ip.end()); }
+
+    /// Replace the points with the given ones. Their descriptors must
+    /// all have the same length.
+    template <class IterT>
+    void assign(IterT begin, IterT end);
+
+    size_t size () const { return m_x.size(); }
+    bool   empty() const { return m_x.empty(); }
+    size_t descriptor_length() const { return m_descriptors.cols(); }
+
+    float       x (size_t i) const { return m_x[i]; }
+    float       y (size_t i) const { return m_y[i]; }
+    vw::int32   ix(size_t i) const { return m_ix[i]; }
+    vw::int32   iy(size_t i) const { return m_iy[i]; }
+    vw::Vector2 location(size_t i) const { return vw::Vector2(m_x[i], m_y[i]); }
+
+    /// The descriptors, one per row
+    vw::Matrix<float> const& descriptors() const { return m_descriptors; }
+
+    /// The descriptors cast to another type, one per row, such as the
+    /// bytes of binary descriptors
+    template <class T>
+    void descriptors_as(vw::Matrix<T> & matrix) const;
+
+    /// A point with all its fields and its descriptor
+    vw::ip::InterestPoint point(size_t i) const;
+
+    /// Keep only the points with the given indices, which must be
+    /// increasing, in that order
+    void select(std::vector<size_t> const& indices);
+
+  private:
+    std::vector<float>      m_x, m_y, m_scale, m_interest, m_orientation;
+    std::vector<vw::int32>  m_ix, m_iy;
+    std::vector<vw::uint32> m_octave, m_scale_lvl;
+    std::vector<char>       m_polarity;
+    vw::Matrix<float>       m_descriptors;
+  };
+
+  template <class IterT>
+  void IpSet::assign(IterT begin, IterT end) {
+    size_t num = std::distance(begin, end);
+    size_t len = (num > 0) ? begin->descriptor.size() : 0;
+
+    m_x.resize(num);        m_y.resize(num);
+    m_ix.resize(num);       m_iy.resize(num);
+    m_scale.resize(num);    m_interest.resize(num);
+    m_orientation.resize(num);
+    m_polarity.resize(num);
+    m_octave.resize(num);   m_scale_lvl.resize(num);
+    m_descriptors.set_size(num, len);
+
+    size_t i = 0;
+    for (IterT ip = begin; ip != end; ++ip, ++i) {
+      if (ip->descriptor.size() != len)
+        vw::vw_throw( vw::ArgumentErr() << "IpSet: The descriptors differ in size.\n" );
+      m_x[i]           = ip->x;
+      m_y[i]           = ip->y;
+      m_ix[i]          = ip->ix;
+      m_iy[i]          = ip->iy;
+      m_scale[i]       = ip->scale;
+      m_interest[i]    = ip->interest;
+      m_orientation[i] = ip->orientation;
+      m_polarity[i]    = ip->polarity;
+      m_octave[i]      = ip->octave;
+      m_scale_lvl[i]   = ip->scale_lvl;
+      for (size_t d = 0; d < len; d++)
+        m_descriptors(i, d) = ip->descriptor[d];
+    }
+  }
+
+  template <class T>
+  void IpSet::descriptors_as(vw::Matrix<T> & matrix) const {
+    matrix.set_size(m_descriptors.rows(), m_descriptors.cols());
+    for (size_t i = 0; i < m_descriptors.rows(); i++) {
+      for (size_t d = 0; d < m_descriptors.cols(); d++)
+        matrix(i, d) = static_cast<T>(m_descriptors(i, d));
+    }
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_IP_SET_H__
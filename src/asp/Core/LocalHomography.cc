@@ -24,9 +24,11 @@
 #include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <vw/Math/Geometry.h>
 #include <asp/Core/LocalHomography.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <cmath>
 
 using namespace vw;
 
@@ -54,11 +56,112 @@ namespace asp {
 
   }
 
+  /// Fit a homography mapping the right points to the left ones with
+  /// RANSAC, then refine it on all points, as homography_rectification()
+  /// does. The random samples are drawn from a generator seeded with
+  /// 'seed' rather than from rand(), so that the tiles can be done in
+  /// parallel and the result does not depend on the order. The search
+  /// stops as soon as enough samples were drawn to find an outlier-free
+  /// one with 99% probability, given the best inlier ratio so far.
+  bool fit_local_homography(std::vector<Vector3> const& right_pts,
+                            std::vector<Vector3> const& left_pts,
+                            double inlier_threshold, size_t min_inliers,
+                            unsigned int seed, Matrix<double> & H){
+
+    const int MAX_ITER = 100, SAMPLE_SIZE = 4;
+    const double CONFIDENCE = 0.99;
+    size_t num = right_pts.size();
+    if (num < size_t(SAMPLE_SIZE) || left_pts.size() != num)
+      return false;
+
+    // Keep the coordinates in plain arrays, so that the inlier count
+    // below is a simple loop over them that can be vectorized.
+    std::vector<double> rx(num), ry(num), lx(num), ly(num);
+    for (size_t k = 0; k < num; k++){
+      rx[k] = right_pts[k].x(); ry[k] = right_pts[k].y();
+      lx[k] = left_pts[k].x();  ly[k] = left_pts[k].y();
+    }
+    double thresh2 = inlier_threshold*inlier_threshold;
+
+    math::HomographyFittingFunctor fit;
+    std::vector<Vector3> sample_r(SAMPLE_SIZE), sample_l(SAMPLE_SIZE);
+    size_t best_count = 0;
+    Matrix<double> best_H;
+    int needed_iter = MAX_ITER;
+    for (int iter = 0; iter < needed_iter; iter++){
+
+      // Draw distinct indices with a linear congruential generator
+      size_t ids[SAMPLE_SIZE];
+      for (int s = 0; s < SAMPLE_SIZE; s++){
+        bool repeated = true;
+        while (repeated){
+          seed = 1664525u*seed + 1013904223u;
+          ids[s] = (seed >> 8) % num;
+          repeated = false;
+          for (int t = 0; t < s; t++)
+            if (ids[t] == ids[s]) repeated = true;
+        }
+        sample_r[s] = right_pts[ids[s]];
+        sample_l[s] = left_pts[ids[s]];
+      }
+
+      Matrix<double> Hs;
+      try {
+        Hs = fit(sample_r, sample_l);
+      } catch (...) {
+        continue; // degenerate sample
+      }
+
+      double h00 = Hs(0,0), h01 = Hs(0,1), h02 = Hs(0,2);
+      double h10 = Hs(1,0), h11 = Hs(1,1), h12 = Hs(1,2);
+      double h20 = Hs(2,0), h21 = Hs(2,1), h22 = Hs(2,2);
+      size_t count = 0;
+      for (size_t k = 0; k < num; k++){
+        double w  = h20*rx[k] + h21*ry[k] + h22;
+        double dx = (h00*rx[k] + h01*ry[k] + h02)/w - lx[k];
+        double dy = (h10*rx[k] + h11*ry[k] + h12)/w - ly[k];
+        count += (dx*dx + dy*dy < thresh2);
+      }
+
+      if (count > best_count){
+        best_count = count;
+        best_H     = Hs;
+        double ratio = double(count)/double(num);
+        double p_good_sample = std::pow(ratio, SAMPLE_SIZE);
+        if (p_good_sample >= 1.0)
+          break;
+        double iter_for_confidence = std::log(1.0 - CONFIDENCE)/std::log(1.0 - p_good_sample);
+        needed_iter = int(std::min(double(MAX_ITER), std::ceil(iter_for_confidence)));
+      }
+    }
+
+    if (best_count < min_inliers || best_count < size_t(SAMPLE_SIZE))
+      return false;
+
+    // Refit to the inliers of the best sample, then refine on all points
+    std::vector<Vector3> inliers_r, inliers_l;
+    for (size_t k = 0; k < num; k++){
+      Vector3 p = best_H*right_pts[k];
+      if (norm_2_sqr(Vector2(p.x()/p.z(), p.y()/p.z()) - subvector(left_pts[k], 0, 2)) < thresh2){
+        inliers_r.push_back(right_pts[k]);
+        inliers_l.push_back(left_pts[k]);
+      }
+    }
+    try {
+      H = fit(inliers_r, inliers_l, best_H);
+      H = fit(right_pts, left_pts, H);
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
   /// Given a disparity map restricted to a subregion, find the homography
   /// transform which aligns best the two images based on this disparity.
   template<class SeedDispT>
   vw::math::Matrix<double> homography_for_disparity(vw::BBox2i subregion,
                                                     SeedDispT const& disparity,
+                                                    unsigned int seed,
                                                     bool & success){
     success = true;
 
@@ -75,7 +178,7 @@ namespace asp {
     split_n_into_k(disparity.cols(), std::min(disparity.cols(), N), partitionx);
     split_n_into_k(disparity.rows(), std::min(disparity.rows(), N), partitiony);
 
-    std::vector<vw::ip::InterestPoint> left_ip, right_ip;
+    std::vector<Vector3> left_pts, right_pts;
     for (int ix = 0; ix < (int)partitionx.size()-1; ix++){
       for (int iy = 0; iy < (int)partitiony.size()-1; iy++){
 
@@ -94,58 +197,63 @@ namespace asp {
         if (count == 0) continue; // no valid points
 
         // Do the averaging. We must add the box corner to the left and
-        // right interest points.
-        vw::ip::InterestPoint l, r;
-        l.x = subregion.min().x() + lx/count; r.x = subregion.min().x() + rx/count;
-        l.y = subregion.min().y() + ly/count; r.y = subregion.min().y() + ry/count;
-        left_ip.push_back(l);
-        right_ip.push_back(r);
+        // right points.
+        left_pts.push_back (Vector3(subregion.min().x() + lx/count,
+                                    subregion.min().y() + ly/count, 1));
+        right_pts.push_back(Vector3(subregion.min().x() + rx/count,
+                                    subregion.min().y() + ry/count, 1));
       }
     }
 
-    try {
-      Matrix<double> left_matrix, right_matrix;
-      BBox2i image_size = bounding_box(disparity);
-      bool adjust_left_image_size = true;
-      homography_rectification( adjust_left_image_size,
-                                image_size.size(), image_size.size(),
-                                left_ip, right_ip, left_matrix, right_matrix );
-      // Undoing the shift in origin.
-      right_matrix(0,2) -= left_matrix(0,2);
-      right_matrix(1,2) -= left_matrix(1,2);
-      return right_matrix;
-    }
-    catch ( const vw::ArgumentErr& e ){}
-    catch ( const vw::math::RANSACErr& e ){}
+    // The same thresholds as in homography_rectification()
+    double thresh_factor = stereo_settings().ip_inlier_factor; // 1/15 by default
+    double inlier_threshold = norm_2(Vector2(disparity.cols(), disparity.rows()))
+      * (1.5*thresh_factor);
+    size_t min_inliers = left_pts.size()*2/3;
+
+    Matrix<double> H;
+    if (fit_local_homography(right_pts, left_pts, inlier_threshold, min_inliers, seed, H))
+      return H;
+
     success = false;
     return vw::math::identity_matrix<3>();
   }
 
-  // Task that computes local homography in a given tile
+  // Task that computes the local homography of one correlation tile.
+  // If the fit fails, the region of the low-res disparity it uses is
+  // grown until it succeeds or covers all of it.
   class LocalHomTask: public vw::Task, private boost::noncopyable {
 
     int m_col, m_row;
-    BBox2i m_sub_bbox;
-    // We on purpose store a local deep copy of sub_disparity_crop to
-    // avoid segfault.
-    ImageView < PixelMask<Vector2i> > m_sub_disparity_crop;
+    BBox2i m_bbox, m_sub_bbox;
+    ImageView< PixelMask<Vector2f> > const& m_sub_disparity;
     ImageView<Matrix3x3> & m_local_hom;
   public:
-    LocalHomTask(int col, int row,
-                 BBox2i sub_bbox,
-                 ImageViewRef < PixelMask<Vector2i> > const& sub_disparity_crop,
+    LocalHomTask(int col, int row, BBox2i const& bbox, BBox2i const& sub_bbox,
+                 ImageView< PixelMask<Vector2f> > const& sub_disparity,
                  ImageView<Matrix3x3> & local_hom):
-      m_col(col), m_row(row), m_sub_bbox(sub_bbox),
-      m_sub_disparity_crop(sub_disparity_crop),
-      m_local_hom(local_hom){}
+      m_col(col), m_row(row), m_bbox(bbox), m_sub_bbox(sub_bbox),
+      m_sub_disparity(sub_disparity), m_local_hom(local_hom){}
 
     void operator()() {
-      bool success;
-      // To do: If this function is ever used, the variable 'success'
-      // needs to be treated properly.
-      exit(1); // broken, for now
-      m_local_hom(m_col, m_row)
-        = homography_for_disparity(m_sub_bbox, m_sub_disparity_crop, success);
+
+      // A seed depending only on the tile, so the answer does not
+      // depend on the number of threads or the order of the tasks.
+      unsigned int seed = 1u + 7919u*unsigned(m_col) + 104729u*unsigned(m_row);
+
+      BBox2i sub_bbox = m_sub_bbox;
+      bool success = false;
+      while(1){
+        sub_bbox.crop( bounding_box(m_sub_disparity) );
+        m_local_hom(m_col, m_row)
+          = homography_for_disparity(sub_bbox, crop(m_sub_disparity, sub_bbox), seed, success);
+        if (success) break;
+        vw_out() << "\t--> Failed to find local disparity in box: " << m_bbox  << std::endl;
+        vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
+        if (sub_bbox == bounding_box(m_sub_disparity)) break; // can't expand more
+        int len = std::max(sub_bbox.width(), sub_bbox.height());
+        sub_bbox.expand(len);
+      }
     }
   };
 
@@ -154,8 +262,11 @@ namespace asp {
 
     DiskImageView< PixelGray<float> > left_sub (opt.out_prefix + "-L_sub.tif");
     DiskImageView< PixelGray<float> > left_img (opt.out_prefix + "-L.tif");
-    DiskImageView< PixelMask<Vector2f> >
-      sub_disparity(opt.out_prefix + "-D_sub.tif");
+
+    // The low-res disparity is small, so read it once, and let all
+    // threads use the copy in memory.
+    ImageView< PixelMask<Vector2f> > sub_disparity
+      = DiskImageView< PixelMask<Vector2f> >(opt.out_prefix + "-D_sub.tif");
 
     Vector2 upscale_factor( double(left_img.cols()) / double(left_sub.cols()),
                             double(left_img.rows()) / double(left_sub.rows()) );
@@ -165,14 +276,12 @@ namespace asp {
     int rows = (int)ceil(left_img.rows()/double(ts));
     ImageView<Matrix3x3> local_hom(cols, rows);
 
-    // Calculate the local homographies using multiple threads.
-    // To do: Each thread calls RANSAC, which calls rand(), which
-    // is not thread safe. So for now use just one thread.
-
     Stopwatch sw;
     sw.start();
 
-    //FifoWorkQueue queue( vw_settings().default_num_threads() );
+    // Each tile is independent and has its own random stream, so
+    // use all threads.
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
     for (int col = 0; col < cols; col++){
       for (int row = 0; row < rows; row++){
 
@@ -184,37 +293,17 @@ namespace asp {
                           elem_quot(bbox.max(), upscale_factor) );
 
         // Expand the box until square to make sure the local
-        // homography calculation does not fail. If that does not
-        // help, keep on expanding the box.
-        bool success = false;
+        // homography calculation does not fail.
         int len = std::max(sub_bbox.width(), sub_bbox.height());
         sub_bbox = BBox2i(sub_bbox.max() - Vector2(len, len), sub_bbox.max());
         sub_bbox.expand(1);
-        while(1){
-
-          // This code enables multi-threading. It gives different answers each time,
-          // as multiple threads pull random numbers from the same stream.
-          // This code must be kept disabled until Boost's random function is used
-          // with one random stream for each thread.
-          //boost::shared_ptr<LocalHomTask>
-          //task(new LocalHomTask(col, row, sub_bbox, crop(sub_disparity, sub_bbox),
-          //                        local_hom));
-          //queue.add_task(task);
-
-          sub_bbox.crop( bounding_box(sub_disparity) );
-          local_hom(col, row)
-            = homography_for_disparity(sub_bbox, crop(sub_disparity, sub_bbox), success);
-          if (success) break;
-          vw_out() << "\t--> Failed to find local disparity in box: " << bbox  << std::endl;
-          vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
-          if (sub_bbox == bounding_box(sub_disparity)) break; // can't expand more
-          len = std::max(sub_bbox.width(), sub_bbox.height());
-          sub_bbox.expand(len);
-        }
 
+        boost::shared_ptr<LocalHomTask>
+          task(new LocalHomTask(col, row, bbox, sub_bbox, sub_disparity, local_hom));
+        queue.add_task(task);
       }
     }
-    //queue.join_all();
+    queue.join_all();
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Local homographies elapsed time: "
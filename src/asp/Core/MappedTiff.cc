@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MappedTiff.cc
+///
+
+#include <asp/Core/MappedTiff.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/config.h>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal_priv.h>
+#endif
+
+using namespace vw;
+
+namespace asp {
+
+  MappedTiffFile::MappedTiffFile():
+    m_cols(0), m_rows(0), m_num_channels(0), m_channel_type(VW_CHANNEL_UNKNOWN),
+    m_block_cols(0), m_block_rows(0), m_blocks_per_row(0), m_pixel_bytes(0),
+    m_data(NULL), m_size(0) {}
+
+  MappedTiffFile::~MappedTiffFile() {
+    if (m_data != NULL)
+      munmap(m_data, m_size);
+  }
+
+  boost::shared_ptr<MappedTiffFile> MappedTiffFile::open(std::string const& filename) {
+
+    boost::shared_ptr<MappedTiffFile> file;
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+    boost::shared_ptr<MappedTiffFile> tiff(new MappedTiffFile);
+
+    // Find the layout of the file with GDAL
+    GDALAllRegister();
+    GDALDataset * dataset = static_cast<GDALDataset*>(GDALOpen(filename.c_str(), GA_ReadOnly));
+    if (dataset == NULL)
+      return file;
+
+    bool ok = (std::string(dataset->GetDriver()->GetDescription()) == "GTiff" &&
+               dataset->GetRasterCount() > 0);
+    if (ok) {
+      const char * compression = dataset->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+      const char * interleave  = dataset->GetMetadataItem("INTERLEAVE",  "IMAGE_STRUCTURE");
+      ok = (compression == NULL || std::string(compression) == "NONE") &&
+           (dataset->GetRasterCount() == 1 ||
+            (interleave != NULL && std::string(interleave) == "PIXEL"));
+    }
+
+    GDALDataType data_type = GDT_Unknown;
+    if (ok) {
+      data_type = dataset->GetRasterBand(1)->GetRasterDataType();
+      for (int b = 2; b <= dataset->GetRasterCount(); b++)
+        ok = ok && (dataset->GetRasterBand(b)->GetRasterDataType() == data_type);
+      switch (data_type) {
+      case GDT_Byte:    tiff->m_channel_type = VW_CHANNEL_UINT8;   break;
+      case GDT_UInt16:  tiff->m_channel_type = VW_CHANNEL_UINT16;  break;
+      case GDT_Int16:   tiff->m_channel_type = VW_CHANNEL_INT16;   break;
+      case GDT_UInt32:  tiff->m_channel_type = VW_CHANNEL_UINT32;  break;
+      case GDT_Int32:   tiff->m_channel_type = VW_CHANNEL_INT32;   break;
+      case GDT_Float32: tiff->m_channel_type = VW_CHANNEL_FLOAT32; break;
+      case GDT_Float64: tiff->m_channel_type = VW_CHANNEL_FLOAT64; break;
+      default: ok = false;
+      }
+    }
+
+    if (ok) {
+      GDALRasterBand * band = dataset->GetRasterBand(1);
+      tiff->m_cols         = dataset->GetRasterXSize();
+      tiff->m_rows         = dataset->GetRasterYSize();
+      tiff->m_num_channels = dataset->GetRasterCount();
+      tiff->m_pixel_bytes  = size_t(tiff->m_num_channels)*GDALGetDataTypeSize(data_type)/8;
+      band->GetBlockSize(&tiff->m_block_cols, &tiff->m_block_rows);
+      tiff->m_blocks_per_row = (tiff->m_cols + tiff->m_block_cols - 1)/tiff->m_block_cols;
+      int blocks_per_col     = (tiff->m_rows + tiff->m_block_rows - 1)/tiff->m_block_rows;
+
+      // Where each block starts. Blocks which were never written have
+      // no data, so such files are read with GDAL.
+      for (int by = 0; by < blocks_per_col && ok; by++) {
+        for (int bx = 0; bx < tiff->m_blocks_per_row && ok; bx++) {
+          std::string item = "BLOCK_OFFSET_" + boost::lexical_cast<std::string>(bx)
+            + "_" + boost::lexical_cast<std::string>(by);
+          const char * offset = band->GetMetadataItem(item.c_str(), "TIFF");
+          if (offset == NULL) {
+            ok = false;
+            break;
+          }
+          size_t value = boost::lexical_cast<size_t>(offset);
+          ok = (value > 0 && value % (GDALGetDataTypeSize(data_type)/8) == 0);
+          tiff->m_block_offsets.push_back(value);
+        }
+      }
+    }
+    GDALClose(dataset);
+    if (!ok)
+      return file;
+
+    // Map the file
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return file;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      close(fd);
+      return file;
+    }
+    tiff->m_size = st.st_size;
+    void * data = mmap(NULL, tiff->m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return file;
+    tiff->m_data = static_cast<unsigned char*>(data);
+
+    // The byte order of the file must be that of this machine
+    const unsigned short one = 1;
+    bool little_endian = (*reinterpret_cast<const unsigned char*>(&one) == 1);
+    if (tiff->m_size < 2 || tiff->m_data[0] != tiff->m_data[1] ||
+        tiff->m_data[0] != (little_endian ? 'I' : 'M'))
+      return file;
+
+    // All the pixels must be in the file. Tiles at the image edges are
+    // stored whole, and only the strips may be cut.
+    for (size_t b = 0; b < tiff->m_block_offsets.size(); b++) {
+      int block_row = b / tiff->m_blocks_per_row;
+      size_t rows = std::min(tiff->m_block_rows, tiff->m_rows - block_row*tiff->m_block_rows);
+      if (tiff->m_block_offsets[b] + rows*tiff->m_block_cols*tiff->m_pixel_bytes > tiff->m_size)
+        return file;
+    }
+
+    vw_out(DebugMessage, "asp") << "Reading " << filename << " mapped in memory.\n";
+    file = tiff;
+#endif
+
+    return file;
+  }
+
+} // namespace asp
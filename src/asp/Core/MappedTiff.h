@@ -0,0 +1,132 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MappedTiff.h
+///
+/// Read the intermediate files of stereo, such as L.tif, R.tif and
+/// D.tif, by mapping them in memory rather than through GDAL. When a
+/// file is uncompressed, with the channels of each pixel stored
+/// together, and in the byte order of this machine, its pixels can be
+/// used where they are on disk, without copying them into buffers or
+/// converting them. Other files are read with DiskImageView as usual.
+
+#ifndef __ASP_CORE_MAPPED_TIFF_H__
+#define __ASP_CORE_MAPPED_TIFF_H__
+
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// A TIFF file mapped in memory, whose pixels can be read in place.
+  class MappedTiffFile: private boost::noncopyable {
+  public:
+    /// Map the file if it is an uncompressed TIFF, tiled or in strips,
+    /// with the channels of each pixel together, and in the byte order
+    /// of this machine. Return a null pointer otherwise.
+    static boost::shared_ptr<MappedTiffFile> open(std::string const& filename);
+
+    ~MappedTiffFile();
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    int num_channels() const { return m_num_channels; }
+    vw::ChannelTypeEnum channel_type() const { return m_channel_type; }
+
+    /// Where the pixel is in memory
+    const unsigned char* pixel_address(int col, int row) const {
+      int block_col = col / m_block_cols, block_row = row / m_block_rows;
+      size_t offset = m_block_offsets[block_row*m_blocks_per_row + block_col];
+      return m_data + offset
+        + (size_t(row - block_row*m_block_rows)*m_block_cols
+           + (col - block_col*m_block_cols))*m_pixel_bytes;
+    }
+
+  private:
+    MappedTiffFile();
+
+    int                 m_cols, m_rows, m_num_channels;
+    vw::ChannelTypeEnum m_channel_type;
+    int                 m_block_cols, m_block_rows, m_blocks_per_row;
+    size_t              m_pixel_bytes;
+    std::vector<size_t> m_block_offsets;
+    unsigned char     * m_data;
+    size_t              m_size;
+  };
+
+  /// An image whose pixels are read from a mapped file. Nothing is
+  /// copied when it is prerasterized. The file must have the same
+  /// channels as PixelT.
+  template <class PixelT>
+  class MappedTiffView: public vw::ImageViewBase< MappedTiffView<PixelT> > {
+    boost::shared_ptr<MappedTiffFile> m_file;
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef vw::ProceduralPixelAccessor<MappedTiffView> pixel_accessor;
+
+    MappedTiffView(boost::shared_ptr<MappedTiffFile> file): m_file(file) {}
+
+    inline vw::int32 cols  () const { return m_file->cols(); }
+    inline vw::int32 rows  () const { return m_file->rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      return *reinterpret_cast<const PixelT*>(m_file->pixel_address(col, row));
+    }
+
+    typedef MappedTiffView prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& /*bbox*/) const { return *this; }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Whether the pixels of the file can be read as PixelT in place
+  template <class PixelT>
+  bool has_pixel_layout(MappedTiffFile const& file) {
+    typedef typename vw::PixelChannelType<PixelT>::type channel_type;
+    return file.num_channels() == int(vw::PixelNumChannels<PixelT>::value) &&
+      file.channel_type() == vw::ChannelTypeID<channel_type>::value &&
+      sizeof(PixelT) == vw::PixelNumChannels<PixelT>::value*sizeof(channel_type);
+  }
+
+  /// Open an intermediate file of stereo, mapping it in memory if its
+  /// format permits, and with DiskImageView otherwise.
+  template <class PixelT>
+  vw::ImageViewRef<PixelT> open_intermediate(std::string const& filename) {
+    boost::shared_ptr<MappedTiffFile> file = MappedTiffFile::open(filename);
+    if (file && has_pixel_layout<PixelT>(*file))
+      return MappedTiffView<PixelT>(file);
+    return vw::DiskImageView<PixelT>(filename);
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_MAPPED_TIFF_H__
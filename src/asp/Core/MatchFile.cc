@@ -0,0 +1,239 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MatchFile.cc
+///
+
+#include <asp/Core/MatchFile.h>
+#include <vw/Core/Exception.h>
+#include <vw/InterestPoint/Matcher.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace asp {
+
+  namespace {
+
+    const char       MATCH_FILE_MAGIC[8]  = {'A', 'S', 'P', 'M', 'A', 'T', 'C', 'H'};
+    const vw::uint32 MATCH_FILE_VERSION   = 1;
+    const vw::uint32 MATCH_FILE_BYTE_ORDER = 0x01020304;
+
+    // All sizes and offsets are in bytes. The header is 64 bytes, with
+    // room for later fields.
+    struct MatchFileHeader {
+      char       magic[8];
+      vw::uint32 version;
+      vw::uint32 byte_order;
+      vw::uint64 num_matches;
+      vw::uint32 descriptor_length;
+      vw::uint32 reserved;
+      vw::uint64 coords_offset;
+      vw::uint64 descriptors_offset; // 0 if there are no descriptors
+      vw::uint64 padding[2];
+    };
+
+    const size_t COORDS_PER_MATCH = 4;
+
+  } // end anonymous namespace
+
+  void write_compact_match_file(std::string const& filename,
+                                std::vector<ip::InterestPoint> const& ip1,
+                                std::vector<ip::InterestPoint> const& ip2,
+                                bool with_descriptors) {
+
+    if (ip1.size() != ip2.size())
+      vw_throw(ArgumentErr() << "Cannot write " << filename
+               << ": the numbers of left and right interest points differ.\n");
+
+    size_t num_matches = ip1.size();
+    size_t descriptor_length = 0;
+    if (with_descriptors && num_matches > 0) {
+      descriptor_length = ip1[0].descriptor.size();
+      for (size_t k = 0; k < num_matches; k++) {
+        if (ip1[k].descriptor.size() != descriptor_length ||
+            ip2[k].descriptor.size() != descriptor_length)
+          vw_throw(ArgumentErr() << "Cannot write " << filename
+                   << ": the descriptors must all have the same length.\n");
+      }
+    }
+
+    MatchFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MATCH_FILE_MAGIC, sizeof(header.magic));
+    header.version            = MATCH_FILE_VERSION;
+    header.byte_order         = MATCH_FILE_BYTE_ORDER;
+    header.num_matches        = num_matches;
+    header.descriptor_length  = descriptor_length;
+    header.coords_offset      = sizeof(header);
+    if (descriptor_length > 0)
+      header.descriptors_offset = header.coords_offset
+        + num_matches*COORDS_PER_MATCH*sizeof(float);
+
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if (!ofs)
+      vw_throw(IOErr() << "Cannot open for writing: " << filename << "\n");
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<float> buf;
+    buf.reserve(COORDS_PER_MATCH*num_matches);
+    for (size_t k = 0; k < num_matches; k++) {
+      buf.push_back(ip1[k].x);
+      buf.push_back(ip1[k].y);
+      buf.push_back(ip2[k].x);
+      buf.push_back(ip2[k].y);
+    }
+    if (!buf.empty())
+      ofs.write(reinterpret_cast<const char*>(&buf[0]), buf.size()*sizeof(float));
+
+    if (descriptor_length > 0) {
+      buf.resize(2*descriptor_length);
+      for (size_t k = 0; k < num_matches; k++) {
+        for (size_t d = 0; d < descriptor_length; d++) {
+          buf[d]                     = ip1[k].descriptor[d];
+          buf[descriptor_length + d] = ip2[k].descriptor[d];
+        }
+        ofs.write(reinterpret_cast<const char*>(&buf[0]), buf.size()*sizeof(float));
+      }
+    }
+
+    if (!ofs)
+      vw_throw(IOErr() << "Failed writing: " << filename << "\n");
+  }
+
+  MappedMatchFile::MappedMatchFile():
+    m_num_matches(0), m_descriptor_length(0), m_coords(NULL), m_descriptors(NULL),
+    m_data(NULL), m_size(0) {}
+
+  MappedMatchFile::~MappedMatchFile() {
+    if (m_data != NULL)
+      munmap(m_data, m_size);
+  }
+
+  boost::shared_ptr<MappedMatchFile> MappedMatchFile::open(std::string const& filename) {
+
+    boost::shared_ptr<MappedMatchFile> file;
+
+    // Check the magic number before mapping anything
+    MatchFileHeader header;
+    {
+      std::ifstream ifs(filename.c_str(), std::ios::binary);
+      if (!ifs)
+        vw_throw(IOErr() << "Cannot open: " << filename << "\n");
+      if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+          std::memcmp(header.magic, MATCH_FILE_MAGIC, sizeof(header.magic)) != 0)
+        return file;
+    }
+    if (header.byte_order != MATCH_FILE_BYTE_ORDER)
+      vw_throw(IOErr() << "The match file " << filename
+               << " was written on a machine with a different byte order.\n");
+    if (header.version != MATCH_FILE_VERSION)
+      vw_throw(IOErr() << "Unsupported version " << header.version
+               << " of the match file " << filename << ".\n");
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      vw_throw(IOErr() << "Cannot open: " << filename << "\n");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      vw_throw(IOErr() << "Cannot read: " << filename << "\n");
+    }
+    boost::shared_ptr<MappedMatchFile> mapped(new MappedMatchFile);
+    mapped->m_size = st.st_size;
+    void * data = mmap(NULL, mapped->m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      vw_throw(IOErr() << "Cannot map in memory: " << filename << "\n");
+    mapped->m_data = static_cast<unsigned char*>(data);
+
+    // The sections must be in the file, and aligned for floats
+    size_t n = header.num_matches, len = header.descriptor_length;
+    bool ok = (header.coords_offset % sizeof(float) == 0 &&
+               header.coords_offset + n*COORDS_PER_MATCH*sizeof(float) <= mapped->m_size);
+    if (len > 0)
+      ok = ok && (header.descriptors_offset % sizeof(float) == 0 &&
+                  header.descriptors_offset + 2*n*len*sizeof(float) <= mapped->m_size);
+    if (!ok)
+      vw_throw(IOErr() << "The match file " << filename << " is truncated.\n");
+
+    mapped->m_num_matches       = n;
+    mapped->m_descriptor_length = len;
+    mapped->m_coords = reinterpret_cast<const float*>(mapped->m_data + header.coords_offset);
+    if (len > 0)
+      mapped->m_descriptors
+        = reinterpret_cast<const float*>(mapped->m_data + header.descriptors_offset);
+
+    return mapped;
+  }
+
+  vw::Vector2 MappedMatchFile::coords(size_t match, int offset) const {
+    const float * p = m_coords + COORDS_PER_MATCH*match + offset;
+    return Vector2(p[0], p[1]);
+  }
+
+  const float* MappedMatchFile::descriptor(size_t match, int side) const {
+    if (m_descriptors == NULL)
+      return NULL;
+    return m_descriptors + (2*match + side)*size_t(m_descriptor_length);
+  }
+
+  void MappedMatchFile::read(size_t begin, size_t end,
+                             std::vector<ip::InterestPoint> & ip1,
+                             std::vector<ip::InterestPoint> & ip2,
+                             bool with_descriptors) const {
+    end = std::min(end, m_num_matches);
+    begin = std::min(begin, end);
+    ip1.resize(end - begin);
+    ip2.resize(end - begin);
+    with_descriptors = with_descriptors && m_descriptor_length > 0;
+    for (size_t k = begin; k < end; k++) {
+      const float * p = m_coords + COORDS_PER_MATCH*k;
+      ip1[k - begin] = ip::InterestPoint(p[0], p[1]);
+      ip2[k - begin] = ip::InterestPoint(p[2], p[3]);
+      if (!with_descriptors)
+        continue;
+      const float * d1 = left_descriptor(k), * d2 = right_descriptor(k);
+      ip1[k - begin].descriptor.set_size(m_descriptor_length);
+      ip2[k - begin].descriptor.set_size(m_descriptor_length);
+      for (int d = 0; d < m_descriptor_length; d++) {
+        ip1[k - begin].descriptor[d] = d1[d];
+        ip2[k - begin].descriptor[d] = d2[d];
+      }
+    }
+  }
+
+  void read_match_file(std::string const& filename,
+                       std::vector<ip::InterestPoint> & ip1,
+                       std::vector<ip::InterestPoint> & ip2,
+                       bool with_descriptors) {
+    boost::shared_ptr<MappedMatchFile> file = MappedMatchFile::open(filename);
+    if (file) {
+      file->read(0, file->num_matches(), ip1, ip2, with_descriptors);
+      return;
+    }
+    ip::read_binary_match_file(filename, ip1, ip2);
+  }
+
+} // namespace asp
@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MatchFile.h
+///
+/// A compact format for match files, which can be mapped in memory
+/// and read in part. A fixed-size header gives the number of matches
+/// and the offset of each section. The coordinates of the matches are
+/// stored as four float32 values each (left x, left y, right x, right
+/// y), and the descriptors, if any, are in a separate section after
+/// them, so reading the coordinates never touches the descriptors.
+/// The values are in the byte order of the machine which wrote the
+/// file, which the header records.
+///
+/// The usual match files of vw::ip, with whole interest point records,
+/// are still read by read_match_file(), which tells the two apart.
+
+#ifndef __ASP_CORE_MATCH_FILE_H__
+#define __ASP_CORE_MATCH_FILE_H__
+
+#include <vw/InterestPoint/InterestData.h>
+#include <vw/Math/Vector.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Write matches in the compact format. The descriptors are written
+  /// if asked for, and then all of them must have the same length.
+  void write_compact_match_file(std::string const& filename,
+                                std::vector<vw::ip::InterestPoint> const& ip1,
+                                std::vector<vw::ip::InterestPoint> const& ip2,
+                                bool with_descriptors = false);
+
+  /// A match file in the compact format, mapped in memory
+  class MappedMatchFile: private boost::noncopyable {
+  public:
+    /// Map the file if it is in the compact format. Return a null
+    /// pointer otherwise. Throw if it is in that format but damaged.
+    static boost::shared_ptr<MappedMatchFile> open(std::string const& filename);
+
+    ~MappedMatchFile();
+
+    size_t num_matches() const { return m_num_matches; }
+
+    /// The number of values in each descriptor, or 0 if there are none
+    int descriptor_length() const { return m_descriptor_length; }
+
+    vw::Vector2 left (size_t match) const { return coords(match, 0); }
+    vw::Vector2 right(size_t match) const { return coords(match, 2); }
+
+    /// The descriptors of a match, if the file has any
+    const float* left_descriptor (size_t match) const { return descriptor(match, 0); }
+    const float* right_descriptor(size_t match) const { return descriptor(match, 1); }
+
+    /// Make interest points of the matches in [begin, end)
+    void read(size_t begin, size_t end,
+              std::vector<vw::ip::InterestPoint> & ip1,
+              std::vector<vw::ip::InterestPoint> & ip2,
+              bool with_descriptors = true) const;
+
+  private:
+    MappedMatchFile();
+
+    vw::Vector2  coords    (size_t match, int offset) const;
+    const float* descriptor(size_t match, int side) const;
+
+    size_t          m_num_matches;
+    int             m_descriptor_length;
+    const float   * m_coords;
+    const float   * m_descriptors;
+    unsigned char * m_data;
+    size_t          m_size;
+  };
+
+  /// Read a match file in the compact format or in that of vw::ip. Only
+  /// the compact format can skip reading the descriptors.
+  void read_match_file(std::string const& filename,
+                       std::vector<vw::ip::InterestPoint> & ip1,
+                       std::vector<vw::ip::InterestPoint> & ip2,
+                       bool with_descriptors = true);
+
+} // namespace asp
+
+#endif // __ASP_CORE_MATCH_FILE_H__
@@ -18,10 +18,11 @@
 
 #include <asp/Core/MedianFilter.h>
 #include <vw/Math/Vector.h>
+#include <vector>
 
 using namespace vw;
 
-uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
+uint8 vw::find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
                                int kernSize) {
   int acc = 0;
   int acc_limit = kernSize * kernSize / 2;
@@ -39,3 +40,153 @@ uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
 
   return i;
 }
+
+namespace {
+
+  // The 8-bit histograms have 256 fine bins and 16 coarse ones.
+  const int NUM_FINE = 256, NUM_COARSE = 16, COARSE_SHIFT = 4;
+
+  // Add the 'add' histogram to 'hist' and subtract 'sub', if not NULL.
+  // The fixed-length loops are meant to be vectorized by the compiler.
+  template <int N>
+  inline void update_histogram(uint16 * hist, uint16 const* add, uint16 const* sub) {
+    if (sub == NULL) {
+      for (int b = 0; b < N; b++)
+        hist[b] += add[b];
+    }else{
+      for (int b = 0; b < N; b++)
+        hist[b] += add[b] - sub[b];
+    }
+  }
+
+  void check_median_sizes(int in_cols, int in_rows, int radius) {
+    if (radius < 0 || radius > asp::MAX_MEDIAN_FILTER_RADIUS)
+      vw_throw( ArgumentErr() << "The median filter radius must be between 0 and "
+                << asp::MAX_MEDIAN_FILTER_RADIUS << ".\n" );
+    if (in_cols < 2*radius + 1 || in_rows < 2*radius + 1)
+      vw_throw( ArgumentErr() << "The median filter input must be larger than the kernel.\n" );
+  }
+
+}
+
+void asp::constant_time_median_filter(ImageView<uint8> const& input, int radius,
+                                      ImageView<uint8> & output) {
+
+  check_median_sizes(input.cols(), input.rows(), radius);
+  int kern    = 2*radius + 1;
+  int in_cols = input.cols();
+  int cols    = in_cols - 2*radius, rows = input.rows() - 2*radius;
+  int rank    = kern*kern/2; // the median is the value with this many below it
+  output.set_size(cols, rows);
+
+  // One fine and one coarse histogram per input column, over the
+  // kernel's rows. They are moved down one row at a time.
+  std::vector<uint16> col_fine(in_cols*NUM_FINE, 0), col_coarse(in_cols*NUM_COARSE, 0);
+  for (int row = 0; row < kern - 1; row++) {
+    for (int col = 0; col < in_cols; col++) {
+      uint8 v = input(col, row);
+      col_fine  [col*NUM_FINE   + v]++;
+      col_coarse[col*NUM_COARSE + (v >> COARSE_SHIFT)]++;
+    }
+  }
+
+  std::vector<uint16> fine(NUM_FINE), coarse(NUM_COARSE);
+  for (int row = 0; row < rows; row++) {
+
+    // Add the kernel's new bottom row and drop the old top row
+    for (int col = 0; col < in_cols; col++) {
+      uint8 v = input(col, row + kern - 1);
+      col_fine  [col*NUM_FINE   + v]++;
+      col_coarse[col*NUM_COARSE + (v >> COARSE_SHIFT)]++;
+      if (row > 0) {
+        v = input(col, row - 1);
+        col_fine  [col*NUM_FINE   + v]--;
+        col_coarse[col*NUM_COARSE + (v >> COARSE_SHIFT)]--;
+      }
+    }
+
+    // The kernel histogram for the first pixel of the row
+    std::fill(fine.begin(),   fine.end(),   0);
+    std::fill(coarse.begin(), coarse.end(), 0);
+    for (int col = 0; col < kern - 1; col++) {
+      update_histogram<NUM_FINE>  (&fine[0],   &col_fine  [col*NUM_FINE],   NULL);
+      update_histogram<NUM_COARSE>(&coarse[0], &col_coarse[col*NUM_COARSE], NULL);
+    }
+
+    for (int col = 0; col < cols; col++) {
+
+      // Slide right by one column
+      int add = col + kern - 1;
+      uint16 const* sub_fine   = (col > 0) ? &col_fine  [(col - 1)*NUM_FINE]   : NULL;
+      uint16 const* sub_coarse = (col > 0) ? &col_coarse[(col - 1)*NUM_COARSE] : NULL;
+      update_histogram<NUM_FINE>  (&fine[0],   &col_fine  [add*NUM_FINE],   sub_fine);
+      update_histogram<NUM_COARSE>(&coarse[0], &col_coarse[add*NUM_COARSE], sub_coarse);
+
+      // Find the coarse bin with the median, then the value within it
+      int count = 0, c = 0;
+      while (count + coarse[c] <= rank)
+        count += coarse[c++];
+      int b = c << COARSE_SHIFT;
+      while (count + fine[b] <= rank)
+        count += fine[b++];
+      output(col, row) = b;
+    }
+  }
+}
+
+void asp::constant_time_median_filter(ImageView<uint16> const& input, int radius,
+                                      ImageView<uint16> & output) {
+
+  check_median_sizes(input.cols(), input.rows(), radius);
+  int kern = 2*radius + 1;
+  int cols = input.cols() - 2*radius, rows = input.rows() - 2*radius;
+  int rank = kern*kern/2;
+  output.set_size(cols, rows);
+
+  // A histogram of all 65536 values and one of their high bytes. A
+  // constant-time version would need one such histogram per column,
+  // which is too much memory, so this one slides along each row.
+  std::vector<int> fine(65536, 0), coarse(256, 0);
+  for (int row = 0; row < rows; row++) {
+
+    for (int col = 0; col < kern - 1; col++) {
+      for (int k = 0; k < kern; k++) {
+        uint16 v = input(col, row + k);
+        fine[v]++;
+        coarse[v >> 8]++;
+      }
+    }
+
+    for (int col = 0; col < cols; col++) {
+      for (int k = 0; k < kern; k++) {
+        uint16 v = input(col + kern - 1, row + k);
+        fine[v]++;
+        coarse[v >> 8]++;
+      }
+      if (col > 0) {
+        for (int k = 0; k < kern; k++) {
+          uint16 v = input(col - 1, row + k);
+          fine[v]--;
+          coarse[v >> 8]--;
+        }
+      }
+
+      int count = 0, c = 0;
+      while (count + coarse[c] <= rank)
+        count += coarse[c++];
+      int b = c << 8;
+      while (count + fine[b] <= rank)
+        count += fine[b++];
+      output(col, row) = b;
+    }
+
+    // Empty the histograms for the next row
+    for (int col = cols - 1; col < cols + kern - 1; col++) {
+      for (int k = 0; k < kern; k++) {
+        uint16 v = input(col, row + k);
+        fine[v]--;
+        coarse[v >> 8]--;
+      }
+    }
+  }
+}
@@ -18,12 +18,18 @@
 
 /// \file MedianFilter.h
 ///
+/// Median filters for single-channel images. The ConstantTimeMedianView
+/// is tiled, so it streams and can be written with several threads,
+/// and for 8-bit images its cost per pixel does not depend on the
+/// kernel size (Perreault and Hebert, "Median filtering in constant
+/// time", IEEE Trans. Image Processing, 2007).
 
 #ifndef __MEDIAN_FILTER_H__
 #define __MEDIAN_FILTER_H__
 
 #define CALC_PIXEL_NUM_VALS 256
 
+#include <vw/Core/Exception.h>
 #include <vw/Core/Functors.h>
 #include <vw/Core/FundamentalTypes.h>
 #include <vw/Math/Vector.h>
@@ -31,6 +37,9 @@
 #include <vw/Image/ImageView.h>
 #include <vw/Image/EdgeExtension.h>
 #include <vw/Image/PerPixelAccessorViews.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Manipulation.h>
+#include <boost/static_assert.hpp>
 
 namespace vw {
 
@@ -142,4 +151,93 @@ namespace vw {
 
 }
 
+namespace asp {
+
+  /// The largest radius of ConstantTimeMedianView, so that the
+  /// counts in a kernel fit in 16 bits.
+  const int MAX_MEDIAN_FILTER_RADIUS = 127;
+
+  /// Median of each (2*radius+1) x (2*radius+1) window of the input.
+  /// The input must be larger than the output by radius on each side.
+  /// The 8-bit version keeps a histogram per column and is constant
+  /// time per pixel. The 16-bit version slides a two-level histogram
+  /// along each row, and its cost per pixel grows with the radius.
+  void constant_time_median_filter(vw::ImageView<vw::uint8>  const& input, int radius,
+                                   vw::ImageView<vw::uint8>  & output);
+  void constant_time_median_filter(vw::ImageView<vw::uint16> const& input, int radius,
+                                   vw::ImageView<vw::uint16> & output);
+
+  /// A median-filtered view of a single-channel image with uint8 or
+  /// uint16 channels. The edge pixels are repeated beyond the image.
+  template <class ImageT>
+  class ConstantTimeMedianView: public vw::ImageViewBase<ConstantTimeMedianView<ImageT> > {
+    ImageT m_image;
+    int    m_radius;
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type result_type;
+    typedef typename vw::PixelChannelType<pixel_type>::type channel_type;
+    typedef vw::ProceduralPixelAccessor<ConstantTimeMedianView> pixel_accessor;
+
+    BOOST_STATIC_ASSERT(vw::PixelNumChannels<pixel_type>::value == 1);
+
+    ConstantTimeMedianView(ImageT const& image, int radius):
+      m_image(image), m_radius(radius){
+      if (radius < 0 || radius > MAX_MEDIAN_FILTER_RADIUS)
+        vw::vw_throw( vw::ArgumentErr() << "The median filter radius must be between 0 and "
+                      << MAX_MEDIAN_FILTER_RADIUS << ".\n" );
+    }
+
+    inline vw::int32 cols  () const { return m_image.cols(); }
+    inline vw::int32 rows  () const { return m_image.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()( double/*i*/, double/*j*/, vw::int32/*p*/ = 0 ) const {
+      vw::vw_throw(vw::NoImplErr() << "ConstantTimeMedianView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      // Read the tile with a margin, repeating the edge pixels
+      vw::BBox2i big_box = bbox;
+      big_box.expand(m_radius);
+      vw::ImageView<pixel_type> region
+        = vw::crop(vw::edge_extend(m_image, vw::ConstantEdgeExtension()), big_box);
+      vw::ImageView<channel_type> input(region.cols(), region.rows());
+      for (int row = 0; row < region.rows(); row++)
+        for (int col = 0; col < region.cols(); col++)
+          input(col, row) = vw::compound_select_channel<channel_type const&>(region(col, row), 0);
+
+      vw::ImageView<channel_type> filtered;
+      constant_time_median_filter(input, m_radius, filtered);
+
+      vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          tile(col, row) = pixel_type(filtered(col, row));
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Median-filter an image with a square kernel of odd size.
+  template <class ImageT>
+  ConstantTimeMedianView<ImageT>
+  median_filter_view(vw::ImageViewBase<ImageT> const& image, int kernel_size) {
+    if (kernel_size < 1 || kernel_size % 2 == 0)
+      vw::vw_throw( vw::ArgumentErr() << "The median filter size must be odd and positive.\n" );
+    return ConstantTimeMedianView<ImageT>(image.impl(), kernel_size/2);
+  }
+
+} // end namespace asp
+
 #endif // __MEDIAN_FILTER_H__
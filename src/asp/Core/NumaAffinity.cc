@@ -0,0 +1,168 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file NumaAffinity.cc
+///
+
+#include <asp/Core/NumaAffinity.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace vw;
+
+namespace {
+
+  enum NumaMode { NUMA_NONE, NUMA_SPREAD, NUMA_COMPACT };
+
+  vw::Mutex g_numa_mutex;
+  NumaMode  g_numa_mode = NUMA_NONE;
+  int       g_num_pinned = 0; // Threads pinned so far
+  std::vector<std::vector<int> > g_node_cpus;
+
+#ifdef __linux__
+  __thread bool g_thread_pinned = false;
+#endif
+}
+
+namespace asp {
+
+  std::vector<int> parse_cpu_list(std::string const& list) {
+    std::vector<int> cpus;
+    std::vector<std::string> ranges;
+    std::string trimmed = boost::algorithm::trim_copy(list);
+    if (trimmed.empty())
+      return cpus;
+    boost::algorithm::split(ranges, trimmed, boost::algorithm::is_any_of(","));
+    for (size_t k = 0; k < ranges.size(); k++) {
+      std::vector<std::string> ends;
+      boost::algorithm::split(ends, ranges[k], boost::algorithm::is_any_of("-"));
+      try {
+        int first = boost::lexical_cast<int>(boost::algorithm::trim_copy(ends[0]));
+        int last  = first;
+        if (ends.size() == 2)
+          last = boost::lexical_cast<int>(boost::algorithm::trim_copy(ends[1]));
+        if (ends.size() > 2 || first < 0 || last < first)
+          vw_throw( ArgumentErr() << "Invalid CPU list: " << list << "\n" );
+        for (int cpu = first; cpu <= last; cpu++)
+          cpus.push_back(cpu);
+      } catch (boost::bad_lexical_cast const&) {
+        vw_throw( ArgumentErr() << "Invalid CPU list: " << list << "\n" );
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<std::vector<int> > numa_node_cpus() {
+    std::vector<std::vector<int> > node_cpus;
+    // The nodes are numbered from 0, with no gaps on the machines we know
+    for (int node = 0; ; node++) {
+      std::ostringstream os;
+      os << "/sys/devices/system/node/node" << node << "/cpulist";
+      std::ifstream ifs(os.str().c_str());
+      std::string line;
+      if (!ifs || !std::getline(ifs, line))
+        break;
+      std::vector<int> cpus = parse_cpu_list(line);
+      if (!cpus.empty()) // a node with memory only
+        node_cpus.push_back(cpus);
+    }
+    return node_cpus;
+  }
+
+  void set_numa_affinity(std::string const& mode_in) {
+    std::string mode = boost::algorithm::to_lower_copy(mode_in);
+    NumaMode numa_mode;
+    if (mode == "none")
+      numa_mode = NUMA_NONE;
+    else if (mode == "spread")
+      numa_mode = NUMA_SPREAD;
+    else if (mode == "compact")
+      numa_mode = NUMA_COMPACT;
+    else
+      vw_throw( ArgumentErr() << "Unknown NUMA affinity: " << mode_in
+                << ". Use one of: none, spread, compact.\n" );
+
+    vw::Mutex::Lock lock(g_numa_mutex);
+    g_numa_mode = NUMA_NONE;
+    if (numa_mode == NUMA_NONE)
+      return;
+
+#ifdef __linux__
+    g_node_cpus = numa_node_cpus();
+    if (g_node_cpus.size() < 2) {
+      vw_out() << "Found fewer than two NUMA nodes, so the threads will not be pinned.\n";
+      return;
+    }
+    g_numa_mode  = numa_mode;
+    g_num_pinned = 0;
+    vw_out() << "Pinning the processing threads to " << g_node_cpus.size()
+             << " NUMA nodes (" << mode << ").\n";
+#else
+    vw_out(WarningMessage) << "Pinning threads to NUMA nodes is supported only on Linux.\n";
+#endif
+  }
+
+  void numa_bind_current_thread() {
+#ifdef __linux__
+    if (g_numa_mode == NUMA_NONE || g_thread_pinned)
+      return;
+    g_thread_pinned = true;
+
+    std::vector<int> cpus;
+    {
+      vw::Mutex::Lock lock(g_numa_mutex);
+      int index = g_num_pinned++;
+      int node = 0;
+      if (g_numa_mode == NUMA_SPREAD) {
+        node = index % g_node_cpus.size();
+      } else {
+        // Fill the nodes in turn, starting over once all CPUs have a thread
+        int num_cpus = 0;
+        for (size_t k = 0; k < g_node_cpus.size(); k++)
+          num_cpus += g_node_cpus[k].size();
+        int pos = index % num_cpus;
+        while (pos >= int(g_node_cpus[node].size())) {
+          pos -= g_node_cpus[node].size();
+          node++;
+        }
+      }
+      cpus = g_node_cpus[node];
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (size_t k = 0; k < cpus.size(); k++) {
+      if (cpus[k] < CPU_SETSIZE)
+        CPU_SET(cpus[k], &cpu_set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+      vw_out(DebugMessage, "asp") << "Could not pin a thread to a NUMA node.\n";
+#endif
+  }
+
+} // namespace asp
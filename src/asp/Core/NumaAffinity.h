@@ -0,0 +1,55 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file NumaAffinity.h
+///
+/// Pin the threads which process tiles to the NUMA nodes (sockets) of
+/// the machine. A thread is pinned the first time it starts on a tile,
+/// to all the CPUs of one node, and stays there. The buffers of the
+/// tiles which it then allocates are first touched, so placed, in the
+/// memory of that node, and the threads of a node share its caches.
+
+#ifndef __ASP_CORE_NUMA_AFFINITY_H__
+#define __ASP_CORE_NUMA_AFFINITY_H__
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Set how threads are given to the NUMA nodes. With "spread" the
+  /// k-th thread to be pinned goes to node k modulo the number of
+  /// nodes. With "compact" each node gets as many threads as it has
+  /// CPUs before the next one gets any. With "none", the default,
+  /// threads are not pinned. Only on Linux.
+  void set_numa_affinity(std::string const& mode);
+
+  /// Pin the calling thread according to the mode, unless it was
+  /// pinned before. This is cheap after the first call in a thread.
+  void numa_bind_current_thread();
+
+  /// The CPUs of each NUMA node. Empty if they cannot be found.
+  std::vector<std::vector<int> > numa_node_cpus();
+
+  /// Parse a list of CPUs such as "0-3,8,10-11", as in
+  /// /sys/devices/system/node/node0/cpulist.
+  std::vector<int> parse_cpu_list(std::string const& list);
+
+} // namespace asp
+
+#endif // __ASP_CORE_NUMA_AFFINITY_H__
@@ -0,0 +1,423 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ObjectStorage.cc
+///
+
+#include <asp/Core/ObjectStorage.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/config.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <cpl_conv.h>
+#include <cpl_error.h>
+#include <cpl_vsi.h>
+#endif
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // A lock file not touched for this long is left from a process
+  // which died while fetching
+  const int STALE_LOCK_SECONDS = 600;
+
+  // The size of the ranges fetched and uploaded at a time
+  const int64 TRANSFER_BLOCK_SIZE = 16*1024*1024;
+
+  uint64 string_hash(std::string const& str) {
+    // 64-bit FNV-1a
+    const uint64 FNV_OFFSET = 14695981039346656037ULL, FNV_PRIME = 1099511628211ULL;
+    uint64 hash = FNV_OFFSET;
+    for (size_t i = 0; i < str.size(); i++) {
+      hash ^= uint64(static_cast<unsigned char>(str[i]));
+      hash *= FNV_PRIME;
+    }
+    return hash;
+  }
+
+  /// The name of an object past its prefix, such as bucket/key
+  std::string object_path_part(std::string const& name) {
+    std::string vsi = remote_object_vsi_path(name);
+    if (boost::starts_with(vsi, "/vsis3/"))
+      return vsi.substr(7);
+    if (boost::starts_with(vsi, "/vsicurl/"))
+      return vsi.substr(9);
+    return vsi;
+  }
+
+  /// If GDAL can read the image in place, fetching only the tiles it needs
+  bool is_ranged_read_image(std::string const& name) {
+    std::string ext = boost::to_lower_copy(fs::path(object_path_part(name)).extension().string());
+    return ext == ".tif" || ext == ".tiff" || ext == ".ntf" || ext == ".jp2";
+  }
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+
+  void set_default_config_option(const char * key, const char * value) {
+    if (CPLGetConfigOption(key, NULL) == NULL)
+      CPLSetConfigOption(key, value);
+  }
+
+  /// Read objects in chunks of the size of a few tiles, several ranges
+  /// per request, kept in memory once fetched, and do not list the
+  /// bucket to look for side files. The user's settings take precedence.
+  void set_remote_read_options() {
+    static bool done = false;
+    if (done)
+      return;
+    set_default_config_option("CPL_VSIL_CURL_CHUNK_SIZE",          "1048576");
+    set_default_config_option("CPL_VSIL_CURL_CACHE_SIZE",          "536870912");
+    set_default_config_option("VSI_CACHE",                         "TRUE");
+    set_default_config_option("GDAL_HTTP_MULTIRANGE",              "PARALLEL");
+    set_default_config_option("GDAL_HTTP_MERGE_CONSECUTIVE_RANGES", "YES");
+    set_default_config_option("GDAL_DISABLE_READDIR_ON_OPEN",      "EMPTY_DIR");
+    set_default_config_option("GDAL_HTTP_MAX_RETRY",               "5");
+    set_default_config_option("GDAL_HTTP_RETRY_DELAY",             "1");
+    done = true;
+  }
+
+  bool stat_object(std::string const& name, int64 & size, std::time_t & mtime) {
+    set_remote_read_options();
+    VSIStatBufL buf;
+    if (VSIStatExL(remote_object_vsi_path(name).c_str(), &buf,
+                   VSI_STAT_EXISTS_FLAG | VSI_STAT_SIZE_FLAG) != 0)
+      return false;
+    size  = buf.st_size;
+    mtime = buf.st_mtime;
+    return true;
+  }
+
+  /// What the fetching tasks share
+  struct FetchState {
+    std::string vsi_path, lock_file;
+    int fd;
+    int64 size;
+    Mutex mutex;             ///< Guards the members below
+    int64 bytes_done;
+    std::string error;
+    TerminalProgressCallback tpc;
+    FetchState(): fd(-1), size(0), bytes_done(0), tpc("asp", "\t--> Fetching: ") {}
+  };
+
+  /// Fetch a range of blocks of the object, with a handle of its own,
+  /// and write them at their place in the local file
+  class FetchBlocksTask: public Task, private boost::noncopyable {
+    FetchState & m_state;
+    int64 m_beg, m_end;
+  public:
+    FetchBlocksTask(FetchState & state, int64 beg, int64 end):
+      m_state(state), m_beg(beg), m_end(end) {}
+
+    void operator()() {
+      if (m_beg >= m_end)
+        return;
+
+      VSILFILE * in = VSIFOpenL(m_state.vsi_path.c_str(), "rb");
+      if (in == NULL) {
+        Mutex::Lock lock(m_state.mutex);
+        m_state.error = "Could not open: " + m_state.vsi_path;
+        return;
+      }
+
+      std::vector<char> buf;
+      for (int64 pos = m_beg; pos < m_end; pos += TRANSFER_BLOCK_SIZE) {
+        size_t len = size_t(std::min(TRANSFER_BLOCK_SIZE, m_end - pos));
+        buf.resize(len);
+        bool ok = (VSIFSeekL(in, vsi_l_offset(pos), SEEK_SET) == 0 &&
+                   VSIFReadL(&buf[0], 1, len, in) == len);
+        size_t written = 0;
+        while (ok && written < len) {
+          ssize_t n = ::pwrite(m_state.fd, &buf[written], len - written, pos + written);
+          if (n <= 0)
+            ok = false;
+          else
+            written += n;
+        }
+
+        Mutex::Lock lock(m_state.mutex);
+        if (!m_state.error.empty())
+          break;
+        if (!ok) {
+          std::ostringstream os;
+          os << "Failed to fetch bytes " << pos << " to " << pos + len << " of "
+             << m_state.vsi_path << ": " << CPLGetLastErrorMsg();
+          m_state.error = os.str();
+          break;
+        }
+
+        // Let the processes waiting for this object know that it is progressing
+        boost::system::error_code ec;
+        fs::last_write_time(m_state.lock_file, std::time(NULL), ec);
+
+        m_state.bytes_done += len;
+        m_state.tpc.report_fractional_progress(m_state.bytes_done, m_state.size);
+      }
+
+      VSIFCloseL(in);
+    }
+  };
+
+  /// Fetch the object into the given file, with the given number of threads
+  void fetch_object(std::string const& name, int64 size, std::string const& out_file,
+                    std::string const& lock_file, int num_threads) {
+
+    FetchState state;
+    state.vsi_path  = remote_object_vsi_path(name);
+    state.lock_file = lock_file;
+    state.size      = size;
+    state.fd = ::open(out_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (state.fd < 0)
+      vw_throw( IOErr() << "Could not create: " << out_file << "\n" );
+    if (size > 0 && ::ftruncate(state.fd, size) != 0) {
+      ::close(state.fd);
+      vw_throw( IOErr() << "Could not allocate " << size << " bytes for: " << out_file << "\n" );
+    }
+
+    // Each thread gets a contiguous range of whole blocks
+    int64 num_blocks = (size + TRANSFER_BLOCK_SIZE - 1)/TRANSFER_BLOCK_SIZE;
+    int num_tasks = int(std::max(int64(1), std::min(int64(num_threads), num_blocks)));
+
+    vw_out() << "Fetching " << name << " to " << out_file << " with "
+             << num_tasks << " threads.\n";
+    FifoWorkQueue queue(num_tasks);
+    for (int t = 0; t < num_tasks; t++) {
+      int64 beg = TRANSFER_BLOCK_SIZE*(num_blocks*t/num_tasks);
+      int64 end = std::min(size, TRANSFER_BLOCK_SIZE*(num_blocks*(t+1)/num_tasks));
+      boost::shared_ptr<FetchBlocksTask> task(new FetchBlocksTask(state, beg, end));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    state.tpc.report_finished();
+
+    ::close(state.fd);
+    if (!state.error.empty())
+      vw_throw( IOErr() << state.error << "\n" );
+  }
+
+#endif
+
+  /// The directory to keep local copies in
+  std::string local_dir(std::string const& cache_dir) {
+    if (!cache_dir.empty())
+      return cache_dir;
+    return (fs::temp_directory_path() / "asp-objects").string();
+  }
+
+} // end anonymous namespace
+
+bool is_remote_object(std::string const& name) {
+  return boost::starts_with(name, "s3://")   || boost::starts_with(name, "http://")  ||
+         boost::starts_with(name, "https://") || boost::starts_with(name, "/vsis3/") ||
+         boost::starts_with(name, "/vsicurl/");
+}
+
+std::string remote_object_vsi_path(std::string const& name) {
+  if (boost::starts_with(name, "s3://"))
+    return "/vsis3/" + name.substr(5);
+  if (boost::starts_with(name, "http://") || boost::starts_with(name, "https://"))
+    return "/vsicurl/" + name;
+  return name;
+}
+
+std::string object_cache_file(std::string const& name, std::string const& cache_dir) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  int64 size = 0;
+  std::time_t mtime = 0;
+  if (!stat_object(name, size, mtime))
+    vw_throw( IOErr() << "Cannot find: " << name << "\n" );
+  std::ostringstream key;
+  key << remote_object_vsi_path(name) << " " << size << " " << mtime;
+
+  // Keep the extension, which the readers go by
+  fs::path path(object_path_part(name));
+  std::ostringstream os;
+  os << path.stem().string() << "-" << std::hex << std::setw(16) << std::setfill('0')
+     << string_hash(key.str()) << path.extension().string();
+  return (fs::path(local_dir(cache_dir)) / os.str()).string();
+#else
+  vw_throw( NoImplErr() << "Reading from object storage needs GDAL.\n" );
+  return "";
+#endif
+}
+
+bool object_exists(std::string const& name) {
+  if (!is_remote_object(name))
+    return fs::exists(name);
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  int64 size = 0;
+  std::time_t mtime = 0;
+  return stat_object(name, size, mtime);
+#else
+  return false;
+#endif
+}
+
+std::string object_read_path(std::string const& name, std::string const& cache_dir,
+                             int num_threads) {
+  if (!is_remote_object(name))
+    return name;
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  set_remote_read_options();
+  if (cache_dir.empty() && is_ranged_read_image(name))
+    return remote_object_vsi_path(name);
+
+  int64 size = 0;
+  std::time_t mtime = 0;
+  if (!stat_object(name, size, mtime))
+    vw_throw( IOErr() << "Cannot find: " << name << "\n" );
+
+  fs::create_directories(local_dir(cache_dir));
+  std::string cache_file = object_cache_file(name, cache_dir);
+  std::string lock_file  = cache_file + ".lock";
+
+  // Wait for any other process fetching this object, and take over
+  // its lock if it died.
+  bool announced = false;
+  while (!fs::exists(cache_file)) {
+    int fd = ::open(lock_file.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd >= 0) {
+      ::close(fd);
+      break;
+    }
+    boost::system::error_code ec;
+    std::time_t touched = fs::last_write_time(lock_file, ec);
+    if (!ec && std::time(NULL) - touched > STALE_LOCK_SECONDS) {
+      fs::remove(lock_file, ec);
+      continue;
+    }
+    if (!announced)
+      vw_out() << "Waiting for another process to fetch " << name << ".\n";
+    announced = true;
+    ::sleep(1);
+  }
+
+  if (fs::exists(cache_file)) {
+    boost::system::error_code ec;
+    fs::remove(lock_file, ec);
+    vw_out() << "Using the local copy of " << name << ": " << cache_file << "\n";
+    return cache_file;
+  }
+
+  // Write under a temporary name, then rename
+  std::ostringstream tmp_name;
+  tmp_name << cache_file << ".tmp" << ::getpid();
+  try {
+    fetch_object(name, size, tmp_name.str(), lock_file, std::max(1, num_threads));
+    fs::rename(tmp_name.str(), cache_file);
+  } catch (...) {
+    boost::system::error_code ec;
+    fs::remove(tmp_name.str(), ec);
+    fs::remove(lock_file, ec);
+    throw;
+  }
+  boost::system::error_code ec;
+  fs::remove(lock_file, ec);
+  return cache_file;
+#else
+  vw_throw( NoImplErr() << "Reading " << name << " from object storage needs GDAL.\n" );
+  return name;
+#endif
+}
+
+std::string object_write_path(std::string const& name, std::string const& cache_dir) {
+  if (!is_remote_object(name))
+    return name;
+
+  fs::path path(object_path_part(name));
+  std::ostringstream os;
+  os << path.stem().string() << "-out" << ::getpid() << path.extension().string();
+  fs::create_directories(local_dir(cache_dir));
+  return (fs::path(local_dir(cache_dir)) / os.str()).string();
+}
+
+void upload_object(std::string const& local_file, std::string const& name) {
+  if (!is_remote_object(name))
+    return;
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  std::string vsi_path = remote_object_vsi_path(name);
+  if (!boost::starts_with(vsi_path, "/vsis3/"))
+    vw_throw( ArgumentErr() << "Cannot write to: " << name
+              << ". Only outputs to S3 are supported.\n" );
+
+  int fd = ::open(local_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    vw_throw( IOErr() << "Could not open: " << local_file << "\n" );
+
+  // GDAL sends a sequentially written S3 object in parts, as they fill
+  VSILFILE * out = VSIFOpenL(vsi_path.c_str(), "wb");
+  if (out == NULL) {
+    ::close(fd);
+    vw_throw( IOErr() << "Could not create: " << name << ": " << CPLGetLastErrorMsg() << "\n" );
+  }
+
+  int64 size = fs::file_size(local_file);
+  vw_out() << "Uploading " << local_file << " to " << name << ".\n";
+  TerminalProgressCallback tpc("asp", "\t--> Uploading: ");
+  std::vector<char> buf(TRANSFER_BLOCK_SIZE);
+  int64 done = 0;
+  bool ok = true;
+  while (ok) {
+    ssize_t n = ::read(fd, &buf[0], buf.size());
+    if (n < 0)
+      ok = false;
+    if (n <= 0)
+      break;
+    ok = (VSIFWriteL(&buf[0], 1, n, out) == size_t(n));
+    done += n;
+    tpc.report_fractional_progress(done, std::max(int64(1), size));
+  }
+  tpc.report_finished();
+  ::close(fd);
+
+  // The upload is completed when the file is closed
+  if (VSIFCloseL(out) != 0)
+    ok = false;
+  if (!ok)
+    vw_throw( IOErr() << "Failed to upload " << local_file << " to " << name << ": "
+              << CPLGetLastErrorMsg() << "\n" );
+
+  boost::system::error_code ec;
+  fs::remove(local_file, ec);
+#else
+  vw_throw( NoImplErr() << "Writing " << name << " to object storage needs GDAL.\n" );
+#endif
+}
+
+} // namespace asp
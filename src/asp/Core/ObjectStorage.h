@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ObjectStorage.h
+///
+/// Read inputs from, and write outputs to, object storage, such as S3
+/// or a web server, without staging them on a shared filesystem first.
+/// An object is named as s3://bucket/key, http(s)://host/path, or with
+/// the GDAL virtual file prefixes /vsis3/ and /vsicurl/, and is
+/// accessed through the GDAL virtual file layer, which takes the S3
+/// credentials and endpoint from the usual AWS_* variables.
+///
+/// Images GDAL reads are opened in place, with the tiles fetched by
+/// ranged requests, several in parallel, and kept in the GDAL chunk
+/// cache. Other files, such as cameras, and ISIS cubes, are fetched
+/// into a local copy. With a cache directory, such as on a local SSD,
+/// images are fetched into it as well, a range of blocks per thread,
+/// and the copy is shared by the processes of the node and kept for
+/// the next run. A copy is named after a hash of the object name, size
+/// and modification time, so a changed object is fetched again.
+///
+/// An output is written to a local file, then uploaded, which for S3
+/// is done in parts.
+
+#ifndef __ASP_CORE_OBJECT_STORAGE_H__
+#define __ASP_CORE_OBJECT_STORAGE_H__
+
+#include <string>
+
+namespace asp {
+
+  /// If the name is that of an object in object storage rather than a file
+  bool is_remote_object(std::string const& name);
+
+  /// The GDAL virtual file name of an object, such as /vsis3/bucket/key
+  /// for s3://bucket/key. Other names are returned as they are.
+  std::string remote_object_vsi_path(std::string const& name);
+
+  /// The file in the cache directory where the object would be fetched
+  std::string object_cache_file(std::string const& name, std::string const& cache_dir);
+
+  /// If the file or object exists
+  bool object_exists(std::string const& name);
+
+  /// The name to read an input by. A file is returned as it is. An
+  /// image in object storage which GDAL can read is returned as its
+  /// GDAL virtual file name, unless a cache directory is given, and
+  /// then it is fetched there with the given number of threads, as are
+  /// all other objects. Without a cache directory, those are fetched
+  /// to the temporary directory.
+  std::string object_read_path(std::string const& name, std::string const& cache_dir,
+                               int num_threads);
+
+  /// The local file to write an output to. A file is returned as it is.
+  /// For an object, this is a file in the cache directory, or in the
+  /// temporary directory if that is empty, to be passed to
+  /// upload_object() when written.
+  std::string object_write_path(std::string const& name, std::string const& cache_dir);
+
+  /// Upload the local file as the given object, and remove the file.
+  /// Does nothing if the name is not that of an object.
+  void upload_object(std::string const& local_file, std::string const& name);
+
+} // namespace asp
+
+#endif // __ASP_CORE_OBJECT_STORAGE_H__
@@ -36,9 +36,12 @@
 
 #include <asp/Core/SoftwareRenderer.h>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
-#include <valarray>
+#include <asp/Core/NumaAffinity.h>
+#include <asp/Core/Telemetry.h>
+#include <algorithm>
 
 namespace asp{
 
@@ -51,6 +54,17 @@ namespace asp{
     }
   };
 
+  // Make the cells of the filtered points cache
+  struct FilteredPointBlock {
+    OrthoRasterizerView const& m_view;
+    FilteredPointBlock(OrthoRasterizerView const& view): m_view(view) {}
+    ImageView<Vector3> operator()(BBox2i const& cell) const {
+      BBox2i block = cell;
+      block.crop(vw::bounding_box(m_view.m_point_image));
+      return m_view.filtered_points(block);
+    }
+  };
+
   void dump_image(std::string const& prefix, BBox2i const& box,
 		  ImageViewRef<Vector3> const& I){
 
@@ -77,6 +91,157 @@ namespace asp{
     of.close();
   }
 
+  // Sort the given items by the center of their boxes along the given axis.
+  struct CompareBoxCenters {
+    std::vector<BBox3> const& m_boxes;
+    int m_axis;
+    CompareBoxCenters(std::vector<BBox3> const& boxes, int axis):
+      m_boxes(boxes), m_axis(axis){}
+    bool operator()(size_t a, size_t b) const {
+      return m_boxes[a].min()[m_axis] + m_boxes[a].max()[m_axis] <
+             m_boxes[b].min()[m_axis] + m_boxes[b].max()[m_axis];
+    }
+  };
+
+  // Sort-tile-recursive packing of the given boxes in the plane. The
+  // boxes are sorted by x, cut into vertical slices, and each slice is
+  // sorted by y. Consecutive runs of node_size boxes then form the
+  // nodes, which are thus compact.
+  void str_pack(std::vector<BBox3> const& boxes, int node_size,
+                std::vector<size_t> & order){
+
+    size_t num = boxes.size();
+    order.resize(num);
+    for (size_t i = 0; i < num; i++)
+      order[i] = i;
+
+    size_t num_nodes  = (num + node_size - 1)/node_size;
+    size_t num_slices = (size_t)ceil(sqrt(double(num_nodes)));
+    size_t slice_len  = num_slices*node_size;
+
+    std::sort(order.begin(), order.end(), CompareBoxCenters(boxes, 0));
+    for (size_t start = 0; start < num; start += slice_len){
+      size_t end = std::min(num, start + slice_len);
+      std::sort(order.begin() + start, order.begin() + end, CompareBoxCenters(boxes, 1));
+    }
+  }
+
+  void BBoxPairTree::build(std::vector<BBoxPair> const& boundaries){
+
+    m_levels.clear();
+    m_boxes.clear();
+    m_indices.clear();
+
+    std::vector<BBox3>  boxes;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < boundaries.size(); i++){
+      if (boundaries[i].first.empty())
+        continue;
+      boxes.push_back(boundaries[i].first);
+      indices.push_back(i);
+    }
+    if (boxes.empty())
+      return;
+
+    // Pack the leaves
+    std::vector<size_t> order;
+    str_pack(boxes, node_size(), order);
+    for (size_t i = 0; i < order.size(); i++){
+      m_boxes.push_back(boxes[order[i]]);
+      m_indices.push_back(indices[order[i]]);
+    }
+
+    // Form the nodes level by level, until there is just the root.
+    // Above the leaves, the nodes are already in good order, as they
+    // come from packed boxes, so they are not repacked.
+    std::vector<BBox3> const* children = &m_boxes;
+    std::vector<BBox3> node_boxes;
+    while (1){
+      std::vector<Node> level;
+      for (size_t start = 0; start < children->size(); start += node_size()){
+        Node node;
+        node.begin = start;
+        node.end   = std::min(children->size(), start + node_size());
+        for (size_t k = node.begin; k < node.end; k++)
+          node.box.grow((*children)[k]);
+        level.push_back(node);
+      }
+      m_levels.push_back(level);
+      if (level.size() == 1)
+        break;
+
+      node_boxes.clear();
+      for (size_t k = 0; k < level.size(); k++)
+        node_boxes.push_back(level[k].box);
+      children = &node_boxes;
+    }
+  }
+
+  void BBoxPairTree::search(int level, size_t node, BBox3 const& box,
+                            std::vector<size_t> & indices) const {
+    Node const& n = m_levels[level][node];
+    if (!box.intersects(n.box))
+      return;
+    for (size_t k = n.begin; k < n.end; k++){
+      if (level == 0){
+        if (box.intersects(m_boxes[k]))
+          indices.push_back(m_indices[k]);
+      }else{
+        search(level - 1, k, box, indices);
+      }
+    }
+  }
+
+  void BBoxPairTree::intersecting(BBox3 const& box, std::vector<size_t> & indices) const {
+    indices.clear();
+    if (m_levels.empty())
+      return;
+    search(m_levels.size() - 1, 0, box, indices);
+    std::sort(indices.begin(), indices.end());
+  }
+
+  QuantileSketch::QuantileSketch(double relative_accuracy): m_count(0) {
+    VW_ASSERT(relative_accuracy > 0 && relative_accuracy < 1,
+              ArgumentErr() << "QuantileSketch: the accuracy must be in (0, 1).");
+    m_gamma     = (1.0 + relative_accuracy)/(1.0 - relative_accuracy);
+    m_log_gamma = log(m_gamma);
+    m_min_index = int(ceil(log(min_value())/m_log_gamma));
+    int max_index = int(ceil(log(max_value())/m_log_gamma));
+    m_bins.assign(max_index - m_min_index + 1, 0);
+  }
+
+  void QuantileSketch::add(double val) {
+    if (!(val > 0)) return;
+    val = std::min(std::max(val, min_value()), max_value());
+    int k = int(ceil(log(val)/m_log_gamma)) - m_min_index;
+    k = std::min(std::max(k, 0), int(m_bins.size()) - 1);
+    m_bins[k]++;
+    m_count++;
+  }
+
+  void QuantileSketch::merge(QuantileSketch const& other) {
+    VW_ASSERT(m_bins.size() == other.m_bins.size() && m_gamma == other.m_gamma,
+              ArgumentErr() << "QuantileSketch: cannot merge sketches of different accuracy.");
+    for (size_t k = 0; k < m_bins.size(); k++)
+      m_bins[k] += other.m_bins[k];
+    m_count += other.m_count;
+  }
+
+  double QuantileSketch::quantile(double pct) const {
+    VW_ASSERT(m_count > 0, ArgumentErr() << "QuantileSketch: no values were added.");
+    vw::uint64 rank = std::min(m_count - 1, vw::uint64(std::max(pct, 0.0)*m_count));
+    vw::uint64 sum = 0;
+    size_t k = 0;
+    for (k = 0; k + 1 < m_bins.size(); k++) {
+      sum += m_bins[k];
+      if (sum > rank) break;
+    }
+    // Bin k holds the values in (gamma^(i-1), gamma^i]. Return the value
+    // with the same relative error from both ends.
+    double upper = exp(m_log_gamma*(int(k) + m_min_index));
+    return 2.0*upper/(m_gamma + 1.0);
+  }
+
   // Task to parallelize the generation of bounding boxes for each block.
   class SubBlockBoundaryTask : public Task, private boost::noncopyable {
     ImageViewRef<Vector3> m_view;
@@ -85,8 +250,7 @@ namespace asp{
     BBox3& m_global_bbox;
     std::vector<BBoxPair>& m_point_image_boundaries;
     ImageViewRef<double> const& m_error_image;
-    double m_estim_max_error; // used for outlier removal based on percentage
-    std::vector<double> & m_errors_hist;
+    QuantileSketch * m_errors_sketch; // used for outlier removal based on percentage
     double m_max_valid_triangulation_error; // used for outlier removal based on thresh
     Mutex& m_mutex;
     const ProgressCallback& m_progress;
@@ -102,16 +266,11 @@ namespace asp{
       }
     };
 
-    struct ErrorHistAccumulator{
-      std::vector<double> & m_hist;
-      double m_max_val;
-      ErrorHistAccumulator(std::vector<double>& hist, double max_val):
-        m_hist(hist), m_max_val(max_val){}
+    struct ErrorSketchAccumulator{
+      QuantileSketch & m_sketch;
+      ErrorSketchAccumulator(QuantileSketch & sketch): m_sketch(sketch){}
       void operator()(double err){
-        if (err == 0) return; // null errors come from invalid pixels
-        int len = m_hist.size();
-        int k = round((len-1)*std::min(err, m_max_val)/m_max_val);
-        m_hist[k]++;
+        m_sketch.add(err);
       }
     };
 
@@ -121,21 +280,21 @@ namespace asp{
 			  BBox2i const& image_bbox,
 			  BBox3       & global_bbox, 
 			  std::vector<BBoxPair>& boundaries,
-			  ImageViewRef<double> const& error_image, double estim_max_error,
-			  std::vector<double> & errors_hist,
+			  ImageViewRef<double> const& error_image,
+			  QuantileSketch * errors_sketch,
 			  double max_valid_triangulation_error,
 			  Mutex& mutex, const ProgressCallback& progress, float inc_amt ) :
       m_view(view.impl()), m_sub_block_size(sub_block_size),
       m_image_bbox(image_bbox),
       m_global_bbox(global_bbox), m_point_image_boundaries( boundaries ),
-      m_error_image(error_image), m_estim_max_error(estim_max_error),
-      m_errors_hist(errors_hist), m_max_valid_triangulation_error(max_valid_triangulation_error),
+      m_error_image(error_image),
+      m_errors_sketch(errors_sketch), m_max_valid_triangulation_error(max_valid_triangulation_error),
       m_mutex( mutex ), m_progress( progress ), m_inc_amt( inc_amt ) {}
       
     void operator()() {
       ImageView<Vector3 > local_image = crop( m_view, m_image_bbox );
 
-      bool remove_outliers_with_pct = (!m_errors_hist.empty());
+      bool remove_outliers_with_pct = (m_errors_sketch != NULL);
       ImageView<double> local_error;
       if (remove_outliers_with_pct || m_max_valid_triangulation_error > 0.0)
         local_error = crop( m_error_image, m_image_bbox );
@@ -145,7 +304,7 @@ namespace asp{
       std::vector<BBox2i> blocks = subdivide_bbox( m_image_bbox, m_sub_block_size, m_sub_block_size );
       BBox3 local_union;
       std::list<BBoxPair> solutions;
-      std::vector<double> local_hist(m_errors_hist.size(), 0);
+      QuantileSketch local_sketch;
       for ( size_t i = 0; i < blocks.size(); i++ ) {
       
         BBox3 pts_bdbox;
@@ -182,7 +341,7 @@ namespace asp{
         }
 
         if (remove_outliers_with_pct){
-          ErrorHistAccumulator error_accum(local_hist, m_estim_max_error);
+          ErrorSketchAccumulator error_accum(local_sketch);
           for_each_pixel( crop( local_error, blocks[i] - m_image_bbox.min() ),
 		          error_accum );
 
@@ -202,8 +361,7 @@ namespace asp{
         m_global_bbox.grow( local_union );
 
         if (remove_outliers_with_pct)
-          for (int i = 0; i < (int)m_errors_hist.size(); i++)
-            m_errors_hist[i] += local_hist[i];
+          m_errors_sketch->merge(local_sketch);
 
         m_progress.report_incremental_progress( m_inc_amt );
       }
@@ -334,17 +492,48 @@ namespace asp{
 
 
 
+  // The slots are owned by m_slots, so the thread-specific pointers
+  // must not delete them.
+  static void no_cleanup(size_t *){}
+
+  ThreadCounter::ThreadCounter(): m_thread_slot(no_cleanup) {}
+
+  void ThreadCounter::add(size_t val) {
+    size_t * slot = m_thread_slot.get();
+    if (slot == NULL) {
+      vw::Mutex::Lock lock(m_mutex);
+      m_slots.push_back(0);
+      slot = &m_slots.back();
+      m_thread_slot.reset(slot);
+    }
+    *slot += val;
+  }
+
+  size_t ThreadCounter::total() const {
+    vw::Mutex::Lock lock(m_mutex);
+    size_t sum = 0;
+    for (std::list<size_t>::const_iterator it = m_slots.begin(); it != m_slots.end(); it++)
+      sum += *it;
+    return sum;
+  }
+
+  void ThreadCounter::reset() {
+    vw::Mutex::Lock lock(m_mutex);
+    for (std::list<size_t>::iterator it = m_slots.begin(); it != m_slots.end(); it++)
+      *it = 0;
+  }
+
   OrthoRasterizerView::OrthoRasterizerView
   (ImageViewRef<Vector3> point_image, ImageViewRef<double> texture,
    double search_radius_factor, double sigma_factor, bool use_surface_sampling, int pc_tile_size,
    vw::BBox2 const& projwin,
    bool remove_outliers_with_pct, Vector2 const& remove_outliers_params,
-   ImageViewRef<double> const& error_image, double estim_max_error,
+   ImageViewRef<double> const& error_image,
    double max_valid_triangulation_error,
    Vector2 median_filter_params, int erode_len, bool has_las_or_csv,
    std::string const& filter,
    double default_grid_size_multiplier,
-   size_t *num_invalid_pixels, vw::Mutex *count_mutex,
+   ThreadCounter *num_invalid_pixels,
    const ProgressCallback& progress):
     // Ensure all members are initiated, even if to temporary values
     m_point_image(point_image), m_texture(ImageView<float>(1,1)),
@@ -361,9 +550,9 @@ namespace asp{
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
     m_num_invalid_pixels(num_invalid_pixels),
-    m_count_mutex(count_mutex){
+    m_point_cache(new TileCache<Vector3>("point_cloud", pc_tile_size)){
 
-    *m_num_invalid_pixels = 0; // Init counter
+    m_num_invalid_pixels->reset(); // Init counter
     set_texture(texture.impl());
 
     // Convert the filter from string to enum, to speed up checking against it later
@@ -388,12 +577,9 @@ namespace asp{
     // They're used for querying what part of the image we need
     VW_OUT(DebugMessage,"asp") << "Computing raster bounding box...\n";
 
-    int num_bins = 1024;
-    std::vector<double> errors_hist;
-    if (remove_outliers_with_pct){
-      // Need to compute the histogram of all errors in the error image
-      errors_hist = std::vector<double>(num_bins, 0.0);
-    }
+    // The errors are summarized in the same pass, to find their
+    // percentile without reading the cloud again.
+    QuantileSketch errors_sketch;
 
     // Subdivide each block into smaller chunks. Note: small chunks
     // greatly increase the memory usage and run-time for very large
@@ -420,7 +606,8 @@ namespace asp{
       boost::shared_ptr<task_type>
         task( new task_type( m_point_image, sub_block_size, blocks[i],
                              m_bbox, m_point_image_boundaries,
-                             error_image, estim_max_error, errors_hist,
+                             error_image,
+                             remove_outliers_with_pct ? &errors_sketch : NULL,
                              max_valid_triangulation_error,
                              mutex, progress, inc_amt ) );
       queue.add_task( task );
@@ -428,6 +615,10 @@ namespace asp{
     queue.join_all();
     progress.report_finished();
 
+    // Index the point cloud blocks, so that each DEM tile can find
+    // the few blocks it needs.
+    m_boundaries_tree.build(m_point_image_boundaries);
+
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
 
@@ -439,29 +630,14 @@ namespace asp{
 
     VW_OUT(DebugMessage,"asp") << "Point cloud boundary is " << m_bbox << "\n";
 
-    if (remove_outliers_with_pct){
-      // Find the outlier cutoff from the histogram of all errors.
+    if (remove_outliers_with_pct && errors_sketch.count() == 0){
+      vw_out() << "No valid triangulation errors were found. Check if your cloud "
+               << "is valid. Outliers will not be removed.\n";
+    }else if (remove_outliers_with_pct){
       // The cutoff is the outlier factor times the percentile of the errors.
       double pct    = remove_outliers_params[0]/100.0; // e.g., 0.75
       double factor = remove_outliers_params[1];       // e.g., 3.0
-      int hist_size = errors_hist.size();
-      vw::int64 num_errors = 0;
-      for (int s = 0; s < hist_size; s++)
-        num_errors += errors_hist[s];
-      int cutoff_index = 0;
-      vw::int64 sum = 0;
-      for (int s = 0; s < hist_size; s++){
-        sum += errors_hist[s];
-        if (sum >= pct*num_errors){
-          cutoff_index = s;
-          break;
-        }
-      }
-      // The below is equivalent to sorting all errors in increasing order,
-      // and looking at the error at index pct*num_errors.
-      double error_percentile = estim_max_error*cutoff_index/double(hist_size);
-      // Multiply by the outlier factor
-      m_error_cutoff = factor*error_percentile;
+      m_error_cutoff = factor*errors_sketch.quantile(pct);
       vw_out() << "Automatic triangulation error cutoff is " << m_error_cutoff
                << " meters.\n";
     }else if (max_valid_triangulation_error > 0.0){
@@ -572,7 +748,53 @@ namespace asp{
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox )
     const {
-    
+
+    // The point2dem tiles are rendered here, so pin the thread first
+    asp::numa_bind_current_thread();
+
+    std::vector< ImageViewRef<float> > textures(1, m_texture);
+    std::vector< ImageView<float> > results;
+    rasterize_textures(bbox, textures, results);
+
+    ImageView<pixel_type> result = results[0];
+    return prerasterize_type (result, BBox2i(-bbox.min().x(),
+                                             -bbox.min().y(), cols(), rows()));
+  }
+
+  ImageView<Vector3> OrthoRasterizerView::filtered_points(BBox2i const& block) const {
+
+    // Pull a copy of the input image in memory.  Expand the image
+    // to be able to see a bit beyond when filling holes.
+    BBox2i biased_block = block;
+    int bias = m_median_filter_params[0]/2 + m_erode_len;
+    biased_block.expand(bias);
+    biased_block.crop(vw::bounding_box(m_point_image));
+    ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
+
+    remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
+    filter_by_median(point_copy, m_median_filter_params);
+    erode_image(point_copy, m_erode_len);
+
+    // Crop back to the area of interest
+    return crop(point_copy, block - biased_block.min());
+  }
+
+  void OrthoRasterizerView::rasterize_textures(BBox2i const& bbox,
+                                               std::vector< ImageViewRef<float> > const& textures,
+                                               std::vector< ImageView<float> > & results) const {
+
+    asp::ScopedTimer timer("rasterize_tile", bbox);
+
+    const size_t num_textures = textures.size();
+    VW_ASSERT(num_textures > 0,
+              ArgumentErr() << "OrthoRasterizer: no textures to rasterize.");
+    for (size_t t = 0; t < num_textures; t++) {
+      VW_ASSERT(textures[t].cols() == m_point_image.cols() &&
+                textures[t].rows() == m_point_image.rows(),
+                ArgumentErr() << "OrthoRasterizer: rasterize_textures() failed."
+                << " Texture dimensions must match point image dimensions.");
+    }
+
     BBox2i bbox_1 = bbox;
 
     // bugfix, ensure we see enough beyond current tile
@@ -581,18 +803,6 @@ namespace asp{
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
-    if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
-    }
-
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
-                                          &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
-
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
     // given cloud point may contribute to multiple DEM points, but
@@ -604,15 +814,7 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
-                               bbox_1.height(),
-                               d_buffer, weights,
-                               local_3d_bbox.min().x(),
-                               local_3d_bbox.min().y(),
-                               m_spacing, m_default_spacing,
-                               search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
-    
+
     // Set up the default color value
     double min_val = 0.0;
     if (m_use_alpha) {
@@ -624,18 +826,45 @@ namespace asp{
       min_val = m_default_value;
     }
 
-    std::valarray<float> vertices(10), intensities(5);
-
-    if (m_use_surface_sampling){
-      static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+    // One software renderer with an orthographic view matrix, or one
+    // grid, per texture. The buffers must be sized before the
+    // renderers and grids are made, as these keep pointers to them.
+    std::vector< ImageView<float > > render_buffers(num_textures);
+    std::vector< ImageView<double> > d_buffers(num_textures), weights(num_textures);
+    std::vector< boost::shared_ptr<vw::stereo::SoftwareRenderer> > renderers(num_textures);
+    std::vector< boost::shared_ptr<asp::Point2Grid> > point2grids(num_textures);
+    for (size_t t = 0; t < num_textures; t++) {
+      if (m_use_surface_sampling){
+        render_buffers[t].set_size(bbox_1.width(), bbox_1.height());
+        renderers[t] = boost::shared_ptr<vw::stereo::SoftwareRenderer>
+          (new vw::stereo::SoftwareRenderer(bbox_1.width(), bbox_1.height(),
+                                            &render_buffers[t](0,0)));
+        renderers[t]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                              local_3d_bbox.min().y(), local_3d_bbox.max().y());
+        renderers[t]->Clear(min_val);
+      }else{
+        point2grids[t] = boost::shared_ptr<asp::Point2Grid>
+          (new asp::Point2Grid(bbox_1.width(),
+                               bbox_1.height(),
+                               d_buffers[t], weights[t],
+                               local_3d_bbox.min().x(),
+                               local_3d_bbox.min().y(),
+                               m_spacing, m_default_spacing,
+                               search_radius, m_sigma_factor,
+                               m_filter, m_percentile));
+        point2grids[t]->Clear(min_val);
+      }
     }
 
+    // With surface sampling, each block of the cloud is drawn as one
+    // indexed batch of triangles. The triangles are shared by all
+    // textures.
+    static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
+    static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
+    std::vector<float> vertices;
+    std::vector< std::vector<float> > intensities(num_textures);
+    std::vector<int> indices;
+
     // For each block in the DEM space intersecting local_3d_bbox,
     // find the corresponding blocks in the point cloud space.  We
     // use here a map since we'd like to group together the point
@@ -644,11 +873,11 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
-      if (! local_3d_bbox.intersects(boundary.first) )
-        continue;
+    std::vector<size_t> boundary_indices;
+    m_boundaries_tree.intersecting(local_3d_bbox, boundary_indices);
+    for (size_t b = 0; b < boundary_indices.size(); b++) {
 
-      BBox2i pc_block = boundary.second;
+      BBox2i pc_block = m_point_image_boundaries[boundary_indices[b]].second;
 
       BBox2i snapped_block;
       snapped_block.min() = m_block_size*floor(pc_block.min()/double(m_block_size));
@@ -662,24 +891,24 @@ namespace asp{
 
     }
 
+    results.resize(num_textures);
     if ( blocks_map.empty() ){
 
-      { // Lock and update the total number of invalid pixels in this tile.
-        vw::Mutex::Lock lock(*m_count_mutex);
-        (*m_num_invalid_pixels) += bbox.width()*bbox.height();
-      }
-      
-      if (m_use_surface_sampling){
-        return prerasterize_type( render_buffer, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
-      }else{
-        return prerasterize_type( d_buffer,      BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
+      // Update the total number of invalid pixels with this tile.
+      m_num_invalid_pixels->add(bbox.width()*bbox.height());
+
+      for (size_t t = 0; t < num_textures; t++) {
+        results[t].set_size(bbox.width(), bbox.height());
+        fill(results[t], min_val);
       }
+      return;
     }
 
     // This is very important. When doing surface sampling, for each
     // pixel we need to see its next up and right neighbors.
     int d = (int)m_use_surface_sampling;
 
+    std::vector< ImageView<float> > texture_copies(num_textures);
     for (MapIterType it = blocks_map.begin(); it != blocks_map.end(); it++){
 
       BBox2i block = it->second;
@@ -687,22 +916,34 @@ namespace asp{
       block.max() += Vector2i(d, d);
       block.crop(vw::bounding_box(m_point_image));
 
-      // Pull a copy of the input image in memory.  Expand the image
-      // to be able to see a bit beyond when filling holes.
-      BBox2i biased_block = block;
-      int bias = m_median_filter_params[0]/2 + m_erode_len;
-      biased_block.expand(bias);
-      biased_block.crop(vw::bounding_box(m_point_image));
-      ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
-
-      remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
-      filter_by_median(point_copy, m_median_filter_params);
-      erode_image(point_copy, m_erode_len);
+      // The DEM, orthoimage and error images all grid the same
+      // points, and neighboring tiles need the same blocks, so keep
+      // the filtered blocks if there is room.
+      ImageView<Vector3> point_copy;
+      if (m_point_cache->enabled())
+        point_copy = m_point_cache->crop(0, block, FilteredPointBlock(*this));
+      else
+        point_copy = filtered_points(block);
 
-      // Crop back to the area of interest
-      point_copy = crop(point_copy, block - biased_block.min());
+      for (size_t t = 0; t < num_textures; t++)
+        texture_copies[t] = crop(textures[t], block);
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      if (m_use_surface_sampling){
+        int num_points = point_copy.cols()*point_copy.rows();
+        vertices.resize(NUM_VERTEX_COMPONENTS*num_points);
+        for (size_t t = 0; t < num_textures; t++)
+          intensities[t].resize(NUM_COLOR_COMPONENTS*num_points);
+        indices.clear();
+        for ( int32 row = 0; row < point_copy.rows(); ++row ) {
+          for ( int32 col = 0; col < point_copy.cols(); ++col ) {
+            int index = row*point_copy.cols() + col;
+            vertices[2*index  ] = point_copy(col, row).x();
+            vertices[2*index+1] = point_copy(col, row).y();
+            for (size_t t = 0; t < num_textures; t++)
+              intensities[t][index] = texture_copies[t](col, row);
+          }
+        }
+      }
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -717,43 +958,37 @@ namespace asp{
 
           if (m_use_surface_sampling){
 
-            // This loop rasterizes a quad indexed by the upper left.
+            // This loop collects the triangles of the quad indexed
+            // by the upper left.
             if ( !boost::math::isnan((*point_ul).z()) &&
                  !boost::math::isnan((*point_lr).z()) ) {
 
-              vertices[0] = (*point_ul).x(); // UL
-              vertices[1] = (*point_ul).y();
-              vertices[2] = (*point_ll).x(); // LL
-              vertices[3] = (*point_ll).y();
-              vertices[4] = (*point_lr).x(); // LR
-              vertices[5] = (*point_lr).y();
-              vertices[6] = (*point_ur).x(); // UR
-              vertices[7] = (*point_ur).y();
-              vertices[8] = (*point_ul).x(); // UL
-              vertices[9] = (*point_ul).y();
-
-              intensities[0] = texture_copy(col,  row);
-              intensities[1] = texture_copy(col,row+1);
-              intensities[2] = texture_copy(col+1,  row+1);
-              intensities[3] = texture_copy(col+1,row);
-              intensities[4] = texture_copy(col,row);
+              int ul = row*point_copy.cols() + col;
+              int ur = ul + 1;
+              int ll = ul + point_copy.cols();
+              int lr = ll + 1;
 
               if ( !boost::math::isnan((*point_ll).z()) ) {
                 // triangle 1 is: UL LL LR
-                renderer.DrawPolygon(0, 3);
+                indices.push_back(ul);
+                indices.push_back(ll);
+                indices.push_back(lr);
               }
               if ( !boost::math::isnan((*point_ur).z()) ) {
                 // triangle 2 is: LR, UR, UL
-                renderer.DrawPolygon(2, 3);
+                indices.push_back(lr);
+                indices.push_back(ur);
+                indices.push_back(ul);
               }
             }
 
           }else{
             // The new engine
             if ( !boost::math::isnan(point_copy(col, row).z()) ){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+              for (size_t t = 0; t < num_textures; t++)
+                point2grids[t]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         texture_copies[t](col,  row));
             }
           }
           point_ul.next_col();
@@ -761,42 +996,40 @@ namespace asp{
         row_acc.next_row();
       } // End row loop
 
+      if (m_use_surface_sampling && !indices.empty()){
+        for (size_t t = 0; t < num_textures; t++) {
+          renderers[t]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+          renderers[t]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[t][0]);
+          renderers[t]->DrawTriangles(indices.size(), &indices[0]);
+        }
+      }
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
-
     // The software renderer returns an image which will render
-    // upside down in most image formats, so we correct that here.
-    // We also introduce transparent pixels into the result where necessary.
+    // upside down in most image formats, so we correct that here,
+    // and crop away the temporary extension of bbox.
     // TODO: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    BBox2i crop_box = bbox - bbox_1.min();
+    for (size_t t = 0; t < num_textures; t++) {
+      if (m_use_surface_sampling) {
+        results[t] = crop(flip_vertical(render_buffers[t]), crop_box);
+      }else{
+        point2grids[t]->normalize();
+        results[t] = crop(flip_vertical(d_buffers[t]), crop_box);
+      }
+    }
 
-    // Loop through result here and count up how many pixels have been
-    // changed from the default value.
+    // Loop through the first result here and count up how many
+    // pixels have been changed from the default value.
     size_t num_unset = 0;
-    for (int r=0; r<result.rows(); ++r) {
-      for (int c=0; c<result.cols(); ++c) {
-        
-        Vector2i pix = Vector2(c, r) + bbox_1.min();
-        if (bbox.contains(pix)) {
-          //  Ignore the pixels in the temporary extension of bbox.
-          if (result(c,r) == min_val)
-            ++num_unset;
-        }
+    for (int r=0; r<results[0].rows(); ++r) {
+      for (int c=0; c<results[0].cols(); ++c) {
+        if (results[0](c,r) == min_val)
+          ++num_unset;
       }
     }
-    { // Lock and update the total number of invalid pixels in this tile.
-      vw::Mutex::Lock lock(*m_count_mutex);
-      (*m_num_invalid_pixels) += num_unset;
-    }
-
-    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
-                                             -bbox_1.min().y(), cols(), rows()));
+    // Update the total number of invalid pixels with this tile.
+    m_num_invalid_pixels->add(num_unset);
   }
 
 
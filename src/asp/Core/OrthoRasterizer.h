@@ -26,11 +26,15 @@
 #define __ASP_CORE_ORTHORASTERIZER_H__
 
 #include <vw/Core/Thread.h>
+#include <boost/thread/tss.hpp>
+#include <list>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
+#include <asp/Core/TileCache.h>
+#include <boost/shared_ptr.hpp>
 
 namespace asp{
 
@@ -38,6 +42,105 @@ namespace asp{
 
   typedef std::pair<BBox3, BBox2i> BBoxPair;
 
+  /// A static R-tree over the point cloud boxes of a list of BBoxPair,
+  /// built by sort-tile-recursive packing. It is used to quickly find
+  /// the point cloud blocks which may contribute to a given DEM tile,
+  /// rather than checking all of them. dem_mosaic uses it the same way
+  /// for the footprints of the input DEMs.
+  class BBoxPairTree {
+  public:
+    /// Number of children per tree node
+    static int node_size() { return 16; }
+
+    /// Build the tree. Pairs with an empty point box are skipped.
+    void build(std::vector<BBoxPair> const& boundaries);
+
+    /// Find the indices, in increasing order, of the pairs whose point
+    /// box intersects the given box.
+    void intersecting(BBox3 const& box, std::vector<size_t> & indices) const;
+
+    size_t size() const { return m_indices.size(); }
+
+  private:
+    struct Node {
+      BBox3  box;
+      size_t begin, end; // range of children in the level below
+    };
+
+    // Level 0 holds the leaves, which point into m_boxes. Each higher
+    // level points into the level below it. The last level has a
+    // single node, the root.
+    std::vector< std::vector<Node> > m_levels;
+    std::vector<BBox3>  m_boxes;   // the point boxes, in packed order
+    std::vector<size_t> m_indices; // their indices in the input list
+
+    void search(int level, size_t node, BBox3 const& box,
+                std::vector<size_t> & indices) const;
+  };
+
+  /// A count which many threads add to without taking a lock. Each
+  /// thread adds into its own slot, and the slots are summed only
+  /// when the total is asked for, after the threads are done.
+  class ThreadCounter {
+  public:
+    ThreadCounter();
+
+    /// Add to the slot of the calling thread. Only the first call in
+    /// a given thread takes a lock, to create that slot.
+    void add(size_t val);
+
+    /// The sum over all threads. Not to be called while adding.
+    size_t total() const;
+
+    /// Set all slots to zero.
+    void reset();
+
+  private:
+    std::list<size_t> m_slots; // a list, so that slot addresses are stable
+    boost::thread_specific_ptr<size_t> m_thread_slot; // points into m_slots
+    mutable vw::Mutex m_mutex; // a lock for m_slots
+
+    ThreadCounter(ThreadCounter const&);
+    ThreadCounter& operator=(ThreadCounter const&);
+  };
+
+  /// A mergeable summary of positive values, which can return any
+  /// quantile of them with a bounded relative error, in memory which
+  /// does not depend on how many values were added. The values are
+  /// binned on a logarithmic scale, so a bin's width is proportional
+  /// to its values. Sketches filled in separate threads can be merged
+  /// by adding their bins.
+  class QuantileSketch {
+  public:
+    /// The returned quantiles are within this relative error of the
+    /// exact ones, for values in [min_value(), max_value()]. Values
+    /// outside that range are clamped to it.
+    QuantileSketch(double relative_accuracy = 0.005);
+
+    static double min_value() { return 1.0e-12; }
+    static double max_value() { return 1.0e+12; }
+
+    /// Add a value. Zero, negative, and NaN values are ignored, as
+    /// null triangulation errors come from invalid pixels.
+    void add(double val);
+
+    /// Add the values of another sketch with the same accuracy.
+    void merge(QuantileSketch const& other);
+
+    /// The number of values added
+    vw::uint64 count() const { return m_count; }
+
+    /// The value at index pct*count() among the values sorted in
+    /// increasing order, with pct in [0, 1].
+    double quantile(double pct) const;
+
+  private:
+    double m_gamma, m_log_gamma;
+    int    m_min_index; // the bin index of min_value()
+    vw::uint64 m_count;
+    std::vector<vw::uint64> m_bins;
+  };
+
   /// Given a point image and corresponding texture, this class
   /// bins and averages the point cloud on a regular grid over the [x,y]
   /// plane of the point image; producing an evenly sampled ortho-image
@@ -66,20 +169,24 @@ namespace asp{
     asp::FilterType m_filter;
     double m_percentile;
     double m_default_grid_size_multiplier;
-    size_t     *m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
-    vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
+    ThreadCounter *m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
+    boost::shared_ptr< TileCache<Vector3> > m_point_cache; ///< Filtered points, shared by the copies of the view
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
+    BBoxPairTree m_boundaries_tree; // to look up the boundaries by point box
 
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
+    /// The points of a block of the cloud, with outliers removed and
+    /// the median filter and erosion applied.
+    ImageView<Vector3> filtered_points( BBox2i const& block ) const;
+    friend struct FilteredPointBlock;
+
   public:
     typedef PixelGray<float> pixel_type;
     typedef const PixelGray<float> result_type;
@@ -97,15 +204,13 @@ namespace asp{
                         bool    remove_outliers_with_pct,
                         Vector2 const& remove_outliers_params,
                         ImageViewRef<double> const& error_image,
-                        double  estim_max_error,
                         double  max_valid_triangulation_error,
                         Vector2 median_filter_params,
                         int     erode_len,
                         bool    has_las_or_csv,
                         std::string const& filter,
 			double default_grid_size_multiplier,
-                        size_t  *num_invalid_pixels,
-                        vw::Mutex *count_mutex,
+                        ThreadCounter *num_invalid_pixels,
                         const ProgressCallback& progress);
 
     /// This must be called before the object can be used!
@@ -145,6 +250,15 @@ namespace asp{
     }
     /// \endcond
 
+    /// Rasterize several textures over the given box with one pass
+    /// over the cloud. The cloud blocks, their filtering, and the
+    /// triangles are found once and shared by all textures. The
+    /// textures must have the dimensions of the point image. Only
+    /// the unset pixels of the first texture are counted.
+    void rasterize_textures(BBox2i const& bbox,
+                            std::vector< ImageViewRef<float> > const& textures,
+                            std::vector< ImageView<float> > & results) const;
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -197,6 +311,62 @@ namespace asp{
     
   };
 
+  /// Several textures rasterized by an OrthoRasterizerView, as the
+  /// channels of one image, so that they are made with one pass over
+  /// the cloud. The rasterizer must outlive this view.
+  template <int N>
+  class OrthoRasterizerChannelsView:
+    public ImageViewBase< OrthoRasterizerChannelsView<N> > {
+    OrthoRasterizerView const& m_rasterizer;
+    std::vector< ImageViewRef<float> > m_textures;
+
+  public:
+    typedef Vector<float, N> pixel_type;
+    typedef const pixel_type result_type;
+    typedef ProceduralPixelAccessor<OrthoRasterizerChannelsView> pixel_accessor;
+
+    OrthoRasterizerChannelsView(OrthoRasterizerView const& rasterizer,
+                                std::vector< ImageViewRef<float> > const& textures):
+      m_rasterizer(rasterizer), m_textures(textures) {
+      VW_ASSERT(int(m_textures.size()) == N,
+                ArgumentErr() << "OrthoRasterizerChannelsView: expecting "
+                << N << " textures.");
+    }
+
+    inline int32 cols  () const { return m_rasterizer.cols(); }
+    inline int32 rows  () const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "OrthoRasterizerChannelsView::operator() has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      std::vector< ImageView<float> > results;
+      m_rasterizer.rasterize_textures(bbox, m_textures, results);
+
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          for (int t = 0; t < N; t++)
+            tile(col, row)[t] = results[t](col, row);
+        }
+      }
+      return prerasterize_type(tile, BBox2i(-bbox.min().x(), -bbox.min().y(),
+                                            cols(), rows()));
+    }
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   // TODO: Make this a BBox class function!!!
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
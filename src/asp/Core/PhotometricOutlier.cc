@@ -34,56 +34,224 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PhotometricOutlier.h>
-namespace fs = boost::filesystem;
+#include <vw/Core/ThreadPool.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <cmath>
 
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  // For each pixel of the box, the absolute difference between the
+  // left image and the right image projected into the left with the
+  // disparity, bilinearly and with zero beyond the right image, as
+  // transform() with a DisparityTransform and ZeroEdgeExtension does.
+  // Pixels with invalid disparity, or where the projected right image
+  // is zero, are not valid, and have a difference of zero.
+  void photometric_difference(ImageViewRef<PixelGray<float> > const& left,
+                              ImageViewRef<PixelGray<float> > const& right,
+                              ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                              BBox2i const& box,
+                              ImageView<float> & diff, ImageView<char> & right_valid){
+
+    ImageView<PixelMask<Vector2f> > disp = crop(disparity, box);
+    ImageView<PixelGray<float> >    left_crop = crop(left, box);
+
+    // The region of the right image that the disparity points to
+    BBox2i right_box;
+    for (int row = 0; row < disp.rows(); row++){
+      for (int col = 0; col < disp.cols(); col++){
+        if (!is_valid(disp(col, row))) continue;
+        Vector2 p = Vector2(col, row) + box.min() + disp(col, row).child();
+        right_box.grow(Vector2i(floor(p.x()), floor(p.y())));
+      }
+    }
+    right_box.max() += Vector2i(2, 2);
+    right_box.crop(bounding_box(right));
+    ImageView<PixelGray<float> > right_crop;
+    if (!right_box.empty())
+      right_crop = crop(right, right_box);
+
+    diff.set_size(box.width(), box.height());
+    right_valid.set_size(box.width(), box.height());
+    for (int row = 0; row < disp.rows(); row++){
+      for (int col = 0; col < disp.cols(); col++){
+        diff(col, row) = 0;
+        right_valid(col, row) = 0;
+        if (!is_valid(disp(col, row)) || right_box.empty()) continue;
+        Vector2 p = Vector2(col, row) + box.min() + disp(col, row).child();
+        int x0 = int(floor(p.x())), y0 = int(floor(p.y()));
+        double fx = p.x() - x0, fy = p.y() - y0;
+        double val = 0;
+        for (int dy = 0; dy < 2; dy++){
+          for (int dx = 0; dx < 2; dx++){
+            Vector2i q(x0 + dx, y0 + dy);
+            if (!right_box.contains(q)) continue; // zero beyond the image
+            double w = (dx ? fx : 1 - fx)*(dy ? fy : 1 - fy);
+            val += w*right_crop(q.x() - right_box.min().x(), q.y() - right_box.min().y()).v();
+          }
+        }
+        float proj = val;
+        if (proj == 0) continue;
+        right_valid(col, row) = 1;
+        diff(col, row) = std::abs(left_crop(col, row).v() - proj);
+      }
+    }
+  }
+
+  // Collect the differences on some tiles
+  class PhotometricSampleTask: public Task, private boost::noncopyable {
+    ImageViewRef<PixelGray<float> >    const& m_left, & m_right;
+    ImageViewRef<PixelMask<Vector2f> > const& m_disparity;
+    BBox2i m_box;
+    std::vector<float> & m_samples;
+  public:
+    PhotometricSampleTask(ImageViewRef<PixelGray<float> > const& left,
+                          ImageViewRef<PixelGray<float> > const& right,
+                          ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                          BBox2i const& box, std::vector<float> & samples):
+      m_left(left), m_right(right), m_disparity(disparity), m_box(box), m_samples(samples){}
+
+    void operator()(){
+      ImageView<float> diff;
+      ImageView<char>  right_valid;
+      photometric_difference(m_left, m_right, m_disparity, m_box, diff, right_valid);
+      m_samples.reserve(diff.cols()*diff.rows());
+      for (int row = 0; row < diff.rows(); row++)
+        for (int col = 0; col < diff.cols(); col++)
+          m_samples.push_back(diff(col, row));
+    }
+  };
+
+}
+
+float asp::photometric_outlier_threshold(ImageViewRef<PixelGray<float> > const& left,
+                                         ImageViewRef<PixelGray<float> > const& right,
+                                         ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                                         double quantile, int max_tiles){
+
+  if (quantile < 0 || quantile > 1)
+    vw_throw( ArgumentErr() << "photometric_outlier_threshold: The quantile must be between 0 and 1.\n" );
+
+  int ts = vw_settings().default_tile_size();
+  std::vector<BBox2i> tiles = subdivide_bbox(disparity, ts, ts);
+  if (tiles.empty())
+    return 0;
+
+  // Every k-th tile, so that the sample covers the whole image
+  int step = std::max(1, int(ceil(double(tiles.size())/std::max(max_tiles, 1))));
+  std::vector<BBox2i> sample_tiles;
+  for (size_t k = 0; k < tiles.size(); k += step)
+    sample_tiles.push_back(tiles[k]);
+
+  std::vector<std::vector<float> > samples(sample_tiles.size());
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (size_t k = 0; k < sample_tiles.size(); k++){
+    boost::shared_ptr<PhotometricSampleTask>
+      task(new PhotometricSampleTask(left, right, disparity, sample_tiles[k], samples[k]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  std::vector<float> all;
+  for (size_t k = 0; k < samples.size(); k++)
+    all.insert(all.end(), samples[k].begin(), samples[k].end());
+  if (all.empty())
+    return 0;
+
+  size_t pos = std::min(all.size() - 1, size_t(quantile*(all.size() - 1) + 0.5));
+  std::nth_element(all.begin(), all.begin() + pos, all.end());
+  return all[pos];
+}
+
+PhotometricOutlierView::PhotometricOutlierView(ImageViewRef<PixelGray<float> > const& left,
+                                               ImageViewRef<PixelGray<float> > const& right,
+                                               ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                                               float threshold, int kernel_size):
+  m_left(left), m_right(right), m_disparity(disparity),
+  m_threshold(threshold), m_kernel_size(kernel_size){
+
+  if (kernel_size < 1)
+    vw_throw( ArgumentErr() << "PhotometricOutlierView: The kernel size must be positive.\n" );
+  if (left.cols() != disparity.cols() || left.rows() != disparity.rows())
+    vw_throw( ArgumentErr() << "PhotometricOutlierView: The left image and the disparity "
+                            << "must have the same size.\n" );
+}
+
+PhotometricOutlierView::pixel_type
+PhotometricOutlierView::operator()(double /*i*/, double /*j*/, int32 /*p*/) const {
+  vw_throw( NoImplErr() << "PhotometricOutlierView::operator()(...) is not implemented.\n" );
+  return pixel_type();
+}
+
+PhotometricOutlierView::prerasterize_type
+PhotometricOutlierView::prerasterize(BBox2i const& bbox) const {
+
+  // The blurred distance to the dust at a pixel depends on the
+  // distance transform within the blur radius r, about 3.5 sigma,
+  // and the distance transform changes by at most one per pixel. If
+  // it is at least kernel_size + 2r + 1 anywhere in the blur support,
+  // it exceeds kernel_size everywhere there, so truncating it at the
+  // tile edge does not change the outcome. Hence a margin of about
+  // kernel_size + 3r, taken a bit larger.
+  double sigma = m_kernel_size/3; // integer division, as before
+  int blur_radius = int(ceil(3.5*sigma)) + 1;
+  int margin = m_kernel_size + 3*blur_radius + 2;
+
+  BBox2i box = bbox;
+  box.expand(margin);
+  box.crop(bounding_box(m_disparity));
+
+  ImageView<float> diff;
+  ImageView<char>  right_valid;
+  photometric_difference(m_left, m_right, m_disparity, box, diff, right_valid);
+
+  // Threshold and dilate
+  ImageView<PixelGray<float> > dust(diff.cols(), diff.rows());
+  for (int row = 0; row < diff.rows(); row++)
+    for (int col = 0; col < diff.cols(); col++)
+      dust(col, row) = (diff(col, row) > m_threshold) ? 1.0 : 0.0;
+  ImageView<PixelGray<float> > grass;
+  grassfire(dust, grass);
+  dust = gaussian_filter(grass, sigma);
+
+  ImageView<PixelMask<Vector2f> > disp = crop(m_disparity, bbox);
+  for (int row = 0; row < disp.rows(); row++){
+    for (int col = 0; col < disp.cols(); col++){
+      int c = col + bbox.min().x() - box.min().x(), r = row + bbox.min().y() - box.min().y();
+      if (!right_valid(c, r) || dust(c, r).v() > m_kernel_size)
+        disp(col, row).invalidate();
+    }
+  }
+
+  return prerasterize_type(disp, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+}
+
+PhotometricOutlierView
+asp::photometric_outlier_view(ImageViewRef<PixelGray<float> > const& left,
+                              ImageViewRef<PixelGray<float> > const& right,
+                              ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                              int kernel_size){
+  float thresh = photometric_outlier_threshold(left, right, disparity);
+  vw_out() << "\t  Using photometric outlier threshold: " << thresh << "\n";
+  return PhotometricOutlierView(left, right, disparity, thresh, kernel_size);
+}
+
 void asp::photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                          std::string const& prefix,
                                          std::string const& input_disparity,
                                          std::string & output_disparity,
                                          int kernel_size ) {
-  // Projecting right into perspective of left
-  DiskImageView<PixelGray<float> > right_disk_image(prefix+"-R.tif");
-  DiskImageView<PixelMask<Vector2f> > disparity_disk_image( input_disparity );
-  stereo::DisparityTransform trans( disparity_disk_image );
 
-  std::string cache_dir = "/tmp"; // modify here to use a different cache dir if needed
-  if (!fs::is_directory(cache_dir)) {
-    vw_out() << "\nCreating cache directory: " << cache_dir << std::endl;
-    fs::create_directories(cache_dir);
-  }
-
-  DiskCacheImageView<PixelGray<float> >
-    right_proj( transform( right_disk_image, trans, ZeroEdgeExtension() ), "tif", TerminalProgressCallback("asp","Projecting R:"), cache_dir);
-
-  // Differencing Left and Projected Right
-  ImageViewRef<PixelMask<PixelGray<float32> > > right_mask =
-    create_mask(right_proj);
-  DiskImageView<PixelGray<float32> > left_image(prefix+"-L.tif");
-  DiskCacheImageView<PixelGray<float> >
-    diff( abs(apply_mask(copy_mask(left_image,right_mask))-right_proj),
-          "tif", TerminalProgressCallback("asp","\tDifference:"),
-          cache_dir);
-  ChannelAccumulator<math::CDFAccumulator<float32> > cdf;
-  cdf.resize(8000,2001);
-  for_each_pixel(diff, cdf);
-  float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
-  vw_out() << "\t  Using threshold: " << thresh << "\n";
-
-  // Thresholding image and dilating
-  ImageView<PixelGray<float> > dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
-  ImageView<PixelGray<float> > grass;
-  grassfire(dust,grass);
-  dust = gaussian_filter(grass,kernel_size/3);
-
-  ImageViewRef<PixelMask<Vector2f > > cleaned_disparity =
-    intersect_mask(disparity_disk_image,
-                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),right_mask));
+  DiskImageView<PixelGray<float> >    left_image (prefix+"-L.tif");
+  DiskImageView<PixelGray<float> >    right_image(prefix+"-R.tif");
+  DiskImageView<PixelMask<Vector2f> > disparity_disk_image( input_disparity );
 
-  vw::cartography::block_write_gdal_image( prefix+"-FDust.tif",
-                          cleaned_disparity, opt,
-                          TerminalProgressCallback("asp","Dust Removal:") );
+  output_disparity = prefix + "-FDust.tif";
+  vw::cartography::block_write_gdal_image( output_disparity,
+                          photometric_outlier_view(left_image, right_image,
+                                                   disparity_disk_image, kernel_size),
+                          opt, TerminalProgressCallback("asp","Dust Removal:") );
 }
@@ -23,6 +23,12 @@
 #ifndef __STEREO_CORE_PHOTOMETRIC_OUTLIER_H__
 #define __STEREO_CORE_PHOTOMETRIC_OUTLIER_H__
 
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Image/ProceduralPixelAccessor.h>
+#include <vw/Image/Manipulation.h>
 #include <string>
 
 // Forward declaration
@@ -33,6 +39,64 @@ namespace vw{
 }
 
 namespace asp {
+
+  /// The threshold on the difference between the left image and the
+  /// right image projected with the disparity above which a pixel is
+  /// an outlier, as a quantile of the differences. It is estimated
+  /// from a regular sample of at most 'max_tiles' tiles, rather than
+  /// from a pass over the whole image.
+  float photometric_outlier_threshold(vw::ImageViewRef<vw::PixelGray<float> > const& left,
+                                      vw::ImageViewRef<vw::PixelGray<float> > const& right,
+                                      vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity,
+                                      double quantile = 0.99985, int max_tiles = 200);
+
+  /// Invalidate the disparity where the left image and the right one
+  /// projected with the disparity differ by more than the threshold,
+  /// with these dust regions grown by a blur of about kernel_size.
+  /// This is computed lazily, one tile at a time. Each tile reads a
+  /// margin around it large enough that the result is the same as
+  /// when processing the whole image at once.
+  class PhotometricOutlierView: public vw::ImageViewBase<PhotometricOutlierView> {
+    vw::ImageViewRef<vw::PixelGray<float> >        m_left, m_right;
+    vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > m_disparity;
+    float m_threshold;
+    int   m_kernel_size;
+  public:
+    PhotometricOutlierView(vw::ImageViewRef<vw::PixelGray<float> > const& left,
+                           vw::ImageViewRef<vw::PixelGray<float> > const& right,
+                           vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity,
+                           float threshold, int kernel_size);
+
+    typedef vw::PixelMask<vw::Vector2f> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<PhotometricOutlierView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_disparity.cols(); }
+    inline vw::int32 rows  () const { return m_disparity.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    pixel_type operator()(double /*i*/, double /*j*/, vw::int32 /*p*/ = 0) const;
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const;
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Make the above view, finding the threshold from a sample.
+  PhotometricOutlierView
+  photometric_outlier_view(vw::ImageViewRef<vw::PixelGray<float> > const& left,
+                           vw::ImageViewRef<vw::PixelGray<float> > const& right,
+                           vw::ImageViewRef<vw::PixelMask<vw::Vector2f> > const& disparity,
+                           int kernel_size);
+
+  /// Write the disparity cleaned with the above to <prefix>-FDust.tif,
+  /// and return that file name in output_disparity.
   void photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                       std::string const& prefix,
                                       std::string const& input_disparity,
@@ -93,13 +93,46 @@ void Point2Grid::Clear(const float value) {
 
   // For these we need to keep all values (in fact, for stddev we could get away with less,
   // but it is not worth trying so hard).
+  m_chunks.clear();
   if (m_filter == f_median || m_filter == f_stddev ||
       m_filter == f_nmad || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
+    m_last_chunk.set_size(m_width, m_height);
+    m_num_vals.set_size(m_width, m_height);
+    for (int c = 0; c < m_width; c++){
+      for (int r = 0; r < m_height; r++){
+        m_last_chunk(c, r) = -1;
+        m_num_vals  (c, r) = 0;
+      }
+    }
   }
   
 }
 
+void Point2Grid::add_val(int ix, int iy, double z){
+  int pos = m_num_vals(ix, iy) % VALS_PER_CHUNK;
+  if (pos == 0) {
+    // The last chunk is full, or there is none yet
+    ValChunk chunk;
+    chunk.prev = m_last_chunk(ix, iy);
+    m_chunks.push_back(chunk);
+    m_last_chunk(ix, iy) = m_chunks.size() - 1;
+  }
+  m_chunks[m_last_chunk(ix, iy)].vals[pos] = z;
+  m_num_vals(ix, iy)++;
+}
+
+std::vector<double> & Point2Grid::cell_vals(int ix, int iy){
+  m_cell_vals.clear();
+  int num = m_num_vals(ix, iy);
+  int len = num % VALS_PER_CHUNK;
+  if (len == 0) len = VALS_PER_CHUNK; // the last chunk is full
+  for (vw::int32 k = m_last_chunk(ix, iy); k >= 0; k = m_chunks[k].prev) {
+    m_cell_vals.insert(m_cell_vals.end(), m_chunks[k].vals, m_chunks[k].vals + len);
+    len = VALS_PER_CHUNK; // all but the last chunk are full
+  }
+  return m_cell_vals;
+}
+
 void Point2Grid::AddPoint(double x, double y, double z){
 
   int minx = std::max( (int)ceil( (x - m_radius - m_x0)/m_grid_size ), 0 );
@@ -151,7 +184,7 @@ void Point2Grid::AddPoint(double x, double y, double z){
         
       }else if (m_filter == f_stddev || m_filter == f_median ||
                 m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+        add_val(ix, iy, z); // not strictly needed for stddev
       }
       
     }
@@ -171,37 +204,42 @@ void Point2Grid::normalize(){
         m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
 
       else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
+        if (m_num_vals(c, r) == 0)
           continue; // nothing to compute
+        std::vector<double> & vals = cell_vals(c, r);
         vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < vals.size(); it++) 
+          V(vals[it]);
         m_buffer(c, r) = V.value();
       }
       
       else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
+        if (m_num_vals(c, r) == 0)
           continue; // nothing to compute
+        std::vector<double> & vals = cell_vals(c, r);
         vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < vals.size(); it++) 
+          V(vals[it]);
         m_buffer(c, r) = V.value();
       }
 
       else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
+        if (m_num_vals(c, r) == 0)
           continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+        m_buffer(c, r) = vw::math::destructive_nmad(cell_vals(c, r));
       }
       
       else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
+        if (m_num_vals(c, r) == 0)
           continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+        m_buffer(c, r) = vw::math::destructive_percentile(cell_vals(c, r), m_percentile);
       }
       
     }
   }
+
+  // The individual values are no longer needed
+  std::vector<ValChunk>().swap(m_chunks);
 }
   
 } // end namespace asp
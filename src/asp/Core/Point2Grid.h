@@ -23,6 +23,7 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <vector>
 
 namespace asp {
 
@@ -48,7 +49,24 @@ namespace asp {
     int m_width, m_height; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+
+    // When we need to keep all individual values, they are stored in
+    // a shared pool of small chunks, rather than in a vector for each
+    // grid point. Each grid point knows its last chunk, and each chunk
+    // knows the one before it. This avoids a heap allocation per grid
+    // point, and the memory overhead that goes with it.
+    static const int VALS_PER_CHUNK = 8;
+    struct ValChunk {
+      double     vals[VALS_PER_CHUNK];
+      vw::int32  prev; // index of the previous chunk, or -1
+    };
+    std::vector<ValChunk>     m_chunks;
+    vw::ImageView<vw::int32>  m_last_chunk; // -1 if there are no values
+    vw::ImageView<vw::int32>  m_num_vals;
+    std::vector<double>       m_cell_vals; // the values at one grid point, reused
+
+    void add_val(int ix, int iy, double z);
+    std::vector<double> & cell_vals(int ix, int iy); // valid until the next call
     double m_x0, m_y0; // lower-left corner
     double m_grid_size;  // spacing between output DEM pixels
     double m_radius;   // how far to search for cloud points
@@ -0,0 +1,308 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudStats.cc
+///
+
+#include <asp/Core/PointCloudStats.h>
+#include <vw/Core/Log.h>
+#include <vw/config.h>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal_priv.h>
+#endif
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // The metadata items of the cloud
+  const char* NUM_POINTS_TAG  = "POINT_CLOUD_NUM_POINTS";
+  const char* BBOX_TAG        = "POINT_CLOUD_BBOX";
+  const char* MEAN_POINT_TAG  = "POINT_CLOUD_MEAN_POINT";
+  const char* MEAN_LON_TAG    = "POINT_CLOUD_MEAN_LON";
+  const char* ERROR_RANGE_TAG = "POINT_CLOUD_ERROR_RANGE";
+
+  const std::string STATS_HEADER = "# ASP point cloud statistics, version 1";
+
+  std::string to_string(double const* vals, int num) {
+    std::ostringstream os;
+    os.precision(17);
+    for (int i = 0; i < num; i++)
+      os << (i > 0 ? " " : "") << vals[i];
+    return os.str();
+  }
+
+  bool from_string(std::string const& str, double * vals, int num) {
+    std::istringstream is(str);
+    for (int i = 0; i < num; i++) {
+      if (!(is >> vals[i]))
+        return false;
+    }
+    return true;
+  }
+
+  /// The size and modification time of the file, which the text file
+  /// must have been made for.
+  bool file_stamp(std::string const& file, uint64 & size, uint64 & mtime) {
+    boost::system::error_code ec;
+    size = fs::file_size(file, ec);
+    if (ec)
+      return false;
+    std::time_t t = fs::last_write_time(file, ec);
+    if (ec)
+      return false;
+    mtime = uint64(t);
+    return true;
+  }
+
+  /// The statistics of the cloud from its metadata. The means are made
+  /// into sums again.
+  bool read_stats_metadata(std::string const& cloud_file, PointCloudStats & stats) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+    GDALAllRegister();
+    GDALDataset* dataset = static_cast<GDALDataset*>(GDALOpen(cloud_file.c_str(), GA_ReadOnly));
+    if (dataset == NULL)
+      return false;
+    const char* num_points = dataset->GetMetadataItem(NUM_POINTS_TAG, NULL);
+    const char* bbox       = dataset->GetMetadataItem(BBOX_TAG,        NULL);
+    const char* mean_point = dataset->GetMetadataItem(MEAN_POINT_TAG,  NULL);
+    const char* mean_lon   = dataset->GetMetadataItem(MEAN_LON_TAG,    NULL);
+    const char* err_range  = dataset->GetMetadataItem(ERROR_RANGE_TAG, NULL);
+    double n = 0, box[6], mean[3], lon = 0, err[2];
+    bool ok = num_points && bbox && mean_point && mean_lon && err_range &&
+      from_string(num_points, &n, 1) && from_string(bbox, box, 6) &&
+      from_string(mean_point, mean, 3) && from_string(mean_lon, &lon, 1) &&
+      from_string(err_range, err, 2);
+    GDALClose(dataset);
+    if (!ok)
+      return false;
+
+    stats = PointCloudStats();
+    stats.num_points = uint64(n);
+    if (stats.num_points > 0)
+      stats.bbox = BBox3(Vector3(box[0], box[1], box[2]), Vector3(box[3], box[4], box[5]));
+    stats.sum_points = double(stats.num_points)*Vector3(mean[0], mean[1], mean[2]);
+    stats.sum_lon    = double(stats.num_points)*lon;
+    stats.min_error  = err[0];
+    stats.max_error  = err[1];
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void write_stats_metadata(std::string const& cloud_file, PointCloudStats const& stats) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+    GDALAllRegister();
+    GDALDataset* dataset = static_cast<GDALDataset*>(GDALOpen(cloud_file.c_str(), GA_Update));
+    if (dataset == NULL) {
+      vw_out(WarningMessage) << "Could not save the point cloud statistics in: "
+                             << cloud_file << "\n";
+      return;
+    }
+    double n = double(stats.num_points), lon = stats.mean_lon();
+    Vector3 mean = stats.mean_point();
+    double box[6] = {0, 0, 0, 0, 0, 0};
+    if (stats.num_points > 0) {
+      for (int i = 0; i < 3; i++) {
+        box[i]     = stats.bbox.min()[i];
+        box[i + 3] = stats.bbox.max()[i];
+      }
+    }
+    double err[2] = {stats.min_error, stats.max_error};
+    dataset->SetMetadataItem(NUM_POINTS_TAG,  to_string(&n, 1).c_str(),       NULL);
+    dataset->SetMetadataItem(BBOX_TAG,        to_string(box, 6).c_str(),      NULL);
+    dataset->SetMetadataItem(MEAN_POINT_TAG,  to_string(&mean[0], 3).c_str(), NULL);
+    dataset->SetMetadataItem(MEAN_LON_TAG,    to_string(&lon, 1).c_str(),     NULL);
+    dataset->SetMetadataItem(ERROR_RANGE_TAG, to_string(err, 2).c_str(),      NULL);
+    GDALClose(dataset);
+#endif
+  }
+
+} // end anonymous namespace
+
+Vector3 PointCloudStats::mean_point() const {
+  if (num_points == 0)
+    return Vector3();
+  return sum_points/double(num_points);
+}
+
+double PointCloudStats::mean_lon() const {
+  if (num_points == 0)
+    return 0.0;
+  return sum_lon/double(num_points);
+}
+
+void PointCloudStats::add(Vector3 const& point, double error) {
+  if (num_points == 0) {
+    min_error = error;
+    max_error = error;
+  } else {
+    min_error = std::min(min_error, error);
+    max_error = std::max(max_error, error);
+  }
+  num_points++;
+  bbox.grow(point);
+  sum_points += point;
+  sum_lon    += std::atan2(point[1], point[0])*180.0/M_PI;
+}
+
+void PointCloudStats::merge(PointCloudStats const& other) {
+  if (other.num_points == 0)
+    return;
+  if (num_points == 0) {
+    min_error = other.min_error;
+    max_error = other.max_error;
+  } else {
+    min_error = std::min(min_error, other.min_error);
+    max_error = std::max(max_error, other.max_error);
+  }
+  num_points += other.num_points;
+  bbox.grow(other.bbox);
+  sum_points += other.sum_points;
+  sum_lon    += other.sum_lon;
+  tiles.insert(tiles.end(), other.tiles.begin(), other.tiles.end());
+}
+
+PointCloudStats PointCloudStatsAccumulator::result() const {
+  Mutex::Lock lock(m_mutex);
+  PointCloudStats stats;
+  for (std::map<TileKey, PointCloudStats>::const_iterator it = m_tiles.begin();
+       it != m_tiles.end(); it++)
+    stats.merge(it->second);
+  return stats;
+}
+
+std::string point_cloud_stats_file(std::string const& cloud_file) {
+  return fs::path(cloud_file).replace_extension("").string() + "-stats.txt";
+}
+
+void write_point_cloud_stats(std::string const& cloud_file, PointCloudStats const& stats) {
+
+  // The metadata goes first, as saving it changes the cloud file
+  write_stats_metadata(cloud_file, stats);
+
+  uint64 size = 0, mtime = 0;
+  if (!file_stamp(cloud_file, size, mtime)) {
+    vw_out(WarningMessage) << "Could not find the point cloud: " << cloud_file << "\n";
+    return;
+  }
+
+  std::string stats_file = point_cloud_stats_file(cloud_file);
+  std::ofstream ofs(stats_file.c_str());
+  ofs.precision(17);
+  double n = double(stats.num_points);
+  double box[6] = {0, 0, 0, 0, 0, 0};
+  if (stats.num_points > 0) {
+    for (int i = 0; i < 3; i++) {
+      box[i]     = stats.bbox.min()[i];
+      box[i + 3] = stats.bbox.max()[i];
+    }
+  }
+  double err[2] = {stats.min_error, stats.max_error};
+  ofs << STATS_HEADER << "\n"
+      << "cloud_size "  << size  << "\n"
+      << "cloud_mtime " << mtime << "\n"
+      << "num_points "  << to_string(&n, 1) << "\n"
+      << "bbox "        << to_string(box, 6) << "\n"
+      << "sum_points "  << to_string(&stats.sum_points[0], 3) << "\n"
+      << "sum_lon "     << to_string(&stats.sum_lon, 1) << "\n"
+      << "error_range " << to_string(err, 2) << "\n"
+      << "num_tiles "   << stats.tiles.size() << "\n";
+  for (size_t t = 0; t < stats.tiles.size(); t++) {
+    BBox2i const& pix = stats.tiles[t].first;
+    BBox3  const& pts = stats.tiles[t].second;
+    ofs << pix.min().x() << " " << pix.min().y() << " "
+        << pix.width()   << " " << pix.height()  << " "
+        << pts.min().x() << " " << pts.min().y() << " " << pts.min().z() << " "
+        << pts.max().x() << " " << pts.max().y() << " " << pts.max().z() << "\n";
+  }
+  if (!ofs.good())
+    vw_out(WarningMessage) << "Could not write: " << stats_file << "\n";
+}
+
+bool read_point_cloud_stats(std::string const& cloud_file, PointCloudStats & stats) {
+
+  std::ifstream ifs(point_cloud_stats_file(cloud_file).c_str());
+  uint64 size = 0, mtime = 0;
+  if (ifs.good() && file_stamp(cloud_file, size, mtime)) {
+    std::string header, key;
+    uint64 file_size = 0, file_mtime = 0;
+    double n = 0, box[6], sums[3], lon = 0, err[2];
+    size_t num_tiles = 0;
+    std::getline(ifs, header);
+    bool ok = (header == STATS_HEADER) &&
+      (ifs >> key >> file_size) && (ifs >> key >> file_mtime) &&
+      file_size == size && file_mtime == mtime &&
+      (ifs >> key >> n) &&
+      (ifs >> key >> box[0] >> box[1] >> box[2] >> box[3] >> box[4] >> box[5]) &&
+      (ifs >> key >> sums[0] >> sums[1] >> sums[2]) &&
+      (ifs >> key >> lon) && (ifs >> key >> err[0] >> err[1]) &&
+      (ifs >> key >> num_tiles);
+    PointCloudStats file_stats;
+    for (size_t t = 0; ok && t < num_tiles; t++) {
+      int c, r, w, h;
+      double p[6];
+      ok = bool(ifs >> c >> r >> w >> h >> p[0] >> p[1] >> p[2] >> p[3] >> p[4] >> p[5]);
+      if (ok)
+        file_stats.tiles.push_back(std::make_pair(BBox2i(c, r, w, h),
+                                                  BBox3(Vector3(p[0], p[1], p[2]),
+                                                        Vector3(p[3], p[4], p[5]))));
+    }
+    if (ok) {
+      file_stats.num_points = uint64(n);
+      if (file_stats.num_points > 0)
+        file_stats.bbox = BBox3(Vector3(box[0], box[1], box[2]), Vector3(box[3], box[4], box[5]));
+      file_stats.sum_points = Vector3(sums[0], sums[1], sums[2]);
+      file_stats.sum_lon    = lon;
+      file_stats.min_error  = err[0];
+      file_stats.max_error  = err[1];
+      stats = file_stats;
+      return true;
+    }
+  }
+
+  return read_stats_metadata(cloud_file, stats);
+}
+
+bool read_point_cloud_stats(std::vector<std::string> const& cloud_files,
+                            PointCloudStats & stats) {
+  PointCloudStats all;
+  for (size_t i = 0; i < cloud_files.size(); i++) {
+    PointCloudStats file_stats;
+    if (!read_point_cloud_stats(cloud_files[i], file_stats))
+      return false;
+    file_stats.tiles.clear(); // The pixels of different clouds do not go together
+    all.merge(file_stats);
+  }
+  stats = all;
+  return !cloud_files.empty();
+}
+
+} // namespace asp
@@ -0,0 +1,181 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudStats.h
+///
+/// Statistics of a point cloud which stereo_tri finds while writing it,
+/// so that the tools reading the cloud need not make a pass over it
+/// first to find them: the number of valid points, their bounding box
+/// and mean, the mean longitude, and the range of the triangulation
+/// error, as well as the bounding box of the points of each tile.
+///
+/// The statistics of the whole cloud are saved in the metadata of the
+/// cloud, and, together with those of the tiles, in a text file next to
+/// it, named as given by point_cloud_stats_file(). The text file is only
+/// used with the cloud it was made for, of the same size and
+/// modification time. The coordinates are cartesian, without the shift
+/// the cloud is saved with.
+
+#ifndef __ASP_CORE_POINT_CLOUD_STATS_H__
+#define __ASP_CORE_POINT_CLOUD_STATS_H__
+
+#include <asp/Core/PointCloudTypes.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asp {
+
+  struct PointCloudStats {
+    vw::uint64  num_points;
+    vw::BBox3   bbox;
+    vw::Vector3 sum_points;           ///< For the mean point
+    double      sum_lon;              ///< For the mean longitude, in degrees
+    double      min_error, max_error; ///< Zero if the cloud has no error channels
+
+    /// The pixel box and point bounding box of each tile having points
+    std::vector< std::pair<vw::BBox2i, vw::BBox3> > tiles;
+
+    PointCloudStats(): num_points(0), sum_lon(0.0), min_error(0.0), max_error(0.0) {}
+
+    vw::Vector3 mean_point() const;
+    double      mean_lon()   const;
+
+    /// Add a valid point, that is, not the zero one
+    void add(vw::Vector3 const& point, double error);
+
+    /// Add the statistics of another cloud, or of another part of this
+    /// one. The tiles are added as they are.
+    void merge(PointCloudStats const& other);
+  };
+
+  /// Collects the statistics of the tiles of a cloud as they are
+  /// rasterized, from any thread. A tile rasterized again replaces
+  /// what was found for it before.
+  class PointCloudStatsAccumulator {
+  public:
+    template <class VecT>
+    void add_tile(vw::BBox2i const& bbox, vw::ImageView<VecT> const& tile);
+
+    /// The statistics of the tiles so far, with the tiles in row order
+    PointCloudStats result() const;
+
+  private:
+    typedef std::pair<int, int> TileKey; // row, then column
+    mutable vw::Mutex                  m_mutex;
+    std::map<TileKey, PointCloudStats> m_tiles;
+  };
+
+  /// The cloud as it is, collecting the statistics of each tile of it
+  /// which is rasterized.
+  template <class ImageT>
+  class PointCloudStatsView: public vw::ImageViewBase< PointCloudStatsView<ImageT> > {
+    ImageT m_cloud;
+    boost::shared_ptr<PointCloudStatsAccumulator> m_accum;
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<PointCloudStatsView> pixel_accessor;
+
+    PointCloudStatsView(ImageT const& cloud,
+                        boost::shared_ptr<PointCloudStatsAccumulator> accum):
+      m_cloud(cloud), m_accum(accum) {}
+
+    inline vw::int32 cols  () const { return m_cloud.cols(); }
+    inline vw::int32 rows  () const { return m_cloud.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      return m_cloud(col, row);
+    }
+
+    typedef vw::CropView< vw::ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> tile = vw::crop(m_cloud, bbox);
+      m_accum->add_tile(bbox, tile);
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  PointCloudStatsView<ImageT>
+  point_cloud_stats_view(vw::ImageViewBase<ImageT> const& cloud,
+                         boost::shared_ptr<PointCloudStatsAccumulator> accum) {
+    return PointCloudStatsView<ImageT>(cloud.impl(), accum);
+  }
+
+  /// The text file with the statistics of the given cloud
+  std::string point_cloud_stats_file(std::string const& cloud_file);
+
+  /// Save the statistics in the metadata of the cloud, if it is a
+  /// GeoTIFF, and then in the text file next to it. A failure is only
+  /// a warning.
+  void write_point_cloud_stats(std::string const& cloud_file, PointCloudStats const& stats);
+
+  /// Read the statistics of the cloud, from the text file if it is
+  /// there and made for this cloud, or else from the metadata of the
+  /// cloud, and then without the tiles. Return false if there are none.
+  bool read_point_cloud_stats(std::string const& cloud_file, PointCloudStats & stats);
+
+  /// The statistics of all the clouds together, without the tiles.
+  /// Return false unless each of them has them.
+  bool read_point_cloud_stats(std::vector<std::string> const& cloud_files,
+                              PointCloudStats & stats);
+
+  //----------------------------------------------------------------------
+  // Template function definitions
+
+  template <class VecT>
+  void PointCloudStatsAccumulator::add_tile(vw::BBox2i const& bbox,
+                                            vw::ImageView<VecT> const& tile) {
+    PointCloudStats stats;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        vw::Vector3 xyz = cloud_point(tile(col, row));
+        if (xyz == vw::Vector3())
+          continue; // no-data
+        stats.add(xyz, cloud_point_error(tile(col, row)));
+      }
+    }
+    if (stats.num_points > 0)
+      stats.tiles.push_back(std::make_pair(bbox, stats.bbox));
+
+    vw::Mutex::Lock lock(m_mutex);
+    m_tiles[TileKey(bbox.min().y(), bbox.min().x())] = stats;
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_POINT_CLOUD_STATS_H__
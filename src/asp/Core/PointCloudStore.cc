@@ -0,0 +1,257 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudStore.cc
+///
+
+#include <asp/Core/PointCloudStore.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <cmath>
+#include <map>
+
+using namespace vw;
+
+namespace {
+
+  double g_store_resolution = 0.0;
+
+  vw::Mutex g_store_mutex;
+  std::map<std::string, boost::shared_ptr<asp::CompressedPointCloud> > g_stored_clouds;
+
+  // Signed integers as unsigned ones, small in magnitude to small
+  void put_varint(boost::int64_t value, std::vector<unsigned char> & bytes) {
+    boost::uint64_t u = (boost::uint64_t(value) << 1) ^ boost::uint64_t(value >> 63);
+    while (u >= 0x80) {
+      bytes.push_back((unsigned char)(u | 0x80));
+      u >>= 7;
+    }
+    bytes.push_back((unsigned char)u);
+  }
+
+  boost::int64_t get_varint(const unsigned char * & ptr) {
+    boost::uint64_t u = 0;
+    int shift = 0;
+    while (*ptr & 0x80) {
+      u |= boost::uint64_t(*ptr & 0x7f) << shift;
+      shift += 7;
+      ptr++;
+    }
+    u |= boost::uint64_t(*ptr) << shift;
+    ptr++;
+    return boost::int64_t(u >> 1) ^ -boost::int64_t(u & 1);
+  }
+
+  // Predict a value from the previous ones in the row, or, for the
+  // first one, from the first one of the row above.
+  struct Predictor {
+    boost::int64_t prev1, prev2, row_start;
+    int count;
+    Predictor(): prev1(0), prev2(0), row_start(0), count(0) {}
+    void new_row() { count = 0; }
+    boost::int64_t predict() const {
+      if (count == 0) return row_start;
+      if (count == 1) return prev1;
+      return 2*prev1 - prev2;
+    }
+    void update(boost::int64_t value) {
+      if (count == 0) row_start = value;
+      prev2 = prev1;
+      prev1 = value;
+      count++;
+    }
+  };
+
+  const int NUM_XYZ = 3; // the channels stored relative to the tile origin
+}
+
+namespace asp {
+
+  void set_point_cloud_store_resolution(double resolution) {
+    if (resolution < 0)
+      vw_throw(ArgumentErr() << "The resolution of the point clouds kept in memory "
+                             << "must not be negative.\n");
+    g_store_resolution = resolution;
+  }
+
+  double point_cloud_store_resolution() {
+    return g_store_resolution;
+  }
+
+  CompressedPointCloud::CompressedPointCloud(int cols, int rows, int num_channels,
+                                             double resolution, int tile_size):
+    m_cols(cols), m_rows(rows), m_num_channels(num_channels), m_tile_size(tile_size),
+    m_tiles_per_row((cols + tile_size - 1)/tile_size), m_resolution(resolution) {
+    VW_ASSERT(num_channels >= NUM_XYZ && num_channels <= 6,
+              ArgumentErr() << "A point cloud must have 3 to 6 channels.\n");
+    VW_ASSERT(resolution > 0 && tile_size > 0,
+              ArgumentErr() << "Invalid resolution or tile size for a compressed point cloud.\n");
+    m_tiles.resize(size_t(m_tiles_per_row)*((rows + tile_size - 1)/tile_size));
+  }
+
+  BBox2i CompressedPointCloud::tile_box(Vector2i const& corner) const {
+    return BBox2i(corner.x(), corner.y(), std::min(m_tile_size, m_cols - corner.x()),
+                  std::min(m_tile_size, m_rows - corner.y()));
+  }
+
+  int CompressedPointCloud::tile_index(Vector2i const& corner) const {
+    VW_ASSERT(corner.x() % m_tile_size == 0 && corner.y() % m_tile_size == 0 &&
+              corner.x() >= 0 && corner.x() < m_cols && corner.y() >= 0 && corner.y() < m_rows,
+              ArgumentErr() << "Not the corner of a tile: " << corner << "\n");
+    return (corner.y()/m_tile_size)*m_tiles_per_row + corner.x()/m_tile_size;
+  }
+
+  void CompressedPointCloud::set_tile(Vector2i const& corner, std::vector<double> const& values) {
+
+    BBox2i box = tile_box(corner);
+    int num_pixels = box.width()*box.height(), n = m_num_channels;
+    VW_ASSERT(values.size() == size_t(n)*num_pixels,
+              ArgumentErr() << "Wrong number of values in a point cloud tile.\n");
+
+    // Which points are valid
+    std::vector<unsigned char> bytes((num_pixels + 7)/8, 0);
+    std::vector<bool> valid(num_pixels, false);
+    int first_valid = -1;
+    for (int k = 0; k < num_pixels; k++) {
+      const double * v = &values[n*size_t(k)];
+      bool is_zero = true, is_finite = true;
+      for (int c = 0; c < n; c++)
+        is_finite = is_finite && boost::math::isfinite(v[c]);
+      for (int c = 0; c < NUM_XYZ; c++)
+        is_zero = is_zero && (v[c] == 0);
+      valid[k] = (is_finite && !is_zero);
+      if (valid[k]) {
+        bytes[k/8] |= (1 << (k % 8));
+        if (first_valid < 0)
+          first_valid = k;
+      }
+    }
+
+    // The origin of the tile
+    double origin[NUM_XYZ] = {0, 0, 0};
+    if (first_valid >= 0) {
+      for (int c = 0; c < NUM_XYZ; c++)
+        origin[c] = m_resolution*std::floor(values[n*size_t(first_valid) + c]/m_resolution + 0.5);
+    }
+    const unsigned char * origin_bytes = reinterpret_cast<const unsigned char*>(origin);
+    bytes.insert(bytes.end(), origin_bytes, origin_bytes + sizeof(origin));
+
+    // The rounded values, as differences from their predictions
+    std::vector<Predictor> predictors(n);
+    for (int row = 0; row < box.height(); row++) {
+      for (int c = 0; c < n; c++)
+        predictors[c].new_row();
+      for (int col = 0; col < box.width(); col++) {
+        int k = row*box.width() + col;
+        if (!valid[k])
+          continue;
+        for (int c = 0; c < n; c++) {
+          double v = values[n*size_t(k) + c];
+          if (c < NUM_XYZ)
+            v -= origin[c];
+          boost::int64_t q = boost::int64_t(std::floor(v/m_resolution + 0.5));
+          put_varint(q - predictors[c].predict(), bytes);
+          predictors[c].update(q);
+        }
+      }
+    }
+
+    std::vector<unsigned char> & tile = m_tiles[tile_index(corner)];
+    tile.swap(bytes);
+    std::vector<unsigned char>(tile).swap(tile); // release the extra capacity
+  }
+
+  boost::shared_ptr<const std::vector<double> >
+  CompressedPointCloud::get_tile(Vector2i const& corner) const {
+
+    int index = tile_index(corner);
+    {
+      vw::Mutex::Lock lock(m_mutex);
+      for (DecodedList::iterator it = m_decoded.begin(); it != m_decoded.end(); it++) {
+        if (it->first == index) {
+          m_decoded.splice(m_decoded.begin(), m_decoded, it);
+          return it->second;
+        }
+      }
+    }
+
+    BBox2i box = tile_box(corner);
+    int num_pixels = box.width()*box.height(), n = m_num_channels;
+    boost::shared_ptr<std::vector<double> > values(new std::vector<double>(size_t(n)*num_pixels, 0.0));
+
+    std::vector<unsigned char> const& tile = m_tiles[index];
+    if (!tile.empty()) { // else never set, so no-data
+      const unsigned char * bitmap = &tile[0];
+      double origin[NUM_XYZ];
+      std::copy(&tile[(num_pixels + 7)/8], &tile[(num_pixels + 7)/8] + sizeof(origin),
+                reinterpret_cast<unsigned char*>(origin));
+      const unsigned char * ptr = &tile[(num_pixels + 7)/8] + sizeof(origin);
+
+      std::vector<Predictor> predictors(n);
+      for (int row = 0; row < box.height(); row++) {
+        for (int c = 0; c < n; c++)
+          predictors[c].new_row();
+        for (int col = 0; col < box.width(); col++) {
+          int k = row*box.width() + col;
+          if (!(bitmap[k/8] & (1 << (k % 8))))
+            continue;
+          for (int c = 0; c < n; c++) {
+            boost::int64_t q = predictors[c].predict() + get_varint(ptr);
+            predictors[c].update(q);
+            double v = q*m_resolution;
+            if (c < NUM_XYZ)
+              v += origin[c];
+            (*values)[n*size_t(k) + c] = v;
+          }
+        }
+      }
+    }
+
+    // Keep a few tiles for each thread
+    size_t max_decoded = std::max(4, 2*vw_settings().default_num_threads());
+    vw::Mutex::Lock lock(m_mutex);
+    m_decoded.push_front(std::make_pair(index, boost::shared_ptr<const std::vector<double> >(values)));
+    while (m_decoded.size() > max_decoded)
+      m_decoded.pop_back();
+    return values;
+  }
+
+  size_t CompressedPointCloud::size() const {
+    size_t bytes = 0;
+    for (size_t t = 0; t < m_tiles.size(); t++)
+      bytes += m_tiles[t].size();
+    return bytes;
+  }
+
+  boost::shared_ptr<CompressedPointCloud> find_stored_point_cloud(std::string const& filename) {
+    vw::Mutex::Lock lock(g_store_mutex);
+    std::map<std::string, boost::shared_ptr<CompressedPointCloud> >::const_iterator it
+      = g_stored_clouds.find(filename);
+    if (it == g_stored_clouds.end())
+      return boost::shared_ptr<CompressedPointCloud>();
+    return it->second;
+  }
+
+  void add_stored_point_cloud(std::string const& filename,
+                              boost::shared_ptr<CompressedPointCloud> cloud) {
+    vw::Mutex::Lock lock(g_store_mutex);
+    g_stored_clouds[filename] = cloud;
+  }
+
+} // namespace asp
@@ -0,0 +1,212 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudStore.h
+///
+/// Keep point clouds in memory, compressed, so that tools which read a
+/// cloud several times, such as point2dem for the DEM, orthoimage and
+/// error images, read it from disk only once. The cloud is cut into
+/// tiles. In each tile the points are rounded to a given resolution
+/// relative to the first point of the tile, the error channels
+/// relative to zero, and each value is stored as the difference from
+/// its prediction by the two previous ones in the row, in as few bytes
+/// as it needs. A smooth cloud then takes a few bytes per point rather
+/// than 8 per channel. Tiles are decompressed when read.
+
+#ifndef __ASP_CORE_POINT_CLOUD_STORE_H__
+#define __ASP_CORE_POINT_CLOUD_STORE_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vw/Core/Thread.h>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Keep the clouds read with read_asp_point_cloud() in memory,
+  /// compressed, with the points rounded to this resolution, in
+  /// meters. Zero, the default, turns this off.
+  void set_point_cloud_store_resolution(double resolution);
+  double point_cloud_store_resolution();
+
+  /// A point cloud with up to 6 channels, compressed by tiles. A point
+  /// whose first three channels are zero, or not finite, is no-data,
+  /// and is read back as all zeros.
+  class CompressedPointCloud: private boost::noncopyable {
+  public:
+    CompressedPointCloud(int cols, int rows, int num_channels,
+                         double resolution, int tile_size);
+
+    int cols        () const { return m_cols; }
+    int rows        () const { return m_rows; }
+    int num_channels() const { return m_num_channels; }
+    int tile_size   () const { return m_tile_size; }
+
+    /// The tile which has the given corner, with the channels of each
+    /// pixel together. Tiles may be set from several threads at once.
+    void set_tile(vw::Vector2i const& corner, std::vector<double> const& values);
+
+    /// The values of the tile with the given corner, with the channels
+    /// of each pixel together. The most recently read tiles are kept
+    /// decompressed, so reading the pixels one by one is not slow.
+    boost::shared_ptr<const std::vector<double> > get_tile(vw::Vector2i const& corner) const;
+
+    /// The compressed size, in bytes
+    size_t size() const;
+
+  private:
+    int    m_cols, m_rows, m_num_channels, m_tile_size, m_tiles_per_row;
+    double m_resolution;
+    std::vector< std::vector<unsigned char> > m_tiles;
+
+    typedef std::list< std::pair<int, boost::shared_ptr<const std::vector<double> > > > DecodedList;
+    mutable DecodedList m_decoded; // the most recently used first
+    mutable vw::Mutex   m_mutex;
+
+    vw::BBox2i tile_box(vw::Vector2i const& corner) const;
+    int tile_index(vw::Vector2i const& corner) const;
+  };
+
+  /// Compress a cloud, reading its tiles in parallel
+  template <int n>
+  boost::shared_ptr<CompressedPointCloud>
+  compress_point_cloud(vw::ImageViewRef< vw::Vector<double, n> > const& cloud,
+                       double resolution, int tile_size = 256);
+
+  /// The first m channels of a compressed cloud, as an image, with m
+  /// at most the number of channels of the cloud. Only the
+  /// tiles which are needed are decompressed.
+  template <int m>
+  class CompressedPointCloudView:
+    public vw::ImageViewBase< CompressedPointCloudView<m> > {
+    boost::shared_ptr<CompressedPointCloud> m_cloud;
+  public:
+    typedef vw::Vector<double, m> pixel_type;
+    typedef pixel_type            result_type;
+    typedef vw::ProceduralPixelAccessor<CompressedPointCloudView> pixel_accessor;
+
+    CompressedPointCloudView(boost::shared_ptr<CompressedPointCloud> cloud): m_cloud(cloud) {}
+
+    inline vw::int32 cols  () const { return m_cloud->cols(); }
+    inline vw::int32 rows  () const { return m_cloud->rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      int ts = m_cloud->tile_size();
+      vw::Vector2i corner((col/ts)*ts, (row/ts)*ts);
+      boost::shared_ptr<const std::vector<double> > values = m_cloud->get_tile(corner);
+      int width = std::min(ts, cols() - corner.x());
+      const double * v = &(*values)[m_cloud->num_channels()
+                                    *(size_t(row - corner.y())*width + (col - corner.x()))];
+      result_type pix;
+      for (int c = 0; c < m; c++)
+        pix[c] = v[c];
+      return pix;
+    }
+
+    typedef vw::CropView< vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      int ts = m_cloud->tile_size(), n = m_cloud->num_channels();
+      for (int y = (bbox.min().y()/ts)*ts; y < bbox.max().y(); y += ts) {
+        for (int x = (bbox.min().x()/ts)*ts; x < bbox.max().x(); x += ts) {
+          boost::shared_ptr<const std::vector<double> > values
+            = m_cloud->get_tile(vw::Vector2i(x, y));
+          int width = std::min(ts, cols() - x);
+          vw::BBox2i inter(x, y, width, std::min(ts, rows() - y));
+          inter.crop(bbox);
+          for (int row = inter.min().y(); row < inter.max().y(); row++) {
+            for (int col = inter.min().x(); col < inter.max().x(); col++) {
+              const double * v = &(*values)[n*(size_t(row - y)*width + (col - x))];
+              pixel_type & pix = tile(col - bbox.min().x(), row - bbox.min().y());
+              for (int c = 0; c < m; c++)
+                pix[c] = v[c];
+            }
+          }
+        }
+      }
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// The compressed clouds, by file name, so each is read once
+  boost::shared_ptr<CompressedPointCloud> find_stored_point_cloud(std::string const& filename);
+  void add_stored_point_cloud(std::string const& filename,
+                              boost::shared_ptr<CompressedPointCloud> cloud);
+
+  // Compress one tile of a cloud
+  template <int n>
+  class CompressTileTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef< vw::Vector<double, n> > m_cloud;
+    CompressedPointCloud & m_store;
+    vw::BBox2i             m_box;
+  public:
+    CompressTileTask(vw::ImageViewRef< vw::Vector<double, n> > const& cloud,
+                     CompressedPointCloud & store, vw::BBox2i const& box):
+      m_cloud(cloud), m_store(store), m_box(box) {}
+    void operator()() {
+      vw::ImageView< vw::Vector<double, n> > tile = vw::crop(m_cloud, m_box);
+      std::vector<double> values(size_t(n)*tile.cols()*tile.rows());
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          for (int c = 0; c < n; c++)
+            values[n*(size_t(row)*tile.cols() + col) + c] = tile(col, row)[c];
+      m_store.set_tile(m_box.min(), values);
+    }
+  };
+
+  template <int n>
+  boost::shared_ptr<CompressedPointCloud>
+  compress_point_cloud(vw::ImageViewRef< vw::Vector<double, n> > const& cloud,
+                       double resolution, int tile_size) {
+    boost::shared_ptr<CompressedPointCloud>
+      store(new CompressedPointCloud(cloud.cols(), cloud.rows(), n, resolution, tile_size));
+    vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+    for (int y = 0; y < cloud.rows(); y += tile_size) {
+      for (int x = 0; x < cloud.cols(); x += tile_size) {
+        vw::BBox2i box(x, y, std::min(tile_size, cloud.cols() - x),
+                       std::min(tile_size, cloud.rows() - y));
+        queue.add_task(boost::shared_ptr<vw::Task>(new CompressTileTask<n>(cloud, *store, box)));
+      }
+    }
+    queue.join_all();
+    return store;
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_POINT_CLOUD_STORE_H__
@@ -0,0 +1,105 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudTypes.h
+///
+/// The pixel types of the point clouds the tools read and write. A
+/// cloud has 3 channels for the point, then 1 channel for the
+/// triangulation error or 3 for its components. A tool finds the
+/// number of channels of its input once, with
+/// dispatch_point_cloud_channels(), and does its work with code
+/// templated on the pixel type, so the per-pixel loops are compiled
+/// for that number of channels, rather than checking it per pixel or
+/// going through one more view per channel.
+///
+/// Include this from a .cc file only, and instead of specializing
+/// PixelFormatID for these types there.
+
+#ifndef __ASP_CORE_POINT_CLOUD_TYPES_H__
+#define __ASP_CORE_POINT_CLOUD_TYPES_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Math/Vector.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <cmath>
+
+// Allows FileIO to correctly read/write these pixel types
+namespace vw {
+  typedef Vector<float64,6> Vector6;
+  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
+  template<> struct PixelFormatID<Vector3f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
+  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+  template<> struct PixelFormatID<Vector4f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+namespace asp {
+
+  namespace point_cloud_types_private {
+    template <int num_ch>
+    struct TriError {};
+    template <>
+    struct TriError<3> {
+      template <class PixelT>
+      static double get(PixelT const& p) { return 0.0; }
+    };
+    template <>
+    struct TriError<4> {
+      template <class PixelT>
+      static double get(PixelT const& p) { return std::abs(double(p[3])); }
+    };
+    template <>
+    struct TriError<6> {
+      template <class PixelT>
+      static double get(PixelT const& p) {
+        return std::sqrt(double(p[3])*p[3] + double(p[4])*p[4] + double(p[5])*p[5]);
+      }
+    };
+  }
+
+  /// The point of a point cloud pixel
+  template <class PixelT>
+  inline vw::Vector3 cloud_point(PixelT const& p) {
+    return vw::Vector3(p[0], p[1], p[2]);
+  }
+
+  /// The triangulation error of a point cloud pixel, the norm of its
+  /// error channels, or 0 if it has none
+  template <class PixelT>
+  inline double cloud_point_error(PixelT const& p) {
+    return point_cloud_types_private::TriError<vw::math::VectorSize<PixelT>::value>::get(p);
+  }
+
+  /// Call func.template apply<PixelT>(), with PixelT the pixel type of
+  /// a point cloud with the given number of channels, which must be 3,
+  /// 4, or 6.
+  template <class FuncT>
+  void dispatch_point_cloud_channels(int num_channels, FuncT & func) {
+    switch (num_channels) {
+    case 3: func.template apply<vw::Vector3>(); break;
+    case 4: func.template apply<vw::Vector4>(); break;
+    case 6: func.template apply<vw::Vector6>(); break;
+    default:
+      vw::vw_throw(vw::ArgumentErr() << "Expecting a point cloud with 3, 4, or 6 channels, "
+                   << "got " << num_channels << ".\n");
+    }
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_POINT_CLOUD_TYPES_H__
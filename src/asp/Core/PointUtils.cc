@@ -25,11 +25,19 @@
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+#include <vw/Image/Manipulation.h>
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <proj_api.h>
+#include <limits>
 
 using namespace vw;
 using namespace vw::cartography;
 using namespace pdal::filters;
+namespace fs = boost::filesystem;
 
 // Allows FileIO to correctly read/write these pixel types
 namespace vw {
@@ -130,6 +138,10 @@ namespace asp{
     virtual bool ReadNextPoint() = 0;
     virtual Vector3 GetPoint() = 0;
 
+    /// The bounds of the first two point coordinates, if known
+    /// without reading the points.
+    virtual bool GetBounds(BBox2 & bounds){ return false; }
+
     virtual ~BaseReader(){}
   };
 
@@ -158,6 +170,13 @@ namespace asp{
       return Vector3(p.GetX(), p.GetY(), p.GetZ());
     }
 
+    virtual bool GetBounds(BBox2 & bounds){
+      liblas::Header const& header = m_reader.GetHeader();
+      bounds = BBox2(Vector2(header.GetMinX(), header.GetMinY()),
+                     Vector2(header.GetMaxX(), header.GetMaxY()));
+      return !bounds.empty();
+    }
+
   };
 
   class CsvReader: public BaseReader{
@@ -230,6 +249,125 @@ namespace asp{
 
   }; // End class CsvReader
 
+  /// Read points from binary files of raw doubles, as written by
+  /// write_raw_point(), one file after another. The georeference is
+  /// that of the reader the points originally came from.
+  class RawPointReader: public BaseReader{
+    std::vector<std::string> m_files;
+    size_t        m_file_index;
+    std::ifstream m_ifs;
+    Vector3       m_curr_point;
+  public:
+
+    RawPointReader(std::vector<std::string> const& files, BaseReader const& source)
+      : m_files(files), m_file_index(0){
+      m_num_points = source.m_num_points;
+      m_has_georef = source.m_has_georef;
+      m_georef     = source.m_georef;
+    }
+
+    virtual bool ReadNextPoint(){
+      double vals[3];
+      while (1){
+        if (m_ifs.is_open() && m_ifs.read((char*)vals, sizeof(vals))){
+          m_curr_point = Vector3(vals[0], vals[1], vals[2]);
+          return true;
+        }
+        if (m_ifs.is_open())
+          m_ifs.close();
+        if (m_file_index >= m_files.size())
+          return false;
+        m_ifs.clear();
+        m_ifs.open(m_files[m_file_index].c_str(), std::ios::in | std::ios::binary);
+        if (!m_ifs)
+          vw_throw( vw::IOErr() << "Unable to open file \"" << m_files[m_file_index] << "\"" );
+        m_file_index++;
+      }
+    }
+
+    virtual Vector3 GetPoint(){
+      return m_curr_point;
+    }
+
+  }; // End class RawPointReader
+
+  inline void write_raw_point(std::ofstream & ofs, Vector3 const& p){
+    double vals[3] = {p[0], p[1], p[2]};
+    ofs.write((const char*)vals, sizeof(vals));
+  }
+
+  /// Distribute the points of a reader into a grid of spatial buckets
+  /// saved as temporary files, based on the first two coordinates,
+  /// which is what the chipper bins on. The buckets are returned in
+  /// serpentine order, so consecutive buckets are adjacent. If the
+  /// reader does not know its bounds, as for CSV, the points are
+  /// first spilled to disk to find them.
+  std::vector<std::string> bucket_sort_points(BaseReader & reader, int buckets_per_side,
+                                              std::string const& prefix,
+                                              std::vector<std::string> & tmp_files){
+
+    BBox2 bounds;
+    boost::shared_ptr<BaseReader> spill_reader;
+    BaseReader * in_reader = &reader;
+    if (!reader.GetBounds(bounds)){
+      std::string spill_file = prefix + "-spill.bin";
+      tmp_files.push_back(spill_file);
+      std::ofstream ofs(spill_file.c_str(), std::ios::out | std::ios::binary);
+      while (reader.ReadNextPoint()){
+        Vector3 p = reader.GetPoint();
+        write_raw_point(ofs, p);
+        if (!boost::math::isnan(p[0]) && !boost::math::isnan(p[1]))
+          bounds.grow(Vector2(p[0], p[1]));
+      }
+      ofs.close();
+      if (!ofs)
+        vw_throw( vw::IOErr() << "Failed writing: " << spill_file << "\n");
+      spill_reader.reset(new RawPointReader(std::vector<std::string>(1, spill_file), reader));
+      in_reader = spill_reader.get();
+    }
+
+    int num_buckets = buckets_per_side*buckets_per_side;
+    std::vector<std::string> bucket_files(num_buckets);
+    std::vector<boost::shared_ptr<std::ofstream> > buckets(num_buckets);
+    for (int row = 0; row < buckets_per_side; row++){
+      for (int col = 0; col < buckets_per_side; col++){
+        // Serpentine order
+        int pos = row*buckets_per_side + ((row % 2 == 0) ? col : buckets_per_side - 1 - col);
+        std::ostringstream os;
+        os << prefix << "-bucket-" << pos << ".bin";
+        bucket_files[pos] = os.str();
+        tmp_files.push_back(os.str());
+        buckets[row*buckets_per_side + col].reset
+          (new std::ofstream(os.str().c_str(), std::ios::out | std::ios::binary));
+      }
+    }
+
+    double bucket_wid = std::max(bounds.width(),  1e-12)/buckets_per_side;
+    double bucket_hgt = std::max(bounds.height(), 1e-12)/buckets_per_side;
+    while (in_reader->ReadNextPoint()){
+      Vector3 p = in_reader->GetPoint();
+      int col = 0, row = 0;
+      if (!boost::math::isnan(p[0]) && !boost::math::isnan(p[1])){
+        // Points past the bounds, if the LAS header is off, go to the
+        // edge buckets.
+        col = std::max(0, std::min(buckets_per_side - 1,
+                                   int(floor((p[0] - bounds.min().x())/bucket_wid))));
+        row = std::max(0, std::min(buckets_per_side - 1,
+                                   int(floor((p[1] - bounds.min().y())/bucket_hgt))));
+      }
+      write_raw_point(*buckets[row*buckets_per_side + col], p);
+    }
+
+    for (int i = 0; i < num_buckets; i++){
+      buckets[i]->close();
+      if (!*buckets[i])
+        vw_throw( vw::IOErr() << "Failed writing a temporary bucket file with prefix: "
+                              << prefix << "\n");
+    }
+
+    return bucket_files;
+  }
+
 
   /// Create a point cloud image from a las file. The image will be
   /// created block by block, when it needs to be written to disk. It is
@@ -514,17 +652,76 @@ bool asp::CsvConv::parse_georef(vw::cartography::GeoReference & georef) const {
 
 #include <iomanip>
 
+namespace {
+
+  inline bool is_csv_separator(char c, const char * sep){
+    return c != '\0' && strchr(sep, c) != NULL;
+  }
+
+  // Parse the lines in a chunk of a CSV file. Chunks are parsed in
+  // parallel, each into its own vector, so that the records can be
+  // put back together in file order.
+  class CsvChunkParseTask : public vw::Task, private boost::noncopyable {
+    asp::CsvConv const& m_csv_conv;
+    std::string m_text;
+    bool m_is_file_start;
+    std::vector<asp::CsvConv::CsvRecord> & m_records;
+  public:
+    CsvChunkParseTask(asp::CsvConv const& csv_conv, std::string & text, bool is_file_start,
+                      std::vector<asp::CsvConv::CsvRecord> & records):
+      m_csv_conv(csv_conv), m_is_file_start(is_file_start), m_records(records){
+      m_text.swap(text);
+    }
+
+    void operator()() {
+      m_csv_conv.parse_csv_chunk(m_text, m_is_file_start, m_records);
+      std::string().swap(m_text); // Free the memory
+    }
+  };
+
+}
+
+void asp::CsvConv::parse_csv_chunk(std::string const& text, bool is_file_start,
+                                   std::vector<CsvRecord> & records) const {
+  bool first_line = is_file_start, success;
+  std::string line;
+  size_t beg = 0;
+  while (beg < text.size()){
+    size_t end = text.find('\n', beg);
+    if (end == std::string::npos)
+      end = text.size();
+    line.assign(text, beg, end - beg);
+    CsvRecord record = parse_csv_line(first_line, success, line);
+    if (success)
+      records.push_back(record);
+    beg = end + 1;
+  }
+}
+
+bool asp::read_csv_chunk(std::istream & is, std::string & text){
+  const size_t CHUNK_SIZE = 8*1024*1024;
+  text.resize(CHUNK_SIZE);
+  is.read(&text[0], CHUNK_SIZE);
+  text.resize(is.gcount());
+
+  // Complete the last line of the chunk
+  std::string rest;
+  if (is && std::getline(is, rest, '\n'))
+    text += rest;
+
+  return !text.empty();
+}
+
 asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
                                                      std::string const& line) const {
   // Parse a CSV file line in given format
   success = true;
 
-  // Copy the input line into a temporary buffer
-  const int bufSize = 2048;
-  char temp[bufSize];
-  strncpy(temp, line.c_str(), bufSize);
-
-  std::string sep = asp::csv_separator();
+  // Walk through the line in place, rather than copying it and
+  // splitting it with strtok, which is the bottleneck for large files.
+  const char * sep = ", \t"; // Must be the same as asp::csv_separator()
+  const char * ptr = line.c_str();
+  const char * line_end = ptr + line.size();
 
   int col_index = -1; // The current column we are reading
   int num_floats_read = 0;
@@ -541,26 +738,32 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
 
-  char * ptr = temp;
   while(1){
 
+    // Find the next token. Consecutive separators count as one.
+    while (ptr < line_end && is_csv_separator(*ptr, sep))
+      ptr++;
+    if ( ptr >= line_end ) break; // no more tokens
+    const char * token = ptr;
+    while (ptr < line_end && !is_csv_separator(*ptr, sep))
+      ptr++;
+
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
-    if ( token == NULL ) break; // no more tokens
     if ( num_values_read >= this->num_targets ) break; // read enough values
 
     // Check if this is one of the columns we need to read
-    if (this->col2name.find(col_index) == this->col2name.end())
+    std::map<int, std::string>::const_iterator it = this->col2name.find(col_index);
+    if (it == this->col2name.end())
       continue;
 
-    if (this->col2name.at(col_index) == "file") // This is a string input
-      values.file = token;
+    if (it->second == "file") // This is a string input
+      values.file = std::string(token, ptr);
     else {
-      // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
+      // Parse the floating point value from the token. It is followed
+      // by a separator or the end of the line, so strtod stops there.
+      char * num_end = NULL;
+      double val = strtod(token, &num_end);
+      if (num_end == token){ // Handle parsing failure
         success = false;
         break;
       }
@@ -592,19 +795,32 @@ size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
   output_list.clear();
 
   // Open input file
-  std::ifstream file( file_path.c_str() );
+  std::ifstream file( file_path.c_str(), std::ios::in | std::ios::binary );
   if( !file )
     vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
 
-  // Read through all the lines of the input file, parse each line, and build the output list.
-  bool success;
-  bool first_line = true;
-  std::string line = "";
-  while ( std::getline(file, line, '\n') ){
-    CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
-    if (success)
-      output_list.push_back(new_record);
-    first_line = false;
+  // Read the file in chunks of whole lines. Each batch of chunks is
+  // parsed in parallel, and the memory is bounded by the batch size.
+  int num_threads = vw_settings().default_num_threads();
+  int chunks_per_batch = 2*num_threads;
+  bool is_file_start = true;
+  while (file){
+
+    std::vector< std::vector<CsvRecord> > records(chunks_per_batch);
+    FifoWorkQueue queue(num_threads);
+    for (int chunk = 0; chunk < chunks_per_batch && file; chunk++){
+      std::string text;
+      if (!asp::read_csv_chunk(file, text))
+        break;
+      boost::shared_ptr<CsvChunkParseTask>
+        task(new CsvChunkParseTask(*this, text, is_file_start, records[chunk]));
+      queue.add_task(task);
+      is_file_start = false;
+    }
+    queue.join_all();
+
+    for (size_t chunk = 0; chunk < records.size(); chunk++)
+      output_list.insert(output_list.end(), records[chunk].begin(), records[chunk].end());
   }
 
   file.close();
@@ -842,30 +1058,51 @@ void asp::las_or_csv_to_tif(std::string const& in_file,
   Vector2 original_tile_size = opt->raster_tile_size;
   opt->raster_tile_size = tile_size;
 
+  std::ifstream ifs;
+  boost::shared_ptr<liblas::Reader> las_reader;
+  boost::shared_ptr<asp::BaseReader> reader;
   if (asp::is_csv(in_file)){ // CSV
-
-    boost::shared_ptr<asp::CsvReader> csvReaderPtr( new asp::CsvReader(in_file, csv_conv, csv_georef) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (csvReaderPtr.get(), num_rows, TILE_LEN, block_size);
-
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
-
+    reader.reset(new asp::CsvReader(in_file, csv_conv, csv_georef));
   }else if (asp::is_las(in_file)){ // LAS
-
-    std::ifstream ifs;
     ifs.open(in_file.c_str(), std::ios::in | std::ios::binary);
     liblas::ReaderFactory f;
-    liblas::Reader reader = f.CreateWithStream(ifs);
-    boost::shared_ptr<asp::LasReader> lasReaderPtr( new asp::LasReader(reader) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (lasReaderPtr.get(), num_rows, TILE_LEN, block_size);
-
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
+    las_reader.reset(new liblas::Reader(f.CreateWithStream(ifs)));
+    reader.reset(new asp::LasReader(*las_reader));
   }else
     vw_throw( ArgumentErr() << "Unknown file type: " << in_file << "\n");
 
+  // The chipper only groups together points within the same tile of
+  // TILE_LEN x TILE_LEN consecutive points. If the file has more than
+  // that and is not spatially ordered, each tile would be scattered
+  // over the whole extent, and point2dem would have to visit many of
+  // them for each DEM tile. So, first distribute the points into
+  // spatial buckets on disk, with about a tile's worth of points
+  // each, and then chip them bucket by bucket.
+  const int MAX_BUCKETS_PER_SIDE = 16; // Limit the number of open files
+  std::vector<std::string> tmp_files;
+  boost::uint64_t pts_per_tile = boost::uint64_t(TILE_LEN)*TILE_LEN;
+  if (reader->m_num_points > pts_per_tile){
+    int buckets_per_side
+      = std::min(MAX_BUCKETS_PER_SIDE,
+                 (int)ceil(sqrt(double(reader->m_num_points)/double(pts_per_tile))));
+    vw_out() << "Sorting the points into " << buckets_per_side*buckets_per_side
+             << " spatial buckets." << std::endl;
+    fs::path out_path(out_file);
+    std::string prefix = (out_path.parent_path() / out_path.stem()).string();
+    std::vector<std::string> bucket_files
+      = bucket_sort_points(*reader, buckets_per_side, prefix, tmp_files);
+    reader.reset(new asp::RawPointReader(bucket_files, *reader));
+  }
+
+  ImageViewRef<Vector3> Img
+    = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (reader.get(), num_rows, TILE_LEN, block_size);
+
+  // Must use a thread only, as we read the input file serially.
+  vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
+
+  for (size_t i = 0; i < tmp_files.size(); i++)
+    fs::remove(tmp_files[i]);
+
   // Restore the original tile size
   opt->raster_tile_size = original_tile_size;
 
@@ -1029,6 +1266,282 @@ boost::uint64_t asp::csv_file_size(std::string const& file){
   return num_total_points;
 }
 
+//------------------------------------------------------------------------------------------
+// Point cache functions
+
+namespace {
+
+  bool g_use_point_cache = false;
+
+  const std::string    POINT_CACHE_MAGIC   = "ASP_POINT_CACHE";
+  const boost::uint32_t POINT_CACHE_VERSION = 2;
+  const size_t         POINT_CACHE_CHUNK   = 64*1024; // Points per chunk
+
+  template<class T>
+  void write_pod(std::ostream & os, T const& val){
+    os.write((const char*)&val, sizeof(T));
+  }
+
+  template<class T>
+  void read_pod(std::istream & is, T & val){
+    is.read((char*)&val, sizeof(T));
+  }
+
+  void write_str(std::ostream & os, std::string const& str){
+    write_pod(os, boost::uint32_t(str.size()));
+    os.write(str.data(), str.size());
+  }
+
+  void read_str(std::istream & is, std::string & str){
+    boost::uint32_t len = 0;
+    read_pod(is, len);
+    str.resize(len);
+    if (len > 0)
+      is.read(&str[0], len);
+  }
+
+  void write_header(std::ostream & os, asp::PointCacheHeader const& header){
+    os.write(POINT_CACHE_MAGIC.data(), POINT_CACHE_MAGIC.size());
+    write_pod(os, POINT_CACHE_VERSION);
+    write_pod(os, header.num_points);
+    write_pod(os, header.source_size);
+    write_pod(os, header.source_time);
+    write_pod(os, header.mean_longitude);
+    write_str(os, header.csv_format_str);
+    write_str(os, header.csv_proj4_str);
+    write_str(os, header.georef_wkt);
+  }
+
+  bool read_header(std::istream & is, asp::PointCacheHeader & header){
+    std::string magic(POINT_CACHE_MAGIC.size(), '\0');
+    is.read(&magic[0], magic.size());
+    boost::uint32_t version = 0;
+    read_pod(is, version);
+    if (!is || magic != POINT_CACHE_MAGIC || version != POINT_CACHE_VERSION)
+      return false;
+    read_pod(is, header.num_points);
+    read_pod(is, header.source_size);
+    read_pod(is, header.source_time);
+    read_pod(is, header.mean_longitude);
+    read_str(is, header.csv_format_str);
+    read_str(is, header.csv_proj4_str);
+    read_str(is, header.georef_wkt);
+    return bool(is);
+  }
+
+  void write_vec(std::ostream & os, std::vector<double> const& vec){
+    os.write((const char*)&vec[0], vec.size()*sizeof(double));
+  }
+
+  void read_vec(std::istream & is, boost::uint32_t count, std::vector<double> & vec){
+    vec.resize(count);
+    is.read((char*)&vec[0], count*sizeof(double));
+  }
+
+  // If a chunk with points in this lon-lat box can have points in the
+  // given box, with longitudes perhaps off by multiples of 360 degrees.
+  bool chunk_may_intersect(BBox2 chunk_box, BBox2 const& lonlat_box){
+    chunk_box.expand(1e-6); // the boxes of single points are empty
+    for (int k = -2; k <= 2; k++){
+      if (lonlat_box.intersects(chunk_box + Vector2(360.0*k, 0)))
+        return true;
+    }
+    return false;
+  }
+
+  // The header a cache of this file would have, except for the
+  // number of points and mean longitude.
+  asp::PointCacheHeader source_header(std::string const& file, asp::CsvConv const& csv_conv,
+                                      GeoReference const& geo){
+    asp::PointCacheHeader header;
+    header.source_size = fs::file_size(file);
+    header.source_time = fs::last_write_time(file);
+    if (asp::is_csv(file)){
+      header.csv_format_str = csv_conv.get_format_str();
+      header.csv_proj4_str  = csv_conv.get_proj4_str();
+    }
+    header.georef_wkt = geo.get_wkt();
+    return header;
+  }
+
+}
+
+void asp::set_use_point_cache(bool use_cache){
+  g_use_point_cache = use_cache;
+}
+
+bool asp::use_point_cache(){
+  return g_use_point_cache;
+}
+
+std::string asp::point_cache_file(std::string const& file){
+  return file + ".asp-cache";
+}
+
+bool asp::point_cache_is_valid(std::string const& file, CsvConv const& csv_conv,
+                               GeoReference const& geo){
+  std::string cache_file = asp::point_cache_file(file);
+  if (!fs::exists(cache_file))
+    return false;
+
+  std::ifstream ifs(cache_file.c_str(), std::ios::in | std::ios::binary);
+  PointCacheHeader header;
+  if (!read_header(ifs, header))
+    return false;
+
+  PointCacheHeader expected = source_header(file, csv_conv, geo);
+  return (header.source_size    == expected.source_size    &&
+          header.source_time    == expected.source_time    &&
+          header.csv_format_str == expected.csv_format_str &&
+          header.csv_proj4_str  == expected.csv_proj4_str  &&
+          header.georef_wkt     == expected.georef_wkt);
+}
+
+void asp::write_point_cache(std::string const& file, CsvConv const& csv_conv,
+                            GeoReference const& geo){
+
+  PointCacheWriter writer(file, csv_conv, geo);
+
+  if (asp::is_las(file)){
+
+    // Same conversion as in pc_align
+    GeoReference las_georef;
+    if (!asp::georef_from_las(file, las_georef))
+      vw_throw(ArgumentErr() << "LAS: " << file << " does not have a georeference.\n");
+
+    std::ifstream ifs;
+    ifs.open(file.c_str(), std::ios::in | std::ios::binary);
+    liblas::ReaderFactory f;
+    liblas::Reader reader = f.CreateWithStream(ifs);
+    while (reader.ReadNextPoint()){
+      liblas::Point const& p = reader.GetPoint();
+      Vector2 ll = las_georef.point_to_lonlat(Vector2(p.GetX(), p.GetY()));
+      writer.add(las_georef.datum().geodetic_to_cartesian(Vector3(ll[0], ll[1], p.GetZ())));
+    }
+
+  }else if (asp::is_csv(file)){
+
+    if (!csv_conv.is_configured())
+      vw_throw(ArgumentErr() << "Cannot cache the CSV file " << file
+                             << " without a CSV format.\n");
+
+    std::ifstream ifs(file.c_str());
+    if (!ifs)
+      vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
+    bool is_first_line = true, success;
+    std::string line;
+    while (getline(ifs, line, '\n')){
+      if (!asp::is_valid_csv_line(line))
+        continue;
+      CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
+      if (!success)
+        continue;
+      writer.add(csv_conv.csv_to_cartesian(vals, geo), csv_conv.csv_to_lonlat(vals, geo)[0]);
+    }
+
+  }else
+    vw_throw( ArgumentErr() << "Unknown file type: " << file << "\n");
+
+  writer.close();
+}
+
+asp::PointCacheWriter::PointCacheWriter(std::string const& file, CsvConv const& csv_conv,
+                                        GeoReference const& geo):
+  m_file(file), m_geo(geo), m_header(source_header(file, csv_conv, geo)), m_sum_lon(0.0){
+
+  std::string cache_file = asp::point_cache_file(m_file);
+  vw_out() << "Writing point cache: " << cache_file << std::endl;
+
+  // Write to a temporary file first, so that an interrupted run does
+  // not leave behind a truncated cache.
+  m_tmp_file = cache_file + ".tmp";
+  m_ofs.open(m_tmp_file.c_str(), std::ios::out | std::ios::binary);
+  if (!m_ofs)
+    vw_throw( vw::IOErr() << "Unable to open file \"" << m_tmp_file << "\"" );
+
+  write_header(m_ofs, m_header); // Will be written again at the end
+}
+
+void asp::PointCacheWriter::add(Vector3 const& xyz, double file_lon){
+  // Store the lon-lat the reader would otherwise have to compute
+  Vector3 llh = m_geo.datum().cartesian_to_geodetic(xyz);
+  add(xyz, Vector2(llh[0], llh[1]), file_lon);
+}
+
+void asp::PointCacheWriter::add(Vector3 const& xyz, Vector2 const& lonlat, double file_lon){
+  m_x.push_back(xyz[0]); m_y.push_back(xyz[1]); m_z.push_back(xyz[2]);
+  m_lon.push_back(lonlat[0]); m_lat.push_back(lonlat[1]);
+  m_box.grow(lonlat);
+  m_sum_lon += file_lon;
+  m_header.num_points++;
+  if (m_x.size() >= POINT_CACHE_CHUNK)
+    flush();
+}
+
+// Write the points so far as one chunk of columns. Each chunk starts
+// with the number of its points and their lon-lat box, so readers can
+// skip chunks without reading them.
+void asp::PointCacheWriter::flush(){
+  if (m_x.empty())
+    return;
+  write_pod(m_ofs, boost::uint32_t(m_x.size()));
+  write_pod(m_ofs, m_box.min().x()); write_pod(m_ofs, m_box.min().y());
+  write_pod(m_ofs, m_box.max().x()); write_pod(m_ofs, m_box.max().y());
+  write_vec(m_ofs, m_x);   write_vec(m_ofs, m_y); write_vec(m_ofs, m_z);
+  write_vec(m_ofs, m_lon); write_vec(m_ofs, m_lat);
+  m_x.clear(); m_y.clear(); m_z.clear(); m_lon.clear(); m_lat.clear();
+  m_box = BBox2();
+}
+
+void asp::PointCacheWriter::close(){
+  flush();
+  if (m_header.num_points > 0)
+    m_header.mean_longitude = m_sum_lon/m_header.num_points;
+  m_ofs.seekp(0);
+  write_header(m_ofs, m_header);
+  m_ofs.close();
+  if (!m_ofs)
+    vw_throw( vw::IOErr() << "Failed writing: " << m_tmp_file << "\n");
+
+  fs::rename(m_tmp_file, asp::point_cache_file(m_file));
+}
+
+asp::PointCacheReader::PointCacheReader(std::string const& cache_file):
+  m_cache_file(cache_file){
+  m_ifs.open(cache_file.c_str(), std::ios::in | std::ios::binary);
+  if (!m_ifs || !read_header(m_ifs, m_header))
+    vw_throw( vw::IOErr() << "Invalid point cache: " << cache_file << "\n");
+}
+
+bool asp::PointCacheReader::read_chunk(std::vector<double> & x, std::vector<double> & y,
+                                       std::vector<double> & z,
+                                       std::vector<double> & lon, std::vector<double> & lat,
+                                       vw::BBox2 const& lonlat_box){
+  boost::uint32_t count = 0;
+  read_pod(m_ifs, count);
+  if (!m_ifs || count == 0)
+    return false;
+
+  Vector2 box_min, box_max;
+  read_pod(m_ifs, box_min[0]); read_pod(m_ifs, box_min[1]);
+  read_pod(m_ifs, box_max[0]); read_pod(m_ifs, box_max[1]);
+
+  if (!lonlat_box.empty() && !chunk_may_intersect(BBox2(box_min, box_max), lonlat_box)){
+    // Skip the five columns of this chunk
+    x.clear(); y.clear(); z.clear(); lon.clear(); lat.clear();
+    m_ifs.seekg(std::streamoff(5)*count*sizeof(double), std::ios::cur);
+    if (!m_ifs)
+      vw_throw( vw::IOErr() << "Truncated point cache: " << m_cache_file << "\n");
+    return true;
+  }
+
+  read_vec(m_ifs, count, x);   read_vec(m_ifs, count, y); read_vec(m_ifs, count, z);
+  read_vec(m_ifs, count, lon); read_vec(m_ifs, count, lat);
+  if (!m_ifs)
+    vw_throw( vw::IOErr() << "Truncated point cache: " << m_cache_file << "\n");
+  return true;
+}
+
 // Erases a file suffix if one exists and returns the base string
 std::string asp::prefix_from_pointcloud_filename(std::string const& filename) {
   std::string result = filename;
@@ -1121,4 +1634,145 @@ std::string asp::get_cloud_type(std::string const& file_name){
                          << " is neither a point cloud nor a DEM.\n");
 }
 
+//------------------------------------------------------------------------------------------
+// Conversion of tiles of points to the output projection
+
+void asp::cartesian_to_geodetic(Datum const& datum, Vector3 * points, size_t num_points) {
+
+  // The closed form needs the datum as it is, with no offset meridian
+  if (datum.meridian_offset() != 0.0) {
+    for (size_t i = 0; i < num_points; i++) {
+      if (points[i] == Vector3())
+        points[i] = Vector3(0, 0, std::numeric_limits<double>::quiet_NaN());
+      else
+        points[i] = datum.cartesian_to_geodetic(points[i]);
+    }
+    return;
+  }
+
+  const double a   = datum.semi_major_axis();
+  const double b   = datum.semi_minor_axis();
+  const double e2  = 1.0 - (b*b)/(a*a);
+  const double e4  = e2*e2;
+  const double a2  = a*a;
+  const double rad2deg = 180.0/M_PI;
+
+  // No branches in the loop but the selects, so that it vectorizes.
+  // The closed form does not hold on the axis and near the center,
+  // and those points, among them the zero one, are left as they are
+  // and flagged to be converted by the datum below.
+  std::vector<unsigned char> on_axis(num_points);
+  unsigned char any_on_axis = 0;
+  for (size_t i = 0; i < num_points; i++) {
+    double x = points[i][0], y = points[i][1], z = points[i][2];
+    double rho2 = x*x + y*y;
+    double rho  = std::sqrt(rho2);
+    double p = rho2/a2;
+    double q = (1.0 - e2)*z*z/a2;
+    double r = (p + q - e4)/6.0;
+    double s = e4*p*q/(4.0*r*r*r);
+    double t = std::pow(1.0 + s + std::sqrt(s*(2.0 + s)), 1.0/3.0);
+    double u = r*(1.0 + t + 1.0/t);
+    double v = std::sqrt(u*u + e4*q);
+    double w = e2*(u + v - q)/(2.0*v);
+    double k = std::sqrt(u + v + w*w) - w;
+    double d = k*rho/(k + e2);
+    double dz = std::sqrt(d*d + z*z);
+    unsigned char bad = !(r > 0.0 && rho > 0.0);
+    on_axis[i]   = bad;
+    any_on_axis |= bad;
+    points[i][0] = bad ? x : std::atan2(y, x)*rad2deg;
+    points[i][1] = bad ? y : 2.0*std::atan2(z, d + dz)*rad2deg;
+    points[i][2] = bad ? z : (k + e2 - 1.0)/k*dz;
+  }
+  if (!any_on_axis)
+    return;
 
+  for (size_t i = 0; i < num_points; i++) {
+    if (!on_axis[i])
+      continue;
+    if (points[i] == Vector3())
+      points[i] = Vector3(0, 0, std::numeric_limits<double>::quiet_NaN());
+    else
+      points[i] = datum.cartesian_to_geodetic(points[i]);
+  }
+}
+
+void asp::geodetic_to_point(GeoReference const& georef, Vector3 * points, size_t num_points) {
+
+  std::vector<size_t> valid;
+  valid.reserve(num_points);
+  for (size_t i = 0; i < num_points; i++) {
+    if (!boost::math::isnan(points[i][2]))
+      valid.push_back(i);
+  }
+
+  // With one PROJ context per call, which makes this thread-safe
+  bool converted = false;
+  if (georef.is_projected() && !valid.empty()) {
+    projCtx ctx = pj_ctx_alloc();
+    projPJ  proj = pj_init_plus_ctx(ctx, georef.overall_proj4_str().c_str());
+    projPJ  latlong = proj ? pj_latlong_from_proj(proj) : NULL;
+    if (latlong) {
+      const double deg2rad = M_PI/180.0;
+      std::vector<double> x(valid.size()), y(valid.size());
+      for (size_t j = 0; j < valid.size(); j++) {
+        x[j] = points[valid[j]][0]*deg2rad;
+        y[j] = points[valid[j]][1]*deg2rad;
+      }
+      if (pj_transform(latlong, proj, long(valid.size()), 1, &x[0], &y[0], NULL) == 0) {
+        converted = true;
+        for (size_t j = 0; j < valid.size(); j++) {
+          Vector3 & P = points[valid[j]];
+          if (x[j] == HUGE_VAL || y[j] == HUGE_VAL) {
+            // Let the georeference say what is wrong with this point
+            Vector2 xy = georef.lonlat_to_point(subvector(P, 0, 2));
+            P = Vector3(xy[0], xy[1], P[2]);
+          } else {
+            P = Vector3(x[j], y[j], P[2]);
+          }
+        }
+      }
+      pj_free(latlong);
+    }
+    if (proj)
+      pj_free(proj);
+    pj_ctx_free(ctx);
+  }
+  if (converted)
+    return;
+
+  for (size_t j = 0; j < valid.size(); j++) {
+    Vector3 & P = points[valid[j]];
+    Vector2 xy = georef.lonlat_to_point(subvector(P, 0, 2));
+    P = Vector3(xy[0], xy[1], P[2]);
+  }
+}
+
+Vector3 asp::CartesianToProjectedView::operator()(int32 col, int32 row, int32) const {
+  Vector3 P = m_points(col, row);
+  convert(&P, 1);
+  return P;
+}
+
+asp::CartesianToProjectedView::prerasterize_type
+asp::CartesianToProjectedView::prerasterize(BBox2i const& bbox) const {
+  ImageView<Vector3> tile = crop(m_points, bbox);
+  convert(&tile(0, 0), size_t(tile.cols())*tile.rows());
+  return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+}
+
+void asp::CartesianToProjectedView::convert(Vector3 * points, size_t num_points) const {
+  cartesian_to_geodetic(m_georef.datum(), points, num_points);
+
+  // As CenterLongitudeFunc and PointOffsetFunc. A point with a NaN
+  // height is no-data, and stays so with the offset added.
+  for (size_t i = 0; i < num_points; i++) {
+    Vector3 & P = points[i];
+    while (P[0] < m_center_lon - 180.0) P[0] += 360.0;
+    while (P[0] > m_center_lon + 180.0) P[0] -= 360.0;
+    P += m_offset;
+  }
+
+  geodetic_to_point(m_georef, points, num_points);
+}
@@ -24,6 +24,7 @@
 #define __ASP_CORE_POINT_UTILS_H__
 
 #include <string>
+#include <fstream>
 #include <vw/Core/Functors.h>
 #include <vw/Image/PerPixelViews.h>
 #include <vw/Math/Vector.h>
@@ -33,6 +34,7 @@
 #include <vw/FileIO/DiskImageUtils.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/PointCloudStore.h>
 
 namespace vw{
   namespace cartography{
@@ -86,6 +88,9 @@ namespace asp {
     bool      is_configured() const {return csv_format_str != "";}
     CsvFormat get_format   () const {return format;}
 
+    std::string const& get_format_str() const {return csv_format_str;}
+    std::string const& get_proj4_str () const {return csv_proj4_str;}
+
     /// Writes out a header string containing each of the extracted column names
     /// in the order they were specified.
     std::string write_header_string(std::string const delimiter = ", ") const;
@@ -111,6 +116,12 @@ namespace asp {
     size_t read_csv_file(std::string const    & file_path,
                              std::list<CsvRecord> & output_list) const;
 
+    /// Parse the lines of a chunk of a CSV file read with
+    /// read_csv_chunk(), appending a record for each line which parses.
+    /// - Chunks can be parsed in parallel, each into its own vector.
+    void parse_csv_chunk(std::string const& text, bool is_file_start,
+                         std::vector<CsvRecord> & records) const;
+
     /// Convert values read from a csv file using parse_csv_line (in the same order they appear in the file)
     /// to a Cartesian point. If return_point_height is true, and the csv point is not
     /// in xyz format, return instead the projected point and height above datum.
@@ -224,6 +235,93 @@ namespace asp {
   /// Returns the number of points contained in a CSV file
   boost::uint64_t csv_file_size(std::string const& file);
 
+  /// Read the next chunk of a CSV file, of about 8 MB and ending at the
+  /// end of a line. Return false if there is nothing left to read.
+  bool read_csv_chunk(std::istream & is, std::string & text);
+
+  /// Whether pc_align loads LAS and CSV files through a binary
+  /// cache saved next to them (see write_point_cache()).
+  void set_use_point_cache(bool use_cache);
+  bool use_point_cache();
+
+  /// The cache of a LAS or CSV file, <file>.asp-cache
+  std::string point_cache_file(std::string const& file);
+
+  /// What a point cache was made from
+  struct PointCacheHeader {
+    boost::uint64_t num_points;
+    boost::uint64_t source_size;
+    boost::int64_t  source_time;
+    double          mean_longitude; ///< For CSV files, in the file's own range
+    std::string     csv_format_str, csv_proj4_str, georef_wkt;
+    PointCacheHeader(): num_points(0), source_size(0), source_time(0), mean_longitude(0){}
+  };
+
+  /// Return true if the cache of this file exists and was made from
+  /// its current version, with the same CSV format and georeference.
+  bool point_cache_is_valid(std::string const& file, CsvConv const& csv_conv,
+                            vw::cartography::GeoReference const& geo);
+
+  /// Parse all points in a LAS file with a georeference, or a CSV
+  /// file whose format is set, and save them in ECEF in a binary
+  /// file. The points are stored in chunks, each chunk being the
+  /// lon-lat box of its points followed by five columns of x, y, z,
+  /// longitude, and latitude values.
+  void write_point_cache(std::string const& file, CsvConv const& csv_conv,
+                         vw::cartography::GeoReference const& geo);
+
+  /// Write the cache of a file from points parsed elsewhere, as
+  /// write_point_cache() does, so that a tool reading the file anyway
+  /// can save its cache in the same pass. The points must be added in
+  /// the order of the file, and the cache is in place only after
+  /// close().
+  class PointCacheWriter {
+  public:
+    PointCacheWriter(std::string const& file, CsvConv const& csv_conv,
+                     vw::cartography::GeoReference const& geo);
+
+    /// Add a point in ECEF. For a CSV file, file_lon is its longitude
+    /// as given by CsvConv::csv_to_lonlat(), for the mean longitude.
+    void add(vw::Vector3 const& xyz, double file_lon = 0.0);
+
+    /// Add a point whose lon-lat in the datum of the georeference was
+    /// found already
+    void add(vw::Vector3 const& xyz, vw::Vector2 const& lonlat, double file_lon = 0.0);
+
+    /// Write the last chunk and the header, and move the cache in place
+    void close();
+
+  private:
+    void flush();
+
+    std::string                   m_file, m_tmp_file;
+    std::ofstream                 m_ofs;
+    vw::cartography::GeoReference m_geo;
+    PointCacheHeader              m_header;
+    std::vector<double>           m_x, m_y, m_z, m_lon, m_lat;
+    vw::BBox2                     m_box;
+    double                        m_sum_lon;
+  };
+
+  /// Read a point cache chunk by chunk
+  class PointCacheReader {
+  public:
+    PointCacheReader(std::string const& cache_file);
+    PointCacheHeader const& header() const { return m_header; }
+
+    /// Read the next chunk of points. Return false if there are none
+    /// left. If a lon-lat box is given and the chunk has no points in
+    /// it, the chunk is skipped and the vectors are returned empty.
+    bool read_chunk(std::vector<double> & x, std::vector<double> & y,
+                    std::vector<double> & z,
+                    std::vector<double> & lon, std::vector<double> & lat,
+                    vw::BBox2 const& lonlat_box = vw::BBox2());
+  private:
+    std::string      m_cache_file;
+    std::ifstream    m_ifs;
+    PointCacheHeader m_header;
+  };
+
   /// Erases a file suffix if one exists and returns the base string
   std::string prefix_from_pointcloud_filename(std::string const& filename);
 
@@ -232,6 +330,8 @@ namespace asp {
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// With set_point_cloud_store_resolution(), the cloud is read once and
+  /// then kept in memory, compressed.
   template<int m>
   vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename);
 
@@ -307,6 +407,58 @@ namespace asp {
   }
 
 
+  /// Convert cartesian points to geodetic ones, in degrees, with the
+  /// closed-form solution of Vermeille (2002), in a loop the compiler
+  /// can vectorize, rather than calling the datum for each point. The
+  /// zero point, which is no-data, is made one with a NaN height.
+  void cartesian_to_geodetic(vw::cartography::Datum const& datum,
+                             vw::Vector3 * points, size_t num_points);
+
+  /// Convert geodetic points to the projected coordinates of the
+  /// georeference, keeping the height. For a projected georeference,
+  /// PROJ converts all the points with one call. Points with a NaN
+  /// height are left as they are.
+  void geodetic_to_point(vw::cartography::GeoReference const& georef,
+                         vw::Vector3 * points, size_t num_points);
+
+  /// The same as geodetic_to_point(point_image_offset(recenter_longitude
+  /// (cartesian_to_geodetic(points, georef), center_lon), offset), georef),
+  /// but converting the points a tile at a time with the functions above.
+  class CartesianToProjectedView:
+    public vw::ImageViewBase<CartesianToProjectedView> {
+    vw::ImageViewRef<vw::Vector3>  m_points;
+    vw::cartography::GeoReference  m_georef;
+    double                         m_center_lon;
+    vw::Vector3                    m_offset;
+  public:
+    typedef vw::Vector3 pixel_type;
+    typedef vw::Vector3 result_type;
+    typedef vw::ProceduralPixelAccessor<CartesianToProjectedView> pixel_accessor;
+
+    CartesianToProjectedView(vw::ImageViewRef<vw::Vector3> const& points,
+                             vw::cartography::GeoReference const& georef,
+                             double center_lon, vw::Vector3 const& offset):
+      m_points(points), m_georef(georef), m_center_lon(center_lon), m_offset(offset) {}
+
+    inline vw::int32 cols  () const { return m_points.cols(); }
+    inline vw::int32 rows  () const { return m_points.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const;
+
+    typedef vw::CropView< vw::ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const;
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+
+  private:
+    void convert(vw::Vector3 * points, size_t num_points) const;
+  };
+
   /// Imageview operation that applies a transform matrix to every point in the image.
   class PointTransFunc : public vw::ReturnFixedType<vw::Vector3> {
     vw::Matrix3x3 m_trans;
@@ -334,26 +486,86 @@ namespace asp {
 //===================================================================================
 // Template function definitions
 
-template<int m>
-vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename){
+namespace point_utils_private {
+
+  /// Multiply all channels of a pixel by a number
+  template <class VecT>
+  struct ScalePoint: public vw::ReturnFixedType<VecT> {
+    double m_scale;
+    ScalePoint(double scale):m_scale(scale){}
+    VecT operator() (VecT const& pt) const { return m_scale*pt; }
+  };
+
+  /// Read a point cloud from disk, as read_asp_point_cloud().
+  template<int m>
+  vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud_from_disk(std::string const& filename){
+
+    vw::Vector3 shift;
+    std::string shift_str;
+    boost::shared_ptr<vw::DiskImageResource> rsrc
+      ( new vw::DiskImageResourceGDAL(filename) );
+    if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
+      shift = vw::str_to_vec<vw::Vector3>(shift_str);
+    }
+
+    // A fixed-point cloud stores integer multiples of this
+    double scale = 0.0;
+    std::string scale_str;
+    if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str))
+      scale = atof(scale_str.c_str());
 
-  vw::Vector3 shift;
-  std::string shift_str;
-  boost::shared_ptr<vw::DiskImageResource> rsrc
-    ( new vw::DiskImageResourceGDAL(filename) );
-  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
-    shift = vw::str_to_vec<vw::Vector3>(shift_str);
+    // Read the first m channels
+    vw::ImageViewRef< vw::Vector<double, m> > out_image
+      = vw::read_channels<m, double>(filename, 0);
+
+    if (scale > 0)
+      out_image = vw::per_pixel_filter(out_image, ScalePoint< vw::Vector<double, m> >(scale));
+
+    // Add the shift back to the first several channels.
+    if (shift != vw::Vector3())
+      out_image = subtract_shift(out_image, -shift);
+
+    return out_image;
+  }
+
+  /// Compress a cloud read from disk, with all its channels
+  template<int n>
+  boost::shared_ptr<CompressedPointCloud> compress_point_cloud_file(std::string const& filename){
+    return compress_point_cloud<n>(read_asp_point_cloud_from_disk<n>(filename),
+                                   point_cloud_store_resolution());
   }
 
-  // Read the first m channels
-  vw::ImageViewRef< vw::Vector<double, m> > out_image
-    = vw::read_channels<m, double>(filename, 0);
+} // end namespace point_utils_private
 
-  // Add the shift back to the first several channels.
-  if (shift != vw::Vector3())
-    out_image = subtract_shift(out_image, -shift);
+template<int m>
+vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename){
+
+  using namespace point_utils_private;
+
+  if (point_cloud_store_resolution() <= 0)
+    return read_asp_point_cloud_from_disk<m>(filename);
+
+  // Keep the cloud in memory, read from disk the first time
+  boost::shared_ptr<CompressedPointCloud> cloud = find_stored_point_cloud(filename);
+  if (!cloud) {
+    int num_channels = vw::get_num_channels(filename);
+    if      (num_channels == 3) cloud = compress_point_cloud_file<3>(filename);
+    else if (num_channels == 4) cloud = compress_point_cloud_file<4>(filename);
+    else if (num_channels == 5) cloud = compress_point_cloud_file<5>(filename);
+    else if (num_channels >= 6) cloud = compress_point_cloud_file<6>(filename);
+    else
+      return read_asp_point_cloud_from_disk<m>(filename);
+
+    double num_bytes = double(cloud->cols())*cloud->rows()*cloud->num_channels()*sizeof(double);
+    vw::vw_out() << "Keeping " << filename << " in memory, compressed to "
+                 << cloud->size()/(1024.0*1024.0) << " MB from "
+                 << num_bytes/(1024.0*1024.0) << " MB.\n";
+    add_stored_point_cloud(filename, cloud);
+  }
 
-  return out_image;
+  if (m > cloud->num_channels())
+    return read_asp_point_cloud_from_disk<m>(filename);
+  return CompressedPointCloudView<m>(cloud);
 }
 
 
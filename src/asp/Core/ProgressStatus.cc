@@ -0,0 +1,161 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ProgressStatus.cc
+///
+
+#include <asp/Core/ProgressStatus.h>
+#include <asp/Core/Telemetry.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <boost/algorithm/string.hpp>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace vw;
+
+namespace {
+  vw::Mutex   g_status_mutex;
+  std::string g_status_file, g_program;
+  bool        g_status_enabled = false;
+
+  double now_seconds() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + 1.0e-6*now.tv_usec;
+  }
+
+  // The stage name from a progress message such as "\t--> Correlation :"
+  std::string stage_name(std::string const& pre) {
+    std::string stage = pre;
+    size_t pos = stage.find("-->");
+    if (pos != std::string::npos)
+      stage = stage.substr(pos + 3);
+    boost::algorithm::trim_if(stage, boost::algorithm::is_any_of(" \t:"));
+    return stage;
+  }
+}
+
+namespace asp {
+
+  void set_progress_status_file(std::string const& file, std::string const& program) {
+    vw::Mutex::Lock lock(g_status_mutex);
+    if (g_status_enabled)
+      return;
+    g_status_file    = file;
+    g_program        = program;
+    g_status_enabled = true;
+    vw_out() << "Writing the progress status to: " << file << "\n";
+  }
+
+  bool progress_status_enabled() {
+    return g_status_enabled;
+  }
+
+  void write_progress_status(std::string const& stage, double progress,
+                             double elapsed_s, bool finished) {
+    if (!g_status_enabled)
+      return;
+
+    progress = std::min(std::max(progress, 0.0), 1.0);
+    double eta_s = -1; // unknown
+    if (finished)
+      eta_s = 0;
+    else if (progress > 0)
+      eta_s = elapsed_s*(1.0 - progress)/progress;
+
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0)
+      host[0] = '\0';
+    host[sizeof(host) - 1] = '\0';
+
+    std::string clean_stage = stage;
+    for (size_t k = 0; k < clean_stage.size(); k++) {
+      if (clean_stage[k] == '"' || clean_stage[k] == '\\')
+        clean_stage[k] = ' ';
+    }
+
+    ResourceUsage usage = resource_usage(false);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3)
+       << "{\"program\": \"" << g_program << "\", \"host\": \"" << host << "\""
+       << ", \"pid\": "        << getpid()
+       << ", \"stage\": \""    << clean_stage << "\""
+       << ", \"progress\": "   << progress
+       << ", \"elapsed_s\": "  << elapsed_s
+       << ", \"eta_s\": "      << eta_s
+       << ", \"finished\": "   << (finished ? "true" : "false")
+       << ", \"cpu_s\": "      << usage.cpu_s
+       << ", \"peak_rss_mb\": " << usage.peak_rss_mb
+       << std::setprecision(0)
+       << ", \"read_bytes\": "  << usage.read_bytes
+       << ", \"write_bytes\": " << usage.write_bytes
+       << std::setprecision(3)
+       << ", \"updated\": "   << usage.wall_s << "}\n";
+
+    // Write a temporary file, then rename it, which replaces the old
+    // status atomically
+    vw::Mutex::Lock lock(g_status_mutex);
+    std::string tmp_file = g_status_file + ".tmp";
+    std::ofstream ofs(tmp_file.c_str());
+    ofs << os.str();
+    ofs.close();
+    if (!ofs || rename(tmp_file.c_str(), g_status_file.c_str()) != 0)
+      vw_out(WarningMessage) << "Could not write the status file: " << g_status_file << "\n";
+  }
+
+  StatusProgressCallback::StatusProgressCallback(std::string const& ns, std::string const& pre,
+                                                 double min_interval):
+    vw::TerminalProgressCallback(ns, pre), m_stage(stage_name(pre)),
+    m_min_interval(min_interval), m_start_time(-1), m_last_write(-1) {}
+
+  StatusProgressCallback::StatusProgressCallback(std::string const& ns, std::string const& pre,
+                                                 std::string const& stage, double min_interval):
+    vw::TerminalProgressCallback(ns, pre), m_stage(stage),
+    m_min_interval(min_interval), m_start_time(-1), m_last_write(-1) {}
+
+  void StatusProgressCallback::report_progress(double progress) const {
+    vw::TerminalProgressCallback::report_progress(progress);
+    if (!progress_status_enabled())
+      return;
+    double now = now_seconds();
+    if (m_start_time < 0)
+      m_start_time = now;
+    if (m_last_write >= 0 && now - m_last_write < m_min_interval)
+      return;
+    m_last_write = now;
+    write_progress_status(m_stage, progress, now - m_start_time, false);
+  }
+
+  void StatusProgressCallback::report_finished() const {
+    vw::TerminalProgressCallback::report_finished();
+    if (!progress_status_enabled())
+      return;
+    double now = now_seconds();
+    if (m_start_time < 0)
+      m_start_time = now;
+    write_progress_status(m_stage, 1.0, now - m_start_time, true);
+  }
+
+} // namespace asp
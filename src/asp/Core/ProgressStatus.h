@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ProgressStatus.h
+///
+/// A machine-readable status file for long-running tools, so that job
+/// schedulers and parallel_stereo can follow the progress of each
+/// process. The file is a single JSON object with the program, host,
+/// pid, current stage, progress, elapsed time, ETA and resource use. It
+/// is replaced atomically (written to a temporary file, then renamed),
+/// so a reader never sees it half-written.
+
+#ifndef __ASP_CORE_PROGRESS_STATUS_H__
+#define __ASP_CORE_PROGRESS_STATUS_H__
+
+#include <vw/Core/ProgressCallback.h>
+#include <string>
+
+namespace asp {
+
+  /// Write the status of this process to the given file from now on.
+  /// Only the first call has an effect.
+  void set_progress_status_file(std::string const& file, std::string const& program);
+
+  /// If set_progress_status_file() was called
+  bool progress_status_enabled();
+
+  /// Replace the status file. The progress is between 0 and 1, and the
+  /// elapsed time is for the current stage. Does nothing if no status
+  /// file was set.
+  void write_progress_status(std::string const& stage, double progress,
+                             double elapsed_s, bool finished);
+
+  /// A terminal progress callback which also updates the status file,
+  /// at most every min_interval seconds, and when it finishes. The
+  /// stage is taken from the message, such as "\t--> Correlation :",
+  /// unless given.
+  class StatusProgressCallback: public vw::TerminalProgressCallback {
+    std::string    m_stage;
+    double         m_min_interval;
+    mutable double m_start_time, m_last_write;
+  public:
+    StatusProgressCallback(std::string const& ns, std::string const& pre,
+                           double min_interval = 5.0);
+    StatusProgressCallback(std::string const& ns, std::string const& pre,
+                           std::string const& stage, double min_interval = 5.0);
+    virtual void report_progress(double progress) const;
+    virtual void report_finished() const;
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_PROGRESS_STATUS_H__
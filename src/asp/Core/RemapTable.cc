@@ -0,0 +1,111 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/RemapTable.h>
+#include <vw/Core/Log.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResource.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <cmath>
+#include <fstream>
+
+using namespace vw;
+
+namespace asp {
+
+RemapTable::RemapTable(ImageView<Vector2f> const& offsets, int spacing):
+  m_offsets(offsets), m_spacing(spacing) {
+  if (spacing <= 0 || offsets.cols() < 2 || offsets.rows() < 2)
+    vw_throw( ArgumentErr() << "A remap table needs at least 2x2 nodes and a positive spacing.\n" );
+}
+
+Vector2 RemapTable::reverse(Vector2 const& p) const {
+  double x = p.x()/m_spacing, y = p.y()/m_spacing;
+  int col = std::max(0, std::min(m_offsets.cols() - 2, int(std::floor(x))));
+  int row = std::max(0, std::min(m_offsets.rows() - 2, int(std::floor(y))));
+  double fx = x - col, fy = y - row;
+  Vector2 offset = (1-fx)*(1-fy)*Vector2(m_offsets(col,   row  ))
+                 +    fx *(1-fy)*Vector2(m_offsets(col+1, row  ))
+                 + (1-fx)*   fy *Vector2(m_offsets(col,   row+1))
+                 +    fx *   fy *Vector2(m_offsets(col+1, row+1));
+  return p + offset;
+}
+
+Vector2 RemapTable::forward(Vector2 const& /*p*/) const {
+  vw_throw( NoImplErr() << "RemapTable only maps output pixels to input pixels.\n" );
+  return Vector2();
+}
+
+void RemapTable::write(std::string const& prefix, std::string const& key) const {
+  // The text file is written last, so a table is not read back for
+  // its key unless it was written fully.
+  boost::filesystem::remove(prefix + ".txt");
+  write_image(prefix + ".tif", m_offsets);
+
+  std::ofstream ofs((prefix + ".txt").c_str());
+  ofs << m_spacing << "\n" << key << "\n";
+  if (!ofs)
+    vw_throw( IOErr() << "Failed to write: " << prefix << ".txt.\n" );
+}
+
+bool RemapTable::read(std::string const& prefix, std::string const& key) {
+  std::string txt_file = prefix + ".txt", tif_file = prefix + ".tif";
+  if (!boost::filesystem::exists(txt_file) || !boost::filesystem::exists(tif_file))
+    return false;
+
+  std::ifstream ifs(txt_file.c_str());
+  int spacing = 0;
+  std::string line, file_key;
+  ifs >> spacing;
+  std::getline(ifs, line); // the rest of the first line
+  while (std::getline(ifs, line))
+    file_key += (file_key.empty() ? "" : "\n") + line;
+  if (spacing <= 0 || file_key != key)
+    return false;
+
+  ImageView<Vector2f> offsets = DiskImageView<Vector2f>(tif_file);
+  *this = RemapTable(offsets, spacing);
+  return true;
+}
+
+double remap_lattice_error(ImageView<Vector2> const& lattice) {
+  double max_error = 0;
+  for (int row = 0; row < lattice.rows(); row++) {
+    for (int col = 0; col < lattice.cols(); col++) {
+      Vector2 node = lattice(col, row);
+      if (!(std::abs(node.x()) < std::numeric_limits<double>::max()) ||
+          !(std::abs(node.y()) < std::numeric_limits<double>::max()))
+        return -1.0; // NaN or infinite
+      if (row % 2 == 0 && col % 2 == 0)
+        continue; // a node of the table
+
+      // Interpolate from the even nodes around, the midpoint of two
+      // of them on an edge, or of four at the center of a cell.
+      int c0 = col - col % 2, c1 = col + col % 2;
+      int r0 = row - row % 2, r1 = row + row % 2;
+      Vector2 interp = 0.25*(lattice(c0, r0) + lattice(c1, r0) +
+                             lattice(c0, r1) + lattice(c1, r1));
+      max_error = std::max(max_error, norm_2(interp - node));
+    }
+  }
+  return max_error;
+}
+
+} // namespace asp
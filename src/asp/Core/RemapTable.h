@@ -0,0 +1,191 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file RemapTable.h
+///
+/// A transform from the pixels of an output image to those of an input
+/// image, tabulated on a lattice of the output pixels and interpolated
+/// bilinearly in between, for resampling an image with a transform
+/// which is slow to evaluate, such as one going through the lens
+/// distortion of a camera.
+///
+/// The table holds, at each node of the lattice, the offset from the
+/// node to its input pixel, with float channels. The lattice spacing
+/// starts at REMAP_TABLE_MAX_SPACING pixels and is halved until the
+/// table agrees with the transform within a given error at the centers
+/// of the lattice cells. If it does not at REMAP_TABLE_MIN_SPACING
+/// pixels, or if the transform fails at a node, no table is made.
+///
+/// A table can be saved, as a .tif file of the offsets with a .txt
+/// file holding its spacing and a key, such as one made of the camera
+/// files it came from, and it is only read back for the same key.
+
+#ifndef __ASP_CORE_REMAP_TABLE_H__
+#define __ASP_CORE_REMAP_TABLE_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Transform.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <string>
+
+namespace asp {
+
+  const int REMAP_TABLE_MAX_SPACING = 32;
+  const int REMAP_TABLE_MIN_SPACING = 4;
+
+  class RemapTable: public vw::TransformHelper<RemapTable, vw::ContinuousFunction,
+                                               vw::ContinuousFunction> {
+  public:
+    RemapTable(): m_spacing(0) {}
+
+    /// The offsets at the nodes of a lattice with the given spacing,
+    /// starting at pixel (0, 0).
+    RemapTable(vw::ImageView<vw::Vector2f> const& offsets, int spacing);
+
+    int spacing() const { return m_spacing; }
+    vw::ImageView<vw::Vector2f> const& offsets() const { return m_offsets; }
+
+    /// The input pixel of an output pixel. Beyond the lattice, the
+    /// nearest cell is extrapolated.
+    vw::Vector2 reverse(vw::Vector2 const& p) const;
+
+    /// Not available, this throws
+    vw::Vector2 forward(vw::Vector2 const& p) const;
+
+    /// Save the table to <prefix>.tif and <prefix>.txt
+    void write(std::string const& prefix, std::string const& key) const;
+
+    /// Read the table saved with write(), if there is one with this
+    /// key, and return true if so.
+    bool read(std::string const& prefix, std::string const& key);
+
+  private:
+    vw::ImageView<vw::Vector2f> m_offsets;
+    int m_spacing;
+  };
+
+  /// Make a table of the reverse() of a transform over an output image
+  /// of the given size, from which in_offset is subtracted, as when
+  /// the input image is a crop starting there. The transform is
+  /// evaluated with the default number of threads. Return false if no
+  /// table agrees with it within max_error pixels, as above.
+  template <class TxT>
+  bool make_remap_table(TxT const& tx, vw::Vector2i const& size, vw::Vector2 const& in_offset,
+                        double max_error, RemapTable & table);
+
+  /// The largest distance between the bilinear interpolation of the
+  /// even nodes of a lattice, at its odd nodes, and those nodes, or a
+  /// negative value if a node is not finite.
+  double remap_lattice_error(vw::ImageView<vw::Vector2> const& lattice);
+
+  //----------------------------------------------------------------------
+  // Template function definitions
+
+  namespace detail {
+
+    /// Evaluates the offsets of a band of rows of a lattice
+    template <class TxT>
+    class RemapLatticeTask: public vw::Task, private boost::noncopyable {
+      TxT const&                   m_tx;
+      vw::Vector2                  m_in_offset;
+      int                          m_spacing, m_beg_row, m_end_row;
+      vw::ImageView<vw::Vector2> & m_lattice;
+    public:
+      RemapLatticeTask(TxT const& tx, vw::Vector2 const& in_offset, int spacing,
+                       int beg_row, int end_row, vw::ImageView<vw::Vector2> & lattice):
+        m_tx(tx), m_in_offset(in_offset), m_spacing(spacing),
+        m_beg_row(beg_row), m_end_row(end_row), m_lattice(lattice) {}
+
+      virtual void operator()() {
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        for (int row = m_beg_row; row < m_end_row; row++) {
+          for (int col = 0; col < m_lattice.cols(); col++) {
+            vw::Vector2 p(col*m_spacing, row*m_spacing);
+            try {
+              m_lattice(col, row) = m_tx.reverse(p) - m_in_offset - p;
+            } catch (std::exception const&) {
+              m_lattice(col, row) = vw::Vector2(nan, nan);
+            }
+          }
+        }
+      }
+    };
+
+    /// The offsets at the nodes of a lattice covering an image of the
+    /// given size with cells of the given spacing, and with the cell
+    /// centers as nodes too, so the lattice spacing is half of that.
+    template <class TxT>
+    vw::ImageView<vw::Vector2> remap_lattice(TxT const& tx, vw::Vector2i const& size,
+                                             vw::Vector2 const& in_offset, int spacing) {
+      int cells_x = std::max(1, (size.x() - 1 + spacing - 1)/spacing);
+      int cells_y = std::max(1, (size.y() - 1 + spacing - 1)/spacing);
+      vw::ImageView<vw::Vector2> lattice(2*cells_x + 1, 2*cells_y + 1);
+
+      int num_tasks = std::max(1, std::min(int(vw::vw_settings().default_num_threads()),
+                                           lattice.rows()));
+      vw::FifoWorkQueue queue(num_tasks);
+      for (int t = 0; t < num_tasks; t++) {
+        int beg = int((long long)lattice.rows()*t/num_tasks);
+        int end = int((long long)lattice.rows()*(t+1)/num_tasks);
+        boost::shared_ptr< RemapLatticeTask<TxT> >
+          task(new RemapLatticeTask<TxT>(tx, in_offset, spacing/2, beg, end, lattice));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      return lattice;
+    }
+
+  } // namespace detail
+
+  template <class TxT>
+  bool make_remap_table(TxT const& tx, vw::Vector2i const& size, vw::Vector2 const& in_offset,
+                        double max_error, RemapTable & table) {
+    for (int spacing = REMAP_TABLE_MAX_SPACING; spacing >= REMAP_TABLE_MIN_SPACING;
+         spacing /= 2) {
+      vw::ImageView<vw::Vector2> lattice
+        = detail::remap_lattice(tx, size, in_offset, spacing);
+      double error = remap_lattice_error(lattice);
+      if (error < 0)
+        return false; // the transform failed somewhere, which won't go away
+      if (error > max_error)
+        continue;
+
+      vw::ImageView<vw::Vector2f> offsets(lattice.cols()/2 + 1, lattice.rows()/2 + 1);
+      for (int row = 0; row < offsets.rows(); row++)
+        for (int col = 0; col < offsets.cols(); col++)
+          offsets(col, row) = lattice(2*col, 2*row);
+      table = RemapTable(offsets, spacing);
+      return true;
+    }
+    return false;
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_REMAP_TABLE_H__
@@ -0,0 +1,219 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SharedDem.cc
+///
+
+#include <asp/Core/SharedDem.h>
+#include <asp/Core/MappedTiff.h>
+#include <asp/Core/DecodedImageCache.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Beyond this many pixels, the region of a DEM which is not mapped is
+  // not read into memory for a batch, and the pixels are read one by one.
+  const double MAX_BATCH_REGION_PIXELS = 2.5e+8;
+
+  /// The pixels of a mapped DEM
+  struct MappedPixels {
+    MappedTiffFile const& file;
+    explicit MappedPixels(MappedTiffFile const& f): file(f) {}
+    float operator()(int col, int row) const {
+      return *reinterpret_cast<const float*>(file.pixel_address(col, row));
+    }
+  };
+
+  /// The pixels of a region of the DEM read into memory
+  struct RegionPixels {
+    ImageView<float> const& region;
+    int col0, row0;
+    RegionPixels(ImageView<float> const& r, int c, int rr): region(r), col0(c), row0(rr) {}
+    float operator()(int col, int row) const { return region(col - col0, row - row0); }
+  };
+
+  /// The pixels of the DEM, read one at a time
+  struct ViewPixels {
+    ImageViewRef<float> const& dem;
+    explicit ViewPixels(ImageViewRef<float> const& d): dem(d) {}
+    float operator()(int col, int row) const { return dem(col, row); }
+  };
+
+  /// The Catmull-Rom weights of the 4 samples around t in [0, 1)
+  void cubic_weights(double t, double w[4]) {
+    double t2 = t*t, t3 = t2*t;
+    w[0] = 0.5*(-t3 + 2*t2 - t);
+    w[1] = 0.5*(3*t3 - 5*t2 + 2);
+    w[2] = 0.5*(-3*t3 + 4*t2 + t);
+    w[3] = 0.5*(t3 - t2);
+  }
+
+  /// Interpolate the heights at the pixels. The samples past the edges
+  /// are those at the edges.
+  template <class PixelsT>
+  void interpolate_pixels(PixelsT const& dem, int cols, int rows,
+                          bool has_nodata, double nodata, bool bicubic,
+                          std::vector<Vector2> const& pixels,
+                          std::vector< PixelMask<float> > & heights) {
+    heights.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) {
+      double x = pixels[i][0], y = pixels[i][1];
+      heights[i] = PixelMask<float>();
+      heights[i].invalidate();
+      if (!(x >= 0 && x <= cols - 1 && y >= 0 && y <= rows - 1))
+        continue;
+
+      int c0 = std::min(int(std::floor(x)), cols - 1);
+      int r0 = std::min(int(std::floor(y)), rows - 1);
+      double wx[4], wy[4];
+      int beg, end;
+      if (bicubic) {
+        cubic_weights(x - c0, wx);
+        cubic_weights(y - r0, wy);
+        beg = -1; end = 3;
+      } else {
+        wx[1] = 1.0 - (x - c0); wx[2] = x - c0;
+        wy[1] = 1.0 - (y - r0); wy[2] = y - r0;
+        beg = 0; end = 2;
+      }
+
+      double sum = 0.0;
+      bool valid = true;
+      for (int dr = beg; dr < end && valid; dr++) {
+        int r = std::max(0, std::min(rows - 1, r0 + dr));
+        for (int dc = beg; dc < end; dc++) {
+          double w = wx[dc + 1]*wy[dr + 1];
+          int c = std::max(0, std::min(cols - 1, c0 + dc));
+          float v = dem(c, r);
+          if (std::isnan(v) || (has_nodata && v == nodata)) {
+            // A sample which does not count is no reason to give up
+            if (w == 0.0)
+              continue;
+            valid = false;
+            break;
+          }
+          sum += w*v;
+        }
+      }
+      if (valid)
+        heights[i] = PixelMask<float>(float(sum));
+    }
+  }
+
+} // end anonymous namespace
+
+SharedDem::SharedDem(std::string const& dem_file, std::string const& cache_dir,
+                     int num_threads):
+  m_file(dem_file), m_has_nodata(false), m_nodata(0.0) {
+
+  if (!vw::cartography::read_georeference(m_georef, dem_file))
+    vw_throw( ArgumentErr() << "There is no georeference information in: " << dem_file << ".\n" );
+  {
+    boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(dem_file));
+    if (rsrc->has_nodata_read()) {
+      m_has_nodata = true;
+      m_nodata     = rsrc->nodata_read();
+    }
+  }
+
+  // Map the DEM as it is if it has float pixels on disk, else convert it
+  m_mapped = MappedTiffFile::open(dem_file);
+  if (m_mapped && !has_pixel_layout<float>(*m_mapped))
+    m_mapped.reset();
+  if (!m_mapped && !cache_dir.empty()) {
+    m_file   = float_image_path(dem_file, cache_dir, num_threads);
+    m_mapped = MappedTiffFile::open(m_file);
+    if (m_mapped && !has_pixel_layout<float>(*m_mapped))
+      m_mapped.reset();
+  }
+
+  if (m_mapped) {
+    vw_out() << "Mapped the DEM in memory: " << m_file << "\n";
+    m_dem = MappedTiffView<float>(m_mapped);
+  } else {
+    m_dem = DiskImageView<float>(m_file);
+  }
+}
+
+ImageViewRef< PixelMask<float> > SharedDem::masked_dem() const {
+  if (m_has_nodata)
+    return create_mask(m_dem, m_nodata);
+  return pixel_cast< PixelMask<float> >(m_dem);
+}
+
+void SharedDem::interpolate(std::vector<Vector2> const& pixels,
+                            std::vector< PixelMask<float> > & heights,
+                            bool bicubic) const {
+  int cols = m_dem.cols(), rows = m_dem.rows();
+  if (m_mapped) {
+    interpolate_pixels(MappedPixels(*m_mapped), cols, rows, m_has_nodata, m_nodata, bicubic,
+                       pixels, heights);
+    return;
+  }
+
+  // Read the region of the DEM the pixels need at once
+  BBox2i box;
+  int margin = bicubic ? 2 : 1;
+  for (size_t i = 0; i < pixels.size(); i++) {
+    if (!(pixels[i][0] >= 0 && pixels[i][0] <= cols - 1 &&
+          pixels[i][1] >= 0 && pixels[i][1] <= rows - 1))
+      continue;
+    int c = int(std::floor(pixels[i][0])), r = int(std::floor(pixels[i][1]));
+    box.grow(BBox2i(c - margin + 1, r - margin + 1, 2*margin, 2*margin));
+  }
+  box.crop(BBox2i(0, 0, cols, rows));
+  if (box.empty() || double(box.width())*box.height() > MAX_BATCH_REGION_PIXELS) {
+    interpolate_pixels(ViewPixels(m_dem), cols, rows, m_has_nodata, m_nodata, bicubic,
+                       pixels, heights);
+    return;
+  }
+  ImageView<float> region = crop(m_dem, box);
+  interpolate_pixels(RegionPixels(region, box.min().x(), box.min().y()), cols, rows,
+                     m_has_nodata, m_nodata, bicubic, pixels, heights);
+}
+
+void SharedDem::interpolate_lonlat(std::vector<Vector2> const& lonlats,
+                                   std::vector< PixelMask<float> > & heights,
+                                   bool bicubic) const {
+  std::vector<Vector2> pixels(lonlats.size());
+  for (size_t i = 0; i < lonlats.size(); i++) {
+    try {
+      pixels[i] = m_georef.lonlat_to_pixel(lonlats[i]);
+    } catch (...) {
+      pixels[i] = Vector2(-1, -1); // Outside
+    }
+  }
+  interpolate(pixels, heights, bicubic);
+}
+
+} // namespace asp
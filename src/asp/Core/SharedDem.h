@@ -0,0 +1,92 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SharedDem.h
+///
+/// A reference DEM which the processes on a machine share, rather
+/// than each reading and caching its own copy of the tiles.
+///
+/// With a cache directory, the DEM is converted once per machine into
+/// an uncompressed tiled GeoTIFF with float pixels there, as done by
+/// float_image_path(), and that file is mapped in memory. The pages of
+/// a mapped file are in the page cache of the system, so they are read
+/// from disk once, and all processes mapping the file use them. A DEM
+/// which is already an uncompressed float GeoTIFF is mapped as it is.
+/// Otherwise the DEM is read with DiskImageView as before.
+///
+/// Heights at many pixels are interpolated with one call, which, for a
+/// DEM which is not mapped, reads the region of the DEM the pixels are
+/// in at once rather than pixel by pixel.
+
+#ifndef __ASP_CORE_SHARED_DEM_H__
+#define __ASP_CORE_SHARED_DEM_H__
+
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Math/Vector.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class MappedTiffFile;
+
+  class SharedDem {
+  public:
+    /// Open the DEM, converted and mapped as above if the cache
+    /// directory is not empty. The conversion uses the given number of
+    /// threads.
+    SharedDem(std::string const& dem_file, std::string const& cache_dir, int num_threads);
+
+    std::string const& file() const { return m_file; }
+    vw::cartography::GeoReference const& georef() const { return m_georef; }
+    bool   has_nodata() const { return m_has_nodata; }
+    double nodata()     const { return m_nodata; }
+    int    cols()       const { return m_dem.cols(); }
+    int    rows()       const { return m_dem.rows(); }
+    bool   is_mapped()  const { return bool(m_mapped); }
+
+    /// The DEM, with the pixels equal to the nodata value invalid
+    vw::ImageViewRef< vw::PixelMask<float> > masked_dem() const;
+
+    /// The heights at the given pixels, with bilinear interpolation, or
+    /// bicubic if asked. A height is invalid if the pixel is outside
+    /// the DEM or a height it is interpolated from is nodata.
+    void interpolate(std::vector<vw::Vector2> const& pixels,
+                     std::vector< vw::PixelMask<float> > & heights,
+                     bool bicubic = false) const;
+
+    /// The heights at the given lon-lat positions, as interpolate()
+    void interpolate_lonlat(std::vector<vw::Vector2> const& lonlats,
+                            std::vector< vw::PixelMask<float> > & heights,
+                            bool bicubic = false) const;
+
+  private:
+    std::string                       m_file;   ///< The file read, maybe the converted one
+    vw::cartography::GeoReference     m_georef;
+    bool                              m_has_nodata;
+    double                            m_nodata;
+    boost::shared_ptr<MappedTiffFile> m_mapped;
+    vw::ImageViewRef<float>           m_dem;
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_SHARED_DEM_H__
@@ -0,0 +1,277 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SmallBlobs.cc
+///
+
+#include <asp/Core/SmallBlobs.h>
+#include <vw/Core/Exception.h>
+#include <algorithm>
+
+using namespace vw;
+
+namespace {
+
+  inline int find_root(std::vector<int> & parent, int x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  inline void join(std::vector<int> & parent, int a, int b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b)
+      parent[b] = a;
+    else if (b < a)
+      parent[a] = b;
+  }
+
+  // Label the 4-connected components of the valid pixels in rows
+  // [beg, end). Each valid pixel gets the index of its component, and
+  // the others get -1. Returns the number of components, and for each
+  // its area and whether it touches the image border. The words with
+  // no valid pixels are skipped.
+  int label_band(asp::BitImage const& valid, int beg, int end,
+                 std::vector<int> & labels, std::vector<int64> & areas,
+                 std::vector<char> & on_border) {
+
+    int cols = valid.cols();
+    labels.assign(size_t(end - beg)*cols, -1);
+    std::vector<int> parent;
+    for (int row = beg; row < end; row++) {
+      int* curr = &labels[size_t(row - beg)*cols];
+      int* prev = (row > beg) ? curr - cols : NULL;
+      for (int w = 0; w < valid.words_per_row(); w++) {
+        uint64 word = valid.word(w, row);
+        for (int bit = 0; word != 0; bit++, word >>= 1) {
+          if (!(word & 1ULL))
+            continue;
+          int col   = 64*w + bit;
+          int left  = (col > 0) ? curr[col - 1] : -1;
+          int above = prev ? prev[col] : -1;
+          if (left < 0 && above < 0) {
+            curr[col] = parent.size();
+            parent.push_back(curr[col]);
+          } else if (left >= 0 && above >= 0) {
+            curr[col] = left;
+            join(parent, left, above);
+          } else {
+            curr[col] = std::max(left, above);
+          }
+        }
+      }
+    }
+
+    // Replace the labels with consecutive component indices
+    std::vector<int> component(parent.size(), -1);
+    int num_components = 0;
+    areas.clear();
+    on_border.clear();
+    for (size_t k = 0; k < labels.size(); k++) {
+      if (labels[k] < 0)
+        continue;
+      int root = find_root(parent, labels[k]);
+      if (component[root] < 0) {
+        component[root] = num_components++;
+        areas.push_back(0);
+        on_border.push_back(0);
+      }
+      labels[k] = component[root];
+      areas[labels[k]]++;
+      int col = k % cols, row = beg + k / cols;
+      if (col == 0 || col == cols - 1 || row == 0 || row == valid.rows() - 1)
+        on_border[labels[k]] = 1;
+    }
+    return num_components;
+  }
+
+  // The components of a band which reach its first or last row, and so
+  // may continue in the next band. These are renumbered from 0 here.
+  struct BandBoundary {
+    std::vector<int>   top, bottom;  // boundary component of each column, or -1
+    std::vector<int64> areas;        // area of each boundary component in the band
+    std::vector<char>  on_border;    // if it touches the image border in the band
+  };
+
+  // Label a band. Mark the pixels of the small components not reaching
+  // the band boundaries, and record the others. If is_small is not empty,
+  // which happens once the boundary components are merged across bands,
+  // mark instead the pixels of the boundary components it flags. If
+  // enclosed_only is set, the components touching the image border are
+  // never marked.
+  class BandBlobTask: public Task, private boost::noncopyable {
+    asp::BitImage const&     m_valid;
+    int                      m_max_area, m_beg, m_end;
+    bool                     m_enclosed_only;
+    BandBoundary           & m_boundary;
+    std::vector<char> const& m_is_small;
+    asp::BitImage          & m_small;
+  public:
+    BandBlobTask(asp::BitImage const& valid, int max_area, int beg, int end,
+                 bool enclosed_only, BandBoundary & boundary,
+                 std::vector<char> const& is_small, asp::BitImage & small):
+      m_valid(valid), m_max_area(max_area), m_beg(beg), m_end(end),
+      m_enclosed_only(enclosed_only), m_boundary(boundary),
+      m_is_small(is_small), m_small(small) {}
+
+    void operator()() {
+      int cols = m_valid.cols();
+      std::vector<int>   labels;
+      std::vector<int64> areas;
+      std::vector<char>  on_border;
+      int num_components = label_band(m_valid, m_beg, m_end, labels, areas, on_border);
+
+      // Find which components touch a boundary shared with another band
+      std::vector<int> boundary_index(num_components, -1);
+      int num_boundary = 0;
+      int last = (m_end - m_beg - 1)*cols;
+      for (int side = 0; side < 2; side++) {
+        bool inner = (side == 0) ? (m_beg > 0) : (m_end < m_valid.rows());
+        if (!inner)
+          continue;
+        int start = (side == 0) ? 0 : last;
+        for (int col = 0; col < cols; col++) {
+          int c = labels[start + col];
+          if (c >= 0 && boundary_index[c] < 0)
+            boundary_index[c] = num_boundary++;
+        }
+      }
+
+      bool merged = !m_is_small.empty();
+      if (!merged) {
+        m_boundary.top.assign(cols, -1);
+        m_boundary.bottom.assign(cols, -1);
+        m_boundary.areas.assign(num_boundary, 0);
+        m_boundary.on_border.assign(num_boundary, 0);
+        for (int c = 0; c < num_components; c++) {
+          if (boundary_index[c] >= 0) {
+            m_boundary.areas[boundary_index[c]]     = areas[c];
+            m_boundary.on_border[boundary_index[c]] = on_border[c];
+          }
+        }
+        for (int col = 0; col < cols; col++) {
+          int top = labels[col], bottom = labels[last + col];
+          if (top >= 0)
+            m_boundary.top[col] = boundary_index[top];
+          if (bottom >= 0)
+            m_boundary.bottom[col] = boundary_index[bottom];
+        }
+      }
+
+      for (int row = m_beg; row < m_end; row++) {
+        int const* curr = &labels[size_t(row - m_beg)*cols];
+        for (int col = 0; col < cols; col++) {
+          int c = curr[col];
+          if (c < 0)
+            continue;
+          int b = boundary_index[c];
+          bool mark = merged ? (b >= 0 && m_is_small[b]) :
+                               (b < 0 && areas[c] <= m_max_area &&
+                                !(m_enclosed_only && on_border[c]));
+          if (mark)
+            m_small.set(col, row);
+        }
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+namespace asp {
+
+  void mark_small_blobs(BitImage const& valid, int max_area, int num_threads,
+                        BitImage & small, bool enclosed_only) {
+
+    small = BitImage(valid.cols(), valid.rows());
+    if (max_area <= 0 || valid.cols() == 0 || valid.rows() == 0)
+      return;
+    num_threads = std::max(num_threads, 1);
+
+    // A few bands per thread, each of at least 64 rows, so that few
+    // components cross the band boundaries
+    int num_bands   = std::max(1, std::min(4*num_threads, valid.rows()/64));
+    int band_height = (valid.rows() + num_bands - 1)/num_bands;
+    num_bands       = (valid.rows() + band_height - 1)/band_height;
+
+    std::vector<BandBoundary> boundaries(num_bands);
+    std::vector<std::vector<char> > is_small(num_bands);
+    {
+      FifoWorkQueue queue(num_threads);
+      for (int b = 0; b < num_bands; b++) {
+        int beg = b*band_height, end = std::min(beg + band_height, valid.rows());
+        boost::shared_ptr<BandBlobTask>
+          task(new BandBlobTask(valid, max_area, beg, end, enclosed_only,
+                                boundaries[b], is_small[b], small));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    // Merge the boundary components across bands. A component at the
+    // bottom of a band joins the one right below it, at the top of the
+    // next band.
+    std::vector<int> offsets(num_bands + 1, 0);
+    for (int b = 0; b < num_bands; b++)
+      offsets[b + 1] = offsets[b] + boundaries[b].areas.size();
+    std::vector<int> parent(offsets[num_bands]);
+    for (size_t k = 0; k < parent.size(); k++)
+      parent[k] = k;
+    for (int b = 0; b + 1 < num_bands; b++) {
+      for (int col = 0; col < valid.cols(); col++) {
+        int up = boundaries[b].bottom[col], down = boundaries[b + 1].top[col];
+        if (up >= 0 && down >= 0)
+          join(parent, offsets[b] + up, offsets[b + 1] + down);
+      }
+    }
+    std::vector<int64> total_areas(parent.size(), 0);
+    std::vector<char>  on_border(parent.size(), 0);
+    for (int b = 0; b < num_bands; b++) {
+      for (size_t k = 0; k < boundaries[b].areas.size(); k++) {
+        int root = find_root(parent, offsets[b] + k);
+        total_areas[root] += boundaries[b].areas[k];
+        if (boundaries[b].on_border[k])
+          on_border[root] = 1;
+      }
+    }
+
+    // Mark the small merged components, relabeling only the bands having some
+    FifoWorkQueue queue(num_threads);
+    for (int b = 0; b < num_bands; b++) {
+      bool any = false;
+      is_small[b].assign(boundaries[b].areas.size(), 0);
+      for (size_t k = 0; k < is_small[b].size(); k++) {
+        int root = find_root(parent, offsets[b] + k);
+        is_small[b][k] = (total_areas[root] <= max_area &&
+                          !(enclosed_only && on_border[root]));
+        any = any || is_small[b][k];
+      }
+      if (!any)
+        continue;
+      int beg = b*band_height, end = std::min(beg + band_height, valid.rows());
+      boost::shared_ptr<BandBlobTask>
+        task(new BandBlobTask(valid, max_area, beg, end, enclosed_only,
+                              boundaries[b], is_small[b], small));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+} // namespace asp
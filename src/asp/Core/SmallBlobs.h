@@ -0,0 +1,177 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SmallBlobs.h
+///
+/// Find the small islands of valid pixels over a whole image, to erode
+/// them. The image is split into bands of rows, the 4-connected
+/// components of each band are found with union-find in parallel, and
+/// the components touching the band boundaries are then merged across
+/// bands. So the area of each island is exact no matter how many bands
+/// it spans, unlike when eroding each tile with a margin. The pixel
+/// validity, and the result, are kept one bit per pixel.
+
+#ifndef __ASP_CORE_SMALL_BLOBS_H__
+#define __ASP_CORE_SMALL_BLOBS_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace asp {
+
+  /// A boolean image, one bit per pixel. Each row starts at a new
+  /// 64-bit word, so different threads may set the bits of different rows.
+  class BitImage {
+    int m_cols, m_rows, m_words_per_row;
+    std::vector<vw::uint64> m_words;
+  public:
+    BitImage(): m_cols(0), m_rows(0), m_words_per_row(0) {}
+    BitImage(int cols, int rows):
+      m_cols(cols), m_rows(rows), m_words_per_row((cols + 63)/64),
+      m_words(size_t(m_words_per_row)*rows, 0) {}
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    int words_per_row() const { return m_words_per_row; }
+
+    /// The word holding pixels 64*w to 64*w + 63 of the given row
+    vw::uint64 word(int w, int row) const {
+      return m_words[size_t(row)*m_words_per_row + w];
+    }
+    bool get(int col, int row) const {
+      return (word(col/64, row) >> (col % 64)) & 1ULL;
+    }
+    void set(int col, int row) {
+      m_words[size_t(row)*m_words_per_row + col/64] |= (1ULL << (col % 64));
+    }
+  };
+
+  /// Mark the valid pixels belonging to 4-connected components of at
+  /// most max_area pixels. If enclosed_only is set, skip the components
+  /// touching the image border. The rows are split into bands handled
+  /// by the given number of threads.
+  void mark_small_blobs(BitImage const& valid, int max_area, int num_threads,
+                        BitImage & small, bool enclosed_only = false);
+
+  /// Record the valid pixels of a band of rows of an image
+  template <class ImageT>
+  class ValidBitsTask: public vw::Task, private boost::noncopyable {
+    ImageT const& m_img;
+    BitImage    & m_bits;
+    int m_beg, m_end;
+  public:
+    ValidBitsTask(ImageT const& img, BitImage & bits, int beg, int end):
+      m_img(img), m_bits(bits), m_beg(beg), m_end(end) {}
+    void operator()() {
+      vw::ImageView<typename ImageT::pixel_type> band
+        = vw::crop(m_img, vw::BBox2i(0, m_beg, m_img.cols(), m_end - m_beg));
+      for (int row = 0; row < band.rows(); row++) {
+        for (int col = 0; col < band.cols(); col++) {
+          if (is_valid(band(col, row)))
+            m_bits.set(col, row + m_beg);
+        }
+      }
+    }
+  };
+
+  /// Find the valid pixels of a masked image, reading bands of rows
+  /// in parallel.
+  template <class ImageT>
+  BitImage valid_pixel_bits(vw::ImageViewBase<ImageT> const& img, int band_height,
+                            int num_threads) {
+    ImageT const& image = img.impl();
+    BitImage bits(image.cols(), image.rows());
+    vw::FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < image.rows(); beg += band_height) {
+      int end = std::min(beg + band_height, image.rows());
+      boost::shared_ptr<ValidBitsTask<ImageT> >
+        task(new ValidBitsTask<ImageT>(image, bits, beg, end));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    return bits;
+  }
+
+  /// Invalidate the pixels of the image marked in the bit image
+  template <class ImageT>
+  class SmallBlobErodeView: public vw::ImageViewBase<SmallBlobErodeView<ImageT> > {
+    ImageT m_img;
+    boost::shared_ptr<BitImage> m_small;
+  public:
+    SmallBlobErodeView(ImageT const& img, boost::shared_ptr<BitImage> small):
+      m_img(img), m_small(small) {}
+
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<SmallBlobErodeView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(vw::int32 i, vw::int32 j, vw::int32 p = 0) const {
+      pixel_type pix = m_img(i, j, p);
+      if (m_small->get(i, j))
+        invalidate(pix);
+      return pix;
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> tile = vw::crop(m_img, bbox);
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          if (m_small->get(col + bbox.min().x(), row + bbox.min().y()))
+            invalidate(tile(col, row));
+        }
+      }
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Remove the islands of valid pixels of at most max_area pixels
+  /// from the image. The image is read once here, in bands of rows of
+  /// the given height, to find the islands, and again when the
+  /// returned view is rasterized.
+  template <class ImageT>
+  SmallBlobErodeView<ImageT>
+  erode_small_blobs(vw::ImageViewBase<ImageT> const& img, int max_area,
+                    int band_height, int num_threads) {
+    BitImage valid = valid_pixel_bits(img, band_height, num_threads);
+    boost::shared_ptr<BitImage> small(new BitImage(valid.cols(), valid.rows()));
+    mark_small_blobs(valid, max_area, num_threads, *small);
+    return SmallBlobErodeView<ImageT>(img.impl(), small);
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_SMALL_BLOBS_H__
@@ -17,36 +17,27 @@
 
 
 // ===========================================================================
-// The polygon rasterization code is based on s_pgdraw.c and
-// s_pgspan.c from the OpenGL reference implementation
-// ===========================================================================
-
-
-// ===========================================================================
-// NOTE: although within a pixel, we currently don't get results
-// identical to NVIDIA's OpenGL implementation OpenGL version. This
-// may be a difference between the definitions of the pixel center
-// (NVIDIA may use the 0.5 pixel offset). We also may be using a
-// subtly different transform to the final window coords. Should check
-// againt __glUpdateViewport and __glUpdateViewportTransform in
-// s_xform.c. Also code in __glim_Ortho. -- LJE
-// ===========================================================================
-
-// ===========================================================================
-// According to Levoy:
-//
-//     http://graphics.stanford.edu/courses/cs248-01/scan/scan1.html
+// Triangles are rasterized with edge functions (half-space tests)
+// evaluated over 8x8 blocks of pixels. Blocks entirely outside a
+// triangle are skipped, blocks entirely inside are filled without
+// tests, and the rest are tested one row of lanes at a time. The
+// per-lane loops are branch-free so the compiler can vectorize them.
 //
-// SGI "uses a DDA with fixed-point arithmetic. log2N bits of
-// sub-pixel precision for an N-pixel line". This seems to be similar
-// to the approach taken here for polygon rasterization.
+// Pixel (i, j) of the buffer is sampled at window point (i+1, j+1),
+// which is the convention the earlier scanline rasterizer (based on
+// s_pgdraw.c from the OpenGL reference implementation) followed, so
+// DEMs stay registered the same way. A sample exactly on an edge
+// belongs to the triangle for which that edge is a right edge, or a
+// top edge if horizontal, so triangles sharing an edge neither leave
+// gaps nor draw twice.
 // ===========================================================================
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/FundamentalTypes.h>
 #include <asp/Core/SoftwareRenderer.h>
 
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 using namespace vw;
@@ -55,588 +46,193 @@ using namespace stereo;
 enum { eShadeFlat = 0x0, eShadeSmooth = 0x1 };
 
 // ===========================================================================
-// Constants and enums
+// Constants and types
 // ===========================================================================
 
-// NOTE: double does *NOT* work!
-// #define _VW_USE_DOUBLE_
-#ifdef _VW_USE_DOUBLE_
-
-#define __TWO_63 9223372036854775808.0
-#define __FRACTION(result, f) result = (vw::int64) ((f) * __TWO_63)
-#define SHIFT 63
-typedef double RealT;
-
-#else
-
-#define __TWO_31 2147483648.0F
-#define __FRACTION(result, f) result = (vw::int32) ((f) * __TWO_31)
-#define SHIFT 31
-typedef float RealT;
-
-#endif
-
 static const int kVerticesPerTriangle = 3;
 
-// ===========================================================================
-// Type declarations
-// ===========================================================================
-
-// Coordinate structure.  Coordinates contain x, y, z and w.
-struct Coords
-{
-  Coords() {}
-  Coords(float coords[2])
-  {
-    x = coords[0]; y = coords[1]; z = 0.0; w = 1.0;
-  }
-  RealT x, y, z, w;
-};
-
-// Color structure.  Colors are composed of red, green, blue and alpha.
-struct Color
-{
-  Color() {}
-  Color(float gray) { r = gray; g = 0.0; b = 0.0; a = 1.0; }
-  Color(float color[], int numComponents)
-  {
-    switch (numComponents)
-    {
-    case 1:
-      r = color[0]; g = 0.0; b = 0.0; a = 1.0;
-      return;
-    case 3:
-      r = color[0]; g = color[1]; b = color[2]; a = 1.0;
-      return;
-    case 4:
-      r = color[0]; g = color[1]; b = color[2]; a = color[3];
-      return;
-    default:
-      r = 0.0; g = 0.0; b = 0.0; a = 1.0;
+// Blocks are kBlockSize x kBlockSize pixels
+static const int kBlockSize = 8;
+
+// Distance in pixels below which a block corner is considered to be
+// on an edge when classifying whole blocks. This only has to absorb
+// round-off, the per-pixel tests are exact.
+static const double kEdgeMargin = 1e-6;
+
+namespace {
+
+  // A vertex mapped to window coordinates, with its gray value
+  struct WindowVertex {
+    double x, y;
+    float value;
+  };
+
+  // The edge function E(p) = dx*(p.y - y0) - dy*(p.x - x0), with the
+  // end points always taken in the same order regardless of which
+  // triangle the edge belongs to. Two triangles sharing an edge
+  // hence compute bit-identical values with opposite signs.
+  struct EdgeFunction {
+    double x0, y0, dx, dy;
+    double sign;     // Makes E positive inside the triangle
+    bool inclusive;  // Whether samples with E == 0 are inside
+    double margin;
+
+    void setup(WindowVertex const& a, WindowVertex const& b, double orientation) {
+      WindowVertex const* p = &a;
+      WindowVertex const* q = &b;
+      bool swapped = (b.y < a.y) || (b.y == a.y && b.x < a.x);
+      if (swapped)
+        std::swap(p, q);
+      x0 = p->x;
+      y0 = p->y;
+      dx = q->x - p->x;
+      dy = q->y - p->y;
+      sign = swapped ? -orientation : orientation;
+
+      // The gradient of the signed edge function points inside the
+      // triangle. Keep the samples on the edge if the inside is to
+      // the left, or below for horizontal edges.
+      double gx = -sign*dy, gy = sign*dx;
+      inclusive = (gx < 0) || (gx == 0 && gy < 0);
+      margin = kEdgeMargin*(std::abs(dx) + std::abs(dy));
     }
-  }
-  RealT r, g, b, a;
-};
-
-// Interpolator record for color interpolators.  Used for primary and
-// secondary colors;
-struct ColorIterator
-{
-  RealT rLittle, gLittle, bLittle, aLittle;
-  RealT rBig, gBig, bBig, aBig;
-  RealT drdx, dgdx, dbdx, dadx;
-  RealT drdy, dgdy, dbdy, dady;
-};
-
-// A fragment is a collection of all the data needed after
-// rasterization of a primitive has occured, but before the data is
-// entered into various framebuffers.  The data contained in the
-// fragment has been normalized into a form for immediate storage into
-// the framebuffer.
-
-struct FragmentInfo
-{
-  FragmentInfo() {}
-  int x, y;                                // Screen x, y
-  // Colors of the fragment.  When in colorIndexMode only the r
-  // component is valid.
-  Color color;
-};
-
-// Shader record for iterated objects (lines/triangles).  This keeps
-// track of all the various deltas needed to rasterize a triangle.
-struct RasterInfo
-{
-  RasterInfo() {}
-  int dxLeftLittle, dxLeftBig;
-  int dxLeftFrac;
-  int ixLeft, ixLeftFrac;
-
-  int dxRightLittle, dxRightBig;
-  int dxRightFrac;
-  int ixRight, ixRightFrac;
-
-  RealT area;
-  RealT dxAC, dxBC, dyAC, dyBC;
-
-  bool ccw;
-
-  FragmentInfo frag;
-  int length;
 
-  ColorIterator  colorIter;
-
-  unsigned int modeFlags;
-};
-
-struct GraphicsState
-{
-  GraphicsState() {}
-  float *buffer;
-  int numPixels;
-  int width;
-  int height;
-
-  RasterInfo rasterInfo;
-  Color currentFlatColor;
-  // The smallest rectangle that is the intersection of the window clip
-  // and the scissor clip.  If the scissor box is disabled then this
-  // is just the window box. Note that the x0,y0 point is inside the
-  // box but that the x1,y1 point is just outside the box.
-  int clipX0, clipY0, clipX1, clipY1;
-  // The viewport translated into offset window coordinates.  maxx and
-  // maxy are one past the edge (an x coord is in if minx <= x <
-  // maxx).
-  int minx, miny, maxx, maxy;
-};
-
-struct Vertex
-{
-  Vertex(float initCoords[2], float initGray)
-    : color(initGray), window(initCoords) {}
-  Vertex(float initCoords[2], Color initColor)
-    : color(initColor), window(initCoords) {}
-
-  // Current face color in use.
-  Color color;
-  // Window coordinate. This field is filled in when the window clip
-  // coordinate is converted to a drawing surface relative "window"
-  // coordinate. NOTE: the window.w coordinate contains 1/clip.w.
-  Coords window;
-};
-
-
-// ===========================================================================
-// Functions
-// ===========================================================================
-
-inline RealT
-TriangleArea(RealT dxAC, RealT dxBC, RealT dyAC, RealT dyBC)
-{
-  RealT area = dxAC * dyBC - dxBC * dyAC;
-  return area;
-}
-
-static void
-SortVertices(Vertex * &a, Vertex * &b, Vertex * &c)
-{
-  if (*(int *)&a->window.y < *(int *) &b->window.y)
-  {
-    if (*(int *)&b->window.y < *(int *) &c->window.y)      // Already sorted
-    {
-      return;
-    }
-    else
-    {
-      if (*(int *)&a->window.y < *(int *)&c->window.y)
-      {
-        Vertex *temp = b;
-        b = c;
-        c = temp;
-      }
-      else
-      {
-        Vertex *temp = a;
-        a = c;
-        c = b;
-        b = temp;
-      }
-    }
-  }
-  else
-  {
-    if (*(int *)&b->window.y < *(int *)&c->window.y)
-    {
-      if (*(int *)&a->window.y < *(int *)&c->window.y)
-      {
-        Vertex *temp = a;
-        a = b;
-        b = temp;
-      }
-      else
-      {
-        Vertex *temp = a;
-        a = b;
-        b = c;
-        c = temp;
-      }
+    // The part of E which only depends on the row
+    double row_term(double py) const {
+      return dx*(py - y0);
     }
-    else
-    {
-      Vertex *temp = a;
-      a = c;
-      c = temp;
-    }
-   }
-}
 
-static void
-SetInitialParameters(GraphicsState *gc, const Vertex *a, RealT dx, RealT dy)
-{
-  RasterInfo *rasterInfo = &gc->rasterInfo;
-  RealT big = rasterInfo->dxLeftBig;
-  RealT little = rasterInfo->dxLeftLittle;
-  const Color *vertexColor;
-  Color *fragColor;
-  ColorIterator *iter;
-  unsigned int modeFlags = rasterInfo->modeFlags;
-
-  if (big > little)
-  {
-    if (modeFlags & eShadeSmooth)
-    {
-      vertexColor = &a->color;
-      fragColor = &rasterInfo->frag.color;
-      iter = &rasterInfo->colorIter;
-
-      fragColor->r = vertexColor->r + dx*iter->drdx + dy*iter->drdy;
-      iter->rLittle = iter->drdy + little * iter->drdx;
-      iter->rBig = iter->rLittle + iter->drdx;
-    }
-  }
-  else
-  {
-    if (modeFlags & eShadeSmooth)
-    {
-      vertexColor = &a->color;
-      fragColor = &rasterInfo->frag.color;
-      iter = &rasterInfo->colorIter;
-
-      fragColor->r = vertexColor->r + dx*iter->drdx + dy*iter->drdy;
-      iter->rLittle = iter->drdy + little * iter->drdx;
-      iter->rBig = iter->rLittle - iter->drdx;
+    double eval(double row, double px) const {
+      return sign*(row - dy*(px - x0));
     }
-  }
-}
-
-
-static void
-DrawFlatGraySpan(GraphicsState *gc)
-{
-  // Evaluate the clipping in the X direction
-  int length = gc->rasterInfo.length;
-  int x = gc->rasterInfo.frag.x;
-  if ( x < gc->clipX0 ) { // Check to see if the line goes off the left
-    length += x - gc->clipX0;
-    x = gc->clipX0;
-  }
-  if ( x + length > gc->clipX1 ) { // Check to see the line goes off
-                                   // the right
-    length -= x + length - gc->clipX1;
-  }
-
-  // Check to see if we just removed this line
-  if ( length < 1 ) return;
-
-  std::fill_n(&(gc->buffer[gc->rasterInfo.frag.y * gc->width + x]),
-              length, float(gc->rasterInfo.frag.color.r));
-}
-
-static void
-DrawGraySpan(GraphicsState *gc)
-{
-  RealT gray = gc->rasterInfo.frag.color.r;
-  RealT drdx = gc->rasterInfo.colorIter.drdx;
-
-  // Evaluate the clipping in the X direction
-  int length = gc->rasterInfo.length;
-  int x = gc->rasterInfo.frag.x;
-  if ( x < gc->clipX0 ) { // Check to see if the line goes off the left
-    int difference = gc->clipX0 - x;
-    length -= difference;
-    x = gc->clipX0;
-    gray += RealT(difference) * drdx;
-  }
-  if ( x + length > gc->clipX1 ) { // Check to see the line goes off
-                                   // the right
-    length -= x + length - gc->clipX1;
-  }
-
-  // Check to see if we just removed this line
-  if ( length < 1 ) return;
-
-  float *span =
-    &(gc->buffer[gc->rasterInfo.frag.y * gc->width + x ] );
-
-  for (int i = length; i; --i) {
-    *span++ = float(gray);
-    gray += drdx;
-  }
-}
-
-// In the SnapX* and FillSubTriangle routines, 1s31.1s31 fixed point
-// arithmetic is used with the integer and fractional portions carried
-// in separate ints (e.g., ixLeft and ixLeftFrac)
-static void
-SnapXLeft(GraphicsState *gc, RealT xLeft, RealT dxdyLeft)
-{
-  RealT little, dx;
-  int ixLeft, ixLeftFrac, frac, ilittle, ibig;
-
-  ixLeft = (int) xLeft;
-  dx = xLeft - ixLeft;
-  __FRACTION(ixLeftFrac, dx);
-
-  // Is the following right? Seems like it should be ixLeft - (...) --LJE
-  gc->rasterInfo.ixLeft = ixLeft + (((unsigned int) ixLeftFrac) >> SHIFT);
-  gc->rasterInfo.ixLeftFrac = ixLeftFrac & ~0x80000000;
-
-  // Compute big and little steps
-  ilittle = (int) dxdyLeft;
-  little = (RealT) ilittle;
-  if (dxdyLeft < 0) {
-    ibig = ilittle - 1;
-    dx = little - dxdyLeft;
-    // Here we know ilittle and ibig are not going to be zero, and
-    // that frac will be negative, so we can just negate frac, to get
-    // things in our standard form --LJE
-    __FRACTION(frac, dx);
-    gc->rasterInfo.dxLeftFrac = -frac;
-  } else {
-    ibig = ilittle + 1;
-    dx = dxdyLeft - little;
-    __FRACTION(frac, dx);
-    gc->rasterInfo.dxLeftFrac = frac;
-  }
-
-  gc->rasterInfo.dxLeftLittle = ilittle;
-  gc->rasterInfo.dxLeftBig = ibig;
-}
 
-static void
-SnapXRight(RasterInfo *rasterInfo, RealT xRight, RealT dxdyRight)
-{
-  RealT little, big, dx;
-  int ixRight, ixRightFrac, frac;
-
-  ixRight = (int) xRight;
-  dx = xRight - ixRight;
-  __FRACTION(ixRightFrac, dx);
-
-  // Is the following right? Seems like it should be ixRight - (...) -LJE
-  rasterInfo->ixRight = ixRight + (((unsigned int) ixRightFrac) >> SHIFT);
-  rasterInfo->ixRightFrac = ixRightFrac & ~0x80000000;
-
-  // Compute big and little steps
-  little = (RealT) ((int) dxdyRight);
-
-  if (dxdyRight < 0)
-  {
-    big = little - 1;
-    dx = little - dxdyRight;
-    __FRACTION(frac,dx);
-    rasterInfo->dxRightFrac = -frac;
-  }
-  else
-  {
-    big = little + 1;
-    dx = dxdyRight - little;
-    __FRACTION(frac,dx);
-    rasterInfo->dxRightFrac = frac;
+    bool inside(double row, double px) const {
+      double e = eval(row, px);
+      return (e > 0) | (inclusive & (e == 0));
+    }
+  };
+
+  struct RasterTarget {
+    float *buffer;
+    int width, height;
+  };
+
+  // Classify a block against one edge: -1 if all of it is outside, 1
+  // if all of it is inside, and 0 otherwise.
+  int ClassifyBlock(EdgeFunction const& edge,
+                    double px0, double px1, double py0, double py1) {
+    double r0 = edge.row_term(py0), r1 = edge.row_term(py1);
+    double e00 = edge.eval(r0, px0), e10 = edge.eval(r0, px1);
+    double e01 = edge.eval(r1, px0), e11 = edge.eval(r1, px1);
+    double emin = std::min(std::min(e00, e10), std::min(e01, e11));
+    double emax = std::max(std::max(e00, e10), std::max(e01, e11));
+    if (emax < -edge.margin)
+      return -1;
+    if (emin > edge.margin)
+      return 1;
+    return 0;
   }
 
-  rasterInfo->dxRightLittle = (int) little;
-  rasterInfo->dxRightBig = (int) big;
-}
+  void FillTriangle(RasterTarget const& target, bool smooth, float flatValue,
+                    WindowVertex a, WindowVertex b, WindowVertex c) {
 
-static void
-FillSubTriangle(GraphicsState *gc,  int iyBottom, int iyTop)
-{
-  int ixLeft, ixRight;
-  int ixLeftFrac, ixRightFrac;
-  int dxLeftFrac, dxRightFrac;
-  int dxLeftLittle, dxRightLittle;
-  int dxLeftBig, dxRightBig;
-  int spanWidth, clipY0, clipY1;
-  unsigned int modeFlags;
-  void (*processSpan)(GraphicsState *);
-
-  ixLeft = gc->rasterInfo.ixLeft;
-  ixLeftFrac = gc->rasterInfo.ixLeftFrac;
-  ixRight = gc->rasterInfo.ixRight;
-  ixRightFrac = gc->rasterInfo.ixRightFrac;
-  clipY0 = gc->clipY0;
-  clipY1 = std::min( gc->clipY1, iyTop );
-  dxLeftFrac = gc->rasterInfo.dxLeftFrac;
-  dxLeftBig = gc->rasterInfo.dxLeftBig;
-  dxLeftLittle = gc->rasterInfo.dxLeftLittle;
-  dxRightFrac = gc->rasterInfo.dxRightFrac;
-  dxRightBig = gc->rasterInfo.dxRightBig;
-  dxRightLittle = gc->rasterInfo.dxRightLittle;
-  modeFlags = gc->rasterInfo.modeFlags;
-  //  gc->rasterInfo.cfb = gc->drawBuffer;
-
-  if (modeFlags & eShadeSmooth)
-    processSpan = DrawGraySpan;
-  else
-    processSpan = DrawFlatGraySpan;
-
-  while (iyBottom < clipY1)
-  {
-    spanWidth = ixRight - ixLeft;
-    // Only render spans that have non-zero width and which are not
-    // scissored out vertically.
-    if ((spanWidth > 0) && (iyBottom >= clipY0) ) {
-      gc->rasterInfo.frag.x = ixLeft;
-      gc->rasterInfo.frag.y = iyBottom;
-      gc->rasterInfo.length = spanWidth;
-      processSpan(gc);
-    }
+    // Put the vertices in a canonical order so that the result does
+    // not depend on the order in which they were given.
+    if ((b.y < a.y) || (b.y == a.y && b.x < a.x)) std::swap(a, b);
+    if ((c.y < b.y) || (c.y == b.y && c.x < b.x)) std::swap(b, c);
+    if ((b.y < a.y) || (b.y == a.y && b.x < a.x)) std::swap(a, b);
 
-    // Advance right edge fixed point, adjusting for carry
-    ixRightFrac += dxRightFrac;
-    if (ixRightFrac < 0)            // Carry/Borrow'd. Use large step
-    {
-      ixRight += dxRightBig;
-      ixRightFrac &= ~0x80000000;
-    }
-    else                            // Use small step
-    {
-      ixRight += dxRightLittle;
+    // Twice the signed area
+    double e1x = b.x - a.x, e1y = b.y - a.y;
+    double e2x = c.x - a.x, e2y = c.y - a.y;
+    double area = e1x*e2y - e2x*e1y;
+    if (!(area != 0)) // Degenerate, or has NaN vertices
+      return;
+    double orientation = (area > 0) ? 1.0 : -1.0;
+
+    // The range of pixels whose samples fall in the bounding box
+    double minx = std::min(a.x, std::min(b.x, c.x));
+    double maxx = std::max(a.x, std::max(b.x, c.x));
+    double col0 = std::max(ceil(minx) - 1.0, 0.0);
+    double col1 = std::min(floor(maxx) - 1.0, target.width - 1.0);
+    double row0 = std::max(ceil(a.y) - 1.0, 0.0);
+    double row1 = std::min(floor(c.y) - 1.0, target.height - 1.0);
+    if (!(col0 <= col1) || !(row0 <= row1))
+      return;
+    int beg_col = int(col0), end_col = int(col1) + 1;
+    int beg_row = int(row0), end_row = int(row1) + 1;
+
+    EdgeFunction edges[3];
+    edges[0].setup(b, c, orientation);
+    edges[1].setup(c, a, orientation);
+    edges[2].setup(a, b, orientation);
+
+    // The gray value is interpolated in float as
+    //   value(p) = a.value + dvdx*(p.x - a.x) + dvdy*(p.y - a.y)
+    float dvdx = 0, dvdy = 0, ax = float(a.x), ay = float(a.y);
+    float av = smooth ? a.value : flatValue;
+    if (smooth) {
+      double dv1 = b.value - a.value, dv2 = c.value - a.value;
+      dvdx = float((dv1*e2y - dv2*e1y)/area);
+      dvdy = float((dv2*e1x - dv1*e2x)/area);
     }
 
-    iyBottom++;
-    ixLeftFrac += dxLeftFrac;
-    if (ixLeftFrac < 0)             // Carry/Borrow'd. Use large step
-    {
-      ixLeft += dxLeftBig;
-      ixLeftFrac &= ~0x80000000;
-
-      if (modeFlags & eShadeSmooth)
-        gc->rasterInfo.frag.color.r += gc->rasterInfo.colorIter.rBig;
-    }
-    else                            // Use small step
-    {
-      ixLeft += dxLeftLittle;
-      if (modeFlags & eShadeSmooth)
-        gc->rasterInfo.frag.color.r += gc->rasterInfo.colorIter.rLittle;
+    float lane_value[kBlockSize];
+    bool  lane_mask [kBlockSize];
+
+    for (int by = beg_row; by < end_row; by += kBlockSize) {
+      int bye = std::min(by + kBlockSize, end_row);
+
+      for (int bx = beg_col; bx < end_col; bx += kBlockSize) {
+        int bxe = std::min(bx + kBlockSize, end_col);
+        int num_lanes = bxe - bx;
+
+        int state[3];
+        bool skip = false, covered = true;
+        for (int e = 0; e < 3; e++) {
+          state[e] = ClassifyBlock(edges[e], bx + 1.0, double(bxe), by + 1.0, double(bye));
+          skip    = skip    || (state[e] < 0);
+          covered = covered && (state[e] > 0);
+        }
+        if (skip)
+          continue;
+
+        for (int row = by; row < bye; row++) {
+          double py = row + 1.0;
+          float row_value = av + dvdy*(float(py) - ay);
+          float *dest = target.buffer + size_t(row)*target.width + bx;
+
+          for (int i = 0; i < num_lanes; i++)
+            lane_value[i] = row_value + dvdx*(float(bx + i + 1) - ax);
+
+          if (covered) {
+            for (int i = 0; i < num_lanes; i++)
+              dest[i] = lane_value[i];
+            continue;
+          }
+
+          double r0 = edges[0].row_term(py);
+          double r1 = edges[1].row_term(py);
+          double r2 = edges[2].row_term(py);
+          for (int i = 0; i < num_lanes; i++) {
+            double px = bx + i + 1.0;
+            lane_mask[i] = edges[0].inside(r0, px) & edges[1].inside(r1, px) &
+                           edges[2].inside(r2, px);
+          }
+          for (int i = 0; i < num_lanes; i++)
+            dest[i] = lane_mask[i] ? lane_value[i] : dest[i];
+        }
+      }
     }
   }
-  gc->rasterInfo.ixLeft = ixLeft;
-  gc->rasterInfo.ixLeftFrac = ixLeftFrac;
-  gc->rasterInfo.ixRight = ixRight;
-  gc->rasterInfo.ixRightFrac = ixRightFrac;
-}
-
-static void
-FillTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c)
-{
-  RealT area, oneOverArea, t1, t2, t3, t4;
-  RealT dxAC, dxBC, dyAC, dyBC;
-  RealT dxAB, dyAB;
-  RealT dx, dy, dxdyLeft, dxdyRight;
-  Color *aColor, *bColor;
-  int aIY, bIY, cIY;
-  unsigned int modeFlags;
-  bool ccw;                             // was a float for some reason
-
-  // Sort vertices in y.
-  SortVertices(a, b, c);
-
-  // Set edge vectors
-  dxAC = a->window.x - c->window.x;
-  dxBC = b->window.x - c->window.x;
-  dyAC = a->window.y - c->window.y;
-  dyBC = b->window.y - c->window.y;
-
-  // Compute signed area of the triangle
-  area = TriangleArea(dxAC, dxBC, dyAC, dyBC);
-  ccw = (area >= 0);   //  ccw = !(* (int *) & area >> 31);
-
-  // Pre-compute one over polygon area
-  oneOverArea = (area != 0) ? (1.0 / area) : 0.0;
-
-  // Fetch some stuff we are going to reuse
-  modeFlags = gc->rasterInfo.modeFlags;
-  aColor = &a->color;                      // & -LJE
-  bColor = &b->color;                      // & -LJE
-
-  // Compute delta values for unit changes in x or y for each
-  // parameter.
-  t1 = dyAC * oneOverArea;
-  t2 = dyBC * oneOverArea;
-  t3 = dxAC * oneOverArea;
-  t4 = dxBC * oneOverArea;
-
-  if (modeFlags & eShadeSmooth)
-  {
-    RealT drAC, drBC;
-    Color *cColor = &c->color;             // & -LJE
-
-    // If gray scale the intensity is carried in the red component
-    drAC = aColor->r - cColor->r;
-    drBC = bColor->r - cColor->r;
-    gc->rasterInfo.colorIter.drdx = drAC * t2 - drBC * t1;
-    gc->rasterInfo.colorIter.drdy = drBC * t3 - drAC * t4;
-  }
-  else
-  {
-    Color *flatColor = &gc->currentFlatColor; // & -LJE
-    gc->rasterInfo.frag.color.r = flatColor->r;
-  }
 
-  // Snap each y coordinate to its pixel center
-  aIY = (int) (a->window.y);
-  bIY = (int) (b->window.y);
-  cIY = (int) (c->window.y);
-
-  // This algorithim always fills from bottom to top, left to right.
-  // Because of this, ccw triangles are inherently faster because the
-  // parameter values need not be recomputed.
-  dxAB = a->window.x - b->window.x;
-  dyAB = a->window.y - b->window.y;
-
-  if (ccw)
-  {
-    dxdyLeft = (dyAC != 0.0) ? dxAC / dyAC : 0.0;
-    dy = (aIY + 1.0) - a->window.y;
-    SnapXLeft(gc, a->window.x + dy*dxdyLeft, dxdyLeft);
-    dx = (gc->rasterInfo.ixLeft + 1.0) - a->window.x;
-    SetInitialParameters(gc, a, dx, dy);
-    if (aIY != bIY)
-    {
-      dxdyRight = (dyAB != 0.0) ? dxAB / dyAB : 0.0;
-      SnapXRight(&gc->rasterInfo, a->window.x + dy*dxdyRight, dxdyRight);
-      FillSubTriangle(gc, aIY, bIY);
-    }
-    if (bIY != cIY)
-    {
-      dxdyRight = (dyBC != 0.0) ? dxBC / dyBC : 0.0;
-      dy = (bIY + 1.0) - b->window.y;
-      SnapXRight(&gc->rasterInfo, b->window.x + dy*dxdyRight, dxdyRight);
-      FillSubTriangle(gc, bIY, cIY);
-    }
-  }
-  else
-  {
-    dxdyRight = (dyAC != 0.0) ? dxAC / dyAC : 0.0;
-    dy = (aIY + 1.0) - a->window.y;
-    SnapXRight(&gc->rasterInfo, a->window.x + dy*dxdyRight, dxdyRight);
-    if (aIY != bIY)
-    {
-      dxdyLeft = (dyAB != 0.0) ? dxAB / dyAB : 0.0;
-      SnapXLeft(gc, a->window.x + dy*dxdyLeft, dxdyLeft);
-      dx = (gc->rasterInfo.ixLeft + 1.0) - a->window.x;
-      SetInitialParameters(gc, a, dx, dy);
-      FillSubTriangle(gc, aIY, bIY);
-    }
-    if (bIY != cIY)
-    {
-      dxdyLeft = (dyBC != 0.0) ? dxBC / dyBC : 0.0;
-      dy = (bIY + 1.0) - b->window.y;
-      SnapXLeft(gc, b->window.x + dy*dxdyLeft, dxdyLeft);
-      dx = (gc->rasterInfo.ixLeft + 1.0) - b->window.x;
-      SetInitialParameters(gc, b, dx, dy);
-      FillSubTriangle(gc, bIY, cIY);
-    }
-  }
-}
+} // end anonymous namespace
 
 inline void
-MapToWindow(Coords &coords,
+MapToWindow(const float coords[2],
             const double ndcMap[3][2],
             double /*x0*/, double /*y0*/, double width, double height,
-            Coords &result)
+            WindowVertex &result)
 {
   // The separation of NDC and viewport mappings might seem silly
   // right now, but it allows one to modify the projection matrix
@@ -646,14 +242,31 @@ MapToWindow(Coords &coords,
   // According to the glViewPort specification:
   // xw = (xNDC + 1)(width/2) + x
   // yw = (xNDC + 1)(height/2) + y
-  double xNDC = ndcMap[0][0] * coords.x + ndcMap[2][0];
-  double yNDC = ndcMap[1][1] * coords.y + ndcMap[2][1];
+  double xNDC = ndcMap[0][0] * coords[0] + ndcMap[2][0];
+  double yNDC = ndcMap[1][1] * coords[1] + ndcMap[2][1];
 
   result.x = 0.5 * (xNDC + 1.0) * width;
   result.y = 0.5 * (yNDC + 1.0) * height;
 }
 
 
+// Map the vertex with the given index to window coordinates and
+// fetch its gray value
+inline void
+MapVertex(const float *vertices, int numVertexComponents,
+          const float *colors, int numColorComponents,
+          const double ndcMap[3][2], int width, int height,
+          int index, WindowVertex &result)
+{
+  MapToWindow(&vertices[index * numVertexComponents], ndcMap,
+              0.0, 0.0, double(width), double(height), result);
+
+  // If gray scale the intensity is carried in the first component
+  result.value = 0.0;
+  if (colors != 0 && numColorComponents > 0)
+    result.value = colors[index * numColorComponents];
+}
+
 // ===========================================================================
 // Class Member Functions
 // ===========================================================================
@@ -693,30 +306,9 @@ SoftwareRenderer::SoftwareRenderer(const int width, const int height, float *buf
 
   m_shadeMode = eShadeSmooth;
   m_currentFlatColor[0] = m_currentFlatColor[1] = m_currentFlatColor[2] = 0.0;
-
-  // FIX ME!!! Put this state info in the software renderer class
-  GraphicsState *graphicsState = new GraphicsState;
-  graphicsState->buffer = m_buffer;
-  graphicsState->currentFlatColor.r = m_currentFlatColor[0];
-  graphicsState->width = m_bufferWidth;
-  graphicsState->height = m_bufferHeight;
-  graphicsState->rasterInfo.modeFlags = eShadeSmooth;
-  graphicsState->minx = graphicsState->miny = 0;
-  graphicsState->maxx = m_bufferWidth;
-  graphicsState->maxy = m_bufferHeight;
-  graphicsState->clipX0 = graphicsState->clipY0 = 0;
-  graphicsState->clipX1 = m_bufferWidth;
-  graphicsState->clipY1 = m_bufferHeight;
-  m_graphicsState = graphicsState;
 }
 
-// Free up resources that are allocated in the constructor
-SoftwareRenderer::~SoftwareRenderer() {
-
-  if (m_graphicsState)
-    delete static_cast<GraphicsState*>(m_graphicsState);
-
-}
+SoftwareRenderer::~SoftwareRenderer() {}
 
 void
 SoftwareRenderer::Ortho2D(const double left, const double right,
@@ -774,42 +366,57 @@ SoftwareRenderer::DrawPolygon(const int startIndex, const int numVertices)
   if ((m_colorPointer == 0) && (m_shadeMode != eShadeFlat))
     return;
 
+  RasterTarget target = {m_buffer, m_bufferWidth, m_bufferHeight};
+  bool smooth = (m_shadeMode & eShadeSmooth);
+
   // NOTE: we assume polygons are convex! This allows one to easily
   // fan triangulate them.
-  int numTriangles = numVertices - 2;
-  float *vertices = &m_vertexPointer[startIndex * m_numVertexComponents];
-  float *colors = &m_colorPointer[startIndex * m_numColorComponents];
-  int vertexIndex1 = m_numVertexComponents;
-  int vertexIndex2 = vertexIndex1 + m_numVertexComponents;
-  int colorIndex1 = m_numColorComponents;
-  int colorIndex2 = colorIndex1 + m_numColorComponents;
-  ::Color color0(&colors[0], m_numColorComponents);
-  Vertex vertex0(vertices, color0);
-
-  MapToWindow(vertex0.window, m_transformNDC,
-              0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
-              vertex0.window);
-
-  for (int i = 0; i < numTriangles; i++)
-  {
-    ::Color color1(&colors[colorIndex1], m_numColorComponents);
-    ::Color color2(&colors[colorIndex2], m_numColorComponents);
-
-    Vertex vertex1(&vertices[vertexIndex1], color1);
-    Vertex vertex2(&vertices[vertexIndex2], color2);
-
-    MapToWindow(vertex1.window, m_transformNDC,
-                0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
-                vertex1.window);
-    MapToWindow(vertex2.window, m_transformNDC,
-                0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
-                vertex2.window);
-
-    FillTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2);
-
-    vertexIndex1 += m_triangleVertexStep;
-    vertexIndex2 += m_triangleVertexStep;
-    colorIndex1 += m_triangleColorStep;
-    colorIndex2 += m_triangleColorStep;
+  WindowVertex vertex0, vertex1, vertex2;
+  MapVertex(m_vertexPointer, m_numVertexComponents,
+            m_colorPointer, m_numColorComponents,
+            m_transformNDC, m_bufferWidth, m_bufferHeight,
+            startIndex, vertex0);
+  if (numVertices > 1)
+    MapVertex(m_vertexPointer, m_numVertexComponents,
+              m_colorPointer, m_numColorComponents,
+              m_transformNDC, m_bufferWidth, m_bufferHeight,
+              startIndex + 1, vertex1);
+  for (int i = 2; i < numVertices; i++) {
+    MapVertex(m_vertexPointer, m_numVertexComponents,
+              m_colorPointer, m_numColorComponents,
+              m_transformNDC, m_bufferWidth, m_bufferHeight,
+              startIndex + i, vertex2);
+    FillTriangle(target, smooth, m_currentFlatColor[0], vertex0, vertex1, vertex2);
+    vertex1 = vertex2;
+  }
+}
+
+void
+SoftwareRenderer::DrawTriangles(const int numIndices, const int * const indices)
+{
+  if (m_vertexPointer == 0)
+    return;
+
+  if ((m_colorPointer == 0) && (m_shadeMode != eShadeFlat))
+    return;
+
+  RasterTarget target = {m_buffer, m_bufferWidth, m_bufferHeight};
+  bool smooth = (m_shadeMode & eShadeSmooth);
+
+  WindowVertex vertex0, vertex1, vertex2;
+  for (int i = 0; i + kVerticesPerTriangle <= numIndices; i += kVerticesPerTriangle) {
+    MapVertex(m_vertexPointer, m_numVertexComponents,
+              m_colorPointer, m_numColorComponents,
+              m_transformNDC, m_bufferWidth, m_bufferHeight,
+              indices[i    ], vertex0);
+    MapVertex(m_vertexPointer, m_numVertexComponents,
+              m_colorPointer, m_numColorComponents,
+              m_transformNDC, m_bufferWidth, m_bufferHeight,
+              indices[i + 1], vertex1);
+    MapVertex(m_vertexPointer, m_numVertexComponents,
+              m_colorPointer, m_numColorComponents,
+              m_transformNDC, m_bufferWidth, m_bufferHeight,
+              indices[i + 2], vertex2);
+    FillTriangle(target, smooth, m_currentFlatColor[0], vertex0, vertex1, vertex2);
   }
 }
@@ -36,6 +36,11 @@ namespace stereo {
       void SetColorPointer(const int numComponents, float * const colors);
       void DrawPolygon(const int startIndex, const int numVertices);
 
+      // Draw numIndices/3 triangles whose corners are consecutive
+      // triples of indices into the vertex and color arrays, as with
+      // glDrawElements(GL_TRIANGLES, ...).
+      void DrawTriangles(const int numIndices, const int * const indices);
+
     private:
       int m_numVertexComponents;
       float *m_vertexPointer;
@@ -50,7 +55,6 @@ namespace stereo {
       float m_clearColor[4];
       double m_transformNDC[3][2];
       double m_transformViewport[3][2];
-      void *m_graphicsState;
     };
   }
 }
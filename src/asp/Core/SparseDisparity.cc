@@ -0,0 +1,420 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SparseDisparity.cc
+///
+
+#include <asp/Core/SparseDisparity.h>
+#include <asp/Core/FftCorrelation.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+
+  typedef PixelMask<PixelGray<float> > MaskedPixel;
+  typedef ImageViewRef<MaskedPixel>    MaskedImage;
+
+  // The margin read around the templates and search windows for the filtering
+  const int FILTER_MARGIN = 5;
+
+  // A range of disparities has an inclusive maximum, so it may have zero width
+  inline bool is_range(BBox2i const& range) {
+    return range.min().x() <= range.max().x() && range.min().y() <= range.max().y();
+  }
+
+  // The Laplacian of Gaussian filter of sparse_disp. The invalid pixels
+  // are zero, and the Laplacian is zeroed where they meet the valid ones.
+  ImageView<float> log_filter(ImageView<MaskedPixel> const& img) {
+
+    int cols = img.cols(), rows = img.rows();
+    ImageView<float> lap(cols, rows), out(cols, rows);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        bool valid = is_valid(img(col, row));
+        float center = valid ? img(col, row).child().v() : 0;
+        float sum = -4*center;
+        bool boundary = false;
+        int dc[4] = {-1, 1, 0, 0}, dr[4] = {0, 0, -1, 1};
+        for (int k = 0; k < 4; k++) {
+          int c = col + dc[k], r = row + dr[k];
+          if (c < 0 || r < 0 || c >= cols || r >= rows)
+            continue;
+          if (is_valid(img(c, r)))
+            sum += img(c, r).child().v();
+          boundary = boundary || (is_valid(img(c, r)) != valid);
+        }
+        lap(col, row) = boundary ? 0 : sum;
+      }
+    }
+
+    // A separable Gaussian of sigma 1.4
+    const int radius = 5;
+    const double sigma = 1.4;
+    float kernel[2*radius + 1];
+    for (int k = -radius; k <= radius; k++)
+      kernel[k + radius] = exp(-0.5*k*k/(sigma*sigma));
+    double norm = 0;
+    for (int k = 0; k <= 2*radius; k++)
+      norm += kernel[k];
+    for (int k = 0; k <= 2*radius; k++)
+      kernel[k] /= norm;
+
+    ImageView<float> tmp(cols, rows);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        float sum = 0;
+        for (int k = std::max(-radius, -col); k <= std::min(radius, cols - 1 - col); k++)
+          sum += kernel[k + radius]*lap(col + k, row);
+        tmp(col, row) = sum;
+      }
+    }
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        float sum = 0;
+        for (int k = std::max(-radius, -row); k <= std::min(radius, rows - 1 - row); k++)
+          sum += kernel[k + radius]*tmp(col, row + k);
+        out(col, row) = sum;
+      }
+    }
+    return out;
+  }
+
+  // Read a box of an image with the filter margin, and filter it. The
+  // pixels out of the image are invalid. Returns the fraction of
+  // invalid pixels in the box.
+  double read_filtered(MaskedImage const& img, BBox2i const& box, ImageView<float> & filtered) {
+    BBox2i read_box = box;
+    read_box.expand(FILTER_MARGIN);
+    ImageView<MaskedPixel> patch = crop(edge_extend(img, ZeroEdgeExtension()), read_box);
+    int num_invalid = 0;
+    for (int row = FILTER_MARGIN; row < patch.rows() - FILTER_MARGIN; row++)
+      for (int col = FILTER_MARGIN; col < patch.cols() - FILTER_MARGIN; col++)
+        num_invalid += !is_valid(patch(col, row));
+    filtered = crop(log_filter(patch), BBox2i(FILTER_MARGIN, FILTER_MARGIN,
+                                              box.width(), box.height()));
+    return double(num_invalid)/(double(box.width())*box.height());
+  }
+
+  ImageView<float> decimate(ImageView<float> const& img) {
+    ImageView<float> out(img.cols()/2, img.rows()/2);
+    for (int row = 0; row < out.rows(); row++)
+      for (int col = 0; col < out.cols(); col++)
+        out(col, row) = img(2*col + 1, 2*row + 1);
+    return out;
+  }
+
+  // The position of the largest value of the correlation
+  Vector2i correlation_peak(ImageView<float> const& ncc, float & score) {
+    Vector2i peak(0, 0);
+    score = ncc(0, 0);
+    for (int row = 0; row < ncc.rows(); row++) {
+      for (int col = 0; col < ncc.cols(); col++) {
+        if (ncc(col, row) > score) {
+          score = ncc(col, row);
+          peak  = Vector2i(col, row);
+        }
+      }
+    }
+    return peak;
+  }
+
+  // Match the template centered at the given left image pixel within
+  // the given range of disparities, whose maximum is inclusive. As in
+  // sparse_disp, a wide search is first done at half resolution.
+  PixelMask<Vector2f> match_node(MaskedImage const& left, MaskedImage const& right,
+                                 Vector2i const& center, BBox2i range,
+                                 asp::SparseDispOptions const& opt) {
+    PixelMask<Vector2f> result;
+    invalidate(result);
+
+    int t = opt.template_size;
+    BBox2i tmpl_box(center - Vector2i(t/2, t/2), center + Vector2i(t - t/2, t - t/2));
+    ImageView<float> tmpl, search;
+    if (read_filtered(left, tmpl_box, tmpl) > 0.1)
+      return result;
+    BBox2i search_box(tmpl_box.min() + range.min(), tmpl_box.max() + range.max());
+    if (read_filtered(right, search_box, search) > 0.25)
+      return result;
+
+    ImageView<float> ncc;
+    float score;
+    if (range.width() > 32 || range.height() > 32) {
+      if (!asp::normalized_cross_correlation(decimate(tmpl), decimate(search), ncc))
+        return result;
+      Vector2i disp = range.min() + 2*correlation_peak(ncc, score);
+      BBox2i narrow(disp - Vector2i(opt.refine_pad, opt.refine_pad),
+                    disp + Vector2i(opt.refine_pad, opt.refine_pad));
+      narrow.crop(range);
+      ImageView<float> narrow_search
+        = crop(search, BBox2i(narrow.min() - range.min(),
+                              narrow.max() - range.min() + Vector2i(t, t)));
+      search = narrow_search;
+      range  = narrow;
+    }
+
+    if (!asp::normalized_cross_correlation(tmpl, search, ncc))
+      return result;
+    Vector2i disp = range.min() + correlation_peak(ncc, score);
+    if (score < opt.min_score)
+      return result;
+    result = PixelMask<Vector2f>(Vector2f(disp.x(), disp.y()));
+    return result;
+  }
+
+  // Match the nodes of some rows of the grid having a non-empty range
+  class NodeMatchTask: public Task, private boost::noncopyable {
+    MaskedImage const& m_left, & m_right;
+    asp::SparseDispOptions const& m_opt;
+    asp::SparseDispGrid & m_grid;
+    ImageView<BBox2i> const& m_ranges;
+    int m_beg, m_end;
+  public:
+    NodeMatchTask(MaskedImage const& left, MaskedImage const& right,
+                  asp::SparseDispOptions const& opt, asp::SparseDispGrid & grid,
+                  ImageView<BBox2i> const& ranges, int beg, int end):
+      m_left(left), m_right(right), m_opt(opt), m_grid(grid), m_ranges(ranges),
+      m_beg(beg), m_end(end) {}
+
+    void operator()() {
+      for (int j = m_beg; j < m_end; j++) {
+        for (int i = 0; i < m_grid.disp.cols(); i++) {
+          if (!is_range(m_ranges(i, j)))
+            continue;
+          Vector2i center = m_grid.origin + m_grid.spacing*Vector2i(i, j);
+          m_grid.disp(i, j) = match_node(m_left, m_right, center, m_ranges(i, j), m_opt);
+        }
+      }
+    }
+  };
+
+  void match_nodes(MaskedImage const& left, MaskedImage const& right,
+                   asp::SparseDispOptions const& opt, asp::SparseDispGrid & grid,
+                   ImageView<BBox2i> const& ranges, int num_threads) {
+    int rows = grid.disp.rows();
+    int rows_per_task = std::max(1, rows/(4*std::max(num_threads, 1)));
+    FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < rows; beg += rows_per_task) {
+      boost::shared_ptr<NodeMatchTask>
+        task(new NodeMatchTask(left, right, opt, grid, ranges, beg,
+                               std::min(beg + rows_per_task, rows)));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // Drop the matches of the nodes with the given step in the grid which
+  // are far from the median of their valid neighbors at the same step.
+  // The tolerance grows with the distance between the nodes, as the
+  // disparity changes more between farther nodes.
+  int remove_outliers(asp::SparseDispGrid & grid, int step, double base_tol) {
+    double tol = std::max(base_tol, 0.5*step*grid.spacing);
+    ImageView<PixelMask<Vector2f> > disp = copy(grid.disp);
+    int num_removed = 0;
+    for (int j = 0; j < disp.rows(); j += step) {
+      for (int i = 0; i < disp.cols(); i += step) {
+        if (!is_valid(disp(i, j)))
+          continue;
+        std::vector<float> dx, dy;
+        for (int n = -step; n <= step; n += step) {
+          for (int m = -step; m <= step; m += step) {
+            int a = i + m, b = j + n;
+            if ((m == 0 && n == 0) || a < 0 || b < 0 || a >= disp.cols() || b >= disp.rows())
+              continue;
+            if (is_valid(disp(a, b))) {
+              dx.push_back(disp(a, b).child().x());
+              dy.push_back(disp(a, b).child().y());
+            }
+          }
+        }
+        if (dx.size() < 2)
+          continue;
+        std::nth_element(dx.begin(), dx.begin() + dx.size()/2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size()/2, dy.end());
+        if (std::abs(disp(i, j).child().x() - dx[dx.size()/2]) > tol ||
+            std::abs(disp(i, j).child().y() - dy[dy.size()/2]) > tol) {
+          invalidate(grid.disp(i, j));
+          num_removed++;
+        }
+      }
+    }
+    return num_removed;
+  }
+
+  int num_valid(asp::SparseDispGrid const& grid, int step) {
+    int count = 0;
+    for (int j = 0; j < grid.disp.rows(); j += step)
+      for (int i = 0; i < grid.disp.cols(); i += step)
+        count += is_valid(grid.disp(i, j));
+    return count;
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+  SparseDispGrid sparse_disparity(ImageViewRef<PixelMask<PixelGray<float> > > const& left,
+                                  ImageViewRef<PixelMask<PixelGray<float> > > const& right,
+                                  BBox2i const& search_range,
+                                  SparseDispOptions const& opt, int num_threads) {
+
+    if (opt.template_size < 4 || opt.fine_spacing < 1)
+      vw_throw(ArgumentErr() << "Invalid sparse disparity template size or spacing.\n");
+    if (!is_range(search_range))
+      vw_throw(ArgumentErr() << "Invalid sparse disparity search range: "
+               << search_range << ".\n");
+
+    // The coarse grid is every ratio-th node of the fine grid. As in
+    // sparse_disp, by default it has at least 8 nodes along each side.
+    int fine = opt.fine_spacing;
+    int coarse = opt.coarse_spacing;
+    if (coarse <= 0)
+      coarse = next_power_of_two(std::min(left.cols(), left.rows()) + 1)/2/8;
+    int ratio = 1;
+    while (2*ratio*fine <= coarse)
+      ratio *= 2;
+
+    SparseDispGrid grid;
+    grid.spacing = fine;
+    grid.origin  = Vector2i(fine/2, fine/2);
+    grid.disp.set_size(std::max(1, (left.cols() - fine/2 + fine - 1)/fine),
+                       std::max(1, (left.rows() - fine/2 + fine - 1)/fine));
+    for (int j = 0; j < grid.disp.rows(); j++)
+      for (int i = 0; i < grid.disp.cols(); i++)
+        invalidate(grid.disp(i, j));
+
+    // Search the coarse nodes over the whole range
+    ImageView<BBox2i> ranges(grid.disp.cols(), grid.disp.rows());
+    for (int j = 0; j < ranges.rows(); j++)
+      for (int i = 0; i < ranges.cols(); i++)
+        ranges(i, j) = (i % ratio == 0 && j % ratio == 0) ? search_range :
+                       BBox2i(Vector2i(0, 0), Vector2i(-1, -1));
+    vw_out() << "\t--> Sparse matching on a grid of spacing " << ratio*fine << ".\n";
+    match_nodes(left, right, opt, grid, ranges, num_threads);
+    remove_outliers(grid, ratio, opt.outlier_tol);
+    vw_out() << "\t    Found " << num_valid(grid, ratio) << " matches.\n";
+    if (ratio == 1)
+      return grid;
+
+    // Search the other nodes around the disparities of the coarse nodes
+    // within one coarse spacing of them
+    for (int j = 0; j < ranges.rows(); j++) {
+      for (int i = 0; i < ranges.cols(); i++) {
+        ranges(i, j) = BBox2i(Vector2i(0, 0), Vector2i(-1, -1));
+        if (i % ratio == 0 && j % ratio == 0)
+          continue;
+        BBox2f box;
+        int num_near = 0;
+        int a0 = std::max(0, (i - 1)/ratio*ratio), b0 = std::max(0, (j - 1)/ratio*ratio);
+        for (int b = b0; b <= j + ratio && b < grid.disp.rows(); b += ratio) {
+          for (int a = a0; a <= i + ratio && a < grid.disp.cols(); a += ratio) {
+            if (is_valid(grid.disp(a, b))) {
+              box.grow(grid.disp(a, b).child());
+              num_near++;
+            }
+          }
+        }
+        if (num_near == 0)
+          continue;
+        BBox2i range(Vector2i(floor(box.min().x()), floor(box.min().y())),
+                     Vector2i(ceil (box.max().x()), ceil (box.max().y())));
+        range.expand(opt.refine_pad);
+        range.crop(search_range);
+        ranges(i, j) = range;
+      }
+    }
+    vw_out() << "\t--> Sparse matching on a grid of spacing " << fine << ".\n";
+    match_nodes(left, right, opt, grid, ranges, num_threads);
+    remove_outliers(grid, 1, opt.outlier_tol);
+    vw_out() << "\t    Found " << num_valid(grid, 1) << " matches.\n";
+
+    return grid;
+  }
+
+  SparseDispGrid sparse_disparity_spread(SparseDispGrid const& grid) {
+    SparseDispGrid spread = grid;
+    spread.disp = copy(grid.disp);
+    for (int j = 0; j < grid.disp.rows(); j++) {
+      for (int i = 0; i < grid.disp.cols(); i++) {
+        if (!is_valid(grid.disp(i, j)))
+          continue;
+        BBox2f box;
+        for (int b = std::max(j - 1, 0); b <= std::min(j + 1, grid.disp.rows() - 1); b++) {
+          for (int a = std::max(i - 1, 0); a <= std::min(i + 1, grid.disp.cols() - 1); a++) {
+            if (is_valid(grid.disp(a, b)))
+              box.grow(grid.disp(a, b).child());
+          }
+        }
+        spread.disp(i, j) = PixelMask<Vector2f>(Vector2f(box.width()/2, box.height()/2));
+      }
+    }
+    return spread;
+  }
+
+  ImageView<PixelMask<Vector2f> >
+  interpolate_sparse_disparity(SparseDispGrid const& grid,
+                               ImageView<uint8> const& left_mask_sub,
+                               Vector2 const& downsample_scale) {
+
+    ImageView<PixelMask<Vector2f> > out(left_mask_sub.cols(), left_mask_sub.rows());
+    int ncols = grid.disp.cols(), nrows = grid.disp.rows();
+    for (int row = 0; row < out.rows(); row++) {
+      for (int col = 0; col < out.cols(); col++) {
+        invalidate(out(col, row));
+        if (left_mask_sub(col, row) == 0)
+          continue;
+
+        // The position in the grid of this pixel, clamped to the grid
+        double x = (col/downsample_scale.x() - grid.origin.x())/grid.spacing;
+        double y = (row/downsample_scale.y() - grid.origin.y())/grid.spacing;
+        x = std::max(0.0, std::min(x, ncols - 1.0));
+        y = std::max(0.0, std::min(y, nrows - 1.0));
+        int i = std::min(int(x), std::max(ncols - 2, 0));
+        int j = std::min(int(y), std::max(nrows - 2, 0));
+        double fx = x - i, fy = y - j;
+
+        // Average the valid nodes around the pixel with bilinear weights
+        Vector2 sum;
+        double wsum = 0;
+        for (int n = 0; n <= 1; n++) {
+          for (int m = 0; m <= 1; m++) {
+            int a = std::min(i + m, ncols - 1), b = std::min(j + n, nrows - 1);
+            double w = (m ? fx : 1 - fx)*(n ? fy : 1 - fy);
+            if (w <= 0 || !is_valid(grid.disp(a, b)))
+              continue;
+            sum  += w*Vector2(grid.disp(a, b).child());
+            wsum += w;
+          }
+        }
+        if (wsum <= 0)
+          continue;
+        Vector2 d = elem_prod(sum/wsum, downsample_scale);
+        out(col, row) = PixelMask<Vector2f>(Vector2f(d.x(), d.y()));
+      }
+    }
+    return out;
+  }
+
+} // namespace asp
@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file SparseDisparity.h
+///
+/// A native version of the sparse_disp tool. Templates of the
+/// full-resolution left image, taken on a coarse grid, are matched
+/// over a wide search window in the right image with FFT normalized
+/// cross-correlation of the Laplacian of Gaussian filtered images.
+/// These matches give the search window for the nodes of a finer grid,
+/// and the disparities at these nodes are interpolated to make the
+/// low-resolution disparity D_sub. The nodes are matched in parallel.
+
+#ifndef __ASP_CORE_SPARSE_DISPARITY_H__
+#define __ASP_CORE_SPARSE_DISPARITY_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  /// The parameters of the sparse matching. The defaults are those
+  /// of sparse_disp.
+  struct SparseDispOptions {
+    int    template_size;  ///< The size of the square templates
+    int    fine_spacing;   ///< The distance between the nodes of the fine grid
+    int    coarse_spacing; ///< The same for the coarse grid, if 0 found from the image size
+    int    refine_pad;     ///< The padding of the search windows found from the coarse matches
+    double min_score;      ///< Matches of a lower correlation are dropped
+    double outlier_tol;    ///< Matches this far from the median of their neighbors are dropped
+    SparseDispOptions(): template_size(56), fine_spacing(64), coarse_spacing(0),
+                         refine_pad(16), min_score(0.4), outlier_tol(24) {}
+  };
+
+  /// Disparities at the nodes of a regular grid in the left image.
+  /// Node (i, j) is at pixel origin + spacing*(i, j).
+  struct SparseDispGrid {
+    vw::Vector2i origin;
+    int spacing;
+    vw::ImageView<vw::PixelMask<vw::Vector2f> > disp;
+  };
+
+  /// Match the images at the nodes of the fine grid, within the given
+  /// search range, using the given number of threads.
+  SparseDispGrid sparse_disparity(vw::ImageViewRef<vw::PixelMask<vw::PixelGray<float> > > const& left,
+                                  vw::ImageViewRef<vw::PixelMask<vw::PixelGray<float> > > const& right,
+                                  vw::BBox2i const& search_range,
+                                  SparseDispOptions const& opt, int num_threads);
+
+  /// Half the range of the disparities of each valid node and of its
+  /// valid neighbors, as an estimate of the disparity uncertainty.
+  SparseDispGrid sparse_disparity_spread(SparseDispGrid const& grid);
+
+  /// Interpolate bilinearly the grid disparities at the pixels of a
+  /// subsampled left image, scaling them to its resolution. The pixels
+  /// not valid in the subsampled left mask, or with no valid nodes
+  /// around them, are invalid.
+  vw::ImageView<vw::PixelMask<vw::Vector2f> >
+  interpolate_sparse_disparity(SparseDispGrid const& grid,
+                               vw::ImageView<vw::uint8> const& left_mask_sub,
+                               vw::Vector2 const& downsample_scale);
+
+} // namespace asp
+
+#endif // __ASP_CORE_SPARSE_DISPARITY_H__
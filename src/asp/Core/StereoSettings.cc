@@ -114,6 +114,12 @@ namespace asp {
                      "Normalize images based on the global min and max values from both images. Don't use this option if you are using normalized cross correlation.")
       ("individually-normalize",   po::bool_switch(&global.individually_normalize)->default_value(false)->implicit_value(true),
                      "Individually normalize the input images between 0.0-1.0 using +- 2.5 sigmas about their mean values.")
+      ("preprocessed-image-bits",  po::value(&global.preprocessed_image_bits)->default_value(0),
+                     "Save the preprocessed images, L.tif and R.tif, with 8 or 16 bit integer pixels, rather than float ones, which takes 2 or 4 times less space and reading. The default, 0, is float.")
+      ("epipolar-remap-table",     po::bool_switch(&global.epipolar_remap_table)->default_value(false)->implicit_value(true),
+                     "With epipolar alignment of pinhole cameras, resample the images through tables of where each aligned pixel comes from, saved with the output prefix and reused, rather than through the camera models at each pixel. The tables agree with the cameras within 0.01 pixels, or they are not used.")
+      ("multiview-left-prefix",    po::value(&global.multiview_left_prefix)->default_value(""),
+                     "Set by multiview stereo for each pair. The statistics and interest points of the left image are saved with this prefix, and shared by all pairs, rather than found again for each pair.")
       ("ip-per-tile",              po::value(&global.ip_per_tile)->default_value(0),
                      "How many interest points to detect in each 1024^2 image tile (default: automatic determination).")
       ("ip-detect-method",          po::value(&global.ip_matching_method)->default_value(0),
@@ -128,6 +134,34 @@ namespace asp {
        " A higher factor will result in more interest points, but perhaps also more outliers.")
       ("ip-uniqueness-threshold",          po::value(&global.ip_uniqueness_thresh)->default_value(0.7),
        "Min percentage distance between closest and second closest IP descriptors, a larger value allows more IP matches.")
+      ("ip-nn-method", po::value(&global.ip_nn_method)->default_value("flann"),
+       "How to find the closest descriptors when matching interest points (without cameras): flann (approximate, faster) or brute-force (exact).")
+      ("isis-per-thread-cameras", po::bool_switch(&global.isis_per_thread_cameras)->default_value(false)->implicit_value(true),
+       "Load a separate copy of each ISIS camera for each thread, so that interest point matching and triangulation with ISIS cameras can use multiple threads. Experimental.")
+      ("isis-tabulated-linescan", po::bool_switch(&global.isis_tabulated_linescan)->default_value(false)->implicit_value(true),
+       "Tabulate the positions and poses of ISIS linescan cameras once, and project into these cameras without calling ISIS. This is checked against ISIS when the camera is loaded. For map-projected ISIS cubes, project points by interpolating in a grid filled in with ISIS as needed.")
+      ("camera-cache-dir", po::value(&global.camera_cache_dir)->default_value(""),
+       "Store the DG and RPC cameras read from XML files in binary in this directory, and load them from there afterwards, which is faster than parsing the XML. Useful with parallel_stereo, whose many processes load the same cameras.")
+      ("image-cache-dir", po::value(&global.image_cache_dir)->default_value(""),
+       "Decode the input images compressed with JPEG2000, such as DigitalGlobe NITF files, with all threads, once, into uncompressed files in this directory, and read those instead. Can be shared with mapproject and pansharp.")
+      ("startup-file", po::value(&global.startup_file)->default_value(""),
+       "Save in this file which inputs are images, cameras and a DEM, the session type, and that the inputs passed the checks, or read these from it if it was made for the same inputs. Set by parallel_stereo, so that its many processes do not each open the inputs again.")
+      ("dem-cache-dir", po::value(&global.dem_cache_dir)->default_value(""),
+       "Convert the DEM given with --disparity-estimation-dem, once per machine, into an uncompressed float file in this directory, and map that in memory, so that the processes of parallel_stereo share one copy of it. Can be shared with mapproject, bundle_adjust and pc_align.")
+      ("object-cache-dir", po::value(&global.object_cache_dir)->default_value(""),
+       "Fetch the inputs given as s3:// or http(s):// objects into this directory, such as on a local SSD, with parallel ranged requests, and read them from there. Without it, such images are read in place, one tile at a time.")
+      ("telemetry", po::bool_switch(&global.telemetry)->default_value(false)->implicit_value(true),
+       "Record the run time, CPU time, peak memory and bytes read and written of each stage and of each tile, as JSON lines in <output prefix>-telemetry-<program>-<pid>.jsonl.")
+      ("progress-status", po::bool_switch(&global.progress_status)->default_value(false)->implicit_value(true),
+       "Keep the progress, ETA and resource use of each stereo process in the JSON file <output prefix>-status-<program>-<pid>.json, replaced atomically every few seconds.")
+      ("numa-affinity", po::value(&global.numa_affinity)->default_value("none"),
+       "Pin the threads processing tiles to the NUMA nodes of the machine, so that the tile buffers are in the memory of the node. Options: none, spread (alternate the nodes), compact (fill one node first). Only on Linux.")
+      ("capture-tiles", po::value(&global.capture_tiles)->default_value(""),
+       "Save, in <output prefix>-capture, the inputs of the correlation and refinement tiles which intersect these boxes, given as 'xoff yoff xsize ysize ...' in the coordinates of L.tif, so that each can be run again by itself with --replay-tile.")
+      ("capture-slow-tiles", po::value(&global.capture_slow_tiles)->default_value(0),
+       "Save, as with --capture-tiles, the inputs of the correlation and refinement tiles which take at least this many seconds.")
+      ("capture-max-tiles", po::value(&global.capture_max_tiles)->default_value(10),
+       "Save the inputs of at most this many tiles per process, with --capture-tiles and --capture-slow-tiles.")
       ("disable-tri-ip-filter",     po::value(&global.disable_tri_filtering)->default_value(false)->implicit_value(true),
        "Turn off the tri-ip filtering step.")
       ("remove-outliers-by-disparity-params",  po::value(&global.remove_outliers_by_disp_params)->default_value(Vector2(100.0,3.0), "pct factor"),
@@ -162,6 +196,8 @@ namespace asp {
                      "Preprocessing filter mode. [0 None, 1 Gaussian, 2 LoG, 3 Sign of LoG]")
       ("corr-seed-mode",         po::value(&global.seed_mode)->default_value(1),
                      "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development)]")
+      ("native-sparse-disp",     po::bool_switch(&global.native_sparse_disp)->default_value(false)->implicit_value(true),
+                     "With corr-seed-mode 3, find the low-resolution disparity with the built-in sparse matcher rather than with the sparse_disp tool.")
       ("min-num-ip",             po::value(&global.min_num_ip)->default_value(30),
                      "The minimum number of interest points which must be found to estimate the search range.")
       ("corr-sub-seed-percent",  po::value(&global.seed_percent_pad)->default_value(0.25),
@@ -196,12 +232,16 @@ namespace asp {
                               "Filter out pixels in D_sub where disparity > multiple*quantile.  Set >0 to enable.")
       ("skip-low-res-disparity-comp", po::bool_switch(&global.skip_low_res_disparity_comp)->default_value(false)->implicit_value(true),
                      "Skip the low-resolution disparity computation. This option is used in parallel_stereo.")
+      ("lowres-disparity-cache-dir", po::value(&global.lowres_disparity_cache_dir)->default_value(""),
+                     "Save the low-resolution disparity in this directory, and reuse it in later runs with the same subsampled images and low-resolution settings.")
       ("compute-low-res-disparity-only", po::bool_switch(&global.compute_low_res_disparity_only)->default_value(false)->implicit_value(true),
                      "Compute only the low-resolution disparity, skip the full-resolution disparity computation.")
       ("disparity-estimation-dem", po::value(&global.disparity_estimation_dem)->default_value(""),
                      "DEM to use in estimating the low-resolution disparity (when corr-seed-mode is 2).")
       ("disparity-estimation-dem-error", po::value(&global.disparity_estimation_dem_error)->default_value(0.0),
                      "Error (in meters) of the disparity estimation DEM.")
+      ("disparity-estimation-dem-lattice", po::value(&global.disparity_estimation_dem_lattice)->default_value(0),
+                     "If more than 1, find the low-resolution disparity from the DEM exactly only on a lattice with this spacing (in sampled pixels), and interpolate in the cells where that is accurate to half a pixel.")
       ("use-local-homography",   po::bool_switch(&global.use_local_homography)->default_value(false)->implicit_value(true),
                      "Apply a local homography in each tile.")
       ("corr-timeout",           po::value(&global.corr_timeout)->default_value(900),
@@ -214,10 +254,24 @@ namespace asp {
                      "Override the default tile size used for processing.")
       ("sgm-collar-size",        po::value(&global.sgm_collar_size)->default_value(512),
                      "Extend SGM calculation to this distance to increase accuracy at tile borders.")
+      ("blend-collar-size",      po::value(&global.blend_collar_size)->default_value(0),
+                     "Save the SGM disparity in the collars of this size around the tile, with the blending weights, for stereo_blend. This option is used in parallel_stereo.")
       ("sgm-search-buffer",        po::value(&global.sgm_search_buffer)->default_value(Vector2i(4,4),"4 4"),
                      "Search range expansion for SGM down stereo pyramid levels.  Smaller values are faster, but greater change of blunders.")
       ("corr-memory-limit-mb",     po::value(&global.corr_memory_limit_mb)->default_value(6*1024),
                      "Keep correlation memory usage (per tile) close to this limit.  Important for SGM/MGM.")
+      ("reuse-cached-disparity", po::bool_switch(&global.reuse_cached_disparity)->default_value(false)->implicit_value(true),
+                     "Skip full-resolution correlation if the existing disparity was produced from the same inputs and correlation settings.")
+      ("split-expensive-corr-tiles", po::bool_switch(&global.split_expensive_corr_tiles)->default_value(false)->implicit_value(true),
+                     "Split correlation tiles into smaller pieces with their own search ranges, when that reduces the estimated work. Local window search only.")
+      ("corr-image-cache-size", po::value(&global.corr_image_cache_size)->default_value(0),
+                     "Keep up to this many MB of tiles of the left and right images, shared by the correlation tiles, which read overlapping regions of them, instead of reading them again. The default is to not keep them.")
+      ("fuse-correlation-refinement", po::bool_switch(&global.fuse_correlation_refinement)->default_value(false)->implicit_value(true),
+                     "Do subpixel refinement right after correlation, in memory, and write only the refined disparity. The integer disparity is saved only with --stereo-debug. Local window search only.")
+      ("single-pass-xcorr", po::bool_switch(&global.single_pass_xcorr)->default_value(false)->implicit_value(true),
+                     "With SGM or MGM, do the left-right consistency check from the left to right disparity alone, without correlating the images again right to left.")
+      ("compact-disparity", po::bool_switch(&global.compact_disparity)->default_value(false)->implicit_value(true),
+                     "Store the disparities D, RD, and F losslessly in less space, with deflate compression and a predictor, and the integer disparity with 16-bit channels when the search range allows.")
       ("stereo-debug",   po::bool_switch(&global.stereo_debug)->default_value(false)->implicit_value(true),
                      "Write stereo debug images and output.");
 
@@ -246,7 +300,11 @@ namespace asp {
       ("disable-v-subpixel",  po::bool_switch(&global.disable_v_subpixel)->default_value(false)->implicit_value(true),
                               "Disable calculation of subpixel in vertical direction.")
       ("subpixel-max-levels", po::value(&global.subpixel_max_levels)->default_value(2),
-                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).");
+                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).")
+      ("selective-subpixel-threshold", po::value(&global.selective_subpixel_threshold)->default_value(0),
+                              "With subpixel mode 2, refine with Bayes EM only the pixels whose parabola subpixel disparity differs by more than this many pixels from a neighbor's, and keep the parabola result elsewhere. Set to 0 to use Bayes EM everywhere.")
+      ("rfne-tile-size",      po::value(&global.rfne_tile_size_ovr)->default_value(ASPGlobalOptions::rfne_tile_size()),
+                              "The size of the tiles processed and written by refinement and blending.");
 
     po::options_description experimental_subpixel_options("Experimental Subpixel Options");
     experimental_subpixel_options.add_options()
@@ -290,6 +348,8 @@ namespace asp {
                               "Size of region filtered off the image border.  If unset, equal to the subpixel kernel size.")
       ("erode-max-size",      po::value(&global.erode_max_size)->default_value(0),
                               "Isolated blobs with no more pixels than this number should be removed.")
+      ("erode-across-tiles",  po::bool_switch(&global.erode_across_tiles)->default_value(false)->implicit_value(true),
+                              "Find the blobs to remove with erode-max-size over the whole disparity, rather than in each tile with a margin, so that blobs spanning tiles are measured exactly. The filtered disparity is computed one more time.")
       ("median-filter-size",  po::value(&global.median_filter_size)->default_value(0),
                               "Filter subpixel results with a median filter of this size. Can only be used with texture smoothing.")
       ("texture-smooth-size",  po::value(&global.disp_smooth_size)->default_value(0),
@@ -317,10 +377,14 @@ namespace asp {
                                             "Radius of inner boundary of universe in meters (remove points with radius smaller than that).")
       ("far-universe-radius",               po::value(&global.far_universe_radius)->default_value(0.0),
                                             "Radius of outer boundary of universe in meters (remove points with radius larger than that).")
+      ("photometric-outlier-kernel-size",   po::value(&global.photometric_outlier_kernel_size)->default_value(0),
+                                            "If positive, before triangulation invalidate the disparity where the left image and the right image projected with the disparity differ the most, with these regions grown by about this many pixels. This is meant for dust in Apollo Metric images.")
       ("min-triangulation-angle",           po::value(&global.min_triangulation_angle)->default_value(0.0),
                                             "The minimum angle, in degrees, at which rays must meet at a triangulated point to accept this point as valid. The internal default is somewhat less than 1 degree.")
       ("use-least-squares",                 po::bool_switch(&global.use_least_squares)->default_value(false)->implicit_value(true),
                                             "Use rigorous least squares triangulation process. This is slow for ISIS processes.")
+      ("rpc-direct-triangulation",          po::bool_switch(&global.rpc_direct_triangulation)->default_value(false)->implicit_value(true),
+                                            "For a pair of RPC cameras, find each point where the ground tracks of its pixels meet, that is, their longitude and latitude as functions of height, rather than intersecting straight rays through two points of these tracks.")
       ("bundle-adjust-prefix", po::value(&global.bundle_adjust_prefix),
        "Use the camera adjustments obtained by previously running bundle_adjust with this output prefix.")
       ("unalign-disparity",                 po::bool_switch(&global.unalign_disparity)->default_value(false)->implicit_value(true),
@@ -334,6 +398,8 @@ namespace asp {
       ("piecewise-adjustment-camera-weight", po::value(&global.piecewise_adjustment_camera_weight)->default_value(1.0), "The weight to use for the sum of squares of adjustments component of the cost function. Increasing this value will constrain the adjustments to be smaller.")
       ("point-cloud-rounding-error",        po::value(&global.point_cloud_rounding_error)->default_value(0.0),
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
+      ("fixed-point-point-cloud",           po::bool_switch(&global.fixed_point_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Save the point cloud as 32-bit integer multiples of the point cloud rounding error, relative to the cloud center, with horizontal differencing before compression. This is lossless and makes the cloud smaller than when saved as float.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
@@ -342,10 +408,26 @@ namespace asp {
        "Skip the computation of the point cloud center. This option is used in parallel_stereo.")
       ("compute-error-vector",              po::bool_switch(&global.compute_error_vector)->default_value(false)->implicit_value(true),
                                             "Compute the triangulation error vector, not just its length.")
+      ("write-las",                         po::bool_switch(&global.write_las)->default_value(false)->implicit_value(true),
+                                            "Write the triangulated points directly to a LAS file, <output prefix>-PC.las, instead of the point cloud image.")
+      ("compress-las",                      po::bool_switch(&global.compress_las)->default_value(false)->implicit_value(true),
+                                            "With --write-las, compress the output using laszip, creating <output prefix>-PC.laz.")
+      ("las-max-triangulation-error",       po::value(&global.las_max_triangulation_error)->default_value(0.0),
+                                            "With --write-las, skip points with a triangulation error larger than this, in meters. Set to 0 to keep all points.")
+      ("ray-grid-angle-tol",                po::value(&global.ray_grid_angle_tol)->default_value(0.0),
+                                            "If positive, interpolate the camera rays from their values on a grid of pixels, refined until the directions are accurate to within this angle, in radians. The grid is saved with the output prefix and reused. Set to 0 to use the exact cameras.")
+      ("ray-grid-center-tol",               po::value(&global.ray_grid_center_tol)->default_value(0.01),
+                                            "With --ray-grid-angle-tol, the grid is also refined until the camera centers are accurate to within this distance, in meters.")
       ("compute-piecewise-adjustments-only", po::bool_switch(&global.compute_piecewise_adjustments_only)->default_value(false)->implicit_value(true),
        "Compute the piecewise adjustments as part of jitter correction, and then stop.")
       ("skip-computing-piecewise-adjustments", po::bool_switch(&global.skip_computing_piecewise_adjustments)->default_value(false)->implicit_value(true),
        "Skip computing the piecewise adjustments for jitter, they should have been done by now.")
+      ("tri-tile-size",                     po::value(&global.tri_tile_size_ovr)->default_value(ASPGlobalOptions::tri_tile_size()),
+                                            "The size of the tiles processed and written by triangulation.")
+      ("tri-prefetch-size",                 po::value(&global.tri_prefetch_size)->default_value(0.0),
+                                            "Read the disparity of the next tiles to triangulate in the background, keeping up to this many MB of it in memory. This hides the wait for slow (network) storage. Set to 0 to read each tile when it is triangulated.")
+      ("tri-prefetch-threads",              po::value(&global.tri_prefetch_threads)->default_value(2),
+                                            "The number of threads reading the disparity ahead with --tri-prefetch-size.")
       ;
   }
 
@@ -89,6 +89,9 @@ namespace asp {
 
     bool   force_use_entire_range;          /// Use entire dynamic range of image
     bool   individually_normalize;          /// If > 1, normalize the images
+    int    preprocessed_image_bits;         /// Save L.tif and R.tif with 8 or 16 bit pixels, or float if 0
+    bool   epipolar_remap_table;            ///< Resample for pinhole epipolar alignment through saved tables
+    std::string multiview_left_prefix;      ///< Where multiview stereo pairs share left image products
                                             ///         individually with their
                                             ///         own hi's and lo's
     int   ip_per_tile;                      ///< How many ip to find in each 1024^2 tile
@@ -99,6 +102,7 @@ namespace asp {
     double epipolar_threshold;              /// Max distance from epipolar line to search for IP matches.
     double ip_inlier_factor;                /// General scaling factor for IP finding, a larger value allows more IPs to match.
     double ip_uniqueness_thresh;            /// Min percentage distance between closest and second closest IP descriptors.
+    std::string ip_nn_method;               ///< How to find the closest IP descriptors: flann or brute-force.
     bool   disable_tri_filtering;           ///< Turn of tri-ip filtering.
     vw::Vector2 remove_outliers_by_disp_params; /// Remove outliers based on disparity of ip.
     
@@ -116,6 +120,19 @@ namespace asp {
     bool   skip_image_normalization;        ///< Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.
     bool   part_of_multiview_run;           ///< If this run is part of a larger multiview run
     std::string datum;                      ///< The datum to use with RPC camera models
+    bool   isis_per_thread_cameras;         ///< Give each thread its own ISIS camera instance
+    bool   isis_tabulated_linescan;         ///< Evaluate ISIS linescan cameras from tables made once with ISIS, and map-projected cubes from a grid
+    std::string camera_cache_dir;           ///< Where to cache DG and RPC cameras read from XML
+    std::string image_cache_dir;            ///< Where to decode JPEG2000 input images
+    std::string startup_file;               ///< Where the processes of a run share what they found about the inputs
+    std::string object_cache_dir;           ///< Where to keep local copies of the inputs in object storage
+    std::string dem_cache_dir;              ///< Where to keep the float copies of the DEMs which are mapped in memory
+    bool   telemetry;                       ///< Record the timing and resources of stages and tiles
+    bool   progress_status;                 ///< Keep a status file with the progress of the process
+    std::string numa_affinity;              ///< How to pin the tile threads to NUMA nodes
+    std::string capture_tiles;              ///< Save the inputs of the tiles intersecting these boxes
+    double capture_slow_tiles;              ///< Save the inputs of the tiles taking this many seconds
+    int    capture_max_tiles;               ///< Save the inputs of at most this many tiles per process
 
     // Correlation Options
     float slogW;                      ///< Preprocessing filter width
@@ -129,6 +146,8 @@ namespace asp {
                                       //     (see disparity-estimation-dem)
                                       // 3 = Use low-res disparity produced by sparse_disp
                                       //     (in development)
+    bool native_sparse_disp;          // With seed mode 3, use the built-in version of sparse_disp
+    std::string lowres_disparity_cache_dir; // Where to share the low-res disparity between runs
 
     int   min_num_ip;                 ///< Minimum number of IP's needed for search range estimation.
 
@@ -151,6 +170,7 @@ namespace asp {
     bool skip_low_res_disparity_comp;
     std::string disparity_estimation_dem;     // DEM to use in estimating the low-resolution disparity
     double disparity_estimation_dem_error; // Error (in meters) of the disparity estimation DEM
+    int    disparity_estimation_dem_lattice; // Lattice spacing for interpolating the DEM disparity
     bool   use_local_homography;      // Apply a local homography in each tile
     int    corr_timeout;              // Correlation timeout for a tile, in seconds
     int    stereo_algorithm;          // 0 = Default local window search method.
@@ -159,8 +179,15 @@ namespace asp {
     int    corr_blob_filter_area;     // Use blob filtering in pyramidal correlation
     int    corr_tile_size_ovr;        // Override the default tile size used for processing.
     int    sgm_collar_size;           // Extra tile padding used for SGM calculation.
+    int    blend_collar_size;         // Save the SGM collars of this size for stereo_blend
     vw::Vector2i sgm_search_buffer;   // Search padding in SGM around previous pyramid level disparity value.
     size_t corr_memory_limit_mb;      // Correlation memory limit, only important for SGM/MGM.
+    bool   reuse_cached_disparity;    // Reuse D.tif if it was made with the same correlation inputs
+    bool   split_expensive_corr_tiles; // Split tiles whose parts need much smaller search ranges
+    double corr_image_cache_size;     // MB of image tiles the correlation tiles share
+    bool   fuse_correlation_refinement; // Refine the disparity in stereo_corr, skipping D.tif
+    bool   single_pass_xcorr;         // Do the SGM consistency check without a second correlation
+    bool   compact_disparity;         // Write the disparities losslessly in less space
     bool   stereo_debug;              // Write stereo debug images and messages
 
     // Subpixel Options
@@ -173,6 +200,7 @@ namespace asp {
     vw::Vector2i subpixel_kernel;     // Subpixel correlation kernel
     bool disable_h_subpixel, disable_v_subpixel;
     vw::uint16 subpixel_max_levels;   // Max pyramid levels to process. 0 hits only once.
+    double selective_subpixel_threshold; // Use Bayes EM only where parabola is inconsistent
 
     // Experimental Subpixel Options (mode 3 only)
     int subpixel_em_iter;
@@ -190,21 +218,27 @@ namespace asp {
     int    rm_cleanup_passes;         // Number of times to perform cleanup
                                       // in the post-processing phase
     int  erode_max_size;              // Max island size in pixels that it'll remove
+    bool erode_across_tiles;          // Find the islands over the whole image, not per tile
     bool enable_fill_holes;           // If to enable hole-filling
     bool disable_fill_holes;          // This obsolete parameter is ignored
     int  fill_hole_max_size;          // Maximum hole size in pixels that we'll attempt to fill
     bool mask_flatfield;              // Masks pixels in the input images that are less
                                       // than 0 (for use with Apollo Metric Camera)
     int  mask_buffer_size;            // Size of region filtered out of image edges.
+    int   rfne_tile_size_ovr;        // Override the tile size used for refinement
     int   median_filter_size;        // Filter subpixel results with median filter of this size
     int   disp_smooth_size;           // Adaptive disparity smoothing size
     float disp_smooth_texture;        // Adaptive disparity smoothing max texture value    
     
     // Triangulation Options
     std::string universe_center;      // Center for the radius clipping
+    int    tri_tile_size_ovr;         // Override the tile size used for triangulation
+    double tri_prefetch_size;         // Read the disparity ahead of triangulation, up to this many MB
+    int    tri_prefetch_threads;      // The number of threads reading the disparity ahead
     float  near_universe_radius;      // Radius of the universe in meters
     float  far_universe_radius;       // Radius of the universe in meters
     std::string bundle_adjust_prefix; // Use the camera adjustments obtained by previously running bundle_adjust with the output prefix specified here.
+    int   photometric_outlier_kernel_size; // Remove photometric outliers with this kernel size if positive
 
     // Pull this many matches from the stereo disparity
     int num_matches_from_disparity, num_matches_from_disp_triplets;
@@ -219,11 +253,18 @@ namespace asp {
     bool   compute_piecewise_adjustments_only;
 
     bool   compute_error_vector;              // Compute the triangulation error vector, not just its length
+    bool   write_las;                         // Write the point cloud as LAS rather than PC.tif
+    bool   compress_las;                      // Compress the LAS output with laszip
+    double las_max_triangulation_error;       // Skip LAS points with a larger triangulation error
+    double ray_grid_angle_tol;                // Interpolate the camera rays on a grid with this accuracy
+    double ray_grid_center_tol;
 
     double min_triangulation_angle;           // min angle for valid triangulation
     bool   use_least_squares;                 // Use a more rigorous triangulation
+    bool   rpc_direct_triangulation;          // Intersect the RPC ground tracks rather than rays
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   fixed_point_point_cloud;           // Save the point cloud as int32 multiples of the rounding error
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
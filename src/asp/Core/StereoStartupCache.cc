@@ -0,0 +1,206 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/StereoStartupCache.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/FundamentalTypes.h>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Increment this when the layout of the file changes
+  const uint32 STARTUP_VERSION = 1;
+  const char   STARTUP_MAGIC[8] = {'A', 'S', 'P', 'S', 'T', 'R', 'T', '\0'};
+
+  // To reject files written on a machine of different byte order
+  const uint32 BYTE_ORDER_MARK = 0x01020304;
+
+  // Longer strings mean a corrupt file
+  const uint64 MAX_STRING_LENGTH = 1 << 20;
+
+  template <class T>
+  void write_pod(std::ostream & os, T const& val) {
+    os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+
+  template <class T>
+  bool read_pod(std::istream & is, T & val) {
+    is.read(reinterpret_cast<char*>(&val), sizeof(T));
+    return bool(is);
+  }
+
+  void write_string(std::ostream & os, std::string const& str) {
+    write_pod(os, uint64(str.size()));
+    os.write(str.data(), str.size());
+  }
+
+  bool read_string(std::istream & is, std::string & str) {
+    uint64 len = 0;
+    if (!read_pod(is, len) || len > MAX_STRING_LENGTH)
+      return false;
+    str.resize(len);
+    if (len > 0)
+      is.read(&str[0], len);
+    return bool(is);
+  }
+
+  uint64 string_hash(std::string const& str) {
+    // 64-bit FNV-1a
+    const uint64 FNV_OFFSET = 14695981039346656037ULL, FNV_PRIME = 1099511628211ULL;
+    uint64 hash = FNV_OFFSET;
+    for (size_t i = 0; i < str.size(); i++) {
+      hash ^= uint64(static_cast<unsigned char>(str[i]));
+      hash *= FNV_PRIME;
+    }
+    return hash;
+  }
+
+  /// The hash of the arguments, other than the output prefix, and of
+  /// the size and modification time of the files they name
+  uint64 startup_key(std::vector<std::string> const& positional, int out_prefix_index,
+                     std::string const& given_session_type,
+                     std::string const& given_alignment_method) {
+    std::ostringstream os;
+    os << given_session_type << "\n" << given_alignment_method << "\n";
+    for (int i = 0; i < int(positional.size()); i++) {
+      if (i == out_prefix_index) {
+        os << "<output prefix>\n";
+        continue;
+      }
+      boost::system::error_code ec;
+      fs::path path(positional[i]);
+      uintmax_t size  = fs::file_size(path, ec);
+      if (ec)
+        size = 0;
+      std::time_t mtime = fs::last_write_time(path, ec);
+      if (ec)
+        mtime = 0;
+      os << positional[i] << "\n" << size << " " << mtime << "\n";
+    }
+    return string_hash(os.str());
+  }
+
+} // end anonymous namespace
+
+bool read_stereo_startup_file(std::string const& startup_file,
+                              std::vector<std::string> const& positional,
+                              std::string const& given_session_type,
+                              std::string const& given_alignment_method,
+                              StereoStartupInfo & info) {
+  if (startup_file == "")
+    return false;
+  std::ifstream is(startup_file.c_str(), std::ios::binary);
+  if (!is)
+    return false;
+
+  char magic[sizeof(STARTUP_MAGIC)];
+  is.read(magic, sizeof(magic));
+  if (!is || !std::equal(magic, magic + sizeof(magic), STARTUP_MAGIC))
+    return false;
+  uint32 version = 0, byte_order = 0;
+  uint64 key = 0;
+  int32  out_prefix_index = -1;
+  if (!read_pod(is, version)    || version    != STARTUP_VERSION ||
+      !read_pod(is, byte_order) || byte_order != BYTE_ORDER_MARK ||
+      !read_pod(is, key)        || !read_pod(is, out_prefix_index))
+    return false;
+
+  // Made for these inputs?
+  if (out_prefix_index < 0 || out_prefix_index >= int32(positional.size()))
+    return false;
+  if (key != startup_key(positional, out_prefix_index,
+                         given_session_type, given_alignment_method))
+    return false;
+
+  StereoStartupInfo found;
+  found.out_prefix_index = out_prefix_index;
+  if (!read_string(is, found.session_type) || !read_string(is, found.alignment_method) ||
+      !read_string(is, found.in_file1)     || !read_string(is, found.in_file2)         ||
+      !read_string(is, found.cam_file1)    || !read_string(is, found.cam_file2)        ||
+      !read_string(is, found.input_dem))
+    return false;
+
+  // The file ends with the magic string, in case it was cut short
+  is.read(magic, sizeof(magic));
+  if (!is || !std::equal(magic, magic + sizeof(magic), STARTUP_MAGIC) ||
+      is.peek() != std::char_traits<char>::eof())
+    return false;
+
+  info = found;
+  return true;
+}
+
+void write_stereo_startup_file(std::string const& startup_file,
+                               std::vector<std::string> const& positional,
+                               std::string const& given_session_type,
+                               std::string const& given_alignment_method,
+                               StereoStartupInfo const& info) {
+  if (startup_file == "")
+    return;
+
+  // Write under a temporary name, then rename
+  std::ostringstream tmp_name;
+  tmp_name << startup_file << ".tmp" << ::getpid();
+  try {
+    fs::path dir = fs::path(startup_file).parent_path();
+    if (!dir.empty())
+      fs::create_directories(dir);
+
+    std::ofstream ofs(tmp_name.str().c_str(), std::ios::binary);
+    if (ofs) {
+      ofs.write(STARTUP_MAGIC, sizeof(STARTUP_MAGIC));
+      write_pod(ofs, STARTUP_VERSION);
+      write_pod(ofs, BYTE_ORDER_MARK);
+      write_pod(ofs, startup_key(positional, info.out_prefix_index,
+                                 given_session_type, given_alignment_method));
+      write_pod(ofs, int32(info.out_prefix_index));
+      write_string(ofs, info.session_type);
+      write_string(ofs, info.alignment_method);
+      write_string(ofs, info.in_file1);
+      write_string(ofs, info.in_file2);
+      write_string(ofs, info.cam_file1);
+      write_string(ofs, info.cam_file2);
+      write_string(ofs, info.input_dem);
+      ofs.write(STARTUP_MAGIC, sizeof(STARTUP_MAGIC));
+      ofs.close();
+    }
+    if (ofs) {
+      fs::rename(tmp_name.str(), startup_file);
+      return;
+    }
+  } catch (const std::exception& e) {
+    vw_out(WarningMessage) << e.what() << "\n";
+  }
+  vw_out(WarningMessage) << "Could not write the stereo startup file: " << startup_file << "\n";
+  boost::system::error_code ec;
+  fs::remove(tmp_name.str(), ec);
+}
+
+} // namespace asp
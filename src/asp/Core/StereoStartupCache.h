@@ -0,0 +1,70 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StereoStartupCache.h
+///
+/// What a stereo process finds out about its inputs while it parses its
+/// arguments: which files are images, cameras and a DEM, the stereo
+/// session type, which may take loading the cameras to guess, and that
+/// the inputs pass the checks. All the processes of a parallel_stereo
+/// run have the same inputs, so the first one saves this in a small
+/// binary file, and the others, such as the many tile processes, read
+/// it instead of opening the inputs again.
+///
+/// The file is only used for the same positional arguments, except
+/// the output prefix, which is different for each tile, the same given
+/// session type and alignment method, and input files of unchanged
+/// size and modification time.
+
+#ifndef __ASP_CORE_STEREO_STARTUP_CACHE_H__
+#define __ASP_CORE_STEREO_STARTUP_CACHE_H__
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The inputs of a stereo process as found from its arguments
+  struct StereoStartupInfo {
+    std::string session_type, alignment_method;
+    std::string in_file1, in_file2, cam_file1, cam_file2, input_dem;
+    int out_prefix_index; ///< Which of the positional arguments is the output prefix
+    StereoStartupInfo(): out_prefix_index(-1) {}
+  };
+
+  /// Read the startup file made for the given positional arguments,
+  /// session type and alignment method. Return false if it is missing,
+  /// not valid, or was made for other inputs.
+  bool read_stereo_startup_file(std::string const& startup_file,
+                                std::vector<std::string> const& positional,
+                                std::string const& given_session_type,
+                                std::string const& given_alignment_method,
+                                StereoStartupInfo & info);
+
+  /// Write the startup file. It is written under a temporary name and
+  /// renamed, as several processes may write it at the same time. A
+  /// failure to write it is only a warning.
+  void write_stereo_startup_file(std::string const& startup_file,
+                                 std::vector<std::string> const& positional,
+                                 std::string const& given_session_type,
+                                 std::string const& given_alignment_method,
+                                 StereoStartupInfo const& info);
+
+} // namespace asp
+
+#endif // __ASP_CORE_STEREO_STARTUP_CACHE_H__
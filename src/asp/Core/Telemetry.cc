@@ -0,0 +1,168 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Telemetry.cc
+///
+
+#include <asp/Core/Telemetry.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace vw;
+
+namespace {
+  vw::Mutex     g_telemetry_mutex;
+  std::ofstream g_telemetry_file;
+  bool          g_telemetry_enabled = false;
+
+  double to_seconds(struct timeval const& t) {
+    return t.tv_sec + 1.0e-6*t.tv_usec;
+  }
+
+  // The characters read and written, from /proc/self/io. These include
+  // what was served from the page cache. Zero where not available.
+  void read_io_bytes(double & read_bytes, double & write_bytes) {
+    read_bytes = write_bytes = 0;
+    FILE * fp = fopen("/proc/self/io", "r");
+    if (fp == NULL)
+      return;
+    char line[256];
+    unsigned long long value;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "rchar: %llu", &value) == 1)
+        read_bytes = value;
+      else if (sscanf(line, "wchar: %llu", &value) == 1)
+        write_bytes = value;
+    }
+    fclose(fp);
+  }
+}
+
+namespace asp {
+
+  void enable_telemetry(std::string const& file) {
+    vw::Mutex::Lock lock(g_telemetry_mutex);
+    if (g_telemetry_enabled)
+      return;
+    g_telemetry_file.open(file.c_str(), std::ios::out | std::ios::app);
+    if (!g_telemetry_file.is_open())
+      vw_throw(IOErr() << "Could not open telemetry file: " << file << ".\n");
+    g_telemetry_enabled = true;
+    vw_out() << "Writing telemetry to: " << file << "\n";
+  }
+
+  bool telemetry_enabled() {
+    return g_telemetry_enabled;
+  }
+
+  ResourceUsage resource_usage(bool thread_cpu) {
+    ResourceUsage usage;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    usage.wall_s = to_seconds(now);
+
+    struct rusage proc;
+    getrusage(RUSAGE_SELF, &proc);
+    usage.cpu_s = to_seconds(proc.ru_utime) + to_seconds(proc.ru_stime);
+#ifdef RUSAGE_THREAD
+    if (thread_cpu) {
+      struct rusage thread;
+      if (getrusage(RUSAGE_THREAD, &thread) == 0)
+        usage.cpu_s = to_seconds(thread.ru_utime) + to_seconds(thread.ru_stime);
+    }
+#endif
+
+    // The max resident set size is in kilobytes on Linux and in bytes on OSX
+#ifdef __APPLE__
+    usage.peak_rss_mb = proc.ru_maxrss/(1024.0*1024.0);
+#else
+    usage.peak_rss_mb = proc.ru_maxrss/1024.0;
+#endif
+
+    read_io_bytes(usage.read_bytes, usage.write_bytes);
+    return usage;
+  }
+
+  void record_counters(std::string const& name, std::map<std::string, double> const& values) {
+    if (!telemetry_enabled())
+      return;
+    ResourceUsage now = resource_usage(false);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(0)
+       << "{\"name\": \"" << name << "\", \"ph\": \"C\""
+       << ", \"ts\": "  << 1.0e6*now.wall_s
+       << ", \"pid\": " << getpid()
+       << ", \"tid\": " << vw::Thread::id()
+       << ", \"args\": {";
+    for (std::map<std::string, double>::const_iterator it = values.begin();
+         it != values.end(); it++)
+      os << (it == values.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+    os << "}}\n";
+
+    vw::Mutex::Lock lock(g_telemetry_mutex);
+    g_telemetry_file << os.str() << std::flush;
+  }
+
+  ScopedTimer::ScopedTimer(std::string const& name, vw::BBox2i const& tile):
+    m_name(name), m_tile(tile), m_active(telemetry_enabled()) {
+    if (m_active)
+      m_start = resource_usage(!m_tile.empty());
+  }
+
+  ScopedTimer::~ScopedTimer() {
+    if (!m_active)
+      return;
+    ResourceUsage end = resource_usage(!m_tile.empty());
+    double wall = end.wall_s - m_start.wall_s;
+    double cpu  = end.cpu_s  - m_start.cpu_s;
+
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(0)
+       << "{\"name\": \"" << m_name << "\", \"ph\": \"X\""
+       << ", \"ts\": "    << 1.0e6*m_start.wall_s
+       << ", \"dur\": "   << 1.0e6*wall
+       << ", \"pid\": "   << getpid()
+       << ", \"tid\": "   << vw::Thread::id()
+       << ", \"args\": {";
+    if (!m_tile.empty())
+      os << "\"tile\": [" << m_tile.min().x() << ", " << m_tile.min().y() << ", "
+         << m_tile.width() << ", " << m_tile.height() << "], ";
+    os << std::setprecision(3)
+       << "\"wall_s\": "      << wall
+       << ", \"cpu_s\": "     << cpu
+       << ", \"utilization\": " << (wall > 0 ? cpu/wall : 0.0)
+       << ", \"peak_rss_mb\": " << end.peak_rss_mb
+       << std::setprecision(0)
+       << ", \"read_bytes\": "  << end.read_bytes  - m_start.read_bytes
+       << ", \"write_bytes\": " << end.write_bytes - m_start.write_bytes
+       << "}}\n";
+
+    vw::Mutex::Lock lock(g_telemetry_mutex);
+    g_telemetry_file << os.str() << std::flush;
+  }
+
+} // namespace asp
@@ -0,0 +1,75 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Telemetry.h
+///
+/// Timing and resource usage of the stereo stages and of the tiles
+/// they process. Each scoped timer writes, when it ends, one JSON line
+/// to the telemetry file, as a Chrome trace complete event ("ph": "X")
+/// with the wall and CPU time, the peak resident memory and the bytes
+/// read and written. When telemetry is not enabled the timers do nothing.
+
+#ifndef __ASP_CORE_TELEMETRY_H__
+#define __ASP_CORE_TELEMETRY_H__
+
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// Write the telemetry records to this file from now on. Only the
+  /// first call has an effect.
+  void enable_telemetry(std::string const& file);
+
+  /// If enable_telemetry() was called
+  bool telemetry_enabled();
+
+  /// A snapshot of the resources used so far
+  struct ResourceUsage {
+    double wall_s, cpu_s;            ///< Wall time since the epoch, CPU time
+    double peak_rss_mb;              ///< Peak resident memory of the process
+    double read_bytes, write_bytes;  ///< Bytes read and written by the process
+  };
+
+  /// The present resource usage. If thread_cpu is true, the CPU time is
+  /// that of the calling thread, where supported, rather than of the process.
+  ResourceUsage resource_usage(bool thread_cpu);
+
+  /// Record the values of some counters, such as cache hits, as a
+  /// Chrome trace counter event ("ph": "C"). Does nothing when
+  /// telemetry is not enabled.
+  void record_counters(std::string const& name, std::map<std::string, double> const& values);
+
+  /// Record the time and resources used from construction to
+  /// destruction. A timer given a non-empty tile records it, and
+  /// measures the CPU time of its thread only.
+  class ScopedTimer: private boost::noncopyable {
+    std::string   m_name;
+    vw::BBox2i    m_tile;
+    bool          m_active;
+    ResourceUsage m_start;
+  public:
+    ScopedTimer(std::string const& name, vw::BBox2i const& tile = vw::BBox2i());
+    ~ScopedTimer();
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_TELEMETRY_H__
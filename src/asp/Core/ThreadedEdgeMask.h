@@ -43,121 +43,115 @@ namespace asp {
         return false;
     }
 
-    // Task that checks individual blocks for edges
+    // Task that finds the edges of a band of rows (or of columns) of
+    // the image. The band is read one block-sized strip at a time,
+    // from the first strip inward and then from the last one inward,
+    // stopping as soon as all lines in the band have their edge. So
+    // only the strips up to the first valid pixels are read, not the
+    // whole band, and each task writes only to its own lines of the
+    // shared arrays. The search in each strip is the same as it was
+    // for each block, so the result is the same as searching all
+    // blocks and keeping the outermost edges.
     class EdgeMaskTask : public vw::Task, private boost::noncopyable {
-      ViewT m_view;
-      typename ViewT::pixel_type m_mask_value;
-      vw::BBox2i m_bbox;   // Region of image we're working in
-      typedef std::vector<vw::int32> Array;
-      typedef boost::shared_array<vw::int32> SharedArray;
-      SharedArray g_left, g_right, g_top, g_bottom;
-      Array       m_left, m_right, m_top, m_bottom;
+      typedef typename ViewT::pixel_type PixelT;
+      ViewT      m_view;
+      PixelT     m_mask_value;
+      bool       m_by_rows;     // if true, the band is of rows
+      vw::int32  m_beg, m_end;  // the lines of the band
+      vw::int32  m_block_size;
+      SharedArray g_min, g_max; // left and right, or top and bottom
       // This how much we increment after we test a pixel. Set to 1 if
       // you wish to test every pixel.
       const vw::int32 STEP_SIZE;
-    public:
-      EdgeMaskTask(ViewT const& view,
-                   typename ViewT::pixel_type mask_value,
-                   vw::int32 search_step,
-                   vw::BBox2i bbox, SharedArray left, SharedArray right,
-                   SharedArray top, SharedArray bottom ) :
-        m_view(view), m_mask_value(mask_value), m_bbox(bbox), 
-        g_left(left), g_right(right), g_top(top), g_bottom(bottom), 
-        m_left( m_bbox.height() ), m_right( m_bbox.height() ), 
-        m_top( m_bbox.width() ), m_bottom( m_bbox.width() ), STEP_SIZE(search_step) {
-
-        std::fill( m_left.begin  (), m_left.end  (), -1 );
-        std::fill( m_right.begin (), m_right.end (), -1 );
-        std::fill( m_top.begin   (), m_top.end   (), -1 );
-        std::fill( m_bottom.begin(), m_bottom.end(), -1 );
+
+      inline bool masked(vw::ImageView<PixelT> const& tile, vw::int32 line, vw::int32 k) const {
+        return (m_by_rows ? tile(k, line) : tile(line, k)) == m_mask_value;
+      }
+
+      // Search along a line of the strip from its start, first in
+      // steps then pixel by pixel, for a pixel different from the mask
+      // value. Return the index just before it, or -1 if none was found.
+      vw::int32 scan_forward(vw::ImageView<PixelT> const& tile, vw::int32 line) const {
+        vw::int32 n = m_by_rows ? tile.cols() : tile.rows();
+        vw::int32 i = 0;
+        while ( i < n && masked(tile, line, i) ) // Move forward by STEP_SIZE
+          i += STEP_SIZE;                        //    until we hit an invalid pixel
+        if ( i > 0 ) i -= STEP_SIZE;             // Walk back one step if we are not at the start
+        while ( i < n && masked(tile, line, i) ) // Now do the same thing but in steps of 1
+          ++i;
+        if ( i > 0 ) --i;
+        if ( i == n - 1 )                        // The entire line was nodata
+          return -1;
+        return i;
+      }
+
+      // The same from the end of the line. Only call this if
+      // scan_forward() found something.
+      vw::int32 scan_backward(vw::ImageView<PixelT> const& tile, vw::int32 line) const {
+        vw::int32 n = m_by_rows ? tile.cols() : tile.rows();
+        vw::int32 i = n - 1;
+        while ( i >= 0 && masked(tile, line, i) )
+          i -= STEP_SIZE;
+        if ( i < n - 1 )
+          i += STEP_SIZE;
+        while ( i >= 0 && masked(tile, line, i) )
+          --i;
+        if ( i < n - 1 )
+          ++i;
+        return i;
+      }
+
+      // The box of the given strip of the band
+      vw::BBox2i strip_box(vw::int32 start) const {
+        vw::int32 len = m_by_rows ? m_view.cols() : m_view.rows();
+        vw::int32 wid = std::min(m_block_size, len - start);
+        if (m_by_rows)
+          return vw::BBox2i(start, m_beg, wid, m_end - m_beg);
+        return vw::BBox2i(m_beg, start, m_end - m_beg, wid);
       }
 
+    public:
+      EdgeMaskTask(ViewT const& view, PixelT mask_value, vw::int32 search_step,
+                   bool by_rows, vw::int32 beg, vw::int32 end, vw::int32 block_size,
+                   SharedArray min_edge, SharedArray max_edge) :
+        m_view(view), m_mask_value(mask_value), m_by_rows(by_rows),
+        m_beg(beg), m_end(end), m_block_size(block_size),
+        g_min(min_edge), g_max(max_edge), STEP_SIZE(search_step) {}
+
       void operator()() {
         using namespace vw;
 
-        // Rasterizing local tile
-        ImageView<typename ViewT::pixel_type> copy( crop(m_view, m_bbox ) );
-
-        { // Detecting Edges
-          // Search left and right side
-          for ( int32 j = 0; j < copy.rows(); ++j ) { // Loop up through the rows in the local tile
-            int32 i = 0;
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Move from left to right in row by STEP_SIZE
-              i += STEP_SIZE;                                      //    until we hit an invalid pixel
-            if ( i > 0 ) i -= STEP_SIZE;                           // Walk back one step if we are not at col 0
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Now do the same thing but in steps of 1
-              ++i;
-            if ( i > 0 ) --i;
-            // Early exit condition if entire row was nodata
-            if ( i == copy.cols() -1 )
-              continue; // We're keeping left and right as -1
-            m_left[j] = i;                                         // Now we have the left-most valid column in the row
-
-            i = copy.cols() - 1;                                   // Do the same thing going right to left
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              i -= STEP_SIZE;
-            if ( i < copy.cols() - 1 )
-              i += STEP_SIZE;
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              --i;
-            if ( i < copy.cols() - 1 )
-              ++i;
-            m_right[j] = i;
-          }
-                                                                   // Now find the first valid rows from the bottom
-          for ( int32 i = 0; i < copy.cols(); ++i ) {
-            int32 j = 0;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              j += STEP_SIZE;
-            if ( j > 0 )
-              j -= STEP_SIZE;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              ++j;
-            if ( j > 0 )
-              --j;
-            // Early exit condition if entire column was nodata
-            if ( j == copy.rows() - 1 )
-              continue; // We're keeping top and bottom as -1
-            m_top[i] = j;
-
-            j = copy.rows()-1;                                     // And the first valid rows from the top
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              j -= STEP_SIZE;
-            if ( j < copy.rows()-1 )
-              j += STEP_SIZE;
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              --j;
-            if ( j < copy.rows()-1 )
-              ++j;
-            m_bottom[i] = j;
+        int32 num_lines = m_end - m_beg;
+        int32 len = m_by_rows ? m_view.cols() : m_view.rows();
+        int32 num_strips = (len + m_block_size - 1)/m_block_size;
+
+        // Coming in from the start
+        std::vector<char> done(num_lines, 0);
+        int32 num_left = num_lines;
+        for ( int32 s = 0; s < num_strips && num_left > 0; s++ ) {
+          int32 start = s*m_block_size;
+          ImageView<PixelT> tile( crop(m_view, strip_box(start)) ); // Rasterizing local strip
+          for ( int32 k = 0; k < num_lines; k++ ) {
+            if ( done[k] ) continue;
+            int32 i = scan_forward(tile, k);
+            if ( i < 0 ) continue;
+            g_min[m_beg + k] = start + i;
+            done[k] = 1;
+            num_left--;
           }
         }
 
-        { // Merging result back into global perspective
-          int32 l = 0;
-          for ( int32 j = m_bbox.min()[1];                      // Loop through rows
-                j < m_bbox.max()[1]; j++ ) {
-            if ( m_left[l] == -1 ) {                            // Skip rows with no pixels
-              l++; continue;
-            }
-            g_left[j] = std::min( m_left[l] + m_bbox.min()[0],  // Add in the bounding box column
-                                  g_left[j] );
-            g_right[j] = std::max( m_right[l] + m_bbox.min()[0],
-                                   g_right[j] );
-            l++;
-          }
-
-          l = 0;
-          for ( int32 i = m_bbox.min()[0];                       // Loop through columns
-                i < m_bbox.max()[0]; i++ ) {
-            if ( m_top[l] == -1 ) {                              // Skip columns with no pixels
-              l++; continue;
-            }
-            g_top[i] = std::min( m_top[l] + m_bbox.min()[1],     // Add in the bounding box row
-                                 g_top[i] );
-            g_bottom[i] = std::max( m_bottom[l] + m_bbox.min()[1],
-                                    g_bottom[i] );
-            l++;
+        // Coming in from the end
+        std::fill( done.begin(), done.end(), 0 );
+        num_left = num_lines;
+        for ( int32 s = num_strips - 1; s >= 0 && num_left > 0; s-- ) {
+          int32 start = s*m_block_size;
+          ImageView<PixelT> tile( crop(m_view, strip_box(start)) );
+          for ( int32 k = 0; k < num_lines; k++ ) {
+            if ( done[k] || scan_forward(tile, k) < 0 ) continue;
+            g_max[m_beg + k] = start + scan_backward(tile, k);
+            done[k] = 1;
+            num_left--;
           }
         }
       }
@@ -217,8 +211,6 @@ namespace asp {
       // Calculating edges in parallel
       FifoWorkQueue queue( vw_settings().default_num_threads() );
 
-      std::vector<BBox2i> bboxes = subdivide_bbox( m_view, block_size, block_size );
-
       // Figure out an ideal search step size. Smaller means we're
       // more likely to catch small features. Bigger step size means
       // will move a lot faster.
@@ -229,11 +221,22 @@ namespace asp {
         search_step = 10;
       VW_OUT(DebugMessage, "threadededgemask") << "Setting search step to " << search_step << std::endl;
 
-      // Find the outermost valid pixel coming in from each line/direction.
-      BOOST_FOREACH( BBox2i const& box, bboxes ) {
-        VW_OUT(DebugMessage, "threadededgemask") << "Created EdgeMaskTask for " << box << std::endl;
-        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step, box, 
-                                                              m_left, m_right, m_top, m_bottom ) );
+      // Find the outermost valid pixel coming in from each line/direction,
+      // with a task for each band of rows and each band of columns.
+      if (block_size < 1)
+        block_size = 1;
+      for ( int32 beg = 0; beg < view.rows(); beg += block_size ) {
+        int32 end = std::min(beg + block_size, int32(view.rows()));
+        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step,
+                                                              true, beg, end, block_size,
+                                                              m_left, m_right ) );
+        queue.add_task(task);
+      }
+      for ( int32 beg = 0; beg < view.cols(); beg += block_size ) {
+        int32 end = std::min(beg + block_size, int32(view.cols()));
+        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step,
+                                                              false, beg, end, block_size,
+                                                              m_top, m_bottom ) );
         queue.add_task(task);
       }
       queue.join_all(); // Wait for all tasks to complete
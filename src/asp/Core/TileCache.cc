@@ -0,0 +1,87 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+/// \file TileCache.cc
+///
+
+#include <asp/Core/TileCache.h>
+#include <asp/Core/Telemetry.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+using namespace vw;
+
+namespace {
+
+  struct CacheClass {
+    double    budget;
+    long long hits, misses, evictions;
+    CacheClass(): budget(0), hits(0), misses(0), evictions(0) {}
+  };
+
+  vw::Mutex                         g_cache_mutex;
+  std::map<std::string, CacheClass> g_cache_classes;
+}
+
+namespace asp {
+
+  void set_tile_cache_budget(std::string const& cache_class, double budget_mb) {
+    if (budget_mb < 0)
+      vw_throw(ArgumentErr() << "The cache size of " << cache_class
+                             << " tiles must be non-negative.\n");
+    vw::Mutex::Lock lock(g_cache_mutex);
+    g_cache_classes[cache_class].budget = budget_mb*1024.0*1024.0;
+  }
+
+  double tile_cache_budget(std::string const& cache_class) {
+    vw::Mutex::Lock lock(g_cache_mutex);
+    std::map<std::string, CacheClass>::const_iterator it = g_cache_classes.find(cache_class);
+    if (it == g_cache_classes.end())
+      return 0;
+    return it->second.budget;
+  }
+
+  void count_tile_cache_lookups(std::string const& cache_class,
+                                long long hits, long long misses, long long evictions) {
+    vw::Mutex::Lock lock(g_cache_mutex);
+    CacheClass & c = g_cache_classes[cache_class];
+    c.hits      += hits;
+    c.misses    += misses;
+    c.evictions += evictions;
+  }
+
+  void report_tile_cache_stats() {
+    vw::Mutex::Lock lock(g_cache_mutex);
+    for (std::map<std::string, CacheClass>::const_iterator it = g_cache_classes.begin();
+         it != g_cache_classes.end(); it++) {
+      CacheClass const& c = it->second;
+      if (c.hits + c.misses == 0)
+        continue;
+      vw_out() << "Cache of " << it->first << " tiles: " << c.hits << " hits, "
+               << c.misses << " misses, " << c.evictions << " evictions.\n";
+      std::map<std::string, double> values;
+      values["hits"]      = c.hits;
+      values["misses"]    = c.misses;
+      values["evictions"] = c.evictions;
+      values["budget_mb"] = c.budget/(1024.0*1024.0);
+      record_counters("tile_cache_" + it->first, values);
+    }
+  }
+
+} // namespace asp
@@ -0,0 +1,237 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+/// \file TileCache.h
+///
+/// A cache of computed tiles, for the views which read the same region
+/// of their inputs for several output tiles or several passes, such as
+/// a point cloud gridded once for the DEM and again for the
+/// orthoimage and error images. The VW system cache is a single LRU
+/// shared by all the image chains of a process, so a large point cloud
+/// evicts the blocks of everything else. Here each class of resource,
+/// such as "point_cloud" or "dem", has its own memory budget, and the
+/// tiles of a class are evicted least recently used first. Caches are
+/// off until their class is given a budget. The hits, misses and
+/// evictions go to the telemetry file.
+
+#ifndef __ASP_CORE_TILE_CACHE_H__
+#define __ASP_CORE_TILE_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// Set the memory budget of a class of tiles, in MB. Zero turns off
+  /// the caches of the class.
+  void set_tile_cache_budget(std::string const& cache_class, double budget_mb);
+
+  /// The budget of a class, in bytes. Zero if none was set.
+  double tile_cache_budget(std::string const& cache_class);
+
+  /// Count the lookups of a class of tiles
+  void count_tile_cache_lookups(std::string const& cache_class,
+                                long long hits, long long misses, long long evictions);
+
+  /// Print the hits, misses and evictions of each class which was
+  /// used, and record them in the telemetry file if it is enabled.
+  void report_tile_cache_stats();
+
+  /// The tiles, each the cell (col, row) of a grid of the given block
+  /// size, of the image with the given id.
+  template <class PixelT>
+  class TileCache: private boost::noncopyable {
+
+    struct Key {
+      int id, col, row;
+      bool operator<(Key const& k) const {
+        if (id  != k.id ) return id  < k.id;
+        if (row != k.row) return row < k.row;
+        return col < k.col;
+      }
+    };
+    typedef std::list<Key> LruList;
+    struct Entry {
+      vw::ImageView<PixelT> tile;
+      typename LruList::iterator lru_pos;
+    };
+    typedef std::map<Key, Entry> EntryMap;
+
+    std::string m_class;
+    int         m_block_size;
+    double      m_budget, m_bytes;
+    LruList     m_lru; // the most recently used at the front
+    EntryMap    m_entries;
+    vw::Mutex   m_mutex;
+
+    static double tile_bytes(vw::ImageView<PixelT> const& tile) {
+      return double(tile.cols())*tile.rows()*sizeof(PixelT);
+    }
+
+    // Look up a cell. The tile is shared with the cache and must not
+    // be modified.
+    bool get(Key const& key, vw::ImageView<PixelT> & tile) {
+      vw::Mutex::Lock lock(m_mutex);
+      typename EntryMap::iterator it = m_entries.find(key);
+      if (it == m_entries.end())
+        return false;
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru_pos);
+      tile = it->second.tile;
+      return true;
+    }
+
+    // Add a cell, evicting the oldest ones to stay within the budget.
+    // Returns the number of evictions.
+    long long put(Key const& key, vw::ImageView<PixelT> const& tile) {
+      vw::Mutex::Lock lock(m_mutex);
+      if (m_entries.find(key) != m_entries.end())
+        return 0; // another thread made it meanwhile
+      long long evictions = 0;
+      double bytes = tile_bytes(tile);
+      while (!m_lru.empty() && m_bytes + bytes > m_budget) {
+        typename EntryMap::iterator it = m_entries.find(m_lru.back());
+        m_bytes -= tile_bytes(it->second.tile);
+        m_entries.erase(it);
+        m_lru.pop_back();
+        evictions++;
+      }
+      if (bytes > m_budget)
+        return evictions; // too big for the cache
+      m_lru.push_front(key);
+      Entry & entry  = m_entries[key];
+      entry.tile    = tile;
+      entry.lru_pos = m_lru.begin();
+      m_bytes += bytes;
+      return evictions;
+    }
+
+  public:
+    TileCache(std::string const& cache_class, int block_size):
+      m_class(cache_class), m_block_size(block_size),
+      m_budget(tile_cache_budget(cache_class)), m_bytes(0) {}
+
+    bool enabled() const { return m_budget > 0; }
+
+    /// The pixels of the box in the image with the given id. These are
+    /// put together from the grid cells intersecting the box. The
+    /// cells which are not cached are made with the functor, as an
+    /// ImageView<PixelT> of the cell given as a BBox2i, and cached.
+    template <class FuncT>
+    vw::ImageView<PixelT> crop(int id, vw::BBox2i const& box, FuncT const& make_cell) {
+      vw::ImageView<PixelT> result(box.width(), box.height());
+      long long hits = 0, misses = 0, evictions = 0;
+      int beg_col = floor_div(box.min().x()),     beg_row = floor_div(box.min().y());
+      int end_col = floor_div(box.max().x() - 1), end_row = floor_div(box.max().y() - 1);
+      for (int row = beg_row; row <= end_row; row++) {
+        for (int col = beg_col; col <= end_col; col++) {
+          Key key;
+          key.id = id; key.col = col; key.row = row;
+          vw::BBox2i cell(col*m_block_size, row*m_block_size, m_block_size, m_block_size);
+          vw::ImageView<PixelT> tile;
+          if (get(key, tile)) {
+            hits++;
+          } else {
+            misses++;
+            tile = make_cell(cell);
+            evictions += put(key, tile);
+          }
+          // The cells at the image boundary may be smaller
+          vw::BBox2i inter = box;
+          inter.crop(vw::BBox2i(cell.min(), cell.min() + vw::Vector2i(tile.cols(), tile.rows())));
+          if (inter.empty())
+            continue;
+          vw::crop(result, inter - box.min()) = vw::crop(tile, inter - cell.min());
+        }
+      }
+      count_tile_cache_lookups(m_class, hits, misses, evictions);
+      return result;
+    }
+
+  private:
+    int floor_div(int v) const {
+      return (v >= 0) ? v/m_block_size : -((-v + m_block_size - 1)/m_block_size);
+    }
+  };
+
+  /// An image read through a tile cache, so that the views cropping
+  /// overlapping regions of it, such as the correlation tiles with
+  /// their kernel and search range padding, read each cell of it once
+  /// while the cell stays in the cache. The copies of the view share
+  /// the cache, which may be shared by several images of different ids.
+  template <class PixelT>
+  class TileCachedView: public vw::ImageViewBase< TileCachedView<PixelT> > {
+
+    // The cell of the image, smaller or empty past its edges
+    struct ImageCell {
+      vw::ImageViewRef<PixelT> const& image;
+      explicit ImageCell(vw::ImageViewRef<PixelT> const& img): image(img) {}
+      vw::ImageView<PixelT> operator()(vw::BBox2i const& cell) const {
+        vw::BBox2i box = cell;
+        box.crop(bounding_box(image));
+        if (box.empty() || box.min() != cell.min())
+          return vw::ImageView<PixelT>();
+        return vw::crop(image, box);
+      }
+    };
+
+    vw::ImageViewRef<PixelT>                  m_image;
+    boost::shared_ptr< TileCache<PixelT> >    m_cache;
+    int                                       m_id;
+
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef vw::ProceduralPixelAccessor<TileCachedView> pixel_accessor;
+
+    TileCachedView(vw::ImageViewRef<PixelT> const& image,
+                   boost::shared_ptr< TileCache<PixelT> > cache, int id):
+      m_image(image), m_cache(cache), m_id(id) {}
+
+    inline vw::int32 cols  () const { return m_image.cols(); }
+    inline vw::int32 rows  () const { return m_image.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()(vw::int32 col, vw::int32 row, vw::int32 /*p*/ = 0) const {
+      return m_image(col, row);
+    }
+
+    typedef vw::CropView< vw::ImageView<PixelT> > prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<PixelT> tile = m_cache->crop(m_id, bbox, ImageCell(m_image));
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_TILE_CACHE_H__
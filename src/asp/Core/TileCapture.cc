@@ -0,0 +1,325 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TileCapture.cc
+///
+
+#include <asp/Core/TileCapture.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/IntegerImage.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <vw/Math/LinearAlgebra.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace vw;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+namespace {
+  vw::Mutex                g_capture_mutex;
+  bool                     g_capture_enabled = false;
+  std::string              g_capture_dir, g_capture_stereo_file;
+  std::vector<BBox2i>      g_capture_boxes;
+  double                   g_capture_min_seconds = 0;
+  int                      g_capture_max_tiles = 0, g_capture_num_tiles = 0;
+  std::vector<std::string> g_capture_args;
+
+  const char * MANIFEST_FILE = "tile.txt";
+  const char * COMMAND_FILE  = "command.txt";
+  const char * SETTINGS_FILE = "stereo.default";
+}
+
+namespace asp {
+
+  void enable_tile_capture(std::string const& dir, std::vector<BBox2i> const& boxes,
+                           double min_seconds, int max_tiles,
+                           int argc, char* argv[], std::string const& stereo_file) {
+    vw::Mutex::Lock lock(g_capture_mutex);
+    if (g_capture_enabled)
+      return;
+    g_capture_dir         = dir;
+    g_capture_boxes       = boxes;
+    g_capture_min_seconds = min_seconds;
+    g_capture_max_tiles   = max_tiles;
+    g_capture_stereo_file = stereo_file;
+    g_capture_args.assign(argv, argv + argc);
+    g_capture_enabled     = true;
+    vw_out() << "Capturing the inputs of up to " << max_tiles << " tiles in: " << dir << "\n";
+  }
+
+  bool tile_capture_enabled() {
+    return g_capture_enabled;
+  }
+
+  std::vector<BBox2i> parse_capture_boxes(std::string const& text) {
+    std::string spaced = text;
+    std::replace(spaced.begin(), spaced.end(), ',', ' ');
+    std::istringstream is(spaced);
+    std::vector<BBox2i> boxes;
+    std::vector<int> vals;
+    int val;
+    while (is >> val)
+      vals.push_back(val);
+    if (!is.eof() || vals.size() % 4 != 0)
+      vw_throw(ArgumentErr() << "Expecting the tiles to capture as groups of "
+               << "four integers, xoff yoff xsize ysize, but got: " << text << ".\n");
+    for (size_t i = 0; i < vals.size(); i += 4)
+      boxes.push_back(BBox2i(vals[i], vals[i+1], vals[i+2], vals[i+3]));
+    return boxes;
+  }
+
+  bool capture_tile_wanted(BBox2i const& tile, double seconds) {
+    if (!tile_capture_enabled())
+      return false;
+
+    bool wanted = (g_capture_min_seconds > 0 && seconds >= g_capture_min_seconds);
+    for (size_t i = 0; i < g_capture_boxes.size() && !wanted; i++)
+      wanted = tile.intersects(g_capture_boxes[i]);
+    if (!wanted)
+      return false;
+
+    vw::Mutex::Lock lock(g_capture_mutex);
+    if (g_capture_num_tiles >= g_capture_max_tiles)
+      return false;
+    g_capture_num_tiles++;
+    return true;
+  }
+
+  std::string start_tile_capture(std::string const& kind, BBox2i const& tile) {
+    std::ostringstream os;
+    os << g_capture_dir << "/" << kind << "-" << tile.min().x() << "_" << tile.min().y()
+       << "_" << tile.width() << "_" << tile.height();
+    std::string dir = os.str();
+    fs::create_directories(dir);
+
+    // One argument per line, so that those with spaces survive
+    std::ofstream cmd((dir + "/" + COMMAND_FILE).c_str());
+    for (size_t i = 0; i < g_capture_args.size(); i++)
+      cmd << g_capture_args[i] << "\n";
+    if (!cmd)
+      vw_throw(IOErr() << "Could not write: " << dir + "/" + COMMAND_FILE << ".\n");
+
+    std::vector<char*> argv(g_capture_args.size());
+    for (size_t i = 0; i < g_capture_args.size(); i++)
+      argv[i] = const_cast<char*>(g_capture_args[i].c_str());
+    stereo_settings().write_copy(int(argv.size()), argv.empty() ? NULL : &argv[0],
+                                 g_capture_stereo_file, dir + "/" + SETTINGS_FILE);
+
+    vw_out() << "Capturing tile " << tile << " in: " << dir << "\n";
+    return dir;
+  }
+
+  void TileManifest::set(std::string const& key, std::string const& value) {
+    m_values[key] = value;
+  }
+
+  void TileManifest::set(std::string const& key, double value) {
+    std::ostringstream os;
+    os << std::setprecision(17) << value;
+    m_values[key] = os.str();
+  }
+
+  void TileManifest::set(std::string const& key, Vector2i const& value) {
+    std::ostringstream os;
+    os << value.x() << " " << value.y();
+    m_values[key] = os.str();
+  }
+
+  void TileManifest::set(std::string const& key, BBox2i const& value) {
+    std::ostringstream os;
+    os << value.min().x() << " " << value.min().y() << " "
+       << value.width()   << " " << value.height();
+    m_values[key] = os.str();
+  }
+
+  bool TileManifest::has(std::string const& key) const {
+    return m_values.find(key) != m_values.end();
+  }
+
+  std::string TileManifest::get_string(std::string const& key) const {
+    std::map<std::string, std::string>::const_iterator it = m_values.find(key);
+    if (it == m_values.end())
+      vw_throw(ArgumentErr() << "Missing from the captured tile: " << key << ".\n");
+    return it->second;
+  }
+
+  double TileManifest::get_double(std::string const& key) const {
+    std::istringstream is(get_string(key));
+    double value;
+    if (!(is >> value))
+      vw_throw(ArgumentErr() << "Could not parse " << key << " of the captured tile.\n");
+    return value;
+  }
+
+  Vector2i TileManifest::get_vector(std::string const& key) const {
+    std::istringstream is(get_string(key));
+    Vector2i value;
+    if (!(is >> value[0] >> value[1]))
+      vw_throw(ArgumentErr() << "Could not parse " << key << " of the captured tile.\n");
+    return value;
+  }
+
+  BBox2i TileManifest::get_bbox(std::string const& key) const {
+    std::istringstream is(get_string(key));
+    int x, y, w, h;
+    if (!(is >> x >> y >> w >> h))
+      vw_throw(ArgumentErr() << "Could not parse " << key << " of the captured tile.\n");
+    return BBox2i(x, y, w, h);
+  }
+
+  void TileManifest::write(std::string const& dir) const {
+    std::string file = dir + "/" + MANIFEST_FILE;
+    std::ofstream os(file.c_str());
+    for (std::map<std::string, std::string>::const_iterator it = m_values.begin();
+         it != m_values.end(); it++)
+      os << it->first << " " << it->second << "\n";
+    if (!os)
+      vw_throw(IOErr() << "Could not write: " << file << ".\n");
+  }
+
+  void TileManifest::read(std::string const& dir) {
+    std::string file = dir + "/" + MANIFEST_FILE;
+    std::ifstream is(file.c_str());
+    if (!is)
+      vw_throw(IOErr() << "Could not read: " << file << ".\n");
+    m_values.clear();
+    std::string line;
+    while (std::getline(is, line)) {
+      boost::trim(line);
+      if (line.empty())
+        continue;
+      size_t pos = line.find(' ');
+      if (pos == std::string::npos)
+        m_values[line] = "";
+      else
+        m_values[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+  }
+
+  void load_captured_settings(std::string const& dir) {
+    std::string cmd_file = dir + "/" + COMMAND_FILE;
+    std::ifstream is(cmd_file.c_str());
+    if (!is)
+      vw_throw(IOErr() << "Could not read: " << cmd_file << ".\n");
+    std::vector<std::string> args;
+    std::string line;
+    while (std::getline(is, line))
+      args.push_back(line);
+    if (!args.empty())
+      args.erase(args.begin()); // The program
+
+    // The inputs and the options of the tools themselves are not needed
+    vw::cartography::GdalWriteOptions gdal_opt;
+    std::vector<std::string> inputs;
+    po::options_description options;
+    options.add(generate_config_file_options(gdal_opt));
+    po::options_description positional;
+    positional.add_options()("input-files", po::value(&inputs));
+    po::positional_options_description positional_desc;
+    positional_desc.add("input-files", -1);
+    po::options_description all_options;
+    all_options.add(options).add(positional);
+
+    try {
+      po::variables_map vm;
+      po::store(po::command_line_parser(args).options(all_options)
+                .positional(positional_desc).allow_unregistered().run(), vm);
+
+      // The command line takes precedence over the file, as in the run
+      po::options_description cfg_options;
+      cfg_options.add(generate_config_file_options(gdal_opt));
+      po::store(parse_asp_config_file(false, dir + "/" + SETTINGS_FILE, cfg_options, true), vm);
+      po::notify(vm);
+    } catch (po::error const& e) {
+      vw_throw(ArgumentErr() << "Error parsing the settings of the captured tile in "
+               << dir << ":\n" << e.what() << "\n");
+    }
+    stereo_settings().validate();
+  }
+
+  BBox2i right_capture_box(BBox2i const& left_box, BBox2f const& search_range,
+                           Matrix<double> const& right_hom) {
+    BBox2i box = left_box;
+    if (!search_range.empty()) {
+      box.min() += Vector2i(int(floor(search_range.min().x())), int(floor(search_range.min().y())));
+      box.max() += Vector2i(int(ceil (search_range.max().x())), int(ceil (search_range.max().y())));
+    }
+    if (right_hom == math::identity_matrix<3>())
+      return box;
+
+    // The transformed image at a pixel is the image at the inverse of
+    // the homography of it. One more pixel, for the interpolation.
+    Matrix<double> inv_hom = math::inverse(right_hom);
+    BBox2 corners;
+    for (int c = 0; c < 4; c++) {
+      Vector3 p((c & 1) ? box.max().x() : box.min().x(),
+                (c & 2) ? box.max().y() : box.min().y(), 1.0);
+      Vector3 q = inv_hom*p;
+      corners.grow(Vector2(q[0]/q[2], q[1]/q[2]));
+    }
+    BBox2i right_box(Vector2i(int(floor(corners.min().x())), int(floor(corners.min().y()))),
+                     Vector2i(int(ceil (corners.max().x())), int(ceil (corners.max().y()))));
+    right_box.expand(2);
+    return right_box;
+  }
+
+  void report_replayed_tile(std::string const& dir, std::string const& name,
+                            ImageView< PixelMask<Vector2f> > const& result,
+                            double seconds) {
+    TileManifest manifest;
+    manifest.read(dir);
+    vw_out() << "\t--> Replayed the tile in " << seconds << " seconds. It took "
+             << manifest.get_double("seconds") << " seconds when captured.\n";
+
+    ImageView< PixelMask<Vector2f> > captured;
+    read_image(captured, dir + "/" + name + ".tif");
+    DisparityDifference diff = compare_disparities(captured, result, 0.0);
+    if (diff.num_first_only == 0 && diff.num_second_only == 0 && diff.num_above == 0) {
+      vw_out() << "\t--> The result is the same as the one captured.\n";
+      return;
+    }
+    vw_out() << "\t--> The result differs from the one captured: " << diff.num_above
+             << " of " << diff.num_both << " pixels valid in both differ, by at most "
+             << diff.max_diff << ", " << diff.num_first_only << " are valid only in the "
+             << "captured one, and " << diff.num_second_only << " only in the replayed one. "
+             << "The crops may be too small for these settings.\n";
+  }
+
+  bool replay_tile_option(int argc, char* argv[], std::string & dir) {
+    for (int i = 1; i < argc; i++) {
+      if (std::string(argv[i]) != "--replay-tile")
+        continue;
+      if (i + 1 >= argc)
+        vw_throw(ArgumentErr() << "The option --replay-tile needs the directory of a captured tile.\n");
+      dir = argv[i + 1];
+      return true;
+    }
+    return false;
+  }
+
+} // namespace asp
@@ -0,0 +1,145 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TileCapture.h
+///
+/// Saving the inputs of selected tiles of correlation and refinement,
+/// so that a single tile can be run again, by itself, such as under a
+/// profiler. A tile is captured if it intersects one of the boxes
+/// given, or if it took at least a given number of seconds, up to a
+/// number of tiles per process.
+///
+/// Each captured tile has its own directory, <dir>/<kind>-x_y_w_h,
+/// with the command line and the stereo.default file of the run, the
+/// crops of the images the tile reads, the output of the tile, and the
+/// file tile.txt, which says where the crops are in the full images,
+/// together with the settings found at run time, such as the search
+/// range. When replayed, each crop is seen as an image of the full
+/// size, with zeros outside the crop.
+
+#ifndef __ASP_CORE_TILE_CAPTURE_H__
+#define __ASP_CORE_TILE_CAPTURE_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Matrix.h>
+#include <vw/Math/Vector.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Capture the tiles intersecting one of the boxes, or taking at
+  /// least min_seconds if that is positive, at most max_tiles of them,
+  /// in the given directory. The command line and the stereo.default
+  /// file are saved with each tile. Only the first call has an effect.
+  void enable_tile_capture(std::string const& dir,
+                           std::vector<vw::BBox2i> const& boxes,
+                           double min_seconds, int max_tiles,
+                           int argc, char* argv[], std::string const& stereo_file);
+
+  /// If enable_tile_capture() was called
+  bool tile_capture_enabled();
+
+  /// Parse boxes given as "xoff yoff xsize ysize ...", separated by
+  /// spaces or commas.
+  std::vector<vw::BBox2i> parse_capture_boxes(std::string const& text);
+
+  /// If a tile which took this long is to be captured. A tile for
+  /// which this returns true counts towards the maximum.
+  bool capture_tile_wanted(vw::BBox2i const& tile, double seconds);
+
+  /// Make the directory of a tile to capture, with the command line
+  /// and the stereo.default file in it, and return it.
+  std::string start_tile_capture(std::string const& kind, vw::BBox2i const& tile);
+
+  /// The description of a captured tile, as lines of a key followed by
+  /// its values, in tile.txt in the directory of the tile.
+  class TileManifest {
+    std::map<std::string, std::string> m_values;
+  public:
+    void set(std::string const& key, std::string const& value);
+    void set(std::string const& key, double value);
+    void set(std::string const& key, vw::Vector2i const& value);
+    void set(std::string const& key, vw::BBox2i const& value);
+
+    bool         has       (std::string const& key) const;
+    std::string  get_string(std::string const& key) const;
+    double       get_double(std::string const& key) const;
+    vw::Vector2i get_vector(std::string const& key) const;
+    vw::BBox2i   get_bbox  (std::string const& key) const;
+
+    void write(std::string const& dir) const;
+    void read (std::string const& dir);
+  };
+
+  /// Apply to stereo_settings() the command line and the
+  /// stereo.default file saved with a captured tile.
+  void load_captured_settings(std::string const& dir);
+
+  /// If the command line is "--replay-tile <dir>", possibly with other
+  /// options, return true and the directory.
+  bool replay_tile_option(int argc, char* argv[], std::string & dir);
+
+  /// The box of the right image which the pixels of a box of the left
+  /// image are compared with, for the given search range. With a
+  /// homography other than the identity, the right image is seen
+  /// through it, as with the local homographies, and the box is that
+  /// of the right image before it is transformed.
+  vw::BBox2i right_capture_box(vw::BBox2i const& left_box, vw::BBox2f const& search_range,
+                               vw::Matrix<double> const& right_hom);
+
+  /// Compare the result of a replayed tile with the one saved, with the
+  /// given name, when the tile was captured, and print the time each took.
+  void report_replayed_tile(std::string const& dir, std::string const& name,
+                            vw::ImageView< vw::PixelMask<vw::Vector2f> > const& result,
+                            double seconds);
+
+  /// Save a crop of an image with the tile
+  template <class ImageT>
+  void write_capture_crop(std::string const& dir, std::string const& name,
+                          ImageT const& image, vw::BBox2i const& box) {
+    vw::ImageView<typename ImageT::pixel_type> pixels = vw::crop(image, box);
+    vw::write_image(dir + "/" + name + ".tif", pixels);
+  }
+
+  /// Read a crop saved with write_capture_crop() as an image of the full
+  /// size, with zeros outside the crop.
+  template <class PixelT>
+  vw::ImageViewRef<PixelT> read_capture_crop(std::string const& dir, std::string const& name,
+                                             vw::BBox2i const& box, vw::Vector2i const& size) {
+    vw::ImageView<PixelT> pixels;
+    vw::read_image(pixels, dir + "/" + name + ".tif");
+    if (pixels.cols() != box.width() || pixels.rows() != box.height())
+      vw_throw(vw::ArgumentErr() << "The captured crop " << name << " in " << dir
+               << " does not have the size of " << box << ".\n");
+    return vw::edge_extend(pixels, -box.min().x(), -box.min().y(), size.x(), size.y(),
+                           vw::ZeroEdgeExtension());
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_TILE_CAPTURE_H__
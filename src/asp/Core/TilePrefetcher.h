@@ -0,0 +1,211 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TilePrefetcher.h
+///
+/// Read the tiles of an input image ahead of the threads which need
+/// them. When an output image is written, its tiles are processed in
+/// raster order, and each one first reads its region of the inputs.
+/// On network storage the threads then spend much of their time
+/// waiting. Given the order of the tiles, a few background threads
+/// read the next ones into memory, as many as fit in a memory budget,
+/// and a tile thread takes its input from there if it was read, or
+/// waits for it if it is being read. Regions not in the schedule are
+/// read by the caller as usual.
+
+#ifndef __ASP_CORE_TILE_PREFETCHER_H__
+#define __ASP_CORE_TILE_PREFETCHER_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+#include <asp/Core/Telemetry.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  template <class PixelT>
+  class TilePrefetcher: private boost::noncopyable {
+
+    enum TileState { IDLE, READING, READY, FAILED, TAKEN };
+
+    std::string                      m_name;
+    vw::ImageViewRef<PixelT>         m_image;
+    double                           m_budget, m_bytes;
+    std::vector<vw::BBox2i>          m_schedule;
+    std::map<std::pair<int, int>, int> m_index; // from the tile corner to its place in the schedule
+    std::vector<TileState>           m_state;
+    std::vector< vw::ImageView<PixelT> > m_tiles;
+    int                              m_next;    // the next tile to read
+    bool                             m_stopped;
+    long long                        m_hits, m_waits, m_misses;
+    vw::Mutex                        m_mutex;
+    vw::Condition                    m_cond;
+    vw::FifoWorkQueue                m_queue;
+
+    class ReadTask: public vw::Task, private boost::noncopyable {
+      TilePrefetcher & m_prefetcher;
+      int              m_tile;
+    public:
+      ReadTask(TilePrefetcher & prefetcher, int tile): m_prefetcher(prefetcher), m_tile(tile) {}
+      void operator()() { m_prefetcher.read(m_tile); }
+    };
+
+    static double tile_bytes(vw::BBox2i const& box) {
+      return double(box.width())*box.height()*sizeof(PixelT);
+    }
+
+    // Read a tile in a background thread. A failed read is left to
+    // the caller, which will read the tile again and see the error.
+    void read(int tile) {
+      {
+        vw::Mutex::Lock lock(m_mutex);
+        if (m_stopped)
+          return;
+      }
+      vw::ImageView<PixelT> data;
+      bool success = true;
+      try {
+        data = vw::crop(m_image, m_schedule[tile]);
+      } catch (...) {
+        success = false;
+      }
+      vw::Mutex::Lock lock(m_mutex);
+      if (success) {
+        m_tiles[tile] = data;
+        m_state[tile] = READY;
+      } else {
+        m_bytes -= tile_bytes(m_schedule[tile]);
+        m_state[tile] = FAILED;
+      }
+      m_cond.notify_all();
+    }
+
+    // Queue the reads of the next tiles which fit in the budget. The
+    // lock must be held.
+    void read_ahead() {
+      while (m_next < int(m_schedule.size()) && !m_stopped) {
+        if (m_state[m_next] == IDLE) {
+          double bytes = tile_bytes(m_schedule[m_next]);
+          if (m_bytes + bytes > m_budget)
+            break;
+          m_bytes += bytes;
+          m_state[m_next] = READING;
+          m_queue.add_task(boost::shared_ptr<vw::Task>(new ReadTask(*this, m_next)));
+        }
+        m_next++;
+      }
+    }
+
+  public:
+
+    /// Read tiles of the image with this many threads, keeping at
+    /// most budget_mb MB of them in memory. Nothing is read until
+    /// start() is called. A zero budget or number of threads turns
+    /// the prefetching off. The name labels the telemetry counters.
+    TilePrefetcher(std::string const& name, vw::ImageViewRef<PixelT> const& image,
+                   double budget_mb, int num_threads):
+      m_name(name), m_image(image), m_budget(budget_mb*1024.0*1024.0), m_bytes(0),
+      m_next(0), m_stopped(false), m_hits(0), m_waits(0), m_misses(0),
+      m_queue(std::max(num_threads, 1)) {
+      if (num_threads <= 0)
+        m_budget = 0;
+    }
+
+    ~TilePrefetcher() {
+      {
+        vw::Mutex::Lock lock(m_mutex);
+        m_stopped = true;
+      }
+      m_queue.join_all();
+
+      std::map<std::string, double> values;
+      values["hits"]   = m_hits;
+      values["waits"]  = m_waits;
+      values["misses"] = m_misses;
+      if (!m_schedule.empty())
+        record_counters("prefetch_" + m_name, values);
+    }
+
+    bool enabled() const { return m_budget > 0; }
+
+    /// Start reading the tiles, in the order they will be needed.
+    /// Tiles which were not taken from a previous schedule are dropped.
+    void start(std::vector<vw::BBox2i> const& schedule) {
+      if (!enabled())
+        return;
+      m_queue.join_all(); // finish the reads of a previous schedule
+      vw::Mutex::Lock lock(m_mutex);
+      m_schedule = schedule;
+      m_index.clear();
+      for (size_t t = 0; t < m_schedule.size(); t++)
+        m_index[std::make_pair(m_schedule[t].min().x(), m_schedule[t].min().y())] = t;
+      m_state.assign(m_schedule.size(), IDLE);
+      m_tiles.assign(m_schedule.size(), vw::ImageView<PixelT>());
+      m_bytes = 0;
+      m_next  = 0;
+      read_ahead();
+    }
+
+    /// Take the pixels of a tile of the schedule if they were read
+    /// ahead, waiting for them if they are being read. Returns false
+    /// if the caller should read them itself. A tile can be taken once.
+    bool take(vw::BBox2i const& box, vw::ImageView<PixelT> & tile) {
+      vw::Mutex::Lock lock(m_mutex);
+      std::map<std::pair<int, int>, int>::const_iterator it
+        = m_index.find(std::make_pair(box.min().x(), box.min().y()));
+      if (it == m_index.end() || m_schedule[it->second] != box)
+        return false;
+      int t = it->second;
+
+      if (m_state[t] == READING) {
+        m_waits++;
+        while (m_state[t] == READING)
+          m_cond.wait(lock);
+      }
+
+      bool success = false;
+      if (m_state[t] == READY) {
+        tile = m_tiles[t];
+        m_tiles[t] = vw::ImageView<PixelT>();
+        m_bytes -= tile_bytes(box);
+        m_hits++;
+        success = true;
+      } else if (m_state[t] == IDLE) {
+        // The tile threads got ahead of the reads. Skip what they
+        // are going to read themselves.
+        m_next = std::max(m_next, t + 1);
+        m_misses++;
+      }
+      m_state[t] = TAKEN;
+      read_ahead();
+      return success;
+    }
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_TILE_PREFETCHER_H__
@@ -0,0 +1,296 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BenchCoreKernels.cxx
+///
+/// Time the inner kernels of stereo and point2dem on made-up inputs:
+/// the FFT correlation of sparse_disp, the software renderer and
+/// Point2Grid of point2dem, the median filter, CSV line parsing, the
+/// census matching cost of the consistency check of stereo_corr, and
+/// the nearest neighbor queries which pc_align does at each iteration.
+/// The inputs come from a fixed random generator, so they are the same
+/// on all machines. This is not run by "make check". Build it with
+/// "make BenchCoreKernels", then run
+///
+///   BenchCoreKernels [min_seconds] [output.json]
+///
+/// The results go to standard output if no output file is given.
+
+#include <asp/Core/Benchmark.h>
+#include <asp/Core/CensusTransform.h>
+#include <asp/Core/FftCorrelation.h>
+#include <asp/Core/MedianFilter.h>
+#include <asp/Core/Point2Grid.h>
+#include <asp/Core/PointUtils.h>
+#include <asp/Core/SoftwareRenderer.h>
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/FLANNTree.h>
+#include <vw/Math/Matrix.h>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A linear congruential generator giving values in [0, 1)
+  struct Random {
+    unsigned long long state;
+    Random(): state(1234567){}
+    double operator()(){
+      state = state*6364136223846793005ULL + 1442695040888963407ULL;
+      return double(state >> 11)/double(1ULL << 53);
+    }
+  };
+
+  ImageView<float> random_texture(int cols, int rows){
+    Random rand;
+    ImageView<float> image(cols, rows);
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        image(col, row) = rand();
+    return image;
+  }
+
+  // Correlate a template taken from the search image, as sparse_disp does
+  struct FftNccKernel {
+    ImageView<float> tmpl, search, ncc;
+    FftNccKernel(int tmpl_size, int search_size){
+      search = random_texture(search_size, search_size);
+      int offset = (search_size - tmpl_size)/3;
+      tmpl = copy(crop(search, offset, offset, tmpl_size, tmpl_size));
+    }
+    double operator()(){
+      normalized_cross_correlation(tmpl, search, ncc);
+      return double(ncc.cols())*ncc.rows();
+    }
+  };
+
+  // Render the triangles of a regular mesh covering the buffer
+  struct RendererKernel {
+    int size;
+    ImageView<float>   buffer;
+    std::vector<float> vertices, colors;
+    std::vector<int>   indices;
+    explicit RendererKernel(int s): size(s), buffer(s, s){
+      Random rand;
+      int n = size/4 + 1; // a vertex every 4 pixels
+      for (int row = 0; row < n; row++){
+        for (int col = 0; col < n; col++){
+          vertices.push_back(4.0*col + rand());
+          vertices.push_back(4.0*row + rand());
+          colors.push_back(rand());
+        }
+      }
+      for (int row = 0; row + 1 < n; row++){
+        for (int col = 0; col + 1 < n; col++){
+          int a = row*n + col, b = a + 1, c = a + n, d = c + 1;
+          int tri[6] = {a, b, c, b, d, c};
+          indices.insert(indices.end(), tri, tri + 6);
+        }
+      }
+    }
+    double operator()(){
+      stereo::SoftwareRenderer renderer(size, size, &buffer(0, 0));
+      renderer.Ortho2D(0, size, 0, size);
+      renderer.Clear(-1.0);
+      renderer.SetVertexPointer(2, &vertices[0]);
+      renderer.SetColorPointer(1, &colors[0]);
+      renderer.DrawTriangles(indices.size(), &indices[0]);
+      return indices.size()/3;
+    }
+  };
+
+  // Grid scattered points, as point2dem does with a search radius
+  struct Point2GridKernel {
+    int size;
+    FilterType filter;
+    std::vector<Vector3> points;
+    ImageView<double> buffer, weights;
+    Point2GridKernel(int s, int num_points, FilterType f): size(s), filter(f){
+      Random rand;
+      for (int k = 0; k < num_points; k++)
+        points.push_back(Vector3(size*rand(), size*rand(), 100*rand()));
+    }
+    double operator()(){
+      Point2Grid grid(size, size, buffer, weights, 0.0, 0.0, 1.0, 1.0, 1.5, 0.0,
+                      filter, 0.0);
+      grid.Clear(-32768);
+      for (size_t k = 0; k < points.size(); k++)
+        grid.AddPoint(points[k][0], points[k][1], points[k][2]);
+      grid.normalize();
+      return points.size();
+    }
+  };
+
+  struct MedianKernel {
+    ImageView<uint8> image;
+    int kernel_size;
+    MedianKernel(int size, int k): image(size, size), kernel_size(k){
+      Random rand;
+      for (int row = 0; row < size; row++)
+        for (int col = 0; col < size; col++)
+          image(col, row) = uint8(255*rand());
+    }
+    double operator()(){
+      ImageView<uint8> result = fast_median_filter(image, kernel_size);
+      return double(result.cols())*result.rows();
+    }
+  };
+
+  // The census of two tiles, and the cost of matching each left pixel
+  // at each disparity in a range
+  struct CensusKernel {
+    ImageView<float> left, right;
+    Vector2i kernel;
+    int num_disp;
+    CensusKernel(int size, int k, int d): kernel(k, k), num_disp(d){
+      left  = random_texture(size, size);
+      right = random_texture(size + d, size);
+    }
+    double operator()(){
+      CensusImage l(left, kernel), r(right, kernel);
+      long long sum = 0;
+      for (int row = 0; row < l.rows(); row++)
+        for (int col = 0; col < l.cols(); col++)
+          for (int d = 0; d < num_disp; d++)
+            sum += l.cost(col, row, r, col + d, row);
+      if (sum < 0)
+        vw_throw( LogicErr() << "Negative census cost.\n" );
+      return double(l.cols())*l.rows()*num_disp;
+    }
+  };
+
+  // Parse lines as pc_align and point2dem do for CSV inputs
+  struct CsvKernel {
+    CsvConv conv;
+    std::vector<std::string> lines;
+    CsvKernel(int num_lines, std::string const& format){
+      conv.parse_csv_format(format, "");
+      Random rand;
+      for (int k = 0; k < num_lines; k++){
+        std::ostringstream os;
+        os.precision(12);
+        os << 360*rand() - 180 << ", " << 180*rand() - 90 << ", " << 1000*rand();
+        lines.push_back(os.str());
+      }
+    }
+    double operator()(){
+      bool is_first_line = true, success = false;
+      int num_good = 0;
+      for (size_t k = 0; k < lines.size(); k++){
+        conv.parse_csv_line(is_first_line, success, lines[k]);
+        num_good += success;
+      }
+      if (num_good != int(lines.size()))
+        vw_throw( LogicErr() << "Failed to parse the benchmark CSV lines.\n" );
+      return lines.size();
+    }
+  };
+
+  // Nearest neighbors of source points in a reference cloud, the main
+  // cost of each ICP iteration
+  struct NearestNeighborKernel {
+    math::FLANNTree<float> tree;
+    std::vector<Vector<float> > queries;
+    NearestNeighborKernel(int num_ref, int num_queries){
+      Random rand;
+      Matrix<float> ref(num_ref, 3);
+      for (int k = 0; k < num_ref; k++)
+        for (int c = 0; c < 3; c++)
+          ref(k, c) = 100*rand();
+      tree.load_match_data(ref, math::FLANN_DistType_L2);
+      for (int k = 0; k < num_queries; k++){
+        Vector<float> q(3);
+        for (int c = 0; c < 3; c++)
+          q[c] = 100*rand();
+        queries.push_back(q);
+      }
+    }
+    double operator()(){
+      Vector<int>    indices(1);
+      Vector<double> dists(1);
+      for (size_t k = 0; k < queries.size(); k++)
+        tree.knn_search(queries[k], indices, dists, 1);
+      return queries.size();
+    }
+  };
+
+}
+
+int main(int argc, char* argv[]){
+
+  try {
+    double min_seconds = 0.5;
+    if (argc > 1) min_seconds = boost::lexical_cast<double>(argv[1]);
+
+    std::ofstream ofs;
+    if (argc > 2){
+      ofs.open(argv[2]);
+      if (!ofs.is_open())
+        vw_throw( IOErr() << "Unable to open for writing: " << argv[2] << "\n" );
+    }
+    std::ostream & os = (argc > 2) ? ofs : std::cout;
+
+    std::vector<BenchmarkResult> results;
+
+    FftNccKernel ncc(56, 256);
+    results.push_back(run_benchmark("fft_ncc", "template 56, search 256", ncc, min_seconds));
+
+    RendererKernel renderer(1024);
+    results.push_back(run_benchmark("software_renderer", "1024x1024, 4 pixel mesh",
+                                    renderer, min_seconds));
+
+    Point2GridKernel weighted(512, 500000, f_weighted_average);
+    results.push_back(run_benchmark("point2grid_add_point", "weighted_average, 512x512",
+                                    weighted, min_seconds));
+    Point2GridKernel median(512, 500000, f_median);
+    results.push_back(run_benchmark("point2grid_add_point", "median, 512x512",
+                                    median, min_seconds));
+
+    MedianKernel median5(1024, 5), median15(1024, 15);
+    results.push_back(run_benchmark("fast_median_filter", "1024x1024, kernel 5",
+                                    median5, min_seconds));
+    results.push_back(run_benchmark("fast_median_filter", "1024x1024, kernel 15",
+                                    median15, min_seconds));
+
+    CensusKernel census(256, 7, 64);
+    results.push_back(run_benchmark("census_cost", "256x256, kernel 7, 64 disparities",
+                                    census, min_seconds));
+
+    CsvKernel csv(100000, "1:lon 2:lat 3:height_above_datum");
+    results.push_back(run_benchmark("csv_parse_line", "lon lat height", csv, min_seconds));
+
+    NearestNeighborKernel nn(200000, 100000);
+    results.push_back(run_benchmark("nearest_neighbor_3d", "200000 reference points",
+                                    nn, min_seconds));
+
+    write_benchmark_json(os, "BenchCoreKernels", results);
+
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BackgroundWriter.h>
+#include <vw/Core/Thread.h>
+#include <boost/bind.hpp>
+
+#include <vector>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Records the order of the jobs, and can hold them until released
+  struct JobLog {
+    Mutex            mutex;
+    Condition        cond;
+    bool             released;
+    int              started;
+    std::vector<int> done;
+    JobLog(): released(true), started(0) {}
+
+    void job(int id) {
+      Mutex::Lock lock(mutex);
+      started++;
+      cond.notify_all();
+      while (!released)
+        cond.wait(lock);
+      done.push_back(id);
+    }
+    void wait_started(int num) {
+      Mutex::Lock lock(mutex);
+      while (started < num)
+        cond.wait(lock);
+    }
+    void release() {
+      Mutex::Lock lock(mutex);
+      released = true;
+      cond.notify_all();
+    }
+  };
+
+  void failing_job() {
+    vw_throw(IOErr() << "Disk full.");
+  }
+
+}
+
+TEST(BackgroundWriter, InOrder) {
+  JobLog log;
+  BackgroundWriter writer(true);
+  for (int i = 0; i < 10; i++)
+    writer.add(boost::bind(&JobLog::job, &log, i));
+  writer.wait();
+  ASSERT_EQ(10u, log.done.size());
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(i, log.done[i]);
+}
+
+TEST(BackgroundWriter, SkipWhenBehind) {
+  JobLog log;
+  log.released = false;
+  BackgroundWriter writer(true, 1);
+  EXPECT_TRUE(writer.try_add(boost::bind(&JobLog::job, &log, 0)));
+  log.wait_started(1);
+
+  // The first job is running, the second one waits to start, and the
+  // third one is skipped.
+  EXPECT_TRUE (writer.try_add(boost::bind(&JobLog::job, &log, 1)));
+  EXPECT_FALSE(writer.try_add(boost::bind(&JobLog::job, &log, 2)));
+  log.release();
+  writer.wait();
+  ASSERT_EQ(2u, log.done.size());
+  EXPECT_EQ(0, log.done[0]);
+  EXPECT_EQ(1, log.done[1]);
+}
+
+TEST(BackgroundWriter, Errors) {
+  JobLog log;
+  BackgroundWriter writer(true);
+  writer.add(&failing_job);
+  EXPECT_THROW(writer.wait(), IOErr);
+
+  // The error is reported once
+  writer.add(boost::bind(&JobLog::job, &log, 1));
+  writer.wait();
+  EXPECT_EQ(1u, log.done.size());
+
+  BackgroundWriter sync(false);
+  EXPECT_THROW(sync.add(&failing_job), IOErr);
+  sync.add(boost::bind(&JobLog::job, &log, 2));
+  EXPECT_EQ(2u, log.done.size());
+}
@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BundleAdjustUtils.h>
+#include <vw/BundleAdjustment/ControlNetwork.h>
+
+using namespace vw;
+using namespace vw::ba;
+using namespace asp;
+
+TEST( BundleAdjustUtils, CameraObservations ) {
+
+  // Three points seen by three cameras, not all by each
+  ControlNetwork cnet("test");
+  ControlPoint cp0, cp1, cp2;
+  cp0.add_measure(ControlMeasure(1, 2, 1, 1, 0));
+  cp0.add_measure(ControlMeasure(3, 4, 1, 1, 2));
+  cp1.add_measure(ControlMeasure(5, 6, 2, 2, 1));
+  cp1.add_measure(ControlMeasure(7, 8, 1, 1, 2));
+  cp2.add_measure(ControlMeasure(9, 10, 1, 1, 0));
+  cnet.add_control_point(cp0);
+  cnet.add_control_point(cp1);
+  cnet.add_control_point(cp2);
+
+  CameraObservations obs;
+  obs.read_controlnetwork(cnet, 3);
+  ASSERT_EQ(3, obs.num_cameras());
+
+  // Camera 0 sees points 0 and 2, in that order
+  ASSERT_EQ(2u, obs.end(0) - obs.begin(0));
+  EXPECT_EQ(0, obs.point_id(obs.begin(0)));
+  EXPECT_EQ(2, obs.point_id(obs.begin(0) + 1));
+  EXPECT_VECTOR_NEAR(Vector2(9, 10), obs.location(obs.begin(0) + 1), 1e-12);
+
+  // Camera 1 sees point 1
+  ASSERT_EQ(1u, obs.end(1) - obs.begin(1));
+  EXPECT_EQ(1, obs.point_id(obs.begin(1)));
+  EXPECT_VECTOR_NEAR(Vector2(2, 2), obs.scale(obs.begin(1)), 1e-12);
+
+  // Camera 2 sees points 0 and 1
+  ASSERT_EQ(2u, obs.end(2) - obs.begin(2));
+  EXPECT_EQ(0, obs.point_id(obs.begin(2)));
+  EXPECT_EQ(1, obs.point_id(obs.begin(2) + 1));
+  EXPECT_VECTOR_NEAR(Vector2(7, 8), obs.location(obs.begin(2) + 1), 1e-12);
+}
@@ -0,0 +1,74 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CensusTransform.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( CensusTransform, Popcount ) {
+  EXPECT_EQ(0,  popcount64(0));
+  EXPECT_EQ(1,  popcount64(uint64(1) << 63));
+  EXPECT_EQ(64, popcount64(~uint64(0)));
+  EXPECT_EQ(32, popcount64(0x5555555555555555ULL));
+}
+
+TEST( CensusTransform, Bits ) {
+  // A 3x3 image, with the center 4 and the others 0 to 8 but 4
+  ImageView<float> image(3, 3);
+  for (int row = 0; row < 3; row++)
+    for (int col = 0; col < 3; col++)
+      image(col, row) = 3*row + col;
+
+  CensusImage census(image, Vector2i(3, 3));
+  EXPECT_EQ(1, census.words_per_pixel());
+  // The neighbors in row order, the darker ones first: 0, 1, 2, 3
+  EXPECT_EQ(uint64(0x0f), census.pixel(1, 1)[0]);
+  // The corner has only 3 neighbors in the image, all brighter
+  EXPECT_EQ(uint64(0), census.pixel(0, 0)[0]);
+
+  // Differences of 1 are ignored by the ternary census with threshold
+  // 1, which leaves 0, 1, 2 darker, and 6, 7, 8 brighter, with the
+  // darker bit of each neighbor first
+  CensusImage ternary(image, Vector2i(3, 3), true, 1.0);
+  uint64 darker   = (uint64(1) << 0)  | (uint64(1) << 2)  | (uint64(1) << 4);
+  uint64 brighter = (uint64(1) << 11) | (uint64(1) << 13) | (uint64(1) << 15);
+  EXPECT_EQ(darker | brighter, ternary.pixel(1, 1)[0]);
+
+  // A 9x9 kernel takes 80 bits, or 160 if ternary
+  EXPECT_EQ(2, CensusImage(image, Vector2i(9, 9)).words_per_pixel());
+  EXPECT_EQ(3, CensusImage(image, Vector2i(9, 9), true, 0.0).words_per_pixel());
+}
+
+TEST( CensusTransform, Cost ) {
+  // The same texture shifted by 2 columns, and then brightened, which
+  // leaves the census as it is
+  ImageView<float> left(20, 10), right(22, 10);
+  for (int row = 0; row < 10; row++)
+    for (int col = 0; col < 20; col++)
+      left(col, row) = (7*col + 13*row) % 17;
+  for (int row = 0; row < 10; row++)
+    for (int col = 0; col < 20; col++)
+      right(col + 2, row) = 2*left(col, row) + 5;
+
+  CensusImage l(left, Vector2i(5, 5)), r(right, Vector2i(5, 5));
+  EXPECT_EQ(0, l.cost(8, 5, r, 10, 5));
+  EXPECT_GT(l.cost(8, 5, r, 11, 5), 0);
+  EXPECT_EQ(l.cost(8, 5, r, 11, 5), r.cost(11, 5, l, 8, 5));
+}
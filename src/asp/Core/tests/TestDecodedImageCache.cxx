@@ -0,0 +1,126 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/DecodedImageCache.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gdal_priv.h>
+#include <cpl_string.h>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+
+  ImageView<uint16> test_image() {
+    ImageView<uint16> image(300, 270);
+    for (int row = 0; row < image.rows(); row++)
+      for (int col = 0; col < image.cols(); col++)
+        image(col, row) = (7*col + 13*row) % 2048;
+    return image;
+  }
+
+  void write_test_image(std::string const& file, ImageView<uint16> const& image) {
+    cartography::GdalWriteOptions opt;
+    cartography::block_write_gdal_image(file, image, false, cartography::GeoReference(),
+                                        false, 0, opt);
+  }
+
+  // Losslessly, in JPEG2000 tiles of the given size. Return false if
+  // GDAL cannot write JPEG2000.
+  bool write_jp2_image(std::string const& tif_file, std::string const& jp2_file,
+                       int tile_size) {
+    GDALAllRegister();
+    GDALDriver * driver = GetGDALDriverManager()->GetDriverByName("JP2OpenJPEG");
+    if (driver == NULL)
+      return false;
+    GDALDataset * src = static_cast<GDALDataset*>(GDALOpen(tif_file.c_str(), GA_ReadOnly));
+    if (src == NULL)
+      return false;
+    std::string size = boost::lexical_cast<std::string>(tile_size);
+    char ** options = NULL;
+    options = CSLSetNameValue(options, "REVERSIBLE", "YES");
+    options = CSLSetNameValue(options, "QUALITY",    "100");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", size.c_str());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", size.c_str());
+    GDALDataset * dst = driver->CreateCopy(jp2_file.c_str(), src, FALSE, options, NULL, NULL);
+    CSLDestroy(options);
+    GDALClose(src);
+    if (dst == NULL)
+      return false;
+    GDALClose(dst);
+    return true;
+  }
+
+  void expect_decoded(std::string const& jp2_file, std::string const& cache_dir,
+                      ImageView<uint16> const& image) {
+    std::string decoded = decoded_image_path(jp2_file, cache_dir, 4);
+    EXPECT_EQ(decoded_image_cache_file(jp2_file, cache_dir), decoded);
+    ASSERT_TRUE(fs::exists(decoded));
+    EXPECT_FALSE(is_jpeg2000_image(decoded));
+
+    DiskImageView<uint16> out(decoded);
+    ASSERT_EQ(image.cols(), out.cols());
+    ASSERT_EQ(image.rows(), out.rows());
+    ImageView<uint16> pixels = out;
+    for (int row = 0; row < image.rows(); row++)
+      for (int col = 0; col < image.cols(); col++)
+        ASSERT_EQ(image(col, row), pixels(col, row));
+
+    // Found in the cache the second time
+    EXPECT_EQ(decoded, decoded_image_path(jp2_file, cache_dir, 4));
+  }
+}
+
+TEST(DecodedImageCache, OtherImagesAreNotDecoded) {
+  UnlinkName file("decoded_cache_plain.tif");
+  write_test_image(file, test_image());
+  EXPECT_FALSE(is_jpeg2000_image(file));
+  EXPECT_EQ(std::string(file), decoded_image_path(file, "decoded_cache_dir", 4));
+  EXPECT_FALSE(fs::exists("decoded_cache_dir"));
+}
+
+TEST(DecodedImageCache, CacheFileName) {
+  UnlinkName file("decoded_cache_name.tif");
+  write_test_image(file, test_image());
+  std::string name = decoded_image_cache_file(file, "some_dir");
+  EXPECT_EQ(name, decoded_image_cache_file(file, "some_dir"));
+  EXPECT_EQ("some_dir", fs::path(name).parent_path().string());
+  EXPECT_EQ(0u, fs::path(name).filename().string().find("decoded_cache_name-"));
+}
+
+TEST(DecodedImageCache, DecodeJpeg2000) {
+  ImageView<uint16> image = test_image();
+  UnlinkName tif_file("decoded_cache_src.tif");
+  write_test_image(tif_file, image);
+
+  // Many tiles, decoded in parallel, and one tile, decoded in order
+  UnlinkName tiled_file("decoded_cache_tiled.jp2"), single_file("decoded_cache_single.jp2");
+  if (!write_jp2_image(tif_file, tiled_file, 64) ||
+      !write_jp2_image(tif_file, single_file, 512))
+    return; // No JPEG2000 support in this GDAL
+  EXPECT_TRUE(is_jpeg2000_image(tiled_file));
+
+  std::string cache_dir = "decoded_cache_test_dir";
+  expect_decoded(tiled_file,  cache_dir, image);
+  expect_decoded(single_file, cache_dir, image);
+  fs::remove_all(cache_dir);
+}
@@ -0,0 +1,73 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/DisparityConsistency.h>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  void check_collisions(ConsistencyCost cost) {
+
+    // The right image is the left one shifted by 3 columns. A block of
+    // pixels is given the wrong disparity 5. The part of it matched to
+    // right pixels which are also matches of correct pixels, at a lower
+    // cost, fails the check. The rest of it has no competing matches.
+    int cols = 40, rows = 30;
+    ImageView<float> left(cols, rows), right(cols + 10, rows);
+    srand(1);
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        left(col, row) = rand() % 100;
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        right(col + 3, row) = left(col, row);
+
+    ImageView<PixelMask<Vector2f> > disp(cols, rows);
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        disp(col, row) = PixelMask<Vector2f>(Vector2f(3, 0));
+    for (int row = 10; row < 15; row++)
+      for (int col = 10; col < 15; col++)
+        disp(col, row) = PixelMask<Vector2f>(Vector2f(5, 0));
+
+    int num_invalidated = single_pass_consistency_check(left, Vector2i(0, 0), right, Vector2i(0, 0),
+                                                        Vector2i(5, 5), 1.0, disp, cost);
+    EXPECT_EQ(10, num_invalidated);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        bool expected = !(row >= 10 && row < 15 && col >= 13 && col < 15);
+        EXPECT_EQ(expected, is_valid(disp(col, row))) << col << ' ' << row << ' ' << cost;
+      }
+    }
+  }
+
+}
+
+TEST( DisparityConsistency, Collisions ) {
+  check_collisions(MEAN_ABSOLUTE_DIFFERENCE);
+}
+
+TEST( DisparityConsistency, CensusCollisions ) {
+  check_collisions(CENSUS_COST);
+  check_collisions(TERNARY_CENSUS_COST);
+}
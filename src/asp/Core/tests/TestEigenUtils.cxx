@@ -0,0 +1,122 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/EigenUtils.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( EigenUtils, ReservoirMerge ) {
+
+  // Points added to one reservoir, or to several which are then
+  // merged, in any order, give the same sample.
+  const int N = 1000, M = 50;
+  PointReservoir all(M), part1(M), part2(M), merged(M);
+  for (int i = 0; i < N; i++) {
+    Vector3 xyz(i, 2*i, 3*i);
+    all.add(sampling_key(i), i, xyz, i);
+    if (i % 3 == 0)
+      part1.add(sampling_key(i), i, xyz, i);
+  }
+  for (int i = N - 1; i >= 0; i--) {
+    if (i % 3 != 0)
+      part2.add(sampling_key(i), i, Vector3(i, 2*i, 3*i), i);
+  }
+  merged.merge(part2);
+  merged.merge(part1);
+  EXPECT_EQ( M, all.size() );
+  EXPECT_EQ( M, merged.size() );
+
+  DoubleMatrix data1, data2;
+  Vector3 shift1, shift2;
+  double lon1 = 0, lon2 = 0;
+  all.to_matrix(true, shift1, data1, lon1);
+  merged.to_matrix(true, shift2, data2, lon2);
+  ASSERT_EQ( M, data1.cols() );
+  ASSERT_EQ( M, data2.cols() );
+  EXPECT_VECTOR_NEAR( shift1, shift2, 0.0 );
+  EXPECT_NEAR( lon1, lon2, 1e-10 );
+  for (int col = 0; col < M; col++) {
+    for (int row = 0; row <= DIM; row++)
+      EXPECT_EQ( data1(row, col), data2(row, col) );
+  }
+
+  // In the order of the source, shifted by the first point
+  EXPECT_EQ( 0, data1(0, 0) );
+  for (int col = 1; col < M; col++) {
+    EXPECT_LT( data1(0, col - 1), data1(0, col) );
+    EXPECT_EQ( 2*data1(0, col), data1(1, col) );
+    EXPECT_EQ( 1, data1(DIM, col) );
+  }
+}
+
+TEST( EigenUtils, StratifiedSampling ) {
+
+  // On a 64 x 64 grid, the 16 points with the smallest keys are one
+  // in each 16 x 16 block.
+  SamplingGrid grid(BBox2(0, 0, 64, 64), 1.0, true);
+  PointReservoir reservoir(16);
+  for (int j = 0; j < 64; j++) {
+    for (int i = 0; i < 64; i++) {
+      int index = 64*j + i;
+      reservoir.add(grid.key(index, Vector2(i, j)), index, Vector3(i, j, 0));
+    }
+  }
+
+  DoubleMatrix data;
+  Vector3 shift;
+  double mean_longitude = 0;
+  reservoir.to_matrix(false, shift, data, mean_longitude);
+  ASSERT_EQ( 16, data.cols() );
+  int count[4][4] = {{0}};
+  for (int col = 0; col < data.cols(); col++)
+    count[int(data(1, col))/16][int(data(0, col))/16]++;
+  for (int a = 0; a < 4; a++) {
+    for (int b = 0; b < 4; b++)
+      EXPECT_EQ( 1, count[a][b] );
+  }
+}
+
+TEST( EigenUtils, RandomSubsample ) {
+
+  DoubleMatrix points(DIM + 1, 500);
+  for (int col = 0; col < points.cols(); col++) {
+    for (int row = 0; row < DIM; row++)
+      points(row, col) = col;
+    points(DIM, col) = 1;
+  }
+
+  DoubleMatrix errors(1, points.cols());
+  for (int col = 0; col < points.cols(); col++)
+    errors(0, col) = 0.5*col;
+
+  random_pc_subsample(1000, points, &errors);
+  EXPECT_EQ( 500, points.cols() );
+  EXPECT_EQ( 500, errors.cols() );
+
+  // Distinct points, in their original order, with their errors
+  random_pc_subsample(100, points, &errors);
+  ASSERT_EQ( 100, points.cols() );
+  ASSERT_EQ( 100, errors.cols() );
+  for (int col = 1; col < points.cols(); col++) {
+    EXPECT_LT( points(0, col - 1), points(0, col) );
+    EXPECT_EQ( points(0, col), points(2, col) );
+    EXPECT_EQ( 0.5*points(0, col), errors(0, col) );
+  }
+}
@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/FftCorrelation.h>
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+TEST( FftCorrelation, RoundTrip ) {
+
+  ImageView<std::complex<float> > data(16, 8), orig(16, 8);
+  std::complex<float> sum;
+  for (int row = 0; row < data.rows(); row++) {
+    for (int col = 0; col < data.cols(); col++) {
+      orig(col, row) = data(col, row) = std::complex<float>(col*row % 7, col - row);
+      sum += data(col, row);
+    }
+  }
+
+  // The first coefficient is the sum, and the inverse is not scaled
+  fft_2d(data, false);
+  EXPECT_NEAR(sum.real(), data(0, 0).real(), 1e-3);
+  EXPECT_NEAR(sum.imag(), data(0, 0).imag(), 1e-3);
+  fft_2d(data, true);
+  for (int row = 0; row < data.rows(); row++) {
+    for (int col = 0; col < data.cols(); col++) {
+      EXPECT_NEAR(data(col, row).real()/128, orig(col, row).real(), 1e-4);
+      EXPECT_NEAR(data(col, row).imag()/128, orig(col, row).imag(), 1e-4);
+    }
+  }
+}
+
+TEST( FftCorrelation, MatchesDirect ) {
+
+  // The template is an affine function of a part of the search image,
+  // so the correlation there is 1.
+  srand(3);
+  ImageView<float> search(37, 29), tmpl(9, 7);
+  for (int row = 0; row < search.rows(); row++)
+    for (int col = 0; col < search.cols(); col++)
+      search(col, row) = rand() % 100;
+  for (int row = 0; row < tmpl.rows(); row++)
+    for (int col = 0; col < tmpl.cols(); col++)
+      tmpl(col, row) = 2*search(col + 11, row + 5) + 3;
+
+  ImageView<float> ncc;
+  ASSERT_TRUE(normalized_cross_correlation(tmpl, search, ncc));
+  ASSERT_EQ(29, ncc.cols());
+  ASSERT_EQ(23, ncc.rows());
+
+  int n = tmpl.cols()*tmpl.rows();
+  for (int v = 0; v < ncc.rows(); v++) {
+    for (int u = 0; u < ncc.cols(); u++) {
+      double mt = 0, ms = 0;
+      for (int row = 0; row < tmpl.rows(); row++) {
+        for (int col = 0; col < tmpl.cols(); col++) {
+          mt += tmpl(col, row);
+          ms += search(col + u, row + v);
+        }
+      }
+      mt /= n;
+      ms /= n;
+      double num = 0, vt = 0, vs = 0;
+      for (int row = 0; row < tmpl.rows(); row++) {
+        for (int col = 0; col < tmpl.cols(); col++) {
+          double a = tmpl(col, row) - mt, b = search(col + u, row + v) - ms;
+          num += a*b;
+          vt  += a*a;
+          vs  += b*b;
+        }
+      }
+      EXPECT_NEAR(num/sqrt(vt*vs), ncc(u, v), 1e-4);
+    }
+  }
+  EXPECT_NEAR(1.0, ncc(11, 5), 1e-5);
+
+  // A flat template has no correlation
+  ImageView<float> flat(5, 5);
+  EXPECT_FALSE(normalized_cross_correlation(flat, search, ncc));
+}
@@ -0,0 +1,64 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/GaussianFilter.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST( GaussianFilter, Impulse ) {
+
+  // The blurred impulse must be close to the Gaussian kernel
+  double sigma = 10.0;
+  int cols = 201, rows = 151, c0 = 100, r0 = 60;
+  ImageView<double> image(cols, rows);
+  fill(image, 0);
+  image(c0, r0) = 1.0;
+  recursive_gaussian_blur(image, sigma);
+
+  double peak = 1.0/(2*M_PI*sigma*sigma), sum = 0;
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      double d2 = (col - c0)*(col - c0) + (row - r0)*(row - r0);
+      double expected = peak*exp(-d2/(2*sigma*sigma));
+      EXPECT_NEAR(image(col, row), expected, 0.05*peak);
+      sum += image(col, row);
+    }
+  }
+
+  // Nothing is lost, as the image is much bigger than the kernel
+  EXPECT_NEAR(sum, 1.0, 1e-3);
+}
+
+TEST( GaussianFilter, Threads ) {
+
+  int cols = 97, rows = 83;
+  ImageView<double> image1(cols, rows);
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      image1(col, row) = (col*7 + row*13) % 17;
+
+  ImageView<double> image2 = copy(image1);
+  recursive_gaussian_blur(image1, 4.0, 1);
+  recursive_gaussian_blur(image2, 4.0, 4);
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      EXPECT_EQ(image1(col, row), image2(col, row));
+}
@@ -0,0 +1,93 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/HoleFill.h>
+#include <vw/Image/BlockRasterize.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  double plane(int col, int row) { return 2.0*col + 3.0*row + 1.0; }
+}
+
+TEST( HoleFill, PyramidAcrossTiles ) {
+
+  // A plane with a hole which crosses tiles, one too big to fill,
+  // and one open to the image border.
+  int cols = 64, rows = 64, max_len = 12;
+  ImageView<PixelMask<float> > image(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      image(col, row) = PixelMask<float>(plane(col, row));
+      bool in_hole = (col >= 10 && col < 20 && row >= 12 && row < 20) ||
+        (col >= 30 && col < 45 && row >= 30 && row < 50) ||
+        (col >= 50 && row < 3);
+      if (in_hole)
+        image(col, row).invalidate();
+    }
+  }
+
+  for (int method = 0; method < 2; method++) {
+    HoleFillMethod fill_method = HoleFillMethod(method);
+    ImageView<PixelMask<float> > whole = fill_holes_pyramid(image, max_len, fill_method);
+    ImageView<PixelMask<float> > tiled
+      = block_rasterize(fill_holes_pyramid(image, max_len, fill_method), Vector2i(16, 16), 1);
+
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        bool expected = (col < 30 || col >= 45 || row < 30 || row >= 50) &&
+          !(col >= 50 && row < 3);
+        EXPECT_EQ(expected, is_valid(whole(col, row))) << col << ' ' << row;
+        EXPECT_EQ(is_valid(whole(col, row)), is_valid(tiled(col, row)));
+        if (!expected)
+          continue;
+        // The tiling does not change the result
+        EXPECT_NEAR(whole(col, row).child(), tiled(col, row).child(), 1e-4);
+        // The harmonic fill reproduces the plane
+        if (fill_method == LAPLACE_HOLE_FILL)
+          EXPECT_NEAR(plane(col, row), whole(col, row).child(), 1e-3);
+      }
+    }
+  }
+}
+
+TEST( HoleFill, Enclosed ) {
+
+  // Only the hole not touching the border is filled, whatever its size
+  int cols = 100, rows = 300;
+  ImageView<PixelMask<uint8> > mask(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      mask(col, row) = PixelMask<uint8>(255);
+      if ((col >= 5 && col < 95 && row >= 5 && row < 290) || col >= 98)
+        mask(col, row).invalidate();
+    }
+  }
+  mask(50, 100) = PixelMask<uint8>(255); // an island in the hole
+
+  int band_height = 64, num_threads = 3;
+  ImageView<PixelMask<uint8> > filled
+    = fill_enclosed_holes(mask, PixelMask<uint8>(255), band_height, num_threads);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      EXPECT_EQ(col < 98, is_valid(filled(col, row))) << col << ' ' << row;
+      if (col < 98)
+        EXPECT_EQ(255, filled(col, row).child());
+    }
+  }
+}
@@ -0,0 +1,109 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/IntegerImage.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <boost/filesystem.hpp>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+TEST(IntegerImage, Quantize) {
+  QuantizePixelFunctor<uint8> q8;
+  EXPECT_EQ(1,   int(q8(PixelMask<float>(0.0))));
+  EXPECT_EQ(255, int(q8(PixelMask<float>(1.0))));
+  EXPECT_EQ(128, int(q8(PixelMask<float>(0.5))));
+  EXPECT_EQ(255, int(q8(PixelMask<float>(3.0))));  // Clamped
+  EXPECT_EQ(1,   int(q8(PixelMask<float>(-1.0))));
+
+  PixelMask<float> invalid(0.5);
+  invalid.invalidate();
+  EXPECT_EQ(0, int(q8(invalid)));
+
+  QuantizePixelFunctor<uint16> q16;
+  EXPECT_EQ(65535, int(q16(PixelMask<float>(1.0))));
+  EXPECT_EQ(0,     int(q16(invalid)));
+}
+
+TEST(IntegerImage, WriteAndRead) {
+  ImageView< PixelMask<float> > image(20, 10);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = PixelMask<float>((col + 20*row)/199.0);
+  image(3, 4).invalidate();
+
+  cartography::GeoReference georef;
+  cartography::GdalWriteOptions opt;
+  const int bits[] = {0, 8, 16};
+  for (int b = 0; b < 3; b++) {
+    std::string file = "TestIntegerImage.tif";
+    write_preprocessed_image(file, image, bits[b], false, georef, opt,
+                             ProgressCallback::dummy_instance());
+    EXPECT_EQ(preprocessed_channel_type(bits[b]), image_format(file).channel_type);
+
+    boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(file));
+    ASSERT_TRUE(rsrc->has_nodata_read());
+    double nodata = rsrc->nodata_read();
+    EXPECT_EQ(bits[b] == 0 ? double(PREPROCESSED_FLOAT_NODATA) : 0.0, nodata);
+
+    // Read as before, as floats
+    ImageView< PixelGray<float> > back = DiskImageView< PixelGray<float> >(file);
+    double tol = bits[b] == 8 ? 2.0/255 : 1e-4;
+    for (int row = 0; row < image.rows(); row++) {
+      for (int col = 0; col < image.cols(); col++) {
+        if (!is_valid(image(col, row))) {
+          EXPECT_EQ(nodata, back(col, row).v());
+          continue;
+        }
+        EXPECT_GT(back(col, row).v(), nodata);
+        EXPECT_NEAR(image(col, row).child(), back(col, row).v(), tol);
+      }
+    }
+    fs::remove(file);
+  }
+
+  EXPECT_THROW(preprocessed_channel_type(12), ArgumentErr);
+}
+
+TEST(IntegerImage, CompareDisparities) {
+  ImageView< PixelMask<Vector2f> > a(30, 20), b(30, 20);
+  for (int row = 0; row < a.rows(); row++) {
+    for (int col = 0; col < a.cols(); col++) {
+      a(col, row) = PixelMask<Vector2f>(Vector2f(col, row));
+      b(col, row) = a(col, row);
+    }
+  }
+  b(1, 1) = PixelMask<Vector2f>(Vector2f(4, 5));   // Off by 5
+  b(2, 2) = PixelMask<Vector2f>(Vector2f(2, 2.5)); // Off by 0.5
+  a(5, 5).invalidate();
+  b(6, 6).invalidate();
+  b(7, 7).invalidate();
+
+  DisparityDifference diff = compare_disparities(a, b, 1.0);
+  EXPECT_EQ(30u*20u - 3u, diff.num_both);
+  EXPECT_EQ(2u, diff.num_first_only);
+  EXPECT_EQ(1u, diff.num_second_only);
+  EXPECT_EQ(1u, diff.num_above);
+  EXPECT_NEAR(5.0, diff.max_diff, 1e-6);
+  EXPECT_NEAR(5.5/(30*20 - 3), diff.mean_diff(), 1e-9);
+
+  EXPECT_THROW(compare_disparities(a, crop(b, 0, 0, 10, 10), 1.0), ArgumentErr);
+}
@@ -69,3 +69,109 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+namespace {
+
+  // Descriptors of the second image made from those of the first one
+  // with a little noise, in reverse order, so that each IP of the first
+  // image has a clear closest match.
+  void make_descriptor_sets( bool binary, std::vector<ip::InterestPoint>& ip1,
+                             std::vector<ip::InterestPoint>& ip2 ) {
+    int num = 300, len = binary ? 32 : 64;
+    unsigned int state = 12345;
+    ip1.resize(num);
+    ip2.resize(num);
+    for (int i = 0; i < num; i++) {
+      ip1[i].x = i; ip1[i].y = 2*i;
+      ip1[i].descriptor.set_size(len);
+      ip2[num - 1 - i] = ip1[i];
+      for (int e = 0; e < len; e++) {
+        state = 1103515245u*state + 12345u;
+        int noise = (state >> 16) % 256;
+        if (binary) {
+          ip1[i].descriptor[e] = noise;
+          // Flip one bit in every fourth byte
+          ip2[num - 1 - i].descriptor[e] = (e % 4 == 0) ? (noise ^ 1) : noise;
+        } else {
+          ip1[i].descriptor[e] = noise/256.0;
+          ip2[num - 1 - i].descriptor[e] = noise/256.0 + 0.001*((e % 3) - 1.0);
+        }
+      }
+    }
+  }
+
+}
+
+TEST( InterestPointMatching, MatchDescriptors ) {
+
+  for (int binary = 0; binary < 2; binary++) {
+    std::vector<ip::InterestPoint> ip1, ip2;
+    make_descriptor_sets(binary, ip1, ip2);
+    int num = ip1.size();
+
+    std::vector<ip::InterestPoint> exact1, exact2, approx1, approx2;
+    match_ip_descriptors(ip1, ip2, binary, 0.8, "brute-force", exact1, exact2);
+    match_ip_descriptors(ip1, ip2, binary, 0.8, "flann",       approx1, approx2);
+
+    // The exact search finds the planted matches
+    ASSERT_EQ( num, int(exact1.size()) );
+    for (size_t k = 0; k < exact1.size(); k++) {
+      EXPECT_EQ( exact1[k].x, exact2[k].x );
+      EXPECT_EQ( exact1[k].y, exact2[k].y );
+    }
+
+    // The approximate one finds nearly all of them, and no wrong ones
+    EXPECT_GT( approx1.size(), 0.95*num );
+    for (size_t k = 0; k < approx1.size(); k++)
+      EXPECT_EQ( approx1[k].x, approx2[k].x );
+  }
+
+  // Two identical candidates are not unique
+  std::vector<ip::InterestPoint> ip1(1), ip2(2), m1, m2;
+  ip1[0].descriptor = Vector<float>(4);
+  ip2[0].descriptor = ip2[1].descriptor = Vector<float>(4);
+  match_ip_descriptors(ip1, ip2, false, 0.8, "brute-force", m1, m2);
+  EXPECT_EQ( 0u, m1.size() );
+
+  EXPECT_THROW( match_ip_descriptors(ip1, ip2, false, 0.8, "hnsw", m1, m2), ArgumentErr );
+}
+
+TEST( InterestPointMatching, IpSet ) {
+
+  std::vector<ip::InterestPoint> ip(10);
+  for (size_t i = 0; i < ip.size(); i++) {
+    ip[i].x = i + 0.5; ip[i].y = 2*i;
+    ip[i].ix = i;      ip[i].iy = 2*i;
+    ip[i].scale = 1.0 + i;
+    ip[i].descriptor.set_size(3);
+    for (int e = 0; e < 3; e++)
+      ip[i].descriptor[e] = 10*i + e;
+  }
+
+  IpSet set(ip);
+  ASSERT_EQ( 10u, set.size() );
+  ASSERT_EQ( 3u,  set.descriptor_length() );
+  EXPECT_EQ( 42.0, set.descriptors()(4, 2) );
+
+  // Keep the points at the given indices, in place
+  std::vector<size_t> kept;
+  kept.push_back(1); kept.push_back(4); kept.push_back(9);
+  set.select(kept);
+  ASSERT_EQ( 3u, set.size() );
+  for (size_t k = 0; k < kept.size(); k++) {
+    ip::InterestPoint p = set.point(k);
+    EXPECT_EQ( ip[kept[k]].x,     p.x );
+    EXPECT_EQ( ip[kept[k]].iy,    p.iy );
+    EXPECT_EQ( ip[kept[k]].scale, p.scale );
+    EXPECT_VECTOR_NEAR( ip[kept[k]].descriptor, p.descriptor, 0.0 );
+  }
+
+  // The removal of points outside a box
+  EXPECT_EQ( 1u, remove_ip_bbox(BBox2i(0, 0, 5, 10), set, true) );
+  ASSERT_EQ( 2u, set.size() );
+  EXPECT_EQ( 4, set.ix(1) );
+
+  // The descriptors must all have the same length
+  ip[3].descriptor.set_size(2);
+  EXPECT_THROW( IpSet bad(ip), ArgumentErr );
+}
@@ -0,0 +1,74 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/InverseGrid.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A quadratic transform, whose bilinear interpolation error in a cell
+  // is largest at the midpoint. Left of column 40 it is invalid.
+  struct QuadraticTrans {
+    mutable int num_calls;
+    QuadraticTrans(): num_calls(0) {}
+    Vector2 reverse(Vector2 const& p) const {
+      num_calls++;
+      if (p.x() < 40)
+        return Vector2(-1, -1);
+      return Vector2(1.3*p.x() + 0.001*p.x()*p.x() + 0.0005*p.y()*p.y(),
+                     0.8*p.y() + 0.0002*p.x()*p.y());
+    }
+  };
+
+}
+
+TEST( InverseGrid, Tolerance ) {
+
+  BBox2i box(10, 20, 250, 200);
+  Vector2 invalid(-1, -1);
+  ImageView<Vector2> coords;
+  ImageView<uint8>   exact;
+
+  for (double tol = 0; tol < 0.6; tol += 0.25) {
+    QuadraticTrans trans;
+    inverse_grid(trans, box, 16, tol, invalid, coords, exact);
+    ASSERT_EQ(box.width(),  coords.cols());
+    ASSERT_EQ(box.height(), coords.rows());
+    int num_calls = trans.num_calls;
+    if (tol == 0)
+      EXPECT_EQ(box.width()*box.height(), num_calls);
+    else
+      EXPECT_LT(num_calls, box.width()*box.height()/4);
+
+    for (int row = 0; row < box.height(); row++) {
+      for (int col = 0; col < box.width(); col++) {
+        Vector2 expected = trans.reverse(Vector2(box.min().x() + col, box.min().y() + row));
+        if (expected == invalid) {
+          EXPECT_TRUE(exact(col, row));
+          EXPECT_EQ(invalid, coords(col, row));
+        } else {
+          EXPECT_LE(norm_2(expected - coords(col, row)), tol + 1e-8) << col << ' ' << row;
+        }
+      }
+    }
+  }
+}
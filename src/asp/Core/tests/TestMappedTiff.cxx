@@ -0,0 +1,89 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MappedTiff.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/Image/PixelMask.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Write an image with tiles cut at the right and bottom edges
+  void write_test_image(std::string const& file, ImageView<PixelMask<Vector2f> > const& image,
+                        std::string const& compress) {
+    cartography::GdalWriteOptions opt;
+    opt.gdal_options["COMPRESS"] = compress;
+    opt.raster_tile_size = Vector2i(16, 16);
+    cartography::block_write_gdal_image(file, image, false, cartography::GeoReference(),
+                                        false, 0, opt);
+  }
+
+  ImageView<PixelMask<Vector2f> > test_disparity() {
+    ImageView<PixelMask<Vector2f> > disp(50, 37);
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < disp.cols(); col++) {
+        disp(col, row) = PixelMask<Vector2f>(Vector2f(col + 0.5, -row));
+        if ((col + row) % 7 == 0)
+          disp(col, row).invalidate();
+      }
+    }
+    return disp;
+  }
+}
+
+TEST(MappedTiff, ReadInPlace) {
+  UnlinkName file("mapped_tiff.tif");
+  ImageView<PixelMask<Vector2f> > disp = test_disparity();
+  write_test_image(file, disp, "NONE");
+
+  boost::shared_ptr<MappedTiffFile> tiff = MappedTiffFile::open(file);
+  ASSERT_TRUE(tiff.get() != NULL);
+  EXPECT_EQ(50, tiff->cols());
+  EXPECT_EQ(37, tiff->rows());
+  EXPECT_TRUE (has_pixel_layout<PixelMask<Vector2f> >(*tiff));
+  EXPECT_FALSE(has_pixel_layout<PixelMask<Vector2i> >(*tiff));
+  EXPECT_FALSE(has_pixel_layout<PixelGray<float>    >(*tiff));
+
+  ImageView<PixelMask<Vector2f> > mapped = open_intermediate<PixelMask<Vector2f> >(file);
+  ASSERT_EQ(disp.cols(), mapped.cols());
+  ASSERT_EQ(disp.rows(), mapped.rows());
+  for (int row = 0; row < disp.rows(); row++) {
+    for (int col = 0; col < disp.cols(); col++) {
+      EXPECT_EQ(is_valid(disp(col, row)), is_valid(mapped(col, row)));
+      EXPECT_VECTOR_EQ(disp(col, row).child(), mapped(col, row).child());
+    }
+  }
+}
+
+TEST(MappedTiff, CompressedIsNotMapped) {
+  UnlinkName file("mapped_tiff_lzw.tif");
+  ImageView<PixelMask<Vector2f> > disp = test_disparity();
+  write_test_image(file, disp, "LZW");
+
+  EXPECT_TRUE(MappedTiffFile::open(file).get() == NULL);
+
+  // Still read, with GDAL
+  ImageView<PixelMask<Vector2f> > read = open_intermediate<PixelMask<Vector2f> >(file);
+  EXPECT_VECTOR_EQ(disp(3, 4).child(), read(3, 4).child());
+}
@@ -0,0 +1,101 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MatchFile.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  void make_matches(int num, int descriptor_length,
+                    std::vector<ip::InterestPoint> & ip1,
+                    std::vector<ip::InterestPoint> & ip2) {
+    ip1.clear();
+    ip2.clear();
+    for (int k = 0; k < num; k++) {
+      ip1.push_back(ip::InterestPoint(k + 0.25, 2*k + 0.5));
+      ip2.push_back(ip::InterestPoint(k + 10.75, 3*k));
+      ip1.back().descriptor.set_size(descriptor_length);
+      ip2.back().descriptor.set_size(descriptor_length);
+      for (int d = 0; d < descriptor_length; d++) {
+        ip1.back().descriptor[d] = k + 0.01*d;
+        ip2.back().descriptor[d] = -k - 0.01*d;
+      }
+    }
+  }
+}
+
+TEST(MatchFile, CompactRoundTrip) {
+  UnlinkName file("compact.match");
+  std::vector<ip::InterestPoint> ip1, ip2, out1, out2;
+  make_matches(100, 8, ip1, ip2);
+  write_compact_match_file(file, ip1, ip2, true);
+
+  boost::shared_ptr<MappedMatchFile> mapped = MappedMatchFile::open(file);
+  ASSERT_TRUE(mapped.get() != NULL);
+  EXPECT_EQ(100u, mapped->num_matches());
+  EXPECT_EQ(8,    mapped->descriptor_length());
+
+  // Random access to a match
+  EXPECT_VECTOR_NEAR(Vector2(ip1[37].x, ip1[37].y), mapped->left(37),  0.0);
+  EXPECT_VECTOR_NEAR(Vector2(ip2[37].x, ip2[37].y), mapped->right(37), 0.0);
+  EXPECT_EQ(ip2[37].descriptor[5], mapped->right_descriptor(37)[5]);
+
+  // A range of matches
+  mapped->read(90, 200, out1, out2);
+  ASSERT_EQ(10u, out1.size());
+  EXPECT_EQ(ip1[95].x, out1[5].x);
+  EXPECT_EQ(ip2[95].y, out2[5].y);
+  EXPECT_EQ(ip1[95].descriptor[7], out1[5].descriptor[7]);
+
+  // All of them, without the descriptors
+  read_match_file(file, out1, out2, false);
+  ASSERT_EQ(100u, out1.size());
+  ASSERT_EQ(100u, out2.size());
+  for (size_t k = 0; k < out1.size(); k++) {
+    EXPECT_EQ(ip1[k].x, out1[k].x);
+    EXPECT_EQ(ip2[k].y, out2[k].y);
+    EXPECT_EQ(0u, out1[k].descriptor.size());
+  }
+}
+
+TEST(MatchFile, ReadsUsualFormat) {
+  UnlinkName file("usual.match");
+  std::vector<ip::InterestPoint> ip1, ip2, out1, out2;
+  make_matches(20, 4, ip1, ip2);
+  ip::write_binary_match_file(file, ip1, ip2);
+
+  EXPECT_TRUE(MappedMatchFile::open(file).get() == NULL);
+  read_match_file(file, out1, out2);
+  ASSERT_EQ(20u, out1.size());
+  EXPECT_EQ(ip1[13].x, out1[13].x);
+  EXPECT_EQ(ip2[13].descriptor[3], out2[13].descriptor[3]);
+}
+
+TEST(MatchFile, UnequalDescriptors) {
+  UnlinkName file("unequal.match");
+  std::vector<ip::InterestPoint> ip1, ip2;
+  make_matches(5, 4, ip1, ip2);
+  ip2[3].descriptor.set_size(2);
+  EXPECT_THROW(write_compact_match_file(file, ip1, ip2, true), ArgumentErr);
+
+  // Fine without the descriptors
+  write_compact_match_file(file, ip1, ip2);
+  EXPECT_EQ(0, MappedMatchFile::open(file)->descriptor_length());
+}
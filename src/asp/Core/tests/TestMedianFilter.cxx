@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MedianFilter.h>
+#include <vw/Image/PixelTypes.h>
+#include <algorithm>
+#include <vector>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // The median of the window, with the edge pixels repeated
+  template <class ImageT>
+  int brute_force_median(ImageT const& image, int col, int row, int radius) {
+    std::vector<int> vals;
+    for (int r = row - radius; r <= row + radius; r++) {
+      for (int c = col - radius; c <= col + radius; c++) {
+        int cc = std::min(std::max(c, 0), image.cols() - 1);
+        int rr = std::min(std::max(r, 0), image.rows() - 1);
+        vals.push_back(image(cc, rr));
+      }
+    }
+    std::nth_element(vals.begin(), vals.begin() + vals.size()/2, vals.end());
+    return vals[vals.size()/2];
+  }
+
+  template <class T>
+  ImageView<T> test_image(int cols, int rows, int num_vals) {
+    ImageView<T> image(cols, rows);
+    unsigned state = 12345;
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        state = state*1103515245u + 12345u;
+        image(col, row) = (state >> 8) % num_vals;
+      }
+    }
+    return image;
+  }
+
+  template <class T>
+  void check_median(int num_vals, int kernel_size) {
+    ImageView<T> image = test_image<T>(37, 29, num_vals);
+    int radius = kernel_size/2;
+
+    // The whole image, and a tile inside it, as when writing in blocks
+    ImageView<T> result = median_filter_view(image, kernel_size);
+    ImageView<T> tile   = crop(median_filter_view(image, kernel_size), BBox2i(5, 7, 16, 11));
+    for (int row = 0; row < image.rows(); row++) {
+      for (int col = 0; col < image.cols(); col++)
+        EXPECT_EQ(brute_force_median(image, col, row, radius), int(result(col, row)));
+    }
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++)
+        EXPECT_EQ(int(result(col + 5, row + 7)), int(tile(col, row)));
+    }
+  }
+}
+
+TEST( MedianFilter, Uint8 ) {
+  check_median<uint8>(256, 1);
+  check_median<uint8>(256, 3);
+  check_median<uint8>(5,   7); // many equal values
+}
+
+TEST( MedianFilter, Uint16 ) {
+  check_median<uint16>(65536, 5);
+  check_median<uint16>(3,     3);
+}
+
+TEST( MedianFilter, PixelGray ) {
+  ImageView<uint8> image = test_image<uint8>(20, 20, 256);
+  ImageView<PixelGray<uint8> > gray = pixel_cast<PixelGray<uint8> >(image);
+  ImageView<uint8>             result1 = median_filter_view(image, 5);
+  ImageView<PixelGray<uint8> > result2 = median_filter_view(gray,  5);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      EXPECT_EQ(result1(col, row), result2(col, row).v());
+}
+
+TEST( MedianFilter, BadSize ) {
+  ImageView<uint8> image(10, 10);
+  EXPECT_THROW(median_filter_view(image, 4), ArgumentErr);
+  EXPECT_THROW(median_filter_view(image, 2*MAX_MEDIAN_FILTER_RADIUS + 3), ArgumentErr);
+}
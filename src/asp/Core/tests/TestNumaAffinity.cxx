@@ -0,0 +1,46 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/NumaAffinity.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST(NumaAffinity, ParseCpuList) {
+  std::vector<int> cpus = parse_cpu_list("0-3,8,10-11\n");
+  int expected[] = {0, 1, 2, 3, 8, 10, 11};
+  ASSERT_EQ(7u, cpus.size());
+  for (size_t k = 0; k < cpus.size(); k++)
+    EXPECT_EQ(expected[k], cpus[k]);
+
+  EXPECT_TRUE(parse_cpu_list("").empty()); // a node with no CPUs
+  EXPECT_EQ(1u, parse_cpu_list("5").size());
+
+  EXPECT_THROW(parse_cpu_list("3-1"),   ArgumentErr);
+  EXPECT_THROW(parse_cpu_list("1-2-3"), ArgumentErr);
+  EXPECT_THROW(parse_cpu_list("a,b"),   ArgumentErr);
+}
+
+TEST(NumaAffinity, Mode) {
+  EXPECT_THROW(set_numa_affinity("everywhere"), ArgumentErr);
+  // With no pinning, binding does nothing
+  set_numa_affinity("none");
+  numa_bind_current_thread();
+}
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/ObjectStorage.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace asp;
+namespace fs = boost::filesystem;
+
+TEST(ObjectStorage, RemoteNames) {
+  EXPECT_TRUE(is_remote_object("s3://bucket/dir/image.tif"));
+  EXPECT_TRUE(is_remote_object("https://host/image.ntf"));
+  EXPECT_TRUE(is_remote_object("http://host/image.ntf"));
+  EXPECT_TRUE(is_remote_object("/vsis3/bucket/image.tif"));
+  EXPECT_TRUE(is_remote_object("/vsicurl/https://host/image.tif"));
+  EXPECT_FALSE(is_remote_object("image.tif"));
+  EXPECT_FALSE(is_remote_object("/data/s3://image.tif"));
+}
+
+TEST(ObjectStorage, VsiPaths) {
+  EXPECT_EQ("/vsis3/bucket/dir/image.tif", remote_object_vsi_path("s3://bucket/dir/image.tif"));
+  EXPECT_EQ("/vsicurl/https://host/image.ntf", remote_object_vsi_path("https://host/image.ntf"));
+  EXPECT_EQ("/vsis3/bucket/image.tif", remote_object_vsi_path("/vsis3/bucket/image.tif"));
+  EXPECT_EQ("dir/image.tif", remote_object_vsi_path("dir/image.tif"));
+}
+
+TEST(ObjectStorage, LocalFilesPassThrough) {
+  std::string file = "TestObjectStorage_local.txt";
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "data\n";
+  }
+  EXPECT_TRUE(object_exists(file));
+  EXPECT_FALSE(object_exists("TestObjectStorage_missing.txt"));
+  EXPECT_EQ(file, object_read_path(file, "TestObjectStorage_cache", 4));
+  EXPECT_EQ(file, object_write_path(file, "TestObjectStorage_cache"));
+  EXPECT_NO_THROW(upload_object(file, file));
+  EXPECT_TRUE(fs::exists(file));
+  EXPECT_FALSE(fs::exists("TestObjectStorage_cache"));
+  fs::remove(file);
+}
+
+TEST(ObjectStorage, WritePathKeepsExtension) {
+  std::string cache_dir = "TestObjectStorage_out";
+  std::string local = object_write_path("s3://bucket/dir/ortho.tif", cache_dir);
+  EXPECT_EQ(fs::path(cache_dir).string(), fs::path(local).parent_path().string());
+  EXPECT_EQ(".tif", fs::path(local).extension().string());
+  EXPECT_EQ(0u, fs::path(local).filename().string().find("ortho-out"));
+  fs::remove_all(cache_dir);
+}
@@ -0,0 +1,92 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+
+TEST( OrthoRasterizer, BBoxPairTree ) {
+
+  // A grid of point cloud blocks, with an empty one in the middle
+  std::vector<BBoxPair> boundaries;
+  for (int row = 0; row < 30; row++) {
+    for (int col = 0; col < 40; col++) {
+      BBox3 box(Vector3(col, row, 0), Vector3(col + 1.5, row + 1.5, 10));
+      if (row == 15 && col == 20)
+        box = BBox3();
+      boundaries.push_back(std::make_pair(box, BBox2i(16*col, 16*row, 16, 16)));
+    }
+  }
+
+  BBoxPairTree tree;
+  tree.build(boundaries);
+  EXPECT_EQ(boundaries.size() - 1, tree.size());
+
+  // The tree must find the same boxes as checking all of them
+  std::vector<BBox3> queries;
+  queries.push_back(BBox3(Vector3(3.2, 4.7, 0), Vector3(9.1, 6.0, 10)));
+  queries.push_back(BBox3(Vector3(19.0, 14.0, 0), Vector3(22.0, 17.0, 10)));
+  queries.push_back(BBox3(Vector3(-5, -5, 0), Vector3(100, 100, 10)));
+  queries.push_back(BBox3(Vector3(50, 50, 0), Vector3(60, 60, 10)));
+  for (size_t q = 0; q < queries.size(); q++) {
+    std::vector<size_t> expected, found;
+    for (size_t i = 0; i < boundaries.size(); i++) {
+      if (queries[q].intersects(boundaries[i].first))
+        expected.push_back(i);
+    }
+    tree.intersecting(queries[q], found);
+    EXPECT_EQ(expected.size(), found.size());
+    EXPECT_TRUE(expected == found);
+  }
+
+  // An empty tree finds nothing
+  BBoxPairTree empty_tree;
+  empty_tree.build(std::vector<BBoxPair>());
+  std::vector<size_t> found;
+  empty_tree.intersecting(queries[2], found);
+  EXPECT_TRUE(found.empty());
+}
+
+TEST( OrthoRasterizer, QuantileSketch ) {
+
+  // Errors spanning several orders of magnitude, added in two halves,
+  // as two threads would.
+  std::vector<double> vals;
+  QuantileSketch sketch1, sketch2, empty;
+  for (int i = 0; i < 20000; i++) {
+    double val = 1.0e-3*exp(0.001*((i*7919) % 20000));
+    vals.push_back(val);
+    if (i % 2 == 0) sketch1.add(val);
+    else            sketch2.add(val);
+  }
+  sketch1.add(0.0); // null errors are not counted
+  sketch1.merge(sketch2);
+  sketch1.merge(empty);
+  EXPECT_EQ(vals.size(), sketch1.count());
+
+  // The quantiles are within the accuracy of the exact ones
+  std::sort(vals.begin(), vals.end());
+  double pcts[] = {0.0, 0.25, 0.5, 0.75, 0.99, 1.0};
+  for (int p = 0; p < 6; p++) {
+    int k = std::min(int(vals.size()) - 1, int(pcts[p]*vals.size()));
+    EXPECT_NEAR(vals[k], sketch1.quantile(pcts[p]), 0.005*vals[k]);
+  }
+}
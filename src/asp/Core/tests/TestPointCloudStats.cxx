@@ -0,0 +1,112 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/PointCloudStats.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/BlockRasterize.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+
+  ImageView<Vector4> test_cloud() {
+    ImageView<Vector4> cloud(10, 6);
+    for (int row = 0; row < cloud.rows(); row++) {
+      for (int col = 0; col < cloud.cols(); col++) {
+        if (col >= 5 && row >= 3)
+          continue; // An empty corner, of no-data points
+        cloud(col, row) = Vector4(1000 + col, -500 + 2*row, 100 + col*row, 0.1*(col + row));
+      }
+    }
+    return cloud;
+  }
+}
+
+TEST(PointCloudStats, Accumulate) {
+  ImageView<Vector4> cloud = test_cloud();
+
+  boost::shared_ptr<PointCloudStatsAccumulator> accum(new PointCloudStatsAccumulator);
+  PointCloudStatsView< ImageView<Vector4> > view = point_cloud_stats_view(cloud, accum);
+  ImageView<Vector4> copy = block_rasterize(view, Vector2i(5, 3), 2);
+  // A tile done again is not counted twice
+  ImageView<Vector4> again = crop(view, BBox2i(0, 0, 5, 3));
+  EXPECT_EQ(cloud(3, 2), copy(3, 2));
+
+  PointCloudStats stats = accum->result();
+  EXPECT_EQ(45u, stats.num_points);
+  EXPECT_VECTOR_NEAR(Vector3(1000, -500, 100), stats.bbox.min(), 1e-10);
+  EXPECT_VECTOR_NEAR(Vector3(1009, -490, 100 + 4*5), stats.bbox.max(), 1e-10);
+  EXPECT_NEAR(0.0, stats.min_error, 1e-10);
+  EXPECT_NEAR(1.1, stats.max_error, 1e-10);
+  EXPECT_NEAR(std::atan2(-496.0, 1000.0 + 165.0/45.0)*180/M_PI, stats.mean_lon(), 0.05);
+
+  // The empty tile is not listed
+  ASSERT_EQ(3u, stats.tiles.size());
+  EXPECT_EQ(BBox2i(0, 0, 5, 3), stats.tiles[0].first);
+  EXPECT_EQ(BBox2i(5, 0, 5, 3), stats.tiles[1].first);
+  EXPECT_EQ(BBox2i(0, 3, 5, 3), stats.tiles[2].first);
+}
+
+TEST(PointCloudStats, SavedWithCloud) {
+  std::string cloud_file = "TestPointCloudStats-PC.tif";
+  {
+    std::ofstream ofs(cloud_file.c_str());
+    ofs << "not really a cloud";
+  }
+
+  PointCloudStats stats;
+  stats.add(Vector3(1, 2, 3), 0.5);
+  stats.add(Vector3(-4, 5, 6), 0.25);
+  stats.tiles.push_back(std::make_pair(BBox2i(0, 0, 256, 256),
+                                       BBox3(Vector3(-4, 2, 3), Vector3(1, 5, 6))));
+  write_point_cloud_stats(cloud_file, stats);
+  EXPECT_EQ("TestPointCloudStats-PC-stats.txt", point_cloud_stats_file(cloud_file));
+
+  PointCloudStats found;
+  ASSERT_TRUE(read_point_cloud_stats(cloud_file, found));
+  EXPECT_EQ(2u, found.num_points);
+  EXPECT_VECTOR_NEAR(stats.bbox.min(), found.bbox.min(), 1e-10);
+  EXPECT_VECTOR_NEAR(stats.bbox.max(), found.bbox.max(), 1e-10);
+  EXPECT_VECTOR_NEAR(Vector3(-1.5, 3.5, 4.5), found.mean_point(), 1e-10);
+  EXPECT_NEAR(stats.mean_lon(), found.mean_lon(), 1e-10);
+  EXPECT_NEAR(0.25, found.min_error, 1e-10);
+  EXPECT_NEAR(0.5,  found.max_error, 1e-10);
+  ASSERT_EQ(1u, found.tiles.size());
+  EXPECT_EQ(BBox2i(0, 0, 256, 256), found.tiles[0].first);
+
+  // Several clouds together, without the tiles
+  std::vector<std::string> files(2, cloud_file);
+  ASSERT_TRUE(read_point_cloud_stats(files, found));
+  EXPECT_EQ(4u, found.num_points);
+  EXPECT_EQ(0u, found.tiles.size());
+
+  // Not for a changed cloud
+  {
+    std::ofstream ofs(cloud_file.c_str(), std::ios::app);
+    ofs << ", now longer";
+  }
+  EXPECT_FALSE(read_point_cloud_stats(cloud_file, found));
+  EXPECT_FALSE(read_point_cloud_stats(files, found));
+
+  fs::remove(cloud_file);
+  fs::remove(point_cloud_stats_file(cloud_file));
+}
@@ -0,0 +1,76 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/PointCloudStore.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A smooth patch of ECEF points with an error channel, and some no-data
+  ImageView<Vector4> test_cloud(int cols, int rows) {
+    ImageView<Vector4> cloud(cols, rows);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if ((col*7 + row*3) % 11 == 0)
+          continue; // no-data
+        cloud(col, row) = Vector4(-2.4e6 + 0.5*col, -4.6e6 + 0.3*row + 1e-4*col*col,
+                                  3.5e6 + 0.01*col*row, 0.1 + 0.001*col);
+      }
+    }
+    return cloud;
+  }
+}
+
+TEST(PointCloudStore, RoundTrip) {
+  double resolution = 1e-3;
+  ImageView<Vector4> cloud = test_cloud(70, 45);
+  boost::shared_ptr<CompressedPointCloud> store
+    = compress_point_cloud<4>(ImageViewRef<Vector4>(cloud), resolution, 32);
+  EXPECT_EQ(4, store->num_channels());
+
+  // Much smaller than the doubles
+  EXPECT_LT(store->size(), cloud.cols()*cloud.rows()*sizeof(Vector4)/4);
+
+  // All the channels, across tiles and pixel by pixel
+  ImageView<Vector4> all = CompressedPointCloudView<4>(store);
+  CompressedPointCloudView<3> xyz(store);
+  for (int row = 0; row < cloud.rows(); row++) {
+    for (int col = 0; col < cloud.cols(); col++) {
+      EXPECT_VECTOR_NEAR(cloud(col, row), all(col, row), resolution/2 + 1e-9);
+      EXPECT_VECTOR_NEAR(subvector(cloud(col, row), 0, 3), xyz(col, row),
+                         resolution/2 + 1e-9);
+      if (cloud(col, row) == Vector4())
+        EXPECT_EQ(Vector4(), all(col, row));
+    }
+  }
+
+  // A crop not aligned to the tiles
+  BBox2i box(20, 10, 40, 30);
+  ImageView<Vector3> part = crop(xyz, box);
+  EXPECT_VECTOR_NEAR(subvector(cloud(55, 38), 0, 3), part(35, 28), resolution);
+}
+
+TEST(PointCloudStore, Invalid) {
+  EXPECT_THROW(set_point_cloud_store_resolution(-1), ArgumentErr);
+  EXPECT_THROW(CompressedPointCloud(10, 10, 2, 1e-3, 8), ArgumentErr);
+}
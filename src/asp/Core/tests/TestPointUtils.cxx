@@ -18,6 +18,9 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <fstream>
+#include <cstdio>
 
 using namespace vw;
 using namespace asp;
@@ -128,3 +131,158 @@ TEST( PointUtils, CsvConv ) {
   
   
 }
+
+TEST( PointUtils, ReadCsvFile ) {
+
+  CsvConv conv;
+  conv.parse_csv_format("1:x 2:y 3:z", "");
+
+  // A header, a comment, and more lines than fit on one thread
+  std::string file = "TestReadCsvFile.csv";
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "x, y, z\n";
+    ofs << "# comment\n";
+    for (int i = 0; i < 1000; i++)
+      ofs << i << ", " << 2*i << "\t" << 0.5*i << "\n";
+  }
+
+  std::list<CsvConv::CsvRecord> records;
+  EXPECT_EQ(1000u, conv.read_csv_file(file, records));
+  int count = 0;
+  for (std::list<CsvConv::CsvRecord>::const_iterator it = records.begin();
+       it != records.end(); it++){
+    EXPECT_EQ(count,     it->point_data[0]);
+    EXPECT_EQ(2*count,   it->point_data[1]);
+    EXPECT_EQ(0.5*count, it->point_data[2]);
+    count++;
+  }
+  std::remove(file.c_str());
+}
+
+TEST( PointUtils, PointCache ) {
+
+  CsvConv conv;
+  conv.parse_csv_format("1:x 2:y 3:z", "");
+  vw::cartography::GeoReference geo;
+  geo.set_well_known_geogcs("WGS84");
+
+  std::string file = "TestPointCache.csv";
+  {
+    std::ofstream ofs(file.c_str());
+    for (int i = 0; i < 100; i++)
+      ofs << 6378137.0 + i << ", " << i << ", " << -i << "\n";
+  }
+  std::remove(point_cache_file(file).c_str());
+
+  EXPECT_FALSE(point_cache_is_valid(file, conv, geo));
+  write_point_cache(file, conv, geo);
+  EXPECT_TRUE(point_cache_is_valid(file, conv, geo));
+
+  // A different format invalidates the cache
+  CsvConv conv2;
+  conv2.parse_csv_format("2:x 1:y 3:z", "");
+  EXPECT_FALSE(point_cache_is_valid(file, conv2, geo));
+
+  PointCacheReader reader(point_cache_file(file));
+  EXPECT_EQ(100u, reader.header().num_points);
+  std::vector<double> x, y, z, lon, lat;
+  ASSERT_TRUE(reader.read_chunk(x, y, z, lon, lat));
+  ASSERT_EQ(100u, x.size());
+  ASSERT_EQ(100u, lon.size());
+  for (int i = 0; i < 100; i++){
+    EXPECT_EQ(6378137.0 + i, x[i]);
+    EXPECT_EQ(i,  y[i]);
+    EXPECT_EQ(-i, z[i]);
+    EXPECT_NEAR(0.0, lon[i], 1e-3);
+    EXPECT_NEAR(0.0, lat[i], 1e-3);
+  }
+  EXPECT_FALSE(reader.read_chunk(x, y, z, lon, lat));
+
+  // A chunk far from the given box is skipped
+  PointCacheReader reader2(point_cache_file(file));
+  ASSERT_TRUE(reader2.read_chunk(x, y, z, lon, lat, BBox2(100, 10, 20, 20)));
+  EXPECT_EQ(0u, x.size());
+  EXPECT_FALSE(reader2.read_chunk(x, y, z, lon, lat));
+
+  std::remove(point_cache_file(file).c_str());
+  std::remove(file.c_str());
+}
+
+TEST( PointUtils, FixedPointCloud ) {
+
+  // A smooth cloud on the Earth surface, with no-data pixels
+  Vector3 shift(6378137.0, 1000.0, -2000.0);
+  double scale = get_rounding_error(shift, 0.0);
+  ImageView<Vector4> cloud(40, 30);
+  for (int row = 0; row < cloud.rows(); row++){
+    for (int col = 0; col < cloud.cols(); col++){
+      if ((col + 2*row) % 9 == 0)
+        continue; // no-data
+      Vector3 xyz = shift + Vector3(0.01*col*row, 3.7*col, -2.1*row);
+      cloud(col, row) = Vector4(xyz[0], xyz[1], xyz[2], 0.25*col);
+    }
+  }
+
+  std::string file = "fixed_point_cloud.tif";
+  cartography::GdalWriteOptions opt;
+  opt.gdal_options["COMPRESS"] = "LZW";
+  opt.raster_tile_size = Vector2i(16, 16);
+  block_write_fixed_point_gdal_image(file, shift, 0.0, cloud, false,
+                                     cartography::GeoReference(), opt);
+
+  EXPECT_EQ(VW_CHANNEL_INT32, DiskImageResourceGDAL(file).channel_type());
+
+  // The values are recovered to within the rounding error
+  ImageView<Vector4> read_cloud = read_asp_point_cloud<4>(file);
+  ASSERT_EQ(cloud.cols(), read_cloud.cols());
+  ASSERT_EQ(cloud.rows(), read_cloud.rows());
+  for (int row = 0; row < cloud.rows(); row++){
+    for (int col = 0; col < cloud.cols(); col++){
+      for (int i = 0; i < 4; i++)
+        EXPECT_NEAR(cloud(col, row)[i], read_cloud(col, row)[i], scale/2.0);
+    }
+  }
+  EXPECT_EQ(Vector4(), read_cloud(0, 0));
+
+  std::remove(file.c_str());
+}
+
+TEST( PointUtils, CartesianToProjected ) {
+
+  // Compare with the per-pixel conversion in point2dem before
+  vw::cartography::GeoReference geo;
+  geo.set_well_known_geogcs("WGS84");
+  vw::cartography::GeoReference utm = geo;
+  utm.set_UTM(10, true);
+
+  ImageView<Vector3> points(4, 2);
+  points(0, 0) = geo.datum().geodetic_to_cartesian(Vector3(-122.1, 37.3, 1234.5));
+  points(1, 0) = geo.datum().geodetic_to_cartesian(Vector3(-121.5, 38.0, -50));
+  points(2, 0) = Vector3(); // No data
+  points(3, 0) = geo.datum().geodetic_to_cartesian(Vector3(-123.0, 36.5, 8000));
+  points(0, 1) = geo.datum().geodetic_to_cartesian(Vector3(-122.0, 89.9, 0));
+  points(1, 1) = geo.datum().geodetic_to_cartesian(Vector3(-122.0, -20.0, 10));
+  points(2, 1) = geo.datum().geodetic_to_cartesian(Vector3(170.0, 0.0, 100));
+  points(3, 1) = Vector3(0, 0, 6356752.314245); // The pole
+
+  Vector3 offset(0.0, 0.0, 2.5);
+  for (int g = 0; g < 2; g++) {
+    vw::cartography::GeoReference const& georef = (g == 0) ? utm : geo;
+    ImageView<Vector3> result = CartesianToProjectedView(points, georef, -122, offset);
+    for (int row = 0; row < points.rows(); row++) {
+      for (int col = 0; col < points.cols(); col++) {
+        if (points(col, row) == Vector3()) {
+          EXPECT_TRUE(boost::math::isnan(result(col, row)[2]));
+          continue;
+        }
+        if (g == 0 && row == 1 && col != 1)
+          continue; // Far outside the UTM zone
+        Vector3 llh = georef.datum().cartesian_to_geodetic(points(col, row));
+        llh = CenterLongitudeFunc(-122)(llh) + offset;
+        Vector2 xy = georef.lonlat_to_point(subvector(llh, 0, 2));
+        EXPECT_VECTOR_NEAR(Vector3(xy[0], xy[1], llh[2]), result(col, row), 1e-4);
+      }
+    }
+  }
+}
@@ -0,0 +1,107 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/RemapTable.h>
+#include <boost/filesystem.hpp>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+
+  // A shift with a mild radial distortion about the image center
+  struct RadialTransform {
+    Vector2 reverse(Vector2 const& p) const {
+      Vector2 d = (p - Vector2(250, 150))/500.0;
+      double r2 = dot_prod(d, d);
+      return p + Vector2(3.5, -2.0) + 500.0*d*(0.01*r2);
+    }
+  };
+
+  // Fails on part of the image, as a camera might behind it
+  struct FailingTransform {
+    Vector2 reverse(Vector2 const& p) const {
+      if (p.x() > 100)
+        vw_throw(ArgumentErr() << "Outside.\n");
+      return p;
+    }
+  };
+
+}
+
+TEST(RemapTable, MatchesTransform) {
+  RadialTransform tx;
+  Vector2i size(500, 300);
+  Vector2 in_offset(10, 20);
+  double max_error = 0.01;
+
+  RemapTable table;
+  ASSERT_TRUE(make_remap_table(tx, size, in_offset, max_error, table));
+  EXPECT_GE(table.spacing(), REMAP_TABLE_MIN_SPACING);
+  EXPECT_LE(table.spacing(), REMAP_TABLE_MAX_SPACING);
+
+  // Within the error at the cell centers, give or take the
+  // interpolation over the rest of the cell and the float offsets.
+  for (int row = 0; row < size.y(); row += 7) {
+    for (int col = 0; col < size.x(); col += 7) {
+      Vector2 p(col + 0.5, row + 0.25);
+      EXPECT_VECTOR_NEAR(tx.reverse(p) - in_offset, table.reverse(p), 2*max_error);
+    }
+  }
+}
+
+TEST(RemapTable, Failure) {
+  RemapTable table;
+  EXPECT_FALSE(make_remap_table(FailingTransform(), Vector2i(300, 200), Vector2(),
+                                0.01, table));
+}
+
+TEST(RemapTable, LatticeError) {
+  // Linear offsets are interpolated exactly
+  ImageView<Vector2> lattice(5, 3);
+  for (int row = 0; row < lattice.rows(); row++)
+    for (int col = 0; col < lattice.cols(); col++)
+      lattice(col, row) = Vector2(0.5*col, 2.0*row - col);
+  EXPECT_NEAR(0.0, remap_lattice_error(lattice), 1e-12);
+
+  lattice(1, 1) += Vector2(0, 0.25);
+  EXPECT_NEAR(0.25, remap_lattice_error(lattice), 1e-12);
+
+  lattice(2, 2)[0] = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_LT(remap_lattice_error(lattice), 0.0);
+}
+
+TEST(RemapTable, WriteRead) {
+  RemapTable table;
+  ASSERT_TRUE(make_remap_table(RadialTransform(), Vector2i(200, 100), Vector2(),
+                               0.01, table));
+  std::string prefix = "TestRemapTable-L-remap";
+  table.write(prefix, "left.tsai 1234\n200 100");
+
+  RemapTable back;
+  EXPECT_FALSE(back.read(prefix, "left.tsai 1235\n200 100"));
+  ASSERT_TRUE(back.read(prefix, "left.tsai 1234\n200 100"));
+  EXPECT_EQ(table.spacing(), back.spacing());
+  EXPECT_VECTOR_NEAR(table.reverse(Vector2(77.5, 33.25)), back.reverse(Vector2(77.5, 33.25)),
+                     1e-6);
+
+  fs::remove(prefix + ".tif");
+  fs::remove(prefix + ".txt");
+}
@@ -0,0 +1,125 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/SharedDem.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/Image/PixelMask.h>
+#include <boost/filesystem.hpp>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+
+  const double NODATA = -32768;
+
+  // A plane with a nodata pixel, as Int16 or float
+  template <class PixelT>
+  void write_test_dem(std::string const& file, std::string const& compress) {
+    ImageView<PixelT> dem(40, 30);
+    for (int row = 0; row < dem.rows(); row++)
+      for (int col = 0; col < dem.cols(); col++)
+        dem(col, row) = PixelT(2*col + 3*row);
+    dem(20, 10) = PixelT(NODATA);
+
+    cartography::GeoReference georef;
+    georef.set_well_known_geogcs("WGS84");
+    Matrix3x3 transform = math::identity_matrix<3>();
+    transform(0, 0) = 0.01; transform(0, 2) = 10;
+    transform(1, 1) = -0.01; transform(1, 2) = 20;
+    georef.set_transform(transform);
+
+    cartography::GdalWriteOptions opt;
+    opt.gdal_options["COMPRESS"] = compress;
+    opt.raster_tile_size = Vector2i(16, 16);
+    cartography::block_write_gdal_image(file, dem, true, georef, true, NODATA, opt);
+  }
+
+  void check_plane(SharedDem const& dem, bool bicubic) {
+    std::vector<Vector2> pixels;
+    pixels.push_back(Vector2(0, 0));
+    pixels.push_back(Vector2(3.25, 4.5));
+    pixels.push_back(Vector2(39, 29));       // The last pixel
+    pixels.push_back(Vector2(20.5, 10.5));   // Next to nodata
+    pixels.push_back(Vector2(-0.5, 3));      // Outside
+    pixels.push_back(Vector2(10, 29.5));     // Outside
+    std::vector< PixelMask<float> > heights;
+    dem.interpolate(pixels, heights, bicubic);
+    ASSERT_EQ(pixels.size(), heights.size());
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(is_valid(heights[i]));
+      EXPECT_NEAR(2*pixels[i][0] + 3*pixels[i][1], heights[i].child(), 1e-4);
+    }
+    EXPECT_FALSE(is_valid(heights[3]));
+    EXPECT_FALSE(is_valid(heights[4]));
+    EXPECT_FALSE(is_valid(heights[5]));
+  }
+}
+
+TEST(SharedDem, FloatDemIsMapped) {
+  UnlinkName file("shared_dem_float.tif");
+  write_test_dem<float>(file, "NONE");
+
+  SharedDem dem(file, "", 1);
+  EXPECT_TRUE(dem.is_mapped());
+  EXPECT_EQ(40, dem.cols());
+  EXPECT_EQ(30, dem.rows());
+  EXPECT_TRUE(dem.has_nodata());
+  EXPECT_EQ(NODATA, dem.nodata());
+  EXPECT_FALSE(is_valid(dem.masked_dem()(20, 10)));
+  EXPECT_EQ(2*5 + 3*6, dem.masked_dem()(5, 6).child());
+  check_plane(dem, false);
+  check_plane(dem, true);
+
+  // Lon-lat positions go through the georeference
+  std::vector<Vector2> lonlats(1, dem.georef().pixel_to_lonlat(Vector2(3.25, 4.5)));
+  std::vector< PixelMask<float> > heights;
+  dem.interpolate_lonlat(lonlats, heights);
+  ASSERT_TRUE(is_valid(heights[0]));
+  EXPECT_NEAR(2*3.25 + 3*4.5, heights[0].child(), 1e-4);
+}
+
+TEST(SharedDem, CompressedDemIsRead) {
+  UnlinkName file("shared_dem_int16.tif");
+  write_test_dem<int16>(file, "LZW");
+
+  SharedDem dem(file, "", 1);
+  EXPECT_FALSE(dem.is_mapped());
+  check_plane(dem, false);
+  check_plane(dem, true);
+}
+
+TEST(SharedDem, CompressedDemIsConvertedAndMapped) {
+  UnlinkName file("shared_dem_int16_cached.tif");
+  std::string cache_dir = "shared_dem_cache";
+  write_test_dem<int16>(file, "LZW");
+
+  SharedDem dem(file, cache_dir, 2);
+  EXPECT_TRUE(dem.is_mapped());
+  EXPECT_NE(std::string(file), dem.file());
+  EXPECT_TRUE(fs::exists(dem.file()));
+  EXPECT_TRUE(dem.has_nodata());
+  check_plane(dem, false);
+  check_plane(dem, true);
+
+  // The next process uses the same copy
+  SharedDem dem2(file, cache_dir, 2);
+  EXPECT_EQ(dem.file(), dem2.file());
+  fs::remove_all(cache_dir);
+}
@@ -0,0 +1,63 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/SmallBlobs.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( SmallBlobs, AcrossBands ) {
+
+  // A tall image, so that it is split into several bands of rows.
+  // A thin vertical island crosses all of them. Single pixels and
+  // a small square are the small islands.
+  int cols = 70, rows = 1000;
+  ImageView<PixelMask<float> > image(cols, rows);
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      image(col, row).invalidate();
+
+  for (int row = 10; row < 990; row++)
+    image(5, row) = PixelMask<float>(1);
+  for (int row = 100; row < 900; row += 77)
+    image(40, row) = PixelMask<float>(2);
+  for (int col = 60; col < 63; col++)
+    for (int row = 132; row < 137; row++) // 15 pixels, split by the bands with 4 threads
+      image(col, row) = PixelMask<float>(3);
+
+  int max_area = 15, band_height = 64;
+  for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+    ImageView<PixelMask<float> > eroded
+      = erode_small_blobs(image, max_area, band_height, num_threads);
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        bool expected = (col == 5 && row >= 10 && row < 990);
+        EXPECT_EQ(expected, is_valid(eroded(col, row))) << col << ' ' << row;
+      }
+    }
+  }
+
+  // With a larger area the long island goes too
+  ImageView<PixelMask<float> > eroded = erode_small_blobs(image, 980, band_height, 2);
+  int num_valid = 0;
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      num_valid += is_valid(eroded(col, row));
+  EXPECT_EQ(0, num_valid);
+}
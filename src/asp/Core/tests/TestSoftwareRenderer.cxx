@@ -185,3 +185,52 @@ TEST_F( SoftwareRenderTest, ExtremelyLargeTriangle ) {
     }
   }
 }
+
+TEST_F( SoftwareRenderTest, IndexedMeshIsWatertight ) {
+  // A perturbed grid of quads, each split into two triangles the way
+  // OrthoRasterizer does it. Every pixel must be drawn exactly once.
+  const int n = 10;
+  std::vector<float> mesh_vertices, mesh_color;
+  std::vector<int> indices;
+  for ( int j = 0; j <= n; j++ ) {
+    for ( int i = 0; i <= n; i++ ) {
+      double dx = ( i > 0 && i < n ) ? 0.3*((i*7 + j*3) % 5 - 2)/5.0 : 0.0;
+      double dy = ( j > 0 && j < n ) ? 0.3*((i*3 + j*7) % 5 - 2)/5.0 : 0.0;
+      mesh_vertices += (i + dx)/n, (j + dy)/n;
+      mesh_color += 1.0;
+    }
+  }
+  for ( int j = 0; j < n; j++ ) {
+    for ( int i = 0; i < n; i++ ) {
+      int ul = j*(n+1) + i, ur = ul + 1, ll = ul + n + 1, lr = ll + 1;
+      indices += ul, ll, lr, lr, ur, ul;
+    }
+  }
+  renderer.SetVertexPointer( 2, &mesh_vertices[0] );
+  renderer.SetColorPointer( 1, &mesh_color[0] );
+
+  std::vector<int> count( 128*128, 0 );
+  for ( size_t t = 0; t < indices.size(); t += 3 ) {
+    renderer.Clear(0.0);
+    renderer.DrawTriangles( 3, &indices[t] );
+    for ( int i = 0; i < 128; i++ )
+      for ( int j = 0; j < 128; j++ )
+        count[j*128 + i] += ( render_buffer(i,j) > 0 );
+  }
+
+  // The last row and column sample the far edge of the mesh
+  for ( int i = 0; i < 127; i++ ) {
+    for ( int j = 0; j < 127; j++ ) {
+      EXPECT_EQ( 1, count[j*128 + i] ) << i << "," << j;
+    }
+  }
+
+  // Drawing the whole batch at once covers the same pixels
+  renderer.Clear(0.0);
+  renderer.DrawTriangles( indices.size(), &indices[0] );
+  for ( int i = 0; i < 127; i++ ) {
+    for ( int j = 0; j < 127; j++ ) {
+      EXPECT_EQ( 1.0, render_buffer(i,j) );
+    }
+  }
+}
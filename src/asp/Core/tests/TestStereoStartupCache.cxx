@@ -0,0 +1,133 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+#include <test/Helpers.h>
+#include <asp/Core/StereoStartupCache.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace asp;
+namespace fs = boost::filesystem;
+
+namespace {
+
+  void write_text(std::string const& file, std::string const& text) {
+    std::ofstream ofs(file.c_str());
+    ofs << text;
+  }
+
+  StereoStartupInfo test_info() {
+    StereoStartupInfo info;
+    info.session_type     = "pinhole";
+    info.alignment_method = "affineepipolar";
+    info.in_file1         = "TestStereoStartupCache_left.txt";
+    info.in_file2         = "TestStereoStartupCache_right.txt";
+    info.cam_file1        = "TestStereoStartupCache_left.tsai";
+    info.cam_file2        = "TestStereoStartupCache_right.tsai";
+    info.out_prefix_index = 4;
+    return info;
+  }
+
+  std::vector<std::string> test_args(std::string const& out_prefix) {
+    StereoStartupInfo info = test_info();
+    std::vector<std::string> args;
+    args.push_back(info.in_file1);
+    args.push_back(info.in_file2);
+    args.push_back(info.cam_file1);
+    args.push_back(info.cam_file2);
+    args.push_back(out_prefix);
+    return args;
+  }
+
+  void write_test_inputs() {
+    StereoStartupInfo info = test_info();
+    write_text(info.in_file1,  "left");
+    write_text(info.in_file2,  "right");
+    write_text(info.cam_file1, "left camera");
+    write_text(info.cam_file2, "right camera");
+  }
+
+  void remove_test_files(std::string const& startup_file) {
+    StereoStartupInfo info = test_info();
+    fs::remove(info.in_file1);
+    fs::remove(info.in_file2);
+    fs::remove(info.cam_file1);
+    fs::remove(info.cam_file2);
+    fs::remove(startup_file);
+  }
+}
+
+TEST(StereoStartupCache, RoundTrip) {
+  std::string startup_file = "TestStereoStartupCache_round_trip.bin";
+  write_test_inputs();
+  StereoStartupInfo info = test_info();
+  write_stereo_startup_file(startup_file, test_args("run/run"), "", "affineepipolar", info);
+
+  // A tile process has another output prefix
+  StereoStartupInfo found;
+  ASSERT_TRUE(read_stereo_startup_file(startup_file, test_args("run/run-tile-0"),
+                                       "", "affineepipolar", found));
+  EXPECT_EQ(info.session_type,     found.session_type);
+  EXPECT_EQ(info.alignment_method, found.alignment_method);
+  EXPECT_EQ(info.in_file1,         found.in_file1);
+  EXPECT_EQ(info.in_file2,         found.in_file2);
+  EXPECT_EQ(info.cam_file1,        found.cam_file1);
+  EXPECT_EQ(info.cam_file2,        found.cam_file2);
+  EXPECT_EQ(info.input_dem,        found.input_dem);
+  EXPECT_EQ(info.out_prefix_index, found.out_prefix_index);
+
+  remove_test_files(startup_file);
+}
+
+TEST(StereoStartupCache, OtherInputs) {
+  std::string startup_file = "TestStereoStartupCache_other_inputs.bin";
+  write_test_inputs();
+  StereoStartupInfo info = test_info();
+  write_stereo_startup_file(startup_file, test_args("run/run"), "", "affineepipolar", info);
+
+  StereoStartupInfo found;
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, test_args("run/run"),
+                                        "pinhole", "affineepipolar", found));
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, test_args("run/run"),
+                                        "", "homography", found));
+
+  // One more positional argument
+  std::vector<std::string> args = test_args("run/run");
+  args.push_back("dem.tif");
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, args, "", "affineepipolar", found));
+
+  // A changed input
+  write_text(info.cam_file2, "another right camera");
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, test_args("run/run"),
+                                        "", "affineepipolar", found));
+
+  remove_test_files(startup_file);
+}
+
+TEST(StereoStartupCache, MissingOrBadFile) {
+  std::string startup_file = "TestStereoStartupCache_missing.bin";
+  write_test_inputs();
+  StereoStartupInfo found;
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, test_args("run/run"),
+                                        "", "affineepipolar", found));
+  EXPECT_FALSE(read_stereo_startup_file("", test_args("run/run"),
+                                        "", "affineepipolar", found));
+
+  write_text(startup_file, "not a startup file");
+  EXPECT_FALSE(read_stereo_startup_file(startup_file, test_args("run/run"),
+                                        "", "affineepipolar", found));
+  remove_test_files(startup_file);
+}
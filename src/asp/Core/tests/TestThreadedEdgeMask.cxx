@@ -53,4 +53,15 @@ TEST( ThreadedEdgeMask, active_area ) {
 
   output = threaded_edge_mask(input,0);
   EXPECT_EQ( input, output );
+
+  // Small blocks, so that each band is searched over several strips
+  input.set_size(20,17);
+  fill(input,0);
+  fill(crop(input,7,5,9,8),255);
+  EXPECT_EQ( BBox2i(7,5,9,8),
+             threaded_edge_mask(input,0,0,3).active_area() );
+  EXPECT_EQ( BBox2i(8,6,7,6),
+             threaded_edge_mask(input,0,1,3).active_area() );
+  output = threaded_edge_mask(input,0,0,3);
+  EXPECT_EQ( input, output );
 }
@@ -0,0 +1,118 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TileCache.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Each pixel has its column plus 1000 times its row
+  struct RampBlock {
+    mutable int num_calls;
+    RampBlock(): num_calls(0) {}
+    ImageView<double> operator()(BBox2i const& block) const {
+      num_calls++;
+      ImageView<double> tile(block.width(), block.height());
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          tile(col, row) = (block.min().x() + col) + 1000.0*(block.min().y() + row);
+      return tile;
+    }
+  };
+
+  void check_ramp(ImageView<double> const& image, BBox2i const& box) {
+    ASSERT_EQ(box.width(),  image.cols());
+    ASSERT_EQ(box.height(), image.rows());
+    for (int row = 0; row < image.rows(); row++)
+      for (int col = 0; col < image.cols(); col++)
+        EXPECT_EQ((box.min().x() + col) + 1000.0*(box.min().y() + row), image(col, row));
+  }
+}
+
+TEST(TileCache, CropAcrossBlocks) {
+  set_tile_cache_budget("test_ramp", 1.0);
+  TileCache<double> cache("test_ramp", 16);
+  EXPECT_TRUE(cache.enabled());
+
+  // A box over 3 x 2 blocks, one of them at negative coordinates
+  RampBlock ramp;
+  BBox2i box(-5, 3, 40, 20);
+  check_ramp(cache.crop(0, box, ramp), box);
+  EXPECT_EQ(6, ramp.num_calls);
+
+  // An overlapping box reads only the new blocks
+  BBox2i box2(10, 10, 30, 30);
+  check_ramp(cache.crop(0, box2, ramp), box2);
+  EXPECT_EQ(8, ramp.num_calls);
+
+  // Another image has its own blocks
+  check_ramp(cache.crop(1, box2, ramp), box2);
+  EXPECT_EQ(12, ramp.num_calls);
+}
+
+TEST(TileCache, Eviction) {
+  // Room for two blocks of 16 x 16 doubles
+  set_tile_cache_budget("test_small", 2*16*16*sizeof(double)/(1024.0*1024.0));
+  TileCache<double> cache("test_small", 16);
+
+  RampBlock ramp;
+  BBox2i a(0, 0, 16, 16), b(16, 0, 16, 16), c(32, 0, 16, 16);
+  cache.crop(0, a, ramp);
+  cache.crop(0, b, ramp);
+  cache.crop(0, a, ramp); // a is now the most recently used
+  EXPECT_EQ(2, ramp.num_calls);
+  cache.crop(0, c, ramp); // evicts b
+  cache.crop(0, a, ramp);
+  EXPECT_EQ(3, ramp.num_calls);
+  check_ramp(cache.crop(0, b, ramp), b);
+  EXPECT_EQ(4, ramp.num_calls);
+
+  EXPECT_THROW(set_tile_cache_budget("test_small", -1), ArgumentErr);
+}
+
+TEST(TileCache, Disabled) {
+  TileCache<double> cache("test_unset", 16);
+  EXPECT_FALSE(cache.enabled());
+}
+
+TEST(TileCache, CachedView) {
+  set_tile_cache_budget("test_view", 1.0);
+  boost::shared_ptr< TileCache<double> > cache(new TileCache<double>("test_view", 16));
+
+  RampBlock ramp;
+  ImageView<double> image = ramp(BBox2i(0, 0, 40, 30));
+  TileCachedView<double> view(image, cache, 0);
+  EXPECT_EQ(40, view.cols());
+  EXPECT_EQ(30, view.rows());
+
+  BBox2i box(5, 7, 30, 20);
+  ImageView<double> region = crop(view, box);
+  check_ramp(region, box);
+
+  // Past the image edges the pixels are zero
+  BBox2i past(30, 20, 20, 20);
+  region = crop(view, past);
+  ASSERT_EQ(20, region.cols());
+  EXPECT_EQ(39 + 1000.0*29, region(9, 9));
+  EXPECT_EQ(0.0, region(10, 9));
+  EXPECT_EQ(0.0, region(9, 10));
+}
@@ -0,0 +1,108 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/TileCapture.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Matrix.h>
+#include <boost/filesystem.hpp>
+
+using namespace vw;
+using namespace asp;
+namespace fs = boost::filesystem;
+
+TEST(TileCapture, ParseBoxes) {
+  std::vector<BBox2i> boxes = parse_capture_boxes("0 1024 512 512, 2048 0 1024 1024");
+  ASSERT_EQ(2u, boxes.size());
+  EXPECT_EQ(BBox2i(0, 1024, 512, 512),     boxes[0]);
+  EXPECT_EQ(BBox2i(2048, 0, 1024, 1024),   boxes[1]);
+  EXPECT_TRUE(parse_capture_boxes("").empty());
+  EXPECT_THROW(parse_capture_boxes("0 0 10"),    ArgumentErr);
+  EXPECT_THROW(parse_capture_boxes("0 0 10 x"),  ArgumentErr);
+}
+
+TEST(TileCapture, Manifest) {
+  std::string dir = "TestTileCaptureManifest";
+  fs::create_directories(dir);
+
+  TileManifest manifest;
+  manifest.set("kind",    std::string("corr"));
+  manifest.set("tile",    BBox2i(1024, 2048, 512, 256));
+  manifest.set("size",    Vector2i(5000, 4000));
+  manifest.set("seconds", 12.25);
+  manifest.write(dir);
+
+  TileManifest back;
+  back.read(dir);
+  EXPECT_EQ("corr", back.get_string("kind"));
+  EXPECT_EQ(BBox2i(1024, 2048, 512, 256), back.get_bbox("tile"));
+  EXPECT_EQ(Vector2i(5000, 4000), back.get_vector("size"));
+  EXPECT_EQ(12.25, back.get_double("seconds"));
+  EXPECT_FALSE(back.has("search_range"));
+  EXPECT_THROW(back.get_bbox("search_range"), ArgumentErr);
+
+  fs::remove_all(dir);
+}
+
+TEST(TileCapture, RightBox) {
+  BBox2i left_box(100, 200, 50, 40);
+  BBox2f range(Vector2f(-10.5, 2), Vector2f(20, 3.5));
+  Matrix<double> identity = math::identity_matrix<3>();
+  EXPECT_EQ(BBox2i(Vector2i(89, 202), Vector2i(170, 244)),
+            right_capture_box(left_box, range, identity));
+
+  // The right image seen through a shift by (10, 5) is the right image
+  // at pixels 10 and 5 less.
+  Matrix<double> shift = math::identity_matrix<3>();
+  shift(0, 2) = 10;
+  shift(1, 2) = 5;
+  EXPECT_EQ(BBox2i(Vector2i(77, 195), Vector2i(162, 241)),
+            right_capture_box(left_box, range, shift));
+}
+
+TEST(TileCapture, Crop) {
+  std::string dir = "TestTileCaptureCrop";
+  fs::create_directories(dir);
+
+  ImageView< PixelMask<Vector2f> > image(30, 20);
+  for (int row = 0; row < image.rows(); row++)
+    for (int col = 0; col < image.cols(); col++)
+      image(col, row) = PixelMask<Vector2f>(Vector2f(col, -row));
+  BBox2i box(5, 6, 10, 8);
+  write_capture_crop(dir, "D", image, box);
+
+  ImageViewRef< PixelMask<Vector2f> > back
+    = read_capture_crop< PixelMask<Vector2f> >(dir, "D", box, Vector2i(30, 20));
+  EXPECT_EQ(30, back.cols());
+  EXPECT_EQ(20, back.rows());
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      if (box.contains(Vector2i(col, row))) {
+        ASSERT_TRUE(is_valid(back(col, row)));
+        EXPECT_EQ(image(col, row).child(), back(col, row).child());
+      } else {
+        EXPECT_FALSE(is_valid(back(col, row)));
+      }
+    }
+  }
+
+  EXPECT_THROW(read_capture_crop< PixelMask<Vector2f> >(dir, "D", BBox2i(0, 0, 4, 4),
+                                                         Vector2i(30, 20)),
+               ArgumentErr);
+  fs::remove_all(dir);
+}
@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TilePrefetcher.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Each pixel has its column plus 1000 times its row
+  ImageView<double> ramp_image(int cols, int rows) {
+    ImageView<double> image(cols, rows);
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        image(col, row) = col + 1000.0*row;
+    return image;
+  }
+
+  void check_ramp(ImageView<double> const& image, BBox2i const& box) {
+    ASSERT_EQ(box.width(),  image.cols());
+    ASSERT_EQ(box.height(), image.rows());
+    for (int row = 0; row < image.rows(); row++)
+      for (int col = 0; col < image.cols(); col++)
+        EXPECT_EQ((box.min().x() + col) + 1000.0*(box.min().y() + row), image(col, row));
+  }
+}
+
+TEST(TilePrefetcher, TakeInOrder) {
+  ImageView<double> image = ramp_image(100, 70);
+  std::vector<BBox2i> schedule = subdivide_bbox(BBox2i(10, 5, 80, 60), 32, 32);
+  ASSERT_EQ(6u, schedule.size());
+
+  // Room for two tiles at a time
+  TilePrefetcher<double> prefetcher("test", image, 2*32*32*sizeof(double)/(1024.0*1024.0), 2);
+  EXPECT_TRUE(prefetcher.enabled());
+
+  ImageView<double> tile;
+  EXPECT_FALSE(prefetcher.take(schedule[0], tile)); // not started
+
+  prefetcher.start(schedule);
+  for (size_t t = 0; t < schedule.size(); t++) {
+    ASSERT_TRUE(prefetcher.take(schedule[t], tile));
+    check_ramp(tile, schedule[t]);
+  }
+
+  // A tile is taken once, and other boxes are not prefetched
+  EXPECT_FALSE(prefetcher.take(schedule[0], tile));
+  EXPECT_FALSE(prefetcher.take(BBox2i(10, 5, 16, 16), tile));
+
+  // A new schedule starts over
+  prefetcher.start(schedule);
+  ASSERT_TRUE(prefetcher.take(schedule[0], tile));
+  check_ramp(tile, schedule[0]);
+}
+
+TEST(TilePrefetcher, Disabled) {
+  ImageView<double> image = ramp_image(64, 64);
+  TilePrefetcher<double> prefetcher("test", image, 0, 2);
+  EXPECT_FALSE(prefetcher.enabled());
+  prefetcher.start(subdivide_bbox(BBox2i(0, 0, 64, 64), 32, 32));
+  ImageView<double> tile;
+  EXPECT_FALSE(prefetcher.take(BBox2i(0, 0, 32, 32), tile));
+}
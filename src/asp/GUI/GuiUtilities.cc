@@ -22,6 +22,8 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <map>
 #include <QPolygon>
 #include <QtGui>
 #include <QtWidgets>
@@ -32,7 +34,6 @@
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/tools/hillshade.h>
 #include <vw/Core/RunOnce.h>
 #include <asp/GUI/GuiUtilities.h>
 
@@ -120,60 +121,55 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
-
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
-  }
-
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
-
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  try {
-    DiskImageView<float> input(input_file);
-    try{
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
+void hillshade_clip(ImageView<double> const& dem, double nodata_val,
+                    vw::Vector2 const& pixel_size,
+                    double azimuth, double elevation,
+                    ImageView<double> & shade) {
+
+  // The direction towards the light, with x to the east, y to the
+  // north, and z up
+  double a = azimuth*M_PI/180.0, e = elevation*M_PI/180.0;
+  Vector3 light(cos(a)*cos(e), sin(a)*cos(e), sin(e));
+
+  int cols = dem.cols(), rows = dem.rows();
+  shade.set_size(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+
+      double z = dem(col, row);
+      if (z <= nodata_val || std::isnan(z)) {
+        shade(col, row) = std::numeric_limits<double>::quiet_NaN();
+        continue;
       }
-    }catch(...){
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file,  output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
+
+      // Central differences, or one-sided ones next to nodata and at
+      // the clip boundary. The rows go to the south.
+      double nbr[4] = {z, z, z, z}; // left, right, up, down
+      int    num_x = 0, num_y = 0;
+      int    dc[4] = {-1, 1, 0, 0}, dr[4] = {0, 0, -1, 1};
+      for (int k = 0; k < 4; k++) {
+        int c = col + dc[k], r = row + dr[k];
+        if (c < 0 || r < 0 || c >= cols || r >= rows)
+          continue;
+        double v = dem(c, r);
+        if (v <= nodata_val || std::isnan(v))
+          continue;
+        nbr[k] = v;
+        if (k < 2) num_x++; else num_y++;
       }
+      double dzdx = 0, dzdy = 0;
+      if (num_x > 0)
+        dzdx = (nbr[1] - nbr[0])/(num_x*pixel_size.x());
+      if (num_y > 0)
+        dzdy = (nbr[2] - nbr[3])/(num_y*pixel_size.y());
+
+      Vector3 normal(-dzdx, -dzdy, 1.0);
+      double val = dot_prod(normal, light)/norm_2(normal);
+      shade(col, row) = 255.0*std::max(val, 0.0);
     }
-  } catch (const Exception& e) {
-    popUp(e.what());
-    return false;
   }
-
-  return true;
 }
 
-
 // Convert a single polygon in a set of polygons to an ORG ring.  
 void toOGR(const double * xv, const double * yv, int startPos, int numVerts,
 	     OGRLinearRing & R){
@@ -418,25 +414,14 @@ void mergePolys(std::vector<vw::geometry::dPoly> & polyVec){
     fromOGR(good_geom, poly_color, layer_str, polyVec, append);
   }else if (wkbFlatten(good_geom->getGeometryType()) == wkbMultiPolygon) {
 
-    // We can merge
-    OGRGeometry * merged_geom = new OGRPolygon;
-    
-    OGRMultiPolygon *poMultiPolygon = (OGRMultiPolygon*)good_geom;
-    
-    int numGeom = poMultiPolygon->getNumGeometries();
-    for (int iGeom = 0; iGeom < numGeom; iGeom++){
-      
-      const OGRGeometry *currPolyGeom = poMultiPolygon->getGeometryRef(iGeom);
-      if (wkbFlatten(currPolyGeom->getGeometryType()) != wkbPolygon) continue;
-
-      OGRPolygon *poPolygon = (OGRPolygon *) currPolyGeom;
-      OGRGeometry * local_merged = merged_geom->Union(poPolygon);
-
-      // Keep the pointer to the new geometry
-      if (merged_geom != NULL)
-	OGRGeometryFactory::destroyGeometry(merged_geom);
-      merged_geom = local_merged;
-    }    
+    // Merge all the polygons at once. The cascaded union merges nearby
+    // polygons first, a tree of them at a time, which is much faster
+    // than merging them into the result one by one.
+    OGRGeometry * merged_geom = good_geom->UnionCascaded();
+    if (merged_geom == NULL) {
+      OGRGeometryFactory::destroyGeometry(good_geom);
+      vw_throw(ArgumentErr() << "Failed to merge the polygons.\n");
+    }
 
     bool append = false;
     fromOGR(merged_geom, poly_color, layer_str, polyVec, append);
@@ -750,6 +735,21 @@ void imageData::read(std::string const& name_in,
   }
 }
 
+vw::Vector2 imageData::ground_pixel_size() const {
+  if (!has_georef)
+    return Vector2(1, 1);
+
+  Vector2 size(std::abs(georef.transform()(0, 0)), std::abs(georef.transform()(1, 1)));
+  if (georef.is_projected())
+    return size;
+
+  // Degrees to meters, at the latitude of the image center
+  double lat = georef.pixel_to_lonlat(image_bbox.center()).y();
+  double meters_per_degree = georef.datum().semi_major_axis()*M_PI/180.0;
+  return Vector2(size.x()*meters_per_degree*cos(lat*M_PI/180.0),
+                 size.y()*meters_per_degree);
+}
+
 vw::Vector2 QPoint2Vec(QPoint const& qpt) {
   return vw::Vector2(qpt.x(), qpt.y());
 }
@@ -919,7 +919,8 @@ double DiskImagePyramidMultiChannel::get_nodata_val() const {
   
 void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i region_in,
                   bool highlight_nodata,
-                  QImage & qimg, double & scale_out, vw::BBox2i & region_out) const{
+                  QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                  ClipRenderOptions const& render) const{
 
   bool scale_pixels = (m_type == CH1_DOUBLE);
   vw::Vector2 bounds;
@@ -932,8 +933,17 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
     ImageView<double> clip;
     m_img_ch1_double.get_image_clip(scale_in, region_in, clip,
 				    scale_out, region_out);
-    formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(), bounds,
-	       clip, qimg);
+    double nodata_val = std::max(m_img_ch1_double.get_nodata_val(), render.shadow_thresh);
+    if (render.hillshade) {
+      // The clip pixels are scale_out times larger than the original ones
+      ImageView<double> shade;
+      hillshade_clip(clip, nodata_val, scale_out*render.pixel_size,
+                     render.azimuth, render.elevation, shade);
+      formQimage(highlight_nodata, false, -std::numeric_limits<double>::max(), bounds,
+                 shade, qimg);
+    }else{
+      formQimage(highlight_nodata, scale_pixels, nodata_val, bounds, clip, qimg);
+    }
   } else if (m_type == CH2_UINT8) {
     ImageView<Vector<vw::uint8, 2> > clip;
     m_img_ch2_uint8.get_image_clip(scale_in, region_in, clip,
@@ -996,4 +1006,369 @@ void PointList::push_back(std::list<vw::Vector2> pts) {
   }
 }
 
+namespace {
+  // Nodes with no more points than this, or this deep, are not split
+  const size_t MATCH_INDEX_LEAF_SIZE = 32;
+  const int    MATCH_INDEX_MAX_DEPTH = 20;
+
+  // The squared distance from a point to a box, zero if inside
+  double dist2_to_box(Vector2 const& P, BBox2 const& box) {
+    double dx = std::max(0.0, std::max(box.min().x() - P.x(), P.x() - box.max().x()));
+    double dy = std::max(0.0, std::max(box.min().y() - P.y(), P.y() - box.max().y()));
+    return dx*dx + dy*dy;
+  }
+
+  bool box_overlaps(BBox2 const& a, BBox2 const& b) {
+    return a.min().x() <= b.max().x() && b.min().x() <= a.max().x() &&
+           a.min().y() <= b.max().y() && b.min().y() <= a.max().y();
+  }
+
+  bool box_has_point(BBox2 const& box, Vector2 const& P) {
+    return P.x() >= box.min().x() && P.x() <= box.max().x() &&
+           P.y() >= box.min().y() && P.y() <= box.max().y();
+  }
+
+  // Which quadrant of a node a point falls in
+  struct InQuadrant {
+    std::vector<Vector2> const& points;
+    Vector2 center;
+    bool right, bottom;
+    InQuadrant(std::vector<Vector2> const& p, Vector2 const& c, bool r, bool b):
+      points(p), center(c), right(r), bottom(b) {}
+    bool operator()(size_t i) const {
+      return (points[i].x() >= center.x()) == right && (points[i].y() >= center.y()) == bottom;
+    }
+  };
+}
+
+void MatchPointIndex::build(std::vector<vw::ip::InterestPoint> const& ip) {
+  m_nodes.clear();
+  m_points.resize(ip.size());
+  m_order.resize(ip.size());
+  if (ip.empty())
+    return;
+
+  BBox2 box;
+  for (size_t i = 0; i < ip.size(); i++) {
+    m_points[i] = Vector2(ip[i].x, ip[i].y);
+    m_order[i]  = i;
+    box.grow(m_points[i]);
+  }
+  Node root;
+  root.box   = box;
+  root.beg   = 0;
+  root.end   = ip.size();
+  root.child = -1;
+  m_nodes.push_back(root);
+  build_node(0, 0);
+}
+
+void MatchPointIndex::build_node(int node, int depth) {
+  Vector2 sum;
+  for (size_t k = m_nodes[node].beg; k < m_nodes[node].end; k++)
+    sum += m_points[m_order[k]];
+  m_nodes[node].mean = sum/double(m_nodes[node].end - m_nodes[node].beg);
+
+  if (m_nodes[node].end - m_nodes[node].beg <= MATCH_INDEX_LEAF_SIZE ||
+      depth >= MATCH_INDEX_MAX_DEPTH)
+    return;
+
+  // Split the points among the quadrants, in place
+  BBox2   box    = m_nodes[node].box;
+  Vector2 center = (box.min() + box.max())/2.0;
+  size_t  beg    = m_nodes[node].beg;
+  int     child  = m_nodes.size();
+  m_nodes[node].child = child;
+  for (int q = 0; q < 4; q++) {
+    bool right = (q % 2 == 1), bottom = (q >= 2);
+    size_t end = m_nodes[node].end;
+    if (q < 3)
+      end = std::partition(m_order.begin() + beg, m_order.begin() + m_nodes[node].end,
+                           InQuadrant(m_points, center, right, bottom)) - m_order.begin();
+    Node c;
+    c.box   = BBox2(Vector2(right  ? center.x() : box.min().x(),
+                            bottom ? center.y() : box.min().y()),
+                    Vector2(right  ? box.max().x() : center.x(),
+                            bottom ? box.max().y() : center.y()));
+    c.beg   = beg;
+    c.end   = end;
+    c.child = -1;
+    m_nodes.push_back(c);
+    beg = end;
+  }
+  for (int q = 0; q < 4; q++) {
+    if (m_nodes[child + q].end > m_nodes[child + q].beg)
+      build_node(child + q, depth + 1);
+  }
+}
+
+void MatchPointIndex::points_in_box(BBox2 const& box, double min_size,
+                                    std::vector<vw::Vector2> & points) const {
+  points.clear();
+  if (!m_nodes.empty())
+    points_in_node(0, box, min_size, points);
+}
+
+void MatchPointIndex::points_in_node(int node, BBox2 const& box, double min_size,
+                                     std::vector<vw::Vector2> & points) const {
+  Node const& n = m_nodes[node];
+  if (n.end == n.beg || !box_overlaps(n.box, box))
+    return;
+  if (n.box.width() <= min_size && n.box.height() <= min_size) {
+    if (box_has_point(box, n.mean))
+      points.push_back(n.mean);
+    return;
+  }
+  if (n.child < 0) {
+    if (min_size <= 0) {
+      for (size_t k = n.beg; k < n.end; k++) {
+        if (box_has_point(box, m_points[m_order[k]]))
+          points.push_back(m_points[m_order[k]]);
+      }
+      return;
+    }
+    // Merge the points of a leaf falling in the same cell of size min_size
+    std::map< std::pair<int, int>, std::pair<Vector2, int> > cells;
+    for (size_t k = n.beg; k < n.end; k++) {
+      Vector2 const& P = m_points[m_order[k]];
+      if (!box_has_point(box, P))
+        continue;
+      std::pair<int, int> cell(int(std::floor((P.x() - n.box.min().x())/min_size)),
+                               int(std::floor((P.y() - n.box.min().y())/min_size)));
+      std::pair<Vector2, int> & c = cells[cell];
+      c.first  += P;
+      c.second += 1;
+    }
+    for (std::map< std::pair<int, int>, std::pair<Vector2, int> >::const_iterator
+           it = cells.begin(); it != cells.end(); it++)
+      points.push_back(it->second.first/double(it->second.second));
+    return;
+  }
+  for (int q = 0; q < 4; q++)
+    points_in_node(n.child + q, box, min_size, points);
+}
+
+int MatchPointIndex::closest_point(vw::Vector2 const& P) const {
+  double min_dist = std::numeric_limits<double>::max();
+  int min_index = -1;
+  if (!m_nodes.empty())
+    closest_in_node(0, P, min_dist, min_index);
+  return min_index;
+}
+
+void MatchPointIndex::closest_in_node(int node, vw::Vector2 const& P,
+                                      double & min_dist, int & min_index) const {
+  Node const& n = m_nodes[node];
+  if (n.end == n.beg || dist2_to_box(P, n.box) > min_dist)
+    return;
+  if (n.child < 0) {
+    for (size_t k = n.beg; k < n.end; k++) {
+      double d = norm_2_sqr(m_points[m_order[k]] - P);
+      // Of equally close points, the first one, as a linear search would do
+      if (d < min_dist || (d == min_dist && int(m_order[k]) < min_index)) {
+        min_dist  = d;
+        min_index = m_order[k];
+      }
+    }
+    return;
+  }
+
+  // The children closest to the point first, to prune more of the others
+  std::pair<double, int> order[4];
+  for (int q = 0; q < 4; q++)
+    order[q] = std::make_pair(dist2_to_box(P, m_nodes[n.child + q].box), n.child + q);
+  std::sort(order, order + 4);
+  for (int q = 0; q < 4; q++)
+    closest_in_node(order[q].second, P, min_dist, min_index);
+}
+
+namespace {
+  // The most children of a node of the polygon edge R-tree
+  const int POLY_INDEX_NODE_SIZE = 16;
+
+  template <class ItemT>
+  bool box_center_x_less(ItemT const& a, ItemT const& b) {
+    return a.box.min().x() + a.box.max().x() < b.box.min().x() + b.box.max().x();
+  }
+  template <class ItemT>
+  bool box_center_y_less(ItemT const& a, ItemT const& b) {
+    return a.box.min().y() + a.box.max().y() < b.box.min().y() + b.box.max().y();
+  }
+
+  // Order items with boxes so that each run of POLY_INDEX_NODE_SIZE of
+  // them makes a compact node: sort them by x into vertical slices, and
+  // each slice by y (sort-tile-recursive packing).
+  template <class ItemT>
+  void str_sort(std::vector<ItemT> & items) {
+    size_t n = items.size();
+    size_t num_nodes  = (n + POLY_INDEX_NODE_SIZE - 1)/POLY_INDEX_NODE_SIZE;
+    size_t num_slices = std::max(size_t(1), size_t(std::ceil(std::sqrt(double(num_nodes)))));
+    size_t slice_size = num_slices*POLY_INDEX_NODE_SIZE;
+    std::sort(items.begin(), items.end(), box_center_x_less<ItemT>);
+    for (size_t beg = 0; beg < n; beg += slice_size)
+      std::sort(items.begin() + beg, items.begin() + std::min(n, beg + slice_size),
+                box_center_y_less<ItemT>);
+  }
+}
+
+void PolySegmentIndex::build(std::vector<vw::geometry::dPoly> const& polyVec) {
+  m_segs.clear();
+  m_nodes.clear();
+  m_root = -1;
+
+  for (int vec = 0; vec < (int)polyVec.size(); vec++) {
+    const double * xv       = polyVec[vec].get_xv();
+    const double * yv       = polyVec[vec].get_yv();
+    const int    * numVerts = polyVec[vec].get_numVerts();
+    int numPolys            = polyVec[vec].get_numPolys();
+    int start = 0;
+    for (int pIter = 0; pIter < numPolys; pIter++) {
+      if (pIter > 0) start += numVerts[pIter - 1];
+      int n = numVerts[pIter];
+      for (int v = 0; v < n; v++) {
+        int w = (v + 1) % n;
+        Segment seg;
+        seg.x0 = xv[start + v]; seg.y0 = yv[start + v];
+        seg.x1 = xv[start + w]; seg.y1 = yv[start + w];
+        seg.vec = vec; seg.poly = pIter; seg.vert = v;
+        seg.box = BBox2(Vector2(std::min(seg.x0, seg.x1), std::min(seg.y0, seg.y1)),
+                        Vector2(std::max(seg.x0, seg.x1), std::max(seg.y0, seg.y1)));
+        m_segs.push_back(seg);
+      }
+    }
+  }
+  if (m_segs.empty())
+    return;
+
+  // The leaves, over runs of the packed segments
+  str_sort(m_segs);
+  std::vector<Node> level;
+  for (size_t beg = 0; beg < m_segs.size(); beg += POLY_INDEX_NODE_SIZE) {
+    Node node;
+    node.beg  = beg;
+    node.end  = std::min(m_segs.size(), beg + POLY_INDEX_NODE_SIZE);
+    node.leaf = true;
+    for (int i = node.beg; i < node.end; i++)
+      node.box.grow(m_segs[i].box);
+    level.push_back(node);
+  }
+
+  // Pack each level into the one above it, until one node is left
+  while (true) {
+    if (level.size() > 1)
+      str_sort(level);
+    int first = m_nodes.size();
+    m_nodes.insert(m_nodes.end(), level.begin(), level.end());
+    if (level.size() == 1)
+      break;
+    std::vector<Node> parents;
+    for (size_t beg = 0; beg < level.size(); beg += POLY_INDEX_NODE_SIZE) {
+      Node node;
+      node.beg  = first + beg;
+      node.end  = first + std::min(level.size(), beg + POLY_INDEX_NODE_SIZE);
+      node.leaf = false;
+      for (int i = node.beg; i < node.end; i++)
+        node.box.grow(m_nodes[i].box);
+      parents.push_back(node);
+    }
+    level.swap(parents);
+  }
+  m_root = m_nodes.size() - 1;
+}
+
+namespace {
+  // The squared distance from a point to a vertex, the start of a segment
+  struct VertexDist {
+    template <class SegT>
+    double operator()(SegT const& s, double x0, double y0, double & x, double & y) const {
+      x = s.x0; y = s.y0;
+      return (x - x0)*(x - x0) + (y - y0)*(y - y0);
+    }
+  };
+
+  // The squared distance from a point to a segment
+  struct EdgeDist {
+    template <class SegT>
+    double operator()(SegT const& s, double x0, double y0, double & x, double & y) const {
+      double dx = s.x1 - s.x0, dy = s.y1 - s.y0, len2 = dx*dx + dy*dy;
+      double t = (len2 > 0) ? ((x0 - s.x0)*dx + (y0 - s.y0)*dy)/len2 : 0.0;
+      t = std::max(0.0, std::min(1.0, t));
+      x = s.x0 + t*dx; y = s.y0 + t*dy;
+      return (x - x0)*(x - x0) + (y - y0)*(y - y0);
+    }
+  };
+}
+
+template <class DistT>
+void PolySegmentIndex::closest(int node, double x0, double y0, DistT const& dist,
+                               double & minDist2, int & minSeg,
+                               double & minX, double & minY) const {
+  Node const& n = m_nodes[node];
+  if (dist2_to_box(Vector2(x0, y0), n.box) > minDist2)
+    return;
+
+  if (n.leaf) {
+    for (int i = n.beg; i < n.end; i++) {
+      double x, y;
+      double d = dist(m_segs[i], x0, y0, x, y);
+      // Of equally close ones, the last in the order of the polygons,
+      // as the linear search does
+      bool later = false;
+      if (d == minDist2 && minSeg >= 0) {
+        Segment const& a = m_segs[i], & b = m_segs[minSeg];
+        later = (a.vec != b.vec) ? (a.vec > b.vec) :
+          (a.poly != b.poly) ? (a.poly > b.poly) : (a.vert > b.vert);
+      }
+      if (d < minDist2 || minSeg < 0 || later) {
+        minDist2 = d; minSeg = i; minX = x; minY = y;
+      }
+    }
+    return;
+  }
+
+  // The children closest to the point first, to prune more of the others
+  std::vector< std::pair<double, int> > order;
+  for (int i = n.beg; i < n.end; i++)
+    order.push_back(std::make_pair(dist2_to_box(Vector2(x0, y0), m_nodes[i].box), i));
+  std::sort(order.begin(), order.end());
+  for (size_t k = 0; k < order.size(); k++)
+    closest(order[k].second, x0, y0, dist, minDist2, minSeg, minX, minY);
+}
+
+void PolySegmentIndex::findClosestVertex(double x0, double y0,
+                                         int & polyVecIndex, int & polyIndexInCurrPoly,
+                                         int & vertIndexInCurrPoly,
+                                         double & minX, double & minY,
+                                         double & minDist) const {
+  polyVecIndex = -1; polyIndexInCurrPoly = -1; vertIndexInCurrPoly = -1;
+  minX = x0; minY = y0; minDist = std::numeric_limits<double>::max();
+  if (empty())
+    return;
+  double minDist2 = std::numeric_limits<double>::max();
+  int minSeg = -1;
+  closest(m_root, x0, y0, VertexDist(), minDist2, minSeg, minX, minY);
+  polyVecIndex        = m_segs[minSeg].vec;
+  polyIndexInCurrPoly = m_segs[minSeg].poly;
+  vertIndexInCurrPoly = m_segs[minSeg].vert;
+  minDist             = std::sqrt(minDist2);
+}
+
+void PolySegmentIndex::findClosestEdge(double x0, double y0,
+                                       int & polyVecIndex, int & polyIndexInCurrPoly,
+                                       int & vertIndexInCurrPoly,
+                                       double & minX, double & minY,
+                                       double & minDist) const {
+  polyVecIndex = -1; polyIndexInCurrPoly = -1; vertIndexInCurrPoly = -1;
+  minX = x0; minY = y0; minDist = std::numeric_limits<double>::max();
+  if (empty())
+    return;
+  double minDist2 = std::numeric_limits<double>::max();
+  int minSeg = -1;
+  closest(m_root, x0, y0, EdgeDist(), minDist2, minSeg, minX, minY);
+  polyVecIndex        = m_segs[minSeg].vec;
+  polyIndexInCurrPoly = m_segs[minSeg].poly;
+  vertIndexInCurrPoly = m_segs[minSeg].vert;
+  minDist             = std::sqrt(minDist2);
+}
+
 }} // namespace vw::gui
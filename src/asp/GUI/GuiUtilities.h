@@ -27,6 +27,7 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <limits>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem.hpp>
@@ -148,25 +149,13 @@ namespace vw { namespace gui {
   /// Convert a BBox2 object to a QRect object.
   QRect bbox2qrect(BBox2 const& B);
 
-  /// Save a hillshaded file
-  bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                       double azimuth, double elevation,
-                       std::string const& input_file,
-                       std::string      & output_file);
-
-  // Given an image, and an input file name, modify the filename using
-  // a prefix. Write the image to that filename. If that fails, create
-  // instead the filename in the current directory. Return the name
-  // of the output file.
-  template<class PixelT>
-  std::string write_in_orig_or_curr_dir(vw::cartography::GdalWriteOptions const& opt,
-                                        ImageViewRef<PixelT> & image,
-                                        std::string const& input_file,
-                                        std::string const& suffix,
-                                        bool has_georef,
-                                        vw::cartography::GeoReference const & georef,
-                                        bool has_nodata,
-                                        double nodata_val);
+  /// Hillshade a clip of a DEM whose pixels have the given ground size.
+  /// The azimuth is measured counter-clockwise from the east. Nodata
+  /// pixels become NaN, and the others get values in [0, 255].
+  void hillshade_clip(ImageView<double> const& dem, double nodata_val,
+                      vw::Vector2 const& pixel_size,
+                      double azimuth, double elevation,
+                      ImageView<double> & shade);
 
   // Shape file (vector layer) functions
 
@@ -220,6 +209,19 @@ namespace vw { namespace gui {
 			   double & minDist
 			   );
   
+  /// How to show a single-channel image. The thresholding and the
+  /// hillshading are applied to each clip as it is fetched, so changing
+  /// their parameters needs no new images on disk.
+  struct ClipRenderOptions {
+    double      shadow_thresh;        ///< Pixels no more than this are treated as nodata
+    bool        hillshade;
+    double      azimuth, elevation;   ///< The light direction, in degrees
+    vw::Vector2 pixel_size;           ///< The ground size of a full-resolution pixel
+    ClipRenderOptions(): shadow_thresh(-std::numeric_limits<double>::max()),
+                         hillshade(false), azimuth(0), elevation(0),
+                         pixel_size(1, 1) {}
+  };
+
   // An image class that supports 1 to 3 channels.  We use
   // DiskImagePyramid<double> to be able to use some of the
   // pre-defined member functions for an image class. This class
@@ -246,7 +248,8 @@ namespace vw { namespace gui {
     // How we create it, depends on the type of image we want to display.
     void get_image_clip(double scale_in, vw::BBox2i region_in,
                       bool highlight_nodata,
-                      QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+                      QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                      ClipRenderOptions const& render = ClipRenderOptions()) const;
     double get_nodata_val() const;
     
     int32 cols  () const { return m_cols;  }
@@ -278,6 +281,10 @@ namespace vw { namespace gui {
 	      bool use_georef);
 
     bool isPoly() const { return asp::has_shp_extension(name); }
+
+    /// The ground size of a pixel, in meters for a longitude-latitude
+    /// georeference, to make the slopes when hillshading.
+    vw::Vector2 ground_pixel_size() const;
   };
 
   // QT conversion functions
@@ -303,6 +310,88 @@ namespace vw { namespace gui {
     void push_back(std::list<vw::Vector2> pts);
   };
 
+  /// A quadtree over the interest points of an image, so that only the
+  /// points in view are drawn, and the point closest to a click is
+  /// found without going through all of them. Where the points are too
+  /// dense to tell apart on screen, those of a node can be drawn as a
+  /// single point, at their mean.
+  class MatchPointIndex {
+  public:
+    MatchPointIndex() {}
+
+    /// Index these points, replacing what was indexed before
+    void build(std::vector<vw::ip::InterestPoint> const& ip);
+
+    size_t size() const { return m_points.size(); }
+
+    /// The points in the box. A node no bigger than min_size in
+    /// either direction is given as one point, at the mean of its points.
+    void points_in_box(BBox2 const& box, double min_size,
+                       std::vector<vw::Vector2> & points) const;
+
+    /// The index of the point closest to P, or -1 if there are none
+    int closest_point(vw::Vector2 const& P) const;
+
+  private:
+    struct Node {
+      BBox2       box;
+      vw::Vector2 mean;
+      size_t      beg, end; ///< The points of the node, in m_order
+      int         child;    ///< The first of the 4 children, or -1 for a leaf
+    };
+    std::vector<Node>        m_nodes;
+    std::vector<size_t>      m_order;  ///< Point indices, those of each node together
+    std::vector<vw::Vector2> m_points;
+
+    void build_node(int node, int depth);
+    void points_in_node(int node, BBox2 const& box, double min_size,
+                        std::vector<vw::Vector2> & points) const;
+    void closest_in_node(int node, vw::Vector2 const& P,
+                         double & min_dist, int & min_index) const;
+  };
+
+  /// An R-tree over the edges of a set of polygons, packed once when
+  /// built, to find the vertex or edge closest to a point without going
+  /// through all of them. It must be built again after the polygons change.
+  class PolySegmentIndex {
+  public:
+    PolySegmentIndex(): m_root(-1) {}
+
+    void build(std::vector<vw::geometry::dPoly> const& polyVec);
+
+    bool empty() const { return m_root < 0; }
+
+    /// As findClosestPolyVertex() and findClosestPolyEdge()
+    void findClosestVertex(double x0, double y0,
+                           int & polyVecIndex, int & polyIndexInCurrPoly,
+                           int & vertIndexInCurrPoly,
+                           double & minX, double & minY, double & minDist) const;
+    void findClosestEdge(double x0, double y0,
+                         int & polyVecIndex, int & polyIndexInCurrPoly,
+                         int & vertIndexInCurrPoly,
+                         double & minX, double & minY, double & minDist) const;
+
+  private:
+    /// The edge from a vertex to the next one in its polygon
+    struct Segment {
+      double x0, y0, x1, y1;
+      int    vec, poly, vert;
+      BBox2  box;
+    };
+    struct Node {
+      BBox2 box;
+      int   beg, end; ///< The children in m_nodes, or the segments for a leaf
+      bool  leaf;
+    };
+    std::vector<Segment> m_segs;
+    std::vector<Node>    m_nodes;
+    int                  m_root;
+
+    template <class DistT>
+    void closest(int node, double x0, double y0, DistT const& dist,
+                 double & minDist2, int & minSeg, double & minX, double & minY) const;
+  };
+
   /// Class to create a file list on the left side of the window
   class chooseFilesDlg: public QWidget{
     Q_OBJECT
@@ -425,36 +514,6 @@ formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
   }
 }
 
-template<class PixelT>
-std::string write_in_orig_or_curr_dir(vw::cartography::GdalWriteOptions const& opt,
-                                      ImageViewRef<PixelT> & image,
-                                      std::string const& input_file,
-                                      std::string const& suffix,
-                                      bool has_georef,
-                                      vw::cartography::GeoReference const & georef,
-                                      bool has_nodata,
-                                      double nodata_val){
-
-  TerminalProgressCallback tpc("asp", ": ");
-
-  std::string output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-
-  vw_out() << "Writing: " << output_file << std::endl;
-  try{
-    vw::cartography::block_write_gdal_image(output_file, image, has_georef, georef,
-                                has_nodata, nodata_val, opt, tpc);
-  }catch(...){
-    // Failed to write, presumably because we have no write access.
-    // Write the file in the current dir.
-    vw_out() << "Failed to write: " << output_file << "\n";
-    output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-    vw_out() << "Writing: " << output_file << std::endl;
-    vw::cartography::block_write_gdal_image(output_file, image, has_georef, georef,
-                                has_nodata, nodata_val, opt, tpc);
-  }
-  return output_file;
-}
-
 }} // namespace vw::gui
 
 #endif  // __STEREO_GUI_GUI_UTILITIES_H__
@@ -31,6 +31,8 @@
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Core/RunOnce.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <asp/GUI/MainWidget.h>
@@ -41,6 +43,38 @@ using namespace vw::gui;
 using namespace vw::cartography;
 using namespace std;
 
+namespace {
+
+  // How many rendered image clips to keep around
+  const size_t MAX_NUM_CACHED_CLIPS = 64;
+
+  // Fetch one image clip. The pyramid levels are read-only once
+  // built, so several clips can be fetched at the same time.
+  class ImageClipTask: public vw::Task, private boost::noncopyable {
+    DiskImagePyramidMultiChannel const& m_img;
+    double      m_scale;
+    BBox2i      m_region;
+    bool        m_highlight_nodata;
+    ClipRenderOptions m_render;
+    QImage    & m_qimg;
+    double    & m_scale_out;
+    BBox2i    & m_region_out;
+  public:
+    ImageClipTask(DiskImagePyramidMultiChannel const& img, double scale,
+                  BBox2i const& region, bool highlight_nodata,
+                  ClipRenderOptions const& render,
+                  QImage & qimg, double & scale_out, BBox2i & region_out):
+      m_img(img), m_scale(scale), m_region(region), m_highlight_nodata(highlight_nodata),
+      m_render(render), m_qimg(qimg), m_scale_out(scale_out), m_region_out(region_out) {}
+
+    void operator()() {
+      m_img.get_image_clip(m_scale, m_region, m_highlight_nodata,
+                           m_qimg, m_scale_out, m_region_out, m_render);
+    }
+  };
+
+} // end anonymous namespace
+
 namespace vw { namespace gui {
 
   // --------------------------------------------------------------
@@ -172,12 +206,15 @@ namespace vw { namespace gui {
     : QWidget(parent), m_opt(opt), m_chooseFilesDlg(chooseFiles),
       m_image_id(image_id), m_output_prefix(output_prefix),
       m_image_files(image_files), m_matches(matches),  m_use_georef(use_georef),
-      m_view_matches(view_matches), m_zoom_all_to_same_region(zoom_all_to_same_region),
+      m_view_matches(view_matches), m_match_index_dirty(true),
+      m_zoom_all_to_same_region(zoom_all_to_same_region),
       m_allowMultipleSelections(allowMultipleSelections), m_can_emit_zoom_all_signal(false),
       m_polyEditMode(false), m_polyVecIndex(0),
       m_pixelTol(6), m_backgroundColor(QColor("black")) {
 
     installEventFilter(this);
+    m_polyIndexStale = true;
+    m_allPolysStale  = true;
 
     m_firstPaintEvent = true;
     m_emptyRubberBand = QRect(0, 0, 0, 0);
@@ -338,7 +375,7 @@ namespace vw { namespace gui {
     connect(m_insertVertex,       SIGNAL(triggered()), this, SLOT(insertVertex()));
     connect(m_mergePolys,         SIGNAL(triggered()), this, SLOT(mergePolys()));
 
-    MainWidget::maybeGenHillshade();
+    MainWidget::checkHillshadeMode();
 
     
   } // End constructor
@@ -570,57 +607,23 @@ namespace vw { namespace gui {
       return;
     }
 
-    int num_images = m_images.size();
-    m_shadow_thresh_images.clear(); // wipe the old copy
-    m_shadow_thresh_images.resize(num_images);
-
-    // Create the thresholded images and save them to disk. We have to do it each
-    // time as perhaps the shadow threshold changed.
-    for (int image_iter = 0; image_iter < num_images; image_iter++) {
-      std::string input_file = m_image_files[image_iter];
-
-      double nodata_val = -std::numeric_limits<double>::max();
-      vw::read_nodata_val(input_file, nodata_val);
-      nodata_val = std::max(nodata_val, m_shadow_thresh);
-
-      int num_channels = m_images[image_iter].img.planes();
-      if (num_channels != 1) {
+    // The threshold is applied to the image clips when drawn
+    for (size_t image_iter = 0; image_iter < m_images.size(); image_iter++) {
+      if (m_images[image_iter].img.planes() != 1) {
         popUp("Thresholding makes sense only for single-channel images.");
         m_shadow_thresh_view_mode = false;
         return;
       }
-
-      ImageViewRef<double> thresh_image
-        = apply_mask(create_mask_less_or_equal(DiskImageView<double>(input_file),
-                                               nodata_val), nodata_val);
-
-      std::string suffix = "_thresh.tif";
-      bool has_georef = false;
-      bool has_nodata = true;
-      vw::cartography::GeoReference georef;
-      std::string output_file
-        = write_in_orig_or_curr_dir(m_opt,
-                                    thresh_image, input_file, suffix,
-                                    has_georef,  georef,
-                                    has_nodata, nodata_val);
-
-      // Read it back right away
-      m_shadow_thresh_images[image_iter].read(output_file, m_opt, m_use_georef);
-      temporary_files().files.insert(output_file);
     }
 
     refreshPixmap();
   }
 
-  void MainWidget::maybeGenHillshade(){
+  void MainWidget::checkHillshadeMode(){
 
-    int num_images = m_images.size();
-    m_hillshaded_images.clear(); // wipe the old copy
-    m_hillshaded_images.resize(num_images);
-
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
-    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+    // The hillshading is applied to the image clips when drawn, so
+    // here only check that it can be done.
+    for (size_t image_iter = 0; image_iter < m_images.size(); image_iter++) {
 
       if (!m_hillshade_mode[image_iter]) continue;
 
@@ -630,28 +633,12 @@ namespace vw { namespace gui {
         return;
       }
 
-      std::string input_file = m_image_files[image_iter];
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         popUp("Hill-shading makes sense only for single-channel images.");
         m_hillshade_mode[image_iter] = false;
         return;
       }
-
-      // Save the hillshaded images to disk
-      std::string hillshaded_file;
-      bool success = write_hillshade(m_opt,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-      if (!success) {
-        m_hillshade_mode[image_iter] = false;
-        return;
-      }
-
-      vw_out() << "Reading: " << hillshaded_file << std::endl;
-      m_hillshaded_images[image_iter].read(hillshaded_file, m_opt, m_use_georef);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -683,7 +670,7 @@ namespace vw { namespace gui {
 
     m_shadow_thresh_calc_mode = false;
     m_shadow_thresh_view_mode = false;
-    MainWidget::maybeGenHillshade();
+    MainWidget::checkHillshadeMode();
 
     m_indicesWithAction.clear();
     refreshPixmap();
@@ -867,6 +854,10 @@ namespace vw { namespace gui {
     if (m_current_view.empty()) return;
 
     std::list<BBox2i> screen_box_list; // List of regions the images are drawn in
+    std::vector<ImageClip> clips;
+    std::vector<DiskImagePyramidMultiChannel const*> clip_images;
+    std::vector<int> clip_image_indices;
+    std::vector<BBox2i> clip_screen_boxes;
     // Loop through input images
     // - These images get drawn in the same
     for (size_t j = 0; j < m_images.size(); j++){
@@ -909,31 +900,42 @@ namespace vw { namespace gui {
       if (m_images[i].isPoly())
 	continue;
       
-      QImage qimg;
       // Since the image portion contained in image_box could be huge,
       // but the screen area small, render a sub-sampled version of
       // the image for speed.
       // Convert to double before multiplication, to avoid overflow
       // when multiplying large integers.
-      double scale = sqrt((1.0*image_box.width()) * image_box.height())/
+      ImageClip clip;
+      clip.scale = sqrt((1.0*image_box.width()) * image_box.height())/
         std::max(1.0, sqrt((1.0*screen_box.width()) * screen_box.height()));
-      double scale_out;
-      BBox2i region_out;
-      bool   highlight_nodata = m_shadow_thresh_view_mode;
+      clip.region = image_box;
+      clip.highlight_nodata = m_shadow_thresh_view_mode;
       if (m_shadow_thresh_view_mode){
-        m_shadow_thresh_images[i].img.get_image_clip(scale, image_box,
-                                                     highlight_nodata,
-                                                     qimg, scale_out, region_out);
+        clip.render.shadow_thresh = m_shadow_thresh;
       }else if (m_hillshade_mode[i]){
-        m_hillshaded_images[i].img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
-      }else{
-        // Original images
-        m_images[i].img.get_image_clip(scale, image_box,
-                                       highlight_nodata,
-                                       qimg, scale_out, region_out);
+        clip.render.hillshade  = true;
+        clip.render.azimuth    = m_hillshade_azimuth;
+        clip.render.elevation  = m_hillshade_elevation;
+        clip.render.pixel_size = m_images[i].ground_pixel_size();
       }
+      clip.name = m_images[i].name;
+      clips.push_back(clip);
+      clip_images.push_back(&m_images[i].img);
+      clip_image_indices.push_back(i);
+      clip_screen_boxes.push_back(screen_box);
+    }
+
+    // Read all the clips before drawing any, so that those of
+    // different images are read in parallel.
+    getImageClips(clip_images, clips);
+
+    for (size_t c = 0; c < clips.size(); c++) {
+
+      int i = clip_image_indices[c];
+      BBox2i const& screen_box = clip_screen_boxes[c];
+      QImage const& qimg       = clips[c].qimg;
+      double        scale_out  = clips[c].scale_out;
+      BBox2i const& region_out = clips[c].region_out;
 
       // Draw on image screen
       if (!m_use_georef){
@@ -996,7 +998,7 @@ namespace vw { namespace gui {
         paint->drawImage (rect, qimg2);
       }
 
-    } // End loop through input images
+    } // End loop through image clips
 
     // Call another function to handle drawing the interest points
     if ((static_cast<size_t>(m_image_id) < m_matches.size()) && m_view_matches) {
@@ -1007,6 +1009,61 @@ namespace vw { namespace gui {
   } // End function drawImage()
 
 
+  void MainWidget::getImageClips(std::vector<DiskImagePyramidMultiChannel const*> const& images,
+                                 std::vector<ImageClip> & clips) {
+
+    // Take the clips found in the cache, moving them to its front
+    std::vector<size_t> missing;
+    for (size_t c = 0; c < clips.size(); c++) {
+      bool found = false;
+      for (std::list<ImageClip>::iterator it = m_clip_cache.begin();
+           it != m_clip_cache.end(); it++) {
+        ClipRenderOptions const& a = it->render, & b = clips[c].render;
+        if (it->name == clips[c].name && it->scale == clips[c].scale &&
+            it->region == clips[c].region &&
+            it->highlight_nodata == clips[c].highlight_nodata &&
+            a.shadow_thresh == b.shadow_thresh && a.hillshade == b.hillshade &&
+            a.azimuth == b.azimuth && a.elevation == b.elevation) {
+          clips[c] = *it;
+          m_clip_cache.splice(m_clip_cache.begin(), m_clip_cache, it);
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        missing.push_back(c);
+    }
+    if (missing.empty())
+      return;
+
+    int num_threads = std::min(int(missing.size()),
+                               std::max(1, int(vw_settings().default_num_threads())));
+    if (num_threads == 1) {
+      for (size_t k = 0; k < missing.size(); k++) {
+        ImageClip & clip = clips[missing[k]];
+        images[missing[k]]->get_image_clip(clip.scale, clip.region, clip.highlight_nodata,
+                                           clip.qimg, clip.scale_out, clip.region_out,
+                                           clip.render);
+      }
+    } else {
+      FifoWorkQueue queue(num_threads);
+      for (size_t k = 0; k < missing.size(); k++) {
+        ImageClip & clip = clips[missing[k]];
+        boost::shared_ptr<ImageClipTask>
+          task(new ImageClipTask(*images[missing[k]], clip.scale, clip.region,
+                                 clip.highlight_nodata, clip.render,
+                                 clip.qimg, clip.scale_out, clip.region_out));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    for (size_t k = 0; k < missing.size(); k++)
+      m_clip_cache.push_front(clips[missing[k]]);
+    while (m_clip_cache.size() > std::max(MAX_NUM_CACHED_CLIPS, clips.size()))
+      m_clip_cache.pop_back();
+  }
+
   void MainWidget::drawInterestPoints(QPainter* paint, std::list<BBox2i> const& valid_regions) {
 
     QColor ipColor          = QColor("red"  ); // Hard coded interest point color
@@ -1039,30 +1096,48 @@ namespace vw { namespace gui {
         highlight_last = true;
     }
 
-    // For each IP...
-    for (size_t ip_iter = 0; ip_iter < ip.size(); ip_iter++) {
-      // Generate the pixel coord of the point
-      double x = ip[ip_iter].x;
-      double y = ip[ip_iter].y;
-      Vector2 P = world2screen(Vector2(x, y));
+    // Fetch only the points in view from the index. At low zoom, points
+    // closer than a couple of screen pixels are drawn as one.
+    updateMatchIndex();
+    BBox2 world_box;
+    for (std::list<BBox2i>::const_iterator i=valid_regions.begin(); i!=valid_regions.end(); ++i) {
+      world_box.grow(screen2world(Vector2(i->min())));
+      world_box.grow(screen2world(Vector2(i->max())));
+    }
+    double min_size = 2.0*norm_2(screen2world(Vector2(1, 0)) - screen2world(Vector2(0, 0)));
+    std::vector<Vector2> points;
+    if (!world_box.empty())
+      m_match_index.points_in_box(world_box, min_size, points);
+
+    // Draw them all at once, as round points
+    QPolygon batch;
+    batch.reserve(points.size());
+    for (size_t p = 0; p < points.size(); p++) {
+      Vector2 P = world2screen(points[p]);
       QPoint Q(P.x(), P.y());
 
       // Skip the point if none of the valid regions contain it
-      bool safe = false;
       for (std::list<QRect>::const_iterator i=qrect_list.begin(); i!=qrect_list.end(); ++i) {
         if (i->contains(Q)) { // Verify the conversion worked
-          safe = true;
+          batch.push_back(Q);
           break;
         }
       }
-      if (!safe)
-        continue;
-
-      if (highlight_last && (ip_iter == ip.size()-1)) // Highlighting the last point
-        paint->setPen(ipHighlightColor);
+    }
+    paint->setPen(QPen(ipColor, 5, Qt::SolidLine, Qt::RoundCap));
+    paint->drawPoints(batch);
 
-      paint->drawEllipse(Q, 2, 2); // Draw the point!
-    } // End loop through points
+    if (highlight_last) {
+      Vector2 P = world2screen(Vector2(ip.back().x, ip.back().y));
+      QPoint Q(P.x(), P.y());
+      for (std::list<QRect>::const_iterator i=qrect_list.begin(); i!=qrect_list.end(); ++i) {
+        if (i->contains(Q)) {
+          paint->setPen(ipHighlightColor);
+          paint->drawEllipse(Q, 2, 2);
+          break;
+        }
+      }
+    }
   } // End function drawInterestPoints
 
 
@@ -1129,7 +1204,7 @@ namespace vw { namespace gui {
     return;
   }
 
-  void MainWidget::paintEvent(QPaintEvent * /* event */) {
+  void MainWidget::paintEvent(QPaintEvent * event) {
 
     if (m_firstPaintEvent){
       // This will be called the very first time the display is
@@ -1195,7 +1270,11 @@ namespace vw { namespace gui {
                             poly);
     }
     
-    // Plot the polygon being drawn now, and pre-existing polygons
+    // Plot the polygon being drawn now, and pre-existing polygons,
+    // skipping those away from the region being redrawn
+    updateWorldPolys();
+    BBox2 redraw_box = screen2world(BBox2(event->rect().left(),  event->rect().top(),
+                                          event->rect().width(), event->rect().height()));
     for (size_t polyIter = 0; polyIter < m_polyVec.size() + 1; polyIter++){
       
       vw::geometry::dPoly poly;
@@ -1212,21 +1291,15 @@ namespace vw { namespace gui {
 			   vw::geometry::vecPtr(m_currPolyX),  
 			   vw::geometry::vecPtr(m_currPolyY),  
 			   isPolyClosed, polyColorStr, layer);
+        poly = polyToWorld(poly);
       }else{
-	poly = m_polyVec[polyIter-1]; // make a deep copy
-      }
-      
-      double val1 = vw::geometry::signedPolyArea(poly.get_totalNumVerts(),
-					 poly.get_xv(), poly.get_yv());
-
-      // Convert to world units
-      int            numVerts  = poly.get_totalNumVerts();
-      double *             xv  = poly.get_xv();
-      double *             yv  = poly.get_yv();
-      for (int vIter = 0; vIter < numVerts; vIter++){
-	Vector2 P = projpoint2world(Vector2(xv[vIter], yv[vIter]), m_polyVecIndex); 
-	xv[vIter] = P.x();
-	yv[vIter] = P.y();
+        BBox2 const& B = m_worldPolyBoxes[polyIter-1];
+        double pad = 4.0*(redraw_box.width()/std::max(1, event->rect().width()));
+        if (B.empty() || B.min().x() > redraw_box.max().x() + pad ||
+            B.max().x() < redraw_box.min().x() - pad ||
+            B.min().y() > redraw_box.max().y() + pad ||
+            B.max().y() < redraw_box.min().y() - pad)
+          continue;
       }
 
       if (polyIter > 0 && m_polyEditMode && m_moveVertex->isChecked()) {
@@ -1237,18 +1310,11 @@ namespace vw { namespace gui {
 	plotPoints = false;
       }
 
-      double val2 = vw::geometry::signedPolyArea(poly.get_totalNumVerts(),
-					 poly.get_xv(), poly.get_yv());
-
-      // If the conversion to world coords flips the orientation, correct for that.
-      // TODO: This seems necessary. More thought is needed. 
-      if (val1 * val2 < 0)
-	poly.reverse();
-
       MainWidget::plotDPoly(plotPoints, plotEdges, m_showPolysFilled->isChecked(),
                             m_showIndices->isChecked(),
                             lineWidth,  
-			    drawVertIndex, polyColor, paint, poly);
+			    drawVertIndex, polyColor, paint,
+                            (polyIter == 0) ? poly : m_worldPolyVec[polyIter-1]);
     }
 
   } // end paint event
@@ -1297,14 +1363,15 @@ namespace vw { namespace gui {
       
       // Find the vertex we want to move
       double min_x, min_y, min_dist;
-      findClosestPolyVertex(// inputs
-			    P.x(), P.y(), m_polyVec,
-			    // outputs
-			    m_editPolyVecIndex,
-			    m_editIndexInCurrPoly,
-			    m_editVertIndexInCurrPoly,
-			    min_x, min_y, min_dist
-			    );
+      updatePolyIndex();
+      m_polyIndex.findClosestVertex(// inputs
+                                    P.x(), P.y(),
+                                    // outputs
+                                    m_editPolyVecIndex,
+                                    m_editIndexInCurrPoly,
+                                    m_editVertIndexInCurrPoly,
+                                    min_x, min_y, min_dist
+                                    );
       
       // This will redraw just the polygons, not the pixmap
       update();
@@ -1384,12 +1451,19 @@ namespace vw { namespace gui {
       
       m_world_box.grow(P); // to not cut when plotting later
       P = world2projpoint(P, m_polyVecIndex); // projected units
+      QRect dirty = vertexNeighborhood(m_editPolyVecIndex, m_editIndexInCurrPoly,
+                                       m_editVertIndexInCurrPoly);
       m_polyVec[m_editPolyVecIndex].changeVertexValue(m_editIndexInCurrPoly,
                                                       m_editVertIndexInCurrPoly,
                                                       P.x(), P.y());
+      polyVecChanged(m_editPolyVecIndex);
       
-      // This will redraw just the polygons, not the pixmap
-      update();
+      // This will redraw just the polygons near the vertex, not the pixmap
+      if (m_showIndices->isChecked())
+        update(); // the indices may be drawn anywhere
+      else
+        update(dirty.united(vertexNeighborhood(m_editPolyVecIndex, m_editIndexInCurrPoly,
+                                               m_editVertIndexInCurrPoly)));
 
       return;
     }
@@ -1619,10 +1693,102 @@ namespace vw { namespace gui {
     }else{
       m_polyVec.back().appendPolygons(P);
     }
+    polyVecChanged(m_polyVec.size() - 1);
     
     return;
   }
   
+  // Convert a polygon in projected units to world coordinates
+  vw::geometry::dPoly MainWidget::polyToWorld(vw::geometry::dPoly const& projPoly) const {
+
+    vw::geometry::dPoly poly = projPoly; // make a deep copy
+    double val1 = vw::geometry::signedPolyArea(poly.get_totalNumVerts(),
+                                               poly.get_xv(), poly.get_yv());
+
+    int            numVerts  = poly.get_totalNumVerts();
+    double *             xv  = poly.get_xv();
+    double *             yv  = poly.get_yv();
+    for (int vIter = 0; vIter < numVerts; vIter++){
+      Vector2 P = projpoint2world(Vector2(xv[vIter], yv[vIter]), m_polyVecIndex); 
+      xv[vIter] = P.x();
+      yv[vIter] = P.y();
+    }
+
+    double val2 = vw::geometry::signedPolyArea(poly.get_totalNumVerts(),
+                                               poly.get_xv(), poly.get_yv());
+
+    // If the conversion to world coords flips the orientation, correct for that.
+    // TODO: This seems necessary. More thought is needed. 
+    if (val1 * val2 < 0)
+      poly.reverse();
+
+    return poly;
+  }
+
+  // Note that a layer of m_polyVec, or all of them if the layer is
+  // negative, changed, so that what is found from them is found again.
+  void MainWidget::polyVecChanged(int layer) {
+    m_polyIndexStale = true;
+    if (layer < 0)
+      m_allPolysStale = true;
+    else
+      m_stalePolys.insert(layer);
+  }
+
+  void MainWidget::updateWorldPolys() {
+    if (m_worldPolyVec.size() != m_polyVec.size())
+      m_allPolysStale = true;
+    if (m_allPolysStale) {
+      m_worldPolyVec.resize(m_polyVec.size());
+      m_worldPolyBoxes.resize(m_polyVec.size());
+      m_stalePolys.clear();
+      for (size_t layer = 0; layer < m_polyVec.size(); layer++)
+        m_stalePolys.insert(layer);
+      m_allPolysStale = false;
+    }
+    for (std::set<int>::const_iterator it = m_stalePolys.begin();
+         it != m_stalePolys.end(); it++) {
+      if (*it >= (int)m_polyVec.size())
+        continue;
+      vw::geometry::dPoly & poly = m_worldPolyVec[*it];
+      poly = polyToWorld(m_polyVec[*it]);
+      m_worldPolyBoxes[*it] = BBox2();
+      if (poly.get_totalNumVerts() > 0) {
+        double xll, yll, xur, yur;
+        poly.bdBox(xll, yll, xur, yur);
+        m_worldPolyBoxes[*it] = BBox2(Vector2(xll, yll), Vector2(xur, yur));
+      }
+    }
+    m_stalePolys.clear();
+  }
+
+  void MainWidget::updatePolyIndex() {
+    if (!m_polyIndexStale)
+      return;
+    m_polyIndex.build(m_polyVec);
+    m_polyIndexStale = false;
+  }
+
+  // The region on screen of the edges at a vertex of m_polyVec
+  QRect MainWidget::vertexNeighborhood(int vecIndex, int polyIndex, int vertIndex) const {
+    vw::geometry::dPoly const& poly = m_polyVec[vecIndex];
+    const int * numVerts = poly.get_numVerts();
+    int start = 0;
+    for (int pIter = 0; pIter < polyIndex; pIter++)
+      start += numVerts[pIter];
+    int n = numVerts[polyIndex];
+
+    BBox2 box;
+    for (int k = -1; k <= 1; k++) {
+      int v = start + ((vertIndex + k) % n + n) % n;
+      box.grow(world2screen(projpoint2world(Vector2(poly.get_xv()[v], poly.get_yv()[v]),
+                                            m_polyVecIndex)));
+    }
+    int pad = 10; // for the lines and the vertex squares
+    return QRect(int(floor(box.min().x())) - pad, int(floor(box.min().y())) - pad,
+                 int(ceil(box.width())) + 2*pad + 1, int(ceil(box.height())) + 2*pad + 1);
+  }
+  
   // Add a point to the polygon being drawn or stop drawing and append
   // the drawn polygon to the list of polygons. This polygon
   // is in the world coordinate system. When we append it to m_polyVec,
@@ -1720,20 +1886,22 @@ namespace vw { namespace gui {
 
     double min_x, min_y, min_dist;
     int polyVecIndex, polyIndexInCurrPoly, vertIndexInCurrPoly;
-    findClosestPolyVertex(// inputs
-			  P.x(), P.y(), m_polyVec,
-			  // outputs
-			  polyVecIndex,
-			  polyIndexInCurrPoly,
-			  vertIndexInCurrPoly,
-			  min_x, min_y, min_dist
-			  );
+    updatePolyIndex();
+    m_polyIndex.findClosestVertex(// inputs
+                                  P.x(), P.y(),
+                                  // outputs
+                                  polyVecIndex,
+                                  polyIndexInCurrPoly,
+                                  vertIndexInCurrPoly,
+                                  min_x, min_y, min_dist
+                                  );
 
     if (polyVecIndex        < 0 ||
 	polyIndexInCurrPoly < 0 ||
 	vertIndexInCurrPoly < 0) return;
     
     m_polyVec[polyVecIndex].eraseVertex(polyIndexInCurrPoly, vertIndexInCurrPoly);
+    polyVecChanged(polyVecIndex);
 
     // This will redraw just the polygons, not the pixmap
     update();
@@ -1748,8 +1916,17 @@ namespace vw { namespace gui {
       return;
     }
 
+    updateWorldPolys();
     for (size_t layerIter = 0; layerIter < m_polyVec.size(); layerIter++) {
 
+      // A layer away from the selection keeps all its vertices
+      BBox2 const& B = m_worldPolyBoxes[layerIter];
+      if (B.empty() || B.min().x() > m_stereoCropWin.max().x() ||
+          B.max().x() < m_stereoCropWin.min().x() ||
+          B.min().y() > m_stereoCropWin.max().y() ||
+          B.max().y() < m_stereoCropWin.min().y())
+        continue;
+
       // TODO: This lower level code should be moved to VW
 
       vw::geometry::dPoly & poly     = m_polyVec[layerIter]; // alias
@@ -1792,6 +1969,7 @@ namespace vw { namespace gui {
 
       // Overwrite the polygon
       m_polyVec[layerIter] = poly_out;
+      polyVecChanged(layerIter);
     }      
 
     // The selection has done its job
@@ -1822,14 +2000,15 @@ namespace vw { namespace gui {
     // when one searches for closest edge, not vertex. 
     double min_x, min_y, min_dist;
     int polyVecIndex, polyIndexInCurrPoly, vertIndexInCurrPoly;
-    findClosestPolyEdge(// inputs
-			  P.x(), P.y(), m_polyVec,
-			  // outputs
-			  polyVecIndex,
-			  polyIndexInCurrPoly,
-			  vertIndexInCurrPoly,
-			  min_x, min_y, min_dist
-			  );
+    updatePolyIndex();
+    m_polyIndex.findClosestEdge(// inputs
+                                P.x(), P.y(),
+                                // outputs
+                                polyVecIndex,
+                                polyIndexInCurrPoly,
+                                vertIndexInCurrPoly,
+                                min_x, min_y, min_dist
+                                );
 
     if (polyVecIndex        < 0 ||
 	polyIndexInCurrPoly < 0 ||
@@ -1839,6 +2018,7 @@ namespace vw { namespace gui {
     m_polyVec[polyVecIndex].insertVertex(polyIndexInCurrPoly,
 					 vertIndexInCurrPoly + 1,
 					 P.x(), P.y());
+    polyVecChanged(polyVecIndex);
     
     // This will redraw just the polygons, not the pixmap
     update();
@@ -1849,6 +2029,7 @@ namespace vw { namespace gui {
   // Merge existing polygons
   void MainWidget::mergePolys(){
     vw::gui::mergePolys(m_polyVec);
+    polyVecChanged();
   }
   
   // Save the currently created vector layer
@@ -2051,15 +2232,13 @@ namespace vw { namespace gui {
             paint.drawPolygon( pa );
           }else{
             // In some versions of Qt, drawPolygon is buggy when not
-            // called to fill polygons. Don't use it, just draw the
-            // edges one by one.
+            // called to fill polygons. Don't use it, draw the edges
+            // as separate lines, all in one call.
             int n = pa.size();
-            for (int k = 0; k < n; k++){
-              QPolygon pb;
-              int x0, y0; pa.point(k, &x0, &y0);       pb << QPoint(x0, y0);
-              int x1, y1; pa.point((k+1)%n, &x1, &y1); pb << QPoint(x1, y1);
-              paint.drawPolyline(pb);
-            }
+            QVector<QLine> edges(n);
+            for (int k = 0; k < n; k++)
+              edges[k] = QLine(pa[k], pa[(k+1)%n]);
+            paint.drawLines(edges);
           }
 
         }else{
@@ -2213,6 +2392,7 @@ namespace vw { namespace gui {
 	  m_polyVec[m_editPolyVecIndex].changeVertexValue(m_editIndexInCurrPoly,
 							  m_editVertIndexInCurrPoly,
 							  P.x(), P.y());
+	  polyVecChanged(m_editPolyVecIndex);
 	  
 
 	  // These are no longer needed for the time being
@@ -2582,9 +2762,18 @@ namespace vw { namespace gui {
     }
 
     m_view_matches = view_matches;
+    m_match_index_dirty = true; // the matches are loaded or edited before this is called
     refreshPixmap();
   }
 
+  void MainWidget::updateMatchIndex() {
+    std::vector<vw::ip::InterestPoint> const& ip = m_matches[m_image_id];
+    if (!m_match_index_dirty && m_match_index.size() == ip.size())
+      return;
+    m_match_index.build(ip);
+    m_match_index_dirty = false;
+  }
+
   void MainWidget::addMatchPoint(){
 
     if (m_image_id >= (int)m_matches.size()) {
@@ -2661,17 +2850,8 @@ namespace vw { namespace gui {
 
     // Delete the closest match to this point.
     Vector2 P = screen2world(Vector2(m_mousePrsX, m_mousePrsY));
-    double min_dist = std::numeric_limits<double>::max();
-    int min_index = -1;
-    std::vector<vw::ip::InterestPoint> & ip = m_matches[m_image_id]; // alias
-    for (size_t ip_iter = 0; ip_iter < ip.size(); ip_iter++) {
-      Vector2 Q(ip[ip_iter].x, ip[ip_iter].y);
-      double curr_dist = norm_2(Q-P);
-      if (curr_dist < min_dist) {
-        min_dist = curr_dist;
-        min_index = ip_iter;
-      }
-    }
+    updateMatchIndex();
+    int min_index = m_match_index.closest_point(P);
     if (min_index >= 0) {
       for (size_t vec_iter = 0; vec_iter < m_matches.size(); vec_iter++) {
         m_matches[vec_iter].erase(m_matches[vec_iter].begin() + min_index);
@@ -2807,7 +2987,7 @@ namespace vw { namespace gui {
     m_hillshade_azimuth = a;
     m_hillshade_elevation = e;
 
-    MainWidget::maybeGenHillshade();
+    MainWidget::checkHillshadeMode();
     refreshPixmap();
 
     vw_out() << "Hillshade azimuth and elevation for " << m_image_files[0]
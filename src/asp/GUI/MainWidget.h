@@ -337,22 +337,43 @@ public slots:
     double m_shadow_thresh;
     bool   m_shadow_thresh_calc_mode;
     bool   m_shadow_thresh_view_mode;
-    std::vector<imageData> m_shadow_thresh_images;
-
-    std::vector<imageData> m_hillshaded_images;
     std::set<int> m_indicesWithAction;
     
     bool m_view_matches; ///< Control if IP's are drawn
+    MatchPointIndex m_match_index;       ///< Of the IP's of this image
+    bool            m_match_index_dirty; ///< If the matches may have changed since indexed
 
     bool m_zoom_all_to_same_region; // if all widgets are forced to zoom to same region
     bool & m_allowMultipleSelections; // alias, this is controlled from MainWindow for all widgets
     bool m_can_emit_zoom_all_signal; 
 
+    /// A rendered clip of an image, as returned by get_image_clip(),
+    /// kept so that redrawing an unchanged view, or going back to a
+    /// recent one, needs no reading from disk.
+    struct ImageClip {
+      std::string name;
+      double      scale;
+      BBox2i      region;
+      bool        highlight_nodata;
+      ClipRenderOptions render;
+      QImage      qimg;
+      double      scale_out;
+      BBox2i      region_out;
+    };
+    std::list<ImageClip> m_clip_cache; ///< The most recently used clip first
+
+    /// Fetch the clips not in the cache in parallel, add them to the
+    /// cache, and return them all in the same order as the requests.
+    void getImageClips(std::vector<DiskImagePyramidMultiChannel const*> const& images,
+                       std::vector<ImageClip> & clips);
+
     // Drawing is driven by QPaintEvent, which calls out to drawImage()
     void drawImage(QPainter* paint);
     /// Add all the interest points to the provided canvas
     /// - Called internally by drawImage
     void drawInterestPoints(QPainter* paint, std::list<BBox2i> const& valid_regions);
+    /// Index the IP's of this image again if they may have changed
+    void updateMatchIndex();
 
     vw::Vector2 world2screen(vw::Vector2 const& p) const;
     vw::Vector2 screen2world(vw::Vector2 const& pix) const;
@@ -369,7 +390,7 @@ public slots:
     void updateCurrentMousePosition();
     void updateRubberBand(QRect & R);
     void refreshPixmap();
-    void maybeGenHillshade();
+    void checkHillshadeMode();
     void showImage(std::string const& image_name);
     void bringImageOnTop(int image_index);
     void pushImageToBottom(int image_index);
@@ -377,6 +398,19 @@ public slots:
     // For polygon drawing
     bool m_polyEditMode;
     std::vector<vw::geometry::dPoly> m_polyVec;
+
+    /// Found from m_polyVec, and found again after it changes
+    PolySegmentIndex                 m_polyIndex;      ///< For hit testing
+    std::vector<vw::geometry::dPoly> m_worldPolyVec;   ///< In world coordinates, for drawing
+    std::vector<BBox2>               m_worldPolyBoxes; ///< Of each layer, in world coordinates
+    std::set<int>                    m_stalePolys;     ///< Layers to convert to world coordinates again
+    bool                             m_allPolysStale, m_polyIndexStale;
+    vw::geometry::dPoly polyToWorld(vw::geometry::dPoly const& projPoly) const;
+    void  polyVecChanged(int layer = -1);
+    void  updateWorldPolys();
+    void  updatePolyIndex();
+    QRect vertexNeighborhood(int vecIndex, int polyIndex, int vertIndex) const;
+
     int m_polyVecIndex; // which of the current images owns the poly vector layer
     vw::Vector2 m_startPix; // The first poly vertex being drawn in world coords
     std::vector<double> m_currPolyX, m_currPolyY;
@@ -25,6 +25,7 @@
 #include <asp/GUI/MainWindow.h>
 #include <asp/GUI/MainWidget.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/MatchFile.h>
 using namespace asp;
 using namespace vw::gui;
 
@@ -725,7 +726,7 @@ void MainWindow::viewMatches(){
 	// does not appear prompt the user or a path.
 	std::vector<vw::ip::InterestPoint> left, right;
 	try {
-	  ip::read_binary_match_file(match_file, left, right);
+	  asp::read_match_file(match_file, left, right);
 	}catch(...){
 	  try {
 	    match_file = fileDialog("Manually select the match file...", m_output_prefix);
@@ -745,7 +746,7 @@ void MainWindow::viewMatches(){
 
 	  if (match_file != "") {
 	    vw_out() << "Loading " << match_file << std::endl;
-	    ip::read_binary_match_file(match_file, left, right);
+	    asp::read_match_file(match_file, left, right);
 	  }
         
 	  if (i == 0) m_matches[i] = left;
@@ -43,12 +43,19 @@
 // disp(sprintf('saving file %s', file));
 // save(file, 'G', '-ascii', '-double');
 
-// Optionally, grouping the points by track can be done, by parsing
-// the LOLA RDR file, but this was not helpful.
+// The CSV file is read in chunks of lines, which are filtered in
+// parallel and written in file order. With --use-point-cache, the
+// points are read from the binary cache of the CSV file instead,
+// which is written the first time.
+
+// Grouping the points by track, by parsing the time column of the
+// LOLA RDR file, was tried, but was not helpful, and was removed.
 
 // This is work in progess.
 
+#include <vw/Core/Settings.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Image.h>
@@ -61,11 +68,14 @@
 #include <asp/Core/PointUtils.h>
 
 #include <limits>
-#include <cstring>
-#include <ctime>
+#include <map>
+#include <sstream>
+#include <utility>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 
@@ -78,8 +88,9 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::string csv_file, reference_dem;
   double max_height_diff;
   std::string projected_point_file, projected_grid, interpolated_csv, interpolated_dem;
+  bool use_point_cache;
   
-  Options():max_height_diff(-1){}
+  Options():max_height_diff(-1), use_point_cache(false){}
 
 };
 
@@ -95,7 +106,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("projected-point-file",  po::value(&opt.projected_point_file)->default_value(""), "After reading the CSV file entries and filtering them, write them in projected coordinates (projected x, projected y, height above datum).")
     ("projected-grid",  po::value(&opt.projected_grid)->default_value(""), "After reading the CSV file entries and filtering them, write the x, y grid at which we want these values interpolated using natural neighbor.")
     ("interpolated-csv",  po::value(&opt.interpolated_csv)->default_value(""), "Read from disk the CSV values interpolated on the grid.")
-    ("interpolated-dem",  po::value(&opt.interpolated_dem)->default_value(""), "Write the interpolated values as a DEM.");
+    ("interpolated-dem",  po::value(&opt.interpolated_dem)->default_value(""), "Write the interpolated values as a DEM.")
+    ("use-point-cache",  po::bool_switch(&opt.use_point_cache)->default_value(false)->implicit_value(true),
+     "Read the CSV file from a binary cache next to it, named <file>.asp-cache, the same as pc_align uses, rather than parsing it. The cache is written in the first run, and remade if the file, the CSV format, or the datum changes.");
     
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -136,34 +149,213 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
  
 }
 
-// Convert 2009-09-21T23:32:28.76345700 to seconds
-double parse_time(std::string& time_str){
-  int year, month, day, hour, min;
-  double sec;
+// The points of one chunk of the CSV file, in file order
+struct CsvChunk {
+  std::string          text;         // The lines, unless read from the point cache
+  std::vector<Vector3> xyz;          // The points parsed, in ECEF
+  std::vector<Vector2> cache_lonlat; // For writing the point cache
+  std::vector<double>  file_lon;
+  std::string          output;       // The points kept, projected, as text
+  size_t               num_kept;
+  CsvChunk(): num_kept(0){}
+};
 
-  // Replace all '-' and 'T' and ':' with spaces to scan things easier
-  char * str = const_cast<char*>(time_str.c_str());
-  for (size_t i = 0; i < time_str.size(); i++){
-    if (str[i] == 'T' || str[i] == ':' || str[i] == '-')
-      str[i] = ' ';
+// Parse the lines of a chunk, unless it is from the point cache, and
+// keep the points close enough to the DEM.
+class CsvFilterTask: public Task, private boost::noncopyable {
+  asp::CsvConv          const& m_csv_conv;
+  GeoReference                 m_csv_georef, m_dem_georef;
+  DiskImageView<double> const& m_dem;
+  double                       m_dem_nodata, m_max_height_diff;
+  bool                         m_write_cache, m_is_file_start;
+  CsvChunk                   & m_chunk;
+
+  // The heights of the DEM at the points, by the 256 x 256 DEM block
+  // they are in, so each block is read once.
+  void interpolate_dem(std::vector<Vector2> const& pix,
+                       std::map< std::pair<int, int>, std::vector<size_t> > const& buckets,
+                       std::vector< PixelMask<double> > & dem_ht) const {
+    const int block_size = 256;
+    typedef std::map< std::pair<int, int>, std::vector<size_t> >::const_iterator BucketIter;
+    for (BucketIter it = buckets.begin(); it != buckets.end(); it++) {
+      // Bicubic interpolation also needs a pixel before the block and
+      // two after it. At the DEM boundary the edge extension of the
+      // crop is the same as the one of the whole DEM.
+      BBox2i box(it->first.second*block_size - 1, it->first.first*block_size - 1,
+                 block_size + 3, block_size + 3);
+      box.crop(bounding_box(m_dem));
+      ImageView<double> block = crop(m_dem, box);
+      ImageViewRef< PixelMask<double> > interp_block
+        = interpolate(create_mask(block, m_dem_nodata),
+                      BicubicInterpolation(), ConstantEdgeExtension());
+      std::vector<size_t> const& indices = it->second;
+      for (size_t k = 0; k < indices.size(); k++) {
+        Vector2 p = pix[indices[k]] - box.min();
+        dem_ht[indices[k]] = interp_block(p[0], p[1]);
+      }
+    }
   }
-  
-  if (sscanf(time_str.c_str(), "%d %d %d %d %d %lf", &year, &month, &day, &hour, &min, &sec) != 6 )
-    vw_throw(ArgumentErr() << "Could not parse time: " << time_str << ".\n");
-
-  struct tm t = {0};  // Initalize to all 0's
-  t.tm_year = year - 1900;  // This is year-1900, so 112 = 2012
-  t.tm_mon = month - 1; // month must start from 0
-  t.tm_mday = day;
-  t.tm_hour = hour;
-  t.tm_min = min;
-  t.tm_sec = sec;
-  time_t timeSinceEpoch = mktime(&t); // for some reason, the answer I get is off by an hour. Dunno.
-
-  return double(timeSinceEpoch) + (sec - int(sec)); // add back the fractional part
+
+public:
+  CsvFilterTask(asp::CsvConv const& csv_conv,
+                GeoReference const& csv_georef, GeoReference const& dem_georef,
+                DiskImageView<double> const& dem, double dem_nodata,
+                double max_height_diff, bool write_cache, bool is_file_start,
+                CsvChunk & chunk):
+    m_csv_conv(csv_conv), m_csv_georef(csv_georef), m_dem_georef(dem_georef),
+    m_dem(dem), m_dem_nodata(dem_nodata), m_max_height_diff(max_height_diff),
+    m_write_cache(write_cache), m_is_file_start(is_file_start), m_chunk(chunk){}
+
+  // The georeferences are copied for each task, as their projections
+  // cannot be shared between threads.
+  void operator()() {
+
+    if (!m_chunk.text.empty()) {
+      std::vector<asp::CsvConv::CsvRecord> records;
+      m_csv_conv.parse_csv_chunk(m_chunk.text, m_is_file_start, records);
+      std::string().swap(m_chunk.text); // Free the memory
+      for (size_t i = 0; i < records.size(); i++) {
+        Vector3 xyz = m_csv_conv.csv_to_cartesian(records[i], m_csv_georef);
+        m_chunk.xyz.push_back(xyz);
+        if (m_write_cache) {
+          Vector3 llh = m_csv_georef.datum().cartesian_to_geodetic(xyz);
+          m_chunk.cache_lonlat.push_back(subvector(llh, 0, 2));
+          m_chunk.file_lon.push_back(m_csv_conv.csv_to_lonlat(records[i], m_csv_georef)[0]);
+        }
+      }
+    }
+
+    // Find the DEM pixels of the points, and bucket them by DEM block
+    const int block_size = 256;
+    int num_block_cols = (m_dem.cols() + block_size - 1)/block_size;
+    int num_block_rows = (m_dem.rows() + block_size - 1)/block_size;
+    size_t num_points = m_chunk.xyz.size();
+    std::vector<Vector3> llh(num_points);
+    std::vector<Vector2> pix(num_points);
+    std::map< std::pair<int, int>, std::vector<size_t> > buckets;
+    for (size_t it = 0; it < num_points; it++) {
+      Vector3 xyz = m_chunk.xyz[it];
+      if (xyz == Vector3() || xyz != xyz)
+        continue; // invalid point
+      llh[it] = m_dem_georef.datum().cartesian_to_geodetic(xyz);
+      pix[it] = m_dem_georef.lonlat_to_pixel(subvector(llh[it], 0, 2));
+
+      // Check for out of range
+      if (pix[it][0] < 0 || pix[it][0] > m_dem.cols() - 1 ||
+          pix[it][1] < 0 || pix[it][1] > m_dem.rows() - 1)
+        continue;
+      int bc = std::min(num_block_cols - 1, (int)floor(pix[it][0])/block_size);
+      int br = std::min(num_block_rows - 1, (int)floor(pix[it][1])/block_size);
+      buckets[std::make_pair(br, bc)].push_back(it);
+    }
+
+    std::vector< PixelMask<double> > dem_ht(num_points); // invalid by default
+    interpolate_dem(pix, buckets, dem_ht);
+
+    // Keep the points close enough to the DEM, in file order
+    GeodeticToPoint G2P(m_dem_georef);
+    std::ostringstream os;
+    os.precision(17);
+    for (size_t it = 0; it < num_points; it++) {
+      if (!is_valid(dem_ht[it]))
+        continue;
+      double diff = llh[it][2] - dem_ht[it].child();
+      if (std::abs(diff) > m_max_height_diff)
+        continue;
+      Vector3 point = G2P(llh[it]); // geodetic to point
+      os << point[0] << ' ' << point[1] << ' ' << point[2] << '\n';
+      m_chunk.num_kept++;
+    }
+    m_chunk.output = os.str();
+  }
+};
+
+// Filter the CSV points and save the ones kept in the projected
+// coordinate system. The chunks of a batch are filtered in parallel,
+// and written in file order, so the memory is bounded by the batch
+// size. With the point cache, it is read instead of the CSV file if
+// valid, and else it is written as the CSV file is read.
+void filter_csv_points(Options const& opt, asp::CsvConv const& csv_conv,
+                       GeoReference const& csv_georef, GeoReference const& dem_georef,
+                       DiskImageView<double> const& dem, double dem_nodata) {
+
+  boost::scoped_ptr<asp::PointCacheReader> cache_reader;
+  boost::scoped_ptr<asp::PointCacheWriter> cache_writer;
+  std::ifstream ifs;
+  if (opt.use_point_cache && asp::point_cache_is_valid(opt.csv_file, csv_conv, csv_georef)) {
+    vw_out() << "Using point cache: " << asp::point_cache_file(opt.csv_file) << std::endl;
+    cache_reader.reset(new asp::PointCacheReader(asp::point_cache_file(opt.csv_file)));
+  } else {
+    ifs.open(opt.csv_file.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs)
+      vw_throw( IOErr() << "Unable to open file \"" << opt.csv_file << "\"" );
+    if (opt.use_point_cache)
+      cache_writer.reset(new asp::PointCacheWriter(opt.csv_file, csv_conv, csv_georef));
+  }
+
+  std::ofstream phandle(opt.projected_point_file.c_str());
+  if (!phandle)
+    vw_throw( IOErr() << "Unable to open file \"" << opt.projected_point_file << "\"" );
+  vw_out() << "Saving the values in the projected coordiante system to: "
+           << opt.projected_point_file << std::endl;
+
+  Stopwatch sw;
+  sw.start();
+  int num_threads = vw_settings().default_num_threads();
+  int chunks_per_batch = 2*num_threads;
+  bool is_file_start = true, done = false;
+  boost::uint64_t num_points = 0, num_kept = 0;
+  while (!done) {
+
+    std::vector<CsvChunk> chunks(chunks_per_batch);
+    int num_chunks = 0;
+    FifoWorkQueue queue(num_threads);
+    for (; num_chunks < chunks_per_batch; num_chunks++) {
+      CsvChunk & chunk = chunks[num_chunks];
+      if (cache_reader) {
+        std::vector<double> x, y, z, lon, lat;
+        if (!cache_reader->read_chunk(x, y, z, lon, lat)) {
+          done = true;
+          break;
+        }
+        chunk.xyz.resize(x.size());
+        for (size_t i = 0; i < x.size(); i++)
+          chunk.xyz[i] = Vector3(x[i], y[i], z[i]);
+      } else if (!asp::read_csv_chunk(ifs, chunk.text)) {
+        done = true;
+        break;
+      }
+      boost::shared_ptr<CsvFilterTask>
+        task(new CsvFilterTask(csv_conv, csv_georef, dem_georef, dem, dem_nodata,
+                               opt.max_height_diff, bool(cache_writer), is_file_start, chunk));
+      queue.add_task(task);
+      is_file_start = false;
+    }
+    queue.join_all();
+
+    for (int k = 0; k < num_chunks; k++) {
+      CsvChunk const& chunk = chunks[k];
+      phandle << chunk.output;
+      num_points += chunk.xyz.size();
+      num_kept   += chunk.num_kept;
+      if (cache_writer) {
+        for (size_t i = 0; i < chunk.xyz.size(); i++)
+          cache_writer->add(chunk.xyz[i], chunk.cache_lonlat[i], chunk.file_lon[i]);
+      }
+    }
+  }
+
+  phandle.close();
+  if (!phandle)
+    vw_throw( IOErr() << "Failed writing: " << opt.projected_point_file << "\n" );
+  if (cache_writer)
+    cache_writer->close();
+
+  sw.stop();
+  vw_out() << "Kept " << num_kept << " out of " << num_points << " points, in "
+           << sw.elapsed_seconds() << " seconds.\n";
 }
 
-  
 int main(int argc, char *argv[]) {
 
   Options opt;
@@ -193,30 +385,6 @@ int main(int argc, char *argv[]) {
     if (opt.datum != "")
       csv_georef.set_datum(opt.datum);
 
-    // Read the CSV file
-    std::list<asp::CsvConv::CsvRecord> csv_records;
-    typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-    csv_conv.read_csv_file(opt.csv_file, csv_records);
-    
-    std::vector<Vector3> csv_llh;
-    std::vector<double> timestamp;
-    std::vector<std::string> timestamp_str;
-    for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-      Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
-      if (xyz == Vector3() || xyz != xyz)
-	continue; // invalid point
-      Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
-      csv_llh.push_back(llh);
-
-#if 0
-      // Turn off parsing the time column
-      std::string time_str = iter->file;
-      double val = parse_time(time_str);
-      timestamp.push_back(val);
-      timestamp_str.push_back(time_str);
-#endif
-    }
-    
     // Read the DEM
     DiskImageView<double> dem(opt.reference_dem);
     
@@ -231,119 +399,10 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    // We will interpolate into the DEM to find the difference
-    ImageViewRef< PixelMask<double> > interp_dem
-      = interpolate(create_mask(dem, dem_nodata),
-		    BicubicInterpolation(), ConstantEdgeExtension());
-
-    // Object used to do geodetic_to_point
-    GeodeticToPoint G2P(dem_georef);
-
-    // If two time stamps differ by more than this, we declare them in
-    // different groups.
-    //double spacing = 60;
-    int group_id = -1;
-    //int prev_it = -1;
-    double group_size = 0;
-    double group_sum = 0;
-    std::vector<double> means;
-    std::vector<std::string> timestamp_str_sub;
-    
-    std::vector<Vector3> llh_vec;
-    std::vector<int> group_ids;
-    
     if (opt.projected_point_file != "" && opt.projected_grid != ""){
 
       // Filter CSV points and save them. Also save the grid for interpolation.
-      
-      std::ofstream phandle(opt.projected_point_file.c_str());
-      phandle.precision(17);
-
-      //std::ofstream bf("tmp_before.txt");
-      //bf.precision(18);
-      
-      vw_out() << "Saving the values in the projected coordiante system to: "
-	       << opt.projected_point_file << std::endl;
-      for (int it = 0; it < int(csv_llh.size()); it++) {
-      
-	Vector3 llh = csv_llh[it];
-	Vector2 ll  = subvector(llh, 0, 2);
-	Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-      
-	// Check for out of range
-	bool out_of_range = (pix[0] < 0 || pix[0] > dem.cols() - 1 ||
-			     pix[1] < 0 || pix[1] > dem.rows() - 1);
-
-	if (out_of_range) continue;
-	
-	PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-	if (!is_valid(dem_ht))
-	  continue;
-	
-	double diff = llh[2] - dem_ht.child();
-	
-	if (std::abs(diff) > opt.max_height_diff)
-	  continue;
-
-	Vector3 point = G2P(llh); // geodetic to point
-	phandle << point[0] << ' ' << point[1] << ' ' << point[2] << std::endl;
-
-#if 0
-	if (prev_it < 0 || std::abs(timestamp[prev_it] - timestamp[it] ) > spacing ) {
-
-	  group_id++;
-
-	  // Save up the data from the current group
-	  if (group_size > 0) {
-            double mean = group_sum/group_size;
-	    means.push_back(mean);
-	  }
-
-	  // Prepare for the next group
-	  group_size = 1;
-	  group_sum = diff;
-	  
-	}else{
-	  group_size++;
-	  group_sum += diff;
-	}
-	prev_it = it;
-
-	llh_vec.push_back(llh);
-	group_ids.push_back(group_id);
-        timestamp_str_sub.push_back(timestamp_str[it]);
-#endif
-        
-      }
-      phandle.close();
-      
-      // Save up the data from the last group
-      if (group_size > 0) {
-	means.push_back(group_sum/group_size);
-      }
-      
-      if (group_id + 1 != int(means.size())){
-	vw_throw(ArgumentErr() << "Book-keeping error.\n");
-      }
-
-#if 0
-      // Subtract the mean from each group
-      std::ofstream af("tmp_after.txt");
-      af.precision(18);
-      for (size_t it = 0; it < llh_vec.size(); it++){
-	Vector3 llh = llh_vec[it];
-	int group_id = group_ids[it];
-	if (group_id < 0 || group_id >= int(means.size())){
-	  vw_throw(ArgumentErr() << "Book-keeping error.\n");
-	}
-	double mean = means[group_id];
-	//llh[2] -= mean; // temporary!!!
-	af << timestamp_str_sub[it]
-           << " " << llh[0] << ' ' << llh[1] << ' ' << llh[2]
-           << ' ' << group_id << " " << mean << std::endl;
-      }
-      af.close();
-#endif
+      filter_csv_points(opt, csv_conv, csv_georef, dem_georef, dem, dem_nodata);
       
       std::ofstream ghandle(opt.projected_grid.c_str());
       ghandle.precision(17);
@@ -16,7 +16,7 @@
 #  limitations under the License.
 # __END_LICENSE__
 
-import os, sys, argparse, multiprocessing
+import os, sys, argparse, multiprocessing, time
 
 # The path to the ASP python files
 basepath    = os.path.abspath(sys.path[0])
@@ -50,6 +50,81 @@ def runCommand(command):
     print(command)
     os.system(command)  
 
+def readBatchMemUsage(batchFolder):
+    '''Return the stereo memory usage in GB recorded in the run stats file
+       of a batch, or -1 if it is not known.'''
+    statsPath = os.path.join(batchFolder, icebridge_common.getRunStatsFile())
+    if not os.path.exists(statsPath):
+        return -1
+    try:
+        with open(statsPath, 'r') as f:
+            vals = f.readline().split(',')
+        return float(vals[1])
+    except Exception:
+        return -1
+
+class MemoryModel(object):
+    '''Estimate the memory a batch will use. A batch which ran before has its
+       own stereo memory usage in its run stats file, as parsed by
+       getWidthAndMemUsageFromStereoOutput(). Otherwise the mean usage of the
+       batches which finished in this run is used, or the default.'''
+
+    def __init__(self, defaultMemGb):
+        self.defaultMemGb = defaultMemGb
+        self.totalMemGb   = 0.0
+        self.numBatches   = 0
+
+    def estimate(self, batchFolder):
+        mem = readBatchMemUsage(batchFolder)
+        if mem > 0:
+            return mem
+        if self.numBatches > 0:
+            return self.totalMemGb / self.numBatches
+        return self.defaultMemGb
+
+    def record(self, batchFolder):
+        mem = readBatchMemUsage(batchFolder)
+        if mem > 0:
+            self.totalMemGb += mem
+            self.numBatches += 1
+
+def runWithMemoryLimit(pool, numProcesses, commands, memLimitGb, defaultMemGb):
+    '''Run the commands in the pool, starting one only when the estimated
+       memory of it and of the commands running does not exceed the limit.
+       A command is always started if nothing else is running.'''
+
+    SLEEP_TIME = 5
+    model   = MemoryModel(defaultMemGb)
+    pending = list(commands)
+    running = [] # The task handle, batch folder, and memory estimate of each command
+    while len(pending) > 0 or len(running) > 0:
+
+        # Retire the finished commands, learning from their run stats
+        stillRunning = []
+        for (task, folder, mem) in running:
+            if task.ready():
+                model.record(folder)
+            else:
+                stillRunning.append((task, folder, mem))
+        running = stillRunning
+
+        # Start as many commands as fit
+        memInUse = sum([mem for (task, folder, mem) in running])
+        while len(pending) > 0 and len(running) < numProcesses:
+            line   = pending[0]
+            folder = icebridge_common.getBatchFolderFromBatchLine(line)
+            mem    = model.estimate(folder)
+            if len(running) > 0 and memInUse + mem > memLimitGb:
+                break
+            pending.pop(0)
+            print('Starting batch ' + folder + ' with estimated memory usage of ' +
+                  str(mem) + ' GB.')
+            running.append((pool.apply_async(runCommand, (line,)), folder, mem))
+            memInUse += mem
+
+        if len(running) > 0:
+            time.sleep(SLEEP_TIME)
+
 def main(argsIn):
 
     try:
@@ -74,6 +149,17 @@ def main(argsIn):
         parser.add_argument("--command-file-path",  dest="commandFilePath", default=None,
                           help="The file from where to read the commands to process.")
         
+        parser.add_argument('--memory-limit-gb', dest='memLimitGb', type=float,
+                            default=-1,
+                            help='Do not start a batch if the estimated memory usage of ' + \
+                            'the running batches would then exceed this. The estimates ' + \
+                            'come from the stereo memory usage in the run stats of each batch.')
+
+        parser.add_argument('--default-memory-gb', dest='defaultMemGb', type=float,
+                            default=4.0,
+                            help='The estimated memory usage of a batch when none of ' + \
+                            'the batches have run stats yet.')
+
         parser.add_argument("--force-redo-these-frames",  dest="redoFrameList", default="",
                           help="For each frame in this file (stored one per line) within the current frame range, delete the batch folder and redo the batch.")
 
@@ -93,9 +179,13 @@ def main(argsIn):
 
     # TODO: Write to a log?
 
+    if options.numProcesses <= 0:
+        options.numProcesses = multiprocessing.cpu_count()
+        
     print('Starting processing pool with ' + str(options.numProcesses) +' processes.')
     pool = multiprocessing.Pool(options.numProcesses)
     taskHandles = []
+    commands    = []
 
     framesToDo = set()
     if options.redoFrameList != "" and os.path.exists(options.redoFrameList):
@@ -141,12 +231,21 @@ def main(argsIn):
                     print("Will skip frame: " + str(begFrame))
                     continue
                 
-            # Add the command to the task pool
+            commands.append(line)
+
+    if options.memLimitGb > 0:
+        print('Running ' + str(len(commands)) + ' tasks with a memory limit of ' +
+              str(options.memLimitGb) + ' GB.')
+        runWithMemoryLimit(pool, options.numProcesses, commands,
+                           options.memLimitGb, options.defaultMemGb)
+    else:
+        # Add the commands to the task pool
+        for line in commands:
             taskHandles.append(pool.apply_async(runCommand, (line,)))
 
-    # Wait for all the tasks to complete
-    print('Finished adding ' + str(len(taskHandles)) + ' tasks to the pool.')
-    icebridge_common.waitForTaskCompletionOrKeypress(taskHandles, interactive=False)
+        # Wait for all the tasks to complete
+        print('Finished adding ' + str(len(taskHandles)) + ' tasks to the pool.')
+        icebridge_common.waitForTaskCompletionOrKeypress(taskHandles, interactive=False)
 
     # All tasks should be finished, clean up the processing pool
     icebridge_common.stopTaskPool(pool)
@@ -46,11 +46,15 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <algorithm>
 #include <ctime>
+#include <iterator>
 #include <stdlib.h>
 
 // Turn off warnings from eigen
@@ -311,10 +315,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 
 /**
-  Class which loads an Icebridge nav file in chunks and provides an interpolator
-   for each chunk.
+  Class which loads a whole Icebridge nav file in memory, parsing its lines
+   in parallel, and provides an interpolator around any time it covers.
+   The times are indexed, so the frames need not be in time order.
 */
-class ScrollingNavInterpolator {
+class NavIndex {
 public:
 
   // TODO: Is the rotation interpolation method ok?  It is the only
@@ -322,154 +327,161 @@ public:
   typedef vw::camera::LagrangianInterpolationVarTime PosInterpType;
   typedef vw::camera::LagrangianInterpolationVarTime RotInterpType;
 
-  // Open the file
-  ScrollingNavInterpolator(std::string const& path, Datum const& datum_in)
-    : m_datum(datum_in) {
-    m_input_stream.open(path.c_str());
-    
-    // Load the nav file in chunks of this size
-    const size_t INTERPOLATE_CHUNK_LENGTH  = 10000;
-    const size_t INTERPOLATE_CHUNK_OVERLAP = 1000; // Overlap between chunks
-    m_chunk_length  = INTERPOLATE_CHUNK_LENGTH;
-    m_chunk_overlap = INTERPOLATE_CHUNK_OVERLAP;
-    
-    // Init vectors to a fixed size
-    m_time_vector.resize(INTERPOLATE_CHUNK_LENGTH);
-    m_loc_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    m_rot_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    
-    m_first_chunk = true;
-  }
-  
-  ~ScrollingNavInterpolator() {
-    m_input_stream.close();
-  }
-
-  /// Set up the next interpolator
-  /// - Returns false if the end of the file was reached
-  bool load_next_chunk(boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
-                       boost::shared_ptr<PosInterpType> &rot_interpolator_ptr) {
-
-    if (m_input_stream.bad())
-      return false;
-  
-    size_t index = 0;
-    
-    if (!m_first_chunk) {
-      // Copy N values from the end of the vectors to the beginning
-      const size_t end_index = m_chunk_length - m_chunk_overlap;
-      for (index=0; index<m_chunk_overlap; ++index) {
-        m_time_vector[index] = m_time_vector[end_index+index];
-        m_loc_vector [index] = m_loc_vector [end_index+index];
-        m_rot_vector [index] = m_rot_vector [end_index+index];
+  // Read and parse the file
+  NavIndex(std::string const& path, Datum const& datum, int num_threads) {
+
+    std::ifstream handle(path.c_str(), std::ios::in | std::ios::binary);
+    if (!handle.good())
+      vw_throw( ArgumentErr() << "Cannot open the nav file: " << path << "\n" );
+    std::string text((std::istreambuf_iterator<char>(handle)),
+                     std::istreambuf_iterator<char>());
+
+    // Find the non-empty lines
+    std::vector<size_t> line_starts;
+    size_t pos = 0;
+    while (pos < text.size()) {
+      size_t next = text.find('\n', pos);
+      if (next == std::string::npos)
+        next = text.size();
+      if (text.find_first_not_of(" \t\r", pos) < next)
+        line_starts.push_back(pos);
+      pos = next + 1;
+    }
+    const size_t num_lines = line_starts.size();
+    m_time_vector.resize(num_lines);
+    m_loc_vector.resize (num_lines);
+    m_rot_vector.resize (num_lines);
+
+    // Parse the lines in a few chunks per thread
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    const size_t num_chunks = std::min(num_lines, size_t(4*num_threads));
+    std::vector<size_t> bad_lines(num_chunks, num_lines);
+    {
+      FifoWorkQueue queue(num_threads);
+      for (size_t c = 0; c < num_chunks; c++) {
+        boost::shared_ptr<ParseTask>
+          task(new ParseTask(text, line_starts, c*num_lines/num_chunks,
+                             (c+1)*num_lines/num_chunks, datum, *this, bad_lines[c]));
+        queue.add_task(task);
       }
+      queue.join_all();
     }
-    else
-      m_first_chunk = false;
-    
-    // Populate rest of the vectors by reading from the file
-    double  time;
-    Vector3 loc, angles;
-    while (read_next_line(time, loc, angles)){
-      m_time_vector[index] = time;
-      m_loc_vector [index] = loc;
-      m_rot_vector [index] = angles;
-      ++index;
-      if (index == m_chunk_length)
-        break;
+    for (size_t c = 0; c < num_chunks; c++) {
+      if (bad_lines[c] < num_lines) {
+        size_t line_beg = line_starts[bad_lines[c]];
+        vw_throw( ArgumentErr() << "Could not scan 10 values from line: "
+                  << text.substr(line_beg, text.find('\n', line_beg) - line_beg) << "\n" );
+      }
     }
-    
-    // If we hit the end of the file just return false, hopefully no camera
-    //  data is right at the end of the file!
-    if (index < m_chunk_length)
+
+    for (size_t i = 1; i < num_lines; i++) {
+      if (m_time_vector[i] < m_time_vector[i-1])
+        vw_throw( ArgumentErr() << "The times in the nav file " << path
+                                << " are not in increasing order.\n" );
+    }
+    vw_out() << "Read " << num_lines << " lines from " << path << std::endl;
+  }
+
+  /// Set up the interpolators for the nav data within the given time
+  /// margin of a time.
+  /// - Returns false if the file does not cover the time and its margin.
+  bool get_interpolators(double time, double margin,
+                         boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
+                         boost::shared_ptr<RotInterpType> &rot_interpolator_ptr) const {
+
+    if (m_time_vector.empty() ||
+        time < m_time_vector.front() + margin || time > m_time_vector.back() - margin)
       return false;
-  
+
+    std::vector<double>::const_iterator beg
+      = std::lower_bound(m_time_vector.begin(), m_time_vector.end(), time - margin);
+    std::vector<double>::const_iterator end
+      = std::upper_bound(m_time_vector.begin(), m_time_vector.end(), time + margin);
+    size_t b = beg - m_time_vector.begin(), e = end - m_time_vector.begin();
+
+    std::vector<double > times(beg, end);
+    std::vector<Vector3> locs(m_loc_vector.begin() + b, m_loc_vector.begin() + e);
+    std::vector<Vector3> rots(m_rot_vector.begin() + b, m_rot_vector.begin() + e);
+
     // Set up the interpolator
-    const int INTERP_RADIUS = 4;  
+    const int INTERP_RADIUS = 4;
+    if (times.size() < size_t(2*INTERP_RADIUS))
+      return false;
     pos_interpolator_ptr = boost::shared_ptr<PosInterpType>(
-          new PosInterpType(m_loc_vector, m_time_vector, INTERP_RADIUS));
+          new PosInterpType(locs, times, INTERP_RADIUS));
     rot_interpolator_ptr = boost::shared_ptr<RotInterpType>(
-          new RotInterpType(m_rot_vector, m_time_vector, INTERP_RADIUS));
+          new RotInterpType(rots, times, INTERP_RADIUS));
               
     return true;
   }
-  
-  /// Return the time boundaries of the current interpolator
-  void get_time_boundaries(double &start, double &end) const {
-    start = m_time_vector.front();
-    end   = m_time_vector.back ();
-  }
 
-  /// Load a target location vector.
-  void set_target_locs(std::vector<Vector3> const& target_locs) {
-    m_target_loc_vector = target_locs;
-    m_target_distance_vector.resize(m_target_loc_vector.size());
-    m_target_time_vector.resize    (m_target_loc_vector.size());
-    for (size_t i=0; i<m_target_distance_vector.size(); ++i) {
-      m_target_distance_vector[i] = 999999999;
-      m_target_time_vector    [i] = -1;
-    }
-  }
-  /// Get target location vector closest times.
-  void get_target_times(std::vector<double> &target_time_vector,
+  /// For each target location, find the time of the closest nav
+  /// position, and its distance.
+  void get_target_times(std::vector<Vector3> const& target_loc_vector,
+                        std::vector<double> &target_time_vector,
                         std::vector<double> &target_distance_vector) const {
-    target_time_vector     = m_target_time_vector;
-    target_distance_vector = m_target_distance_vector;
+    target_distance_vector.assign(target_loc_vector.size(), 999999999);
+    target_time_vector.assign    (target_loc_vector.size(), -1);
+    for (size_t j=0; j<m_loc_vector.size(); ++j) {
+      for (size_t i=0; i<target_loc_vector.size(); ++i) {
+        double distance = norm_2(m_loc_vector[j] - target_loc_vector[i]);
+        if (distance < target_distance_vector[i]) {
+          target_distance_vector[i] = distance;
+          target_time_vector    [i] = m_time_vector[j];
+        }
+      }
+    } // End loop through nav positions
   }
 
 private:
 
-  bool                 m_first_chunk;
-  const Datum          m_datum;
   std::vector<double > m_time_vector;
   std::vector<Vector3> m_loc_vector;
   std::vector<Vector3> m_rot_vector;
-  size_t               m_chunk_length;
-  size_t               m_chunk_overlap;
-  std::ifstream        m_input_stream;
-  
-  /// Search for these locations in the entire file!
-  std::vector<Vector3> m_target_loc_vector;
-  std::vector<double > m_target_distance_vector;
-  std::vector<double > m_target_time_vector;
-
 
-  /// Read and parse the next line in the file
-  bool read_next_line(double &time, Vector3& loc, Vector3& rot) {
-    // Try to read the line
-    std::string line;
-    if (!getline(m_input_stream, line))
-      return false;
-
-    // Parse the line
-    double lat, lon, alt, roll, pitch, heading;
-    scan_line(line, time, lat, lon, alt, roll, pitch, heading);
-    Vector3 llh(lon, lat, alt);
-    loc = m_datum.geodetic_to_cartesian(llh);
-    rot[0] = roll;
-    rot[1] = pitch;
-    rot[2] = heading;
-    
-    // Compare this position to target locations if they exist.
-    if (!m_target_loc_vector.empty())
-      update_target_locs(loc, time);
-    
-    return true;
-  }
-  
-  /// Check if this location is the best match to any target locations.
-  void update_target_locs(Vector3 loc, double time) {
-    // For each target, record the time and distance if this is the best match.
-    for (size_t i=0; i<m_target_loc_vector.size(); ++i) {
-      double distance = norm_2(loc - m_target_loc_vector[i]);
-      if (distance < m_target_distance_vector[i]) {
-        m_target_distance_vector[i] = distance;
-        m_target_time_vector    [i] = time;
+  /// Parse the lines in [beg, end) into the nav vectors. The index of
+  ///  the first line which cannot be parsed is recorded in bad_line.
+  class ParseTask: public vw::Task, private boost::noncopyable {
+    std::string         const& m_text;
+    std::vector<size_t> const& m_line_starts;
+    size_t                     m_beg, m_end;
+    Datum                      m_datum;
+    NavIndex                 & m_index;
+    size_t                   & m_bad_line;
+  public:
+    ParseTask(std::string const& text, std::vector<size_t> const& line_starts,
+              size_t beg, size_t end, Datum const& datum, NavIndex & index,
+              size_t & bad_line):
+      m_text(text), m_line_starts(line_starts), m_beg(beg), m_end(end),
+      m_datum(datum), m_index(index), m_bad_line(bad_line) {}
+
+    void operator()() {
+      const int NUM_VALUES = 10;
+      double vals[NUM_VALUES];
+      for (size_t i = m_beg; i < m_end; i++) {
+        // The text ends with a null character, so strtod() does not read past it.
+        char const* ptr      = m_text.c_str() + m_line_starts[i];
+        char const* line_end = m_text.c_str() + std::min(m_text.find('\n', m_line_starts[i]),
+                                                         m_text.size());
+        for (int k = 0; k < NUM_VALUES; k++) {
+          char* next = NULL;
+          vals[k] = strtod(ptr, &next);
+          if (next == ptr || next > line_end) {
+            m_bad_line = i;
+            return;
+          }
+          ptr = next;
+        }
+        // seconds, lat, lon, alt, x, y, and z velocity, roll, pitch, heading
+        m_index.m_time_vector[i] = vals[0];
+        m_index.m_loc_vector [i] = m_datum.geodetic_to_cartesian(Vector3(vals[2], vals[1], vals[3]));
+        m_index.m_rot_vector [i] = Vector3(vals[7], vals[8], vals[9]);
       }
-    } // End loop through targets
-  }
+    }
+  };
 
-}; // End class ScrollingNavInterpolator
+}; // End class NavIndex
 
 
 /// Pretty-print a rotation matrix.
@@ -537,9 +549,9 @@ int main(int argc, char* argv[]) {
   
   const boost::filesystem::path output_dir(opt.output_folder);
   
-  // Initialize the nav interpolator
-  std::cout << "Opening input stream: " << opt.nav_file << std::endl;
-  ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
+  // Load the nav file
+  std::cout << "Reading nav file: " << opt.nav_file << std::endl;
+  NavIndex nav_index(opt.nav_file, datum_wgs84, opt.num_threads);
 
   // Load target camera positions if desired
   std::vector<Vector3> target_locations;
@@ -559,290 +571,258 @@ int main(int argc, char* argv[]) {
       } catch(...) {
       } // Just skip cameras that we can't read in.
     }
-    interpLoader.set_target_locs(target_locations);
     std::cout << "Done loading " << target_locations.size() << " target locations.\n";
   } // End target loading condition
 
-  boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> pos_interpolator_ptr;
-  boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator_ptr;
-  double start, end;
+  boost::shared_ptr<NavIndex::PosInterpType> pos_interpolator_ptr;
+  boost::shared_ptr<NavIndex::RotInterpType> rot_interpolator_ptr;
   
   const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
   const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
-  size_t file_index = 0;
   const size_t num_files = opt.image_files.size();
 
-  // Keep loading chunks until the nav data catches up with the images
-  double ortho_time=0;
-  while (interpLoader.load_next_chunk(pos_interpolator_ptr, rot_interpolator_ptr)) {
+  // When detecting offsets all we want is to go through the nav file.
+  for (size_t file_index = 0; file_index < num_files && !opt.detect_offset; file_index++) {
 
-    // Get the time boundaries of the current chunk
-    interpLoader.get_time_boundaries(start, end);  
-
-    //std::cout << "Time range: " << start << " ---- " << end << std::endl;
+    // Get the next input and output paths
+    std::string             orthoimage_path = opt.image_files [file_index];
+    boost::filesystem::path camera_file(opt.camera_files[file_index]);
+    boost::filesystem::path output_camera_path = output_dir / camera_file;
+    
+    // Get time for this frame
+    double ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
+    //vw_out() << orthoimage_path << " -> gps_time = " << ortho_time << std::endl;
+
+    // Skip this ortho if the nav data does not cover its time.
+    if (!nav_index.get_interpolators(ortho_time, CHUNK_TIME_BOUNDARY,
+                                     pos_interpolator_ptr, rot_interpolator_ptr)) {
+      vw_out() << "Nav data does not cover the time of file " << orthoimage_path << std::endl;
+      continue;
+    }
 
-    // When detecting offsets all we want to do is loop through the nav file.
-    if (opt.detect_offset)
+    // Try to interpolate this ortho position
+    Vector3 gcc_interp, rot_interp;
+    try{
+      gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
+      rot_interp = rot_interpolator_ptr->operator()(ortho_time);
+    } catch(...){
+      vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
+      continue;
+    }
+    Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
+    
+    double roll    = rot_interp[0];
+    double pitch   = rot_interp[1];
+    //double heading = rot_interp[2];
+    //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
+    //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
+    //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
+    //vw_out() << "Heading = " << heading << std::endl;
+
+    //std::cout << "Ortho time  = " << ortho_time << std::endl;
+    //vw_out() << "llh = " << llh_interp << std::endl;
+    
+    // Now estimate the rotation information
+
+    /*
+      For some reason the heading interpolated from the navigation data is about 30 degrees
+      off from what is expected by looking at the flight path.  The roll and pitch values are
+      consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
+      provided).  What has proven to work the best so far is to estimate the camera pose 
+      including the heading just by using the flight path, and then to apply the pitch and roll
+      to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
+      which one map-projects closest to the lidar data.
+    */
+    
+    // Get a point ahead of and behind the frame location
+    Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
+    Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
+    
+    if (gcc_interp_forward == gcc_interp_backward) {
+      vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
       continue;
+    }
+    
+    // From these points get two flight direction vectors and take the mean.
+    Vector3 dir1 = gcc_interp_forward - gcc_interp;
+    Vector3 dir2 = gcc_interp - gcc_interp_backward;
+    Vector3 xDir = (dir1 + dir2) / 2.0;
+   
+    // The Z vector is straight down from the camera to the ground.
+    Vector3 llh_ground = llh_interp;
+    llh_ground[2] = 0;
+    Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
+    Vector3 zDir = gcc_ground - gcc_interp;
+    
+    // Normalize the vectors
+    xDir = xDir / norm_2(xDir);
+    zDir = zDir / norm_2(zDir);
+    
+    // The Y vector is the cross product of the two established vectors
+    Vector3 yDir = cross_prod(zDir, xDir);
 
-    // Loop through ortho files until we need to advance the nav chunk
-    while (file_index < num_files) {
+    // Hack to allow testing of whether rotation is applied before axis change.
+    // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
+    // - Once we are satisfied this is always true, remove the option not to do this.
+    if (opt.camera_mounting > 0) {
+      Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                    xDir[1], yDir[1], zDir[1],
+                                    xDir[2], yDir[2], zDir[2]);
+      Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+      Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+      Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
+      xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
+      yDir  = Vector3(M(0,1), M(1,1), M(2,1));
+      zDir  = Vector3(M(0,2), M(1,2), M(2,2));
+      roll  = 0; // Set to zero so that these rotations are not applied twice
+      pitch = 0;
+    }
 
-      // Get the next input and output paths
-      std::string             orthoimage_path = opt.image_files [file_index];
-      boost::filesystem::path camera_file(opt.camera_files[file_index]);
-      boost::filesystem::path output_camera_path = output_dir / camera_file;
-      
-      // Get time for this frame
-      if (ortho_time == 0) {
-        ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
-        //vw_out() << orthoimage_path << " -> gps_time = " << ortho_time << std::endl;
-      }
+    // Account for the camera mounting direction relative to aircraft motion.
+    Vector3 vTemp;
+    switch(abs(opt.camera_mounting)) {
+      case 1: // Left forwards
+        xDir = xDir * -1.0;
+        yDir = yDir * -1.0;
+        break;
+      case 2: // Top forwards
+        vTemp = xDir;
+        xDir = -1.0*yDir;
+        yDir = vTemp;
+        break;
+      case 3: // Bottom forwards
+        vTemp = xDir;
+        xDir = yDir;
+        yDir = -1.0*vTemp;
+        break;
+      default: break; // Right forwards, the default.
+    }
+    
+    // Pack into a rotation matrix
+    Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                  xDir[1], yDir[1], zDir[1],
+                                  xDir[2], yDir[2], zDir[2]);
+    
+    // TODO: ENU or NED?
+    //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
+    //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
+    //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
+    //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
+
+    //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
+    //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
+    
+    //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
 
-      // If this ortho is too far ahead in time, move on to the next nav chunk.
-      if (ortho_time > end - CHUNK_TIME_BOUNDARY)
-        break; // Don't advance file_index
 
-      // If this ortho is too early in time, move on to the next ortho file.
-      if (ortho_time < start + CHUNK_TIME_BOUNDARY) {
-        vw_out() << "Too early to interpolate position for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
+    //std::cout << "gcc = " << gcc_interp << std::endl;
+    //std::cout << "xDir = " << xDir << std::endl;
+    //std::cout << "yDir = " << yDir << std::endl;
+    //std::cout << "zDir = " << zDir << std::endl;
+    
+    //std::cout << std::endl << "Estimate based matrix " << std::endl;
+    //print_matrix(rotation_matrix_gcc);
+    
+    // TODO: Clean all this up once we are satisfied with it!
+    
+    Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+    Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
 
-      // Try to interpolate this ortho position
-      Vector3 gcc_interp, rot_interp;
-      try{
-        gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
-        rot_interp = rot_interpolator_ptr->operator()(ortho_time);
-      } catch(...){
-        vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
-      Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
-      
-      double roll    = rot_interp[0];
-      double pitch   = rot_interp[1];
-      //double heading = rot_interp[2];
-      //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
-      //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
-      //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
-      //vw_out() << "Heading = " << heading << std::endl;
-
-      //std::cout << "Ortho time  = " << ortho_time << std::endl;
-      //vw_out() << "llh = " << llh_interp << std::endl;
+    //std::cout << "M_roll, M_pitch:\n";
+    //print_matrix(M_roll ); std::cout << std::endl;
+    //print_matrix(M_pitch); std::cout << std::endl;
+    
+    // Without documentation it is very difficult to determine
+    // which of these rotation orders is correct!
+    // - Could be neither since the yaw rotation is already baked in.
+    //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
+    //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
+    Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
+    //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+    
+    //std::cout << "Modified matrices:\n";
+    //print_matrix(M1); std::cout << std::endl;
+    //print_matrix(M2); std::cout << std::endl;
+    //print_matrix(M3); std::cout << std::endl;
+    //print_matrix(M4); std::cout << std::endl;
+
+    //std::string var_path = output_camera_path.string() + "_";
+    //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
+    //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
+    //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
+    //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
+    //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
+
+    write_output_camera(gcc_interp, M3,
+                        opt.input_cam, output_camera_path.string());
+
+    //std::cout << std::endl << "NED matrix " << std::endl;
+    //print_matrix(ned_matrix);
+
+    //std::cout << std::endl << "ENU matrix " << std::endl;
+    //std::cout << enu_matrix << std::endl << std::endl;
+    /*
+    double yaw = -3.14159 / 2;
+    Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
+    
+    for (int p=0; p<0; ++p) {
+      Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
+
+
+      std::cout << std::endl << "Angle based matrix " << p << std::endl;
+      std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
+
+      //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
+      //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
       
-      // Now estimate the rotation information
-
-      /*
-        For some reason the heading interpolated from the navigation data is about 30 degrees
-        off from what is expected by looking at the flight path.  The roll and pitch values are
-        consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
-        provided).  What has proven to work the best so far is to estimate the camera pose 
-        including the heading just by using the flight path, and then to apply the pitch and roll
-        to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
-        which one map-projects closest to the lidar data.
-      */
+      std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
+      std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
       
-      // Get a point ahead of and behind the frame location
-      Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
-      Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
       
-      if (gcc_interp_forward == gcc_interp_backward) {
-        vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
+      std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
+      std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
       
-      // From these points get two flight direction vectors and take the mean.
-      Vector3 dir1 = gcc_interp_forward - gcc_interp;
-      Vector3 dir2 = gcc_interp - gcc_interp_backward;
-      Vector3 xDir = (dir1 + dir2) / 2.0;
-     
-      // The Z vector is straight down from the camera to the ground.
-      Vector3 llh_ground = llh_interp;
-      llh_ground[2] = 0;
-      Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
-      Vector3 zDir = gcc_ground - gcc_interp;
+      //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
+      //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
       
-      // Normalize the vectors
-      xDir = xDir / norm_2(xDir);
-      zDir = zDir / norm_2(zDir);
-      
-      // The Y vector is the cross product of the two established vectors
-      Vector3 yDir = cross_prod(zDir, xDir);
-
-      // Hack to allow testing of whether rotation is applied before axis change.
-      // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
-      // - Once we are satisfied this is always true, remove the option not to do this.
-      if (opt.camera_mounting > 0) {
-        Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                      xDir[1], yDir[1], zDir[1],
-                                      xDir[2], yDir[2], zDir[2]);
-        Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-        Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-        Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
-        xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
-        yDir  = Vector3(M(0,1), M(1,1), M(2,1));
-        zDir  = Vector3(M(0,2), M(1,2), M(2,2));
-        roll  = 0; // Set to zero so that these rotations are not applied twice
-        pitch = 0;
-      }
+      std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
+      std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
+
+      std::cout << "------------\n";
 
-      // Account for the camera mounting direction relative to aircraft motion.
-      Vector3 vTemp;
-      switch(abs(opt.camera_mounting)) {
-        case 1: // Left forwards
-          xDir = xDir * -1.0;
-          yDir = yDir * -1.0;
-          break;
-        case 2: // Top forwards
-          vTemp = xDir;
-          xDir = -1.0*yDir;
-          yDir = vTemp;
-          break;
-        case 3: // Bottom forwards
-          vTemp = xDir;
-          xDir = yDir;
-          yDir = -1.0*vTemp;
-          break;
-        default: break; // Right forwards, the default.
-      }
-      
-      // Pack into a rotation matrix
-      Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                    xDir[1], yDir[1], zDir[1],
-                                    xDir[2], yDir[2], zDir[2]);
-      
-      // TODO: ENU or NED?
-      //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
-      //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
-      //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
-      //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
-
-      //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
-      //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
-      
-      //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
 
+      std::cout << std::endl << "Angle based matrix " << p << std::endl;
+      std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
 
-      //std::cout << "gcc = " << gcc_interp << std::endl;
-      //std::cout << "xDir = " << xDir << std::endl;
-      //std::cout << "yDir = " << yDir << std::endl;
-      //std::cout << "zDir = " << zDir << std::endl;
+      //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
+      //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
       
-      //std::cout << std::endl << "Estimate based matrix " << std::endl;
-      //print_matrix(rotation_matrix_gcc);
+      std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
+      std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
       
-      // TODO: Clean all this up once we are satisfied with it!
       
-      Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-      Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-
-      //std::cout << "M_roll, M_pitch:\n";
-      //print_matrix(M_roll ); std::cout << std::endl;
-      //print_matrix(M_pitch); std::cout << std::endl;
+      std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
+      std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
       
-      // Without documentation it is very difficult to determine
-      // which of these rotation orders is correct!
-      // - Could be neither since the yaw rotation is already baked in.
-      //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
-      //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
-      Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
-      //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+      //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
+      //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
       
-      //std::cout << "Modified matrices:\n";
-      //print_matrix(M1); std::cout << std::endl;
-      //print_matrix(M2); std::cout << std::endl;
-      //print_matrix(M3); std::cout << std::endl;
-      //print_matrix(M4); std::cout << std::endl;
-
-      //std::string var_path = output_camera_path.string() + "_";
-      //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
-      //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
-      //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
-      //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
-      //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
-
-      write_output_camera(gcc_interp, M3,
-                          opt.input_cam, output_camera_path.string());
-
-      //std::cout << std::endl << "NED matrix " << std::endl;
-      //print_matrix(ned_matrix);
-
-      //std::cout << std::endl << "ENU matrix " << std::endl;
-      //std::cout << enu_matrix << std::endl << std::endl;
-      /*
-      double yaw = -3.14159 / 2;
-      Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
-      
-      for (int p=0; p<0; ++p) {
-        Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
-
-
-        std::cout << std::endl << "Angle based matrix " << p << std::endl;
-        std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
-
-        //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-        //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
-        std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-        std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-        std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
-        
-        //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-        //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
-        std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
-
-        std::cout << "------------\n";
-
-
-        std::cout << std::endl << "Angle based matrix " << p << std::endl;
-        std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
-
-        //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-        //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
-        std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-        std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-        std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
-        
-        //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-        //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
-        std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
-
-        
-      }
-      std::cout << std::endl << std::endl;
-      */
-      //write_output_camera(gcc_interp, rotation_matrix_gcc,
-      //                    opt.input_cam, output_camera_path.string());
+      std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
+      std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
 
+      
+    }
+    std::cout << std::endl << std::endl;
+    */
+    //write_output_camera(gcc_interp, rotation_matrix_gcc,
+    //                    opt.input_cam, output_camera_path.string());
 
-      // Update progress
-      if (file_index % PRINT_INTERVAL == 0)
-        vw_out() << file_index << " files processed.\n";
 
-      ++file_index;
-      ortho_time = 0;
+    // Update progress
+    if (file_index % PRINT_INTERVAL == 0)
+      vw_out() << file_index << " files processed.\n";
 
-    } // End loop through ortho files
-    
-  } // End loop through nav batches
+  } // End loop through ortho files
   
   vw_out() << "Finished looping through the nav file.\n";
 /*
@@ -898,7 +878,7 @@ int main(int argc, char* argv[]) {
     // Compute the mean difference between the target camera time and the matched time
     //  and print the results.
     std::vector<double> matched_times, best_distances;
-    interpLoader.get_target_times(matched_times, best_distances);
+    nav_index.get_target_times(target_locations, matched_times, best_distances);
     const size_t num_targets = target_times.size();
     double mean_offset = 0, mean_dist = 0;
     for (size_t i=0; i<num_targets; ++i) {
@@ -31,9 +31,14 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/MatchFile.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <boost/core/null_deleter.hpp>
+#include <algorithm>
+#include <sstream>
 
 
 // Turn off warnings from eigen
@@ -70,7 +75,8 @@ typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
 
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate;
+  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate,
+    batch_list;
   double camera_height, orthoimage_height, ip_inlier_factor, max_translation;
   int    ip_per_tile, ip_detect_method, min_ip;
   bool   individually_normalize, keep_match_file, write_gcp_file, skip_image_normalization, 
@@ -278,29 +284,40 @@ int solve_for_cam_adjust(boost::shared_ptr<PinholeModel> camera_model,
 
 
 
-   
-/// Load the DEM and adjust some options depending on DEM statistics.
-void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
-                        vw::cartography::GeoReference const& ortho_georef,
-                        ImageViewRef< PixelMask<float> > &dem,
-                        vw::cartography::GeoReference &dem_georef,
-                        bool &elevation_change_present) {
 
-  // Set up the DEM if it was provided.
-  float dem_nodata = -std::numeric_limits<float>::max();
+/// The reference DEM, opened once and shared by all frames. The
+/// frames read it through the block cache of a single disk view.
+struct ReferenceDem {
+  ImageViewRef<float>           dem;
+  vw::cartography::GeoReference georef;
+  float                         nodata;
+  ReferenceDem(): nodata(-std::numeric_limits<float>::max()) {}
+};
+
+/// Open the reference DEM and read its georeference and no-data value.
+void open_reference_dem(std::string const& dem_file, ReferenceDem & ref_dem) {
 
-  bool is_good = vw::cartography::read_georeference(dem_georef, opt.reference_dem);
+  bool is_good = vw::cartography::read_georeference(ref_dem.georef, dem_file);
   if (!is_good) {
     vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
-                           << opt.reference_dem << ".\n");
+                           << dem_file << ".\n");
   }
 
-  {
-    // Read the no-data
-    DiskImageResourceGDAL rsrc(opt.reference_dem);
-    if (rsrc.has_nodata_read()) dem_nodata = rsrc.nodata_read();
-  }
+  boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(dem_file));
+  if (rsrc->has_nodata_read()) ref_dem.nodata = rsrc->nodata_read();
+  ref_dem.dem = DiskImageView<float>(rsrc);
+}
+   
+/// Get the DEM for this frame and adjust some options depending on DEM statistics.
+void load_reference_dem(Options &opt, ReferenceDem const& ref_dem,
+                        boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
+                        vw::cartography::GeoReference const& ortho_georef,
+                        ImageViewRef< PixelMask<float> > &dem,
+                        vw::cartography::GeoReference &dem_georef,
+                        bool &elevation_change_present) {
 
+  float dem_nodata = ref_dem.nodata;
+  dem_georef = ref_dem.georef;
 
   bool crop_is_success = false;
   if (opt.crop_reference_dem){
@@ -310,8 +327,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
     DiskImageView<float> tmp_ortho(rsrc_ortho);
     BBox2 ortho_bbox = bounding_box(tmp_ortho);
 
-    DiskImageView<float> tmp_dem(opt.reference_dem);
-    BBox2 dem_bbox = bounding_box(tmp_dem);
+    BBox2 dem_bbox = bounding_box(ref_dem.dem);
     
     // The GeoTransform will hide the messy details of conversions
     vw::cartography::GeoTransform geotrans(dem_georef, ortho_georef, dem_bbox, ortho_bbox);
@@ -331,7 +347,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
       crop_box.crop(dem_bbox);
       
       if (!crop_box.empty()) {
-        ImageView<float> cropped_dem = crop(DiskImageView<float>(opt.reference_dem), crop_box);
+        ImageView<float> cropped_dem = crop(ref_dem.dem, crop_box);
         dem = create_mask(cropped_dem, dem_nodata);
         dem_georef = crop(dem_georef, crop_box);
         crop_is_success = true;
@@ -343,7 +359,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
   // Default behavior  
   if (!crop_is_success)
-    dem = create_mask(DiskImageView<float>(opt.reference_dem), dem_nodata);
+    dem = create_mask(ref_dem.dem, dem_nodata);
 
   
   // Get an estimate of the elevation range in the input image
@@ -635,8 +651,40 @@ double refine_camera_with_dem_pts(Options const& opt,
 } // End function refine_camera_with_dem_pts
 
 
-// Primary task-solving function.
-void ortho2pinhole(Options & opt){
+/// When significant elevation change is present, the homography IP filter is not
+///  accurate and we need to compensate by relaxing our inlier threshold.
+void relax_inlier_threshold() {
+  const double ELEVATION_INLIER_SCALE = 10;
+  // TODO: Decouple threshold from other params!
+  asp::stereo_settings().epipolar_threshold = 150*asp::stereo_settings().ip_inlier_factor * ELEVATION_INLIER_SCALE;
+  //asp::stereo_settings().ip_inlier_factor *= ELEVATION_INLIER_SCALE;
+}
+
+/// Find if the DEM under the orthoimage has significant elevation
+/// change. This also sets the estimated orthoimage height in opt.
+bool has_elevation_change(Options & opt, ReferenceDem const& ref_dem) {
+
+  boost::shared_ptr<DiskImageResource> rsrc_ortho(vw::DiskImageResourcePtr(opt.ortho_image));
+  vw::cartography::GeoReference ortho_georef;
+  bool is_good = vw::cartography::read_georeference(ortho_georef, opt.ortho_image);
+  if (!is_good) {
+    vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
+                           << opt.ortho_image << ".\n");
+  }
+
+  ImageViewRef< PixelMask<float> > dem;
+  vw::cartography::GeoReference dem_georef;
+  bool elevation_change_present = false;
+  load_reference_dem(opt, ref_dem, rsrc_ortho, ortho_georef, dem, dem_georef,
+                     elevation_change_present);
+  return elevation_change_present;
+}
+
+// Primary task-solving function. If adjust_inlier_threshold is false,
+// the caller is in charge of the inlier threshold, which is shared by
+// all frames.
+void ortho2pinhole(Options & opt, ReferenceDem const& ref_dem,
+                   bool adjust_inlier_threshold){
 
   // Input image handles
   boost::shared_ptr<DiskImageResource>
@@ -659,18 +707,12 @@ void ortho2pinhole(Options & opt){
   bool has_ref_dem = (opt.reference_dem != "");
   bool elevation_change_present = false;
   if (has_ref_dem) {
-    load_reference_dem(opt, rsrc_ortho, ortho_georef, dem, dem_georef, elevation_change_present);
+    load_reference_dem(opt, ref_dem, rsrc_ortho, ortho_georef, dem, dem_georef,
+                       elevation_change_present);
   }
   
-
-  // When significant elevation change is present, the homography IP filter is not
-  //  accurate and we need to compensate by relaxing our inlier threshold.
-  const double ELEVATION_INLIER_SCALE = 10;
-  if (elevation_change_present) {
-    // TODO: Decouple threshold from other params!
-    asp::stereo_settings().epipolar_threshold = 150*asp::stereo_settings().ip_inlier_factor * ELEVATION_INLIER_SCALE;
-    //asp::stereo_settings().ip_inlier_factor *= ELEVATION_INLIER_SCALE;
-    
+  if (elevation_change_present && adjust_inlier_threshold) {
+    relax_inlier_threshold();
     vw_out() << "Due to elevation change, increasing ip_inlier_factor to " 
              << asp::stereo_settings().ip_inlier_factor << std::endl;
   }
@@ -686,7 +728,7 @@ void ortho2pinhole(Options & opt){
   vw_out() << "Using estimated cam height: " << cam_height << std::endl;
 
   std::vector<vw::ip::InterestPoint> raw_ip, ortho_ip;
-  ip::read_binary_match_file(match_filename, raw_ip, ortho_ip);
+  asp::read_match_file(match_filename, raw_ip, ortho_ip);
   vw::camera::PinholeModel *pcam = dynamic_cast<vw::camera::PinholeModel*>(cam.get());
   if (pcam == NULL) {
     vw_throw(ArgumentErr() << "Expecting a pinhole camera model.\n");
@@ -907,6 +949,167 @@ std::string handle_rgb_input(std::string const& input_path, Options const& opt)
 
 }
 
+/// Copy the camera position and pose from the camera estimate to the
+/// input camera, without using the ortho image.
+void write_short_circuit_camera(Options const& opt) {
+  
+  // Load input camera files
+  vw_out() << "Loading: " << opt.input_cam << std::endl;
+  PinholeModel input_cam(opt.input_cam);
+  vw_out() << "Loading: " << opt.camera_estimate << std::endl;
+  PinholeModel est_cam(opt.camera_estimate);
+  
+  // Copy camera position and pose from estimate camera to input camera
+  input_cam.set_camera_center(est_cam.camera_center());
+  input_cam.set_camera_pose  (est_cam.camera_pose  ());
+  
+  // Write to output camera
+  vw_out() << "Writing: " << opt.output_cam << std::endl;
+  input_cam.write(opt.output_cam);
+}
+
+/// Read the frames of the batch list. Each line has the raw image, the
+/// ortho image, the input and output cameras, and optionally the estimated
+/// camera of that frame. Empty lines and lines starting with '#' are skipped.
+void read_batch_list(Options const& opt, std::vector<Options> & frames) {
+
+  std::ifstream handle(opt.batch_list.c_str());
+  if (!handle.good())
+    vw_throw(ArgumentErr() << "Cannot read the batch list: " << opt.batch_list << ".\n");
+
+  frames.clear();
+  std::string line;
+  int line_num = 0;
+  while (std::getline(handle, line)) {
+    line_num++;
+    std::istringstream is(line);
+    std::string token;
+    std::vector<std::string> tokens;
+    while (is >> token)
+      tokens.push_back(token);
+    if (tokens.empty() || tokens[0][0] == '#')
+      continue;
+    if (tokens.size() != 4 && tokens.size() != 5)
+      vw_throw(ArgumentErr() << "Line " << line_num << " of " << opt.batch_list
+                             << " must have a raw image, an ortho image, an input and "
+                             << "an output camera, and optionally a camera estimate.\n");
+
+    Options frame = opt;
+    frame.raw_image   = tokens[0];
+    frame.ortho_image = tokens[1];
+    frame.input_cam   = tokens[2];
+    frame.output_cam  = tokens[3];
+    if (tokens.size() == 5)
+      frame.camera_estimate = tokens[4];
+    
+    if (frame.camera_estimate != "" && !boost::filesystem::exists(frame.camera_estimate))
+      vw_throw( ArgumentErr() << "Estimated camera file " << frame.camera_estimate
+                              << " does not exist!\n");
+    if (frame.short_circuit && frame.camera_estimate == "")
+      vw_throw( ArgumentErr() << "Estimated camera file is required with the "
+                              << "short-circuit option, on line " << line_num << " of "
+                              << opt.batch_list << ".\n");
+    
+    vw::create_out_dir(frame.output_cam);
+    frames.push_back(frame);
+  }
+}
+
+namespace {
+
+  enum FrameStatus { FRAME_FAILED, FRAME_FLAT, FRAME_ELEVATION_CHANGE };
+
+  // Process one frame of the batch. The first stage converts the input
+  // images if needed and checks the reference DEM for elevation change.
+  // The second finds the camera.
+  class FrameTask: public vw::Task, private boost::noncopyable {
+    Options            & m_opt;
+    ReferenceDem const & m_ref_dem;
+    bool                 m_solve;
+    FrameStatus        & m_status;
+  public:
+    FrameTask(Options & opt, ReferenceDem const& ref_dem, bool solve, FrameStatus & status):
+      m_opt(opt), m_ref_dem(ref_dem), m_solve(solve), m_status(status) {}
+
+    void operator()() {
+      try {
+        if (!m_solve) {
+          m_opt.raw_image   = handle_rgb_input(m_opt.raw_image,   m_opt);
+          m_opt.ortho_image = handle_rgb_input(m_opt.ortho_image, m_opt);
+          m_status = FRAME_FLAT;
+          if (m_opt.reference_dem != "" && has_elevation_change(m_opt, m_ref_dem))
+            m_status = FRAME_ELEVATION_CHANGE;
+        } else {
+          ortho2pinhole(m_opt, m_ref_dem, false);
+        }
+      } catch (const std::exception& e) {
+        vw_out() << "Failed to create " << m_opt.output_cam << ": " << e.what() << std::endl;
+        m_status = FRAME_FAILED;
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+/// Find the cameras of all frames in the batch list in one process,
+/// a few frames at a time. The reference DEM is opened only once. As
+/// the inlier threshold is global, the frames with significant
+/// elevation change are solved after the others.
+/// - Returns the number of frames which failed.
+int batch_ortho2pinhole(Options & opt, ReferenceDem const& ref_dem) {
+
+  std::vector<Options> frames;
+  read_batch_list(opt, frames);
+  vw_out() << "Processing " << frames.size() << " frames from " << opt.batch_list << std::endl;
+
+  if (opt.short_circuit) {
+    for (size_t i = 0; i < frames.size(); i++)
+      write_short_circuit_camera(frames[i]);
+    return 0;
+  }
+
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  std::vector<FrameStatus> status(frames.size(), FRAME_FAILED);
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < frames.size(); i++) {
+      boost::shared_ptr<FrameTask> task(new FrameTask(frames[i], ref_dem, false, status[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  FrameStatus passes[] = {FRAME_FLAT, FRAME_ELEVATION_CHANGE};
+  for (int pass = 0; pass < 2; pass++) {
+    int num_frames = std::count(status.begin(), status.end(), passes[pass]);
+    if (num_frames == 0)
+      continue;
+    if (passes[pass] == FRAME_ELEVATION_CHANGE) {
+      relax_inlier_threshold();
+      vw_out() << "Due to elevation change, increasing ip_inlier_factor to " 
+               << asp::stereo_settings().ip_inlier_factor << " for "
+               << num_frames << " frames." << std::endl;
+    }
+
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (status[i] != passes[pass])
+        continue;
+      boost::shared_ptr<FrameTask> task(new FrameTask(frames[i], ref_dem, true, status[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  int num_failed = std::count(status.begin(), status.end(), FRAME_FAILED);
+  vw_out() << "Created " << frames.size() - num_failed << " out of "
+           << frames.size() << " cameras." << std::endl;
+  return num_failed;
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -941,7 +1144,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("reference-dem",             po::value(&opt.reference_dem)->default_value(""),
      "If provided, extract from this DEM the heights above the ground rather than assuming the value in --orthoimage-height.")
     ("crop-reference-dem", po::bool_switch(&opt.crop_reference_dem)->default_value(false)->implicit_value(true),
-     "Crop the reference DEM to a generous area to make it faster to load.");
+     "Crop the reference DEM to a generous area to make it faster to load.")
+    ("batch-list",             po::value(&opt.batch_list)->default_value(""),
+     "Process in one run the frames in this file, each on a line having the raw image, the ortho image, the input and output cameras, and optionally the camera estimate. The frames are processed in parallel and the reference DEM is loaded once.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
   
@@ -958,7 +1163,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("input-cam",  1);
   positional_desc.add("output-cam", 1);
 
-  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]");
+  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]\n"
+                    "       --batch-list <frame list> [options]");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -972,6 +1178,20 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().skip_image_normalization = opt.skip_image_normalization;
   asp::stereo_settings().ip_inlier_factor         = opt.ip_inlier_factor;
   
+  if (opt.batch_list != "") {
+    if (!opt.raw_image.empty() || !opt.ortho_image.empty() ||
+        !opt.input_cam.empty() || !opt.output_cam.empty())
+      vw_throw( ArgumentErr() << "The input images and cameras must be in the batch list "
+                              << "when --batch-list is used.\n" << usage << general_options );
+    if (opt.camera_estimate != "")
+      vw_throw( ArgumentErr() << "The camera estimates must be in the batch list "
+                              << "when --batch-list is used.\n");
+
+    // Turn on logging to file
+    asp::log_to_file(argc, argv, "", opt.batch_list);
+    return;
+  }
+
   if ( opt.raw_image.empty() )
     vw_throw( ArgumentErr() << "Missing input raw image.\n" << usage << general_options );
 
@@ -1009,29 +1229,25 @@ int main(int argc, char* argv[]) {
   //try {
   handle_arguments( argc, argv, opt );
    
-  if (opt.short_circuit) {
+  if (opt.short_circuit)
     vw_out() << "Creating camera without using ortho image.\n";
+
+  ReferenceDem ref_dem;
+  if (opt.reference_dem != "" && !opt.short_circuit)
+    open_reference_dem(opt.reference_dem, ref_dem);
+
+  if (opt.batch_list != "")
+    return (batch_ortho2pinhole(opt, ref_dem) > 0) ? 1 : 0;
   
-    // Load input camera files
-    vw_out() << "Loading: " << opt.input_cam << std::endl;
-    PinholeModel input_cam(opt.input_cam);
-    vw_out() << "Loading: " << opt.camera_estimate << std::endl;
-    PinholeModel est_cam(opt.camera_estimate);
-    
-    // Copy camera position and pose from estimate camera to input camera
-    input_cam.set_camera_center(est_cam.camera_center());
-    input_cam.set_camera_pose  (est_cam.camera_pose  ());
-    
-    // Write to output camera
-    vw_out() << "Writing: " << opt.output_cam << std::endl;
-    input_cam.write(opt.output_cam);
+  if (opt.short_circuit) {
+    write_short_circuit_camera(opt);
     return 0;
   }
   
   opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
   opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
   
-  ortho2pinhole(opt);
+  ortho2pinhole(opt, ref_dem, true);
   return 0;
   //} ASP_STANDARD_CATCHES;
 }
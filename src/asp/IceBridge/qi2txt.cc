@@ -21,49 +21,49 @@
 
 /* Copied from qi2txt-readme.txt
 
-OVERVIEW
-
-This readme accompanies the IceBridge QFIT data reader: qi2txt
-
-The qi2txt program reads binary data files from the Operation IceBridge ATM
-instrument, which are available as the ILATM1B and BLATM1B product at the
-National Snow and Ice Data Center (NSIDC), at
-
-http://nsidc.org/data/ilatm1b.html
-
-This software is available at
-
-http://nsidc.org/data/icebridge/tools.html
-
-DISCLAIMER
-
-This software is provided as-is as a service to the user community in the
-hope that it will be useful, but without any warranty of fitness for any
-particular purpose or correctness.  Bug reports, comments, and suggestions
-for improvement are welcome; please send to nsidc@nsidc.org.
-
-CHANGELOG
-
-v0.4 >> 7-8-16 Modified to accommodate 10 and 14-word data outputs
-       plus more output modes:
+OVERVIEW
+
+This readme accompanies the IceBridge QFIT data reader: qi2txt
+
+The qi2txt program reads binary data files from the Operation IceBridge ATM
+instrument, which are available as the ILATM1B and BLATM1B product at the
+National Snow and Ice Data Center (NSIDC), at
+
+http://nsidc.org/data/ilatm1b.html
+
+This software is available at
+
+http://nsidc.org/data/icebridge/tools.html
+
+DISCLAIMER
+
+This software is provided as-is as a service to the user community in the
+hope that it will be useful, but without any warranty of fitness for any
+particular purpose or correctness.  Bug reports, comments, and suggestions
+for improvement are welcome; please send to nsidc@nsidc.org.
+
+CHANGELOG
+
+v0.4 >> 7-8-16 Modified to accommodate 10 and 14-word data outputs
+       plus more output modes:
         - Short output  -Coordinates only -First and Last -Print all
 
-The program assumes by default that the input binary QFIT file is in big
-endian format.  It tests the endianness of the host machine and swaps the
-data to match that of the host machine.  To have the program assume the
-data format is little endian, use the -L option.
-
-
-Examples of using the reader:
-
-Convert an entire binary input file to a (possibly huge) text file:
-  $ ./qi2txt inputfile.qi > outfile_ascii.txt
-
-Extract lat, lon, elevation only, skipping over the header line:
-  $ ./qi2txt -S inputfile.qi > xyz.txt
-
-Print the first few lines, and tell the program that the input file is in
-little endian format:
+The program assumes by default that the input binary QFIT file is in big
+endian format.  It tests the endianness of the host machine and swaps the
+data to match that of the host machine.  To have the program assume the
+data format is little endian, use the -L option.
+
+
+Examples of using the reader:
+
+Convert an entire binary input file to a (possibly huge) text file:
+  $ ./qi2txt inputfile.qi > outfile_ascii.txt
+
+Extract lat, lon, elevation only, skipping over the header line:
+  $ ./qi2txt -S inputfile.qi > xyz.txt
+
+Print the first few lines, and tell the program that the input file is in
+little endian format:
   $ ./qi2txt -L inputfile.qi | head -n10
 
 */
@@ -238,29 +238,41 @@ int testendianness(void) {
 
 
 /*======================================================================*/
-int4 get_record_length(int4 *value, int4 *svalue, FILE *infile) {
+/* The first word of the file is the record length in bytes */
+int4 get_record_length(char *data) {
 
-    int4 nvar, ipart;
-
-    fread((char *)value,sizeof(*value),1,infile);//Read single int4
+    int4 value, svalue;
+    memcpy(&value, data, sizeof(value));
  
     /* swap bytes if host machine is little-endian (e.g. PC) */
     if (host_endianness != data_endianness) {
-      ipart = myswap((char*)value,(char*)svalue,4,1); // Swap the bytes in that int4
-      nvar = *(svalue) / 4;
-    }
-    else {
-      /* Sun Workstations, etc. */
-      nvar = *(value) / 4;
+      myswap((char*)&value,(char*)&svalue,4,1); // Swap the bytes in that int4
+      return svalue / 4;
     }
+    /* Sun Workstations, etc. */
+    return value / 4;
+}
 
-    /*  rewind file */
-    fseek (infile,0L,SEEK_SET);
-
-    /*  read past first record */	 
-    fread((char *)value,sizeof(*value),nvar,infile); // Read again but length of that first integer into infile
-
-    return( nvar );
+/*======================================================================*/
+/* Read the whole file in memory. Decoding the records from a single
+ * buffer is much faster than reading them one by one, and makes it
+ * cheap to look up the last records in -F mode. */
+char * read_whole_file(FILE *infile, long *num_bytes) {
+
+    fseek(infile, 0L, SEEK_END);
+    *num_bytes = ftell(infile);
+    fseek(infile, 0L, SEEK_SET);
+    if (*num_bytes < (long)sizeof(int4))
+        return NULL;
+
+    char *data = (char *)malloc(*num_bytes);
+    if (data == NULL)
+        return NULL;
+    if (fread(data, 1, *num_bytes, infile) != (size_t)*num_bytes) {
+        free(data);
+        return NULL;
+    }
+    return data;
 }
 
 
@@ -427,11 +439,19 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    long num_bytes = 0;
+    char *data = read_whole_file(infile, &num_bytes);
+    fclose(infile);
+    if (data == NULL) {
+        fprintf(stderr, "cannot read input file\n");
+        exit(1);
+    }
+
     /*  read first record and verify fixed record length */
-    nvar = get_record_length(value, svalue, infile);
+    nvar = get_record_length(data);
     word_format = (nvar-10)/2; // 10word = 0, 12word = 1, 14word = 2
     // Quick error check
-    if (word_format > 2){
+    if (nvar < 10 || nvar > MAXARG || word_format > 2){
 	fprintf(stderr, "ERROR: Unexpected words/record %d\n", nvar);
 	exit(1);
     }
@@ -448,11 +468,20 @@ int main(int argc, char *argv[]) {
     int found_last = 0;
     int nvar_mult = 0;
 
+    // Formatting the text is now the bottleneck, so write it out in large blocks
+    static char out_buffer[1 << 20];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
     printData(word_format, 'h', NULL); // Print headers
     
-    
-    // Begin fairly slow stdout print. Want speedup? fputs out to file instead!
-    while (fread((char *)value,sizeof(*value),nvar,infile) != 0) {
+    // Records past the first one, which is the header. A partial record
+    // at the end of the file is ignored.
+    const long record_bytes = nvar*sizeof(*value);
+    const long num_records  = num_bytes / record_bytes;
+    long rec_index = 1;
+    while (rec_index < num_records) {
+        memcpy(value, data + rec_index*record_bytes, record_bytes);
+        ++rec_index;
         ++in_rec;
 
 
@@ -504,19 +533,17 @@ int main(int argc, char *argv[]) {
 		if (found_last){
 			break;
 		}
-		// Rewind line-by-line to find the last data point
-		fseek(infile,-nvar*nvar_mult*sizeof(*value), SEEK_END);
+		// Go back record by record from the end to find the last data point
+		rec_index = num_records - nvar_mult;
+		if (rec_index < 1)
+			break;
 	}
     }
-    
-    
-    
-    
-    
+    free(data);
  
+    fflush(stdout);
     fprintf(stderr, "Number of records read = %ld\nNumber of records written = %ld\n", in_rec, out_rec);
     fprintf(stderr, "Number of negative time records skipped = %d\n", neg_rec_count);
-    fclose(infile);
 
     
     if (out_rec == 0){
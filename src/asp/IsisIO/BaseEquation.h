@@ -22,6 +22,7 @@
 // STL
 #include <fstream>
 #include <iostream>
+#include <vector>
 // VW
 #include <vw/Math/Vector.h>
 
@@ -56,6 +57,18 @@ namespace asp {
     }
     vw::Vector3 operator()( double const& t ) { return evaluate(t);}
 
+    // Evaluates the equation at many times at once. This does not
+    // use the cached value.
+    virtual void evaluate_many( std::vector<double> const& times,
+                                std::vector<vw::Vector3> & output ) {
+      output.resize( times.size() );
+      for ( size_t i = 0; i < times.size(); i++ ) {
+        update( times[i] );
+        output[i] = m_cached_output;
+      }
+      m_cached_time = -1;
+    }
+
     // Tells the number of constants defining the equation
     // This is especially vague as it is meant for interaction with a
     // bundle adjuster. BA just wants to roll through the constants
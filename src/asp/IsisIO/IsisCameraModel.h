@@ -27,23 +27,39 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/CameraModel.h>
+#include <vw/Core/Thread.h>
 
 // ASP
 #include <asp/IsisIO/IsisInterface.h>
 
+#include <map>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
 namespace vw {
 namespace camera {
 
   // This is largely just a shortened reimplementation of ISIS's
   // Camera.cpp.
-  class IsisCameraModel : public CameraModel {
+  class IsisCameraModel : public CameraModel, private boost::noncopyable {
 
   public:
     //------------------------------------------------------------------
     // Constructors / Destructors
     //------------------------------------------------------------------
-    IsisCameraModel(std::string cube_filename) :
-      m_interface(asp::isis::IsisInterface::open( cube_filename )) {}
+
+    // An Isis::Camera is not thread-safe. If per_thread_cameras is
+    // true, each thread which uses this model gets its own instance,
+    // made from the same cube the first time that thread needs it, and
+    // calls from different threads can run concurrently. Else, there is
+    // one instance and the caller must not use it from several threads.
+    // If use_native_model is true, linescan cameras are evaluated from
+    // tables of positions and poses made once with ISIS.
+    IsisCameraModel(std::string cube_filename, bool per_thread_cameras = false,
+                    bool use_native_model = false) :
+      m_cube_filename(cube_filename), m_per_thread_cameras(per_thread_cameras),
+      m_use_native_model(use_native_model),
+      m_interface(asp::isis::IsisInterface::open( cube_filename, use_native_model )) {}
     virtual std::string type() const { return "Isis"; }
 
     //------------------------------------------------------------------
@@ -54,55 +70,86 @@ namespace camera {
     //  image plane.  Returns a pixel location (col, row) where the
     //  point appears in the image.
     virtual Vector2 point_to_pixel(Vector3 const& point) const {
-      return m_interface->point_to_pixel( point ); }
+      return interface()->point_to_pixel( point ); }
 
     // Returns a (normalized) pointing vector from the camera center
     //  through the position of the pixel 'pix' on the image plane.
     virtual Vector3 pixel_to_vector (Vector2 const& pix) const {
-      return m_interface->pixel_to_vector( pix ); }
+      return interface()->pixel_to_vector( pix ); }
 
 
     // Returns the position of the focal point of the camera
     virtual Vector3 camera_center(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_center( pix ); }
+      return interface()->camera_center( pix ); }
 
     // Pose is a rotation which moves a vector in camera coordinates
     // into world coordinates.
     virtual Quat camera_pose(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_pose( pix ); }
+      return interface()->camera_pose( pix ); }
 
     // Returns the number of lines is the ISIS cube
-    int lines() const { return m_interface->lines(); }
+    int lines() const { return interface()->lines(); }
 
     // Returns the number of samples in the ISIS cube
-    int samples() const{ return m_interface->samples(); }
+    int samples() const{ return interface()->samples(); }
 
     // Returns the serial number of the ISIS cube
     std::string serial_number() const {
-      return m_interface->serial_number(); }
+      return interface()->serial_number(); }
 
     // Returns the ephemeris time for a pixel
     double ephemeris_time( Vector2 const& pix = Vector2() ) const {
-      return m_interface->ephemeris_time( pix );
+      return interface()->ephemeris_time( pix );
     }
 
     // Sun position in the target frame's inertial frame
     Vector3 sun_position( Vector2 const& pix = Vector2() ) const {
-      return m_interface->sun_position( pix );
+      return interface()->sun_position( pix );
+    }
+
+    // Sun positions at many ephemeris times at once
+    void sun_positions( std::vector<double> const& times,
+                        std::vector<Vector3> & positions ) const {
+      interface()->sun_positions( times, positions );
     }
 
     // The three main radii that make up the spheroid. Z is out the polar region.
     Vector3 target_radii() const {
-      return m_interface->target_radii();
+      return interface()->target_radii();
     }
 
     // The spheroid name.
     std::string target_name() const {
-      return m_interface->target_name();
+      return interface()->target_name();
     }
 
   protected:
+
+    // The instance for the current thread
+    asp::isis::IsisInterface* interface() const {
+      if (!m_per_thread_cameras)
+        return m_interface.get();
+
+      // Only finding the instance is under the lock, not the camera
+      // calls. Creating one happens once per thread.
+      vw::uint64 id = vw::Thread::id();
+      vw::Mutex::Lock lock(m_pool_mutex);
+      std::map<vw::uint64, boost::shared_ptr<asp::isis::IsisInterface> >::iterator it
+        = m_pool.find(id);
+      if (it != m_pool.end())
+        return it->second.get();
+      boost::shared_ptr<asp::isis::IsisInterface>
+        thread_interface(asp::isis::IsisInterface::open( m_cube_filename, m_use_native_model ));
+      m_pool[id] = thread_interface;
+      return thread_interface.get();
+    }
+
+    std::string m_cube_filename;
+    bool        m_per_thread_cameras;
+    bool        m_use_native_model;
     boost::shared_ptr<asp::isis::IsisInterface> m_interface;
+    mutable std::map<vw::uint64, boost::shared_ptr<asp::isis::IsisInterface> > m_pool;
+    mutable vw::Mutex m_pool_mutex;
 
     friend std::ostream& operator<<( std::ostream&, IsisCameraModel const& );
   };
@@ -17,6 +17,7 @@
 
 
 #include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
 #include <vw/Math/Vector.h>
 #include <asp/IsisIO/IsisInterface.h>
 #include <asp/IsisIO/IsisInterfaceMapFrame.h>
@@ -26,6 +27,7 @@
 #include <boost/filesystem.hpp>
 
 #include <iomanip>
+#include <map>
 #include <ostream>
 
 #include <Cube.h>
@@ -42,7 +44,7 @@ using namespace vw;
 using namespace asp;
 using namespace asp::isis;
 
-IsisInterface::IsisInterface( std::string const& file ) {
+IsisInterface::IsisInterface( std::string const& file ): m_file(file) {
   // Opening labels and camera
   Isis::FileName ifilename( QString::fromStdString(file) );
   m_label.reset( new Isis::Pvl() );
@@ -55,7 +57,15 @@ IsisInterface::IsisInterface( std::string const& file ) {
 
 IsisInterface::~IsisInterface() {}
 
-IsisInterface* IsisInterface::open( std::string const& filename ) {
+namespace {
+  // Opening a cube reads its label and sets up its camera, which
+  // touches state shared by all ISIS cameras.
+  vw::Mutex g_isis_open_mutex;
+}
+
+IsisInterface* IsisInterface::open( std::string const& filename, bool use_native_model ) {
+  vw::Mutex::Lock lock(g_isis_open_mutex);
+
   // Opening Labels (This should be done somehow though labels)
   Isis::FileName ifilename( QString::fromStdString(filename) );
   Isis::Pvl label;
@@ -71,16 +81,16 @@ IsisInterface* IsisInterface::open( std::string const& filename ) {
   case 0:
     // Framing Camera
     if ( camera->HasProjection() )
-      result = new IsisInterfaceMapFrame( filename );
+      result = new IsisInterfaceMapFrame( filename, use_native_model );
     else
       result = new IsisInterfaceFrame( filename );
     break;
   case 2:
     // Linescan Camera
     if ( camera->HasProjection() )
-      result = new IsisInterfaceMapLineScan( filename );
+      result = new IsisInterfaceMapLineScan( filename, use_native_model );
     else
-      result = new IsisInterfaceLineScan( filename );
+      result = new IsisInterfaceLineScan( filename, use_native_model );
     break;
   default:
     vw_throw( NoImplErr() << "Don't support Isis Camera Type " << camera->GetCameraType() << " at this moment" );
@@ -107,11 +117,40 @@ double IsisInterface::ephemeris_time( vw::Vector2 const& pix ) const {
   return m_camera->time().Et();
 }
 
+namespace {
+  // The sun positions found so far, by cube and pixel
+  typedef std::pair<std::string, std::pair<double, double> > SunPositionKey;
+  vw::Mutex                          g_sun_position_mutex;
+  std::map<SunPositionKey, Vector3>  g_sun_positions;
+}
+
 vw::Vector3 IsisInterface::sun_position( vw::Vector2 const& pix ) const {
+  SunPositionKey key( m_file, std::make_pair( pix[0], pix[1] ) );
+  {
+    vw::Mutex::Lock lock( g_sun_position_mutex );
+    std::map<SunPositionKey, Vector3>::const_iterator it = g_sun_positions.find( key );
+    if ( it != g_sun_positions.end() )
+      return it->second;
+  }
+
   m_camera->SetImage( pix[0]+1, pix[1]+1 );
   Vector3 sun;
   m_camera->sunPosition( &sun[0] );
-  return sun * 1000;
+  sun *= 1000;
+
+  vw::Mutex::Lock lock( g_sun_position_mutex );
+  g_sun_positions[key] = sun;
+  return sun;
+}
+
+void IsisInterface::sun_positions( std::vector<double> const& times,
+                                   std::vector<vw::Vector3> & positions ) const {
+  positions.resize( times.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    m_camera->setTime( Isis::iTime( times[i] ) );
+    m_camera->sunPosition( &positions[i][0] );
+    positions[i] *= 1000;
+  }
 }
 
 vw::Vector3 IsisInterface::target_radii() const {
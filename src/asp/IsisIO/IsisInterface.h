@@ -25,6 +25,7 @@
 
 // VW & ASP
 #include <string>
+#include <vector>
 #include <Cube.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
@@ -49,7 +50,11 @@ namespace isis {
     virtual std::string type() = 0;
     
     /// Construct an IsisInterface-derived class of the correct type for the given file.
-    static IsisInterface* open( std::string const& filename );
+    /// If use_native_model is true, linescan cameras with no map projection are
+    /// evaluated from tables made once with ISIS, see IsisInterfaceLineScan,
+    /// and points are projected into map-projected cubes with a
+    /// ProjectedPixelGrid.
+    static IsisInterface* open( std::string const& filename, bool use_native_model = false );
 
     // Standard Methods
     //------------------------------------------------------
@@ -69,7 +74,16 @@ namespace isis {
     int         samples       () const;
     std::string serial_number () const;
     double      ephemeris_time( vw::Vector2 const& pix ) const;
+
+    /// The sun position at a pixel depends only on the cube and the
+    /// pixel, so it is found once per process for each, even with
+    /// several cameras for the same cube, as sfs loads for each DEM clip.
     vw::Vector3 sun_position  ( vw::Vector2 const& pix = vw::Vector2() ) const;
+
+    /// The sun positions at the given ephemeris times. This skips the
+    /// intersection with the ground which a query at a pixel makes.
+    void sun_positions( std::vector<double> const& times,
+                        std::vector<vw::Vector3> & positions ) const;
     vw::Vector3 target_radii  () const;
     std::string target_name   () const;
 
@@ -79,6 +93,7 @@ namespace isis {
     boost::scoped_ptr<Isis::Pvl   > m_label;
     boost::scoped_ptr<Isis::Camera> m_camera;
     boost::scoped_ptr<Isis::Cube  > m_cube;
+    std::string                     m_file;
 
     friend std::ostream& operator<<( std::ostream&, IsisInterface* );
   };
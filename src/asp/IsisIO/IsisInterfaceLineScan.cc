@@ -15,12 +15,14 @@
 //  limitations under the License.
 // __END_LICENSE__
 
+#include <vw/Core/Log.h>
 #include <vw/Math/LevenbergMarquardt.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/CameraModel.h>
 #include <asp/IsisIO/IsisInterfaceLineScan.h>
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include <Camera.h>
@@ -36,12 +38,24 @@ using namespace asp;
 using namespace asp::isis;
 
 // Construct
-IsisInterfaceLineScan::IsisInterfaceLineScan( std::string const& filename ) : IsisInterface(filename), m_alphacube( *m_cube ) {
+IsisInterfaceLineScan::IsisInterfaceLineScan( std::string const& filename, bool use_native_model ) :
+  IsisInterface(filename), m_alphacube( *m_cube ), m_use_native_model(false), m_line_step(1) {
 
   // Gutting Isis::Camera
   m_distortmap = m_camera->DistortionMap();
   m_focalmap   = m_camera->FocalPlaneMap();
   m_detectmap  = m_camera->DetectorMap();
+
+  if ( use_native_model ) {
+    m_use_native_model = build_native_model() && validate_native_model();
+    if ( !m_use_native_model ) {
+      vw_out(WarningMessage) << "Cannot use the tabulated model for " << filename
+                             << ". Will use ISIS for this camera.\n";
+      m_table_centers.clear();
+      m_table_poses.clear();
+      m_table_looks.clear();
+    }
+  }
 }
 
 // Custom Function to help avoid over invoking the deeply buried
@@ -117,7 +131,7 @@ EphemerisLMA::operator()( EphemerisLMA::domain_type const& x ) const {
 }
 
 Vector2
-IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
+IsisInterfaceLineScan::isis_point_to_pixel( Vector3 const& point ) const {
 
   // First seed LMA with an ephemeris time in the middle of the image
   double middle = lines() / 2;
@@ -170,7 +184,7 @@ IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
 }
 
 Vector3
-IsisInterfaceLineScan::pixel_to_vector( Vector2 const& pix ) const {
+IsisInterfaceLineScan::isis_pixel_to_vector( Vector2 const& pix ) const {
   Vector2 px = pix + Vector2(1,1);
   SetTime( px, true );
 
@@ -188,8 +202,24 @@ IsisInterfaceLineScan::pixel_to_vector( Vector2 const& pix ) const {
   return result;
 }
 
+Vector2
+IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
+  if ( m_use_native_model )
+    return native_point_to_pixel( point );
+  return isis_point_to_pixel( point );
+}
+
+Vector3
+IsisInterfaceLineScan::pixel_to_vector( Vector2 const& pix ) const {
+  if ( m_use_native_model )
+    return normalize( native_pose( pix[1] ).rotate( native_look( pix[0] ) ) );
+  return isis_pixel_to_vector( pix );
+}
+
 Vector3
 IsisInterfaceLineScan::camera_center( Vector2 const& pix ) const {
+  if ( m_use_native_model )
+    return native_center( pix[1] );
   Vector2 px = pix + Vector2(1,1);
   SetTime( px, true );
   return m_center;
@@ -197,7 +227,215 @@ IsisInterfaceLineScan::camera_center( Vector2 const& pix ) const {
 
 Quat
 IsisInterfaceLineScan::camera_pose( Vector2 const& pix ) const {
+  if ( m_use_native_model )
+    return native_pose( pix[1] );
   Vector2 px = pix + Vector2(1,1);
   SetTime( px, true );
   return m_pose;
 }
+
+// The native model
+//-------------------------------------------------
+
+namespace {
+
+  // The weights of the cubic Lagrange polynomial through the nodes
+  // i0, .., i0 + 3 of a table with nodes at 0, 1, 2, .., evaluated at u.
+  int lagrange_weights( double u, int num_nodes, double w[4] ) {
+    int i0 = int(std::floor(u)) - 1;
+    i0 = std::max(0, std::min(i0, num_nodes - 4));
+    for ( int i = 0; i < 4; i++ ) {
+      w[i] = 1.0;
+      for ( int j = 0; j < 4; j++ ) {
+        if ( j != i )
+          w[i] *= (u - (i0 + j)) / double(i - j);
+      }
+    }
+    return i0;
+  }
+
+  // The ratio of a look direction's x or y coordinate to its z,
+  // which is the position in the undistorted focal plane up to the
+  // focal length.
+  inline double focal_ratio( Vector3 const& look, int coord ) {
+    return look[coord] / look[2];
+  }
+}
+
+bool IsisInterfaceLineScan::build_native_model() {
+
+  int num_lines = lines(), num_samples = samples();
+  if ( num_lines < 2 || num_samples < 2 )
+    return false;
+
+  // Positions and poses change slowly from line to line, so a cubic
+  // through them every 16 lines is far below a pixel in error. Keep
+  // at least 8 nodes for short images.
+  int num_nodes = std::max( 8, num_lines / 16 + 1 );
+  m_line_step = ( num_lines - 1.0 ) / ( num_nodes - 1.0 );
+  m_table_centers.resize( num_nodes );
+  m_table_poses.resize( num_nodes );
+  for ( int k = 0; k < num_nodes; k++ ) {
+    SetTime( Vector2( 1, k * m_line_step + 1 ), true );
+    m_table_centers[k] = m_center;
+
+    // q and -q are the same rotation. Pick the one closest to the
+    // previous node, else interpolating across them is meaningless.
+    Quat q = m_pose;
+    if ( k > 0 ) {
+      Quat const& p = m_table_poses[k-1];
+      if ( p[0]*q[0] + p[1]*q[1] + p[2]*q[2] + p[3]*q[3] < 0 )
+        q = Quat( -q[0], -q[1], -q[2], -q[3] );
+    }
+    m_table_poses[k] = q;
+  }
+
+  // For a linescan sensor the look direction in the camera frame
+  // depends only on the sample, so find it once on the middle line.
+  double middle = num_lines / 2;
+  m_table_looks.resize( num_samples );
+  for ( int s = 0; s < num_samples; s++ ) {
+    SetTime( Vector2( s + 1, middle + 1 ), false );
+    m_focalmap->SetDetector( m_detectmap->DetectorSample(),
+                             m_detectmap->DetectorLine() );
+    m_distortmap->SetFocalPlane( m_focalmap->FocalPlaneX(),
+                                 m_focalmap->FocalPlaneY() );
+    Vector3 look( m_distortmap->UndistortedFocalPlaneX(),
+                  m_distortmap->UndistortedFocalPlaneY(),
+                  m_distortmap->UndistortedFocalPlaneZ() );
+    if ( look[2] == 0 )
+      return false;
+    m_table_looks[s] = normalize( look );
+  }
+
+  // Projecting into the camera inverts the across-track focal plane
+  // coordinate, which must then be monotonic in the sample.
+  double sign = focal_ratio( m_table_looks[1], 0 ) - focal_ratio( m_table_looks[0], 0 );
+  for ( int s = 1; s < num_samples; s++ ) {
+    double diff = focal_ratio( m_table_looks[s], 0 ) - focal_ratio( m_table_looks[s-1], 0 );
+    if ( diff * sign <= 0 )
+      return false;
+  }
+
+  return true;
+}
+
+Vector3 IsisInterfaceLineScan::native_center( double line ) const {
+  double w[4];
+  int i0 = lagrange_weights( line / m_line_step, m_table_centers.size(), w );
+  Vector3 result;
+  for ( int i = 0; i < 4; i++ )
+    result += w[i] * m_table_centers[i0 + i];
+  return result;
+}
+
+Quat IsisInterfaceLineScan::native_pose( double line ) const {
+  double w[4];
+  int i0 = lagrange_weights( line / m_line_step, m_table_poses.size(), w );
+  double q[4] = {0, 0, 0, 0};
+  for ( int i = 0; i < 4; i++ ) {
+    for ( int c = 0; c < 4; c++ )
+      q[c] += w[i] * m_table_poses[i0 + i][c];
+  }
+  double len = std::sqrt( q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3] );
+  return Quat( q[0]/len, q[1]/len, q[2]/len, q[3]/len );
+}
+
+Vector3 IsisInterfaceLineScan::native_look( double sample ) const {
+  // Linear between samples, and extrapolated past the first and last one
+  int num_samples = m_table_looks.size();
+  int i0 = std::max( 0, std::min( int(std::floor(sample)), num_samples - 2 ) );
+  double t = sample - i0;
+  return (1.0 - t) * m_table_looks[i0] + t * m_table_looks[i0 + 1];
+}
+
+Vector2
+IsisInterfaceLineScan::native_point_to_pixel( Vector3 const& point ) const {
+
+  // Given a line, find the sample whose look direction has the same
+  // across-track focal plane coordinate as the point, and return how
+  // far the point is from that look direction along track. That is
+  // zero at the line which sees the point, found with the secant method.
+  int    num_samples = m_table_looks.size();
+  double first_u = focal_ratio( m_table_looks[0], 0 );
+  bool   increasing = focal_ratio( m_table_looks[num_samples-1], 0 ) > first_u;
+
+  double line[2], residual[2], sample = 0;
+  line[0] = lines() / 2;
+  line[1] = line[0] + 1;
+  const double LINE_TOL       = 1e-8;
+  const int    MAX_ITERATIONS = 50;
+  for ( int iter = 0; iter < MAX_ITERATIONS + 2; iter++ ) {
+    int curr = std::min( iter, 1 );
+    if ( iter >= 2 ) {
+      double denom = residual[1] - residual[0];
+      if ( denom == 0 )
+        break;
+      double next = line[1] - residual[1] * ( line[1] - line[0] ) / denom;
+      line[0] = line[1]; residual[0] = residual[1];
+      line[1] = next;
+    }
+
+    Vector3 look = inverse( native_pose( line[curr] ) ).rotate( point - native_center( line[curr] ) );
+    if ( look[2] == 0 )
+      break;
+    double u = focal_ratio( look, 0 );
+
+    // The last table interval with its start before u, counting from
+    // the side where u is smallest.
+    int lo = 0, hi = num_samples - 1;
+    while ( hi - lo > 1 ) {
+      int mid = ( lo + hi ) / 2;
+      bool before = ( focal_ratio( m_table_looks[mid], 0 ) <= u ) == increasing;
+      if ( before ) lo = mid; else hi = mid;
+    }
+    double u0 = focal_ratio( m_table_looks[lo], 0 ), u1 = focal_ratio( m_table_looks[lo+1], 0 );
+    sample = lo + ( u - u0 ) / ( u1 - u0 );
+
+    residual[curr] = focal_ratio( look, 1 ) - focal_ratio( native_look( sample ), 1 );
+
+    if ( iter >= 2 && std::abs( line[1] - line[0] ) < LINE_TOL )
+      return Vector2( sample, line[1] );
+  }
+
+  // Rare, but the ISIS solver may still manage
+  return isis_point_to_pixel( point );
+}
+
+// Compare the native model with ISIS on a grid of pixels, for the
+// look direction, the camera center, and the projection of a point
+// along the ray back into the camera.
+bool IsisInterfaceLineScan::validate_native_model() const {
+
+  const int    NUM_PTS = 5;
+  const double MAX_PIXEL_ERROR = 0.05;
+  double max_pixel_err = 0, max_angle_err = 0, max_center_err = 0;
+  try {
+    for ( int row = 0; row < NUM_PTS; row++ ) {
+      for ( int col = 0; col < NUM_PTS; col++ ) {
+        Vector2 pix( ( samples() - 1.0 ) * col / ( NUM_PTS - 1.0 ),
+                     ( lines()   - 1.0 ) * row / ( NUM_PTS - 1.0 ) );
+
+        SetTime( pix + Vector2(1,1), true );
+        Vector3 isis_center = m_center;
+        Vector3 isis_dir    = isis_pixel_to_vector( pix );
+        Vector3 native_dir  = normalize( native_pose( pix[1] ).rotate( native_look( pix[0] ) ) );
+        max_center_err = std::max( max_center_err, norm_2( isis_center - native_center( pix[1] ) ) );
+        max_angle_err  = std::max( max_angle_err,
+                                   std::acos( std::max( -1.0, std::min( 1.0, dot_prod( isis_dir, native_dir ) ) ) ) );
+
+        Vector3 point = isis_center + 0.1 * norm_2( isis_center ) * isis_dir;
+        max_pixel_err = std::max( max_pixel_err,
+                                  norm_2( isis_point_to_pixel( point ) - native_point_to_pixel( point ) ) );
+      }
+    }
+  } catch ( const vw::Exception& e ) {
+    vw_out(WarningMessage) << "Failed to validate the tabulated ISIS camera: " << e.what() << "\n";
+    return false;
+  }
+
+  vw_out() << "Tabulated ISIS camera versus ISIS: max pixel error "
+           << max_pixel_err << ", max angle error (radians) " << max_angle_err
+           << ", max center error (meters) " << max_center_err << "\n";
+  return max_pixel_err <= MAX_PIXEL_ERROR;
+}
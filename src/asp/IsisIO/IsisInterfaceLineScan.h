@@ -28,6 +28,7 @@
 #include <asp/IsisIO/IsisInterface.h>
 
 #include <string>
+#include <vector>
 
 #include <AlphaCube.h>
 
@@ -43,7 +44,13 @@ namespace isis {
   class IsisInterfaceLineScan : public IsisInterface {
 
   public:
-    IsisInterfaceLineScan( std::string const& file );
+    /// If use_native_model is true, the camera positions and poses
+    /// are tabulated once over the image lines, and so are the look
+    /// directions in the camera frame over the image samples. The
+    /// camera is then evaluated from these tables rather than by ISIS.
+    /// The result is checked against ISIS on a few pixels, and if
+    /// it does not agree, ISIS is used as before.
+    IsisInterfaceLineScan( std::string const& file, bool use_native_model = false );
 
     virtual ~IsisInterfaceLineScan() {}
 
@@ -73,6 +80,24 @@ namespace isis {
     mutable vw::Quat    m_pose;
     void SetTime( vw::Vector2 const& px,
                   bool calc=false ) const;
+
+    // The camera as computed by ISIS
+    vw::Vector2 isis_point_to_pixel ( vw::Vector3 const& point ) const;
+    vw::Vector3 isis_pixel_to_vector( vw::Vector2 const& pix   ) const;
+
+    // The native model. Centers and poses are at lines 0, m_line_step,
+    // 2*m_line_step, etc., and look directions at each sample.
+    bool                     m_use_native_model;
+    double                   m_line_step;
+    std::vector<vw::Vector3> m_table_centers;
+    std::vector<vw::Quat>    m_table_poses;
+    std::vector<vw::Vector3> m_table_looks;
+    bool        build_native_model();
+    bool        validate_native_model() const;
+    vw::Vector3 native_center ( double line   ) const;
+    vw::Quat    native_pose   ( double line   ) const;
+    vw::Vector3 native_look   ( double sample ) const;
+    vw::Vector2 native_point_to_pixel( vw::Vector3 const& point ) const;
   };
 
 }}
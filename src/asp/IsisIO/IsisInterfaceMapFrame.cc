@@ -30,12 +30,14 @@
 #include <Latitude.h>
 #include <Longitude.h>
 
+#include <boost/bind.hpp>
+
 using namespace vw;
 using namespace asp;
 using namespace asp::isis;
 
 // Constructor
-IsisInterfaceMapFrame::IsisInterfaceMapFrame( std::string const& filename ) :
+IsisInterfaceMapFrame::IsisInterfaceMapFrame( std::string const& filename, bool use_grid ) :
   IsisInterface(filename){// , m_projection( Isis::ProjectionFactory::CreateFromCube( *m_label ) ) {
 
   Isis::TProjection* tempProj = (Isis::TProjection*)Isis::ProjectionFactory::CreateFromCube(*m_label);
@@ -56,10 +58,21 @@ IsisInterfaceMapFrame::IsisInterfaceMapFrame( std::string const& filename ) :
   MatrixProxy<double,3,3> R_inst(&(rot_inst[0]));
   MatrixProxy<double,3,3> R_body(&(rot_body[0]));
   m_pose = Quat(R_body*transpose(R_inst));
+
+  if ( use_grid )
+    m_grid = ProjectedPixelGrid::get( filename, m_projection->Resolution() );
 }
 
 Vector2
 IsisInterfaceMapFrame::point_to_pixel( Vector3 const& point ) const {
+  if ( m_grid )
+    return m_grid->point_to_pixel( point, boost::bind( &IsisInterfaceMapFrame::exact_point_to_pixel,
+                                                       this, _1 ) );
+  return exact_point_to_pixel( point );
+}
+
+Vector2
+IsisInterfaceMapFrame::exact_point_to_pixel( Vector3 const& point ) const {
   Vector3 lon_lat_radius = cartography::xyz_to_lon_lat_radius_estimate( point ); // TODO: INACCURATE!!!
   if ( lon_lat_radius[0] < 0 )
     lon_lat_radius[0] += 360;
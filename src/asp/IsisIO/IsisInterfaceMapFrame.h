@@ -27,6 +27,7 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/IsisIO/ProjectedPixelGrid.h>
 
 #include <string>
 
@@ -45,7 +46,9 @@ namespace isis {
   class IsisInterfaceMapFrame : public IsisInterface {
 
   public:
-    IsisInterfaceMapFrame( std::string const& file );
+    /// If use_grid is true, points are projected into the cube with
+    /// a ProjectedPixelGrid shared by all cameras of this cube.
+    IsisInterfaceMapFrame( std::string const& file, bool use_grid = false );
 
     virtual std::string type()  { return "MapFrame"; }
 
@@ -59,7 +62,11 @@ namespace isis {
 
   protected:
 
+    /// Project a point into the cube with ISIS
+    vw::Vector2 exact_point_to_pixel( vw::Vector3 const& point ) const;
+
     // Custom Variables
+    boost::shared_ptr<ProjectedPixelGrid> m_grid;
     boost::scoped_ptr<Isis::TProjection> m_projection;
     Isis::CameraGroundMap     *m_groundmap;
     Isis::CameraDistortionMap *m_distortmap;
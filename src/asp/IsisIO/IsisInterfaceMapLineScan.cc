@@ -42,12 +42,14 @@
 
 #include <boost/smart_ptr/scoped_ptr.hpp>
 
+#include <boost/bind.hpp>
+
 using namespace vw;
 using namespace asp;
 using namespace asp::isis;
 
 // Constructor
-IsisInterfaceMapLineScan::IsisInterfaceMapLineScan( std::string const& filename ) :
+IsisInterfaceMapLineScan::IsisInterfaceMapLineScan( std::string const& filename, bool use_grid ) :
   IsisInterface( filename ){//, m_projection( Isis::ProjectionFactory::CreateFromCube(*m_label) ) {
 
   Isis::TProjection* tempProj = (Isis::TProjection*)Isis::ProjectionFactory::CreateFromCube(*m_label);
@@ -58,6 +60,9 @@ IsisInterfaceMapLineScan::IsisInterfaceMapLineScan( std::string const& filename
   m_groundmap = m_camera->GroundMap();
   m_focalmap = m_camera->FocalPlaneMap();
   m_cache_px[0] = m_cache_px[1] = std::numeric_limits<double>::quiet_NaN();
+
+  if ( use_grid )
+    m_grid = ProjectedPixelGrid::get( filename, m_projection->Resolution() );
 }
 
 // Custom Functions
@@ -113,6 +118,14 @@ EphemerisLMA::operator()( EphemerisLMA::domain_type const& x ) const {
 
 Vector2
 IsisInterfaceMapLineScan::point_to_pixel( Vector3 const& point ) const {
+  if ( m_grid )
+    return m_grid->point_to_pixel( point, boost::bind( &IsisInterfaceMapLineScan::exact_point_to_pixel,
+                                                       this, _1 ) );
+  return exact_point_to_pixel( point );
+}
+
+Vector2
+IsisInterfaceMapLineScan::exact_point_to_pixel( Vector3 const& point ) const {
 
   // First seed LMA with an ephemeris time in the middle of the image
   double middle_et =
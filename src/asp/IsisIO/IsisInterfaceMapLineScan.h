@@ -25,6 +25,7 @@
 
 // ASP & VW
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/IsisIO/ProjectedPixelGrid.h>
 
 // Isis
 #include <TProjection.h>
@@ -38,7 +39,9 @@ namespace isis {
   class IsisInterfaceMapLineScan : public IsisInterface {
 
   public:
-    IsisInterfaceMapLineScan( std::string const& file );
+    /// If use_grid is true, points are projected into the cube with
+    /// a ProjectedPixelGrid shared by all cameras of this cube.
+    IsisInterfaceMapLineScan( std::string const& file, bool use_grid = false );
 
     virtual std::string type()  { return "MapLineScan"; }
 
@@ -52,7 +55,11 @@ namespace isis {
 
   protected:
 
+    /// Project a point into the cube with ISIS
+    vw::Vector2 exact_point_to_pixel( vw::Vector3 const& point ) const;
+
     // Custom Variables
+    boost::shared_ptr<ProjectedPixelGrid> m_grid;
     mutable vw::Vector2 m_cache_px;
     boost::scoped_ptr<Isis::TProjection> m_projection;
     Isis::CameraDistortionMap *m_distortmap;
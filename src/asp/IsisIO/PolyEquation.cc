@@ -67,21 +67,34 @@ PolyEquation::PolyEquation( int order_x,
   m_max_length = uint8( std::max( order_x, std::max( order_y, order_z ) ) ) + 1;
 }
 
+namespace {
+  // Horner's method
+  inline double eval_poly( Vector<double> const& coeff, double t ) {
+    double result = 0;
+    for ( size_t i = coeff.size(); i > 0; i-- )
+      result = result*t + coeff[i-1];
+    return result;
+  }
+}
+
 // Update
 //-----------------------------------------------
 void PolyEquation::update( double const& t ) {
   m_cached_time = t;
   double delta_t = t-m_time_offset;
-  Vector<double> powers( m_max_length );
-  powers[0] = 1;
-  for ( uint8 i = 1; i < m_max_length; i++ )
-    powers[i] = powers[i-1]*delta_t;
-  m_cached_output[0] = sum( elem_prod(m_x_coeff,
-                                      subvector(powers,0,m_x_coeff.size())) );
-  m_cached_output[1] = sum( elem_prod(m_y_coeff,
-                                      subvector(powers,0,m_y_coeff.size())) );
-  m_cached_output[2] = sum( elem_prod(m_z_coeff,
-                                      subvector(powers,0,m_z_coeff.size())) );
+  m_cached_output[0] = eval_poly( m_x_coeff, delta_t );
+  m_cached_output[1] = eval_poly( m_y_coeff, delta_t );
+  m_cached_output[2] = eval_poly( m_z_coeff, delta_t );
+}
+void PolyEquation::evaluate_many( std::vector<double> const& times,
+                                  std::vector<Vector3> & output ) {
+  output.resize( times.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    double delta_t = times[i]-m_time_offset;
+    output[i][0] = eval_poly( m_x_coeff, delta_t );
+    output[i][1] = eval_poly( m_y_coeff, delta_t );
+    output[i][2] = eval_poly( m_z_coeff, delta_t );
+  }
 }
 
 // FileIO
@@ -50,6 +50,9 @@ namespace asp {
     size_t size() const { return m_x_coeff.size()+m_y_coeff.size()+m_z_coeff.size(); }
     double& operator[]( size_t const& n );
 
+    void evaluate_many( std::vector<double> const& times,
+                        std::vector<vw::Vector3> & output );
+
     void write( std::ofstream &f );
     void read( std::ifstream &f );
   };
@@ -0,0 +1,138 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/IsisIO/ProjectedPixelGrid.h>
+#include <vw/Core/Exception.h>
+
+#include <cmath>
+#include <exception>
+
+using namespace vw;
+using namespace asp::isis;
+
+namespace {
+  vw::Mutex g_grids_mutex;
+  std::map<std::string, boost::shared_ptr<ProjectedPixelGrid> > g_grids;
+}
+
+ProjectedPixelGrid::ProjectedPixelGrid( double spacing, double max_error ):
+  m_spacing(spacing), m_max_error(max_error) {
+  if ( !(spacing > 0) )
+    vw_throw( ArgumentErr() << "The spacing of the projected pixel grid must be positive.\n" );
+}
+
+boost::shared_ptr<ProjectedPixelGrid>
+ProjectedPixelGrid::get( std::string const& file, double meters_per_pixel ) {
+  vw::Mutex::Lock lock( g_grids_mutex );
+  boost::shared_ptr<ProjectedPixelGrid> & grid = g_grids[file];
+  if ( !grid )
+    grid.reset( new ProjectedPixelGrid( CELL_PIXELS * meters_per_pixel ) );
+  return grid;
+}
+
+Vector2 ProjectedPixelGrid::interpolate( Cell const& cell, Vector3 const& frac ) {
+  Vector2 result;
+  for ( int i = 0; i < 8; i++ ) {
+    double w = ( (i & 1)        ? frac[0] : 1 - frac[0] ) *
+               ( ((i >> 1) & 1) ? frac[1] : 1 - frac[1] ) *
+               ( ((i >> 2) & 1) ? frac[2] : 1 - frac[2] );
+    result += w * cell.corners[i];
+  }
+  return result;
+}
+
+ProjectedPixelGrid::Cell
+ProjectedPixelGrid::make_cell( Index const& index, ExactFunc const& exact ) {
+  Cell cell;
+  cell.valid = true;
+
+  for ( int i = 0; i < 8; i++ ) {
+    Index c = corner( index, i );
+    {
+      vw::Mutex::Lock lock( m_mutex );
+      if ( m_bad_corners.count( c ) ) {
+        cell.valid = false;
+        break;
+      }
+      std::map<Index, Vector2>::const_iterator it = m_corners.find( c );
+      if ( it != m_corners.end() ) {
+        cell.corners[i] = it->second;
+        continue;
+      }
+    }
+
+    // ISIS is called without the lock, with the camera of this thread
+    bool good = true;
+    try {
+      cell.corners[i] = exact( m_spacing * Vector3( c.x, c.y, c.z ) );
+    } catch ( std::exception const& ) {
+      good = false;
+    }
+
+    vw::Mutex::Lock lock( m_mutex );
+    if ( good ) {
+      m_corners[c] = cell.corners[i];
+    } else {
+      m_bad_corners.insert( c );
+      cell.valid = false;
+      break;
+    }
+  }
+  if ( !cell.valid )
+    return cell;
+
+  // Check at the center, which is the farthest from the corners
+  Vector3 half( 0.5, 0.5, 0.5 );
+  try {
+    Vector2 px = exact( m_spacing * ( Vector3( index.x, index.y, index.z ) + half ) );
+    cell.valid = norm_2( px - interpolate( cell, half ) ) <= m_max_error;
+  } catch ( std::exception const& ) {
+    cell.valid = false;
+  }
+  return cell;
+}
+
+Vector2 ProjectedPixelGrid::point_to_pixel( Vector3 const& point, ExactFunc const& exact ) {
+  Vector3 scaled = point / m_spacing;
+  Vector3 base( std::floor( scaled[0] ), std::floor( scaled[1] ), std::floor( scaled[2] ) );
+  for ( int i = 0; i < 3; i++ ) {
+    if ( !( std::abs( base[i] ) < 1e9 ) ) // also NaN
+      return exact( point );
+  }
+  Index index( int( base[0] ), int( base[1] ), int( base[2] ) );
+
+  Cell cell;
+  bool found = false;
+  {
+    vw::Mutex::Lock lock( m_mutex );
+    std::map<Index, Cell>::const_iterator it = m_cells.find( index );
+    if ( it != m_cells.end() ) {
+      cell  = it->second;
+      found = true;
+    }
+  }
+  if ( !found ) {
+    cell = make_cell( index, exact );
+    vw::Mutex::Lock lock( m_mutex );
+    m_cells.insert( std::make_pair( index, cell ) );
+  }
+
+  if ( !cell.valid )
+    return exact( point );
+  return interpolate( cell, scaled - base );
+}
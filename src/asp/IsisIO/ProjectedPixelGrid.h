@@ -0,0 +1,109 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ProjectedPixelGrid.h
+///
+/// A grid of cubes in space, for projecting points into map-projected
+/// ISIS cubes without going through ISIS for each point. The pixel
+/// of each corner of a cube of the grid is found with ISIS the first
+/// time a point in the cube is projected, and afterwards the pixels
+/// of the points in the cube are interpolated from those of its
+/// corners. Before it is used, a cube is checked against ISIS at its
+/// center, and if it does not agree, such as where the ray meets the
+/// ground in a DEM, or where a corner does not project into the
+/// image, ISIS is used for the points in that cube.
+///
+/// There is one grid per cube file in a process, so the copies of a
+/// camera loaded for each thread fill in and use the same grid.
+
+#ifndef __ASP_ISIS_PROJECTED_PIXEL_GRID_H__
+#define __ASP_ISIS_PROJECTED_PIXEL_GRID_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace asp {
+namespace isis {
+
+  class ProjectedPixelGrid {
+  public:
+    /// Projects a point into the cube with ISIS, throwing if it cannot
+    typedef boost::function<vw::Vector2 (vw::Vector3 const&)> ExactFunc;
+
+    /// The cubes of the grid are spacing meters wide, and a cube is
+    /// used if, at its center, it is within max_error pixels of ISIS.
+    ProjectedPixelGrid( double spacing, double max_error = 0.05 );
+
+    /// The grid of a cube file with pixels of the given size in
+    /// meters, made the first time it is asked for, with cubes
+    /// CELL_PIXELS pixels wide.
+    static boost::shared_ptr<ProjectedPixelGrid> get( std::string const& file,
+                                                      double meters_per_pixel );
+
+    static const int CELL_PIXELS = 32;
+
+    /// The pixel of a point, from the grid if its cube agrees with
+    /// ISIS, or else with exact(), which is also used to fill in the grid.
+    vw::Vector2 point_to_pixel( vw::Vector3 const& point, ExactFunc const& exact );
+
+  private:
+    struct Index {
+      int x, y, z;
+      Index( int x_, int y_, int z_ ): x(x_), y(y_), z(z_) {}
+      bool operator<( Index const& other ) const {
+        if ( x != other.x ) return x < other.x;
+        if ( y != other.y ) return y < other.y;
+        return z < other.z;
+      }
+    };
+
+    struct Cell {
+      bool        valid;
+      vw::Vector2 corners[8]; // in the order of corner()
+    };
+
+    Index corner( Index const& cell, int i ) const {
+      return Index( cell.x + (i & 1), cell.y + ((i >> 1) & 1), cell.z + ((i >> 2) & 1) );
+    }
+
+    /// Find the pixels of the corners of a cell with ISIS, and check
+    /// the cell at its center.
+    Cell make_cell( Index const& cell, ExactFunc const& exact );
+
+    /// Trilinear interpolation over a cell, with the position of the
+    /// point in the cell in [0, 1]^3.
+    static vw::Vector2 interpolate( Cell const& cell, vw::Vector3 const& frac );
+
+    double m_spacing, m_max_error;
+
+    vw::Mutex                    m_mutex;
+    std::map<Index, Cell>        m_cells;
+    std::map<Index, vw::Vector2> m_corners;     // shared by neighboring cells
+    std::set<Index>              m_bad_corners; // which ISIS did not project
+  };
+
+}}
+
+#endif//__ASP_ISIS_PROJECTED_PIXEL_GRID_H__
@@ -19,8 +19,9 @@
 #include <vw/Math/Vector.h>
 #include <asp/IsisIO/RPNEquation.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
-#include <stack>
 #include <vector>
 
 #include <boost/algorithm/string/classification.hpp>
@@ -29,15 +30,117 @@
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  // How many values an operation takes from the stack
+  int num_args( RPNEquation::OpCode code ) {
+    switch ( code ) {
+    case RPNEquation::OP_CONST:
+    case RPNEquation::OP_VALUE:
+    case RPNEquation::OP_T:
+      return 0;
+    case RPNEquation::OP_SIN:
+    case RPNEquation::OP_COS:
+    case RPNEquation::OP_TAN:
+    case RPNEquation::OP_ABS:
+      return 1;
+    default:
+      return 2;
+    }
+  }
+
+  inline double apply_unary( RPNEquation::OpCode code, double a ) {
+    switch ( code ) {
+    case RPNEquation::OP_SIN: return sin( a );
+    case RPNEquation::OP_COS: return cos( a );
+    case RPNEquation::OP_TAN: return tan( a );
+    default:                  return fabs( a );
+    }
+  }
+
+  // 'a' is the deeper of the two values on the stack
+  inline double apply_binary( RPNEquation::OpCode code, double a, double b ) {
+    switch ( code ) {
+    case RPNEquation::OP_MUL: return a * b;
+    case RPNEquation::OP_DIV: return a / b;
+    case RPNEquation::OP_SUB: return a - b;
+    case RPNEquation::OP_ADD: return a + b;
+    default:                  return pow( a, b );
+    }
+  }
+
+  std::string op_name( RPNEquation::OpCode code ) {
+    switch ( code ) {
+    case RPNEquation::OP_T:   return "t";
+    case RPNEquation::OP_SIN: return "sin";
+    case RPNEquation::OP_COS: return "cos";
+    case RPNEquation::OP_TAN: return "tan";
+    case RPNEquation::OP_ABS: return "abs";
+    case RPNEquation::OP_MUL: return "*";
+    case RPNEquation::OP_DIV: return "/";
+    case RPNEquation::OP_SUB: return "-";
+    case RPNEquation::OP_ADD: return "+";
+    case RPNEquation::OP_POW: return "^";
+    default:                  return "";
+    }
+  }
+
+  bool name_to_op( std::string const& name, RPNEquation::OpCode & code ) {
+    const RPNEquation::OpCode codes[] = { RPNEquation::OP_T,
+                                          RPNEquation::OP_SIN, RPNEquation::OP_COS,
+                                          RPNEquation::OP_TAN, RPNEquation::OP_ABS,
+                                          RPNEquation::OP_MUL, RPNEquation::OP_DIV,
+                                          RPNEquation::OP_SUB, RPNEquation::OP_ADD,
+                                          RPNEquation::OP_POW };
+    for ( size_t i = 0; i < sizeof(codes)/sizeof(codes[0]); i++ ) {
+      if ( name == op_name( codes[i] ) ) {
+        code = codes[i];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Evaluate the parts of the program which do not depend on t. A
+  // value on the stack which does not depend on t was made by the
+  // last of the operations emitted so far, as a single OP_VALUE.
+  void fold_program( std::vector<RPNEquation::Op> const& ops,
+                     std::vector<double> const& consts,
+                     std::vector<RPNEquation::Op> & folded ) {
+    folded.clear();
+    std::vector<bool> is_value; // For each value on the stack
+    for ( size_t i = 0; i < ops.size(); i++ ) {
+      RPNEquation::Op const& op = ops[i];
+      int n = num_args( op.code );
+      if ( op.code == RPNEquation::OP_CONST ) {
+        folded.push_back( RPNEquation::Op( RPNEquation::OP_VALUE, 0, consts[op.index] ) );
+        is_value.push_back( true );
+      } else if ( n == 0 ) {
+        folded.push_back( op );
+        is_value.push_back( op.code == RPNEquation::OP_VALUE );
+      } else if ( n == 1 && is_value.back() ) {
+        folded.back().value = apply_unary( op.code, folded.back().value );
+      } else if ( n == 2 && is_value[is_value.size()-1] && is_value[is_value.size()-2] ) {
+        double b = folded.back().value;
+        folded.pop_back();
+        folded.back().value = apply_binary( op.code, folded.back().value, b );
+        is_value.pop_back();
+      } else {
+        folded.push_back( op );
+        is_value.resize( is_value.size() - n );
+        is_value.push_back( false );
+      }
+    }
+  }
+}
+
 // Constructors
 //-----------------------------------------------------
 RPNEquation::RPNEquation() {
-  m_x_eq.clear();
   m_x_consts.clear();
-  m_y_eq.clear();
   m_y_consts.clear();
-  m_z_eq.clear();
   m_z_consts.clear();
+  m_folded = false;
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -47,6 +150,7 @@ RPNEquation::RPNEquation( std::string x_eq,
   string_to_eqn( x_eq, m_x_eq, m_x_consts );
   string_to_eqn( y_eq, m_y_eq, m_y_consts );
   string_to_eqn( z_eq, m_z_eq, m_z_consts );
+  m_folded = false;
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -54,128 +158,158 @@ RPNEquation::RPNEquation( std::string x_eq,
 // Update
 //-----------------------------------------------------
 void RPNEquation::update( double const& t ) {
+  if ( !m_folded )
+    fold();
   m_cached_time = t;
   double delta_t = t - m_time_offset;
-  m_cached_output[0] = evaluate( m_x_eq,
-                                 m_x_consts,
-                                 delta_t );
-  m_cached_output[1] = evaluate( m_y_eq,
-                                 m_y_consts,
-                                 delta_t );
-  m_cached_output[2] = evaluate( m_z_eq,
-                                 m_z_consts,
-                                 delta_t );
+  m_cached_output[0] = evaluate( m_x_eq, delta_t );
+  m_cached_output[1] = evaluate( m_y_eq, delta_t );
+  m_cached_output[2] = evaluate( m_z_eq, delta_t );
 }
 void RPNEquation::string_to_eqn( std::string& str,
-                                 std::vector<std::string>& commands,
+                                 Program& program,
                                  std::vector<double>& consts ) {
-  // Breaks a string into the equation format used internally
-  commands.clear();
-  consts.clear();
+  // Compiles a string into the list of operations used internally
+  std::vector<std::string> commands;
   boost::split( commands, str, boost::is_any_of(" ="));
+  program.ops.clear();
+  program.folded.clear();
+  program.max_depth = 0;
+  consts.clear();
+  m_folded = false;
 
-  // Cleaning out any tokens that are just ""
-  for(std::vector<std::string>::iterator iter = commands.begin();
-      iter != commands.end(); ++iter ) {
-    if ( (*iter) == "" ) {
-      iter = commands.erase(iter);
-      iter--;
-    }
-  }
+  size_t depth = 0;
+  for ( size_t i = 0; i < commands.size(); i++ ) {
+    std::string const& command = commands[i];
+    if ( command == "" )
+      continue;
 
-  // Pulling out the numbers
-  for(std::vector<std::string>::iterator iter = commands.begin();
-      iter != commands.end(); ++iter ) {
-    if ( isdigit( (*iter)[(*iter).size()-1] ) ) {
-      consts.push_back( atof( iter->c_str() ) );
-      *iter = "c";
+    OpCode code;
+    if ( isdigit( command[command.size()-1] ) ) {
+      program.ops.push_back( Op( OP_CONST, consts.size() ) );
+      consts.push_back( atof( command.c_str() ) );
+    } else if ( name_to_op( command, code ) ) {
+      int n = num_args( code );
+      if ( n == 1 && depth < 1 )
+        vw_throw( IOErr() << "Insufficient arguments for RPN command: "
+                  << command << "\n" );
+      if ( n == 2 && depth < 2 )
+        vw_throw( IOErr() << "Insufficient arguments for command: "
+                  << command << "\n" );
+      program.ops.push_back( Op( code ) );
+    } else {
+      vw_throw( IOErr() << "Unknown RPN operator: " << command << "\n" );
     }
+    depth = depth - num_args( program.ops.back().code ) + 1;
+    program.max_depth = std::max( program.max_depth, depth );
   }
+
+  if ( !program.ops.empty() && depth != 1 )
+    vw_throw( IOErr() << "Unbalanced RPN equation! More constants than need by operators.\n" );
 }
-double RPNEquation::evaluate( std::vector<std::string>& commands,
-                              std::vector<double>& consts,
+void RPNEquation::fold() {
+  fold_program( m_x_eq.ops, m_x_consts, m_x_eq.folded );
+  fold_program( m_y_eq.ops, m_y_consts, m_y_eq.folded );
+  fold_program( m_z_eq.ops, m_z_consts, m_z_eq.folded );
+  m_stack.resize( std::max( m_x_eq.max_depth,
+                            std::max( m_y_eq.max_depth, m_z_eq.max_depth ) ) );
+  m_folded = true;
+}
+double RPNEquation::evaluate( Program const& program,
                               double const& t ) {
-  // Evaluates an equation in the internal format
-  if ( commands.empty() )
+  // Evaluates a folded program
+  if ( program.folded.empty() )
     return 0;
-  int consts_index = 0;
-  std::stack<double> rpn_stack;
-  double buffer;
-  for ( std::vector<std::string>::iterator iter = commands.begin();
-        iter != commands.end(); ++iter ) {
-    if ( *iter == "c" ) {
-      rpn_stack.push( consts[consts_index] );
-      consts_index++;
-    } else if ( *iter == "t" ) {
-      rpn_stack.push( t );
-    } else if ( rpn_stack.size() < 1 ) {
-      vw_throw( IOErr() << "Insufficient arguments for RPN command: "
-                << *iter << "\n" );
-    } else if ( *iter == "sin" ) {
-      buffer = sin( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "cos" ) {
-      buffer = cos( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "tan" ) {
-      buffer = tan( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "abs" ) {
-      buffer = fabs( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( rpn_stack.size() < 2 ) {
-      vw_throw( IOErr() << "Insufficient arguments for command: "
-                << *iter << "\n" );
-    } else if ( *iter == "*" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer *= rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "/" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() / buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "-" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() - buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "+" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer += rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "^" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = pow( rpn_stack.top(), buffer );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else {
-      vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
+  double* stack = &m_stack[0];
+  size_t top = 0; // One past the top
+  for ( std::vector<Op>::const_iterator iter = program.folded.begin();
+        iter != program.folded.end(); ++iter ) {
+    switch ( iter->code ) {
+    case OP_VALUE: stack[top++] = iter->value; break;
+    case OP_T:     stack[top++] = t;           break;
+    case OP_SIN: case OP_COS: case OP_TAN: case OP_ABS:
+      stack[top-1] = apply_unary( iter->code, stack[top-1] );
+      break;
+    default:
+      top--;
+      stack[top-1] = apply_binary( iter->code, stack[top-1], stack[top] );
+      break;
     }
   } // End of calculator
 
-  if ( rpn_stack.size() != 1 )
-    vw_throw( IOErr() << "Unbalanced RPN equation! More constants than need by operators.\n" );
+  return stack[0];
+}
+void RPNEquation::evaluate_program_many( Program const& program,
+                                         double const* t, size_t num,
+                                         double* output ) {
+  // Evaluates a folded program at many times, one operation at a
+  // time, with a stack of rows of num values
+  if ( program.folded.empty() ) {
+    std::fill( output, output + num, 0.0 );
+    return;
+  }
+  double* stack = &m_stack[0];
+  size_t rows = 0; // On the stack
+  for ( std::vector<Op>::const_iterator iter = program.folded.begin();
+        iter != program.folded.end(); ++iter ) {
+    switch ( iter->code ) {
+    case OP_VALUE:
+      std::fill( stack + rows*num, stack + (rows+1)*num, iter->value );
+      rows++;
+      break;
+    case OP_T:
+      std::copy( t, t + num, stack + rows*num );
+      rows++;
+      break;
+    case OP_SIN: case OP_COS: case OP_TAN: case OP_ABS: {
+      double* top = stack + (rows-1)*num;
+      for ( size_t i = 0; i < num; i++ )
+        top[i] = apply_unary( iter->code, top[i] );
+      break;
+    }
+    default: {
+      rows--;
+      double* top = stack + (rows-1)*num;
+      for ( size_t i = 0; i < num; i++ )
+        top[i] = apply_binary( iter->code, top[i], top[num+i] );
+      break;
+    }
+    }
+  }
+  std::copy( stack, stack + num, output );
+}
+void RPNEquation::evaluate_many( std::vector<double> const& times,
+                                 std::vector<vw::Vector3> & output ) {
+  // In chunks, so the stack stays in the cache
+  const size_t CHUNK = 256;
+  if ( !m_folded )
+    fold();
+  size_t max_depth = m_stack.size();
+  std::vector<double> stack( std::max( max_depth, size_t(1) ) * CHUNK ), delta_t( CHUNK ),
+    values( CHUNK );
+  m_stack.swap( stack );
+
+  output.resize( times.size() );
+  for ( size_t beg = 0; beg < times.size(); beg += CHUNK ) {
+    size_t num = std::min( CHUNK, times.size() - beg );
+    for ( size_t i = 0; i < num; i++ )
+      delta_t[i] = times[beg+i] - m_time_offset;
+    for ( int axis = 0; axis < 3; axis++ ) {
+      Program const& program = axis == 0 ? m_x_eq : ( axis == 1 ? m_y_eq : m_z_eq );
+      evaluate_program_many( program, &delta_t[0], num, &values[0] );
+      for ( size_t i = 0; i < num; i++ )
+        output[beg+i][axis] = values[i];
+    }
+  }
 
-  return rpn_stack.top();
+  m_stack.swap( stack );
 }
 
 // FileIO
 //-----------------------------------------------------
 void RPNEquation::write( std::ofstream &f ) {
   for ( int i = 0; i < 3; i++ ) {
-    std::vector<std::string>* eq_ptr = NULL;
+    Program* eq_ptr = NULL;
     std::vector<double>* cs_ptr = NULL;
     switch(i) {
     case 0:
@@ -193,14 +327,11 @@ void RPNEquation::write( std::ofstream &f ) {
     }
 
     f << std::setprecision( 15 );
-    int cs_idx = 0;
-    for ( unsigned j = 0; j < eq_ptr->size(); j++ ) {
-      if ( (*eq_ptr)[j] == "c" ) {
-        f << (*cs_ptr)[cs_idx] << " ";
-        cs_idx++;
-      } else {
-        f << (*eq_ptr)[j] << " ";
-      }
+    for ( unsigned j = 0; j < eq_ptr->ops.size(); j++ ) {
+      if ( eq_ptr->ops[j].code == OP_CONST )
+        f << (*cs_ptr)[eq_ptr->ops[j].index] << " ";
+      else
+        f << op_name( eq_ptr->ops[j].code ) << " ";
     }
     f << "\n";
   }
@@ -223,7 +354,9 @@ void RPNEquation::read( std::ifstream &f ) {
 // Constant Access
 //-----------------------------------------------------
 double& RPNEquation::operator[]( size_t const& n ) {
+  // The constant may be changed through the reference
   m_cached_time = -1;
+  m_folded = false;
   if ( n >= m_x_consts.size() + m_y_consts.size()
        + m_z_consts.size() )
     vw_throw( ArgumentErr() << "RPNEquation: invalid index." );
@@ -21,6 +21,7 @@
 
 // STL
 #include <vector>
+#include <string>
 // ASP
 #include <asp/IsisIO/BaseEquation.h>
 
@@ -37,22 +38,53 @@ namespace asp {
   //  *, /, -, +, ^
   //
   // Remember: Have your equation space delimited
-  // Also: 'c' is an internal place holder for RPNEquation
+  //
+  // The equations are compiled once, when made or read, into a list
+  // of operations, which refer to the constants by index so these can
+  // be changed through operator[]. Before an evaluation after such a
+  // change, the parts which do not depend on t are evaluated once and
+  // replaced by their values.
   class RPNEquation : public BaseEquation {
-    std::vector<std::string> m_x_eq;
+  public:
+    enum OpCode { OP_CONST, // Push a constant of the equation, by index
+                  OP_VALUE, // Push a value found by folding constants
+                  OP_T,
+                  OP_SIN, OP_COS, OP_TAN, OP_ABS,
+                  OP_MUL, OP_DIV, OP_SUB, OP_ADD, OP_POW };
+    struct Op {
+      OpCode code;
+      size_t index;
+      double value;
+      Op( OpCode c, size_t i = 0, double v = 0 ) : code(c), index(i), value(v) {}
+    };
+
+  private:
+    struct Program {
+      std::vector<Op> ops;    // As written
+      std::vector<Op> folded; // With the constant parts evaluated
+      size_t max_depth;       // Of the stack
+      Program() : max_depth(0) {}
+    };
+
+    Program m_x_eq;
     std::vector<double> m_x_consts;
-    std::vector<std::string> m_y_eq;
+    Program m_y_eq;
     std::vector<double> m_y_consts;
-    std::vector<std::string> m_z_eq;
+    Program m_z_eq;
     std::vector<double> m_z_consts;
+    bool m_folded;
+    std::vector<double> m_stack;
 
     void update( double const& t );
     void string_to_eqn( std::string& str,
-                        std::vector<std::string>& commands,
+                        Program& program,
                         std::vector<double>& consts );
-    double evaluate( std::vector<std::string>& commands,
-                     std::vector<double>& consts,
+    void fold();
+    double evaluate( Program const& program,
                      double const& t );
+    void evaluate_program_many( Program const& program,
+                                double const* t, size_t num,
+                                double* output );
   public:
     RPNEquation();
     RPNEquation( std::string x_eq,
@@ -64,6 +96,9 @@ namespace asp {
         m_y_consts.size() + m_z_consts.size(); }
     double& operator[]( size_t const& n );
 
+    void evaluate_many( std::vector<double> const& times,
+                        std::vector<vw::Vector3> & output );
+
     void write( std::ofstream &f );
     void read( std::ifstream &f );
   };
@@ -0,0 +1,113 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BenchIsisCameraModel.cxx
+///
+/// Time the ISIS camera interfaces on the cubes in this directory, the
+/// same way as Camera/tests/BenchCameraModels does for the other camera
+/// models, and with the same CSV output. Not run by "make check". Use
+///
+///   BenchIsisCameraModel [num_points] [num_threads] [output.csv]
+///
+/// With more than one thread, each thread gets its own ISIS camera.
+/// The results are written as JSON if the output file name ends in .json.
+
+#include <asp/Camera/CameraBenchmark.h>
+#include <asp/IsisIO/IsisCameraModel.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Exception.h>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <fstream>
+
+using namespace vw;
+using namespace vw::camera;
+
+int main(int argc, char* argv[]){
+
+  try {
+    int num_points  = 2000;
+    int num_threads = vw_settings().default_num_threads();
+    if (argc > 1) num_points  = boost::lexical_cast<int>(argv[1]);
+    if (argc > 2) num_threads = boost::lexical_cast<int>(argv[2]);
+    if (num_points <= 0 || num_threads <= 0)
+      vw_throw( ArgumentErr() << "The number of points and of threads must be positive.\n" );
+
+    std::ofstream ofs;
+    if (argc > 3){
+      ofs.open(argv[3]);
+      if (!ofs.is_open())
+        vw_throw( IOErr() << "Unable to open for writing: " << argv[3] << "\n" );
+    }
+    std::ostream & os = (argc > 3) ? ofs : std::cout;
+    os.precision(10);
+
+    std::vector<std::string> files;
+    files.push_back("E1701676.reduce.cub"); // Linescan
+    files.push_back("5165r.cub");           // Frame
+    files.push_back("5165r.map.cub");
+    files.push_back("E0201461.tiny.cub");
+
+    std::vector<int> thread_counts;
+    thread_counts.push_back(1);
+    if (num_threads > 1)
+      thread_counts.push_back(num_threads);
+
+    std::vector<asp::CameraBenchmarkResult> results;
+    for (size_t j = 0; j < files.size(); j++){
+      std::string cube = std::string(TEST_SRCDIR) + "/" + files[j];
+
+      // The tabulated model only changes linescan cameras, but it is
+      // cheap to try it on all of them.
+      for (int native = 0; native < 2; native++){
+        IsisCameraModel cam(cube, true, native == 1);
+        std::string name = files[j] + (native == 1 ? ":tabulated" : ":isis");
+
+        Vector3 radii = cam.target_radii();
+        double radius1 = (radii[0] + radii[1]) / 2;
+        cartography::Datum datum("D_" + cam.target_name(), cam.target_name(),
+                                 "Reference Meridian", radius1, radii[2], 0);
+
+        BBox2 box(0, 0, cam.samples() - 1, cam.lines() - 1);
+        for (int p = 0; p < 2; p++){
+          std::string pattern = (p == 0) ? "grid" : "random";
+          std::vector<Vector2> pixels = (p == 0) ?
+            asp::structured_benchmark_pixels(box, num_points) :
+            asp::random_benchmark_pixels(box, num_points);
+          for (size_t t = 0; t < thread_counts.size(); t++)
+            results.push_back(asp::benchmark_camera(name, pattern, cam, datum, pixels,
+                                                    thread_counts[t]));
+        }
+      }
+    }
+
+    if (argc > 3 && asp::is_json_benchmark_output(argv[3])){
+      asp::write_camera_benchmark_json(os, "BenchIsisCameraModel", results);
+    }else{
+      asp::write_camera_benchmark_header(os);
+      for (size_t k = 0; k < results.size(); k++)
+        asp::write_camera_benchmark_result(os, results[k]);
+    }
+
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
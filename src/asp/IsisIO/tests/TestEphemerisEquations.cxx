@@ -126,3 +126,54 @@ TEST(EphemerisEquations, reversepolish) {
   EXPECT_NEAR( 15.4176744337735, test[1], DELTA );
   EXPECT_NEAR( 2737.72972972973, test[2], DELTA );
 }
+
+TEST(EphemerisEquations, reversepolish_constant_parts) {
+  // The parts without t are evaluated once, and again after the
+  // constants change
+  RPNEquation rpn( "2 3 ^ t * 1 2 / +", "4 sin", "" );
+  EXPECT_EQ( 5u, rpn.size() );
+  Vector3 test = rpn(2);
+  EXPECT_NEAR( 16.5, test[0], DELTA );
+  EXPECT_NEAR( sin(4.0), test[1], DELTA );
+  EXPECT_EQ( 0, test[2] );
+
+  rpn[1] = 2;
+  rpn[4] = 0;
+  test = rpn(2);
+  EXPECT_NEAR( 8.5, test[0], DELTA );
+  EXPECT_NEAR( sin(0.0), test[1], DELTA );
+}
+
+TEST(EphemerisEquations, reversepolish_invalid) {
+  EXPECT_THROW( RPNEquation( "t +", "t", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t", "sin", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t", "t", "t 2" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t", "t log", "t" ), IOErr );
+}
+
+TEST(EphemerisEquations, evaluate_many) {
+  RPNEquation rpn( "3 t t * * 1 +", "t sin 4 * t +", "t t 2 * * 5 t / - abs" );
+  rpn.set_time_offset( -20 );
+  PolyEquation poly(0,2,1);
+  poly[0] = 11;
+  poly[1] = -5; poly[2] = 0.6; poly[3] = .1;
+  poly[4] = -4; poly[5] = 2.5;
+
+  // More than one chunk of the RPN evaluation
+  std::vector<double> times;
+  for ( int i = 0; i < 700; i++ )
+    times.push_back( -30 + 0.1*i + 0.05 );
+
+  std::vector<Vector3> rpn_out, poly_out;
+  rpn.evaluate_many( times, rpn_out );
+  poly.evaluate_many( times, poly_out );
+  ASSERT_EQ( times.size(), rpn_out.size() );
+  ASSERT_EQ( times.size(), poly_out.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    Vector3 rpn_test = rpn(times[i]), poly_test = poly(times[i]);
+    for ( int j = 0; j < 3; j++ ) {
+      EXPECT_NEAR( rpn_test[j],  rpn_out[i][j],  DELTA );
+      EXPECT_NEAR( poly_test[j], poly_out[i][j], DELTA );
+    }
+  }
+}
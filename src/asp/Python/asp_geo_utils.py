@@ -99,6 +99,11 @@ def getImageGeoInfo(imagePath, getStats=True):
         outputDict['point_offset'] =  (float(offsetValues[0]), float(offsetValues[1]), float(offsetValues[2]))        
     except:
         pass # In most cases this line will not be present
+    try:
+        pointScaleLine = asp_string_utils.getLineAfterText(textOutput, 'POINT_SCALE=') # Tag name must be synced with C++ code
+        outputDict['point_scale'] = pointScaleLine.split(' ')[0]
+    except:
+        pass # Only present in fixed-point clouds
 
     # TODO: Currently this does not find much information, and there
     #       is another function in image_utils dedicated to returning statistics.
@@ -429,7 +434,11 @@ def build_vrt( fullImageSize, tileLocs, tilePaths, outputPath ):
     # This special metadata value is only used for ASP stereo point cloud files!    
     if 'point_offset' in gdalInfo:
         f.write("  <Metadata>\n    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
-                gdalInfo['point_offset'][0] + "</MDI>\n  </Metadata>\n")
+                gdalInfo['point_offset'][0] + "</MDI>\n")
+        if 'point_scale' in gdalInfo: # fixed-point clouds
+            f.write("    <MDI key=\"" + 'POINT_SCALE' + "\">" +
+                    gdalInfo['point_scale'] + "</MDI>\n")
+        f.write("  </Metadata>\n")
       
 
     # Write each band
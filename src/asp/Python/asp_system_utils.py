@@ -61,6 +61,23 @@ def get_prog_version(prog):
         return m.group(1)
     return ""
 
+def get_memory_mb():
+    """Return the total and available memory on the current machine, in MB.
+    Return zeros if this cannot be found."""
+
+    vals = {}
+    try:
+        for line in open('/proc/meminfo', 'r'):
+            m = re.match('^(\w+):\s+(\d+)', line)
+            if m:
+                vals[m.group(1)] = float(m.group(2))/1024.0 # it is in KB
+    except IOError:
+        return (0.0, 0.0)
+
+    total_mb     = vals.get('MemTotal', 0.0)
+    available_mb = vals.get('MemAvailable', vals.get('MemFree', 0.0))
+    return (total_mb, available_mb)
+
 def get_num_cpus():
     """Return the number of CPUs on the current machine."""
 
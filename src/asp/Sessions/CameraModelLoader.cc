@@ -38,6 +38,9 @@
 #include <asp/Sessions/CameraModelLoader.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/CameraModelCache.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <map>
@@ -48,6 +51,16 @@
 
 namespace asp {
 
+namespace {
+  // The cache file for a camera, if caching is on and this is an XML file
+  std::string cache_file_for(std::string const& path, std::string const& kind) {
+    std::string ext = boost::to_lower_copy(boost::filesystem::path(path).extension().string());
+    if (ext != ".xml")
+      return "";
+    return camera_cache_file(stereo_settings().camera_cache_dir, path, kind);
+  }
+}
+
 CameraModelLoader::CameraModelLoader()
 {
   xercesc::XMLPlatformUtils::Initialize();
@@ -67,12 +80,18 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_pinhole_camer
 // - TODO: Move to another file
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_rpc_camera_model(std::string const& path) const
 {
+  std::string cache_file = cache_file_for(path, "rpc");
+  boost::shared_ptr<RPCModel> cached_model;
+  if (read_rpc_camera_cache(cache_file, cached_model))
+    return cached_model;
+
   // Try the default loading method
   RPCModel* rpc_model = NULL;
   try {
     RPCXML rpc_xml; // This is for reading XML files
     rpc_xml.read_from_file(path);
     rpc_model = new RPCModel(*rpc_xml.rpc_ptr()); // Copy the value
+    write_rpc_camera_cache(cache_file, *rpc_model);
   } catch (...) {}
   if (!rpc_model) // The default loading method failed, try the backup method.
   {
@@ -88,8 +107,14 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_rpc_camera_mo
 // Load a DG camera file
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_dg_camera_model(std::string const& path) const
 {
-  // Redirect to the call from LinescanDGModel.h file
-  return CameraModelPtr(load_dg_camera_model_from_xml(path));
+  // Redirect to the calls from LinescanDGModel.h file
+  DGCameraData data;
+  std::string cache_file = cache_file_for(path, "dg");
+  if (!read_dg_camera_cache(cache_file, data)) {
+    read_dg_camera_data_from_xml(path, data);
+    write_dg_camera_cache(cache_file, data);
+  }
+  return CameraModelPtr(dg_camera_model_from_data(data));
 }
 
 // Load a spot5 camera file
@@ -113,7 +138,9 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_ASTER_camera_
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_isis_camera_model(std::string const& path) const
 {
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
-  return CameraModelPtr(new vw::camera::IsisCameraModel(path));
+  return CameraModelPtr(new vw::camera::IsisCameraModel(path,
+                                                        stereo_settings().isis_per_thread_cameras,
+                                                        stereo_settings().isis_tabulated_linescan));
 #endif
   // If ISIS was not enabled in the build, just throw an exception.
   vw::vw_throw( vw::NoImplErr() << "\nCannot load ISIS files because ISIS was not enabled in the build!.\n");
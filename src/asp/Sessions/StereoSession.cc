@@ -20,6 +20,7 @@
 ///
 #include <vw/Core/Exception.h>
 #include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
 #include <vw/Math/Vector.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Image/PixelMask.h>
@@ -30,6 +31,9 @@
 
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MappedTiff.h>
+#include <asp/Core/DecodedImageCache.h>
+#include <asp/Core/IntegerImage.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
@@ -39,6 +43,11 @@
 #include <utility>
 #include <string>
 #include <ostream>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
 #include <limits>
 
 using namespace vw;
@@ -69,6 +78,54 @@ namespace asp {
     m_input_dem         = input_dem;
   }
 
+  // The process-wide camera cache, see enable_camera_cache().
+  namespace {
+    bool g_camera_cache_enabled = false;
+    vw::Mutex g_camera_cache_mutex;
+    std::map<std::string, boost::shared_ptr<vw::camera::CameraModel> > g_camera_cache;
+  }
+
+  void StereoSession::enable_camera_cache(bool enable) {
+    vw::Mutex::Lock lock(g_camera_cache_mutex);
+    g_camera_cache_enabled = enable;
+    if (!enable)
+      g_camera_cache.clear();
+  }
+
+  std::string StereoSession::camera_cache_key(std::string const& image_file,
+                                              std::string const& camera_file) const {
+    // The camera also depends on the cropped image files and the DEM
+    // (via the pixel offset), and on the adjustments and alignment.
+    std::ostringstream os;
+    os << name() << '\n' << image_file << '\n' << camera_file << '\n'
+       << m_left_image_file  << '\n' << m_right_image_file  << '\n'
+       << m_left_camera_file << '\n' << m_right_camera_file << '\n'
+       << m_input_dem << '\n' << stereo_settings().bundle_adjust_prefix << '\n'
+       << stereo_settings().alignment_method;
+    return os.str();
+  }
+
+  boost::shared_ptr<vw::camera::CameraModel>
+  StereoSession::cached_camera_model(std::string const& image_file,
+                                     std::string const& camera_file) const {
+    vw::Mutex::Lock lock(g_camera_cache_mutex);
+    if (!g_camera_cache_enabled)
+      return boost::shared_ptr<vw::camera::CameraModel>();
+    std::map<std::string, boost::shared_ptr<vw::camera::CameraModel> >::const_iterator it
+      = g_camera_cache.find(camera_cache_key(image_file, camera_file));
+    if (it == g_camera_cache.end())
+      return boost::shared_ptr<vw::camera::CameraModel>();
+    return it->second;
+  }
+
+  void StereoSession::cache_camera_model(std::string const& image_file,
+                                         std::string const& camera_file,
+                                         boost::shared_ptr<vw::camera::CameraModel> const& cam) const {
+    vw::Mutex::Lock lock(g_camera_cache_mutex);
+    if (g_camera_cache_enabled && cam.get() != NULL)
+      g_camera_cache[camera_cache_key(image_file, camera_file)] = cam;
+  }
+
   // A default IP matching implementation that derived classes can use
   bool StereoSession::ip_matching(std::string const& input_file1,
 				  std::string const& input_file2,
@@ -79,7 +136,9 @@ namespace asp {
 				  float nodata1, float nodata2,
 				  std::string const& match_filename,
 				  vw::camera::CameraModel* cam1,
-				  vw::camera::CameraModel* cam2){
+				  vw::camera::CameraModel* cam2,
+				  std::string const& ip_cache_prefix1,
+				  std::string const& ip_cache_prefix2){
 
     bool crop_left  = ( stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
     bool crop_right = ( stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
@@ -106,6 +165,7 @@ namespace asp {
 
     DiskImageView<float> image1(rsrc1), image2(rsrc2);
     ImageViewRef<float> image1_norm=image1, image2_norm=image2;
+    std::string cache_prefix1 = ip_cache_prefix1, cache_prefix2 = ip_cache_prefix2;
     // Get normalized versions of the images for OpenCV based methods
     if ( (stereo_settings().ip_matching_method != DETECT_IP_METHOD_INTEGRAL) &&
        (stats1[0] != stats1[1]) ) { // Don't normalize if no stats were provided!
@@ -115,6 +175,16 @@ namespace asp {
                        true, // Use percentile based stretch for ip matching
                        stats1,      stats2,
                        image1_norm, image2_norm);
+
+      // With joint normalization each image is affected by the
+      // other one, so its interest points can't be reused.
+      if (!stereo_settings().individually_normalize &&
+          (!cache_prefix1.empty() || !cache_prefix2.empty())) {
+        vw_out() << "\t--> Not caching interest points, as the images are not "
+                 << "individually normalized.\n";
+        cache_prefix1 = "";
+        cache_prefix2 = "";
+      }
     }
 
     bool nadir_facing = this->is_nadir_facing();
@@ -122,7 +192,8 @@ namespace asp {
     bool inlier = false;
     if (nadir_facing) {
       // Run an IP matching function that takes the camera and datum info into account
-      bool single_threaded_camera = true; // TODO: This is probably needed only for ISIS.
+      // TODO: This is probably needed only for ISIS.
+      bool single_threaded_camera = !stereo_settings().isis_per_thread_cameras;
 
       bool use_sphere_for_isis = false; // Assume Mars is not a sphere
       cartography::Datum datum = this->get_datum(cam1, use_sphere_for_isis);
@@ -176,7 +247,11 @@ namespace asp {
                              ip_per_tile,
                              datum, match_filename,
                              epipolar_threshold, ip_uniqueness_thresh,
-                             nodata1, nodata2);              
+                             nodata1, nodata2,
+                             TransformRef(TranslateTransform(0,0)),
+                             TransformRef(TranslateTransform(0,0)),
+                             true, // transform_to_original_coord
+                             cache_prefix1, cache_prefix2);
       }
       else {
         inlier = ip_matching_w_alignment(single_threaded_camera, cam1, cam2,
@@ -184,7 +259,10 @@ namespace asp {
                                          ip_per_tile,
                                          datum, match_filename,
                                          epipolar_threshold, ip_uniqueness_thresh,
-                                         nodata1, nodata2);
+                                         nodata1, nodata2,
+                                         TransformRef(TranslateTransform(0,0)),
+                                         TransformRef(TranslateTransform(0,0)),
+                                         cache_prefix1);
       }
     } else { // Not nadir facing
       // Run a simpler purely image based matching function
@@ -200,7 +278,8 @@ namespace asp {
                                        ip_per_tile,
                                        match_filename,
                                        inlier_threshold,
-                                       nodata1, nodata2);
+                                       nodata1, nodata2,
+                                       cache_prefix1, cache_prefix2);
     }
     if (!inlier) {
       boost::filesystem::remove(match_filename);
@@ -302,7 +381,7 @@ namespace asp {
 
   ImageViewRef<PixelMask<Vector2f> >
   StereoSession::pre_pointcloud_hook(std::string const& input_file) {
-    return DiskImageView<PixelMask<Vector2f> >( input_file );
+    return asp::open_intermediate<PixelMask<Vector2f> >( input_file );
   }
 
   void StereoSession::post_pointcloud_hook(std::string const& input_file,
@@ -400,9 +479,16 @@ shared_preprocessing_hook(vw::cartography::GdalWriteOptions              & optio
       vw_log().console_log().rule_set().add_rule(-1,"fileio");
       DiskImageView<PixelGray<float32> > out_left (left_output_file );
       DiskImageView<PixelGray<float32> > out_right(right_output_file);
-      vw_out(InfoMessage) << "\t--> Using cached normalized input images.\n";
+      // Redo them if they were saved with other pixels than asked for now
+      ChannelTypeEnum channel_type
+        = asp::preprocessed_channel_type(stereo_settings().preprocessed_image_bits);
+      if (image_format(left_output_file ).channel_type == channel_type &&
+          image_format(right_output_file).channel_type == channel_type) {
+        vw_out(InfoMessage) << "\t--> Using cached normalized input images.\n";
+        vw_settings().reload_config();
+        return true; // Return true if we exist early since the images exist
+      }
       vw_settings().reload_config();
-      return true; // Return true if we exist early since the images exist
     } catch (vw::ArgumentErr const& e) {
       // This throws on a corrupted file.
       vw_settings().reload_config();
@@ -411,6 +497,18 @@ shared_preprocessing_hook(vw::cartography::GdalWriteOptions              & optio
     }
   } // End check for existing output files
 
+  // Decode the JPEG2000 images once, with all threads, and read them
+  // from the cache from now on
+  int num_threads = options.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  std::string left_image_file
+    = asp::decoded_image_path(left_input_file,  stereo_settings().image_cache_dir, num_threads);
+  std::string right_image_file
+    = asp::decoded_image_path(right_input_file, stereo_settings().image_cache_dir, num_threads);
+  left_cropped_file  = left_image_file;
+  right_cropped_file = right_image_file;
+
   // See if to crop the images
   if (crop_left) {
     // Crop the image, will use them from now on. Crop the georef as well, if available.
@@ -419,7 +517,7 @@ shared_preprocessing_hook(vw::cartography::GdalWriteOptions              & optio
     has_left_georef = read_georeference(left_georef, left_input_file);
     bool has_nodata = true;
 
-    DiskImageView<float> left_orig_image(left_input_file);
+    DiskImageView<float> left_orig_image(left_image_file);
     BBox2i left_win = stereo_settings().left_image_crop_win;
     left_win.crop (bounding_box(left_orig_image));
 
@@ -438,7 +536,7 @@ shared_preprocessing_hook(vw::cartography::GdalWriteOptions              & optio
     has_right_georef = read_georeference(right_georef, right_input_file);
     bool has_nodata = true;
 
-    DiskImageView<float> right_orig_image(right_input_file);
+    DiskImageView<float> right_orig_image(right_image_file);
     BBox2i right_win = stereo_settings().right_image_crop_win;
     right_win.crop(bounding_box(right_orig_image));
 
@@ -606,4 +704,101 @@ load_adjusted_model(boost::shared_ptr<vw::camera::CameraModel> cam,
 						 pose_correction[0], pixel_offset));
 }
 
+Vector6f stats_from_samples(std::vector<float> & samples) {
+  Vector6f result;
+  int num = samples.size();
+  if (num == 0)
+    return result;
+
+  double sum = 0, sum2 = 0;
+  float  lo = samples[0], hi = samples[0];
+  for (int k = 0; k < num; k++) {
+    double v = samples[k];
+    sum  += v;
+    sum2 += v*v;
+    lo = std::min(lo, samples[k]);
+    hi = std::max(hi, samples[k]);
+  }
+  double mean = sum/num;
+  double var  = std::max(sum2/num - mean*mean, 0.0);
+
+  result[0] = lo;
+  result[1] = hi;
+  result[2] = mean;
+  result[3] = std::sqrt(var);
+
+  // The 2% and 98% percentiles
+  double q[] = {0.02, 0.98};
+  for (int i = 0; i < 2; i++) {
+    int pos = int(q[i]*(num - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + pos, samples.end());
+    result[4 + i] = samples[pos];
+  }
+  return result;
+}
+
+std::string file_stats_key(std::string const& file) {
+  std::ostringstream os;
+  os << file;
+  boost::system::error_code ec;
+  boost::uintmax_t size = boost::filesystem::file_size(file, ec);
+  if (!ec)
+    os << ' ' << size;
+  std::time_t mtime = boost::filesystem::last_write_time(file, ec);
+  if (!ec)
+    os << ' ' << mtime;
+  return os.str();
+}
+
+std::string image_stats_key(std::string const& image_file, double nodata_value) {
+  std::ostringstream os;
+  os.precision(17);
+  os << file_stats_key(image_file) << " nodata " << nodata_value;
+  return os.str();
+}
+
+std::string left_cache_prefix(std::string const& out_prefix) {
+  if (stereo_settings().multiview_left_prefix.empty())
+    return out_prefix;
+  return stereo_settings().multiview_left_prefix;
+}
+
+std::string left_ip_cache_prefix(std::string const& left_image_file) {
+  if (stereo_settings().multiview_left_prefix.empty())
+    return "";
+  return stereo_settings().multiview_left_prefix + "-"
+    + boost::filesystem::path(left_image_file).stem().string();
+}
+
+bool read_cached_stats(std::string const& cache_file, std::string const& key,
+                       Vector6f & stats) {
+  std::ifstream ifs(cache_file.c_str());
+  if (!ifs.is_open())
+    return false;
+  std::string file_key;
+  if (!std::getline(ifs, file_key) || file_key != key)
+    return false;
+  Vector6f vals;
+  for (int i = 0; i < 6; i++) {
+    if (!(ifs >> vals[i]))
+      return false;
+  }
+  stats = vals;
+  return true;
+}
+
+void write_cached_stats(std::string const& cache_file, std::string const& key,
+                        Vector6f const& stats) {
+  std::ofstream ofs(cache_file.c_str());
+  if (!ofs.is_open()) {
+    vw_out(WarningMessage) << "Could not write: " << cache_file << "\n";
+    return;
+  }
+  ofs.precision(17);
+  ofs << key << "\n";
+  for (int i = 0; i < 6; i++)
+    ofs << stats[i] << " ";
+  ofs << "\n";
+}
+
 } // End namespace asp
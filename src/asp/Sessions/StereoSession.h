@@ -29,7 +29,13 @@
 #include <vw/Math/Functors.h>
 #include <vw/Math/Geometry.h>
 
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
+
 #include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -38,9 +44,66 @@ namespace asp {
 
   typedef vw::Vector<vw::float32,6> Vector6f;
 
+  /// Summarize the sampled pixel values of an image as in gather_stats().
+  /// The samples are reordered.
+  Vector6f stats_from_samples(std::vector<float> & samples);
+
+  /// Describe a file by its path, size and modification time, to tell
+  /// if the statistics cached from it are still current.
+  std::string file_stats_key(std::string const& file);
+
+  /// The key for the statistics of an image masked by a nodata value.
+  std::string image_stats_key(std::string const& image_file, double nodata_value);
+
+  /// The prefix for the files which depend only on the left image,
+  /// such as its statistics. The pairs of multiview stereo share it,
+  /// see --multiview-left-prefix, so that this work is done once.
+  std::string left_cache_prefix(std::string const& out_prefix);
+
+  /// The prefix for caching the interest points of the left image, if
+  /// shared by the pairs of multiview stereo. Otherwise empty, so that
+  /// none are cached.
+  std::string left_ip_cache_prefix(std::string const& left_image_file);
+
+  /// Read the statistics saved by write_cached_stats(). Returns false
+  /// if there is no such file, or if it was made with another key.
+  bool read_cached_stats (std::string const& cache_file, std::string const& key,
+                          Vector6f & stats);
+  void write_cached_stats(std::string const& cache_file, std::string const& key,
+                          Vector6f const& stats);
+
+  /// Collect the valid pixel values of every scale-th column of every
+  /// scale-th row in the given range of rows. Used by gather_stats().
+  template <class ViewT>
+  class StatsSampleTask: public vw::Task, private boost::noncopyable {
+    ViewT const& m_image;
+    int m_scale, m_beg_row, m_end_row;
+    std::vector<float> & m_samples;
+  public:
+    StatsSampleTask(ViewT const& image, int scale, int beg_row, int end_row,
+                    std::vector<float> & samples):
+      m_image(image), m_scale(scale), m_beg_row(beg_row), m_end_row(end_row),
+      m_samples(samples){}
+
+    void operator()(){
+      typedef typename ViewT::pixel_type PixelT;
+      typedef typename vw::PixelChannelType<PixelT>::type ChannelT;
+      for (int row = m_beg_row; row < m_end_row; row += m_scale){
+        vw::ImageView<PixelT> line = vw::crop(m_image, vw::BBox2i(0, row, m_image.cols(), 1));
+        for (int col = 0; col < line.cols(); col += m_scale){
+          if (vw::is_valid(line(col, 0)))
+            m_samples.push_back(vw::compound_select_channel<ChannelT const&>(line(col, 0), 0));
+        }
+      }
+    }
+  };
+
   //TODO: Move this function!
   /// Compute the min, max, mean, and standard deviation of an image object and write them to a log.
   /// - "tag" is only used to make the log messages more descriptive.
+  /// - The image is read once, with several threads, at a reduced resolution
+  ///   of about a million pixels, as before. The percentiles are exact for
+  ///   these samples, rather than estimated from a CDF accumulator.
   template <class ViewT>
   Vector6f gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag) {
     using namespace vw;
@@ -49,24 +112,59 @@ namespace asp {
 
     // Compute statistics at a reduced resolution
     int stat_scale = int(ceil(sqrt(float(image.cols())*float(image.rows()) / 1000000)));
+    stat_scale = std::max(stat_scale, 1);
+
+    // Each band of rows has its own samples, so no locking is needed
+    int num_threads = vw_settings().default_num_threads();
+    int num_lines   = (image.rows() + stat_scale - 1)/stat_scale; // rows to sample
+    int num_bands   = std::max(1, std::min(num_lines, 4*num_threads));
+    std::vector< std::vector<float> > band_samples(num_bands);
+    {
+      FifoWorkQueue queue(num_threads);
+      for (int band = 0; band < num_bands; band++){
+        int beg = (long long)num_lines*band/num_bands;
+        int end = (long long)num_lines*(band + 1)/num_bands;
+        if (beg >= end)
+          continue;
+        boost::shared_ptr< StatsSampleTask<ViewT> >
+          task(new StatsSampleTask<ViewT>(image, stat_scale, beg*stat_scale,
+                                          std::min(end*stat_scale, image.rows()),
+                                          band_samples[band]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
 
-    ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
-    for_each_pixel( subsample( edge_extend(image, ConstantEdgeExtension()),
-			       stat_scale ),
-		    accumulator );
-    Vector6f result;
-    result[0] = accumulator.quantile(0); // Min
-    result[1] = accumulator.quantile(1); // Max
-    result[2] = accumulator.approximate_mean();
-    result[3] = accumulator.approximate_stddev();
-    result[4] = accumulator.quantile(0.02); // Percentile values
-    result[5] = accumulator.quantile(0.98);
+    std::vector<float> samples;
+    for (int band = 0; band < num_bands; band++)
+      samples.insert(samples.end(), band_samples[band].begin(), band_samples[band].end());
+    Vector6f result = stats_from_samples(samples);
 
     vw_out(InfoMessage) << "\t  " << tag << ": [ lo: " << result[0] << " hi: " << result[1]
 					     << " mean: " << result[2] << " std_dev: "  << result[3] << " ]\n";
     return result;
   }
 
+  /// As gather_stats(), but the result is saved in cache_file, and read
+  /// from there instead of being computed again if it was saved with
+  /// the same key. The key must describe everything the statistics
+  /// depend on, such as the files, see file_stats_key(), and the nodata value.
+  template <class ViewT>
+  Vector6f gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag,
+                         std::string const& cache_file, std::string const& cache_key) {
+    Vector6f result;
+    if (read_cached_stats(cache_file, cache_key, result)) {
+      vw::vw_out(vw::InfoMessage) << "\t--> Read statistics for " << tag << " from "
+                                  << cache_file << "\n";
+      vw::vw_out(vw::InfoMessage) << "\t  " << tag << ": [ lo: " << result[0] << " hi: " << result[1]
+                                  << " mean: " << result[2] << " std_dev: "  << result[3] << " ]\n";
+      return result;
+    }
+    result = gather_stats(view_base, tag);
+    write_cached_stats(cache_file, cache_key, result);
+    return result;
+  }
+
   //TODO: Move this function!
   /// Normalize the intensity of two grayscale images based on input statistics
   template<class ImageT>
@@ -148,6 +246,20 @@ namespace asp {
     std::string m_left_camera_file, m_right_camera_file;
     std::string m_out_prefix, m_input_dem;
 
+    /// Look up a camera made earlier by camera_model(), see
+    /// enable_camera_cache(). Returns an empty pointer if the cache is
+    /// disabled or does not have this camera.
+    boost::shared_ptr<vw::camera::CameraModel>
+    cached_camera_model(std::string const& image_file, std::string const& camera_file) const;
+
+    /// Keep a camera made by camera_model() if the cache is enabled.
+    void cache_camera_model(std::string const& image_file, std::string const& camera_file,
+                            boost::shared_ptr<vw::camera::CameraModel> const& cam) const;
+
+    /// The inputs which determine the camera made by camera_model().
+    std::string camera_cache_key(std::string const& image_file,
+                                 std::string const& camera_file) const;
+
     virtual void initialize (vw::cartography::GdalWriteOptions const& options,
                              std::string const& left_image_file,
                              std::string const& right_image_file,
@@ -185,10 +297,19 @@ namespace asp {
     camera_model(std::string const& image_file,
                  std::string const& camera_file = "") = 0;
 
+    /// If enabled, the cameras made by camera_model() are kept and are
+    /// returned again, without loading them, when any session in this
+    /// process asks for the same camera with the same inputs. This is
+    /// used by stereo_all, which runs all stereo stages in one process.
+    static void enable_camera_cache(bool enable);
+
     /// Method to help determine what session we actually have
     virtual std::string name() const = 0;
 
     /// Specialization for how interest points are found
+    /// - If the cache prefixes are not empty, the interest points detected
+    ///   in each image are cached, if they do not depend on the other image,
+    ///   and reused when matching it with other images. See detect_ip().
     bool ip_matching(std::string  const& input_file1,
                      std::string  const& input_file2,
                      vw::Vector2  const& uncropped_image_size,
@@ -198,7 +319,9 @@ namespace asp {
                      float nodata1, float nodata2,
                      std::string const& match_filename,
                      vw::camera::CameraModel* cam1,
-                     vw::camera::CameraModel* cam2);
+                     vw::camera::CameraModel* cam2,
+                     std::string const& ip_cache_prefix1 = "",
+                     std::string const& ip_cache_prefix2 = "");
 
     /// Returns the target datum to use for a given camera model
     virtual vw::cartography::Datum get_datum(const vw::camera::CameraModel* cam,
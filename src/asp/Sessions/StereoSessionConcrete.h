@@ -138,7 +138,9 @@ namespace asp {
                                     float nodata1, float nodata2,
                                     std::string const& match_filename,
                                     vw::camera::CameraModel* cam1,
-                                    vw::camera::CameraModel* cam2);
+                                    vw::camera::CameraModel* cam2,
+                                    std::string const& ip_cache_prefix1 = "",
+                                    std::string const& ip_cache_prefix2 = "");
 
 /*
     /// This class guesses the name but derived classes may still need to override.
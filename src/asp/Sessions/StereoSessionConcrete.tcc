@@ -83,7 +83,9 @@ ip_matching(std::string  const& input_file1,
             float nodata1, float nodata2,
             std::string const& match_filename,
             vw::camera::CameraModel* cam1,
-            vw::camera::CameraModel* cam2)
+            vw::camera::CameraModel* cam2,
+            std::string const& ip_cache_prefix1,
+            std::string const& ip_cache_prefix2)
 {
   if (IsTypeMapProjected<DISKTRANSFORM_TYPE>::value) {
     vw_throw( vw::ArgumentErr() << "StereoSessionConcrete: IP matching is not implemented as no alignment is applied to map-projected images.");
@@ -95,7 +97,8 @@ ip_matching(std::string  const& input_file1,
                                       stats1,      stats2,
                                       ip_per_tile,
                                       nodata1, nodata2,
-                                      match_filename, cam1, cam2);
+                                      match_filename, cam1, cam2,
+                                      ip_cache_prefix1, ip_cache_prefix2);
 }
 
 
@@ -207,12 +210,19 @@ template <STEREOSESSION_DISKTRANSFORM_TYPE  DISKTRANSFORM_TYPE,
 boost::shared_ptr<vw::camera::CameraModel>
 StereoSessionConcrete<DISKTRANSFORM_TYPE,STEREOMODEL_TYPE>::camera_model(std::string const& image_file,
                                                                          std::string const& camera_file) {
+  boost::shared_ptr<vw::camera::CameraModel> cam = this->cached_camera_model(image_file, camera_file);
+  if (cam.get() != NULL)
+    return cam;
+
   vw_out() << "Loading camera model: " << image_file << ' ' << camera_file << "\n";
 
   if (camera_file == "") // No camera file provided, use the image file.
-    return load_camera_model(STEREOMODEL_TYPE, image_file, image_file);
+    cam = load_camera_model(STEREOMODEL_TYPE, image_file, image_file);
   else // Camera file provided
-    return load_camera_model(STEREOMODEL_TYPE, image_file, camera_file);
+    cam = load_camera_model(STEREOMODEL_TYPE, image_file, camera_file);
+
+  this->cache_camera_model(image_file, camera_file, cam);
+  return cam;
 }
 
 template <STEREOSESSION_DISKTRANSFORM_TYPE  DISKTRANSFORM_TYPE,
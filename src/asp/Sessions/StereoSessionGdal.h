@@ -31,6 +31,8 @@
 #include <asp/Core/AffineEpipolar.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/IntegerImage.h>
 
 namespace asp {
 
@@ -103,8 +105,12 @@ namespace asp {
       = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
     // Compute input image statistics
-    Vector6f left_stats  = gather_stats(left_masked_image,  "left" );
-    Vector6f right_stats = gather_stats(right_masked_image, "right");
+    Vector6f left_stats  = gather_stats(left_masked_image,  "left",
+                                        left_cache_prefix(this->m_out_prefix) + "-lStatsCache.txt",
+                                        image_stats_key(left_cropped_file,  left_nodata_value));
+    Vector6f right_stats = gather_stats(right_masked_image, "right",
+                                        this->m_out_prefix + "-rStatsCache.txt",
+                                        image_stats_key(right_cropped_file, right_nodata_value));
 
     ImageViewRef< PixelMask<float> > Limg, Rimg;
     std::string lcase_file = boost::to_lower_copy(this->m_left_camera_file);
@@ -129,11 +135,12 @@ namespace asp {
 			left_stats, right_stats,
 			stereo_settings().ip_per_tile,
 			left_nodata_value, right_nodata_value, match_filename,
-			left_cam.get(),    right_cam.get() );
+			left_cam.get(),    right_cam.get(),
+			left_ip_cache_prefix(left_cropped_file) );
 
       // Load the interest points results from the file we just wrote.
       std::vector<ip::InterestPoint> left_ip, right_ip;
-      ip::read_binary_match_file(match_filename, left_ip, right_ip);
+      asp::read_match_file(match_filename, left_ip, right_ip);
 
       // Initialize alignment matrices and get the input image sizes.
       Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
@@ -183,31 +190,26 @@ namespace asp {
 		     false, // Use std stretch
 		     left_stats, right_stats, Limg, Rimg);
 
-    // The output no-data value must be < 0 as we scale the images to [0, 1].
-    bool has_nodata = true;
-    float output_nodata = -32768.0;
+    int bits = stereo_settings().preprocessed_image_bits;
 
     // The left image is written out with no alignment warping.
     vw_out() << "\t--> Writing pre-aligned images.\n";
     vw_out() << "\t--> Writing: " << left_output_file << ".\n";
-    block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
-			    has_left_georef, left_georef,
-			    has_nodata, output_nodata, options,
-			    TerminalProgressCallback("asp","\t  L:  ") );
+    asp::write_preprocessed_image( left_output_file, Limg, bits,
+				   has_left_georef, left_georef, options,
+				   TerminalProgressCallback("asp","\t  L:  ") );
 
     vw_out() << "\t--> Writing: " << right_output_file << ".\n";
     if ( stereo_settings().alignment_method == "none" )
-      block_write_gdal_image( right_output_file, apply_mask(Rimg, output_nodata),
-			      has_right_georef, right_georef,
-			      has_nodata, output_nodata, options,
-			      TerminalProgressCallback("asp","\t  R:  ") );
+      asp::write_preprocessed_image( right_output_file, Rimg, bits,
+				     has_right_georef, right_georef, options,
+				     TerminalProgressCallback("asp","\t  R:  ") );
     else // Write out the right image cropped to align with the left image.
-      block_write_gdal_image( right_output_file,
-			      apply_mask(crop(edge_extend(Rimg, ConstantEdgeExtension()),
-					      bounding_box(Limg)), output_nodata),
-			      has_right_georef, right_georef,
-			      has_nodata, output_nodata, options,
-			      TerminalProgressCallback("asp","\t  R:  ") );
+      asp::write_preprocessed_image( right_output_file,
+				     crop(edge_extend(Rimg, ConstantEdgeExtension()),
+					  bounding_box(Limg)), bits,
+				     has_right_georef, right_georef, options,
+				     TerminalProgressCallback("asp","\t  R:  ") );
   } // End function pre_preprocessing_hook
 
 
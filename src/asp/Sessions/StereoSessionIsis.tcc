@@ -49,6 +49,8 @@
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 #include <asp/IsisIO/Equation.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/IntegerImage.h>
 
 
 // Boost
@@ -141,9 +143,7 @@ void write_preprocessed_isis_image( vw::cartography::GdalWriteOptions const& opt
 				    bool has_georef,
 				    vw::cartography::GeoReference const& georef) {
 
-  // The output no-data value must be < 0 as we scale the images to [0, 1].
-  bool has_nodata = true;
-  float output_nodata = -32768.0;
+  int bits = stereo_settings().preprocessed_image_bits;
 
   ImageViewRef<float> image_sans_mask = apply_mask(masked_image, isis_lo);
 
@@ -176,10 +176,9 @@ void write_preprocessed_isis_image( vw::cartography::GdalWriteOptions const& opt
     }
 
     vw_out() << "\t--> Writing normalized image: " << out_file << "\n";
-    block_write_gdal_image( out_file, apply_mask(applied_image, output_nodata),
-			    has_georef, georef,
-			    has_nodata, output_nodata, opt,
-			    TerminalProgressCallback("asp", "\t  "+tag+":  "));
+    asp::write_preprocessed_image( out_file, applied_image, bits,
+				   has_georef, georef, opt,
+				   TerminalProgressCallback("asp", "\t  "+tag+":  "));
 
   }else{
 
@@ -199,10 +198,9 @@ void write_preprocessed_isis_image( vw::cartography::GdalWriteOptions const& opt
     }
 
     vw_out() << "\t--> Writing normalized image: " << out_file << "\n";
-    block_write_gdal_image( out_file, applied_image,
-			    has_georef, georef,
-			    has_nodata, output_nodata, opt,
-			    TerminalProgressCallback("asp", "\t  "+tag+":  "));
+    asp::write_preprocessed_image( out_file, pixel_cast< PixelMask<float> >(applied_image), bits,
+				   has_georef, georef, opt,
+				   TerminalProgressCallback("asp", "\t  "+tag+":  "));
   }
 
 }
@@ -331,10 +329,11 @@ pre_preprocessing_hook(bool adjust_left_image_size,
 		      left_stats, right_stats,
 		      stereo_settings().ip_per_tile,
 		      left_nodata_value, right_nodata_value, match_filename,
-		      left_cam.get(),    right_cam.get());
+		      left_cam.get(),    right_cam.get(),
+		      left_ip_cache_prefix(left_cropped_file));
     // Read in the interest point data we just wrote to disk
     std::vector<ip::InterestPoint> left_ip, right_ip;
-    ip::read_binary_match_file(match_filename, left_ip, right_ip);
+    asp::read_match_file(match_filename, left_ip, right_ip);
 
     // Compute the appropriate transform matrix between the two input images.
     if ( stereo_settings().alignment_method == "homography" ) {
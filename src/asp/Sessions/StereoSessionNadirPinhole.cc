@@ -22,6 +22,8 @@
 //#include <asp/Core/StereoSettings.h>
 #include <asp/Core/AffineEpipolar.h>
 #include <asp/Sessions/StereoSessionNadirPinhole.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/IntegerImage.h>
 
 #include <vw/Camera.h>
 #include <vw/Image/Transform.h>
@@ -70,8 +72,12 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
   ImageViewRef< PixelMask<float> > right_masked_image
     = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
-  Vector6f left_stats  = gather_stats(left_masked_image,  "left" );
-  Vector6f right_stats = gather_stats(right_masked_image, "right");
+  Vector6f left_stats  = gather_stats(left_masked_image,  "left",
+                                      left_cache_prefix(m_out_prefix) + "-lStatsCache.txt",
+                                      image_stats_key(left_cropped_file,  left_nodata_value));
+  Vector6f right_stats = gather_stats(right_masked_image, "right",
+                                      m_out_prefix + "-rStatsCache.txt",
+                                      image_stats_key(right_cropped_file, right_nodata_value));
 
   ImageViewRef< PixelMask<float> > Limg, Rimg;
   std::string lcase_file = boost::to_lower_copy(m_left_camera_file);
@@ -111,14 +117,11 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
 
       // Transform the input images to be as if they were captured by the
       //  epipolar-aligned camera models, aligning the two images.
-      get_epipolar_transformed_pinhole_images(m_left_camera_file, m_right_camera_file,
-                                              left_cam, right_cam,
-                                              left_masked_image, right_masked_image,
-                                              left_image_in_roi, right_image_in_roi,
-                                              left_out_size, right_out_size,
-                                              Limg, Rimg,
-                                              ext_nodata,
-                                              BilinearInterpolation());
+      epipolar_transformed_pinhole_images(left_cam, right_cam,
+                                          left_masked_image, right_masked_image,
+                                          left_image_in_roi, right_image_in_roi,
+                                          left_out_size, right_out_size,
+                                          Limg, Rimg, ext_nodata);
     } else { // Handle CAHV derived models
       
       camera_models( left_cam, right_cam );
@@ -149,10 +152,11 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
                       left_stats, right_stats,
                       stereo_settings().ip_per_tile,
                       left_nodata_value, right_nodata_value, match_filename,
-                      left_cam.get(), right_cam.get() );
+                      left_cam.get(), right_cam.get(),
+                      left_ip_cache_prefix(left_cropped_file) );
 
     std::vector<ip::InterestPoint> left_ip, right_ip;
-    ip::read_binary_match_file( match_filename, left_ip, right_ip  );
+    asp::read_match_file( match_filename, left_ip, right_ip  );
 
     Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
                    align_right_matrix = math::identity_matrix<3>();
@@ -198,25 +202,21 @@ void asp::StereoSessionNadirPinhole::pre_preprocessing_hook(bool adjust_left_ima
                    false, // Use std stretch
                    left_stats, right_stats, Limg, Rimg);
 
-  // The output no-data value must be < 0 as we scale the images to [0, 1].
-  bool has_nodata = true;
-  float output_nodata = -32768.0;
+  int bits = stereo_settings().preprocessed_image_bits;
 
   vw_out() << "\t--> Writing pre-aligned images.\n";
   vw_out() << "\t--> Writing: " << left_output_file << ".\n";
-  block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
-                          has_left_georef, left_georef,
-                          has_nodata, output_nodata,
-                          options,
-                          TerminalProgressCallback("asp","\t  L:  ") );
+  asp::write_preprocessed_image( left_output_file, Limg, bits,
+                                 has_left_georef, left_georef,
+                                 options,
+                                 TerminalProgressCallback("asp","\t  L:  ") );
   vw_out() << "\t--> Writing: " << right_output_file << ".\n";
-  block_write_gdal_image( right_output_file,
-                          apply_mask(crop(edge_extend(Rimg, ext_nodata), // Force -R.tif to be the same size as -L.tif! ???
-                                          bounding_box(Limg)), output_nodata),
-                          has_right_georef, right_georef,
-                          has_nodata, output_nodata,
-                          options,
-                          TerminalProgressCallback("asp","\t  R:  ") );
+  asp::write_preprocessed_image( right_output_file,
+                                 crop(edge_extend(Rimg, ext_nodata), // Force -R.tif to be the same size as -L.tif! ???
+                                      bounding_box(Limg)), bits,
+                                 has_right_georef, right_georef,
+                                 options,
+                                 TerminalProgressCallback("asp","\t  R:  ") );
 
 }
 
@@ -21,6 +21,9 @@
 
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/IntegerImage.h>
+#include <asp/Core/RemapTable.h>
 
 #include <vw/Math/BBox.h>
 #include <vw/Math/Geometry.h>
@@ -29,6 +32,7 @@
 #include <vw/Math/Vector.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Image/MaskViews.h>
+#include <vw/Image/Transform.h>
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Stereo/DisparityMap.h>
 
@@ -36,6 +40,8 @@
 #include <boost/filesystem/operations.hpp>
 namespace fs = boost::filesystem;
 
+#include <sstream>
+
 using namespace vw;
 using namespace vw::ip;
 using namespace vw::camera;
@@ -74,10 +80,11 @@ asp::StereoSessionPinhole::determine_image_align(std::string const& out_prefix,
                     stereo_settings().ip_per_tile,
                     nodata1, nodata2,
                     match_filename,
-                    null_camera_model, null_camera_model);
+                    null_camera_model, null_camera_model,
+                    left_ip_cache_prefix(input_file1));
 
   std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
-  read_binary_match_file( match_filename,
+  asp::read_match_file( match_filename,
                           matched_ip1, matched_ip2 );
 
   // Get the matrix using RANSAC
@@ -136,8 +143,12 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(bool adjust_left_image_si
   ImageViewRef< PixelMask<float> > right_masked_image
     = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
-  Vector6f left_stats  = gather_stats(left_masked_image,  "left" );
-  Vector6f right_stats = gather_stats(right_masked_image, "right");
+  Vector6f left_stats  = gather_stats(left_masked_image,  "left",
+                                      left_cache_prefix(m_out_prefix) + "-lStatsCache.txt",
+                                      image_stats_key(left_cropped_file,  left_nodata_value));
+  Vector6f right_stats = gather_stats(right_masked_image, "right",
+                                      m_out_prefix + "-rStatsCache.txt",
+                                      image_stats_key(right_cropped_file, right_nodata_value));
 
   // Use no-data in interpolation and edge extension.
   PixelMask<float> nodata_pix(0);
@@ -170,14 +181,11 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(bool adjust_left_image_si
 
       // Transform the input images to be as if they were captured by the
       //  epipolar-aligned camera models, aligning the two images.
-      get_epipolar_transformed_pinhole_images(m_left_camera_file, m_right_camera_file,
-                                              left_cam, right_cam,
-                                              left_masked_image, right_masked_image,
-                                              left_image_in_roi, right_image_in_roi,
-                                              left_out_size, right_out_size,
-                                              Limg, Rimg,
-                                              ext_nodata,
-                                              BilinearInterpolation());
+      epipolar_transformed_pinhole_images(left_cam, right_cam,
+                                          left_masked_image, right_masked_image,
+                                          left_image_in_roi, right_image_in_roi,
+                                          left_out_size, right_out_size,
+                                          Limg, Rimg, ext_nodata);
 
     } else { // Handle CAHV derived models
     
@@ -220,25 +228,99 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(bool adjust_left_image_si
                    false, // Use std stretch
                    left_stats, right_stats, Limg, Rimg);
 
-  // The output no-data value must be < 0 as we scale the images to [0, 1].
-  bool has_nodata = true;
-  float output_nodata = -32768.0;
+  int bits = stereo_settings().preprocessed_image_bits;
 
   vw_out() << "\t--> Writing pre-aligned images.\n";
   vw_out() << "\t--> Writing: " << left_output_file << ".\n";
-  block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
-                          has_left_georef, left_georef,
-                          has_nodata, output_nodata,
-                          options,
-                          TerminalProgressCallback("asp","\t  L:  ") );
+  asp::write_preprocessed_image( left_output_file, Limg, bits,
+                                 has_left_georef, left_georef,
+                                 options,
+                                 TerminalProgressCallback("asp","\t  L:  ") );
   vw_out() << "\t--> Writing: " << right_output_file << ".\n";
-  block_write_gdal_image( right_output_file,
-                          apply_mask(crop(edge_extend(Rimg, ext_nodata),
-                                          bounding_box(Limg)), output_nodata),
-                          has_right_georef, right_georef,
-                          has_nodata, output_nodata,
-                          options,
-                          TerminalProgressCallback("asp","\t  R:  ") );
+  asp::write_preprocessed_image( right_output_file,
+                                 crop(edge_extend(Rimg, ext_nodata),
+                                      bounding_box(Limg)), bits,
+                                 has_right_georef, right_georef,
+                                 options,
+                                 TerminalProgressCallback("asp","\t  R:  ") );
+}
+
+namespace {
+
+  // How far a remap table may be from the cameras, in pixels
+  const double EPIPOLAR_REMAP_MAX_ERROR = 0.01;
+
+  // Where the pixels of an image aligned to an epipolar camera come
+  // from, from the table saved with this prefix if it was made for the
+  // same cameras, or else made and saved. Return false if no table
+  // agrees with the cameras.
+  bool epipolar_remap_table(std::string const& prefix, std::string const& camera_file,
+                            PinholeModel const& epi_cam, BBox2i const& in_roi,
+                            Vector2i const& out_size, asp::RemapTable & table) {
+    std::ostringstream key;
+    key.precision(17);
+    key << camera_file << " " << fs::last_write_time(camera_file) << "\n"
+        << in_roi << " " << out_size << "\n" << epi_cam;
+    if (table.read(prefix, key.str())) {
+      vw_out() << "\t--> Using the remap table: " << prefix << ".tif\n";
+      return true;
+    }
+
+    PinholeModel in_cam(camera_file);
+    asp::PinholeCamTrans trans(in_cam, epi_cam);
+    if (!asp::make_remap_table(trans, out_size, Vector2(in_roi.min()),
+                               EPIPOLAR_REMAP_MAX_ERROR, table)) {
+      vw_out(WarningMessage) << "No remap table agrees with the camera " << camera_file
+                             << ". Will resample through the cameras.\n";
+      return false;
+    }
+    vw_out() << "\t--> Writing the remap table, with spacing " << table.spacing()
+             << ": " << prefix << ".tif\n";
+    table.write(prefix, key.str());
+    return true;
+  }
+
+}
+
+void asp::StereoSessionPinhole::epipolar_transformed_pinhole_images(
+                   boost::shared_ptr<camera::CameraModel> left_cam,
+                   boost::shared_ptr<camera::CameraModel> right_cam,
+                   ImageViewRef< PixelMask<float> > const& left_image_in,
+                   ImageViewRef< PixelMask<float> > const& right_image_in,
+                   BBox2i   const& left_image_in_roi,
+                   BBox2i   const& right_image_in_roi,
+                   Vector2i const& left_out_size,
+                   Vector2i const& right_out_size,
+                   ImageViewRef< PixelMask<float> > & left_image_out,
+                   ImageViewRef< PixelMask<float> > & right_image_out,
+                   ValueEdgeExtension< PixelMask<float> > const& ext_nodata) const {
+
+  PinholeModel* left_epi  = dynamic_cast<PinholeModel*>(left_cam.get ());
+  PinholeModel* right_epi = dynamic_cast<PinholeModel*>(right_cam.get());
+
+  RemapTable left_table, right_table;
+  if (stereo_settings().epipolar_remap_table && left_epi != NULL && right_epi != NULL &&
+      epipolar_remap_table(m_out_prefix + "-L-remap", m_left_camera_file, *left_epi,
+                           left_image_in_roi, left_out_size, left_table) &&
+      epipolar_remap_table(m_out_prefix + "-R-remap", m_right_camera_file, *right_epi,
+                           right_image_in_roi, right_out_size, right_table)) {
+    left_image_out  = transform(left_image_in, left_table,
+                                left_out_size.x(), left_out_size.y(),
+                                ext_nodata, BilinearInterpolation());
+    right_image_out = transform(right_image_in, right_table,
+                                right_out_size.x(), right_out_size.y(),
+                                ext_nodata, BilinearInterpolation());
+    return;
+  }
+
+  get_epipolar_transformed_pinhole_images(m_left_camera_file, m_right_camera_file,
+                                          left_cam, right_cam,
+                                          left_image_in, right_image_in,
+                                          left_image_in_roi, right_image_in_roi,
+                                          left_out_size, right_out_size,
+                                          left_image_out, right_image_out,
+                                          ext_nodata,
+                                          BilinearInterpolation());
 }
 
 namespace asp {
@@ -344,10 +426,16 @@ load_adj_pinhole_model(std::string const& image_file,       std::string const& c
 boost::shared_ptr<vw::camera::CameraModel>
 asp::StereoSessionPinhole::camera_model(std::string const& image_file,
                                         std::string const& camera_file) {
-  return asp::load_adj_pinhole_model(image_file, camera_file,
-                                m_left_image_file, m_right_image_file,
-                                m_left_camera_file, m_right_camera_file,
-                                m_input_dem);  
+  boost::shared_ptr<vw::camera::CameraModel> cam = cached_camera_model(image_file, camera_file);
+  if (cam.get() != NULL)
+    return cam;
+
+  cam = asp::load_adj_pinhole_model(image_file, camera_file,
+                                    m_left_image_file, m_right_image_file,
+                                    m_left_camera_file, m_right_camera_file,
+                                    m_input_dem);
+  cache_camera_model(image_file, camera_file, cam);
+  return cam;
 }
 
 
@@ -95,6 +95,23 @@ namespace asp {
    virtual bool supports_image_alignment () const {return !isMapProjected();}
    virtual bool is_nadir_facing          () const {return false;}
 
+ protected:
+    /// Transform the input images to be as if they were seen by the
+    /// epipolar-aligned pinhole cameras. With --epipolar-remap-table,
+    /// this goes through a RemapTable for each image, saved with the
+    /// output prefix, if one agrees with the cameras.
+    void epipolar_transformed_pinhole_images(boost::shared_ptr<vw::camera::CameraModel> left_cam,
+                                             boost::shared_ptr<vw::camera::CameraModel> right_cam,
+                                             vw::ImageViewRef< vw::PixelMask<float> > const& left_image_in,
+                                             vw::ImageViewRef< vw::PixelMask<float> > const& right_image_in,
+                                             vw::BBox2i   const& left_image_in_roi,
+                                             vw::BBox2i   const& right_image_in_roi,
+                                             vw::Vector2i const& left_out_size,
+                                             vw::Vector2i const& right_out_size,
+                                             vw::ImageViewRef< vw::PixelMask<float> > & left_image_out,
+                                             vw::ImageViewRef< vw::PixelMask<float> > & right_image_out,
+                                             vw::ValueEdgeExtension< vw::PixelMask<float> > const& ext_nodata) const;
+
  private:
     /// Helper function for determining image alignment.
     /// - Only used in pre_preprocessing_hook()
@@ -0,0 +1,78 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Sessions/StereoSession.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <test/Helpers.h>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST( GatherStats, SmallImage ) {
+
+  // Small enough that every pixel is sampled. The invalid pixels
+  // must not count.
+  int cols = 60, rows = 45;
+  ImageView< PixelMask<float> > image(cols, rows);
+  std::vector<float> vals;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      float v = (col*7 + row*11) % 101;
+      image(col, row) = PixelMask<float>(v);
+      if (col % 5 == 0)
+        image(col, row).invalidate();
+      else
+        vals.push_back(v);
+    }
+  }
+
+  Vector6f stats = gather_stats(image, "test");
+
+  double sum = 0, sum2 = 0;
+  for (size_t k = 0; k < vals.size(); k++) {
+    sum  += vals[k];
+    sum2 += vals[k]*vals[k];
+  }
+  double mean = sum/vals.size();
+  std::sort(vals.begin(), vals.end());
+  EXPECT_EQ(vals.front(), stats[0]);
+  EXPECT_EQ(vals.back(),  stats[1]);
+  EXPECT_NEAR(mean, stats[2], 1e-4);
+  EXPECT_NEAR(sqrt(sum2/vals.size() - mean*mean), stats[3], 1e-3);
+  EXPECT_EQ(vals[int(0.02*(vals.size() - 1) + 0.5)], stats[4]);
+  EXPECT_EQ(vals[int(0.98*(vals.size() - 1) + 0.5)], stats[5]);
+}
+
+TEST( GatherStats, Cache ) {
+
+  std::string cache_file = "TestGatherStatsCache.txt";
+  Vector6f stats, read_stats;
+  for (int i = 0; i < 6; i++)
+    stats[i] = 0.5*i - 1.25;
+
+  write_cached_stats(cache_file, "key one", stats);
+  EXPECT_TRUE (read_cached_stats(cache_file, "key one", read_stats));
+  EXPECT_VECTOR_NEAR(stats, read_stats, 1e-6);
+  EXPECT_FALSE(read_cached_stats(cache_file, "key two", read_stats));
+  EXPECT_FALSE(read_cached_stats("NoSuchCacheFile.txt", "key one", read_stats));
+
+  std::remove(cache_file.c_str());
+}
@@ -24,6 +24,8 @@
 #include "SpiceUsr.h"
 #include "SpiceZfc.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <list>
@@ -31,6 +33,7 @@
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/Debugging.h>
+#include <vw/Core/Log.h>
 
 #include <string.h>
 
@@ -231,6 +234,172 @@ namespace spice {
     CHECK_SPICE_ERROR();
   }
 
+  void body_state(std::vector<double> const& times,
+                  std::vector<Vector3> &position,
+                  std::vector<Vector3> &velocity,
+                  std::vector<Quat > &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument) {
+    position.resize(times.size());
+    velocity.resize(times.size());
+    pose.resize(times.size());
+    for (size_t i = 0; i < times.size(); i++)
+      body_state(times[i], position[i], velocity[i], pose[i],
+                 spacecraft, reference_frame, planet, instrument);
+  }
+
+  namespace {
+
+    // Never halve an interval of the table more than this many times,
+    // as when the error cannot be met because of noise in the kernels.
+    const int MAX_REFINE_DEPTH = 20;
+
+    // The intervals the table starts with
+    const int NUM_START_INTERVALS = 8;
+
+    // q and -q are the same rotation. The one of them closest to p.
+    Quat closest_quat(Quat const& p, Quat const& q) {
+      if (p[0]*q[0] + p[1]*q[1] + p[2]*q[2] + p[3]*q[3] < 0)
+        return Quat(-q[0], -q[1], -q[2], -q[3]);
+      return q;
+    }
+
+    // The angle of the rotation from one unit quaternion to another
+    double quat_angle(Quat const& p, Quat const& q) {
+      double dot = std::abs(p[0]*q[0] + p[1]*q[1] + p[2]*q[2] + p[3]*q[3]);
+      return 2.0*std::acos(std::min(1.0, dot));
+    }
+  }
+
+  BodyStateTable::BodyStateTable(double begin_time, double end_time,
+                                 std::string const& spacecraft,
+                                 std::string const& reference_frame,
+                                 std::string const& planet,
+                                 std::string const& instrument,
+                                 double max_position_error,
+                                 double max_angle_error):
+    m_spacecraft(spacecraft), m_reference_frame(reference_frame),
+    m_planet(planet), m_instrument(instrument),
+    m_max_position_error(max_position_error), m_max_angle_error(max_angle_error) {
+
+    if (!(end_time > begin_time))
+      vw_throw(ArgumentErr() << "BodyStateTable: expecting an end time after the begin time.");
+
+    // Query the ends of the starting intervals, then refine each of
+    // them. The nodes found are added in the order of time.
+    Vector3 position, velocity;
+    Quat pose;
+    query(begin_time, position, velocity, pose);
+    m_times.push_back(begin_time);
+    m_positions.push_back(position);
+    m_velocities.push_back(velocity);
+    m_poses.push_back(pose);
+    for (int k = 1; k <= NUM_START_INTERVALS; k++) {
+      double t0 = m_times.back();
+      double t1 = (k == NUM_START_INTERVALS) ? end_time :
+        begin_time + (end_time - begin_time)*k/NUM_START_INTERVALS;
+      refine(t0, t1, 0);
+    }
+
+    vw_out(DebugMessage, "spice") << "BodyStateTable: " << m_times.size()
+                                  << " nodes for " << (end_time - begin_time) << " seconds.\n";
+  }
+
+  void BodyStateTable::query(double time, Vector3 &position, Vector3 &velocity,
+                             Quat &pose) const {
+    body_state(time, position, velocity, pose,
+               m_spacecraft, m_reference_frame, m_planet, m_instrument);
+    if (!m_poses.empty())
+      pose = closest_quat(m_poses.back(), pose);
+  }
+
+  // Add the nodes in (t0, t1], given that the last node is at t0
+  void BodyStateTable::refine(double t0, double t1, int depth) {
+
+    Vector3 position1, velocity1;
+    Quat pose1;
+    query(t1, position1, velocity1, pose1);
+
+    // Compare the interpolated state in the middle with SPICE. This
+    // needs the node at t1 to be in the table, so add it for now.
+    size_t i0 = m_times.size() - 1;
+    m_times.push_back(t1);
+    m_positions.push_back(position1);
+    m_velocities.push_back(velocity1);
+    m_poses.push_back(pose1);
+
+    double tm = 0.5*(t0 + t1);
+    Vector3 position, velocity, true_position, true_velocity;
+    Quat pose, true_pose;
+    interpolate(i0, tm, position, velocity, pose);
+    body_state(tm, true_position, true_velocity, true_pose,
+               m_spacecraft, m_reference_frame, m_planet, m_instrument);
+
+    if (depth >= MAX_REFINE_DEPTH ||
+        (norm_2(position - true_position) <= m_max_position_error &&
+         quat_angle(pose, true_pose) <= m_max_angle_error))
+      return;
+
+    // Refine the two halves instead
+    m_times.pop_back();
+    m_positions.pop_back();
+    m_velocities.pop_back();
+    m_poses.pop_back();
+    refine(t0, tm, depth + 1);
+    refine(tm, t1, depth + 1);
+  }
+
+  void BodyStateTable::interpolate(size_t i, double time, Vector3 &position,
+                                   Vector3 &velocity, Quat &pose) const {
+    double dt = m_times[i+1] - m_times[i];
+    double u  = (time - m_times[i])/dt;
+
+    // Cubic Hermite spline, and its derivative, from the positions and
+    // velocities at the ends
+    double u2 = u*u, u3 = u2*u;
+    double h00 = 2*u3 - 3*u2 + 1, h10 = u3 - 2*u2 + u;
+    double h01 = -2*u3 + 3*u2,    h11 = u3 - u2;
+    position = h00*m_positions[i] + h10*dt*m_velocities[i]
+             + h01*m_positions[i+1] + h11*dt*m_velocities[i+1];
+    double d00 = 6*u2 - 6*u, d10 = 3*u2 - 4*u + 1;
+    double d01 = -6*u2 + 6*u, d11 = 3*u2 - 2*u;
+    velocity = (d00*m_positions[i] + d01*m_positions[i+1])/dt
+             + d10*m_velocities[i] + d11*m_velocities[i+1];
+
+    Quat const& p = m_poses[i];
+    Quat const& q = m_poses[i+1];
+    double c[4];
+    for (int k = 0; k < 4; k++)
+      c[k] = (1 - u)*p[k] + u*q[k];
+    double len = std::sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3]);
+    pose = Quat(c[0]/len, c[1]/len, c[2]/len, c[3]/len);
+  }
+
+  void BodyStateTable::state(double time, Vector3 &position, Vector3 &velocity,
+                             Quat &pose) const {
+    if (time < m_times.front() || time > m_times.back()) {
+      body_state(time, position, velocity, pose,
+                 m_spacecraft, m_reference_frame, m_planet, m_instrument);
+      return;
+    }
+    size_t i = std::upper_bound(m_times.begin(), m_times.end(), time) - m_times.begin();
+    i = std::min(std::max(i, size_t(1)), m_times.size() - 1) - 1;
+    interpolate(i, time, position, velocity, pose);
+  }
+
+  void BodyStateTable::states(std::vector<double> const& times,
+                              std::vector<Vector3> &position,
+                              std::vector<Vector3> &velocity,
+                              std::vector<Quat > &pose) const {
+    position.resize(times.size());
+    velocity.resize(times.size());
+    pose.resize(times.size());
+    for (size_t i = 0; i < times.size(); i++)
+      state(times[i], position[i], velocity[i], pose[i]);
+  }
+
   // Load all relevent SPICE kernels.
   //
   // Someday, rather than hard coding these values, the user might be
@@ -25,6 +25,7 @@
 #include <list>
 #include <vector>
 #include <string>
+#include <cstddef>
 #include <vw/Core/Exception.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
@@ -69,6 +70,61 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument);
 
+  /// The states at each of the given times
+  void body_state(std::vector<double> const& times,
+                  std::vector<vw::Vector3> &position,
+                  std::vector<vw::Vector3> &velocity,
+                  std::vector<vw::Quaternion<double> > &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument);
+
+  /// Answers body_state() queries over a span of time, such as that of
+  /// an image, from a table made once. An interval of the table is
+  /// halved until the position in its middle, interpolated with a cubic
+  /// Hermite spline from the positions and velocities at its ends, and
+  /// the pose, interpolated linearly between those at its ends and
+  /// normalized, agree with SPICE to within the given errors. Times
+  /// outside the span are queried from SPICE.
+  class BodyStateTable {
+  public:
+    BodyStateTable(double begin_time, double end_time,
+                   std::string const& spacecraft,
+                   std::string const& reference_frame,
+                   std::string const& planet,
+                   std::string const& instrument,
+                   double max_position_error = 0.01,  // meters
+                   double max_angle_error    = 1e-8); // radians
+
+    void state(double time,
+               vw::Vector3 &position,
+               vw::Vector3 &velocity,
+               vw::Quaternion<double> &pose) const;
+
+    /// The states at each of the given times
+    void states(std::vector<double> const& times,
+                std::vector<vw::Vector3> &position,
+                std::vector<vw::Vector3> &velocity,
+                std::vector<vw::Quaternion<double> > &pose) const;
+
+    /// The number of times SPICE was queried at to make the table
+    size_t size() const { return m_times.size(); }
+
+  private:
+    std::string m_spacecraft, m_reference_frame, m_planet, m_instrument;
+    double      m_max_position_error, m_max_angle_error;
+    std::vector<double>                  m_times;
+    std::vector<vw::Vector3>             m_positions, m_velocities;
+    std::vector<vw::Quaternion<double> > m_poses;
+
+    void query(double time, vw::Vector3 &position, vw::Vector3 &velocity,
+               vw::Quaternion<double> &pose) const;
+    void refine(double t0, double t1, int depth);
+    void interpolate(size_t i, double time, vw::Vector3 &position,
+                     vw::Vector3 &velocity, vw::Quaternion<double> &pose) const;
+  };
+
 }} // namespace asp::spice
 
 #endif // __SPICE_H__
@@ -25,6 +25,7 @@
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Settings.h>
 #include <vw/Image.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -56,9 +57,10 @@ using asp::RPCModel;
 struct Options : public vw::cartography::GdalWriteOptions {
   string input_path, output_path; 
   double min_height, max_height;
-  int    num_samples;
-  double penalty_weight;
-  Options(): min_height(-1), max_height(-1), num_samples(-1), penalty_weight(-1) {}
+  int    num_samples, max_sampling_refinements;
+  double penalty_weight, max_fit_error;
+  Options(): min_height(-1), max_height(-1), num_samples(-1), max_sampling_refinements(0),
+             penalty_weight(-1), max_fit_error(-1) {}
 };
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -72,7 +74,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("num-samples",     po::value(&opt.num_samples)->default_value(100),
      "How many samples to use between the minimum and maximum heights.")
     ("penalty-weight",     po::value(&opt.penalty_weight)->default_value(0.1),
-     "Penalty weight to use to keep the higher-order RPC coefficients small. Higher penalty weight results in smaller such coefficients.");
+     "Penalty weight to use to keep the higher-order RPC coefficients small. Higher penalty weight results in smaller such coefficients.")
+    ("max-fit-error",     po::value(&opt.max_fit_error)->default_value(-1.0),
+     "If positive, check the RPC model at points halfway between the samples, add to the samples the points where it differs from the camera by more than this many pixels, and fit again.")
+    ("max-sampling-refinements", po::value(&opt.max_sampling_refinements)->default_value(2),
+     "How many times to add samples where the RPC fit error is above --max-fit-error. Each time the points checked are twice as dense.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -94,6 +100,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if ( opt.input_path.empty() )
     vw_throw( ArgumentErr() << "Missing input path.\n" << usage << general_options );
 
+  if (opt.max_fit_error <= 0)
+    opt.max_sampling_refinements = 0;
+  if (opt.max_sampling_refinements < 0)
+    vw_throw( ArgumentErr() << "The value of --max-sampling-refinements must be non-negative.\n" );
+
   if ( opt.output_path.empty() ) {
     vw_out() << "Output path not provided, appending RPC model to the input metadata file.\n";
     opt.output_path = opt.input_path;
@@ -102,23 +113,21 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 }
 
 
-/// Generates the set of GDC/pixel pairs that will be fed into the solver.
-void generate_point_pairs(Options opt,
-                          Vector<double> &normalized_geodetics,
-                          Vector<double> &normalized_pixels,
-                          Vector3 &llh_scale, Vector3 &llh_offset,
-                          Vector2 &uv_scale,  Vector2 &uv_offset) {
-
-    // Load up the camera model from the camera file
-    xercesc::XMLPlatformUtils::Initialize();
-
-    // Load the input camera model
-    boost::shared_ptr<camera::CameraModel> cam_ptr
-      = asp::load_spot5_camera_model_from_xml(opt.input_path);
+/// The region of the ground seen by a SPOT5 image, from its metadata
+struct SpotFootprint {
+  Vector2 top_left, col_axis, row_axis;
+  double  min_height, height_range;
+};
 
-    // Load some image info
-    vw::ImageFormat format     = vw::DiskImageResourceRaw::image_format_from_spot5_DIM(opt.input_path);
-    Vector2         image_size = Vector2(format.cols, format.rows);
+/// Generates the set of GDC/pixel pairs that will be fed into the
+/// solver. The samples are on a num_pts^3 grid in the footprint and
+/// height range. With a shift of 0.5, they are halfway between those
+/// for a shift of 0, which is for checking the fit. The points are
+/// projected into the camera on the given number of threads.
+void generate_point_pairs(SpotFootprint const& fp, int num_pts, double shift,
+                          camera::CameraModel const* cam, int num_threads,
+                          std::vector<Vector3> & all_llh,
+                          std::vector<Vector2> & all_pixels) {
 
     // Will have to change this if any SPOT5 data uses a different datum.
     vw::cartography::Datum datum("WGS84");
@@ -127,114 +136,50 @@ void generate_point_pairs(Options opt,
     // - There is no guarantee that a point right on the edge will safely project!
     const double CONTRACTION = 0.10;
 
-    // Load the estimated image bounds from the XML file!
-    std::vector<vw::Vector2> lonlat_corners = asp::SpotXML::get_lonlat_corners(opt.input_path);
-    if (lonlat_corners.size() != 4)
-      vw::vw_throw(ArgumentErr() << "Failed to parse lonlat corners of metadata file!");
-
-    Vector2 top_left  = lonlat_corners[0]; // The corners should be loaded in this order.
-    Vector2 top_right = lonlat_corners[1];
-    //Vector2 bot_right = lonlat_corners[2];
-    Vector2 bot_left  = lonlat_corners[3];
-    
-    // These vectors are aligned with the image projected on to the ground and are 
-    //  used to iterate through the coverage region of the image.
-    Vector2 col_axis = top_right - top_left;
-    Vector2 row_axis = bot_left  - top_left;
-    double  height_range = opt.max_height - opt.min_height;
-    
-    // Get a bounding box of the covered region (not all of the BBox has image coverage!)
-    BBox2 bounding_box;
-    for (size_t i=0; i<4; ++i)
-      bounding_box.grow(lonlat_corners[i]);
-    Vector3 min_llh_coord = Vector3(bounding_box.min()[0], bounding_box.min()[1], opt.min_height);
-    Vector3 max_llh_coord = Vector3(bounding_box.max()[0], bounding_box.max()[1], opt.max_height);
-    vw_out() << "Min lon/lat/height coord: " << min_llh_coord << std::endl;
-    vw_out() << "Max lon/lat/height coord: " << max_llh_coord << std::endl;
-
-    // Compute scale factors to describe the bounding box (aligned with ENU coordinate system)
-    llh_scale  = (max_llh_coord - min_llh_coord)/2.0; // half range
-    llh_offset = (max_llh_coord + min_llh_coord)/2.0; // center point
-    double pixel_max = vw::math::max(image_size);
-    uv_scale  = Vector2(pixel_max/2.0, pixel_max/2.0); // The long axis pixel is scaled to 1.0
-    uv_offset = image_size/2.0; // center point
-
-
-    // Number of points in x and y at which we will optimize the RPC
-    // model. Using 10 or 20 points gives roughly similar results.
-    // 20 points result in 20^3 input data for optimization, with the
-    // number of variable to optimize being just 78.
-    int num_pts = 20; // The number of points per axis
-    int num_total_pts = num_pts*num_pts*num_pts;
-    vw_out() << "Attempting to project " << num_total_pts << " locations...\n";
-
-    // Initialize normalized data storage
-    normalized_geodetics.set_size(RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
-    normalized_pixels.set_size(RPCModel::IMAGE_COORD_SIZE*num_total_pts
-                               + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
-    for (size_t i = 0; i < normalized_pixels.size(); i++) {
-      // Important: The extra penalty terms are all set to zero here.
-      normalized_pixels[i] = 0.0; 
-    }
-    
-    // Loop through the coverage area of the sattelite and generate pairs of 
-    // normalized image/GDC training data using the SPOT5 camera model.
-    int success_count = 0;
-    int fail_count    = 0;
+    // Loop through the coverage area of the sattelite and generate
+    // the ground points.
+    std::vector<Vector3> llh_vec, xyz_vec;
     for (int x = 0; x < num_pts; x++){
       for (int y = 0; y < num_pts; y++){
         for (int z = 0; z < num_pts; z++){
 
           // This is the test point location in our image normalized to 0 <> 1 range
-          Vector3 u( x/(num_pts - 1.0),
-                     y/(num_pts - 1.0),
-                     z/(num_pts - 1.0) );
+          Vector3 u( (x + shift)/(num_pts - 1.0),
+                     (y + shift)/(num_pts - 1.0),
+                     (z + shift)/(num_pts - 1.0) );
+          if (vw::math::max(u) > 1.0)
+            continue;
+          
           // Shrink the point a little bit so we don't go all the way up to the valid boundaries.
           u = elem_sum(elem_prod(u,1.0-CONTRACTION), (CONTRACTION/2.0));
 
           // Obtain the lat/lon/height of this location
-          Vector2 lonlat = top_left + u[0]*col_axis + u[1]*row_axis;
-          Vector3 G      = Vector3(lonlat[0], lonlat[1], u[2]*height_range + opt.min_height);
-
-          // Convert the actual lonlat point to vector U in the -1 <> 1 range.
-          // - This vector is in a north-aligned coordinate system.
-          // - RPC expects inputs in this range so it can use them with the scaling values we computed.
-          Vector3 U = elem_quot((G - llh_offset), llh_scale);
+          Vector2 lonlat = fp.top_left + u[0]*fp.col_axis + u[1]*fp.row_axis;
+          Vector3 G      = Vector3(lonlat[0], lonlat[1], u[2]*fp.height_range + fp.min_height);
+          llh_vec.push_back(G);
 
           // Convert from geodetic to geocentric coordinates
-          Vector3 P = datum.geodetic_to_cartesian(G); // xyz
-
-          Vector2 pxg;
-          try {
-            // Project the GCC coordinate into the SPOT5 camera model
-            pxg = cam_ptr->point_to_pixel(P);
-            //vw_out() << "SUCESS location " << G << " === " << u << " === " << U << " into camera!  Skipping it.\n";
-          } catch (vw::camera::PointToPixelErr) {
-            //vw_out() << "Failed to project location " << G << " === " << u << " === " << U << " into camera!  Skipping it.\n";
-            ++fail_count;
-            continue;
-          }
-
-          // Normalize the pixel to -1 <> 1 range
-          Vector2 pxn = elem_quot(pxg - uv_offset, uv_scale);
-
-          subvector(normalized_geodetics, RPCModel::GEODETIC_COORD_SIZE*success_count,
-                    RPCModel::GEODETIC_COORD_SIZE) = U;
-          subvector(normalized_pixels,    RPCModel::IMAGE_COORD_SIZE   *success_count,
-                    RPCModel::IMAGE_COORD_SIZE   ) = pxn;
-          success_count++;
-
+          xyz_vec.push_back(datum.geodetic_to_cartesian(G));
         } // End z loop
       } // End y loop
     } // End x loop
 
-    vw_out() << "Successfully projected " << success_count << " locations.\n";
-    
-    // Update the sizes to reflect the number of successful point projections
-    const bool preserve = true;
-    normalized_geodetics.set_size(RPCModel::GEODETIC_COORD_SIZE*success_count, preserve);
-    normalized_pixels.set_size(RPCModel::IMAGE_COORD_SIZE*success_count
-                               + asp::RpcSolveLMA::NUM_PENALTY_TERMS, preserve);
+    vw_out() << "Attempting to project " << xyz_vec.size() << " locations...\n";
+
+    // Project the GCC coordinates into the SPOT5 camera model
+    std::vector<Vector2> pixels;
+    std::vector<char>    valid;
+    asp::project_points_to_camera(cam, xyz_vec, num_threads, pixels, valid);
+
+    all_llh.clear();
+    all_pixels.clear();
+    for (size_t k = 0; k < xyz_vec.size(); k++) {
+      if (!valid[k])
+        continue;
+      all_llh.push_back(llh_vec[k]);
+      all_pixels.push_back(pixels[k]);
+    }
+    vw_out() << "Successfully projected " << all_llh.size() << " locations.\n";
 }
 
 
@@ -339,23 +284,108 @@ int main( int argc, char *argv[] ) {
   //try {
     handle_arguments(argc, argv, opt);
    
-    // Generate all the point pairs using the input options
-    Vector<double> normalized_geodetics;
-    Vector<double> normalized_pixels;
-    Vector3 llh_scale, llh_offset;
-    Vector2 uv_scale,  uv_offset;
-    generate_point_pairs(opt, normalized_geodetics, normalized_pixels,
-                         llh_scale, llh_offset, uv_scale, uv_offset);
-
-    // Find the RPC coefficients
+    // Load up the camera model from the camera file
+    xercesc::XMLPlatformUtils::Initialize();
+
+    // Load the input camera model
+    boost::shared_ptr<camera::CameraModel> cam_ptr
+      = asp::load_spot5_camera_model_from_xml(opt.input_path);
+
+    // Load some image info
+    vw::ImageFormat format     = vw::DiskImageResourceRaw::image_format_from_spot5_DIM(opt.input_path);
+    Vector2         image_size = Vector2(format.cols, format.rows);
+
+    // Load the estimated image bounds from the XML file!
+    std::vector<vw::Vector2> lonlat_corners = asp::SpotXML::get_lonlat_corners(opt.input_path);
+    if (lonlat_corners.size() != 4)
+      vw::vw_throw(ArgumentErr() << "Failed to parse lonlat corners of metadata file!");
+
+    // These vectors are aligned with the image projected on to the ground and are 
+    //  used to iterate through the coverage region of the image.
+    // The corners should be loaded in the order top left, top right,
+    //  bottom right, bottom left.
+    SpotFootprint fp;
+    fp.top_left     = lonlat_corners[0];
+    fp.col_axis     = lonlat_corners[1] - lonlat_corners[0];
+    fp.row_axis     = lonlat_corners[3] - lonlat_corners[0];
+    fp.min_height   = opt.min_height;
+    fp.height_range = opt.max_height - opt.min_height;
+    
+    // Get a bounding box of the covered region (not all of the BBox has image coverage!)
+    BBox2 bounding_box;
+    for (size_t i=0; i<4; ++i)
+      bounding_box.grow(lonlat_corners[i]);
+    Vector3 min_llh_coord = Vector3(bounding_box.min()[0], bounding_box.min()[1], opt.min_height);
+    Vector3 max_llh_coord = Vector3(bounding_box.max()[0], bounding_box.max()[1], opt.max_height);
+    vw_out() << "Min lon/lat/height coord: " << min_llh_coord << std::endl;
+    vw_out() << "Max lon/lat/height coord: " << max_llh_coord << std::endl;
+
+    // Compute scale factors to describe the bounding box (aligned with ENU coordinate system)
+    Vector3 llh_scale  = (max_llh_coord - min_llh_coord)/2.0; // half range
+    Vector3 llh_offset = (max_llh_coord + min_llh_coord)/2.0; // center point
+    double pixel_max = vw::math::max(image_size);
+    Vector2 uv_scale  = Vector2(pixel_max/2.0, pixel_max/2.0); // The long axis pixel is scaled to 1.0
+    Vector2 uv_offset = image_size/2.0; // center point
+
+    // Number of points in x and y at which we will optimize the RPC
+    // model. Using 10 or 20 points gives roughly similar results.
+    // 20 points result in 20^3 input data for optimization, with the
+    // number of variable to optimize being just 78.
+    int num_pts = 20; // The number of points per axis
+
+    int num_threads = vw_settings().default_num_threads();
+
+    // Generate all the point pairs, fit the RPC model, and if it is
+    // not accurate enough between the samples, add samples where it
+    // is worst and fit again.
+    std::vector<Vector3> all_llh;
+    std::vector<Vector2> all_pixels;
+    generate_point_pairs(fp, num_pts, 0.0, cam_ptr.get(), num_threads, all_llh, all_pixels);
+
     RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
-    asp::gen_rpc(// Inputs
-                 opt.penalty_weight,
-                 "", // Only need to pass in an output prefix to log solver output
-                 normalized_geodetics, normalized_pixels,  
-                 llh_scale, llh_offset, uv_scale, uv_offset,
-                 // Outputs
-                 line_num, line_den, samp_num, samp_den);
+    int check_pts = num_pts;
+    for (int pass = 0; pass <= opt.max_sampling_refinements; pass++) {
+
+      Vector<double> normalized_geodetics;
+      Vector<double> normalized_pixels;
+      asp::normalize_point_pairs(all_llh, all_pixels, llh_scale, llh_offset,
+                                 uv_scale, uv_offset, normalized_geodetics, normalized_pixels);
+
+      // Find the RPC coefficients
+      asp::gen_rpc(// Inputs
+                   opt.penalty_weight,
+                   "", // Only need to pass in an output prefix to log solver output
+                   normalized_geodetics, normalized_pixels,  
+                   llh_scale, llh_offset, uv_scale, uv_offset,
+                   // Outputs
+                   line_num, line_den, samp_num, samp_den);
+
+      if (opt.max_fit_error <= 0)
+        break;
+
+      // Check the fit halfway between the samples
+      std::vector<Vector3> check_llh;
+      std::vector<Vector2> check_pixels;
+      std::vector<double>  check_errors;
+      generate_point_pairs(fp, check_pts, 0.5, cam_ptr.get(), num_threads,
+                           check_llh, check_pixels);
+      double max_err = asp::rpc_fit_errors(check_llh, check_pixels, llh_scale, llh_offset,
+                                           uv_scale, uv_offset,
+                                           line_num, line_den, samp_num, samp_den,
+                                           check_errors);
+      vw_out() << "Max RPC fit error between the samples: " << max_err << " pixels.\n";
+      if (max_err <= opt.max_fit_error)
+        break;
+      if (pass == opt.max_sampling_refinements) {
+        vw_out(WarningMessage) << "The RPC fit error is larger than --max-fit-error.\n";
+        break;
+      }
+
+      int num_added = asp::add_poorly_fit_points(check_llh, check_pixels, check_errors,
+                                                 opt.max_fit_error, all_llh, all_pixels);
+      vw_out() << "Adding " << num_added << " samples where the fit is worst.\n";
+      check_pts *= 2;
+    }
    
     save_xml(llh_scale, llh_offset, uv_scale, uv_offset,  
              line_num, line_den, samp_num, samp_den,  
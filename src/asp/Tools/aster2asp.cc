@@ -35,6 +35,8 @@
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -49,6 +51,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -263,14 +266,15 @@ public:
 
     ImageView<input_type> input_tile = crop(m_img, bbox); // to speed things up
     ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-      Vector3 C = m_corr[col];
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-	input_type val = input_tile(col - bbox.min().x(), row - bbox.min().y());
+    // Go along the rows, in the order the tile is stored in memory
+    for (int row = 0; row < bbox.height(); row++){
+      for (int col = 0; col < bbox.width(); col++){
+	Vector3 const& C = m_corr[col + bbox.min().x()];
+	input_type val = input_tile(col, row);
 	if (m_has_nodata && val == m_nodata)
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = val;
+	  tile(col, row) = val;
 	else
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = C[1] * val / C[2] + C[0];
+	  tile(col, row) = C[1] * val / C[2] + C[0];
       }
     }
     
@@ -335,11 +339,62 @@ void apply_radiometric_corrections(Options const& opt,
 			      TerminalProgressCallback("asp", "\t-->: "));
 }
 
+// Find the points at given heights on the rays from the ground points
+// to the satellite, for a range of indices into the list of all
+// heights and ground points, and convert them to lon-lat-height.
+class HeightLayerTask : public vw::Task, private boost::noncopyable {
+  std::vector<Vector3> const & m_ground_xyz;
+  std::vector<Vector3> const & m_full_sat_pos;
+  std::vector<Vector2> const & m_pixels;
+  double m_min_height, m_max_height;
+  int    m_num_samples, m_beg, m_end;
+  cartography::Datum   const & m_datum;
+  std::vector<Vector3>       & m_all_llh;
+  std::vector<Vector2>       & m_all_pixels;
+public:
+  HeightLayerTask(std::vector<Vector3> const& ground_xyz,
+                  std::vector<Vector3> const& full_sat_pos,
+                  std::vector<Vector2> const& pixels,
+                  double min_height, double max_height, int num_samples, int beg, int end,
+                  cartography::Datum const& datum,
+                  std::vector<Vector3> & all_llh, std::vector<Vector2> & all_pixels):
+    m_ground_xyz(ground_xyz), m_full_sat_pos(full_sat_pos), m_pixels(pixels),
+    m_min_height(min_height), m_max_height(max_height), m_num_samples(num_samples),
+    m_beg(beg), m_end(end), m_datum(datum), m_all_llh(all_llh), m_all_pixels(all_pixels) {}
+
+  void operator()() {
+    int num_pts = m_ground_xyz.size();
+    for (int k = m_beg; k < m_end; k++) {
+      int sample = k / num_pts;
+      int pt     = k % num_pts;
+      double height = m_min_height
+        + double(sample)*(m_max_height - m_min_height)/(m_num_samples - 1.0);
+
+      // Find an xyz position at roughly that height on the line
+      // connecting the original ground point and the satellite
+      // center. We need to solve a quadratic equation for that. We
+      // assume the Earth is a sphere.
+      Vector3 A = m_ground_xyz[pt];
+      Vector3 B = m_full_sat_pos[pt];
+      Vector3 D = B - A;
+
+      // Find t such that norm(A + t*D) = norm(A) + height
+      double  d = dot_prod(A, D) * dot_prod(A, D)
+        + dot_prod(D, D) * (height*height + 2*norm_2(A)*height);
+      double  t = ( -dot_prod(A, D) + sqrt(d) ) / dot_prod(D, D);
+      Vector3 P = A + t*D;
+
+      m_all_llh[k]    = m_datum.cartesian_to_geodetic(P);
+      m_all_pixels[k] = m_pixels[pt];
+    }
+  }
+};
+
 // Generate lon-lat-height to image pixel correspondences that we will
 // use to create the RPC model.
 void generate_point_pairs(// Inputs
                           double min_height, double max_height, int num_samples,
-                          double penalty_weight,
+                          double penalty_weight, int num_threads,
                           std::string const& sat_pos_file,
                           std::string const& sight_vec_file,
                           std::string const& longitude_file,
@@ -438,34 +493,29 @@ void generate_point_pairs(// Inputs
     
   // Form num_samples layers between min_height and max_height.
   // Each point there will have its corresponding pixel value.
+  // Converting to lon-lat-height is what takes time, so do that
+  // in parallel.
   int num_total_pts = num_pts*num_samples;
   std::vector<Vector3> all_llh (num_total_pts);
   std::vector<Vector2> all_pixels(num_total_pts);
-  count = 0;
-  for (int sample = 0; sample < num_samples; sample++) {
-    double height = min_height
-      + double(sample)*(max_height - min_height)/(num_samples - 1.0);
-
-    // Find an xyz position at roughly that height on the line
-    // connecting the original ground point and the satellite
-    // center. We need to solve a quadratic equation for that. We
-    // assume the Earth is a sphere.
-    for (int pt = 0; pt < num_pts; pt++) {
-
-      Vector3 A = ground_xyz[pt]; 
-      Vector3 B = full_sat_pos[pt];
-      Vector3 D = B - A;
-
-      // Find t such that norm(A + t*D) = norm(A) + height
-      double  d = dot_prod(A, D) * dot_prod(A, D)
-        + dot_prod(D, D) * (height*height + 2*norm_2(A)*height);
-      double  t = ( -dot_prod(A, D) + sqrt(d) ) / dot_prod(D, D);
-      Vector3 P = A + t*D;
-
-      all_llh[count]  = datum.cartesian_to_geodetic(P);
-      all_pixels[count] = pixels[pt];
-      count++;
+  int num_tasks = std::max(1, std::min(num_total_pts, 16*num_threads));
+  if (num_threads <= 1) {
+    HeightLayerTask task(ground_xyz, full_sat_pos, pixels, min_height, max_height,
+                         num_samples, 0, num_total_pts, datum, all_llh, all_pixels);
+    task();
+  }else{
+    FifoWorkQueue queue(num_threads);
+    for (int t = 0; t < num_tasks; t++) {
+      int beg = (long long)num_total_pts*t/num_tasks;
+      int end = (long long)num_total_pts*(t + 1)/num_tasks;
+      if (beg >= end)
+        continue;
+      boost::shared_ptr<HeightLayerTask>
+        task(new HeightLayerTask(ground_xyz, full_sat_pos, pixels, min_height, max_height,
+                                 num_samples, beg, end, datum, all_llh, all_pixels));
+      queue.add_task(task);
     }
+    queue.join_all();
   }
   
   // Find the range of lon-lat-heights
@@ -624,7 +674,7 @@ void save_xml(int image_cols, int image_rows,
 
 // Create XML files containing rigorous camera info, and compute the RPC coefficients as well.
 void gen_xml(double min_height, double max_height, int num_samples,
-	     double penalty_weight,
+	     double penalty_weight, int num_threads,
 	     std::string const& image_file,
 	     std::string const& sat_pos_file,
 	     std::string const& sight_vec_file,
@@ -657,7 +707,7 @@ void gen_xml(double min_height, double max_height, int num_samples,
   Vector<double> normalized_pixels;
   std::vector< std::vector<vw::Vector3> > world_sight_mat; // sight dir in world coords
   generate_point_pairs(// inputs
-                       min_height, max_height, num_samples, penalty_weight,  
+                       min_height, max_height, num_samples, penalty_weight, num_threads,
                        sat_pos_file, sight_vec_file,  
                        longitude_file, latitude_file, lattice_file,  
                        // Outputs
@@ -725,6 +775,8 @@ int main( int argc, char *argv[] ) {
     std::string out_nadir_cam = opt.output_prefix + "-Band3N.xml";
     std::string out_back_cam  = opt.output_prefix + "-Band3B.xml";
 
+    int num_threads = vw_settings().default_num_threads();
+
 #if 0
     std::cout 	<< "nadir_image             " 	<< nadir_image 		<< std::endl;
     std::cout 	<< "back_image              " 	<< back_image 		<< std::endl;
@@ -746,11 +798,11 @@ int main( int argc, char *argv[] ) {
               	<< out_back_cam  		<< std::endl;
 #endif
     
-    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight,
+    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight, num_threads,
 	    nadir_image, nadir_sat_pos, nadir_sight_vec, nadir_longitude, nadir_latitude,  
 	    nadir_lattice_point, out_nadir_cam);
     
-    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight,
+    gen_xml(opt.min_height, opt.max_height, opt.num_samples, opt.penalty_weight, num_threads,
 	    back_image, back_sat_pos, back_sight_vec, back_longitude, back_latitude,  
 	    back_lattice_point, out_back_cam);
     
@@ -21,6 +21,11 @@
 
 #include <vw/FileIO/KML.h>
 #include <vw/Camera/CameraUtilities.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -30,6 +35,10 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <xercesc/util/PlatformUtils.hpp>
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/ProgressStatus.h>
+#include <asp/Core/BackgroundWriter.h>
+#include <asp/Core/MatchFile.h>
+#include <asp/Core/SharedDem.h>
 
 // Turn off warnings from eigen
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -46,6 +55,7 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
 #if LOCAL_GCC_VERSION >= 40600
@@ -257,7 +267,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::vector<std::string> image_files, camera_files, gcp_files;
   std::string cnet_file, out_prefix, input_prefix, stereo_session_string,
     cost_function, ba_type, mapprojected_data, gcp_data;
-  int    ip_per_tile, ip_edge_buffer_percent;
+  int    ip_per_tile, ip_edge_buffer_percent, matching_job_index, num_matching_jobs;
   double min_triangulation_angle, lambda, camera_weight, rotation_weight, 
     translation_weight, overlap_exponent, robust_threshold, parameter_tolerance;
   int    report_level, min_matches, max_iterations, overlap_limit;
@@ -266,10 +276,13 @@ struct Options : public vw::cartography::GdalWriteOptions {
          disable_tri_filtering, ip_normalize_tiles, ip_debug_images;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list, intrinsics_to_float_str,
-    heights_from_dem;
+    heights_from_dem, solver_type, preconditioner_type, resume_from, status_file,
+    dem_cache_dir;
   double semi_major, semi_minor, position_filter_dist;
-  int num_ba_passes, max_num_reference_points;
-  std::string remove_outliers_params_str;
+  int num_ba_passes, max_num_reference_points, num_camera_blocks, num_block_sweeps,
+    checkpoint_interval;
+  std::set<int> block_cameras; // if not empty, solve only for these cameras
+  std::string remove_outliers_params_str, ip_nn_method;
   vw::Vector<double, 4> remove_outliers_params;
   vw::Vector2 remove_outliers_by_disp_params;
   boost::shared_ptr<ControlNetwork> cnet;
@@ -278,7 +291,9 @@ struct Options : public vw::cartography::GdalWriteOptions {
   int    ip_detect_method, num_scales;
   double epipolar_threshold; // Max distance from epipolar line to search for IP matches.
   double ip_inlier_factor, ip_uniqueness_thresh, nodata_value, max_disp_error;
-  bool   skip_rough_homography, individually_normalize, use_llh_error;
+  bool   skip_rough_homography, individually_normalize, use_llh_error, ip_feature_cache,
+         overlap_by_footprint, explicit_schur_ordering, benchmark_solvers,
+         skip_residual_logs, incremental, save_in_background;
   vw::Vector2  elevation_limit;     // Expected range of elevation to limit results to.
   vw::BBox2    lon_lat_limit;       // Limit the triangulated interest points to this lonlat range
   std::set<std::string> intrinsics_to_float;
@@ -290,19 +305,31 @@ struct Options : public vw::cartography::GdalWriteOptions {
   
   // Make sure all values are initialized, even though they will be
   // over-written later.
-  Options(): ip_per_tile(0), min_triangulation_angle(0), lambda(-1.0), camera_weight(-1),
+  Options(): ip_per_tile(0), matching_job_index(0), num_matching_jobs(1), min_triangulation_angle(0), lambda(-1.0), camera_weight(-1),
              rotation_weight(0), translation_weight(0), overlap_exponent(0), 
              robust_threshold(0), report_level(0), min_matches(0),
              max_iterations(0), overlap_limit(0), save_iteration(false),
              create_pinhole(false), fix_gcp_xyz(false), solve_intrinsics(false),
              semi_major(0), semi_minor(0), position_filter_dist(-1),
              num_ba_passes(1), max_num_reference_points(-1),
+             num_camera_blocks(1), num_block_sweeps(3), checkpoint_interval(0),
              datum(cartography::Datum(UNSPECIFIED_DATUM, "User Specified Spheroid",
                                       "Reference Meridian", 1, 1, 0)),
              ip_detect_method(0), num_scales(-1), skip_rough_homography(false),
-             individually_normalize(false), use_llh_error(false){}
+             individually_normalize(false), use_llh_error(false), ip_feature_cache(false),
+             overlap_by_footprint(false), explicit_schur_ordering(false),
+             benchmark_solvers(false), skip_residual_logs(false), incremental(false),
+             save_in_background(false){}
 };
 
+/// If a previous run wrote an adjustment for this camera to the input
+/// adjustments prefix. With --incremental, the cameras without one are new.
+bool has_prior_adjustment(Options const& opt, int icam){
+  return fs::exists(asp::bundle_adjust_file_name(opt.input_prefix,
+                                                 opt.image_files[icam],
+                                                 opt.camera_files[icam]));
+}
+
 // TODO: This update stuff should really be done somewhere else!
 //       Also the comments may be wrong.
 
@@ -329,6 +356,10 @@ update_cnet_and_init_cams(ModelT & ba_model, Options & opt,
       std::string adjust_file = asp::bundle_adjust_file_name(opt.input_prefix,
                                                              opt.image_files[icam],
                                                              opt.camera_files[icam]);
+      if (opt.incremental && !has_prior_adjustment(opt, icam)) {
+        vw_out() << "New camera, starting with no adjustment: " << opt.camera_files[icam] << "\n";
+        continue;
+      }
 
       ba_model.read_adjustment(icam, adjust_file, cameras_vec);
     }
@@ -466,6 +497,126 @@ struct BaReprojectionError {
   size_t m_icam, m_ipt;
 };
 
+/// The point which, projected into the unadjusted camera, gives the
+/// same pixel as the given point projected into the camera with the
+/// given adjustments, as done by AdjustedCameraModel. The camera
+/// parameters are the translation and then the axis-angle rotation.
+struct AdjustedPointFunctor {
+  AdjustedPointFunctor(Vector3 const& rotation_center): m_rotation_center(rotation_center){}
+
+  template <typename T>
+  bool operator()(const T* camera, const T* point, T* adj_point) const {
+    T offset[3], inv_axis_angle[3];
+    for (int k = 0; k < 3; k++) {
+      offset[k]         = point[k] - T(m_rotation_center[k]) - camera[k];
+      inv_axis_angle[k] = -camera[k + 3];
+    }
+    ceres::AngleAxisRotatePoint(inv_axis_angle, offset, adj_point);
+    for (int k = 0; k < 3; k++)
+      adj_point[k] += T(m_rotation_center[k]);
+    return true;
+  }
+
+  Vector3 m_rotation_center;
+};
+
+/// The reprojection error for the BundleAdjustmentModel, the same as
+/// BaReprojectionError, but with faster derivatives. Numerically
+/// differentiating the whole adjusted projection takes 18
+/// projections, which for linescan cameras are each an iterative
+/// solve. Here the adjustment, which is cheap, is differentiated
+/// automatically, and only the unadjusted projection is
+/// differentiated numerically, in the 3 coordinates of the adjusted
+/// point, which takes 6 projections.
+class BaAdjustedReprojectionError: public ceres::SizedCostFunction<PIXEL_SIZE,
+                                     BundleAdjustmentModel::camera_params_n,
+                                     BundleAdjustmentModel::point_params_n> {
+public:
+  BaAdjustedReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                              BundleAdjustmentModel * const ba_model, size_t icam):
+    m_observation(observation), m_pixel_sigma(pixel_sigma),
+    m_camera(ba_model->unadjusted_camera(icam)),
+    m_adjusted_point(new ceres::AutoDiffCostFunction<AdjustedPointFunctor, 3,
+                     BundleAdjustmentModel::camera_params_n,
+                     BundleAdjustmentModel::point_params_n>
+                     (new AdjustedPointFunctor(ba_model->rotation_center(icam)))){}
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    const int nc = BundleAdjustmentModel::camera_params_n;
+    const int np = BundleAdjustmentModel::point_params_n;
+
+    // The adjusted point, and its derivatives in the camera and point parameters
+    double adj_point[3], dadj_dcam[3*nc], dadj_dpt[3*np];
+    double * adj_jacobians[2] = {dadj_dcam, dadj_dpt};
+    if (!m_adjusted_point->Evaluate(parameters, adj_point,
+                                    (jacobians == NULL) ? NULL : adj_jacobians))
+      return false;
+
+    Vector3 point(adj_point[0], adj_point[1], adj_point[2]);
+    Vector2 prediction;
+    bool success = project(point, prediction);
+    for (size_t r = 0; r < PIXEL_SIZE; r++)
+      residuals[r] = (prediction[r] - m_observation[r])/m_pixel_sigma[r];
+
+    if (jacobians == NULL)
+      return true;
+
+    // Central differences of the unadjusted projection, with the
+    // same step as ceres::NumericDiffCostFunction.
+    const double relative_step = 1e-6;
+    double dpix_dadj[PIXEL_SIZE][3];
+    for (int k = 0; k < 3; k++) {
+      double step = std::max(relative_step*fabs(point[k]), relative_step);
+      Vector3 point_plus = point, point_minus = point;
+      point_plus[k]  += step;
+      point_minus[k] -= step;
+      Vector2 pix_plus, pix_minus;
+      bool good = success && project(point_plus, pix_plus) && project(point_minus, pix_minus);
+      for (size_t r = 0; r < PIXEL_SIZE; r++)
+        dpix_dadj[r][k] = good ? (pix_plus[r] - pix_minus[r])/(2*step)/m_pixel_sigma[r] : 0.0;
+    }
+
+    // The chain rule
+    double * dadj[2] = {dadj_dcam, dadj_dpt};
+    int      num_params[2] = {nc, np};
+    for (int b = 0; b < 2; b++) {
+      if (jacobians[b] == NULL)
+        continue;
+      for (size_t r = 0; r < PIXEL_SIZE; r++) {
+        for (int c = 0; c < num_params[b]; c++) {
+          double val = 0;
+          for (int k = 0; k < 3; k++)
+            val += dpix_dadj[r][k]*dadj[b][k*num_params[b] + c];
+          jacobians[b][r*num_params[b] + c] = val;
+        }
+      }
+    }
+    
+    return true;
+  }
+
+private:
+
+  // If the projection fails, return a garbage pixel instead of
+  // crashing, as done by BundleAdjustmentModel::cam_pixel().
+  bool project(Vector3 const& point, Vector2 & pixel) const {
+    try {
+      pixel = m_camera->point_to_pixel(point);
+      return true;
+    } catch(...) {
+      pixel = Vector2(-999999,-999999);
+      return false;
+    }
+  }
+
+  Vector2 m_observation;
+  Vector2 m_pixel_sigma;
+  BundleAdjustmentModel::cam_ptr_t       m_camera;
+  boost::shared_ptr<ceres::CostFunction> m_adjusted_point;
+};
+
 /// A ceres cost function. Here we float a pinhole camera's intrinsic
 /// and extrinsic parameters. The result is the residual, the
 /// difference in the observation and the projection of the point into
@@ -1093,6 +1244,371 @@ struct RotTransError {
 
 //=========================================================================
 
+/// Split the cameras into the given number of spatially compact
+/// blocks, by repeatedly cutting the largest block in half along
+/// the axis on which its camera centers are most spread out.
+std::vector< std::set<int> > partition_cameras(Options const& opt, int num_blocks){
+
+  const int num_cameras = opt.camera_models.size();
+  std::vector<Vector3> centers(num_cameras);
+  for (int icam = 0; icam < num_cameras; icam++)
+    centers[icam] = opt.camera_models[icam]->camera_center(Vector2(0,0));
+
+  std::vector< std::vector<int> > groups(1);
+  for (int icam = 0; icam < num_cameras; icam++)
+    groups[0].push_back(icam);
+
+  while (int(groups.size()) < num_blocks) {
+
+    size_t largest = 0;
+    for (size_t g = 1; g < groups.size(); g++)
+      if (groups[g].size() > groups[largest].size())
+        largest = g;
+    std::vector<int> & group = groups[largest];
+    if (group.size() < 2)
+      break; // not enough cameras
+
+    BBox3 box;
+    for (size_t k = 0; k < group.size(); k++)
+      box.grow(centers[group[k]]);
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+      if (box.size()[a] > box.size()[axis])
+        axis = a;
+
+    // Put the cameras with the smaller coordinate first
+    std::vector< std::pair<double, int> > coords;
+    for (size_t k = 0; k < group.size(); k++)
+      coords.push_back(std::make_pair(centers[group[k]][axis], group[k]));
+    std::sort(coords.begin(), coords.end());
+
+    size_t half = coords.size()/2;
+    std::vector<int> first, second;
+    for (size_t k = 0; k < coords.size(); k++)
+      (k < half ? first : second).push_back(coords[k].second);
+    groups[largest] = first;
+    groups.push_back(second);
+  }
+
+  std::vector< std::set<int> > blocks(groups.size());
+  for (size_t g = 0; g < groups.size(); g++)
+    blocks[g].insert(groups[g].begin(), groups[g].end());
+  return blocks;
+}
+
+/// With --incremental, the cameras to solve for: the new ones, and
+/// those which see some of the same points. The others stay fixed,
+/// and the points they alone see are left out of the problem.
+std::set<int> incremental_free_cameras(Options const& opt, asp::CameraObservations const& crn,
+                                       int num_points){
+
+  const int num_cameras = crn.num_cameras();
+  std::set<int> new_cameras;
+  std::vector<bool> seen_by_new(num_points, false);
+  for (int icam = 0; icam < num_cameras; icam++) {
+    if (has_prior_adjustment(opt, icam))
+      continue;
+    new_cameras.insert(icam);
+    for (size_t iobs = crn.begin(icam); iobs < crn.end(icam); iobs++)
+      seen_by_new[crn.point_id(iobs)] = true;
+  }
+  if (new_cameras.empty())
+    vw_throw( ArgumentErr() << "With --incremental, all cameras have adjustments with prefix "
+              << opt.input_prefix << ", so there is nothing new to solve for.\n" );
+
+  std::set<int> free_cameras = new_cameras;
+  for (int icam = 0; icam < num_cameras; icam++) {
+    for (size_t iobs = crn.begin(icam); iobs < crn.end(icam); iobs++) {
+      if (seen_by_new[crn.point_id(iobs)]) {
+        free_cameras.insert(icam);
+        break;
+      }
+    }
+  }
+
+  vw_out() << "Incremental mode: solving for " << new_cameras.size() << " new cameras and "
+           << free_cameras.size() - new_cameras.size() << " overlapping ones, out of "
+           << num_cameras << ".\n";
+  return free_cameras;
+}
+
+/// Set the linear solver and preconditioner types from strings, with
+/// "auto" picking them based on the number of cameras, according to
+/// the recommendations in the Ceres solving FAQs.
+void set_linear_solver(std::string const& solver_type,
+                       std::string const& preconditioner_type,
+                       int num_cameras, ceres::Solver::Options & options){
+
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  if (solver_type == "auto") {
+    if (num_cameras < 100)
+      options.linear_solver_type = ceres::DENSE_SCHUR;
+    if (num_cameras > 3500) {
+      options.use_explicit_schur_complement = true; // This is supposed to help with speed in a certain size range
+      options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
+      options.preconditioner_type = ceres::SCHUR_JACOBI;
+    }
+    if (num_cameras > 7000)
+      options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+  }else{
+    options.use_explicit_schur_complement = false;
+    if (!ceres::StringToLinearSolverType(solver_type, &options.linear_solver_type))
+      vw_throw( ArgumentErr() << "Unknown solver type: " << solver_type << ".\n" );
+  }
+
+  if (preconditioner_type != "auto") {
+    if (!ceres::StringToPreconditionerType(preconditioner_type, &options.preconditioner_type))
+      vw_throw( ArgumentErr() << "Unknown preconditioner: " << preconditioner_type << ".\n" );
+  }else if (options.linear_solver_type == ceres::CGNR) {
+    options.preconditioner_type = ceres::JACOBI;
+  }else if (options.linear_solver_type == ceres::ITERATIVE_SCHUR) {
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+  }
+}
+
+/// For the Schur solvers, eliminate the triangulated points first,
+/// then solve for the cameras and intrinsics, rather than have Ceres
+/// search for an ordering.
+void set_schur_ordering(ceres::Problem & problem, double * points,
+                        int num_points, int num_point_params,
+                        ceres::Solver::Options & options){
+
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  double * points_end = points + num_points * num_point_params;
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    bool is_point = (blocks[i] >= points && blocks[i] < points_end);
+    ordering->AddElementToGroup(blocks[i], is_point ? 0 : 1);
+  }
+  options.linear_solver_ordering.reset(ordering);
+}
+
+/// Solve the problem with several linear solvers and preconditioners,
+/// and report how long each took. The parameters are restored
+/// after each solve. Combinations which this build of Ceres does not
+/// support are reported as unavailable.
+void benchmark_linear_solvers(ceres::Solver::Options const& base_options,
+                              ceres::Problem & problem,
+                              std::vector<double*> const& param_arrays,
+                              std::vector<int>     const& param_sizes){
+
+  std::vector<std::string> solvers, preconditioners;
+  solvers.push_back("dense_schur");     preconditioners.push_back("jacobi");
+  solvers.push_back("sparse_schur");    preconditioners.push_back("jacobi");
+  solvers.push_back("iterative_schur"); preconditioners.push_back("jacobi");
+  solvers.push_back("iterative_schur"); preconditioners.push_back("schur_jacobi");
+  solvers.push_back("iterative_schur"); preconditioners.push_back("cluster_jacobi");
+  solvers.push_back("iterative_schur"); preconditioners.push_back("cluster_tridiagonal");
+  solvers.push_back("cgnr");            preconditioners.push_back("jacobi");
+
+  // Keep the starting values
+  std::vector< std::vector<double> > orig(param_arrays.size());
+  for (size_t k = 0; k < param_arrays.size(); k++)
+    orig[k].assign(param_arrays[k], param_arrays[k] + param_sizes[k]);
+
+  vw_out() << "Benchmarking the linear solvers.\n";
+  std::ostringstream report;
+  report << "solver preconditioner time(s) iterations final_cost\n";
+  for (size_t c = 0; c < solvers.size(); c++) {
+
+    ceres::Solver::Options options = base_options;
+    options.minimizer_progress_to_stdout = false;
+    options.linear_solver_ordering.reset(); // let Ceres find it for each solver
+    set_linear_solver(solvers[c], preconditioners[c], 0, options);
+
+    report << solvers[c] << ' ' << preconditioners[c] << ' ';
+    std::string error;
+    if (!options.IsValid(&error)) {
+      report << "unavailable: " << error << "\n";
+      continue;
+    }
+
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    if (summary.termination_type == ceres::FAILURE)
+      report << "failed: " << summary.message << "\n";
+    else
+      report << summary.total_time_in_seconds << ' '
+             << summary.iterations.size() << ' ' << summary.final_cost << "\n";
+
+    for (size_t k = 0; k < param_arrays.size(); k++)
+      std::copy(orig[k].begin(), orig[k].end(), param_arrays[k]);
+  }
+
+  vw_out() << report.str();
+}
+
+/// Save the state of the solver, so that an interrupted run can be
+/// continued with --resume-from. If 'mid_pass' is false, the given
+/// pass is about to start, with these outliers. The file is written
+/// under a temporary name and then renamed, so it is never left
+/// incomplete.
+void write_checkpoint(std::string const& checkpoint_file, int pass, bool mid_pass,
+                      const double * cameras,    int num_camera_vals,
+                      const double * intrinsics, int num_intrinsic_vals,
+                      const double * points,     int num_point_vals,
+                      std::set<int> const& outlier_xyz){
+
+  std::string tmp_file = checkpoint_file + "-" + fs::unique_path().string() + ".tmp";
+  std::ofstream ofs(tmp_file.c_str());
+  ofs.precision(17);
+  ofs << "pass " << pass << " " << int(mid_pass) << "\n";
+
+  const double * vals[3] = {cameras, intrinsics, points};
+  int        num_vals[3] = {num_camera_vals, num_intrinsic_vals, num_point_vals};
+  for (int k = 0; k < 3; k++) {
+    ofs << num_vals[k] << "\n";
+    for (int i = 0; i < num_vals[k]; i++)
+      ofs << vals[k][i] << "\n";
+  }
+
+  ofs << outlier_xyz.size() << "\n";
+  for (std::set<int>::const_iterator it = outlier_xyz.begin(); it != outlier_xyz.end(); it++)
+    ofs << *it << "\n";
+
+  ofs.close();
+  if (!ofs)
+    vw_throw( IOErr() << "Failed to write: " << tmp_file << "\n" );
+  fs::rename(tmp_file, checkpoint_file);
+}
+
+/// Read the state written by write_checkpoint(). The sizes must agree
+/// with the current problem.
+void read_checkpoint(std::string const& checkpoint_file, int & pass, bool & mid_pass,
+                     std::vector<double> & cameras_vec,
+                     std::vector<double> & intrinsics_vec,
+                     std::vector<double> & points_vec,
+                     std::set<int> & outlier_xyz){
+
+  vw_out() << "Resuming from: " << checkpoint_file << std::endl;
+  std::ifstream ifs(checkpoint_file.c_str());
+  std::string tag;
+  int mid = 0;
+  if (!(ifs >> tag >> pass >> mid) || tag != "pass")
+    vw_throw( IOErr() << "Invalid checkpoint file: " << checkpoint_file << "\n" );
+  mid_pass = (mid != 0);
+
+  std::vector<double> * vals[3] = {&cameras_vec, &intrinsics_vec, &points_vec};
+  for (int k = 0; k < 3; k++) {
+    size_t num = 0;
+    if ( !(ifs >> num) || num != vals[k]->size() )
+      vw_throw( ArgumentErr() << "The checkpoint " << checkpoint_file
+                << " was made for a different problem.\n" );
+    for (size_t i = 0; i < num; i++) {
+      if (!(ifs >> (*vals[k])[i]))
+        vw_throw( IOErr() << "Truncated checkpoint file: " << checkpoint_file << "\n" );
+    }
+  }
+
+  size_t num_outliers = 0;
+  if (!(ifs >> num_outliers))
+    vw_throw( IOErr() << "Truncated checkpoint file: " << checkpoint_file << "\n" );
+  outlier_xyz.clear();
+  for (size_t i = 0; i < num_outliers; i++) {
+    int ipt;
+    if (!(ifs >> ipt) || ipt < 0 || ipt >= int(points_vec.size()))
+      vw_throw( IOErr() << "Invalid outlier in checkpoint file: " << checkpoint_file << "\n" );
+    outlier_xyz.insert(ipt);
+  }
+}
+
+/// A copy of the parameters in the middle of a pass, to write as a
+/// checkpoint while the solver goes on.
+struct CheckpointSnapshot {
+  std::string         checkpoint_file;
+  int                 pass;
+  std::vector<double> cameras, intrinsics, points;
+  std::set<int>       outlier_xyz;
+
+  void write() const {
+    vw_out() << "Writing checkpoint: " << checkpoint_file << std::endl;
+    write_checkpoint(checkpoint_file, pass, true,
+                     cameras.empty()    ? NULL : &cameras[0],    cameras.size(),
+                     intrinsics.empty() ? NULL : &intrinsics[0], intrinsics.size(),
+                     points.empty()     ? NULL : &points[0],     points.size(),
+                     outlier_xyz);
+  }
+};
+
+/// Write a checkpoint every given number of solver iterations.
+/// The solver must update the parameters every iteration. In the
+/// background, a checkpoint due while the previous one is still
+/// waiting to be written is skipped.
+class CheckpointCallback: public ceres::IterationCallback {
+public:
+  CheckpointCallback(std::string const& checkpoint_file, int interval, int pass,
+                     const double * cameras, int num_camera_vals,
+                     const double * intrinsics, const double * scaled_intrinsics,
+                     int num_intrinsic_vals,
+                     const double * points, int num_point_vals,
+                     std::set<int> const& outlier_xyz, bool background):
+    m_checkpoint_file(checkpoint_file), m_interval(interval), m_pass(pass),
+    m_cameras(cameras), m_num_camera_vals(num_camera_vals),
+    m_intrinsics(intrinsics), m_scaled_intrinsics(scaled_intrinsics),
+    m_num_intrinsic_vals(num_intrinsic_vals),
+    m_points(points), m_num_point_vals(num_point_vals), m_outlier_xyz(outlier_xyz),
+    m_writer(background){}
+
+  virtual ceres::CallbackReturnType operator()(const ceres::IterationSummary& summary) {
+    if (summary.iteration == 0 || summary.iteration % m_interval != 0)
+      return ceres::SOLVER_CONTINUE;
+
+    boost::shared_ptr<CheckpointSnapshot> snapshot(new CheckpointSnapshot);
+    snapshot->checkpoint_file = m_checkpoint_file;
+    snapshot->pass            = m_pass;
+    snapshot->cameras.assign(m_cameras, m_cameras + m_num_camera_vals);
+    snapshot->points.assign (m_points,  m_points  + m_num_point_vals);
+    snapshot->outlier_xyz     = m_outlier_xyz;
+
+    // The solver works with multipliers of the intrinsics
+    snapshot->intrinsics.resize(m_num_intrinsic_vals);
+    for (int i = 0; i < m_num_intrinsic_vals; i++)
+      snapshot->intrinsics[i] = m_intrinsics[i] * m_scaled_intrinsics[i];
+
+    if (!m_writer.try_add(boost::bind(&CheckpointSnapshot::write, snapshot)))
+      vw_out() << "Skipping the checkpoint of iteration " << summary.iteration
+               << ", as the previous one is still being written.\n";
+    return ceres::SOLVER_CONTINUE;
+  }
+
+  /// Wait for the checkpoints being written
+  void finish() { m_writer.wait(); }
+
+private:
+  std::string    m_checkpoint_file;
+  int            m_interval, m_pass;
+  const double * m_cameras;
+  int            m_num_camera_vals;
+  const double * m_intrinsics;
+  const double * m_scaled_intrinsics;
+  int            m_num_intrinsic_vals;
+  const double * m_points;
+  int            m_num_point_vals;
+  std::set<int> const& m_outlier_xyz;
+  asp::BackgroundWriter m_writer;
+};
+
+/// Update the status file after each solver iteration, with the
+/// progress of the pass measured in iterations.
+class StatusCallback: public ceres::IterationCallback {
+public:
+  StatusCallback(int pass, int num_passes, int max_iterations):
+    m_pass(pass), m_num_passes(num_passes), m_max_iterations(max_iterations){}
+
+  virtual ceres::CallbackReturnType operator()(const ceres::IterationSummary& summary) {
+    std::ostringstream stage;
+    stage << "Solving, pass " << m_pass + 1 << " of " << m_num_passes;
+    double progress = double(summary.iteration)/std::max(m_max_iterations, 1);
+    asp::write_progress_status(stage.str(), progress, summary.cumulative_time_in_seconds,
+                               false);
+    return ceres::SOLVER_CONTINUE;
+  }
+
+private:
+  int m_pass, m_num_passes, m_max_iterations;
+};
+
 ceres::LossFunction* get_loss_function(Options const& opt ){
   double th = opt.robust_threshold;
   ceres::LossFunction* loss_function;
@@ -1128,6 +1644,22 @@ void add_residual_block(ModelT & ba_model,
   problem.AddResidualBlock(cost_function, loss_function, camera, point);
 }
 
+// Add residual block for the reprojection error with adjusted cameras
+template<>
+void add_residual_block<BundleAdjustmentModel>
+                  (BundleAdjustmentModel & ba_model,
+                   Vector2 const& observation, Vector2 const& pixel_sigma,
+                   size_t icam, size_t ipt,
+                   double * camera, double * point, double * scaled_intrinsics,
+                   std::set<std::string> const& intrinsics_to_float,
+                   ceres::LossFunction* loss_function,
+                   ceres::Problem & problem){
+
+  ceres::CostFunction* cost_function =
+    new BaAdjustedReprojectionError(observation, pixel_sigma, &ba_model, icam);
+  problem.AddResidualBlock(cost_function, loss_function, camera, point);
+}
+
 // Add residual block for the reprojection error, optionally floating the intrinsics
 template<>
 void add_residual_block<BAPinholeModel>
@@ -1200,49 +1732,102 @@ void add_residual_block<BAPinholeModel>
   
 }
 
-/// Compute residual map by averaging all the reprojection error at a given point
-void compute_mean_residuals_at_xyz(CameraRelationNetwork<JFeature> & crn,
+/// Accumulate the pixel residuals at each xyz point over a range of
+/// cameras. Each task has its own sums, so no locking is needed.
+class MeanResidualsTask : public vw::Task, private boost::noncopyable {
+  asp::CameraObservations const& m_crn;
+  std::vector<double>     const& m_residuals;
+  std::vector<bool>       const& m_is_outlier;
+  std::vector<size_t>     const& m_cam_offsets;
+  size_t m_beg, m_end;
+  std::vector<double> & m_sums;
+  std::vector<int>    & m_counts;
+public:
+  MeanResidualsTask(asp::CameraObservations const& crn, std::vector<double> const& residuals,
+                    std::vector<bool> const& is_outlier, std::vector<size_t> const& cam_offsets,
+                    size_t beg, size_t end, std::vector<double> & sums, std::vector<int> & counts):
+    m_crn(crn), m_residuals(residuals), m_is_outlier(is_outlier), m_cam_offsets(cam_offsets),
+    m_beg(beg), m_end(end), m_sums(sums), m_counts(counts){}
+
+  void operator()() {
+    for (size_t icam = m_beg; icam < m_end; icam++) {
+      size_t residual_index = m_cam_offsets[icam];
+      for (size_t iobs = m_crn.begin(icam); iobs < m_crn.end(icam); iobs++){
+
+        // The index of the 3D point
+        int ipt = m_crn.point_id(iobs);
+        if (m_is_outlier[ipt]) continue; // skip outliers
+
+        // Get the residual error for this observation
+        double errorX = m_residuals[residual_index ];
+        double errorY = m_residuals[residual_index+1];
+        residual_index += PIXEL_SIZE;
+
+        m_counts[ipt] += 1;
+        m_sums  [ipt] += (fabs(errorX) + fabs(errorY)) / 2;
+      }
+    }
+  }
+};
+
+/// Compute residual map by averaging all the reprojection error at a given point.
+/// The cameras are split among threads, each with its own accumulators.
+void compute_mean_residuals_at_xyz(asp::CameraObservations const& crn,
 				   std::vector<double> const& residuals,
 				   const size_t num_points,
 				   std::set<int>  const& outlier_xyz,
 				   const size_t num_cameras,
+				   std::vector<size_t> const& cam_residual_counts,
+				   int num_threads,
 				   // outputs
 				   std::vector<double> & mean_residuals,
 				   std::vector<int>  & num_point_observations
 				   ) {
 
-  mean_residuals.resize(num_points);
-  num_point_observations.resize(num_points);
+  mean_residuals.assign(num_points, 0.0);
+  num_point_observations.assign(num_points, 0);
+
+  std::vector<bool> is_outlier(num_points, false);
+  for (std::set<int>::const_iterator it = outlier_xyz.begin(); it != outlier_xyz.end(); it++)
+    is_outlier[*it] = true;
   
   // Observation residuals are stored at the beginning of the residual vector in the 
-  //  same order they were originally added to Ceres.
-  
-  size_t residual_index = 0;
-  // Double loop through cameras and crn entries will give us the correct order
-  for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
-
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
-
-      if (outlier_xyz.find(ipt) != outlier_xyz.end()) continue; // skip outliers
-      
-      // Get the residual error for this observation
-      double errorX = residuals[residual_index ];
-      double errorY = residuals[residual_index+1];
-      double residual_error = (fabs(errorX) + fabs(errorY)) / 2;
-      residual_index += PIXEL_SIZE;
-
-      // Update information for this point
-      num_point_observations[ipt] += 1;
-      mean_residuals       [ipt] += residual_error;
+  //  same order they were originally added to Ceres, camera by camera.
+  std::vector<size_t> cam_offsets(num_cameras, 0);
+  for (size_t icam = 1; icam < num_cameras; icam++)
+    cam_offsets[icam] = cam_offsets[icam-1] + cam_residual_counts[icam-1]*PIXEL_SIZE;
+
+  // One set of sums per task, added together at the end
+  num_threads = std::max(num_threads, 1);
+  size_t num_tasks = std::min(size_t(num_threads), num_cameras);
+  if (num_tasks <= 1) {
+    MeanResidualsTask task(crn, residuals, is_outlier, cam_offsets, 0, num_cameras,
+                           mean_residuals, num_point_observations);
+    task();
+  } else {
+    std::vector< std::vector<double> > sums(num_tasks, std::vector<double>(num_points, 0.0));
+    std::vector< std::vector<int> >  counts(num_tasks, std::vector<int>(num_points, 0));
+    FifoWorkQueue queue(num_threads);
+    for (size_t itask = 0; itask < num_tasks; itask++) {
+      size_t beg = num_cameras*itask/num_tasks, end = num_cameras*(itask + 1)/num_tasks;
+      boost::shared_ptr<MeanResidualsTask>
+        task(new MeanResidualsTask(crn, residuals, is_outlier, cam_offsets, beg, end,
+                                   sums[itask], counts[itask]));
+      queue.add_task(task);
     }
-  } // End double loop through all the observations
+    queue.join_all();
+    
+    for (size_t itask = 0; itask < num_tasks; itask++) {
+      for (size_t i = 0; i < num_points; i++) {
+        mean_residuals[i]         += sums[itask][i];
+        num_point_observations[i] += counts[itask][i];
+      }
+    }
+  }
 
   // Do the averaging
   for (size_t i = 0; i < num_points; ++i) {
-    if (outlier_xyz.find(i) != outlier_xyz.end()) {
+    if (is_outlier[i]) {
       // Skip outliers. But initialize to something.
       mean_residuals[i] = std::numeric_limits<double>::quiet_NaN();
       num_point_observations[i] = std::numeric_limits<double>::quiet_NaN();
@@ -1254,12 +1839,13 @@ void compute_mean_residuals_at_xyz(CameraRelationNetwork<JFeature> & crn,
 }
 
 /// Write out a .csv file recording the residual error at each location on the ground
-void write_residual_map(std::string const& output_prefix, CameraRelationNetwork<JFeature> & crn,
+void write_residual_map(std::string const& output_prefix, asp::CameraObservations const& crn,
                         std::vector<double> const& residuals,
                         const double *points, const size_t num_points,
 			std::set<int>  const& outlier_xyz,
                         const size_t num_point_params, 
                         const size_t num_cameras,
+                        std::vector<size_t> const& cam_residual_counts,
                         Options const& opt) {
 
   // Mean residual, and how many times that residual is seen
@@ -1267,6 +1853,7 @@ void write_residual_map(std::string const& output_prefix, CameraRelationNetwork<
   std::vector<int>  num_point_observations;
   
   compute_mean_residuals_at_xyz(crn,  residuals,  num_points, outlier_xyz,  num_cameras,
+                                cam_residual_counts, opt.num_threads,
 				// outputs
 				mean_residuals, num_point_observations);
   
@@ -1291,7 +1878,7 @@ void write_residual_map(std::string const& output_prefix, CameraRelationNetwork<
       Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
   
      file << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
-          << num_point_observations[i] << std::endl;
+          << num_point_observations[i] << "\n";
   }
   file.close();
     
@@ -1304,7 +1891,7 @@ void compute_residuals(bool apply_loss_function,
 		       std::vector<size_t> const& cam_residual_counts,
 		       size_t num_gcp_residuals, 
                        std::vector<vw::Vector3> const& reference_vec,
-		       CameraRelationNetwork<JFeature> & crn,
+		       asp::CameraObservations const& crn,
 		       ceres::Problem &problem,
 		       std::vector<double> & residuals // output
 		       ) {
@@ -1345,7 +1932,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
 			 std::vector<size_t> const& cam_residual_counts,
 			 size_t num_gcp_residuals, 
                          std::vector<vw::Vector3> const& reference_vec,
-			 CameraRelationNetwork<JFeature> & crn,
+			 asp::CameraObservations const& crn,
 			 const double *points, const size_t num_points,
 			 std::set<int>  const& outlier_xyz,
 			 ceres::Problem &problem) {
@@ -1402,7 +1989,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
       ++index;
       mean_residual += fabs(ex) + fabs(ey);
       
-      residual_file_raw_pixels << ex << ", " << ey << std::endl; // Write ex, ey on raw file
+      residual_file_raw_pixels << ex << ", " << ey << "\n"; // Write ex, ey on raw file
     }
     // Write line for the summary file
     mean_residual /= static_cast<double>(num_this_cam_residuals);
@@ -1484,13 +2071,24 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   // Generate the location based files
   std::string map_prefix = residual_prefix + "_pointmap";
   write_residual_map(map_prefix, crn, residuals, points, num_points, outlier_xyz,
-		     num_point_params, num_cameras, opt);
+		     num_point_params, num_cameras, cam_residual_counts, opt);
 
 } // End function write_residual_logs
 
+/// A point can become an outlier if it is not one yet, is seen in
+/// some camera, and is not a GCP, as those are never outliers.
+bool is_outlier_candidate(ControlNetwork const& cnet, std::set<int> const& outlier_xyz,
+                          std::vector<int> const& num_point_observations, size_t ipt) {
+  if (outlier_xyz.find(ipt) != outlier_xyz.end())
+    return false;
+  if (num_point_observations[ipt] <= 0)
+    return false;
+  return (cnet[ipt].type() != ControlPoint::GroundControlPoint);
+}
+
 /// Add to the outliers based on the large residuals
 int update_outliers(ControlNetwork                  & cnet,
-                    CameraRelationNetwork<JFeature> & crn,
+                    asp::CameraObservations const& crn,
                     const double *points, const size_t num_points,
                     std::set<int> & outlier_xyz,
                     Options const& opt,
@@ -1517,38 +2115,21 @@ int update_outliers(ControlNetwork                  & cnet,
   std::vector<double> mean_residuals;
   std::vector<int>  num_point_observations;
   compute_mean_residuals_at_xyz(crn,  residuals,  num_points, outlier_xyz,  num_cameras,
+                                cam_residual_counts, opt.num_threads,
                                 // outputs
                                 mean_residuals, num_point_observations);
 
 
   // The number of mean residuals is the same as the number of points,
   // of which some are outliers. Hence need to collect only the
-  // non-outliers so far to be able to remove new outliers.  Need to
-  // follow the same logic as when residuals were formed. And also ignore GCP.
+  // non-outliers so far to be able to remove new outliers. Points
+  // not seen in any camera have no residual. And also ignore GCP.
   std::vector<double> actual_residuals;
-  std::set<int> was_added;
-  for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
-
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
-
-      // skip existing outliers
-      if (outlier_xyz.find(ipt) != outlier_xyz.end()) continue; 
-
-      // Skip gcp, those are never outliers no matter what.
-      if (cnet[ipt].type() == ControlPoint::GroundControlPoint) continue;
-
-      // We already encountered this residual in the previous camera
-      if (was_added.find(ipt) != was_added.end()) 
-        continue;
-      
-      was_added.insert(ipt);
-      actual_residuals.push_back(mean_residuals[ipt]);
-      //vw_out() << "XYZ residual " << ipt << " = " << mean_residuals[ipt] << std::endl;
-    }
-  } // End double loop through all the observations
+  for (size_t ipt = 0; ipt < num_points; ipt++) {
+    if (!is_outlier_candidate(cnet, outlier_xyz, num_point_observations, ipt))
+      continue;
+    actual_residuals.push_back(mean_residuals[ipt]);
+  }
 
   double pct      = 1.0 - opt.remove_outliers_params[0]/100.0;
   double factor   = opt.remove_outliers_params[1];
@@ -1569,46 +2150,36 @@ int update_outliers(ControlNetwork                  & cnet,
   
   // Now add to the outliers. Must repeat the same logic as above. 
   std::set<int>  new_outliers = outlier_xyz;
-  for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
-
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
-
-      // skip existing outliers
-      if (outlier_xyz.find(ipt) != outlier_xyz.end()) continue; 
-
-      // Skip gcp
-      if (cnet[ipt].type() == ControlPoint::GroundControlPoint) continue;
+  for (size_t ipt = 0; ipt < num_points; ipt++) {
+    if (!is_outlier_candidate(cnet, outlier_xyz, num_point_observations, ipt))
+      continue;
 
-      if (mean_residuals[ipt] > e) {
-        //vw_out() << "Removing " << ipt << " with residual " << mean_residuals[ipt] << std::endl;
-        new_outliers.insert(ipt);
-      }
+    if (mean_residuals[ipt] > e) {
+      //vw_out() << "Removing " << ipt << " with residual " << mean_residuals[ipt] << std::endl;
+      new_outliers.insert(ipt);
+    }
 
-      /*
-      const double * point = points + ipt * num_point_params;
-      Vector3 xyz(point[0], point[1], point[2]);
-      Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
-      // Also filter by elevation limit
-      if ( (asp::stereo_settings().elevation_limit[0] <
-            asp::stereo_settings().elevation_limit[1]) && 
+    /*
+    const double * point = points + ipt * num_point_params;
+    Vector3 xyz(point[0], point[1], point[2]);
+    Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
+    // Also filter by elevation limit
+    if ( (asp::stereo_settings().elevation_limit[0] <
+          asp::stereo_settings().elevation_limit[1]) && 
 	           ( (llh[2] < asp::stereo_settings().elevation_limit[0]) ||
-             (llh[2] > asp::stereo_settings().elevation_limit[1]) ) ) {
-        vw_out() << "Removing " << ipt << " with elevation " << llh[2] << std::endl;
-        new_outliers.insert(ipt); 
-      }
-
-      // And by lonlat limit
-      Vector2 lon_lat = subvector(llh, 0, 2);
-      if ( (!asp::stereo_settings().lon_lat_limit.empty()) &&
-           (!asp::stereo_settings().lon_lat_limit.contains(lon_lat)) ) {
-        vw_out() << "Removing " << ipt << " with lonlat " << lon_lat << std::endl;
-        new_outliers.insert(ipt); 
-      }*/
+           (llh[2] > asp::stereo_settings().elevation_limit[1]) ) ) {
+      vw_out() << "Removing " << ipt << " with elevation " << llh[2] << std::endl;
+      new_outliers.insert(ipt); 
     }
-  } // End double loop through all the observations
+
+    // And by lonlat limit
+    Vector2 lon_lat = subvector(llh, 0, 2);
+    if ( (!asp::stereo_settings().lon_lat_limit.empty()) &&
+         (!asp::stereo_settings().lon_lat_limit.contains(lon_lat)) ) {
+      vw_out() << "Removing " << ipt << " with lonlat " << lon_lat << std::endl;
+      new_outliers.insert(ipt); 
+    }*/
+  } // End loop through all the points
 
   int num_new_outliers     = new_outliers.size() - outlier_xyz.size();
   int num_remaining_points = num_points - new_outliers.size();
@@ -1672,31 +2243,35 @@ void record_points_to_kml(const std::string &kml_path, const cartography::Datum&
 }
 
 
-void create_interp_dem(std::string & dem_file,
+void create_interp_dem(std::string & dem_file, Options const& opt,
                        vw::cartography::GeoReference & dem_georef,
                        ImageViewRef< PixelMask<double> > & interp_dem){
   
   vw_out() << "Loading DEM: " << dem_file << std::endl;
-  double nodata_val = -std::numeric_limits<float>::max(); // note we use a float nodata
-  if (vw::read_nodata_val(dem_file, nodata_val)){
-    vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
-  }
-  
-  ImageView< PixelMask<double> > dem = create_mask(DiskImageView<double>(dem_file), nodata_val);
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  asp::SharedDem shared_dem(dem_file, opt.dem_cache_dir, num_threads);
+  if (shared_dem.has_nodata())
+    vw_out() << "Found DEM nodata value: " << shared_dem.nodata() << std::endl;
+  dem_georef = shared_dem.georef();
+
+  // A DEM mapped in memory is shared with the other processes, so it
+  // is not copied. Otherwise it is read in memory.
+  ImageViewRef< PixelMask<double> > dem
+    = pixel_cast< PixelMask<double> >(shared_dem.masked_dem());
+  if (!shared_dem.is_mapped())
+    dem = ImageView< PixelMask<double> >(dem);
   
   interp_dem = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
-  bool is_good = vw::cartography::read_georeference(dem_georef, dem_file);
-  if (!is_good) {
-    vw_throw(ArgumentErr() << "Error: Cannot read georeference from DEM: "
-             << dem_file << ".\n");
-  }
 }
 
 template <class ModelT>
 int do_ba_ceres_one_pass(ModelT                          & ba_model,
                           Options                         & opt,
                           ControlNetwork                  & cnet,
-                          CameraRelationNetwork<JFeature> & crn,
+                          asp::CameraObservations const& crn,
+                          int                               pass,
                           bool                              first_pass,
                           bool                              last_pass,
                           int                               num_camera_params,
@@ -1714,16 +2289,15 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
 
   // Add the cost function component for difference of pixel observations
   // - Reduce error by making pixel projection consistent with observations.
-  typedef CameraNode<JFeature>::iterator crn_iter;
-  if (num_cameras != static_cast<int>(crn.size()))
-    vw_throw( LogicErr() << "Expected " << num_cameras << " cameras but crn has " << crn.size());
+  if (num_cameras != crn.num_cameras())
+    vw_throw( LogicErr() << "Expected " << num_cameras << " cameras but crn has " << crn.num_cameras());
 
   // How many times an xyz point shows up in the problem
   std::map<double*, int> count_map;
   if (opt.overlap_exponent > 0) {
     for ( int icam = 0; icam < num_cameras; icam++ ) {
-      for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
-        int ipt = (**fiter).m_point_id;
+      for (size_t iobs = crn.begin(icam); iobs < crn.end(icam); iobs++){
+        int ipt = crn.point_id(iobs);
         if (outlier_xyz.find(ipt) != outlier_xyz.end())
           continue; // skip outliers
         double * point  = points  + ipt  * num_point_params;
@@ -1748,17 +2322,29 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   if (opt.heights_from_dem != "") {
     if (!opt.create_pinhole) 
       vw_throw( ArgumentErr() << "When using a high quality DEM, must use the --create-pinhole-cameras option.\n");
-    create_interp_dem(opt.heights_from_dem, dem_georef, interp_dem);
+    create_interp_dem(opt.heights_from_dem, opt, dem_georef, interp_dem);
   }
   
+  // When solving for a block of cameras, use only the points they see.
+  bool solve_for_block = !opt.block_cameras.empty();
+  std::vector<bool> block_points;
+  if (solve_for_block) {
+    block_points.resize(num_points, false);
+    for (std::set<int>::const_iterator it = opt.block_cameras.begin();
+         it != opt.block_cameras.end(); it++) {
+      for (size_t iobs = crn.begin(*it); iobs < crn.end(*it); iobs++)
+        block_points[crn.point_id(iobs)] = true;
+    }
+  }
+
   // Add the various cost functions the solver will optimize over.
   std::vector<size_t> cam_residual_counts(num_cameras);
   for ( int icam = 0; icam < num_cameras; icam++ ) {
     cam_residual_counts[icam] = 0;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+    for (size_t iobs = crn.begin(icam); iobs < crn.end(icam); iobs++){
 
       // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+      int ipt = crn.point_id(iobs);
       if (outlier_xyz.find(ipt) != outlier_xyz.end())
         continue; // skip outliers
 
@@ -1767,10 +2353,13 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
       VW_ASSERT(int(ipt)  < num_points,
                 ArgumentErr() << "Out of bounds in the number of points");
 
+      if (solve_for_block && !block_points[ipt])
+        continue; // not seen by any camera in the block
+
       // The observed value for the projection of point with index ipt into
       // the camera with index icam.
-      Vector2 observation = (**fiter).m_location;
-      Vector2 pixel_sigma = (**fiter).m_scale;
+      Vector2 observation = crn.location(iobs);
+      Vector2 pixel_sigma = crn.scale(iobs);
 
       // This is a bugfix
       if (pixel_sigma != pixel_sigma) // nan check
@@ -1796,8 +2385,10 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
                          camera, point, scaled_intrinsics_ptr, opt.intrinsics_to_float,
                          loss_function, problem);
 
-      // Fix this camera if requested
-      if (opt.fixed_cameras_indices.find(icam) != opt.fixed_cameras_indices.end()) 
+      // Fix this camera if requested, or if it is outside the block
+      // being solved for, as it is then seen only as the neighbor of one.
+      if (opt.fixed_cameras_indices.find(icam) != opt.fixed_cameras_indices.end() ||
+          (solve_for_block && opt.block_cameras.find(icam) == opt.block_cameras.end()))
 	problem.SetParameterBlockConstant(camera);
             
       if (opt.heights_from_dem != "") {
@@ -1840,6 +2431,9 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
 
     if (outlier_xyz.find(ipt) != outlier_xyz.end())
       continue; // skip outliers
+
+    if (solve_for_block && !block_points[ipt])
+      continue;
     
     num_gcp++;
     
@@ -1870,6 +2464,9 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
 
     for (int icam = 0; icam < num_cameras; icam++){
 
+      if (solve_for_block && opt.block_cameras.find(icam) == opt.block_cameras.end())
+        continue;
+
       typename ModelT::camera_vector_t orig_cam;
       for (int q = 0; q < num_camera_params; q++)
         orig_cam[q] = orig_cameras_vec[icam * num_camera_params + q];
@@ -1892,6 +2489,9 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
 
     for (int icam = 0; icam < num_cameras; icam++){
 
+      if (solve_for_block && opt.block_cameras.find(icam) == opt.block_cameras.end())
+        continue;
+
       typename ModelT::camera_vector_t orig_cam;
       for (int q = 0; q < num_camera_params; q++)
         orig_cam[q] = orig_cameras_vec[icam * num_camera_params + q];
@@ -2116,16 +2716,20 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   std::string residual_prefix = opt.out_prefix + "-initial_residuals_loss_function";
   std::string point_kml_path  = opt.out_prefix + "-initial_points.kml";
     
-  if (first_pass) { 
+  // The residual logs walk over all the points, so they can't be
+  // written for a problem restricted to a block of cameras.
+  if (first_pass && !opt.skip_residual_logs) { 
     vw_out() << "Writing initial condition files..." << std::endl;
 
-    write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
-                        num_point_params, cam_residual_counts, num_gcp_residuals,
-                        reference_vec, crn, points, num_points, outlier_xyz, problem);
-    residual_prefix = opt.out_prefix + "-initial_residuals_no_loss_function";
-    write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
-                        num_point_params, cam_residual_counts, num_gcp_residuals,
-                        reference_vec, crn, points, num_points, outlier_xyz, problem);
+    if (!solve_for_block) {
+      write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
+                          num_point_params, cam_residual_counts, num_gcp_residuals,
+                          reference_vec, crn, points, num_points, outlier_xyz, problem);
+      residual_prefix = opt.out_prefix + "-initial_residuals_no_loss_function";
+      write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
+                          num_point_params, cam_residual_counts, num_gcp_residuals,
+                          reference_vec, crn, points, num_points, outlier_xyz, problem);
+    }
 
 
       
@@ -2149,17 +2753,21 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   else
     options.num_threads = opt.num_threads;
 
-  // Set solver options according to the recommendations in the Ceres solving FAQs
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-  if (num_cameras < 100)
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-  if (num_cameras > 3500) {
-    options.use_explicit_schur_complement = true; // This is supposed to help with speed in a certain size range
-    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
-    options.preconditioner_type = ceres::SCHUR_JACOBI;
+  set_linear_solver(opt.solver_type, opt.preconditioner_type, num_cameras, options);
+  if (opt.explicit_schur_ordering)
+    set_schur_ordering(problem, points, num_points, num_point_params, options);
+
+  if (opt.benchmark_solvers && first_pass) {
+    std::vector<double*> param_arrays;
+    std::vector<int>     param_sizes;
+    param_arrays.push_back(cameras); param_sizes.push_back(num_cameras*num_camera_params);
+    param_arrays.push_back(points);  param_sizes.push_back(num_points*num_point_params);
+    if (num_intrinsic_params > 0) {
+      param_arrays.push_back(scaled_intrinsics_ptr);
+      param_sizes.push_back(num_intrinsic_params);
+    }
+    benchmark_linear_solvers(options, problem, param_arrays, param_sizes);
   }
-  if (num_cameras > 7000)
-    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
 
   //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
@@ -2169,9 +2777,29 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   //  options->minimizer_type = ceres::LINE_SEARCH;
   //}
 
+  boost::shared_ptr<CheckpointCallback> checkpoint_callback;
+  if (opt.checkpoint_interval > 0) {
+    checkpoint_callback.reset
+      (new CheckpointCallback(opt.out_prefix + "-checkpoint.txt", opt.checkpoint_interval, pass,
+                              cameras, num_cameras*num_camera_params,
+                              intrinsics, scaled_intrinsics_ptr, num_intrinsic_params,
+                              points, num_points*num_point_params, outlier_xyz,
+                              opt.save_in_background));
+    options.callbacks.push_back(checkpoint_callback.get());
+    options.update_state_every_iteration = true;
+  }
+
+  boost::shared_ptr<StatusCallback> status_callback;
+  if (asp::progress_status_enabled()) {
+    status_callback.reset(new StatusCallback(pass, opt.num_ba_passes, opt.max_iterations));
+    options.callbacks.push_back(status_callback.get());
+  }
+
   vw_out() << "Starting the Ceres optimizer..." << std::endl;
   ceres::Solver::Summary summary;
   ceres::Solve(options, &problem, &summary);
+  if (checkpoint_callback)
+    checkpoint_callback->finish(); // before the checkpoint at the end of the pass
   vw_out() << summary.FullReport() << "\n";
   if (summary.termination_type == ceres::NO_CONVERGENCE){
     // Print a clarifying message, so the user does not think that the algorithm failed.
@@ -2189,22 +2817,26 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     vw_out() << std::endl;
   }
   
-  vw_out() << "Writing final condition log files..." << std::endl;
-  residual_prefix = opt.out_prefix + "-final_residuals_loss_function";
-  write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
-                      num_point_params, cam_residual_counts,
-                      num_gcp_residuals, reference_vec, crn,
-                      points, num_points, outlier_xyz, problem);
-  residual_prefix = opt.out_prefix + "-final_residuals_no_loss_function";
-  write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
-                      num_point_params, cam_residual_counts,
-                      num_gcp_residuals, reference_vec, crn,
-                      points, num_points, outlier_xyz, problem);
+  if (!solve_for_block && !opt.skip_residual_logs) {
+    vw_out() << "Writing final condition log files..." << std::endl;
+    residual_prefix = opt.out_prefix + "-final_residuals_loss_function";
+    write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
+                        num_point_params, cam_residual_counts,
+                        num_gcp_residuals, reference_vec, crn,
+                        points, num_points, outlier_xyz, problem);
+    residual_prefix = opt.out_prefix + "-final_residuals_no_loss_function";
+    write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
+                        num_point_params, cam_residual_counts,
+                        num_gcp_residuals, reference_vec, crn,
+                        points, num_points, outlier_xyz, problem);
+  }
 
-  point_kml_path = opt.out_prefix + "-final_points.kml";
-  record_points_to_kml(point_kml_path, opt.datum, points, num_points, outlier_xyz,
-		       kmlPointSkip, "final_points",
-                       "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
+  if (!opt.skip_residual_logs) {
+    point_kml_path = opt.out_prefix + "-final_points.kml";
+    record_points_to_kml(point_kml_path, opt.datum, points, num_points, outlier_xyz,
+                         kmlPointSkip, "final_points",
+                         "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
+  }
 
   // Print stats for optimized gcp
   if (num_gcp > 0) {
@@ -2248,10 +2880,10 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     std::vector<int> left_pt, right_pt; // these are used for bookkeeping
 
     for ( int icam = 0; icam < num_cameras; icam++ ) {
-      for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+      for (size_t iobs = crn.begin(icam); iobs < crn.end(icam); iobs++){
         
         // The index of the 3D point
-        int ipt = (**fiter).m_point_id;
+        int ipt = crn.point_id(iobs);
         if (outlier_xyz.find(ipt) != outlier_xyz.end())
           continue; // skip outliers
         
@@ -2264,7 +2896,7 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
         VW_ASSERT(int(ipt)  < num_points,
                   ArgumentErr() << "Out of bounds in the number of points");
         
-        Vector2 observation = (**fiter).m_location; // pixel value
+        Vector2 observation = crn.location(iobs); // pixel value
         ip::InterestPoint P;
         P.x = observation.x();
         P.y = observation.y();
@@ -2363,18 +2995,37 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
     orig_intrinsics_vec = intrinsics_vec;
   }
   
-  CameraRelationNetwork<JFeature> crn;
-  crn.read_controlnetwork(cnet);
+  asp::CameraObservations crn;
+  crn.read_controlnetwork(cnet, num_cameras);
 
   // We will keep here the outliers
   std::set<int> outlier_xyz;
 
   if (opt.num_ba_passes <= 0)
     vw_throw(ArgumentErr() << "Error: Expecting at least one bundle adjust pass.\n");
+
+  // Continue an interrupted run. If it was stopped in the middle of
+  // a pass, continue that pass starting with the saved parameters.
+  int start_pass = 0;
+  bool resume_mid_pass = false;
+  if (opt.resume_from != "") {
+    read_checkpoint(opt.resume_from, start_pass, resume_mid_pass,
+                    cameras_vec, intrinsics_vec, points_vec, outlier_xyz);
+    if (start_pass < 0 || start_pass >= opt.num_ba_passes)
+      vw_throw( ArgumentErr() << "The checkpoint is for pass " << start_pass
+                << ", but the number of passes is " << opt.num_ba_passes << ".\n" );
+    vw_out() << "Resuming with pass " << start_pass << ".\n";
+  }
+  std::string checkpoint_file = opt.out_prefix + "-checkpoint.txt";
+
+  // Solve only for the part of the problem affected by the new cameras
+  if (opt.incremental)
+    opt.block_cameras = incremental_free_cameras(opt, crn, num_points);
   
-  for (int pass = 0; pass < opt.num_ba_passes; pass++) {
+  for (int pass = start_pass; pass < opt.num_ba_passes; pass++) {
 
-    if (opt.num_ba_passes > 1) {
+    bool resumed = (pass == start_pass && resume_mid_pass);
+    if (opt.num_ba_passes > 1 && !resumed) {
       vw_out() << "Bundle adjust pass: " << pass << std::endl;
       // Go back to the original inputs to optimize, sans the outliers. Note that we
       // copy values, to not disturb the pointer of each vector.
@@ -2390,7 +3041,32 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
     if (num_intrinsic_params > 0) intrinsics = &intrinsics_vec[0];
     
     bool last_pass = (pass == opt.num_ba_passes - 1);
-    int num_new_outliers = do_ba_ceres_one_pass(ba_model, opt,  cnet,  crn, (pass==0), last_pass,
+
+    if (opt.num_camera_blocks > 1) {
+      // Solve for one block of cameras at a time, with the cameras
+      // in the other blocks which see the same points held fixed,
+      // and sweep over the blocks several times. Only one pass is
+      // allowed in this mode, so there is no outlier removal.
+      std::vector< std::set<int> > blocks = partition_cameras(opt, opt.num_camera_blocks);
+      for (int sweep = 0; sweep < opt.num_block_sweeps; sweep++) {
+        for (size_t b = 0; b < blocks.size(); b++) {
+          vw_out() << "Block sweep " << sweep << ", solving for block " << b
+                   << " with " << blocks[b].size() << " cameras.\n";
+          opt.block_cameras = blocks[b];
+          bool first_block = (sweep == 0 && b == 0);
+          do_ba_ceres_one_pass(ba_model, opt,  cnet,  crn, pass, first_block, last_pass,
+                               num_camera_params,  num_point_params,  
+                               num_intrinsic_params, num_cameras, num_points,  
+                               orig_cameras_vec,  cameras,  intrinsics,  points,  
+                               outlier_xyz);
+        }
+      }
+      opt.block_cameras.clear();
+      break;
+    }
+
+    bool first_pass = (pass == 0 && !resumed);
+    int num_new_outliers = do_ba_ceres_one_pass(ba_model, opt,  cnet,  crn, pass, first_pass, last_pass,
                                                 num_camera_params,  num_point_params,  
                                                 num_intrinsic_params, num_cameras, num_points,  
                                                 orig_cameras_vec,  cameras,  intrinsics,  points,  
@@ -2401,6 +3077,15 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
       break;
     }
 
+    // The next pass starts from the original inputs, so only the outliers matter
+    if (!last_pass && opt.checkpoint_interval > 0) {
+      vw_out() << "Writing checkpoint: " << checkpoint_file << std::endl;
+      write_checkpoint(checkpoint_file, pass + 1, false,
+                       &cameras_vec[0], cameras_vec.size(),
+                       intrinsics_vec.empty() ? NULL : &intrinsics_vec[0], intrinsics_vec.size(),
+                       &points_vec[0], points_vec.size(), outlier_xyz);
+    }
+
     int num_points_remaining = num_points - outlier_xyz.size();
     if (opt.num_ba_passes > 1 && num_points_remaining < opt.min_matches) {
       // Do not throw if there were is just one pass, as no outlier filtering happened.
@@ -2409,6 +3094,9 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
     }
   }
 
+  if (opt.incremental)
+    opt.block_cameras.clear();
+
   // Copy the latest version of the optimized intrinsic variables back
   // into the the separate parameter vectors in ba_model, right after
   // the already updated extrinsic parameters.
@@ -2678,6 +3366,59 @@ void check_gcp_dists(Options const &opt) {
 }
 
 
+/// Fill in the overlap list with the pairs of images whose camera
+/// footprints on the datum intersect. Images whose footprint could
+/// not be found are not matched to any other image.
+void select_pairs_by_footprint(Options & opt) {
+
+  vw::cartography::GeoReference geo;
+  geo.set_datum(opt.datum); // We checked for a datum earlier
+
+  const int num_images = opt.image_files.size();
+  std::vector<BBox2> footprints(num_images);
+  vw_out() << "Computing the camera footprints.\n";
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  for (int i = 0; i < num_images; i++) {
+    tpc.report_progress(double(i)/num_images);
+    try {
+      float mean_gsd = 0;
+      Vector2i image_size = vw::file_image_size(opt.image_files[i]);
+      footprints[i] = vw::cartography::camera_bbox(geo, opt.camera_models[i],
+                                                   image_size[0], image_size[1],
+                                                   mean_gsd);
+    } catch (const std::exception& e) {
+      footprints[i] = BBox2();
+    }
+    if (footprints[i].empty())
+      vw_out(WarningMessage) << "Could not find the footprint of: "
+                             << opt.image_files[i] << ".\n";
+  }
+  tpc.report_finished();
+
+  // Comparing the boxes of all pairs is cheap compared to matching
+  // even one pair. Account for the footprints being in different
+  // 360 degree longitude ranges.
+  opt.overlap_list.clear();
+  int num_pairs = 0;
+  for (int i = 0; i < num_images; i++) {
+    if (footprints[i].empty())
+      continue;
+    for (int j = i + 1; j < num_images; j++) {
+      if (footprints[j].empty())
+        continue;
+      bool intersect = false;
+      for (int k = -1; k <= 1 && !intersect; k++)
+        intersect = footprints[i].intersects(footprints[j] + Vector2(360.0*k, 0));
+      if (!intersect)
+        continue;
+      opt.overlap_list.insert(std::make_pair(opt.image_files[i], opt.image_files[j]));
+      opt.overlap_list.insert(std::make_pair(opt.image_files[j], opt.image_files[i]));
+      num_pairs++;
+    }
+  }
+  vw_out() << "Found " << num_pairs << " image pairs with intersecting footprints.\n";
+}
+
 /// Looks in the input camera position file to generate a GCC position for
 /// each input camera.
 /// - If no match is found, the coordinate is (0,0,0)
@@ -2959,11 +3700,96 @@ bool init_pinhole_model_with_gcp(Options &opt, bool check_only=false) {
   return true;
 } // End function init_pinhole_model_with_gcp
 
+/// Take pixels in a map-projected image back to the camera it was
+/// made with, through the DEM it was made on, for a range of the
+/// pixels. A pixel comes back invalid if it is off the DEM, the DEM
+/// has no data there, or the camera does not see it. The
+/// georeferences are copied for each task, as their projections cannot
+/// be shared between threads. The DEM is in memory or mapped, so it is
+/// shared.
+class MapprojectedToCameraTask : public vw::Task, private boost::noncopyable {
+  CameraModel                             * m_camera;
+  vw::cartography::GeoReference             m_map_georef, m_dem_georef;
+  ImageViewRef< PixelMask<double> > const & m_interp_dem;
+  std::vector<Vector2>              const & m_map_pix;
+  size_t                                    m_beg, m_end;
+  std::vector< PixelMask<Vector2> >       & m_cam_pix;
+public:
+  MapprojectedToCameraTask(CameraModel * camera,
+                           vw::cartography::GeoReference const& map_georef,
+                           vw::cartography::GeoReference const& dem_georef,
+                           ImageViewRef< PixelMask<double> > const& interp_dem,
+                           std::vector<Vector2> const& map_pix, size_t beg, size_t end,
+                           std::vector< PixelMask<Vector2> > & cam_pix):
+    m_camera(camera), m_map_georef(map_georef), m_dem_georef(dem_georef),
+    m_interp_dem(interp_dem), m_map_pix(map_pix), m_beg(beg), m_end(end),
+    m_cam_pix(cam_pix){}
+
+  void operator()() {
+    for (size_t k = m_beg; k < m_end; k++) {
+      m_cam_pix[k] = PixelMask<Vector2>();
+      m_cam_pix[k].invalidate();
+      Vector2 ll = m_map_georef.pixel_to_lonlat(m_map_pix[k]);
+      Vector2 dem_pix = m_dem_georef.lonlat_to_pixel(ll);
+      if (dem_pix[0] < 0 || dem_pix[0] >= m_interp_dem.cols() - 1) continue;
+      if (dem_pix[1] < 0 || dem_pix[1] >= m_interp_dem.rows() - 1) continue;
+      PixelMask<double> dem_val = m_interp_dem(dem_pix[0], dem_pix[1]);
+      if (!is_valid(dem_val)) continue;
+      Vector3 llh(ll[0], ll[1], dem_val.child());
+      Vector3 xyz = m_dem_georef.datum().geodetic_to_cartesian(llh);
+      try { m_cam_pix[k] = PixelMask<Vector2>(m_camera->point_to_pixel(xyz)); }
+      catch(...){ continue; }
+    }
+  }
+};
+
+/// Add to the queue the tasks taking the pixels in a map-projected
+/// image back to its camera, a block of pixels per task.
+void queue_mapprojected_to_camera(CameraModel * camera,
+                                  vw::cartography::GeoReference const& map_georef,
+                                  vw::cartography::GeoReference const& dem_georef,
+                                  ImageViewRef< PixelMask<double> > const& interp_dem,
+                                  std::vector<Vector2> const& map_pix,
+                                  std::vector< PixelMask<Vector2> > & cam_pix,
+                                  FifoWorkQueue & queue){
+  const size_t block_size = 1000;
+  cam_pix.resize(map_pix.size());
+  for (size_t beg = 0; beg < map_pix.size(); beg += block_size) {
+    size_t end = std::min(beg + block_size, map_pix.size());
+    boost::shared_ptr<MapprojectedToCameraTask>
+      task(new MapprojectedToCameraTask(camera, map_georef, dem_georef, interp_dem,
+                                        map_pix, beg, end, cam_pix));
+    queue.add_task(task);
+  }
+}
+
+/// The threads to take map-projected pixels back to the cameras with.
+/// ISIS cameras cannot be used from more than one thread.
+int mapprojected_num_threads(Options const& opt){
+  if (opt.stereo_session_string == "isis")
+    return 1;
+  if (opt.num_threads > 0)
+    return opt.num_threads;
+  return vw_settings().default_num_threads();
+}
+
+/// Read the georeference of each map-projected image
+void read_mapprojected_georefs(std::vector<std::string> const& map_files,
+                               std::vector<vw::cartography::GeoReference> & georefs){
+  georefs.resize(map_files.size());
+  for (size_t i = 0; i < map_files.size(); i++) {
+    vw_out() << "Reading georef from " << map_files[i] << std::endl;
+    if (!vw::cartography::read_georeference(georefs[i], map_files[i]))
+      vw_throw(ArgumentErr() << "Error: Cannot read georeference.\n");
+  }
+}
+
 // If the user map-projected the images and created matches by hand
 // (this is useful when the illumination conditions are too different,
 // and automated matching fails), project those matching ip back
 // into the cameras, creating matches between the raw images
-// that then bundle_adjust can use. 
+// that then bundle_adjust can use. The pairs are done a batch at a
+// time, with the points of all pairs of a batch done in parallel.
 void create_matches_from_mapprojected_images(Options const& opt){
   
   std::istringstream is(opt.mapprojected_data);
@@ -2977,63 +3803,67 @@ void create_matches_from_mapprojected_images(Options const& opt){
 
   vw::cartography::GeoReference dem_georef;
   ImageViewRef< PixelMask<double> > interp_dem;
-  create_interp_dem(dem_file, dem_georef, interp_dem);
-  
+  create_interp_dem(dem_file, opt, dem_georef, interp_dem);
+
+  // Each georef is read once, rather than once per pair
+  std::vector<vw::cartography::GeoReference> georefs;
+  read_mapprojected_georefs(map_files, georefs);
+
+  std::vector< std::pair<size_t, size_t> > pairs;
   for (size_t i = 0; i < map_files.size(); i++) {
     for (size_t j = i+1; j < map_files.size(); j++) {
-      
-      vw::cartography::GeoReference georef1, georef2;
-      vw_out() << "Reading georef from " << map_files[i] << ' ' << map_files[j] << std::endl;
-      bool is_good1 = vw::cartography::read_georeference(georef1, map_files[i]);
-      bool is_good2 = vw::cartography::read_georeference(georef2, map_files[j]);
-      if (!is_good1 || !is_good2) {
-        vw_throw(ArgumentErr() << "Error: Cannot read georeference.\n");
-      }
-      
       std::string match_filename = ip::match_filename(opt.out_prefix,
 						      map_files[i], map_files[j]);
       if (!fs::exists(match_filename)) {
         vw_out() << "Missing: " << match_filename << "\n";
         continue;
       }
+      pairs.push_back(std::make_pair(i, j));
+    }
+  }
+
+  int num_threads = mapprojected_num_threads(opt);
+  size_t pairs_per_batch = 2*num_threads;
+  for (size_t batch_beg = 0; batch_beg < pairs.size(); batch_beg += pairs_per_batch) {
+    size_t num_batch_pairs = std::min(pairs_per_batch, pairs.size() - batch_beg);
+
+    // Read the matches of the pairs in the batch and undo the
+    // map-projection of all of them at once
+    std::vector< std::vector<ip::InterestPoint> > ip1(num_batch_pairs), ip2(num_batch_pairs);
+    std::vector< std::vector<Vector2> > map_pix1(num_batch_pairs), map_pix2(num_batch_pairs);
+    std::vector< std::vector< PixelMask<Vector2> > >
+      cam_pix1(num_batch_pairs), cam_pix2(num_batch_pairs);
+    FifoWorkQueue queue(num_threads);
+    for (size_t k = 0; k < num_batch_pairs; k++) {
+      size_t i = pairs[batch_beg + k].first, j = pairs[batch_beg + k].second;
+      std::string match_filename = ip::match_filename(opt.out_prefix,
+						      map_files[i], map_files[j]);
       vw_out() << "Reading: " << match_filename << std::endl;
-      std::vector<ip::InterestPoint> ip1, ip2;
+      asp::read_match_file( match_filename, ip1[k], ip2[k] );
+      for (size_t ip_iter = 0; ip_iter < ip1[k].size(); ip_iter++) {
+        map_pix1[k].push_back(Vector2(ip1[k][ip_iter].x, ip1[k][ip_iter].y));
+        map_pix2[k].push_back(Vector2(ip2[k][ip_iter].x, ip2[k][ip_iter].y));
+      }
+      queue_mapprojected_to_camera(opt.camera_models[i].get(), georefs[i], dem_georef,
+                                   interp_dem, map_pix1[k], cam_pix1[k], queue);
+      queue_mapprojected_to_camera(opt.camera_models[j].get(), georefs[j], dem_georef,
+                                   interp_dem, map_pix2[k], cam_pix2[k], queue);
+    }
+    queue.join_all();
+
+    for (size_t k = 0; k < num_batch_pairs; k++) {
+      size_t i = pairs[batch_beg + k].first, j = pairs[batch_beg + k].second;
+
+      // Keep the matches whose both ends made it back to the cameras
       std::vector<ip::InterestPoint> ip1_cam, ip2_cam;
-      ip::read_binary_match_file( match_filename, ip1, ip2 );
-      
-      // Undo the map-projection
-      for (size_t ip_iter = 0; ip_iter < ip1.size(); ip_iter++) {
-            
-        vw::ip::InterestPoint P1 = ip1[ip_iter];
-        Vector2 pix1(P1.x, P1.y);
-        Vector2 ll1 = georef1.pixel_to_lonlat(pix1);
-        Vector2 dem_pix1 = dem_georef.lonlat_to_pixel(ll1);
-        if (dem_pix1[0] < 0 || dem_pix1[0] >= interp_dem.cols() - 1) continue;
-        if (dem_pix1[1] < 0 || dem_pix1[1] >= interp_dem.rows() - 1) continue;
-        PixelMask<double> dem_val1 = interp_dem(dem_pix1[0], dem_pix1[1]);
-        if (!is_valid(dem_val1)) continue;
-        Vector3 llh1(ll1[0], ll1[1], dem_val1.child());
-        Vector3 xyz1 = dem_georef.datum().geodetic_to_cartesian(llh1);
-        Vector2 cam_pix1;
-        try { cam_pix1 = opt.camera_models[i]->point_to_pixel(xyz1); }
-        catch(...){ continue; }
-        P1.x = cam_pix1.x(); P1.y = cam_pix1.y(); P1.ix = P1.x; P1.iy = P1.y;
-        
-        vw::ip::InterestPoint P2 = ip2[ip_iter];
-        Vector2 pix2(P2.x, P2.y);
-        Vector2 ll2 = georef2.pixel_to_lonlat(pix2);
-        Vector2 dem_pix2 = dem_georef.lonlat_to_pixel(ll2);
-        if (dem_pix2[0] < 0 || dem_pix2[0] >= interp_dem.cols() - 1) continue;
-        if (dem_pix2[1] < 0 || dem_pix2[1] >= interp_dem.rows() - 1) continue;
-        PixelMask<double> dem_val2 = interp_dem(dem_pix2[0], dem_pix2[1]);
-        if (!is_valid(dem_val2)) continue;
-        Vector3 llh2(ll2[0], ll2[1], dem_val2.child());
-        Vector3 xyz2 = dem_georef.datum().geodetic_to_cartesian(llh2);
-        Vector2 cam_pix2;
-        try { cam_pix2 = opt.camera_models[j]->point_to_pixel(xyz2); }
-        catch(...){ continue; }
-        P2.x = cam_pix2.x(); P2.y = cam_pix2.y(); P2.ix = P2.x; P2.iy = P2.y;
-        
+      for (size_t ip_iter = 0; ip_iter < ip1[k].size(); ip_iter++) {
+        if (!is_valid(cam_pix1[k][ip_iter]) || !is_valid(cam_pix2[k][ip_iter]))
+          continue;
+        vw::ip::InterestPoint P1 = ip1[k][ip_iter], P2 = ip2[k][ip_iter];
+        Vector2 cam_pix = cam_pix1[k][ip_iter].child();
+        P1.x = cam_pix.x(); P1.y = cam_pix.y(); P1.ix = P1.x; P1.iy = P1.y;
+        cam_pix = cam_pix2[k][ip_iter].child();
+        P2.x = cam_pix.x(); P2.y = cam_pix.y(); P2.ix = P2.x; P2.iy = P2.y;
         ip1_cam.push_back(P1);
         ip2_cam.push_back(P2);
       }
@@ -3042,11 +3872,10 @@ void create_matches_from_mapprojected_images(Options const& opt){
       vw_out() << "Saving " << ip1_cam.size() << " matches.\n";
       std::string image1_path  = opt.image_files[i];
       std::string image2_path  = opt.image_files[j];
-      match_filename = ip::match_filename(opt.out_prefix, image1_path, image2_path);
+      std::string match_filename = ip::match_filename(opt.out_prefix, image1_path, image2_path);
       
       vw_out() << "Writing: " << match_filename << std::endl;
       ip::write_binary_match_file(match_filename, ip1_cam, ip2_cam);
-      
     }
   }
 }
@@ -3055,6 +3884,7 @@ void create_matches_from_mapprojected_images(Options const& opt){
 // from each map-projected image to the DEM it was map-projected onto,
 // project those matches back into the camera image, and crate gcp
 // tying each camera image match to its desired location on the DEM.
+// The matches of all images are taken back to the cameras in parallel.
 void create_gcp_from_mapprojected_images(Options const& opt){
 
   // Read the map-projected images and the dem
@@ -3069,7 +3899,7 @@ void create_gcp_from_mapprojected_images(Options const& opt){
 
   vw::cartography::GeoReference dem_georef;
   ImageViewRef< PixelMask<double> > interp_dem;
-  create_interp_dem(dem_file, dem_georef, interp_dem);
+  create_interp_dem(dem_file, opt, dem_georef, interp_dem);
   
   int num_images = image_files.size();
   std::vector<std::vector<vw::ip::InterestPoint> > matches;
@@ -3077,15 +3907,8 @@ void create_gcp_from_mapprojected_images(Options const& opt){
   matches.resize(num_images + 1); // the last match will be for the DEM
 
   // Read the matches and georefs
+  read_mapprojected_georefs(image_files, img_georefs);
   for (int i = 0; i < num_images; i++) {
-      
-    vw::cartography::GeoReference img_georef;
-    vw_out() << "Reading georef from " << image_files[i]  << std::endl;
-    bool is_good_img = vw::cartography::read_georeference(img_georef, image_files[i]);
-    if (!is_good_img) {
-      vw_throw(ArgumentErr() << "Error: Cannot read georeference.\n");
-    }
-    img_georefs.push_back(img_georef);
     
     std::string match_filename = ip::match_filename(opt.out_prefix,
                                                     image_files[i], dem_file);
@@ -3094,7 +3917,7 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     
     vw_out() << "Reading: " << match_filename << std::endl;
     std::vector<ip::InterestPoint> ip1, ip2;
-    ip::read_binary_match_file( match_filename, ip1, ip2 );
+    asp::read_match_file( match_filename, ip1, ip2 );
     
     if (matches[num_images].size() > 0 && matches[num_images].size() != ip2.size()) {
       vw_throw(ArgumentErr() << "All match files must have the same number of IP.\n");
@@ -3103,6 +3926,21 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     matches[num_images] = ip2;
   }
 
+  // Take the ip in each map-projected image back into its camera
+  std::vector< std::vector<Vector2> > map_pix(num_images);
+  std::vector< std::vector< PixelMask<Vector2> > > cam_pix(num_images);
+  {
+    int num_threads = mapprojected_num_threads(opt);
+    FifoWorkQueue queue(num_threads);
+    for (int i = 0; i < num_images; i++) {
+      for (size_t p = 0; p < matches[i].size(); p++)
+        map_pix[i].push_back(Vector2(matches[i][p].x, matches[i][p].y));
+      queue_mapprojected_to_camera(opt.camera_models[i].get(), img_georefs[i], dem_georef,
+                                   interp_dem, map_pix[i], cam_pix[i], queue);
+    }
+    queue.join_all();
+  }
+
   std::vector<std::vector<vw::ip::InterestPoint> > cam_matches = matches;
 
   std::string gcp_file;
@@ -3148,23 +3986,10 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     // Write the per-image information
     for (int i = 0; i < num_images; i++) {
 
-      // Take the ip in the map-projected image, and back-project it into
-      // the camera
+      // The ip in the map-projected image, back-projected into the camera
+      if (!is_valid(cam_pix[i][p])) continue;
       ip::InterestPoint ip = matches[i][p];
-      Vector2 ip_pix(ip.x, ip.y);
-      Vector2 ll = img_georefs[i].pixel_to_lonlat(ip_pix);
-      
-      Vector2 dem_pix = dem_georef.lonlat_to_pixel(ll);
-      if (dem_pix[0] < 0 || dem_pix[0] >= interp_dem.cols() - 1) continue;
-      if (dem_pix[1] < 0 || dem_pix[1] >= interp_dem.rows() - 1) continue;
-      PixelMask<double> dem_val = interp_dem(dem_pix[0], dem_pix[1]);
-      if (!is_valid(dem_val)) continue;
-      Vector3 llh(ll[0], ll[1], dem_val.child());
-      Vector3 xyz = dem_georef.datum().geodetic_to_cartesian(llh);
-      Vector2 cam_pix;
-      try { cam_pix = opt.camera_models[i]->point_to_pixel(xyz); }
-      catch(...){ continue; }
-      ip.x = cam_pix.x(); ip.y = cam_pix.y();
+      ip.x = cam_pix[i][p].child().x(); ip.y = cam_pix[i][p].child().y();
 
       // TODO: Here we can have a book-keeping problem!
       cam_matches[i][p] = ip;
@@ -3258,6 +4083,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "A higher factor will result in more interest points, but perhaps also more outliers.")
     ("ip-uniqueness-threshold",          po::value(&opt.ip_uniqueness_thresh)->default_value(0.7),
      "A higher threshold will result in more interest points, but perhaps less unique ones.")
+    ("ip-nn-method",     po::value(&opt.ip_nn_method)->default_value("flann"),
+     "How to find the closest descriptors when matching interest points: flann (approximate, faster) or brute-force (exact).")
     ("ip-side-filter-percent",        po::value(&opt.ip_edge_buffer_percent)->default_value(-1),
      "Remove matched IPs this percentage from the image left/right sides.")
     ("normalize-ip-tiles", po::bool_switch(&opt.ip_normalize_tiles)->default_value(false)->implicit_value(true),
@@ -3279,14 +4106,32 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Skip the step of performing datum-based rough homography if it fails.")
     ("individually-normalize",   po::bool_switch(&opt.individually_normalize)->default_value(false)->implicit_value(true),
                         "Individually normalize the input images instead of using common values.")
+    ("ip-feature-cache",   po::bool_switch(&opt.ip_feature_cache)->default_value(false)->implicit_value(true),
+     "Save the interest points and descriptors detected in each image to <output prefix>-<image>-<settings>.vwip, and reuse them for all pairs that image is in, rather than detecting them again.")
+    ("skip-residual-logs", po::bool_switch(&opt.skip_residual_logs)->default_value(false)->implicit_value(true),
+     "Do not write the files with the initial and final residuals and the KML files with the triangulated points. This saves time for large problems.")
     ("max-iterations",   po::value(&opt.max_iterations)->default_value(1000),
                          "Set the maximum number of iterations.")
+    ("solver-type",   po::value(&opt.solver_type)->default_value("auto"),
+     "The Ceres linear solver. Options: auto, dense_schur, sparse_schur, iterative_schur, sparse_normal_cholesky, cgnr. With auto, it is chosen based on the number of cameras.")
+    ("preconditioner",   po::value(&opt.preconditioner_type)->default_value("auto"),
+     "The preconditioner for the iterative_schur and cgnr solvers. Options: auto, identity, jacobi, schur_jacobi, cluster_jacobi, cluster_tridiagonal.")
+    ("explicit-schur-ordering", po::bool_switch(&opt.explicit_schur_ordering)->default_value(false)->implicit_value(true),
+     "With the Schur solvers, eliminate the triangulated points first and then solve for the cameras, rather than let Ceres find an ordering.")
+    ("benchmark-solvers", po::bool_switch(&opt.benchmark_solvers)->default_value(false)->implicit_value(true),
+     "Before the first pass, solve the problem with several solver and preconditioner combinations and print how long each took. Then solve with the chosen ones.")
     ("parameter-tolerance",   po::value(&opt.parameter_tolerance)->default_value(1e-8),
      "Making this smaller will result in more iterations.")
     ("overlap-limit",    po::value(&opt.overlap_limit)->default_value(0),
                          "Limit the number of subsequent images to search for matches to the current image to this value.  By default match all images.")
     ("overlap-list",    po::value(&opt.overlap_list_file)->default_value(""),
      "A file containing a list of image pairs, one pair per line, separated by a space, which are expected to overlap. Matches are then computed only among the images in each pair.")
+    ("overlap-by-footprint", po::bool_switch(&opt.overlap_by_footprint)->default_value(false)->implicit_value(true),
+     "Match only the image pairs whose camera footprints on the datum intersect. Can be used together with --overlap-limit.")
+    ("num-matching-jobs", po::value(&opt.num_matching_jobs)->default_value(1),
+     "Split the image pairs to match among this many jobs, which can run at the same time, on one or more machines, with the same output prefix. In each job only the pairs for --matching-job-index are matched, with the program stopping after that. Then run bundle_adjust once more without these options to use all the match files.")
+    ("matching-job-index", po::value(&opt.matching_job_index)->default_value(0),
+     "The index of this matching job, from 0 to --num-matching-jobs minus 1.")
     ("position-filter-dist", po::value(&opt.position_filter_dist)->default_value(-1),
                          "Set a distance in meters and don't perform IP matching on images with an estimated camera center farther apart than this distance.  Requires --camera-positions.")
     ("rotation-weight",  po::value(&opt.rotation_weight)->default_value(0.0), "A higher weight will penalize more rotation deviations from the original configuration.")
@@ -3297,6 +4142,20 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "If a feature is seen in n >= 2 images, give it a weight proportional with (n-1)^exponent.")
     ("ip-per-tile",             po::value(&opt.ip_per_tile)->default_value(0),
      "How many interest points to detect in each 1024^2 image tile (default: automatic determination).")
+    ("num-camera-blocks",      po::value(&opt.num_camera_blocks)->default_value(1),
+     "Split the cameras into this many spatial blocks, and optimize one block at a time, with the cameras in other blocks seeing the same points kept fixed. This uses much less memory for large problems. Not available with more than one pass or with a reference terrain.")
+    ("num-block-sweeps",       po::value(&opt.num_block_sweeps)->default_value(3),
+     "How many times to optimize each block, in turn, when --num-camera-blocks is more than 1.")
+    ("incremental", po::bool_switch(&opt.incremental)->default_value(false)->implicit_value(true),
+     "Add new cameras to a problem solved before. The cameras with adjustments in --input-adjustments-prefix start from them, and the others are new. Only the new cameras, and those seeing the same points, are solved for, with the rest kept fixed. Existing match files are reused, and only pairs with a new camera are matched.")
+    ("checkpoint-interval",    po::value(&opt.checkpoint_interval)->default_value(0),
+     "Every this many solver iterations, and after each pass, save the cameras, triangulated points, and outliers to <output prefix>-checkpoint.txt. An interrupted run can then be continued with --resume-from. Set to 0 to not save checkpoints.")
+    ("save-in-background",     po::bool_switch(&opt.save_in_background)->default_value(false)->implicit_value(true),
+     "Write the checkpoints within a pass in a background thread, from a copy of the parameters, while the solver goes on. A checkpoint due while the previous one is still waiting to be written is skipped.")
+    ("status-file",            po::value(&opt.status_file)->default_value(""),
+     "Keep in this JSON file the current pass, the solver iteration as a fraction of --max-iterations, the ETA, and the resource use. It is replaced atomically, so it can be read at any time.")
+    ("resume-from",            po::value(&opt.resume_from)->default_value(""),
+     "Continue a run from the given checkpoint, written with --checkpoint-interval. The inputs and options must be the same as for the run that wrote it.")
     ("num-passes",             po::value(&opt.num_ba_passes)->default_value(1),
      "How many passes of bundle adjustment to do. If more than one, outliers will be removed between passes using --remove-outliers-params, and re-optimization will take place. Match files and residual files with the outliers removed will be written to disk.")
     ("remove-outliers-params",        po::value(&opt.remove_outliers_params_str)->default_value("75.0 3.0 2.0 3.0", "'pct factor err1 err2'"),
@@ -3313,6 +4172,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     
     ("heights-from-dem",  po::value(&opt.heights_from_dem)->default_value(""),
      "If the cameras have already been bunde-adjusted and rigidly transformed to create a DEM aligned to a known high-quality DEM, in the original triangulated xyz points replace the heights with the ones from this high quality DEM and fix those points. This can be used to refine camera positions and intrinsics and works only for pinhole images. Niche and experimental, not for general use.")
+    ("dem-cache-dir",  po::value(&opt.dem_cache_dir)->default_value(""),
+     "Convert the DEM given with --heights-from-dem, --mapprojected-data or --gcp-data, once per machine, into an uncompressed float file in this directory, and map that in memory, so that the processes on a machine share one copy of it, rather than each reading it in memory. Can be shared with stereo, mapproject and pc_align.")
     ("gcp-data",  po::value(&opt.gcp_data)->default_value(""),
      "Given map-projected versions of the input images and the DEM mapprojected onto, create GCP so that during bundle adjustment the original unprojected images are adjusted to mapproject where desired onto the DEM. Niche and experimental, not for general use.")
     ("lambda,l",         po::value(&opt.lambda)->default_value(-1),
@@ -3364,6 +4225,50 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   if (opt.overlap_list_file != "" && opt.overlap_limit > 0)
     vw_throw( ArgumentErr() << "Cannot specify both the overlap limit and the overlap list.\n" << usage << general_options );
+
+  // Validate the solver choices early
+  {
+    ceres::Solver::Options options;
+    set_linear_solver(opt.solver_type, opt.preconditioner_type, 0, options);
+  }
+
+  if ( opt.num_camera_blocks < 1 || opt.num_block_sweeps < 1 )
+    vw_throw( ArgumentErr() << "The number of camera blocks and of block sweeps must be positive.\n"
+              << usage << general_options );
+
+  if ( opt.num_camera_blocks > 1 && (opt.num_ba_passes > 1 || opt.reference_terrain != "") )
+    vw_throw( ArgumentErr() << "Cannot use --num-camera-blocks with more than one pass "
+              << "or with a reference terrain.\n" << usage << general_options );
+
+  if ( opt.incremental &&
+       (opt.input_prefix == "" || opt.num_camera_blocks > 1 || opt.num_ba_passes > 1 ||
+        opt.reference_terrain != "") )
+    vw_throw( ArgumentErr() << "The --incremental option needs --input-adjustments-prefix, "
+              << "and cannot be used with --num-camera-blocks, with more than one pass, "
+              << "or with a reference terrain.\n" << usage << general_options );
+
+  if ( opt.checkpoint_interval < 0 )
+    vw_throw( ArgumentErr() << "The checkpoint interval must be non-negative.\n"
+              << usage << general_options );
+
+  if ( opt.status_file != "" )
+    asp::set_progress_status_file(opt.status_file, "bundle_adjust");
+
+  if ( (opt.checkpoint_interval > 0 || opt.resume_from != "") && opt.num_camera_blocks > 1 )
+    vw_throw( ArgumentErr() << "Cannot use checkpoints with --num-camera-blocks.\n"
+              << usage << general_options );
+
+  if ( opt.resume_from != "" && !fs::exists(opt.resume_from) )
+    vw_throw( ArgumentErr() << "Cannot find the checkpoint: " << opt.resume_from << "\n"
+              << usage << general_options );
+
+  if ( opt.num_matching_jobs < 1 || opt.matching_job_index < 0 ||
+       opt.matching_job_index >= opt.num_matching_jobs )
+    vw_throw( ArgumentErr() << "The matching job index must be non-negative and less than "
+              << "the number of matching jobs.\n" << usage << general_options );
+
+  if (opt.overlap_list_file != "" && opt.overlap_by_footprint)
+    vw_throw( ArgumentErr() << "Cannot specify both the overlap list and --overlap-by-footprint.\n" << usage << general_options );
     
   if ( opt.overlap_limit < 0 )
     vw_throw( ArgumentErr() << "Must allow search for matches between "
@@ -3422,6 +4327,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().epipolar_threshold      = opt.epipolar_threshold;
   asp::stereo_settings().ip_inlier_factor        = opt.ip_inlier_factor;
   asp::stereo_settings().ip_uniqueness_thresh    = opt.ip_uniqueness_thresh;
+  asp::stereo_settings().ip_nn_method            = opt.ip_nn_method;
   asp::stereo_settings().num_scales              = opt.num_scales;
   asp::stereo_settings().nodata_value            = opt.nodata_value;
   asp::stereo_settings().skip_rough_homography   = opt.skip_rough_homography;
@@ -3485,6 +4391,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     if ( !opt.gcp_files.empty() || !opt.camera_position_file.empty() )
       vw_throw( ArgumentErr() << "When ground control points or a camera position file are used, "
                 << "the datum must be specified.\n" << usage << general_options );
+    if ( opt.overlap_by_footprint )
+      vw_throw( ArgumentErr() << "When --overlap-by-footprint is used, "
+                << "the datum must be specified.\n" << usage << general_options );
   }
   
 
@@ -3521,6 +4430,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Unknown bundle adjustment version: " << opt.ba_type
               << ". Options are: [Ceres, RobustSparse, RobustRef, Sparse, Ref]\n" );
 
+  if ( (opt.checkpoint_interval > 0 || opt.resume_from != "") && opt.ba_type != "ceres" )
+    vw_throw( ArgumentErr() << "Checkpoints are supported only with the Ceres solver.\n" );
+
+  if ( opt.incremental && opt.ba_type != "ceres" )
+    vw_throw( ArgumentErr() << "The --incremental option is supported only with the Ceres solver.\n" );
+
   if (opt.initial_transform_file != "") {
     std::ifstream is(opt.initial_transform_file.c_str());
     for (size_t row = 0; row < opt.initial_transform.rows(); row++){
@@ -3637,13 +4552,16 @@ int main(int argc, char* argv[]) {
     // Iterate through each pair of input images
     std::map< std::pair<int, int>, std::string> match_files;
 
+    if (opt.overlap_by_footprint)
+      select_pairs_by_footprint(opt);
+
     // Load estimated camera positions if they were provided.
     std::vector<Vector3> estimated_camera_gcc;
     load_estimated_camera_positions(opt, estimated_camera_gcc);
     const bool got_est_cam_positions =
       (estimated_camera_gcc.size() == static_cast<size_t>(num_images));
     
-    int num_pairs_matched = 0;
+    int num_pairs_matched = 0, pair_count = 0;
     for (int i = 0; i < num_images; i++){
       for (int j = i+1; j <= std::min(num_images-1, i+opt.overlap_limit); j++){
 
@@ -3651,7 +4569,7 @@ int main(int argc, char* argv[]) {
         std::string image2_path  = opt.image_files[j];
         
         // Look only at these pairs, if specified in a list
-        if (!opt.overlap_list.empty()) {
+        if (!opt.overlap_list.empty() || opt.overlap_by_footprint) {
           std::pair<std::string, std::string> pair(image1_path, image2_path);
           if (opt.overlap_list.find(pair) == opt.overlap_list.end()) continue;
         }
@@ -3670,17 +4588,27 @@ int main(int argc, char* argv[]) {
           }
         } // End estimated camera position filtering
       
+        // With several matching jobs, each does every n-th pair.
+        // All jobs see the pairs in the same order.
+        if ((pair_count++) % opt.num_matching_jobs != opt.matching_job_index)
+          continue;
+
         // Load both images into a new StereoSession object and use it to find interest points.
         // - The points are written to a file on disk.
         std::string camera1_path = opt.camera_files[i];
         std::string camera2_path = opt.camera_files[j];        
         std::string match_filename = ip::match_filename(opt.out_prefix, image1_path, image2_path);
-        match_files[ std::pair<int, int>(i, j) ] = match_filename;
         if (fs::exists(match_filename)) {
+          match_files[ std::pair<int, int>(i, j) ] = match_filename;
           vw_out() << "\t--> Using cached match file: " << match_filename << "\n";
           ++num_pairs_matched;
           continue;
         }
+
+        // With --incremental, pairs of cameras adjusted before are not matched again
+        if (opt.incremental && has_prior_adjustment(opt, i) && has_prior_adjustment(opt, j))
+          continue;
+        match_files[ std::pair<int, int>(i, j) ] = match_filename;
         boost::shared_ptr<DiskImageResource>
           rsrc1(vw::DiskImageResourcePtr(image1_path)),
           rsrc2(vw::DiskImageResourcePtr(image2_path));
@@ -3705,19 +4633,33 @@ int main(int argc, char* argv[]) {
           vw::Vector<vw::float32,6> image1_stats = asp::gather_stats(masked_image1, image1_path);
           vw::Vector<vw::float32,6> image2_stats = asp::gather_stats(masked_image2, image2_path);
 
+          std::string ip_cache_prefix1, ip_cache_prefix2;
+          if (opt.ip_feature_cache) {
+            ip_cache_prefix1 = opt.out_prefix + "-" + fs::path(image1_path).stem().string();
+            ip_cache_prefix2 = opt.out_prefix + "-" + fs::path(image2_path).stem().string();
+          }
+
+          // Write to a temporary file and rename it when done, so that
+          // a match file which exists is always complete, even if this
+          // run, or another job writing it, was interrupted.
+          std::string tmp_match_filename = match_filename + "-"
+            + fs::unique_path().string() + ".tmp";
           session->ip_matching(image1_path, image2_path,
                                Vector2(masked_image1.cols(), masked_image1.rows()),
                                image1_stats,
                                image2_stats,
                                opt.ip_per_tile,
-                               nodata1, nodata2, match_filename,
+                               nodata1, nodata2, tmp_match_filename,
                                opt.camera_models[i].get(),
-                               opt.camera_models[j].get());
+                               opt.camera_models[j].get(),
+                               ip_cache_prefix1, ip_cache_prefix2);
+          fs::rename(tmp_match_filename, match_filename);
         
         // TODO: Move this into the IP finding code!
         // Compute the coverage fraction
         std::vector<ip::InterestPoint> ip1, ip2;
-        ip::read_binary_match_file(match_filename, ip1, ip2);       
+        bool with_descriptors = false;
+        asp::read_match_file(match_filename, ip1, ip2, with_descriptors);
         int right_ip_width = rsrc1->cols()*
                               static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
         Vector2i ip_size(right_ip_width, rsrc1->rows());
@@ -3734,6 +4676,12 @@ int main(int argc, char* argv[]) {
       }
     } // End loop through all input image pairs
 
+    if (opt.num_matching_jobs > 1) {
+      vw_out() << "Matched " << num_pairs_matched << " image pairs in job "
+               << opt.matching_job_index << " of " << opt.num_matching_jobs << ".\n";
+      return 0;
+    }
+
     //if (num_pairs_matched == 0) {
     //  vw_throw( ArgumentErr() << "Unable to find an IP based match between any input image pair!\n");
     // }
@@ -3850,5 +4798,7 @@ int main(int argc, char* argv[]) {
 
     xercesc::XMLPlatformUtils::Terminate();
 
+    asp::write_progress_status("Done", 1.0, 0.0, true);
+
   } ASP_STANDARD_CATCHES;
 }
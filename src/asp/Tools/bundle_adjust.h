@@ -77,6 +77,7 @@ private:
   std::vector<point_vector_t      > m_point_vec;
   std::vector<camera_vector_t     > m_cam_target_vec;
   std::vector<point_vector_t      > m_point_target_vec;
+  std::vector<vw::Vector3         > m_rotation_centers;
   int m_num_pixel_observations;
 
 public:
@@ -84,7 +85,7 @@ public:
                         boost::shared_ptr<vw::ba::ControlNetwork> network) :
     m_cameras(cameras), m_network(network), m_cam_vec(cameras.size()),
     m_point_vec(network->size()), m_cam_target_vec(cameras.size()),
-    m_point_target_vec(network->size()) {
+    m_point_target_vec(network->size()), m_rotation_centers(cameras.size()) {
 
     // Compute the number of observations from the bundle.
     m_num_pixel_observations = 0;
@@ -97,6 +98,10 @@ public:
       m_point_vec[i] = (*m_network)[i].position();
       m_point_target_vec[i] = m_point_vec[i];
     }
+
+    // The adjustments rotate about the camera center, as in AdjustedCameraModel
+    for (unsigned j = 0; j < cameras.size(); ++j)
+      m_rotation_centers[j] = m_cameras[j]->camera_center(vw::Vector2());
   }
 
   int num_intrinsic_params() const {return 0;}
@@ -112,6 +117,10 @@ public:
   camera_vector_t cam_target  (int j) const { return m_cam_target_vec[j];   }
   point_vector_t  point_target(int i) const { return m_point_target_vec[i]; }
 
+  /// The camera j before the adjustments, and the point the adjustment rotation is about
+  cam_ptr_t   unadjusted_camera(int j) const { return m_cameras[j];          }
+  vw::Vector3 rotation_center  (int j) const { return m_rotation_centers[j]; }
+
   unsigned num_cameras()            const { return m_cam_vec.size();         }
   unsigned num_points ()            const { return m_point_vec.size();       }
   unsigned num_pixel_observations() const { return m_num_pixel_observations; }
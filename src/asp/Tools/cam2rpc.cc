@@ -58,12 +58,12 @@ struct Options : public vw::cartography::GdalWriteOptions {
   BBox2i image_crop_box;
   Vector2 height_range;
   float output_nodata_value;
-  double gsd;
-  int num_samples;
+  double gsd, max_fit_error;
+  int num_samples, max_sampling_refinements;
   Options(): penalty_weight(-1.0), no_crop(false),
              skip_computing_rpc(false), save_tif(false), has_output_nodata(false),
              output_nodata_value(-std::numeric_limits<float>::max()),
-             gsd(-1.0), num_samples(-1) {}
+             gsd(-1.0), max_fit_error(-1.0), num_samples(-1), max_sampling_refinements(0) {}
 };
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -79,6 +79,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "How many samples to use in each direction in the longitude-latitude-height range.")
     ("penalty-weight",     po::value(&opt.penalty_weight)->default_value(0.03), // check here!
      "A higher penalty weight will result in smaller higher-order RPC coefficients.")
+    ("max-fit-error",     po::value(&opt.max_fit_error)->default_value(-1.0),
+     "If positive, check the RPC model at points halfway between the samples, add to the samples the points where it differs from the camera by more than this many pixels, and fit again.")
+    ("max-sampling-refinements", po::value(&opt.max_sampling_refinements)->default_value(2),
+     "How many times to add samples where the RPC fit error is above --max-fit-error. Each time the points checked are twice as dense.")
     ("save-tif-image", po::bool_switch(&opt.save_tif)->default_value(false),
      "Save a TIF version of the input image that approximately corresponds to the input longitude-latitude-height range and which can be used for stereo together with the RPC model.")
     ("output-nodata-value", po::value(&opt.output_nodata_value)->default_value(-std::numeric_limits<float>::max()),
@@ -162,6 +166,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
              << "on its surface to " << opt.num_samples << "^2.\n";
   }
 
+  if (opt.max_fit_error <= 0)
+    opt.max_sampling_refinements = 0;
+  if (opt.max_sampling_refinements < 0)
+    vw_throw( ArgumentErr() << "The value of --max-sampling-refinements must be non-negative.\n" );
+
   // Convert from width and height to min and max
   if (!opt.image_crop_box.empty()) {
     BBox2 b = opt.image_crop_box; // make a copy
@@ -169,6 +178,80 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   }
 }
 
+// Sample the lon-lat-height box, or the DEM if given, and project
+// the samples into the camera. Keep the ones which fall in the image
+// box. With a shift of 0.5, the samples are halfway between the ones
+// for a shift of 0, which is for checking the fit.
+void gen_point_pairs(Options const& opt, int num_samples, double shift,
+                     cartography::Datum const& datum,
+                     ImageView< PixelMask<double> > const& dem, GeoReference const& dem_geo,
+                     CameraModel const* cam, BBox2 const& image_box, int num_threads,
+                     std::vector<Vector3> & all_llh, std::vector<Vector2> & all_pixels) {
+
+  std::vector<Vector3> llh_vec, xyz_vec;
+  if (opt.dem_file.empty()) {
+    BBox2   const& ll = opt.lon_lat_range; // shortcut
+    Vector2 const& H  = opt.height_range;
+    double delta_lon = (ll.max()[0] - ll.min()[0])/double(num_samples);
+    double delta_lat = (ll.max()[1] - ll.min()[1])/double(num_samples);
+    double delta_ht  = (H[1] - H[0])/double(num_samples);
+    for (double lon = ll.min()[0] + shift*delta_lon; lon <= ll.max()[0]; lon += delta_lon) {
+      for (double lat = ll.min()[1] + shift*delta_lat; lat <= ll.max()[1]; lat += delta_lat) {
+        for (double ht = H[0] + shift*delta_ht; ht <= H[1]; ht += delta_ht) {
+          Vector3 llh(lon, lat, ht);
+          Vector3 xyz = datum.geodetic_to_cartesian(llh);
+          
+          // Go back to llh. This is a bugfix for the 360 deg offset problem.
+          llh = datum.cartesian_to_geodetic(xyz);
+          llh_vec.push_back(llh);
+          xyz_vec.push_back(xyz);
+        }
+      }
+    }
+  }else{
+    // If the DEM is too big, we need to skip points. About
+    // 40,000 points should be good enough to determine 78 RPC
+    // coefficients.
+    double delta_col = std::max(1.0, dem.cols()/double(num_samples));
+    double delta_row = std::max(1.0, dem.rows()/double(num_samples));
+    for (double dcol = shift*delta_col; dcol < dem.cols(); dcol += delta_col) {
+      for (double drow = shift*delta_row; drow < dem.rows(); drow += delta_row) {
+        int col = dcol, row = drow; // cast to int
+        
+        if (!is_valid(dem(col, row))) continue;
+        
+        Vector2 pix(col, row);
+        Vector2 lonlat = dem_geo.pixel_to_lonlat(pix);
+        
+        // Lon lat height
+        Vector3 llh;
+        llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row).child();
+        Vector3 xyz = dem_geo.datum().geodetic_to_cartesian(llh);
+        
+        // Go back to llh. This is a bugfix for the 360 deg offset problem.
+        llh = dem_geo.datum().cartesian_to_geodetic(xyz);
+        llh_vec.push_back(llh);
+        xyz_vec.push_back(xyz);
+      }
+    }
+  }
+
+  // Projecting into the camera is what takes time, so do that in parallel
+  int num_pts = xyz_vec.size();
+  std::vector<Vector2> pixels;
+  std::vector<char>    valid;
+  asp::project_points_to_camera(cam, xyz_vec, num_threads, pixels, valid);
+
+  all_llh.clear();
+  all_pixels.clear();
+  for (int k = 0; k < num_pts; k++) {
+    if (valid[k] && image_box.contains(pixels[k])) {
+      all_llh.push_back(llh_vec[k]);
+      all_pixels.push_back(pixels[k]);
+    }
+  }
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -228,121 +311,130 @@ int main( int argc, char *argv[] ) {
       image_box.crop(opt.image_crop_box);
     
     // TODO: Merge this code with what is in sfs.cc!
-    // Generate point pairs
-    std::vector<Vector3> all_llh;
-    std::vector<Vector2> all_pixels;
-
-    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(opt.num_samples);
-    
+    // The surface on which to sample
+    cartography::Datum datum;
+    ImageView< PixelMask<double> > dem;
+    GeoReference dem_geo;
     if (opt.dem_file.empty()) {
-
-      cartography::Datum datum(opt.datum_str);
+      datum = cartography::Datum(opt.datum_str);
       vw_out() << "Using datum: " << datum << std::endl;
-      
-      BBox2   & ll = opt.lon_lat_range; // shortcut
-      Vector2 & H  = opt.height_range;
-      double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
-      double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
-      double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
-      tpc.report_progress(0);
-      for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
-        for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
-          for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
-
-            Vector3 llh(lon, lat, ht);
-            Vector3 xyz = datum.geodetic_to_cartesian(llh);
-            
-            // Go back to llh. This is a bugfix for the 360 deg offset problem.
-            llh = datum.cartesian_to_geodetic(xyz);
-            
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
-            }
-            
-          }
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
-      
     }else{
       vw_out() << "Sampling the surface of the DEM: " << opt.dem_file  << std::endl;
 
       float dem_nodata_val = -std::numeric_limits<float>::max(); 
       vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageView< PixelMask<double> > dem = create_mask
-        (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
+      dem = create_mask(channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
       
-      GeoReference dem_geo;
       if (!read_georeference(dem_geo, opt.dem_file))
         vw_throw( ArgumentErr() << "Missing georef.\n");
-      
-      
-      // If the DEM is too big, we need to skip points. About
-      // 40,000 points should be good enough to determine 78 RPC
-      // coefficients.
-      double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
-      double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
-      tpc.report_progress(0);
-      for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
-        for (double drow = 0; drow < dem.rows(); drow += delta_row) {
-          int col = dcol, row = drow; // cast to int
-          
-          if (!is_valid(dem(col, row))) continue;
-          
-          Vector2 pix(col, row);
-          Vector2 lonlat = dem_geo.pixel_to_lonlat(pix);
-          
-          // Lon lat height
-          Vector3 llh;
-          llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row).child();
-          Vector3 xyz = dem_geo.datum().geodetic_to_cartesian(llh);
-          
-          // Go back to llh. This is a bugfix for the 360 deg offset problem.
-          llh = dem_geo.datum().cartesian_to_geodetic(xyz);
-          
-          Vector2 cam_pix = cam->point_to_pixel(xyz);
-          if (image_box.contains(cam_pix)) {
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-          }
-          
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
     }
-    tpc.report_finished();
 
-    // The pixel box
-    BBox2 pixel_box;
-    for (size_t i = 0; i < all_pixels.size(); i++) 
-      pixel_box.grow(all_pixels[i]);
+    // An ISIS camera must not be used from more than one thread
+    int num_threads = vw_settings().default_num_threads();
+    if (boost::starts_with(session->name(), "isis"))
+      num_threads = 1;
 
-    // Find the range of lon-lat-heights
+    // Sample the camera and fit the RPC model. If the fit is not
+    // accurate enough at points between the samples, add the points
+    // where it is worst to the samples and fit again. Each time, check
+    // at points twice as dense, so the samples are refined only where
+    // the camera is hard to approximate.
+    std::vector<Vector3> all_llh;
+    std::vector<Vector2> all_pixels;
+    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
+    gen_point_pairs(opt, opt.num_samples, 0.0, datum, dem, dem_geo, cam.get(),
+                    image_box, num_threads, all_llh, all_pixels);
+    
+    BBox2 pixel_box, crop_box;
     BBox3 llh_box;
-    for (size_t i = 0; i < all_llh.size(); i++) 
-      llh_box.grow(all_llh[i]);
-
-    // If cropping, adjust the pixels
-    BBox2 crop_box;
-    if (!opt.no_crop) {
-      // Cast to int so that we can crop properly
-      pixel_box.min() = floor(pixel_box.min());
-      pixel_box.max() = ceil(pixel_box.max());
-      pixel_box.crop(image_box);
-
-      crop_box = pixel_box; // save it before we modify pixel_box
+    Vector3 llh_scale, llh_offset;
+    Vector2 pixel_scale, pixel_offset, pixel_shift;
+    asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    int check_samples = opt.num_samples;
+    for (int pass = 0; pass <= opt.max_sampling_refinements; pass++) {
 
-      // Shift all pixels by the crop corner, including the pixel box itself
+      // The pixel box
+      pixel_box = BBox2();
       for (size_t i = 0; i < all_pixels.size(); i++) 
-        all_pixels[i] -= pixel_box.min();
+        pixel_box.grow(all_pixels[i]);
+
+      // Find the range of lon-lat-heights
+      llh_box = BBox3();
+      for (size_t i = 0; i < all_llh.size(); i++) 
+        llh_box.grow(all_llh[i]);
+
+      // If cropping, the pixels are relative to the crop corner
+      crop_box = BBox2();
+      pixel_shift = Vector2();
+      if (!opt.no_crop) {
+        // Cast to int so that we can crop properly
+        pixel_box.min() = floor(pixel_box.min());
+        pixel_box.max() = ceil(pixel_box.max());
+        pixel_box.crop(image_box);
+
+        crop_box = pixel_box; // save it before we modify pixel_box
+
+        // Need to first save the corner before subtracting it, otherwise get wrong result
+        pixel_shift = pixel_box.min(); 
+        pixel_box -= pixel_shift;
+      }
 
-      // Need to first save the corner before subtracting it, otherwise get wrong result
-      Vector2 shift = pixel_box.min(); 
-      pixel_box -= shift;
+      if (opt.skip_computing_rpc)
+        break;
+    
+      llh_scale  = (llh_box.max() - llh_box.min())/2.0; // half range
+      llh_offset = (llh_box.max() + llh_box.min())/2.0; // center point
+      
+      pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0; // half range 
+      pixel_offset = (pixel_box.max() + pixel_box.min())/2.0; // center point
+      
+      vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
+      vw_out() << "Camera pixel box for the RPC approx:   " << pixel_box << std::endl;
+
+      // Form the arrays of normalized pixels and normalized llh. The
+      // pixels are normalized around the shifted offset.
+      Vector<double> normalized_llh;
+      Vector<double> normalized_pixels;
+      asp::normalize_point_pairs(all_llh, all_pixels, llh_scale, llh_offset,
+                                 pixel_scale, pixel_offset + pixel_shift,
+                                 normalized_llh, normalized_pixels);
+
+      // Find the RPC coefficients
+      std::string output_prefix = "";
+      vw_out() << "Generating the RPC approximation using " << all_llh.size()
+               << " point pairs.\n";
+      asp::gen_rpc(// Inputs
+                   opt.penalty_weight, output_prefix,
+                   normalized_llh, normalized_pixels,  
+                   llh_scale, llh_offset, pixel_scale, pixel_offset,
+                   // Outputs
+                   line_num, line_den, samp_num, samp_den);
+
+      if (opt.max_fit_error <= 0)
+        break;
+
+      // Check the fit halfway between the samples
+      std::vector<Vector3> check_llh;
+      std::vector<Vector2> check_pixels;
+      std::vector<double>  check_errors;
+      gen_point_pairs(opt, check_samples, 0.5, datum, dem, dem_geo, cam.get(),
+                      image_box, num_threads, check_llh, check_pixels);
+      double max_err = asp::rpc_fit_errors(check_llh, check_pixels, llh_scale, llh_offset,
+                                           pixel_scale, pixel_offset + pixel_shift,
+                                           line_num, line_den, samp_num, samp_den,
+                                           check_errors);
+      vw_out() << "Max RPC fit error between the samples: " << max_err << " pixels.\n";
+      if (max_err <= opt.max_fit_error)
+        break;
+      if (pass == opt.max_sampling_refinements) {
+        vw_out(WarningMessage) << "The RPC fit error is larger than --max-fit-error.\n";
+        break;
+      }
+
+      int num_added = asp::add_poorly_fit_points(check_llh, check_pixels, check_errors,
+                                                 opt.max_fit_error, all_llh, all_pixels);
+      vw_out() << "Adding " << num_added << " samples where the fit is worst.\n";
+      check_samples *= 2;
     }
 
     // We need this line for other tools
@@ -372,48 +464,6 @@ int main( int argc, char *argv[] ) {
 
     if (opt.skip_computing_rpc) 
       return 0;
-    
-    Vector3 llh_scale  = (llh_box.max() - llh_box.min())/2.0; // half range
-    Vector3 llh_offset = (llh_box.max() + llh_box.min())/2.0; // center point
-      
-    Vector2 pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0; // half range 
-    Vector2 pixel_offset = (pixel_box.max() + pixel_box.min())/2.0; // center point
-      
-    vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
-    vw_out() << "Camera pixel box for the RPC approx:   " << pixel_box << std::endl;
-
-    Vector<double> normalized_llh;
-    Vector<double> normalized_pixels;
-    int num_total_pts = all_llh.size();
-    normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
-    normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
-			       + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
-    for (size_t i = 0; i < normalized_pixels.size(); i++) {
-      // Important: The extra penalty terms are all set to zero here.
-      normalized_pixels[i] = 0.0; 
-    }
-      
-    // Form the arrays of normalized pixels and normalized llh
-    for (int pt = 0; pt < num_total_pts; pt++) {
-      // Normalize the pixel to -1 <> 1 range
-      Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
-      Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
-      subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
-		asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
-      subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
-		asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
-    }
-
-    // Find the RPC coefficients
-    asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
-    std::string output_prefix = "";
-    vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
-    asp::gen_rpc(// Inputs
-		 opt.penalty_weight, output_prefix,
-		 normalized_llh, normalized_pixels,  
-		 llh_scale, llh_offset, pixel_scale, pixel_offset,
-		 // Outputs
-		 line_num, line_den, samp_num, samp_den);
 
     // TODO: Integrate this with aster2asp existing functionality!
     // Have a generic function for saving WV RPC files. 
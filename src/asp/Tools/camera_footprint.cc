@@ -27,14 +27,20 @@
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/FileIO/KML.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
 
 #include <limits>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 
@@ -48,8 +54,9 @@ using namespace vw::cartography;
 
 
 struct Options : public vw::cartography::GdalWriteOptions {
-  string image_file, camera_file, stereo_session, bundle_adjust_prefix,
-         datum_str, dem_file, target_srs_string, output_kml;
+  string stereo_session, bundle_adjust_prefix,
+         datum_str, dem_file, target_srs_string, output_kml, cache_dir;
+  std::vector<std::string> input_files, image_files, camera_files;
   bool quick;
   //BBox2i image_crop_box;
 };
@@ -72,20 +79,20 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     //("image-crop-box", po::value(&opt.image_crop_box)->default_value(BBox2i(0,0,0,0), "0 0 0 0"),
     // "The output image and RPC model should not exceed this box, specified in input image pixels as minx miny widx widy.")
     ("dem-file",   po::value(&opt.dem_file)->default_value(""),
-     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.");
+     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.")
+    ("cache-dir",  po::value(&opt.cache_dir)->default_value(""),
+     "Save the footprint of each camera in this directory, and reuse it on a later run with the same camera and options.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
   positional.add_options()
-    ("camera-image", po::value(&opt.image_file))
-    ("camera-model", po::value(&opt.camera_file));
+    ("input-files", po::value(&opt.input_files));
 
   po::positional_options_description positional_desc;
-  positional_desc.add("camera-image",1);
-  positional_desc.add("camera-model",1);
+  positional_desc.add("input-files", -1);
 
-  string usage("[options] <camera-image> <camera-model>");
+  string usage("[options] <camera-image> <camera-model> [<more images and cameras>]");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -94,10 +101,20 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 			    allow_unregistered, unregistered);
 
   
-  if ( opt.image_file.empty() )
+  if ( opt.input_files.empty() )
     vw_throw( ArgumentErr() << "Missing input image.\n" << usage << general_options );
 
-  if (boost::iends_with(opt.image_file, ".cub") && opt.stereo_session == "" )
+  bool ensure_equal_sizes = true;
+  asp::separate_images_from_cameras(opt.input_files,
+                                    opt.image_files, opt.camera_files, // outputs
+                                    ensure_equal_sizes);
+
+  // The camera information may be contained within the image files,
+  // such as for ISIS cubes.
+  if (opt.camera_files.empty())
+    opt.camera_files = opt.image_files;
+
+  if (boost::iends_with(opt.image_files[0], ".cub") && opt.stereo_session == "" )
     opt.stereo_session = "isis";
 
   // Need this to be able to load adjusted camera models. That will happen
@@ -109,6 +126,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.dem_file.empty() && opt.datum_str.empty() && opt.target_srs_string.empty())
     vw_throw( ArgumentErr() << "Need to provide a DEM, a datum, or a t_srs string.\n" << usage << general_options );
 
+  if (!opt.cache_dir.empty())
+    vw::create_out_dir(opt.cache_dir + "/");
 
   //// Convert from width and height to min and max
   //if (!opt.image_crop_box.empty()) {
@@ -117,58 +136,181 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   //}
 }
 
-int main( int argc, char *argv[] ) {
+/// The footprint of a camera, with the intersection points as
+/// longitude, latitude, and height.
+struct Footprint {
+  BBox2                bbox;
+  float                mean_gsd;
+  std::vector<Vector3> coords;
+  std::string          error; // Not empty if the footprint could not be found
+  Footprint(): mean_gsd(0) {}
+};
 
-  Options opt;
-  //try {
+/// Combine into the key a hash of the contents of a file. If the file is
+/// an image, such as an ISIS cube, hash only its size and modification time.
+void hash_combine_file(size_t & key, std::string const& file) {
+  boost::hash_combine(key, file);
+  if (!fs::exists(file))
+    return;
+  if (asp::has_image_extension(file)) {
+    boost::hash_combine(key, uint64(fs::file_size(file)));
+    boost::hash_combine(key, uint64(fs::last_write_time(file)));
+    return;
+  }
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  boost::hash_combine(key, bytes);
+}
 
-    handle_arguments(argc, argv, opt);
+/// The cache file for the footprint of this camera, which changes
+/// with the camera, its adjustment, and the options.
+std::string cache_file(Options const& opt, std::string const& image_file,
+                       std::string const& camera_file) {
+  size_t key = 0;
+  hash_combine_file(key, camera_file);
+  if (opt.bundle_adjust_prefix != "")
+    hash_combine_file(key, asp::bundle_adjust_file_name(opt.bundle_adjust_prefix,
+                                                        image_file, camera_file));
+  vw::Vector2i image_size = vw::file_image_size(image_file);
+  boost::hash_combine(key, image_size[0]);
+  boost::hash_combine(key, image_size[1]);
+  if (opt.dem_file != "")
+    hash_combine_file(key, opt.dem_file);
+  boost::hash_combine(key, opt.datum_str);
+  boost::hash_combine(key, opt.target_srs_string);
+  boost::hash_combine(key, opt.stereo_session);
+  boost::hash_combine(key, opt.quick);
+
+  std::ostringstream os;
+  os << opt.cache_dir << "/" << std::hex << std::setw(2*sizeof(size_t)) << std::setfill('0')
+     << key << ".txt";
+  return os.str();
+}
 
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session(asp::StereoSessionFactory::create
-		       (opt.stereo_session, // may change inside
-                        opt,
-                        opt.image_file,  opt.image_file,
-                        opt.camera_file, opt.camera_file,
-                        "",
-                        "",
-                        false) ); // Do not allow promotion from normal to map projected session
-    
-    // If the session was above auto-guessed as isis, adjust for the fact
-    // that the isis .cub file also has camera info.
-    if ((session->name() == "isis" || session->name() == "isismapisis") ){
-      // The user did not provide an output file. Then the camera
-      // information is contained within the image file and what is in
-      // the camera file is actually the output file.
-      opt.camera_file = opt.image_file;
-    }
+bool read_cached_footprint(std::string const& file, Footprint & fp) {
+  std::ifstream ifs(file.c_str());
+  size_t num_coords = 0;
+  if (!(ifs >> fp.bbox.min()[0] >> fp.bbox.min()[1] >> fp.bbox.max()[0] >> fp.bbox.max()[1]
+            >> fp.mean_gsd >> num_coords))
+    return false;
+  fp.coords.resize(num_coords);
+  for (size_t i = 0; i < num_coords; i++) {
+    if (!(ifs >> fp.coords[i][0] >> fp.coords[i][1] >> fp.coords[i][2]))
+      return false;
+  }
+  return true;
+}
 
-    if ( opt.camera_file.empty() )
-      vw_throw( ArgumentErr() << "Missing input camera.\n" );
+void write_cached_footprint(std::string const& file, Footprint const& fp) {
+  // Write to a temporary file first, so that an interrupted run does
+  // not leave a partial cache file.
+  std::string tmp_file = file + ".tmp";
+  {
+    std::ofstream ofs(tmp_file.c_str());
+    ofs << std::setprecision(17);
+    ofs << fp.bbox.min()[0] << " " << fp.bbox.min()[1] << " "
+        << fp.bbox.max()[0] << " " << fp.bbox.max()[1] << "\n"
+        << fp.mean_gsd << "\n" << fp.coords.size() << "\n";
+    for (size_t i = 0; i < fp.coords.size(); i++)
+      ofs << fp.coords[i][0] << " " << fp.coords[i][1] << " " << fp.coords[i][2] << "\n";
+  }
+  boost::system::error_code ec;
+  fs::rename(tmp_file, file, ec);
+}
 
-   
-    boost::shared_ptr<CameraModel> cam = session->camera_model(opt.image_file, opt.camera_file);
 
-    // The input nodata value
-    float input_nodata_value = -std::numeric_limits<float>::max(); 
-    vw::read_nodata_val(opt.image_file, input_nodata_value);
+/// Intersect the camera with the DEM, if provided, or otherwise with the datum.
+void compute_footprint(Options const& opt, std::string const& image_file,
+                       std::string const& camera_file,
+                       ImageViewRef< PixelMask<double> > const& dem,
+                       GeoReference const& dem_georef,
+                       GeoReference const& target_georef,
+                       Footprint & fp) {
+
+  typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+  std::string stereo_session = opt.stereo_session; // may change inside
+  SessionPtr session(asp::StereoSessionFactory::create
+                     (stereo_session,
+                      opt,
+                      image_file,  image_file,
+                      camera_file, camera_file,
+                      "",
+                      "",
+                      false) ); // Do not allow promotion from normal to map projected session
+    
+  boost::shared_ptr<CameraModel> cam = session->camera_model(image_file, camera_file);
 
-    // Just get the image size
-    vw::Vector2i image_size = vw::file_image_size(opt.image_file);
+  // Just get the image size
+  vw::Vector2i image_size = vw::file_image_size(image_file);
 
 //    // The bounding box -> Add this feature in the future!
 //    BBox2 image_box = bounding_box(input_img);
 //    if (!opt.image_crop_box.empty()) 
 //      image_box.crop(opt.image_crop_box);
     
-    // Perform the computation
-    
-    GeoReference target_georef;
-    
-    BBox2 footprint_bbox;
-    float mean_gsd=0;
-    std::vector<Vector3> coords;
-    if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
+  fp.coords.clear();
+  if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
+    std::vector<Vector2> coords2;
+    fp.bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1], fp.mean_gsd,
+                          &coords2);
+    for (size_t i=0; i<coords2.size(); ++i) {
+      Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
+      fp.coords.push_back(target_georef.point_to_geodetic(proj_coord));
+    }
+  } else { // DEM provided, intersect with it.
+    fp.bbox = camera_bbox(dem, dem_georef, target_georef, cam,
+                          image_size[0], image_size[1], fp.mean_gsd, opt.quick, &fp.coords);
+    for (size_t i=0; i<fp.coords.size(); ++i)
+      fp.coords[i] = target_georef.datum().cartesian_to_geodetic(fp.coords[i]);
+  }
+}
+
+/// Find the footprint of one camera, or read it from the cache.
+class FootprintTask: public vw::Task, private boost::noncopyable {
+  Options                           const& m_opt;
+  std::string                              m_image_file, m_camera_file;
+  ImageViewRef< PixelMask<double> > const& m_dem;
+  GeoReference                      const& m_dem_georef, & m_target_georef;
+  Footprint                              & m_fp;
+public:
+  FootprintTask(Options const& opt, std::string const& image_file,
+                std::string const& camera_file,
+                ImageViewRef< PixelMask<double> > const& dem,
+                GeoReference const& dem_georef, GeoReference const& target_georef,
+                Footprint & fp):
+    m_opt(opt), m_image_file(image_file), m_camera_file(camera_file), m_dem(dem),
+    m_dem_georef(dem_georef), m_target_georef(target_georef), m_fp(fp) {}
+
+  void operator()() {
+    try {
+      std::string cached;
+      if (!m_opt.cache_dir.empty()) {
+        cached = cache_file(m_opt, m_image_file, m_camera_file);
+        if (read_cached_footprint(cached, m_fp))
+          return;
+      }
+      compute_footprint(m_opt, m_image_file, m_camera_file, m_dem,
+                        m_dem_georef, m_target_georef, m_fp);
+      if (!cached.empty())
+        write_cached_footprint(cached, m_fp);
+    } catch (const std::exception& e) {
+      m_fp.error = e.what();
+    }
+  }
+};
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  //try {
+
+    handle_arguments(argc, argv, opt);
+
+    // Load the DEM, or set up the georef from the datum. This is
+    // shared by all cameras.
+    GeoReference target_georef, dem_georef;
+    ImageViewRef< PixelMask<double> > dem;
+    if (opt.dem_file.empty()) {
 
       // Initialize the georef/datum
       bool have_user_datum = (opt.datum_str != "");
@@ -176,39 +318,59 @@ int main( int argc, char *argv[] ) {
       target_georef = GeoReference(datum);
       
       asp::set_srs_string(opt.target_srs_string, have_user_datum, datum, target_georef);
-      vw_out() << "Using georef: " << target_georef << std::endl;
-
-      std::vector<Vector2> coords2;
-      footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1], mean_gsd, &coords2);
-      for (size_t i=0; i<coords2.size(); ++i) {
-        Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
-        coords.push_back(target_georef.point_to_geodetic(proj_coord));
-      }
       
-    } else { // DEM provided, intersect with it.
+    } else {
 
-      // Load the DEM
       float dem_nodata_val = -std::numeric_limits<float>::max(); 
       vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageViewRef< PixelMask<double> > dem = create_mask
-        (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
+      dem = create_mask(channel_cast<double>(DiskImageView<float>(opt.dem_file)),
+                        dem_nodata_val);
       
-      GeoReference dem_georef;
       if (!read_georeference(dem_georef, opt.dem_file))
         vw_throw( ArgumentErr() << "Missing georef.\n");
 
       target_georef = dem_georef; // return box in this projection
-      vw_out() << "Using georef: " << target_georef << std::endl;
-      
-      footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
-                                   image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
-      for (size_t i=0; i<coords.size(); ++i)
-        coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
     }
+    vw_out() << "Using georef: " << target_georef << std::endl;
+
+    // Perform the computation, for the cameras in parallel. ISIS
+    // cameras cannot be loaded from several threads.
+    const size_t num_cameras = opt.image_files.size();
+    std::vector<Footprint> footprints(num_cameras);
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    bool has_isis = (opt.stereo_session == "isis");
+    for (size_t i = 0; i < num_cameras; i++)
+      has_isis = has_isis || boost::iends_with(opt.camera_files[i], ".cub");
+    if (has_isis || num_cameras == 1)
+      num_threads = 1;
+    {
+      FifoWorkQueue queue(num_threads);
+      for (size_t i = 0; i < num_cameras; i++) {
+        boost::shared_ptr<FootprintTask>
+          task(new FootprintTask(opt, opt.image_files[i], opt.camera_files[i], dem,
+                                 dem_georef, target_georef, footprints[i]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    // A single camera which failed is an error, as before
+    if (num_cameras == 1 && footprints[0].error != "")
+      vw_throw( ArgumentErr() << footprints[0].error );
     
     // Print out the results    
-    vw_out() << "Computed footprint bounding box:\n" << footprint_bbox << std::endl;
-    vw_out() << "Computed mean gsd: " << mean_gsd << std::endl;
+    for (size_t i = 0; i < num_cameras; i++) {
+      if (num_cameras > 1)
+        vw_out() << "Footprint of " << opt.image_files[i] << ":\n";
+      if (footprints[i].error != "") {
+        vw_out() << "Failed to compute the footprint: " << footprints[i].error << std::endl;
+        continue;
+      }
+      vw_out() << "Computed footprint bounding box:\n" << footprints[i].bbox << std::endl;
+      vw_out() << "Computed mean gsd: " << footprints[i].mean_gsd << std::endl;
+    }
  
     if (opt.output_kml == "")
       return 0;
@@ -242,7 +404,10 @@ int main( int argc, char *argv[] ) {
     kml.append_line(coordinates);
     */  
     
-    kml.append_line(coords, "intersections", "placemark");
+    for (size_t i = 0; i < num_cameras; i++) {
+      if (footprints[i].error == "")
+        kml.append_line(footprints[i].coords, "intersections", "placemark");
+    }
     vw_out() << "Writing: " << opt.output_kml << std::endl; 
     kml.close_kml();
     
@@ -43,6 +43,7 @@ class DatumConvertView : public ImageViewBase<DatumConvertView<ImageT> >
   GeoReference const& m_input_georef;
   GeoReference const& m_output_georef;
   double              m_nodata_val;
+  bool                m_same_ellipsoid; ///< If true, the heights do not change
 
 public:
 
@@ -57,7 +58,13 @@ public:
                    GeoReference const& output_georef,
                    double nodata_val):
     m_input_dem(input_dem), m_input_georef(input_georef), m_output_georef(output_georef),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val){
+    Datum const& a = input_georef.datum();
+    Datum const& b = output_georef.datum();
+    m_same_ellipsoid = (a.semi_major_axis() == b.semi_major_axis() &&
+                        a.semi_minor_axis() == b.semi_minor_axis() &&
+                        a.meridian_offset() == b.meridian_offset());
+  }
 
   inline int32 cols  () const { return m_input_dem.cols(); }
   inline int32 rows  () const { return m_input_dem.rows(); }
@@ -65,15 +72,17 @@ public:
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+  /// The height in the output datum of the point at the given pixel
+  /// and with the given height in the input datum.
+  inline double convert_height(Vector2 const& pix, double current_height) const {
 
-    // Handle nodata
-    if ( m_input_dem(col, row) == m_nodata_val )
-      return m_nodata_val;
+    // The datums only differ by their ellipsoids, so there is nothing
+    // to do if those are the same
+    if (m_same_ellipsoid)
+      return current_height;
 
     // Compute the elevation in the output datum
-    double  current_height  = m_input_dem(col, row);
-    Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(Vector2(col, row));
+    Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(pix);
     Vector3 input_llh(input_lonlat[0], input_lonlat[1], current_height);
     Vector3 gcc_coord       = m_input_georef.datum().geodetic_to_cartesian(input_llh);
     Vector3 output_lonlat   = m_output_georef.datum().cartesian_to_geodetic(gcc_coord);
@@ -92,11 +101,31 @@ public:
     return output_height;
   }
 
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+
+    // Handle nodata
+    if ( m_input_dem(col, row) == m_nodata_val )
+      return m_nodata_val;
+
+    return convert_height(Vector2(col, row), m_input_dem(col, row));
+  }
+
   /// \cond INTERNAL
-  typedef DatumConvertView<typename ImageT::prerasterize_type> prerasterize_type;
+  /// Convert each tile in one pass over the rasterized input heights.
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_input_dem.prerasterize(bbox), m_input_georef,
-                              m_output_georef, m_nodata_val );
+    ImageView<result_type> dem = crop(m_input_dem, bbox);
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        if (dem(col, row) == m_nodata_val)
+          tile(col, row) = m_nodata_val;
+        else
+          tile(col, row) = convert_height(Vector2(col + bbox.min().x(), row + bbox.min().y()),
+                                          dem(col, row));
+      }
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -138,13 +167,19 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
 
   vw_out() << "Image size = " << Vector2(num_cols, num_rows) << std::endl;
 
+  // Read the border pixels once, rather than one at a time from disk
+  ImageView<T> left_col  = crop(input_dem, BBox2i(0,          0, 1, num_rows));
+  ImageView<T> right_col = crop(input_dem, BBox2i(num_cols-1, 0, 1, num_rows));
+  ImageView<T> top_row   = crop(input_dem, BBox2i(0, 0,          num_cols, 1));
+  ImageView<T> bot_row   = crop(input_dem, BBox2i(0, num_rows-1, num_cols, 1));
+
   // Expand along sides
   BBox2 output_bbox;
   for (int r=0; r<num_rows; ++r) {
     Vector2 pixel_left (0,          r);
     Vector2 pixel_right(num_cols-1, r);
-    double height_left  = input_dem(pixel_left[0],  pixel_left[1]);
-    double height_right = input_dem(pixel_right[0], pixel_right[1]);
+    double height_left  = left_col (0, r);
+    double height_right = right_col(0, r);
 
     output_bbox.grow(get_output_loc(pixel_left,  height_left,  input_georef, output_georef));
     output_bbox.grow(get_output_loc(pixel_right, height_right, input_georef, output_georef));
@@ -154,8 +189,8 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
   for (int c=1; c<num_cols-1; ++c) {
     Vector2 pixel_top(c, 0         );
     Vector2 pixel_bot(c, num_rows-1);
-    double height_top = input_dem(pixel_top[0], pixel_top[1]);
-    double height_bot = input_dem(pixel_bot[0], pixel_bot[1]);
+    double height_top = top_row(c, 0);
+    double height_bot = bot_row(c, 0);
 
     output_bbox.grow(get_output_loc(pixel_top, height_top, input_georef, output_georef));
     output_bbox.grow(get_output_loc(pixel_bot, height_bot, input_georef, output_georef));
@@ -55,6 +55,7 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   bool     m_reverse_adjustment; ///< If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
+  int      m_grid_spacing; ///< If positive, interpolate the geoid between nodes this far apart
 
 public:
 
@@ -68,13 +69,14 @@ public:
                bool is_egm2008, vector<double> const& egm2008_grid,
                ImageViewRef<PixelMask<double> > const& geoid,
                GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
+               double correction, double nodata_val, int grid_spacing):
     m_img(img), m_georef(georef),
     m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
     m_geoid(geoid), m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val),
+    m_grid_spacing(grid_spacing){}
 
   inline int32 cols  () const { return m_img.cols(); }
   inline int32 rows  () const { return m_img.rows(); }
@@ -82,12 +84,11 @@ public:
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
-
-    if ( m_img(col, row, p) == m_nodata_val )
-      return m_nodata_val; // Skip invalid pixels
+  /// The geoid height, with the correction, at the given DEM pixel.
+  /// Returns false if the geoid is not valid there.
+  bool geoid_height(Vector2 const& pix, double & height) const {
 
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
 
     // For testing (see the link to the reference web form belows).
     //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
@@ -112,28 +113,28 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    height = 0.0;
     if (m_is_egm2008){
       int nr = m_geoid.rows(), 
           nc = m_geoid.cols();
       // Call fortran function from "geoid" mini external library
       egm2008_call_interp_(&nr, &nc, (double*)&m_egm2008_grid[0],
-                           &lonlat[0], &lonlat[1], &geoid_height);
+                           &lonlat[0], &lonlat[1], &height);
     }else{
       // Use our own interpolation into the geoid image
-      Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
+      Vector2  geoid_pix = m_geoid_georef.lonlat_to_pixel(lonlat);
+      PixelMask<double> interp_val = m_geoid(geoid_pix[0], geoid_pix[1]);
       if (!is_valid(interp_val))
-        return m_nodata_val;
-      geoid_height = interp_val.child();
+        return false;
+      height = interp_val.child();
     }
 
-    geoid_height += m_correction;
+    height += m_correction;
+    return true;
+  }
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-    
+  /// Apply the geoid height to a DEM height
+  inline result_type adjust(double height_above_ellipsoid, double geoid_height) const {
     // Compute height above the geoid
     // - See the note in the main program about the formula below
     if (m_reverse_adjustment)
@@ -142,13 +143,79 @@ public:
       return height_above_ellipsoid - geoid_height;
   }
 
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+
+    if ( m_img(col, row, p) == m_nodata_val )
+      return m_nodata_val; // Skip invalid pixels
+
+    double height;
+    if (!geoid_height(Vector2(col, row), height))
+      return m_nodata_val;
+
+    return adjust(m_img(col, row, p), height);
+  }
+
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+
+    ImageView<result_type> dem = crop(m_img, bbox);
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+
+    // With a grid spacing, find the geoid heights exactly at the nodes
+    // of a lattice covering the tile, aligned with the image origin so
+    // that neighboring tiles agree, and interpolate them bilinearly
+    // in between. The geoid is smooth at the scale of a few DEM pixels.
+    int s = m_grid_spacing;
+    Vector2i node_min, num_nodes;
+    ImageView<double> node_height;
+    ImageView<uint8 > node_valid;
+    if (s > 0) {
+      for (int d = 0; d < 2; d++) {
+        node_min [d] = bbox.min()[d]/s;
+        num_nodes[d] = (bbox.max()[d] - 1)/s - node_min[d] + 2;
+      }
+      node_height.set_size(num_nodes[0], num_nodes[1]);
+      node_valid.set_size (num_nodes[0], num_nodes[1]);
+      for (int j = 0; j < num_nodes[1]; j++) {
+        for (int i = 0; i < num_nodes[0]; i++) {
+          Vector2 pix(s*(node_min[0] + i), s*(node_min[1] + j));
+          node_valid(i, j) = geoid_height(pix, node_height(i, j));
+        }
+      }
+    }
+
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+
+        if (dem(col, row) == m_nodata_val) {
+          tile(col, row) = m_nodata_val; // Skip invalid pixels
+          continue;
+        }
+
+        bool   valid = false;
+        double height = 0.0;
+        if (s > 0) {
+          int gc = col + bbox.min().x(), gr = row + bbox.min().y();
+          int i  = gc/s - node_min[0], j = gr/s - node_min[1];
+          if (node_valid(i, j) && node_valid(i+1, j) &&
+              node_valid(i, j+1) && node_valid(i+1, j+1)) {
+            double x = double(gc % s)/s, y = double(gr % s)/s;
+            height = (1-y)*((1-x)*node_height(i, j  ) + x*node_height(i+1, j  )) +
+                        y *((1-x)*node_height(i, j+1) + x*node_height(i+1, j+1));
+            valid = true;
+          }
+        }
+        // Near invalid geoid nodes, and without a grid, compute exactly
+        if (!valid)
+          valid = geoid_height(Vector2(col + bbox.min().x(), row + bbox.min().y()), height);
+
+        tile(col, row) = valid ? adjust(dem(col, row), height) : m_nodata_val;
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -163,11 +230,12 @@ dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            bool is_egm2008, vector<double> & egm2008_grid,
            ImageViewRef<PixelMask<double> > const& geoid,
            GeoReference const& geoid_georef, bool reverse_adjustment,
-           double correction, double nodata_val) {
+           double correction, double nodata_val, int grid_spacing) {
   return DemGeoidView<ImageT>( img.impl(), georef,
                                is_egm2008, egm2008_grid,
                                geoid, geoid_georef,
-                               reverse_adjustment, correction, nodata_val );
+                               reverse_adjustment, correction, nodata_val,
+                               grid_spacing );
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
@@ -175,6 +243,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   double nodata_value;
   bool   use_double;
   bool   reverse_adjustment;
+  int    grid_spacing;
 };
 
 string get_geoid_full_path(string geoid_file){
@@ -216,7 +285,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
          "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
                         po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("geoid-grid-spacing", po::value(&opt.grid_spacing)->default_value(0),
+        "Compute the geoid height exactly only at the nodes of a grid of this spacing, in DEM pixels, and interpolate bilinearly in between. This is much faster, particularly for EGM2008. The default is to compute it exactly at each pixel.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -241,6 +312,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
 
   boost::to_lower(opt.geoid);
 
+  if ( opt.grid_spacing < 0 )
+    vw_throw( ArgumentErr() << "The geoid grid spacing must be non-negative.\n" );
+
   if ( opt.out_prefix.empty() )
     opt.out_prefix = fs::path(opt.dem_name).stem().string();
 
@@ -450,7 +524,8 @@ int main( int argc, char *argv[] ) {
     ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
                                              is_egm2008, egm2008_grid,
                                              geoid, geoid_georef,
-                                             reverse_adjustment, major_correction, dem_nodata_val);
+                                             reverse_adjustment, major_correction, dem_nodata_val,
+                                             opt.grid_spacing);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
     vw_out() << "Writing adjusted DEM: " << adj_dem_file << endl;
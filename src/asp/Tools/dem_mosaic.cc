@@ -34,8 +34,11 @@
 #include <iomanip>
 #include <string>
 #include <vector>
+#include <list>
+#include <map>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <time.h>
 #include <limits>
@@ -45,16 +48,22 @@
 #include <vw/Image.h>
 #include <vw/Cartography.h>
 #include <vw/Math.h>
-#include <vw/FileIO/DiskImageManager.h>
 #include <vw/Image/InpaintView.h>
 #include <vw/Image/Algorithms2.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/GaussianFilter.h>
+#include <asp/Core/ProgressStatus.h>
+#include <asp/Core/TileCache.h>
+#include <asp/Core/HoleFill.h>
 
 
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/erf.hpp>
+#include <boost/math/special_functions/next.hpp>
 #include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <boost/filesystem/convenience.hpp>
 
@@ -71,6 +80,10 @@ typedef float RealT;
 // This is used for various tolerances
 double g_tol = 1e-6;
 
+// Starting with this sigma the weights are blurred with a recursive
+// filter rather than by convolution
+const double RECURSIVE_BLUR_MIN_SIGMA = 10.0;
+
 // TODO: Fold modifications into VW!
 template<class ImageT>
 void centerline_weights2(ImageT const& img, ImageView<double> & weights,
@@ -234,6 +247,29 @@ void blur_weights(ImageView<double> & weights, double sigma){
   // huge holes. To get smooth weights, if really desired one should
   // use the weights-exponent option.
 
+  // For large sigma the kernel gets wide and convolution with it
+  // expensive, so use instead the recursive filter, whose cost does
+  // not depend on sigma. It already treats the pixels beyond the
+  // image as zero, so no padding is needed. One thread suffices,
+  // as the tiles are already processed in parallel.
+  if (sigma >= RECURSIVE_BLUR_MIN_SIGMA) {
+    ImageView<double> blurred_wts = copy(weights);
+    for (int col = 0; col < blurred_wts.cols(); col++) {
+      for (int row = 0; row < blurred_wts.rows(); row++) {
+        if (!(blurred_wts(col, row) > 0))
+          blurred_wts(col, row) = 0;
+      }
+    }
+    asp::recursive_gaussian_blur(blurred_wts, sigma, 1);
+    for (int col = 0; col < weights.cols(); col++) {
+      for (int row = 0; row < weights.rows(); row++) {
+        if (weights(col, row) > 0)
+          weights(col, row) = blurred_wts(col, row);
+      }
+    }
+    return;
+  }
+
   int half_kernel = vw::compute_kernel_size(sigma)/2;
   int extra = half_kernel + 1; // to guarantee we stay zero at boundary
 
@@ -320,25 +356,28 @@ std::string processed_proj4(std::string const& srs){
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
-  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference;
+  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference, dem_bbox_cache, status_file, hole_fill_method_str;
   vector<string> dem_files;
   double tr, geo_tile_size;
   bool   has_out_nodata;
   double out_nodata_value;
-  int    tile_size, tile_index, erode_len, priority_blending_len, extra_crop_len, hole_fill_len, block_size, save_dem_weight;
+  int    tile_size, tile_index, erode_len, priority_blending_len, extra_crop_len, hole_fill_len, block_size, save_dem_weight, max_open_files;
   double  weights_exp, weights_blur_sigma, dem_blur_sigma;
-  double nodata_threshold;
-  bool   first, last, min, max, block_max, mean, stddev, median, count, save_index_map, use_centerline_weights, first_dem_as_reference, propagate_nodata;
+  double nodata_threshold, dem_cache_size;
+  bool   first, last, min, max, block_max, mean, stddev, median, count, save_index_map, use_centerline_weights, first_dem_as_reference, propagate_nodata, update, cog;
   std::set<int> tile_list;
   BBox2 projwin;
+  asp::HoleFillMethod hole_fill_method;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), tile_index(-1),
 	     erode_len(0), priority_blending_len(0), extra_crop_len(0),
-	     hole_fill_len(0), block_size(0), save_dem_weight(-1), 
+	     hole_fill_len(0), block_size(0), save_dem_weight(-1), max_open_files(0),
 	     weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
 	     nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
 	     first(false), last(false), min(false), max(false), block_max(false),
 	     mean(false), stddev(false), median(false), count(false), save_index_map(false),
-	     use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
+	     use_centerline_weights(false), first_dem_as_reference(false), propagate_nodata(false),
+	     update(false), cog(false), projwin(BBox2()),
+	     hole_fill_method(asp::PUSH_PULL_HOLE_FILL) {}
 };
 
 /// Return the number of no-blending options selected.
@@ -347,8 +386,32 @@ int no_blend(Options const& opt){
     + int(opt.mean) + int(opt.stddev) + int(opt.median) + int(opt.count) + int(opt.block_max);
 }
 
+/// When more than one statistic is asked for, they are all found with
+/// one pass over the DEMs, and each is saved to its own file.
+bool multi_stats(Options const& opt){
+  return no_blend(opt) > 1;
+}
+
+/// The statistics to find when there are several, in the order of the
+/// bands of the mosaic. These are also the suffixes of the output files.
+std::vector<std::string> stat_names(Options const& opt){
+  std::vector<std::string> names;
+  if (opt.first         ) names.push_back("first");
+  if (opt.last          ) names.push_back("last");
+  if (opt.min           ) names.push_back("min");
+  if (opt.max           ) names.push_back("max");
+  if (opt.mean          ) names.push_back("mean");
+  if (opt.stddev        ) names.push_back("stddev");
+  if (opt.median        ) names.push_back("median");
+  if (opt.count         ) names.push_back("count");
+  if (opt.save_index_map) names.push_back("index-map");
+  return names;
+}
+
 std::string tile_suffix(Options const& opt){
   std::string ans;
+  if (multi_stats(opt)) return ans; // each statistic gets its own file, see stat_file()
+
   if (opt.first    ) ans = "-first";
   if (opt.last     ) ans = "-last";
   if (opt.min      ) ans = "-min";
@@ -364,33 +427,471 @@ std::string tile_suffix(Options const& opt){
   return ans;
 }
 
+// The DEM footprints in the mosaic are kept in an asp::BBoxPairTree,
+// which works with 3D boxes. The footprints are made into boxes of
+// unit height.
+/// The file for one of several statistics, given the tile file name
+std::string stat_file(std::string const& dem_tile, std::string const& name){
+  return dem_tile.substr(0, dem_tile.size() - 4) + "-" + name + ".tif";
+}
+
+BBox3 mosaic_box_to_3d(BBox2 const& box){
+  return BBox3(Vector3(box.min().x(), box.min().y(), 0),
+               Vector3(box.max().x(), box.max().y(), 1));
+}
+
+/// A bounded cache of open DEM handles, shared by the threads which
+/// mosaic the tiles. When too many DEMs are open, the least recently
+/// used ones are closed, so that the limit on open files is respected
+/// without having to reopen the DEMs which nearby tiles still use. A
+/// handle which was returned stays valid even after it is dropped from
+/// the cache, and its file is closed once all its copies are gone.
+class DemHandleCache {
+  typedef boost::shared_ptr< DiskImageView<RealT> > HandleT;
+  typedef std::list<int>                             LruList;
+  typedef std::map<int, std::pair<HandleT, LruList::iterator> > HandleMap;
+
+  std::vector<std::string> m_files;
+  size_t    m_max_open;
+  LruList   m_lru;     // the indices of the open DEMs, most recently used first
+  HandleMap m_handles;
+  vw::Mutex m_mutex;   // a lock for m_lru and m_handles
+
+public:
+  DemHandleCache(): m_max_open(1) {}
+
+  void set_max_open(int max_open) { m_max_open = std::max(max_open, 1); }
+
+  /// Add a DEM. It is not opened until needed.
+  void add_file(std::string const& file) { m_files.push_back(file); }
+
+  size_t size() const { return m_files.size(); }
+  std::string const& get_file_name(int i) const { return m_files[i]; }
+
+  /// Return a handle to the given DEM, opening it if needed.
+  DiskImageView<RealT> get_handle(int i) {
+
+    {
+      vw::Mutex::Lock lock(m_mutex);
+      HandleMap::iterator it = m_handles.find(i);
+      if (it != m_handles.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+        return *(it->second.first);
+      }
+    }
+
+    // Open the file without holding the lock, as opening can be slow
+    // on network file systems, and other threads need not wait for it.
+    HandleT handle(new DiskImageView<RealT>(m_files[i]));
+
+    vw::Mutex::Lock lock(m_mutex);
+    HandleMap::iterator it = m_handles.find(i);
+    if (it != m_handles.end()) {
+      // Another thread opened it in the meantime
+      m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+      return *(it->second.first);
+    }
+    while (m_handles.size() >= m_max_open && !m_lru.empty()) {
+      m_handles.erase(m_lru.back());
+      m_lru.pop_back();
+    }
+    m_lru.push_front(i);
+    m_handles[i] = std::make_pair(handle, m_lru.begin());
+    return *handle;
+  }
+};
+
 /// Class that does the actual image processing work
+// Read a block of an input DEM for the cache
+struct DemBlock {
+  ImageViewRef<double> m_dem;
+  DemBlock(ImageViewRef<double> const& dem): m_dem(dem) {}
+  ImageView<double> operator()(BBox2i const& block) const {
+    BBox2i box = block;
+    box.crop(bounding_box(m_dem));
+    return crop(m_dem, box);
+  }
+};
+
+/// Find the median of the values of the DEMs at each pixel of a tile,
+/// with memory which does not depend on how many DEMs overlap. The
+/// DEMs are passed over a few times, each DEM tile being added with
+/// add(), and end_pass() telling if another pass is needed. The
+/// first pass counts the values at each pixel, and keeps them if
+/// there are few. Each later pass either histograms the values in the
+/// range known to hold the median, narrowing it, or collects them
+/// once few are left. As in math::destructive_median(), the median is
+/// the middle value, or the mean of the two middle values.
+class MedianSelector {
+
+  static const int NUM_BINS = 16; // how much a range is narrowed in a pass
+  static const int NUM_VALS = 8;  // how many values can be collected
+
+  enum PixelState {COUNT, HIST, SPLIT, COLLECT, DONE};
+
+  struct PixelData {
+    PixelState state;
+    vw::uint32 count; // the number of valid values
+    vw::uint32 below; // values below the range, in this pass
+    vw::uint32 num;   // values in the range, in this pass
+    double lo, hi;    // the range [lo, hi) holding the median
+    double min, max;  // of the values in the range, in this pass
+  };
+
+  int m_cols, m_rows;
+  std::vector<PixelData>  m_pixels;
+  std::vector<vw::uint32> m_hist; // NUM_BINS per pixel
+  std::vector<double>     m_vals; // NUM_VALS per pixel
+
+  // The pivots split [lo, hi) into bins. They are found the same way
+  // in each pass, so that a value is in the same bin each time.
+  static double pivot(double lo, double hi, int j) {
+    if (j == NUM_BINS) return hi;
+    return lo + (hi - lo)*j/NUM_BINS;
+  }
+  static int bin(double lo, double hi, double val) {
+    int b = int(NUM_BINS*((val - lo)/(hi - lo)));
+    b = std::max(0, std::min(b, NUM_BINS - 1));
+    while (b > 0 && val < pivot(lo, hi, b)) b--;
+    while (b < NUM_BINS - 1 && val >= pivot(lo, hi, b + 1)) b++;
+    return b;
+  }
+
+  // The values at the two middle ranks, given the count, the values
+  // below, and the sorted values in the range.
+  static double middle(PixelData const& p, double const* vals) {
+    int k1 = (p.count - 1)/2 - p.below, k2 = p.count/2 - p.below;
+    return 0.5*(vals[k1] + vals[k2]);
+  }
+
+public:
+  MedianSelector(): m_cols(0), m_rows(0) {}
+
+  MedianSelector(int cols, int rows): m_cols(cols), m_rows(rows) {
+    PixelData p;
+    p.state = COUNT;
+    p.count = 0; p.below = 0; p.num = 0;
+    p.lo  =  std::numeric_limits<double>::max();
+    p.hi  = -std::numeric_limits<double>::max();
+    p.min = p.lo; p.max = p.hi;
+    m_pixels.assign(size_t(cols)*rows, p);
+    m_hist.assign(m_pixels.size()*NUM_BINS, 0);
+    m_vals.assign(m_pixels.size()*NUM_VALS, 0.0);
+  }
+
+  /// Add the values of one DEM, with invalid ones set to nodata
+  void add(ImageView<double> const& tile, double nodata) {
+    for (int r = 0; r < m_rows; r++) {
+      for (int c = 0; c < m_cols; c++) {
+        double val = tile(c, r);
+        if (val != nodata)
+          add(c, r, val);
+      }
+    }
+  }
+
+  /// Add one value of one DEM
+  void add(int c, int r, double val) {
+    if (boost::math::isnan(val))
+      return;
+    size_t i = size_t(r)*m_cols + c;
+    PixelData & p = m_pixels[i];
+    switch (p.state) {
+    case COUNT:
+      if (p.count < vw::uint32(NUM_VALS))
+        m_vals[i*NUM_VALS + p.count] = val;
+      p.count++;
+      p.lo = std::min(p.lo, val);
+      p.hi = std::max(p.hi, val);
+      break;
+    case HIST:
+      if (val < p.lo) {
+        p.below++;
+      } else if (val < p.hi) {
+        m_hist[i*NUM_BINS + bin(p.lo, p.hi, val)]++;
+        p.min = std::min(p.min, val);
+        p.max = std::max(p.max, val);
+      }
+      break;
+    case SPLIT: // the last value in one bin, the first in another
+      if (val >= p.lo && val < p.hi)
+        p.max = std::max(p.max, val);
+      if (val >= m_vals[i*NUM_VALS] && val < m_vals[i*NUM_VALS + 1])
+        p.min = std::min(p.min, val);
+      break;
+    case COLLECT:
+      if (val < p.lo) {
+        p.below++;
+      } else if (val < p.hi) {
+        VW_ASSERT(p.num < vw::uint32(NUM_VALS),
+                  LogicErr() << "MedianSelector: too many values.");
+        m_vals[i*NUM_VALS + p.num] = val;
+        p.num++;
+      }
+      break;
+    case DONE:
+      break;
+    }
+  }
+
+  /// Prepare for the next pass. Return false if the medians are known.
+  bool end_pass() {
+    bool more = false;
+    for (size_t i = 0; i < m_pixels.size(); i++) {
+      PixelData & p = m_pixels[i];
+      vw::uint32 * hist = &m_hist[i*NUM_BINS];
+      double     * vals = &m_vals[i*NUM_VALS];
+
+      if (p.state == COUNT) {
+        if (p.count == 0) {
+          p.state = DONE;
+          continue;
+        }
+        if (p.lo == p.hi) { // all values are equal
+          p.state = DONE;
+          continue;
+        }
+        if (p.count <= vw::uint32(NUM_VALS)) {
+          std::sort(vals, vals + p.count);
+          p.lo = middle(p, vals);
+          p.state = DONE;
+          continue;
+        }
+        p.hi = boost::math::float_next(p.hi); // make the range half-open
+        p.state = HIST;
+      } else if (p.state == HIST) {
+        if (p.min == p.max) { // all values in the range are equal
+          p.lo = p.min;
+          p.state = DONE;
+          continue;
+        }
+        // Find the bins of the two middle ranks
+        vw::int64 k1 = (p.count - 1)/2 - p.below, k2 = p.count/2 - p.below;
+        vw::int64 sum = 0;
+        int b1 = -1, b2 = -1;
+        for (int b = 0; b < NUM_BINS; b++) {
+          sum += hist[b];
+          if (b1 < 0 && sum > k1) b1 = b;
+          if (b2 < 0 && sum > k2) b2 = b;
+        }
+        VW_ASSERT(b1 >= 0 && b2 >= 0, LogicErr() << "MedianSelector: book-keeping error.");
+        double lo = p.lo, hi = p.hi;
+        p.lo = pivot(lo, hi, b1);
+        p.hi = pivot(lo, hi, b1 + 1);
+        if (b1 != b2) {
+          vals[0] = pivot(lo, hi, b2);
+          vals[1] = pivot(lo, hi, b2 + 1);
+          p.state = SPLIT;
+        } else if (hist[b1] <= vw::uint32(NUM_VALS)) {
+          p.state = COLLECT;
+        }
+      } else if (p.state == SPLIT) {
+        p.lo = 0.5*(p.max + p.min);
+        p.state = DONE;
+        continue;
+      } else if (p.state == COLLECT) {
+        std::sort(vals, vals + p.num);
+        p.lo = middle(p, vals);
+        p.state = DONE;
+        continue;
+      } else {
+        continue;
+      }
+
+      // Start the next pass for this pixel
+      p.below = 0;
+      p.num   = 0;
+      p.min   =  std::numeric_limits<double>::max();
+      p.max   = -std::numeric_limits<double>::max();
+      std::fill(hist, hist + NUM_BINS, 0);
+      more = true;
+    }
+    return more;
+  }
+
+  /// Set the medians in the tile, and nodata where there are no values
+  void median(ImageView<double> & tile, double nodata) const {
+    for (int r = 0; r < m_rows; r++) {
+      for (int c = 0; c < m_cols; c++) {
+        PixelData const& p = m_pixels[size_t(r)*m_cols + c];
+        tile(c, r) = (p.count > 0) ? p.lo : nodata;
+      }
+    }
+  }
+};
+
+/// Find several statistics of the DEM values at each pixel of a tile,
+/// with one pass over the DEMs, or a few if the median is needed.
+/// Each statistic is as with its own option. The index map records
+/// the DEM giving the first, last, min, or max value, whichever of
+/// these is asked for.
+class MosaicStats {
+  Options const* m_opt;
+  int m_pass;
+  ImageView<double> m_first, m_last, m_min, m_max, m_sum, m_mean, m_m2, m_index;
+  ImageView<vw::uint32> m_count;
+  ImageView<vw::uint8>  m_invalid; // for --propagate-nodata
+  MedianSelector m_median;
+
+public:
+  MosaicStats(): m_opt(NULL), m_pass(0) {}
+
+  MosaicStats(Options const& opt, int cols, int rows): m_opt(&opt), m_pass(0) {
+    m_count.set_size(cols, rows);
+    fill(m_count, 0);
+    if (opt.first ) m_first.set_size(cols, rows);
+    if (opt.last  ) m_last.set_size (cols, rows);
+    if (opt.min   ) m_min.set_size  (cols, rows);
+    if (opt.max   ) m_max.set_size  (cols, rows);
+    if (opt.mean  ) { m_sum.set_size(cols, rows); fill(m_sum, 0.0); }
+    if (opt.stddev) {
+      m_mean.set_size(cols, rows); fill(m_mean, 0.0);
+      m_m2.set_size  (cols, rows); fill(m_m2,   0.0);
+    }
+    if (opt.median) m_median = MedianSelector(cols, rows);
+    if (opt.save_index_map) {
+      m_index.set_size(cols, rows);
+      fill(m_index, opt.out_nodata_value);
+    }
+    if (opt.propagate_nodata) {
+      m_invalid.set_size(cols, rows);
+      fill(m_invalid, 0);
+    }
+  }
+
+  /// Add the value of a DEM at a pixel. After the first pass only the
+  /// median needs the values.
+  void add(int c, int r, double val, int dem_iter) {
+    if (m_opt->median)
+      m_median.add(c, r, val);
+    if (m_pass > 0)
+      return;
+
+    bool is_first = (m_count(c, r) == 0);
+    m_count(c, r)++;
+    double n = m_count(c, r);
+
+    bool replaced = false;
+    if (m_opt->first && is_first) {
+      m_first(c, r) = val;
+      replaced = true;
+    }
+    if (m_opt->last) {
+      m_last(c, r) = val;
+      replaced = true;
+    }
+    if (m_opt->min && (is_first || val < m_min(c, r))) {
+      m_min(c, r) = val;
+      replaced = true;
+    }
+    if (m_opt->max && (is_first || val > m_max(c, r))) {
+      m_max(c, r) = val;
+      replaced = true;
+    }
+    if (m_opt->save_index_map && replaced)
+      m_index(c, r) = dem_iter;
+    if (m_opt->mean)
+      m_sum(c, r) += val;
+    if (m_opt->stddev) { // Welford's running update
+      double delta = val - m_mean(c, r);
+      m_mean(c, r) += delta/n;
+      m_m2(c, r)   += delta*(val - m_mean(c, r));
+    }
+  }
+
+  /// A DEM has an invalid value at this pixel, and --propagate-nodata is on
+  void invalidate(int c, int r) {
+    m_invalid(c, r) = 1;
+  }
+
+  /// Prepare for the next pass. Return false if all is known.
+  bool end_pass() {
+    m_pass++;
+    return m_opt->median && m_median.end_pass();
+  }
+
+  /// The statistics, in the order of stat_names()
+  void results(std::vector< ImageView<double> > & tiles) const {
+    double nodata = m_opt->out_nodata_value;
+    int cols = m_count.cols(), rows = m_count.rows();
+    ImageView<double> median;
+    if (m_opt->median) {
+      median.set_size(cols, rows);
+      m_median.median(median, nodata);
+    }
+
+    std::vector<std::string> names = stat_names(*m_opt);
+    tiles.clear();
+    for (size_t s = 0; s < names.size(); s++) {
+      std::string const& name = names[s];
+
+      // Most statistics are kept as they are. The others are found here.
+      enum {KEPT, MEAN, STDDEV, COUNT} kind = KEPT;
+      ImageView<double> const* kept = NULL;
+      if      (name == "first"    ) kept = &m_first;
+      else if (name == "last"     ) kept = &m_last;
+      else if (name == "min"      ) kept = &m_min;
+      else if (name == "max"      ) kept = &m_max;
+      else if (name == "median"   ) kept = &median;
+      else if (name == "index-map") kept = &m_index;
+      else if (name == "mean"     ) kind = MEAN;
+      else if (name == "stddev"   ) kind = STDDEV;
+      else if (name == "count"    ) kind = COUNT;
+
+      ImageView<double> tile(cols, rows);
+      for (int c = 0; c < cols; c++) {
+        for (int r = 0; r < rows; r++) {
+          double n = m_count(c, r);
+          double val = nodata;
+          if (kind == KEPT && (n > 0 || kept == &m_index))
+            val = (*kept)(c, r);
+          else if (kind == MEAN && n > 0)
+            val = m_sum(c, r)/n;
+          else if (kind == STDDEV && n > 1)
+            val = sqrt(m_m2(c, r)/(n - 1));
+          else if (kind == COUNT && n > 0)
+            val = n;
+          if (m_opt->propagate_nodata && m_invalid(c, r))
+            val = nodata;
+          tile(c, r) = val;
+        }
+      }
+      tiles.push_back(tile);
+    }
+  }
+};
+
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
   Options                 const& m_opt;              // alias
-  DiskImageManager<RealT>      & m_imgMgr;           // alias
+  DemHandleCache               & m_imgMgr;           // alias
   vector<GeoReference>    const& m_georefs;          // alias
   GeoReference                   m_out_georef;
   vector<double>          const& m_nodata_values;    // alias
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
+  asp::BBoxPairTree       const& m_dem_tree;         // alias, DEM footprints in the mosaic
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
+  asp::TileCache<double>       & m_dem_cache;        // alias, blocks of the input DEMs
 
 public:
   DemMosaicView(int cols, int rows, int bias,
                 Options                const& opt,
-                DiskImageManager<RealT>     & imgMgr,
+                DemHandleCache              & imgMgr,
                 vector<GeoReference>   const& georefs,
                 GeoReference           const& out_georef,
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
+                asp::BBoxPairTree      const& dem_tree,
                 long long int               & num_valid_pixels,
-                vw::Mutex                   & count_mutex):
+                vw::Mutex                   & count_mutex,
+                asp::TileCache<double>      & dem_cache):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
-    m_count_mutex(count_mutex) {
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_tree(dem_tree),
+    m_num_valid_pixels(num_valid_pixels),
+    m_count_mutex(count_mutex), m_dem_cache(dem_cache) {
 
     // How many valid pixels we will have
     m_num_valid_pixels = 0;
@@ -443,6 +944,21 @@ public:
 
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i bbox) const {
+    std::vector< ImageView<double> > tiles;
+    prerasterize_tiles(bbox, tiles);
+
+    // Return the tile we created with fake borders to make it look
+    // the size of the entire output image. So far we operated
+    // on doubles, here we cast to RealT.
+    return prerasterize_type(pixel_cast<RealT>(tiles[0]),
+			     -bbox.min().x(), -bbox.min().y(),
+			     cols(), rows() );
+  }
+
+  /// Mosaic the given box. That gives one tile, or, with several
+  /// statistics, one tile for each of stat_names(). The box is
+  /// expanded to the extent of the tiles if priority blending is on.
+  void prerasterize_tiles(BBox2i & bbox, std::vector< ImageView<double> > & tiles) const {
 
     BBox2i orig_box = bbox;
     
@@ -465,11 +981,8 @@ public:
     bool noblend = (no_blend(m_opt) > 0);
 
     // A vector of images the size of the output tile.
-    // - Used for median and stddev calculation.
+    // - Used for stddev calculation and priority blending.
     std::vector< ImageView<double> > tile_vec, weight_vec;
-    std::vector< std::string > dem_vec;
-    if (m_opt.median) // Store each input separately
-      tile_vec.reserve(m_imgMgr.size());
     if (m_opt.stddev) { // Need one working image
       tile_vec.push_back(ImageView<double>(bbox.width(), bbox.height()));
       // Each pixel starts at zero, nodata is handled later
@@ -504,337 +1017,391 @@ public:
       fill(index_map, m_opt.out_nodata_value);
     }
 
+    // The median is found with a few passes over the DEMs, and for
+    // the max per block only the best DEM so far is kept, so that
+    // memory does not grow with the number of overlapping DEMs.
+    bool multi = multi_stats(m_opt);
+    MedianSelector median_selector;
+    if (m_opt.median && !multi)
+      median_selector = MedianSelector(bbox.width(), bbox.height());
+
+    // With several statistics, these are found here instead
+    MosaicStats stats;
+    if (multi)
+      stats = MosaicStats(m_opt, bbox.width(), bbox.height());
+    ImageView<double> block_max_tile;
+    double block_max_sum = 0.0;
+    bool   has_block_max = false;
+
     ImageView<double> first_dem;
     ImageView<double> local_wts_orig;
     
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++){
-
-      // Load the information for this DEM
-      GeoReference georef        = m_georefs         [dem_iter];
-      BBox2i       dem_pixel_box = m_dem_pixel_bboxes[dem_iter];
+    // Find the DEMs whose footprints intersect this tile, in input
+    // order, rather than checking each of them.
+    std::vector<size_t> dem_indices;
+    m_dem_tree.intersecting(mosaic_box_to_3d(bbox), dem_indices);
+
+    // Loop through the input DEMs which may overlap with this tile.
+    // Only the median needs more than one pass.
+    bool another_pass = true;
+    while (another_pass) {
+      for (size_t dem_index = 0; dem_index < dem_indices.size(); dem_index++){
+
+        int dem_iter = dem_indices[dem_index];
+
+        // Load the information for this DEM
+        GeoReference georef        = m_georefs         [dem_iter];
+        BBox2i       dem_pixel_box = m_dem_pixel_bboxes[dem_iter];
       
-      // The GeoTransform will hide the messy details of conversions
-      // from pixels to points and lon-lat.
-      GeoTransform geotrans(georef, m_out_georef, dem_pixel_box, bbox);
+        // The GeoTransform will hide the messy details of conversions
+        // from pixels to points and lon-lat.
+        GeoTransform geotrans(georef, m_out_georef, dem_pixel_box, bbox);
 
-      // Get the tile bbox in the frame of the current input DEM
-      BBox2 in_box = geotrans.reverse_bbox(bbox);
+        // Get the tile bbox in the frame of the current input DEM
+        BBox2 in_box = geotrans.reverse_bbox(bbox);
 
-      // Grow to account for blending and erosion length, etc.  If
-      // priority blending length was positive, we've already done that.
-      if (m_opt.priority_blending_len <= 0)
-        in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
+        // Grow to account for blending and erosion length, etc.  If
+        // priority blending length was positive, we've already done that.
+        if (m_opt.priority_blending_len <= 0)
+          in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
 
-      in_box.crop(dem_pixel_box);
-      if (in_box.width() == 1 || in_box.height() == 1){
-        // Grassfire likes to have width of at least 2
-        in_box.expand(1);
         in_box.crop(dem_pixel_box);
-      }
-      if (in_box.width() <= 1 || in_box.height() <= 1)
-        continue; // No overlap with this tile, skip to the next DEM.
+        if (in_box.width() == 1 || in_box.height() == 1){
+          // Grassfire likes to have width of at least 2
+          in_box.expand(1);
+          in_box.crop(dem_pixel_box);
+        }
+        if (in_box.width() <= 1 || in_box.height() <= 1)
+          continue; // No overlap with this tile, skip to the next DEM.
 
-      if (m_opt.median || m_opt.priority_blending_len > 0 || m_opt.block_max){
-        // Must use a blank tile each time
-        fill( tile, m_opt.out_nodata_value );
-        fill( weights, 0.0 );
-      }
+        if (m_opt.median || m_opt.priority_blending_len > 0 || m_opt.block_max){
+          // Must use a blank tile each time
+          fill( tile, m_opt.out_nodata_value );
+          fill( weights, 0.0 );
+        }
 
-      // Crop the disk dem to a 2-channel in-memory image. First
-      // channel is the image pixels, second will be the weights.
-      ImageViewRef<double     > disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter, bbox));
-      ImageView   <DoubleGrayA> dem      = crop(disk_dem, in_box);
+        // Crop the disk dem to a 2-channel in-memory image. First
+        // channel is the image pixels, second will be the weights.
+        ImageViewRef<double     > disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter));
+        ImageView   <DoubleGrayA> dem;
+        if (m_dem_cache.enabled()) {
+          // The neighboring tiles read overlapping regions of the DEM
+          BBox2i int_box(int32(in_box.min().x()), int32(in_box.min().y()),
+                         int32(0.5 + in_box.width()), int32(0.5 + in_box.height()));
+          dem = m_dem_cache.crop(dem_iter, int_box, DemBlock(disk_dem));
+        } else {
+          dem = crop(disk_dem, in_box);
+        }
 
-      if (m_opt.first_dem_as_reference && dem_iter == 0) {
-        // We need to keep the first DEM, to use it as ref
-        // when merging in the blended DEM
-        first_dem = crop(disk_dem, bbox);
-      }
+        if (m_opt.first_dem_as_reference && dem_iter == 0) {
+          // We need to keep the first DEM, to use it as ref
+          // when merging in the blended DEM
+          first_dem = crop(disk_dem, bbox);
+        }
       
-      std::string dem_name = m_imgMgr.get_file_name(dem_iter);
+        std::string dem_name = m_imgMgr.get_file_name(dem_iter);
       
-      // If the nodata_threshold is specified, all values no more than this
-      // will be invalidated.
-      double nodata_value = m_nodata_values[dem_iter];
-      if (!boost::math::isnan(m_opt.nodata_threshold)) {
-        nodata_value = m_opt.nodata_threshold;
-        for (int col = 0; col < dem.cols(); col++) {
-          for (int row = 0; row < dem.rows(); row++) {
-            if (dem(col, row)[0] <= nodata_value) {
-              dem(col, row)[0] = nodata_value;
+        // If the nodata_threshold is specified, all values no more than this
+        // will be invalidated.
+        double nodata_value = m_nodata_values[dem_iter];
+        if (!boost::math::isnan(m_opt.nodata_threshold)) {
+          nodata_value = m_opt.nodata_threshold;
+          for (int col = 0; col < dem.cols(); col++) {
+            for (int row = 0; row < dem.rows(); row++) {
+              if (dem(col, row)[0] <= nodata_value) {
+                dem(col, row)[0] = nodata_value;
+              }
             }
           }
         }
-      }
 
-      if (m_opt.first_dem_as_reference && dem_iter == 0) {
-        //TODO: Should be a function!
-        // Convert to the output nodata value
-        for (int col = 0; col < first_dem.cols(); col++) {
-          for (int row = 0; row < first_dem.rows(); row++) {
-            if (first_dem(col, row) == nodata_value) {
-              first_dem(col, row) = m_opt.out_nodata_value;
+        if (m_opt.first_dem_as_reference && dem_iter == 0) {
+          //TODO: Should be a function!
+          // Convert to the output nodata value
+          for (int col = 0; col < first_dem.cols(); col++) {
+            for (int row = 0; row < first_dem.rows(); row++) {
+              if (first_dem(col, row) == nodata_value) {
+                first_dem(col, row) = m_opt.out_nodata_value;
+              }
             }
           }
         }
-      }
 
-      // Mark the handle to the image as not in use, though we still
-      // keep that image file open, for increased performance, unless
-      // their number becomes too large.
-      m_imgMgr.release(dem_iter);
-      
-      if (dem_iter == 0 && m_opt.this_dem_as_reference != "") {
-        // We won't actually use this DEM, we just do all in reference to it.
-        continue;
-      }
+        if (dem_iter == 0 && m_opt.this_dem_as_reference != "") {
+          // We won't actually use this DEM, we just do all in reference to it.
+          continue;
+        }
       
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value));
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
+        // Compute linear weights
+        ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value));
+        local_wts_orig = local_wts;
+        if (m_opt.use_centerline_weights) {
+          // Erode based on grassfire weights, and then overwrite the grassfire
+          // weights with centerline weights
+          ImageView<DoubleGrayA> dem2 = copy(dem);
+          for (int col = 0; col < dem2.cols(); col++) {
+            for (int row = 0; row < dem2.rows(); row++) {
+              if (local_wts(col, row) <= m_opt.erode_len) {
+                dem2(col, row) = DoubleGrayA(nodata_value);
+              }
             }
           }
+          // TODO: Generalize this modification and move it to VW!!!
+          centerline_weights2
+                  (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
+                   local_wts, -1.0);
         }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2
-                (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                 local_wts, -1.0);
-      }
 
-      // If we don't limit the weights from above, we will have tiling artifacts,
-      // as in different tiles the weights grow to different heights since
-      // they are cropped to different regions. for priority blending length,
-      // we'll do this process later, as the bbox is obtained differently in that case.
-      if (m_opt.priority_blending_len <= 0) {
-        for (int col = 0; col < local_wts.cols(); col++) {
-          for (int row = 0; row < local_wts.rows(); row++) {
-            local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
+        // If we don't limit the weights from above, we will have tiling artifacts,
+        // as in different tiles the weights grow to different heights since
+        // they are cropped to different regions. for priority blending length,
+        // we'll do this process later, as the bbox is obtained differently in that case.
+        if (m_opt.priority_blending_len <= 0) {
+          for (int col = 0; col < local_wts.cols(); col++) {
+            for (int row = 0; row < local_wts.rows(); row++) {
+              local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
+            }
           }
         }
-      }
       
-      // Erode. We already did that if centerline weights are used.
-      if (!m_opt.use_centerline_weights){
-        int max_cutoff = max_pixel_value(local_wts);
-        int min_cutoff = m_opt.erode_len;
-        if (max_cutoff <= min_cutoff)
-          max_cutoff = min_cutoff + 1; // precaution
-        local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
-      }
+        // Erode. We already did that if centerline weights are used.
+        if (!m_opt.use_centerline_weights){
+          int max_cutoff = max_pixel_value(local_wts);
+          int min_cutoff = m_opt.erode_len;
+          if (max_cutoff <= min_cutoff)
+            max_cutoff = min_cutoff + 1; // precaution
+          local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
+        }
       
-      // Blur the weights. If priority blending length is on, we'll do the blur later,
-      // after weights from different DEMs are combined.
-      if (m_opt.weights_blur_sigma > 0 && m_opt.priority_blending_len <= 0)
-        blur_weights(local_wts, m_opt.weights_blur_sigma);
-
-      // Raise to the power. Note that when priority blending length is positive, we
-      // delay this process.
-      if (m_opt.weights_exp != 1 && m_opt.priority_blending_len <= 0) {
-        for (int col = 0; col < dem.cols(); col++){
-          for (int row = 0; row < dem.rows(); row++){
-            if (local_wts(col, row) > 0)
-              local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
+        // Blur the weights. If priority blending length is on, we'll do the blur later,
+        // after weights from different DEMs are combined.
+        if (m_opt.weights_blur_sigma > 0 && m_opt.priority_blending_len <= 0)
+          blur_weights(local_wts, m_opt.weights_blur_sigma);
+
+        // Raise to the power. Note that when priority blending length is positive, we
+        // delay this process.
+        if (m_opt.weights_exp != 1 && m_opt.priority_blending_len <= 0) {
+          for (int col = 0; col < dem.cols(); col++){
+            for (int row = 0; row < dem.rows(); row++){
+              if (local_wts(col, row) > 0)
+                local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
+            }
           }
         }
-      }
 
 #if 0
-      // Dump the weights
-      std::ostringstream os;
-      os << "weights_" << dem_iter << ".tif";
-      vw_out() << "Writing: " << os.str() << std::endl;
-      bool has_georef = true, has_nodata = true;
-      block_write_gdal_image(os.str(), local_wts,
-			     has_georef, georef,
-			     has_nodata, -100,
-			     vw::cartography::GdalWriteOptions(),
-			     TerminalProgressCallback("asp", ""));
+        // Dump the weights
+        std::ostringstream os;
+        os << "weights_" << dem_iter << ".tif";
+        vw_out() << "Writing: " << os.str() << std::endl;
+        bool has_georef = true, has_nodata = true;
+        block_write_gdal_image(os.str(), local_wts,
+                               has_georef, georef,
+                               has_nodata, -100,
+                               vw::cartography::GdalWriteOptions(),
+                               TerminalProgressCallback("asp", ""));
 #endif
 
-      // TODO: Function call!
-      // Set the weights in the alpha channel
-      for (int col = 0; col < dem.cols(); col++){
-        for (int row = 0; row < dem.rows(); row++){
-          dem(col, row).a() = local_wts(col, row);
+        // TODO: Function call!
+        // Set the weights in the alpha channel
+        for (int col = 0; col < dem.cols(); col++){
+          for (int row = 0; row < dem.rows(); row++){
+            dem(col, row).a() = local_wts(col, row);
+          }
         }
-      }
-
-      // Prepare the DEM for interpolation
-      ImageViewRef<DoubleGrayA> interp_dem
-        = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
 
-      // Loop through each output pixel
-      for (int c = 0; c < bbox.width(); c++){
-        for (int r = 0; r < bbox.height(); r++){
-
-          // Coordinates in the output mosaic
-          Vector2 out_pix(c +  bbox.min().x(), r +  bbox.min().y());
-          // Coordinate in this input DEM
-          Vector2 in_pix = geotrans.reverse(out_pix);
-
-          // Input DEM pixel relative to loaded bbox
-          double x = in_pix[0] - in_box.min().x();
-          double y = in_pix[1] - in_box.min().y();
-          DoubleGrayA pval;
-
-          int i0 = round(x),  // Round to nearest integer location
-              j0 = round(y);
-          if ((fabs(x-i0) < g_tol) && (fabs(y-j0) < g_tol) &&
-              ((i0 >= 0) && (i0 <= dem.cols()-1) &&
-               (j0 >= 0) && (j0 <= dem.rows()-1)) ){
-
-            // A lot of care is needed here. We are at an integer
-            // pixel, save for numerical error. Just borrow pixel's
-            // value, and don't interpolate. Interpolation can result
-            // in invalid pixels if the current pixel is valid but its
-            // neighbors are not. It can also make it appear is if the
-            // current indices are out of bounds while in fact they
-            // are barely so.
-            pval = dem(i0, j0);
-
-          }else{ // We are not right on an integer pixel and we need to interpolate
-
-            // Below must use x <= cols()-1 as x is double
-            bool is_good = ((x >= 0) && (x <= dem.cols()-1) && // TODO: should be an image function!
-		            (y >= 0) && (y <= dem.rows()-1));
-            if (!is_good)
-              continue; // Outside the loaded DEM bounds, skip to the next pixel
-
-            // If we have weights of 0, that means there are invalid pixels, so skip this point.
-            int i0 = (int)floor(x), j0 = (int)floor(y);
-            int i1 = (int)ceil(x),  j1 = (int)ceil(y);
-            bool nodata = ((dem(i0, j0).a() == 0) || (dem(i1, j0).a() == 0) ||
-                           (dem(i0, j1).a() == 0) || (dem(i1, j1).a() == 0));
-            bool border = ((dem(i0, j0).a() <  0) || (dem(i1, j0).a() <  0) ||
-                           (dem(i0, j1).a() <  0) || (dem(i1, j1).a() <  0));
+        // Prepare the DEM for interpolation
+        ImageViewRef<DoubleGrayA> interp_dem
+          = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
+
+        // Loop through each output pixel
+        for (int c = 0; c < bbox.width(); c++){
+          for (int r = 0; r < bbox.height(); r++){
+
+            // Coordinates in the output mosaic
+            Vector2 out_pix(c +  bbox.min().x(), r +  bbox.min().y());
+            // Coordinate in this input DEM
+            Vector2 in_pix = geotrans.reverse(out_pix);
+
+            // Input DEM pixel relative to loaded bbox
+            double x = in_pix[0] - in_box.min().x();
+            double y = in_pix[1] - in_box.min().y();
+            DoubleGrayA pval;
+
+            int i0 = round(x),  // Round to nearest integer location
+                j0 = round(y);
+            if ((fabs(x-i0) < g_tol) && (fabs(y-j0) < g_tol) &&
+                ((i0 >= 0) && (i0 <= dem.cols()-1) &&
+                 (j0 >= 0) && (j0 <= dem.rows()-1)) ){
+
+              // A lot of care is needed here. We are at an integer
+              // pixel, save for numerical error. Just borrow pixel's
+              // value, and don't interpolate. Interpolation can result
+              // in invalid pixels if the current pixel is valid but its
+              // neighbors are not. It can also make it appear is if the
+              // current indices are out of bounds while in fact they
+              // are barely so.
+              pval = dem(i0, j0);
+
+            }else{ // We are not right on an integer pixel and we need to interpolate
+
+              // Below must use x <= cols()-1 as x is double
+              bool is_good = ((x >= 0) && (x <= dem.cols()-1) && // TODO: should be an image function!
+                              (y >= 0) && (y <= dem.rows()-1));
+              if (!is_good)
+                continue; // Outside the loaded DEM bounds, skip to the next pixel
+
+              // If we have weights of 0, that means there are invalid pixels, so skip this point.
+              int i0 = (int)floor(x), j0 = (int)floor(y);
+              int i1 = (int)ceil(x),  j1 = (int)ceil(y);
+              bool nodata = ((dem(i0, j0).a() == 0) || (dem(i1, j0).a() == 0) ||
+                             (dem(i0, j1).a() == 0) || (dem(i1, j1).a() == 0));
+              bool border = ((dem(i0, j0).a() <  0) || (dem(i1, j0).a() <  0) ||
+                             (dem(i0, j1).a() <  0) || (dem(i1, j1).a() <  0));
             
-            if (nodata || border) {
-              pval.v() = 0;
-              pval.a() = -1; // Flag as border
+              if (nodata || border) {
+                pval.v() = 0;
+                pval.a() = -1; // Flag as border
 
-              if (m_opt.propagate_nodata && !border)
-                pval.a() = 0; // Flag as nodata
+                if (m_opt.propagate_nodata && !border)
+                  pval.a() = 0; // Flag as nodata
               
-            } else
-              pval = interp_dem(x, y); // Things checked out, do the interpolation.
-          }
-          // Seperate the value and alpha for this pixel.
-          double val = pval.v();
-          double wt  = pval.a();
-
-          if (m_opt.priority_blending_len > 0) {
-            // The priority blending, pixels from earlier DEMs at this location
-            // are used unmodified unless close to that DEM boundary.
-            wt = std::min(weight_modifier(c, r), wt);
-
-            // Now ensure that the current DEM values will be used
-            // unmodified unless close to the boundary for subsequent
-            // DEMs. The weight w2 will be 0 well inside the DEM, and
-            // increase towards the boundary.
-            double wt2 = wt;
-            wt2 = std::max(0.0, m_opt.priority_blending_len - wt2);
-            weight_modifier(c, r) = std::min(weight_modifier(c, r), wt2);
-          }
+              } else
+                pval = interp_dem(x, y); // Things checked out, do the interpolation.
+            }
+            // Seperate the value and alpha for this pixel.
+            double val = pval.v();
+            double wt  = pval.a();
+
+            if (m_opt.priority_blending_len > 0) {
+              // The priority blending, pixels from earlier DEMs at this location
+              // are used unmodified unless close to that DEM boundary.
+              wt = std::min(weight_modifier(c, r), wt);
+
+              // Now ensure that the current DEM values will be used
+              // unmodified unless close to the boundary for subsequent
+              // DEMs. The weight w2 will be 0 well inside the DEM, and
+              // increase towards the boundary.
+              double wt2 = wt;
+              wt2 = std::max(0.0, m_opt.priority_blending_len - wt2);
+              weight_modifier(c, r) = std::min(weight_modifier(c, r), wt2);
+            }
 
-          // If point is in-bounds and nodata, make sure this point stays 
-          //  at nodata even if other DEMS contain it.
-          if ((wt == 0) && m_opt.propagate_nodata) {
-            tile   (c, r) = 0;
-            weights(c, r) = -1.0;
-          }
+            if (multi) {
+              if ((wt == 0) && m_opt.propagate_nodata)
+                stats.invalidate(c, r);
+              else if (wt > 0)
+                stats.add(c, r, val, dem_iter);
+              continue;
+            }
 
-          if (wt <= 0)
-            continue; // No need to continue if the weight is zero
+            // If point is in-bounds and nodata, make sure this point stays 
+            //  at nodata even if other DEMS contain it.
+            if ((wt == 0) && m_opt.propagate_nodata) {
+              tile   (c, r) = 0;
+              weights(c, r) = -1.0;
+            }
 
-          // Check if the current output value at this pixel is nodata
-          bool is_nodata = ((tile(c, r) == m_opt.out_nodata_value));
+            if (wt <= 0)
+              continue; // No need to continue if the weight is zero
 
-          // Initialize the tile if not done already.
-          // Init to zero not needed with some types.
-          if (!m_opt.stddev && !m_opt.median && !m_opt.min && !m_opt.max &&
-              m_opt.priority_blending_len <= 0){
-            if ( is_nodata ){
-              tile   (c, r) = 0;
-              weights(c, r) = 0.0;
+            // Check if the current output value at this pixel is nodata
+            bool is_nodata = ((tile(c, r) == m_opt.out_nodata_value));
+
+            // Initialize the tile if not done already.
+            // Init to zero not needed with some types.
+            if (!m_opt.stddev && !m_opt.median && !m_opt.min && !m_opt.max &&
+                m_opt.priority_blending_len <= 0){
+              if ( is_nodata ){
+                tile   (c, r) = 0;
+                weights(c, r) = 0.0;
+              }
             }
-          }
 
-          // Update the output value according to the commanded mode
-          if ( ( m_opt.first && is_nodata)                        ||
-               m_opt.last                                         ||
-               ( m_opt.min && ( val < tile(c, r) || is_nodata ) ) ||
-               ( m_opt.max && ( val > tile(c, r) || is_nodata ) ) ||
-               m_opt.median || m_opt.priority_blending_len > 0    ||
-                     m_opt.block_max){
-            // --> Conditions where we replace the current value
-            tile   (c, r) = val;
-            weights(c, r) = wt;
-
-            // In these cases, the saved weight will be 1 or 0, since either
-            // a given DEM gives it all, or nothing at all.
-            if (m_opt.save_dem_weight >= 0 && (m_opt.first || m_opt.last ||
-					              m_opt.min || m_opt.max))
-              saved_weight(c, r) = (m_opt.save_dem_weight == dem_iter);
-
-            // In these cases, the saved weight will be 1 or 0, since either
-            // a given DEM gives it all, or nothing at all.
-            if (m_opt.save_index_map && (m_opt.first || m_opt.last ||
-				         m_opt.min || m_opt.max))
-              index_map(c, r) = dem_iter;
-
-          }else if (m_opt.mean){ // Mean --> Accumulate the value
-            tile(c, r) += val;
-            weights(c, r)++;
-
-            if (m_opt.save_dem_weight == dem_iter)
-              saved_weight(c, r) = 1;
-
-          }else if (m_opt.count){ // Count --> Increment the value
-            tile(c, r)++;
-            weights(c, r) += wt;
-          }else if (m_opt.stddev){ // Standard Deviation --> Keep running calculation
-            weights(c, r) += 1.0;
-            double curr_mean = tile_vec[0](c,r);
-            double delta     = val - curr_mean;
-            curr_mean     += delta / weights(c, r);
-            double newVal = tile(c, r) + delta*(val - curr_mean);
-            tile(c, r)    = newVal;
-            tile_vec[0](c,r) = curr_mean;
-          }else if (!noblend){ // Blending --> Weighted average
-            tile(c, r) += wt*val;
-            weights(c, r) += wt;
-            if (m_opt.save_dem_weight == dem_iter)
-              saved_weight(c, r) = wt;
-          }
+            // Update the output value according to the commanded mode
+            if ( ( m_opt.first && is_nodata)                        ||
+                 m_opt.last                                         ||
+                 ( m_opt.min && ( val < tile(c, r) || is_nodata ) ) ||
+                 ( m_opt.max && ( val > tile(c, r) || is_nodata ) ) ||
+                 m_opt.median || m_opt.priority_blending_len > 0    ||
+                       m_opt.block_max){
+              // --> Conditions where we replace the current value
+              tile   (c, r) = val;
+              weights(c, r) = wt;
+
+              // In these cases, the saved weight will be 1 or 0, since either
+              // a given DEM gives it all, or nothing at all.
+              if (m_opt.save_dem_weight >= 0 && (m_opt.first || m_opt.last ||
+                                                        m_opt.min || m_opt.max))
+                saved_weight(c, r) = (m_opt.save_dem_weight == dem_iter);
+
+              // In these cases, the saved weight will be 1 or 0, since either
+              // a given DEM gives it all, or nothing at all.
+              if (m_opt.save_index_map && (m_opt.first || m_opt.last ||
+                                           m_opt.min || m_opt.max))
+                index_map(c, r) = dem_iter;
+
+            }else if (m_opt.mean){ // Mean --> Accumulate the value
+              tile(c, r) += val;
+              weights(c, r)++;
+
+              if (m_opt.save_dem_weight == dem_iter)
+                saved_weight(c, r) = 1;
+
+            }else if (m_opt.count){ // Count --> Increment the value
+              tile(c, r)++;
+              weights(c, r) += wt;
+            }else if (m_opt.stddev){ // Standard Deviation --> Keep running calculation
+              weights(c, r) += 1.0;
+              double curr_mean = tile_vec[0](c,r);
+              double delta     = val - curr_mean;
+              curr_mean     += delta / weights(c, r);
+              double newVal = tile(c, r) + delta*(val - curr_mean);
+              tile(c, r)    = newVal;
+              tile_vec[0](c,r) = curr_mean;
+            }else if (!noblend){ // Blending --> Weighted average
+              tile(c, r) += wt*val;
+              weights(c, r) += wt;
+              if (m_opt.save_dem_weight == dem_iter)
+                saved_weight(c, r) = wt;
+            }
 
-        } // End col loop
-      } // End row loop
+          } // End col loop
+        } // End row loop
 
-      // For the median option, keep a copy of the output tile for each input DEM!
-      // Also do it for max per block.
-      // - This will be memory intensive. 
-      if (m_opt.median || m_opt.block_max) {
-        tile_vec.push_back(copy(tile));
-        dem_vec.push_back(dem_name);
-      }
+        if (m_opt.median)
+          median_selector.add(tile, m_opt.out_nodata_value);
+
+        // For max per block, keep this DEM if the sum of its values is
+        // the largest so far.
+        if (m_opt.block_max) {
+          double tile_sum = 0.0;
+          for (int c = 0; c < tile.cols(); c++) {
+            for (int r = 0; r < tile.rows(); r++) {
+              if (tile(c, r) != m_opt.out_nodata_value)
+                tile_sum += tile(c, r);
+            }
+          }
+          // The latter is useful later when inspecting the individual DEMs
+          vw_out(DebugMessage,"asp") << "\n" << dem_name << " sum: " << tile_sum << std::endl;
+          if (!has_block_max || tile_sum > block_max_sum) {
+            block_max_tile = copy(tile);
+            block_max_sum  = tile_sum;
+            has_block_max  = true;
+          }
+        }
       
-      // For priority blending, need also to keep all tiles, but also the weights
-      if (m_opt.priority_blending_len > 0){
-        tile_vec.push_back(copy(tile));
-        weight_vec.push_back(copy(weights));
-        clip2dem_index.push_back(dem_iter);
-      }
+        // For priority blending, need also to keep all tiles, but also the weights
+        if (m_opt.priority_blending_len > 0){
+          tile_vec.push_back(copy(tile));
+          weight_vec.push_back(copy(weights));
+          clip2dem_index.push_back(dem_iter);
+        }
+
+      } // End iterating over DEMs
 
-    } // End iterating over DEMs
+      another_pass = multi ? stats.end_pass() : (m_opt.median && median_selector.end_pass());
+    } // End passes over DEMs
 
     // Divide by the weights in blend, mean
     if (!noblend || m_opt.mean){
@@ -866,50 +1433,14 @@ public:
     } // End stddev case
 
     // For the median operation
-    if (m_opt.median){
-      // Init output pixels to nodata
-      fill( tile, m_opt.out_nodata_value );
-      vector<double> vals(tile_vec.size());
-      // Iterate through all pixels
-      for (int c = 0; c < bbox.width(); c++){
-        for (int r = 0; r < bbox.height(); r++){
-          // Compute the median for this pixel
-          vals.clear();
-          for (int i = 0; i < (int)tile_vec.size(); i++){
-            ImageView<double> & tile_ref = tile_vec[i];
-            if ( tile_ref(c, r) == m_opt.out_nodata_value )
-              continue;
-            vals.push_back(tile_ref(c, r));
-          }
-          if (!vals.empty()){
-            tile(c, r) = math::destructive_median(vals);
-          }
-        }// End row loop
-      } // End col loop
-    } // End median case
+    if (m_opt.median)
+      median_selector.median(tile, m_opt.out_nodata_value);
 
-    // For max per block, find the sum of values in each DEM
+    // For max per block, use the DEM with the largest sum of values
     if (m_opt.block_max) {
       fill( tile, m_opt.out_nodata_value );
-      int num_tiles = tile_vec.size();
-      if (tile_vec.size() != dem_vec.size()) 
-        vw_throw(ArgumentErr() << "Book-keeping error.\n");
-      std::vector<double> tile_sum(num_tiles, 0);
-      for (int i = 0; i < num_tiles; i++) {
-        for (int c = 0; c < tile_vec[i].cols(); c++) {
-          for (int r = 0; r < tile_vec[i].rows(); r++) {
-            if (tile_vec[i](c, r) != m_opt.out_nodata_value) {
-              tile_sum[i] += tile_vec[i](c, r);
-            }
-          }
-        }
-        // The latter is useful later when inspecting the individual DEMs
-        vw_out(DebugMessage,"asp") << "\n" << dem_vec[i] << " sum: " << tile_sum[i] << std::endl;
-      }
-      int max_index = std::distance(tile_sum.begin(),
-                                    std::max_element(tile_sum.begin(), tile_sum.end()));
-      if (max_index >= 0 && max_index < num_tiles) 
-        tile = copy(tile_vec[max_index]);
+      if (has_block_max)
+        tile = block_max_tile;
     }
     
     // For priority blending length.
@@ -1019,45 +1550,60 @@ public:
 
     } // end considering the priority blending length
 
-    // Fill-in no-data values a bit and blur. If just the blurring is used,
-    // it will choke on no-data values, leaving large holes around each,
-    // hence the need to fill a little.
-    if (m_opt.dem_blur_sigma > 0.0) {
-      int kernel_size = vw::compute_kernel_size(m_opt.dem_blur_sigma);
-      tile = apply_mask(gaussian_filter(fill_nodata_with_avg
-					(create_mask(tile, m_opt.out_nodata_value),
-					 kernel_size),
-					m_opt.dem_blur_sigma),
-			m_opt.out_nodata_value);
+    // With several statistics, the index map, if present, is the last
+    // tile, and it is not blurred or hole-filled.
+    int num_filtered = 1;
+    if (multi) {
+      stats.results(tiles);
+      num_filtered = int(tiles.size()) - int(m_opt.save_index_map);
+    } else {
+      tiles.assign(1, tile);
     }
+
+    for (int t = 0; t < num_filtered; t++) {
+
+      // Fill-in no-data values a bit and blur. If just the blurring is used,
+      // it will choke on no-data values, leaving large holes around each,
+      // hence the need to fill a little.
+      if (m_opt.dem_blur_sigma > 0.0) {
+        int kernel_size = vw::compute_kernel_size(m_opt.dem_blur_sigma);
+        tiles[t] = apply_mask(gaussian_filter(fill_nodata_with_avg
+                                              (create_mask(tiles[t], m_opt.out_nodata_value),
+                                               kernel_size),
+                                              m_opt.dem_blur_sigma),
+                              m_opt.out_nodata_value);
+      }
     
-    // Fill holes
-    if (m_opt.hole_fill_len > 0){
-      tile = apply_mask(vw::fill_holes_grass
-			   (create_mask(tile, m_opt.out_nodata_value),
-			    m_opt.hole_fill_len),
-			m_opt.out_nodata_value);
+      // Fill holes
+      if (m_opt.hole_fill_len > 0){
+        tiles[t] = apply_mask(asp::fill_holes_pyramid
+                              (create_mask(tiles[t], m_opt.out_nodata_value),
+                               m_opt.hole_fill_len, m_opt.hole_fill_method),
+                              m_opt.out_nodata_value);
+      }
     }
 
     // Save the weight instead
     if (m_opt.save_dem_weight >= 0)
-      tile = saved_weight;
+      tiles[0] = saved_weight;
 
     // Save the index map instead
-    if (m_opt.save_index_map)
-      tile = index_map;
+    if (m_opt.save_index_map && !multi)
+      tiles[0] = index_map;
 
 
-    // How many valid pixels are there in the tile
+    // How many valid pixels are there in the tile, in any of the statistics
     long long int num_valid_in_tile = 0;
-    for (int col = 0; col < tile.cols(); col++) {
-      for (int row = 0; row < tile.rows(); row++) {
+    for (int col = 0; col < bbox.width(); col++) {
+      for (int row = 0; row < bbox.height(); row++) {
         Vector2 pix = Vector2(col, row) + bbox.min();
         if (!orig_box.contains(pix))
           continue; // in case the box got expanded, ignore the padding
-        if (tile(col, row) == m_opt.out_nodata_value)
-          continue;
-        num_valid_in_tile++;
+        bool is_valid = false;
+        for (size_t t = 0; t < tiles.size(); t++)
+          is_valid = is_valid || (tiles[t](col, row) != m_opt.out_nodata_value);
+        if (is_valid)
+          num_valid_in_tile++;
       }
     }
     {
@@ -1068,7 +1614,7 @@ public:
 
     if (m_opt.first_dem_as_reference) {
       
-      if (first_dem.cols() != tile.cols() || first_dem.rows() != tile.rows()) {
+      if (first_dem.cols() != bbox.width() || first_dem.rows() != bbox.height()) {
         vw_throw(ArgumentErr() << "Book-keeping error when blending into first DEM.\n");
       }
 
@@ -1079,20 +1625,15 @@ public:
       bool fill_holes = true;
       centerline_weights(create_mask(first_dem, m_opt.out_nodata_value), local_wts,
                          BBox2(), fill_holes);
-      for (int col = 0; col < tile.cols(); col++) {
-        for (int row = 0; row < tile.rows(); row++) {
-          if (local_wts(col, row) == 0)
-            tile(col, row) = m_opt.out_nodata_value;
+      for (size_t t = 0; t < tiles.size(); t++) {
+        for (int col = 0; col < bbox.width(); col++) {
+          for (int row = 0; row < bbox.height(); row++) {
+            if (local_wts(col, row) == 0)
+              tiles[t](col, row) = m_opt.out_nodata_value;
+          }
         }
       }
     }
-    
-    // Return the tile we created with fake borders to make it look
-    // the size of the entire output image. So far we operated
-    // on doubles, here we cast to RealT.
-    return prerasterize_type(pixel_cast<RealT>(tile),
-			     -bbox.min().x(), -bbox.min().y(),
-			     cols(), rows() );
   }
 
   template <class DestT>
@@ -1101,6 +1642,94 @@ public:
   }
 }; // End class DemMosaicView
 
+/// All statistics of the mosaic, as the planes of one image, so that
+/// they are found together. The planes follow stat_names().
+class DemMosaicStatsView: public ImageViewBase<DemMosaicStatsView>{
+  DemMosaicView m_view;
+  int m_planes;
+
+public:
+  DemMosaicStatsView(DemMosaicView const& view, int planes):
+    m_view(view), m_planes(planes) {}
+
+  typedef RealT      pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemMosaicStatsView> pixel_accessor;
+  inline int cols  () const { return m_view.cols(); }
+  inline int rows  () const { return m_view.rows(); }
+  inline int planes() const { return m_planes; }
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DemMosaicStatsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i bbox) const {
+    std::vector< ImageView<double> > tiles;
+    m_view.prerasterize_tiles(bbox, tiles);
+    if ((int)tiles.size() != m_planes)
+      vw_throw(ArgumentErr() << "Book-keeping error in the number of statistics.\n");
+
+    ImageView<pixel_type> planes(bbox.width(), bbox.height(), m_planes);
+    for (int p = 0; p < m_planes; p++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++)
+          planes(col, row, p) = tiles[p](col, row);
+      }
+    }
+    return prerasterize_type(planes, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// Save a tile of the mosaic with the requested output type
+void save_tile(int block_size, std::string const& dem_tile,
+               ImageViewRef<RealT> const& out_dem, GeoReference const& crop_georef,
+               Options & opt, vw::ProgressCallback const& tpc) {
+  if (opt.output_type == "Float32") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile, out_dem, crop_georef,
+                                   opt.out_nodata_value, opt, tpc);
+  else if (opt.output_type == "Byte") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                   per_pixel_filter(out_dem, RoundAndClamp<uint8, RealT>()),
+                                   crop_georef,
+                                   vw::round_and_clamp<uint8>(opt.out_nodata_value),
+                                   opt, tpc);
+  else if (opt.output_type == "UInt16") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                   per_pixel_filter(out_dem, RoundAndClamp<uint16, RealT>()),
+                                   crop_georef,
+                                   vw::round_and_clamp<uint16>(opt.out_nodata_value),
+                                   opt, tpc);
+  else if (opt.output_type == "Int16") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                   per_pixel_filter(out_dem, RoundAndClamp<int16, RealT>()),
+                                   crop_georef,
+                                   vw::round_and_clamp<int16>(opt.out_nodata_value),
+                                   opt, tpc);
+  else if (opt.output_type == "UInt32") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                   per_pixel_filter(out_dem, RoundAndClamp<uint32, RealT>()),
+                                   crop_georef,
+                                   vw::round_and_clamp<uint32>(opt.out_nodata_value),
+                                   opt, tpc);
+  else if (opt.output_type == "Int32") 
+    asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                   per_pixel_filter(out_dem, RoundAndClamp<int32, RealT>()),
+                                   crop_georef,
+                                   vw::round_and_clamp<int32>(opt.out_nodata_value),
+                                   opt, tpc);
+  else
+    vw_throw( NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n" );
+}
+
 
 /// Find the bounding box of all DEMs in the projected space.
 /// - mosaic_bbox is the output bounding box in projected space
@@ -1195,6 +1824,144 @@ void load_dem_bounding_boxes(Options       const& opt,
   
 } // End function load_dem_bounding_boxes
 
+// The bounding boxes of the DEMs depend on the DEM files, the mosaic
+// georeference, and whether the first DEM is the reference. This
+// string identifies the latter two.
+std::string dem_bbox_cache_key(Options const& opt, GeoReference const& mosaic_georef){
+  std::ostringstream os;
+  os << mosaic_georef << " first_dem_as_reference " << opt.first_dem_as_reference;
+  std::string key = os.str();
+  std::replace(key.begin(), key.end(), '\n', ' ');
+  return key;
+}
+
+// The contents of a file written by write_dem_bbox_cache().
+struct DemBBoxCache {
+  std::string key;
+  std::vector<std::string>      files;
+  std::vector<boost::uintmax_t> sizes;
+  std::vector<long long int>    times;
+  std::vector<BBox2i>           pixel_bboxes;
+  std::vector<BBox2>            proj_bboxes;
+  BBox2                         mosaic_bbox;
+};
+
+// Parse a DEM bounding box cache. Return false if it does not exist
+// or cannot be parsed.
+bool parse_dem_bbox_cache(std::string const& cache_file, DemBBoxCache & cache) {
+
+  std::ifstream ifs(cache_file.c_str());
+  if (!ifs)
+    return false;
+
+  std::string line;
+  int num_dems = 0;
+  if (!std::getline(ifs, line) || line != "dem_mosaic bounding box cache 1" ||
+      !std::getline(ifs, cache.key) || !(ifs >> num_dems) || num_dems < 0)
+    return false;
+
+  cache.files.resize(num_dems);
+  cache.sizes.resize(num_dems);
+  cache.times.resize(num_dems);
+  cache.pixel_bboxes.resize(num_dems);
+  cache.proj_bboxes.resize(num_dems);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++){
+    Vector2i pmin, pmax;
+    Vector2  qmin, qmax;
+    ifs >> std::ws;
+    if (!std::getline(ifs, cache.files[dem_iter]) ||
+        !(ifs >> cache.sizes[dem_iter] >> cache.times[dem_iter]
+              >> pmin[0] >> pmin[1] >> pmax[0] >> pmax[1]
+              >> qmin[0] >> qmin[1] >> qmax[0] >> qmax[1]))
+      return false;
+    cache.pixel_bboxes[dem_iter] = BBox2i(pmin, pmax);
+    cache.proj_bboxes [dem_iter] = BBox2 (qmin, qmax);
+  }
+
+  Vector2 mmin, mmax;
+  if (!(ifs >> mmin[0] >> mmin[1] >> mmax[0] >> mmax[1]))
+    return false;
+  cache.mosaic_bbox = BBox2(mmin, mmax);
+
+  return true;
+}
+
+// If the given DEM is the same file, of the same size and
+// modification time, as the one with the given index in the cache.
+bool same_dem_as_cached(DemBBoxCache const& cache, int cache_index,
+                        std::string const& file) {
+  return (cache.files[cache_index] == file && fs::exists(file) &&
+          cache.sizes[cache_index] == fs::file_size(file) &&
+          cache.times[cache_index] == (long long int)fs::last_write_time(file));
+}
+
+// Read the bounding boxes of the DEMs saved by a previous run with
+// the same DEMs and mosaic georeference. Return false if the cache
+// does not exist or is out of date.
+bool read_dem_bbox_cache(Options       const& opt,
+                         GeoReference  const& mosaic_georef,
+                         BBox2              & mosaic_bbox,
+                         std::vector<BBox2> & dem_proj_bboxes,
+                         std::vector<BBox2i> & dem_pixel_bboxes) {
+
+  DemBBoxCache cache;
+  if (!parse_dem_bbox_cache(opt.dem_bbox_cache, cache) ||
+      cache.key != dem_bbox_cache_key(opt, mosaic_georef) ||
+      cache.files.size() != opt.dem_files.size())
+    return false;
+
+  for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
+    if (!same_dem_as_cached(cache, dem_iter, opt.dem_files[dem_iter]))
+      return false;
+  }
+
+  vw_out() << "Read the bounding boxes of the input DEMs from: "
+           << opt.dem_bbox_cache << "\n";
+  mosaic_bbox      = cache.mosaic_bbox;
+  dem_proj_bboxes  = cache.proj_bboxes;
+  dem_pixel_bboxes = cache.pixel_bboxes;
+  return true;
+}
+
+// Save the bounding boxes of the DEMs, for read_dem_bbox_cache().
+void write_dem_bbox_cache(Options       const& opt,
+                          GeoReference  const& mosaic_georef,
+                          BBox2         const& mosaic_bbox,
+                          std::vector<BBox2>  const& dem_proj_bboxes,
+                          std::vector<BBox2i> const& dem_pixel_bboxes) {
+
+  vw_out() << "Writing the bounding boxes of the input DEMs to: "
+           << opt.dem_bbox_cache << "\n";
+
+  // Write to a temporary file first, so that an interrupted run, or
+  // another process reading the cache, does not see a partial one.
+  std::string tmp_file = opt.dem_bbox_cache + ".tmp";
+  std::ofstream ofs(tmp_file.c_str());
+  if (!ofs)
+    vw_throw( IOErr() << "Unable to open file \"" << tmp_file << "\"" );
+  ofs.precision(17);
+
+  ofs << "dem_mosaic bounding box cache 1\n";
+  ofs << dem_bbox_cache_key(opt, mosaic_georef) << "\n";
+  ofs << opt.dem_files.size() << "\n";
+  for (size_t dem_iter = 0; dem_iter < opt.dem_files.size(); dem_iter++){
+    std::string const& file = opt.dem_files[dem_iter];
+    BBox2i const& p = dem_pixel_bboxes[dem_iter];
+    BBox2  const& q = dem_proj_bboxes [dem_iter];
+    ofs << file << "\n"
+        << fs::file_size(file) << " " << (long long int)fs::last_write_time(file) << " "
+        << p.min()[0] << " " << p.min()[1] << " " << p.max()[0] << " " << p.max()[1] << " "
+        << q.min()[0] << " " << q.min()[1] << " " << q.max()[0] << " " << q.max()[1] << "\n";
+  }
+  ofs << mosaic_bbox.min()[0] << " " << mosaic_bbox.min()[1] << " "
+      << mosaic_bbox.max()[0] << " " << mosaic_bbox.max()[1] << "\n";
+  ofs.close();
+
+  if (!ofs)
+    vw_throw( IOErr() << "Failed writing file \"" << tmp_file << "\"" );
+  fs::rename(tmp_file, opt.dem_bbox_cache);
+}
+
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
@@ -1215,6 +1982,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	   "If positive, keep unmodified values from the earliest available DEM at the current location except a band this wide measured in pixels around its boundary where blending will happen.")
     ("hole-fill-length",   po::value(&opt.hole_fill_len)->default_value(0),
 	   "Maximum dimensions of a hole in the output DEM to fill in, in pixels.")
+    ("hole-fill-method",   po::value(&opt.hole_fill_method_str)->default_value("push-pull"),
+	   "How to fill the holes: 'push-pull' (pyramid interpolation, fastest) or 'laplace' (the smoothest surface through the hole boundary, starting from the push-pull result).")
     ("tr",              po::value(&opt.tr),
 	   "Output DEM resolution in target georeferenced units per pixel. Default: use the same resolution as the first DEM to be mosaicked.")
     ("t_srs",           po::value(&opt.target_srs_string)->default_value(""),
@@ -1234,7 +2003,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("stddev",    po::bool_switch(&opt.stddev)->default_value(false),
 	   "Find the standard deviation of the DEM values.")
     ("median",  po::bool_switch(&opt.median)->default_value(false),
-	   "Find the median DEM value (this can be memory-intensive, fewer threads are suggested).")
+	   "Find the median DEM value. The overlapping DEMs are read a few times, with memory use not growing with their number.")
     ("count",   po::bool_switch(&opt.count)->default_value(false),
      "Each pixel is set to the number of valid DEM heights at that pixel.")
     ("block-max", po::bool_switch(&opt.block_max)->default_value(false),
@@ -1268,6 +2037,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "The output DEM will have the same size, grid, and georeference as this one, but it will not be used in the mosaic.")
     ("save-index-map",   po::bool_switch(&opt.save_index_map)->default_value(false),
      "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, and --max). A text file with the index assigned to each input DEM is saved as well.")
+    ("dem-bbox-cache",   po::value(&opt.dem_bbox_cache)->default_value(""),
+     "Save the bounding boxes of the input DEMs to this file, and read them from it on later runs with the same DEMs and output georeference, rather than opening each DEM again.")
+    ("update", po::bool_switch(&opt.update)->default_value(false),
+     "Create only the output tiles which intersect DEMs that were added, removed, or modified since the previous run which wrote --dem-bbox-cache. The output extent (see --t_projwin), resolution, and tile size must stay the same.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output tiles as Cloud-Optimized GeoTIFF files, with overviews. Needs GDAL 3.1 or newer.")
+    ("status-file",      po::value(&opt.status_file)->default_value(""),
+     "Keep in this JSON file the tile being written, the progress, the ETA, and the resource use. It is replaced atomically, so it can be read at any time.")
+    ("max-open-files",   po::value<int>(&opt.max_open_files)->default_value(0),
+     "The maximum number of input DEMs to keep open at the same time. The least recently used ones are closed when there are more. Default: half of the limit on open files for this process.")
+    ("dem-cache-size",   po::value(&opt.dem_cache_size)->default_value(0),
+     "Keep up to this many MB of blocks of the input DEMs, to reuse them for the neighboring output tiles, which read overlapping regions, instead of reading them again. The default is to not keep them.")
     ("threads",             po::value<int>(&opt.num_threads)->default_value(4),
 	   "Number of threads to use.")
     ("help,h", "Display this help message.");
@@ -1296,9 +2077,26 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.extra_crop_len < 0)
     vw_throw(ArgumentErr() << "The blending length must not be negative.\n"
 			   << usage << general_options );
+  if (opt.update && opt.dem_bbox_cache == "")
+    vw_throw(ArgumentErr() << "The --update option requires --dem-bbox-cache.\n"
+			   << usage << general_options );
+  if (opt.status_file != "")
+    asp::set_progress_status_file(opt.status_file, "dem_mosaic");
+  if (opt.max_open_files < 0)
+    vw_throw(ArgumentErr() << "The maximum number of open files must not be negative.\n"
+			   << usage << general_options );
+  if (opt.max_open_files == 0) {
+    // Leave room for the other files which GDAL and the output need
+    struct rlimit limit;
+    opt.max_open_files = 500; // if there is no limit, or it cannot be found
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+      opt.max_open_files = std::max(int(limit.rlim_cur/2), 1);
+  }
+  asp::set_tile_cache_budget("dem", opt.dem_cache_size);
   if (opt.hole_fill_len < 0)
     vw_throw(ArgumentErr() << "The hole fill length must not be negative.\n"
 			   << usage << general_options );
+  opt.hole_fill_method = asp::parse_hole_fill_method(opt.hole_fill_method_str);
   if (opt.tile_size <= 0)
     vw_throw(ArgumentErr() << "The size of a tile in pixels must be positive.\n"
 			   << usage << general_options );
@@ -1310,11 +2108,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // If priority blending is used, need to adjust extra_crop_len accordingly
   opt.extra_crop_len = std::max(opt.extra_crop_len, 3*opt.priority_blending_len);
 
-  // Make sure no more than one of these options is enabled.
+  // Several of these options can be enabled, then each is saved to
+  // its own file, except for --block-max, which works by itself.
   int noblend = no_blend(opt);
-  if (noblend > 1)
-    vw_throw(ArgumentErr() << "At most one of the options --first, --last, "
-	     << "--min, --max, -mean, --stddev, --median, --count can be specified.\n"
+  if (noblend > 1 && opt.block_max)
+    vw_throw(ArgumentErr() << "The option --block-max cannot be used with "
+	     << "--first, --last, --min, --max, -mean, --stddev, --median, --count.\n"
 	     << usage << general_options );
 
   if (opt.geo_tile_size < 0)
@@ -1346,6 +2145,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	     << "--first, --last, --min, --max is invoked.\n"
 	     << usage << general_options );
 
+  if (noblend > 1 && opt.save_dem_weight >= 0)
+    vw_throw(ArgumentErr()
+	     << "Cannot save the weights when finding several statistics.\n"
+	     << usage << general_options );
+
+  if (noblend > 1 && opt.save_index_map &&
+      int(opt.first) + int(opt.last) + int(opt.min) + int(opt.max) != 1)
+    vw_throw(ArgumentErr()
+	     << "When finding several statistics, an index map can be saved only "
+	     << "with exactly one of --first, --last, --min, --max.\n"
+	     << usage << general_options );
+
   if (opt.save_dem_weight >= 0 && opt.save_index_map)
     vw_throw(ArgumentErr()
 	     << "Cannot save both the index map and the DEM weights at the same time.\n"
@@ -1551,8 +2362,34 @@ int main( int argc, char *argv[] ) {
     BBox2 mosaic_bbox;
     vector<BBox2> dem_proj_bboxes;
     vector<BBox2i> dem_pixel_bboxes, loaded_dem_pixel_bboxes;
-    load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
-                            dem_proj_bboxes, dem_pixel_bboxes);
+
+    // In update mode, the cache written by the previous run tells
+    // which DEMs changed since then. It is overwritten only once the
+    // changed tiles are written.
+    DemBBoxCache prev_cache;
+    bool have_prev_cache = false;
+    if (opt.update) {
+      have_prev_cache = (parse_dem_bbox_cache(opt.dem_bbox_cache, prev_cache) &&
+                         prev_cache.key == dem_bbox_cache_key(opt, mosaic_georef));
+      if (!have_prev_cache)
+        vw_out(WarningMessage) << "Could not find the bounding boxes of the DEMs from a "
+                               << "previous run with the same output georeference in: "
+                               << opt.dem_bbox_cache << ". All tiles will be created.\n";
+    }
+
+    if (opt.dem_bbox_cache == "" ||
+        !read_dem_bbox_cache(opt, mosaic_georef, mosaic_bbox,
+                             dem_proj_bboxes, dem_pixel_bboxes)) {
+      load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
+                              dem_proj_bboxes, dem_pixel_bboxes);
+      if (opt.dem_bbox_cache != "" && !opt.update)
+        write_dem_bbox_cache(opt, mosaic_georef, mosaic_bbox,
+                             dem_proj_bboxes, dem_pixel_bboxes);
+    }
+
+    // Keep the boxes before they are cropped, to write them later.
+    BBox2 full_mosaic_bbox = mosaic_bbox;
+    vector<BBox2> full_dem_proj_bboxes = dem_proj_bboxes;
 
     if (opt.projwin != BBox2()) {
       // If to create the mosaic only in a given region
@@ -1644,14 +2481,89 @@ int main( int argc, char *argv[] ) {
       tile_pixel_bboxes.push_back(tile_box);
     }
 
+    // In update mode, create only the tiles which intersect DEMs that
+    // were added, removed, or modified since the previous run. They
+    // are created in full, so they are the same as with a full run.
+    if (opt.update && have_prev_cache) {
+
+      BBox2 prev_mosaic_bbox = prev_cache.mosaic_bbox;
+      if (opt.projwin != BBox2())
+        prev_mosaic_bbox.crop(opt.projwin);
+
+      if (prev_mosaic_bbox != mosaic_bbox) {
+        vw_out(WarningMessage) << "The extent of the mosaic changed since the previous "
+                               << "run, so all tiles will be created. Use --t_projwin "
+                               << "to keep it fixed.\n";
+      }else{
+
+        // The boxes of the DEMs which changed, in the old and new versions
+        std::map<std::string, int> prev_index;
+        for (int i = 0; i < (int)prev_cache.files.size(); i++)
+          prev_index[prev_cache.files[i]] = i;
+        std::vector<bool>  prev_seen(prev_cache.files.size(), false);
+        std::vector<BBox2> changed_boxes;
+        for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
+          std::map<std::string, int>::const_iterator it
+            = prev_index.find(opt.dem_files[dem_iter]);
+          if (it != prev_index.end()) {
+            prev_seen[it->second] = true;
+            if (same_dem_as_cached(prev_cache, it->second, opt.dem_files[dem_iter]))
+              continue;
+            changed_boxes.push_back(prev_cache.proj_bboxes[it->second]);
+          }
+          changed_boxes.push_back(dem_proj_bboxes[dem_iter]);
+        }
+        for (size_t i = 0; i < prev_seen.size(); i++) {
+          if (!prev_seen[i])
+            changed_boxes.push_back(prev_cache.proj_bboxes[i]); // a removed DEM
+        }
+
+        // A DEM can change the mosaic somewhat beyond its boundary,
+        // due to hole-filling and blurring.
+        double pad = std::abs(spacing)*(bias + vw::compute_kernel_size(opt.dem_blur_sigma) + 1);
+        for (size_t i = 0; i < changed_boxes.size(); i++)
+          changed_boxes[i].expand(pad);
+
+        std::set<int> update_tiles;
+        for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
+          if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end())
+            continue;
+          BBox2 tile_proj_box
+            = mosaic_georef.pixel_to_point_bbox(tile_pixel_bboxes[tile_id - start_tile]);
+          for (size_t i = 0; i < changed_boxes.size(); i++) {
+            if (tile_proj_box.intersects(changed_boxes[i])) {
+              update_tiles.insert(tile_id);
+              break;
+            }
+          }
+        }
+
+        vw_out() << "Number of tiles to update: " << update_tiles.size() << ".\n";
+        if (update_tiles.empty()) {
+          write_dem_bbox_cache(opt, mosaic_georef, full_mosaic_bbox,
+                               full_dem_proj_bboxes, dem_pixel_bboxes);
+          return 0;
+        }
+        opt.tile_list = update_tiles;
+      }
+    }
+
     // Store the no-data values, pointers to images, and georeferences (for speed).
     vw_out() << "Reading the input DEMs.\n";
     vector<double>          nodata_values;
     vector<GeoReference>    georefs;
     std::vector<string>     loaded_dems;
-    DiskImageManager<RealT> imgMgr;
+    DemHandleCache          imgMgr;
+    imgMgr.set_max_open(opt.max_open_files);
+    asp::TileCache<double>  dem_cache("dem", 256);
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
+
+    // The footprints of the loaded DEMs in the mosaic, to quickly find
+    // which DEMs a tile needs. They are grown by as much as a tile may
+    // read beyond the DEM boundary.
+    int footprint_pad = bias + BilinearInterpolation::pixel_buffer + 2;
+    std::vector<asp::BBoxPair> dem_footprints;
     
     // Loop through all DEMs
     for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
@@ -1688,21 +2600,25 @@ int main( int argc, char *argv[] ) {
       BBox2 curr_box = geotrans.forward_bbox(dem_pixel_box);
       curr_box.crop(output_dem_box);
 
-      // This is a fix for GDAL crashing when there are too many open
-      // file handles. In such situation, just selectively close the
-      // handles furthest from the current location.
-      imgMgr.add_file_handle_not_thread_safe(opt.dem_files[dem_iter], curr_box);
+      BBox2i grown_dem_box = dem_pixel_box;
+      grown_dem_box.expand(footprint_pad);
+      BBox2 footprint = geotrans.forward_bbox(grown_dem_box);
+      footprint.expand(1);
+      if (footprint.empty()) {
+        // Could not find the footprint, so let this DEM be checked
+        // against every tile.
+        footprint = BBox2(output_dem_box);
+        footprint.expand(footprint_pad);
+      }
+
+      // The DEM is opened when a tile first needs it. The number of
+      // DEMs kept open is bounded, to avoid GDAL crashing when there
+      // are too many open file handles.
+      imgMgr.add_file(opt.dem_files[dem_iter]);
       
       double curr_nodata_value = opt.out_nodata_value;
-      try {
-        // Get the nodata-value. Need a try block, in case we can't
-        // open more handles.
-        DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-        if ( in_rsrc.has_nodata_read() )
-          curr_nodata_value = RealT(in_rsrc.nodata_read());
-      }catch(std::exception const& e){
-        // Try again
-        imgMgr.freeup_handles_not_thread_safe();
+      {
+        // Get the nodata-value. No other DEM is open at this point.
         DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
         if ( in_rsrc.has_nodata_read() )
           curr_nodata_value = RealT(in_rsrc.nodata_read());
@@ -1717,8 +2633,12 @@ int main( int argc, char *argv[] ) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      dem_footprints.push_back(asp::BBoxPair(mosaic_box_to_3d(footprint), dem_pixel_box));
     } // End loop through DEM files
 
+    asp::BBoxPairTree dem_tree;
+    dem_tree.build(dem_footprints);
+
     // If there are 17 tiles, let them be tile-00, ..., tile-16.
     int num_digits = 1;
     int tens = 10;
@@ -1750,65 +2670,78 @@ int main( int argc, char *argv[] ) {
       long long int num_valid_pixels; // Will be populated when saving to disk
       vw::Mutex count_mutex; // to lock when updating num_valid_pixels
 
-      ImageViewRef<RealT> out_dem
-        = crop(DemMosaicView(cols, rows, bias, opt,
-                             imgMgr, georefs,
-                             mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
-                             num_valid_pixels, count_mutex),
-               tile_box);
+      DemMosaicView mosaic(cols, rows, bias, opt,
+                           imgMgr, georefs,
+                           mosaic_georef, nodata_values,
+                           loaded_dem_pixel_bboxes, dem_tree,
+                           num_valid_pixels, count_mutex, dem_cache);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
 				      tile_box.min().y());
+      std::ostringstream stage;
+      stage << "Tile " << tile_id << " of " << num_tiles;
+      asp::StatusProgressCallback tpc("asp", "\t--> ", stage.str());
+
+      // The files to write
+      std::vector<std::string> tile_files;
+      std::vector< ImageViewRef<RealT> > tile_images;
+      std::string stats_file;
+      if (!multi_stats(opt)) {
+        tile_files.push_back(dem_tile);
+        tile_images.push_back(crop(mosaic, tile_box));
+      } else {
+        // Find all statistics with one pass over the DEMs, into a
+        // temporary file with one plane each, then save each plane.
+        std::vector<std::string> names = stat_names(opt);
+        stats_file = dem_tile.substr(0, dem_tile.size() - 4) + "-stats-tmp.tif";
+        vw_out() << "Writing: " << stats_file << std::endl;
+        Vector2 orig_block_size = opt.raster_tile_size;
+        opt.raster_tile_size = Vector2(block_size, block_size);
+        block_write_gdal_image(stats_file,
+                               crop(DemMosaicStatsView(mosaic, names.size()), tile_box),
+                               true, crop_georef, true, opt.out_nodata_value, opt, tpc);
+        opt.raster_tile_size = orig_block_size;
+
+        DiskImageView<RealT> stats(stats_file);
+        for (size_t s = 0; s < names.size(); s++) {
+          tile_files.push_back(stat_file(dem_tile, names[s]));
+          tile_images.push_back(select_plane(stats, s));
+        }
+      }
 
-      // Raster the tile to disk. Optionally cast to int (may be
-      // useful for mosaicking ortho images).
-      vw_out() << "Writing: " << dem_tile << std::endl;
-      TerminalProgressCallback tpc("asp", "\t--> ");
-      if (opt.output_type == "Float32") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile, out_dem, crop_georef,
-                                       opt.out_nodata_value, opt, tpc);
-      else if (opt.output_type == "Byte") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile,
-				       per_pixel_filter(out_dem, RoundAndClamp<uint8, RealT>()),
-                                       crop_georef,
-                                       vw::round_and_clamp<uint8>(opt.out_nodata_value),
-                                       opt, tpc);
-      else if (opt.output_type == "UInt16") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile,
-				       per_pixel_filter(out_dem, RoundAndClamp<uint16, RealT>()),
-                                       crop_georef,
-                                       vw::round_and_clamp<uint16>(opt.out_nodata_value),
-                                       opt, tpc);
-      else if (opt.output_type == "Int16") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile,
-				       per_pixel_filter(out_dem, RoundAndClamp<int16, RealT>()),
-                                       crop_georef,
-                                       vw::round_and_clamp<int16>(opt.out_nodata_value),
-                                       opt, tpc);
-      else if (opt.output_type == "UInt32") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile,
-				       per_pixel_filter(out_dem, RoundAndClamp<uint32, RealT>()),
-                                       crop_georef,
-                                       vw::round_and_clamp<uint32>(opt.out_nodata_value),
-                                       opt, tpc);
-      else if (opt.output_type == "Int32") 
-        asp::save_with_temp_big_blocks(block_size, dem_tile,
-				       per_pixel_filter(out_dem, RoundAndClamp<int32, RealT>()),
-                                       crop_georef,
-                                       vw::round_and_clamp<int32>(opt.out_nodata_value),
-                                       opt, tpc);
-      else
-        vw_throw( NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n" );
+      // Raster the tiles to disk. Optionally cast to int (may be
+      // useful for mosaicking ortho images). With several statistics,
+      // the tiles are empty if no valid pixels were found above.
+      for (size_t t = 0; t < tile_files.size(); t++) {
+        if (!stats_file.empty() && num_valid_pixels == 0)
+          break;
+        vw_out() << "Writing: " << tile_files[t] << std::endl;
+        save_tile(block_size, tile_files[t], tile_images[t], crop_georef, opt, tpc);
+      }
+      tile_images.clear(); // close the temporary file before removing it
+      if (!stats_file.empty())
+        boost::filesystem::remove(stats_file);
 
       vw_out() << "Number of valid (not no-data) pixels written: " << num_valid_pixels
                << "."<< std::endl;
-      if (num_valid_pixels == 0) {
-        vw_out() << "Removing tile with no valid pixels: " << dem_tile << std::endl;
-        boost::filesystem::remove(dem_tile);
+      for (size_t t = 0; t < tile_files.size(); t++) {
+        if (num_valid_pixels == 0) {
+          if (!fs::exists(tile_files[t]))
+            continue;
+          vw_out() << "Removing tile with no valid pixels: " << tile_files[t] << std::endl;
+          boost::filesystem::remove(tile_files[t]);
+        } else if (opt.cog) {
+          TerminalProgressCallback cog_tpc("asp", "\t--> ");
+          asp::convert_to_cog(tile_files[t], opt, cog_tpc);
+        }
       }
       
     } // End loop through tiles
 
+    // Now that the tiles are up to date, save the boxes for the next update
+    if (opt.update)
+      write_dem_bbox_cache(opt, mosaic_georef, full_mosaic_bbox,
+                           full_dem_proj_bboxes, dem_pixel_bboxes);
+
     // Write the name of each DEM file that was used together with its index
     if (opt.save_index_map) {
       std::string index_map = opt.out_prefix + "-index-map.txt";
@@ -1819,6 +2752,8 @@ int main( int argc, char *argv[] ) {
       }
     }
 
+    asp::report_tile_cache_stats();
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -31,12 +31,22 @@
 
 #include <stdlib.h>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/Image.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/IntegerImage.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <boost/scoped_ptr.hpp>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal_priv.h>
+#endif
+
 using namespace vw;
 using namespace vw::stereo;
 
@@ -48,6 +58,10 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string input_file_name;
   BBox2       normalization_range;
   BBox2       roi;    ///< Only generate output images in this region
+  std::string compare_file; ///< Compare with this disparity instead
+  double      compare_threshold;
+  double      normalization_percentile; ///< Normalize to these percentiles, if positive
+  bool        quick_look, no_overviews;
 
   // Output
   std::string output_prefix, output_file_type;
@@ -61,7 +75,17 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("roi", po::value(&opt.roi)->default_value(BBox2(0,0,0,0), "auto"),
      "Region of interest. Specify in format: xmin,ymin,xmax,ymax.")
     ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.")
-    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.");
+    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.")
+    ("compare", po::value(&opt.compare_file)->default_value(""),
+     "Instead of making the debug images, print how much the input disparity differs from this one, for example one found with preprocessed-image-bits, and one found with float images.")
+    ("compare-threshold", po::value(&opt.compare_threshold)->default_value(1.0),
+     "With --compare, count the pixels whose disparities differ by more than this many pixels.")
+    ("normalization-percentile", po::value(&opt.normalization_percentile)->default_value(0.0),
+     "If positive, normalize each channel to the range from this percentile of its values to 100 minus it, rather than from the smallest to the largest value, so that outliers do not wash out the images.")
+    ("quick-look", po::bool_switch(&opt.quick_look)->default_value(false),
+     "Only print the statistics of the disparity found from a sparse lattice of its tiles, without writing any images.")
+    ("no-overviews", po::bool_switch(&opt.no_overviews)->default_value(false),
+     "Do not add reduced-resolution overviews to the output images, which are added by default for the tif file type.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -84,6 +108,160 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
               << usage << general_options );
   if ( opt.output_prefix.empty() )
     opt.output_prefix = vw::prefix_from_filename(opt.input_file_name);
+  if ( opt.normalization_percentile < 0 || opt.normalization_percentile >= 50 )
+    vw_throw( ArgumentErr() << "The normalization percentile must be in [0, 50).\n" );
+}
+
+// Tiles on a lattice with about this many of them are read to find the
+// statistics of the disparity before writing the images.
+const int NUM_SAMPLE_TILES = 64;
+
+/// Mergeable statistics of the two channels of the valid disparities:
+/// their ranges, and sketches of their distributions for the
+/// percentiles. Those of separate tiles are merged.
+struct DisparityStats {
+  vw::uint64          count;
+  BBox2               range;
+  asp::QuantileSketch positive[2], negative[2];
+  vw::uint64          zeros[2];
+
+  DisparityStats(): count(0) { zeros[0] = zeros[1] = 0; }
+
+  void add(Vector2 const& d) {
+    count++;
+    range.grow(d);
+    for (int c = 0; c < 2; c++) {
+      if (d[c] > 0)      positive[c].add(d[c]);
+      else if (d[c] < 0) negative[c].add(-d[c]);
+      else               zeros[c]++;
+    }
+  }
+
+  void merge(DisparityStats const& other) {
+    count += other.count;
+    range.grow(other.range);
+    for (int c = 0; c < 2; c++) {
+      positive[c].merge(other.positive[c]);
+      negative[c].merge(other.negative[c]);
+      zeros[c] += other.zeros[c];
+    }
+  }
+
+  /// The value of a channel below which are pct percent of the values
+  double percentile(int c, double pct) const {
+    double n_neg = negative[c].count(), n_zero = zeros[c], n_pos = positive[c].count();
+    double k = pct/100.0*(n_neg + n_zero + n_pos);
+    if (k < n_neg)
+      return -negative[c].quantile(std::max(0.0, 1.0 - k/n_neg));
+    if (k < n_neg + n_zero || n_pos == 0)
+      return 0.0;
+    return positive[c].quantile(std::min(1.0, (k - n_neg - n_zero)/n_pos));
+  }
+
+  /// The normalization range, of all the values if pct is 0, or
+  /// else from the pct percentile to the 100 - pct one.
+  BBox2 normalization_range(double pct) const {
+    if (pct <= 0)
+      return range;
+    return BBox2(Vector2(percentile(0, pct),       percentile(1, pct)),
+                 Vector2(percentile(0, 100 - pct), percentile(1, 100 - pct)));
+  }
+
+  void print(std::ostream & os) const {
+    os << "\t    Valid pixels: " << count << "\n";
+    if (count == 0)
+      return;
+    const char * names[2] = {"Horizontal", "Vertical"};
+    for (int c = 0; c < 2; c++)
+      os << "\t    " << names[c] << ": min " << range.min()[c] << ", 2% " << percentile(c, 2)
+         << ", median " << percentile(c, 50) << ", 98% " << percentile(c, 98)
+         << ", max " << range.max()[c] << "\n";
+  }
+};
+
+/// A channel of a disparity normalized as the debug images show it
+inline uint8 normalize_channel(double v, double lo, double hi) {
+  double u = (hi > lo) ? (v - lo)/(hi - lo) : 0.0;
+  u = std::max(0.0, std::min(1.0, u));
+  return uint8(std::floor(u*255.0 + 0.5));
+}
+
+/// Read a tile of the disparity once, add its valid pixels to the
+/// statistics, and, if given resources, write the normalized horizontal
+/// and vertical images of the tile to them.
+template <class PixelT>
+class DisparityTileTask: public Task, private boost::noncopyable {
+  ImageViewRef<PixelT> m_disparity;
+  BBox2i               m_bbox;
+  BBox2                m_norm;
+  DiskImageResource  * m_h_rsrc, * m_v_rsrc;
+  DisparityStats     & m_stats;
+  Mutex              & m_mutex;
+  ProgressCallback const& m_progress;
+  int                & m_num_done;
+  int                  m_num_tiles;
+public:
+  DisparityTileTask(ImageViewRef<PixelT> const& disparity, BBox2i const& bbox, BBox2 const& norm,
+                    DiskImageResource * h_rsrc, DiskImageResource * v_rsrc,
+                    DisparityStats & stats, Mutex & mutex,
+                    ProgressCallback const& progress, int & num_done, int num_tiles):
+    m_disparity(disparity), m_bbox(bbox), m_norm(norm), m_h_rsrc(h_rsrc), m_v_rsrc(v_rsrc),
+    m_stats(stats), m_mutex(mutex), m_progress(progress), m_num_done(num_done),
+    m_num_tiles(num_tiles) {}
+
+  void operator()() {
+    ImageView<PixelT> tile = crop(m_disparity, m_bbox);
+    bool write = (m_h_rsrc != NULL);
+    ImageView<uint8> h_tile, v_tile;
+    if (write) {
+      h_tile.set_size(tile.cols(), tile.rows());
+      v_tile.set_size(tile.cols(), tile.rows());
+    }
+    DisparityStats stats;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        bool valid = is_valid(tile(col, row));
+        Vector2 d = remove_mask(tile(col, row));
+        if (valid)
+          stats.add(d);
+        if (!write)
+          continue;
+        h_tile(col, row) = valid ? normalize_channel(d[0], m_norm.min().x(), m_norm.max().x()) : 0;
+        v_tile(col, row) = valid ? normalize_channel(d[1], m_norm.min().y(), m_norm.max().y()) : 0;
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    m_stats.merge(stats);
+    if (write) {
+      m_h_rsrc->write(h_tile.buffer(), m_bbox);
+      m_v_rsrc->write(v_tile.buffer(), m_bbox);
+    }
+    m_num_done++;
+    m_progress.report_fractional_progress(m_num_done, m_num_tiles);
+  }
+};
+
+/// Add reduced-resolution overviews to a tif image, halving it until
+/// it fits in a tile.
+void build_overviews(std::string const& file) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  GDALAllRegister();
+  GDALDataset* dataset = static_cast<GDALDataset*>(GDALOpen(file.c_str(), GA_Update));
+  if (dataset == NULL) {
+    vw_out(WarningMessage) << "Could not add overviews to: " << file << "\n";
+    return;
+  }
+  std::vector<int> levels;
+  for (int level = 2; std::max(dataset->GetRasterXSize(), dataset->GetRasterYSize())/level >= 256;
+       level *= 2)
+    levels.push_back(level);
+  if (!levels.empty() &&
+      dataset->BuildOverviews("AVERAGE", levels.size(), &levels[0], 0, NULL,
+                              GDALDummyProgress, NULL) != CE_None)
+    vw_out(WarningMessage) << "Could not add overviews to: " << file << "\n";
+  GDALClose(dataset);
+#endif
 }
 
 template <class PixelT>
@@ -95,72 +273,148 @@ void do_disparity_visualization(Options& opt) {
   bool has_nodata = false;
   float output_nodata = -32768.0;
 
-  vw_out() << "\t--> Computing disparity range \n";
-
   // If no ROI passed in, use the full image
-  BBox2 roiToUse(opt.roi);
+  BBox2i roiToUse(opt.roi.min().x(), opt.roi.min().y(), opt.roi.width(), opt.roi.height());
   if ( opt.roi == BBox2(0,0,0,0) )
-    roiToUse = BBox2(0,0,disk_disparity_map.cols(),disk_disparity_map.rows());
+    roiToUse = BBox2i(0,0,disk_disparity_map.cols(),disk_disparity_map.rows());
 
   if (has_georef)
     georef = crop(georef, roiToUse);
 
-  // We don't want to sample every pixel as the image might be very
-  // large. Let's subsample the image so that it is rough 1000x1000 samples.
-  float subsample_amt =
-    float(roiToUse.height())*float(roiToUse.width()) / ( 1000.f * 1000.f );
+  ImageViewRef<PixelT> disparity = crop(disk_disparity_map, roiToUse);
+  int num_threads = vw_settings().default_num_threads();
+  Mutex mutex;
 
-  // Compute intensity display range if not passed in
-  if ( opt.normalization_range == BBox2(0,0,0,0) )
-    opt.normalization_range =
-      get_disparity_range(subsample(crop(disk_disparity_map, roiToUse),
-                                    subsample_amt > 1 ? subsample_amt : 1));
+  // Find the statistics from the tiles of the disparity on a lattice,
+  // so that only a small part of it is read. The tiles are those of the
+  // file, so that each is read at once.
+  if ( opt.quick_look || opt.normalization_range == BBox2(0,0,0,0) ) {
+    vw_out() << "\t--> Computing disparity range \n";
+    Vector2i tile_size;
+    {
+      boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(opt.input_file_name));
+      tile_size = rsrc->block_read_size();
+    }
+    tile_size = Vector2i(std::min(std::max(tile_size.x(), 16), disparity.cols()),
+                         std::min(std::max(tile_size.y(), 16), disparity.rows()));
+    int num_tiles_x = (disparity.cols() + tile_size.x() - 1)/tile_size.x();
+    int num_tiles_y = (disparity.rows() + tile_size.y() - 1)/tile_size.y();
+    int stride = std::max(1, int(std::ceil(std::sqrt(double(num_tiles_x)*num_tiles_y
+                                                      /NUM_SAMPLE_TILES))));
+    std::vector<BBox2i> tiles;
+    for (int ty = stride/2; ty < num_tiles_y; ty += stride) {
+      for (int tx = stride/2; tx < num_tiles_x; tx += stride) {
+        BBox2i bbox(tx*tile_size.x(), ty*tile_size.y(), tile_size.x(), tile_size.y());
+        bbox.crop(bounding_box(disparity));
+        tiles.push_back(bbox);
+      }
+    }
+    DisparityStats sample_stats;
+    int num_done = 0;
+    FifoWorkQueue queue(num_threads);
+    for (size_t t = 0; t < tiles.size(); t++) {
+      boost::shared_ptr< DisparityTileTask<PixelT> >
+        task(new DisparityTileTask<PixelT>(disparity, tiles[t], BBox2(), NULL, NULL,
+                                           sample_stats, mutex, ProgressCallback::dummy_instance(),
+                                           num_done, tiles.size()));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    vw_out() << "\t    From " << tiles.size() << " of " << num_tiles_x*num_tiles_y << " tiles:\n";
+    sample_stats.print(vw_out());
+    if (opt.quick_look)
+      return;
+    if (sample_stats.count == 0)
+      vw_throw( ArgumentErr() << "No valid disparities were found. Set the "
+                << "normalization range with --normalization.\n" );
+    opt.normalization_range = sample_stats.normalization_range(opt.normalization_percentile);
+  }
 
   vw_out() << "\t    Horizontal: [" << opt.normalization_range.min().x()
            << " " << opt.normalization_range.max().x() << "]    Vertical: ["
            << opt.normalization_range.min().y() << " "
            << opt.normalization_range.max().y() << "]\n";
 
-  // Generate value-normalized copies of the H and V channels
-  typedef typename PixelChannelType<PixelT>::type ChannelT;
-  ImageViewRef<ChannelT> horizontal =
-    apply_mask(copy_mask(clamp(normalize(crop(select_channel(disk_disparity_map,0),
-                                              roiToUse),
-                                         opt.normalization_range.min().x(),
-                                         opt.normalization_range.max().x(),
-                                         ChannelRange<ChannelT>::min(),ChannelRange<ChannelT>::max()
-                                        )
-                              ),
-                         crop(disk_disparity_map, roiToUse)
-                        )
-              );
-  ImageViewRef<ChannelT> vertical =
-    apply_mask(copy_mask(clamp(normalize(crop(select_channel(disk_disparity_map,1),
-                                              roiToUse),
-                                         opt.normalization_range.min().y(),
-                                         opt.normalization_range.max().y(),
-                                         ChannelRange<ChannelT>::min(),ChannelRange<ChannelT>::max()
-                                        )
-                              ),
-                         crop(disk_disparity_map, roiToUse)
-                        )
-              );
-
-  // Write both images to disk, casting as UINT8
+  // Write both images in one pass over the disparity, reading each tile
+  // of it once, and find the statistics of all of it on the way.
   std::string h_file = opt.output_prefix+"-H."+opt.output_file_type;
-  vw_out() << "\t--> Writing horizontal disparity debug image: " << h_file << "\n";
-  block_write_gdal_image( h_file,
-                          channel_cast_rescale<uint8>(horizontal),
-                          has_georef, georef,
-                          has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    H : "));
   std::string v_file = opt.output_prefix+"-V."+opt.output_file_type;
-  vw_out() << "\t--> Writing vertical disparity debug image: " << v_file << "\n";
-  block_write_gdal_image( v_file,
-                          channel_cast_rescale<uint8>(vertical),
-                          has_georef, georef,
-                          has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    V : "));
+  vw_out() << "\t--> Writing disparity debug images: " << h_file << ", " << v_file << "\n";
+  ImageViewRef<uint8> shape = constant_view(uint8(0), disparity.cols(), disparity.rows());
+  DisparityStats stats;
+  {
+    boost::scoped_ptr<DiskImageResourceGDAL>
+      h_rsrc(vw::cartography::build_gdal_rsrc(h_file, shape, opt)),
+      v_rsrc(vw::cartography::build_gdal_rsrc(v_file, shape, opt));
+    if (has_nodata) {
+      h_rsrc->set_nodata_write(output_nodata);
+      v_rsrc->set_nodata_write(output_nodata);
+    }
+    if (has_georef) {
+      write_georeference(*h_rsrc, georef);
+      write_georeference(*v_rsrc, georef);
+    }
+
+    Vector2i block = h_rsrc->block_write_size();
+    TerminalProgressCallback tpc("asp", "\t    H and V : ");
+    int num_blocks = ((disparity.rows() + block.y() - 1)/block.y())
+      * ((disparity.cols() + block.x() - 1)/block.x());
+    int num_done = 0;
+    FifoWorkQueue queue(num_threads);
+    for (int row = 0; row < disparity.rows(); row += block.y()) {
+      for (int col = 0; col < disparity.cols(); col += block.x()) {
+        BBox2i bbox(col, row, std::min(block.x(), disparity.cols() - col),
+                    std::min(block.y(), disparity.rows() - row));
+        boost::shared_ptr< DisparityTileTask<PixelT> >
+          task(new DisparityTileTask<PixelT>(disparity, bbox, opt.normalization_range,
+                                             h_rsrc.get(), v_rsrc.get(), stats, mutex,
+                                             tpc, num_done, num_blocks));
+        queue.add_task(task);
+      }
+    }
+    queue.join_all();
+    tpc.report_finished();
+  } // Close the files
+
+  vw_out() << "\t    From all tiles:\n";
+  stats.print(vw_out());
+
+  if (!opt.no_overviews && (opt.output_file_type == "tif" || opt.output_file_type == "tiff")) {
+    vw_out() << "\t--> Adding overviews\n";
+    build_overviews(h_file);
+    build_overviews(v_file);
+  }
+}
+
+/// The disparity as a masked float one, whatever the pixels on disk
+ImageViewRef< PixelMask<Vector2f> > read_masked_disparity(std::string const& file) {
+  ImageFormat fmt = vw::image_format(file);
+  bool masked = (fmt.pixel_format == VW_PIXEL_RGB ||
+                 fmt.pixel_format == VW_PIXEL_GENERIC_3_CHANNEL ||
+                 (fmt.pixel_format == VW_PIXEL_SCALAR && fmt.planes == 3));
+  if (masked) {
+    if (fmt.channel_type == VW_CHANNEL_INT32)
+      return pixel_cast< PixelMask<Vector2f> >(DiskImageView< PixelMask<Vector2i> >(file));
+    return DiskImageView< PixelMask<Vector2f> >(file);
+  }
+  if (fmt.channel_type == VW_CHANNEL_INT32)
+    return pixel_cast< PixelMask<Vector2f> >(DiskImageView<Vector2i>(file));
+  return pixel_cast< PixelMask<Vector2f> >(DiskImageView<Vector2f>(file));
+}
+
+void print_disparity_difference(Options const& opt) {
+  vw_out() << "Comparing with " << opt.compare_file << "\n";
+  asp::DisparityDifference diff
+    = asp::compare_disparities(read_masked_disparity(opt.input_file_name),
+                               read_masked_disparity(opt.compare_file),
+                               opt.compare_threshold);
+  vw_out() << "Valid in both:        " << diff.num_both        << "\n"
+           << "Valid only in first:  " << diff.num_first_only  << "\n"
+           << "Valid only in second: " << diff.num_second_only << "\n"
+           << "Mean difference:      " << diff.mean_diff()     << "\n"
+           << "Max difference:       " << diff.max_diff        << "\n"
+           << "Differing by more than " << opt.compare_threshold << ": "
+           << diff.num_above << "\n";
 }
 
 int main( int argc, char *argv[] ) {
@@ -169,6 +423,11 @@ int main( int argc, char *argv[] ) {
   try {
     handle_arguments( argc, argv, opt );
 
+    if ( !opt.compare_file.empty() ) {
+      print_disparity_difference(opt);
+      return 0;
+    }
+
     vw_out() << "Opening " << opt.input_file_name << "\n";
     ImageFormat fmt = vw::image_format(opt.input_file_name);
 
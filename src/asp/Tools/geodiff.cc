@@ -30,6 +30,14 @@ using namespace vw::cartography;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <limits>
+#include <map>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -44,11 +52,200 @@ public:
   }
 };
 
+/// Summary statistics of differences, accumulated separately over
+/// tiles and then merged. The median, the percentiles and the NMAD are
+/// found from a histogram of the values rounded to the nearest
+/// millimeter, which keeps the memory use bounded for any number of
+/// values, so these are accurate to half a millimeter.
+class DiffStats {
+  int64  m_count;
+  double m_min, m_max, m_sum, m_sum2;
+  std::map<int64, int64> m_hist;
+
+  static double bin_size() { return 1e-3; }
+
+public:
+  DiffStats(): m_count(0), m_min(std::numeric_limits<double>::max()),
+               m_max(-std::numeric_limits<double>::max()), m_sum(0), m_sum2(0) {}
+
+  void add(double val) {
+    m_count++;
+    m_min   = std::min(m_min, val);
+    m_max   = std::max(m_max, val);
+    m_sum  += val;
+    m_sum2 += val*val;
+    m_hist[(int64)floor(val/bin_size() + 0.5)]++;
+  }
+
+  void merge(DiffStats const& other) {
+    m_count += other.m_count;
+    m_min    = std::min(m_min, other.m_min);
+    m_max    = std::max(m_max, other.m_max);
+    m_sum   += other.m_sum;
+    m_sum2  += other.m_sum2;
+    for (std::map<int64, int64>::const_iterator it = other.m_hist.begin();
+         it != other.m_hist.end(); it++)
+      m_hist[it->first] += it->second;
+  }
+
+  int64  count() const { return m_count; }
+  double min  () const { return m_min;   }
+  double max  () const { return m_max;   }
+  double mean () const { return m_count > 0 ? m_sum/m_count : 0.0; }
+  double stddev() const {
+    if (m_count == 0)
+      return 0.0;
+    double m = mean();
+    return std::sqrt(std::max(m_sum2/m_count - m*m, 0.0)); // guard against numerical noise
+  }
+
+  /// The value below which the given percent of the values are
+  double percentile(double percent) const {
+    if (m_count == 0)
+      return 0.0;
+    int64 rank = std::min(m_count - 1, std::max(int64(0), (int64)floor(percent/100.0*m_count)));
+    int64 seen = 0;
+    for (std::map<int64, int64>::const_iterator it = m_hist.begin(); it != m_hist.end(); it++) {
+      seen += it->second;
+      if (seen > rank)
+        return it->first*bin_size();
+    }
+    return m_max;
+  }
+
+  /// The normalized median absolute deviation, 1.4826 times the median
+  /// of the distances of the values to their median
+  double nmad() const {
+    if (m_count == 0)
+      return 0.0;
+    double median = percentile(50.0);
+    std::vector<std::pair<double, int64> > dev;
+    for (std::map<int64, int64>::const_iterator it = m_hist.begin(); it != m_hist.end(); it++)
+      dev.push_back(std::make_pair(std::abs(it->first*bin_size() - median), it->second));
+    std::sort(dev.begin(), dev.end());
+    int64 rank = m_count/2, seen = 0;
+    for (size_t k = 0; k < dev.size(); k++) {
+      seen += dev[k].second;
+      if (seen > rank)
+        return 1.4826*dev[k].first;
+    }
+    return 0.0;
+  }
+
+  /// Print the statistics, each line starting with the given prefix
+  void print(std::ostream & os, std::string const& prefix) const {
+    os << prefix << "Max difference:       " << max()            << std::endl;
+    os << prefix << "Min difference:       " << min()            << std::endl;
+    os << prefix << "Mean difference:      " << mean()           << std::endl;
+    os << prefix << "StdDev of difference: " << stddev()         << std::endl;
+    os << prefix << "Median difference:    " << percentile(50.0) << std::endl;
+    os << prefix << "NMAD of difference:   " << nmad()           << std::endl;
+    os << prefix << "5th percentile:       " << percentile(5.0)  << std::endl;
+    os << prefix << "25th percentile:      " << percentile(25.0) << std::endl;
+    os << prefix << "75th percentile:      " << percentile(75.0) << std::endl;
+    os << prefix << "95th percentile:      " << percentile(95.0) << std::endl;
+  }
+};
+
+/// A view which passes through the tiles of the difference image, and
+/// adds their valid pixels to shared statistics as they are made. This
+/// way the statistics come from the same pass which writes the image.
+class DiffStatsView: public ImageViewBase<DiffStatsView> {
+  ImageViewRef<double> m_diff;
+  double m_nodata;
+  boost::shared_ptr<vw::Mutex> m_mutex;
+  DiffStats & m_stats;
+
+public:
+  typedef double pixel_type;
+  typedef double result_type;
+  typedef ProceduralPixelAccessor<DiffStatsView> pixel_accessor;
+
+  DiffStatsView(ImageViewRef<double> const& diff, double nodata, DiffStats & stats):
+    m_diff(diff), m_nodata(nodata), m_mutex(new vw::Mutex), m_stats(stats) {}
+
+  inline int32 cols  () const { return m_diff.cols(); }
+  inline int32 rows  () const { return m_diff.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DiffStatsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile = crop(m_diff, bbox);
+    DiffStats tile_stats;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        if (tile(col, row) != m_nodata)
+          tile_stats.add(tile(col, row));
+      }
+    }
+    {
+      vw::Mutex::Lock lock(*m_mutex);
+      m_stats.merge(tile_stats);
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// Rasterize one tile of a DiffStatsView, for its statistics only
+class DiffStatsTask: public Task, private boost::noncopyable {
+  DiffStatsView const& m_view;
+  BBox2i m_bbox;
+public:
+  DiffStatsTask(DiffStatsView const& view, BBox2i const& bbox): m_view(view), m_bbox(bbox) {}
+  void operator()() { m_view.prerasterize(m_bbox); }
+};
+
+/// Interpolate the DEM at the CSV points falling in one block of it,
+/// reading the block from disk only once.
+class CsvBlockTask: public Task, private boost::noncopyable {
+  DiskImageView<double>    const& m_dem;
+  double                          m_nodata;
+  BBox2i                          m_block;
+  std::vector<Vector2>     const& m_pix;
+  std::vector<size_t>      const& m_indices; // the points in this block
+  std::vector<PixelMask<double> > & m_heights;
+public:
+  CsvBlockTask(DiskImageView<double> const& dem, double nodata, BBox2i const& block,
+               std::vector<Vector2> const& pix, std::vector<size_t> const& indices,
+               std::vector<PixelMask<double> > & heights):
+    m_dem(dem), m_nodata(nodata), m_block(block), m_pix(pix), m_indices(indices),
+    m_heights(heights) {}
+
+  void operator()() {
+    // Bilinear interpolation also needs the pixels right after the
+    // block. At the DEM boundary the edge extension of the crop is the
+    // same as the one of the whole DEM.
+    BBox2i box = m_block;
+    box.max() += Vector2i(1, 1);
+    box.crop(bounding_box(m_dem));
+    ImageView<double> block = crop(m_dem, box);
+    ImageViewRef< PixelMask<double> > interp_block
+      = interpolate(create_mask(block, m_nodata),
+                    BilinearInterpolation(), ConstantEdgeExtension());
+    for (size_t k = 0; k < m_indices.size(); k++) {
+      Vector2 p = m_pix[m_indices[k]] - box.min();
+      m_heights[m_indices[k]] = interp_block(p[0], p[1]);
+    }
+  }
+};
+
 struct Options : vw::cartography::GdalWriteOptions {
   string dem1_file, dem2_file, output_prefix, csv_format_str, csv_proj4_str;
   double nodata_value;
 
-  bool use_float, use_absolute;
+  bool use_float, use_absolute, stats_only;
 };
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -62,6 +259,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                         "Output using float (32 bit) instead of using doubles (64 bit).")
     ("absolute",        po::bool_switch(&opt.use_absolute)->default_value(false), 
      "Output the absolute difference as opposed to just the difference.")
+    ("stats-only",      po::bool_switch(&opt.stats_only)->default_value(false),
+     "Compute the statistics of the difference of two DEMs without writing the difference image.")
     ("csv-format",     po::value(&opt.csv_format_str)->default_value(""),
      asp::csv_opt_caption().c_str())
     ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV file. If not specified, it will be borrowed from the DEM.");
@@ -174,7 +373,28 @@ void dem2dem_diff(Options& opt){
   }
     
   GeoReference crop_georef = crop(dem1_georef, crop_box);
-    
+
+  // The statistics are accumulated as the tiles are made
+  DiffStats stats;
+  DiffStatsView stats_view(difference, opt.nodata_value, stats);
+  difference = stats_view;
+
+  if (opt.stats_only) {
+    const int tile_size = 256;
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int row = 0; row < difference.rows(); row += tile_size) {
+      for (int col = 0; col < difference.cols(); col += tile_size) {
+        BBox2i tile(col, row, std::min(tile_size, difference.cols() - col),
+                    std::min(tile_size, difference.rows() - row));
+        boost::shared_ptr<DiffStatsTask> task(new DiffStatsTask(stats_view, tile));
+        queue.add_task(task);
+      }
+    }
+    queue.join_all();
+    stats.print(vw_out(), "");
+    return;
+  }
+
   std::string output_file = opt.output_prefix + "-diff.tif";
   vw_out() << "Writing difference file: " << output_file << "\n";
     
@@ -196,6 +416,7 @@ void dem2dem_diff(Options& opt){
     block_write_image(*rsrc, difference,
                       TerminalProgressCallback("asp", "\t--> Differencing: "));
   }
+  stats.print(vw_out(), "");
 }
 
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
@@ -255,60 +476,64 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
     csv_llh.push_back(llh);
   }
 
-  // We will interpolate into the DEM to find the difference
-  ImageViewRef< PixelMask<double> > interp_dem
-    = interpolate(create_mask(dem, dem_nodata),
-		  BilinearInterpolation(), ConstantEdgeExtension());
-
-
-  // Save the diffs
-  int    count     = 0;
-  double diff_min  = std::numeric_limits<double>::max();
-  double diff_max  = -diff_min;
-  double diff_mean = 0.0;
-  double diff_std  = 0.0;
-  
-  std::vector<Vector3> csv_diff;
+  // Bucket the points by the DEM block they fall in, so that each
+  // block is read once, and interpolate into the blocks in parallel
+  const int block_size = 256;
+  int num_block_cols = (dem.cols() + block_size - 1)/block_size;
+  int num_block_rows = (dem.rows() + block_size - 1)/block_size;
+  std::vector<Vector2> csv_pix(csv_llh.size());
+  std::vector<std::vector<size_t> > buckets(num_block_cols*num_block_rows);
   for (size_t it = 0; it < csv_llh.size(); it++) {
+    Vector2 pix = dem_georef.lonlat_to_pixel(subvector(csv_llh[it], 0, 2));
+    csv_pix[it] = pix;
 
-    Vector3 llh = csv_llh[it];
-    Vector2 ll  = subvector(llh, 0, 2);
-    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-    
     // Check for out of range
     if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
     if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
-    PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
+    int bc = std::min(num_block_cols - 1, (int)floor(pix[0])/block_size);
+    int br = std::min(num_block_rows - 1, (int)floor(pix[1])/block_size);
+    buckets[br*num_block_cols + bc].push_back(it);
+  }
+
+  std::vector<PixelMask<double> > csv_dem_ht(csv_llh.size()); // invalid by default
+  {
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int br = 0; br < num_block_rows; br++) {
+      for (int bc = 0; bc < num_block_cols; bc++) {
+        std::vector<size_t> const& bucket = buckets[br*num_block_cols + bc];
+        if (bucket.empty())
+          continue;
+        BBox2i block(bc*block_size, br*block_size, block_size, block_size);
+        block.crop(bounding_box(dem));
+        boost::shared_ptr<CsvBlockTask>
+          task(new CsvBlockTask(dem, dem_nodata, block, csv_pix, bucket, csv_dem_ht));
+        queue.add_task(task);
+      }
+    }
+    queue.join_all();
+  }
+
+  // Save the diffs, in the order of the input points
+  DiffStats stats;
+  std::vector<Vector3> csv_diff;
+  for (size_t it = 0; it < csv_llh.size(); it++) {
+
+    PixelMask<double> dem_ht = csv_dem_ht[it];
     if (!is_valid(dem_ht))
       continue;
 
+    Vector3 llh = csv_llh[it];
     double diff = dem_ht.child() - llh[2];
     if (reverse) 
       diff *= -1;
     if (opt.use_absolute)
       diff = std::abs(diff);
 
-    if (diff > diff_max) diff_max = diff;
-    if (diff < diff_min) diff_min = diff;
-
-    diff_mean += diff;
-    diff_std  += diff*diff;
-    count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
-  }
-
-  if (count > 0) {
-    diff_mean /= count;
-    diff_std = diff_std/count - diff_mean*diff_mean;
-    if (diff_std < 0)
-      diff_std = 0; // just in case, for numerical noise
-    diff_std = std::sqrt(diff_std);
+    stats.add(diff);
+    csv_diff.push_back(Vector3(llh[0], llh[1], diff));
   }
 
-  vw_out() << "Max difference:       " << diff_max  << std::endl;
-  vw_out() << "Min difference:       " << diff_min  << std::endl;
-  vw_out() << "Mean difference:      " << diff_mean << std::endl;
-  vw_out() << "StdDev of difference: " << diff_std  << std::endl;
+  stats.print(vw_out(), "");
 
   std::string output_file = opt.output_prefix + "-diff.csv";
   vw_out() << "Writing difference file: " << output_file << "\n";
@@ -316,10 +541,7 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   outfile.precision(16);
   outfile << "# longitude,latitude, height diff (m)" << std::endl;
   outfile << "# " << dem_georef.datum() << std::endl; // dem's datum
-  outfile << "# Max difference:       " << diff_max  << std::endl;
-  outfile << "# Min difference:       " << diff_min  << std::endl;
-  outfile << "# Mean difference:      " << diff_mean << std::endl;
-  outfile << "# StdDev of difference: " << diff_std  << std::endl;
+  stats.print(outfile, "# ");
   for (size_t it = 0; it < csv_diff.size(); it++) {
     Vector3 diff = csv_diff[it];
     outfile << diff[0] << "," << diff[1] << "," << diff[2] << std::endl;
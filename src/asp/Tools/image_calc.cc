@@ -24,6 +24,9 @@
 
 #include <vw/Core/FundamentalTypes.h>
 #include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Image/ImageIO.h>
 #include <vw/Image/ImageView.h>
@@ -39,8 +42,12 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 
+#include <map>
+#include <sstream>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/program_options.hpp>
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/phoenix.hpp>
@@ -396,7 +403,165 @@ vw::float64 clamp_and_cast<vw::float64>(const double val) {
   return clamp_and_cast_float<vw::float64>(val);
 }
 
-/// Image view class which applies the calc_operation tree to each pixel location.
+/// The calc_operation trees of all the expressions compiled once, with
+/// their constant subtrees folded, into instructions for a register
+/// machine. Each instruction is applied to a whole row of values at a
+/// time, in a tight loop, rather than walking the tree for each pixel.
+/// The first registers hold the variables, and instruction k writes
+/// register num_vars + k. A subexpression occurring more than once, in
+/// one expression or across several, is computed only once.
+class calc_program {
+
+  struct instruction {
+    OperationType    opType;
+    double           value; // The number, for OP_number
+    std::vector<int> args;  // The registers of the inputs
+  };
+
+  int m_num_vars;
+  std::vector<instruction>   m_code;
+  std::vector<int>           m_outputs;   // The register of each expression
+  std::map<std::string, int> m_registers; // The register of each distinct instruction
+
+  static bool is_constant(calc_operation const& node) {
+    if (node.opType == OP_variable)
+      return false;
+    for (size_t i=0; i<node.inputs.size(); ++i)
+      if (!is_constant(node.inputs[i]))
+        return false;
+    return true;
+  }
+
+  // Add the instruction unless the same one is already there. Returns
+  // the register holding its result.
+  int emit(OperationType opType, double value, std::vector<int> const& args) {
+    std::ostringstream key;
+    key.precision(17);
+    key << opType << " " << value;
+    for (size_t i=0; i<args.size(); ++i)
+      key << " " << args[i];
+    std::map<std::string, int>::const_iterator it = m_registers.find(key.str());
+    if (it != m_registers.end())
+      return it->second;
+
+    instruction ins;
+    ins.opType = opType;
+    ins.value  = value;
+    ins.args   = args;
+    m_code.push_back(ins);
+    int reg = m_num_vars + m_code.size() - 1;
+    m_registers[key.str()] = reg;
+    return reg;
+  }
+
+  // Compile the node. Returns the register holding its result.
+  int compile(calc_operation const& node) {
+
+    const int numInputs = node.inputs.size();
+    std::vector<int> args;
+
+    if (node.opType != OP_number && is_constant(node))
+      return emit(OP_number, node.applyOperation<double>(std::vector<double>()), args);
+
+    switch(node.opType) {
+      case OP_number:
+        return emit(OP_number, node.value, args);
+      case OP_variable:
+        if (node.varName < 0 || node.varName >= m_num_vars)
+          vw_throw(ArgumentErr() << "Unrecognized variable input: var_" << node.varName << "\n");
+        return node.varName;
+      case OP_negate: case OP_abs:
+        if (numInputs < 1)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        args.push_back(compile(node.inputs[0]));
+        return emit(node.opType, 0, args);
+      case OP_add: case OP_subtract: case OP_divide: case OP_multiply: case OP_power:
+        if (numInputs < 2)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        args.push_back(compile(node.inputs[0]));
+        args.push_back(compile(node.inputs[1]));
+        return emit(node.opType, 0, args);
+      case OP_min: case OP_max:
+        if (numInputs < 1)
+          vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+        for (int i=0; i<numInputs; ++i)
+          args.push_back(compile(node.inputs[i]));
+        return emit(node.opType, 0, args);
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type!\n");
+    }
+    return 0;
+  }
+
+public:
+  calc_program(): m_num_vars(0) {}
+
+  calc_program(std::vector<calc_operation> const& trees, int num_vars): m_num_vars(num_vars) {
+    for (size_t k=0; k<trees.size(); ++k)
+      m_outputs.push_back(compile(trees[k]));
+  }
+
+  /// The number of rows of values the registers must have
+  int num_registers() const { return m_num_vars + m_code.size(); }
+
+  int num_outputs() const { return m_outputs.size(); }
+
+  /// The register holding the result of the k'th expression
+  int output_register(int k) const { return m_outputs[k]; }
+
+  /// Apply the program to the first n values of each variable, which
+  /// must be in the first registers.
+  void apply(std::vector<std::vector<double> > & regs, int n) const {
+    for (size_t k=0; k<m_code.size(); ++k) {
+      instruction const& ins = m_code[k];
+      double * a = &regs[m_num_vars + k][0];
+      switch(ins.opType) {
+        case OP_number: {
+          for (int i=0; i<n; ++i) a[i] = ins.value;
+          break;
+        }
+        case OP_negate: {
+          double const* x = &regs[ins.args[0]][0];
+          for (int i=0; i<n; ++i) a[i] = -x[i];
+          break;
+        }
+        case OP_abs: {
+          double const* x = &regs[ins.args[0]][0];
+          for (int i=0; i<n; ++i) a[i] = std::abs(x[i]);
+          break;
+        }
+        case OP_add: case OP_subtract: case OP_divide: case OP_multiply: case OP_power: {
+          double const* x = &regs[ins.args[0]][0];
+          double const* y = &regs[ins.args[1]][0];
+          if      (ins.opType == OP_add     ) for (int i=0; i<n; ++i) a[i] = x[i] + y[i];
+          else if (ins.opType == OP_subtract) for (int i=0; i<n; ++i) a[i] = x[i] - y[i];
+          else if (ins.opType == OP_divide  ) for (int i=0; i<n; ++i) a[i] = x[i] / y[i];
+          else if (ins.opType == OP_multiply) for (int i=0; i<n; ++i) a[i] = x[i] * y[i];
+          else                                for (int i=0; i<n; ++i) a[i] = pow(x[i], y[i]);
+          break;
+        }
+        case OP_min: case OP_max: {
+          double const* x = &regs[ins.args[0]][0];
+          for (int i=0; i<n; ++i) a[i] = x[i];
+          for (size_t j=1; j<ins.args.size(); ++j) {
+            double const* b = &regs[ins.args[j]][0];
+            if (ins.opType == OP_min)
+              for (int i=0; i<n; ++i) a[i] = (b[i] < a[i]) ? b[i] : a[i];
+            else
+              for (int i=0; i<n; ++i) a[i] = (b[i] > a[i]) ? b[i] : a[i];
+          }
+          break;
+        }
+        default:
+          vw_throw(LogicErr() << "Unexpected operation type!\n");
+      }
+    }
+  }
+};
+
+/// Image view class which applies the calc_operation trees to each pixel location.
+/// The view is the image of the first expression. The images of all of them
+/// are made at once, from the same input tiles, with compute_tiles().
 template <class ImageT, typename OutputPixelT>
 class ImageCalcView : public ImageViewBase<ImageCalcView<ImageT, OutputPixelT> > {
 
@@ -410,7 +575,7 @@ private: // Variables
   std::vector<bool      > m_has_nodata_vec;
   std::vector<input_pixel_type> m_nodata_vec;
   result_type    m_output_nodata;
-  calc_operation m_operation_tree;
+  calc_program   m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -422,14 +587,15 @@ public: // Functions
                  std::vector<bool  >           const& has_nodata_vec,
                  std::vector<input_pixel_type> const& nodata_vec,
                  result_type outputNodata,
-                 calc_operation const& operation_tree)
+                 std::vector<calc_operation> const& operation_trees)
                   : m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
                     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-                    m_operation_tree(operation_tree) {
+                    m_program(operation_trees, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageCalcView: One or more images required!." );
     VW_ASSERT( (has_nodata_vec.size() == numImages), LogicErr() << "ImageCalcView: Incorrect hasNodata count passed in!." );
     VW_ASSERT( (nodata_vec.size()    == numImages), LogicErr() << "ImageCalcView: Incorrect nodata count passed in!." );
+    VW_ASSERT( (!operation_trees.empty()), ArgumentErr() << "ImageCalcView: One or more operations required!." );
 
     // Make sure all images are the same size
     m_num_rows     = imageVec[0].rows();
@@ -447,6 +613,9 @@ public: // Functions
   inline int32 rows  () const { return m_num_rows; }
   inline int32 planes() const { return m_num_channels; }
 
+  /// The number of expressions, and so of output images
+  int num_outputs() const { return m_program.num_outputs(); }
+
   inline result_type operator()( int32 i, int32 j, int32 p=0 ) const
   {
     return 0; // NOT IMPLEMENTED!
@@ -455,68 +624,79 @@ public: // Functions
   typedef ProceduralPixelAccessor<ImageCalcView<ImageT, OutputPixelT> > pixel_accessor;
   inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
 
-  typedef CropView<ImageView<result_type> > prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+  /// Compute the tile of each output image at this bounding box
+  void compute_tiles( BBox2i const& bbox, std::vector<ImageView<result_type> > & tiles ) const {
     //typedef typename PixelChannelType<typename input_pixel_type>::type output_channel_type; // TODO: Why does this not compile?
     typedef typename ImageChannelType<ImageView<result_type> >::type output_channel_type;
 
-    // Set up the output image tile
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-
-    // TODO: Left to right processing!
+    // Set up the output image tiles
+    const int num_outputs = m_program.num_outputs();
+    tiles.resize(num_outputs);
+    for (int k=0; k<num_outputs; ++k)
+      tiles[k].set_size(bbox.width(), bbox.height());
 
-    // Set up for pixel calculations
+    // Set up for row calculations. The inputs go in the first registers.
+    const int    width      = bbox.width();
     const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
+    std::vector<std::vector<double> > regs(m_program.num_registers(), std::vector<double>(width));
+    std::vector<bool> isNodata(width);
 
     // Rasterize all the input images at this particular tile
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
+    // Compute each output row, one channel at a time
+    for (int r = 0; r < bbox.height(); r++) {
 
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
+      // If any of the input pixels are nodata, the output is nodata.
+      for (int c = 0; c < width; c++) {
+        isNodata[c] = false;
+        for (size_t i=0; i<num_images; ++i) {
+          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_tiles[i](c,r))) {
+            isNodata[c] = true;
             break;
           }
         } // End image loop
+      }
 
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
-          continue;
-        }
-
-
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          std::vector<double> & row = regs[i];
+          for (int c = 0; c < width; c++)
+            row[c] = input_tiles[i](c,r)[chan];
+        } // End image loop
 
-          // Apply the operation tree to this pixel and store in the output pixel
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          //if (newVal > 255)
-          //  std::cout << "Value: " << newVal << " --> " << static_cast<double>(clamp_and_cast<output_channel_type>(newVal)) << "\n";
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+        // Apply the operation trees to this row and store in the output pixels
+        m_program.apply(regs, width);
+        for (int k=0; k<num_outputs; ++k) {
+          std::vector<double> const& result = regs[m_program.output_register(k)];
+          for (int c = 0; c < width; c++) {
+            if (!isNodata[c])
+              tiles[k](c, r, chan) = clamp_and_cast<output_channel_type>(result[c]);
+          }
+        }
+      } // End channel loop
 
-        } // End channel loop
+      for (int k=0; k<num_outputs; ++k) {
+        for (int c = 0; c < width; c++) {
+          if (isNodata[c])
+            tiles[k](c, r) = m_output_nodata;
+        }
+      }
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
+  }
 
-  // Return the tile we created with fake borders to make it look the size of the entire output image
-  return prerasterize_type(tile,
-                           -bbox.min().x(), -bbox.min().y(),
-                           cols(), rows() );
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+    std::vector<ImageView<result_type> > tiles;
+    compute_tiles(bbox, tiles);
 
+    // Return the tile we created with fake borders to make it look the size of the entire output image
+    return prerasterize_type(tiles[0],
+                             -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
   } // End prerasterize function
 
  template <class DestT>
@@ -526,6 +706,102 @@ public: // Functions
 
 }; // End class ImageCalcView
 
+/// Hands out the tiles of the outputs of an ImageCalcView to their
+/// writers. The tiles of all outputs at a bounding box are computed
+/// when the first writer asks for one of them, and are kept until
+/// every writer got its own. The writers go through the tiles in the
+/// same order, so only the tiles between the slowest and the fastest
+/// writer are kept at any time.
+template <class ViewT>
+class CalcTileCache: private boost::noncopyable {
+
+  typedef typename ViewT::pixel_type pixel_type;
+  typedef std::pair<std::pair<int32, int32>, std::pair<int32, int32> > TileKey;
+
+  struct Entry {
+    vw::Mutex mutex;
+    std::vector<ImageView<pixel_type> > tiles;
+    int num_taken;
+    Entry(): num_taken(0) {}
+  };
+
+  ViewT m_view;
+  vw::Mutex m_mutex;
+  std::map<TileKey, boost::shared_ptr<Entry> > m_entries;
+
+public:
+  CalcTileCache(ViewT const& view): m_view(view) {}
+
+  ViewT const& view() const { return m_view; }
+
+  /// The tile at this bounding box of the given output
+  ImageView<pixel_type> tile(BBox2i const& bbox, int output) {
+
+    TileKey key(std::make_pair(bbox.min().x(), bbox.min().y()),
+                std::make_pair(bbox.width(),   bbox.height()));
+    boost::shared_ptr<Entry> entry;
+    {
+      vw::Mutex::Lock lock(m_mutex);
+      boost::shared_ptr<Entry> & slot = m_entries[key];
+      if (!slot)
+        slot.reset(new Entry);
+      entry = slot;
+    }
+
+    // The first writer to get here computes the tiles, while the
+    // others asking for them wait
+    vw::Mutex::Lock entry_lock(entry->mutex);
+    if (entry->tiles.empty())
+      m_view.compute_tiles(bbox, entry->tiles);
+    ImageView<pixel_type> result = entry->tiles[output];
+    entry->num_taken++;
+    if (entry->num_taken == m_view.num_outputs()) {
+      vw::Mutex::Lock lock(m_mutex);
+      m_entries.erase(key);
+    }
+    return result;
+  }
+};
+
+/// The image of one output of an ImageCalcView, with the tiles shared
+/// with the other outputs through a CalcTileCache.
+template <class ViewT>
+class CalcOutputView : public ImageViewBase<CalcOutputView<ViewT> > {
+  boost::shared_ptr<CalcTileCache<ViewT> > m_cache;
+  int m_output;
+
+public:
+  typedef typename ViewT::pixel_type pixel_type;
+  typedef pixel_type result_type;
+
+  CalcOutputView(boost::shared_ptr<CalcTileCache<ViewT> > cache, int output):
+    m_cache(cache), m_output(output) {}
+
+  inline int32 cols  () const { return m_cache->view().cols(); }
+  inline int32 rows  () const { return m_cache->view().rows(); }
+  inline int32 planes() const { return m_cache->view().planes(); }
+
+  inline result_type operator()( int32 i, int32 j, int32 p=0 ) const
+  {
+    return 0; // NOT IMPLEMENTED!
+  }
+
+  typedef ProceduralPixelAccessor<CalcOutputView<ViewT> > pixel_accessor;
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+    return prerasterize_type(m_cache->tile(bbox, m_output),
+                             -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+};
+
 
 //======================================================================================================
 
@@ -541,8 +817,8 @@ struct Options : vw::cartography::GdalWriteOptions {
   DataType    output_data_type;
   bool        has_out_nodata;
   double      out_nodata_value;
-  std::string calc_string;
-  std::string output_file, metadata;
+  std::vector<std::string> calc_strings, output_files;
+  std::string metadata;
 };
 
 
@@ -555,7 +831,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     "Recognized operators: +, -, /, *, (), pow(), abs(), min(), max(), var_0, var_1, ...\n"
     "Use var_n to refer to the pixel of the n'th input image."
     "Order of operations is parsed with RIGHT priority, use parenthesis to assure the order you want.\n"
-    "Surround the entire string with double quotes.\n";
+    "Surround the entire string with double quotes.\n"
+    "Repeat this option to compute several outputs in one pass over the inputs.\n";
 
   const std::string data_type_string =
     "The data type of the output file:\n"
@@ -569,8 +846,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("");
   general_options.add_options()
-    ("output-file,o", po::value(&opt.output_file), "Output file name.")
-    ("calc,c",            po::value(&opt.calc_string), calc_string_help.c_str())
+    ("output-file,o", po::value(&opt.output_files), "Output file name. Repeat it, in the same order, when there are several operations.")
+    ("calc,c",            po::value(&opt.calc_strings), calc_string_help.c_str())
     ("output-data-type,d",  po::value(&opt.output_data_string)->default_value("float64"), data_type_string.c_str())
     ("input-nodata-value",  po::value(&opt.in_nodata_value), "Value that is no-data in the input images.")
     ("output-nodata-value", po::value(&opt.out_nodata_value), "Value to use for no-data in the output image.")
@@ -596,8 +873,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   if ( opt.input_files.empty() )
     vw_throw( ArgumentErr() << "Missing input files!\n" << usage << general_options );
-  if ( opt.calc_string.size() == 0)
+  if ( opt.calc_strings.empty() )
     vw_throw( ArgumentErr() << "Missing operation string!\n" << usage << general_options );
+  if ( !opt.output_files.empty() && opt.output_files.size() != opt.calc_strings.size() )
+    vw_throw( ArgumentErr() << "There must be as many output files as operations.\n" );
 
   if      (opt.output_data_string == "uint8"  ) opt.output_data_type = DT_UINT8;
   else if (opt.output_data_string == "uint16" ) opt.output_data_type = DT_UINT16;
@@ -621,14 +900,55 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   }else
     opt.has_out_nodata = true;
 
- vw::create_out_dir(opt.output_file);
+ for (size_t k=0; k<opt.output_files.size(); ++k)
+   vw::create_out_dir(opt.output_files[k]);
 }
 
+/// Write one output of an ImageCalcView. There is one such task per
+/// output, and they all run at the same time.
+template <class ViewT>
+class CalcWriteTask: public Task, private boost::noncopyable {
+  std::string                              m_output_file;
+  CalcOutputView<ViewT>                    m_view;
+  vw::cartography::GdalWriteOptions const& m_opt;
+  bool                                     m_have_georef;
+  vw::cartography::GeoReference     const& m_georef;
+  bool                                     m_has_nodata;
+  double                                   m_nodata;
+  std::map<std::string, std::string> const& m_keywords;
+  bool                                     m_show_progress;
+  std::string                            & m_error;
+public:
+  CalcWriteTask(std::string const& output_file, CalcOutputView<ViewT> const& view,
+                vw::cartography::GdalWriteOptions const& opt,
+                bool have_georef, vw::cartography::GeoReference const& georef,
+                bool has_nodata, double nodata,
+                std::map<std::string, std::string> const& keywords,
+                bool show_progress, std::string & error):
+    m_output_file(output_file), m_view(view), m_opt(opt),
+    m_have_georef(have_georef), m_georef(georef),
+    m_has_nodata(has_nodata), m_nodata(nodata), m_keywords(keywords),
+    m_show_progress(show_progress), m_error(error) {}
+
+  void operator()() {
+    // The progress of the first output stands for all of them
+    try {
+      TerminalProgressCallback tpc("image_calc", "Writing:");
+      vw::cartography::block_write_gdal_image
+        (m_output_file, m_view, m_have_georef, m_georef, m_has_nodata, m_nodata, m_opt,
+         m_show_progress ? (ProgressCallback const&)tpc : ProgressCallback::dummy_instance(),
+         m_keywords);
+    } catch (std::exception const& e) {
+      m_error = e.what();
+    }
+  }
+};
+
 /// This function call is just to clean up the case statement in load_inputs_and_process
 template <typename PixelT, typename OutputT>
-void generate_output(const std::string                         & output_file,
+void generate_output(const std::vector<std::string>            & output_files,
                      const Options                             & opt,
-                     const calc_operation                      & calc_tree,
+                     const std::vector<calc_operation>         & calc_trees,
                      const bool                                  have_georef,
                      const vw::cartography::GeoReference       & georef,
                            std::vector< ImageViewRef<PixelT> > & input_images,
@@ -638,25 +958,57 @@ void generate_output(const std::string                         & output_file,
   // Parse keywords from --mo.
   std::map<std::string, std::string> keywords;
   asp::parse_append_metadata(opt.metadata, keywords);
-  
-  vw_out() << "Writing: " << output_file << std::endl;
-  vw::cartography::block_write_gdal_image
-    (output_file,
-     ImageCalcView< ImageViewRef<PixelT>, OutputT >(input_images,
-                                                    has_nodata_vec,
-                                                    nodata_vec,
-                                                    opt.out_nodata_value,
-                                                    calc_tree),
-     have_georef, georef,
-     opt.has_out_nodata, opt.out_nodata_value,
-     opt,
-     TerminalProgressCallback("image_calc","Writing:"),
-     keywords);
+
+  typedef ImageCalcView< ImageViewRef<PixelT>, OutputT > CalcViewT;
+  CalcViewT calc_view(input_images, has_nodata_vec, nodata_vec,
+                      opt.out_nodata_value, calc_trees);
+
+  if (output_files.size() == 1) {
+    vw_out() << "Writing: " << output_files[0] << std::endl;
+    vw::cartography::block_write_gdal_image
+      (output_files[0], calc_view,
+       have_georef, georef,
+       opt.has_out_nodata, opt.out_nodata_value,
+       opt,
+       TerminalProgressCallback("image_calc","Writing:"),
+       keywords);
+    return;
+  }
+
+  // Write all the outputs at the same time, splitting the threads
+  // among them. Each tile of the inputs is read once for all outputs.
+  const int num_outputs = output_files.size();
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  vw::cartography::GdalWriteOptions write_opt = opt;
+  write_opt.num_threads = std::max(1, num_threads/num_outputs);
+
+  boost::shared_ptr<CalcTileCache<CalcViewT> > cache(new CalcTileCache<CalcViewT>(calc_view));
+  std::vector<std::string> errors(num_outputs);
+  {
+    FifoWorkQueue queue(num_outputs);
+    for (int k=0; k<num_outputs; ++k) {
+      vw_out() << "Writing: " << output_files[k] << std::endl;
+      boost::shared_ptr<CalcWriteTask<CalcViewT> >
+        task(new CalcWriteTask<CalcViewT>(output_files[k], CalcOutputView<CalcViewT>(cache, k),
+                                          write_opt, have_georef, georef,
+                                          opt.has_out_nodata, opt.out_nodata_value,
+                                          keywords, k == 0, errors[k]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  for (int k=0; k<num_outputs; ++k) {
+    if (!errors[k].empty())
+      vw_throw(IOErr() << "Failed to write " << output_files[k] << ": " << errors[k]);
+  }
 }
 
 /// This function loads the input images and calls the main processing function
 template <typename PixelT>
-void load_inputs_and_process(Options &opt, const std::string &output_file, const calc_operation &calc_tree) {
+void load_inputs_and_process(Options &opt, const std::vector<std::string> &output_files,
+                             const std::vector<calc_operation> &calc_trees) {
 
   // Read the georef from the first file, they should all have the same value.
   const size_t numInputFiles = opt.input_files.size();
@@ -709,13 +1061,13 @@ void load_inputs_and_process(Options &opt, const std::string &output_file, const
   // Write out the selected data type
   //vw_out() << "Writing: " << output_file << " with data type " << opt.output_data_type << std::endl;
   switch(opt.output_data_type) {
-    case    DT_UINT8  : generate_output<PixelT, PixelGray<vw::uint8  > >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    case    DT_INT16  : generate_output<PixelT, PixelGray<vw::int16  > >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    case    DT_UINT16 : generate_output<PixelT, PixelGray<vw::uint16 > >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    case    DT_INT32  : generate_output<PixelT, PixelGray<vw::int32  > >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    case    DT_UINT32 : generate_output<PixelT, PixelGray<vw::uint32 > >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    case    DT_FLOAT32: generate_output<PixelT, PixelGray<vw::float32> >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
-    default :           generate_output<PixelT, PixelGray<vw::float64> >(output_file, opt, calc_tree, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_UINT8  : generate_output<PixelT, PixelGray<vw::uint8  > >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_INT16  : generate_output<PixelT, PixelGray<vw::int16  > >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_UINT16 : generate_output<PixelT, PixelGray<vw::uint16 > >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_INT32  : generate_output<PixelT, PixelGray<vw::int32  > >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_UINT32 : generate_output<PixelT, PixelGray<vw::uint32 > >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    case    DT_FLOAT32: generate_output<PixelT, PixelGray<vw::float32> >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
+    default :           generate_output<PixelT, PixelGray<vw::float64> >(output_files, opt, calc_trees, have_georef, georef, input_images, has_nodata_vec, nodata_vec); break;
   };
 
 }
@@ -727,44 +1079,51 @@ int main( int argc, char *argv[] ) {
   try {
     handle_arguments( argc, argv, opt );
 
-    std::string exp(opt.calc_string);
-
     calc_grammar<std::string::const_iterator> grammerParser;
-    calc_operation calc_tree;
-
-    std::string::const_iterator iter = exp.begin();
-    std::string::const_iterator end = exp.end();
-    bool r = phrase_parse(iter, end, grammerParser, boost::spirit::ascii::space, calc_tree);
-
-    if (r && iter == end) {// Successfully parsed the calculation expression
-      //std::cout << "-------------------------\n";
-      //std::cout << "Parsing succeeded\n";
-      //std::cout << "-------------------------\n";
-      ////calc_tree.print();
-      ////std::cout << "----------- pruned --------------\n";
-      calc_tree.clearEmptyNodes();
-      //calc_tree.print();
-    }
-    else { // Failed to parse the calculation expression
-      std::string::const_iterator some = iter+30;
-      std::string context(iter, (some>end)?end:some);
-      std::cout << "-------------------------\n";
-      std::cout << "Parsing calculation expression failed\n";
-      std::cout << "stopped at: \": " << context << "...\"\n";
-      std::cout << "-------------------------\n";
-      return -1;
+    std::vector<calc_operation> calc_trees(opt.calc_strings.size());
+
+    for (size_t k=0; k<opt.calc_strings.size(); ++k) {
+      std::string const& exp = opt.calc_strings[k];
+      calc_operation   & calc_tree = calc_trees[k];
+
+      std::string::const_iterator iter = exp.begin();
+      std::string::const_iterator end = exp.end();
+      bool r = phrase_parse(iter, end, grammerParser, boost::spirit::ascii::space, calc_tree);
+
+      if (r && iter == end) {// Successfully parsed the calculation expression
+        //std::cout << "-------------------------\n";
+        //std::cout << "Parsing succeeded\n";
+        //std::cout << "-------------------------\n";
+        ////calc_tree.print();
+        ////std::cout << "----------- pruned --------------\n";
+        calc_tree.clearEmptyNodes();
+        //calc_tree.print();
+      }
+      else { // Failed to parse the calculation expression
+        std::string::const_iterator some = iter+30;
+        std::string context(iter, (some>end)?end:some);
+        std::cout << "-------------------------\n";
+        std::cout << "Parsing calculation expression failed\n";
+        std::cout << "stopped at: \": " << context << "...\"\n";
+        std::cout << "-------------------------\n";
+        return -1;
+      }
     }
 
-    // Use a default output file if none provided
+    // Use default output files if none provided, numbered if there
+    // are several operations
     const std::string firstFile = opt.input_files[0];
     //vw_out() << "Loading: " << firstFile << "\n";
     size_t pt_idx = firstFile.rfind(".");
-    std::string output_file;
-    if (opt.output_file.size() != 0)
-      output_file = opt.output_file;
-    else {
-      output_file = firstFile.substr(0,pt_idx)+"_calc";
-      output_file += firstFile.substr(pt_idx,firstFile.size()-pt_idx);
+    std::vector<std::string> output_files = opt.output_files;
+    if (output_files.empty()) {
+      for (size_t k=0; k<calc_trees.size(); ++k) {
+        std::string output_file = firstFile.substr(0,pt_idx)+"_calc";
+        if (calc_trees.size() > 1)
+          output_file += "_" + vw::num_to_str(k);
+        output_file += firstFile.substr(pt_idx,firstFile.size()-pt_idx);
+        output_files.push_back(output_file);
+      }
     }
 
     // Determining the format of the input images (all are assumed to be the same type!)
@@ -774,14 +1133,14 @@ int main( int argc, char *argv[] ) {
 
     // Redirect to another function with the correct template type
     switch(input_data_type) {
-    case VW_CHANNEL_INT8   : load_inputs_and_process<PixelGray<vw::int8   > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_UINT8  : load_inputs_and_process<PixelGray<vw::uint8  > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_INT16  : load_inputs_and_process<PixelGray<vw::int16  > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_UINT16 : load_inputs_and_process<PixelGray<vw::uint16 > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_INT32  : load_inputs_and_process<PixelGray<vw::int32  > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_UINT32 : load_inputs_and_process<PixelGray<vw::uint32 > >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_FLOAT32: load_inputs_and_process<PixelGray<vw::float32> >(opt, output_file, calc_tree);  break;
-    case VW_CHANNEL_FLOAT64: load_inputs_and_process<PixelGray<vw::float64> >(opt, output_file, calc_tree);  break;
+    case VW_CHANNEL_INT8   : load_inputs_and_process<PixelGray<vw::int8   > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_UINT8  : load_inputs_and_process<PixelGray<vw::uint8  > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_INT16  : load_inputs_and_process<PixelGray<vw::int16  > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_UINT16 : load_inputs_and_process<PixelGray<vw::uint16 > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_INT32  : load_inputs_and_process<PixelGray<vw::int32  > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_UINT32 : load_inputs_and_process<PixelGray<vw::uint32 > >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_FLOAT32: load_inputs_and_process<PixelGray<vw::float32> >(opt, output_files, calc_trees);  break;
+    case VW_CHANNEL_FLOAT64: load_inputs_and_process<PixelGray<vw::float64> >(opt, output_files, calc_trees);  break;
     default : vw_throw(ArgumentErr() << "Input image format " << input_data_type << " is not supported!\n");
     };
   } ASP_STANDARD_CATCHES;
@@ -29,6 +29,7 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Tools/jitter_adjust.h>
+#include <asp/Core/MatchFile.h>
 #include <vw/Core/Stopwatch.h>
 
 // Turn off warnings from eigen
@@ -73,62 +74,6 @@ const int NUM_POINT_PARAMS = 3;
 
 typedef Vector<double, NUM_CAMERA_PARAMS> camera_vector_t;
 
-// In spite of trying a lot, I could not find a way to make a base class
-// from which both AdjustedLinescanDGModel and PiecewiseAdjustedLinescanModel
-// could inherit. Hence this wrapper.
-class AdjustedModelWrapper {
-public:
-  AdjustedModelWrapper(std::string               const& session,
-                       boost::shared_ptr<vw::camera::CameraModel> cam,
-                       int interp_type,
-                       vw::Vector2               const& adjustment_bounds,
-                       std::vector<vw::Vector3>  const& position_adjustments,
-                       std::vector<vw::Quat>     const& pose_adjustments,
-                       vw::Vector2i              const& image_size):
-    m_session(session)
-  {
-    if (m_session == "dg" || m_session == "dgmaprpc") {
-      m_cam = boost::shared_ptr<vw::camera::CameraModel>
-        (new asp::AdjustedLinescanDGModel(cam, interp_type, adjustment_bounds,
-                                          position_adjustments, pose_adjustments,
-                                          image_size));
-    } else {
-      m_cam = boost::shared_ptr<vw::camera::CameraModel>
-        (new asp::PiecewiseAdjustedLinescanModel(cam, interp_type, adjustment_bounds,
-                                                 position_adjustments, pose_adjustments,
-                                                 image_size));
-    }
-    
-  }
-
-  vw::Vector2 point_to_pixel(vw::Vector3 const& point, double starty) const {
-    if (m_session == "dg" || m_session == "dgmaprpc") 
-      return
-        dynamic_cast<asp::AdjustedLinescanDGModel*>
-	(m_cam.get())->point_to_pixel(point, starty);
-    
-    return
-      dynamic_cast<asp::PiecewiseAdjustedLinescanModel*>
-      (m_cam.get())->point_to_pixel(point, starty);
-  }
-  
-  std::vector<int> get_closest_adj_indices(double t){
-    if (m_session == "dg" || m_session == "dgmaprpc") 
-      return
-        dynamic_cast<asp::AdjustedLinescanDGModel*>(m_cam.get())->get_closest_adj_indices(t);
-    
-    return
-      dynamic_cast<asp::PiecewiseAdjustedLinescanModel*>(m_cam.get())->get_closest_adj_indices(t);
-  }
-  
-private:
-  std::string m_session;
-  boost::shared_ptr<vw::camera::CameraModel> m_cam;
-
-  
-};
-  
-  
 void populate_adjustements(std::vector<double> const& cameras_vec,
 			   int start_index, int end_index,
 			   std::vector<vw::Vector3> & position_adjustments,
@@ -160,160 +105,165 @@ void populate_adjustements(std::vector<double> const& cameras_vec,
 // the current camera and point indices. The result is the residual,
 // the difference in the observation and the projection of the point
 // into the camera, normalized by pixel_sigma.
-struct PiecewiseReprojectionError {
+//
+// The adjusted camera type is a template parameter, either
+// AdjustedLinescanDGModel or PiecewiseAdjustedLinescanModel, so the
+// projection is not dispatched at run time. Each evaluation creates
+// its own adjusted camera, so residuals can be evaluated in parallel.
+//
+// Numerically differentiating the whole projection in all parameters
+// takes two projections per parameter, up to 54 of them, and for
+// linescan cameras each projection is an iterative solve. Instead,
+// the projection is differentiated numerically only in the point,
+// which takes 6 projections. With linear interpolation between the
+// adjustments, the derivatives in the adjustments follow from these.
+// Moving all adjustments by the same offset is the same as moving the
+// point the other way, and rotating them all by the same small
+// rotation is the same as rotating the point the other way about the
+// camera center. An adjustment contributes to these with its
+// interpolation weight at the projected line. This is exact for the
+// positions, and for the rotations it holds to first order in the
+// adjustments, which are small. With smooth interpolation the
+// derivatives in the adjustments are found numerically, as before.
+//
+// An adjustment affects only the lines near it, so the adjusted camera
+// is made of a window of the adjustments around the ones being
+// floated, rather than of all of them.
+template <class AdjustedCamT>
+class PiecewiseReprojectionError: public ceres::CostFunction {
+public:
   PiecewiseReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
 			     Vector2 const& adjustment_bounds,
 			     std::vector<double> const& cameras_vec,
 			     boost::shared_ptr<vw::camera::CameraModel> cam,
 			     Vector2i const& image_size,
-			     std::string const& session,
 			     int start_index,
-			     int camera_index1, int camera_index2,
-			     int camera_index3, int camera_index4,
-			     int end_index,
-			     size_t ipt):
+			     std::vector<int> const& camera_indices,
+			     int end_index):
     m_observation(observation),
     m_pixel_sigma(pixel_sigma),
     m_adjustment_bounds(adjustment_bounds),
     m_cameras_vec(cameras_vec),
     m_cam(cam),
     m_image_size(image_size),
-    m_session(session),
     m_start_index(start_index),
-    m_camera_index1(camera_index1),
-    m_camera_index2(camera_index2),
-    m_camera_index3(camera_index3),
-    m_camera_index4(camera_index4),
-    m_end_index(end_index),
-    m_ipt(ipt){}
-
-  template <typename T>
-  bool do_calc(const T* const camera1, const T* const camera2,
-	       const T* const camera3, const T* const camera4,
-	       const T* const point, T* residuals) const {
-
-    try{
-
-      int num_cameras = m_cameras_vec.size();
-      std::vector<double> local_cameras_vec = m_cameras_vec;
-
-	// Copy the camera adjustments to local storage.  Update them
-	// with the latest value for the current camera being floated.
-
-      for (int i = 1; i <= 4; i++) {
-
-	int camera_index = -1;
-	const T * camera = NULL;
-	if (i == 1 && m_camera_index1 >= 0 && camera1 != NULL) {
-	  camera_index = m_camera_index1;
-	  camera       = camera1;
-	} else if (i == 2 && m_camera_index2 >= 0 && camera2 != NULL) {
-	  camera_index = m_camera_index2;
-	  camera       = camera2;
-	} else if (i == 3 && m_camera_index3 >= 0 && camera3 != NULL) {
-	  camera_index = m_camera_index3;
-	  camera       = camera3;
-	} else if (i == 4 && m_camera_index4 >= 0 && camera4 != NULL) {
-	  camera_index = m_camera_index4;
-	  camera       = camera4;
-	}
-
-	if (camera == NULL) continue;
+    m_camera_indices(camera_indices),
+    m_end_index(end_index){
+
+    int num_cameras = m_cameras_vec.size()/NUM_CAMERA_PARAMS;
+    VW_ASSERT(m_camera_indices.size() >= 1 && m_camera_indices.size() <= 4,
+	      ArgumentErr() << "Expecting between 1 and 4 camera indices.");
+    for (size_t i = 0; i < m_camera_indices.size(); i++)
+      VW_ASSERT(0 <= m_start_index && m_start_index <= m_camera_indices[i]
+		&& m_camera_indices[i] < m_end_index && m_end_index <= num_cameras,
+		ArgumentErr() << "Book-keeping failure in camera indicies");
+
+    // The window of adjustments used to create the camera. Pad the
+    // floated ones by as many as the smooth interpolation uses, so
+    // that a projection a little away from the observation is still
+    // within the window. Need at least two adjustments to interpolate.
+    int min_index = *std::min_element(m_camera_indices.begin(), m_camera_indices.end());
+    int max_index = *std::max_element(m_camera_indices.begin(), m_camera_indices.end());
+    m_window_start = std::max(m_start_index, min_index - g_num_wts);
+    m_window_end   = std::min(m_end_index,   max_index + g_num_wts + 1);
+    if (m_window_end - m_window_start < 2) {
+      m_window_start = m_start_index;
+      m_window_end   = m_end_index;
+    }
 
-	VW_ASSERT(0 <= camera_index && camera_index < num_cameras,
-		  ArgumentErr() << "Out of bounds in the number of cameras");
+    set_num_residuals(2);
+    for (size_t i = 0; i < m_camera_indices.size(); i++)
+      mutable_parameter_block_sizes()->push_back(NUM_CAMERA_PARAMS);
+    mutable_parameter_block_sizes()->push_back(NUM_POINT_PARAMS);
+  }
 
-	VW_ASSERT(0 <= m_start_index && m_start_index <= camera_index
-		  && camera_index < m_end_index && m_end_index <= num_cameras,
-		  ArgumentErr() << "Book-keeping failure in camera indicies");
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    int num_blocks = m_camera_indices.size();
+    double const* point_params = parameters[num_blocks];
+    Vector3 point(point_params[0], point_params[1], point_params[2]);
+
+    // Copy the window of adjustments to local storage, and update
+    // them with the latest values for the ones being floated.
+    std::vector<double> local_cameras_vec
+      (m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_window_start,
+       m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_window_end);
+    for (int b = 0; b < num_blocks; b++) {
+      for (int p = 0; p < NUM_CAMERA_PARAMS; p++)
+	local_cameras_vec[NUM_CAMERA_PARAMS*(m_camera_indices[b] - m_window_start) + p]
+	  = parameters[b][p];
+    }
 
-	for (int p = 0; p < NUM_CAMERA_PARAMS; p++) {
-	  local_cameras_vec[NUM_CAMERA_PARAMS*camera_index + p] = camera[p];
-	}
-      }
+    boost::shared_ptr<AdjustedCamT> cam = adjusted_camera(local_cameras_vec);
+    Vector2 prediction;
+    if (!project(*cam, point, prediction, true)) {
+      residuals[0] = 1e+20;
+      residuals[1] = 1e+20;
+      return false;
+    }
 
-      // Extract the adjustments specific to the current camera
-      std::vector<vw::Vector3> position_adjustments;
-      std::vector<vw::Quat>   pose_adjustments;
-      populate_adjustements(local_cameras_vec,
-			    m_start_index, m_end_index,
-			    position_adjustments, pose_adjustments);
-
-      // The adjusted camera has just the adjustments, it does not create a full
-      // copy of the camera.
-      int interp_type = stereo_settings().piecewise_adjustment_interp_type;
-
-      asp::AdjustedModelWrapper cam_wrapper(m_session, m_cam,
-                                            interp_type,
-                                            m_adjustment_bounds,
-                                            position_adjustments, pose_adjustments,
-                                            m_image_size);
-      
-      // Copy the input data to structures expected by the BA model
-      Vector3 point_vec;
-      for (size_t p = 0; p < point_vec.size(); p++)
-	point_vec[p]  = (double)point[p];
-
-      // Project the current point into the current camera.  Note that
-      // we pass the observation as an initial guess, as the
-      // prediction is hopefully not too far from it.
-      Vector2 prediction = cam_wrapper.point_to_pixel(point_vec, m_observation.y());
-
-      // The error is the difference between the predicted and observed position,
-      // normalized by sigma.
-      residuals[0] = (prediction[0] - m_observation[0])/m_pixel_sigma[0];
-      residuals[1] = (prediction[1] - m_observation[1])/m_pixel_sigma[1];
+    // The error is the difference between the predicted and observed position,
+    // normalized by sigma.
+    for (int r = 0; r < 2; r++)
+      residuals[r] = (prediction[r] - m_observation[r])/m_pixel_sigma[r];
+
+    if (jacobians == NULL)
+      return true;
+
+    // Central differences in the point, with the same step as
+    // ceres::NumericDiffCostFunction.
+    double dpix_dpt[2][NUM_POINT_PARAMS];
+    for (int k = 0; k < NUM_POINT_PARAMS; k++) {
+      double step = std::max(RELATIVE_STEP*fabs(point[k]), RELATIVE_STEP);
+      Vector3 point_plus = point, point_minus = point;
+      point_plus[k]  += step;
+      point_minus[k] -= step;
+      Vector2 pix_plus, pix_minus;
+      bool good = project(*cam, point_plus, pix_plus) && project(*cam, point_minus, pix_minus);
+      for (int r = 0; r < 2; r++)
+	dpix_dpt[r][k] = good ? (pix_plus[r] - pix_minus[r])/(2*step)/m_pixel_sigma[r] : 0.0;
+    }
 
-    } catch (std::exception const& e) {
+    if (jacobians[num_blocks] != NULL) {
+      for (int r = 0; r < 2; r++)
+	for (int k = 0; k < NUM_POINT_PARAMS; k++)
+	  jacobians[num_blocks][r*NUM_POINT_PARAMS + k] = dpix_dpt[r][k];
+    }
 
-      // Failed to compute residuals
+    if (!cam->linear_interp()) {
+      numeric_adjustment_jacobians(local_cameras_vec, point, jacobians);
+      return true;
+    }
 
-      Mutex::Lock lock( g_jitter_mutex );
-      g_jitter_num_errors++;
-      if (g_jitter_num_errors < 100) {
-	vw_out(ErrorMessage) << e.what() << std::endl;
-      }else if (g_jitter_num_errors == 100) {
-	vw_out() << "Will print no more error messages about "
-                 << "failing to compute residuals.\n";
+    // The derivatives in a common offset and a common small rotation
+    // of all adjustments. The rotation is about the camera center.
+    Vector3 ray = point - cam->camera_center(prediction);
+    double dpix_dall[2][NUM_CAMERA_PARAMS];
+    for (int r = 0; r < 2; r++) {
+      for (int k = 0; k < NUM_CAMERA_PARAMS/2; k++) {
+	Vector3 axis;
+	axis[k] = 1.0;
+	Vector3 dpt = cross_prod(ray, axis); // moving the point this way
+	dpix_dall[r][k] = -dpix_dpt[r][k];
+	dpix_dall[r][k + NUM_CAMERA_PARAMS/2] = 0.0;
+	for (int j = 0; j < NUM_POINT_PARAMS; j++)
+	  dpix_dall[r][k + NUM_CAMERA_PARAMS/2] += dpix_dpt[r][j]*dpt[j];
       }
+    }
 
-      residuals[0] = T(1e+20);
-      residuals[1] = T(1e+20);
-      return false;
+    for (int b = 0; b < num_blocks; b++) {
+      if (jacobians[b] == NULL)
+	continue;
+      double wt = cam->get_adj_weight(prediction.y(), m_camera_indices[b] - m_window_start);
+      for (int r = 0; r < 2; r++)
+	for (int p = 0; p < NUM_CAMERA_PARAMS; p++)
+	  jacobians[b][r*NUM_CAMERA_PARAMS + p] = wt*dpix_dall[r][p];
     }
 
     return true;
   }
 
-  template <typename T>
-  bool operator()(const T* const camera1, const T* const point, T* residuals) const {
-    return do_calc<T>(camera1, NULL, NULL, NULL, point, residuals);
-  }
-
-  template <typename T>
-  bool operator()(const T* const camera1,
-		  const T* const camera2,
-		  const T* const point, T* residuals) const {
-    return do_calc<T>(camera1, camera2, NULL, NULL,  point, residuals);
-  }
-
-  template <typename T>
-  bool operator()(const T* const camera1,
-		  const T* const camera2,
-		  const T* const camera3,
-		  const T* const point, T* residuals) const {
-    return do_calc<T>(camera1, camera2, camera3, NULL, point, residuals);
-  }
-
-  template <typename T>
-  bool operator()(const T* const camera1,
-		  const T* const camera2,
-		  const T* const camera3,
-		  const T* const camera4,
-		  const T* const point, T* residuals) const {
-    return do_calc<T>(camera1, camera2, camera3, camera4, point, residuals);
-  }
-
   // Factory to hide the construction of the CostFunction object from
   // the client code.
   static ceres::CostFunction* Create(Vector2 const& observation,
@@ -322,65 +272,81 @@ struct PiecewiseReprojectionError {
 				     std::vector<double> const& cameras_vec,
 				     boost::shared_ptr<vw::camera::CameraModel> cam,
 				     Vector2i const& image_size,
-				     std::string const& session,
 				     int start_index,
-				     int camera_index1,
-				     int camera_index2,
-				     int camera_index3,
-				     int camera_index4,
-				     int end_index,
-				     size_t ipt // point index
-				     ){
-
-    if (camera_index2 < 0 && camera_index3 < 0 && camera_index4 < 0)
-      return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
-
-    if (camera_index3 < 0 && camera_index4 < 0)
-      return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
-
-    if (camera_index4 < 0)
-      return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS,
-              NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
-
-    if (camera_index1 < 0 || camera_index2 < 0 || camera_index3 < 0)
-      vw_throw( ArgumentErr() << "Book-keeping failure in camera indices: "
-		<< camera_index1 << ' ' << camera_index2 << ' ' << camera_index3 << ".\n" );
-
-
-    return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	    ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS,
-            NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	    (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					    cameras_vec, cam, image_size, session,
-					    start_index,
-					    camera_index1, camera_index2,
-					    camera_index3, camera_index4,
-					    end_index,
-					    ipt)));
+				     std::vector<int> const& camera_indices,
+				     int end_index){
+    return new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
+					  cameras_vec, cam, image_size,
+					  start_index, camera_indices, end_index);
+  }
+
+private:
+
+  static const double RELATIVE_STEP;
+
+  // The adjusted camera has just the adjustments, it does not create a full
+  // copy of the camera.
+  boost::shared_ptr<AdjustedCamT> adjusted_camera(std::vector<double> const& local_cameras_vec) const {
+    std::vector<vw::Vector3> position_adjustments;
+    std::vector<vw::Quat>    pose_adjustments;
+    populate_adjustements(local_cameras_vec,
+			  0, m_window_end - m_window_start,
+			  position_adjustments, pose_adjustments);
+    int interp_type = stereo_settings().piecewise_adjustment_interp_type;
+    return boost::shared_ptr<AdjustedCamT>
+      (new AdjustedCamT(m_cam, interp_type, m_adjustment_bounds,
+			position_adjustments, pose_adjustments, m_image_size,
+			m_window_start - m_start_index, m_end_index - m_start_index));
+  }
+
+  // Project the point into the camera. Note that we pass the
+  // observation as an initial guess, as the prediction is hopefully
+  // not too far from it. Failures are counted if requested.
+  bool project(AdjustedCamT const& cam, Vector3 const& point, Vector2 & pixel,
+	       bool report_failure = false) const {
+    try {
+      pixel = cam.point_to_pixel(point, m_observation.y());
+    } catch (std::exception const& e) {
+
+      // Failed to compute residuals
+      if (report_failure) {
+	Mutex::Lock lock( g_jitter_mutex );
+	g_jitter_num_errors++;
+	if (g_jitter_num_errors < 100) {
+	  vw_out(ErrorMessage) << e.what() << std::endl;
+	}else if (g_jitter_num_errors == 100) {
+	  vw_out() << "Will print no more error messages about "
+		   << "failing to compute residuals.\n";
+	}
+      }
+      pixel = Vector2(-999999,-999999);
+      return false;
+    }
+    return true;
+  }
+
+  // Central differences in the adjustments being floated
+  void numeric_adjustment_jacobians(std::vector<double> const& local_cameras_vec,
+				    Vector3 const& point, double** jacobians) const {
+
+    for (size_t b = 0; b < m_camera_indices.size(); b++) {
+      if (jacobians[b] == NULL)
+	continue;
+      int start = NUM_CAMERA_PARAMS*(m_camera_indices[b] - m_window_start);
+      for (int p = 0; p < NUM_CAMERA_PARAMS; p++) {
+	double val  = local_cameras_vec[start + p];
+	double step = std::max(RELATIVE_STEP*fabs(val), RELATIVE_STEP);
+	std::vector<double> plus_vec = local_cameras_vec, minus_vec = local_cameras_vec;
+	plus_vec [start + p] += step;
+	minus_vec[start + p] -= step;
+	Vector2 pix_plus, pix_minus;
+	bool good = project(*adjusted_camera(plus_vec),  point, pix_plus) &&
+	            project(*adjusted_camera(minus_vec), point, pix_minus);
+	for (int r = 0; r < 2; r++)
+	  jacobians[b][r*NUM_CAMERA_PARAMS + p]
+	    = good ? (pix_plus[r] - pix_minus[r])/(2*step)/m_pixel_sigma[r] : 0.0;
+      }
+    }
   }
 
   Vector2 m_observation;
@@ -389,18 +355,23 @@ struct PiecewiseReprojectionError {
   std::vector<double> const& m_cameras_vec;  // alias
   boost::shared_ptr<vw::camera::CameraModel> m_cam;
   Vector2i m_image_size; // TODO: Group this with the above
-  std::string m_session;
-								   
+
   // all adjustments for the current camera will be >= this
   int m_start_index;
 
   // indices of the current adjustments
-  int m_camera_index1, m_camera_index2, m_camera_index3, m_camera_index4;
+  std::vector<int> m_camera_indices;
 
   int m_end_index;    // all adjustment indices for current camera will be < this
-  int m_ipt;          // index of the current 3D point in the vector of points
+
+  // the window of adjustments used to create the camera
+  int m_window_start, m_window_end;
 };
 
+template <class AdjustedCamT>
+const double PiecewiseReprojectionError<AdjustedCamT>::RELATIVE_STEP = 1e-6;
+
+
 // A ceres cost function. The residual is the difference between the
 // original camera center and the current (floating) camera center.
 // This cost function prevents the cameras from straying too far from
@@ -440,6 +411,76 @@ ceres::LossFunction* get_jitter_loss_function(){
 }
 
 
+// Add the cost function components for the pixel observations in
+// the given camera.
+template <class AdjustedCamT>
+void add_reprojection_residuals(ceres::Problem & problem,
+				CameraNode<JFeature> & camera_node,
+				boost::shared_ptr<vw::camera::CameraModel> camera_model,
+				Vector2 const& adjustment_bounds,
+				Vector2i const& image_size,
+				std::vector<double> & cameras_vec,
+				std::vector<double> & points_vec,
+				int start_index, int end_index){
+
+  int num_total_adj = cameras_vec.size()/NUM_CAMERA_PARAMS;
+  int num_points    = points_vec.size()/NUM_POINT_PARAMS;
+
+  // Initialize an adjusted model with no adjustments. We need it simply to
+  // look up the index adjustments.
+  std::vector<vw::Vector3> position_adjustments(end_index - start_index);
+  std::vector<vw::Quat> pose_adjustments(end_index - start_index);
+  AdjustedCamT adj_cam(camera_model,
+		       stereo_settings().piecewise_adjustment_interp_type,
+		       adjustment_bounds,
+		       position_adjustments, pose_adjustments,
+		       image_size);
+
+  typedef CameraNode<JFeature>::iterator crn_iter;
+  for (crn_iter fiter = camera_node.begin(); fiter != camera_node.end(); fiter++){
+
+    // The index of the 3D point
+    int ipt = (**fiter).m_point_id;
+    VW_ASSERT(ipt < num_points, ArgumentErr() << "Out of bounds in the number of points");
+
+    // The observed value for the projection of point with index ipt into
+    // the camera with index icam.
+    Vector2 observation = (**fiter).m_location;
+    Vector2 pixel_sigma = (**fiter).m_scale;
+
+    // This is a bugfix for NaN problems
+    if (pixel_sigma != pixel_sigma)
+      pixel_sigma = Vector2(1, 1);
+
+    // The adjustments that will be affected by the current observation (recall that
+    // the adjustments are placed at several scan lines (image rows)).
+    std::vector<int> indices = adj_cam.get_closest_adj_indices(observation.y());
+
+    VW_ASSERT(indices.size() >= 1 && indices.size() <= 4,
+	      ArgumentErr() << "Expecting between 1 and 4 camera indices.");
+
+    // Each observation corresponds to a pair of a camera and a point
+    std::vector<double*> param_blocks;
+    for (size_t i = 0; i < indices.size(); i++) {
+      indices[i] += start_index;
+      VW_ASSERT(0 <= indices[i] && indices[i] < num_total_adj,
+		ArgumentErr() << "Out of bounds in the camera index");
+      param_blocks.push_back(&cameras_vec[0] + indices[i] * NUM_CAMERA_PARAMS);
+    }
+    param_blocks.push_back(&points_vec[0] + ipt * NUM_POINT_PARAMS);
+
+    ceres::LossFunction* loss_function = get_jitter_loss_function();
+
+    ceres::CostFunction* cost_function
+      = PiecewiseReprojectionError<AdjustedCamT>::Create(observation, pixel_sigma,
+							 adjustment_bounds,
+							 cameras_vec, camera_model,
+							 image_size,
+							 start_index, indices, end_index);
+    problem.AddResidualBlock(cost_function, loss_function, param_blocks);
+  }
+}
+
 std::vector<double> * g_cameras_vec;
 
 // Will be called at each iteration. Here we can put any desired logging info.
@@ -518,7 +559,7 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   std::vector<Vector2> adjustment_bounds;
   adjustment_bounds.resize(num_cameras);
   std::vector<ip::InterestPoint> ip0, ip1;
-  ip::read_binary_match_file(match_file, ip0, ip1);
+  asp::read_match_file(match_file, ip0, ip1);
   adjustment_bounds[0]
     = find_bounds_from_percentiles(ip0, stereo_settings().piecewise_adjustment_percentiles);
   adjustment_bounds[1]
@@ -612,7 +653,6 @@ void jitter_adjust(std::vector<std::string> const& image_files,
       points_vec[ipt*NUM_POINT_PARAMS + q] = cnet[ipt].position()[q];
     }
   }
-  double* points = &points_vec[0];
 
   // The camera positions and orientations before we float them
   std::vector<double> orig_cameras_vec = cameras_vec;
@@ -624,122 +664,26 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   CameraRelationNetwork<JFeature> crn;
   crn.read_controlnetwork(cnet);
   start_index = 0;
-  std::vector<Vector2i> sizes;
-  
+  bool is_dg = (session == "dg" || session == "dgmaprpc");
   for (int icam = 0; icam < (int)crn.size(); icam++) {
 
     if (icam > 0)
       start_index += num_adj_per_cam[icam - 1];
     int end_index = start_index + num_adj_per_cam[icam];
 
-    // Initialize an adjusted model with no adjustments. We need it simply to
-    // look up the index adjustments.
-    std::vector<vw::Vector3> position_adjustments(num_adj_per_cam[icam]);
-    std::vector<vw::Quat> pose_adjustments(num_adj_per_cam[icam]);
+    VW_ASSERT(icam < num_cameras, ArgumentErr() << "Out of bounds in the number of cameras");
 
     DiskImageView<float> img(image_files[icam]);
     Vector2i image_size(img.cols(), img.rows());
-    sizes.push_back(image_size);
-
-    asp::AdjustedModelWrapper cam_wrapper(session, 
-                                          camera_models[icam],
-                                          stereo_settings().piecewise_adjustment_interp_type,
-                                          adjustment_bounds[icam],
-                                          position_adjustments, pose_adjustments,
-                                          image_size);
-    
-    typedef CameraNode<JFeature>::iterator crn_iter;
-    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
-
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
-
-      VW_ASSERT(icam < num_cameras, ArgumentErr() << "Out of bounds in the number of cameras");
-      VW_ASSERT(ipt < num_points,   ArgumentErr() << "Out of bounds in the number of points");
-
-      // The observed value for the projection of point with index ipt into
-      // the camera with index icam.
-      Vector2 observation = (**fiter).m_location;
-      Vector2 pixel_sigma = (**fiter).m_scale;
-
-      // This is a bugfix for NaN problems
-      if (pixel_sigma != pixel_sigma)
-	pixel_sigma = Vector2(1, 1);
-
-      // The adjustments that will be affected by the current observation (recall that
-      // the adjustments are placed at several scan lines (image rows)).
-      std::vector<int> indices = cam_wrapper.get_closest_adj_indices(observation.y());
-
-      VW_ASSERT(indices.size() >= 1 && indices.size() <= 4,
-		ArgumentErr() << "Expecting between 1 and 4 camera indices.");
-
-      // We assume below there are only 4 closest indices!
-      int camera_index1 = -1, camera_index2 = -1, camera_index3 = -1, camera_index4 = -1;
-
-      if (indices.size() >= 1) camera_index1 = indices[1-1] + start_index;
-      if (indices.size() >= 2) camera_index2 = indices[2-1] + start_index;
-      if (indices.size() >= 3) camera_index3 = indices[3-1] + start_index;
-      if (indices.size() >= 4) camera_index4 = indices[4-1] + start_index;
-
-      VW_ASSERT(            0 <= camera_index1 &&
-		camera_index1 <  num_total_adj &&
-		camera_index2 <  num_total_adj &&
-		camera_index3 <  num_total_adj &&
-		camera_index4 <  num_total_adj,
-		ArgumentErr() << "Out of bounds in the camera index");
-
-      // Each observation corresponds to a pair of a camera and a point
-      double * point = points  + ipt * NUM_POINT_PARAMS;
-
-      ceres::LossFunction* loss_function = get_jitter_loss_function();
-
-      ceres::CostFunction* cost_function
-	= PiecewiseReprojectionError::Create(observation, pixel_sigma,
-					     adjustment_bounds[icam],
-					     cameras_vec, camera_models[icam],
-					     sizes[icam],
-					     session,
-					     start_index,
-					     camera_index1, camera_index2,
-					     camera_index3, camera_index4,
-					     end_index,
-					     ipt);
-      if      (camera_index2 < 0) {
-	problem.AddResidualBlock(cost_function, loss_function,
-				 cameras + camera_index1 * NUM_CAMERA_PARAMS,
-				 point);
-
-      }else if (camera_index3 < 0) {
-	problem.AddResidualBlock(cost_function, loss_function,
-				 cameras + camera_index1 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index2 * NUM_CAMERA_PARAMS,
-				 point);
-
-      }else if (camera_index4 < 0) {
-	problem.AddResidualBlock(cost_function, loss_function,
-				 cameras + camera_index1 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index2 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index3 * NUM_CAMERA_PARAMS,
-				 point);
-
-      }else if (camera_index1 >= 0 && camera_index2 >= 0 &&
-		camera_index3 >= 0 && camera_index4 >= 0){
-	problem.AddResidualBlock(cost_function, loss_function,
-				 cameras + camera_index1 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index2 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index3 * NUM_CAMERA_PARAMS,
-				 cameras + camera_index4 * NUM_CAMERA_PARAMS,
-				 point);
-
-      }else{
-	vw_throw( ArgumentErr() << "Book-keeping failure in camera indices! "
-		  << "Values of start_index, camera indices, and end_index are "
-		  << start_index << ' ' << camera_index1 << ' ' << camera_index2
-		  << ' ' << camera_index3 << ' ' << camera_index4 << ' ' << end_index << "\n" );
-      }
-
-    }
 
+    if (is_dg)
+      add_reprojection_residuals<asp::AdjustedLinescanDGModel>
+	(problem, crn[icam], camera_models[icam], adjustment_bounds[icam], image_size,
+	 cameras_vec, points_vec, start_index, end_index);
+    else
+      add_reprojection_residuals<asp::PiecewiseAdjustedLinescanModel>
+	(problem, crn[icam], camera_models[icam], adjustment_bounds[icam], image_size,
+	 cameras_vec, points_vec, start_index, end_index);
   }
 
   // Add camera constraints
@@ -18,6 +18,8 @@
 
 /// \file lronacjitreg.cc
 ///
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Math/Functors.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/ImageMath.h>
@@ -38,6 +40,7 @@
 #include <asp/Tools/stereo.h>
 
 #include <iomanip>
+#include <cmath>
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
@@ -78,6 +81,54 @@ struct Parameters : vw::cartography::GdalWriteOptions
 
 
 
+/// The sums of the valid disparities in one row of the disparity map
+struct RowShifts {
+  double sum_x, sum_y, sum_xx, sum_yy;
+  int    count;
+  RowShifts(): sum_x(0), sum_y(0), sum_xx(0), sum_yy(0), count(0) {}
+};
+
+/// Rasterize a band of rows of the disparity map and sum the valid
+/// disparities of each row. The bands are computed at the same time,
+/// each on its own thread, and each task writes only its own rows.
+class RowShiftsTask : public Task, private boost::noncopyable {
+  ImageViewRef<PixelMask<Vector2f> > const& m_disparity;
+  int m_beg, m_end;
+  std::vector<RowShifts> & m_shifts;
+public:
+  RowShiftsTask(ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                int beg, int end, std::vector<RowShifts> & shifts):
+    m_disparity(disparity), m_beg(beg), m_end(end), m_shifts(shifts) {}
+
+  void operator()() {
+    ImageView<PixelMask<Vector2f> > disp
+      = crop(m_disparity, BBox2i(0, m_beg, m_disparity.cols(), m_end - m_beg));
+    for (int row = 0; row < disp.rows(); row++) {
+      RowShifts & s = m_shifts[m_beg + row];
+      for (int col = 0; col < disp.cols(); col++) {
+        if (!is_valid(disp(col, row)))
+          continue;
+        double dX = disp(col, row).child()[0];
+        double dY = disp(col, row).child()[1];
+        s.sum_x  += dX;
+        s.sum_y  += dY;
+        s.sum_xx += dX*dX;
+        s.sum_yy += dY*dY;
+        s.count++;
+      }
+    }
+  }
+};
+
+/// The standard deviation of values from their sum and sum of squares
+double std_dev(double sum, double sum_sq, double count) {
+  if (count <= 0)
+    return 0.0;
+  double mean = sum / count;
+  return std::sqrt(std::max(sum_sq / count - mean*mean, 0.0));
+}
+
+
 bool handle_arguments(int argc, char* argv[],
                      Parameters &opt) 
 { 
@@ -260,9 +311,9 @@ bool determineShifts(Parameters & params,
   int    corr_timeout       = 0;
   int    min_lr_level = 0;
   double seconds_per_op     = 0.0;
-  DiskCacheImageView<PixelMask<Vector2f> >
+  ImageViewRef<PixelMask<Vector2f> >
     disparity_map
-    ( stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
+    = stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
 				 apply_mask(create_mask_less_or_equal(crop(right_disk_image, crop_roi),0)),
 				 constant_view( uint8(255), left_disk_image ),
 				 constant_view( uint8(255), right_disk_image ),
@@ -270,12 +321,28 @@ bool determineShifts(Parameters & params,
 				 searchRegion,
 				 params.kernel,
 				 corr_type, corr_timeout, seconds_per_op,
-				 params.lrthresh, min_lr_level, filter_kernel_size, max_pyramid_levels ) );
+				 params.lrthresh, min_lr_level, filter_kernel_size, max_pyramid_levels );
 
   // Compute the mean horizontal and vertical shifts
-  // - Currently disparity_map contains the per-pixel shifts
-  
-  printf("Accumulating offsets...\n");  
+  // - Correlate bands of rows in parallel and sum the shifts in each
+  //   row as each band is computed, instead of caching the disparity
+  //   on disk and reading it back one pixel at a time.
+
+  printf("Correlating and accumulating offsets...\n");
+
+  const int band_height = 1024;
+  const int num_rows    = disparity_map.rows();
+  std::vector<RowShifts> shifts(num_rows);
+  {
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int beg = 0; beg < num_rows; beg += band_height) {
+      int end = std::min(beg + band_height, num_rows);
+      boost::shared_ptr<RowShiftsTask>
+        task(new RowShiftsTask(disparity_map, beg, end, shifts));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
 
   std::ofstream out;
   const bool writeLogFile = !params.rowLogFilePath.empty();
@@ -326,66 +393,59 @@ bool determineShifts(Parameters & params,
   double meanHorizOffset     = 0.0;
   int    numValidRows        = 0;
   int    totalNumValidPixels = 0;
-  
-  vw::StdDevAccumulator<float> stdCalcX, stdCalcY;
-  
-  std::vector<double> rowOffsets(disparity_map.rows());
-  std::vector<double> colOffsets(disparity_map.rows());  
-  for (int row=0; row<disparity_map.rows(); ++row)
+
+  // Totals over all rows
+  RowShifts total;
+
+  std::vector<double> rowOffsets(num_rows);
+  std::vector<double> colOffsets(num_rows);
+  for (int row=0; row<num_rows; ++row)
   {
-  
-    // Accumulate the shifts for this row
-    vw::StdDevAccumulator<float> stdDevCalcRow;
-    double rowSum        = 0.0;
-    double colSum        = 0.0;
-    double stdDevRow     = 0.0;
-    int    numValidInRow = 0;
-    for (int col=0; col<disparity_map.cols(); ++col)
-    {
-    
-      if (is_valid(disparity_map(col,row)))
-      {
-        float dY = disparity_map(col,row)[1]; // Y
-        float dX = disparity_map(col,row)[0]; // X
-        rowSum += dY;
-        colSum += dX;
-        ++numValidInRow;
-      
-        stdCalcX(dX);
-        stdCalcY(dY);
-
-        stdDevCalcRow(dY);
-      }
-    } // End loop through cols
+    RowShifts const& s = shifts[row];
+    double stdDevRow = 0.0;
 
     // Compute mean shift for this row
-    if (numValidInRow == 0)
+    if (s.count == 0)
     {
       rowOffsets[row] = 0;
       colOffsets[row] = 0;
-      stdDevRow       = 0;
     }
     else  // At least one valid pixel
     {
-      rowOffsets[row] = rowSum / static_cast<double>(numValidInRow);
-      colOffsets[row] = colSum / static_cast<double>(numValidInRow);
-      stdDevRow = stdDevCalcRow.value();
-      totalNumValidPixels += numValidInRow;
-      ++numValidRows;      
+      rowOffsets[row] = s.sum_y / static_cast<double>(s.count);
+      colOffsets[row] = s.sum_x / static_cast<double>(s.count);
+      stdDevRow = std_dev(s.sum_y, s.sum_yy, s.count);
+      totalNumValidPixels += s.count;
+      ++numValidRows;
+
+      total.sum_x  += s.sum_x;
+      total.sum_y  += s.sum_y;
+      total.sum_xx += s.sum_xx;
+      total.sum_yy += s.sum_yy;
     }
-    
+
     if (writeLogFile)
     {
       out << setprecision(4)
-          << setw(5) << row             << ", " 
-          << setw(6) << rowOffsets[row] << ", " 
-          << setw(6) << colOffsets[row] << " Count = " 
-          << setw(3) << numValidInRow   << " Std = " 
-          << setw(4) << stdDevRow << std::endl;    
+          << setw(5) << row             << ", "
+          << setw(6) << rowOffsets[row] << ", "
+          << setw(6) << colOffsets[row] << " Count = "
+          << setw(3) << s.count         << " Std = "
+          << setw(4) << stdDevRow << std::endl;
     }
 
   } // End loop through rows
- 
+
+  // The mean and standard deviation of the shifts of all valid pixels
+  double meanX = 0.0, meanY = 0.0;
+  if (totalNumValidPixels > 0)
+  {
+    meanX = total.sum_x / totalNumValidPixels;
+    meanY = total.sum_y / totalNumValidPixels;
+  }
+  double stdDevX = std_dev(total.sum_x, total.sum_xx, totalNumValidPixels);
+  double stdDevY = std_dev(total.sum_y, total.sum_yy, totalNumValidPixels);
+
   if (writeLogFile)
   {
     out << "\n#  **** Registration Data ****\n";
@@ -405,10 +465,10 @@ bool determineShifts(Parameters & params,
     if(numValidRows > 0) 
     {
       out << "#   Using IpFind result only:   0" << endl;
-      out << "#   Average Sample Offset: " << setprecision(4) << stdCalcX.mean()
-          << "  StdDev: " << setprecision(4) << stdCalcX.value() << endl;
-      out << "#   Average Line Offset:   " << setprecision(4) << stdCalcY.mean()
-          << " StdDev: " << setprecision(4) << stdCalcY.value() << endl;
+      out << "#   Average Sample Offset: " << setprecision(4) << meanX
+          << "  StdDev: " << setprecision(4) << stdDevX << endl;
+      out << "#   Average Line Offset:   " << setprecision(4) << meanY
+          << " StdDev: " << setprecision(4) << stdDevY << endl;
      }
      else  // No valid rows
      {
@@ -439,8 +499,8 @@ bool determineShifts(Parameters & params,
   }
   
   // Compute overall mean shift
-  meanVertOffset  = stdCalcY.mean();
-  meanHorizOffset = stdCalcX.mean();
+  meanVertOffset  = meanY;
+  meanHorizOffset = meanX;
   
   dX = meanHorizOffset;
   dY = meanVertOffset;
@@ -33,6 +33,10 @@
 #include <asp/Core/Common.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/InverseGrid.h>
+#include <asp/Core/DecodedImageCache.h>
+#include <asp/Core/ObjectStorage.h>
+#include <asp/Core/SharedDem.h>
 
 #include <boost/algorithm/string/replace.hpp>
 
@@ -119,16 +123,162 @@ public:
 /// The pixel type used for the DEM data
 typedef PixelMask<float> DemPixelT;
 
+/// Tells if the DEM has heights around the ground point of an output
+/// pixel, so that Map2CamTrans can project it into the camera.
+class DemFootprint {
+  GeoReference            m_target_georef, m_dem_georef;
+  ImageViewRef<DemPixelT> m_dem;
+
+  bool has_height(Vector2 const& dem_pix) const {
+    int col = (int)floor(dem_pix.x()), row = (int)floor(dem_pix.y());
+    if (col < 0 || row < 0 || col + 1 >= m_dem.cols() || row + 1 >= m_dem.rows())
+      return false;
+    return is_valid(m_dem(col, row    )) && is_valid(m_dem(col + 1, row    )) &&
+           is_valid(m_dem(col, row + 1)) && is_valid(m_dem(col + 1, row + 1));
+  }
+
+public:
+  DemFootprint(GeoReference const& target_georef, GeoReference const& dem_georef,
+               ImageViewRef<DemPixelT> const& dem):
+    m_target_georef(target_georef), m_dem_georef(dem_georef), m_dem(dem) {}
+
+  bool operator()(Vector2 const& pix) const {
+    Vector2 lonlat = m_target_georef.pixel_to_lonlat(pix);
+    // The DEM longitudes may be offset by 360 degrees from the output ones
+    const double lon_shifts[] = {0.0, -360.0, 360.0};
+    for (int k = 0; k < 3; k++) {
+      if (has_height(m_dem_georef.lonlat_to_pixel(lonlat + Vector2(lon_shifts[k], 0))))
+        return true;
+    }
+    return false;
+  }
+};
+
+/// On a datum all output pixels have a height
+struct DatumFootprint {
+  bool operator()(Vector2 const& /*pix*/) const { return true; }
+};
+
+/// Map-project an image the way transform_nodata() does, but with the
+/// camera pixels of each tile found by asp::inverse_grid(), which
+/// projects into the camera exactly only where interpolation is not
+/// accurate enough. The interpolated pixels are checked to be in the
+/// DEM footprint, as there may be holes in the DEM smaller than a cell.
+template <class ImageT, class EdgeT, class TransformT, class FootprintT>
+class InverseGridTransformView:
+    public ImageViewBase<InverseGridTransformView<ImageT, EdgeT, TransformT, FootprintT> > {
+
+  ImageT     m_image;
+  EdgeT      m_edge;
+  TransformT m_trans;
+  FootprintT m_footprint;
+  int        m_cols, m_rows;
+  double     m_tol;
+  typename ImageT::pixel_type m_nodata;
+
+  template <class InterpT, class TileT>
+  void sample(InterpT const& interp, BBox2i const& in_box, ImageView<Vector2> const& coords,
+              ImageView<uint8> const& use, TileT & tile) const {
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        if (use(col, row))
+          tile(col, row) = interp(coords(col, row).x() - in_box.min().x(),
+                                  coords(col, row).y() - in_box.min().y());
+      }
+    }
+  }
+
+public:
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type                  result_type;
+  typedef ProceduralPixelAccessor<InverseGridTransformView> pixel_accessor;
+
+  InverseGridTransformView(ImageT const& image, EdgeT const& edge, TransformT const& trans,
+                           FootprintT const& footprint, int cols, int rows, double tol,
+                           pixel_type const& nodata):
+    m_image(image), m_edge(edge), m_trans(trans), m_footprint(footprint),
+    m_cols(cols), m_rows(rows), m_tol(tol), m_nodata(nodata) {}
+
+  inline int32 cols  () const { return m_cols; }
+  inline int32 rows  () const { return m_rows; }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
+    vw_throw(NoImplErr() << "InverseGridTransformView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    const int GRID_SPACING = 16;
+    Vector2 invalid_pix = vw::camera::CameraModel::invalid_pixel();
+    ImageView<Vector2> coords;
+    ImageView<uint8>   exact;
+    asp::inverse_grid(m_trans, bbox, GRID_SPACING, m_tol, invalid_pix, coords, exact);
+
+    // Keep the camera pixels which can be interpolated into, as in
+    // Datum2CamTrans, and find the input image region they need
+    int b = BicubicInterpolation::pixel_buffer;
+    ImageView<uint8> use(bbox.width(), bbox.height());
+    BBox2 in_box;
+    bool any = false;
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        Vector2 const& pt = coords(col, row);
+        use(col, row) = ( pt != invalid_pix &&
+                          pt[0] >= b - 1 && pt[0] < m_image.cols() - b &&
+                          pt[1] >= b - 1 && pt[1] < m_image.rows() - b &&
+                          (exact(col, row) ||
+                           m_footprint(Vector2(bbox.min().x() + col, bbox.min().y() + row))) );
+        if (use(col, row)) {
+          in_box.grow(pt);
+          any = true;
+        }
+      }
+    }
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    fill(tile, m_nodata);
+    if (any) {
+      BBox2i in_ibox = grow_bbox_to_int(in_box);
+      in_ibox.expand(b + 1);
+      ImageView<pixel_type> src = crop(edge_extend(m_image, m_edge), in_ibox);
+      sample(interpolate(src, BicubicInterpolation(), m_edge), in_ibox, coords, use, tile);
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT, class EdgeT, class TransformT, class FootprintT>
+InverseGridTransformView<ImageT, EdgeT, TransformT, FootprintT>
+inverse_grid_transform(ImageViewBase<ImageT> const& image, EdgeT const& edge,
+                       TransformT const& trans, FootprintT const& footprint,
+                       int cols, int rows, double tol,
+                       typename ImageT::pixel_type const& nodata) {
+  return InverseGridTransformView<ImageT, EdgeT, TransformT, FootprintT>
+    (image.impl(), edge, trans, footprint, cols, rows, tol, nodata);
+}
+
 
 struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
-    bundle_adjust_prefix;
-  bool isQuery, noGeoHeaderInfo;
+    bundle_adjust_prefix, image_cache_dir, object_cache_dir, dem_cache_dir;
+  std::string image_data_file; ///< Where to read the image pixels from, decoded if JPEG2000
+  std::string output_object;   ///< Where to upload the output to, if in object storage
+  bool isQuery, noGeoHeaderInfo, cog;
 
   // Settings
   std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, inverse_grid_tolerance;
   BBox2 target_projwin, target_pixelwin;
 };
 
@@ -161,7 +311,17 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type, when the input is single channel. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type. This option will be ignored for multi-channel images, when the output type is set to be the same as the input type.")
     ("mo",  po::value(&opt.metadata)->default_value(""), "Write metadata to the output file. Provide as a string in quotes if more than one item, separated by a space, such as 'VAR1=VALUE1 VAR2=VALUE2'. Neither the variable names nor the values should contain spaces.")
     ("no-geoheader-info", po::bool_switch(&opt.noGeoHeaderInfo)->default_value(false),
-     "Suppress writing some auxiliary information in geoheaders.");
+     "Suppress writing some auxiliary information in geoheaders.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output image as a Cloud-Optimized GeoTIFF file, with overviews. Needs GDAL 3.1 or newer.")
+    ("inverse-grid-tolerance", po::value(&opt.inverse_grid_tolerance)->default_value(0),
+     "If positive, project into the camera exactly only at the nodes of a grid, refined where bilinear interpolation is off by more than this many camera pixels, and interpolate elsewhere. Much faster for linescan cameras.")
+    ("image-cache-dir", po::value(&opt.image_cache_dir)->default_value(""),
+     "If the input image is compressed with JPEG2000, such as a DigitalGlobe NITF file, decode it with all threads, once, into an uncompressed file in this directory, and read that instead. Can be shared with stereo and pansharp.")
+    ("dem-cache-dir", po::value(&opt.dem_cache_dir)->default_value(""),
+     "Convert the DEM, once per machine, into an uncompressed float file in this directory, and map that in memory, so that the processes of mapproject share one copy of the DEM. Can be shared with stereo, bundle_adjust and pc_align.")
+    ("object-cache-dir", po::value(&opt.object_cache_dir)->default_value(""),
+     "Fetch the inputs given as s3:// or http(s):// objects into this directory, with parallel ranged requests, and read them from there. Without it, such images are read in place. An output given as an s3:// object is written in this directory, or in the temporary directory, then uploaded.");
   
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -189,6 +349,17 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") )
     vw_throw( ArgumentErr() << usage << general_options );
 
+  // Inputs in object storage are read in place or fetched to a local
+  // copy. With an ISIS cube and no camera file, the camera file is
+  // the output, which does not exist yet.
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  opt.dem_file   = asp::object_read_path(opt.dem_file,   opt.object_cache_dir, num_threads);
+  opt.image_file = asp::object_read_path(opt.image_file, opt.object_cache_dir, num_threads);
+  if (!opt.output_file.empty() || asp::object_exists(opt.camera_file))
+    opt.camera_file = asp::object_read_path(opt.camera_file, opt.object_cache_dir, num_threads);
+
   // We support map-projecting using the DG camera model, however, these images
   // cannot be used later to do stereo, as that process expects the images
   // to be map-projected using the RPC model.
@@ -313,6 +484,8 @@ void write_parallel_cond( std::string              const& filename,
                                 has_nodata, nodata_val, opt, tpc, keywords);
   }
 
+  if (opt.cog)
+    asp::convert_to_cog(filename, opt, TerminalProgressCallback("asp", "\t--> COG: "));
 }
 
 /// Compute which camera pixel observes a DEM pixel.
@@ -474,19 +647,20 @@ void calc_target_geom(// Inputs
 
 
 /// Map project the image with a nodata value.  Used for single channel images.
-template <class ImagePixelT, class Map2CamTransT>
+template <class ImagePixelT, class Map2CamTransT, class FootprintT>
 void project_image_nodata(Options & opt,
                           GeoReference const& croppedGeoRef,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
                           boost::shared_ptr<camera::CameraModel> const& camera_model,
-                   Map2CamTransT const& transform) {
+                   Map2CamTransT const& transform,
+                   FootprintT    const& footprint) {
 
     typedef PixelMask<ImagePixelT> ImageMaskPixelT;
 
     // Create handle to input image to be projected on to the map
     boost::shared_ptr<DiskImageResource> img_rsrc = 
-          vw::DiskImageResourcePtr(opt.image_file);   
+          vw::DiskImageResourcePtr(opt.image_data_file);   
 
     // Update the nodata value from the input file if it is present.
     if (img_rsrc->has_nodata_read()) 
@@ -495,6 +669,31 @@ void project_image_nodata(Options & opt,
     bool            has_img_nodata = true;
     ImageMaskPixelT nodata_mask    = ImageMaskPixelT(); // invalid value for a PixelMask
 
+    if (opt.inverse_grid_tolerance > 0) {
+      write_parallel_type
+        ( // Write to the output file
+         opt.output_file,
+         crop( // Apply crop (only happens if --t_pixelwin was specified)
+              apply_mask
+              ( // Handle nodata
+               inverse_grid_transform(create_mask(DiskImageView<ImagePixelT>(img_rsrc),
+                                                  opt.nodata_value), // Handle nodata
+                                      ValueEdgeExtension<ImageMaskPixelT>(nodata_mask),
+                                      transform, footprint,
+                                      virtual_image_size[0],
+                                      virtual_image_size[1],
+                                      opt.inverse_grid_tolerance, nodata_mask
+                                      ),
+               opt.nodata_value
+               ),
+              croppedImageBB
+              ),
+         croppedGeoRef, has_img_nodata, opt.nodata_value, opt,
+         TerminalProgressCallback("","")
+         );
+      return;
+    }
+
     write_parallel_type
       ( // Write to the output file
        opt.output_file,
@@ -521,21 +720,43 @@ void project_image_nodata(Options & opt,
 }
 
 /// Map project the image with an alpha channel.  Used for multi-channel images.
-template <class ImagePixelT, class Map2CamTransT>
+template <class ImagePixelT, class Map2CamTransT, class FootprintT>
 void project_image_alpha(Options & opt,
                    GeoReference const& croppedGeoRef,
                    Vector2i     const& virtual_image_size,
                    BBox2i       const& croppedImageBB,
                    boost::shared_ptr<camera::CameraModel> const& camera_model,
-                   Map2CamTransT const& transform) {
+                   Map2CamTransT const& transform,
+                   FootprintT    const& footprint) {
 
     // Create handle to input image to be projected on to the map
     boost::shared_ptr<DiskImageResource> img_rsrc = 
-          vw::DiskImageResourcePtr(opt.image_file);   
+          vw::DiskImageResourcePtr(opt.image_data_file);   
 
     const bool        has_img_nodata    = false;
     const ImagePixelT transparent_pixel = ImagePixelT();
 
+    if (opt.inverse_grid_tolerance > 0) {
+      write_parallel_type
+        ( // Write to the output file
+         opt.output_file,
+         crop( // Apply crop (only happens if --t_pixelwin was specified)
+               // Transparent pixels are inserted for nodata
+               inverse_grid_transform(DiskImageView<ImagePixelT>(img_rsrc),
+                                      ConstantEdgeExtension(),
+                                      transform, footprint,
+                                      virtual_image_size[0],
+                                      virtual_image_size[1],
+                                      opt.inverse_grid_tolerance, transparent_pixel
+                                      ),
+               croppedImageBB
+             ),
+         croppedGeoRef, has_img_nodata, opt.nodata_value, opt,
+         TerminalProgressCallback("","")
+         );
+      return;
+    }
+
     write_parallel_type
       ( // Write to the output file
        opt.output_file,
@@ -563,6 +784,7 @@ void project_image_alpha(Options & opt,
 
 template <class ImagePixelT>
 void project_image_nodata_pick_transform(Options & opt,
+                          ImageViewRef<DemPixelT> const& dem,
                           GeoReference const& dem_georef,
                           GeoReference const& target_georef,
                           GeoReference const& croppedGeoRef,
@@ -580,7 +802,8 @@ void project_image_nodata_pick_transform(Options & opt,
                                                           camera_model.get(), target_georef,
                                                           dem_georef, opt.dem_file, image_size,
                                                           call_from_mapproject
-                                                          )
+                                                          ),
+                                             DemFootprint(target_georef, dem_georef, dem)
                                             );
   } else {
     // A constant datum elevation was provided
@@ -591,13 +814,15 @@ void project_image_nodata_pick_transform(Options & opt,
                                                             camera_model.get(), target_georef,
                                                             dem_georef, opt.datum_offset, image_size,
                                                             call_from_mapproject
-                                                            )
+                                                            ),
+                                             DatumFootprint()
                                             );
   }
 }
 
 template <class ImagePixelT>
 void project_image_alpha_pick_transform(Options & opt,
+                          ImageViewRef<DemPixelT> const& dem,
                           GeoReference const& dem_georef,
                           GeoReference const& target_georef,
                           GeoReference const& croppedGeoRef,
@@ -615,7 +840,8 @@ void project_image_alpha_pick_transform(Options & opt,
                                                          camera_model.get(), target_georef,
                                                          dem_georef, opt.dem_file, image_size,
                                                          call_from_mapproject
-                                                         )
+                                                         ),
+                                            DemFootprint(target_georef, dem_georef, dem)
                                            );
   } else {
     // A constant datum elevation was provided
@@ -626,7 +852,8 @@ void project_image_alpha_pick_transform(Options & opt,
                                                            camera_model.get(), target_georef,
                                                            dem_georef, opt.datum_offset, image_size,
                                                            call_from_mapproject
-                                                           )
+                                                           ),
+                                            DatumFootprint()
                                            );
   }
 }
@@ -667,6 +894,10 @@ int main( int argc, char* argv[] ) {
     if ( opt.output_file.empty() )
       vw_throw( ArgumentErr() << "Missing output filename.\n" );
 
+    // An output in object storage is written locally, then uploaded
+    opt.output_object = opt.output_file;
+    opt.output_file   = asp::object_write_path(opt.output_object, opt.object_cache_dir);
+
     // Initialize a camera model
     boost::shared_ptr<camera::CameraModel> camera_model =
       session->camera_model(opt.image_file, opt.camera_file);
@@ -687,21 +918,14 @@ int main( int argc, char* argv[] ) {
     GeoReference dem_georef;
     ImageViewRef<DemPixelT> dem;
     if (fs::path(opt.dem_file).extension() != "") {
-      // A path to a real DEM file was provided, load it!
-
-      bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
-      if (!has_georef)
-        vw_throw( ArgumentErr() << "There is no georeference information in: " << opt.dem_file << ".\n" );
-
-      boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
-
-      // If we have a nodata value, create a mask.
-      DiskImageView<float> dem_disk_image(opt.dem_file);
-      if (dem_rsrc->has_nodata_read()){
-        dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
-      }else{
-        dem = pixel_cast<DemPixelT>(dem_disk_image);
-      }      
+      // A path to a real DEM file was provided, load it! Its
+      // pixels are masked where they equal the nodata value.
+      int num_threads = opt.num_threads;
+      if (num_threads <= 0)
+        num_threads = vw_settings().default_num_threads();
+      asp::SharedDem shared_dem(opt.dem_file, opt.dem_cache_dir, num_threads);
+      dem_georef = shared_dem.georef();
+      dem        = shared_dem.masked_dem();
     } else {
       // Projecting to a datum instead of a DEM
       std::string datum_name = opt.dem_file;
@@ -804,8 +1028,15 @@ int main( int argc, char* argv[] ) {
       return 0;
     }
 
+    // Decode a JPEG2000 image once, for all the processes of mapproject
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    opt.image_data_file = asp::decoded_image_path(opt.image_file, opt.image_cache_dir,
+                                                  num_threads);
+
     // Determine the pixel type of the input image
-    boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
+    boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_data_file);
     ImageFormat image_fmt = image_rsrc->format();
     const int num_input_channels = num_channels(image_fmt.pixel_format);
 
@@ -821,28 +1052,28 @@ int main( int argc, char* argv[] ) {
       // - Always use an alpha channel with RGB images.
       switch(image_fmt.channel_type) {
       case VW_CHANNEL_UINT8:
-        project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem_georef, target_georef,
+        project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem, dem_georef, target_georef,
                                                               croppedGeoRef, image_size, 
                                                               Vector2i(virtual_image_width,
                                                                        virtual_image_height),
                                                               croppedImageBB, camera_model);
         break;
       case VW_CHANNEL_INT16:
-        project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem_georef, target_georef,
+        project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem, dem_georef, target_georef,
                                                               croppedGeoRef, image_size, 
                                                               Vector2i(virtual_image_width,
                                                                        virtual_image_height),
                                                               croppedImageBB, camera_model);
         break;
       case VW_CHANNEL_UINT16:
-        project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem_georef, target_georef,
+        project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem, dem_georef, target_georef,
                                                                croppedGeoRef, image_size, 
                                                                Vector2i(virtual_image_width,
                                                                         virtual_image_height),
                                                                croppedImageBB, camera_model);
         break;
       default:
-        project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem_georef, target_georef,
+        project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem, dem_georef, target_georef,
                                                                 croppedGeoRef, image_size, 
                                                                 Vector2i(virtual_image_width,
                                                                          virtual_image_height),
@@ -855,13 +1086,15 @@ int main( int argc, char* argv[] ) {
       if (num_input_channels != 1 || image_fmt.planes != 1)
         vw_throw( ArgumentErr() << "Input images must be single channel or RGB!\n" );
       // This will cast to float but will not rescale the pixel values.
-      project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
+      project_image_nodata_pick_transform<float>(opt, dem, dem_georef, target_georef, croppedGeoRef,
                                                  image_size, 
                            Vector2i(virtual_image_width, virtual_image_height),
                            croppedImageBB, camera_model);
     } 
     // Done map projecting!
 
+    asp::upload_object(opt.output_file, opt.output_object);
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
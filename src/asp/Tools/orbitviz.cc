@@ -32,6 +32,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Sessions/StereoSessionFactory.h>
+#include <asp/Core/MatchFile.h>
 
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
 #include <asp/IsisIO/IsisCameraModel.h>
@@ -141,6 +142,57 @@ size_t split_files_list(std::vector<std::string> const& input_files,
   return num_cameras;
 }
 
+/// The camera data written to the KML and csv files
+struct CameraInfo {
+  Vector3     xyz, lon_lat_alt;
+  Quat        pose;
+  std::string serial_number; // Only for ISIS cameras
+};
+
+/// Load a camera and find its position and pose at the given pixel.
+/// This is so clumsy, a new stereo session needs to be loaded for each
+/// input camera.
+class CameraInfoTask: public vw::Task, private boost::noncopyable {
+  Options     const& m_opt;
+  std::string        m_image_file, m_camera_file;
+  Vector2            m_camera_pixel;
+  Datum       const& m_datum;
+  CameraInfo       & m_info;
+public:
+  CameraInfoTask(Options const& opt, std::string const& image_file,
+                 std::string const& camera_file, Vector2 const& camera_pixel,
+                 Datum const& datum, CameraInfo & info):
+    m_opt(opt), m_image_file(image_file), m_camera_file(camera_file),
+    m_camera_pixel(camera_pixel), m_datum(datum), m_info(info) {}
+
+  void operator()() {
+    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+    std::string stereo_session_string = m_opt.stereo_session_string; // may change inside
+    SessionPtr session
+      (asp::StereoSessionFactory::create(stereo_session_string,
+                                         m_opt,
+                                         m_image_file,  m_image_file,
+                                         m_camera_file, m_camera_file
+                                         ) );
+    boost::shared_ptr<camera::CameraModel> current_camera
+      = session->camera_model(m_image_file, m_camera_file);
+
+    // Add the ISIS camera serial number if applicable
+#if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
+    boost::shared_ptr<IsisCameraModel> isis_cam =
+      boost::dynamic_pointer_cast<IsisCameraModel>(current_camera);
+    if ( isis_cam != NULL )
+      m_info.serial_number = isis_cam->serial_number();
+#endif
+
+    // Compute and record the GDC coordinates
+    m_info.xyz         = current_camera->camera_center(m_camera_pixel);
+    m_info.lon_lat_alt = m_datum.cartesian_to_geodetic(m_info.xyz);
+    if (!m_opt.path_to_outside_model.empty())
+      m_info.pose = current_camera->camera_pose(m_camera_pixel);
+  }
+};
+
 /// Get a list of the files in the solver output folder
 size_t get_files_from_solver_folder(std::string                 const& solver_folder,
                                       std::vector<std::string>       & image_files, 
@@ -183,7 +235,7 @@ size_t get_files_from_solver_folder(std::string                 const& solver_fo
   const size_t MIN_MATCHES = 30; // This is the default value, but it could be made an option.
   std::vector<ip::InterestPoint> ip1, ip2;
   for (size_t m=0; m<num_matches; ++m) {
-    vw::ip::read_binary_match_file(solver_folder+ "/"+match_files[m], ip1, ip2);
+    asp::read_match_file(solver_folder+ "/"+match_files[m], ip1, ip2);
     //std::cout << "Read " << ip1.size() << " matches from file " << match_files[m] << std::endl;
     if (ip1.size() < MIN_MATCHES)
       match_files[m] = "";
@@ -332,42 +384,41 @@ int main(int argc, char* argv[]) {
     
     Vector2 camera_pixel(0, opt.linescan_line);
 
-    // Building Camera Models and then writing to KML
+    // Build the camera models in parallel. ISIS cameras cannot be
+    // loaded from several threads.
+    std::vector<CameraInfo> camera_info(num_cameras);
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    if (session->name().find("isis") != std::string::npos)
+      num_threads = 1;
+    {
+      FifoWorkQueue queue(num_threads);
+      for (size_t i=0; i < num_cameras; i++) {
+        boost::shared_ptr<CameraInfoTask>
+          task(new CameraInfoTask(opt, image_files[i], camera_files[i], camera_pixel,
+                                  datum, camera_info[i]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    // Writing the cameras to KML, in the input order
     std::vector<Vector3> camera_positions(num_cameras);
     for (size_t i=0; i < num_cameras; i++) {
-      boost::shared_ptr<camera::CameraModel> current_camera;
-
-      // This is so clumsy, a new stereo session needs to be loaded for each
-      // input camera.
-      SessionPtr session
-        (asp::StereoSessionFactory::create(opt.stereo_session_string, // may change inside
-                                           opt,
-                                           image_files[i],  image_files[i],
-                                           camera_files[i], camera_files[i]
-                                           ) );
-      current_camera = session->camera_model(image_files[i], camera_files[i]);
 
       if ( opt.write_csv ) {
         csv_handle << image_files[i] << ", ";
+        if (camera_info[i].serial_number != "")
+          csv_handle << camera_info[i].serial_number << ", ";
 
-        // Add the ISIS camera serial number if applicable
-#if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
-        boost::shared_ptr<IsisCameraModel> isis_cam =
-          boost::dynamic_pointer_cast<IsisCameraModel>(current_camera);
-        if ( isis_cam != NULL ) {
-          csv_handle << isis_cam->serial_number() << ", ";
-        }
-#endif
-
-        Vector3 xyz = current_camera->camera_center(camera_pixel);
+        Vector3 xyz = camera_info[i].xyz;
         csv_handle << std::setprecision(12);
         csv_handle << xyz[0] << ", "
                    << xyz[1] << ", " << xyz[2] << "\n";
       } // End csv write condition
       
-      // Compute and record the GDC coordinates
-      Vector3 lon_lat_alt = datum.cartesian_to_geodetic(
-                                current_camera->camera_center(camera_pixel));
+      Vector3 lon_lat_alt = camera_info[i].lon_lat_alt;
       camera_positions[i] = lon_lat_alt;
 
       // Adding Placemarks
@@ -375,7 +426,7 @@ int main(int argc, char* argv[]) {
       if (!opt.path_to_outside_model.empty()) {
         kml.append_model( opt.path_to_outside_model,
                           lon_lat_alt.x(), lon_lat_alt.y(),
-                          inverse(current_camera->camera_pose(camera_pixel)),
+                          inverse(camera_info[i].pose),
                           display_name, "",
                           lon_lat_alt[2], opt.model_scale );
       } else {
@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 
+#include <vw/Core/Settings.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -29,6 +30,8 @@ using namespace vw::cartography;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/DecodedImageCache.h>
+#include <asp/Core/ObjectStorage.h>
 #include <asp/Camera/RPC_XML.h>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -161,26 +164,27 @@ public: // Functions
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // Loop through each output pixels and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      int source_c = c + bbox.min()[0];
-      for (int r = 0; r < bbox.height(); r++) {
-        int source_r = r + bbox.min()[1];
+    // Rasterize both inputs over the tile at once, rather than pulling
+    // them one pixel at a time through their views. For the color
+    // image this does the resampling of the whole tile in one go.
+    ImageView<typename ImageGrayT::pixel_type > gray_tile  = crop(m_gray_image,  bbox);
+    ImageView<typename ImageColorT::pixel_type> color_tile = crop(m_color_image, bbox);
+
+    // Loop through each output pixel, along rows, and compute each output value
+    for (int r = 0; r < bbox.height(); r++) {
+      for (int c = 0; c < bbox.width(); c++) {
 
         // Check for a masked pixel
-        if ( !is_valid(m_gray_image (source_c, source_r)) ||
-             !is_valid(m_color_image(source_c, source_r))  ) {
+        if ( !is_valid(gray_tile(c, r)) || !is_valid(color_tile(c, r)) ) {
           tile(c, r) = m_output_nodata;
           continue;
         }
 
         // Pass the two input pixels into the conversion function
-        //result_type output_pixel = convert_pixel(m_gray_image(source_c, r), m_color_image(source_c, r));
-        tile(c,r) = convert_pixel(m_gray_image (source_c, source_r),
-                                  m_color_image(source_c, source_r));
+        tile(c, r) = convert_pixel(gray_tile(c, r), color_tile(c, r));
 
-      } // End row loop
-    } // End column loop
+      } // End column loop
+    } // End row loop
 
     // Return the tile we created with fake borders to make it look the size of the entire output image
     return prerasterize_type(tile,
@@ -218,7 +222,12 @@ struct Options : vw::cartography::GdalWriteOptions {
          gray_xml_file,
          color_file,
          color_xml_file,
-         output_file;
+         output_file,
+         image_cache_dir,
+         object_cache_dir;
+  string output_object;   ///< Where to upload the output to, if in object storage
+  string gray_data_file,  ///< Where to read the pixels from, decoded if JPEG2000
+         color_data_file;
   double nodata_value,
          min_value,
          max_value;
@@ -240,7 +249,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("color-xml", po::value(&opt.color_xml_file)->default_value(""),
              "Path to a WV XML file for the color image.  Can be used to obtain the geo data.")
     ("nodata-value", po::value(&opt.nodata_value)->default_value(DEFAULT_NODATA),
-             "The no-data value to use, unless present in the color image header.");
+             "The no-data value to use, unless present in the color image header.")
+    ("image-cache-dir", po::value(&opt.image_cache_dir)->default_value(""),
+             "Decode the input images compressed with JPEG2000, such as DigitalGlobe NITF files, with all threads, once, into uncompressed files in this directory, and read those instead. Can be shared with stereo and mapproject.")
+    ("object-cache-dir", po::value(&opt.object_cache_dir)->default_value(""),
+             "Fetch the inputs given as s3:// or http(s):// objects into this directory, with parallel ranged requests, and read them from there. Without it, such images are read in place. An output given as an s3:// object is written in this directory, or in the temporary directory, then uploaded.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -273,6 +286,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // Determine if the user entered a nodata value
   opt.has_nodata = vm.count("output-nodata-value");
 
+  // Inputs in object storage are read in place or fetched to a local
+  // copy, and an output there is written locally, then uploaded.
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  opt.gray_file      = asp::object_read_path(opt.gray_file,      opt.object_cache_dir, num_threads);
+  opt.color_file     = asp::object_read_path(opt.color_file,     opt.object_cache_dir, num_threads);
+  opt.gray_xml_file  = asp::object_read_path(opt.gray_xml_file,  opt.object_cache_dir, num_threads);
+  opt.color_xml_file = asp::object_read_path(opt.color_xml_file, opt.object_cache_dir, num_threads);
+  opt.output_object  = opt.output_file;
+  opt.output_file    = asp::object_write_path(opt.output_object, opt.object_cache_dir);
+
   vw::create_out_dir(opt.output_file);
 }
 
@@ -298,8 +323,8 @@ void load_inputs_and_process(Options           & opt,
   std::cout << "Out   nodata: " << (double)opt.nodata_value << std::endl;
 
   // Set up file handles
-  DiskImageResourceGDAL gray_rsrc(opt.gray_file),
-                        color_rsrc(opt.color_file);
+  DiskImageResourceGDAL gray_rsrc(opt.gray_data_file),
+                        color_rsrc(opt.color_data_file);
   DiskImageView<PixelGray<T> > gray_img (gray_rsrc);
   DiskImageView<PixelRGB <T> > color_img(color_rsrc);
 
@@ -350,8 +375,17 @@ int main( int argc, char *argv[] ) {
   try {
     handle_arguments( argc, argv, opt );
 
-    DiskImageResourceGDAL gray_rsrc(opt.gray_file),
-                          color_rsrc(opt.color_file);
+    // Decode JPEG2000 images once, with all threads
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    opt.gray_data_file  = asp::decoded_image_path(opt.gray_file,  opt.image_cache_dir,
+                                                  num_threads);
+    opt.color_data_file = asp::decoded_image_path(opt.color_file, opt.image_cache_dir,
+                                                  num_threads);
+
+    DiskImageResourceGDAL gray_rsrc(opt.gray_data_file),
+                          color_rsrc(opt.color_data_file);
 
     double gray_nodata  = opt.nodata_value;
     double color_nodata = opt.nodata_value;
@@ -401,6 +435,8 @@ int main( int argc, char *argv[] ) {
       default : vw_throw(ArgumentErr() << "Input image format " << input_data_type << " is not supported!\n");
     };
 
+    asp::upload_object(opt.output_file, opt.output_object);
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -47,6 +47,8 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Image.h>
@@ -57,6 +59,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudTypes.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <liblas/liblas.hpp>
 
@@ -68,9 +71,11 @@
 #include <ceres/loss_function.h>
 
 #include <asp/Tools/pc_align_utils.h>
+#include <asp/Core/MatchFile.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 
@@ -86,35 +91,33 @@ using namespace PointMatcherSupport;
 
 const double BIG_NUMBER = 1e+300; // libpointmatcher does not like here the largest double
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector3f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 /// Options container for the pc_align tool
 struct Options : public vw::cartography::GdalWriteOptions {
   // Input
   string reference, source, init_transform_file, alignment_method, config_file,
-    datum, csv_format_str, csv_proj4_str, match_file;
+    datum, csv_format_str, csv_proj4_str, match_file, dem_cache_dir;
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
+         num_pyramid_levels,
+         num_points_per_residual_block,
          max_num_reference_points,
          max_num_source_points;
   double diff_translation_err,
          diff_rotation_err,
          max_disp,
          outlier_ratio,
+         reference_voxel_size,
+         pyramid_voxel_size,
          semi_major,
-         semi_minor;
+         semi_minor,
+         in_memory_cloud_resolution;
   bool   compute_translation_only,
          dont_use_dem_distances,
          save_trans_source,
          save_trans_ref,
          highest_accuracy,
+         use_point_cache,
+         stratified_sampling,
          verbose;
   std::string initial_ned_translation;
   
@@ -145,10 +148,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                                  "Fraction of source (movable) points considered inliers (after gross outliers further than max-displacement from reference points are removed).")
     ("max-num-reference-points", po::value(&opt.max_num_reference_points)->default_value(100000000),
                                  "Maximum number of (randomly picked) reference points to use.")
+    ("reference-voxel-size",     po::value(&opt.reference_voxel_size)->default_value(0.0),
+                                 "Keep only one reference point in each cube of this size, in meters, before building the tree used to find the closest reference points. This makes each iteration faster for dense reference clouds. Default: keep all points.")
+    ("num-pyramid-levels",       po::value(&opt.num_pyramid_levels)->default_value(1),
+                                 "Run ICP first on this many levels of voxel-subsampled copies of the clouds, from coarse to fine, and then on the clouds themselves. The voxel size doubles with each coarser level. Use 1 for no pyramid.")
+    ("pyramid-voxel-size",       po::value(&opt.pyramid_voxel_size)->default_value(0.0),
+                                 "The voxel size, in meters, at the finest pyramid level (see --num-pyramid-levels).")
     ("max-num-source-points",    po::value(&opt.max_num_source_points)->default_value(100000),
                                  "Maximum number of (randomly picked) source points to use (after discarding gross outliers).")
     ("alignment-method",         po::value(&opt.alignment_method)->default_value("point-to-plane"),
                                  "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, least-squares, similarity-least-squares]")
+    ("num-points-per-residual-block", po::value(&opt.num_points_per_residual_block)->default_value(1),
+                                 "For the least-squares alignment methods, group this many source points in each residual block. Larger blocks have less overhead in the solver.")
     ("highest-accuracy",         po::bool_switch(&opt.highest_accuracy)->default_value(false)->implicit_value(true),
                                  "Compute with highest accuracy for point-to-plane (can be much slower).")
     ("csv-format",               po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
@@ -176,6 +187,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
     ("match-file", po::value(&opt.match_file)->default_value(""),
      "Compute a translation + rotation + scale transform from the source to the reference point cloud using manually selected point correspondences (obtained for example using stereo_gui).")
+    ("use-point-cache",          po::bool_switch(&opt.use_point_cache)->default_value(false)->implicit_value(true),
+     "Save the points parsed from LAS and CSV files to a binary cache next to each file, named <file>.asp-cache, and load them from there in later runs. Only the parts of the cache near the other cloud are read. The cache is remade if the file, the CSV format, or the datum changes.")
+    ("stratified-sampling",      po::bool_switch(&opt.stratified_sampling)->default_value(false)->implicit_value(true),
+     "When loading at most --max-num-reference-points or --max-num-source-points points from a DEM, point cloud, or CSV file, spread them evenly over the input rather than picking them at random.")
+    ("in-memory-cloud-resolution", po::value(&opt.in_memory_cloud_resolution)->default_value(0),
+     "Keep the input point clouds in memory, compressed, with the points rounded to this resolution in meters, for example 0.001, rather than reading them from disk more than once. Set to 0 to not keep them.")
+    ("dem-cache-dir",            po::value(&opt.dem_cache_dir)->default_value(""),
+     "When the reference is a DEM, convert it, once per machine, into an uncompressed float file in this directory, and map that in memory, so that the processes on a machine share one copy of it. Can be shared with stereo, mapproject and bundle_adjust.")
     ("config-file",              po::value(&opt.config_file)->default_value(""),
      "This is an advanced option. Read the alignment parameters from a configuration file, in the format expected by libpointmatcher, over-riding the command-line options.");
 
@@ -207,6 +226,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( opt.out_prefix.empty() )
     vw_throw( ArgumentErr() << "Missing output prefix.\n" << usage << general_options );
 
+  asp::set_use_point_cache(opt.use_point_cache);
+  asp::set_point_loading_threads(opt.num_threads);
+  asp::set_stratified_point_sampling(opt.stratified_sampling);
+  asp::set_point_cloud_store_resolution(opt.in_memory_cloud_resolution);
+
   // There is no need to use max-displacement with custom tie points.
   if (opt.match_file != "")
     opt.max_disp = -1.0;
@@ -219,6 +243,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "The number of iterations must be non-negative.\n"
                             << usage << general_options );
 
+  if ( opt.num_pyramid_levels > 1 && opt.pyramid_voxel_size <= 0 )
+    vw_throw( ArgumentErr() << "Must set a positive --pyramid-voxel-size when "
+                            << "using more than one pyramid level.\n"
+                            << usage << general_options );
+
   if ( (opt.semi_major != 0 && opt.semi_minor == 0) ||
        (opt.semi_minor != 0 && opt.semi_major == 0)
        ){
@@ -284,6 +313,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr()
 	      << "Least squares alignment can be used only when the "
 	      << "reference cloud is a DEM.\n" );
+
+  if ( (opt.alignment_method == "least-squares" ||
+	opt.alignment_method == "similarity-least-squares")
+       && opt.num_pyramid_levels > 1)
+    vw_throw( ArgumentErr()
+	      << "Pyramid levels can be used only with the ICP alignment methods.\n" );
 }
 
 /// Try to read the georef/datum info, need it to read CSV files.
@@ -414,30 +449,39 @@ void read_georef(Options& opt, asp::CsvConv& csv_conv, GeoReference& geo){
   return;
 }
 
-/// Compute output statistics for pc_align
+/// Compute output statistics for pc_align. The percentiles and the
+/// means of the smallest errors are found by partitioning the errors
+/// around each of the needed positions, from the last one down, which
+/// is linear time rather than the time of a full sort.
 void calc_stats(string label, PointMatcher<RealT>::Matrix const& dists){
 
   VW_ASSERT(dists.rows() == 1,
             LogicErr() << "Expecting only one row.");
 
-  vector<double> errs(dists.cols()*dists.rows());
-  int count = 0;
-  for (int col = 0; col < dists.cols(); col++){
-    //for (int row = 0; row < dists.rows(); row++){
-    errs[count] = dists(0, col);
-    count++;
-    //}
-  }
-  sort(errs.begin(), errs.end());
+  vector<double> errs(dists.data(), dists.data() + dists.cols());
 
   int len = errs.size();
   vw_out() << "Number of errors: " << len << endl;
   if (len == 0)
     return;
 
-  double p16 = errs[std::min(len-1, (int)round(len*0.16))];
-  double p50 = errs[std::min(len-1, (int)round(len*0.50))];
-  double p84 = errs[std::min(len-1, (int)round(len*0.84))];
+  int i16 = std::min(len-1, (int)round(len*0.16));
+  int i50 = std::min(len-1, (int)round(len*0.50));
+  int i84 = std::min(len-1, (int)round(len*0.84));
+
+  // After each partition the errors before a position are the smallest
+  // ones, so the later partitions need only look before it.
+  int pos[] = {i84, 3*len/4, i50, len/2, len/4, i16};
+  int num_pos = sizeof(pos)/sizeof(pos[0]);
+  int end = len;
+  for (int k = 0; k < num_pos; k++){
+    if (pos[k] >= end)
+      continue;
+    std::nth_element(errs.begin(), errs.begin() + pos[k], errs.begin() + end);
+    end = pos[k];
+  }
+
+  double p16 = errs[i16], p50 = errs[i50], p84 = errs[i84];
   vw_out() << label << ": error percentile of smallest errors (meters):"
            << " 16%: " << p16 << ", 50%: " << p50 << ", 84%: " << p84 << endl;
 
@@ -578,40 +622,78 @@ void debug_save_point_cloud(DP const& point_cloud, GeoReference const& geo,
   }
 }
 
-/// Like PM::ICP::filterGrossOutliersAndCalcErrors, except comparing to a DEM instead.
+/// Like PM::ICP::filterGrossOutliersAndCalcErrors, except comparing
+/// to a DEM instead, for a range of points. The error of each point
+/// becomes the distance to the DEM if that one is less. A point which
+/// does not project into the DEM keeps its error.
 /// - The point cloud is in GCC coordinates with point_cloud_shift subtracted from each point.
-/// - The output is put in the "errors" vector for each point.
-/// - If there is a problem computing the point error, a very large number is used as a flag.
-void calcErrorsWithDem(DP          const& point_cloud,
-                       vw::Vector3 const& point_cloud_shift,
-                       vw::cartography::GeoReference        const& georef,
-                       vw::ImageViewRef< PixelMask<float> > const& dem,
-                       std::vector<double> &errors) {
-
-  // Initialize output error storage
-  const int num_pts = point_cloud.features.cols();
-  errors.resize(num_pts);
+class DemErrorsTask: public vw::Task, private boost::noncopyable {
+  DP                                   const& m_point_cloud;
+  vw::Vector3                                 m_shift;
+  vw::cartography::GeoReference               m_georef; // a copy per thread
+  vw::ImageViewRef< PixelMask<float> > const& m_dem;
+  int                                         m_beg, m_end;
+  PointMatcher<RealT>::Matrix               & m_errors;
+public:
+  DemErrorsTask(DP const& point_cloud, vw::Vector3 const& shift,
+                vw::cartography::GeoReference const& georef,
+                vw::ImageViewRef< PixelMask<float> > const& dem,
+                int beg, int end, PointMatcher<RealT>::Matrix & errors):
+    m_point_cloud(point_cloud), m_shift(shift), m_georef(georef), m_dem(dem),
+    m_beg(beg), m_end(end), m_errors(errors) {}
+
+  void operator()() {
+    double dem_height_here;
+    for (int col = m_beg; col < m_end; col++){
+      // Extract and un-shift the point to get the real GCC coordinate
+      Vector3 gcc_coord = get_cloud_gcc_coord(m_point_cloud, m_shift, col);
 
-  // Loop through every point in the point cloud
-  double dem_height_here;
-  for(int i=0; i<num_pts; ++i){
-    // Extract and un-shift the point to get the real GCC coordinate
-    Vector3 gcc_coord = get_cloud_gcc_coord(point_cloud, point_cloud_shift, i);
+      // Convert from GCC to GDC
+      Vector3 llh = m_georef.datum().cartesian_to_geodetic(gcc_coord); // lon-lat-height
 
-    // Convert from GDC to GCC
-    Vector3 llh = georef.datum().cartesian_to_geodetic(gcc_coord); // lon-lat-height
+      // Interpolate the point at this location
+      if (!interp_dem_height(m_dem, m_georef, llh, dem_height_here))
+        continue;
 
-    // Interpolate the point at this location
-    if (!interp_dem_height(dem, georef, llh, dem_height_here)) {
-      // If we did not intersect the DEM, record a flag error value here.
-      errors[i] = BIG_NUMBER;
-    }
-    else { // Success, the error is the absolute height difference
-      errors[i] = std::abs(llh[2] - dem_height_here);
+      double dem_error = std::abs(llh[2] - dem_height_here);
+      if (dem_error < m_errors(0, col))
+        m_errors(0, col) = dem_error;
     }
+  }
+};
 
-  } // End loop through all points
+/// Use for each point the distance to the DEM if it is less than the
+/// distance already in 'errors'. The points are processed in parallel.
+void update_errors_with_dem(DP          const& point_cloud,
+                            vw::Vector3 const& point_cloud_shift,
+                            vw::cartography::GeoReference        const& georef,
+                            vw::ImageViewRef< PixelMask<float> > const& dem,
+                            int num_threads,
+                            PointMatcher<RealT>::Matrix & errors) {
+
+  const int num_pts = point_cloud.features.cols();
+  if (errors.cols() != num_pts)
+    vw_throw( LogicErr() << "Error: error size does not match point count size!\n");
+
+  num_threads = std::max(num_threads, 1);
+  int num_tasks = std::max(1, std::min(num_pts, 16*num_threads));
+  if (num_threads == 1) {
+    DemErrorsTask task(point_cloud, point_cloud_shift, georef, dem, 0, num_pts, errors);
+    task();
+    return;
+  }
 
+  FifoWorkQueue queue(num_threads);
+  for (int t = 0; t < num_tasks; t++) {
+    int beg = (long long)num_pts*t/num_tasks;
+    int end = (long long)num_pts*(t + 1)/num_tasks;
+    if (beg >= end)
+      continue;
+    boost::shared_ptr<DemErrorsTask>
+      task(new DemErrorsTask(point_cloud, point_cloud_shift, georef, dem, beg, end, errors));
+    queue.add_task(task);
+  }
+  queue.join_all();
 }
 
 template<class F>
@@ -681,6 +763,99 @@ struct PointToDemError {
   cartography::GeoReference        const & m_geo;    // alias
 };
 
+/// Like PointToDemError, but for a block of points, with one residual
+/// for each. The robust loss can't be applied to the block as a whole,
+/// so it is applied to each residual on its own, in a way which keeps
+/// the cost function the same as with one block per point.
+struct PointToDemBlockError {
+  PointToDemBlockError(std::vector<Vector3> const& points,
+                       ImageViewRef< PixelMask<float> > const& dem,
+                       cartography::GeoReference const& geo,
+                       double loss_scale):
+    m_points(points), m_dem(dem), m_geo(geo), m_loss(loss_scale){}
+
+  bool operator()(const double* const transform, const double* const scale,
+                  double* residuals) const {
+
+    Vector3 translation;
+    Quat rotation;
+    extract_rotation_translation(transform, rotation, translation);
+
+    for (size_t i = 0; i < m_points.size(); i++){
+      residuals[i] = 0.0;
+      Vector3 trans_point = scale[0]*rotation.rotate(m_points[i]) + translation;
+      Vector3 llh = m_geo.datum().cartesian_to_geodetic(trans_point);
+      double dem_height_here;
+      if (!interp_dem_height(m_dem, m_geo, llh, dem_height_here))
+        continue;
+
+      // Ceres minimizes half the sum of the squared residuals, so
+      // this has the same minimum as applying the loss to each point.
+      double res = llh[2] - dem_height_here, rho[3];
+      m_loss.Evaluate(res*res, rho);
+      residuals[i] = (res < 0 ? -1.0 : 1.0)*sqrt(rho[0]);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction* Create(std::vector<Vector3> const& points,
+				     ImageViewRef< PixelMask<float> > const& dem,
+				     vw::cartography::GeoReference const& geo,
+                                     double loss_scale){
+    return (new ceres::NumericDiffCostFunction<PointToDemBlockError,
+	    ceres::CENTRAL, ceres::DYNAMIC, 6, 1>
+	    (new PointToDemBlockError(points, dem, geo, loss_scale),
+             ceres::TAKE_OWNERSHIP, points.size()));
+  }
+
+  std::vector<Vector3>                     m_points;
+  ImageViewRef< PixelMask<float> > const & m_dem;    // alias
+  cartography::GeoReference        const & m_geo;    // alias
+  ceres::CauchyLoss                        m_loss;
+};
+
+/// The pixel box in the reference DEM which the source points can
+/// reach during alignment. That is all of the DEM, unless the
+/// displacement is bounded by --max-displacement.
+BBox2i reachable_dem_box(DP const& source_point_cloud,
+                         vw::Vector3 const& point_cloud_shift,
+                         vw::cartography::GeoReference const& dem_georef,
+                         vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                         Options const& opt){
+
+  BBox2i full_box = bounding_box(dem_ref);
+  if (opt.max_disp <= 0)
+    return full_box;
+
+  BBox2 pix_box;
+  for (int i = 0; i < source_point_cloud.features.cols(); i++){
+    Vector3 llh = dem_georef.datum().cartesian_to_geodetic
+      (get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i));
+    try {
+      pix_box.grow(dem_georef.lonlat_to_pixel(subvector(llh, 0, 2)));
+    }catch(...){}
+  }
+  if (pix_box.empty())
+    return full_box;
+
+  // Convert the displacement to pixels, using the pixel size at the
+  // center of the box.
+  Vector2 ctr = (pix_box.min() + pix_box.max())/2.0;
+  Vector3 p0  = dem_georef.datum().geodetic_to_cartesian
+    (Vector3(dem_georef.pixel_to_lonlat(ctr)[0], dem_georef.pixel_to_lonlat(ctr)[1], 0));
+  Vector3 p1  = dem_georef.datum().geodetic_to_cartesian
+    (Vector3(dem_georef.pixel_to_lonlat(ctr + Vector2(1, 1))[0],
+             dem_georef.pixel_to_lonlat(ctr + Vector2(1, 1))[1], 0));
+  double pixel_size = norm_2(p1 - p0)/sqrt(2.0);
+  if (!(pixel_size > 0))
+    return full_box;
+
+  BBox2i box = grow_bbox_to_int(pix_box);
+  box.expand(int(ceil(opt.max_disp/pixel_size)) + 2);
+  box.crop(full_box);
+  return box;
+}
+
 /// Compute alignment using least squares
 PointMatcher<RealT>::Matrix
 least_squares_alignment(DP & source_point_cloud, // Should not be modified
@@ -695,21 +870,46 @@ least_squares_alignment(DP & source_point_cloud, // Should not be modified
   std::vector<double> transform(6, 0.0);
 
   double scale = 1.0;
-  
-  // Add a residual block for every source point
-  const int num_pts = source_point_cloud.features.cols();
 
-  // Loop through every point in the point cloud
-  for(int i = 0; i < num_pts; ++i){
-    
-    // Extract and un-shift the point to get the real GCC coordinate
-    Vector3 gcc_coord = get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i);
+  // Read the part of the DEM the points can reach into memory, if
+  // not too big, so the threads evaluating the residuals don't
+  // contend for the disk image cache.
+  const double max_tile_pixels = 2.5e+8;
+  vw::cartography::GeoReference tile_georef = dem_georef;
+  ImageViewRef< PixelMask<float> > dem_tile = dem_ref;
+  BBox2i tile_box = reachable_dem_box(source_point_cloud, point_cloud_shift,
+                                      dem_georef, dem_ref, opt);
+  if (!tile_box.empty() && double(tile_box.width())*tile_box.height() <= max_tile_pixels) {
+    vw_out() << "Loading into memory the reference DEM region: " << tile_box << endl;
+    dem_tile = load_interpolation_ready_dem_tile(opt.reference, tile_box, tile_georef,
+                                                 opt.dem_cache_dir, opt.num_threads);
+  }
+
+  // Add a residual block for every source point, or for every block
+  // of that many points.
+  const int num_pts = source_point_cloud.features.cols();
+  const double loss_scale = 0.5;
+  int block_size = std::max(opt.num_points_per_residual_block, 1);
+
+  for (int beg = 0; beg < num_pts; beg += block_size){
+
+    // Extract and un-shift the points to get the real GCC coordinates
+    int end = std::min(beg + block_size, num_pts);
+    std::vector<Vector3> gcc_coords;
+    for (int i = beg; i < end; i++)
+      gcc_coords.push_back(get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i));
+
+    if (block_size == 1) {
+      ceres::CostFunction* cost_function =
+        PointToDemError::Create(gcc_coords[0], dem_tile, tile_georef);
+      ceres::LossFunction* loss_function = new ceres::CauchyLoss(loss_scale); // NULL;
+      problem.AddResidualBlock(cost_function, loss_function, &transform[0], &scale);
+    }else{
+      ceres::CostFunction* cost_function =
+        PointToDemBlockError::Create(gcc_coords, dem_tile, tile_georef, loss_scale);
+      problem.AddResidualBlock(cost_function, NULL, &transform[0], &scale);
+    }
 
-    ceres::CostFunction* cost_function =
-      PointToDemError::Create(gcc_coord, dem_ref, dem_georef);
-    ceres::LossFunction* loss_function = new ceres::CauchyLoss(0.5); // NULL;
-    problem.AddResidualBlock(cost_function, loss_function, &transform[0], &scale);
-    
   } // End loop through all points
 
   if (opt.alignment_method == "least-squares") {
@@ -754,63 +954,42 @@ least_squares_alignment(DP & source_point_cloud, // Should not be modified
   return T;
 }
 
-/// Filters out all points from point_cloud with an error entry higher than cutoff
+/// Filters out all points from point_cloud with an error entry
+/// higher than cutoff. The errors of the points kept are kept along
+/// with them. This is done in place, as each point kept moves to the
+/// same place or before it.
 void filterPointsByError(DP & point_cloud, PointMatcher<RealT>::Matrix &errors, double cutoff) {
 
-  DP input_copy = point_cloud; // Make a copy of the input DP object
-
-  // Init LPM data structure
   const int input_point_count = point_cloud.features.cols();
   if (errors.cols() != input_point_count)
     vw_throw( LogicErr() << "Error: error size does not match point count size!\n");
-  point_cloud.features.conservativeResize(DIM+1, input_point_count);
-  point_cloud.featureLabels = form_labels<double>(DIM);
 
-  // Loop through all the input points and copy them to the output if they pass the test
+  // Loop through all the input points and keep them if they pass the test
   int points_count = 0;
   for (int col = 0; col < input_point_count; ++col) {
 
-    if (errors(0,col) > cutoff) {
-      //vw_out() << "Throwing out point " << col << " for having error " << errors(0,col) << "\n";
-      continue; // Error too high, don't add this point
-    }
+    if (errors(0,col) > cutoff)
+      continue; // Error too high, don't keep this point
 
-    // Copy this point to the output LPM structure
     for (int row = 0; row < DIM; row++)
-      point_cloud.features(row, points_count) = input_copy.features(row, col);
+      point_cloud.features(row, points_count) = point_cloud.features(row, col);
     point_cloud.features(DIM, points_count) = 1; // Extend to be a homogenous coordinate
+    errors(0, points_count) = errors(0, col);
     ++points_count; // Update output point count
 
   } // End loop through points
 
-  // Finalize the LPM data structure
-  point_cloud.features.conservativeResize(Eigen::NoChange, points_count);
-
-}
-
-// Note: The LPM matrix type used to store errors only ever has a single row.
-
-/// Updates an LPM error matrix to use the DEM-based error for each point if it is lower.
-void update_best_error(std::vector<double>         const& dem_errors,
-                       PointMatcher<RealT>::Matrix      & lpm_errors) {
-  int num_points = lpm_errors.cols();
-  if (dem_errors.size() != static_cast<size_t>(num_points))
-    vw_throw( LogicErr() << "Error: error size does not match point count size!\n");
-  //vw_out() << "Updating error...\n";
-
-  // Loop through points
-  for(int col = 0; col < num_points; col++){
-    // Use the DEM error if it is less
-    if (dem_errors[col] < lpm_errors(0,col)) {
-      //vw_out() << "DEM error = " << dem_errors[col] << ", LPM error = " << lpm_errors(0,col) << std::endl;
-      lpm_errors(0, col) = dem_errors[col];
-    }
-  }
-
+  point_cloud.features.conservativeResize(DIM+1, points_count);
+  point_cloud.featureLabels = form_labels<double>(DIM);
+  errors.conservativeResize(Eigen::NoChange, points_count);
 }
 
-
 /// Compute the distance from source_point_cloud to the reference points.
+/// If a DEM is given, for each point use the lower of the distances to
+/// the reference cloud and to the DEM. We compute the error in two
+/// passes for two reasons:
+/// 1 - Get the most accurate distance for each point in all cases.
+/// 2 - Help fill in distances where the DEM has holes.
 double compute_registration_error(DP          const& ref_point_cloud,
                                   DP               & source_point_cloud, // Should not be modified
                                   PM::ICP          & pm_icp_object, // Must already be initialized
@@ -827,31 +1006,25 @@ double compute_registration_error(DP          const& ref_point_cloud,
   pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, BIG_NUMBER,
                                                  source_point_cloud, error_matrix);
 
-  if (opt.use_dem_distances()) {
-    // Compute the distance from each point to the DEM
-    std::vector<double> dem_errors;
-    calcErrorsWithDem(source_point_cloud, shift, dem_georef, dem_ref, dem_errors);
-
-    // For each point use the lower of the two calculated errors.
-    update_best_error(dem_errors, error_matrix);
-
-    // We compute the error in two passes for two reasons:
-    // 1 - Get the most accurate distance for each point in all cases.
-    // 2 - Help fill in distances where the DEM has holes.
-  }
+  if (opt.use_dem_distances())
+    update_errors_with_dem(source_point_cloud, shift, dem_georef, dem_ref,
+                           opt.num_threads, error_matrix);
 
   sw.stop();
   return sw.elapsed_seconds();
 }
 
-/// Points in source_point_cloud farther than opt.max_disp from the reference cloud are deleted.
+/// Points in source_point_cloud farther than opt.max_disp from the
+/// reference cloud are deleted. The errors of the points left are
+/// returned, so they need not be found again.
 void filter_source_cloud(DP          const& ref_point_cloud,
                          DP               & source_point_cloud,
                          PM::ICP          & pm_icp_object, // Must already be initialized
                          vw::Vector3 const& shift,
                          vw::cartography::GeoReference        const& dem_georef,
                          vw::ImageViewRef< PixelMask<float> > const& dem_ref,
-                         Options const& opt) {
+                         Options const& opt,
+                         PointMatcher<RealT>::Matrix & error_matrix) {
 
   // Filter gross outliers
   Stopwatch sw;
@@ -860,23 +1033,11 @@ void filter_source_cloud(DP          const& ref_point_cloud,
   if (opt.verbose)
     vw_out() << "Filtering gross outliers" << endl;
 
-  PointMatcher<RealT>::Matrix error_matrix;
-  try {
-    if (opt.use_dem_distances()) {
-      // Compute the registration error using the best available means
-      compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object, shift,
-                                 dem_georef, dem_ref, opt, error_matrix);
-
-      filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
-    } else { // LPM only method
-        // Points in source_point_cloud further than opt.max_disp from ref_point_cloud are deleted!
-        pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, opt.max_disp,
-                                                       source_point_cloud, error_matrix);
-    }
-  }catch(const PointMatcher<RealT>::ConvergenceError & e){
+  compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object, shift,
+                             dem_georef, dem_ref, opt, error_matrix);
+  filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
+  if (source_point_cloud.features.cols() == 0)
     vw_throw( ArgumentErr() << "Error: No points left in source cloud after filtering.\n");
-  }
-
 
   sw.stop();
   if (opt.verbose)
@@ -919,7 +1080,7 @@ void manual_transform(Options & opt){
 
   vector<vw::ip::InterestPoint> ref_ip, source_ip;
   vw_out() << "Reading match file: " << opt.match_file << "\n";
-  vw::ip::read_binary_match_file(opt.match_file, ref_ip, source_ip);
+  asp::read_match_file(opt.match_file, ref_ip, source_ip);
 
   DiskImageView<float> ref(opt.reference);
   vw::cartography::GeoReference ref_geo;
@@ -1011,6 +1172,78 @@ void apply_transform_to_cloud(PointMatcher<RealT>::Matrix const& T, DP & point_c
   }
 }
 
+/// Set the ICP parameters from the command line, or from the
+/// configuration file if one was given.
+void set_icp_params(Options const& opt, PM::ICP & icp){
+  if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+}
+
+/// Run ICP on voxel-subsampled copies of the clouds, with the voxel
+/// size halving from the coarsest level to the finest, each level
+/// starting from where the previous one converged. Return the
+/// transform from the source to the reference found at the end.
+PointMatcher<RealT>::Matrix
+pyramid_icp(DP const& ref_point_cloud, DP const& source_point_cloud,
+            vw::Vector3 const& shift,
+            vw::cartography::GeoReference        const& dem_georef,
+            vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+            Options const& opt){
+
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  PointMatcher<RealT>::Matrix T = Id;
+  for (int level = opt.num_pyramid_levels - 1; level >= 1; level--){
+
+    Stopwatch sw;
+    sw.start();
+
+    // Copy just the points, not any descriptors computed for them
+    double voxel_size = opt.pyramid_voxel_size*pow(2.0, level - 1);
+    DP ref, source;
+    ref.features        = ref_point_cloud.features;
+    ref.featureLabels   = ref_point_cloud.featureLabels;
+    source.features     = source_point_cloud.features;
+    source.featureLabels = source_point_cloud.featureLabels;
+    voxel_pc_subsample(voxel_size, ref.features);
+    voxel_pc_subsample(voxel_size, source.features);
+    apply_transform_to_cloud(T, source);
+
+    std::ostringstream label;
+    label << "Level " << level;
+    vw_out() << label.str() << " of the pyramid, with voxel size " << voxel_size
+             << " meters, has " << ref.features.cols() << " reference and "
+             << source.features.cols() << " source points." << endl;
+
+    PM::ICP icp;
+    icp.initRefTree(ref, alignment_method_fallback(opt.alignment_method),
+		    opt.highest_accuracy, false /*opt.verbose*/);
+    set_icp_params(opt, icp);
+    PointMatcher<RealT>::Matrix levelT = icp(source, ref, Id, opt.compute_translation_only);
+    T = levelT*T;
+
+    apply_transform_to_cloud(levelT, source);
+    PointMatcher<RealT>::Matrix errors;
+    compute_registration_error(ref, source, icp, shift, dem_georef, dem_ref, opt, errors);
+    calc_stats(label.str(), errors);
+
+    sw.stop();
+    vw_out() << label.str() << " took " << sw.elapsed_seconds() << " [s]" << endl;
+  }
+
+  return T;
+}
+
 
 // Convert a north-east-down vector at a given location to a vector in reference
 // to the center of the Earth and create a translation matrix from that vector. 
@@ -1145,6 +1378,12 @@ int main( int argc, char *argv[] ) {
     if (opt.verbose)
       vw_out() << "Loading the reference point cloud took "
                << sw1.elapsed_seconds() << " [s]" << endl;
+
+    if (opt.reference_voxel_size > 0) {
+      voxel_pc_subsample(opt.reference_voxel_size, ref_point_cloud.features);
+      vw_out() << "Reducing number of reference points to "
+               << ref_point_cloud.features.cols() << endl;
+    }
     //ref_point_cloud.save(outputBaseFile + "_ref.vtk");
 
     // Load the subsampled source point cloud. If the user wants
@@ -1204,7 +1443,9 @@ int main( int argc, char *argv[] ) {
       vw_out() << "Loading reference as DEM." << endl;
       // Load the dem, then wrap it inside an ImageViewRef object.
       // - This is done because the actual DEM type cannot be created without being initialized.
-      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef));
+      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef,
+                                                                       opt.dem_cache_dir,
+                                                                       opt.num_threads));
       reference_dem_ref.reset(reference_dem);
     }
 
@@ -1227,54 +1468,60 @@ int main( int argc, char *argv[] ) {
     // Apply the initial guess transform to the source point cloud.
     apply_transform_to_cloud(initT, source_point_cloud);
     
+    // The errors found when filtering are those of the input, so
+    // subsample them with the points rather than finding them again.
     PointMatcher<RealT>::Matrix beg_errors;
-    if (opt.max_disp > 0.0){
+    bool have_beg_errors = (opt.max_disp > 0.0);
+    if (have_beg_errors){
       // Filter gross outliers
       filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
-                          shift, dem_georef, reference_dem_ref, opt);
+                          shift, dem_georef, reference_dem_ref, opt, beg_errors);
     }
 
-    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
+    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features,
+                        have_beg_errors ? &beg_errors : NULL);
     vw_out() << "Reducing number of source points to "
              << source_point_cloud.features.cols() << endl;
 
     //dump_llh("ref.csv", datum, ref_point_cloud,    shift);
     //dump_llh("src.csv", datum, source, shift);
 
-    elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref,
-					      opt, beg_errors);
+    if (!have_beg_errors){
+      elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
+                                                shift, dem_georef, reference_dem_ref,
+                                                opt, beg_errors);
+      if (opt.verbose)
+        vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
+    }
     calc_stats("Input", beg_errors);
-    if (opt.verbose)
-      vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
 
 
     // Compute the transformation to align the source to reference.
     Stopwatch sw4;
     sw4.start();
     PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
-    }else{
+    if (opt.config_file != "")
       vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
-    }
+    set_icp_params(opt, icp);
 
     // We bypass calling ICP if the user explicitely asks for 0 iterations.
     PointMatcher<RealT>::Matrix T = Id;
     if (opt.num_iter > 0){
       if (opt.alignment_method != "least-squares" &&
 	  opt.alignment_method != "similarity-least-squares") {
-	T = icp(source_point_cloud, ref_point_cloud, Id,
-		opt.compute_translation_only);
+        if (opt.num_pyramid_levels > 1) {
+          // Converge on the coarse levels first, then refine at full density
+          PointMatcher<RealT>::Matrix pyramidT
+            = pyramid_icp(ref_point_cloud, source_point_cloud, shift,
+                          dem_georef, reference_dem_ref, opt);
+          DP pyramid_source_point_cloud(source_point_cloud);
+          apply_transform_to_cloud(pyramidT, pyramid_source_point_cloud);
+          T = icp(pyramid_source_point_cloud, ref_point_cloud, Id,
+                  opt.compute_translation_only)*pyramidT;
+        }else{
+          T = icp(source_point_cloud, ref_point_cloud, Id,
+                  opt.compute_translation_only);
+        }
 	vw_out() << "Match ratio: "
 		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
       }else{
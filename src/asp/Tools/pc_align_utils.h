@@ -60,7 +60,10 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/SharedDem.h>
+#include <vw/Core/ThreadPool.h>
 #include <liblas/liblas.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <limits>
 #include <cstring>
@@ -227,9 +230,22 @@ typedef vw::InterpolationView< vw::EdgeExtensionView< vw::ImageViewRef< vw::Pixe
                                                       vw::ConstantEdgeExtension>,
                                vw::BilinearInterpolation> InterpolationReadyDem;
 
-/// Get ready to interpolate points on a DEM existing on disk.
+/// Get ready to interpolate points on a DEM existing on disk. With a
+/// cache directory, the DEM is mapped in memory as SharedDem does.
 InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef);
+                                                   vw::cartography::GeoReference     & georef,
+                                                   std::string const& dem_cache_dir = "",
+                                                   int num_threads = 1);
+
+/// Read into memory the part of a DEM on disk within the given pixel
+/// box, and get it ready to interpolate, as load_interpolation_ready_dem()
+/// does. Interpolating into it needs no locking, so it is faster and
+/// can be shared among threads. The georeference is that of the part.
+InterpolationReadyDem load_interpolation_ready_dem_tile(std::string const& dem_path,
+                                                        vw::BBox2i pix_box,
+                                                        vw::cartography::GeoReference & georef,
+                                                        std::string const& dem_cache_dir = "",
+                                                        int num_threads = 1);
 
 /// Interpolates the DEM height at the input coordinate.
 /// - Returns false if the coordinate falls outside the valid DEM area.
@@ -199,7 +199,11 @@ void load_cloud(std::string const& file_name,
   else if (file_type == "PC")
     load_pc(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	    geo, verbose, data);
-  else if (file_type == "LAS")
+  else if (can_use_point_cache(file_name, csv_conv)){
+    is_lola_rdr_format = false;
+    load_cached_cloud(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
+                      geo, csv_conv, mean_longitude, verbose, data);
+  }else if (file_type == "LAS")
     load_las(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	     geo, verbose, data);
   else if (file_type == "CSV"){
@@ -436,6 +440,101 @@ vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 co
     return Q;
 }
 
+/// Points are transformed and formatted for output in chunks of this
+/// size, and this many chunks per thread are kept in memory at a time.
+const int TRANS_CHUNK_SIZE        = 100000;
+const int TRANS_CHUNKS_PER_THREAD = 4;
+
+/// Transform a range of points loaded from a CSV file and format them
+/// as lines of a CSV file consistent with it.
+class CsvTransformTask: public vw::Task, private boost::noncopyable {
+  DP                          const& m_point_cloud;
+  vw::Vector3                        m_shift;
+  PointMatcher<RealT>::Matrix        m_T;
+  CsvConv                     const& m_csv_conv;
+  vw::cartography::GeoReference      m_geo; // a copy for each thread
+  double                             m_mean_longitude;
+  bool                               m_is_lola_rdr_format;
+  int                                m_beg, m_end;
+  std::string                      & m_text;
+public:
+  CsvTransformTask(DP const& point_cloud, vw::Vector3 const& shift,
+                   PointMatcher<RealT>::Matrix const& T, CsvConv const& csv_conv,
+                   vw::cartography::GeoReference const& geo, double mean_longitude,
+                   bool is_lola_rdr_format, int beg, int end, std::string & text):
+    m_point_cloud(point_cloud), m_shift(shift), m_T(T), m_csv_conv(csv_conv),
+    m_geo(geo), m_mean_longitude(mean_longitude), m_is_lola_rdr_format(is_lola_rdr_format),
+    m_beg(beg), m_end(end), m_text(text){}
+
+  void operator()() {
+    std::ostringstream os;
+    os.precision(16);
+    Eigen::VectorXd V(DIM + 1);
+    for (int col = m_beg; col < m_end; col++){
+
+      for (int row = 0; row < DIM; row++)
+        V[row] = m_point_cloud.features(row, col) + m_shift[row];
+      V[DIM] = 1;
+
+      // Apply the transform
+      V = m_T*V;
+
+      vw::Vector3 P;
+      for (int row = 0; row < DIM; row++) P[row] = V[row];
+
+      if (m_csv_conv.is_configured()){
+
+        vw::Vector3 csv = m_csv_conv.cartesian_to_csv(P, m_geo, m_mean_longitude);
+        os << csv[0] << ',' << csv[1] << ',' << csv[2] << '\n';
+
+      }else{
+        vw::Vector3 llh = m_geo.datum().cartesian_to_geodetic(P); // lon-lat-height
+        llh[0] += 360.0*round((m_mean_longitude - llh[0])/360.0); // 360 deg adjustment
+
+        if (m_is_lola_rdr_format)
+          os << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << '\n';
+        else
+          os << llh[1] << ',' << llh[0] << ',' << llh[2] << '\n';
+      }
+    }
+    m_text = os.str();
+  }
+};
+
+/// Transform a range of points read from a LAS file, in place.
+class LasTransformTask: public vw::Task, private boost::noncopyable {
+  std::vector<vw::Vector3>         & m_points;
+  PointMatcher<RealT>::Matrix        m_T;
+  bool                               m_has_georef;
+  vw::cartography::GeoReference      m_las_georef; // a copy for each thread
+  size_t                             m_beg, m_end;
+public:
+  LasTransformTask(std::vector<vw::Vector3> & points, PointMatcher<RealT>::Matrix const& T,
+                   bool has_georef, vw::cartography::GeoReference const& las_georef,
+                   size_t beg, size_t end):
+    m_points(points), m_T(T), m_has_georef(has_georef), m_las_georef(las_georef),
+    m_beg(beg), m_end(end){}
+
+  void operator()() {
+    for (size_t i = m_beg; i < m_end; i++){
+      vw::Vector3 P = m_points[i];
+      if (m_has_georef){
+        // Go from projected space to xyz
+        vw::Vector2 ll = m_las_georef.point_to_lonlat(subvector(P, 0, 2));
+        P = m_las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], P[2]));
+      }
+      P = apply_transform(m_T, P);
+      if (m_has_georef){
+        // Go from xyz to projected space
+        vw::Vector3 llh = m_las_georef.datum().cartesian_to_geodetic(P);
+        subvector(P, 0, 2) = m_las_georef.lonlat_to_point(subvector(llh, 0, 2));
+        P[2] = llh[2];
+      }
+      m_points[i] = P;
+    }
+  }
+};
+
 /// Apply a given transform to the point cloud in input file,
 /// and save it.
 /// - Note: We transform the entire point cloud, not just the resampled
@@ -515,35 +614,41 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
     ofs.open(output_file.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
+    // Read a batch of points, transform it in parallel, and write it,
+    // keeping the order of the points.
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = num_total_points/hundred;
-    double inc_amount = 1.0 / hundred;
+    int num_threads = std::max(opt.num_threads, 1);
+    size_t batch_size = size_t(TRANS_CHUNK_SIZE)*TRANS_CHUNKS_PER_THREAD*num_threads;
+    std::vector<vw::Vector3> points;
     vw::int64 count = 0;
-    while (reader.ReadNextPoint()){
+    bool has_more = true;
+    while (has_more){
 
-      liblas::Point const& in_las_pt = reader.GetPoint();
-      vw::Vector3 P(in_las_pt.GetX(), in_las_pt.GetY(), in_las_pt.GetZ());
-      if (has_georef){
-        // Go from projected space to xyz
-        vw::Vector2 ll = las_georef.point_to_lonlat(subvector(P, 0, 2));
-        P = las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], P[2]));
-      }
-      P = apply_transform(T, P);
-      if (has_georef){
-        // Go from xyz to projected space
-        vw::Vector3 llh = las_georef.datum().cartesian_to_geodetic(P);
-        subvector(P, 0, 2) = las_georef.lonlat_to_point(subvector(llh, 0, 2));
-        P[2] = llh[2];
+      points.clear();
+      while (points.size() < batch_size && (has_more = reader.ReadNextPoint())){
+        liblas::Point const& in_las_pt = reader.GetPoint();
+        points.push_back(vw::Vector3(in_las_pt.GetX(), in_las_pt.GetY(), in_las_pt.GetZ()));
       }
 
-      liblas::Point out_las_pt(&header);
-      out_las_pt.SetCoordinates(P[0], P[1], P[2]);
-      writer.WritePoint(out_las_pt);
+      {
+        vw::FifoWorkQueue queue(num_threads);
+        for (size_t beg = 0; beg < points.size(); beg += TRANS_CHUNK_SIZE){
+          size_t end = std::min(beg + TRANS_CHUNK_SIZE, points.size());
+          boost::shared_ptr<LasTransformTask>
+            task(new LasTransformTask(points, T, has_georef, las_georef, beg, end));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
 
-      if (count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+      for (size_t i = 0; i < points.size(); i++){
+        liblas::Point out_las_pt(&header);
+        out_las_pt.SetCoordinates(points[i][0], points[i][1], points[i][2]);
+        writer.WritePoint(out_las_pt);
+      }
 
-      count++;
+      count += points.size();
+      tpc.report_progress(double(count)/std::max(num_total_points, vw::int64(1)));
     }
     tpc.report_finished();
 
@@ -583,40 +688,33 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
       outfile << "# Projection: " << geo.overall_proj4_str() << std::endl;
     }
 
+    // Transform and format the points in parallel, in chunks, and
+    // write the chunks in order.
     int numPts = point_cloud.features.cols();
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = numPts/hundred;
-    double inc_amount = 1.0 / hundred;
-    for (int col = 0; col < numPts; col++){
-
-      Eigen::VectorXd V(DIM + 1);
-      for (int row = 0; row < DIM; row++)
-        V[row] = point_cloud.features(row, col) + shift[row];
-      V[DIM] = 1;
-
-      // Apply the transform
-      V = T*V;
-
-      vw::Vector3 P;
-      for (int row = 0; row < DIM; row++) P[row] = V[row];
-
-      if (csv_conv.is_configured()){
-
-        vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, mean_longitude);
-        outfile << csv[0] << ',' << csv[1] << ',' << csv[2] << std::endl;
-
-      }else{
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
-        llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
-
-        if (is_lola_rdr_format)
-          outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << std::endl;
-        else
-          outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
+    int num_threads = std::max(opt.num_threads, 1);
+    int batch_size  = TRANS_CHUNK_SIZE*TRANS_CHUNKS_PER_THREAD*num_threads;
+    for (int batch_beg = 0; batch_beg < numPts; batch_beg += batch_size){
+
+      int batch_end = std::min(batch_beg + batch_size, numPts);
+      std::vector<std::string> texts((batch_end - batch_beg + TRANS_CHUNK_SIZE - 1)/TRANS_CHUNK_SIZE);
+      {
+        vw::FifoWorkQueue queue(num_threads);
+        for (int beg = batch_beg; beg < batch_end; beg += TRANS_CHUNK_SIZE){
+          int end = std::min(beg + TRANS_CHUNK_SIZE, batch_end);
+          boost::shared_ptr<CsvTransformTask>
+            task(new CsvTransformTask(point_cloud, shift, T, csv_conv, geo, mean_longitude,
+                                      is_lola_rdr_format, beg, end,
+                                      texts[(beg - batch_beg)/TRANS_CHUNK_SIZE]));
+          queue.add_task(task);
+        }
+        queue.join_all();
       }
 
-      if (col%spacing == 0) tpc.report_incremental_progress( inc_amount );
+      for (size_t i = 0; i < texts.size(); i++)
+        outfile << texts[i];
+
+      tpc.report_progress(double(batch_end)/numPts);
     }
     tpc.report_finished();
     outfile.close();
@@ -629,26 +727,32 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
 
 
 InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef) {
-  // Load the georeference from the DEM
-  bool has_georef = vw::cartography::read_georeference( georef, dem_path );
-  if (!has_georef)
-    vw::vw_throw(vw::ArgumentErr() << "DEM: " << dem_path << " does not have a georeference.\n");
-
-  // Set up file handle to the DEM and read the nodata value
-  vw::DiskImageView<float> dem(dem_path);
-  double nodata = std::numeric_limits<double>::quiet_NaN();
-  {
-    boost::shared_ptr<vw::DiskImageResource> dem_rsrc( new vw::DiskImageResourceGDAL(dem_path) );
-    if (dem_rsrc->has_nodata_read())
-      nodata = dem_rsrc->nodata_read();
-  }
-  
-  // Set up interpolation + mask view of the DEM
-  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = create_mask(dem, nodata);
+                                                   vw::cartography::GeoReference     & georef,
+                                                   std::string const& dem_cache_dir,
+                                                   int num_threads) {
+  // Set up interpolation + mask view of the DEM, mapped in memory if it can be
+  SharedDem dem(dem_path, dem_cache_dir, num_threads);
+  georef = dem.georef();
+  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = dem.masked_dem();
   return InterpolationReadyDem(interpolate(masked_dem));
 }
 
+InterpolationReadyDem load_interpolation_ready_dem_tile(std::string const& dem_path,
+                                                        vw::BBox2i pix_box,
+                                                        vw::cartography::GeoReference & georef,
+                                                        std::string const& dem_cache_dir,
+                                                        int num_threads) {
+  SharedDem dem(dem_path, dem_cache_dir, num_threads);
+  georef = dem.georef();
+  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = dem.masked_dem();
+
+  pix_box.crop(bounding_box(masked_dem));
+  vw::ImageView< vw::PixelMask<float> > tile = crop(masked_dem, pix_box);
+  georef = vw::cartography::crop(georef, pix_box.min().x(), pix_box.min().y());
+
+  vw::ImageViewRef< vw::PixelMask<float> > tile_ref = tile;
+  return InterpolationReadyDem(interpolate(tile_ref));
+}
 
 bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
                        vw::cartography::GeoReference const & georef,
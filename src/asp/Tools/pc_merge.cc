@@ -24,42 +24,37 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudTypes.h>
 #include <asp/Core/OrthoRasterizer.h>
 
+#include <vw/Core/Settings.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
 #include <limits>
+#include <map>
 
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,4> Vector4;
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector3f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector4f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::vector<std::string> pointcloud_files;
 
   // Settings
-  bool  write_double;  ///< If true, output file is double instead of float
+  bool   write_double;   ///< If true, output file is double instead of float
+  bool   spatial_tiling; ///< If true, group the output points by location
+  double voxel_size;     ///< If positive, thin the points of overlapping clouds
 
   // Output
   std::string out_file;
 
-  Options() : write_double(false) {}
+  Options() : write_double(false), spatial_tiling(false), voxel_size(0) {}
 };
 
 
@@ -68,7 +63,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("General Options");
   general_options.add_options()
     ("output-file,o",  po::value(&opt.out_file)->default_value(""),        "Specify the output file.")
-    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.");
+    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.")
+    ("spatial-tiling", po::bool_switch(&opt.spatial_tiling)->default_value(false),
+     "Group the points of the output cloud by location, so that tools reading it by blocks, such as point2dem, read fewer blocks per region.")
+    ("voxel-size",     po::value(&opt.voxel_size)->default_value(0),
+     "With --spatial-tiling, drop the points falling in a cube of this size already having points from an earlier cloud.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -96,6 +95,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "The output file must be specified!\n"
               << usage << general_options );
 
+  if (opt.voxel_size > 0 && !opt.spatial_tiling)
+    vw_throw( ArgumentErr() << "The --voxel-size option requires --spatial-tiling.\n" );
+
   vw::create_out_dir(opt.out_file);
 }
 
@@ -146,12 +148,337 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
 }
 
 
+// ---------------------------------------------------------------------------
+// Spatial tiling. The valid points of all clouds are bucketed into square
+// cells of a grid in a plane tangent to the clouds. The points of each cell
+// go to their own blocks of the output image, and these blocks are as large
+// as the subblocks point2dem reads, so each of those is spatially compact.
+// The input clouds are read from disk block by block, not held in memory.
+
+namespace {
+
+  /// Coordinates in a plane perpendicular to the direction of the
+  /// center of the clouds
+  class TangentPlane {
+    Vector3 m_e1, m_e2;
+  public:
+    TangentPlane(): m_e1(1, 0, 0), m_e2(0, 1, 0) {}
+    TangentPlane(Vector3 const& center): m_e1(1, 0, 0), m_e2(0, 1, 0) {
+      if (norm_2(center) <= 0)
+        return;
+      Vector3 n = normalize(center);
+      Vector3 a = (std::abs(n[2]) < 0.9) ? Vector3(0, 0, 1) : Vector3(1, 0, 0);
+      m_e1 = normalize(cross_prod(a, n));
+      m_e2 = cross_prod(n, m_e1);
+    }
+    Vector2 operator()(Vector3 const& p) const {
+      return Vector2(dot_prod(p, m_e1), dot_prod(p, m_e2));
+    }
+  };
+
+  /// A grid of square cells in the tangent plane. Points outside of it
+  /// go to the nearest cell.
+  struct CellGrid {
+    Vector2 origin;
+    double  cell_size;
+    int     cols, rows;
+    CellGrid(): cell_size(1), cols(1), rows(1) {}
+    int cell(Vector2 const& p) const {
+      int c = (int)floor((p.x() - origin.x())/cell_size);
+      int r = (int)floor((p.y() - origin.y())/cell_size);
+      c = std::max(0, std::min(c, cols - 1));
+      r = std::max(0, std::min(r, rows - 1));
+      return r*cols + c;
+    }
+  };
+
+  template <class PixelT>
+  inline bool is_valid_point(PixelT const& p) {
+    return subvector(p, 0, 3) != Vector3();
+  }
+
+  /// A block of an input cloud, with its valid points
+  struct InputBlock {
+    int    file;
+    BBox2i box;
+    BBox3  bbox;                        ///< Bounding box of the points
+    int64  count;                       ///< Number of points
+    std::map<int, int64> cell_counts;   ///< Number of points in each cell
+    InputBlock(int file_in, BBox2i const& box_in): file(file_in), box(box_in), count(0) {}
+  };
+
+  /// Find the bounding box and the number of points of an input block,
+  /// or, once the grid is known, the number of its points in each cell.
+  template <class PixelT>
+  class InputBlockTask: public Task, private boost::noncopyable {
+    ImageViewRef<PixelT> const& m_cloud;
+    InputBlock  & m_block;
+    TangentPlane  m_plane;
+    CellGrid const* m_grid;
+  public:
+    InputBlockTask(ImageViewRef<PixelT> const& cloud, InputBlock & block,
+                   TangentPlane const& plane, CellGrid const* grid):
+      m_cloud(cloud), m_block(block), m_plane(plane), m_grid(grid) {}
+
+    void operator()() {
+      ImageView<PixelT> points = crop(m_cloud, m_block.box);
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col < points.cols(); col++) {
+          if (!is_valid_point(points(col, row)))
+            continue;
+          Vector3 xyz = subvector(points(col, row), 0, 3);
+          if (m_grid) {
+            m_block.cell_counts[m_grid->cell(m_plane(xyz))]++;
+          } else {
+            m_block.bbox.grow(xyz);
+            m_block.count++;
+          }
+        }
+      }
+    }
+  };
+
+  /// What is needed to gather the points of each output block
+  template <class PixelT>
+  struct SpatialTiling {
+    std::vector<ImageViewRef<PixelT> > clouds;
+    std::vector<InputBlock> blocks;
+    std::map<int, std::vector<int> > cell_blocks;  ///< The input blocks having points in each cell
+    std::vector<std::pair<int, int> > out_blocks;  ///< The cell and chunk of each output block
+    TangentPlane plane;
+    CellGrid     grid;
+    double       voxel_size;
+    int          block_size, blocks_per_row;
+  };
+
+  /// The merged cloud, with output block k holding the chunk of the
+  /// points of a cell given by out_blocks[k]. Where a cell has more
+  /// points than a block holds, its points go to consecutive blocks.
+  template <class PixelT>
+  class SpatialTileView: public ImageViewBase<SpatialTileView<PixelT> > {
+    boost::shared_ptr<SpatialTiling<PixelT> const> m_tiling;
+
+    // The points of the given output block, in the order of the input
+    // clouds. With thinning, a point is dropped if its voxel has a point
+    // of an earlier cloud.
+    void gather_block(int block_index, std::vector<PixelT> & pts) const {
+
+      SpatialTiling<PixelT> const& T = *m_tiling;
+      int   cell = T.out_blocks[block_index].first;
+      int64 beg  = int64(T.out_blocks[block_index].second)*T.block_size*T.block_size;
+      int64 end  = beg + int64(T.block_size)*T.block_size;
+
+      typedef std::pair<int64, std::pair<int64, int64> > VoxelKey;
+      std::map<VoxelKey, int> voxel_file;
+      int64 num_kept = 0;
+
+      std::vector<int> const& blocks = T.cell_blocks.find(cell)->second;
+      for (size_t b = 0; b < blocks.size(); b++) {
+        InputBlock const& block = T.blocks[blocks[b]];
+        ImageView<PixelT> points = crop(T.clouds[block.file], block.box);
+        for (int row = 0; row < points.rows(); row++) {
+          for (int col = 0; col < points.cols(); col++) {
+            PixelT const& p = points(col, row);
+            if (!is_valid_point(p))
+              continue;
+            Vector3 xyz = subvector(p, 0, 3);
+            if (T.grid.cell(T.plane(xyz)) != cell)
+              continue;
+            if (T.voxel_size > 0) {
+              VoxelKey key((int64)floor(xyz[0]/T.voxel_size),
+                           std::make_pair((int64)floor(xyz[1]/T.voxel_size),
+                                          (int64)floor(xyz[2]/T.voxel_size)));
+              std::map<VoxelKey, int>::iterator it = voxel_file.find(key);
+              if (it == voxel_file.end())
+                voxel_file[key] = block.file;
+              else if (it->second != block.file)
+                continue;
+            }
+            if (num_kept >= beg)
+              pts.push_back(p);
+            num_kept++;
+            if (num_kept >= end)
+              return;
+          }
+        }
+      }
+    }
+
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef ProceduralPixelAccessor<SpatialTileView> pixel_accessor;
+
+    SpatialTileView(boost::shared_ptr<SpatialTiling<PixelT> const> tiling): m_tiling(tiling) {}
+
+    inline int32 cols  () const { return m_tiling->blocks_per_row*m_tiling->block_size; }
+    inline int32 rows  () const {
+      int num_block_rows = (m_tiling->out_blocks.size() + m_tiling->blocks_per_row - 1)
+        /m_tiling->blocks_per_row;
+      return num_block_rows*m_tiling->block_size;
+    }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "SpatialTileView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      fill(tile, pixel_type());
+
+      int B = m_tiling->block_size;
+      for (int by = bbox.min().y()/B; by <= (bbox.max().y() - 1)/B; by++) {
+        for (int bx = bbox.min().x()/B; bx <= (bbox.max().x() - 1)/B; bx++) {
+          int block_index = by*m_tiling->blocks_per_row + bx;
+          if (block_index >= (int)m_tiling->out_blocks.size())
+            continue;
+          std::vector<PixelT> pts;
+          gather_block(block_index, pts);
+          for (size_t k = 0; k < pts.size(); k++) {
+            Vector2i pix(bx*B + k%B, by*B + k/B);
+            if (bbox.contains(pix))
+              tile(pix.x() - bbox.min().x(), pix.y() - bbox.min().y()) = pts[k];
+          }
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end anonymous namespace
+
+/// Read the clouds block by block to bucket their points into cells, and
+/// return the merged cloud with the points of each cell together.
+template <class PixelT>
+ImageViewRef<PixelT> spatially_tiled_cloud(Options const& opt) {
+
+  boost::shared_ptr<SpatialTiling<PixelT> > T(new SpatialTiling<PixelT>());
+  T->voxel_size = opt.voxel_size;
+  T->block_size = asp::OrthoRasterizerView::max_subblock_size();
+  int B = T->block_size;
+
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  for (size_t i = 0; i < opt.pointcloud_files.size(); i++) {
+    T->clouds.push_back(asp::read_asp_point_cloud< math::VectorSize<PixelT>::value >
+                        (opt.pointcloud_files[i]));
+    ImageViewRef<PixelT> const& cloud = T->clouds.back();
+    for (int row = 0; row < cloud.rows(); row += B) {
+      for (int col = 0; col < cloud.cols(); col += B) {
+        T->blocks.push_back(InputBlock(i, BBox2i(col, row, std::min(B, cloud.cols() - col),
+                                                 std::min(B, cloud.rows() - row))));
+      }
+    }
+  }
+
+  vw_out() << "Finding the extent of the point clouds.\n";
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t b = 0; b < T->blocks.size(); b++) {
+      boost::shared_ptr<InputBlockTask<PixelT> >
+        task(new InputBlockTask<PixelT>(T->clouds[T->blocks[b].file], T->blocks[b],
+                                        TangentPlane(), NULL));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  BBox3 cloud_bbox;
+  int64 num_points = 0;
+  for (size_t b = 0; b < T->blocks.size(); b++) {
+    if (T->blocks[b].count == 0)
+      continue;
+    cloud_bbox.grow(T->blocks[b].bbox);
+    num_points += T->blocks[b].count;
+  }
+  if (num_points == 0)
+    vw_throw( ArgumentErr() << "The input point clouds have no valid points.\n" );
+
+  // The extent in the tangent plane, from the corners of the bounding
+  // boxes of the blocks. The cells are sized so that, if the points were
+  // uniformly spread, each would fill one output block.
+  T->plane = TangentPlane((cloud_bbox.min() + cloud_bbox.max())/2.0);
+  BBox2 extent;
+  for (size_t b = 0; b < T->blocks.size(); b++) {
+    if (T->blocks[b].count == 0)
+      continue;
+    BBox3 const& bb = T->blocks[b].bbox;
+    for (int corner = 0; corner < 8; corner++) {
+      Vector3 p((corner & 1) ? bb.max()[0] : bb.min()[0],
+                (corner & 2) ? bb.max()[1] : bb.min()[1],
+                (corner & 4) ? bb.max()[2] : bb.min()[2]);
+      extent.grow(T->plane(p));
+    }
+  }
+  double area = extent.width()*extent.height();
+  T->grid.origin    = extent.min();
+  T->grid.cell_size = std::sqrt(area*B*B/double(num_points));
+  if (T->grid.cell_size <= 0)
+    T->grid.cell_size = std::max(1.0, std::max(extent.width(), extent.height()));
+  T->grid.cols = std::max(1, (int)ceil(extent.width ()/T->grid.cell_size));
+  T->grid.rows = std::max(1, (int)ceil(extent.height()/T->grid.cell_size));
+
+  vw_out() << "Bucketing " << num_points << " points into cells of size "
+           << T->grid.cell_size << ".\n";
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t b = 0; b < T->blocks.size(); b++) {
+      if (T->blocks[b].count == 0)
+        continue;
+      boost::shared_ptr<InputBlockTask<PixelT> >
+        task(new InputBlockTask<PixelT>(T->clouds[T->blocks[b].file], T->blocks[b],
+                                        T->plane, &T->grid));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // Lay out the output blocks of each cell, in the order of the cells
+  std::map<int, int64> cell_counts;
+  for (size_t b = 0; b < T->blocks.size(); b++) {
+    for (std::map<int, int64>::const_iterator it = T->blocks[b].cell_counts.begin();
+         it != T->blocks[b].cell_counts.end(); it++) {
+      cell_counts[it->first] += it->second;
+      T->cell_blocks[it->first].push_back(b);
+    }
+  }
+  for (std::map<int, int64>::const_iterator it = cell_counts.begin();
+       it != cell_counts.end(); it++) {
+    int num_chunks = (it->second + int64(B)*B - 1)/(int64(B)*B);
+    for (int chunk = 0; chunk < num_chunks; chunk++)
+      T->out_blocks.push_back(std::make_pair(it->first, chunk));
+  }
+  T->blocks_per_row = std::max(1, (int)ceil(sqrt(double(T->out_blocks.size()))));
+  vw_out() << "The points are in " << cell_counts.size() << " cells, written to "
+           << T->out_blocks.size() << " blocks of size " << B << ".\n";
+
+  boost::shared_ptr<SpatialTiling<PixelT> const> tiling = T;
+  return SpatialTileView<PixelT>(tiling);
+}
+
 // Do the actual work of loading, merging, and saving the point clouds
 
 // Case 1: Single-channel cloud.
 template <class PixelT>
 typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
 do_work(Vector3 const& shift, Options const& opt) {
+  if (opt.spatial_tiling)
+    vw_throw( ArgumentErr() << "Spatial tiling requires point clouds with 3 or more channels.\n" );
+
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
   ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
@@ -173,7 +500,11 @@ typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >
 do_work(Vector3 const& shift, Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
-  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
+  ImageViewRef<PixelT> merged_cloud;
+  if (opt.spatial_tiling)
+    merged_cloud = spatially_tiled_cloud<PixelT>(opt);
+  else
+    merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
 
   // See if we can pull a georeference from somewhere. Of course it will be wrong
   // when applied to the merged cloud, but it will at least have the correct datum
@@ -205,6 +536,15 @@ do_work(Vector3 const& shift, Options const& opt) {
       opt, TerminalProgressCallback("asp", "\t--> Merging: "));
 }
 
+// Calls do_work() with the pixel type of the input clouds
+struct MergeWork {
+  Vector3 const& m_shift;
+  Options const& m_opt;
+  MergeWork(Vector3 const& shift, Options const& opt): m_shift(shift), m_opt(opt) {}
+  template <class PixelT>
+  void apply() { do_work<PixelT>(m_shift, m_opt); }
+};
+
 //-----------------------------------------------------------------------------------
 
 int main( int argc, char *argv[] ) {
@@ -219,16 +559,14 @@ int main( int argc, char *argv[] ) {
     // Determine the output shift (if any)
     Vector3 shift = determine_output_shift(opt.pointcloud_files, opt);
 
-    // The code has to branch here depending on the number of channels
-    switch (num_channels)
-    {
-      // The input point clouds have their shift incorporated and are stored as doubles.
-      // If the output file is stored as float, it needs to have a single shift value applied.
-      case 1:  do_work< vw::PixelGray<float> >(shift, opt); break;
-      case 3:  do_work<Vector3>(shift, opt); break;
-      case 4:  do_work<Vector4>(shift, opt); break;
-      case 6:  do_work<Vector6>(shift, opt); break;
-      default: vw_throw( ArgumentErr() << "Unsupported number of channels!.\n" );
+    // The code has to branch here depending on the number of channels.
+    // The input point clouds have their shift incorporated and are stored as doubles.
+    // If the output file is stored as float, it needs to have a single shift value applied.
+    if (num_channels == 1) {
+      do_work< vw::PixelGray<float> >(shift, opt);
+    } else {
+      MergeWork work(shift, opt);
+      asp::dispatch_point_cloud_channels(num_channels, work);
     }
 
   } ASP_STANDARD_CATCHES;
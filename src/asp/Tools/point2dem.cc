@@ -21,9 +21,16 @@
 
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/NumaAffinity.h>
+#include <asp/Core/Telemetry.h>
+#include <asp/Core/TileCache.h>
+#include <asp/Core/HoleFill.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/PointCloudTypes.h>
+#include <asp/Core/ObjectStorage.h>
+#include <asp/Core/PointCloudStats.h>
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Image/InpaintView.h>
 
@@ -38,21 +45,13 @@
 #include <boost/math/special_functions/fpclassify.hpp>
 
 #include <limits>
+#include <unistd.h>
 
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector3f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 // This is a list of types the user can specify for output with a dedicated command line flag.
 enum ProjectionType {
   SINUSOIDAL,
@@ -78,6 +77,10 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string reference_spheroid, datum;
   double      phi_rot, omega_rot, kappa_rot;
   std::string rot_order;
+  std::string numa_affinity;
+  double      point_cloud_cache_size;
+  double      in_memory_cloud_resolution;
+  bool        telemetry;
   double      proj_lat, proj_lon, proj_scale, false_easting, false_northing;
   double      lon_offset, lat_offset, height_offset;
   size_t      utm_zone;
@@ -87,6 +90,8 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string target_srs_string;
   BBox2       target_projwin;
   int         fsaa, dem_hole_fill_len, ortho_hole_fill_len, ortho_hole_fill_extra_len;
+  std::string hole_fill_method_str;
+  asp::HoleFillMethod hole_fill_method;
   bool        remove_outliers_with_pct;
   Vector2     remove_outliers_params;
   double      max_valid_triangulation_error;
@@ -97,6 +102,8 @@ struct Options : vw::cartography::GdalWriteOptions {
   bool        use_surface_sampling;
   bool        has_las_or_csv;
   Vector2i    max_output_size;
+  bool        coarse_dems_from_finest;
+  bool        cog;
 
   // Output
   std::string out_prefix, output_file_type;
@@ -105,10 +112,12 @@ struct Options : vw::cartography::GdalWriteOptions {
   Options() : nodata_value(-std::numeric_limits<float>::max()),
 	      semi_major(0), semi_minor(0), fsaa(1),
 	      dem_hole_fill_len(0), ortho_hole_fill_len(0), ortho_hole_fill_extra_len(0),
+	      hole_fill_method(asp::PUSH_PULL_HOLE_FILL),
 	      remove_outliers_with_pct(true), max_valid_triangulation_error(0),
 	      erode_len(0), search_radius_factor(0), sigma_factor(0),
 	      default_grid_size_multiplier(1.0), use_surface_sampling(false),
-	      has_las_or_csv(false), max_output_size(9999999, 9999999){}
+	      has_las_or_csv(false), max_output_size(9999999, 9999999),
+	      coarse_dems_from_finest(false), cog(false){}
 };
 
 void parse_input_clouds_textures(std::vector<std::string> const& files,
@@ -136,11 +145,23 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
 
   // Ensure that files exist
   for (int i = 0; i < num; i++){
-    if (!fs::exists(files[i])){
+    if (!asp::object_exists(files[i])){
       vw_throw( ArgumentErr() << "File does not exist: " << files[i] << ".\n" );
     }
   }
 
+  // Point clouds and textures in object storage are read in place,
+  // and LAS and CSV files there are fetched to a local copy.
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  std::vector<std::string> paths(num);
+  for (int i = 0; i < num; i++)
+    paths[i] = asp::object_read_path(files[i], "", num_threads);
+  if (opt.out_prefix.empty() && asp::is_remote_object(files[0]))
+    vw_throw( ArgumentErr() << "The output prefix must be set when the point cloud "
+              << "is in object storage.\n" );
+
   if (opt.do_ortho){
     if (num <= 1)
       vw_throw( ArgumentErr() << "Missing input texture files.\n"
@@ -154,10 +175,10 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
   // Separate the input point clouds from the textures
   opt.pointcloud_files.clear(); opt.texture_files.clear();
   for (int i = 0; i < num; i++){
-    if (asp::is_las_or_csv(files[i]) || get_num_channels(files[i]) >= 3)
-      opt.pointcloud_files.push_back(files[i]);
+    if (asp::is_las_or_csv(paths[i]) || get_num_channels(paths[i]) >= 3)
+      opt.pointcloud_files.push_back(paths[i]);
     else
-      opt.texture_files.push_back(files[i]);
+      opt.texture_files.push_back(paths[i]);
   }
 
   if (opt.pointcloud_files.empty())
@@ -389,11 +410,15 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("output-prefix,o",   po::value(&opt.out_prefix),                             "Specify the output prefix.")
     ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file.")
     ("errorimage",        po::bool_switch(&opt.do_error)->default_value(false),   "Write a triangulation intersection error image.")
+    ("cog",               po::bool_switch(&opt.cog)->default_value(false),
+	    "Write the output images as Cloud-Optimized GeoTIFF files, with overviews. Needs GDAL 3.1 or newer.")
     ("dem-hole-fill-len", po::value(&opt.dem_hole_fill_len)->default_value(0),    "Maximum dimensions of a hole in the output DEM to fill in, in pixels.")
     ("orthoimage-hole-fill-len",      po::value(&opt.ortho_hole_fill_len)->default_value(0),
 	    "Maximum dimensions of a hole in the output orthoimage to fill in, in pixels.")
     ("orthoimage-hole-fill-extra-len",      po::value(&opt.ortho_hole_fill_extra_len)->default_value(0),
 	    "This value, in pixels, will make orthoimage hole filling more aggressive by first extrapolating the point cloud. A small value is suggested to avoid artifacts. Hole-filling also works better when less strict with outlier removal, such as in --remove-outliers-params, etc.")
+    ("hole-fill-method",              po::value(&opt.hole_fill_method_str)->default_value("push-pull"),
+	    "How to fill the DEM and orthoimage holes: 'push-pull' (pyramid interpolation, fastest) or 'laplace' (the smoothest surface through the hole boundary, starting from the push-pull result).")
     ("remove-outliers",               po::bool_switch(&opt.remove_outliers_with_pct)->default_value(true),
 	    "Turn on outlier removal based on percentage of triangulation error. Obsolete, as this is the default.")
     ("remove-outliers-params",        po::value(&opt.remove_outliers_params)->default_value(Vector2(75.0, 3.0), "pct factor"),
@@ -420,7 +445,17 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("use-surface-sampling", po::bool_switch(&opt.use_surface_sampling)->default_value(false),
      "Use the older algorithm, interpret the point cloud as a surface made up of triangles and interpolate into it (prone to aliasing).")
     ("fsaa",   po::value<int>(&opt.fsaa)->default_value(1),            "Oversampling amount to perform antialiasing (obsolete).")
-    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.");
+    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.")
+    ("coarse-dems-from-finest", po::bool_switch(&opt.coarse_dems_from_finest)->default_value(false),
+     "When several values of --dem-spacing are given, and they are integer multiples of the finest one, create only the finest DEM from the point cloud, and the others by aggregating its pixels. The point cloud is then read only once. Can be used with the weighted_average, mean, min, and max filters, and when only DEMs are produced.")
+    ("numa-affinity", po::value(&opt.numa_affinity)->default_value("none"),
+     "Pin the threads to the NUMA nodes (sockets), so that the memory of each tile is on the socket of the thread processing it. Options: none, spread (give the threads to the nodes in turn), compact (fill each node before the next).")
+    ("point-cloud-cache-size", po::value(&opt.point_cloud_cache_size)->default_value(0),
+     "Keep up to this many MB of point cloud blocks, after outlier removal and filtering, to reuse them for the neighboring tiles and when making the orthoimage and error images, instead of reading them again. The default is to not keep them.")
+    ("in-memory-cloud-resolution", po::value(&opt.in_memory_cloud_resolution)->default_value(0),
+     "Keep the input point clouds in memory, compressed, with the points rounded to this resolution in meters, for example 0.001, rather than reading them from disk more than once. Set to 0 to not keep them.")
+    ("telemetry", po::bool_switch(&opt.telemetry)->default_value(false),
+     "Record the run time and resources of each tile and the point cloud cache hits and misses, as JSON lines in <output prefix>-telemetry-point2dem-<pid>.jsonl.");
   
   general_options.add( manipulation_options );
   general_options.add( projection_options );
@@ -447,6 +482,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   std::vector<std::string> input_files = vm["input-files"].as< std::vector<std::string> >();
   parse_input_clouds_textures(input_files, usage, general_options, opt);
 
+  asp::set_numa_affinity(opt.numa_affinity);
+  asp::set_tile_cache_budget("point_cloud", opt.point_cloud_cache_size);
+  asp::set_point_cloud_store_resolution(opt.in_memory_cloud_resolution);
+
   if (opt.median_filter_params[0] < 0 || opt.median_filter_params[1] < 0){
     vw_throw( ArgumentErr() << "The parameters for median-based filtering "
 			    << "must be non-negative.\n"
@@ -523,6 +562,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.ortho_hole_fill_extra_len < 0)
     vw_throw( ArgumentErr() << "The value of "
 			    << "--orthoimage-hole-fill-extra-len must be non-negative.\n");
+  opt.hole_fill_method = asp::parse_hole_fill_method(opt.hole_fill_method_str);
   if ( !opt.do_ortho && opt.ortho_hole_fill_len > 0) {
     vw_throw( ArgumentErr() << "The value of --orthoimage-hole-fill-len"
 			    << " is positive, but orthoimage generation was not requested.\n");
@@ -587,6 +627,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // Turn on logging to file
   asp::log_to_file(argc, argv, "", opt.out_prefix);
 
+  if (opt.telemetry)
+    asp::enable_telemetry(opt.out_prefix + "-telemetry-point2dem-"
+                          + vw::num_to_str(getpid()) + ".jsonl");
+
   // reference_spheroid and datum are aliases.
   boost::to_lower(opt.reference_spheroid);
   boost::to_lower(opt.datum);
@@ -729,11 +773,16 @@ namespace asp{
       + "." + opt.output_file_type;
     vw_out() << "Writing: " << output_file << "\n";
     TerminalProgressCallback tpc("asp", imgName + ": ");
-    if ( opt.output_file_type == "tif" )
+    if ( opt.output_file_type == "tif" ) {
       asp::save_with_temp_big_blocks(block_size, output_file, img, georef,
                                      opt.nodata_value, opt, tpc);
-    else
+      if (opt.cog) {
+        TerminalProgressCallback cog_tpc("asp", imgName + " COG: ");
+        asp::convert_to_cog(output_file, opt, cog_tpc);
+      }
+    } else {
       vw::cartography::write_gdal_image(output_file, img, georef, opt, tpc);
+    }
   } // End function save_image
 
 
@@ -808,6 +857,98 @@ namespace asp{
     return CombinedView<ImageT>(nodata_value, image1.impl(), image2.impl(), image3.impl());
   }
 
+  /// Create a coarser DEM from a finer one on a compatible grid. The
+  /// coarse grid spacing is factor times the fine one, and coarse pixel
+  /// (0, 0) is at fine pixel offset. Each coarse pixel aggregates the
+  /// valid fine pixels within factor/2 fine pixels of it, using the
+  /// same filter that was used to create the fine DEM.
+  class CoarsenDemView : public ImageViewBase<CoarsenDemView> {
+    ImageViewRef< PixelGray<float> > m_fine_dem;
+    int      m_factor;
+    Vector2i m_offset;
+    int32    m_cols, m_rows;
+    double   m_nodata_value;
+    std::string m_filter;
+
+  public:
+    typedef PixelGray<float> pixel_type;
+    typedef const PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<CoarsenDemView> pixel_accessor;
+
+    CoarsenDemView(ImageViewRef< PixelGray<float> > const& fine_dem, int factor,
+                   Vector2i const& offset, int32 cols, int32 rows,
+                   double nodata_value, std::string const& filter):
+      m_fine_dem(fine_dem), m_factor(factor), m_offset(offset),
+      m_cols(cols), m_rows(rows), m_nodata_value(nodata_value), m_filter(filter){}
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int32 /*i*/, int32 /*j*/, int32 /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "CoarsenDemView::operator()(...) is not implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+      // Bring in memory the fine pixels needed for this box
+      int half = m_factor/2;
+      BBox2i fine_box(m_offset + m_factor*bbox.min() - Vector2i(half, half),
+                      m_offset + m_factor*(bbox.max() - Vector2i(1, 1)) + Vector2i(half + 1, half + 1));
+      fine_box.crop(bounding_box(m_fine_dem));
+
+      ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      if (fine_box.empty()) { // the box is outside the fine DEM
+        fill(tile, m_nodata_value);
+        return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+      }
+      ImageView<pixel_type> fine = crop(m_fine_dem, fine_box);
+
+      for (int row = 0; row < bbox.height(); row++) {
+        for (int col = 0; col < bbox.width(); col++) {
+
+          Vector2i center = m_offset + m_factor*(bbox.min() + Vector2i(col, row));
+          BBox2i win(center - Vector2i(half, half), center + Vector2i(half + 1, half + 1));
+          win.crop(fine_box);
+
+          double sum = 0, min_val = 0, max_val = 0;
+          int count = 0;
+          for (int y = win.min().y(); y < win.max().y(); y++) {
+            for (int x = win.min().x(); x < win.max().x(); x++) {
+              double val = fine(x - fine_box.min().x(), y - fine_box.min().y());
+              if (val == m_nodata_value)
+                continue;
+              if (count == 0 || val < min_val) min_val = val;
+              if (count == 0 || val > max_val) max_val = val;
+              sum += val;
+              count++;
+            }
+          }
+
+          if (count == 0)
+            tile(col, row) = m_nodata_value;
+          else if (m_filter == "min")
+            tile(col, row) = min_val;
+          else if (m_filter == "max")
+            tile(col, row) = max_val;
+          else
+            tile(col, row) = sum/count; // weighted_average and mean
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   /// Round pixels in given image to multiple of given scale.
   /// Don't round nodata values.
   template <class PixelT>
@@ -853,47 +994,6 @@ namespace asp{
     }
   };
 
-  class ErrorRangeEstimAccum : public ReturnFixedType<void> {
-    typedef double accum_type;
-    std::vector<accum_type> m_vals;
-  public:
-    typedef accum_type value_type;
-
-    ErrorRangeEstimAccum() { m_vals.clear(); }
-
-    void operator()( accum_type const& value ) {
-      // Don't add zero errors, those most likely came from invalid points
-      if (value > 0)
-	m_vals.push_back(value);
-    }
-
-    int size(){
-      return m_vals.size();
-    }
-
-    value_type value(Vector2 const& remove_outliers_params){
-      VW_ASSERT(!m_vals.empty(), ArgumentErr() << "ErrorRangeEstimAccum: no valid samples");
-
-      // How to pick a representative value for maximum error?  The
-      // maximum error itself may be no good, as it could be very
-      // huge, and then sampling the range of errors will be distorted
-      // by that.  The solution adopted here: Find a percentile of the
-      // range of errors, mulitply it by the outlier factor, and
-      // multiply by another factor to ensure we don't underestimate
-      // the maximum. This value may end up being larger than the
-      // largest error, but at least it is is not grossly huge
-      // if just a few of the errors are very large.
-      std::sort(m_vals.begin(), m_vals.end());
-      int    len    = m_vals.size();
-      double pct    = remove_outliers_params[0]/100.0; // e.g., 0.75
-      double factor = remove_outliers_params[1];
-      int    k      = std::min(len-1, (int)(pct*len));
-      double val    = m_vals[k]*factor*4.0;
-      return val;
-    }
-
-  };
-
   template<int num_ch>
   ImageViewRef<double> error_norm(std::vector<std::string> const& pc_files){
 
@@ -941,29 +1041,12 @@ namespace asp{
 
 
 /// Do more work!
-void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
-                                Options& opt,
-                                cartography::GeoReference& georef,
-                                ImageViewRef<double> const& error_image,
-                                double estim_max_error,
-                                size_t *num_invalid_pixels) {
-
-  vw_out() << "\t-- Starting DEM rasterization --\n";
-  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
-  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
-
-  // TODO: Maybe put a warning or check here if the size is too big
-
-  // Now we are ready to specify the affine transform.
-  georef.set_transform(rasterizer.geo_transform());
+// Set the affine transform of the DEM georeference, given the
+// transform of the grid the rasterizer uses.
+void set_dem_transform(vw::Matrix<double,3,3> const& geo_transform,
+                       Options const& opt, cartography::GeoReference& georef) {
 
-  // If the user requested FSAA, we temporarily increase the
-  // resolution, apply a blur, then resample to the original
-  // resolution. This results in a DEM with less antialiasing.  Note
-  // that the georef above is set with the spacing before resolution
-  // is increased, which will be the final spacing as well.
-  if ( opt.fsaa > 1 )
-    rasterizer.set_spacing( rasterizer.spacing() / double(opt.fsaa) );
+  georef.set_transform(geo_transform);
 
   // If the user specified the ULLR .. update the georeference
   // transform here. The generate_fsaa_raster will be responsible
@@ -984,6 +1067,49 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     transform(1,2) -= 0.5 * transform(1,1);
     georef.set_transform( transform );
   }
+}
+
+// Rasterize the given textures with one pass over the cloud, into a
+// temporary file with one band per texture, and return the bands as
+// images to be written out as the individual products.
+template <int N>
+void rasterize_textures_to_file(asp::OrthoRasterizerView const& rasterizer,
+                                std::vector< ImageViewRef<float> > const& textures,
+                                Options const& opt, std::string const& file,
+                                std::vector< ImageViewRef< PixelGray<float> > > & channels) {
+
+  asp::OrthoRasterizerChannelsView<N> all_channels(rasterizer, textures);
+  vw::cartography::block_write_gdal_image(file, all_channels, opt,
+                                          TerminalProgressCallback("asp", "\t--> Rasterizing: "));
+
+  DiskImageView< Vector<float, N> > disk_channels(file);
+  channels.clear();
+  for (int ch = 0; ch < N; ch++)
+    channels.push_back(pixel_cast< PixelGray<float> >(select_channel(disk_channels, ch)));
+}
+
+void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
+                                Options& opt,
+                                cartography::GeoReference& georef,
+                                ImageViewRef<double> const& error_image,
+                                asp::ThreadCounter *num_invalid_pixels) {
+
+  vw_out() << "\t-- Starting DEM rasterization --\n";
+  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
+  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
+
+  // TODO: Maybe put a warning or check here if the size is too big
+
+  // Now we are ready to specify the affine transform.
+  set_dem_transform(rasterizer.geo_transform(), opt, georef);
+
+  // If the user requested FSAA, we temporarily increase the
+  // resolution, apply a blur, then resample to the original
+  // resolution. This results in a DEM with less antialiasing.  Note
+  // that the georef above is set with the spacing before resolution
+  // is increased, which will be the final spacing as well.
+  if ( opt.fsaa > 1 )
+    rasterizer.set_spacing( rasterizer.spacing() / double(opt.fsaa) );
 
   // Do not round the DEM heights for small bodies
   if (georef.datum().semi_major_axis() <= asp::MIN_RADIUS_FOR_ROUNDING ||
@@ -991,8 +1117,83 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     opt.rounding_error = 0.0;
   }
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa
-    = generate_fsaa_raster( rasterizer, opt );
+  // Stop the program if it is going to create too large a DEM, this
+  // will cause a crash. This is checked before anything is rasterized.
+  Vector2i dem_size = bounding_box(generate_fsaa_raster( rasterizer, opt )).size();
+  if ( !opt.no_dem ){
+    vw_out()<< "Creating output file that is " << dem_size << " px.\n";
+    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
+      vw_throw( ArgumentErr()
+                << "Requested DEM size is too large, max allowed output size is "
+                << opt.max_output_size << " pixels.\n" );
+  }
+
+  // The textures of the triangulation error channels, if requested.
+  std::vector< ImageViewRef<float> > err_textures;
+  if ( opt.do_error ) {
+    int num_channels = asp::num_channels(opt.pointcloud_files);
+    if (num_channels == 4){
+      // The error is a scalar.
+      ImageViewRef<Vector4> point_disk_image
+        = asp::form_point_cloud_composite<Vector4>
+        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+      err_textures.push_back(channel_cast<float>(select_channel(point_disk_image,3)));
+    }else if (num_channels == 6){
+      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
+      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+        err_textures.push_back(channel_cast<float>(select_channel(ned_err, ch_index)));
+    }else{
+      // Note: We don't throw here. We still would like to write the
+      // DRG (below) even if we can't write the error image.
+      vw_out() << "The point cloud files must have an equal number of channels which "
+	       << "must be 4 or 6 to be able to process the intersection error.\n";
+    }
+  }
+
+  // The products whose textures can be rasterized together, with one
+  // pass over the cloud. The DEM must come first, as the invalid pixels
+  // are counted for the first texture. The orthoimage can be among them
+  // only if no holes are filled in the cloud for it, as that changes
+  // the cloud.
+  std::vector< ImageViewRef<float> > textures;
+  int dem_ch = -1, err_ch = -1, ortho_ch = -1;
+  if ( !opt.no_dem ){
+    dem_ch = textures.size();
+    textures.push_back(channel_cast<float>(select_channel(rasterizer.get_point_image(), 2)));
+  }
+  if ( !err_textures.empty() ){
+    err_ch = textures.size();
+    textures.insert(textures.end(), err_textures.begin(), err_textures.end());
+  }
+  if ( opt.do_ortho && opt.ortho_hole_fill_len <= 0 ){
+    ImageViewRef< PixelGray<float> > texture
+      = asp::form_point_cloud_composite< PixelGray<float> >
+      (opt.texture_files, asp::OrthoRasterizerView::max_subblock_size());
+    ortho_ch = textures.size();
+    textures.push_back(channel_cast<float>(channels_to_planes(texture)));
+  }
+
+  // If there is more than one texture, rasterize them all to a
+  // temporary file, and write the products from its bands.
+  std::vector< ImageViewRef< PixelGray<float> > > channels;
+  std::string channels_file = opt.out_prefix + "-products-tmp.tif";
+  if ( textures.size() > 1 ){
+    vw_out() << "\t--> Rasterizing " << textures.size() << " channels together.\n";
+    switch ( textures.size() ){
+    case 2: rasterize_textures_to_file<2>(rasterizer, textures, opt, channels_file, channels); break;
+    case 3: rasterize_textures_to_file<3>(rasterizer, textures, opt, channels_file, channels); break;
+    case 4: rasterize_textures_to_file<4>(rasterizer, textures, opt, channels_file, channels); break;
+    case 5: rasterize_textures_to_file<5>(rasterizer, textures, opt, channels_file, channels); break;
+    default:
+      vw_throw( LogicErr() << "Unexpected number of channels to rasterize: "
+                << textures.size() << ".\n" );
+    }
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
 
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
@@ -1000,6 +1201,10 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   if ( !opt.no_dem ){
     Stopwatch sw2;
     sw2.start();
+    if ( !channels.empty() )
+      rasterizer_fsaa = generate_fsaa_raster( channels[dem_ch], opt );
+    else
+      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
     ImageViewRef< PixelGray<float> > dem
       = asp::round_image_pixels_skip_nodata(rasterizer_fsaa, opt.rounding_error,
                                             opt.nodata_value);
@@ -1009,76 +1214,60 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
       // Note that we first cache the tiles of the rasterized DEM, and
       // fill holes later. This greatly improves the performance.
       dem = apply_mask
-        (vw::fill_holes_grass(create_mask
-                               (block_cache(dem, tile_size, opt.num_threads),
-                                opt.nodata_value),
-                               hole_fill_len),
+        (asp::fill_holes_pyramid(create_mask
+                                 (block_cache(dem, tile_size, opt.num_threads),
+                                  opt.nodata_value),
+                                 hole_fill_len, opt.hole_fill_method),
          opt.nodata_value);
     }
 
-    // Stop the program if it is going to create too large a DEM, this will cause a crash.
-    Vector2i dem_size = bounding_box(dem).size();
-    vw_out()<< "Creating output file that is " << dem_size << " px.\n";
-    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
-      vw_throw( ArgumentErr()
-                << "Requested DEM size is too large, max allowed output size is "
-                << opt.max_output_size << " pixels.\n" );
-    
     asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
 
-    double num_invalid_pixelsD = static_cast<double>(*num_invalid_pixels);
+    double num_invalid_pixelsD = static_cast<double>(num_invalid_pixels->total());
     double num_total_pixels    = static_cast<double>(dem_size[0]*dem_size[1]);
     double invalid_ratio       = num_invalid_pixelsD / num_total_pixels;
     vw_out() << "Percentage of valid pixels = " << 1.0-invalid_ratio << "\n";
-    *num_invalid_pixels = 0; // Reset this count
+    num_invalid_pixels->reset(); // Reset this count
   }
 
   // Write triangulation error image if requested
-  if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
-
+  if ( err_textures.size() == 1 ) {
+    // The error is a scalar.
     int hole_fill_len = 0;
-    if (num_channels == 4){
-      // The error is a scalar.
-      ImageViewRef<Vector4> point_disk_image
-        = asp::form_point_cloud_composite<Vector4>
-        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
+    if ( !channels.empty() ){
+      rasterizer_fsaa = generate_fsaa_raster( channels[err_ch], opt );
+    }else{
+      rasterizer.set_texture( err_textures[0] );
       rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-      save_image(opt,
-		 asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
-						     opt.rounding_error,
-						     opt.nodata_value),
-		 georef, hole_fill_len, "IntersectionErr");
-    }else if (num_channels == 6){
-      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
-      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
-        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
-      std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
-      for (int ch_index = 0; ch_index < 3; ch_index++){
-        ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-        rasterizer.set_texture(ch);
+    }
+    save_image(opt,
+	       asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
+						   opt.rounding_error,
+						   opt.nodata_value),
+	       georef, hole_fill_len, "IntersectionErr");
+  }else if ( err_textures.size() == 3 ) {
+    // The error is a 3D vector in the NED coordinate system.
+    int hole_fill_len = 0;
+    std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
+    for (int ch_index = 0; ch_index < 3; ch_index++){
+      if ( !channels.empty() ){
+        rasterized[ch_index] = generate_fsaa_raster( channels[err_ch + ch_index], opt );
+      }else{
+        rasterizer.set_texture(err_textures[ch_index]);
         rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
         rasterized[ch_index] =
           block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
       }
-      save_image(opt,
-		 asp::round_image_pixels_skip_nodata
-		 (asp::combine_channels
-		  (opt.nodata_value,
-		   rasterized[0], rasterized[1], rasterized[2]),
-		  opt.rounding_error, opt.nodata_value),
-		 georef, hole_fill_len, "IntersectionErr");
-    }else{
-      // Note: We don't throw here. We still would like to write the
-      // DRG (below) even if we can't write the error image.
-      vw_out() << "The point cloud files must have an equal number of channels which "
-	       << "must be 4 or 6 to be able to process the intersection error.\n";
     }
+    save_image(opt,
+	       asp::round_image_pixels_skip_nodata
+	       (asp::combine_channels
+		(opt.nodata_value,
+		 rasterized[0], rasterized[1], rasterized[2]),
+		opt.rounding_error, opt.nodata_value),
+	       georef, hole_fill_len, "IntersectionErr");
   }
 
   // Write out a normalized version of the DEM, if requested (for debugging)
@@ -1099,7 +1288,16 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
   // image in irreversible ways.
-  if (opt.do_ortho) {
+  if (opt.do_ortho && ortho_ch >= 0 && !channels.empty()) {
+
+    Stopwatch sw3;
+    sw3.start();
+    rasterizer_fsaa = generate_fsaa_raster(channels[ortho_ch], opt);
+    asp::save_image(opt, rasterizer_fsaa, georef, 0, "DRG");
+    sw3.stop();
+    vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << "\n";
+
+  }else if (opt.do_ortho) {
     
     Stopwatch sw3;
     sw3.start();
@@ -1124,7 +1322,7 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 
       // If to grow the cloud a bit, to help hole-filling later. This should
       // not be large as it creates artifacts. The main work better
-      // be done by grassfire later. 
+      // be done by the hole filling later.
       if (opt.ortho_hole_fill_extra_len > 0) {
         int hole_fill_mode = 2;
         int hole_fill_num_smooth_iter = 3;
@@ -1148,7 +1346,8 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
       }
       
       // Fill the holes
-      point_image_mask =vw::fill_holes_grass(point_image_mask, hole_fill_len);
+      point_image_mask = asp::fill_holes_pyramid(point_image_mask, hole_fill_len,
+                                                 opt.hole_fill_method);
 
       // back to NaNs
       point_image = per_pixel_filter(point_image_mask, asp::Mask2NaN<Vector3>());
@@ -1177,31 +1376,108 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << "\n";
   }
 
+  // Done with the bands of the products rasterized together
+  if ( !channels.empty() ){
+    channels.clear();
+    if (fs::exists(channels_file))
+      fs::remove(channels_file);
+  }
+
 } // End do_software_rasterization
 
 
+// The name of the DEM file written by save_image()
+std::string dem_file(Options const& opt) {
+  std::string tag = "";
+  if (opt.filter != "weighted_average")
+    tag = "-" + opt.filter;
+  return opt.out_prefix + tag + "-DEM." + opt.output_file_type;
+}
+
+// See if the coarser DEMs can be made from the finest one, rather than
+// from the point cloud. Their spacings must be integer multiples of
+// the finest one, so that the grids are nested, and the filter must be
+// one whose result can be aggregated.
+bool can_coarsen_from_finest(Options const& opt, size_t finest) {
+
+  std::string reason;
+  double finest_spacing = opt.dem_spacing[finest];
+  if (opt.filter != "weighted_average" && opt.filter != "mean" &&
+      opt.filter != "min" && opt.filter != "max")
+    reason = "the filter is not weighted_average, mean, min, or max";
+  else if (opt.do_ortho || opt.do_error || opt.do_normalize || opt.no_dem)
+    reason = "images other than the DEM were requested";
+  else if (opt.fsaa > 1 || opt.target_projwin != BBox2())
+    reason = "--fsaa or --t_projwin was set";
+  else if (finest_spacing <= 0)
+    reason = "all DEM spacings must be specified";
+
+  for (size_t i = 0; i < opt.dem_spacing.size() && reason == ""; i++) {
+    double ratio = opt.dem_spacing[i]/finest_spacing;
+    if (std::abs(ratio - round(ratio)) > 1e-6*ratio)
+      reason = "the DEM spacings are not integer multiples of the finest one";
+  }
+
+  if (reason != "") {
+    vw_out(WarningMessage) << "Cannot create the coarser DEMs from the finest one, as "
+                           << reason << ". Will create them from the point cloud.\n";
+    return false;
+  }
+  return true;
+}
+
+// Create the DEM at the rasterizer's current spacing by aggregating the
+// pixels of the finest DEM, which must have been written already.
+void coarsen_from_finest(asp::OrthoRasterizerView const& rasterizer,
+                         Options& opt, cartography::GeoReference& georef,
+                         Matrix3x3 const& finest_transform,
+                         std::string const& finest_dem, double ratio) {
+
+  vw_out() << "\t-- Creating DEM from: " << finest_dem << " --\n";
+  vw_out() << "\t--> DEM spacing: " << rasterizer.spacing() << " pt/px\n";
+
+  // Both grids are snapped to multiples of their spacings, so the
+  // coarse grid corners fall on fine grid pixels.
+  Matrix3x3 coarse_transform = rasterizer.geo_transform();
+  double fine_spacing = finest_transform(0,0);
+  Vector2i offset((int)round((coarse_transform(0,2) - finest_transform(0,2))/fine_spacing),
+                  (int)round((finest_transform(1,2) - coarse_transform(1,2))/fine_spacing));
+
+  set_dem_transform(coarse_transform, opt, georef);
+
+  DiskImageView< PixelGray<float> > fine_dem(finest_dem);
+  ImageViewRef< PixelGray<float> > dem
+    = asp::round_image_pixels_skip_nodata
+    (asp::CoarsenDemView(fine_dem, (int)round(ratio), offset,
+                         rasterizer.cols(), rasterizer.rows(),
+                         opt.nodata_value, opt.filter),
+     opt.rounding_error, opt.nodata_value);
+
+  int hole_fill_len = 0; // the finest DEM had its holes filled already
+  asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_point_input,
                                              Options& opt,
                                              cartography::GeoReference& georef,
-                                             ImageViewRef<double> const& error_image,
-                                             double estim_max_error) {
+                                             ImageViewRef<double> const& error_image) {
   // Perform the slow initialization that can be shared by all output resolutions
   Stopwatch sw1;
   sw1.start();
-  vw::Mutex count_mutex; // Need to pass in by pointer due to C++ class restrictions
-  size_t num_invalid_pixels = 0; // Need to pass in by pointer because we can't get back the number from
-                                 //  the original rasterizer object otherwise for some reason.
+  // Need to pass in by pointer because we can't get back the number from
+  // the original rasterizer object otherwise for some reason.
+  asp::ThreadCounter num_invalid_pixels;
   asp::OrthoRasterizerView
     rasterizer(proj_point_input.impl(), select_channel(proj_point_input.impl(),2),
                opt.search_radius_factor, opt.sigma_factor, opt.use_surface_sampling,
                asp::ASPGlobalOptions::tri_tile_size(), // to efficiently process the cloud
                opt.target_projwin,
                opt.remove_outliers_with_pct, opt.remove_outliers_params,
-               error_image, estim_max_error, opt.max_valid_triangulation_error,
+               error_image, opt.max_valid_triangulation_error,
                opt.median_filter_params, opt.erode_len, opt.has_las_or_csv,
                opt.filter, opt.default_grid_size_multiplier,
-               &num_invalid_pixels, &count_mutex,
+               &num_invalid_pixels,
                TerminalProgressCallback("asp","QuadTree: "));
 
   sw1.stop();
@@ -1214,8 +1490,24 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
 
   std::string base_out_prefix = opt.out_prefix;
 
-  // Call the function for each dem spacing
+  // Process the finest spacing first, so that the coarser DEMs can be
+  // made from it if desired.
+  size_t finest = 0;
   for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+    if (opt.dem_spacing[i] < opt.dem_spacing[finest])
+      finest = i;
+  }
+  bool from_finest = (opt.coarse_dems_from_finest && can_coarsen_from_finest(opt, finest));
+  std::vector<size_t> order(1, finest);
+  for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+    if (i != finest)
+      order.push_back(i);
+  }
+
+  Matrix3x3 finest_transform;
+  std::string finest_dem;
+  for (size_t k = 0; k < order.size(); k++) {
+    size_t i = order[k];
     double this_spacing = opt.dem_spacing[i];
     
     // Required second init step for each spacing
@@ -1226,8 +1518,17 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
       opt.out_prefix = base_out_prefix;
     else // Write later iterations to a different path.
       opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+
+    if (from_finest && i != finest) {
+      coarsen_from_finest(rasterizer, opt, georef, finest_transform, finest_dem,
+                          opt.dem_spacing[i]/opt.dem_spacing[finest]);
+      continue;
+    }
+
+    finest_transform = rasterizer.geo_transform();
+    finest_dem       = dem_file(opt);
     do_software_rasterization(rasterizer, opt, georef, error_image,
-                              estim_max_error, &num_invalid_pixels);
+                              &num_invalid_pixels);
   } // End loop through spacings
 
   opt.out_prefix = base_out_prefix; // Restore the original value
@@ -1309,12 +1610,9 @@ int main( int argc, char *argv[] ) {
       point_image = asp::point_transform(point_image,
 					 math::euler_to_rotation_matrix(opt.phi_rot, opt.omega_rot,opt.kappa_rot, opt.rot_order));
     }
-    // Estimate the maximum value of the error channel in case we would
-    // like to remove outliers. This not the cuttoff triangulation error,
-    // just a large but reasonable number that will be used to estimate
-    // that error later.
+    // The error channel, in case we would like to remove outliers.
+    // Its percentile is found while the rasterizer scans the cloud.
     ImageViewRef<double> error_image;
-    double estim_max_error = 0.0;
     if (opt.remove_outliers_with_pct || opt.max_valid_triangulation_error > 0.0){
       int num_channels = asp::num_channels(opt.pointcloud_files);
 
@@ -1326,46 +1624,25 @@ int main( int argc, char *argv[] ) {
         opt.remove_outliers_with_pct      = false;
         opt.max_valid_triangulation_error = 0.0;
       }
-
-      if (opt.remove_outliers_with_pct && opt.max_valid_triangulation_error == 0.0){
-        // Get a somewhat dense sampling of the error image to get an idea
-        // of what the distribution of errors is. This will be refined
-        // later using a histogram approach and using all points. Do
-        // several attempts if the sampling is too coarse.
-        bool success = false;
-        for (int count = 7; count <= 18; count++){
-
-          double sample = (1 << count);
-          int32 subsample_amt = int32(norm_2(Vector2(point_image.cols(),
-				               point_image.rows()))/sample);
-          if (subsample_amt < 1 ) subsample_amt = 1;
-
-          Stopwatch sw2;
-          sw2.start();
-          PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
-          for_each_pixel( subsample(error_image, subsample_amt),
-	            error_accum,
-	            TerminalProgressCallback
-	            ("asp","Triangulation error range estimation: ") );
-          if (error_accum.size() > 0){
-            success = true;
-            estim_max_error = error_accum.value(opt.remove_outliers_params);
-          }
-          sw2.stop();
-          vw_out(DebugMessage,"asp") << "Triangulation error range estimation time: "
-		               << sw2.elapsed_seconds() << std::endl;
-          if (success || subsample_amt == 1) break;
-          vw_out() << "Failed to estimate the triangulation range. Check if your cloud is valid. "
-             << "Trying again with finer sampling.\n";
-        }
-      }
     }
+
     // Determine if we should be using a longitude range between
     // [-180, 180] or [0,360]. We determine this by looking at the
     // average location of the points. If the average location has a
     // negative x value (think in ECEF coordinates) then we should
     // be using [0,360].
-    double avg_lon = asp::find_avg_lon(point_image);
+    // The mean point is saved with the clouds stereo_tri writes, which
+    // saves a pass over them.
+    double avg_lon = 0.0;
+    asp::PointCloudStats cloud_stats;
+    bool rotated = (opt.phi_rot != 0 || opt.omega_rot != 0 || opt.kappa_rot != 0);
+    if (!rotated && asp::read_point_cloud_stats(opt.pointcloud_files, cloud_stats) &&
+        cloud_stats.num_points > 0) {
+      vw_out() << "\t--> Using the saved point cloud statistics.\n";
+      avg_lon = cloud_stats.mean_point()[0] >= 0 ? 0 : 180;
+    } else {
+      avg_lon = asp::find_avg_lon(point_image);
+    }
     
     
     // TODO: Do we need the recenter code now that we have this?
@@ -1374,34 +1651,22 @@ int main( int argc, char *argv[] ) {
     if (output_georef.overall_proj4_str().find("+proj=aea") == std::string::npos)
       output_georef.set_lon_center(avg_lon < 100);
     
-    // We trade off readability here to avoid ImageViewRef dereferences
-    if (opt.lon_offset != 0 || opt.lat_offset != 0 || opt.height_offset != 0) {
+    // Convert the points to the output projection a tile at a time,
+    // normalizing the longitude and adding the user coordinate offset.
+    Vector3 offset(opt.lon_offset, opt.lat_offset, opt.height_offset);
+    if (offset != Vector3())
       vw_out() << "\t--> Applying offset: " << opt.lon_offset
                << " " << opt.lat_offset << " " << opt.height_offset << "\n";
-      do_software_rasterization_multi_spacing
-        (geodetic_to_point  // GDC to XYZ
-            (asp::point_image_offset  // Add user coordinate offset
-              (asp::recenter_longitude(cartesian_to_geodetic(point_image,output_georef), // XYZ to GDC, then normalize longitude
-			               avg_lon),
-           Vector3(opt.lon_offset,
-	           opt.lat_offset,
-	           opt.height_offset)),
-             output_georef),
-         opt, output_georef, error_image, estim_max_error);
-    } else {
-      do_software_rasterization_multi_spacing
-        (geodetic_to_point
-            (asp::recenter_longitude
-              (cartesian_to_geodetic(point_image, output_georef),
-               avg_lon),
-             output_georef),
-        opt, output_georef, error_image, estim_max_error);
-    }
+    do_software_rasterization_multi_spacing
+      (asp::CartesianToProjectedView(point_image, output_georef, avg_lon, offset),
+       opt, output_georef, error_image);
 
     // Wipe the temporary files
     for (int i = 0; i < (int)tmp_tifs.size(); i++)
       if (fs::exists(tmp_tifs[i])) fs::remove(tmp_tifs[i]);
 
+    asp::report_tile_cache_stats();
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -21,6 +21,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <vector>
 #include <string>
 #include <boost/program_options.hpp>
 #include <liblas/liblas.hpp>
@@ -28,7 +29,11 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudTypes.h>
+#include <asp/Core/PointCloudStats.h>
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Math.h>
@@ -37,25 +42,111 @@
 using namespace vw;
 namespace po = boost::program_options;
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3> { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4> { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6> { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string reference_spheroid, datum;
   std::string pointcloud_file;
   std::string target_srs_string;
   bool compressed;
+  double max_valid_triangulation_error, in_memory_cloud_resolution;
   // Output
   std::string out_prefix;
-  Options() : compressed(false){}
+  Options() : compressed(false), max_valid_triangulation_error(0), in_memory_cloud_resolution(0){}
+};
+
+// How to bring the points of the cloud to the output coordinates, and
+// which of them to keep
+struct PointFilter {
+  double max_error;     ///< Largest triangulation error, if positive
+  bool   is_geodetic;   ///< If to project the points with the georeference
+  cartography::Datum        datum;
+  cartography::GeoReference georef;
+  double avg_lon;       ///< Center of the longitude range
+  PointFilter(): max_error(0), is_geodetic(false), avg_lon(0) {}
+};
+
+// Read a band of rows of the point cloud, and keep its valid points
+// with a small enough triangulation error, in the output coordinates,
+// in row-major order. If there is no room for the points, only find
+// their bounding box. The points and their errors come from one read
+// of the band.
+template <class PixelT>
+class PointBandTask : public Task, private boost::noncopyable {
+  ImageViewRef<PixelT> const& m_cloud;
+  PointFilter m_filter; // a copy, as the georeference is not thread-safe
+  int    m_beg, m_end;
+  std::vector<Vector3> * m_points;
+  BBox3                & m_bbox;
+public:
+  PointBandTask(ImageViewRef<PixelT> const& cloud, PointFilter const& filter,
+                int beg, int end, std::vector<Vector3> * points, BBox3 & bbox):
+    m_cloud(cloud), m_filter(filter), m_beg(beg), m_end(end),
+    m_points(points), m_bbox(bbox) {}
+
+  void operator()() {
+    BBox2i box(0, m_beg, m_cloud.cols(), m_end - m_beg);
+    ImageView<PixelT> cloud = crop(m_cloud, box);
+
+    // The points, with no-data ones as zero
+    ImageView<Vector3> points(cloud.cols(), cloud.rows());
+    for (int row = 0; row < cloud.rows(); row++){
+      for (int col = 0; col < cloud.cols(); col++){
+        PixelT const& pix = cloud(col, row);
+        if (m_filter.max_error > 0 && asp::cloud_point_error(pix) > m_filter.max_error)
+          points(col, row) = Vector3();
+        else
+          points(col, row) = asp::cloud_point(pix);
+      }
+    }
+
+    // No-data points become NaN here
+    if (m_filter.is_geodetic) {
+      ImageView<Vector3> geodetic = cartesian_to_geodetic(points, m_filter.datum);
+      points = geodetic_to_point(asp::recenter_longitude(geodetic, m_filter.avg_lon),
+                                 m_filter.georef);
+    }
+
+    for (int row = 0; row < points.rows(); row++){
+      for (int col = 0; col < points.cols(); col++){
+
+        Vector3 const& point = points(col, row);
+
+        // Skip no-data points
+        bool is_good = ( (!m_filter.is_geodetic && point != vw::Vector3()) ||
+                         (m_filter.is_geodetic  && !boost::math::isnan(point.z())) );
+        if (!is_good) continue;
+
+        m_bbox.grow(point);
+        if (m_points)
+          m_points->push_back(point);
+      }
+    }
+  }
 };
 
+// Process the given bands of rows of the point cloud in parallel
+template <class PixelT>
+void process_bands(ImageViewRef<PixelT> const& cloud, PointFilter const& filter,
+                   int band_height, int beg_band, int end_band,
+                   int num_threads, std::vector<std::vector<Vector3> > * points,
+                   std::vector<BBox3> & bboxes) {
+
+  FifoWorkQueue queue(num_threads);
+  for (int band = beg_band; band < end_band; band++) {
+    int beg = band*band_height, end = std::min(beg + band_height, cloud.rows());
+    std::vector<Vector3> * band_points = NULL;
+    if (points) {
+      band_points = &(*points)[band - beg_band];
+      band_points->clear();
+    }
+    boost::shared_ptr<PointBandTask<PixelT> >
+      task(new PointBandTask<PixelT>(cloud, filter, beg, end, band_points,
+                                     bboxes[band - beg_band]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("General Options");
@@ -69,7 +160,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
           "This is identical to the datum option.")
 
     ("t_srs", po::value(&opt.target_srs_string)->default_value(""),
-     "Specify a custom projection (PROJ.4 string).");
+     "Specify a custom projection (PROJ.4 string).")
+    ("max-valid-triangulation-error", po::value(&opt.max_valid_triangulation_error)->default_value(0),
+     "Points with triangulation error larger than this (in meters) are not written. Needs a point cloud with 4 or 6 channels.")
+    ("in-memory-cloud-resolution", po::value(&opt.in_memory_cloud_resolution)->default_value(0),
+     "Keep the input point clouds in memory, compressed, with the points rounded to this resolution in meters, for example 0.001, rather than reading them from disk more than once. Set to 0 to not keep them.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -96,6 +191,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.out_prefix =
       vw::prefix_from_filename( opt.pointcloud_file );
 
+  asp::set_point_cloud_store_resolution(opt.in_memory_cloud_resolution);
+
   // reference_spheroid and datum are aliases.
   boost::to_lower(opt.reference_spheroid);
   boost::to_lower(opt.datum);
@@ -112,10 +209,114 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 }
 
-int main( int argc, char *argv[] ) {
+// Write the valid points of the cloud, read with the given pixel type,
+// to the LAS file. If the bounding box of the points is known, it is
+// not found first.
+template <class PixelT>
+void write_las(Options const& opt, PointFilter const& filter, BBox3 const& known_bbox,
+               liblas::Header & header) {
+
+  ImageViewRef<PixelT> cloud
+    = asp::read_asp_point_cloud< math::VectorSize<PixelT>::value >(opt.pointcloud_file);
+
+  // The cloud is read in bands of rows, a batch of them at a time,
+  // each band by a thread.
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  int band_height = std::max(1, std::min(cloud.rows(),
+                                         (1 << 20)/std::max(1, cloud.cols())));
+  int num_bands   = (cloud.rows() + band_height - 1)/band_height;
+  int batch_size  = 2*num_threads;
+
+  // The bounding box is needed for the LAS header before any point is
+  // written, so this is a separate pass.
+  BBox3 cloud_bbox = known_bbox;
+  if (cloud_bbox.empty()) {
+    vw_out() << "Computing the point cloud bounding box.\n";
+    TerminalProgressCallback tpc("asp", "\t--> ");
+    std::vector<BBox3> bboxes(batch_size);
+    for (int beg = 0; beg < num_bands; beg += batch_size) {
+      tpc.report_fractional_progress(beg, num_bands);
+      int end = std::min(beg + batch_size, num_bands);
+      std::fill(bboxes.begin(), bboxes.end(), BBox3());
+      process_bands(cloud, filter, band_height, beg, end, num_threads, NULL, bboxes);
+      for (int k = 0; k < end - beg; k++){
+        if (!bboxes[k].empty())
+          cloud_bbox.grow(bboxes[k]);
+      }
+    }
+    tpc.report_finished();
+  }
+
+  // The las format stores the values as 32 bit integers. So, for a
+  // given point, we store round((point-offset)/scale), as well as
+  // the offset and scale values. Here we decide the values for
+  // offset and scale to lose minimum amount of precision. We make
+  // the scale almost as large as it can be without causing integer overflow.
+  Vector3 offset = (cloud_bbox.min() + cloud_bbox.max())/2.0;
+  double  maxInt = std::numeric_limits<int32>::max();
+          maxInt *= 0.95; // Just in case stay a bit away
+  Vector3 scale  = cloud_bbox.size()/(2.0*maxInt);
+  for (size_t i = 0; i < scale.size(); i++){
+    if (scale[i] <= 0.0) scale[i] = 1.0e-16; // avoid degeneracy
+  }
+
+  // The line below causes trouble with compression in libLAS-1.7.0.
+  //header.SetDataFormatId(liblas::ePointFormat1);
+  header.SetScale (scale [0], scale [1], scale [2]);
+  header.SetOffset(offset[0], offset[1], offset[2]);
+
+  // Populate the min and max fields of the LAS header
+  header.SetMax(cloud_bbox.max().x(),cloud_bbox.max().y(),cloud_bbox.max().z());
+  header.SetMin(cloud_bbox.min().x(),cloud_bbox.min().y(),cloud_bbox.min().z());
+
+  std::string lasFile;
+  header.SetCompressed(opt.compressed);
+  if (opt.compressed)
+    lasFile = opt.out_prefix + ".laz";
+  else
+    lasFile = opt.out_prefix + ".las";
+
+  vw_out() << "Writing LAS file: " << lasFile + "\n";
+  std::ofstream ofs;
+  ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
+  liblas::Writer writer(ofs, header);
+
+  // Read a batch of bands in parallel, then write its points in order
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  std::vector<std::vector<Vector3> > points(batch_size);
+  std::vector<BBox3> bboxes(batch_size);
+  for (int beg = 0; beg < num_bands; beg += batch_size) {
+    tpc.report_fractional_progress(beg, num_bands);
+    int end = std::min(beg + batch_size, num_bands);
+    process_bands(cloud, filter, band_height, beg, end, num_threads, &points, bboxes);
+    for (int k = 0; k < end - beg; k++){
+      for (size_t p = 0; p < points[k].size(); p++){
+        Vector3 const& point = points[k][p];
+        liblas::Point las_point(&header);
+        las_point.SetCoordinates(point[0], point[1], point[2]);
+        writer.WritePoint(las_point);
+      }
+    }
+  }
+  tpc.report_finished();
+}
+
+// Calls write_las() with the pixel type of the cloud
+struct LasWriter {
+  Options        const& m_opt;
+  PointFilter    const& m_filter;
+  BBox3          const& m_known_bbox;
+  liblas::Header      & m_header;
+  LasWriter(Options const& opt, PointFilter const& filter, BBox3 const& known_bbox,
+            liblas::Header & header):
+    m_opt(opt), m_filter(filter), m_known_bbox(known_bbox), m_header(header) {}
+  template <class PixelT>
+  void apply() { write_las<PixelT>(m_opt, m_filter, m_known_bbox, m_header); }
+};
 
-  // To do: need to understand what is the optimal strategy for
-  // traversing the input point cloud file to minimize the reading time.
+int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
@@ -150,76 +351,42 @@ int main( int argc, char *argv[] ) {
       datum = georef.datum();
     }
 
-    // Save the las file with given georeference, if present
-    ImageViewRef<Vector3> point_image = asp::read_asp_point_cloud<3>(opt.pointcloud_file);
+    PointFilter filter;
+    filter.max_error   = opt.max_valid_triangulation_error;
+    filter.is_geodetic = is_geodetic;
+    filter.datum       = datum;
+    filter.georef      = georef;
+    asp::PointCloudStats cloud_stats;
+    bool has_stats = asp::read_point_cloud_stats(opt.pointcloud_file, cloud_stats) &&
+      cloud_stats.num_points > 0;
     if (is_geodetic) {
-      point_image = cartesian_to_geodetic(point_image, datum);
-      double avg_lon = asp::find_avg_lon(point_image); // see if to use [-180, 180] or [0, 360]
-      point_image = geodetic_to_point(asp::recenter_longitude(point_image, avg_lon), georef);
-    }
-
-    BBox3 cloud_bbox = asp::pointcloud_bbox(point_image, is_geodetic);
-
-    // The las format stores the values as 32 bit integers. So, for a
-    // given point, we store round((point-offset)/scale), as well as
-    // the offset and scale values. Here we decide the values for
-    // offset and scale to lose minimum amount of precision. We make
-    // the scale almost as large as it can be without causing integer overflow.
-    Vector3 offset = (cloud_bbox.min() + cloud_bbox.max())/2.0;
-    double  maxInt = std::numeric_limits<int32>::max();
-            maxInt *= 0.95; // Just in case stay a bit away
-    Vector3 scale  = cloud_bbox.size()/(2.0*maxInt);
-    for (size_t i = 0; i < scale.size(); i++){
-      if (scale[i] <= 0.0) scale[i] = 1.0e-16; // avoid degeneracy
+      // See if to use [-180, 180] or [0, 360]
+      if (has_stats && datum.meridian_offset() == 0.0) {
+        filter.avg_lon = cloud_stats.mean_lon() >= 0 ? 0 : 180;
+      } else {
+        ImageViewRef<Vector3> geodetic
+          = cartesian_to_geodetic(asp::read_asp_point_cloud<3>(opt.pointcloud_file), datum);
+        filter.avg_lon = asp::find_avg_lon(geodetic);
+      }
     }
 
-    // The line below causes trouble with compression in libLAS-1.7.0.
-    //header.SetDataFormatId(liblas::ePointFormat1);
-    header.SetScale (scale [0], scale [1], scale [2]);
-    header.SetOffset(offset[0], offset[1], offset[2]);
-
-    // Populate the min and max fields of the LAS header
-    header.SetMax(cloud_bbox.max().x(),cloud_bbox.max().y(),cloud_bbox.max().z());
-    header.SetMin(cloud_bbox.min().x(),cloud_bbox.min().y(),cloud_bbox.min().z());
-
-    std::string lasFile;
-    header.SetCompressed(opt.compressed);
-    if (opt.compressed)
-      lasFile = opt.out_prefix + ".laz";
-    else
-      lasFile = opt.out_prefix + ".las";
-
-    vw_out() << "Writing LAS file: " << lasFile + "\n";
-    std::ofstream ofs;
-    ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
-    liblas::Writer writer(ofs, header);
-
-    TerminalProgressCallback tpc("asp", "\t--> ");
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
-
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
-
-#if 0
-        // For comparison later with las2txt.
-        std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
-#endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-        writer.WritePoint(las_point);
-
-      }
+    // The saved bounding box of the cloud is that of the LAS file if
+    // the points are neither projected nor filtered
+    BBox3 known_bbox;
+    if (has_stats && !is_geodetic && opt.max_valid_triangulation_error <= 0)
+      known_bbox = cloud_stats.bbox;
+
+    // Read the error channels only if filtering by them, and then
+    // do all the work with the pixels having those channels.
+    int num_channels = 3;
+    if (opt.max_valid_triangulation_error > 0) {
+      num_channels = get_num_channels(opt.pointcloud_file);
+      if (num_channels != 4 && num_channels != 6)
+        vw_throw( ArgumentErr() << "The point cloud must have 4 or 6 channels to "
+                  << "filter by triangulation error.\n" );
     }
-    tpc.report_finished();
+    LasWriter writer(opt, filter, known_bbox, header);
+    asp::dispatch_point_cloud_channels(num_channels, writer);
 
   } ASP_STANDARD_CATCHES;
 
@@ -28,10 +28,14 @@
 #include <math.h>
 
 //VisionWorkbench & ASP
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/Transform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Image/MaskViews.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudStats.h>
+#include <asp/Core/PointCloudTypes.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 using namespace vw;
@@ -64,14 +68,6 @@ namespace po = boost::program_options;
 // UTILITIES
 // ---------------------------------------------------------
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 struct Options : vw::cartography::GdalWriteOptions {
   Options() : root( new osg::Group() ), simplify_percent(0) {};
   // Input
@@ -79,6 +75,7 @@ struct Options : vw::cartography::GdalWriteOptions {
 
   // Settings
   uint32 step_size;
+  int tile_size;
   osg::ref_ptr<osg::Group> root;
   float simplify_percent;
   osg::Vec3f dataNormal;
@@ -159,92 +156,83 @@ osg::StateSet* create1DTexture( osg::Node* loadedModel , const osg::Vec3f& Direc
 //
 // Takes in an image and builds geodes for every triangle strip.
 // ---------------------------------------------------------
-template <class ViewT>
-osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
-                       Options& opt ) {
-
-  //const ViewT& point_image_impl = point_image.impl();
-  osg::Geode* mesh = new osg::Geode();
-  osg::Geometry* geometry = new osg::Geometry();
-  osg::Vec3Array* vertices = new osg::Vec3Array();
-  osg::Vec2Array* texcoords = new osg::Vec2Array();
-  osg::Vec3Array* normals = new osg::Vec3Array();
-
-  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
-
-  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
-  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
-            << point_image.impl().rows()/opt.step_size << "]\n";
 
-  //////////////////////////////////////////////////
-  // Deciding how to reduce the texture size
-  //   Max texture width or height is 4096
-  std::string tex_file;
-  if ( opt.texture_file_name.size() ) {
-    DiskImageView<PixelGray<uint8> > previous_texture(opt.texture_file_name);
-    tex_file = asp::prefix_from_pointcloud_filename(opt.output_prefix) + "-tex";
-    if (point_image.impl().cols() > 4096 ||
-        point_image.impl().rows() > 4096 ) {
-      vw_out() << "Resampling to reduce texture size:\n";
-      float tex_sub_scale = 4096.0/float(std::max(previous_texture.cols(),previous_texture.rows()));
-      ImageViewRef<PixelGray<uint8> > new_texture = resample(previous_texture,tex_sub_scale);
-      vw_out() << "\t--> Texture size: [" << new_texture.cols() << ", " << new_texture.rows() << "]\n";
-      vw_out() << "Writing temporary file: " << tex_file+".tif" << "\n";
-      vw::cartography::block_write_gdal_image( tex_file+".tif", new_texture, opt,
-                                   TerminalProgressCallback("asp","\tSubsampling:") );
-    } else {
-      // Always saving as an 8bit texture. These second handedly
-      // normalizes the data for us (which is a problem for datasets
-      // like HiRISE which will feed us tiffs with values outside of
-      // 0-1).
-      vw_out() << "Writing temporary file: " << tex_file+".tif" << "\n";
-      vw::cartography::block_write_gdal_image( tex_file+".tif", previous_texture, opt,
-                                   TerminalProgressCallback("asp","\tNormalizing:") );
+// Read the points at every step_size-th pixel of a band of rows of the
+// point image. Whole image rows are read, as random pixel access to a
+// disk image is much slower.
+template <class ViewT>
+class MeshNodesTask : public Task, private boost::noncopyable {
+  ViewT const& m_point_image;
+  uint32 m_step_size;
+  int m_beg, m_end;
+  ImageView<Vector3> & m_nodes;
+public:
+  MeshNodesTask(ViewT const& point_image, uint32 step_size, int beg, int end,
+                ImageView<Vector3> & nodes):
+    m_point_image(point_image), m_step_size(step_size), m_beg(beg), m_end(end),
+    m_nodes(nodes) {}
+
+  void operator()() {
+    for (int r = m_beg; r < m_end; r++) {
+      ImageView<Vector3> row = crop(m_point_image, BBox2i(0, r*m_step_size,
+                                                          m_point_image.cols(), 1));
+      for (int c = 0; c < m_nodes.cols(); c++)
+        m_nodes(c, r) = row(c*m_step_size, 0);
     }
-    // When we subsample, we use tiff because we can block write the image.
-    // However, trying to load the tiff with osg causes problems because
-    // osg uses libtiff to load the images. libtiff conflicts with gdal
-    // if gdal was compiled with internal tiff, and osg will fail to load
-    // the texture. To avoid all this, we resave our subsampled texture as a jpg
-    DiskImageView<PixelGray<uint8> > new_texture(tex_file+".tif");
-    vw_out() << "Writing temporary file: " << tex_file+".jpg" << "\n";
-    write_image(tex_file+".jpg", new_texture);
-    unlink((tex_file+".tif").c_str());
-    tex_file += ".jpg";
   }
+};
 
-  //////////////////////////////////////////////////
-  /// Setting name of geode
-  {
-    std::ostringstream os;
-    os << "Simple Mesh" << std::endl;
-    mesh->setName( os.str() );
-  }
-
-  //////////////////////////////////////////////////
-  /// PUSHING ALL VERTICES & Also texture coordinates
-  {
-
-    // Some constants for the calculation in here
-    uint32 num_rows = point_image.impl().rows()/opt.step_size;
-    uint32 num_cols = point_image.impl().cols()/opt.step_size;
-
-    TerminalProgressCallback progress("asp", "\tVertices:   ");
-    double progress_mult = 1.0/double(num_rows*num_cols);
-
-    for ( uint32 r = 0; r < (num_rows); ++r ){
-      for (uint32 c = 0; c < (num_cols); ++c ){
-        progress.report_progress((r*num_cols+c)*progress_mult);
-
-        uint32 r_step = r * opt.step_size;
-        uint32 c_step = c * opt.step_size;
+inline bool is_valid_vertex(osg::Vec3f const& v) {
+  return (v[0] != 0) && (v[1] != 0) && (v[2] != 0);
+}
 
-        vertices->push_back( osg::Vec3f( point_image.impl()(c_step,r_step)[0] ,
-                                         point_image.impl()(c_step,r_step)[1] ,
-                                         point_image.impl()(c_step,r_step)[2] ) );
+// Build the mesh of the nodes in the given range, inclusive of its
+// last row and column, so that neighboring tiles share their
+// boundary vertices. The tile is then smoothed and simplified on its
+// own, if asked for.
+class MeshTileTask : public Task, private boost::noncopyable {
+  ImageView<Vector3> const& m_nodes;
+  int m_c0, m_r0, m_c1, m_r1;
+  Options const& m_opt;
+  Vector2i m_image_size;
+  bool m_has_texture;
+  osg::ref_ptr<osg::Geode> & m_tile;
+  TerminalProgressCallback & m_progress;
+  Mutex & m_progress_mutex;
+  int & m_num_done;
+  int m_num_tiles;
+public:
+  MeshTileTask(ImageView<Vector3> const& nodes, int c0, int r0, int c1, int r1,
+               Options const& opt, Vector2i const& image_size, bool has_texture,
+               osg::ref_ptr<osg::Geode> & tile, TerminalProgressCallback & progress,
+               Mutex & progress_mutex, int & num_done, int num_tiles):
+    m_nodes(nodes), m_c0(c0), m_r0(r0), m_c1(c1), m_r1(r1), m_opt(opt),
+    m_image_size(image_size), m_has_texture(has_texture), m_tile(tile),
+    m_progress(progress), m_progress_mutex(progress_mutex), m_num_done(num_done),
+    m_num_tiles(num_tiles) {}
+
+  void operator()() {
+
+    osg::Geode* mesh = new osg::Geode();
+    osg::Geometry* geometry = new osg::Geometry();
+    osg::Vec3Array* vertices = new osg::Vec3Array();
+    osg::Vec2Array* texcoords = new osg::Vec2Array();
+    osg::Vec3Array* normals = new osg::Vec3Array();
+
+    int num_rows = m_nodes.rows(), num_cols = m_nodes.cols();
+    uint32 step = m_opt.step_size;
+    Vector3 zero(0, 0, 0);
+
+    //////////////////////////////////////////////////
+    /// PUSHING ALL VERTICES & Also texture coordinates
+    for (int r = m_r0; r <= m_r1; ++r) {
+      for (int c = m_c0; c <= m_c1; ++c) {
+
+        Vector3 const& p = m_nodes(c, r);
+        vertices->push_back( osg::Vec3f( p[0], p[1], p[2] ) );
 
         // Calculating normals, if the user wants shading
-        if (opt.enable_lighting) {
+        if (m_opt.enable_lighting) {
           Vector3 temp_normal;
 
           // These calculations seems backwards from what they should
@@ -252,44 +240,28 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
           // its column then row.
 
           // Is quadrant 1 normal calculation possible?
-          if ( (r > 0) && ( (c+1) < (num_cols)) ) {
-            if ( (point_image.impl()(c_step+opt.step_size,r_step) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step,r_step-opt.step_size) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step+opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step,r_step-opt.step_size) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
+          if ( (r > 0) && ( (c+1) < num_cols) ) {
+            if ( (m_nodes(c+1,r) != zero) && (m_nodes(c,r-1) != zero) )
+              temp_normal = temp_normal + normalize(cross_prod( m_nodes(c+1,r) - p,
+                                                                m_nodes(c,r-1) - p ) );
           }
           // Is quadrant 2 normal calculation possible?
-          if ( ( (c+1) < (num_cols) ) && ((r+1) < (num_rows))){
-            if ( (point_image.impl()(c_step,r_step+opt.step_size) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step+opt.step_size,r_step) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step,r_step+opt.step_size) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step+opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
+          if ( ( (c+1) < num_cols ) && ((r+1) < num_rows) ) {
+            if ( (m_nodes(c,r+1) != zero) && (m_nodes(c+1,r) != zero) )
+              temp_normal = temp_normal + normalize(cross_prod( m_nodes(c,r+1) - p,
+                                                                m_nodes(c+1,r) - p ) );
           }
           // Is quadrant 3 normal calculation possible?
-          if ( ((r+1) < (num_rows)) && (c>0) ) {
-            if ( (point_image.impl()(c_step-opt.step_size,r_step) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step,r_step+opt.step_size) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step-opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step,r_step+opt.step_size) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
+          if ( ((r+1) < num_rows) && (c > 0) ) {
+            if ( (m_nodes(c-1,r) != zero) && (m_nodes(c,r+1) != zero) )
+              temp_normal = temp_normal + normalize(cross_prod( m_nodes(c-1,r) - p,
+                                                                m_nodes(c,r+1) - p ) );
           }
           // Is quadrant 4 normal calculation possible?
-          if ( (c>0) && (r>0) ) {
-            if ( (point_image.impl()(c_step,r_step-opt.step_size) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step-opt.step_size,r_step) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step,r_step-opt.step_size) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step-opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
+          if ( (c > 0) && (r > 0) ) {
+            if ( (m_nodes(c,r-1) != zero) && (m_nodes(c-1,r) != zero) )
+              temp_normal = temp_normal + normalize(cross_prod( m_nodes(c,r-1) - p,
+                                                                m_nodes(c-1,r) - p ) );
           }
 
           temp_normal = normalize( temp_normal );
@@ -298,110 +270,221 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
                                           temp_normal[2] ) );
         }
 
-        if ( tex_file.size() ) {
-          texcoords->push_back( osg::Vec2f ( (float)c_step / (float)point_image.impl().cols() ,
-                                             1-(float)r_step / (float)point_image.impl().rows() ) );
-        } else if ( (point_image.impl()(c_step,r_step)[0] != 0 ) &&
-                    (point_image.impl()(c_step,r_step)[1] != 0 ) &&
-                    (point_image.impl()(c_step,r_step)[2] != 0 ) ) {
-          //I'm calculating the main normal for the data.
-          opt.dataNormal[0] += point_image.impl()(c_step,r_step)[0];
-          opt.dataNormal[1] += point_image.impl()(c_step,r_step)[1];
-          opt.dataNormal[2] += point_image.impl()(c_step,r_step)[2];
-        }
+        if ( m_has_texture )
+          texcoords->push_back( osg::Vec2f ( (float)(c*step) / (float)m_image_size[0] ,
+                                             1-(float)(r*step) / (float)m_image_size[1] ) );
       }
     }
-    progress.report_finished();
-
-    vw_out() << "\t > size: " << vertices->size() << " vertices\n";
 
     geometry->setVertexArray( vertices );
 
-    if (opt.enable_lighting)
+    if (m_opt.enable_lighting)
       geometry->setNormalArray( normals );
 
-    if ( tex_file.size() ) {
+    if ( m_has_texture )
       geometry->setTexCoordArray( 0,texcoords );
-    } else {
-      opt.dataNormal.normalize();
-    }
 
     osg::Vec4Array* colour = new osg::Vec4Array();
     colour->push_back( osg::Vec4f( 1.0f, 1.0f, 1.0f, 1.0f ) );
     geometry->setColorArray( colour );
     geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
 
-  }
-
-  //////////////////////////////////////////////////
-  // Deciding How to draw triangle strips
-  vw_out() << "Drawing triangle strips\n";
-  {
-    uint32 col_steps = point_image.impl().cols()/opt.step_size;
-
-    for (uint32 r = 0;
-         r < ( point_image.impl().rows()/opt.step_size - 1); ++r){
+    //////////////////////////////////////////////////
+    // Deciding How to draw triangle strips
+    uint32 col_steps = m_c1 - m_c0 + 1;
+    for (int r = 0; r < m_r1 - m_r0; ++r) {
 
       bool add_direction_down = true;
       osg::DrawElementsUInt* dui = new osg::DrawElementsUInt(GL_TRIANGLE_STRIP);
 
-      for (uint32 c = 0; c < ( col_steps ); ++c){
+      for (uint32 c = 0; c < col_steps; ++c) {
 
-        uint32 pointing_index = r*(col_steps) + c;
-
-        //vw_out() << "V: " << vertices->at(pointing_index)[0] << " " << vertices->at(pointing_index)[1] << " " << vertices->at(pointing_index)[2] << std::endl;
+        uint32 pointing_index = r*col_steps + c;
+        bool top_valid    = is_valid_vertex(vertices->at(pointing_index));
+        bool bottom_valid = is_valid_vertex(vertices->at(pointing_index+col_steps));
 
         if (add_direction_down) {
+          // Adding top point, then bottom point
+          if (top_valid)
+            dui->push_back( pointing_index );
+          if (bottom_valid)
+            dui->push_back( pointing_index+col_steps );
+          else
+            add_direction_down = false; // a drop out, switch the adding direction
+        } else {
+          // Adding bottom point, then top point
+          if (bottom_valid)
+            dui->push_back( pointing_index+col_steps );
+          if (top_valid)
+            dui->push_back( pointing_index );
+          else
+            add_direction_down = true;
+        }
+      }
+
+      geometry->addPrimitiveSet(dui);
+    }
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+    mesh->addDrawable( geometry );
 
-            dui->push_back( pointing_index );
-          }
+    if ( m_opt.smooth_mesh ) {
+      osgUtil::SmoothingVisitor sv;
+      mesh->accept(sv);
+    }
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+    if ( m_opt.simplify_mesh ) {
+      osgUtil::Simplifier simple;
+      simple.setSmoothing( m_opt.smooth_mesh );
+      simple.setSampleRatio( m_opt.simplify_percent );
+      mesh->accept(simple);
+    }
 
-            dui->push_back( pointing_index+col_steps );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = false;
-          }
+    m_tile = mesh;
 
-        } else {
+    Mutex::Lock lock(m_progress_mutex);
+    m_num_done++;
+    m_progress.report_progress(double(m_num_done)/m_num_tiles);
+  }
+};
+
+template <class ViewT>
+osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
+                       Options& opt ) {
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
 
-            dui->push_back( pointing_index+col_steps );
-          }
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
+  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
+            << point_image.impl().rows()/opt.step_size << "]\n";
 
-            dui->push_back( pointing_index );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = true;
-          }
+  //////////////////////////////////////////////////
+  // Deciding how to reduce the texture size
+  //   Max texture width or height is 4096
+  std::string tex_file;
+  if ( opt.texture_file_name.size() ) {
+    DiskImageView<PixelGray<uint8> > previous_texture(opt.texture_file_name);
+    tex_file = asp::prefix_from_pointcloud_filename(opt.output_prefix) + "-tex";
+    if (point_image.impl().cols() > 4096 ||
+        point_image.impl().rows() > 4096 ) {
+      vw_out() << "Resampling to reduce texture size:\n";
+      float tex_sub_scale = 4096.0/float(std::max(previous_texture.cols(),previous_texture.rows()));
+      ImageViewRef<PixelGray<uint8> > new_texture = resample(previous_texture,tex_sub_scale);
+      vw_out() << "\t--> Texture size: [" << new_texture.cols() << ", " << new_texture.rows() << "]\n";
+      vw_out() << "Writing temporary file: " << tex_file+".tif" << "\n";
+      vw::cartography::block_write_gdal_image( tex_file+".tif", new_texture, opt,
+                                   TerminalProgressCallback("asp","\tSubsampling:") );
+    } else {
+      // Always saving as an 8bit texture. These second handedly
+      // normalizes the data for us (which is a problem for datasets
+      // like HiRISE which will feed us tiffs with values outside of
+      // 0-1).
+      vw_out() << "Writing temporary file: " << tex_file+".tif" << "\n";
+      vw::cartography::block_write_gdal_image( tex_file+".tif", previous_texture, opt,
+                                   TerminalProgressCallback("asp","\tNormalizing:") );
+    }
+    // When we subsample, we use tiff because we can block write the image.
+    // However, trying to load the tiff with osg causes problems because
+    // osg uses libtiff to load the images. libtiff conflicts with gdal
+    // if gdal was compiled with internal tiff, and osg will fail to load
+    // the texture. To avoid all this, we resave our subsampled texture as a jpg
+    DiskImageView<PixelGray<uint8> > new_texture(tex_file+".tif");
+    vw_out() << "Writing temporary file: " << tex_file+".jpg" << "\n";
+    write_image(tex_file+".jpg", new_texture);
+    unlink((tex_file+".tif").c_str());
+    tex_file += ".jpg";
+  }
+
+  //////////////////////////////////////////////////
+  /// Reading the points at the mesh nodes
+  int num_rows = point_image.impl().rows()/opt.step_size;
+  int num_cols = point_image.impl().cols()/opt.step_size;
+  if (num_rows < 1 || num_cols < 1)
+    vw_throw( ArgumentErr() << "The step size is larger than the point cloud.\n" );
+
+  ImageView<Vector3> nodes(num_cols, num_rows);
+  {
+    vw_out() << "\t--> Reading vertices\n";
+    int band = std::max(1, std::min(32, num_rows/(4*num_threads)));
+    FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < num_rows; beg += band) {
+      boost::shared_ptr<MeshNodesTask<ViewT> >
+        task(new MeshNodesTask<ViewT>(point_image.impl(), opt.step_size, beg,
+                                      std::min(beg + band, num_rows), nodes));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  vw_out() << "\t > size: " << size_t(num_rows)*num_cols << " vertices\n";
+
+  // The main normal for the data, used for the contour coloring
+  if ( tex_file.empty() ) {
+    for (int r = 0; r < num_rows; r++) {
+      for (int c = 0; c < num_cols; c++) {
+        Vector3 const& p = nodes(c, r);
+        if ( (p[0] != 0) && (p[1] != 0) && (p[2] != 0) ) {
+          opt.dataNormal[0] += p[0];
+          opt.dataNormal[1] += p[1];
+          opt.dataNormal[2] += p[2];
         }
       }
+    }
+    opt.dataNormal.normalize();
+  }
 
-      geometry->addPrimitiveSet(dui);
-
+  //////////////////////////////////////////////////
+  /// Meshing the tiles in parallel. Neighboring tiles share a row or
+  /// column of nodes, so a tile starts at each multiple of the tile
+  /// size but the last node.
+  int tile_size = opt.tile_size;
+  if (tile_size <= 0)
+    tile_size = std::max(num_rows, num_cols);
+  std::vector<int> tile_rows, tile_cols;
+  for (int r0 = 0; r0 == 0 || r0 + 1 < num_rows; r0 += tile_size)
+    tile_rows.push_back(r0);
+  for (int c0 = 0; c0 == 0 || c0 + 1 < num_cols; c0 += tile_size)
+    tile_cols.push_back(c0);
+  int num_tiles = tile_rows.size()*tile_cols.size();
+  vw_out() << "\t--> Meshing " << num_tiles << " tile(s)\n";
+
+  std::vector<osg::ref_ptr<osg::Geode> > tiles(num_tiles);
+  {
+    TerminalProgressCallback progress("asp", "\tTiles:      ");
+    Mutex progress_mutex;
+    int num_done = 0;
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < tile_rows.size(); i++) {
+      for (size_t j = 0; j < tile_cols.size(); j++) {
+        int r0 = tile_rows[i], c0 = tile_cols[j];
+        boost::shared_ptr<MeshTileTask>
+          task(new MeshTileTask(nodes, c0, r0,
+                                std::min(c0 + tile_size, num_cols - 1),
+                                std::min(r0 + tile_size, num_rows - 1),
+                                opt, Vector2i(point_image.impl().cols(),
+                                              point_image.impl().rows()),
+                                !tex_file.empty(), tiles[i*tile_cols.size() + j],
+                                progress, progress_mutex, num_done, num_tiles));
+        queue.add_task(task);
+      }
     }
+    queue.join_all();
+    progress.report_finished();
+  }
+
+  osg::Group* mesh = new osg::Group();
+  {
+    std::ostringstream os;
+    os << "Simple Mesh" << std::endl;
+    mesh->setName( os.str() );
   }
+  for (size_t k = 0; k < tiles.size(); k++)
+    mesh->addChild( tiles[k].get() );
 
   ////////////////////////////////////////////////
-  /// Adding texture to the DTM
+  /// Adding texture to the DTM. All tiles share the same texture.
   if (tex_file.size()){
 
     vw_out() << "Attaching texture data\n";
@@ -412,7 +495,7 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
       if ( textureImage->valid() ){
         osg::Texture2D* texture = new osg::Texture2D;
         texture->setImage(textureImage);
-        osg::StateSet* stateset = geometry->getOrCreateStateSet();
+        osg::StateSet* stateset = mesh->getOrCreateStateSet();
         stateset->setTextureAttributeAndModes(0,texture,osg::StateAttribute::ON);
       } else {
         vw_out() << "Failed to open texture data in " << tex_file << std::endl;
@@ -422,8 +505,6 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
     }
   }
 
-  mesh->addDrawable( geometry );
-
   return mesh;
 
 }
@@ -441,6 +522,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("use-delaunay", "Uses the delaunay triangulator to create a surface from the point cloud. This is not recommended for point clouds with serious noise issues.")
     ("step,s", po::value(&opt.step_size)->default_value(10),
      "Step size for mesher, sets the polygons size per point")
+    ("tile-size", po::value(&opt.tile_size)->default_value(256),
+     "Build the mesh as square tiles of this many points on a side, in parallel. Each tile is smoothed and simplified on its own. Set to 0 for a single tile.")
     ("output-prefix,o", po::value(&opt.output_prefix),
      "Specify the output prefix.")
     ("output-filetype,t",
@@ -486,6 +569,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::log_to_file(argc, argv, "", opt.output_prefix);
 
   opt.simplify_mesh = vm.count("simplify-mesh");
+  if ( opt.simplify_mesh && opt.simplify_percent == 0.0 )
+    opt.simplify_percent = 1.0;
 
   // The purpose of this is to force ASP to link to the OSG libraries
   // at link-time, otherwise it fails to find them at run-time
@@ -527,8 +612,15 @@ int main( int argc, char *argv[] ){
 
     // Centering Option (helpful if you are experiencing round-off error...)
     if (opt.center) {
-      bool is_geodetic = false; // raw xyz values
-      BBox3 bbox = asp::pointcloud_bbox(point_image, is_geodetic);
+      // A cloud from stereo_tri has its bounding box saved with it
+      BBox3 bbox;
+      asp::PointCloudStats cloud_stats;
+      if (num_channels >= 3 && asp::read_point_cloud_stats(input_file, cloud_stats)) {
+        bbox = cloud_stats.bbox;
+      } else {
+        bool is_geodetic = false; // raw xyz values
+        bbox = asp::pointcloud_bbox(point_image, is_geodetic);
+      }
       vw_out() << "\t--> Centering model around the origin.\n";
       vw_out() << "\t    Initial point image bounding box: " << bbox << "\n";
       Vector3 midpoint = (bbox.max() + bbox.min()) / 2.0;
@@ -559,23 +651,6 @@ int main( int argc, char *argv[] ){
       }
     }
 
-    if ( opt.smooth_mesh ) {
-      vw_out() << "Smoothing data\n";
-      osgUtil::SmoothingVisitor sv;
-      opt.root->accept(sv);
-    }
-
-    if ( opt.simplify_mesh ) {
-      if ( opt.simplify_percent == 0.0 )
-        opt.simplify_percent = 1.0;
-
-      vw_out() << "Simplifying data\n";
-      osgUtil::Simplifier simple;
-      simple.setSmoothing( opt.smooth_mesh );
-      simple.setSampleRatio( opt.simplify_percent );
-      opt.root->accept(simple);
-    }
-
     {
       vw_out() << "Optimizing data\n";
       osgUtil::Optimizer optimizer;
@@ -35,8 +35,11 @@
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/NumaAffinity.h>
+#include <asp/Core/BackgroundWriter.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Core/BundleAdjustUtils.h>
@@ -44,6 +47,8 @@
 #include <asp/Camera/RPCModelGen.h>
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <iostream>
 #include <stdexcept>
 #include <stdio.h>
@@ -80,9 +85,8 @@ typedef ImageViewRef<double> DoubleImgT;
 // TODO: Make it possible to initialize a DEM from scratch.
 // TODO: Study more the multi-resolution approach.
 // TODO: Must specify in the SfS doc that the lunar lambertian model fails at poles
-// TODO: If this code becomes multi-threaded, need to keep in mind
-// that camera models are shared and modified, so
-// this may cause problems.
+// TODO: The exact ISIS camera models are not thread-safe, and are
+// shared, so they are only invoked under a lock.
 // TODO: How to relax conditions at the boundary to improve the accuracy?
 // TODO: Study if blurring the input images improves the fit.
 // TODO: Add --orthoimage option, and make it clear where the final DEM is.
@@ -116,26 +120,44 @@ namespace vw { namespace camera {
   // This class provides an approximation for the point_to_pixel()
   // function of an ISIS camera around a current DEM. The algorithm
   // works by tabulation of point_to_pixel and pixel_to_vector values
-  // at the mean dem height.
+  // at the mean dem height. The camera center is tabulated as well,
+  // as a function of the image line.
+  //
+  // The tables are only read by point_to_pixel() and camera_center(),
+  // so these can be invoked from many threads at once without locking.
+  // The exact camera, which is not thread-safe, is used under a lock
+  // only for points outside the tables. Those points are recorded,
+  // and grow_table() extends the table to cover them. That one must
+  // be called when no other thread uses the model, such as between
+  // solver iterations.
   class ApproxCameraModel: public CameraModel {
     boost::shared_ptr<CameraModel>  m_exact_camera;
-    mutable Vector3 m_mean_dir; // mean vector from camera to ground
+    Vector3 m_mean_dir; // mean vector from camera to ground
     BBox2i m_img_bbox;
     GeoReference m_geo;
     double m_mean_ht;
-    mutable ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
-    mutable ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
-    //ImageView< PixelMask<Vector3> > m_camera_center_mat;
+    ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
+    ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
     double m_approx_table_gridx, m_approx_table_gridy;
-    mutable BBox2 m_point_box, m_crop_box;
+    BBox2 m_point_box, m_crop_box;
     bool m_use_rpc_approximation, m_use_semi_approx;
     vw::Mutex& m_camera_mutex;
     Vector2 m_uncompValue;
-    mutable int m_begX, m_endX, m_begY, m_endY;
-    mutable bool m_compute_mean, m_stop_growing_range;
-    mutable int m_count;
+    int m_begX, m_endX, m_begY, m_endY;
+    bool m_compute_mean, m_stop_growing_range;
+    int m_count;
     boost::shared_ptr<asp::RPCModel> m_rpc_model;
     bool m_model_is_valid;
+
+    // The camera center at every m_center_step lines starting at
+    // m_center_beg_line. Empty if it depends on more than the line.
+    std::vector< PixelMask<Vector3> > m_center_table;
+    double m_center_beg_line, m_center_step;
+
+    // The table indices which were looked up out of the computed range,
+    // to be added by grow_table(). Protected by m_camera_mutex.
+    mutable BBox2i m_missed_box;
+    mutable bool   m_has_missed;
     
     bool comp_rpc_approx_table(AdjustedCameraModel const& adj_camera,
                                boost::shared_ptr<CameraModel> exact_camera,
@@ -344,7 +366,7 @@ namespace vw { namespace camera {
       return true;
     }
     
-    void comp_entries_in_table() const{
+    void comp_entries_in_table(){
       for (int x = m_begX; x <= m_endX; x++) {
 	for (int y = m_begY; y <= m_endY; y++) {
 	  
@@ -390,6 +412,56 @@ namespace vw { namespace camera {
       }
       
     }
+
+    // Tabulate the camera center along the image lines. This is
+    // skipped if the center also changes along a line, as for
+    // cameras which are not linescan or frame.
+    void comp_center_table(){
+
+      m_center_table.clear();
+      if (m_img_bbox.empty())
+        return;
+
+      int num_samples = 4096;
+      m_center_beg_line = m_img_bbox.min().y();
+      m_center_step = std::max(1.0, double(m_img_bbox.height())/num_samples);
+      int num = int(ceil((m_img_bbox.height() - 1)/m_center_step)) + 1;
+
+      // The center must not depend on the column
+      double left = m_img_bbox.min().x(), right = m_img_bbox.max().x() - 1;
+      double mid  = (left + right)/2.0;
+      for (int k = 0; k <= 4; k++) {
+        double line = m_img_bbox.min().y() + k*(m_img_bbox.height() - 1)/4.0;
+        try {
+          Vector3 c1 = m_exact_camera->camera_center(Vector2(left,  line));
+          Vector3 c2 = m_exact_camera->camera_center(Vector2(right, line));
+          if (norm_2(c1 - c2) > 1e-3)
+            return;
+        }catch(...){
+        }
+      }
+
+      m_center_table.resize(num);
+      for (int k = 0; k < num; k++) {
+        try {
+          m_center_table[k]
+            = m_exact_camera->camera_center(Vector2(mid, m_center_beg_line + k*m_center_step));
+          m_center_table[k].validate();
+        }catch(...){
+          m_center_table[k].invalidate();
+        }
+      }
+    }
+
+    // Remember that this point of the table was needed and not computed
+    void record_miss(double x, double y) const{
+      Vector2i ipt(int(floor(x)), int(floor(y)));
+      if (!m_has_missed)
+        m_missed_box = BBox2i(ipt, ipt);
+      m_missed_box.grow(ipt);
+      m_missed_box.grow(ipt + Vector2i(1, 1));
+      m_has_missed = true;
+    }
     
   public:
 
@@ -417,7 +489,8 @@ namespace vw { namespace camera {
       m_exact_camera(exact_camera), m_img_bbox(img_bbox), m_geo(geo),
       m_use_rpc_approximation(use_rpc_approximation),
       m_use_semi_approx(use_semi_approx),
-      m_camera_mutex(camera_mutex), m_model_is_valid(true)
+      m_camera_mutex(camera_mutex), m_model_is_valid(true),
+      m_center_beg_line(0), m_center_step(1), m_has_missed(false)
     {
 
       int big = 1e+8;
@@ -489,6 +562,7 @@ namespace vw { namespace camera {
         m_crop_box.crop(m_img_bbox);
 #endif
 
+        comp_center_table();
         return;
       }
       
@@ -550,30 +624,59 @@ namespace vw { namespace camera {
       m_crop_box.crop(m_img_bbox);
 #endif
 
-#if 0 // takes too much memory
-      // Tabulate the camera_center function
-      m_camera_center_mat.set_size(m_crop_box.width(), m_crop_box.height());
-      for (int col = 0; col < m_crop_box.width(); col++) {
-	for (int row = 0; row < m_crop_box.height(); row++) {
-	  bool success = true;
-	  Vector3 ctr;
-	  try {
-	    ctr = m_exact_camera->camera_center(m_crop_box.min() + Vector2(col, row));
-	  }catch(...){
-	    success = false;
-	  }
-	  if (success) {
-	    m_camera_center_mat(col, row) = ctr;
-	    m_camera_center_mat(col, row).validate();
-	  }else{
-	    m_camera_center_mat(col, row).invalidate();
-	  }
-	}
-      }
-#endif
+      comp_center_table();
       return;
     }
 
+    /// Extend the table to cover the points which were looked up out
+    /// of its computed range since the last invocation. Not thread-safe.
+    void grow_table(){
+
+      if (m_use_semi_approx || m_use_rpc_approximation || !m_has_missed)
+        return;
+
+      BBox2i missed = m_missed_box;
+      m_has_missed = false;
+      if (m_stop_growing_range)
+        return;
+
+      if (g_warning_count < g_max_warning_count) {
+        g_warning_count++;
+        vw_out(WarningMessage) << "Pixel outside of computed range. "
+                               << "Growing the computed table." << std::endl;
+        vw_out(WarningMessage) << "Start table: " << m_begX << ' ' << m_begY << ' '
+                               << m_endX << ' ' << m_endY << std::endl;
+      }
+
+      // If we have to expand, do it by a lot
+      int extrax = std::max(10, int(0.1*(m_endX - m_begX)));
+      int extray = std::max(10, int(0.1*(m_endY - m_begY)));
+
+      int old_begX = m_begX, old_begY = m_begY;
+      int old_endX = m_endX, old_endY = m_endY;
+
+      m_begX = std::min(m_begX, missed.min().x()) - extrax; m_begX = std::max(0, m_begX);
+      m_begY = std::min(m_begY, missed.min().y()) - extray; m_begY = std::max(0, m_begY);
+
+      m_endX = std::max(m_endX, missed.max().x()) + extrax;
+      m_endX = std::min(m_pixel_to_vec_mat.cols()-1, m_endX);
+
+      m_endY = std::max(m_endY, missed.max().y()) + extray;
+      m_endY = std::min(m_pixel_to_vec_mat.rows()-1, m_endY);
+
+      if (g_warning_count < g_max_warning_count) {
+        vw_out(WarningMessage) << "Updated table: " << m_begX << ' ' << m_begY << ' '
+                               << m_endX << ' ' << m_endY << std::endl;
+      }
+      comp_entries_in_table();
+
+      // Avoid growing forever if we can't grow the table
+      if (old_begX == m_begX && old_begY == m_begY &&
+          old_endX == m_endX && old_endY == m_endY ) {
+        m_stop_growing_range = true;
+      }
+    }
+
     // We have tabulated point_to_pixel at the mean dem height.
     // Look-up point_to_pixel for the current point by first
     // intersecting the ray from the current point to the camera
@@ -633,54 +736,14 @@ namespace vw { namespace camera {
 	bool out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
 				  y < m_begY || y >= m_endY-1);
 
-	// If we are not out of range, but we need to expand the computed table, do that
-	if (!m_stop_growing_range && !out_of_range && out_of_comp_range) {
+	if (out_of_range || out_of_comp_range){
 	  vw::Mutex::Lock lock(m_camera_mutex);
 	  g_num_locks++;
-          if (g_warning_count < g_max_warning_count) {
-            g_warning_count++;
-            vw_out(WarningMessage) << "Pixel outside of computed range. "
-                                   << "Growing the computed table." << std::endl;
-            vw_out(WarningMessage) << "Start table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-          
-	  // If we have to expand, do it by a lot
-	  int extrax = std::max(10, int(0.1*(m_endX - m_begX)));
-	  int extray = std::max(10, int(0.1*(m_endY - m_begY)));
 
-          int old_begX = m_begX, old_begY = m_begY;
-          int old_endX = m_endX, old_endY = m_endY;
-
-	  m_begX = std::min(m_begX, int(floor(x))) - extrax; m_begX = std::max(0, m_begX);
-	  m_begY = std::min(m_begY, int(floor(y))) - extray; m_begY = std::max(0, m_begY);
-	  
-	  m_endX = std::max(m_endX, int(ceil(x))) + extrax;
-	  m_endX = std::min(m_pixel_to_vec_mat.cols()-1, m_endX);
+	  // The computed table can be grown later to include this point
+	  if (!out_of_range)
+	    record_miss(x, y);
 
-	  m_endY = std::max(m_endY, int(ceil(y))) + extray;
-	  m_endY = std::min(m_pixel_to_vec_mat.rows()-1, m_endY);
-	  
-          if (g_warning_count < g_max_warning_count) {
-            vw_out(WarningMessage) << "Updated table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-	  comp_entries_in_table();
-
-	  // Update this
-	  out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
-			       y < m_begY || y >= m_endY-1);
-
-          // Avoid an infinite loop if we can't grow the table
-          if (old_begX == m_begX && old_begY == m_begY &&
-              old_endX == m_endX && old_endY == m_endY ) {
-            m_stop_growing_range = true;
-          }
-	}
-
-	if (out_of_range || out_of_comp_range){
-	  vw::Mutex::Lock lock(m_camera_mutex);
-	  g_num_locks++;
           if (g_warning_count < g_max_warning_count) {
             g_warning_count++;
             vw_out(WarningMessage) << "Pixel outside of range. Current values and range: "  << ' '
@@ -739,32 +802,18 @@ namespace vw { namespace camera {
     }
 
     virtual Vector3 camera_center(Vector2 const& pix) const{
-      // It is tricky to approximate the camera center
-      //if (m_use_rpc_approximation){
-	vw::Mutex::Lock lock(m_camera_mutex);
-	g_num_locks++;
-	//vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
-        //                       << pix << std::endl;
-	return this->exact_camera()->camera_center(pix);
-	//return m_rpc_model->camera_center(pix);
-	//}
 
-#if 0
-      // TODO: Is this function invoked? Should just the underlying exact model
-      // camera center be used all the time?
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> camera_center_interp
-	= interpolate(m_camera_center_mat, BilinearInterpolation(),
-		      ConstantEdgeExtension());
-      double lx = pix[0] - m_crop_box.min().x();
-      double ly = pix[1] - m_crop_box.min().y();
-      if (0 <= lx && lx < m_camera_center_mat.cols() - 1 &&
-	  0 <= ly && ly < m_camera_center_mat.rows() - 1 ) {
-	PixelMask<Vector3> ctr = camera_center_interp(lx, ly);
-	if (is_valid(ctr))
-	  return ctr.child();
+      // Interpolate linearly between the tabulated lines
+      if (!m_use_semi_approx && !m_center_table.empty()) {
+        double t = (pix[1] - m_center_beg_line)/m_center_step;
+        int k = int(floor(t));
+        if (k >= 0 && k + 1 < int(m_center_table.size()) &&
+            is_valid(m_center_table[k]) && is_valid(m_center_table[k+1])) {
+          t -= k;
+          return (1.0 - t)*m_center_table[k].child() + t*m_center_table[k+1].child();
+        }
       }
-#endif
-      
+
       {
 	// Failed to interpolate
 	vw::Mutex::Lock lock(m_camera_mutex);
@@ -849,6 +898,24 @@ boost::shared_ptr<CameraModel> get_isis_cam(boost::shared_ptr<CameraModel> cam){
   return ucam;
 }
 
+// Let the approximate camera models extend their tables to cover the
+// points which were looked up outside of them. Not thread-safe.
+void grow_approx_camera_tables(std::vector< std::vector<boost::shared_ptr<CameraModel> > >
+                               & cameras){
+  for (size_t dem_iter = 0; dem_iter < cameras.size(); dem_iter++) {
+    for (size_t image_iter = 0; image_iter < cameras[dem_iter].size(); image_iter++) {
+      AdjustedCameraModel * acam
+        = dynamic_cast<AdjustedCameraModel*>(cameras[dem_iter][image_iter].get());
+      if (acam == NULL)
+        continue;
+      ApproxCameraModel * apcam
+        = dynamic_cast<ApproxCameraModel*>(acam->unadjusted_model().get());
+      if (apcam != NULL)
+        apcam->grow_table();
+    }
+  }
+}
+
 
 // Compute mean and standard deviation of an image
 template <class ImageT>
@@ -938,32 +1005,330 @@ bool isInShadow(int col, int row, Vector3 & sunPos,
   return false;
 }
 
+namespace {
+
+  // A line y = slope*x + intercept for the convex hull trick
+  struct HullLine {
+    double slope, intercept;
+    HullLine(double s, double b): slope(s), intercept(b){}
+    double operator()(double x) const { return slope*x + intercept; }
+  };
+
+  // Find the shadows along a range of lines parallel to the sun
+  // direction. See computeShadowMap() for the notation.
+  class ShadowSweepTask : public vw::Task, private boost::noncopyable {
+    ImageView<double> const& m_dem;
+    ImageView<float>       & m_shadow;
+    Vector2 m_sun_dir;             // in pixels, pointing to the sun
+    double  m_meters_per_pixel, m_tan_elev, m_curv;
+    int     m_beg, m_end;          // the range of lines
+  public:
+    ShadowSweepTask(ImageView<double> const& dem, ImageView<float> & shadow,
+                    Vector2 const& sun_dir, double meters_per_pixel,
+                    double tan_elev, double curv, int beg, int end):
+      m_dem(dem), m_shadow(shadow), m_sun_dir(sun_dir),
+      m_meters_per_pixel(meters_per_pixel), m_tan_elev(tan_elev), m_curv(curv),
+      m_beg(beg), m_end(end){}
+
+    void operator()() {
+
+      // Walk along the major axis, one pixel at a time, starting
+      // from the side of the sun.
+      bool by_col   = (std::abs(m_sun_dir[0]) >= std::abs(m_sun_dir[1]));
+      int  n_major  = by_col ? m_dem.cols() : m_dem.rows();
+      int  n_minor  = by_col ? m_dem.rows() : m_dem.cols();
+      double major  = by_col ? m_sun_dir[0] : m_sun_dir[1];
+      double minor  = by_col ? m_sun_dir[1] : m_sun_dir[0];
+      double m      = minor/major;
+      int start     = (major > 0) ? n_major - 1 : 0;
+      int step      = (major > 0) ? -1 : 1;
+
+      std::vector<HullLine> hull;
+      for (int line = m_beg; line < m_end; line++) {
+        hull.clear();
+        size_t head = 0;
+        for (int a = start; a >= 0 && a < n_major; a += step) {
+          int b = line + int(floor(a*m + 0.5));
+          if (b < 0 || b >= n_minor)
+            continue;
+          int col = by_col ? a : b, row = by_col ? b : a;
+
+          // The distance towards the sun, and the height of the ray
+          // from this point to the sun, less the curvature term
+          double x = m_meters_per_pixel*(col*m_sun_dir[0] + row*m_sun_dir[1]);
+          double h = m_dem(col, row) - m_tan_elev*x;
+
+          // The highest point ahead, relative to the ray
+          while (hull.size() - head >= 2 && hull[head + 1](x) >= hull[head](x))
+            head++;
+          bool in_shadow = (hull.size() > head &&
+                            hull[head](x) - m_curv*x*x > h);
+          m_shadow(col, row) = in_shadow;
+
+          // Add this point as an obstacle for the points behind it.
+          // The slopes decrease, so the lines that can no longer
+          // be on top are removed from the back.
+          HullLine curr(2*m_curv*x, h - m_curv*x*x);
+          if (hull.size() > head && hull.back().slope == curr.slope) {
+            if (hull.back().intercept >= curr.intercept)
+              continue;
+            hull.pop_back();
+          }
+          while (hull.size() - head >= 2) {
+            HullLine const& l1 = hull[hull.size() - 2];
+            HullLine const& l2 = hull[hull.size() - 1];
+            if ((curr.intercept - l2.intercept)*(l1.slope - l2.slope) <
+                (l2.intercept - l1.intercept)*(l2.slope - curr.slope))
+              break;
+            hull.pop_back();
+          }
+          hull.push_back(curr);
+        }
+      }
+    }
+  };
+
+}
+
+// Find the points of a DEM which are shadowed by other points of it,
+// all at once. The sun is taken to be in the same direction from all
+// points, and the planet to be locally a sphere of radius R. A point
+// is then in shadow if some point ahead of it towards the sun, at a
+// horizontal distance x, is higher than tan(elevation)*x + x^2/(2R)
+// above it. The points are visited along lines parallel to the sun
+// direction, and on each line the highest point ahead is found with
+// the convex hull trick, so the cost does not depend on the length
+// of the rays, unlike with isInShadow(). The lines are split among
+// threads.
+void computeShadowMap(Vector3 const& sunPos, ImageView<double> const& dem,
+                      double gridx, double gridy,
+                      cartography::GeoReference const& geo, int num_threads,
+                      ImageView<float> & shadow){
+
+  shadow.set_size(dem.cols(), dem.rows());
+  fill(shadow, 0);
+  if (dem.cols() == 0 || dem.rows() == 0)
+    return;
+
+  // The sun elevation and azimuth at the DEM center
+  Vector2 ctr_pix(dem.cols()/2, dem.rows()/2);
+  Vector2 ctr_ll = geo.pixel_to_lonlat(ctr_pix);
+  Vector3 ctr = geo.datum().geodetic_to_cartesian
+    (Vector3(ctr_ll[0], ctr_ll[1], dem(ctr_pix[0], ctr_pix[1])));
+  double radius = norm_2(ctr);
+  Vector3 up    = ctr/radius;
+  Vector3 dir   = sunPos - ctr;
+  if (dir == Vector3())
+    return;
+  dir = dir/norm_2(dir);
+  Vector3 horiz = dir - dot_prod(dir, up)*up;
+  double horiz_len = norm_2(horiz);
+  if (horiz_len < 1e-12)
+    return; // the sun is at the zenith
+  double tan_elev = dot_prod(dir, up)/horiz_len;
+  horiz /= horiz_len;
+
+  // The sun direction in pixels, and the pixel size along it
+  double len = std::max(std::min(gridx, gridy), 1e-6);
+  Vector3 llh = geo.datum().cartesian_to_geodetic(ctr + len*horiz);
+  llh[0] += 360.0*round((ctr_ll[0] - llh[0])/360.0);
+  Vector2 sun_dir = geo.lonlat_to_pixel(Vector2(llh[0], llh[1])) - ctr_pix;
+  if (norm_2(sun_dir) == 0)
+    return;
+  double meters_per_pixel = len/norm_2(sun_dir);
+  sun_dir = sun_dir/norm_2(sun_dir);
+
+  // The lines, indexed by where they cross the minor axis
+  bool by_col = (std::abs(sun_dir[0]) >= std::abs(sun_dir[1]));
+  int  n_major = by_col ? dem.cols() : dem.rows();
+  int  n_minor = by_col ? dem.rows() : dem.cols();
+  double m = by_col ? sun_dir[1]/sun_dir[0] : sun_dir[0]/sun_dir[1];
+  int end_shift = int(floor((n_major - 1)*m + 0.5));
+  int beg_line  = -std::max(end_shift, 0);
+  int end_line  = n_minor - std::min(end_shift, 0);
+  int num_lines = end_line - beg_line;
+
+  double curv = 1.0/(2.0*radius);
+  num_threads = std::max(num_threads, 1);
+  if (num_threads == 1 || num_lines < 2*num_threads) {
+    ShadowSweepTask task(dem, shadow, sun_dir, meters_per_pixel, tan_elev, curv,
+                         beg_line, end_line);
+    task();
+    return;
+  }
+
+  // A few bands per thread, so that they finish at about the same time
+  int num_bands = 4*num_threads;
+  FifoWorkQueue queue(num_threads);
+  for (int band = 0; band < num_bands; band++){
+    int beg = beg_line + (long long)num_lines*band/num_bands;
+    int end = beg_line + (long long)num_lines*(band + 1)/num_bands;
+    if (beg >= end)
+      continue;
+    boost::shared_ptr<ShadowSweepTask>
+      task(new ShadowSweepTask(dem, shadow, sun_dir, meters_per_pixel, tan_elev, curv,
+                               beg, end));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 void areInShadow(Vector3 & sunPos, ImageView<double> const& dem,
 		 double gridx, double gridy,
 		 cartography::GeoReference const& geo,
 		 ImageView<float> & shadow){
+  computeShadowMap(sunPos, dem, gridx, gridy, geo, vw_settings().default_num_threads(), shadow);
+}
 
-  // Find the max DEM height
-  double max_dem_height = -std::numeric_limits<double>::max();
-  for (int col = 0; col < dem.cols(); col++) {
+// Shadow maps computed with computeShadowMap(), for each DEM and set
+// of images with about the same sun direction. They are recomputed
+// when the DEM changes, after each solver iteration, and are only
+// read while the solver evaluates the residuals.
+class ShadowCache {
+  struct Entry {
+    ImageView<double>         const* dem;
+    cartography::GeoReference const* geo;
+    Vector3                          sun_pos;
+    double                           gridx, gridy;
+    ImageView<float>                 shadow;
+  };
+  std::vector<Entry> m_entries;
+  double m_angle_tol; // in degrees
+
+  bool is_close(Vector3 const& a, Vector3 const& b) const {
+    if (a == b)
+      return true;
+    double c = dot_prod(a, b)/(norm_2(a)*norm_2(b));
+    return acos(std::max(-1.0, std::min(1.0, c)))*180.0/M_PI <= m_angle_tol;
+  }
+
+public:
+  ShadowCache(): m_angle_tol(0.0){}
+
+  void clear(double angle_tol) {
+    m_entries.clear();
+    m_angle_tol = angle_tol;
+  }
+
+  /// Add a shadow map for this DEM and sun, unless one with a close
+  /// enough sun direction exists already.
+  void add(ImageView<double> const& dem, double gridx, double gridy,
+           cartography::GeoReference const& geo,
+           Vector3 const& sun_pos, int num_threads) {
+    if (find(dem, sun_pos) != NULL)
+      return;
+    Entry entry;
+    entry.dem = &dem; entry.geo = &geo; entry.sun_pos = sun_pos;
+    entry.gridx = gridx; entry.gridy = gridy;
+    m_entries.push_back(entry);
+    computeShadowMap(sun_pos, dem, gridx, gridy, geo, num_threads, m_entries.back().shadow);
+  }
+
+  /// Update the shadow maps after the DEMs changed
+  void recompute(int num_threads) {
+    for (size_t i = 0; i < m_entries.size(); i++)
+      computeShadowMap(m_entries[i].sun_pos, *m_entries[i].dem,
+                       m_entries[i].gridx, m_entries[i].gridy, *m_entries[i].geo,
+                       num_threads, m_entries[i].shadow);
+  }
+
+  /// The shadow map for this DEM and sun, or NULL if there is none
+  ImageView<float> const* find(ImageView<double> const& dem, Vector3 const& sun_pos) const {
+    for (size_t i = 0; i < m_entries.size(); i++) {
+      if (m_entries[i].dem == &dem && is_close(m_entries[i].sun_pos, sun_pos))
+        return &m_entries[i].shadow;
+    }
+    return NULL;
+  }
+};
+
+ShadowCache g_shadow_cache;
+
+// The DEM grid points in ECEF at zero height, and the unit vertical at
+// each of them, so that the point on the DEM at height h is xyz0 + h*up.
+// That holds exactly for a datum. This saves converting five points from
+// geodetic coordinates at each residual evaluation. The two parts are
+// kept in separate images.
+class DemGeometryCache {
+  struct Entry {
+    ImageView<double> const* dem;
+    ImageView<Vector3>       xyz0, up;
+  };
+  std::vector<Entry> m_entries;
+
+public:
+  void clear() { m_entries.clear(); }
+
+  void add(ImageView<double> const& dem, cartography::GeoReference const& geo) {
+    ImageView<Vector3> const* xyz0;
+    ImageView<Vector3> const* up;
+    if (find(dem, xyz0, up))
+      return;
+    m_entries.push_back(Entry());
+    Entry & entry = m_entries.back();
+    entry.dem = &dem;
+    entry.xyz0.set_size(dem.cols(), dem.rows());
+    entry.up.set_size(dem.cols(), dem.rows());
+    double ht = 1.0e+4; // the heights are linear, any value will do
     for (int row = 0; row < dem.rows(); row++) {
-      if (dem(col, row) > max_dem_height) {
-	max_dem_height = dem(col, row);
+      for (int col = 0; col < dem.cols(); col++) {
+        Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+        Vector3 xyz0 = geo.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], 0));
+        Vector3 xyz1 = geo.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], ht));
+        entry.xyz0(col, row) = xyz0;
+        entry.up(col, row)   = (xyz1 - xyz0)/ht;
       }
     }
   }
 
-  shadow.set_size(dem.cols(), dem.rows());
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      shadow(col, row) = isInShadow(col, row, sunPos, dem,
-				    max_dem_height, gridx, gridy, geo);
+  /// Return false if the DEM was not added
+  bool find(ImageView<double> const& dem, ImageView<Vector3> const*& xyz0,
+            ImageView<Vector3> const*& up) const {
+    for (size_t i = 0; i < m_entries.size(); i++) {
+      if (m_entries[i].dem == &dem) {
+        xyz0 = &m_entries[i].xyz0;
+        up   = &m_entries[i].up;
+        return true;
+      }
     }
+    return false;
+  }
+};
+
+DemGeometryCache g_dem_geometry;
+
+// What computeReflectanceAndIntensity() finds from where a DEM point
+// projects into a camera. With numerical differentiation, for most
+// evaluations of a residual only the neighboring heights, the albedo,
+// the exposure, or the reflectance model coefficients change, and then
+// these can be reused. They are keyed on the center height and the six
+// camera adjustments, which are compared exactly.
+struct ProjectionCache {
+  bool              valid, success;
+  double            center_h, adjustments[6];
+  Vector3           camera_position;
+  PixelMask<double> intensity;
+  double            weight;
+
+  ProjectionCache(): valid(false), success(false), center_h(0), weight(0){
+    for (int i = 0; i < 6; i++) adjustments[i] = 0;
   }
-}
+
+  /// Forget the cached values unless they are for this height and adjustments
+  void update_key(double h, const double * adj) {
+    bool same = (valid && h == center_h);
+    for (int i = 0; i < 6; i++) {
+      same = same && (adj[i] == adjustments[i]);
+      adjustments[i] = adj[i];
+    }
+    center_h = h;
+    valid = same;
+  }
+};
 
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string input_dems_str, out_prefix, stereo_session_string, bundle_adjust_prefix;
+  std::string input_dems_str, out_prefix, stereo_session_string, bundle_adjust_prefix,
+    numa_affinity;
   std::vector<std::string> input_dems, input_images, input_cameras;
   std::string shadow_thresholds, max_valid_image_vals, skip_images_str, image_exposure_prefix,
     model_coeffs_prefix, model_coeffs;
@@ -973,18 +1338,20 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::vector< std::set<int> > skip_images;
 
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels, blending_dist,
-    blending_power;
+    blending_power, multigrid_cycles;
   bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
     save_computed_intensity_only,
     save_dem_with_nodata, use_approx_camera_models, use_rpc_approximation, use_semi_approx, crop_input_images,
     use_blending_weights,
-    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly;
+    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly,
+    save_in_background, matrix_free_solver;
   double smoothness_weight, init_dem_height, nodata_val, initial_dem_constraint_weight,
-    albedo_constraint_weight, camera_position_step_size, rpc_penalty_weight, unreliable_intensity_threshold;
+    albedo_constraint_weight, camera_position_step_size, rpc_penalty_weight, unreliable_intensity_threshold,
+    shadow_sun_angle_tol;
   vw::BBox2 crop_win;
 
   Options():max_iterations(0), max_coarse_iterations(0), reflectance_type(0),
-	    coarse_levels(0), blending_dist(10), blending_power(2),
+	    coarse_levels(0), blending_dist(10), blending_power(2), multigrid_cycles(0),
             float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
 	    model_shadows(false),
@@ -996,10 +1363,11 @@ struct Options : public vw::cartography::GdalWriteOptions {
 	    crop_input_images(false), use_blending_weights(false),
             float_dem_at_boundary(false), fix_dem(false),
             float_reflectance_model(false), query(false), save_sparingly(false),
+            save_in_background(false), matrix_free_solver(false),
 	    smoothness_weight(0), initial_dem_constraint_weight(0.0),
 	    albedo_constraint_weight(0.0),
 	    camera_position_step_size(1.0), rpc_penalty_weight(0.0),
-            unreliable_intensity_threshold(0.0),
+            unreliable_intensity_threshold(0.0), shadow_sun_angle_tol(0.0),
 	    crop_win(BBox2i(0, 0, 0, 0)){}
 };
 
@@ -1440,7 +1808,9 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
 				    PixelMask<double> & reflectance,
 				    PixelMask<double> & intensity,
 				    double            & weight,
-                                    const double * coeffs) {
+                                    const double * coeffs,
+                                    ImageView<float> const* shadow = NULL,
+                                    ProjectionCache * proj_cache = NULL) {
 
   // Set output values
   reflectance = 0.0; reflectance.invalidate();
@@ -1452,35 +1822,28 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     
   // TODO: Investigate various ways of finding the normal.
 
-  // The xyz position at the center grid point
-  Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
-  double h = center_h;
-  Vector3 lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 base = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the left grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col-1, row));
-  h = left_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 left = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the right grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col+1, row));
-  h = right_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 right = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the bottom grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row+1));
-  h = bottom_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 bottom = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the top grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row-1));
-  h = top_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 top = geo.datum().geodetic_to_cartesian(lonlat3);
+  // The xyz positions at the center, left, right, bottom, and top grid points
+  Vector3 base, left, right, bottom, top;
+  ImageView<Vector3> const* xyz0 = NULL;
+  ImageView<Vector3> const* up   = NULL;
+  if (col >= 1 && row >= 1 && g_dem_geometry.find(dem, xyz0, up)) {
+    base   = (*xyz0)(col,   row  ) + center_h*(*up)(col,   row  );
+    left   = (*xyz0)(col-1, row  ) + left_h  *(*up)(col-1, row  );
+    right  = (*xyz0)(col+1, row  ) + right_h *(*up)(col+1, row  );
+    bottom = (*xyz0)(col,   row+1) + bottom_h*(*up)(col,   row+1);
+    top    = (*xyz0)(col,   row-1) + top_h   *(*up)(col,   row-1);
+  }else{
+    Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+    base   = geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), center_h));
+    lonlat = geo.pixel_to_lonlat(Vector2(col-1, row));
+    left   = geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), left_h));
+    lonlat = geo.pixel_to_lonlat(Vector2(col+1, row));
+    right  = geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), right_h));
+    lonlat = geo.pixel_to_lonlat(Vector2(col, row+1));
+    bottom = geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), bottom_h));
+    lonlat = geo.pixel_to_lonlat(Vector2(col, row-1));
+    top    = geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), top_h));
+  }
 
 #if 0
   // two-point normal
@@ -1496,68 +1859,88 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   // Update the camera position for the given pixel (camera position
   // is pixel-dependent for for linescan cameras.
   ModelParams local_model_params = model_params;
-  Vector2 pix;
   Vector3 cameraPosition;
-  try {
-    pix = camera->point_to_pixel(base);
-    
-    // Need camera center only for Lunar Lambertian
-    if ( global_params.reflectanceType != LAMBERT ) {
-      cameraPosition = camera->camera_center(pix);
-    }
-    
-  } catch(...){
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
-    return false;
-  }
-  
-  double phase_angle;
-  reflectance = ComputeReflectance(cameraPosition,
-				   normal, base, local_model_params,
-				   global_params, phase_angle,
-                                   coeffs);
-  reflectance.validate();
+  bool success = true;
+  if (proj_cache != NULL && proj_cache->valid) {
+    success        = proj_cache->success;
+    cameraPosition = proj_cache->camera_position;
+    intensity      = proj_cache->intensity;
+    weight         = proj_cache->weight;
+  }else{
+    Vector2 pix;
+    try {
+      pix = camera->point_to_pixel(base);
 
+      // Need camera center only for Lunar Lambertian
+      if ( global_params.reflectanceType != LAMBERT ) {
+        cameraPosition = camera->camera_center(pix);
+      }
 
-  // Since our image is cropped
-  pix -= crop_box.min();
+    } catch(...){
+      success = false;
+    }
 
-  // Check for out of range
-  if (pix[0] < 0 || pix[0] >= image.cols()-1 ||
-      pix[1] < 0 || pix[1] >= image.rows()-1) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
-    return false;
-  }
+    // Since our image is cropped
+    pix -= crop_box.min();
+
+    // Check for out of range
+    if (success &&
+        (pix[0] < 0 || pix[0] >= image.cols()-1 ||
+         pix[1] < 0 || pix[1] >= image.rows()-1))
+      success = false;
+
+    if (success) {
+      InterpolationView<EdgeExtensionView<MaskedImgT, ConstantEdgeExtension>, BilinearInterpolation>
+        interp_image = interpolate(image, BilinearInterpolation(),
+                                   ConstantEdgeExtension());
+      intensity = interp_image(pix[0], pix[1]); // this interpolates
+
+      InterpolationView<EdgeExtensionView<DoubleImgT, ConstantEdgeExtension>, BilinearInterpolation>
+        interp_weight = interpolate(blend_weight, BilinearInterpolation(),
+                                    ConstantEdgeExtension());
+      if (blend_weight.cols() > 0 && blend_weight.rows() > 0) // The weight may not exist
+        weight = interp_weight(pix[0], pix[1]); // this interpolates
+      else
+        weight = 1.0;
 
-  InterpolationView<EdgeExtensionView<MaskedImgT, ConstantEdgeExtension>, BilinearInterpolation>
-    interp_image = interpolate(image, BilinearInterpolation(),
-			       ConstantEdgeExtension());
-  intensity = interp_image(pix[0], pix[1]); // this interpolates
+      success = is_valid(intensity);
+    }
 
-  InterpolationView<EdgeExtensionView<DoubleImgT, ConstantEdgeExtension>, BilinearInterpolation>
-    interp_weight = interpolate(blend_weight, BilinearInterpolation(),
-                                ConstantEdgeExtension());
-  if (blend_weight.cols() > 0 && blend_weight.rows() > 0) // The weight may not exist
-    weight = interp_weight(pix[0], pix[1]); // this interpolates
-  else
-    weight = 1.0;
+    if (proj_cache != NULL) {
+      proj_cache->valid           = true;
+      proj_cache->success         = success;
+      proj_cache->camera_position = cameraPosition;
+      proj_cache->intensity       = intensity;
+      proj_cache->weight          = weight;
+    }
+  }
 
-  if (!is_valid(intensity)) {
+  if (!success) {
     reflectance = 0.0; reflectance.invalidate();
     intensity   = 0.0; intensity.invalidate();
     weight      = 0.0;
     return false;
   }
 
+  double phase_angle;
+  reflectance = ComputeReflectance(cameraPosition,
+				   normal, base, local_model_params,
+				   global_params, phase_angle,
+                                   coeffs);
+  reflectance.validate();
 
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-			       dem, max_dem_height, gridx, gridy,
-			       geo);
+    // Use the shadow map if one was computed for this DEM and sun,
+    // and else march along the ray to the sun.
+    if (shadow == NULL)
+      shadow = g_shadow_cache.find(dem, local_model_params.sunPosition);
+    bool inShadow;
+    if (shadow != NULL)
+      inShadow = ((*shadow)(col, row) != 0);
+    else
+      inShadow = isInShadow(col, row, local_model_params.sunPosition,
+                            dem, max_dem_height, gridx, gridy,
+                            geo);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -1597,6 +1980,18 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
     }
     vw_out() << "Maximum DEM height: " << max_dem_height << std::endl;
   }
+
+  // Find all shadows at once, unless they are known already
+  ImageView<float> local_shadow;
+  ImageView<float> const* shadow = NULL;
+  if (model_shadows) {
+    shadow = g_shadow_cache.find(dem, model_params.sunPosition);
+    if (shadow == NULL) {
+      computeShadowMap(model_params.sunPosition, dem, gridx, gridy, geo,
+                       vw_settings().default_num_threads(), local_shadow);
+      shadow = &local_shadow;
+    }
+  }
   
   // Init the reflectance and intensity as invalid
   reflectance.set_size(dem.cols(), dem.rows());
@@ -1622,7 +2017,7 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
 				     crop_box, image, blend_weight, camera,
 				     reflectance(col, row), intensity(col, row),
                                      weight(col, row),
-                                     coeffs);
+                                     coeffs, shadow);
     }
   }
 
@@ -1651,6 +2046,62 @@ void interp_image(ImageView<double> const& coarse_image, double scale,
   }
 }
 
+// Form a coarser resolution image from a fine image, the same way the
+// coarse levels are made at the start. Write in place, as the values of
+// the coarse image are the parameters of an sfs problem.
+void restrict_image(ImageView<double> const& fine_image, double sub_scale,
+                    ImageView<double> & coarse_image){
+
+  ImageView<double> coarse = pixel_cast<double>(vw::resample_aa
+                                                (pixel_cast< PixelMask<double> >
+                                                 (fine_image), sub_scale));
+  if (coarse.cols() != coarse_image.cols() || coarse.rows() != coarse_image.rows())
+    vw_throw( LogicErr() << "restrict_image: Unexpected coarse image size.\n" );
+
+  for (int col = 0; col < coarse.cols(); col++) {
+    for (int row = 0; row < coarse.rows(); row++) {
+      coarse_image(col, row) = coarse(col, row);
+    }
+  }
+}
+
+// Add to a fine image the change made to a coarse image, interpolated
+// to the fine grid.
+void prolong_correction(ImageView<double> const& coarse_after,
+                        ImageView<double> const& coarse_before,
+                        double scale, ImageView<double> & fine_image){
+
+  ImageView<double> correction = coarse_after - coarse_before;
+  ImageView<double> fine_correction(fine_image.cols(), fine_image.rows());
+  interp_image(correction, scale, fine_correction);
+  for (int col = 0; col < fine_image.cols(); col++) {
+    for (int row = 0; row < fine_image.rows(); row++) {
+      fine_image(col, row) += fine_correction(col, row);
+    }
+  }
+}
+
+// Set the scale of the adjusted cameras, for the current level
+void set_camera_scale(Options const& opt, double scale,
+                      std::vector< std::vector<boost::shared_ptr<CameraModel> > > & cameras){
+
+  int num_dems = cameras.size();
+  int num_images = opt.input_images.size();
+  for (int image_iter = 0; image_iter < num_images; image_iter++) {
+    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+
+      if (opt.skip_images[dem_iter].find(image_iter) !=
+          opt.skip_images[dem_iter].end()) continue;
+
+      AdjustedCameraModel * adj_cam
+        = dynamic_cast<AdjustedCameraModel*>(cameras[dem_iter][image_iter].get());
+      if (adj_cam == NULL)
+        vw_throw( ArgumentErr() << "Expecting adjusted camera.\n");
+      adj_cam->set_scale(scale);
+    }
+  }
+}
+
 // A function to invoke at every iteration of ceres.
 // We need a lot of global variables to do something useful.
 int                                            g_iter = -1;
@@ -1674,6 +2125,7 @@ double                                       * g_gridy;
 int                                            g_level = -1;
 bool                                           g_final_iter = false;
 double                                       * g_coeffs; 
+asp::BackgroundWriter                        * g_writer = NULL;
 
 // When floating the camera position and orientation, multiply the
 // position variables by this factor times
@@ -1682,6 +2134,43 @@ double                                       * g_coeffs;
 // 1 meter than by a tiny fraction of one millimeter).
 double g_position_scale_factor = 1e+6;
 
+// An image of an iteration to save. It is a copy, so that it can be
+// written in the background while the solver changes the original.
+struct SfsOutputImage {
+  std::string               file;
+  ImageView<double>         image;
+  cartography::GeoReference georef;
+  double                    nodata;
+};
+
+void write_sfs_outputs(std::vector<SfsOutputImage> const& outputs,
+                       cartography::GdalWriteOptions const& opt) {
+  bool has_georef = true, has_nodata = true;
+  for (size_t i = 0; i < outputs.size(); i++) {
+    vw_out() << "Writing: " << outputs[i].file << std::endl;
+    TerminalProgressCallback tpc("asp", ": ");
+    block_write_gdal_image(outputs[i].file, outputs[i].image, has_georef, outputs[i].georef,
+                           has_nodata, outputs[i].nodata, opt, tpc);
+  }
+}
+
+// Write an image of an iteration now, or, with --save-in-background,
+// add it to those to write after the iteration.
+template <class ImageT>
+void add_sfs_output(std::vector<SfsOutputImage> & outputs, std::string const& file,
+                    ImageViewBase<ImageT> const& image,
+                    cartography::GeoReference const& georef, double nodata) {
+  SfsOutputImage output;
+  output.file   = file;
+  output.image  = copy(image);
+  output.georef = georef;
+  output.nodata = nodata;
+  if (g_writer->background())
+    outputs.push_back(output);
+  else
+    write_sfs_outputs(std::vector<SfsOutputImage>(1, output), *g_opt);
+}
+
 class SfsCallback: public ceres::IterationCallback {
 public:
   virtual ceres::CallbackReturnType operator()
@@ -1692,6 +2181,15 @@ public:
     vw_out() << "Finished iteration: " << g_iter << std::endl;
     callTop();
 
+    // The DEMs changed, so the shadows must be found again
+    if (g_opt->model_shadows)
+      g_shadow_cache.recompute(vw_settings().default_num_threads());
+
+    // No residuals are being evaluated now, so the approximate
+    // camera tables can grow if needed
+    if (g_opt->use_approx_camera_models)
+      grow_approx_camera_tables(*g_cameras);
+
     std::string exposure_file = exposure_file_name(g_opt->out_prefix);
     vw_out() << "Writing: " << exposure_file << std::endl;
     std::ofstream exf(exposure_file.c_str());
@@ -1721,6 +2219,7 @@ public:
     }
     vw_out() << std::endl;
 
+    std::vector<SfsOutputImage> outputs;
     int num_dems = (*g_dem).size();
     for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
       
@@ -1767,25 +2266,18 @@ public:
         fill(dem_nodata, *g_dem_nodata_val);
       }
         
-      bool has_georef = true, has_nodata = true;
-      TerminalProgressCallback tpc("asp", ": ");
       if ( !g_opt->save_sparingly || g_final_iter ) {
         std::string out_dem_file = g_opt->out_prefix + "-DEM"
           + iter_str + ".tif";
-        vw_out() << "Writing: " << out_dem_file << std::endl;
-        block_write_gdal_image(out_dem_file, (*g_dem)[dem_iter], has_georef, (*g_geo)[dem_iter],
-                               has_nodata, *g_dem_nodata_val,
-                               *g_opt, tpc);
+        add_sfs_output(outputs, out_dem_file, (*g_dem)[dem_iter], (*g_geo)[dem_iter],
+                       *g_dem_nodata_val);
       }
       
       if (!g_opt->save_sparingly || (g_final_iter && g_opt->float_albedo) ) {
         std::string out_albedo_file = g_opt->out_prefix + "-comp-albedo"
           + iter_str + ".tif";
-        vw_out() << "Writing: " << out_albedo_file << std::endl;
-        block_write_gdal_image(out_albedo_file, (*g_albedo)[dem_iter], has_georef,
-                               (*g_geo)[dem_iter],
-                               has_nodata, *g_dem_nodata_val,
-                               *g_opt, tpc);
+        add_sfs_output(outputs, out_albedo_file, (*g_albedo)[dem_iter], (*g_geo)[dem_iter],
+                       *g_dem_nodata_val);
       }
 
       // Print reflectance and other things
@@ -1872,35 +2364,26 @@ public:
         }
 
         std::string out_meas_intensity_file = iter_str2 + "-meas-intensity.tif";
-        vw_out() << "Writing: " << out_meas_intensity_file << std::endl;
-        block_write_gdal_image(out_meas_intensity_file,
-                               apply_mask(intensity, *g_img_nodata_val),
-                               has_georef, (*g_geo)[dem_iter], has_nodata,
-                               *g_img_nodata_val, *g_opt, tpc);
+        add_sfs_output(outputs, out_meas_intensity_file,
+                       apply_mask(intensity, *g_img_nodata_val),
+                       (*g_geo)[dem_iter], *g_img_nodata_val);
 	
 	std::string out_comp_intensity_file = iter_str2 + "-comp-intensity.tif";
-        vw_out() << "Writing: " << out_comp_intensity_file << std::endl;
-        block_write_gdal_image(out_comp_intensity_file,
-                               apply_mask(comp_intensity, *g_img_nodata_val),
-                               has_georef, (*g_geo)[dem_iter], has_nodata, *g_img_nodata_val,
-                               *g_opt, tpc);
+        add_sfs_output(outputs, out_comp_intensity_file,
+                       apply_mask(comp_intensity, *g_img_nodata_val),
+                       (*g_geo)[dem_iter], *g_img_nodata_val);
 
         if (g_opt->save_computed_intensity_only) 
           continue; // don't write too many things
 
 	std::string out_weight_file = iter_str2 + "-blending-weight.tif";
-        vw_out() << "Writing: " << out_weight_file << std::endl;
-        block_write_gdal_image(out_weight_file,
-                               blend_weight,
-                               has_georef, (*g_geo)[dem_iter], has_nodata, *g_img_nodata_val,
-                               *g_opt, tpc);
+        add_sfs_output(outputs, out_weight_file, blend_weight,
+                       (*g_geo)[dem_iter], *g_img_nodata_val);
 
 	std::string out_reflectance_file = iter_str2 + "-reflectance.tif";
-        vw_out() << "Writing: " << out_reflectance_file << std::endl;
-        block_write_gdal_image(out_reflectance_file,
-                               apply_mask(reflectance, *g_img_nodata_val),
-                               has_georef, (*g_geo)[dem_iter], has_nodata, *g_img_nodata_val,
-                               *g_opt, tpc);
+        add_sfs_output(outputs, out_reflectance_file,
+                       apply_mask(reflectance, *g_img_nodata_val),
+                       (*g_geo)[dem_iter], *g_img_nodata_val);
 
 
         // Find the measured normalized albedo, after correcting for
@@ -1917,9 +2400,7 @@ public:
           }
         }
 	std::string out_albedo_file = iter_str2 + "-meas-albedo.tif";
-        vw_out() << "Writing: " << out_albedo_file << std::endl;
-        block_write_gdal_image(out_albedo_file, measured_albedo,
-                               has_georef, (*g_geo)[dem_iter], has_nodata, 0, *g_opt, tpc);
+        add_sfs_output(outputs, out_albedo_file, measured_albedo, (*g_geo)[dem_iter], 0);
 
 
         double imgmean, imgstdev, refmean, refstdev;
@@ -1952,14 +2433,23 @@ public:
         if ( !g_opt->save_sparingly || g_final_iter ) {
           std::string out_dem_nodata_file = g_opt->out_prefix + "-DEM-nodata"
             + iter_str + ".tif";
-          vw_out() << "Writing: " << out_dem_nodata_file << std::endl;
-          TerminalProgressCallback tpc("asp", ": ");
-          block_write_gdal_image(out_dem_nodata_file, dem_nodata, has_georef, (*g_geo)[dem_iter],
-                                 has_nodata, *g_dem_nodata_val,
-                                 *g_opt, tpc);
+          add_sfs_output(outputs, out_dem_nodata_file, dem_nodata, (*g_geo)[dem_iter],
+                         *g_dem_nodata_val);
         }
       }
     }
+
+    // The images of an iteration are skipped if those of the previous
+    // one are still waiting to be written, but not the final ones.
+    if (outputs.empty())
+      return ceres::SOLVER_CONTINUE;
+    asp::BackgroundWriter::Job job = boost::bind(&write_sfs_outputs, outputs,
+                                                 cartography::GdalWriteOptions(*g_opt));
+    if (g_final_iter)
+      g_writer->add(job);
+    else if (!g_writer->try_add(job))
+      vw_out() << "The images of iteration " << g_iter << " are not saved, as those of "
+               << "the previous iteration are still being written.\n";
     
     return ceres::SOLVER_CONTINUE;
   }
@@ -1990,6 +2480,7 @@ public:
                             MaskedImgT                        const & m_image,          // alias
                             DoubleImgT                        const & m_blend_weight,   // alias
                             boost::shared_ptr<CameraModel>    const & m_camera,         // alias
+                            ProjectionCache                         & m_proj_cache,
                             F* residuals) {
     
     // Default residuals. Using here 0 rather than some big number tuned out to
@@ -2018,6 +2509,9 @@ public:
       adj_cam_copy.set_translation(translation);
       adj_cam_copy.set_axis_angle_rotation(axis_angle);
 
+      // Reuse the projection into the camera if the point and camera did not move
+      m_proj_cache.update_key(center[0], adjustments);
+
       PixelMask<double> reflectance, intensity;
       double weight;
       bool success =
@@ -2028,7 +2522,8 @@ public:
 				       m_gridx, m_gridy,
 				       m_model_params,  m_global_params,
 				       m_crop_box, m_image, m_blend_weight, &adj_cam_copy,
-				       reflectance, intensity, weight, coeffs);
+				       reflectance, intensity, weight, coeffs,
+				       NULL, &m_proj_cache);
       
       if (g_opt->unreliable_intensity_threshold > 0){
         if (is_valid(intensity) && intensity.child() <= g_opt->unreliable_intensity_threshold &&
@@ -2092,6 +2587,8 @@ struct IntensityError {
 		  const F* const coeffs, // Lunar lambertian model coeffs
                   F* residuals) const {
 
+    asp::numa_bind_current_thread(); // the first time in a solver thread
+
     return calc_residual(exposure, left, center, right, bottom,  top, albedo,
                          adjustments,  // camera adjustments
                          coeffs,  // Lunar lambertian model coeffs
@@ -2108,6 +2605,7 @@ struct IntensityError {
                          m_image,  // alias
                          m_blend_weight,  // alias
                          m_camera,  // alias
+                         m_proj_cache,
                          residuals);
   }
 
@@ -2150,6 +2648,7 @@ struct IntensityError {
   MaskedImgT                        const & m_image;          // alias
   DoubleImgT                        const & m_blend_weight;   // alias
   boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  mutable ProjectionCache                   m_proj_cache;
 };
 
 // A variation of IntensityError where albedo, dem, and model params are fixed.
@@ -2188,6 +2687,8 @@ struct IntensityErrorFixedMost {
 		  const F* const adjustments, // camera adjustments
                   F* residuals) const {
 
+    asp::numa_bind_current_thread(); // the first time in a solver thread
+
     return calc_residual(exposure,
                          &m_dem(m_col-1, m_row),            // left
                          &m_dem(m_col, m_row),              // center
@@ -2210,6 +2711,7 @@ struct IntensityErrorFixedMost {
                          m_image,  // alias
                          m_blend_weight,  // alias
                          m_camera,  // alias
+                         m_proj_cache,
                          residuals);
   }
 
@@ -2256,6 +2758,7 @@ struct IntensityErrorFixedMost {
   MaskedImgT                        const & m_image;          // alias
   DoubleImgT                        const & m_blend_weight;   // alias
   boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  mutable ProjectionCache                   m_proj_cache;
 };
 
 // The smoothness error is the sum of squares of
@@ -2286,10 +2789,10 @@ struct SmoothnessError {
 
       // Normalize by grid size seems to make the functional less
       // sensitive to the actual grid size used.
-      residuals[0] = (left[0] + right[0] - 2*center[0])/m_gridx/m_gridx;   // u_xx
+      residuals[0] = (left[0] + right[0] - 2.0*center[0])/m_gridx/m_gridx; // u_xx
       residuals[1] = (br[0] + tl[0] - bl[0] - tr[0] )/4.0/m_gridx/m_gridy; // u_xy
       residuals[2] = residuals[1];                                         // u_yx
-      residuals[3] = (bottom[0] + top[0] - 2*center[0])/m_gridy/m_gridy;   // u_yy
+      residuals[3] = (bottom[0] + top[0] - 2.0*center[0])/m_gridy/m_gridy; // u_yy
 
       for (int i = 0; i < 4; i++)
 	residuals[i] *= m_smoothness_weight;
@@ -2307,11 +2810,13 @@ struct SmoothnessError {
   }
 
   // Factory to hide the construction of the CostFunction object from
-  // the client code.
+  // the client code. The residuals are linear in the heights, so
+  // automatic differentiation gives the exact Jacobian, in one pass
+  // rather than in two evaluations per height.
   static ceres::CostFunction* Create(double smoothness_weight,
 				     double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<SmoothnessError,
-	    ceres::CENTRAL, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
+    return (new ceres::AutoDiffCostFunction<SmoothnessError,
+	    4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
 	    (new SmoothnessError(smoothness_weight, gridx, gridy)));
   }
 
@@ -2333,8 +2838,7 @@ struct HeightChangeError {
   // the client code.
   static ceres::CostFunction* Create(double orig_height,
 				     double initial_dem_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<HeightChangeError,
-	    ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<HeightChangeError, 1, 1>
 	    (new HeightChangeError(orig_height, initial_dem_constraint_weight)));
   }
 
@@ -2356,8 +2860,7 @@ struct AlbedoChangeError {
   // the client code.
   static ceres::CostFunction* Create(double initial_albedo,
 				     double albedo_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<AlbedoChangeError,
-	    ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<AlbedoChangeError, 1, 1>
 	    (new AlbedoChangeError(initial_albedo, albedo_constraint_weight)));
   }
 
@@ -2422,7 +2925,9 @@ void compute_grid_sizes_in_meters(ImageView<double> const& dem,
   if (!gridy_vec.empty()) gridy = gridy_vec[gridy_vec.size()/2];
 }
 
-ImageView<double> comp_blending_weights(MaskedImgT const& img,
+// The weights are in [0, 1], so float is precise enough for them, and
+// halves the memory they take, which is as much as for the images.
+ImageView<float> comp_blending_weights(MaskedImgT const& img,
                                         double blending_dist,
                                         double blending_power){
  
@@ -2437,7 +2942,7 @@ ImageView<double> comp_blending_weights(MaskedImgT const& img,
 //     return weights;
 //   }
   
-  ImageView<double> weights = grassfire(img);
+  ImageView<float> weights = grassfire(img);
 
   for (int col = 0; col < weights.cols(); col++) {
     for (int row = 0; row < weights.rows(); row++) {
@@ -2476,6 +2981,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Float the camera pose for each image, including the first one. Experimental.")
     ("model-shadows",   po::bool_switch(&opt.model_shadows)->default_value(false)->implicit_value(true),
      "Model the fact that some points on the DEM are in the shadow (occluded from the Sun).")
+    ("shadow-sun-angle-tol", po::value(&opt.shadow_sun_angle_tol)->default_value(0.0),
+     "With --model-shadows, let images whose Sun directions differ by no more than this angle, in degrees, share the same shadow map.")
     ("save-computed-intensity-only",   po::bool_switch(&opt.save_computed_intensity_only)->default_value(false)->implicit_value(true),
      "Do not run any optimization. Simply compute the intensity for a given DEM with exposures, camera positions, etc, coming from a previous SfS run. Useful with --model-shadows.")
     ("shadow-thresholds", po::value(&opt.shadow_thresholds)->default_value(""),
@@ -2499,6 +3006,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Solve the problem on a grid coarser than the original by a factor of 2 to this power, then refine the solution on finer grids.")
     ("max-coarse-iterations", po::value(&opt.max_coarse_iterations)->default_value(50),
      "How many iterations to do at levels of resolution coarser than the final result.")
+    ("multigrid-cycles", po::value(&opt.multigrid_cycles)->default_value(0),
+     "With --coarse-levels, after the first pass from the coarsest to the finest level, do this many more passes which bring the fine solution down to the coarse levels, and add back to it the corrections found there.")
     ("crop-input-images",   po::bool_switch(&opt.crop_input_images)->default_value(false)->implicit_value(true),
      "Crop the images to a region that was computed to be large enough, and keep them fully in memory, for speed.")
     ("use-blending-weights", po::bool_switch(&opt.use_blending_weights)->default_value(false)->implicit_value(true),
@@ -2525,12 +3034,18 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Do not float the DEM at all. Useful when floating the model params.")
     ("float-reflectance-model",   po::bool_switch(&opt.float_reflectance_model)->default_value(false)->implicit_value(true),
      "Allow the coefficients of the reflectance model to float (not recommended).")
+    ("matrix-free-solver",   po::bool_switch(&opt.matrix_free_solver)->default_value(false)->implicit_value(true),
+     "When only the DEM floats, find it with Gauss-Newton steps solved by preconditioned conjugate gradients, without forming the normal equations. Needs less memory than the default solver for large DEMs.")
     ("query",   po::bool_switch(&opt.query)->default_value(false)->implicit_value(true),
      "Print some info and exit. Invoked from parallel_sfs.")
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
+    ("save-in-background",   po::bool_switch(&opt.save_in_background)->default_value(false)->implicit_value(true),
+     "Write the images of each iteration in a background thread, from a copy of them, while the solver goes on. If those of the previous iteration are still waiting to be written then, the images of this iteration are skipped, other than the final ones.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
-     "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).");
+     "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).")
+    ("numa-affinity", po::value(&opt.numa_affinity)->default_value("none"),
+     "Pin the solver threads to the NUMA nodes (sockets). Options: none, spread (give the threads to the nodes in turn), compact (fill each node before the next).");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -2549,6 +3064,7 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 			    positional, positional_desc, usage,
 			     allow_unregistered, unregistered);
 
+  asp::set_numa_affinity(opt.numa_affinity);
 
   if (opt.float_all_cameras)
     opt.float_cameras = true;
@@ -2710,6 +3226,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw(ArgumentErr() << "Expecting the number of levels to be non-negative.\n");
   }
 
+  if (opt.multigrid_cycles < 0) {
+    vw_throw(ArgumentErr() << "Expecting the number of multigrid cycles to be non-negative.\n");
+  }
+
+  if (opt.shadow_sun_angle_tol < 0) {
+    vw_throw(ArgumentErr() << "Expecting a non-negative value for shadow-sun-angle-tol.\n");
+  }
+
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
@@ -2778,312 +3302,794 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   
 }
 
-// Run sfs at a given coarseness level
-void run_sfs_level(// Fixed inputs
-		   int num_iterations, Options & opt,
-		   std::vector<GeoReference> const& geo,
-		   double smoothness_weight,
-		   double dem_nodata_val,
-		   std::vector< std::vector<BBox2i>     > const& crop_boxes,
-		   std::vector< std::vector<MaskedImgT> > const& masked_images,
-		   std::vector< std::vector<DoubleImgT> > const& blend_weights,
-		   GlobalParams const& global_params,
-		   std::vector<ModelParams> const & model_params,
-		   std::vector< ImageView<double> > const& orig_dems, 
-		   double initial_albedo,
-		   // Quantities that will float
-		   std::vector< ImageView<double> > & dems,
-		   std::vector< ImageView<double> > & albedos,
-		   std::vector< std::vector<boost::shared_ptr<CameraModel> > > & cameras,
-		   std::vector<double> & exposures,
-		   std::vector<double> & adjustments,
-                   std::vector<double> & coeffs){
+// Helpers of the matrix-free solver of SfsLevel, for the heights alone,
+// with the albedo, exposures, cameras and reflectance model fixed. The
+// normal equations of each Gauss-Newton step are solved with
+// preconditioned conjugate gradients, applying J^T J to a vector with
+// the stencils of the residuals rather than forming it as a matrix.
+namespace {
+
+  // The offsets of the heights an intensity residual depends on, in the
+  // order of calc_residual(): left, center, right, bottom, top
+  const int INTENSITY_DCOL[5] = {-1, 0, 1, 0,  0};
+  const int INTENSITY_DROW[5] = { 0, 0, 0, 1, -1};
+  const int INTENSITY_BLOCK   = 15; // the upper triangle of a 5x5 matrix
+
+  // The index of (a, b) in the upper triangle of a 5x5 matrix, by rows
+  inline int sym5(int a, int b) {
+    if (a > b) std::swap(a, b);
+    return 5*a - a*(a - 1)/2 + (b - a);
+  }
 
-  int num_images = opt.input_images.size();
-  int num_dems   = dems.size();
-  ceres::Problem problem;
-  
-  // Find the grid sizes in meters. Note that dem heights are in
-  // meters too, so we treat both horizontal and vertical
-  // measurements in same units.
-  double gridx, gridy;
-  compute_grid_sizes_in_meters(dems[0], geo[0], dem_nodata_val, gridx, gridy);
-  vw_out() << "grid in x and y in meters: "
-	   << gridx << ' ' << gridy << std::endl;
-  g_gridx = &gridx;
-  g_gridy = &gridy;
-
-  std::vector<double> max_dem_height(num_dems, -std::numeric_limits<double>::max());
-  if (opt.model_shadows) {
-    // Find the max DEM height
-    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) { 
-      double curr_max_dem_height = -std::numeric_limits<double>::max();
-      for (int col = 0; col < dems[dem_iter].cols(); col++) {
-        for (int row = 0; row < dems[dem_iter].rows(); row++) {
-          if (dems[dem_iter](col, row) > curr_max_dem_height) {
-            curr_max_dem_height = dems[dem_iter](col, row);
+  // A residual of SmoothnessError, as a weighted sum of heights around
+  // a pixel. The mixed derivative appears twice.
+  struct SmoothnessTerm {
+    int    num;
+    int    dcol[4], drow[4];
+    double coeff[4];
+    double multiplicity;
+  };
+
+  std::vector<SmoothnessTerm> smoothness_terms(double weight, double gridx, double gridy) {
+    std::vector<SmoothnessTerm> terms(3);
+    double xx = weight/gridx/gridx, yy = weight/gridy/gridy, xy = weight/4.0/gridx/gridy;
+    SmoothnessTerm uxx = {3, {-1, 1, 0}, {0, 0, 0}, {xx, xx, -2*xx}, 1.0};
+    SmoothnessTerm uxy = {4, {1, -1, -1, 1}, {1, -1, 1, -1}, {xy, xy, -xy, -xy}, 2.0};
+    SmoothnessTerm uyy = {3, {0, 0, 0}, {1, -1, 0}, {yy, yy, -2*yy}, 1.0};
+    terms[0] = uxx; terms[1] = uxy; terms[2] = uyy;
+    return terms;
+  }
+
+  // For the smoothness residuals r = S h at the interior pixels, add
+  // S^T S v to normal, if not null, and the diagonal of S^T S to diag,
+  // if not null. Return half the sum of squares of S v.
+  double smoothness_pass(std::vector<SmoothnessTerm> const& terms,
+                         ImageView<double> const& v,
+                         ImageView<double> * normal, ImageView<double> * diag) {
+    double cost = 0.0;
+    for (int row = 1; row < v.rows() - 1; row++) {
+      for (int col = 1; col < v.cols() - 1; col++) {
+        for (size_t t = 0; t < terms.size(); t++) {
+          SmoothnessTerm const& term = terms[t];
+          double r = 0.0;
+          for (int k = 0; k < term.num; k++)
+            r += term.coeff[k]*v(col + term.dcol[k], row + term.drow[k]);
+          cost += 0.5*term.multiplicity*r*r;
+          for (int k = 0; k < term.num; k++) {
+            int c = col + term.dcol[k], rr = row + term.drow[k];
+            if (normal)
+              (*normal)(c, rr) += term.multiplicity*term.coeff[k]*r;
+            if (diag)
+              (*diag)(c, rr) += term.multiplicity*term.coeff[k]*term.coeff[k];
           }
         }
       }
-      max_dem_height[dem_iter] = curr_max_dem_height;
     }
+    return cost;
   }
-  g_max_dem_height = &max_dem_height;
 
-  // See if a given image is used in at least one clip or skipped in
-  // all of them
-  std::vector<bool> use_image(num_images, false);
-  int num_used = 0;
-  for (int image_iter = 0; image_iter < num_images; image_iter++) {
-    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
-      if (opt.skip_images[dem_iter].find(image_iter) == opt.skip_images[dem_iter].end()){
-        use_image[image_iter] = true;
-        num_used++;
+  // Add the product of the intensity blocks of J^T J with v to out
+  void apply_intensity_blocks(std::vector<double> const& blocks, ImageView<double> const& v,
+                              ImageView<double> & out) {
+    int cols = v.cols();
+    for (int row = 1; row < v.rows() - 1; row++) {
+      for (int col = 1; col < cols - 1; col++) {
+        const double * block = &blocks[(size_t(row)*cols + col)*INTENSITY_BLOCK];
+        double x[5];
+        for (int a = 0; a < 5; a++)
+          x[a] = v(col + INTENSITY_DCOL[a], row + INTENSITY_DROW[a]);
+        for (int a = 0; a < 5; a++) {
+          double y = 0.0;
+          for (int b = 0; b < 5; b++)
+            y += block[sym5(a, b)]*x[b];
+          out(col + INTENSITY_DCOL[a], row + INTENSITY_DROW[a]) += y;
+        }
       }
     }
   }
 
-  // When albedo, dem, model, are fixed, we will not even set these as variables.
-  bool fix_most = (!opt.float_albedo && opt.fix_dem && !opt.float_reflectance_model);
+  // The sum of the products of the values at the interior pixels
+  double interior_dot(ImageView<double> const& a, ImageView<double> const& b) {
+    double sum = 0.0;
+    for (int row = 1; row < a.rows() - 1; row++)
+      for (int col = 1; col < a.cols() - 1; col++)
+        sum += a(col, row)*b(col, row);
+    return sum;
+  }
+
+  void zero_boundary(ImageView<double> & v) {
+    for (int col = 0; col < v.cols(); col++) {
+      v(col, 0) = 0.0;
+      v(col, v.rows() - 1) = 0.0;
+    }
+    for (int row = 0; row < v.rows(); row++) {
+      v(0, row) = 0.0;
+      v(v.cols() - 1, row) = 0.0;
+    }
+  }
+
+  // Evaluate the intensity residuals of a band of rows, on a thread
+  template <class LevelT>
+  class IntensityBandTask: public vw::Task, private boost::noncopyable {
+    LevelT & m_level;
+    int m_dem_iter;
+    ImageView<double> const& m_heights;
+    int m_beg, m_end;
+    bool m_derivatives;
+    double & m_cost;
+  public:
+    IntensityBandTask(LevelT & level, int dem_iter, ImageView<double> const& heights,
+                      int beg, int end, bool derivatives, double & cost):
+      m_level(level), m_dem_iter(dem_iter), m_heights(heights),
+      m_beg(beg), m_end(end), m_derivatives(derivatives), m_cost(cost) {}
+    void operator()() {
+      asp::numa_bind_current_thread();
+      m_cost = m_level.evaluate_intensity_rows(m_dem_iter, m_heights, m_beg, m_end,
+                                               m_derivatives);
+    }
+  };
+
+} // end anonymous namespace
 
-  std::set<int> use_dem, use_albedo; // to avoid a crash in Ceres when a param is fixed but not set
+// The sfs problem at a given coarseness level. It is set up once, and
+// can then be solved repeatedly, as with the multigrid cycles, while
+// the floating quantities change in place between solves.
+class SfsLevel: private boost::noncopyable {
+public:
+  SfsLevel(// Fixed inputs
+           Options & opt,
+           std::vector<GeoReference> const& geo,
+           double smoothness_weight,
+           double dem_nodata_val,
+           std::vector< std::vector<BBox2i>     > const& crop_boxes,
+           std::vector< std::vector<MaskedImgT> > const& masked_images,
+           std::vector< std::vector<DoubleImgT> > const& blend_weights,
+           GlobalParams const& global_params,
+           std::vector<ModelParams> const & model_params,
+           std::vector< ImageView<double> > const& orig_dems,
+           double initial_albedo,
+           // Quantities that will float
+           std::vector< ImageView<double> > & dems,
+           std::vector< ImageView<double> > & albedos,
+           std::vector< std::vector<boost::shared_ptr<CameraModel> > > & cameras,
+           std::vector<double> & exposures,
+           std::vector<double> & adjustments,
+           std::vector<double> & coeffs):
+    m_opt(opt), m_geo(geo), m_crop_boxes(crop_boxes), m_masked_images(masked_images),
+    m_blend_weights(blend_weights), m_global_params(global_params),
+    m_model_params(model_params), m_dems(dems), m_albedos(albedos),
+    m_cameras(cameras), m_exposures(exposures), m_adjustments(adjustments), m_coeffs(coeffs),
+    m_num_images(opt.input_images.size()), m_num_dems(dems.size()),
+    m_max_dem_height(dems.size(), -std::numeric_limits<double>::max()),
+    m_smoothness_weight(smoothness_weight), m_matrix_free(false) {
+
+    // Find the grid sizes in meters. Note that dem heights are in
+    // meters too, so we treat both horizontal and vertical
+    // measurements in same units.
+    compute_grid_sizes_in_meters(m_dems[0], m_geo[0], dem_nodata_val, m_gridx, m_gridy);
+    vw_out() << "grid in x and y in meters: "
+             << m_gridx << ' ' << m_gridy << std::endl;
+
+    // See if a given image is used in at least one clip or skipped in
+    // all of them
+    std::vector<bool> use_image(m_num_images, false);
+    int num_used = 0;
+    for (int image_iter = 0; image_iter < m_num_images; image_iter++) {
+      for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
+        if (m_opt.skip_images[dem_iter].find(image_iter) == m_opt.skip_images[dem_iter].end()){
+          use_image[image_iter] = true;
+          num_used++;
+        }
+      }
+    }
+
+    // When albedo, dem, model, are fixed, we will not even set these as variables.
+    bool fix_most = (!m_opt.float_albedo && m_opt.fix_dem && !m_opt.float_reflectance_model);
+
+    // When only the heights float, the matrix-free solver can be used,
+    // and then no Ceres problem is made.
+    m_matrix_free = (m_opt.matrix_free_solver && !m_opt.fix_dem && !m_opt.float_albedo &&
+                     !m_opt.float_exposure && !m_opt.float_cameras &&
+                     !m_opt.float_reflectance_model && !m_opt.float_dem_at_boundary);
+    if (m_opt.matrix_free_solver && !m_matrix_free)
+      vw_out() << "The matrix-free solver floats only the heights, with the DEM boundary "
+               << "fixed. Using Ceres instead.\n";
+    if (m_matrix_free) {
+      m_used_images.resize(m_num_dems);
+      m_orig_dems.resize(m_num_dems);
+      for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
+        for (int image_iter = 0; image_iter < m_num_images; image_iter++) {
+          if (m_opt.skip_images[dem_iter].find(image_iter) == m_opt.skip_images[dem_iter].end())
+            m_used_images[dem_iter].push_back(image_iter);
+        }
+        if (m_opt.initial_dem_constraint_weight > 0)
+          m_orig_dems[dem_iter] = copy(orig_dems[dem_iter]);
+      }
+      return;
+    }
+
+    std::set<int> use_dem, use_albedo; // to avoid a crash in Ceres when a param is fixed but not set
   
-  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
     
-    // Add a residual block for every grid point not at the boundary
-    for (int col = 1; col < dems[dem_iter].cols()-1; col++) {
-      for (int row = 1; row < dems[dem_iter].rows()-1; row++) {
+      // Add a residual block for every grid point not at the boundary
+      for (int col = 1; col < m_dems[dem_iter].cols()-1; col++) {
+        for (int row = 1; row < m_dems[dem_iter].rows()-1; row++) {
 
-        // Intensity error for each image
-        for (int image_iter = 0; image_iter < num_images; image_iter++) {
+          // Intensity error for each image
+          for (int image_iter = 0; image_iter < m_num_images; image_iter++) {
 
-          if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end()) {
-            continue;
-          }
+            if (m_opt.skip_images[dem_iter].find(image_iter) != m_opt.skip_images[dem_iter].end()) {
+              continue;
+            }
         
-          ceres::LossFunction* loss_function_img = NULL;
-          if (!fix_most) {
-            ceres::CostFunction* cost_function_img =
-              IntensityError::Create(col, row, dems[dem_iter], geo[dem_iter],
-                                     opt.model_shadows,
-                                     opt.camera_position_step_size,
-                                     max_dem_height[dem_iter],
-                                     gridx, gridy,
-                                     global_params, model_params[image_iter],
-                                     crop_boxes[dem_iter][image_iter],
-                                     masked_images[dem_iter][image_iter],
-                                     blend_weights[dem_iter][image_iter],
-                                     cameras[dem_iter][image_iter]);
-            problem.AddResidualBlock(cost_function_img, loss_function_img,
-                                     &exposures[image_iter],      // exposure
-                                     &dems[dem_iter](col-1, row),            // left
-                                     &dems[dem_iter](col, row),              // center
-                                     &dems[dem_iter](col+1, row),            // right
-                                     &dems[dem_iter](col, row+1),            // bottom
-                                     &dems[dem_iter](col, row-1),            // top
-                                     &albedos[dem_iter](col, row),           // albedo
-                                     &adjustments[6*image_iter],  // camera
-                                     &coeffs[0]);                 // reflectance model coeffs
-            use_dem.insert(dem_iter); 
-            use_albedo.insert(dem_iter);
-          }else{
-            ceres::CostFunction* cost_function_img =
-              IntensityErrorFixedMost::Create(col, row, dems[dem_iter],
-                                              albedos[dem_iter](col, row), // albedo
-                                              &coeffs[0],                  // reflectance model coeffs
-                                              geo[dem_iter],
-                                              opt.model_shadows,
-                                              opt.camera_position_step_size,
-                                              max_dem_height[dem_iter],
-                                              gridx, gridy,
-                                              global_params, model_params[image_iter],
-                                              crop_boxes[dem_iter][image_iter],
-                                              masked_images[dem_iter][image_iter],
-                                              blend_weights[dem_iter][image_iter],
-                                              cameras[dem_iter][image_iter]);
-            problem.AddResidualBlock(cost_function_img, loss_function_img,
-                                     &exposures[image_iter],      // exposure
-                                     &adjustments[6*image_iter]  // camera
-                                     );
+            ceres::LossFunction* loss_function_img = NULL;
+            if (!fix_most) {
+              ceres::CostFunction* cost_function_img =
+                IntensityError::Create(col, row, m_dems[dem_iter], m_geo[dem_iter],
+                                       m_opt.model_shadows,
+                                       m_opt.camera_position_step_size,
+                                       m_max_dem_height[dem_iter],
+                                       m_gridx, m_gridy,
+                                       m_global_params, m_model_params[image_iter],
+                                       m_crop_boxes[dem_iter][image_iter],
+                                       m_masked_images[dem_iter][image_iter],
+                                       m_blend_weights[dem_iter][image_iter],
+                                       m_cameras[dem_iter][image_iter]);
+              m_problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                       &m_exposures[image_iter],      // exposure
+                                       &m_dems[dem_iter](col-1, row),            // left
+                                       &m_dems[dem_iter](col, row),              // center
+                                       &m_dems[dem_iter](col+1, row),            // right
+                                       &m_dems[dem_iter](col, row+1),            // bottom
+                                       &m_dems[dem_iter](col, row-1),            // top
+                                       &m_albedos[dem_iter](col, row),           // albedo
+                                       &m_adjustments[6*image_iter],  // camera
+                                       &m_coeffs[0]);                 // reflectance model m_coeffs
+              use_dem.insert(dem_iter); 
+              use_albedo.insert(dem_iter);
+            }else{
+              ceres::CostFunction* cost_function_img =
+                IntensityErrorFixedMost::Create(col, row, m_dems[dem_iter],
+                                                m_albedos[dem_iter](col, row), // albedo
+                                                &m_coeffs[0],                  // reflectance model m_coeffs
+                                                m_geo[dem_iter],
+                                                m_opt.model_shadows,
+                                                m_opt.camera_position_step_size,
+                                                m_max_dem_height[dem_iter],
+                                                m_gridx, m_gridy,
+                                                m_global_params, m_model_params[image_iter],
+                                                m_crop_boxes[dem_iter][image_iter],
+                                                m_masked_images[dem_iter][image_iter],
+                                                m_blend_weights[dem_iter][image_iter],
+                                                m_cameras[dem_iter][image_iter]);
+              m_problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                       &m_exposures[image_iter],      // exposure
+                                       &m_adjustments[6*image_iter]  // camera
+                                       );
             
-          }
-        } // end iterating over images
+            }
+          } // end iterating over images
 
-        if (!fix_most) {
-          // Smoothness penalty
-          ceres::LossFunction* loss_function_sm = NULL;
-          ceres::CostFunction* cost_function_sm =
-            SmoothnessError::Create(smoothness_weight, gridx, gridy);
-          problem.AddResidualBlock(cost_function_sm, loss_function_sm,
-                                   &dems[dem_iter](col-1, row+1), &dems[dem_iter](col, row+1),
-                                   &dems[dem_iter](col+1, row+1),
-                                   &dems[dem_iter](col-1, row  ), &dems[dem_iter](col, row  ),
-                                   &dems[dem_iter](col+1, row  ),
-                                   &dems[dem_iter](col-1, row-1), &dems[dem_iter](col, row-1),
-                                   &dems[dem_iter](col+1, row-1));
-          use_dem.insert(dem_iter); 
-          
-          // Deviation from prescribed height constraint
-          if (opt.initial_dem_constraint_weight > 0) {
-            ceres::LossFunction* loss_function_hc = NULL;
-            ceres::CostFunction* cost_function_hc =
-              HeightChangeError::Create(orig_dems[dem_iter](col, row),
-                                        opt.initial_dem_constraint_weight);
-            problem.AddResidualBlock(cost_function_hc, loss_function_hc,
-                                     &dems[dem_iter](col, row));
+          if (!fix_most) {
+            // Smoothness penalty
+            ceres::LossFunction* loss_function_sm = NULL;
+            ceres::CostFunction* cost_function_sm =
+              SmoothnessError::Create(smoothness_weight, m_gridx, m_gridy);
+            m_problem.AddResidualBlock(cost_function_sm, loss_function_sm,
+                                     &m_dems[dem_iter](col-1, row+1), &m_dems[dem_iter](col, row+1),
+                                     &m_dems[dem_iter](col+1, row+1),
+                                     &m_dems[dem_iter](col-1, row  ), &m_dems[dem_iter](col, row  ),
+                                     &m_dems[dem_iter](col+1, row  ),
+                                     &m_dems[dem_iter](col-1, row-1), &m_dems[dem_iter](col, row-1),
+                                     &m_dems[dem_iter](col+1, row-1));
             use_dem.insert(dem_iter); 
-          }
           
-          // Deviation from prescribed albedo
-          if (opt.float_albedo > 0 && opt.albedo_constraint_weight > 0) {
-            ceres::LossFunction* loss_function_hc = NULL;
-            ceres::CostFunction* cost_function_hc =
-              AlbedoChangeError::Create(initial_albedo,
-                                        opt.albedo_constraint_weight);
-            problem.AddResidualBlock(cost_function_hc, loss_function_hc,
-                                     &albedos[dem_iter](col, row));
-            use_albedo.insert(dem_iter);
+            // Deviation from prescribed height constraint
+            if (m_opt.initial_dem_constraint_weight > 0) {
+              ceres::LossFunction* loss_function_hc = NULL;
+              ceres::CostFunction* cost_function_hc =
+                HeightChangeError::Create(orig_dems[dem_iter](col, row),
+                                          m_opt.initial_dem_constraint_weight);
+              m_problem.AddResidualBlock(cost_function_hc, loss_function_hc,
+                                       &m_dems[dem_iter](col, row));
+              use_dem.insert(dem_iter); 
+            }
+          
+            // Deviation from prescribed albedo
+            if (m_opt.float_albedo > 0 && m_opt.albedo_constraint_weight > 0) {
+              ceres::LossFunction* loss_function_hc = NULL;
+              ceres::CostFunction* cost_function_hc =
+                AlbedoChangeError::Create(initial_albedo,
+                                          m_opt.albedo_constraint_weight);
+              m_problem.AddResidualBlock(cost_function_hc, loss_function_hc,
+                                       &m_albedos[dem_iter](col, row));
+              use_albedo.insert(dem_iter);
+            }
           }
-        }
         
-      } // end row iter
-    } // end col iter
+        } // end row iter
+      } // end col iter
     
-    // DEM at the boundary must be fixed.
-    if (!fix_most) {
-      if (!opt.float_dem_at_boundary) {
-        for (int col = 0; col < dems[dem_iter].cols(); col++) {
-          for (int row = 0; row < dems[dem_iter].rows(); row++) {
-            if (col == 0 || col == dems[dem_iter].cols() - 1 ||
-                row == 0 || row == dems[dem_iter].rows() - 1 ) {
+      // DEM at the boundary must be fixed.
+      if (!fix_most) {
+        if (!m_opt.float_dem_at_boundary) {
+          for (int col = 0; col < m_dems[dem_iter].cols(); col++) {
+            for (int row = 0; row < m_dems[dem_iter].rows(); row++) {
+              if (col == 0 || col == m_dems[dem_iter].cols() - 1 ||
+                  row == 0 || row == m_dems[dem_iter].rows() - 1 ) {
+                if (use_dem.find(dem_iter) != use_dem.end())
+                  m_problem.SetParameterBlockConstant(&m_dems[dem_iter](col, row));
+              }
+            }
+          }
+        }
+
+        if (m_opt.fix_dem) {
+          for (int col = 0; col < m_dems[dem_iter].cols(); col++) {
+            for (int row = 0; row < m_dems[dem_iter].rows(); row++) {
               if (use_dem.find(dem_iter) != use_dem.end())
-                problem.SetParameterBlockConstant(&dems[dem_iter](col, row));
+                m_problem.SetParameterBlockConstant(&m_dems[dem_iter](col, row));
             }
           }
         }
       }
+    
+      if (m_opt.initial_dem_constraint_weight <= 0 && num_used <= 1) {    
+
+        if (m_opt.float_albedo && m_opt.albedo_constraint_weight <= 0) {
+          vw_out() << "No DEM or albedo constraint is used, and there is at most one "
+                   << "usable image. Fixing the albedo.\n";
+          m_opt.float_albedo = false;
+        }
 
-      if (opt.fix_dem) {
-        for (int col = 0; col < dems[dem_iter].cols(); col++) {
-          for (int row = 0; row < dems[dem_iter].rows(); row++) {
-            if (use_dem.find(dem_iter) != use_dem.end())
-              problem.SetParameterBlockConstant(&dems[dem_iter](col, row));
+        if (m_opt.float_exposure) {
+          vw_out() << "No DEM constraint is used, and there is at most one "
+                   << "usable image. Fixing the exposure.\n";
+          m_opt.float_exposure = false;
+        }
+      }
+    
+      // If to float the albedo
+      if (!fix_most) {
+        for (int col = 1; col < m_dems[dem_iter].cols() - 1; col++) {
+          for (int row = 1; row < m_dems[dem_iter].rows() - 1; row++) {
+            if (!m_opt.float_albedo && num_used > 0 && use_albedo.find(dem_iter) != use_albedo.end())
+              m_problem.SetParameterBlockConstant(&m_albedos[dem_iter](col, row));
           }
         }
       }
+    } // end iterating over DEMs
+
+    // If there's just one image, don't float the exposure, as the
+    // problem is under-determined. If we float the albedo, we will
+    // implicitly float the exposure, hence keep the exposure itself
+    // fixed.
+    if (!m_opt.float_exposure){
+      for (int image_iter = 0; image_iter < m_num_images; image_iter++) {
+        if (use_image[image_iter]) m_problem.SetParameterBlockConstant(&m_exposures[image_iter]);
+      }
     }
+  
+    if (!m_opt.float_cameras) {
+      vw_out() << "Not floating m_cameras." << std::endl;
+      for (int image_iter = 0; image_iter < m_num_images; image_iter++){
+        if (use_image[image_iter]){
+          m_problem.SetParameterBlockConstant(&m_adjustments[6*image_iter]);
+        }
+      }
+    }else if (!m_opt.float_all_cameras){
+      // Fix the first camera, let the other ones conform to it.
+      // TODO: This needs further study.
+      vw_out() << "Floating all m_cameras sans the first one." << std::endl;
+      int image_iter = 0;
+      if (use_image[image_iter]){
+        m_problem.SetParameterBlockConstant(&m_adjustments[6*image_iter]);
+      }
     
-    if (opt.initial_dem_constraint_weight <= 0 && num_used <= 1) {    
-
-      if (opt.float_albedo && opt.albedo_constraint_weight <= 0) {
-        vw_out() << "No DEM or albedo constraint is used, and there is at most one "
-                 << "usable image. Fixing the albedo.\n";
-        opt.float_albedo = false;
+    }else{
+      vw_out() << "Floating all m_cameras, including the first one." << std::endl;
+    }
+  
+  
+    // If to float the reflectance model coefficients
+    if (!fix_most) {
+      if (!m_opt.float_reflectance_model && num_used > 0) {
+        m_problem.SetParameterBlockConstant(&m_coeffs[0]);
       }
+    }
+  }
 
-      if (opt.float_exposure) {
-        vw_out() << "No DEM constraint is used, and there is at most one "
-                 << "usable image. Fixing the exposure.\n";
-        opt.float_exposure = false;
+  /// Do the given number of iterations, starting from the current values
+  /// of the floating quantities.
+  void solve(int num_iterations) {
+
+    g_gridx = &m_gridx;
+    g_gridy = &m_gridy;
+
+    // The residuals refer to these by alias, so update them in place
+    if (m_opt.model_shadows) {
+      // Find the max DEM height
+      for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
+        double curr_max_dem_height = -std::numeric_limits<double>::max();
+        for (int col = 0; col < m_dems[dem_iter].cols(); col++) {
+          for (int row = 0; row < m_dems[dem_iter].rows(); row++) {
+            if (m_dems[dem_iter](col, row) > curr_max_dem_height) {
+              curr_max_dem_height = m_dems[dem_iter](col, row);
+            }
+          }
+        }
+        m_max_dem_height[dem_iter] = curr_max_dem_height;
       }
     }
-    
-    // If to float the albedo
-    if (!fix_most) {
-      for (int col = 1; col < dems[dem_iter].cols() - 1; col++) {
-        for (int row = 1; row < dems[dem_iter].rows() - 1; row++) {
-          if (!opt.float_albedo && num_used > 0 && use_albedo.find(dem_iter) != use_albedo.end())
-            problem.SetParameterBlockConstant(&albedos[dem_iter](col, row));
+    g_max_dem_height = &m_max_dem_height;
+
+    // The DEM grid points in ECEF, up to the heights
+    g_dem_geometry.clear();
+    for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++)
+      g_dem_geometry.add(m_dems[dem_iter], m_geo[dem_iter]);
+
+    // Find the shadows for each DEM and image. They will be kept fixed
+    // while the residuals are evaluated, and updated after each iteration.
+    g_shadow_cache.clear(m_opt.shadow_sun_angle_tol);
+    if (m_opt.model_shadows) {
+      for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
+        for (int image_iter = 0; image_iter < m_num_images; image_iter++) {
+          if (m_opt.skip_images[dem_iter].find(image_iter) != m_opt.skip_images[dem_iter].end())
+            continue;
+          g_shadow_cache.add(m_dems[dem_iter], m_gridx, m_gridy, m_geo[dem_iter],
+                             m_model_params[image_iter].sunPosition,
+                             vw_settings().default_num_threads());
         }
       }
     }
-  } // end iterating over DEMs
 
-  // If there's just one image, don't float the exposure, as the
-  // problem is under-determined. If we float the albedo, we will
-  // implicitly float the exposure, hence keep the exposure itself
-  // fixed.
-  if (!opt.float_exposure){
-    for (int image_iter = 0; image_iter < num_images; image_iter++) {
-      if (use_image[image_iter]) problem.SetParameterBlockConstant(&exposures[image_iter]);
+    if (m_opt.num_threads > 1 && !m_opt.use_approx_camera_models) {
+      vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
+      m_opt.num_threads = 1;
     }
+    vw_out() << "Using: " << m_opt.num_threads << " threads.\n";
+
+    ceres::Solver::Options options;
+    options.gradient_tolerance = 1e-16;
+    options.function_tolerance = 1e-16;
+    options.max_num_iterations = num_iterations;
+    options.minimizer_progress_to_stdout = 1;
+    options.num_threads = m_opt.num_threads;
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+
+    // Use a callback function at every iteration
+    SfsCallback callback;
+    options.callbacks.push_back(&callback);
+    options.update_state_every_iteration = true;
+
+    // A bunch of global variables to use in the callback
+    g_opt            = &m_opt;
+    g_dem            = &m_dems;
+    g_albedo         = &m_albedos;
+    g_geo            = &m_geo;
+    g_global_params  = &m_global_params;
+    g_model_params   = &m_model_params;
+    g_crop_boxes     = &m_crop_boxes;
+    g_masked_images  = &m_masked_images;
+    g_blend_weights  = &m_blend_weights;
+    g_cameras        = &m_cameras;
+    g_iter           = -1; // reset the iterations for each level
+    g_final_iter     = false;
+
+    // Solve the problem if asked to do iterations. Otherwise
+    // just keep the DEM at the initial guess, while saving
+    // all the output data as if iterations happened.
+    ceres::Solver::Summary summary;
+    if (m_matrix_free)
+      solve_heights(num_iterations, callback);
+    else if (options.max_num_iterations > 0)
+      ceres::Solve(options, &m_problem, &summary);
+
+    // Save the final results
+    g_final_iter = true;
+    ceres::IterationSummary callback_summary;
+    callback(callback_summary);
+
+    // The cached shadows and geometry point to this level's DEMs
+    g_shadow_cache.clear(m_opt.shadow_sun_angle_tol);
+    g_dem_geometry.clear();
+
+    if (!m_matrix_free)
+      vw_out() << summary.FullReport() << "\n" << std::endl;
   }
-  
-  if (!opt.float_cameras) {
-    vw_out() << "Not floating cameras." << std::endl;
-    for (int image_iter = 0; image_iter < num_images; image_iter++){
-      if (use_image[image_iter]){
-        problem.SetParameterBlockConstant(&adjustments[6*image_iter]);
+
+  /// Half the sum of squares of the intensity residuals of the given
+  /// rows of a DEM, with the heights given. With derivatives, also find
+  /// at each pixel the block of J^T J and the products J^T r for the
+  /// heights the residuals there depend on, by central differences, as
+  /// Ceres does for IntensityError.
+  double evaluate_intensity_rows(int dem_iter, ImageView<double> const& heights,
+                                 int beg_row, int end_row, bool derivatives) {
+    int cols = heights.cols();
+    double cost = 0.0;
+    for (int row = beg_row; row < end_row; row++) {
+      for (int col = 1; col < cols - 1; col++) {
+        double * block = NULL, * jtr = NULL;
+        if (derivatives) {
+          block = &m_jtj[dem_iter][(size_t(row)*cols + col)*INTENSITY_BLOCK];
+          jtr   = &m_jtr[dem_iter][(size_t(row)*cols + col)*5];
+          std::fill(block, block + INTENSITY_BLOCK, 0.0);
+          std::fill(jtr, jtr + 5, 0.0);
+        }
+        double h[5];
+        for (int a = 0; a < 5; a++)
+          h[a] = heights(col + INTENSITY_DCOL[a], row + INTENSITY_DROW[a]);
+
+        for (size_t k = 0; k < m_used_images[dem_iter].size(); k++) {
+          int image_iter = m_used_images[dem_iter][k];
+          ProjectionCache cache;
+          double r = intensity_residual(dem_iter, image_iter, col, row, h, cache);
+          cost += 0.5*r*r;
+          if (!derivatives)
+            continue;
+
+          // The center last, so that the projection is reused for the neighbors
+          const int order[5] = {0, 2, 3, 4, 1};
+          double j[5];
+          for (int i = 0; i < 5; i++) {
+            int a = order[i];
+            double step = 1e-6*(h[a] != 0.0 ? std::abs(h[a]) : 1.0);
+            double hp[5], hm[5];
+            std::copy(h, h + 5, hp);
+            std::copy(h, h + 5, hm);
+            hp[a] += step;
+            hm[a] -= step;
+            j[a] = (intensity_residual(dem_iter, image_iter, col, row, hp, cache) -
+                    intensity_residual(dem_iter, image_iter, col, row, hm, cache))/(2.0*step);
+          }
+          for (int a = 0; a < 5; a++) {
+            jtr[a] += j[a]*r;
+            for (int b = a; b < 5; b++)
+              block[sym5(a, b)] += j[a]*j[b];
+          }
+        }
       }
     }
-  }else if (!opt.float_all_cameras){
-    // Fix the first camera, let the other ones conform to it.
-    // TODO: This needs further study.
-    vw_out() << "Floating all cameras sans the first one." << std::endl;
-    int image_iter = 0;
-    if (use_image[image_iter]){
-      problem.SetParameterBlockConstant(&adjustments[6*image_iter]);
+    return cost;
+  }
+
+private:
+
+  double intensity_residual(int dem_iter, int image_iter, int col, int row,
+                            const double h[5], ProjectionCache & cache) const {
+    double residual = 0.0;
+    calc_residual(&m_exposures[image_iter], &h[0], &h[1], &h[2], &h[3], &h[4],
+                  &m_albedos[dem_iter](col, row), &m_adjustments[6*image_iter], &m_coeffs[0],
+                  col, row, m_dems[dem_iter], m_geo[dem_iter], m_opt.model_shadows,
+                  m_opt.camera_position_step_size, m_max_dem_height[dem_iter],
+                  m_gridx, m_gridy, m_global_params, m_model_params[image_iter],
+                  m_crop_boxes[dem_iter][image_iter], m_masked_images[dem_iter][image_iter],
+                  m_blend_weights[dem_iter][image_iter], m_cameras[dem_iter][image_iter],
+                  cache, &residual);
+    return residual;
+  }
+
+  /// The intensity cost of a DEM with the given heights, with the rows
+  /// split among threads
+  double evaluate_intensity(int dem_iter, ImageView<double> const& heights, bool derivatives) {
+    int num_rows    = heights.rows() - 2;
+    int num_threads = (m_opt.num_threads > 0) ? m_opt.num_threads
+                                              : vw_settings().default_num_threads();
+    int num_bands   = std::max(1, std::min(4*num_threads, num_rows));
+    std::vector<double> costs(num_bands, 0.0);
+    FifoWorkQueue queue(num_threads);
+    for (int band = 0; band < num_bands; band++) {
+      int beg = 1 + (long long)num_rows*band/num_bands;
+      int end = 1 + (long long)num_rows*(band + 1)/num_bands;
+      if (beg >= end)
+        continue;
+      boost::shared_ptr< IntensityBandTask<SfsLevel> >
+        task(new IntensityBandTask<SfsLevel>(*this, dem_iter, heights, beg, end,
+                                             derivatives, costs[band]));
+      queue.add_task(task);
     }
-    
-  }else{
-    vw_out() << "Floating all cameras, including the first one." << std::endl;
+    queue.join_all();
+
+    double cost = 0.0;
+    for (int band = 0; band < num_bands; band++)
+      cost += costs[band];
+    return cost;
   }
-  
-  
-  // If to float the reflectance model coefficients
-  if (!fix_most) {
-    if (!opt.float_reflectance_model && num_used > 0) {
-      problem.SetParameterBlockConstant(&coeffs[0]);
+
+  /// The cost of a DEM with the given heights. With a gradient, also
+  /// find the derivatives, and the gradient at the interior pixels.
+  double evaluate_cost(int dem_iter, ImageView<double> const& heights,
+                       std::vector<SmoothnessTerm> const& terms,
+                       ImageView<double> * gradient) {
+    double cost = evaluate_intensity(dem_iter, heights, gradient != NULL);
+    if (gradient)
+      fill(*gradient, 0.0);
+    cost += smoothness_pass(terms, heights, gradient, NULL);
+
+    int cols = heights.cols();
+    double w = m_opt.initial_dem_constraint_weight;
+    for (int row = 1; row < heights.rows() - 1; row++) {
+      for (int col = 1; col < cols - 1; col++) {
+        if (w > 0) {
+          double d = heights(col, row) - m_orig_dems[dem_iter](col, row);
+          cost += 0.5*w*w*d*d;
+          if (gradient)
+            (*gradient)(col, row) += w*w*d;
+        }
+        if (gradient) {
+          const double * jtr = &m_jtr[dem_iter][(size_t(row)*cols + col)*5];
+          for (int a = 0; a < 5; a++)
+            (*gradient)(col + INTENSITY_DCOL[a], row + INTENSITY_DROW[a]) += jtr[a];
+        }
+      }
     }
+    if (gradient)
+      zero_boundary(*gradient);
+    return cost;
   }
-  
-  if (opt.num_threads > 1 && !opt.use_approx_camera_models) {
-    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
-    opt.num_threads = 1;
-  }
-  vw_out() << "Using: " << opt.num_threads << " threads.\n";
-
-  ceres::Solver::Options options;
-  options.gradient_tolerance = 1e-16;
-  options.function_tolerance = 1e-16;
-  options.max_num_iterations = num_iterations;
-  options.minimizer_progress_to_stdout = 1;
-  options.num_threads = opt.num_threads;
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-
-  // Use a callback function at every iteration
-  SfsCallback callback;
-  options.callbacks.push_back(&callback);
-  options.update_state_every_iteration = true;
-
-  // A bunch of global variables to use in the callback
-  g_opt            = &opt;
-  g_dem            = &dems;
-  g_albedo         = &albedos;
-  g_geo            = &geo;
-  g_global_params  = &global_params;
-  g_model_params   = &model_params;
-  g_crop_boxes     = &crop_boxes;
-  g_masked_images  = &masked_images;
-  g_blend_weights  = &blend_weights;
-  g_cameras        = &cameras;
-  g_iter           = -1; // reset the iterations for each level
-  g_final_iter     = false;
-
-  // Solve the problem if asked to do iterations. Otherwise
-  // just keep the DEM at the initial guess, while saving
-  // all the output data as if iterations happened.
-  ceres::Solver::Summary summary;
-  if (options.max_num_iterations > 0)
-    ceres::Solve(options, &problem, &summary);
-
-  // Save the final results
-  g_final_iter = true;
-  ceres::IterationSummary callback_summary;
-  callback(callback_summary);
-  
-  vw_out() << summary.FullReport() << "\n" << std::endl;
-}
+
+  /// Solve (J^T J + mu D) delta = -gradient at the interior pixels, with
+  /// D the diagonal of J^T J, by conjugate gradients preconditioned
+  /// with the diagonal. Return the number of iterations.
+  int solve_normal_equations(int dem_iter, std::vector<SmoothnessTerm> const& terms,
+                             double mu, ImageView<double> const& diag,
+                             ImageView<double> const& gradient, ImageView<double> & delta) {
+    const int    max_iterations = 200;
+    const double tolerance      = 1e-3; // relative to the right side
+
+    int cols = gradient.cols(), rows = gradient.rows();
+    double w2 = std::max(0.0, m_opt.initial_dem_constraint_weight);
+    w2 *= w2;
+    ImageView<double> r(cols, rows), z(cols, rows), p(cols, rows), Ap(cols, rows),
+      precond(cols, rows);
+    fill(delta, 0.0);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        r(col, row) = -gradient(col, row);
+        double d = (1.0 + mu)*diag(col, row);
+        precond(col, row) = (d > 0) ? 1.0/d : 1.0;
+        z(col, row) = precond(col, row)*r(col, row);
+        p(col, row) = z(col, row);
+      }
+    }
+    zero_boundary(r);
+    zero_boundary(z);
+    zero_boundary(p);
+
+    double rz = interior_dot(r, z), b_norm = std::sqrt(interior_dot(r, r));
+    if (b_norm == 0.0)
+      return 0;
+    int iter = 0;
+    while (iter < max_iterations) {
+      fill(Ap, 0.0);
+      apply_intensity_blocks(m_jtj[dem_iter], p, Ap);
+      smoothness_pass(terms, p, &Ap, NULL);
+      for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++)
+          Ap(col, row) += (w2 + mu*diag(col, row))*p(col, row);
+      zero_boundary(Ap);
+
+      double pAp = interior_dot(p, Ap);
+      if (pAp <= 0.0)
+        break;
+      double alpha = rz/pAp;
+      iter++;
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          delta(col, row) += alpha*p(col, row);
+          r(col, row)     -= alpha*Ap(col, row);
+        }
+      }
+      if (std::sqrt(interior_dot(r, r)) <= tolerance*b_norm)
+        break;
+      for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++)
+          z(col, row) = precond(col, row)*r(col, row);
+      double rz_new = interior_dot(r, z);
+      for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++)
+          p(col, row) = z(col, row) + (rz_new/rz)*p(col, row);
+      rz = rz_new;
+    }
+    return iter;
+  }
+
+  /// Levenberg-Marquardt iterations for the heights alone, each with a
+  /// Gauss-Newton step found without forming J^T J. The callback is
+  /// called after each iteration, as Ceres does.
+  void solve_heights(int num_iterations, SfsCallback & callback) {
+    std::vector<SmoothnessTerm> terms = smoothness_terms(m_smoothness_weight, m_gridx, m_gridy);
+    double w2 = std::max(0.0, m_opt.initial_dem_constraint_weight);
+    w2 *= w2;
+    m_jtj.resize(m_num_dems);
+    m_jtr.resize(m_num_dems);
+    std::vector<double> mu(m_num_dems, 1e-4);
+
+    for (int iter = 0; iter < num_iterations; iter++) {
+      Stopwatch sw;
+      sw.start();
+      double cost_before = 0.0, cost_after = 0.0;
+      int num_cg = 0;
+      for (int dem_iter = 0; dem_iter < m_num_dems; dem_iter++) {
+        ImageView<double> & dem = m_dems[dem_iter];
+        int cols = dem.cols(), rows = dem.rows();
+        if (cols < 3 || rows < 3)
+          continue;
+
+        m_jtj[dem_iter].assign(size_t(cols)*rows*INTENSITY_BLOCK, 0.0);
+        m_jtr[dem_iter].assign(size_t(cols)*rows*5, 0.0);
+        ImageView<double> gradient(cols, rows);
+        double cost = evaluate_cost(dem_iter, dem, terms, &gradient);
+
+        ImageView<double> diag(cols, rows);
+        fill(diag, 0.0);
+        smoothness_pass(terms, dem, NULL, &diag);
+        for (int row = 1; row < rows - 1; row++) {
+          for (int col = 1; col < cols - 1; col++) {
+            const double * block = &m_jtj[dem_iter][(size_t(row)*cols + col)*INTENSITY_BLOCK];
+            for (int a = 0; a < 5; a++)
+              diag(col + INTENSITY_DCOL[a], row + INTENSITY_DROW[a]) += block[sym5(a, a)];
+            diag(col, row) += w2;
+          }
+        }
+
+        ImageView<double> delta(cols, rows);
+        num_cg += solve_normal_equations(dem_iter, terms, mu[dem_iter], diag, gradient, delta);
+        ImageView<double> trial = copy(dem);
+        for (int row = 1; row < rows - 1; row++)
+          for (int col = 1; col < cols - 1; col++)
+            trial(col, row) += delta(col, row);
+        double trial_cost = evaluate_cost(dem_iter, trial, terms, NULL);
+
+        cost_before += cost;
+        if (trial_cost < cost) {
+          // In place, as the shadow and geometry caches point to the DEM
+          for (int row = 1; row < rows - 1; row++)
+            for (int col = 1; col < cols - 1; col++)
+              dem(col, row) = trial(col, row);
+          mu[dem_iter] = std::max(mu[dem_iter]/3.0, 1e-12);
+          cost_after += trial_cost;
+        } else {
+          mu[dem_iter] = std::min(mu[dem_iter]*10.0, 1e+12);
+          cost_after += cost;
+        }
+      }
+      sw.stop();
+      vw_out() << "Matrix-free iteration " << iter << ": cost " << cost_before
+               << " -> " << cost_after << ", " << num_cg << " CG iterations, "
+               << sw.elapsed_seconds() << " s.\n";
+
+      ceres::IterationSummary summary;
+      callback(summary);
+    }
+  }
+
+  Options                                                     & m_opt;
+  std::vector<GeoReference>                             const & m_geo;
+  std::vector< std::vector<BBox2i>     >                const & m_crop_boxes;
+  std::vector< std::vector<MaskedImgT> >                const & m_masked_images;
+  std::vector< std::vector<DoubleImgT> >                const & m_blend_weights;
+  GlobalParams                                          const & m_global_params;
+  std::vector<ModelParams>                              const & m_model_params;
+  std::vector< ImageView<double> >                            & m_dems;
+  std::vector< ImageView<double> >                            & m_albedos;
+  std::vector< std::vector<boost::shared_ptr<CameraModel> > > & m_cameras;
+  std::vector<double>                                         & m_exposures;
+  std::vector<double>                                         & m_adjustments;
+  std::vector<double>                                         & m_coeffs;
+  int                                                           m_num_images, m_num_dems;
+  double                                                        m_gridx, m_gridy;
+  std::vector<double>                                           m_max_dem_height;
+  ceres::Problem                                                m_problem;
+
+  // For the matrix-free solver
+  double                                                        m_smoothness_weight;
+  bool                                                          m_matrix_free;
+  std::vector< std::vector<int> >                               m_used_images;
+  std::vector< ImageView<double> >                              m_orig_dems;
+  std::vector< std::vector<double> >                            m_jtj, m_jtr; // per pixel
+};
 
 int main(int argc, char* argv[]) {
   
@@ -3094,6 +4100,10 @@ int main(int argc, char* argv[]) {
   try {
     handle_arguments( argc, argv, opt );
 
+    // Writes the images of the iterations
+    asp::BackgroundWriter writer(opt.save_in_background);
+    g_writer = &writer;
+
     GlobalParams global_params;
     if (opt.reflectance_type == 0)
       global_params.reflectanceType = LAMBERT;
@@ -3535,8 +4545,8 @@ int main(int argc, char* argv[]) {
             // cropping the images. Otherwise the weights are too huge.
             if (opt.use_blending_weights)
               blend_weights_vec[0][dem_iter][image_iter]
-                = comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
-                                        opt.blending_dist, opt.blending_power);
+                = pixel_cast<double>(comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
+                                                           opt.blending_dist, opt.blending_power));
           }
         }else{
           masked_images_vec[0][dem_iter][image_iter]
@@ -3815,14 +4825,17 @@ int main(int argc, char* argv[]) {
                  Vector2i(tile_size, tile_size), sub_threads), dem_nodata_val),
                has_img_georef, img_georef, has_img_nodata, dem_nodata_val, opt, tpc);
 
-            ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
-            blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            ImageView<float> memory_weight = copy(DiskImageView<float>(sub_weight));
+            blend_weights_vec[level][dem_iter][image_iter] = pixel_cast<double>(memory_weight);
           }
         
         }
       }
     }
     
+    // The problem at each level, set up when first needed
+    std::vector< boost::shared_ptr<SfsLevel> > sfs_levels(levels+1);
+
     // Start going from the coarsest to the finest level
     for (int level = levels; level >= 0; level--) {
 
@@ -3834,32 +4847,26 @@ int main(int argc, char* argv[]) {
       else
         num_iterations = opt.max_coarse_iterations;
 
-      // Scale the cameras
-      for (int image_iter = 0; image_iter < num_images; image_iter++) {
-        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
-          
-          if (opt.skip_images[dem_iter].find(image_iter) !=
-              opt.skip_images[dem_iter].end()) continue;
-	  
-          AdjustedCameraModel * adj_cam
-            = dynamic_cast<AdjustedCameraModel*>(cameras[dem_iter][image_iter].get());
-          if (adj_cam == NULL)
-            vw_throw( ArgumentErr() << "Expecting adjusted camera.\n");
-          adj_cam->set_scale(factors[level]);
-        }
-      }
-      
-      run_sfs_level(// Fixed inputs
-                    num_iterations, opt, geos[level],
-                    opt.smoothness_weight*factors[level]*factors[level],
-                    dem_nodata_val, crop_boxes[level],
-                    masked_images_vec[level], blend_weights_vec[level],
-                    global_params, model_params,
-                    orig_dems[level], initial_albedo,
-                    // Quantities that will float
-                    dems[level], albedos[level], cameras,
-                    opt.image_exposures_vec,
-                    adjustments, opt.model_coeffs_vec);
+      set_camera_scale(opt, factors[level], cameras);
+      sfs_levels[level] = boost::shared_ptr<SfsLevel>
+        (new SfsLevel(// Fixed inputs
+                      opt, geos[level],
+                      opt.smoothness_weight*factors[level]*factors[level],
+                      dem_nodata_val, crop_boxes[level],
+                      masked_images_vec[level], blend_weights_vec[level],
+                      global_params, model_params,
+                      orig_dems[level], initial_albedo,
+                      // Quantities that will float
+                      dems[level], albedos[level], cameras,
+                      opt.image_exposures_vec,
+                      adjustments, opt.model_coeffs_vec));
+
+      // The input DEM at this level is needed only to set up the
+      // height change terms, which keep their own copy of it.
+      for (int dem_iter = 0; dem_iter < num_dems; dem_iter++)
+        orig_dems[level][dem_iter] = ImageView<double>();
+
+      sfs_levels[level]->solve(num_iterations);
 
       // TODO: Study this. Discarding the coarse DEM and exposure so
       // keeping only the cameras seem to work better.
@@ -3876,6 +4883,52 @@ int main(int argc, char* argv[]) {
       
     }
 
+    // Multigrid V-cycles. Bring the fine solution down to the coarse
+    // levels, solve there, and bring back up only the changes the coarse
+    // solves made, so that the fine details are kept. The problems
+    // set up above are reused, as the DEMs are changed in place.
+    for (int cycle = 0; cycle < opt.multigrid_cycles && levels > 0; cycle++) {
+
+      vw_out() << "Multigrid cycle " << cycle + 1 << " of " << opt.multigrid_cycles << "\n";
+
+      // The restricted values at each level, before the coarse solves
+      std::vector< std::vector< ImageView<double> > > dems_before(levels+1), albedos_before(levels+1);
+      for (int level = 1; level <= levels; level++) {
+        dems_before[level].resize(num_dems);
+        albedos_before[level].resize(num_dems);
+        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+          if (!opt.fix_dem) {
+            restrict_image(dems[level-1][dem_iter], sub_scale, dems[level][dem_iter]);
+            dems_before[level][dem_iter] = copy(dems[level][dem_iter]);
+          }
+          if (opt.float_albedo) {
+            restrict_image(albedos[level-1][dem_iter], sub_scale, albedos[level][dem_iter]);
+            albedos_before[level][dem_iter] = copy(albedos[level][dem_iter]);
+          }
+        }
+      }
+
+      for (int level = levels; level >= 0; level--) {
+
+        g_level = level;
+        set_camera_scale(opt, factors[level], cameras);
+        sfs_levels[level]->solve(level == 0 ? opt.max_iterations : opt.max_coarse_iterations);
+
+        if (level > 0) {
+          for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+            if (!opt.fix_dem)
+              prolong_correction(dems[level][dem_iter], dems_before[level][dem_iter],
+                                 sub_scale, dems[level-1][dem_iter]);
+            if (opt.float_albedo)
+              prolong_correction(albedos[level][dem_iter], albedos_before[level][dem_iter],
+                                 sub_scale, albedos[level-1][dem_iter]);
+          }
+        }
+      }
+    }
+
+
+    writer.wait();
   } ASP_STANDARD_CATCHES;
   
   VW_OUT(DebugMessage, "asp") << "Number of times we used the global lock: "
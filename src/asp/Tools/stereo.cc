@@ -20,6 +20,7 @@
 ///
 
 #include <vw/Cartography.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Stereo/StereoView.h>
 #include <vw/Stereo/PreFilter.h>
 #include <vw/Stereo/CorrelationView.h>
@@ -29,8 +30,11 @@
 #include <asp/Camera/RPCModel.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/StereoStartupCache.h>
+#include <asp/Core/ObjectStorage.h>
 
 #include <boost/accumulators/accumulators.hpp>
+#include <unistd.h>
 #include <boost/accumulators/statistics.hpp>
 
 using namespace vw;
@@ -205,6 +209,12 @@ namespace asp {
       for (int t = 0; t < (int)options.size(); t++)
         cmd.push_back(options[t]);
 
+      // All pairs share the products which depend only on the left image
+      if (num_pairs > 1){
+        cmd.push_back("--multiview-left-prefix");
+        cmd.push_back(output_prefix + "-multiview");
+      }
+
       cmd.push_back(images[0]); // left image
       cmd.push_back(images[p]); // right image
 
@@ -358,6 +368,16 @@ namespace asp {
       return;
     }
 
+    // Inputs in object storage are read in place or fetched to a local copy
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    std::string * positional[] = {&opt.in_file1, &opt.in_file2, &opt.cam_file1,
+                                  &opt.cam_file2, &opt.out_prefix, &opt.input_dem};
+    for (int i = 0; i < int(sizeof(positional)/sizeof(positional[0])); i++)
+      *positional[i] = asp::object_read_path(*positional[i], stereo_settings().object_cache_dir,
+                                             num_threads);
+
     // Re-use the logic in parse_multiview_cmd_files, but just for two images/cameras.
     std::vector<std::string> files;
     std::vector<std::string> images, cameras;
@@ -367,15 +387,35 @@ namespace asp {
     if (!opt.cam_file2.empty())  files.push_back(opt.cam_file2);
     if (!opt.out_prefix.empty()) files.push_back(opt.out_prefix);
     if (!opt.input_dem.empty())  files.push_back(opt.input_dem);
-    if (!parse_multiview_cmd_files(files, // inputs
-                                   images, cameras, opt.out_prefix, opt.input_dem // outputs
-                                   ))
-      vw_throw( ArgumentErr() << "Missing all of the correct input files.\n\n" << usage );
 
-    opt.in_file1 = "";  if (images.size() >= 1)  opt.in_file1  = images[0];
-    opt.in_file2 = "";  if (images.size() >= 2)  opt.in_file2  = images[1];
-    opt.cam_file1 = ""; if (cameras.size() >= 1) opt.cam_file1 = cameras[0];
-    opt.cam_file2 = ""; if (cameras.size() >= 2) opt.cam_file2 = cameras[1];
+    // A process of a parallel_stereo run can use what the first one
+    // found out about the inputs, and not open them again.
+    std::string given_session_type     = opt.stereo_session_string;
+    std::string given_alignment_method = stereo_settings().alignment_method;
+    asp::StereoStartupInfo startup;
+    bool have_startup = asp::read_stereo_startup_file(stereo_settings().startup_file, files,
+                                                      given_session_type, given_alignment_method,
+                                                      startup);
+    if (have_startup) {
+      opt.in_file1   = startup.in_file1;
+      opt.in_file2   = startup.in_file2;
+      opt.cam_file1  = startup.cam_file1;
+      opt.cam_file2  = startup.cam_file2;
+      opt.out_prefix = files[startup.out_prefix_index];
+      opt.input_dem  = startup.input_dem;
+      opt.stereo_session_string = startup.session_type;
+      stereo_settings().alignment_method = startup.alignment_method;
+    }else{
+      if (!parse_multiview_cmd_files(files, // inputs
+                                     images, cameras, opt.out_prefix, opt.input_dem // outputs
+                                     ))
+        vw_throw( ArgumentErr() << "Missing all of the correct input files.\n\n" << usage );
+
+      opt.in_file1 = "";  if (images.size() >= 1)  opt.in_file1  = images[0];
+      opt.in_file2 = "";  if (images.size() >= 2)  opt.in_file2  = images[1];
+      opt.cam_file1 = ""; if (cameras.size() >= 1) opt.cam_file1 = cameras[0];
+      opt.cam_file2 = ""; if (cameras.size() >= 2) opt.cam_file2 = cameras[1];
+    }
 
     if (opt.in_file1.empty() || opt.in_file2.empty() || opt.out_prefix.empty())
       vw_throw( ArgumentErr() << "Missing all of the correct input files.\n\n" << usage );
@@ -388,6 +428,27 @@ namespace asp {
     std::string prog_name = extract_prog_name(argv[0]);
     if (prog_name.find("stereo_parse") == std::string::npos) 
       asp::log_to_file(argc, argv, opt.stereo_default_filename, opt.out_prefix);
+
+    // Record the stage and tile timings next to the log
+    if (stereo_settings().telemetry && prog_name.find("stereo_parse") == std::string::npos)
+      asp::enable_telemetry(opt.out_prefix + "-telemetry-" + prog_name + "-"
+                            + vw::num_to_str(getpid()) + ".jsonl");
+
+    // Keep a status file with the progress of this process
+    if (stereo_settings().progress_status && prog_name.find("stereo_parse") == std::string::npos)
+      asp::set_progress_status_file(opt.out_prefix + "-status-" + prog_name + "-"
+                                    + vw::num_to_str(getpid()) + ".json", prog_name);
+
+    asp::set_numa_affinity(stereo_settings().numa_affinity);
+
+    // Save the inputs of selected tiles, to run them again by themselves
+    if ((!stereo_settings().capture_tiles.empty() || stereo_settings().capture_slow_tiles > 0) &&
+        prog_name.find("stereo_parse") == std::string::npos)
+      asp::enable_tile_capture(opt.out_prefix + "-capture",
+                               asp::parse_capture_boxes(stereo_settings().capture_tiles),
+                               stereo_settings().capture_slow_tiles,
+                               stereo_settings().capture_max_tiles,
+                               argc, argv, opt.stereo_default_filename);
     
     // There are two crop win boxes, in respect to original left
     // image, named left_image_crop_win, and in respect to the
@@ -530,7 +591,29 @@ namespace asp {
                                                         opt.out_prefix, opt.input_dem));
     // Run a set of checks to make sure the settings are compatible
     // - Since we already created the session, any errors are fatal.
-    user_safety_checks(opt);
+    // - The checks of the inputs were done already if they were found
+    //   in the startup file.
+    if (have_startup) {
+      settings_safety_checks(opt);
+    }else{
+      user_safety_checks(opt);
+
+      if (!stereo_settings().startup_file.empty()) {
+        startup.session_type     = opt.stereo_session_string;
+        startup.alignment_method = stereo_settings().alignment_method;
+        startup.in_file1         = opt.in_file1;
+        startup.in_file2         = opt.in_file2;
+        startup.cam_file1        = opt.cam_file1;
+        startup.cam_file2        = opt.cam_file2;
+        startup.input_dem        = opt.input_dem;
+        startup.out_prefix_index = std::find(files.begin(), files.end(), opt.out_prefix)
+          - files.begin();
+        if (startup.out_prefix_index < int(files.size()))
+          asp::write_stereo_startup_file(stereo_settings().startup_file, files,
+                                         given_session_type, given_alignment_method,
+                                         startup);
+      }
+    }
 
     // The last thing we do before we get started is to copy the
     // stereo.default settings over into the results directory so that
@@ -553,9 +636,7 @@ namespace asp {
 #endif
   }
 
-  void user_safety_checks(ASPGlobalOptions const& opt){
-
-    // Error checking
+  void settings_safety_checks(ASPGlobalOptions const& opt){
 
     const bool dem_provided = !opt.input_dem.empty();
 
@@ -564,6 +645,21 @@ namespace asp {
       vw_throw(ArgumentErr() << "Invalid value for seed-mode: " << stereo_settings().seed_mode << ".\n");
     }
 
+    // The refinement and triangulation tiles are also the blocks of
+    // the output files
+    if (stereo_settings().rfne_tile_size_ovr <= 0 || stereo_settings().rfne_tile_size_ovr % 16 != 0 ||
+        stereo_settings().tri_tile_size_ovr  <= 0 || stereo_settings().tri_tile_size_ovr  % 16 != 0)
+      vw_throw( ArgumentErr() << "The values of rfne-tile-size and tri-tile-size must be "
+                << "positive multiples of 16.\n" );
+
+    if (stereo_settings().tri_prefetch_size < 0 || stereo_settings().tri_prefetch_threads < 0)
+      vw_throw( ArgumentErr() << "The values of tri-prefetch-size and tri-prefetch-threads "
+                << "must not be negative.\n" );
+
+    int bits = stereo_settings().preprocessed_image_bits;
+    if (bits != 0 && bits != 8 && bits != 16)
+      vw_throw( ArgumentErr() << "The value of preprocessed-image-bits must be 0, 8, or 16.\n" );
+
     // Local homography needs D_sub
     if (stereo_settings().seed_mode == 0 &&
         stereo_settings().use_local_homography){
@@ -587,6 +683,54 @@ namespace asp {
       vw_throw( NoImplErr() << "Computation of low-resolution disparity from "
                 << "DEM is not implemented for map-projected images.\n");
 
+    if (stereo_settings().corr_kernel[0]%2 == 0 ||
+        stereo_settings().corr_kernel[1]%2 == 0   ){
+      vw_throw(ArgumentErr() << "The entries of corr-kernel must be odd numbers.\n");
+    }
+
+    if (stereo_settings().subpixel_kernel[0]%2 == 0 ||
+        stereo_settings().subpixel_kernel[1]%2 == 0   ){
+      vw_throw(ArgumentErr() << "The entries of subpixel-kernel must be odd numbers.\n");
+    }
+
+    // Check SGM related settings.
+    bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW);
+    if (!using_sgm) {
+      if (stereo_settings().cost_mode == 3)
+        vw_throw( ArgumentErr() << "Cannot use census transform without SGM!\n" );
+      if (stereo_settings().cost_mode == 4)
+        vw_throw( ArgumentErr() << "Cannot use ternary census transform without SGM!\n" );
+    }
+    if (stereo_settings().cost_mode > 4)
+      vw_throw( ArgumentErr() << "Unknown value " << stereo_settings().cost_mode << " for cost-mode.\n" );
+
+    // If later we perform piecewise adjustments, the cameras loaded
+    // so far must not be adjusted. And we also can't just perform
+    // stereo on cropped images, as we need the full disparity.
+    if (stereo_settings().image_lines_per_piecewise_adjustment > 0) {
+
+      // This check must come first as it implies adjusted cameras
+      if ( ( stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0)) &&
+           ( stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0) ) )
+        vw_throw(ArgumentErr() << "Since we perform piecewise adjustments we "
+                 << "need the full disparities, so --left-image-crop-win and  "
+                 << "--right-image-crop-win cannot be used.\n");
+
+      if (stereo_settings().piecewise_adjustment_interp_type != 1 &&
+          stereo_settings().piecewise_adjustment_interp_type != 2)
+        vw_throw(ArgumentErr() << "Interpolation type for piecewise "
+                 << "adjustment can be only 1 or 2.\n");
+    }
+  } // End settings_safety_checks
+
+  void user_safety_checks(ASPGlobalOptions const& opt){
+
+    // Error checking
+
+    settings_safety_checks(opt);
+
+    const bool dem_provided = !opt.input_dem.empty();
+
     // Must use map-projected images if input DEM is provided
     GeoReference georef1, georef2;
     bool has_georef1 = vw::cartography::read_georeference(georef1, opt.in_file1);
@@ -664,29 +808,7 @@ namespace asp {
 
     } // End if dem_provided
 
-    if (stereo_settings().corr_kernel[0]%2 == 0 ||
-        stereo_settings().corr_kernel[1]%2 == 0   ){
-      vw_throw(ArgumentErr() << "The entries of corr-kernel must be odd numbers.\n");
-    }
-
-    if (stereo_settings().subpixel_kernel[0]%2 == 0 ||
-        stereo_settings().subpixel_kernel[1]%2 == 0   ){
-      vw_throw(ArgumentErr() << "The entries of subpixel-kernel must be odd numbers.\n");
-    }
-
-    // Check SGM related settings.
-    bool using_sgm = (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW);
-    if (!using_sgm) {
-      if (stereo_settings().cost_mode == 3)
-        vw_throw( ArgumentErr() << "Cannot use census transform without SGM!\n" );
-      if (stereo_settings().cost_mode == 4)
-        vw_throw( ArgumentErr() << "Cannot use ternary census transform without SGM!\n" );
-    }
-    if (stereo_settings().cost_mode > 4)
-      vw_throw( ArgumentErr() << "Unknown value " << stereo_settings().cost_mode << " for cost-mode.\n" );
-
     // Camera checks
-    bool force_throw = false;
     try {
       // TODO: Remove this extra camera load!
       //       - Some camera models take a long time to load and this causes us to load them twice!
@@ -731,36 +853,12 @@ namespace asp {
           << "\tbe able to triangulate.\n";
       }
 
-      // If later we perform piecewise adjustments, the cameras loaded
-      // so far must not be adjusted. And we also can't just perform
-      // stereo on cropped images, as we need the full disparity.
-      if (stereo_settings().image_lines_per_piecewise_adjustment > 0) {
-
-        force_throw = true;
-
-        // This check must come first as it implies adjusted cameras
-        if ( ( stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0)) &&
-             ( stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0) ) )
-          vw_throw(ArgumentErr() << "Since we perform piecewise adjustments we "
-                   << "need the full disparities, so --left-image-crop-win and  "
-                   << "--right-image-crop-win cannot be used.\n");
-
-        if (stereo_settings().piecewise_adjustment_interp_type != 1 &&
-            stereo_settings().piecewise_adjustment_interp_type != 2)
-          vw_throw(ArgumentErr() << "Interpolation type for piecewise "
-                   << "adjustment can be only 1 or 2.\n");
-
-      }
-
     } catch (const exception& e) {
       // Don't throw an error here. There are legitimate reasons as to
       // why the first checks may fail. For example, the top left pixel
       // might not be valid on a map projected image. But notify the
-      // user anyway. Make an exception for the piecewise adjustment checks.
-      if (!force_throw)
-        vw_out(DebugMessage,"asp") << e.what() << endl;
-      else
-        vw_throw( ArgumentErr() << e.what() );
+      // user anyway.
+      vw_out(DebugMessage,"asp") << e.what() << endl;
     }
   } // End user_safety_checks
 
@@ -780,4 +878,71 @@ namespace asp {
            has_tif_or_ntf_extension(opt.in_file2));
   } // End function skip_image_normalization
 
+  void attach_georeference_to_lowres_disparity(ASPGlobalOptions const& opt){
+
+    std::string left_image_file = opt.out_prefix + "-L.tif";
+    if (!fs::exists(left_image_file))
+      return;
+
+    cartography::GeoReference left_georef, left_sub_georef;
+    bool   has_left_georef = read_georeference(left_georef, left_image_file);
+    bool   has_nodata      = false;
+    double output_nodata   = -32768.0;
+    if (!has_left_georef)
+      return;
+
+    DiskImageView<float> left_image(left_image_file);
+    for (int i = 0; i < 2; i++) {
+      std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+      if (i == 1) d_sub_file = opt.out_prefix + "-D_sub_spread.tif";
+      if (!fs::exists(d_sub_file))
+        continue;
+
+      bool has_sub_georef = read_georeference(left_sub_georef, d_sub_file);
+      if (has_sub_georef) {
+        // If D_sub already has a georef, as with seed-mode 3, don't overwrite it.
+        continue;
+      }
+
+      ImageView<PixelMask<Vector2f> > d_sub;
+      read_image(d_sub, d_sub_file);
+      // Account for scale.
+      double left_scale = 0.5*( double(d_sub.cols())/left_image.cols() +
+                                double(d_sub.rows())/left_image.rows());
+      left_sub_georef = resample(left_georef, left_scale);
+      vw::cartography::block_write_gdal_image(d_sub_file, d_sub,
+                                              has_left_georef, left_sub_georef,
+                                              has_nodata, output_nodata,
+                                              opt, TerminalProgressCallback("asp", "\t    D_sub: "));
+    } // End i loop
+  } // End function attach_georeference_to_lowres_disparity
+
+  vw::cartography::GdalWriteOptions
+  disparity_write_options(ASPGlobalOptions const& opt, bool integer_disparity){
+
+    vw::cartography::GdalWriteOptions disp_opt = opt;
+    if (!stereo_settings().compact_disparity)
+      return disp_opt;
+
+    // Horizontal differencing for integers, floating point one otherwise
+    if (opt.tif_compress != "NONE")
+      disp_opt.gdal_options["COMPRESS"] = "DEFLATE";
+    disp_opt.gdal_options["PREDICTOR"] = integer_disparity ? "2" : "3";
+    return disp_opt;
+  } // End function disparity_write_options
+
+  bool compact_integer_disparity(){
+
+    if (!stereo_settings().compact_disparity)
+      return false;
+
+    // The tiles may search a little past the global search range, by
+    // up to the spread of the low-resolution disparity. Keep a margin.
+    const int MAX_INT16 = 32767, MARGIN = 1024;
+    BBox2i const& range = stereo_settings().search_range;
+    int max_disp = std::max(std::max(std::abs(range.min().x()), std::abs(range.min().y())),
+                            std::max(std::abs(range.max().x()), std::abs(range.max().y())));
+    return max_disp + MARGIN <= MAX_INT16;
+  } // End function compact_integer_disparity
+
 } // end namespace asp
@@ -33,6 +33,10 @@
 #include <asp/Core/MedianFilter.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/Telemetry.h>
+#include <asp/Core/ProgressStatus.h>
+#include <asp/Core/TileCapture.h>
+#include <asp/Core/NumaAffinity.h>
 
 // Support for ISIS image files
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
@@ -60,6 +64,15 @@ enum { PREPROCESSING = 0,
        WIRE_MESH,
        NUM_STAGES};
 
+/// The bodies of the stereo_pprc, stereo_corr, stereo_rfne,
+/// stereo_fltr, and stereo_tri programs. These are also called one
+/// after another by stereo_all, which runs all stages in one process.
+int stereo_pprc_main(int argc, char* argv[]);
+int stereo_corr_main(int argc, char* argv[]);
+int stereo_rfne_main(int argc, char* argv[]);
+int stereo_fltr_main(int argc, char* argv[]);
+int stereo_tri_main (int argc, char* argv[]);
+
 // Allows FileIO to correctly read/write these pixel types
 namespace asp {
 
@@ -90,9 +103,29 @@ namespace asp {
   /// - Throws if any incompatible settings are found.
   void user_safety_checks(ASPGlobalOptions const& opt);
 
+  /// The part of user_safety_checks() which only looks at the
+  /// settings, and not at the input files and cameras.
+  void settings_safety_checks(ASPGlobalOptions const& opt);
+
 
   bool skip_image_normalization(ASPGlobalOptions const& opt);
 
+  /// Attach to the low-resolution disparities D_sub.tif and
+  /// D_sub_spread.tif the georeference of L.tif, scaled to their
+  /// size, if L.tif has one and the disparities do not.
+  void attach_georeference_to_lowres_disparity(ASPGlobalOptions const& opt);
+
+  /// The options for writing the disparities D, RD, and F. With
+  /// compact-disparity these use deflate compression with a predictor,
+  /// which is lossless and transparent to the readers.
+  vw::cartography::GdalWriteOptions
+  disparity_write_options(ASPGlobalOptions const& opt, bool integer_disparity);
+
+  /// If the integer disparity D can be written with 16-bit channels.
+  /// True with compact-disparity when the search range, with a margin,
+  /// fits in them. Read back as floats, it is the same as with 32-bit ones.
+  bool compact_integer_disparity();
+
 } // end namespace vw
 
 #endif//__ASP_STEREO_H__
@@ -0,0 +1,191 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_all.cc
+///
+/// Run the stereo stages, from preprocessing to triangulation, one
+/// after another in a single process, as the stereo script does with
+/// one process per stage. The camera models are cached once loaded,
+/// so each camera is loaded and set up once rather than once per
+/// stage, which matters for the slow-to-load cameras (ISIS, DG with
+/// many ephemeris samples, ASTER). This is invoked by
+/// "stereo --single-process". The intermediate images are still
+/// written to disk as before, so a run can be resumed with
+/// --entry-point, or combined with parallel_stereo.
+
+#include <asp/Tools/stereo.h>
+#include <asp/Sessions/StereoSession.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/Macros.h>
+#include <vw/Core/Log.h>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+using namespace std;
+
+namespace {
+
+  typedef int (*StageFunc)(int argc, char* argv[]);
+
+  // Run one stage with the given program name and arguments. The
+  // settings are reset first, as the options of each stage are parsed
+  // on top of the defaults, and the previous stage's log files are
+  // dropped, so that each stage logs only to its own file.
+  int run_stage(std::string const& prog_name, StageFunc stage,
+                std::vector<std::string> const& args){
+
+    asp::stereo_settings() = asp::StereoSettings();
+    vw::vw_log().clear();
+
+    std::vector<std::string> strs;
+    strs.push_back(prog_name);
+    strs.insert(strs.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (size_t i = 0; i < strs.size(); i++)
+      argv.push_back(&strs[i][0]);
+    argv.push_back(NULL);
+
+    return stage(int(strs.size()), &argv[0]);
+  }
+
+  // Parse the options as the stages do, and attach the georeference
+  // to the low-resolution disparity if asked, as stereo_parse does.
+  int parse_stage(int argc, char* argv[]){
+    try {
+      xercesc::XMLPlatformUtils::Initialize();
+      stereo_register_sessions();
+      bool verbose = false;
+      vector<ASPGlobalOptions> opt_vec;
+      string output_prefix;
+      asp::parse_multiview(argc, argv, TriangulationDescription(),
+                           verbose, output_prefix, opt_vec);
+      if (opt_vec.empty())
+        return 1;
+      if (stereo_settings().attach_georeference_to_lowres_disparity)
+        asp::attach_georeference_to_lowres_disparity(opt_vec[0]);
+      xercesc::XMLPlatformUtils::Terminate();
+    } ASP_STANDARD_CATCHES;
+    return 0;
+  }
+
+  // Remove an option with a value from the arguments, and return the
+  // value of its last occurrence, or the default if not present.
+  int extract_int_option(std::vector<std::string> & args, std::string const& name,
+                         int default_value){
+    int value = default_value;
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < args.size(); i++){
+      if (args[i] == name || (name == "--entry-point" && args[i] == "-e")){
+        if (i + 1 >= args.size())
+          vw_throw( ArgumentErr() << "Missing value for " << name << ".\n" );
+        value = boost::lexical_cast<int>(args[i+1]);
+        i++;
+        continue;
+      }
+      kept.push_back(args[i]);
+    }
+    args = kept;
+    return value;
+  }
+
+  // Read the value of an option without removing it.
+  int peek_int_option(std::vector<std::string> const& args, std::string const& name,
+                      int default_value){
+    int value = default_value;
+    for (size_t i = 0; i + 1 < args.size(); i++){
+      if (args[i] == name)
+        value = boost::lexical_cast<int>(args[i+1]);
+    }
+    return value;
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+
+  try {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    int entry_point = extract_int_option(args, "--entry-point", PREPROCESSING);
+    int stop_point  = extract_int_option(args, "--stop-point",  WIRE_MESH);
+    int seed_mode   = peek_int_option(args, "--corr-seed-mode", 1);
+
+    // With seed mode 3 the low-resolution disparity is made by the
+    // sparse_disp script, which the stereo script must run, unless
+    // its built-in version is used.
+    bool native_sparse_disp = (std::find(args.begin(), args.end(), "--native-sparse-disp")
+                               != args.end());
+    if (seed_mode == 3 && !native_sparse_disp &&
+        entry_point <= CORRELATION && stop_point > CORRELATION)
+      vw_throw( ArgumentErr() << "stereo_all cannot be used with --corr-seed-mode 3 "
+                << "without --native-sparse-disp. Run stereo without --single-process.\n" );
+
+    StereoSession::enable_camera_cache(true);
+
+    int ret = 0;
+    if (entry_point <= PREPROCESSING && stop_point > PREPROCESSING) {
+      ret = run_stage("stereo_pprc", stereo_pprc_main, args);
+      if (ret != 0) return ret;
+    }
+
+    if (entry_point <= CORRELATION && stop_point > CORRELATION) {
+      std::vector<std::string> corr_args = args;
+      if (seed_mode != 0) {
+        // Do the low-resolution correlation first, as the stereo script does
+        std::vector<std::string> lowres_args = args;
+        lowres_args.push_back("--compute-low-res-disparity-only");
+        ret = run_stage("stereo_corr", stereo_corr_main, lowres_args);
+        if (ret != 0) return ret;
+        std::vector<std::string> georef_args = args;
+        georef_args.push_back("--attach-georeference-to-lowres-disparity");
+        ret = run_stage("stereo_parse", parse_stage, georef_args);
+        if (ret != 0) return ret;
+        corr_args.push_back("--skip-low-res-disparity-comp");
+      }
+      ret = run_stage("stereo_corr", stereo_corr_main, corr_args);
+      if (ret != 0) return ret;
+    }
+
+    if (entry_point <= REFINEMENT && stop_point > REFINEMENT) {
+      // With --fuse-correlation-refinement this was done together
+      // with correlation. Parse the settings to find out.
+      ret = run_stage("stereo_parse", parse_stage, args);
+      if (ret != 0) return ret;
+      if (!stereo_settings().fuse_correlation_refinement ||
+          stereo_settings().stereo_algorithm != 0) {
+        ret = run_stage("stereo_rfne", stereo_rfne_main, args);
+        if (ret != 0) return ret;
+      }
+    }
+
+    if (entry_point <= FILTERING && stop_point > FILTERING) {
+      ret = run_stage("stereo_fltr", stereo_fltr_main, args);
+      if (ret != 0) return ret;
+    }
+
+    if (entry_point <= POINT_CLOUD && stop_point > POINT_CLOUD) {
+      ret = run_stage("stereo_tri", stereo_tri_main, args);
+      if (ret != 0) return ret;
+    }
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
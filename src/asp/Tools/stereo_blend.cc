@@ -34,227 +34,15 @@
 // tiles which overlap with the inner area of the current tile, and
 // blend the results.
 
-#include <asp/Tools/stereo.h>
-#include <vw/Stereo/DisparityMap.h>
+#include <asp/Tools/stereo_blend.h>
 #include <boost/filesystem.hpp>
 
-using namespace vw;
-using namespace vw::stereo;
-using namespace asp;
 using namespace std;
 
 typedef DiskImageView<PixelMask<Vector2f> > DiskImageType;
 typedef ImageView    <PixelMask<Vector2f> > DispImageType;
 typedef ImageView    <double              > WeightsType;
 
-const size_t NUM_NEIGHBORS = 8;
-enum Position {TL = 0, T = 1, TR = 2,
-                L = 3, M = 8,  R = 4,
-               BL = 5, B = 6, BR = 7};
-// M is the central non-buffered area.
-
-/// Debugging aid
-std::string position_string(int p) {
-  switch(p) {
-    case TL: return "TL";
-    case T:  return "T";
-    case TR: return "TR";
-    case L:  return "L";
-    case R:  return "R";
-    case BL: return "BL";
-    case B:  return "B";
-    case BR: return "BR";
-    default: return "M";
-  };
-}
-
-/// Returns the opposite position (what it is in the neighbor)
-Position get_opposed_position(Position p) {
-  switch(p) {
-    case TL: return BR;
-    case T:  return B;
-    case TR: return BL;
-    case L:  return R;
-    case R:  return L;
-    case BL: return TR;
-    case B:  return T;
-    case BR: return TL;
-    default: return M;
-  };
-}
-
-/// Given "out-2048_0_1487_2048" return "2048_0_1487_2048"
-std::string extract_process_folder_bbox_string(std::string  s) {
-  // If the filename was included, throw it out first.
-  if (s.find("-Dnosym.tif") != std::string::npos) {
-    size_t pt = s.rfind("/");
-    s = s.substr(0, pt);
-  }
-  size_t num_start = s.rfind("-");
-  if (num_start == std::string::npos)
-    vw_throw( ArgumentErr() << "Error parsing folder string: " << s );
-  return s.substr(num_start+1);
-}
-
-/// Constructs a BBox2i from a parallel_stereo formatted folder.
-BBox2i bbox_from_folder(std::string const& s) {
-  std::string cropped = extract_process_folder_bbox_string(s);
-  int x, y, width, height;
-  sscanf(cropped.c_str(), "%d_%d_%d_%d", &x, &y, &width, &height);
-  return BBox2i(x, y, width, height);
-}
-
-
-/// Returns one of eight possible ROI locations for the given tile.
-/// - If get_buffer is set, fetch the ROI from the buffer region,
-///   so from the outer region to the tile
-///   Otherwise get it from the non-buffer region at that location,
-///   that is, from the inner region.
-/// - Some tiles do not have all buffers available, if one of these
-///   is requested the function will return false.
-/// - Set buffers_stripped if you want the output ROI in reference to
-///   an image with the buffers removed.  This will always fail if combined
-///   with get_bufer==true, as there is no buffer area to fetch
-/// - Generally you would get the non-buffer region for the main tile,
-///   and the opposed buffer region for the neighboring tile.
-bool get_roi_from_tile(std::string const& tile_path, Position pos,
-		       int buffer_size, bool get_buffer,
-		       BBox2i &output_roi,
-		       bool buffers_stripped=false) {
-  
-  // Initialize the output
-  output_roi = BBox2i();
-
-  // Get the ROI of this tile and of the entire processing job
-  // The unbuffered roi is before we expand it with buffer on the sides.
-  BBox2i unbuffered_roi = bbox_from_folder(tile_path); // extract from 2048_5120_1024_394
-
-  Vector2i image_size = file_image_size(tile_path);
-  if (buffers_stripped) {
-    image_size = Vector2i(unbuffered_roi.width(), unbuffered_roi.height());
-
-    // No buffer to remove
-    buffer_size = 0;
-  }
-  
-  // Adjust the size of the output ROI according to the available buffer area
-  int roi_width    = unbuffered_roi.width();   // Size with no buffers
-  int roi_height   = unbuffered_roi.height();
-  int image_width  = image_size[0];  // Size with buffers included
-  int image_height = image_size[1];
-
-  // Determine if this tile sits on the upper left image border.
-  // We don't need to worry about the lower-right border,
-  // we will infer what goes there based on tile size.
-  bool left_edge  = (unbuffered_roi.min().x() == 0);
-  bool top_edge   = (unbuffered_roi.min().y() == 0);
-  if (buffers_stripped) {
-    left_edge = top_edge = false; 
-  }
-
-  // Get the size of the buffers/padding  on each edge (no buffer if on the edge)
-  int left_offset  = (left_edge ) ? 0 : buffer_size;
-  int top_offset   = (top_edge  ) ? 0 : buffer_size;
-  int right_offset = image_width  - left_offset - roi_width;
-  int bot_offset   = image_height - top_offset  - roi_height;
-  vw_out() << "Offsets: " << left_offset << ' ' << right_offset << ' '
-           << top_offset << ' ' << bot_offset << std::endl;
-  
-  if (right_offset < 0 || bot_offset < 0) 
-    vw_throw( ArgumentErr() << "Something is wrong with the current tile geometry.\n" );
-  
-  // The three sizes of bboxes that will be used.
-  Vector2i corner_size         (buffer_size, buffer_size);
-  Vector2i horizontal_edge_size(roi_width,   buffer_size);
-  Vector2i vertical_edge_size  (buffer_size, roi_height);
-  Vector2i dummy(0,0);
-  BBox2i   image_box(0, 0, image_width, image_height);
-
-  int right_diff = image_width  - right_offset;
-  int bot_diff   = image_height - top_offset;
-  switch(pos) {
-  case TL: 
-    if (get_buffer) {
-      if (left_edge || top_edge)
-        return false;
-      output_roi = BBox2i(Vector2i(0, 0), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
-    output_roi.set_size(corner_size);
-    break;
-  case T:
-    if (get_buffer) {
-      if (top_edge)
-        return false;
-      output_roi = BBox2i(Vector2i(left_offset, 0), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
-    output_roi.set_size(horizontal_edge_size);
-    break;             
-  case TR:
-    if (get_buffer) {
-      if (top_edge)
-          return false;
-      output_roi = BBox2i(Vector2i(right_diff, 0), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(right_diff - buffer_size, top_offset), dummy);
-    output_roi.set_size(corner_size);
-    break;
-  case L:
-    if (get_buffer) {
-      if (left_edge)
-        return false;
-      output_roi = BBox2i(Vector2i(0, top_offset), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
-    output_roi.set_size(vertical_edge_size);
-    break;
-  case R:
-    if (get_buffer) {
-      output_roi = BBox2i(Vector2i(right_diff, top_offset), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(right_diff - buffer_size, top_offset), dummy);
-    output_roi.set_size(vertical_edge_size);
-    break;
-  case BL:
-    if (get_buffer) {
-      if (left_edge)
-        return false;
-      output_roi = BBox2i(Vector2i(0, bot_diff), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(left_offset, bot_diff - buffer_size), dummy);
-    output_roi.set_size(corner_size);
-    break;
-  case B:
-    if (get_buffer) {
-      output_roi = BBox2i(Vector2i(left_offset, bot_diff), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(left_offset, bot_diff - buffer_size), dummy);
-    output_roi.set_size(horizontal_edge_size);
-    break;
-  case BR:
-    if (get_buffer) {
-      output_roi = BBox2i(Vector2i(right_diff, bot_diff), dummy);
-    } else
-      output_roi = BBox2i(Vector2i(right_diff - buffer_size, bot_diff - buffer_size), dummy);
-    output_roi.set_size(corner_size);
-    break;
-  default: // M (central area, everything except for the buffers)
-    if (get_buffer)
-      return false; // Central area is never a buffer
-    output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
-    output_roi.set_size(Vector2i(roi_width, roi_height));
-    break;
-  };
-
-  // Ensure we never go across image boundary
-  output_roi.crop(image_box);
-
-  if (output_roi.empty()) return false;
-
-  return true;
-}
-
 /// Load the desired portion of a disparity tile and associated image weights.
 bool load_image_and_weights(std::string const& file_path, BBox2i const& roi,
                             DispImageType & image, WeightsType & weights) {
@@ -306,6 +94,7 @@ struct BlendOptions {
   std::string main_path;
   BBox2i      main_roi;
   std::string tile_paths[NUM_NEIGHBORS];
+  std::string tile_prefixes[NUM_NEIGHBORS]; // The output prefixes of the neighbors
   BBox2i      rois      [NUM_NEIGHBORS]; // TODO: Keep?
   int sgm_collar_size;
   
@@ -406,13 +195,26 @@ tile_blend( DispImageType const& input_image,
       bool ans1 = get_roi_from_tile(opt.main_path, Position(i),
                                     buff_size, NOT_BUFFER, input_rois[i],
                                     BUFFERS_GONE);
-      // Get the ROI from the neighboring tile
-      bool ans2 = get_roi_from_tile(opt.tile_paths[i], get_opposed_position(Position(i)), 
-                                    buff_size, GET_BUFFER, tile_rois[i]);
-      if (!ans1 || !ans2) continue; // nothing to blend
-
-      check_roi_bounds(input_rois[i], tile_rois[i], bounding_box(output_image));
-      load_image_and_weights(opt.tile_paths[i], tile_rois[i], images[i], weights[i]);
+      if (!ans1) continue; // nothing to blend
+
+      // Use the buffer region and weights saved when the neighbor was
+      // correlated, if present, rather than loading the whole neighbor.
+      std::string collar_file = blend_collar_file(opt.tile_prefixes[i],
+                                                  get_opposed_position(Position(i)));
+      if (fs::exists(collar_file) &&
+          fs::last_write_time(collar_file) >= fs::last_write_time(opt.tile_paths[i])) {
+        read_blend_collar(collar_file, images[i], weights[i]);
+        tile_rois[i] = bounding_box(images[i]);
+        check_roi_bounds(input_rois[i], tile_rois[i], bounding_box(output_image));
+      } else {
+        // Get the ROI from the neighboring tile
+        bool ans2 = get_roi_from_tile(opt.tile_paths[i], get_opposed_position(Position(i)),
+                                      buff_size, GET_BUFFER, tile_rois[i]);
+        if (!ans2) continue; // nothing to blend
+
+        check_roi_bounds(input_rois[i], tile_rois[i], bounding_box(output_image));
+        load_image_and_weights(opt.tile_paths[i], tile_rois[i], images[i], weights[i]);
+      }
       
       if (debug) {
         write_image("tile_image_"+position_string(i)+".tif", images[i]);
@@ -502,20 +304,24 @@ void fill_blend_options(ASPGlobalOptions const& opt, BlendOptions & blend_option
       // Note that folder_list[i] already has the output prefix relative to the
       // directory parallel_stereo runs in.
       folder_list[i] + "/" + bbox_string + "-Dnosym.tif";
+    const std::string tile_prefix = folder_list[i] + "/" + bbox_string;
 
     if (bbox.max().x() == main_bbox.min().x()) { // Tiles one column to left
       if (bbox.max().y() == main_bbox.min().y()) { // Top left
         blend_options.tile_paths[TL] = abs_path;
+        blend_options.tile_prefixes[TL] = tile_prefix;
         blend_options.rois      [TL] = bbox;
         continue;
       }
       if (bbox.min().y() == main_bbox.min().y()) { // Left
         blend_options.tile_paths[L] = abs_path;
+        blend_options.tile_prefixes[L] = tile_prefix;
         blend_options.rois      [L] = bbox;
         continue;
       }
       if (bbox.min().y() == main_bbox.max().y()) { // Bot left
         blend_options.tile_paths[BL] = abs_path;
+        blend_options.tile_prefixes[BL] = tile_prefix;
         blend_options.rois      [BL] = bbox;
         continue;
       }
@@ -523,16 +329,19 @@ void fill_blend_options(ASPGlobalOptions const& opt, BlendOptions & blend_option
     if (bbox.min().x() == main_bbox.max().x()) { // Tiles one column to right
       if (bbox.max().y() == main_bbox.min().y()) { // Top right
         blend_options.tile_paths[TR] = abs_path;
+        blend_options.tile_prefixes[TR] = tile_prefix;
         blend_options.rois      [TR] = bbox;
         continue;
       }
       if (bbox.min().y() == main_bbox.min().y()) { // Right
         blend_options.tile_paths[R] = abs_path;
+        blend_options.tile_prefixes[R] = tile_prefix;
         blend_options.rois      [R] = bbox;
         continue;
       }
       if (bbox.min().y() == main_bbox.max().y()) { // Bot right
         blend_options.tile_paths[BR] = abs_path;
+        blend_options.tile_prefixes[BR] = tile_prefix;
         blend_options.rois      [BR] = bbox;
         continue;
       }
@@ -540,11 +349,13 @@ void fill_blend_options(ASPGlobalOptions const& opt, BlendOptions & blend_option
     if (bbox.min().x() == main_bbox.min().x()) { // Tiles in same column
       if (bbox.max().y() == main_bbox.min().y()) { // Top
         blend_options.tile_paths[T] = abs_path;
+        blend_options.tile_prefixes[T] = tile_prefix;
         blend_options.rois      [T] = bbox;
         continue;
       }
       if (bbox.min().y() == main_bbox.max().y()) { // Bottom
         blend_options.tile_paths[B] = abs_path;
+        blend_options.tile_prefixes[B] = tile_prefix;
         blend_options.rois      [B] = bbox;
         continue;
       }
@@ -596,8 +407,8 @@ void stereo_blending( ASPGlobalOptions const& opt ) {
   vw_out() << "Writing: " << rd_file << "\n";
   vw::cartography::block_write_gdal_image(rd_file, output,
                                           has_left_georef, left_georef,
-                                          has_nodata, nodata, opt,
-                                          TerminalProgressCallback("asp", "\t--> Blending :") );
+                                          has_nodata, nodata, asp::disparity_write_options(opt, false),
+                                          asp::StatusProgressCallback("asp", "\t--> Blending :") );
 }
 
 int main(int argc, char* argv[]) {
@@ -618,12 +429,15 @@ int main(int argc, char* argv[]) {
 
     // Subpixel refinement uses smaller tiles.
     //---------------------------------------------------------
-    int ts = ASPGlobalOptions::rfne_tile_size();
+    int ts = stereo_settings().rfne_tile_size_ovr;
     opt.raster_tile_size = Vector2i(ts, ts);
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_blending( opt );
+    {
+      asp::ScopedTimer timer("stereo_blend");
+      stereo_blending( opt );
+    }
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : BLENDING FINISHED \n";
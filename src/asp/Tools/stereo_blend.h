@@ -0,0 +1,311 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file stereo_blend.h
+///
+/// The geometry of the buffer regions (collars) of the SGM tiles of
+/// parallel_stereo, shared by stereo_corr, which saves the collars of
+/// each tile with their blending weights, and by stereo_blend, which
+/// blends them into the neighboring tiles.
+
+#ifndef __ASP_TOOLS_STEREO_BLEND_H__
+#define __ASP_TOOLS_STEREO_BLEND_H__
+
+#include <asp/Tools/stereo.h>
+#include <vw/Stereo/DisparityMap.h>
+
+// The tools including this header all use these namespaces.
+using namespace vw;
+using namespace vw::stereo;
+using namespace asp;
+
+namespace vw {
+  template<> struct PixelFormatID<Vector3f> { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
+}
+
+const size_t NUM_NEIGHBORS = 8;
+enum Position {TL = 0, T = 1, TR = 2,
+                L = 3, M = 8,  R = 4,
+               BL = 5, B = 6, BR = 7};
+// M is the central non-buffered area.
+
+/// Debugging aid
+inline std::string position_string(int p) {
+  switch(p) {
+    case TL: return "TL";
+    case T:  return "T";
+    case TR: return "TR";
+    case L:  return "L";
+    case R:  return "R";
+    case BL: return "BL";
+    case B:  return "B";
+    case BR: return "BR";
+    default: return "M";
+  };
+}
+
+/// Returns the opposite position (what it is in the neighbor)
+inline Position get_opposed_position(Position p) {
+  switch(p) {
+    case TL: return BR;
+    case T:  return B;
+    case TR: return BL;
+    case L:  return R;
+    case R:  return L;
+    case BL: return TR;
+    case B:  return T;
+    case BR: return TL;
+    default: return M;
+  };
+}
+
+/// Given "out-2048_0_1487_2048" return "2048_0_1487_2048"
+inline std::string extract_process_folder_bbox_string(std::string  s) {
+  // If the filename was included, throw it out first.
+  if (s.find("-Dnosym.tif") != std::string::npos) {
+    size_t pt = s.rfind("/");
+    s = s.substr(0, pt);
+  }
+  size_t num_start = s.rfind("-");
+  if (num_start == std::string::npos)
+    vw_throw( ArgumentErr() << "Error parsing folder string: " << s );
+  return s.substr(num_start+1);
+}
+
+/// Constructs a BBox2i from a parallel_stereo formatted folder.
+inline BBox2i bbox_from_folder(std::string const& s) {
+  std::string cropped = extract_process_folder_bbox_string(s);
+  int x, y, width, height;
+  sscanf(cropped.c_str(), "%d_%d_%d_%d", &x, &y, &width, &height);
+  return BBox2i(x, y, width, height);
+}
+
+
+/// Returns one of eight possible ROI locations for the given tile.
+/// - If get_buffer is set, fetch the ROI from the buffer region,
+///   so from the outer region to the tile
+///   Otherwise get it from the non-buffer region at that location,
+///   that is, from the inner region.
+/// - Some tiles do not have all buffers available, if one of these
+///   is requested the function will return false.
+/// - Set buffers_stripped if you want the output ROI in reference to
+///   an image with the buffers removed.  This will always fail if combined
+///   with get_bufer==true, as there is no buffer area to fetch
+/// - Generally you would get the non-buffer region for the main tile,
+///   and the opposed buffer region for the neighboring tile.
+/// - The unbuffered ROI is the tile before it is expanded with the
+///   buffers on the sides, and the image size is that of the tile with
+///   the buffers.
+inline bool get_roi_from_tile(BBox2i const& unbuffered_roi, Vector2i image_size,
+                              Position pos, int buffer_size, bool get_buffer,
+                              BBox2i &output_roi,
+                              bool buffers_stripped=false) {
+  
+  // Initialize the output
+  output_roi = BBox2i();
+
+  if (buffers_stripped) {
+    image_size = Vector2i(unbuffered_roi.width(), unbuffered_roi.height());
+
+    // No buffer to remove
+    buffer_size = 0;
+  }
+  
+  // Adjust the size of the output ROI according to the available buffer area
+  int roi_width    = unbuffered_roi.width();   // Size with no buffers
+  int roi_height   = unbuffered_roi.height();
+  int image_width  = image_size[0];  // Size with buffers included
+  int image_height = image_size[1];
+
+  // Determine if this tile sits on the upper left image border.
+  // We don't need to worry about the lower-right border,
+  // we will infer what goes there based on tile size.
+  bool left_edge  = (unbuffered_roi.min().x() == 0);
+  bool top_edge   = (unbuffered_roi.min().y() == 0);
+  if (buffers_stripped) {
+    left_edge = top_edge = false; 
+  }
+
+  // Get the size of the buffers/padding  on each edge (no buffer if on the edge)
+  int left_offset  = (left_edge ) ? 0 : buffer_size;
+  int top_offset   = (top_edge  ) ? 0 : buffer_size;
+  int right_offset = image_width  - left_offset - roi_width;
+  int bot_offset   = image_height - top_offset  - roi_height;
+  vw_out() << "Offsets: " << left_offset << ' ' << right_offset << ' '
+           << top_offset << ' ' << bot_offset << std::endl;
+  
+  if (right_offset < 0 || bot_offset < 0) 
+    vw_throw( ArgumentErr() << "Something is wrong with the current tile geometry.\n" );
+  
+  // The three sizes of bboxes that will be used.
+  Vector2i corner_size         (buffer_size, buffer_size);
+  Vector2i horizontal_edge_size(roi_width,   buffer_size);
+  Vector2i vertical_edge_size  (buffer_size, roi_height);
+  Vector2i dummy(0,0);
+  BBox2i   image_box(0, 0, image_width, image_height);
+
+  int right_diff = image_width  - right_offset;
+  int bot_diff   = image_height - top_offset;
+  switch(pos) {
+  case TL: 
+    if (get_buffer) {
+      if (left_edge || top_edge)
+        return false;
+      output_roi = BBox2i(Vector2i(0, 0), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
+    output_roi.set_size(corner_size);
+    break;
+  case T:
+    if (get_buffer) {
+      if (top_edge)
+        return false;
+      output_roi = BBox2i(Vector2i(left_offset, 0), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
+    output_roi.set_size(horizontal_edge_size);
+    break;             
+  case TR:
+    if (get_buffer) {
+      if (top_edge)
+          return false;
+      output_roi = BBox2i(Vector2i(right_diff, 0), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(right_diff - buffer_size, top_offset), dummy);
+    output_roi.set_size(corner_size);
+    break;
+  case L:
+    if (get_buffer) {
+      if (left_edge)
+        return false;
+      output_roi = BBox2i(Vector2i(0, top_offset), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
+    output_roi.set_size(vertical_edge_size);
+    break;
+  case R:
+    if (get_buffer) {
+      output_roi = BBox2i(Vector2i(right_diff, top_offset), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(right_diff - buffer_size, top_offset), dummy);
+    output_roi.set_size(vertical_edge_size);
+    break;
+  case BL:
+    if (get_buffer) {
+      if (left_edge)
+        return false;
+      output_roi = BBox2i(Vector2i(0, bot_diff), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(left_offset, bot_diff - buffer_size), dummy);
+    output_roi.set_size(corner_size);
+    break;
+  case B:
+    if (get_buffer) {
+      output_roi = BBox2i(Vector2i(left_offset, bot_diff), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(left_offset, bot_diff - buffer_size), dummy);
+    output_roi.set_size(horizontal_edge_size);
+    break;
+  case BR:
+    if (get_buffer) {
+      output_roi = BBox2i(Vector2i(right_diff, bot_diff), dummy);
+    } else
+      output_roi = BBox2i(Vector2i(right_diff - buffer_size, bot_diff - buffer_size), dummy);
+    output_roi.set_size(corner_size);
+    break;
+  default: // M (central area, everything except for the buffers)
+    if (get_buffer)
+      return false; // Central area is never a buffer
+    output_roi = BBox2i(Vector2i(left_offset, top_offset), dummy);
+    output_roi.set_size(Vector2i(roi_width, roi_height));
+    break;
+  };
+
+  // Ensure we never go across image boundary
+  output_roi.crop(image_box);
+
+  if (output_roi.empty()) return false;
+
+  return true;
+}
+
+/// As above, with the unbuffered ROI found from the tile folder name
+/// and the image size from the tile disparity on disk.
+inline bool get_roi_from_tile(std::string const& tile_path, Position pos,
+                              int buffer_size, bool get_buffer,
+                              BBox2i &output_roi,
+                              bool buffers_stripped=false) {
+  // The unbuffered roi is extracted from 2048_5120_1024_394
+  return get_roi_from_tile(bbox_from_folder(tile_path), file_image_size(tile_path),
+                           pos, buffer_size, get_buffer, output_roi, buffers_stripped);
+}
+
+/// The file with the buffer region of a tile's disparity at the given
+/// position, and the blending weights there, as saved at correlation
+/// time, so that stereo_blend need not load the neighboring tiles.
+inline std::string blend_collar_file(std::string const& out_prefix, Position pos) {
+  return out_prefix + "-collar-" + position_string(pos) + ".tif";
+}
+
+/// Save each buffer region of this tile's SGM disparity, together with
+/// the blending weights there, which depend on the whole tile. Each pixel
+/// holds the disparity and its weight. The weight is what marks the
+/// pixels to use, as stereo_blend ignores the mask of the neighbors.
+inline void write_blend_collars(ASPGlobalOptions const& opt,
+                                ImageView<PixelMask<Vector2f> > const& disparity,
+                                BBox2i const& unbuffered_roi, int buffer_size) {
+
+  const bool GET_BUFFER = true;
+  for (size_t i = 0; i < NUM_NEIGHBORS; i++) {
+    BBox2i roi;
+    if (!get_roi_from_tile(unbuffered_roi, bounding_box(disparity).size(), Position(i),
+                           buffer_size, GET_BUFFER, roi))
+      continue;
+
+    ImageView<double> weights;
+    centerline_weights(disparity, weights, roi);
+    ImageView<Vector3f> collar(roi.width(), roi.height());
+    for (int col = 0; col < roi.width(); col++) {
+      for (int row = 0; row < roi.height(); row++) {
+        PixelMask<Vector2f> const& d = disparity(col + roi.min().x(), row + roi.min().y());
+        collar(col, row) = Vector3f(d.child()[0], d.child()[1], weights(col, row));
+      }
+    }
+
+    std::string collar_file = blend_collar_file(opt.out_prefix, Position(i));
+    vw_out() << "Writing: " << collar_file << "\n";
+    vw::cartography::block_write_gdal_image(collar_file, collar, opt,
+                                            TerminalProgressCallback("asp", "\t--> Collar :"));
+  }
+}
+
+/// Read back a buffer region written by write_blend_collars().
+inline void read_blend_collar(std::string const& collar_file,
+                              ImageView<PixelMask<Vector2f> > & image,
+                              ImageView<double> & weights) {
+  ImageView<Vector3f> collar = DiskImageView<Vector3f>(collar_file);
+  image.set_size(collar.cols(), collar.rows());
+  weights.set_size(collar.cols(), collar.rows());
+  for (int col = 0; col < collar.cols(); col++) {
+    for (int row = 0; row < collar.rows(); row++) {
+      image(col, row)   = PixelMask<Vector2f>(Vector2f(collar(col, row)[0], collar(col, row)[1]));
+      weights(col, row) = collar(col, row)[2];
+    }
+  }
+}
+
+#endif//__ASP_TOOLS_STEREO_BLEND_H__
@@ -25,17 +25,29 @@
 #include <vw/Camera/PinholeModel.h>
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 #include <vw/Stereo/CorrelationView.h>
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_rfne.h>
+#include <asp/Tools/stereo_blend.h>
 #include <asp/Core/DemDisparity.h>
+#include <asp/Core/FftCorrelation.h>
+#include <asp/Core/SparseDisparity.h>
+#include <asp/Core/DisparityConsistency.h>
 #include <asp/Core/LocalHomography.h>
+#include <asp/Core/TileCache.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/MatchFile.h>
 #include <vw/Stereo/StereoModel.h>
 
 using namespace vw;
@@ -71,6 +83,13 @@ SemiGlobalMatcher::SgmSubpixelMode get_sgm_subpixel_mode() {
 }
 
 
+/// Combine into the key a hash of the contents of a file, which may not exist
+void hash_combine_file(size_t & key, std::string const& file) {
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  boost::hash_combine(key, bytes);
+}
+
 // Read the search range from D_sub, and scale it to the full image
 void read_search_range_from_dsub(ASPGlobalOptions & opt){
 
@@ -103,6 +122,63 @@ void read_search_range_from_dsub(ASPGlobalOptions & opt){
 
 
 
+/// Produces D_sub and D_sub_spread with the built-in version of
+/// sparse_disp, matching the full-resolution images at sparse points.
+void produce_sparse_lowres_disparity( ASPGlobalOptions & opt,
+                                      Vector2 const& downsample_scale ) {
+
+  DiskImageView<PixelGray<float> > left_image (opt.out_prefix + "-L.tif"),
+                                   right_image(opt.out_prefix + "-R.tif");
+  DiskImageView<vw::uint8> left_mask (opt.out_prefix + "-lMask.tif"),
+                           right_mask(opt.out_prefix + "-rMask.tif");
+  ImageViewRef<PixelMask<PixelGray<float> > >
+    left  = copy_mask(left_image,  create_mask(left_mask)),
+    right = copy_mask(right_image, create_mask(right_mask));
+
+  // Without a user-defined search range, use the default one of
+  // sparse_disp, no more than a quarter of the image size.
+  BBox2i search_range = stereo_settings().search_range;
+  if (!stereo_settings().is_search_defined()) {
+    Vector2i half_size;
+    for (int k = 0; k < 2; k++) {
+      int size = (k == 0) ? left.cols() : left.rows();
+      half_size[k] = std::min(1024 - 56, asp::next_power_of_two(size + 1)/2/4)/2;
+    }
+    search_range = BBox2i(-half_size, half_size);
+  }
+  vw_out() << "\t--> Sparse matching search range: " << search_range << "\n";
+
+  asp::SparseDispGrid grid = asp::sparse_disparity(left, right, search_range,
+                                                   asp::SparseDispOptions(),
+                                                   vw_settings().default_num_threads());
+
+  ImageView<vw::uint8> left_mask_sub = DiskImageView<vw::uint8>(opt.out_prefix + "-lMask_sub.tif");
+  std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+  vw_out() << "Writing: " << d_sub_file << std::endl;
+  vw::cartography::block_write_gdal_image(d_sub_file,
+                                          asp::interpolate_sparse_disparity(grid, left_mask_sub,
+                                                                            downsample_scale),
+                                          opt, TerminalProgressCallback("asp", "\t--> Low-resolution disparity:"));
+
+  // The spread is mandatory with this seed mode, and it is an integer
+  ImageView<PixelMask<Vector2f> > spread
+    = asp::interpolate_sparse_disparity(asp::sparse_disparity_spread(grid), left_mask_sub,
+                                        downsample_scale);
+  ImageView<PixelMask<Vector2i> > int_spread(spread.cols(), spread.rows());
+  for (int row = 0; row < spread.rows(); row++) {
+    for (int col = 0; col < spread.cols(); col++) {
+      int_spread(col, row) = PixelMask<Vector2i>(Vector2i(ceil(spread(col, row).child().x()),
+                                                          ceil(spread(col, row).child().y())));
+      if (!is_valid(spread(col, row)))
+        int_spread(col, row).invalidate();
+    }
+  }
+  std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+  vw_out() << "Writing: " << spread_file << std::endl;
+  vw::cartography::block_write_gdal_image(spread_file, int_spread, opt,
+                                          TerminalProgressCallback("asp", "\t--> Low-resolution disparity spread:"));
+}
+
 /// Produces the low-resolution disparity file D_sub
 void produce_lowres_disparity( ASPGlobalOptions & opt ) {
 
@@ -234,7 +310,10 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
     opt.session->camera_models(left_camera_model, right_camera_model);
     produce_dem_disparity(opt, left_camera_model, right_camera_model, opt.session->name());
   }else if ( stereo_settings().seed_mode == 3 ) {
-    // D_sub is already generated by now by sparse_disp
+    // D_sub is already generated by now by sparse_disp, unless
+    // the built-in version of it is used
+    if (stereo_settings().native_sparse_disp)
+      produce_sparse_lowres_disparity(opt, downsample_scale);
   }
 
   read_search_range_from_dsub(opt); // TODO: We already call this when needed!
@@ -525,21 +604,34 @@ double compute_ip(ASPGlobalOptions & opt, std::string & match_filename) {
 
 
 
-BBox2i get_search_range_from_ip_hists(vw::math::Histogram const& hist_x,
-                                      vw::math::Histogram const& hist_y,
-                                      double edge_discard_percentile = 0.05) {
+/// The quantiles of a set of values, found by sorting them once
+class SortedQuantiles {
+  std::vector<double> m_values;
+public:
+  SortedQuantiles(std::vector<double> const& values): m_values(values) {
+    std::sort(m_values.begin(), m_values.end());
+  }
+  double min() const { return m_values.front(); }
+  double max() const { return m_values.back (); }
+
+  /// The value of rank closest to p*(n-1), with p in [0, 1]
+  double operator()(double p) const {
+    size_t k = size_t(std::max(0.0, std::min(1.0, p))*(m_values.size() - 1) + 0.5);
+    return m_values[k];
+  }
+};
+
+BBox2i get_search_range_from_ip_quantiles(SortedQuantiles const& dx,
+                                          SortedQuantiles const& dy,
+                                          double edge_discard_percentile = 0.05) {
 
   const double min_percentile = edge_discard_percentile;
   const double max_percentile = 1.0 - edge_discard_percentile;
 
   const Vector2 FORCED_EXPANSION = Vector2(30,2); // Must expand range by at least this much
   double search_scale = 2.0;
-  size_t min_bin_x = hist_x.get_percentile(min_percentile);
-  size_t min_bin_y = hist_y.get_percentile(min_percentile);
-  size_t max_bin_x = hist_x.get_percentile(max_percentile);
-  size_t max_bin_y = hist_y.get_percentile(max_percentile);
-  Vector2 search_min(hist_x.get_bin_center(min_bin_x), hist_y.get_bin_center(min_bin_y));
-  Vector2 search_max(hist_x.get_bin_center(max_bin_x), hist_y.get_bin_center(max_bin_y));
+  Vector2 search_min(dx(min_percentile), dy(min_percentile));
+  Vector2 search_max(dx(max_percentile), dy(max_percentile));
   Vector2 search_center = (search_max + search_min) / 2.0;
   Vector2 d_min = search_min - search_center; // TODO: Make into a bbox function!
   Vector2 d_max = search_max - search_center;
@@ -584,8 +676,8 @@ BBox2i get_search_range_from_ip_hists(vw::math::Histogram const& hist_x,
 /// Use existing interest points to compute a search range
 /// - This function could use improvement!
 /// - Should it be used in all cases?
-BBox2i approximate_search_range(ASPGlobalOptions & opt, 
-                                double ip_scale, std::string const& match_filename) {
+BBox2i compute_ip_search_range(ASPGlobalOptions & opt, 
+                               double ip_scale, std::string const& match_filename) {
 
   vw_out() << "\t--> Using interest points to determine search window.\n";
   vector<ip::InterestPoint> in_ip1, in_ip2, matched_ip1, matched_ip2;
@@ -595,7 +687,7 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
     vw_throw( ArgumentErr() << "Missing IP file: " << match_filename);
 
   vw_out() << "\t    * Loading match file: " << match_filename << "\n";
-  ip::read_binary_match_file(match_filename, in_ip1, in_ip2);
+  asp::read_match_file(match_filename, in_ip1, in_ip2);
 
   // TODO: Consolidate IP adjustment
   // TODO: This logic is messed up. We __know__ from stereo_settings() what
@@ -650,22 +742,19 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
   vw_out(InfoMessage,"asp") << "Estimating search range with: " 
                             << num_ip << " interest points.\n";
 
-  // Record the disparities for each point pair
-  const double BIG_NUM   =  99999999;
-  const double SMALL_NUM = -99999999;
-  std::vector<double> dx, dy;
-  double min_dx = BIG_NUM, max_dx = SMALL_NUM,
-         min_dy = BIG_NUM, max_dy = SMALL_NUM;
+  if (num_ip == 0)
+    vw_throw(ArgumentErr() << "No interest points left after filtering, aborting stereo_corr.\n");
+
+  // Record the disparities for each point pair, sorted once for all
+  // the quantiles below
+  std::vector<double> diff_x(num_ip), diff_y(num_ip);
   for (size_t i = 0; i < num_ip; i++) {
-    double diffX = i_scale * (matched_ip2[i].x - matched_ip1[i].x);
-    double diffY = i_scale * (matched_ip2[i].y - matched_ip1[i].y);      
-    dx.push_back(diffX);
-    dy.push_back(diffY);
-    if (diffX < min_dx) min_dx = diffX;
-    if (diffY < min_dy) min_dy = diffY;
-    if (diffX > max_dx) max_dx = diffX;
-    if (diffY > max_dy) max_dy = diffY;
+    diff_x[i] = i_scale * (matched_ip2[i].x - matched_ip1[i].x);
+    diff_y[i] = i_scale * (matched_ip2[i].y - matched_ip1[i].y);
   }
+  SortedQuantiles dx(diff_x), dy(diff_y);
+  double min_dx = dx.min(), max_dx = dx.max(),
+         min_dy = dy.min(), max_dy = dy.max();
 
   vw_out(InfoMessage,"asp") << "Initial search range: " 
         << BBox2i(Vector2(min_dx,min_dy),Vector2(max_dx,max_dy)) << std::endl;
@@ -685,22 +774,6 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
     return search_range;
   }
   
-  // Compute histograms
-  const int NUM_BINS = 2000; // Accuracy is important with scaled pixels
-  vw::math::Histogram hist_x(NUM_BINS, min_dx, max_dx);
-  vw::math::Histogram hist_y(NUM_BINS, min_dy, max_dy);
-  for (size_t i = 0; i < dx.size(); ++i){
-    hist_x.add_value(dx[i]);
-    hist_y.add_value(dy[i]);
-  }
-
-
-  //printf("min x,y = %lf, %lf, max x,y = %lf, %lf\n", min_dx, min_dy, max_dx, max_dy);
-  
-  //for (int i=0; i<NUM_BINS; ++i) {
-  //  printf("%d => X: %lf: %lf,   Y:  %lf: %lf\n", i, centers_x[i], hist_x[i], centers_y[i], hist_y[i]);
-  //}
-
   const double PERCENTILE_CUTOFF     = 0.05; // Gradually increase the filtering
   const double PERCENTILE_CUTOFF_INC = 0.05; //  until the search width is reasonable.
   const double MAX_PERCENTILE_CUTOFF = 0.201;
@@ -710,7 +783,7 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
   BBox2i search_range;
   while (true) {
     vw_out() << "Filtering IP with percentile cutoff " << current_percentile_cutoff << std::endl;
-    search_range = get_search_range_from_ip_hists(hist_x, hist_y, current_percentile_cutoff);
+    search_range = get_search_range_from_ip_quantiles(dx, dy, current_percentile_cutoff);
     vw_out() << "Scaled search range = " << search_range << std::endl;
     search_width = search_range.width();
     
@@ -739,9 +812,151 @@ BBox2i approximate_search_range(ASPGlobalOptions & opt,
     vw_throw(ArgumentErr() << "Computed an empty search range!");
   
   return search_range;
+} // End function compute_ip_search_range
+
+/// The file caching the search range found from the given match file
+/// at the given scale. Its name holds a hash of the match file, of the
+/// alignment matrices, of the inputs, and of the settings used to
+/// filter the matches, so a stale range is never used.
+std::string ip_search_range_cache_file(ASPGlobalOptions const& opt, double ip_scale,
+                                       std::string const& match_filename) {
+  size_t key = 0;
+  hash_combine_file(key, match_filename);
+  hash_combine_file(key, opt.out_prefix + "-align-L.exr");
+  hash_combine_file(key, opt.out_prefix + "-align-R.exr");
+  boost::hash_combine(key, opt.in_file1);
+  boost::hash_combine(key, opt.in_file2);
+  boost::hash_combine(key, opt.cam_file1);
+  boost::hash_combine(key, opt.cam_file2);
+  boost::hash_combine(key, opt.stereo_session_string);
+  boost::hash_combine(key, ip_scale);
+  boost::hash_combine(key, stereo_settings().alignment_method);
+  boost::hash_combine(key, stereo_settings().min_num_ip);
+  for (int i = 0; i < 2; i++) {
+    boost::hash_combine(key, stereo_settings().elevation_limit[i]);
+    boost::hash_combine(key, stereo_settings().remove_outliers_by_disp_params[i]);
+    boost::hash_combine(key, stereo_settings().lon_lat_limit.min()[i]);
+    boost::hash_combine(key, stereo_settings().lon_lat_limit.max()[i]);
+    boost::hash_combine(key, stereo_settings().left_image_crop_win.min()[i]);
+    boost::hash_combine(key, stereo_settings().left_image_crop_win.max()[i]);
+    boost::hash_combine(key, stereo_settings().right_image_crop_win.min()[i]);
+    boost::hash_combine(key, stereo_settings().right_image_crop_win.max()[i]);
+  }
+
+  std::ostringstream os;
+  os << opt.out_prefix << "-ip-search-range-" << std::hex << key << ".txt";
+  return os.str();
+}
+
+/// The search range from interest points. It is read from the cache
+/// file if already found for the same matches and settings, which
+/// saves loading the cameras and filtering the matches, and written
+/// there otherwise.
+BBox2i approximate_search_range(ASPGlobalOptions & opt, 
+                                double ip_scale, std::string const& match_filename) {
+
+  if (!fs::exists(match_filename))
+    vw_throw( ArgumentErr() << "Missing IP file: " << match_filename);
+
+  std::string cache_file = ip_search_range_cache_file(opt, ip_scale, match_filename);
+  BBox2i search_range;
+  std::ifstream ifs(cache_file.c_str());
+  if (ifs >> search_range.min().x() >> search_range.min().y()
+          >> search_range.max().x() >> search_range.max().y()) {
+    vw_out() << "\t--> Using search range cached in: " << cache_file << "\n";
+    return search_range;
+  }
+
+  search_range = compute_ip_search_range(opt, ip_scale, match_filename);
+  std::ofstream ofs(cache_file.c_str());
+  ofs << search_range.min().x() << " " << search_range.min().y() << " "
+      << search_range.max().x() << " " << search_range.max().y() << "\n";
+  if (!ofs)
+    vw_out(WarningMessage) << "Could not write: " << cache_file << "\n";
+  return search_range;
 } // End function approximate_search_range
 
 
+/// The low-resolution disparity files of a given prefix
+std::string lowres_disparity_file(std::string const& prefix, bool spread) {
+  return prefix + (spread ? "-D_sub_spread.tif" : "-D_sub.tif");
+}
+
+/// The prefix of the low-resolution disparity in the cache directory.
+/// The key holds a hash of the subsampled aligned images and their
+/// masks, the full image size, the seed mode, the search range, and
+/// the settings used to find the low-resolution disparity, so runs
+/// sharing all of these share it.
+std::string lowres_disparity_cache_prefix(ASPGlobalOptions const& opt) {
+  size_t key = 0;
+  hash_combine_file(key, opt.out_prefix + "-L_sub.tif");
+  hash_combine_file(key, opt.out_prefix + "-R_sub.tif");
+  hash_combine_file(key, opt.out_prefix + "-lMask_sub.tif");
+  hash_combine_file(key, opt.out_prefix + "-rMask_sub.tif");
+  Vector2i full_size = file_image_size(opt.out_prefix + "-L.tif");
+  boost::hash_combine(key, full_size[0]);
+  boost::hash_combine(key, full_size[1]);
+
+  StereoSettings const& s = stereo_settings();
+  boost::hash_combine(key, s.seed_mode);
+  BBox2i const& r = s.search_range;
+  int range[] = {r.min().x(), r.min().y(), r.max().x(), r.max().y()};
+  for (int i = 0; i < 4; i++)
+    boost::hash_combine(key, range[i]);
+  if (s.seed_mode == 1) {
+    boost::hash_combine(key, s.seed_percent_pad);
+    boost::hash_combine(key, s.corr_kernel[0]);
+    boost::hash_combine(key, s.corr_kernel[1]);
+    boost::hash_combine(key, s.cost_mode);
+    boost::hash_combine(key, s.slogW);
+    boost::hash_combine(key, s.stereo_algorithm);
+    boost::hash_combine(key, s.xcorr_threshold);
+    boost::hash_combine(key, s.min_xcorr_level);
+    boost::hash_combine(key, s.corr_max_levels);
+    boost::hash_combine(key, s.corr_timeout);
+    boost::hash_combine(key, s.corr_blob_filter_area);
+    boost::hash_combine(key, s.sgm_collar_size);
+    boost::hash_combine(key, s.subpixel_mode);
+    boost::hash_combine(key, s.sgm_search_buffer[0]);
+    boost::hash_combine(key, s.sgm_search_buffer[1]);
+    boost::hash_combine(key, s.rm_threshold);
+    boost::hash_combine(key, s.rm_min_matches);
+    boost::hash_combine(key, s.rm_quantile_percentile);
+    boost::hash_combine(key, s.rm_quantile_multiple);
+  } else if (s.seed_mode == 2) {
+    // The cameras are not hashed, only their file names
+    boost::hash_combine(key, opt.cam_file1);
+    boost::hash_combine(key, opt.cam_file2);
+    boost::hash_combine(key, opt.stereo_session_string);
+    hash_combine_file(key, s.disparity_estimation_dem);
+    boost::hash_combine(key, s.disparity_estimation_dem_error);
+    boost::hash_combine(key, s.disparity_estimation_dem_lattice);
+  } else if (s.seed_mode == 3) {
+    hash_combine_file(key, opt.out_prefix + "-L.tif");
+    hash_combine_file(key, opt.out_prefix + "-R.tif");
+  }
+
+  std::ostringstream os;
+  os << s.lowres_disparity_cache_dir << "/lowres-" << std::hex << key;
+  return os.str();
+}
+
+/// Copy the low-resolution disparity, and its spread if present, from
+/// one prefix to another. Returns false if there is no disparity to copy.
+bool copy_lowres_disparity(std::string const& from_prefix, std::string const& to_prefix) {
+  if (!fs::exists(lowres_disparity_file(from_prefix, false)))
+    return false;
+  for (int k = 0; k < 2; k++) {
+    std::string from = lowres_disparity_file(from_prefix, k == 1);
+    std::string to   = lowres_disparity_file(to_prefix,   k == 1);
+    if (fs::exists(to))
+      fs::remove(to);
+    if (fs::exists(from))
+      fs::copy_file(from, to);
+  }
+  return true;
+}
+
 /// The first step of correlation computation.
 void lowres_correlation( ASPGlobalOptions & opt ) {
 
@@ -824,9 +1039,33 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
       rebuild = true;
     }
 
-    if ( rebuild )
+    // Seed mode 3 without the native sparse matcher gets D_sub from sparse_disp
+    bool use_cache = (!stereo_settings().lowres_disparity_cache_dir.empty() &&
+                      (stereo_settings().seed_mode != 3 ||
+                       stereo_settings().native_sparse_disp));
+    std::string cache_prefix;
+    if ( rebuild && use_cache ) {
+      cache_prefix = lowres_disparity_cache_prefix(opt);
+      if (copy_lowres_disparity(cache_prefix, opt.out_prefix)) {
+        vw_out() << "\t--> Using low-resolution disparity cached in: "
+                 << lowres_disparity_file(cache_prefix, false) << "\n";
+        read_search_range_from_dsub(opt);
+        rebuild = false;
+      }
+    }
+
+    if ( rebuild ) {
       produce_lowres_disparity(opt); // Note: This does not always remake D_sub!
-    else
+      if (use_cache) {
+        try {
+          fs::create_directories(stereo_settings().lowres_disparity_cache_dir);
+          copy_lowres_disparity(opt.out_prefix, cache_prefix);
+        } catch (fs::filesystem_error const& e) {
+          vw_out(WarningMessage) << "Could not cache the low-resolution disparity: "
+                                 << e.what() << "\n";
+        }
+      }
+    } else if (cache_prefix.empty())
       vw_out() << "\t--> Using cached low-resolution disparity: " << sub_disp_file << "\n";
   }
 
@@ -849,10 +1088,10 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
 /// This correlator takes a low resolution disparity image as an input
 /// so that it may narrow its search range for each tile that is processed.
 class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
-  DiskImageView<PixelGray<float> >   m_left_image;
-  DiskImageView<PixelGray<float> >   m_right_image;
-  DiskImageView<vw::uint8> m_left_mask;
-  DiskImageView<vw::uint8> m_right_mask;
+  ImageViewRef<PixelGray<float> >    m_left_image;
+  ImageViewRef<PixelGray<float> >    m_right_image;
+  ImageViewRef<vw::uint8>  m_left_mask;
+  ImageViewRef<vw::uint8>  m_right_mask;
   ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
   ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
   ImageView<Matrix3x3> const& m_local_hom;
@@ -867,9 +1106,10 @@ class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
 
 public:
 
-  // Set these input types here instead of making them template arguments
-  typedef DiskImageView<PixelGray<float> >   ImageType;
-  typedef DiskImageView<vw::uint8>           MaskType;
+  // Set these input types here instead of making them template arguments.
+  // The images are read from disk, maybe through a tile cache.
+  typedef ImageViewRef<PixelGray<float> >    ImageType;
+  typedef ImageViewRef<vw::uint8>            MaskType;
   typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
   typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
   typedef ImageType::pixel_type InputPixelType;
@@ -911,16 +1151,247 @@ public:
     return pixel_type();
   }
 
-  /// Does the work
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
+
+  /// Estimate the correlation cost of a region as its area times the area
+  /// of the seeded search range. The kernel size is the same for all
+  /// regions, so it is not included.
+  double estimate_cost(BBox2i const& bbox) const {
+    BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
+                      elem_quot(bbox.max(), m_upscale_factor) );
+    seed_bbox.expand(1);
+    seed_bbox.crop( m_seed_bbox );
+    BBox2f range = stereo::get_disparity_range( crop( m_sub_disp, seed_bbox ) );
+    if ( m_sub_disp_spread.cols() != 0 && m_sub_disp_spread.rows() != 0 ) {
+      BBox2f spread = stereo::get_disparity_range( crop( m_sub_disp_spread, seed_bbox ) );
+      range.min() -= spread.max();
+      range.max() += spread.max();
+    }
+    if (range.empty())
+      return 0.0;
+    double range_area = (range.width()  * m_upscale_factor[0] + 1.0) *
+                        (range.height() * m_upscale_factor[1] + 1.0);
+    return double(bbox.width()) * double(bbox.height()) * range_area;
+  }
+
+  /// Recursively split a tile into quadrants as long as doing so
+  /// reduces the estimated correlation cost by a good margin. That
+  /// happens when parts of the tile need a much smaller search range
+  /// than the tile as a whole, such as in mountains next to flat terrain.
+  void split_expensive_tile(BBox2i const& bbox, std::vector<BBox2i> & sub_tiles) const {
+
+    const double MIN_GAIN = 0.25; // Split only if it saves at least 25% of the work
+    int min_size = std::max(ASPGlobalOptions::rfne_tile_size(),
+                            4*std::max(m_kernel_size[0], m_kernel_size[1]));
+
+    if (bbox.width() < 2*min_size || bbox.height() < 2*min_size) {
+      sub_tiles.push_back(bbox);
+      return;
+    }
+
+    int half_x = bbox.width()/2, half_y = bbox.height()/2;
+    std::vector<BBox2i> quads;
+    quads.push_back(BBox2i(bbox.min().x(),          bbox.min().y(),
+                           half_x,                  half_y));
+    quads.push_back(BBox2i(bbox.min().x() + half_x, bbox.min().y(),
+                           bbox.width() - half_x,   half_y));
+    quads.push_back(BBox2i(bbox.min().x(),          bbox.min().y() + half_y,
+                           half_x,                  bbox.height() - half_y));
+    quads.push_back(BBox2i(bbox.min().x() + half_x, bbox.min().y() + half_y,
+                           bbox.width() - half_x,   bbox.height() - half_y));
+
+    double whole_cost = estimate_cost(bbox), quads_cost = 0.0;
+    for (size_t q = 0; q < quads.size(); q++)
+      quads_cost += estimate_cost(quads[q]);
+
+    if (quads_cost >= (1.0 - MIN_GAIN)*whole_cost) {
+      sub_tiles.push_back(bbox);
+      return;
+    }
+
+    for (size_t q = 0; q < quads.size(); q++)
+      split_expensive_tile(quads[q], sub_tiles);
+  }
+
+  /// Does the work
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
+    asp::numa_bind_current_thread();
+    asp::ScopedTimer timer("correlation_tile", bbox);
+    if (!asp::tile_capture_enabled())
+      return split_and_correlate(bbox);
+
+    Stopwatch sw;
+    sw.start();
+    prerasterize_type tile = split_and_correlate(bbox);
+    sw.stop();
+    if (asp::capture_tile_wanted(bbox, sw.elapsed_seconds()))
+      capture_tile(bbox, tile, sw.elapsed_seconds());
+    return tile;
+  }
+
+  /// Save the inputs of a tile and its result, so that it can be run
+  /// again by itself with replay_correlation_tile().
+  void capture_tile(BBox2i const& bbox, prerasterize_type const& result, double seconds) const {
+
+    std::string dir = asp::start_tile_capture("corr", bbox);
+
+    // The pixels the correlator reads around the tile, for the kernel
+    // and the filtering, at each pyramid level, and for the SGM collar
+    const int rm_half_kernel = 5;
+    int half_kernel = std::max(m_kernel_size[0], m_kernel_size[1])/2;
+    int margin = (1 << stereo_settings().corr_max_levels)*(half_kernel + rm_half_kernel + 2)
+               + stereo_settings().sgm_collar_size;
+    BBox2i left_box = bbox;
+    left_box.expand(margin);
+    left_box.crop(bounding_box(m_left_image));
+
+    Matrix<double> fullres_hom;
+    BBox2f search_range = tile_search_range(bbox, fullres_hom);
+    BBox2i right_box = asp::right_capture_box(left_box, search_range, fullres_hom);
+    right_box.crop(bounding_box(m_right_image));
+
+    asp::write_capture_crop(dir, "left",       m_left_image,  left_box);
+    asp::write_capture_crop(dir, "left_mask",  m_left_mask,   left_box);
+    asp::write_capture_crop(dir, "right",      m_right_image, right_box);
+    asp::write_capture_crop(dir, "right_mask", m_right_mask,  right_box);
+    if (m_sub_disp.cols() != 0 && m_sub_disp.rows() != 0)
+      asp::write_capture_crop(dir, "D_sub", m_sub_disp, bounding_box(m_sub_disp));
+    if (m_sub_disp_spread.cols() != 0 && m_sub_disp_spread.rows() != 0)
+      asp::write_capture_crop(dir, "D_sub_spread", m_sub_disp_spread,
+                              bounding_box(m_sub_disp_spread));
+    if (m_local_hom.cols() != 0 && m_local_hom.rows() != 0)
+      write_local_homographies(dir + "/local_hom.txt", m_local_hom);
+    asp::write_capture_crop(dir, "D", result, bbox);
+
+    asp::TileManifest manifest;
+    manifest.set("kind",           std::string("corr"));
+    manifest.set("tile",           bbox);
+    manifest.set("left_size",      Vector2i(m_left_image.cols(),  m_left_image.rows()));
+    manifest.set("right_size",     Vector2i(m_right_image.cols(), m_right_image.rows()));
+    manifest.set("left_box",       left_box);
+    manifest.set("right_box",      right_box);
+    manifest.set("search_range",   stereo_settings().search_range);
+    manifest.set("seconds_per_op", m_seconds_per_op);
+    manifest.set("seconds",        seconds);
+    manifest.write(dir);
+  }
+
+  /// Correlate a tile, split into smaller ones if that saves work
+  prerasterize_type split_and_correlate(BBox2i const& bbox) const {
+
+    // Splitting is only done for the local window search with a seed
+    // and no local homography (which is defined per full tile). SGM
+    // must process the whole image as one tile.
+    bool can_split = ( stereo_settings().split_expensive_corr_tiles &&
+                       stereo_settings().seed_mode > 0              &&
+                       !stereo_settings().use_local_homography      &&
+                       stereo_settings().stereo_algorithm == vw::stereo::CORRELATION_WINDOW );
+    if (!can_split)
+      return correlate_tile(bbox);
+
+    std::vector<BBox2i> sub_tiles;
+    split_expensive_tile(bbox, sub_tiles);
+    if (sub_tiles.size() <= 1)
+      return correlate_tile(bbox);
+
+    VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView: splitting tile " << bbox
+                                   << " into " << sub_tiles.size() << " sub-tiles.\n";
+
+    // Each sub-tile gets its own, tighter search range
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (size_t t = 0; t < sub_tiles.size(); t++)
+      crop(tile, sub_tiles[t] - bbox.min()) = crop(correlate_tile(sub_tiles[t]), sub_tiles[t]);
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  /// Correlate the given tile of the two images with the given search
+  /// range. This is the single place where the correlation algorithm is
+  /// invoked, for all tiles and with or without a local homography.
+  template <class RightImageT, class RightMaskT>
+  prerasterize_type correlate_images(ImageType   const& left_image,
+                                     RightImageT const& right_image,
+                                     MaskType    const& left_mask,
+                                     RightMaskT  const& right_mask,
+                                     BBox2f      const& search_range,
+                                     BBox2i      const& bbox) const {
+
+    SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
+    Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
+    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+
+    // With SGM, the consistency check may be done here from the forward
+    // disparity alone, rather than by correlating again right to left
+    bool single_pass_xcorr = ( stereo_settings().single_pass_xcorr &&
+                               stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW &&
+                               stereo_settings().xcorr_threshold >= 0 );
+    float xcorr_threshold = single_pass_xcorr ? -1 : stereo_settings().xcorr_threshold;
+
+    typedef vw::stereo::PyramidCorrelationView<ImageType, RightImageT,
+                                               MaskType,  RightMaskT > CorrView;
+    CorrView corr_view( left_image,   right_image,
+                        left_mask,    right_mask,
+                        static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                        stereo_settings().slogW,
+                        search_range,
+                        m_kernel_size,  m_cost_mode,
+                        m_corr_timeout, m_seconds_per_op,
+                        xcorr_threshold,
+                        stereo_settings().min_xcorr_level,
+                        rm_half_kernel,
+                        stereo_settings().corr_max_levels,
+                        static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm),
+                        stereo_settings().sgm_collar_size,
+                        sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
+                        stereo_settings().corr_blob_filter_area,
+                        stereo_settings().stereo_debug );
+    if (!single_pass_xcorr)
+      return corr_view.prerasterize(bbox);
+
+    ImageView<pixel_type> tile = crop(corr_view.prerasterize(bbox), bbox);
+
+    // The image pixels under the kernel around the tile and its matches.
+    // Subpixel disparities may go a little past the search range.
+    int half_kernel = std::max(m_kernel_size[0], m_kernel_size[1])/2;
+    BBox2i left_box = bbox;
+    left_box.expand(half_kernel);
+    left_box.crop(bounding_box(left_image));
+    BBox2i right_box = bbox;
+    right_box.min() += Vector2i(floor(search_range.min().x()), floor(search_range.min().y()));
+    right_box.max() += Vector2i(ceil (search_range.max().x()), ceil (search_range.max().y()));
+    right_box.expand(half_kernel + 1);
+    right_box.crop(bounding_box(right_image));
+    if (left_box.empty() || right_box.empty())
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+    ImageView<float> left_tile  = select_channel(crop(left_image,  left_box),  0);
+    ImageView<float> right_tile = select_channel(crop(right_image, right_box), 0);
+    asp::ConsistencyCost check_cost = asp::MEAN_ABSOLUTE_DIFFERENCE;
+    if (m_cost_mode == stereo::CENSUS_TRANSFORM)
+      check_cost = asp::CENSUS_COST;
+    else if (m_cost_mode == stereo::TERNARY_CENSUS_TRANSFORM)
+      check_cost = asp::TERNARY_CENSUS_COST;
+    int num_invalidated
+      = asp::single_pass_consistency_check(left_tile,  left_box.min()  - bbox.min(),
+                                           right_tile, right_box.min() - bbox.min(),
+                                           m_kernel_size, stereo_settings().xcorr_threshold,
+                                           tile, check_cost);
+    VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView(" << bbox << "): the consistency check "
+                                   << "removed " << num_invalidated << " pixels.\n";
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  /// The search range of a tile, found from the seed. With a local
+  /// homography, also the full-resolution homography the right image
+  /// is transformed with for this tile.
+  BBox2f tile_search_range(BBox2i const& bbox, Matrix<double> & fullres_hom) const {
+
     bool use_local_homography = stereo_settings().use_local_homography;
 
-    Matrix<double> lowres_hom  = math::identity_matrix<3>();
-    Matrix<double> fullres_hom = math::identity_matrix<3>();
-    ImageViewRef<InputPixelType> right_trans_img;
-    ImageViewRef<vw::uint8     > right_trans_mask;
+    Matrix<double> lowres_hom = math::identity_matrix<3>();
+    fullres_hom = math::identity_matrix<3>();
 
     bool do_round = true; // round integer disparities after transform
 
@@ -981,15 +1452,6 @@ public:
         Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
         Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
         fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-        ImageViewRef< PixelMask<InputPixelType> >
-          right_trans_masked_img
-          = transform (copy_mask( m_right_image.impl(),
-			          create_mask(m_right_mask.impl()) ),
-	               HomographyTransform(fullres_hom),
-	               m_left_image.impl().cols(), m_left_image.impl().rows());
-        right_trans_img  = apply_mask(right_trans_masked_img);
-        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
       } //endif use_local_homography
 
       local_search_range = grow_bbox_to_int(local_search_range);
@@ -1019,53 +1481,35 @@ public:
       VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
     }
 
-    SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
-    Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
+    return local_search_range;
+  }
 
-    // Now we are ready to actually perform correlation
-    const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
-    if (use_local_homography){
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
-                                                 MaskType,  ImageViewRef<vw::uint8     > > CorrView;
-      CorrView corr_view( m_left_image,   right_trans_img,
-                          m_left_mask,    right_trans_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
-    }else{
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
-      CorrView corr_view( m_left_image,   m_right_image,
-                          m_left_mask,    m_right_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
-    }
-    
-  } // End function prerasterize_helper
+  /// Correlate a single tile, with the search range found from the seed.
+  inline prerasterize_type correlate_tile(BBox2i const& bbox) const {
+
+    Matrix<double> fullres_hom;
+    BBox2f local_search_range = tile_search_range(bbox, fullres_hom);
+
+    if (!stereo_settings().use_local_homography)
+      return correlate_images(m_left_image, m_right_image,
+                              m_left_mask,  m_right_mask,
+                              local_search_range, bbox);
+
+    // Correlate with the right image transformed by the local homography
+    ImageViewRef< PixelMask<InputPixelType> >
+      right_trans_masked_img
+      = transform (copy_mask( m_right_image.impl(),
+                              create_mask(m_right_mask.impl()) ),
+                   HomographyTransform(fullres_hom),
+                   m_left_image.impl().cols(), m_left_image.impl().rows());
+    ImageViewRef<InputPixelType> right_trans_img  = apply_mask(right_trans_masked_img);
+    ImageViewRef<vw::uint8     > right_trans_mask
+      = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
+    return correlate_images(m_left_image, right_trans_img,
+                            m_left_mask,  right_trans_mask,
+                            local_search_range, bbox);
+
+  } // End function correlate_tile
 
   template <class DestT>
   inline void rasterize(DestT const& dest, BBox2i bbox) const {
@@ -1074,6 +1518,166 @@ public:
 }; // End class SeededCorrelatorView
 
 
+/// Metadata tag in D.tif storing the inputs that produced it
+const std::string CORR_CACHE_KEY_TAG_STR = "CORRELATION_CACHE_KEY";
+
+/// Append a cheap signature of a file (size and modification time) to a stream.
+void append_file_signature(std::string const& file, std::ostringstream & os) {
+  os << file << " ";
+  if (!fs::exists(file)) {
+    os << "none ";
+    return;
+  }
+  os << fs::file_size(file) << " " << fs::last_write_time(file) << " ";
+}
+
+/// Form a string which uniquely identifies the inputs and settings that
+/// determine the full-resolution integer disparity of this tile. Settings
+/// used only by later stages (e.g., subpixel refinement with the local
+/// window algorithm) are not part of the key, so changing them still allows reuse.
+std::string correlation_cache_key(ASPGlobalOptions const& opt) {
+
+  std::ostringstream os;
+  os.precision(17);
+
+  append_file_signature(opt.out_prefix + "-L.tif",     os);
+  append_file_signature(opt.out_prefix + "-R.tif",     os);
+  append_file_signature(opt.out_prefix + "-lMask.tif", os);
+  append_file_signature(opt.out_prefix + "-rMask.tif", os);
+  if (stereo_settings().seed_mode > 0) {
+    append_file_signature(opt.out_prefix + "-D_sub.tif",        os);
+    append_file_signature(opt.out_prefix + "-D_sub_spread.tif", os);
+    if (stereo_settings().use_local_homography)
+      append_file_signature(opt.out_prefix + "-local_hom.txt", os);
+  }
+
+  os << stereo_settings().trans_crop_win      << " "
+     << stereo_settings().seed_mode           << " "
+     << stereo_settings().search_range        << " "
+     << stereo_settings().search_range_limit  << " "
+     << stereo_settings().corr_kernel         << " "
+     << stereo_settings().cost_mode           << " "
+     << stereo_settings().pre_filter_mode     << " "
+     << stereo_settings().slogW               << " "
+     << stereo_settings().xcorr_threshold     << " "
+     << stereo_settings().min_xcorr_level     << " "
+     << stereo_settings().corr_max_levels     << " "
+     << stereo_settings().corr_timeout        << " "
+     << stereo_settings().stereo_algorithm    << " "
+     << stereo_settings().corr_blob_filter_area << " "
+     << stereo_settings().use_local_homography << " "
+     << stereo_settings().single_pass_xcorr   << " ";
+
+  // SGM and MGM also do subpixel refinement during correlation
+  if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW) {
+    os << stereo_settings().sgm_collar_size      << " "
+       << stereo_settings().sgm_search_buffer    << " "
+       << stereo_settings().corr_memory_limit_mb << " "
+       << stereo_settings().corr_tile_size_ovr   << " "
+       << get_sgm_subpixel_mode()                << " ";
+  }
+
+  return os.str();
+}
+
+/// Return true if the disparity on disk was created with the given key.
+bool has_cached_disparity(std::string const& d_file, std::string const& key) {
+
+  if (!fs::exists(d_file))
+    return false;
+
+  std::string cached_key;
+  try {
+    boost::shared_ptr<vw::DiskImageResource> rsrc(new vw::DiskImageResourceGDAL(d_file));
+    if (!vw::cartography::read_header_string(*rsrc.get(), CORR_CACHE_KEY_TAG_STR, cached_key))
+      return false;
+  } catch (...) {
+    // Corrupted or partially written file
+    return false;
+  }
+
+  return (cached_key == key);
+}
+
+/// Run subpixel refinement on the integer disparity as it gets computed,
+/// and write only the refined disparity, RD.tif. Each block of integer
+/// disparity is cached, so that it is correlated only once, even though
+/// the refinement of neighboring tiles needs it too. The integer
+/// disparity, D.tif, is saved as well only with --stereo-debug.
+void correlate_and_refine(ASPGlobalOptions & opt,
+                          SeededCorrelatorView const& seeded_correlator,
+                          ImageViewRef<PixelMask<Vector2f> > const& sub_disp,
+                          ImageView<Matrix3x3> const& local_hom,
+                          bool has_left_georef,
+                          cartography::GeoReference const& left_georef) {
+
+  DiskImageView<PixelGray<float> > left_image (opt.out_prefix+"-L.tif"),
+                                   right_image(opt.out_prefix+"-R.tif");
+  ImageViewRef<uint8> right_mask = DiskImageView<vw::uint8>(opt.out_prefix + "-rMask.tif");
+  BBox2i trans_crop_win = stereo_settings().trans_crop_win;
+  bool   has_nodata     = false;
+  double nodata         = -32768.0;
+
+  // Correlate only in the crop window, plus a margin the size of the
+  // subpixel kernel, beyond which the refinement does not look.
+  // Outside of that the integer disparity is invalid.
+  BBox2i corr_win = trans_crop_win;
+  corr_win.expand(max(stereo_settings().subpixel_kernel));
+  corr_win.crop(bounding_box(left_image));
+
+  // Round to integer, as when going through D.tif on disk
+  int ts = opt.raster_tile_size[0];
+  ImageViewRef<PixelMask<Vector2f> > integer_disp
+    = crop(edge_extend(block_cache(pixel_cast<PixelMask<Vector2f> >
+                                   (pixel_cast<PixelMask<Vector2i> >
+                                    (crop(seeded_correlator, corr_win))),
+                                   Vector2i(ts, ts), opt.num_threads),
+                       ZeroEdgeExtension()),
+           BBox2i(-corr_win.min().x(), -corr_win.min().y(),
+                  left_image.cols(), left_image.rows()));
+
+  if (stereo_settings().stereo_debug) {
+    string d_file = opt.out_prefix + "-D.tif";
+    vw_out() << "Writing: " << d_file << "\n";
+    if (asp::compact_integer_disparity())
+      vw::cartography::block_write_gdal_image(d_file,
+                pixel_cast<PixelMask<Vector<int16, 2> > >(crop(integer_disp, trans_crop_win)),
+                has_left_georef, left_georef,
+                has_nodata, nodata, asp::disparity_write_options(opt, true),
+                asp::StatusProgressCallback("asp", "\t--> Correlation :") );
+    else
+      vw::cartography::block_write_gdal_image(d_file,
+                pixel_cast<PixelMask<Vector2i> >(crop(integer_disp, trans_crop_win)),
+                has_left_georef, left_georef,
+                has_nodata, nodata, asp::disparity_write_options(opt, true),
+                asp::StatusProgressCallback("asp", "\t--> Correlation :") );
+  }
+
+  // Print the refinement messages
+  bool verbose = true;
+  ImageView<PixelGray<float>    > left_dummy(1, 1), right_dummy(1, 1);
+  ImageView<PixelMask<Vector2f> > dummy_disp(1, 1);
+  refine_disparity(left_dummy, right_dummy, dummy_disp, opt, verbose);
+
+  PerTileRfne< DiskImageView<PixelGray<float> >, DiskImageView<PixelGray<float> >,
+               ImageViewRef<PixelMask<Vector2f> > >
+    rfne_view = per_tile_rfne(left_image, right_image, right_mask,
+                              integer_disp, sub_disp, local_hom, opt);
+  ImageViewRef< PixelMask<Vector2f> > refined_disp
+    = crop(rfne_view, trans_crop_win);
+
+  // Write with the refinement tile size, as stereo_rfne does
+  int rfne_ts = stereo_settings().rfne_tile_size_ovr;
+  opt.raster_tile_size = Vector2i(rfne_ts, rfne_ts);
+  string rd_file = opt.out_prefix + "-RD.tif";
+  vw_out() << "Writing: " << rd_file << "\n";
+  vw::cartography::block_write_gdal_image(rd_file, refined_disp,
+                              has_left_georef, left_georef,
+                              has_nodata, nodata, asp::disparity_write_options(opt, false),
+                              asp::StatusProgressCallback("asp", "\t--> Correlation and refinement :") );
+  rfne_view.report_selective_stats();
+}
+
 /// Main stereo correlation function, called after parsing input arguments.
 void stereo_correlation( ASPGlobalOptions& opt ) {
 
@@ -1082,8 +1686,10 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   // Note that even when we are told to skip low-resolution correlation,
   // we must still go through the motions when seed_mode is 0, to be
   // able to get a search range, even though we don't write D_sub then.
-  if (!stereo_settings().skip_low_res_disparity_comp || stereo_settings().seed_mode == 0)
+  if (!stereo_settings().skip_low_res_disparity_comp || stereo_settings().seed_mode == 0) {
+    asp::ScopedTimer timer("low_res_correlation");
     lowres_correlation(opt);
+  }
 
   if (stereo_settings().compute_low_res_disparity_only) 
     return; // Just computed the low-res disparity, so quit.
@@ -1152,13 +1758,33 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   if (corr_timeout > 0)
     seconds_per_op = calc_seconds_per_op(cost_mode, left_disk_image, right_disk_image, kernel_size);
 
+  // The correlation tiles read overlapping regions of the images, for
+  // the kernel and search range around them, which with a budget are
+  // read once and shared through a cache.
+  SeededCorrelatorView::ImageType left_image  = left_disk_image, right_image = right_disk_image;
+  SeededCorrelatorView::MaskType  left_mask   = Lmask,           right_mask  = Rmask;
+  double image_cache_mb = stereo_settings().corr_image_cache_size;
+  if (image_cache_mb > 0) {
+    vw_out() << "\t--> Caching up to " << image_cache_mb << " MB of image tiles.\n";
+    const int cache_block_size = 256;
+    asp::set_tile_cache_budget("corr_image", image_cache_mb);
+    asp::set_tile_cache_budget("corr_mask",  image_cache_mb/4.0); // one byte per pixel
+    boost::shared_ptr< asp::TileCache<PixelGray<float> > >
+      image_cache(new asp::TileCache<PixelGray<float> >("corr_image", cache_block_size));
+    boost::shared_ptr< asp::TileCache<vw::uint8> >
+      mask_cache(new asp::TileCache<vw::uint8>("corr_mask", cache_block_size));
+    left_image  = asp::TileCachedView<PixelGray<float> >(left_disk_image,  image_cache, 0);
+    right_image = asp::TileCachedView<PixelGray<float> >(right_disk_image, image_cache, 1);
+    left_mask   = asp::TileCachedView<vw::uint8>(Lmask, mask_cache, 0);
+    right_mask  = asp::TileCachedView<vw::uint8>(Rmask, mask_cache, 1);
+  }
+
   // Set up the reference to the stereo disparity code
   // - Processing is limited to trans_crop_win for use with parallel_stereo.
-  ImageViewRef<PixelMask<Vector2f> > fullres_disparity =
-    crop(SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
-                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
-                               cost_mode, corr_timeout, seconds_per_op ), 
-         trans_crop_win);
+  SeededCorrelatorView seeded_correlator( left_image, right_image, left_mask, right_mask,
+                                          sub_disp, sub_disp_spread, local_hom, kernel_size,
+                                          cost_mode, corr_timeout, seconds_per_op );
+  ImageViewRef<PixelMask<Vector2f> > fullres_disparity = crop(seeded_correlator, trans_crop_win);
 
   // With SGM, we must do the entire image chunk as one tile. Otherwise,
   // if it gets done in smaller tiles, there will be artifacts at tile boundaries.
@@ -1194,7 +1820,27 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   bool   has_nodata      = false;
   double nodata          = -32768.0;
 
+  if (stereo_settings().fuse_correlation_refinement && !using_sgm) {
+    correlate_and_refine(opt, seeded_correlator, sub_disp, local_hom,
+                         has_left_georef, left_georef);
+    asp::report_tile_cache_stats();
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
+    return;
+  }
+
   string d_file = opt.out_prefix + "-D.tif";
+
+  // Record what produced this disparity, so that a later run with the
+  // same inputs and correlation settings can reuse it.
+  std::string cache_key = correlation_cache_key(opt);
+  std::map<std::string, std::string> keywords;
+  keywords[CORR_CACHE_KEY_TAG_STR] = cache_key;
+  if (stereo_settings().reuse_cached_disparity && has_cached_disparity(d_file, cache_key)) {
+    vw_out() << "\t--> Using cached full-resolution disparity: " << d_file << "\n";
+    vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
+    return;
+  }
+
   vw_out() << "Writing: " << d_file << "\n";
   if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW) {
     // SGM performs subpixel correlation in this step, so write out floats.
@@ -1206,29 +1852,106 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
     opt.raster_tile_size = Vector2i(ASPGlobalOptions::rfne_tile_size(),ASPGlobalOptions::rfne_tile_size());
     vw::cartography::block_write_gdal_image(d_file, result,
 			        has_left_georef, left_georef,
-			        has_nodata, nodata, opt,
-			        TerminalProgressCallback("asp", "\t--> Correlation :") );
-			        
+			        has_nodata, nodata, asp::disparity_write_options(opt, false),
+			        asp::StatusProgressCallback("asp", "\t--> Correlation :"),
+			        keywords );
+
+    // Under parallel_stereo, the tile folder name is the tile without the collar
+    int collar_size = stereo_settings().blend_collar_size;
+    if (collar_size > 0) {
+      std::string tile_folder = fs::path(opt.out_prefix).parent_path().filename().string();
+      write_blend_collars(opt, result, bbox_from_folder(tile_folder), collar_size);
+    }
+
   } else {
     // Otherwise cast back to integer results to save on storage space.
-    vw::cartography::block_write_gdal_image(d_file, 
-              pixel_cast<PixelMask<Vector2i> >(fullres_disparity),
-			        has_left_georef, left_georef,
-			        has_nodata, nodata, opt,
-			        TerminalProgressCallback("asp", "\t--> Correlation :") );
+    if (asp::compact_integer_disparity())
+      vw::cartography::block_write_gdal_image(d_file,
+                pixel_cast<PixelMask<Vector<int16, 2> > >(fullres_disparity),
+                has_left_georef, left_georef,
+                has_nodata, nodata, asp::disparity_write_options(opt, true),
+                asp::StatusProgressCallback("asp", "\t--> Correlation :"),
+                keywords );
+    else
+      vw::cartography::block_write_gdal_image(d_file,
+                pixel_cast<PixelMask<Vector2i> >(fullres_disparity),
+                has_left_georef, left_georef,
+                has_nodata, nodata, asp::disparity_write_options(opt, true),
+                asp::StatusProgressCallback("asp", "\t--> Correlation :"),
+                keywords );
   }
+  asp::report_tile_cache_stats();
 
   vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
 
 } // End function stereo_correlation
 
-int main(int argc, char* argv[]) {
+/// Correlate again, by itself, a tile captured with --capture-tiles or
+/// --capture-slow-tiles, with the settings of the run it was captured
+/// from, and compare the result with the one saved then.
+void replay_correlation_tile(std::string const& dir) {
+
+  asp::TileManifest manifest;
+  manifest.read(dir);
+  if (manifest.get_string("kind") != "corr")
+    vw_throw( ArgumentErr() << "Not a captured correlation tile: " << dir << ".\n" );
+  asp::load_captured_settings(dir);
+  stereo_settings().search_range = manifest.get_bbox("search_range");
+
+  BBox2i   bbox       = manifest.get_bbox("tile");
+  BBox2i   left_box   = manifest.get_bbox("left_box");
+  BBox2i   right_box  = manifest.get_bbox("right_box");
+  Vector2i left_size  = manifest.get_vector("left_size");
+  Vector2i right_size = manifest.get_vector("right_size");
+
+  SeededCorrelatorView::ImageType left_image
+    = asp::read_capture_crop<PixelGray<float> >(dir, "left", left_box, left_size);
+  SeededCorrelatorView::ImageType right_image
+    = asp::read_capture_crop<PixelGray<float> >(dir, "right", right_box, right_size);
+  SeededCorrelatorView::MaskType left_mask
+    = asp::read_capture_crop<vw::uint8>(dir, "left_mask", left_box, left_size);
+  SeededCorrelatorView::MaskType right_mask
+    = asp::read_capture_crop<vw::uint8>(dir, "right_mask", right_box, right_size);
+
+  ImageViewRef<PixelMask<Vector2f> > sub_disp;
+  ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
+  ImageView<Matrix3x3> local_hom;
+  if (fs::exists(dir + "/D_sub.tif"))
+    sub_disp = DiskImageView<PixelMask<Vector2f> >(dir + "/D_sub.tif");
+  if (fs::exists(dir + "/D_sub_spread.tif"))
+    sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(dir + "/D_sub_spread.tif");
+  if (fs::exists(dir + "/local_hom.txt"))
+    read_local_homographies(dir + "/local_hom.txt", local_hom);
+
+  SeededCorrelatorView seeded_correlator( left_image, right_image, left_mask, right_mask,
+                                          sub_disp, sub_disp_spread, local_hom,
+                                          stereo_settings().corr_kernel, get_cost_mode_value(),
+                                          stereo_settings().corr_timeout,
+                                          manifest.get_double("seconds_per_op") );
+
+  vw_out() << "Replaying correlation tile " << bbox << " from: " << dir << "\n";
+  Stopwatch sw;
+  sw.start();
+  ImageView<PixelMask<Vector2f> > result = crop(seeded_correlator.prerasterize(bbox), bbox);
+  sw.stop();
+  asp::report_replayed_tile(dir, "D", result, sw.elapsed_seconds());
+}
+
+int stereo_corr_main(int argc, char* argv[]) {
 
   //try {
     xercesc::XMLPlatformUtils::Initialize();
 
     stereo_register_sessions();
 
+    // Run a single captured tile, without the rest of the inputs
+    std::string replay_dir;
+    if (asp::replay_tile_option(argc, argv, replay_dir)) {
+      replay_correlation_tile(replay_dir);
+      xercesc::XMLPlatformUtils::Terminate();
+      return 0;
+    }
+
     bool verbose = false;
     vector<ASPGlobalOptions> opt_vec;
     string output_prefix;
@@ -1262,7 +1985,10 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_correlation( opt );
+    {
+      asp::ScopedTimer timer("stereo_corr");
+      stereo_correlation( opt );
+    }
   
     xercesc::XMLPlatformUtils::Terminate();
   //} ASP_STANDARD_CATCHES;
@@ -1270,3 +1996,8 @@ int main(int argc, char* argv[]) {
   return 0;
 }
 
+#ifndef ASP_STEREO_ALL_STAGES
+int main(int argc, char* argv[]) {
+  return stereo_corr_main(argc, argv);
+}
+#endif
@@ -28,6 +28,7 @@
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/SmallBlobs.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -83,6 +84,8 @@ public:
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
+    asp::ScopedTimer timer("texture_filter_tile", bbox);
+
     // Figure out the largest kernel expansion we need to support the filtering
     int max_half_kernel = m_texture_smooth_range;
     if (m_max_smooth_kernel_size > max_half_kernel)
@@ -90,12 +93,29 @@ public:
     max_half_kernel += m_median_filter_size; // Don't forget we apply two kernels in succession
     max_half_kernel /= 2;
 
-    // Rasterize both input image regions
+    // Rasterize the input disparity region
     BBox2i bbox2 = bbox;
     bbox2.expand(max_half_kernel);
     bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
-    ImageView<typename ImageT::pixel_type> input_tile      = crop(m_img,      bbox2);
-    ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
+    ImageView<pixel_type> input_disp_tile = crop(m_disp_img, bbox2);
+
+    // With no valid disparity there is nothing to filter, and the input
+    // image need not be read either. This is common around the images.
+    bool has_valid = false;
+    for (int row = 0; row < input_disp_tile.rows() && !has_valid; row++) {
+      for (int col = 0; col < input_disp_tile.cols(); col++) {
+        if (is_valid(input_disp_tile(col, row))) {
+          has_valid = true;
+          break;
+        }
+      }
+    }
+    if (!has_valid)
+      return prerasterize_type(input_disp_tile,
+                               -bbox2.min().x(), -bbox2.min().y(),
+                               cols(), rows() );
+
+    ImageView<typename ImageT::pixel_type> input_tile = crop(m_img, bbox2);
 
     ImageView<float> texture_image;
     vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
@@ -170,6 +190,8 @@ public:
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
+    asp::ScopedTimer timer("blob_filter_tile", bbox);
+
     int area = stereo_settings().erode_max_size;
 
     // We look a beyond the current tile, to avoid cutting blobs
@@ -197,8 +219,18 @@ public:
 };
 
 template <class ImageT>
-PerTileErode<ImageT>
+ImageViewRef<typename ImageT::pixel_type>
 per_tile_erode( ImageViewBase<ImageT> const& img) {
+
+  // Find the islands over the whole image if asked, so that those
+  // crossing tiles are not cut.
+  if (stereo_settings().erode_across_tiles) {
+    vw_out() << "\t--> Finding the blobs to remove over the whole image.\n";
+    return asp::erode_small_blobs(img.impl(), stereo_settings().erode_max_size,
+                                  vw::vw_settings().default_tile_size(),
+                                  vw::vw_settings().default_num_threads());
+  }
+
   typedef PerTileErode<ImageT> return_type;
   return return_type( img.impl() );
 }
@@ -279,6 +311,7 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
   bool removeSmallBlobs = (stereo_settings().erode_max_size > 0);
 
   string outF = opt.out_prefix + "-F.tif";
+  vw::cartography::GdalWriteOptions disp_opt = asp::disparity_write_options(opt, false);
 
   // Fill holes
   if(stereo_settings().enable_fill_holes) {
@@ -303,8 +336,8 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
                                    inpaint(inputview.impl(), smallHoleIndex,
                                            use_grassfire, default_inpaint_val),
                                    has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
-                                   TerminalProgressCallback
+                                   has_nodata, nodata, disp_opt,
+                                   asp::StatusProgressCallback
                                    ("asp","\t--> Filtering: ") );
     }
     else { // Add small blob removal step
@@ -318,8 +351,8 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
                                             use_grassfire,
                                             default_inpaint_val) ),
                                    has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
-                                   TerminalProgressCallback
+                                   has_nodata, nodata, disp_opt,
+                                   asp::StatusProgressCallback
                                    ("asp","\t--> Filtering: ") );
     }
 
@@ -328,8 +361,8 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
       vw_out() << "Writing: " << outF << endl;
       vw::cartography::block_write_gdal_image( outF, inputview.impl(),
                                    has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
-                                   TerminalProgressCallback
+                                   has_nodata, nodata, disp_opt,
+                                   asp::StatusProgressCallback
                                    ("asp", "\t--> Filtering: ") );
     }
     else { // Add small blob removal step
@@ -338,8 +371,8 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
       vw_out() << "Writing: " << outF << endl;
       vw::cartography::block_write_gdal_image(outF, per_tile_erode(inputview.impl()),
                                   has_left_georef, left_georef,
-                                  has_nodata, nodata, opt,
-                                  TerminalProgressCallback
+                                  has_nodata, nodata, disp_opt,
+                                  asp::StatusProgressCallback
                                   ("asp","\t--> Filtering: ") );
     }
 
@@ -448,7 +481,7 @@ void stereo_filtering( ASPGlobalOptions& opt ) {
   }
 } // end stereo_filtering()
 
-int main(int argc, char* argv[]) {
+int stereo_fltr_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -475,7 +508,10 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_filtering( opt );
+    {
+      asp::ScopedTimer timer("stereo_fltr");
+      stereo_filtering( opt );
+    }
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : FILTERING FINISHED \n";
@@ -485,3 +521,9 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+#ifndef ASP_STEREO_ALL_STAGES
+int main(int argc, char* argv[]) {
+  return stereo_fltr_main(argc, argv);
+}
+#endif
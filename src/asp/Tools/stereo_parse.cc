@@ -117,56 +117,49 @@ int main( int argc, char* argv[] ) {
 
     //vw_out() << "corr_tile_size," << ASPGlobalOptions::corr_tile_size() << endl;
     vw_out() << "corr_tile_size," << stereo_settings().corr_tile_size_ovr << endl;
-    vw_out() << "rfne_tile_size," << ASPGlobalOptions::rfne_tile_size() << endl;
-    vw_out() << "tri_tile_size,"  << ASPGlobalOptions::tri_tile_size()  << endl;
+    vw_out() << "rfne_tile_size," << stereo_settings().rfne_tile_size_ovr << endl;
+    vw_out() << "tri_tile_size,"  << stereo_settings().tri_tile_size_ovr  << endl;
 
     vw_out() << "stereo_algorithm," << stereo_settings().stereo_algorithm << endl;
+    vw_out() << "fuse_correlation_refinement," << stereo_settings().fuse_correlation_refinement << endl;
+    vw_out() << "write_las," << stereo_settings().write_las << endl;
+    vw_out() << "native_sparse_disp," << stereo_settings().native_sparse_disp << endl;
+    vw_out() << "telemetry," << stereo_settings().telemetry << endl;
     if (stereo_settings().stereo_algorithm == 0)
       vw_out() << "collar_size," << 0 << endl;
     else
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
 
-    // This block of code should be in its own executable but I am
-    // reluctant to create one just for it. This functionality will be
-    // invoked after low-res disparity is computed, whether done in
-    // C++ or in Python. It will attach a georeference to this disparity.
-    std::string left_image_file = opt.out_prefix + "-L.tif";
-    if (stereo_settings().attach_georeference_to_lowres_disparity &&
-        fs::exists(left_image_file) ) {
-
-      cartography::GeoReference left_georef, left_sub_georef;
-      bool   has_left_georef = read_georeference(left_georef, left_image_file);
-      bool   has_nodata      = false;
-      double output_nodata   = -32768.0;
-      if (has_left_georef) {
-
-        DiskImageView<float> left_image(left_image_file);
-        for (int i = 0; i < 2; i++) {
-          std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
-          if (i == 1) d_sub_file = opt.out_prefix + "-D_sub_spread.tif";
-          if (!fs::exists(d_sub_file)) 
-            continue;
-
-          bool has_sub_georef = read_georeference(left_sub_georef, d_sub_file);
-          if (has_sub_georef) {
-            // If D_sub already has a georef, as with seed-mode 3, don't overwrite it.
-            continue;
-          }
-
-          ImageView<PixelMask<Vector2f> > d_sub;
-          read_image(d_sub, d_sub_file);
-          // Account for scale.
-          double left_scale = 0.5*( double(d_sub.cols())/left_image.cols() +
-                                    double(d_sub.rows())/left_image.rows());
-          left_sub_georef = resample(left_georef, left_scale);
-          vw::cartography::block_write_gdal_image(d_sub_file, d_sub,
-                                      has_left_georef, left_sub_georef,
-                                      has_nodata, output_nodata,
-                                      opt, TerminalProgressCallback("asp", "\t    D_sub: ")
-                                      );
-        } // End i loop
-      } // End has_left_georef
-    } // End georef attach ?
+    // The full-resolution search range from the low-resolution
+    // disparity, used by parallel_stereo to estimate how much memory
+    // SGM will need.
+    vw_out() << "corr_memory_limit_mb," << stereo_settings().corr_memory_limit_mb << endl;
+    Vector2i search_range_size;
+    std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+    if (stereo_settings().stereo_algorithm > 0 && fs::exists(d_sub_file) &&
+        trans_left_image_size.x() > 0 && trans_left_image_size.y() > 0) {
+      ImageView<PixelMask<Vector2f> > d_sub;
+      read_image(d_sub, d_sub_file);
+      if (d_sub.cols() > 0 && d_sub.rows() > 0) {
+        Vector2 upscale = elem_quot(trans_left_image_size, Vector2(d_sub.cols(), d_sub.rows()));
+        BBox2f search_range = stereo::get_disparity_range(d_sub);
+        if (!search_range.empty()) {
+          search_range.min() = elem_prod(search_range.min(), upscale);
+          search_range.max() = elem_prod(search_range.max(), upscale);
+          search_range_size = Vector2i(ceil(search_range.width()),
+                                       ceil(search_range.height()))
+            + 2*stereo_settings().sgm_search_buffer + Vector2i(1, 1);
+        }
+      }
+    }
+    vw_out() << "corr_search_range_size," << search_range_size.x() << ","
+             << search_range_size.y() << endl;
+
+    // This functionality will be invoked after low-res disparity is
+    // computed, whether done in C++ or in Python. It will attach a
+    // georeference to this disparity.
+    if (stereo_settings().attach_georeference_to_lowres_disparity)
+      asp::attach_georeference_to_lowres_disparity(opt);
 
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
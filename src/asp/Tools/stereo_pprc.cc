@@ -19,13 +19,12 @@
 /// \file stereo_pprc.cc
 ///
 #include <vw/Image/AntiAliasing.h>
-#include <vw/Image/BlobIndex.h>
-#include <vw/Image/InpaintView.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/HoleFill.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -56,30 +55,18 @@ inline mask_above_threshold( ImageViewBase<ImageT> const& image, double threshol
                                                         MaskAboveThreshold(threshold) );
 }
 
-struct BlobHolder {
-  // This object will ensure that the current BlobIndexThreaded object
-  // is not de-allocated while still being used to fill holes in a
-  // given mask.
-  boost::shared_ptr<vw::BlobIndexThreaded> m_blobPtr;
-
-  // Member function which does the hole-filling.
-  ImageViewRef< PixelMask<uint8> > mask_and_fill_holes( ImageViewRef< PixelGray<float> > const& img,
-                                                        double threshold );
-};
-
-/// Create the mask of pixels above threshold. Fix any holes in it.
+/// Create the mask of pixels above threshold. Fix any holes in it, of
+/// any size. The holes are found over the whole image right away, in
+/// parallel bands of rows.
 ImageViewRef< PixelMask<uint8> >
-BlobHolder::mask_and_fill_holes( ImageViewRef< PixelGray<float> > const& img,
-                                 double threshold ){
+mask_and_fill_holes( ImageViewRef< PixelGray<float> > const& img,
+                     double threshold ){
 
   ImageViewRef< PixelMask<uint8> > thresh_mask = mask_above_threshold(img, threshold);
-  int max_area = 0; // fill arbitrarily big holes
-  bool use_grassfire = false; // fill with default value
-  PixelMask<uint8> default_inpaint_val = uint8(255);
-
-  m_blobPtr = boost::shared_ptr<BlobIndexThreaded>
-    (new BlobIndexThreaded( invert_mask( thresh_mask.impl() ), max_area ));
-  return inpaint(thresh_mask.impl(), *m_blobPtr.get(), use_grassfire, default_inpaint_val);
+  PixelMask<uint8> fill_val = uint8(255);
+  return asp::fill_enclosed_holes(thresh_mask, fill_val,
+                                  vw::vw_settings().default_tile_size(),
+                                  vw::vw_settings().default_num_threads());
 }
 
 
@@ -263,12 +250,9 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       right_threshold = right_cdf.quantile(nodata_fraction);
     }
 
-    // The blob holders must not go out of scope while masks are being written.
-    BlobHolder LB, RB;
-
     if ( !isnan(left_threshold) && !isnan(right_threshold) ){
-      ImageViewRef< PixelMask<uint8> > left_thresh_mask  = LB.mask_and_fill_holes(left_image,  left_threshold);
-      ImageViewRef< PixelMask<uint8> > right_thresh_mask = RB.mask_and_fill_holes(right_image, right_threshold);
+      ImageViewRef< PixelMask<uint8> > left_thresh_mask  = mask_and_fill_holes(left_image,  left_threshold);
+      ImageViewRef< PixelMask<uint8> > right_thresh_mask = mask_and_fill_holes(right_image, right_threshold);
       left_mask  = intersect_mask(left_mask,  left_thresh_mask );
       right_mask = intersect_mask(right_mask, right_thresh_mask);
     }
@@ -475,8 +459,14 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       = copy_mask(left_image, create_mask(left_mask));
     ImageViewRef< PixelMask< PixelGray<float> > > right_masked_image
       = copy_mask(right_image, create_mask(right_mask));
-    Vector6f left_stats       = gather_stats( left_masked_image,  "left" );
-    Vector6f right_stats      = gather_stats( right_masked_image, "right" );
+    Vector6f left_stats       = gather_stats( left_masked_image,  "left",
+                                              opt.out_prefix + "-lStatsCache.txt",
+                                              file_stats_key(left_image_file) + " mask " +
+                                              file_stats_key(left_mask_file) );
+    Vector6f right_stats      = gather_stats( right_masked_image, "right",
+                                              opt.out_prefix + "-rStatsCache.txt",
+                                              file_stats_key(right_image_file) + " mask " +
+                                              file_stats_key(right_mask_file) );
     string   left_stats_file  = opt.out_prefix + "-lStats.tif";
     string   right_stats_file = opt.out_prefix + "-rStats.tif";
 
@@ -489,7 +479,7 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
 } // End function stereo_preprocessing
 
-int main(int argc, char* argv[]) {
+int stereo_pprc_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -521,7 +511,10 @@ int main(int argc, char* argv[]) {
     // Internal Processes
     //---------------------------------------------------------
     vw_out() << "Using \"" << opt.stereo_default_filename << "\"\n";
-    stereo_preprocessing(adjust_left_image_size, opt );
+    {
+      asp::ScopedTimer timer("stereo_pprc");
+      stereo_preprocessing(adjust_left_image_size, opt );
+    }
 
     vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
 
@@ -530,3 +523,9 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+#ifndef ASP_STEREO_ALL_STAGES
+int main(int argc, char* argv[]) {
+  return stereo_pprc_main(argc, argv);
+}
+#endif
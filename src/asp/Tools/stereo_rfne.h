@@ -0,0 +1,510 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_rfne.h
+///
+/// Subpixel refinement of an integer disparity, shared by stereo_rfne
+/// and by stereo_corr when correlation and refinement are fused.
+
+#ifndef __ASP_TOOLS_STEREO_RFNE_H__
+#define __ASP_TOOLS_STEREO_RFNE_H__
+
+#include <asp/Tools/stereo.h>
+#include <vw/Stereo/PreFilter.h>
+#include <vw/Stereo/CostFunctions.h>
+#include <vw/Stereo/SubpixelView.h>
+#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+#include <vw/Stereo/DisparityMap.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <asp/Core/LocalHomography.h>
+
+// The tools including this header all use these namespaces.
+using namespace vw;
+using namespace vw::stereo;
+using namespace asp;
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+template <class Image1T, class Image2T>
+ImageViewRef<PixelMask<Vector2f> >
+refine_disparity(Image1T const& left_image,
+                 Image2T const& right_image,
+                 ImageViewRef< PixelMask<Vector2f> > const& integer_disp,
+                 ASPGlobalOptions const& opt, bool verbose){
+
+  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
+
+  PrefilterModeType prefilter_mode = 
+    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+
+  if ((stereo_settings().subpixel_mode == 0) || (stereo_settings().subpixel_mode > 5)) {
+    // Do nothing (includes SGM specific subpixel modes)
+    if (verbose)
+      vw_out() << "\t--> Skipping subpixel mode.\n";
+  }
+  if (stereo_settings().subpixel_mode == 1) {
+    // Parabola
+    
+    if (verbose) {
+      vw_out() << "\t--> Using parabola subpixel mode.\n";
+      if (stereo_settings().pre_filter_mode == 2)
+        vw_out() << "\t--> Using LOG pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else if (stereo_settings().pre_filter_mode == 1)
+        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else
+        vw_out() << "\t--> NO preprocessing" << endl;
+    } 
+    
+    refined_disp = parabola_subpixel( integer_disp,
+                                      left_image, right_image,
+                                      prefilter_mode, stereo_settings().slogW,
+                                      stereo_settings().subpixel_kernel );
+    
+  } // End parabola cases
+  if (stereo_settings().subpixel_mode == 2) {
+    // Bayes EM
+    if (verbose){
+      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+      if (stereo_settings().selective_subpixel_threshold > 0)
+        vw_out() << "\t--> Using Bayes EM only where parabola subpixel differs by more than "
+                 << stereo_settings().selective_subpixel_threshold
+                 << " pixels from a neighbor.\n";
+    }
+    refined_disp =
+      bayes_em_subpixel( integer_disp,
+                         left_image, right_image,
+                         prefilter_mode, stereo_settings().slogW,
+                         stereo_settings().subpixel_kernel,
+                         stereo_settings().subpixel_max_levels );
+
+  } // End Bayes EM cases
+  if (stereo_settings().subpixel_mode == 3) {
+    // Fast affine
+    if (verbose){
+      vw_out() << "\t--> Using affine subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      affine_subpixel( integer_disp,
+                       left_image, right_image,
+                       prefilter_mode, stereo_settings().slogW,
+                       stereo_settings().subpixel_kernel,
+                       stereo_settings().subpixel_max_levels );
+
+  } // End Fast affine cases
+  if (stereo_settings().subpixel_mode == 4) {
+    // Lucas-Kanade
+    if (verbose){
+      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      lk_subpixel( integer_disp,
+                   left_image, right_image,
+                   prefilter_mode, stereo_settings().slogW,
+                   stereo_settings().subpixel_kernel,
+                   stereo_settings().subpixel_max_levels );
+
+  } // End Lucas-Kanade cases
+  if (stereo_settings().subpixel_mode == 5) {
+    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
+    if (verbose){
+      vw_out() << "\t--> Using EM Subpixel mode "
+               << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Mode 3 does internal preprocessing;"
+               << " settings will be ignored. " << endl;
+    }
+
+    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+    EMCorrelator em_correlator(channels_to_planes(left_image),
+                               channels_to_planes(right_image),
+                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
+    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
+    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
+    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
+    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
+
+    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
+
+    block_write_image(em_disparity_map_rsrc, em_correlator,
+                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
+
+    DiskImageResource *em_disparity_map_rsrc_2 =
+      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
+    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
+
+    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractUncertaintyFunctor());
+    ImageViewRef<float> spectral_uncertainty =
+      per_pixel_filter(disparity_uncertainty,
+                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
+    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
+    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
+
+    refined_disp =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractDisparityFunctor());
+  } // End EM subpixel cases 
+  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
+    if (verbose) {
+      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Doing nothing\n";
+    }
+  }
+
+  return refined_disp;
+}
+
+// The number of pixels and the time spent in each pass of the
+// selective subpixel refinement, summed over all tiles. The time is
+// summed over the threads, so it is not wall-clock time.
+struct SelectiveRfneStats {
+  vw::Mutex mutex;
+  vw::int64 num_valid, num_bayes_em;
+  double    parabola_time, bayes_em_time;
+  SelectiveRfneStats(): num_valid(0), num_bayes_em(0),
+                        parabola_time(0), bayes_em_time(0){}
+
+  void report() {
+    if (num_valid == 0)
+      return;
+    vw_out() << "\t--> Parabola subpixel on " << num_valid << " pixels, "
+             << parabola_time << " seconds.\n";
+    vw_out() << "\t--> Bayes EM on " << num_bayes_em << " pixels ("
+             << 100.0*double(num_bayes_em)/double(num_valid) << "%), "
+             << bayes_em_time << " seconds.\n";
+  }
+};
+
+// A parabola subpixel disparity is trusted if it differs by no more
+// than the threshold from the disparity at its valid 4-neighbors.
+// Well-textured and smooth areas pass, while steep or poorly textured
+// areas, and those next to invalid pixels, are refined with Bayes EM.
+inline bool parabola_disparity_is_consistent(ImageView<PixelMask<Vector2f> > const& disp,
+                                             int col, int row, double thresh) {
+  PixelMask<Vector2f> const& d = disp(col, row);
+  int dc[4] = {-1, 1, 0, 0}, dr[4] = {0, 0, -1, 1};
+  for (int k = 0; k < 4; k++) {
+    int c = col + dc[k], r = row + dr[k];
+    if (c < 0 || r < 0 || c >= disp.cols() || r >= disp.rows())
+      continue;
+    PixelMask<Vector2f> const& n = disp(c, r);
+    if (!is_valid(n))
+      return false;
+    if (std::abs(n.child()[0] - d.child()[0]) > thresh ||
+        std::abs(n.child()[1] - d.child()[1]) > thresh)
+      return false;
+  }
+  return true;
+}
+
+// Perform refinement in each tile. If using local homography,
+// apply the local homography transform for the given tile
+// to the right image before doing refinement in that tile.
+template <class Image1T, class Image2T, class SeedDispT>
+class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT> >{
+  Image1T              m_left_image;
+  Image2T              m_right_image;
+  ImageViewRef<uint8>  m_right_mask;
+  SeedDispT            m_integer_disp;
+  SeedDispT            m_sub_disp;
+  ImageView<Matrix3x3> m_local_hom;
+  ASPGlobalOptions const&       m_opt;
+  Vector2              m_upscale_factor;
+  boost::shared_ptr<SelectiveRfneStats> m_stats;
+
+  // Refine the disparity in the given tile. With Bayes EM and a
+  // selective threshold, refine the tile with parabola subpixel first,
+  // and then run Bayes EM seeded only at the pixels where the parabola
+  // result is not consistent with its neighbors. Bayes EM skips the
+  // pixels with no valid seed.
+  template <class RightT>
+  ImageView<PixelMask<Vector2f> > refine_tile(RightT const& right_image,
+                                              BBox2i const& bbox) const {
+    typedef PixelMask<Vector2f> disp_type;
+    bool verbose = false;
+    double thresh = stereo_settings().selective_subpixel_threshold;
+    if (stereo_settings().subpixel_mode != 2 || thresh <= 0)
+      return crop(refine_disparity(m_left_image, right_image,
+                                   m_integer_disp, m_opt, verbose), bbox);
+
+    PrefilterModeType prefilter_mode =
+      static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+
+    // One more pixel on each side, for the neighbors of the boundary pixels
+    BBox2i big_box = bbox;
+    big_box.expand(1);
+    big_box.crop(bounding_box(m_left_image));
+
+    Stopwatch sw;
+    sw.start();
+    ImageView<disp_type> parabola_disp
+      = crop(parabola_subpixel(m_integer_disp, m_left_image, right_image,
+                               prefilter_mode, stereo_settings().slogW,
+                               stereo_settings().subpixel_kernel), big_box);
+    sw.stop();
+    double parabola_time = sw.elapsed_seconds();
+
+    Vector2i shift = bbox.min() - big_box.min();
+    ImageView<disp_type> tile_disparity
+      = crop(parabola_disp, shift.x(), shift.y(), bbox.width(), bbox.height());
+    ImageView<disp_type> integer_tile = crop(m_integer_disp, bbox);
+    ImageView<disp_type> em_seed(bbox.width(), bbox.height()); // all invalid
+
+    vw::int64 num_valid = 0, num_bayes_em = 0;
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        if (!is_valid(tile_disparity(col, row)))
+          continue;
+        num_valid++;
+        if (parabola_disparity_is_consistent(parabola_disp, col + shift.x(),
+                                             row + shift.y(), thresh))
+          continue;
+        em_seed(col, row) = integer_tile(col, row);
+        num_bayes_em++;
+      }
+    }
+
+    double bayes_em_time = 0;
+    if (num_bayes_em > 0) {
+      Stopwatch em_sw;
+      em_sw.start();
+      ImageViewRef<disp_type> em_seed_full
+        = edge_extend(em_seed, -bbox.min().x(), -bbox.min().y(), cols(), rows(),
+                      ZeroEdgeExtension());
+      ImageView<disp_type> em_disp
+        = crop(bayes_em_subpixel(em_seed_full, m_left_image, right_image,
+                                 prefilter_mode, stereo_settings().slogW,
+                                 stereo_settings().subpixel_kernel,
+                                 stereo_settings().subpixel_max_levels), bbox);
+      for (int row = 0; row < bbox.height(); row++) {
+        for (int col = 0; col < bbox.width(); col++) {
+          if (is_valid(em_seed(col, row)))
+            tile_disparity(col, row) = em_disp(col, row);
+        }
+      }
+      em_sw.stop();
+      bayes_em_time = em_sw.elapsed_seconds();
+    }
+
+    {
+      vw::Mutex::Lock lock(m_stats->mutex);
+      m_stats->num_valid     += num_valid;
+      m_stats->num_bayes_em  += num_bayes_em;
+      m_stats->parabola_time += parabola_time;
+      m_stats->bayes_em_time += bayes_em_time;
+    }
+
+    return tile_disparity;
+  }
+
+public:
+  PerTileRfne( ImageViewBase<Image1T>   const& left_image,
+               ImageViewBase<Image2T>   const& right_image,
+               ImageViewRef <uint8>     const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView    <Matrix3x3> const& local_hom,
+               ASPGlobalOptions const& opt):
+    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
+    m_right_mask(right_mask),
+    m_integer_disp( integer_disp.impl() ), m_sub_disp( sub_disp.impl() ),
+    m_local_hom(local_hom), m_opt(opt), m_stats(new SelectiveRfneStats){
+
+    m_upscale_factor = Vector2(double(m_left_image.impl().cols()) / m_sub_disp.cols(),
+                               double(m_left_image.impl().rows()) / m_sub_disp.rows());
+  }
+
+  // Image View interface
+  typedef PixelMask<Vector2f>                  pixel_type;
+  typedef pixel_type                           result_type;
+  typedef ProceduralPixelAccessor<PerTileRfne> pixel_accessor;
+
+  inline int32 cols  () const { return m_left_image.cols(); }
+  inline int32 rows  () const { return m_left_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PerTileRfne::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    asp::numa_bind_current_thread();
+    if (!asp::tile_capture_enabled())
+      return refine_full_tile(bbox);
+
+    Stopwatch sw;
+    sw.start();
+    prerasterize_type tile = refine_full_tile(bbox);
+    sw.stop();
+    if (asp::capture_tile_wanted(bbox, sw.elapsed_seconds()))
+      capture_tile(bbox, tile, sw.elapsed_seconds());
+    return tile;
+  }
+
+  /// Save the inputs of a tile and its result, so that it can be run
+  /// again by itself with replay_refinement_tile().
+  void capture_tile(BBox2i const& bbox, prerasterize_type const& result, double seconds) const {
+
+    std::string dir = asp::start_tile_capture("rfne", bbox);
+
+    // The pixels the subpixel refinement reads around the tile, for the
+    // kernel at each pyramid level
+    Vector2i kernel = stereo_settings().subpixel_kernel;
+    int levels = std::max(int(stereo_settings().subpixel_max_levels),
+                          stereo_settings().subpixel_pyramid_levels);
+    int margin = (1 << (levels + 1))*(std::max(kernel[0], kernel[1])/2 + 2);
+    BBox2i left_box = bbox;
+    left_box.expand(margin);
+    left_box.crop(bounding_box(m_left_image));
+
+    // The integer disparity is to the right image as seen through the
+    // local homography, if there is one
+    ImageView<pixel_type> integer_disp = crop(m_integer_disp, left_box);
+    Matrix<double> fullres_hom = math::identity_matrix<3>();
+    if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography)
+      fullres_hom = fullres_homography(bbox);
+    BBox2i right_box = asp::right_capture_box(left_box, get_disparity_range(integer_disp),
+                                              fullres_hom);
+    right_box.crop(bounding_box(m_right_image));
+
+    asp::write_capture_crop(dir, "left",       m_left_image,  left_box);
+    asp::write_capture_crop(dir, "right",      m_right_image, right_box);
+    asp::write_capture_crop(dir, "right_mask", m_right_mask,  right_box);
+    asp::write_capture_crop(dir, "D_integer",  integer_disp,  bounding_box(integer_disp));
+    if (m_sub_disp.cols() != 0 && m_sub_disp.rows() != 0)
+      asp::write_capture_crop(dir, "D_sub", m_sub_disp, bounding_box(m_sub_disp));
+    if (m_local_hom.cols() != 0 && m_local_hom.rows() != 0)
+      write_local_homographies(dir + "/local_hom.txt", m_local_hom);
+    asp::write_capture_crop(dir, "RD", result, bbox);
+
+    asp::TileManifest manifest;
+    manifest.set("kind",       std::string("rfne"));
+    manifest.set("tile",       bbox);
+    manifest.set("left_size",  Vector2i(m_left_image.cols(),  m_left_image.rows()));
+    manifest.set("right_size", Vector2i(m_right_image.cols(), m_right_image.rows()));
+    manifest.set("left_box",   left_box);
+    manifest.set("right_box",  right_box);
+    manifest.set("seconds",    seconds);
+    manifest.write(dir);
+  }
+
+  /// The local homography of the tile, at full resolution
+  Matrix<double> fullres_homography(BBox2i const& bbox) const {
+    int ts = ASPGlobalOptions::corr_tile_size();
+    Matrix<double>  lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+    Vector3 upscale( m_upscale_factor[0],     m_upscale_factor[1],     1 );
+    Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+    return diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+  }
+
+  /// Refine a tile, with the right image transformed by the local
+  /// homography of the tile, if there is one
+  prerasterize_type refine_full_tile(BBox2i const& bbox) const {
+
+    // Tiles with no valid integer disparity, as in the no-data areas
+    // around the images, have nothing to refine. Skip them, as the
+    // subpixel modes would otherwise still filter and build the image
+    // pyramids for the whole tile.
+    ImageView<pixel_type> tile_disparity = crop(m_integer_disp, bbox);
+    bool has_valid = false;
+    for (int row = 0; row < tile_disparity.rows() && !has_valid; row++) {
+      for (int col = 0; col < tile_disparity.cols(); col++) {
+        if (is_valid(tile_disparity(col, row))) {
+          has_valid = true;
+          break;
+        }
+      }
+    }
+    if (!has_valid)
+      return prerasterize_type(tile_disparity, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows());
+
+    if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
+
+      Matrix<double>  fullres_hom = fullres_homography(bbox);
+
+      // Must transform the right image by the local disparity
+      // to be in the same conditions as for stereo correlation.
+      typedef typename Image2T::pixel_type right_pix_type;
+      ImageViewRef< PixelMask<right_pix_type> > right_trans_masked_img
+        = transform (copy_mask( m_right_image.impl(), create_mask(m_right_mask) ),
+                     HomographyTransform(fullres_hom),
+                     m_left_image.impl().cols(), m_left_image.impl().rows());
+      ImageViewRef<right_pix_type> right_trans_img = apply_mask(right_trans_masked_img);
+
+
+      tile_disparity = refine_tile(right_trans_img, bbox);
+
+      // Must undo the local homography transform
+      bool do_round = false; // don't round floating point disparities
+      tile_disparity = transform_disparities(do_round, bbox, inverse(fullres_hom),
+                                             tile_disparity);
+
+    }else{
+      tile_disparity = refine_tile(m_right_image, bbox);
+    }
+    
+    prerasterize_type disparity = prerasterize_type(tile_disparity,
+                                                    -bbox.min().x(), -bbox.min().y(),
+                                                    cols(), rows() );
+    return disparity;
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+  /// Print the pixel counts and timing of the selective subpixel
+  /// refinement, once all tiles are written. The copies of this view
+  /// share the counts.
+  void report_selective_stats() const { m_stats->report(); }
+};
+
+template <class Image1T, class Image2T, class SeedDispT>
+PerTileRfne<Image1T, Image2T, SeedDispT>
+per_tile_rfne( ImageViewBase<Image1T  > const& left,
+               ImageViewBase<Image2T  > const& right,
+               ImageViewRef<uint8     > const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView<Matrix3x3    > const& local_hom,
+               ASPGlobalOptions const& opt) {
+  typedef PerTileRfne<Image1T, Image2T, SeedDispT> return_type;
+  return return_type( left.impl(), right.impl(), right_mask,
+                      integer_disp.impl(), sub_disp.impl(), local_hom, opt );
+}
+
+#endif//__ASP_TOOLS_STEREO_RFNE_H__
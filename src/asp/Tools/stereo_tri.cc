@@ -20,15 +20,22 @@
 ///
 
 #include <vw/Cartography.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/CameraModel.h>
 #include <vw/Stereo/StereoView.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/InterestPoint/InterestData.h>
 
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/RayGridCameraModel.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
+#include <asp/Core/PhotometricOutlier.h>
+#include <asp/Core/TilePrefetcher.h>
+#include <asp/Core/MappedTiff.h>
+#include <asp/Core/PointCloudStats.h>
 
 // We must have the implementations of all sessions for triangulation
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -40,7 +47,9 @@
 #include <asp/Sessions/StereoSessionSpot.h>
 #include <asp/Sessions/StereoSessionASTER.h>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <liblas/liblas.hpp>
 #include <ctime>
+#include <fstream>
 
 using namespace vw;
 using namespace asp;
@@ -66,6 +75,10 @@ class StereoTXAndErrorView : public ImageViewBase<StereoTXAndErrorView<Disparity
   StereoModelT m_stereo_model;
   bool         m_is_map_projected;
   typedef typename DisparityImageT::pixel_type DPixelT;
+  typedef boost::shared_ptr< asp::TilePrefetcher<DPixelT> > PrefetcherPtr;
+  vector<PrefetcherPtr> m_prefetchers; // read the disparities ahead, if not empty
+  typedef boost::shared_ptr<asp::RPCStereoModel> RPCModelPtr;
+  RPCModelPtr m_rpc_model; // triangulate rows at a time with it, if set
 
 public:
 
@@ -77,11 +90,15 @@ public:
   StereoTXAndErrorView( vector<DisparityImageT> const& disparity_maps,
                         vector<TXT>             const& transforms,
                         StereoModelT            const& stereo_model,
-                        bool is_map_projected) :
+                        bool is_map_projected,
+                        vector<PrefetcherPtr>   const& prefetchers = vector<PrefetcherPtr>(),
+                        RPCModelPtr             const& rpc_model = RPCModelPtr()) :
     m_disparity_maps(disparity_maps),
     m_transforms(transforms),
     m_stereo_model(stereo_model),
-    m_is_map_projected(is_map_projected) {
+    m_is_map_projected(is_map_projected),
+    m_prefetchers(prefetchers),
+    m_rpc_model(rpc_model) {
 
     // Sanity check
     for (int p = 1; p < (int)m_disparity_maps.size(); p++){
@@ -124,9 +141,82 @@ public:
     return result; // Contains location and error vector
   }
 
-  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, TXT, StereoModelT> prerasterize_type;
+  /// Triangulate all pixels in the given box, one row at a time. The
+  /// pixels of a row are first de-warped for each camera into their own
+  /// buffer, so that no per-pixel allocations are made, and pixels
+  /// with no valid disparity skip both the de-warping and the stereo
+  /// model, which are the expensive parts for map-projected images.
+  /// With RPC cameras, the rays of a whole row are found at once.
+  template <class DestT>
+  void triangulate_rows( BBox2i const& bbox, DestT & dest ) const {
+
+    int num_disp = m_disparity_maps.size();
+    int width    = bbox.width();
+    double nan   = std::numeric_limits<double>::quiet_NaN();
+
+    vector< vector<Vector2> > pix_buffers(num_disp + 1, vector<Vector2>(width));
+    vector<bool> has_valid_disp(width);
+    vector<Vector2> pixVec(num_disp + 1);
+    Vector3 errorVec;
+    asp::RPCStereoModel::RowSeeds seeds;
+    vector<Vector3> points, errors;
+
+    for (int row = 0; row < bbox.height(); row++) {
+      int j = bbox.min().y() + row;
+
+      // De-warp the "right" pixels of this row, for each disparity
+      std::fill(has_valid_disp.begin(), has_valid_disp.end(), false);
+      for (int c = 0; c < num_disp; c++) {
+        for (int col = 0; col < width; col++) {
+          int i = bbox.min().x() + col;
+          DPixelT disp = m_disparity_maps[c](i, j);
+          if (is_valid(disp)) {
+            pix_buffers[c+1][col] = m_transforms[c+1].reverse( Vector2(i,j) + stereo::DispHelper(disp) );
+            has_valid_disp[col] = true;
+          }else{
+            pix_buffers[c+1][col] = Vector2(nan, nan); // flag value
+          }
+        }
+      }
+
+      // De-warp the "left" pixels, only where needed
+      for (int col = 0; col < width; col++) {
+        if (has_valid_disp[col])
+          pix_buffers[0][col] = m_transforms[0].reverse( Vector2(bbox.min().x() + col, j) );
+      }
+
+      if (m_rpc_model) {
+        m_rpc_model->triangulate_row(pix_buffers, has_valid_disp, seeds, points, errors);
+        for (int col = 0; col < width; col++) {
+          pixel_type result;
+          subvector(result,0,3) = points[col];
+          subvector(result,3,3) = errors[col];
+          dest(col, row) = result;
+        }
+        continue;
+      }
+
+      // Intersect the rays
+      for (int col = 0; col < width; col++) {
+        pixel_type result; // zero means no point
+        if (has_valid_disp[col]) {
+          for (int c = 0; c <= num_disp; c++)
+            pixVec[c] = pix_buffers[c][col];
+          subvector(result,0,3) = m_stereo_model(pixVec, errorVec);
+          subvector(result,3,3) = errorVec;
+        }
+        dest(col, row) = result;
+      }
+    }
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return PreRasterHelper( bbox, m_transforms );
+    asp::numa_bind_current_thread();
+    asp::ScopedTimer timer("triangulation_tile", bbox);
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    PreRasterHelper( bbox, m_transforms ).triangulate_rows( bbox, tile );
+    return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
   }
   template <class DestT>
   inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
@@ -135,9 +225,21 @@ public:
 
 private:
 
+  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, TXT, StereoModelT> cached_type;
+
+  /// Bring in memory the disparity for the current box, taking it
+  /// from the prefetcher if it was read ahead.
+  ImageView<DPixelT> disparity_clip( int p, BBox2i const& bbox ) const {
+    ImageView<DPixelT> clip;
+    if (p < (int)m_prefetchers.size() && m_prefetchers[p]->take(bbox, clip))
+      return clip;
+    clip = crop( m_disparity_maps[p], bbox );
+    return clip;
+  }
+
   /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
   template <class T>
-  prerasterize_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
+  cached_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
 
     // Code for NON-MAP-PROJECTED session types.
     if (m_is_map_projected == false) {
@@ -146,12 +248,13 @@ private:
       // image by virtually enlarging it using a CropView.
       vector< ImageViewRef<DPixelT> > disparity_cropviews;
       for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-        ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
+        ImageView<DPixelT> clip = disparity_clip( p, bbox );
         ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
         disparity_cropviews.push_back(cropview_clip);
       }
 
-      return prerasterize_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected);
+      return cached_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected,
+                         vector<PrefetcherPtr>(), m_rpc_model);
     }
 
     // Code for MAP-PROJECTED session types.
@@ -176,7 +279,7 @@ private:
       // We explicitly bring in-memory the disparities for the current
       // box to speed up processing later, and then we pretend this is
       // the entire image by virtually enlarging it using a CropView.
-      ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
+      ImageView<DPixelT> clip = disparity_clip( p, bbox );
       ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
       disparity_cropviews.push_back(cropview_clip);
 
@@ -190,7 +293,8 @@ private:
       transforms_copy[p+1].reverse_bbox(right_bbox); // As a side effect this call makes transforms_copy create a local cache we want later
     }
 
-    return prerasterize_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected);
+    return cached_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected,
+                       vector<PrefetcherPtr>(), m_rpc_model);
   } // End function PreRasterHelper() DGMapRPC version
 
 }; // End class StereoTXAndErrorView
@@ -201,12 +305,129 @@ StereoTXAndErrorView<DisparityT, TXT, StereoModelT>
 stereo_error_triangulate( vector<DisparityT> const& disparities,
                           vector<TXT>        const& transforms,
                           StereoModelT       const& model,
-                          bool is_map_projected ) {
+                          bool is_map_projected,
+                          vector< boost::shared_ptr< asp::TilePrefetcher<typename DisparityT::pixel_type> > >
+                          const& prefetchers,
+                          boost::shared_ptr<asp::RPCStereoModel> const& rpc_model ) {
 
   typedef StereoTXAndErrorView<DisparityT, TXT, StereoModelT> result_type;
-  return result_type( disparities, transforms, model, is_map_projected );
+  return result_type( disparities, transforms, model, is_map_projected, prefetchers, rpc_model );
+}
+
+/// The number of threads for work which uses the cameras. ISIS does not
+/// support multi-threading, unless each thread has its own copy of the
+/// cameras.
+int camera_num_threads(ASPGlobalOptions const& opt) {
+  int num_threads = opt.num_threads;
+  if ( ((opt.session->name() == "isis") || (opt.session->name() == "isismapisis")) &&
+       !stereo_settings().isis_per_thread_cameras )
+    num_threads = 1;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  return num_threads;
 }
 
+/// The transforms between the original and the aligned images. Since
+/// all our code is templated, and for pinhole cameras there can be
+/// more than one type of transform, and there is no base pointer for
+/// all transforms, pinhole epipolar alignment keeps its own transforms.
+/// Each task gets its own copy.
+template <class TXT>
+struct AlignTransforms {
+  TXT  left_trans, right_trans;
+  bool use_pinhole_epipolar;
+  asp::PinholeCamTrans left_trans2, right_trans2;
+
+  // The pinhole cameras must be initialized to something to respect
+  // the constructor.
+  AlignTransforms(vector<ASPGlobalOptions> const& opt_vec, vector<TXT> const& transforms):
+    left_trans(transforms[0]), right_trans(transforms[1]),
+    use_pinhole_epipolar( (stereo_settings().alignment_method == "epipolar") &&
+                          ( opt_vec[0].session->name() == "pinhole" ||
+                            opt_vec[0].session->name() == "nadirpinhole") ),
+    left_trans2(vw::camera::PinholeModel(), vw::camera::PinholeModel()),
+    right_trans2(left_trans2) {
+    if (use_pinhole_epipolar) {
+      StereoSessionPinhole* pinPtr = dynamic_cast<StereoSessionPinhole*>(opt_vec[0].session.get());
+      if (pinPtr == NULL)
+        vw_throw(ArgumentErr() << "Expected a pinhole camera.\n");
+      pinPtr->pinhole_cam_trans(left_trans2, right_trans2);
+    }
+  }
+
+  Vector2 left_forward(Vector2 const& pix) const {
+    return use_pinhole_epipolar ? left_trans2.forward(pix) : left_trans.forward(pix);
+  }
+  Vector2 left_reverse(Vector2 const& pix) const {
+    return use_pinhole_epipolar ? left_trans2.reverse(pix) : left_trans.reverse(pix);
+  }
+  Vector2 right_reverse(Vector2 const& pix) const {
+    return use_pinhole_epipolar ? right_trans2.reverse(pix) : right_trans.reverse(pix);
+  }
+};
+
+/// Unalign the disparity of a tile. The disparity at each unaligned
+/// left pixel is added to the sums of its 3x3 neighborhood, once the
+/// whole tile is transformed, so the lock is held briefly.
+template <class DisparityT, class TXT>
+class UnalignDispTask: public vw::Task, private boost::noncopyable {
+  typedef typename DisparityT::pixel_type DispPixelT;
+  DisparityT            const& m_disp;
+  AlignTransforms<TXT>         m_trans;
+  BBox2i                       m_bbox;
+  ImageView<DispPixelT>      & m_sum;
+  ImageView<int>             & m_count;
+  Mutex                      & m_mutex;
+  TerminalProgressCallback   & m_tpc;
+  double                       m_inc_amount;
+public:
+  UnalignDispTask(DisparityT const& disp, AlignTransforms<TXT> const& trans,
+                  BBox2i const& bbox, ImageView<DispPixelT> & sum,
+                  ImageView<int> & count, Mutex & mutex,
+                  TerminalProgressCallback & tpc, double inc_amount):
+    m_disp(disp), m_trans(trans), m_bbox(bbox), m_sum(sum), m_count(count),
+    m_mutex(mutex), m_tpc(tpc), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    ImageView<DispPixelT> tile = crop(m_disp, m_bbox);
+    std::vector<Vector2i> left_pixels;
+    std::vector<Vector2>  dirs;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        DispPixelT dpix = tile(col, row);
+        if (!is_valid(dpix))
+          continue;
+
+        // De-warp left and right pixels to be in the camera coordinate system
+        Vector2 pix(col + m_bbox.min().x(), row + m_bbox.min().y());
+        Vector2 left_pix  = m_trans.left_reverse (pix);
+        Vector2 right_pix = m_trans.right_reverse(pix + stereo::DispHelper(dpix));
+        left_pixels.push_back(Vector2i(round(left_pix[0]), round(left_pix[1])));
+        dirs.push_back(right_pix - left_pix); // disparity value
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+
+    // This averaging is useful in filling tiny holes and avoiding staircasing.
+    // TODO: Use some weights. The closer contribution should have more weight.
+    for (size_t k = 0; k < left_pixels.size(); k++) {
+      for (int icol = -1; icol <= 1; icol++) {
+        for (int irow = -1; irow <= 1; irow++) {
+          int lcol = left_pixels[k][0] + icol;
+          int lrow = left_pixels[k][1] + irow;
+          if (lcol < 0 || lcol >= m_sum.cols())  continue;
+          if (lrow < 0 || lrow >= m_sum.rows())  continue;
+          if (!is_valid(m_sum(lcol, lrow))) m_sum(lcol, lrow).validate();
+          m_sum(lcol, lrow).child() += dirs[k];
+          m_count(lcol, lrow)++;
+        }
+      }
+    }
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
 // Take a given disparity and make it between the original unaligned images
 template <class DisparityT, class TXT>
 void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
@@ -219,26 +440,7 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
   DisparityT const& disp = disparities[0]; // pull the disparity
 
   // Transforms to compensate for alignment
-  TXT left_trans  = transforms[0];
-  TXT right_trans = transforms[1];
-
-  // Since all our code is templated, and for pinhole cameras
-  // there can be more than one type of transform, and there is no base
-  // pointer for all transforms, need to do this kludge.
-  bool usePinholeEpipolar = ( (stereo_settings().alignment_method == "epipolar") &&
-                              ( opt_vec[0].session->name() == "pinhole" ||
-                                opt_vec[0].session->name() == "nadirpinhole") );
-
-  // Must initialize below the two cameras to something to respect the constructor.
-  asp::PinholeCamTrans left_trans2 = asp::PinholeCamTrans(vw::camera::PinholeModel(),
-                                                          vw::camera::PinholeModel());
-  asp::PinholeCamTrans right_trans2 = left_trans2;
-  if (usePinholeEpipolar) {
-    StereoSessionPinhole* pinPtr = dynamic_cast<StereoSessionPinhole*>(opt_vec[0].session.get());
-    if (pinPtr == NULL) 
-      vw_throw(ArgumentErr() << "Expected a pinhole camera.\n");
-    pinPtr->pinhole_cam_trans(left_trans2, right_trans2);
-  }
+  AlignTransforms<TXT> trans(opt_vec, transforms);
 
   std::string left_file  = opt_vec[0].in_file1;
   std::string right_file = opt_vec[0].in_file2;
@@ -258,46 +460,23 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
   }
   
   vw_out() << "Unwarping the disparity.\n";
-  
+
+  // The tiles are unaligned in parallel
+  std::vector<BBox2i> tiles = subdivide_bbox(disp, opt_vec[0].raster_tile_size[0],
+                                             opt_vec[0].raster_tile_size[1]);
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(disp.cols());
   tpc.report_progress(0);
-
-  // TODO: This is too slow. Needs to be multi-threaded.
-  for (int col = 0; col < disp.cols(); col++) {
-    for (int row = 0; row < disp.rows(); row++) {
-      
-      DispPixelT dpix = disp(col, row);
-      if (!is_valid(dpix))
-        continue;
-
-      // De-warp left and right pixels to be in the camera coordinate system
-      Vector2 left_pix, right_pix;
-      if (!usePinholeEpipolar) {
-        left_pix  = left_trans.reverse ( Vector2(col, row) );
-        right_pix = right_trans.reverse( Vector2(col, row) + stereo::DispHelper(dpix) );
-      }else{
-        left_pix  = left_trans2.reverse ( Vector2(col, row) );
-        right_pix = right_trans2.reverse( Vector2(col, row) + stereo::DispHelper(dpix) );
-      }
-      Vector2 dir = right_pix - left_pix; // disparity value
-
-      // This averaging is useful in filling tiny holes and avoiding staircasing.
-      // TODO: Use some weights. The closer contribution should have more weight.
-      for (int icol = -1; icol <= 1; icol++) {
-        for (int irow = -1; irow <= 1; irow++) {
-          int lcol = round(left_pix[0]) + icol;
-          int lrow = round(left_pix[1]) + irow;
-          if (lcol < 0 || lcol >= left_img.cols())  continue;
-          if (lrow < 0 || lrow >= left_img.rows())  continue;
-          if (!is_valid(unaligned_disp(lcol, lrow))) unaligned_disp(lcol, lrow).validate();
-          unaligned_disp(lcol, lrow).child() += dir;
-          count(lcol, lrow)++;
-        }
-      }
+  Mutex mutex;
+  {
+    FifoWorkQueue queue(camera_num_threads(opt_vec[0]));
+    for (size_t t = 0; t < tiles.size(); t++) {
+      boost::shared_ptr<UnalignDispTask<DisparityT, TXT> >
+        task(new UnalignDispTask<DisparityT, TXT>(disp, trans, tiles[t],
+                                                  unaligned_disp, count, mutex,
+                                                  tpc, 1.0/tiles.size()));
+      queue.add_task(task);
     }
-
-    tpc.report_incremental_progress( inc_amount );
+    queue.join_all();
   }
   tpc.report_finished();
 
@@ -322,12 +501,179 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
 					  TerminalProgressCallback("asp", "\t--> Undist disp:") );
 }
 
+/// The left and right pixels of the matches found by a task
+struct MatchCandidates {
+  std::vector<Vector2> left, right;
+};
+
+/// Find the matches from a range of columns of bins. Without triplets,
+/// the bins are over the disparity, of length bin_len. Each is probed
+/// at its center, and if the disparity is not valid there, at the
+/// centers of the cells of a 3x3 grid over it, until a valid one is
+/// found. So even with many holes in the disparity most bins give a
+/// match, while only a few pixels per bin are visited. With triplets,
+/// the bins are over the left image, and the match is at the corner
+/// of each bin, which is a multiple of bin_len.
+template <class DisparityT, class TXT>
+class BinMatchTask: public vw::Task, private boost::noncopyable {
+  typedef typename DisparityT::pixel_type DispPixelT;
+  DisparityT          const& m_disp;
+  AlignTransforms<TXT>       m_trans;
+  double                     m_bin_len;
+  int                        m_beg_binx, m_end_binx, m_leny;
+  Vector2i                   m_left_size;
+  bool                       m_gen_triplets;
+  MatchCandidates          & m_matches;
+  Mutex                    & m_mutex;
+  TerminalProgressCallback & m_tpc;
+  double                     m_inc_amount;
+
+  // The match at a pixel of the disparity, if valid there
+  bool match_at(Vector2 const& trans_left_pix) {
+    if (trans_left_pix[0] < 0 || trans_left_pix[0] >= m_disp.cols()) return false;
+    if (trans_left_pix[1] < 0 || trans_left_pix[1] >= m_disp.rows()) return false;
+    DispPixelT dpix = m_disp(trans_left_pix[0], trans_left_pix[1]);
+    if (!is_valid(dpix))
+      return false;
+    Vector2 trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
+    m_matches.right.push_back(m_trans.right_reverse(trans_right_pix));
+    return true;
+  }
+
+public:
+  BinMatchTask(DisparityT const& disp, AlignTransforms<TXT> const& trans,
+               double bin_len, int beg_binx, int end_binx, int leny,
+               Vector2i const& left_size, bool gen_triplets,
+               MatchCandidates & matches, Mutex & mutex,
+               TerminalProgressCallback & tpc, double inc_amount):
+    m_disp(disp), m_trans(trans), m_bin_len(bin_len), m_beg_binx(beg_binx),
+    m_end_binx(end_binx), m_leny(leny), m_left_size(left_size),
+    m_gen_triplets(gen_triplets), m_matches(matches), m_mutex(mutex),
+    m_tpc(tpc), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    for (int binx = m_beg_binx; binx < m_end_binx; binx++) {
+      for (int biny = 0; biny < m_leny; biny++) {
+
+        if (m_gen_triplets) {
+          // Make the left pixel go to the disparity domain. Find the corresponding
+          // right pixel. And make that one go to the right image domain.
+          Vector2 left_pix(binx*m_bin_len, biny*m_bin_len); // integer multiples
+          if (left_pix.x() >= m_left_size.x() || left_pix.y() >= m_left_size.y())
+            continue;
+          if (match_at(round(m_trans.left_forward(left_pix))))
+            m_matches.left.push_back(left_pix);
+          continue;
+        }
+
+        // Probe the center first, then the 3x3 grid
+        for (int probe = 0; probe < 10; probe++) {
+          double dx = 0, dy = 0;
+          if (probe > 0) {
+            if (probe == 5) // the center again
+              continue;
+            dx = ((probe - 1) % 3 - 1)/3.0;
+            dy = ((probe - 1) / 3 - 1)/3.0;
+          }
+          int posx = round( (binx + 0.5 + dx)*m_bin_len );
+          int posy = round( (biny + 0.5 + dy)*m_bin_len );
+          if (posx >= m_disp.cols() || posy >= m_disp.rows())
+            continue;
+          if (match_at(Vector2(posx, posy))) {
+            // De-warp the left pixel to be in the camera coordinate system
+            m_matches.left.push_back(m_trans.left_reverse(Vector2(posx, posy)));
+            break;
+          }
+        }
+      }
+    }
+    Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
+/// Find the matches from a tile of the disparity whose right pixel,
+/// after rounding, is a multiple of bin_len in the right image.
+template <class DisparityT, class TXT>
+class RightBinMatchTask: public vw::Task, private boost::noncopyable {
+  typedef typename DisparityT::pixel_type DispPixelT;
+  DisparityT          const& m_disp;
+  AlignTransforms<TXT>       m_trans;
+  int                        m_bin_len;
+  BBox2i                     m_bbox;
+  MatchCandidates          & m_matches;
+  Mutex                    & m_mutex;
+  TerminalProgressCallback & m_tpc;
+  double                     m_inc_amount;
+public:
+  RightBinMatchTask(DisparityT const& disp, AlignTransforms<TXT> const& trans,
+                    int bin_len, BBox2i const& bbox, MatchCandidates & matches,
+                    Mutex & mutex, TerminalProgressCallback & tpc, double inc_amount):
+    m_disp(disp), m_trans(trans), m_bin_len(bin_len), m_bbox(bbox),
+    m_matches(matches), m_mutex(mutex), m_tpc(tpc), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    ImageView<DispPixelT> tile = crop(m_disp, m_bbox);
+    for (int col = 0; col < tile.cols(); col++) {
+      for (int row = 0; row < tile.rows(); row++) {
+
+        DispPixelT dpix = tile(col, row);
+        if (!is_valid(dpix))
+          continue;
+
+        // Compute the right pixel. If, once rounded, it is a multiple
+        // of the bin size, keep it.
+        Vector2 trans_left_pix(col + m_bbox.min().x(), row + m_bbox.min().y());
+        Vector2 right_pix
+          = round(m_trans.right_reverse(trans_left_pix + stereo::DispHelper(dpix)));
+        if ( int(right_pix[0]) % m_bin_len != 0 ) continue;
+        if ( int(right_pix[1]) % m_bin_len != 0 ) continue;
+
+        m_matches.left.push_back(m_trans.left_reverse(trans_left_pix));
+        m_matches.right.push_back(right_pix);
+      }
+    }
+    Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
+/// Add the matches found by the tasks, in task order. With triplets,
+/// skip those whose left or right pixel was added already, as
+/// bundle_adjust would wipe both copies. This is clumsy, but we can't
+/// use a set since there is no ordering for pairs.
+void add_matches(std::vector<MatchCandidates> const& candidates, bool gen_triplets,
+                 std::map<double, double> & left_done,
+                 std::map<double, double> & right_done,
+                 std::vector<vw::ip::InterestPoint> & left_ip,
+                 std::vector<vw::ip::InterestPoint> & right_ip) {
+  for (size_t t = 0; t < candidates.size(); t++) {
+    for (size_t k = 0; k < candidates[t].left.size(); k++) {
+      Vector2 const& left_pix  = candidates[t].left[k];
+      Vector2 const& right_pix = candidates[t].right[k];
+      if (gen_triplets) {
+        std::map<double, double>::iterator it;
+        it = left_done.find(left_pix.x());
+        if (it != left_done.end() && it->second == left_pix.y()) continue; 
+        it = right_done.find(right_pix.x());
+        if (it != right_done.end() && it->second == right_pix.y()) continue; 
+        left_done[left_pix.x()] = left_pix.y();
+        right_done[right_pix.x()] = right_pix.y();
+      }
+      left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
+      right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
+    }
+  }
+}
+
 /// Bin the disparities, and from each bin get a disparity value.
 /// This will create a correspondence from the left to right image,
 /// which we save in the match format.
 /// When gen_triplets is true, and there are many overlapping images,
 /// try hard to have many IP with the property that each such IP is seen
 /// in more than two images. This helps with bundle adjustment.
+/// The bins, and for triplets the disparity tiles, are processed in
+/// parallel, each task keeping its matches, which are then merged.
 template <class DisparityT, class TXT>
 void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
                                vector<DisparityT> const& disparities,
@@ -342,235 +688,94 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
   DisparityT const& disp = disparities[0]; // pull the disparity
 
   // Transforms to compensate for alignment
-  TXT left_trans  = transforms[0];
-  TXT right_trans = transforms[1];
-
-  // Since all our code is templated, and for pinhole cameras
-  // there can be more than one type of transform, and there is no base
-  // pointer for all transforms, need to do this kludge.
-  bool usePinholeEpipolar = ( (stereo_settings().alignment_method == "epipolar") &&
-                              ( opt_vec[0].session->name() == "pinhole" ||
-                                opt_vec[0].session->name() == "nadirpinhole") );
-
-  // Must initialize below the two cameras to something to respect the constructor.
-  asp::PinholeCamTrans left_trans2 = asp::PinholeCamTrans(vw::camera::PinholeModel(),
-                                                          vw::camera::PinholeModel());
-  asp::PinholeCamTrans right_trans2 = left_trans2;
-  if (usePinholeEpipolar) {
-    StereoSessionPinhole* pinPtr = dynamic_cast<StereoSessionPinhole*>(opt_vec[0].session.get());
-    if (pinPtr == NULL) 
-      vw_throw(ArgumentErr() << "Expected a pinhole camera.\n");
-    pinPtr->pinhole_cam_trans(left_trans2, right_trans2);
-  }
-  
+  AlignTransforms<TXT> trans(opt_vec, transforms);
+
+  int num_threads = camera_num_threads(opt_vec[0]);
+  Mutex mutex;
+
   std::vector<vw::ip::InterestPoint> left_ip, right_ip;
 
-  if (!gen_triplets) {
+  // Need these to not insert an ip twice with triplets
+  std::map<double, double> left_done, right_done;
+
+  // Without triplets, the bins are over the disparity. With triplets,
+  // first create ip with left_ip being at integer multiple of bin
+  // size. Then do the same for right_ip. This way there is a symmetry
+  // and predictable location for ip. So if three images overlap, a
+  // feature can often be seen in many of them whether a given image
+  // is left in some pairs or right in some others.
+  {
+    Vector2i left_size(disp.cols(), disp.rows());
+    if (gen_triplets) {
+      DiskImageView<float> left_img(opt_vec[0].in_file1);
+      left_size = Vector2i(left_img.cols(), left_img.rows());
+    }
 
-    double num_pixels = double(disp.cols()) * double(disp.rows());
+    double num_pixels = double(left_size.x()) * double(left_size.y());
     double bin_len = sqrt(num_pixels/std::min(double(max_num_matches), num_pixels));
+    if (gen_triplets)
+      bin_len = round(bin_len);
     VW_ASSERT( bin_len >= 1.0, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
 
-    int lenx = round( disp.cols()/bin_len ); lenx = std::max(1, lenx);
-    int leny = round( disp.rows()/bin_len ); leny = std::max(1, leny);
-
-    // Iterate over bins.
+    int lenx = round( left_size.x()/bin_len ); lenx = std::max(1, lenx);
+    int leny = round( left_size.y()/bin_len ); leny = std::max(1, leny);
+    if (gen_triplets) {
+      // The bin corners go up to the image edge
+      lenx++;
+      leny++;
+    }
 
     vw_out() << "Computing interest point matches based on disparity.\n";
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(lenx);
     tpc.report_progress(0);
 
-    for (int binx = 0; binx < lenx; binx++) {
-
-      // Pick the disparity at the center of the bin
-      int posx = round( (binx+0.5)*bin_len );
-
-      for (int biny = 0; biny < leny; biny++) {
-
-        int posy = round( (biny+0.5)*bin_len );
-
-        if (posx >= disp.cols() || posy >= disp.rows()) 
-          continue;
-        typedef typename DisparityT::pixel_type DispPixelT;
-        DispPixelT dpix = disp(posx, posy);
-        if (!is_valid(dpix))
-          continue;
-
-        // De-warp left and right pixels to be in the camera coordinate system
-        Vector2 left_pix, right_pix;
-        if (!usePinholeEpipolar) {
-          left_pix  = left_trans.reverse ( Vector2(posx, posy) );
-          right_pix = right_trans.reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
-        }else{
-          left_pix  = left_trans2.reverse ( Vector2(posx, posy) );
-          right_pix = right_trans2.reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
-        }
-
-        left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
-        right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
-      }
-
-      tpc.report_incremental_progress( inc_amount );
+    // A few tasks per thread
+    int binx_per_task = std::max(1, lenx/(8*num_threads));
+    int num_tasks = (lenx + binx_per_task - 1)/binx_per_task;
+    std::vector<MatchCandidates> candidates(num_tasks);
+    FifoWorkQueue queue(num_threads);
+    for (int t = 0; t < num_tasks; t++) {
+      int beg = t*binx_per_task, end = std::min(beg + binx_per_task, lenx);
+      boost::shared_ptr<BinMatchTask<DisparityT, TXT> >
+        task(new BinMatchTask<DisparityT, TXT>(disp, trans, bin_len, beg, end, leny,
+                                               left_size, gen_triplets, candidates[t],
+                                               mutex, tpc, 1.0/num_tasks));
+      queue.add_task(task);
     }
+    queue.join_all();
     tpc.report_finished();
 
-  } else{
-
-    // First create ip with left_ip being at integer multiple of bin size.
-    // Then do the same for right_ip. This way there is a symmetry
-    // and predictable location for ip. So if three images overlap,
-    // a feature can often be seen in many of them whether a given
-    // image is left in some pairs or right in some others.
-
-    // Note that the code above is modified in subtle ways.
-
-    // Need these to not insert an ip twice, as then bundle_adjust
-    // will wipe both copies
-    std::map<double, double> left_done, right_done;
-    
-    // Start with the left
-    {
-      DiskImageView<float> left_img(opt_vec[0].in_file1);
-    
-      double num_pixels = double(left_img.cols()) * double(left_img.rows());
-      int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
-      VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
-
-      int lenx = round( left_img.cols()/bin_len ); lenx = std::max(1, lenx);
-      int leny = round( left_img.rows()/bin_len ); leny = std::max(1, leny);
-
-      // Iterate over bins.
-
-      vw_out() << "Computing interest point matches based on disparity.\n";
-      vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(lenx);
-      tpc.report_progress(0);
-
-      for (int binx = 0; binx <= lenx; binx++) {
-
-        int posx = binx*bin_len; // integer multiple of bin length
-
-        for (int biny = 0; biny <= leny; biny++) {
-
-          int posy = biny*bin_len; // integer multiple of bin length
-
-          if (posx >= left_img.cols() || posy >= left_img.rows()) 
-            continue;
-
-          Vector2 left_pix(posx, posy);
-          Vector2 trans_left_pix, trans_right_pix, right_pix;
-        
-          typedef typename DisparityT::pixel_type DispPixelT;
-
-          // Make the left pixel go to the disparity domain. Find the corresponding
-          // right pixel. And make that one go to the right image domain.
-          if (!usePinholeEpipolar) {
-            trans_left_pix = round(left_trans.forward(left_pix));
-            if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
-            if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
-            DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-            if (!is_valid(dpix))
-              continue;
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix = right_trans.reverse(trans_right_pix);
-          }else{
-            trans_left_pix = round(left_trans2.forward(left_pix));
-            if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
-            if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
-            DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-            if (!is_valid(dpix))
-              continue;
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix = right_trans2.reverse(trans_right_pix);
-          }
+    add_matches(candidates, gen_triplets, left_done, right_done, left_ip, right_ip);
+  }
 
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
-      tpc.report_finished();
-    }
+  // Now create ip in predictable location for the right image. This is hard,
+  // as the disparity goes from left to right, so we need to examine every disparity.
+  if (gen_triplets) {
+    DiskImageView<float> right_img(opt_vec[0].in_file2);
     
-    // Now create ip in predictable location for the right image.This is hard,
-    // as the disparity goes from left to right, so we need to examine every disparity.
-    typedef typename DisparityT::pixel_type DispPixelT;
-    ImageView<DispPixelT> disp_copy = copy(disp);
-    {
-      DiskImageView<float> right_img(opt_vec[0].in_file2);
-    
-      double num_pixels = double(right_img.cols()) * double(right_img.rows());
-      int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
-      VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
-
-      // Iterate over disparity.
-
-      vw_out() << "Doing a second pass. This will be very slow.\n";
-      vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(disp_copy.cols());
-      tpc.report_progress(0);
+    double num_pixels = double(right_img.cols()) * double(right_img.rows());
+    int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
+    VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
 
-      for (int col = 0; col < disp_copy.cols(); col++) {
-        for (int row = 0; row < disp_copy.rows(); row++) {
-
-          Vector2 trans_left_pix(col, row);
-          Vector2 left_pix, trans_right_pix, right_pix;
-
-          DispPixelT dpix = disp_copy(trans_left_pix[0], trans_left_pix[1]);
-          if (!is_valid(dpix))
-            continue;
-          
-          // Compute the left and right pixels. 
-          if (!usePinholeEpipolar) {
-            left_pix        = left_trans.reverse(trans_left_pix);
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix       = right_trans.reverse(trans_right_pix);
-          }else{
-            left_pix        = left_trans2.reverse(trans_left_pix);
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix       = right_trans2.reverse(trans_right_pix);
-          }
+    vw_out() << "Doing a second pass over the whole disparity.\n";
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    tpc.report_progress(0);
 
-          // If the right pixel is a multiple of the bin size, keep
-          // it.
-          right_pix = round(right_pix); // very important
-          if ( int(right_pix[0]) % bin_len != 0 ) continue;
-          if ( int(right_pix[1]) % bin_len != 0 ) continue;
-
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
-      tpc.report_finished();
+    std::vector<BBox2i> tiles = subdivide_bbox(disp, opt_vec[0].raster_tile_size[0],
+                                               opt_vec[0].raster_tile_size[1]);
+    std::vector<MatchCandidates> candidates(tiles.size());
+    FifoWorkQueue queue(num_threads);
+    for (size_t t = 0; t < tiles.size(); t++) {
+      boost::shared_ptr<RightBinMatchTask<DisparityT, TXT> >
+        task(new RightBinMatchTask<DisparityT, TXT>(disp, trans, bin_len, tiles[t],
+                                                    candidates[t], mutex, tpc,
+                                                    1.0/tiles.size()));
+      queue.add_task(task);
     }
+    queue.join_all();
+    tpc.report_finished();
 
-    
+    add_matches(candidates, gen_triplets, left_done, right_done, left_ip, right_ip);
   } // end considering multi-image friendly ip
 
   vw_out() << "Determined " << left_ip.size()
@@ -614,23 +819,120 @@ namespace asp{
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
     // TODO: Replace this with with a function call!
-    if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
+    bool single_threaded = ((opt.session->name() == "isis") ||
+                            (opt.session->name() == "isismapisis")) &&
+      !stereo_settings().isis_per_thread_cameras;
+
+    // Find the statistics of the cloud as its tiles are written, for
+    // the tools which read it later
+    boost::shared_ptr<asp::PointCloudStatsAccumulator>
+      stats(new asp::PointCloudStatsAccumulator);
+    asp::PointCloudStatsView<ImageT> cloud = asp::point_cloud_stats_view(point_cloud, stats);
+
+    if (stereo_settings().fixed_point_point_cloud) {
+      if (single_threaded)
+        asp::write_fixed_point_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            cloud, has_georef, georef,
+            opt, asp::StatusProgressCallback("asp", "\t--> Triangulating: "));
+      else
+        asp::block_write_fixed_point_gdal_image
+          ( point_cloud_file, shift,
+            stereo_settings().point_cloud_rounding_error,
+            cloud, has_georef, georef,
+            opt, asp::StatusProgressCallback("asp", "\t--> Triangulating: "));
+    }else if (single_threaded){
       // ISIS does not support multi-threading
       asp::write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
-          point_cloud,
+          cloud,
           has_georef, georef, has_nodata, nodata,
-          opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+          opt, asp::StatusProgressCallback("asp", "\t--> Triangulating: "));
     }else{
       asp::block_write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
-          point_cloud,
+          cloud,
           has_georef, georef, has_nodata, nodata,
-          opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+          opt, asp::StatusProgressCallback("asp", "\t--> Triangulating: "));
+    }
+
+    asp::write_point_cloud_stats(point_cloud_file, stats->result());
+  }
+
+  /// Write the points straight to a LAS file, without creating the
+  /// point cloud image first. The points are stored relative to the
+  /// cloud center, rounded to the point cloud rounding error. The cloud
+  /// is triangulated one strip of tiles at a time, using the usual
+  /// number of threads, and the points are written in order.
+  void save_point_cloud_las(Vector3 const& shift, ImageViewRef<Vector6> const& point_cloud,
+                            string const& las_file, ASPGlobalOptions const& opt){
+
+    vw_out() << "Writing LAS file: " << las_file << "\n";
+
+    double scale = get_rounding_error(shift, stereo_settings().point_cloud_rounding_error);
+    double max_error = stereo_settings().las_max_triangulation_error;
+
+    liblas::Header header;
+    header.SetScale (scale, scale, scale);
+    header.SetOffset(shift[0], shift[1], shift[2]);
+    header.SetCompressed(stereo_settings().compress_las);
+
+    // The points are in ECEF
+    liblas::SpatialReference ref;
+    ref.SetFromUserInput("+proj=geocent " + opt.session->get_georef().datum().proj4_str());
+    header.SetSRS(ref);
+
+    std::ofstream ofs(las_file.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs.good())
+      vw_throw( IOErr() << "Could not open for writing: " << las_file << "\n" );
+    liblas::Writer writer(ofs, header);
+
+    int num_threads = camera_num_threads(opt);
+
+    Vector2i tile_size = opt.raster_tile_size;
+    BBox2i   cloud_box = bounding_box(point_cloud);
+    BBox3    points_box;
+    boost::uint32_t num_points = 0;
+    asp::StatusProgressCallback tpc("asp", "\t--> Triangulating: ");
+    for (int row = cloud_box.min().y(); row < cloud_box.max().y(); row += tile_size.y()) {
+      tpc.report_fractional_progress(row - cloud_box.min().y(), cloud_box.height());
+
+      BBox2i strip_box(cloud_box.min().x(), row, cloud_box.width(), tile_size.y());
+      strip_box.crop(cloud_box);
+      ImageView<Vector6> strip = block_rasterize(crop(point_cloud, strip_box),
+                                                 tile_size, num_threads);
+
+      for (int r = 0; r < strip.rows(); r++) {
+        for (int c = 0; c < strip.cols(); c++) {
+          Vector3 xyz = subvector(strip(c, r), 0, 3);
+          if (xyz == Vector3())
+            continue; // no-data
+          if (max_error > 0 && norm_2(subvector(strip(c, r), 3, 3)) > max_error)
+            continue;
+
+          points_box.grow(xyz);
+          liblas::Point las_point(&header);
+          las_point.SetCoordinates(xyz[0], xyz[1], xyz[2]);
+          writer.WritePoint(las_point);
+          num_points++;
+        }
+      }
+    }
+    tpc.report_finished();
+
+    // Now that the points are known, fill in their count and extent
+    if (num_points > 0) {
+      header.SetMin(points_box.min().x(), points_box.min().y(), points_box.min().z());
+      header.SetMax(points_box.max().x(), points_box.max().y(), points_box.max().z());
     }
+    header.SetPointRecordsCount(num_points);
+    writer.SetHeader(header);
+    writer.WriteHeader();
 
+    vw_out() << "Wrote " << num_points << " points.\n";
   }
 
   Vector3 find_approx_points_median(vector<Vector3> const& points){
@@ -804,6 +1106,16 @@ void stereo_triangulation( string          const& output_prefix,
     vector<PVImageT> disparity_maps;
     for (int p = 0; p < (int)opt_vec.size(); p++){
       disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
+
+      // Remove the photometric outliers as the tiles are triangulated
+      int kernel_size = stereo_settings().photometric_outlier_kernel_size;
+      if (kernel_size > 0) {
+        vw_out() << "\t--> Removing photometric outliers.\n";
+        disparity_maps.back()
+          = asp::photometric_outlier_view(asp::open_intermediate<PixelGray<float> >(opt_vec[p].out_prefix+"-L.tif"),
+                                          asp::open_intermediate<PixelGray<float> >(opt_vec[p].out_prefix+"-R.tif"),
+                                          disparity_maps.back(), kernel_size);
+      }
     }
 
     std::string unalign_disp = asp::unwarped_disp_file(output_prefix,
@@ -849,9 +1161,7 @@ void stereo_triangulation( string          const& output_prefix,
       compute_matches_from_disp(opt_vec, disparity_maps, transforms, match_file,
                                 max_num_matches, gen_triplets);
 
-      int num_threads = opt_vec[0].num_threads;
-      if (opt_vec[0].session->name() == "isis" || opt_vec[0].session->name() == "isismapisis")
-        num_threads = 1;
+      int num_threads = camera_num_threads(opt_vec[0]);
       asp::jitter_adjust(image_files, camera_files, cameras,
 			 output_prefix, opt_vec[0].session->name(),
 			 match_file,  num_threads);
@@ -886,6 +1196,24 @@ void stereo_triangulation( string          const& output_prefix,
       }
     }
 
+    // Replace the cameras with ones interpolating their rays on a grid.
+    // RPC cameras are cheap to evaluate, and the RPC stereo model needs
+    // them as they are.
+    if (stereo_settings().ray_grid_angle_tol > 0) {
+      for (int c = 0; c < (int)cameras.size(); c++) {
+        if (dynamic_cast<const asp::RPCModel*>(vw::camera::unadjusted_model(cameras[c].get())) != NULL)
+          continue;
+        std::ostringstream os;
+        os << output_prefix << "-camera" << c << "-ray-grid.txt";
+        BBox2i image_box = bounding_box(DiskImageView<float>(image_files[c]));
+        cameras[c] = boost::shared_ptr<camera::CameraModel>
+          (new asp::RayGridCameraModel(cameras[c], image_box,
+                                       stereo_settings().ray_grid_angle_tol,
+                                       stereo_settings().ray_grid_center_tol,
+                                       os.str()));
+      }
+    }
+
     if (is_map_projected)
       vw_out() << "\t--> Inputs are map projected" << std::endl;
 
@@ -902,11 +1230,34 @@ void stereo_triangulation( string          const& output_prefix,
     StereoModelT stereo_model( camera_ptrs, stereo_settings().use_least_squares,
                                angle_tol);
 
+    // Plain RPC cameras are triangulated a row of pixels at a time
+    boost::shared_ptr<asp::RPCStereoModel> rpc_model;
+    if (asp::RPCStereoModel::are_rpc(camera_ptrs)) {
+      rpc_model.reset(new asp::RPCStereoModel(camera_ptrs, stereo_settings().use_least_squares,
+                                              angle_tol));
+      rpc_model->set_direct_intersection(stereo_settings().rpc_direct_triangulation);
+    }else if (stereo_settings().rpc_direct_triangulation) {
+      vw_out(WarningMessage) << "The option --rpc-direct-triangulation applies only "
+                             << "to RPC cameras with no adjustments. Ignoring it.\n";
+    }
+
+    // The disparities can be read ahead of the tiles being
+    // triangulated. This is started once the tiles are written.
+    typedef boost::shared_ptr< asp::TilePrefetcher<typename PVImageT::pixel_type> > PrefetcherPtr;
+    vector<PrefetcherPtr> prefetchers;
+    if (stereo_settings().tri_prefetch_size > 0) {
+      for (int p = 0; p < (int)disparity_maps.size(); p++)
+        prefetchers.push_back(PrefetcherPtr(new asp::TilePrefetcher<typename PVImageT::pixel_type>
+                                            ("disparity", disparity_maps[p],
+                                             stereo_settings().tri_prefetch_size,
+                                             stereo_settings().tri_prefetch_threads)));
+    }
+
     // Apply radius function and stereo model in one go
     vw_out() << "\t--> Generating a 3D point cloud." << endl;
     ImageViewRef<Vector6> point_cloud = per_pixel_filter
       (stereo_error_triangulate
-       (disparity_maps, transforms, stereo_model, is_map_projected),
+       (disparity_maps, transforms, stereo_model, is_map_projected, prefetchers, rpc_model),
        universe_radius_func);
 
     // If we crop the left and right images, at each run we must
@@ -934,7 +1285,23 @@ void stereo_triangulation( string          const& output_prefix,
     // so force rasterization in that box only using crop().
     BBox2i cbox = stereo_settings().trans_crop_win;
     string point_cloud_file = output_prefix + "-PC.tif";
-    if (stereo_settings().compute_error_vector){
+
+    // The LAS file always needs a center to store the points relative to
+    if (stereo_settings().write_las && cloud_center == Vector3())
+      cloud_center = find_point_cloud_center(opt_vec[0].raster_tile_size, point_cloud);
+
+    // The tiles are written in raster order, starting at the corner of cbox
+    if (!prefetchers.empty()) {
+      std::vector<BBox2i> schedule = subdivide_bbox(cbox, opt_vec[0].raster_tile_size[0],
+                                                    opt_vec[0].raster_tile_size[1]);
+      for (size_t p = 0; p < prefetchers.size(); p++)
+        prefetchers[p]->start(schedule);
+    }
+
+    if (stereo_settings().write_las){
+      string las_file = output_prefix + (stereo_settings().compress_las ? "-PC.laz" : "-PC.las");
+      save_point_cloud_las(cloud_center, crop(point_cloud, cbox), las_file, opt_vec[0]);
+    }else if (stereo_settings().compute_error_vector){
 
       if (num_cams > 2)
         vw_out(WarningMessage) << "For more than two cameras, the error "
@@ -959,7 +1326,7 @@ void stereo_triangulation( string          const& output_prefix,
 } // End function stereo_triangulation()
 
 
-int main( int argc, char* argv[] ) {
+int stereo_tri_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -994,7 +1361,7 @@ int main( int argc, char* argv[] ) {
 
     // Triangulation uses small tiles.
     //---------------------------------------------------------
-    int ts = ASPGlobalOptions::tri_tile_size();
+    int ts = stereo_settings().tri_tile_size_ovr;
     for (int s = 0; s < (int)opt_vec.size(); s++)
       opt_vec[s].raster_tile_size = Vector2i(ts, ts);
 
@@ -1004,6 +1371,7 @@ int main( int argc, char* argv[] ) {
    // TODO: De-template these classes!
 
 #define INSTANTIATE(T,NAME) if ( opt_vec[0].session->name() == NAME ) { \
+      asp::ScopedTimer timer("stereo_tri");                              \
       stereo_triangulation<T>(output_prefix, opt_vec); }
 
     INSTANTIATE(StereoSessionPinhole,           "pinhole"           );
@@ -1031,3 +1399,9 @@ int main( int argc, char* argv[] ) {
 
   return 0;
 }
+
+#ifndef ASP_STEREO_ALL_STAGES
+int main(int argc, char* argv[]) {
+  return stereo_tri_main(argc, argv);
+}
+#endif
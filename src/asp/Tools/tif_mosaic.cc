@@ -320,12 +320,49 @@ public:
 
     // TODO: Replace this code with the resample_aa function??
 
-    // TODO: This could possibly be performed entirely with a
-    // TransformView and apply_mask.
-    // -- or --
-    // Since we have no rotations, we can assume whole lines will come
-    // from a single image
+    // The images are only scaled and shifted, so along an output row
+    // the source pixel of each image moves by a fixed step, and the
+    // columns where it can be in the active area of that image form one
+    // interval. Find these once per row, with a margin, so that each
+    // pixel is looked up only in the few images which can have it.
+    std::vector<Vector2> src_step(m_img_data.size());
+    for (int k = 0; k < (int)m_img_data.size(); k++) {
+      if (src_vec[k].empty())
+        continue;
+      Vector2 dst_pix = Vector2(bbox.min().x(), bbox.min().y())/m_scale;
+      src_step[k] = m_img_data[k].transform.reverse(dst_pix + Vector2(1.0/m_scale, 0))
+        - m_img_data[k].transform.reverse(dst_pix);
+    }
+
+    std::vector<int> row_images, row_begin, row_end;
     for (int row = 0; row < bbox.height(); row++){
+
+      row_images.clear(); row_begin.clear(); row_end.clear();
+      for (int k = (int)m_img_data.size()-1; k >= 0; k--){
+        if (src_vec[k].empty())
+          continue;
+        Vector2 dst_pix = Vector2(bbox.min().x(), row + bbox.min().y())/m_scale;
+        Vector2 src_pix = m_img_data[k].transform.reverse(dst_pix);
+        double beg = 0, end = bbox.width();
+        for (int d = 0; d < 2; d++){
+          double lo = src_vec[k].min()[d], hi = src_vec[k].max()[d];
+          if (std::abs(src_step[k][d]) < 1e-12){
+            if (src_pix[d] < lo - 1 || src_pix[d] > hi + 1)
+              end = beg;
+            continue;
+          }
+          double c0 = (lo - src_pix[d])/src_step[k][d];
+          double c1 = (hi - src_pix[d])/src_step[k][d];
+          beg = std::max(beg, floor(std::min(c0, c1)) - 1.0);
+          end = std::min(end, ceil (std::max(c0, c1)) + 1.0);
+        }
+        if (beg >= end)
+          continue;
+        row_images.push_back(k);
+        row_begin.push_back((int)beg);
+        row_end.push_back((int)end);
+      }
+
       for (int col = 0; col < bbox.width(); col++){
 
         Vector2 dst_pix = Vector2(col + bbox.min().x(),
@@ -334,7 +371,10 @@ public:
         // See which src image we end up in. Start from the later
         // images, as those are on top. Stop when we find an image
         // with a valid pixel at given location.
-        for (int k = (int)m_img_data.size()-1; k >= 0; k--){
+        for (size_t i = 0; i < row_images.size(); i++){
+          if (col < row_begin[i] || col >= row_end[i])
+            continue;
+          int k = row_images[i];
           Vector2 src_pix = m_img_data[k].transform.reverse(dst_pix);
           if (!src_vec[k].contains(src_pix))
             continue;
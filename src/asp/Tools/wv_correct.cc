@@ -35,11 +35,14 @@
 #include <vw/Image/Algorithms2.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/PointCloudTypes.h>
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/RPCModel.h>
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/sax/HandlerBase.hpp>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <fstream>
+#include <sstream>
 
 namespace po = boost::program_options;
 using namespace vw;
@@ -48,24 +51,17 @@ using namespace vw::cartography;
 using namespace xercesc;
 using namespace std;
 
-// Allows FileIO to correctly read/write these pixel types
-namespace vw {
-  typedef Vector<float64,6> Vector6;
-  template<> struct PixelFormatID<Vector3>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector3f>  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
-  template<> struct PixelFormatID<Vector4>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
-  template<> struct PixelFormatID<Vector6>   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
 struct Options : vw::cartography::GdalWriteOptions {
-  std::string camera_image_file, camera_model_file, output_image, output_type;
+  std::string camera_image_file, camera_model_file, output_image, output_type,
+    ccd_offsets_file;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   
   po::options_description general_options("");
   general_options.add_options()
-    ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type.");
+    ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type.")
+    ("ccd-offsets", po::value(&opt.ccd_offsets_file)->default_value(""), "Use the CCD offsets from this file, as produced by wv_ccd_calib, rather than the built-in ones.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
   
   po::options_description positional("");
@@ -476,24 +472,56 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   
 }
 
+/// Read the CCD offsets written by wv_ccd_calib. Each line has the
+/// axis (x or y), the position, and the offset. Lines starting with
+/// '#' are ignored.
+void read_offsets(std::string const& file,
+                  std::vector<double> & posx, std::vector<double> & ccdx,
+                  std::vector<double> & posy, std::vector<double> & ccdy){
+
+  posx.clear();
+  ccdx.clear();
+  posy.clear();
+  ccdy.clear();
+
+  std::ifstream ifs(file.c_str());
+  if (!ifs.good())
+    vw_throw( ArgumentErr() << "Could not read: " << file << ".\n" );
+
+  std::string line;
+  while (std::getline(ifs, line)){
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream is(line);
+    std::string axis;
+    double pos, offset;
+    if ( !(is >> axis >> pos >> offset) || (axis != "x" && axis != "y") )
+      vw_throw( ArgumentErr() << "Invalid line in " << file << ": " << line << "\n" );
+    if (axis == "x"){
+      posx.push_back(pos);
+      ccdx.push_back(offset);
+    }else{
+      posy.push_back(pos);
+      ccdy.push_back(offset);
+    }
+  }
+}
+
 template <class ImageT>
 class WVCorrectView: public ImageViewBase< WVCorrectView<ImageT> >{
   ImageT m_img;
-  int m_tdi;
-  bool m_is_wv01, m_is_forward;
   double m_pitch_ratio;
   std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
+  std::vector<double> m_col_dx, m_col_dy; // The accumulated offsets at each column
   
   typedef typename ImageT::pixel_type PixelT;
 
 public:
-  WVCorrectView( ImageT const& img, int tdi, bool is_wv01, bool is_forward,
+  WVCorrectView( ImageT const& img,
+                 std::vector<double> const& posx, std::vector<double> const& ccdx,
+                 std::vector<double> const& posy, std::vector<double> const& ccdy,
                  double pitch_ratio):
-    m_img(img), m_tdi(tdi), m_is_wv01(is_wv01), m_is_forward(is_forward),
-    m_pitch_ratio(pitch_ratio){
-    
-    get_offsets(m_tdi, m_is_wv01, m_is_forward,  
-                m_posx, m_ccdx, m_posy, m_ccdy);
+    m_img(img), m_pitch_ratio(pitch_ratio),
+    m_posx(posx), m_ccdx(ccdx), m_posy(posy), m_ccdy(ccdy){
 
     // Compensate for the variable pitch ratio
     for (int i = 0; i < (int)m_posx.size(); i++) m_posx[i] *= m_pitch_ratio;
@@ -503,6 +531,23 @@ public:
               m_posy.size() == m_ccdy.size(),
               ArgumentErr() << "wv_correct: Expecting the arrays of positions "
               << "and offsets to have the same sizes.");
+
+    // Accumulate the corrections up to each column, once for the
+    // whole image rather than for each tile
+    m_col_dx.assign(m_img.cols(), 0.0);
+    m_col_dy.assign(m_img.cols(), 0.0);
+    if (m_ccdx.size() > 0){
+      for (int col = 0; col < m_img.cols(); col++){
+        for (size_t t = 0; t < m_ccdx.size(); t++){
+          if (m_posx[t] < col)
+            m_col_dx[col] -= m_ccdx[t];
+        }
+        for (size_t t = 0; t < m_ccdy.size(); t++){
+          if (m_posy[t] < col)
+            m_col_dy[col] -= m_ccdy[t];
+        }
+      }
+    }
   }
   
   typedef PixelT pixel_type;
@@ -532,36 +577,37 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
 
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
+    // The offsets are the same along each column, so the bilinear
+    // interpolation weights and the pixels it uses, relative to the
+    // current row, are found once per column. The pixels outside the
+    // cropped image are those of its edge, as with a constant edge
+    // extension.
+    int width = bbox.width();
+    std::vector<int>    x0(width), x1(width), dy(width);
+    std::vector<double> fx(width), fy(width);
+    for (int c = 0; c < width; c++){
+      int col = c + bbox.min().x();
+      double x = col - biased_box.min().x() + m_col_dx[col];
+      double y = m_col_dy[col];
+      int ix = (int)floor(x), iy = (int)floor(y);
+      fx[c] = x - ix;
+      fy[c] = y - iy;
+      x0[c] = std::min(std::max(ix,     0), cropped_img.cols() - 1);
+      x1[c] = std::min(std::max(ix + 1, 0), cropped_img.cols() - 1);
+      dy[c] = iy;
+    }
 
-      // Accumulate the corrections up to the current column
-      double valx = 0, valy = 0;
-      if (m_ccdx.size() > 0){
-        valx = 0.0;
-        for (size_t t = 0; t < m_ccdx.size(); t++){
-          if (m_posx[t] < col){
-            valx -= m_ccdx[t];
-          }
-        }
-        valy = 0.0;
-        for (size_t t = 0; t < m_ccdy.size(); t++){
-          if (m_posy[t] < col){
-            valy -= m_ccdy[t];
-          }
-        }
-      }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
+    int last_row = cropped_img.rows() - 1;
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    for (int r = 0; r < bbox.height(); r++){
+      int row = r + bbox.min().y() - biased_box.min().y();
+      for (int c = 0; c < width; c++){
+        int y0 = std::min(std::max(row + dy[c],     0), last_row);
+        int y1 = std::min(std::max(row + dy[c] + 1, 0), last_row);
+        double wx = fx[c], wy = fy[c];
+        tile(c, r) = result_type( ((1 - wx)*cropped_img(x0[c], y0) + wx*cropped_img(x1[c], y0))*(1 - wy)
+                                + ((1 - wx)*cropped_img(x0[c], y1) + wx*cropped_img(x1[c], y1))*wy );
       }
     }
     
@@ -576,9 +622,12 @@ public:
 };
 template <class ImageT>
 WVCorrectView<ImageT> wv_correct(ImageT const& img,
-                                 int tdi, bool is_wv01, bool is_forward,
+                                 std::vector<double> const& posx,
+                                 std::vector<double> const& ccdx,
+                                 std::vector<double> const& posy,
+                                 std::vector<double> const& ccdy,
                                  double pitch_ratio){
-  return WVCorrectView<ImageT>(img, tdi, is_wv01, is_forward, pitch_ratio);
+  return WVCorrectView<ImageT>(img, posx, ccdx, posy, ccdy, pitch_ratio);
 }
 
 int main( int argc, char *argv[] ) {
@@ -625,6 +674,12 @@ int main( int argc, char *argv[] ) {
     // Adjust for detector pitch
     double pitch_ratio = 8.0e-3/det_pitch;
 
+    std::vector<double> posx, ccdx, posy, ccdy;
+    if (opt.ccd_offsets_file != "")
+      read_offsets(opt.ccd_offsets_file, posx, ccdx, posy, ccdy);
+    else
+      get_offsets(tdi, is_wv01, is_forward, posx, ccdx, posy, ccdy);
+
     DiskImageView<float> input_img(opt.camera_image_file);
     bool has_nodata = false;
     double nodata = numeric_limits<double>::quiet_NaN();
@@ -641,10 +696,10 @@ int main( int argc, char *argv[] ) {
     ImageViewRef<float> corr_img;
     if (has_nodata) 
       corr_img = apply_mask(wv_correct(create_mask(input_img, nodata),
-                                       tdi, is_wv01, is_forward,
+                                       posx, ccdx, posy, ccdy,
                                        pitch_ratio), nodata);
     else
-      corr_img = wv_correct(input_img, tdi, is_wv01, is_forward, pitch_ratio);
+      corr_img = wv_correct(input_img, posx, ccdx, posy, ccdy, pitch_ratio);
     
     vw_out() << "Writing: " << opt.output_image << std::endl;
     TerminalProgressCallback tpc("asp", "\t--> ");
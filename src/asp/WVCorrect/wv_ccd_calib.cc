@@ -0,0 +1,424 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file wv_ccd_calib.cc
+///
+
+// Find the CCD offsets for WorldView images of given TDI and scan
+// direction, from the disparities of several stereo runs. This does
+// in one pass what disp_avg, find_ccds.m and find_ccds_aux.m do. See
+// the README in this directory.
+
+// Each disparity is read once, with its tiles processed in parallel,
+// and its rows are averaged. Each average is resampled to the base
+// detector pitch, its ends are discarded, and its moving average is
+// subtracted. The averages over all runs are then searched for jumps,
+// keeping at most one per CCD. The x and y offsets are found in
+// parallel. The result is saved as a table which can be passed to
+// wv_correct with --ccd-offsets.
+
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/BBox.h>
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+
+namespace po = boost::program_options;
+using namespace vw;
+using namespace std;
+
+namespace {
+
+  // Constants from find_ccds.m and find_ccds_aux.m
+  const double BASE_PITCH        = 8.0e-3; // The pitch the CCD positions are at
+  const int    EDGE_BUFFER       = 100;    // Discard this many columns near the ends
+  const int    MOVING_AVG_WINDOW = 700;    // Window to find the smooth trend
+  const double MAX_RUN_VALUE     = 1.0;    // Skip runs with larger values after detrending
+  const int    JUMP_WIDTH        = 35;     // Half the width of a jump
+  const double MIN_JUMP          = 0.01;   // Smallest CCD jump
+  const double MAX_JUMP          = 1.5;    // Largest CCD jump
+  const int    CCD_PERIOD        = 705;    // Approximate width of a CCD, in pixels
+  const int    CCD_SHIFT         = -35;    // Position of the first CCD border, minus the period
+  const int    CCD_SEARCH_WIDTH  = 80;     // Look this far from the expected border
+
+  const double NaN = std::numeric_limits<double>::quiet_NaN();
+}
+
+struct Options : vw::cartography::GdalWriteOptions {
+  std::vector<std::string> disparity_files;
+  std::vector<double> pitches;
+  std::string pitches_str, output_prefix;
+  int tile_size;
+};
+
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.")
+    ("pitches", po::value(&opt.pitches_str)->default_value(""),
+     "The detector pitch of the left image of each run, in the order of the disparities, separated by commas (see <DETPITCH> in the XML file). Default: 0.008 for each run.")
+    ("tile-size", po::value(&opt.tile_size)->default_value(1024),
+     "The disparities are read and averaged in parallel in tiles of this size.");
+  general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
+
+  po::options_description positional("");
+  positional.add_options()
+    ("disparity-files", po::value(&opt.disparity_files));
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("disparity-files", -1);
+
+  std::string usage("[options] <run1-F.tif> <run2-F.tif> ... -o <output prefix>");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line( argc, argv, opt, general_options, general_options,
+                             positional, positional_desc, usage,
+                             allow_unregistered, unregistered );
+
+  if ( opt.disparity_files.empty() )
+    vw_throw( ArgumentErr() << "No disparities were specified.\n\n"
+              << usage << general_options );
+  if ( opt.output_prefix.empty() )
+    vw_throw( ArgumentErr() << "Missing the output prefix.\n\n"
+              << usage << general_options );
+  if ( opt.tile_size <= 0 )
+    vw_throw( ArgumentErr() << "The tile size must be positive.\n" );
+
+  std::string pitches_str = opt.pitches_str;
+  std::replace(pitches_str.begin(), pitches_str.end(), ',', ' ');
+  std::istringstream is(pitches_str);
+  double pitch;
+  while (is >> pitch) {
+    if (pitch <= 0)
+      vw_throw( ArgumentErr() << "The pitches must be positive.\n" );
+    opt.pitches.push_back(pitch);
+  }
+  if (opt.pitches.empty())
+    opt.pitches.assign(opt.disparity_files.size(), BASE_PITCH);
+  if (opt.pitches.size() != opt.disparity_files.size())
+    vw_throw( ArgumentErr() << "Expecting as many pitches as disparities.\n" );
+
+  vw::create_out_dir(opt.output_prefix);
+}
+
+/// The sums of the valid disparities in each column. These can be
+/// found for parts of the disparity in parallel, and then merged.
+struct ColumnStats {
+  std::vector<double> sum_x, sum_y, count;
+
+  ColumnStats(int cols = 0): sum_x(cols, 0.0), sum_y(cols, 0.0), count(cols, 0.0) {}
+
+  void merge(ColumnStats const& other, int col_start) {
+    for (size_t c = 0; c < other.count.size(); c++) {
+      sum_x[col_start + c] += other.sum_x[c];
+      sum_y[col_start + c] += other.sum_y[c];
+      count[col_start + c] += other.count[c];
+    }
+  }
+
+  // The average in each column, or 0 if the column has no valid disparities,
+  // as written by disp_avg.
+  void averages(std::vector<double> & avg_x, std::vector<double> & avg_y) const {
+    avg_x.assign(count.size(), 0.0);
+    avg_y.assign(count.size(), 0.0);
+    for (size_t c = 0; c < count.size(); c++) {
+      if (count[c] > 0) {
+        avg_x[c] = sum_x[c]/count[c];
+        avg_y[c] = sum_y[c]/count[c];
+      }
+    }
+  }
+};
+
+/// Accumulate the column sums of one tile of the disparity
+class ColumnStatsTask: public vw::Task, private boost::noncopyable {
+  DiskImageView< PixelMask<Vector2f> > m_disp;
+  BBox2i        m_bbox;
+  ColumnStats & m_stats;
+  Mutex       & m_mutex;
+public:
+  ColumnStatsTask(DiskImageView< PixelMask<Vector2f> > const& disp, BBox2i const& bbox,
+                  ColumnStats & stats, Mutex & mutex):
+    m_disp(disp), m_bbox(bbox), m_stats(stats), m_mutex(mutex) {}
+
+  void operator()() {
+    ImageView< PixelMask<Vector2f> > tile = crop(m_disp, m_bbox);
+    ColumnStats local(tile.cols());
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        PixelMask<Vector2f> const& p = tile(col, row);
+        if (!is_valid(p))
+          continue;
+        local.sum_x[col] += p.child()[0];
+        local.sum_y[col] += p.child()[1];
+        local.count[col] += 1;
+      }
+    }
+    Mutex::Lock lock(m_mutex);
+    m_stats.merge(local, m_bbox.min().x());
+  }
+};
+
+/// Average the rows of a disparity, reading it once.
+void average_rows(std::string const& disp_file, Options const& opt,
+                  std::vector<double> & avg_x, std::vector<double> & avg_y) {
+
+  vw_out() << "Reading: " << disp_file << std::endl;
+  DiskImageView< PixelMask<Vector2f> > disp(disp_file);
+  ColumnStats stats(disp.cols());
+  Mutex mutex;
+
+  std::vector<BBox2i> tiles = subdivide_bbox(disp, opt.tile_size, opt.tile_size);
+  FifoWorkQueue queue(std::max(int(opt.num_threads), 1));
+  for (size_t t = 0; t < tiles.size(); t++)
+    queue.add_task(boost::shared_ptr<Task>(new ColumnStatsTask(disp, tiles[t], stats, mutex)));
+  queue.join_all();
+
+  stats.averages(avg_x, avg_y);
+}
+
+/// Resample a row average to the base pitch, as scale_by_pitch() in find_ccds.m.
+std::vector<double> scale_by_pitch(std::vector<double> const& data, double pitch) {
+  std::vector<double> out;
+  int len = data.size();
+  double ratio = BASE_PITCH/pitch;
+  for (int k = 1; ratio*k <= len; k++) {
+    double x = ratio*k - 1; // 0-based position
+    int    i = std::min(int(floor(x)), len - 2);
+    double w = x - i;
+    out.push_back(i < 0 ? data[0] : (1 - w)*data[i] + w*data[i + 1]);
+  }
+  if (!out.empty())
+    out.pop_back();
+  return out;
+}
+
+/// Discard the columns near the ends, where the disparity is zero or
+/// close to where it is zero.
+void blank_edges(std::vector<double> & data) {
+  int len = data.size();
+  int edge_search_dist = round(len/3.0);
+  int col_start = 0, col_end = len - 1;
+  for (int c = 0; c < edge_search_dist && c < len; c++)
+    if (data[c] == 0) col_start = c;
+  for (int c = std::max(len - 1 - edge_search_dist, 0); c < len; c++)
+    if (data[c] == 0) col_end = std::min(col_end, c);
+  col_start += EDGE_BUFFER;
+  col_end   -= EDGE_BUFFER;
+  for (int c = 0; c < len; c++)
+    if (c <= col_start || c >= col_end)
+      data[c] = NaN;
+}
+
+/// Subtract the moving average, as find_moving_avg.m does, using a
+/// window centered at each value and shrunk near the ends.
+void subtract_moving_avg(std::vector<double> & data) {
+  int len = data.size();
+  int ss = 0, ee = len - 1; // first and last valid values
+  while (ss < len && data[ss] != data[ss]) ss++;
+  while (ee >= 0  && data[ee] != data[ee]) ee--;
+  if (ss > ee)
+    return;
+
+  std::vector<double> cumsum(len + 1, 0.0);
+  for (int i = ss; i <= ee; i++)
+    cumsum[i + 1] = cumsum[i] + data[i];
+
+  int wid2 = MOVING_AVG_WINDOW/2;
+  std::vector<double> avg(data);
+  for (int i = ss; i <= ee; i++) {
+    int s0 = std::max(i - wid2, ss);
+    int e0 = std::min(i + wid2, ee);
+    if (s0 < i && e0 > i) {
+      s0 = std::max(s0, i - (e0 - i));
+      e0 = std::min(e0, i + (i - s0));
+      avg[i] = (cumsum[e0 + 1] - cumsum[s0])/(e0 - s0 + 1);
+    }
+  }
+  for (int i = 0; i < len; i++)
+    data[i] -= avg[i];
+}
+
+/// The jumps in the averaged disparity, one per CCD, as find_ccds_aux.m
+/// does. Positions are 1-based, as in the wv_correct tables.
+void find_jumps(std::vector<double> const& mean_disp,
+                std::vector<double> & positions, std::vector<double> & jumps) {
+
+  positions.clear();
+  jumps.clear();
+  int len = mean_disp.size();
+  int W   = JUMP_WIDTH;
+
+  // The change across each location, with the slopes on either side removed
+  std::vector<double> Q(len, NaN);
+  for (int i = W; i + 2*W < len; i++)
+    Q[i] = 1.5*(mean_disp[i + W] - mean_disp[i]) - 0.5*(mean_disp[i + 2*W] - mean_disp[i - W]);
+
+  // Keep the local maxima in a range
+  int wid2 = ceil(1.5*W);
+  std::vector<int>    cand_pos;
+  std::vector<double> cand_val;
+  for (int i = wid2; i + wid2 < len; i++) {
+    double q = std::abs(Q[i]);
+    if (Q[i] != Q[i] || q < MIN_JUMP || q > MAX_JUMP)
+      continue;
+    bool is_good = true;
+    for (int l = i - wid2; l <= i + wid2; l++)
+      if (q < std::abs(Q[l])) is_good = false; // false for NaN
+    if (!is_good)
+      continue;
+    cand_pos.push_back(i + 1 + W/2); // at the center of the jump, 1-based
+    cand_val.push_back(Q[i]);
+  }
+
+  // Keep the largest jump near each expected CCD border
+  for (int k = 1; CCD_PERIOD*k + CCD_SHIFT <= len; k++) {
+    int p = CCD_PERIOD*k + CCD_SHIFT;
+    if (p <= 0)
+      continue;
+    int best = -1;
+    for (size_t j = 0; j < cand_pos.size(); j++) {
+      if (cand_pos[j] < p - CCD_SEARCH_WIDTH || cand_pos[j] > p + CCD_SEARCH_WIDTH)
+        continue;
+      if (best < 0 || std::abs(cand_val[j]) > std::abs(cand_val[best]))
+        best = j;
+    }
+    if (best >= 0) {
+      positions.push_back(cand_pos[best]);
+      jumps.push_back(cand_val[best]);
+    }
+  }
+}
+
+/// Process the row averages of all runs along one axis and find the jumps
+class AxisTask: public vw::Task, private boost::noncopyable {
+  std::string                         m_axis;
+  std::vector< std::vector<double> >  m_runs;
+  std::vector<double>               & m_mean, & m_positions, & m_jumps;
+public:
+  AxisTask(std::string const& axis, std::vector< std::vector<double> > const& runs,
+           std::vector<double> & mean, std::vector<double> & positions,
+           std::vector<double> & jumps):
+    m_axis(axis), m_runs(runs), m_mean(mean), m_positions(positions), m_jumps(jumps) {}
+
+  void operator()() {
+
+    // The runs may have different lengths after resampling
+    size_t len = 0;
+    for (size_t r = 0; r < m_runs.size(); r++)
+      len = std::max(len, m_runs[r].size());
+
+    std::vector<double> sum(len, 0.0), num(len, 0.0);
+    for (size_t r = 0; r < m_runs.size(); r++) {
+      std::vector<double> & run = m_runs[r];
+      run.resize(len, 0.0);
+      blank_edges(run);
+      subtract_moving_avg(run);
+
+      double max_val = 0;
+      for (size_t c = 0; c < len; c++)
+        if (run[c] == run[c]) max_val = std::max(max_val, std::abs(run[c]));
+      if (max_val > MAX_RUN_VALUE) {
+        vw_out() << "Skipping run " << r << " in " << m_axis << " with maximum value "
+                 << max_val << ".\n";
+        continue;
+      }
+
+      for (size_t c = 0; c < len; c++) {
+        if (run[c] != run[c]) continue;
+        sum[c] += run[c];
+        num[c] += 1;
+      }
+    }
+
+    m_mean.assign(len, 0.0);
+    for (size_t c = 0; c < len; c++)
+      if (num[c] > 0) m_mean[c] = sum[c]/num[c];
+
+    find_jumps(m_mean, m_positions, m_jumps);
+  }
+};
+
+void write_average(std::string const& file, std::vector<double> const& mean) {
+  vw_out() << "Writing: " << file << std::endl;
+  std::ofstream ofs(file.c_str());
+  ofs.precision(9);
+  for (size_t c = 0; c < mean.size(); c++)
+    ofs << mean[c] << "\n";
+}
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    Stopwatch sw;
+    sw.start();
+
+    // Average the rows of each disparity, resampled to the base pitch
+    std::vector< std::vector<double> > runs_x, runs_y;
+    for (size_t i = 0; i < opt.disparity_files.size(); i++) {
+      std::vector<double> avg_x, avg_y;
+      average_rows(opt.disparity_files[i], opt, avg_x, avg_y);
+      runs_x.push_back(scale_by_pitch(avg_x, opt.pitches[i]));
+      runs_y.push_back(scale_by_pitch(avg_y, opt.pitches[i]));
+    }
+
+    // Find the offsets in x and y in parallel
+    std::vector<double> mean_x, mean_y, posx, ccdx, posy, ccdy;
+    FifoWorkQueue queue(2);
+    queue.add_task(boost::shared_ptr<Task>(new AxisTask("x", runs_x, mean_x, posx, ccdx)));
+    queue.add_task(boost::shared_ptr<Task>(new AxisTask("y", runs_y, mean_y, posy, ccdy)));
+    queue.join_all();
+
+    if (posx.empty() && posy.empty())
+      vw_out(WarningMessage) << "No CCD jumps were detected.\n";
+
+    // The table for wv_correct --ccd-offsets, and the averages, for plotting
+    std::string table_file = opt.output_prefix + "-ccd-offsets.txt";
+    vw_out() << "Writing: " << table_file << std::endl;
+    std::ofstream ofs(table_file.c_str());
+    ofs.precision(9);
+    ofs << "# axis position offset, with positions at detector pitch "
+        << BASE_PITCH << "\n";
+    for (size_t t = 0; t < posx.size(); t++)
+      ofs << "x " << posx[t] << ' ' << ccdx[t] << "\n";
+    for (size_t t = 0; t < posy.size(); t++)
+      ofs << "y " << posy[t] << ' ' << ccdy[t] << "\n";
+    ofs.close();
+
+    write_average(opt.output_prefix + "-avgx.txt", mean_x);
+    write_average(opt.output_prefix + "-avgy.txt", mean_y);
+
+    sw.stop();
+    vw_out() << "Elapsed time: " << sw.elapsed_seconds() << " seconds.\n";
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}